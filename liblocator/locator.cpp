@@ -32,23 +32,27 @@ Locator::make(uint32_t str, uint32_t dex, uint32_t cls)
   return Locator(str, dex, cls);
 }
 
+constexpr const uint64_t Locator::powers[];
+
 uint32_t
 Locator::encode(char buf[encoded_max]) noexcept
 {
-  uint64_t value = strnr << clsnr_bits;
+  uint64_t value = uint64_t(strnr) << clsnr_bits;
   value = (value | clsnr) << dexnr_bits;
   value = (value | dexnr);
-  uint8_t* pos = (uint8_t*) &buf[0];
-  while (value != 0) {
-    uint8_t enc = (value % base) + bias;
+
+  // The number of digits is the number of powers that don't exceed the
+  // value. All the digits are written, and the NUL then cuts the unused
+  // ones off.
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < max_digits; ++i) {
+    len += value >= powers[i];
+    uint8_t enc = (value / powers[i]) % base + bias;
     assert((enc & 0x80) == 0);
-    assert(enc >= bias);
-    *pos++ = enc;
-    value /= base;
+    buf[i] = enc;
   }
-  *pos = '\0';
-  uint32_t len = (pos - (uint8_t*) buf);
-  assert(len <= encoded_max);
+  assert(len < encoded_max);
+  buf[len] = '\0';
   return len;
 }
 
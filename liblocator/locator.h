@@ -87,6 +87,25 @@ class Locator {
   constexpr static const unsigned base = 94;
   constexpr static const unsigned bias = '!';
 
+  // Number of payload bytes needed to encode any locator.
+  constexpr static const uint32_t max_digits = 7;
+
+  // powers[i] is base^i. Decoding weighs each digit by its power, so that
+  // the digits don't depend on each other, and encoding counts the digits by
+  // comparing the value against the powers.
+  constexpr static const uint64_t powers[max_digits + 1] = {
+      1ULL,
+      94ULL,
+      8836ULL,
+      830584ULL,
+      78074896ULL,
+      7339040224ULL,
+      689869781056ULL,
+      64847759419264ULL,
+  };
+  static_assert(powers[max_digits] > (1ULL << bits) - 1,
+                "max_digits are not enough for a locator");
+
  public:
 
   const unsigned strnr;
@@ -111,13 +130,16 @@ class Locator {
 Locator
 Locator::decodeBackward(const char* endpos) noexcept
 {
-  // N.B. Because we _encode_ little-endian, when we _decode_
-  // backward, we decode big-endian.
+  // The payload starts after the ULEB length prefix, which is below bias.
+  const uint8_t* end = (const uint8_t*) endpos;
+  const uint8_t* begin = end;
+  while (begin[-1] >= bias) {
+    --begin;
+  }
 
   uint64_t value = 0;
-  const uint8_t* pos = (uint8_t*) (endpos - 1);
-  while (*pos >= bias) {
-    value = value * base + (*pos-- - bias);
+  for (uint32_t i = 0; begin + i < end; ++i) {
+    value += (begin[i] - bias) * powers[i];
   }
 
   uint32_t dex = (value & dexmask);
@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace facebook {
+
+//
+// A locator table is the alternative to locator strings: instead of a
+// locator string after each class name in the dex string tables, a single
+// table maps every class descriptor to its (strnr, dexnr, clsnr) tuple, with
+// the same numbering as the locators. It is indexed by a minimal perfect
+// hash, so a lookup hashes the descriptor twice and compares it with the one
+// entry it lands on, whether or not the class is in the table.
+//
+// The hash is of the "hash and displace" kind: the first hash of a
+// descriptor picks a bucket, and the seed of the bucket makes the second
+// hash, which picks the entry. The seeds are chosen when the table is built
+// so that no two descriptors land on the same entry.
+//
+// The table is little-endian and laid out as:
+//
+//   LocatorTableHeader
+//   uint32_t seeds[num_buckets]
+//   LocatorTableEntry entries[num_entries]
+//   char strings[strings_size]  NUL terminated descriptors
+//
+
+struct LocatorTableHeader {
+  char magic[4];
+  uint32_t num_buckets;
+  uint32_t num_entries;
+  uint32_t strings_size;
+};
+
+struct LocatorTableEntry {
+  uint32_t name_off;
+  uint16_t strnr;
+  uint16_t dexnr;
+  uint32_t clsnr;
+};
+
+constexpr const char locator_table_magic[4] = {'L', 'O', 'C', '1'};
+
+// FNV-1a, seeded, with a final avalanche so that nearby seeds give unrelated
+// hashes.
+inline uint32_t locator_table_hash(const char* descriptor, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (const uint8_t* p = (const uint8_t*) descriptor; *p != 0; ++p) {
+    h = (h ^ *p) * 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+class LocatorTable {
+ public:
+  // Returns false if data doesn't hold a well-formed table. The table points
+  // into data, which must outlive it.
+  bool init(const void* data, size_t size) noexcept {
+    if (size < sizeof(LocatorTableHeader)) {
+      return false;
+    }
+    m_header = (const LocatorTableHeader*) data;
+    if (memcmp(m_header->magic, locator_table_magic, sizeof(m_header->magic))) {
+      return false;
+    }
+    uint64_t expected =
+        sizeof(LocatorTableHeader) +
+        uint64_t(m_header->num_buckets) * sizeof(uint32_t) +
+        uint64_t(m_header->num_entries) * sizeof(LocatorTableEntry) +
+        m_header->strings_size;
+    if (expected != size || m_header->num_buckets == 0 ||
+        (m_header->strings_size > 0 &&
+         ((const char*) data)[size - 1] != '\0')) {
+      return false;
+    }
+    m_seeds = (const uint32_t*) (m_header + 1);
+    m_entries =
+        (const LocatorTableEntry*) (m_seeds + m_header->num_buckets);
+    m_strings = (const char*) (m_entries + m_header->num_entries);
+    for (uint32_t i = 0; i < m_header->num_entries; ++i) {
+      if (m_entries[i].name_off >= m_header->strings_size) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns null if the class isn't in the table.
+  const LocatorTableEntry* find(const char* descriptor) const noexcept {
+    if (m_header->num_entries == 0) {
+      return nullptr;
+    }
+    uint32_t bucket =
+        locator_table_hash(descriptor, 0) % m_header->num_buckets;
+    uint32_t slot = locator_table_hash(descriptor, m_seeds[bucket]) %
+                    m_header->num_entries;
+    const LocatorTableEntry* entry = &m_entries[slot];
+    if (strcmp(m_strings + entry->name_off, descriptor) != 0) {
+      return nullptr;
+    }
+    return entry;
+  }
+
+  const char* name(const LocatorTableEntry* entry) const noexcept {
+    return m_strings + entry->name_off;
+  }
+
+ private:
+  const LocatorTableHeader* m_header{nullptr};
+  const uint32_t* m_seeds{nullptr};
+  const LocatorTableEntry* m_entries{nullptr};
+  const char* m_strings{nullptr};
+};
+
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "AhoCorasick.h"
+
+#include <queue>
+
+#include "Debug.h"
+
+namespace {
+
+constexpr uint32_t kNone = 0xffffffff;
+
+} // namespace
+
+AhoCorasick::AhoCorasick(const std::vector<std::string>& patterns) {
+  // The trie of the patterns, with kNone where it has no edge.
+  std::vector<uint32_t> trie(256, kNone);
+  m_outputs.emplace_back();
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    always_assert_log(!patterns[i].empty(), "Empty pattern");
+    uint32_t state = 0;
+    for (char c : patterns[i]) {
+      auto& next = trie[state * 256 + static_cast<uint8_t>(c)];
+      if (next == kNone) {
+        next = m_outputs.size();
+        m_outputs.emplace_back();
+        trie.resize(trie.size() + 256, kNone);
+      }
+      state = next;
+    }
+    m_outputs[state].push_back(i);
+  }
+
+  // Breadth first, so that the failure state of each state, the longest
+  // proper suffix of it that is in the trie, is complete before it is used.
+  m_transitions.resize(trie.size());
+  std::vector<uint32_t> failure(m_outputs.size(), 0);
+  std::queue<uint32_t> queue;
+  for (size_t c = 0; c < 256; ++c) {
+    auto next = trie[c];
+    if (next == kNone) {
+      m_transitions[c] = 0;
+    } else {
+      m_transitions[c] = next;
+      queue.push(next);
+    }
+  }
+  while (!queue.empty()) {
+    auto state = queue.front();
+    queue.pop();
+    auto& outputs = m_outputs[state];
+    const auto& inherited = m_outputs[failure[state]];
+    outputs.insert(outputs.end(), inherited.begin(), inherited.end());
+    for (size_t c = 0; c < 256; ++c) {
+      auto next = trie[state * 256 + c];
+      auto on_failure = m_transitions[failure[state] * 256 + c];
+      if (next == kNone) {
+        m_transitions[state * 256 + c] = on_failure;
+      } else {
+        m_transitions[state * 256 + c] = next;
+        failure[next] = on_failure;
+        queue.push(next);
+      }
+    }
+  }
+}
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Finds all the occurrences of a fixed set of byte strings in one pass over
+ * a text, whatever the number of patterns. The automaton is a full table of
+ * transitions, 256 per state, so it is meant for a handful of short patterns.
+ */
+class AhoCorasick {
+ public:
+  explicit AhoCorasick(const std::vector<std::string>& patterns);
+
+  /*
+   * Calls fn(pattern_index, match_end) for every occurrence of every pattern
+   * in [begin, end), overlapping ones included, in the order of where they
+   * end. match_end points just past the occurrence.
+   */
+  template <typename Fn>
+  void search(const char* begin, const char* end, Fn fn) const {
+    uint32_t state = 0;
+    for (auto p = begin; p != end; ++p) {
+      state = m_transitions[state * 256 + static_cast<uint8_t>(*p)];
+      for (auto pattern : m_outputs[state]) {
+        fn(pattern, p + 1);
+      }
+    }
+  }
+
+  /*
+   * Whether any of the patterns occurs in [begin, end). This stops at the
+   * first occurrence.
+   */
+  bool contains_any(const char* begin, const char* end) const {
+    uint32_t state = 0;
+    for (auto p = begin; p != end; ++p) {
+      state = m_transitions[state * 256 + static_cast<uint8_t>(*p)];
+      if (!m_outputs[state].empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::vector<uint32_t> m_transitions;
+  // The patterns that end at each state.
+  std::vector<std::vector<size_t>> m_outputs;
+};
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Arena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "Debug.h"
+
+namespace {
+
+std::atomic<bool> s_huge_pages{false};
+
+} // namespace
+
+Arena::Arena(size_t chunk_size) : m_chunk_size(chunk_size) {
+  always_assert(chunk_size > 0);
+  m_current = new_chunk(m_chunk_size);
+}
+
+Arena::~Arena() {
+  for (auto chunk : m_chunks) {
+    free(chunk->data);
+    delete chunk;
+  }
+}
+
+Arena::Chunk* Arena::new_chunk(size_t min_capacity) {
+  auto chunk = new Chunk();
+  chunk->capacity = std::max(min_capacity, m_chunk_size);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (s_huge_pages.load(std::memory_order_relaxed)) {
+    constexpr size_t kHugePageSize = 2 << 20;
+    // The kernel only maps huge pages over aligned 2MB ranges, so the chunk
+    // must cover whole ones. The memory still comes from the C allocator,
+    // which keeps free() in the destructor valid.
+    chunk->capacity =
+        (chunk->capacity + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    void* data = nullptr;
+    if (posix_memalign(&data, kHugePageSize, chunk->capacity) == 0) {
+      chunk->data = static_cast<uint8_t*>(data);
+      // Failing is harmless: the chunk is then backed by regular pages.
+      chunk->huge_pages =
+          madvise(data, chunk->capacity, MADV_HUGEPAGE) == 0;
+    }
+  }
+#endif
+  if (chunk->data == nullptr) {
+    chunk->data = static_cast<uint8_t*>(malloc(chunk->capacity));
+  }
+  always_assert_log(chunk->data != nullptr, "Arena out of memory\n");
+  m_chunks.push_back(chunk);
+  return chunk;
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+  // Chunks come from malloc and are aligned for any fundamental type, so we
+  // only need to align offsets. Reserving alignment - 1 extra bytes leaves
+  // room to do that no matter what the previous request looked like.
+  always_assert(alignment > 0 && alignment <= alignof(std::max_align_t) &&
+                (alignment & (alignment - 1)) == 0);
+  size_t reserved = size + alignment - 1;
+  while (true) {
+    Chunk* chunk = m_current.load(std::memory_order_acquire);
+    size_t offset = chunk->used.fetch_add(reserved, std::memory_order_relaxed);
+    if (offset + reserved <= chunk->capacity) {
+      return chunk->data + ((offset + alignment - 1) & ~(alignment - 1));
+    }
+    // The chunk is exhausted. Whoever gets the lock first installs a new one;
+    // everyone else retries against it.
+    std::lock_guard<std::mutex> lock(m_chunks_lock);
+    if (m_current.load(std::memory_order_relaxed) == chunk) {
+      m_current.store(new_chunk(reserved), std::memory_order_release);
+    }
+  }
+}
+
+const char* Arena::copy_string(const char* data, size_t size) {
+  auto storage = static_cast<char*>(allocate(size + 1, 1));
+  memcpy(storage, data, size);
+  storage[size] = '\0';
+  return storage;
+}
+
+size_t Arena::num_chunks() const {
+  std::lock_guard<std::mutex> lock(m_chunks_lock);
+  return m_chunks.size();
+}
+
+size_t Arena::bytes_allocated() const {
+  std::lock_guard<std::mutex> lock(m_chunks_lock);
+  size_t result = 0;
+  for (auto chunk : m_chunks) {
+    result += std::min(chunk->used.load(), chunk->capacity);
+  }
+  return result;
+}
+
+size_t Arena::bytes_reserved() const {
+  std::lock_guard<std::mutex> lock(m_chunks_lock);
+  size_t result = 0;
+  for (auto chunk : m_chunks) {
+    result += chunk->capacity;
+  }
+  return result;
+}
+
+size_t Arena::bytes_in_huge_pages() const {
+  std::lock_guard<std::mutex> lock(m_chunks_lock);
+  size_t result = 0;
+  for (auto chunk : m_chunks) {
+    if (chunk->huge_pages) {
+      result += chunk->capacity;
+    }
+  }
+  return result;
+}
+
+void Arena::set_huge_pages(bool enabled) { s_huge_pages = enabled; }
+
+bool Arena::huge_pages() { return s_huge_pages; }
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*
+ * A bump-pointer allocator for objects that live as long as the arena itself.
+ * Memory is handed out from large chunks and is only ever released all at
+ * once, when the arena is destroyed. Destructors of objects placed in the
+ * arena are never run, so it should only hold objects whose destructors have
+ * no effect that matters beyond the arena's lifetime.
+ *
+ * allocate() is safe to call concurrently: the common case is a single atomic
+ * add on the current chunk, and only switching to a fresh chunk takes a lock.
+ *
+ * With set_huge_pages(true), chunks are rounded up to whole 2MB pages and the
+ * kernel is asked to back them with transparent huge pages, which saves TLB
+ * misses when the arenas grow to gigabytes. Only Linux honors it.
+ */
+class Arena {
+ public:
+  explicit Arena(size_t chunk_size = 1 << 20);
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  template <class T, class... Args>
+  T* make(Args&&... args) {
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  // Copies size bytes from data and appends a NUL terminator.
+  const char* copy_string(const char* data, size_t size);
+
+  size_t num_chunks() const;
+  size_t bytes_allocated() const;
+  // What the chunks take up, used or not.
+  size_t bytes_reserved() const;
+  // What the chunks that were advised to use huge pages take up.
+  size_t bytes_in_huge_pages() const;
+
+  // Applies to the chunks that any arena allocates from now on.
+  static void set_huge_pages(bool enabled);
+  static bool huge_pages();
+
+ private:
+  struct Chunk {
+    std::atomic<size_t> used{0};
+    size_t capacity;
+    uint8_t* data{nullptr};
+    bool huge_pages{false};
+  };
+
+  Chunk* new_chunk(size_t min_capacity);
+
+  const size_t m_chunk_size;
+  std::atomic<Chunk*> m_current;
+  mutable std::mutex m_chunks_lock;
+  std::vector<Chunk*> m_chunks;
+};
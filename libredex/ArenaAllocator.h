@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Arena.h"
+
+/*
+ * A standard allocator that takes its memory from an Arena, so that
+ * containers of temporaries can be dropped all at once with the arena
+ * instead of going back to the global heap piece by piece. Deallocating
+ * does nothing: the memory of a container that grows or is destroyed is only
+ * reclaimed with the arena, and the container must not outlive it.
+ *
+ * See PassManager::get_scratch_arena() for an arena that lives as long as the
+ * pass being run.
+ */
+template <class T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  // Not explicit, so that containers can be made straight from an arena, e.g.
+  // arena::vector<DexMethod*> methods(scratch).
+  ArenaAllocator(Arena& arena) : m_arena(&arena) {}
+
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& that) : m_arena(that.arena()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t) {}
+
+  Arena* arena() const { return m_arena; }
+
+  template <class U>
+  bool operator==(const ArenaAllocator<U>& that) const {
+    return m_arena == that.arena();
+  }
+
+  template <class U>
+  bool operator!=(const ArenaAllocator<U>& that) const {
+    return m_arena != that.arena();
+  }
+
+ private:
+  Arena* m_arena;
+};
+
+namespace arena {
+
+template <class T>
+using vector = std::vector<T, ArenaAllocator<T>>;
+
+template <class T, class Hash = std::hash<T>, class Eq = std::equal_to<T>>
+using unordered_set = std::unordered_set<T, Hash, Eq, ArenaAllocator<T>>;
+
+template <class K,
+          class V,
+          class Hash = std::hash<K>,
+          class Eq = std::equal_to<K>>
+using unordered_map =
+    std::unordered_map<K, V, Hash, Eq, ArenaAllocator<std::pair<const K, V>>>;
+
+} // namespace arena
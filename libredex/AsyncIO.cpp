@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "AsyncIO.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include "Debug.h"
+
+namespace async_io {
+
+void prefetch_file(const std::string& filename) {
+#if defined(POSIX_FADV_WILLNEED)
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    // Whoever loads the file reports it.
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+#endif
+}
+
+AsyncWriter::AsyncWriter() : m_thread([this] { writer_loop(); }) {}
+
+AsyncWriter::~AsyncWriter() {
+  // Destructors can't abort, so the failures nobody flushed are only
+  // printed.
+  for (const auto& error : take_errors()) {
+    fprintf(stderr, "Can't write %s\n", error.c_str());
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_stopping = true;
+  }
+  m_changed.notify_all();
+  m_thread.join();
+}
+
+void AsyncWriter::write(const std::string& filename,
+                        std::string contents,
+                        bool append) {
+  auto size = contents.size();
+  enqueue(Job{filename, std::move(contents), nullptr, size, append, nullptr});
+}
+
+void AsyncWriter::write(const std::string& filename,
+                        const void* data,
+                        size_t size,
+                        std::function<void()> release) {
+  enqueue(Job{filename, std::string(), data, size, false, std::move(release)});
+}
+
+void AsyncWriter::enqueue(Job job) {
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_jobs.push_back(std::move(job));
+  }
+  m_changed.notify_all();
+}
+
+std::vector<std::string> AsyncWriter::take_errors() {
+  std::unique_lock<std::mutex> lock(m_lock);
+  m_changed.wait(lock, [this] { return m_jobs.empty() && !m_busy; });
+  std::vector<std::string> errors;
+  errors.swap(m_errors);
+  return errors;
+}
+
+void AsyncWriter::flush() {
+  // Each failure is only reported once.
+  auto errors = take_errors();
+  always_assert_log(errors.empty(),
+                    "Can't write %s",
+                    errors.empty() ? "" : errors.front().c_str());
+}
+
+void AsyncWriter::writer_loop() {
+  std::unique_lock<std::mutex> lock(m_lock);
+  while (true) {
+    m_changed.wait(lock, [this] { return !m_jobs.empty() || m_stopping; });
+    if (m_jobs.empty()) {
+      return;
+    }
+    auto job = std::move(m_jobs.front());
+    m_jobs.pop_front();
+    m_busy = true;
+    lock.unlock();
+
+    const void* data = job.data != nullptr
+                           ? job.data
+                           : static_cast<const void*>(job.contents.data());
+    std::string error;
+    FILE* fd = fopen(job.filename.c_str(), job.append ? "ab" : "wb");
+    if (fd == nullptr) {
+      error = job.filename + ": " + strerror(errno);
+    } else {
+      if (fwrite(data, 1, job.size, fd) != job.size) {
+        error = job.filename + ": " + strerror(errno);
+      }
+      if (fclose(fd) != 0 && error.empty()) {
+        error = job.filename + ": " + strerror(errno);
+      }
+    }
+    if (job.release) {
+      job.release();
+    }
+
+    lock.lock();
+    if (!error.empty()) {
+      m_errors.push_back(error);
+    }
+    m_busy = false;
+    m_changed.notify_all();
+  }
+}
+
+} // namespace async_io
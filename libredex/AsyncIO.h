@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <boost/thread/thread.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Takes the file I/O of loading and writing dexes off the critical path.
+ *
+ * prefetch_file() asks the kernel to start reading a file, and returns
+ * without waiting for it, so that the files loaded later are in the page
+ * cache by the time they are parsed.
+ *
+ * AsyncWriter writes files on a thread of its own while the caller goes on
+ * to the next dex. Writes happen in the order they were queued, so that
+ * several appends to the same file keep their order. flush() waits for the
+ * queued writes and aborts if any of them failed.
+ */
+namespace async_io {
+
+// A no-op where the platform has no way to read ahead.
+void prefetch_file(const std::string& filename);
+
+class AsyncWriter {
+ public:
+  AsyncWriter();
+  // Waits for the queued writes.
+  ~AsyncWriter();
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  // Replaces the contents of the file, or appends to them.
+  void write(const std::string& filename,
+             std::string contents,
+             bool append = false);
+
+  // Replaces the contents of the file with the `size` bytes at `data`, which
+  // must stay valid until `release` is called, once they are written.
+  void write(const std::string& filename,
+             const void* data,
+             size_t size,
+             std::function<void()> release);
+
+  void flush();
+
+ private:
+  struct Job {
+    std::string filename;
+    std::string contents;
+    // Null if the job owns its contents.
+    const void* data;
+    size_t size;
+    bool append;
+    std::function<void()> release;
+  };
+
+  void enqueue(Job job);
+  // Waits for the queued writes, and returns the failures since the last
+  // call.
+  std::vector<std::string> take_errors();
+  void writer_loop();
+
+  std::mutex m_lock;
+  std::condition_variable m_changed;
+  std::deque<Job> m_jobs;
+  // Whether the writer thread is in the middle of a job.
+  bool m_busy{false};
+  bool m_stopping{false};
+  // The files that could not be written, with why.
+  std::vector<std::string> m_errors;
+  boost::thread m_thread;
+};
+
+} // namespace async_io
@@ -0,0 +1,190 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "BinaryGraph.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include "Debug.h"
+#include "WorkQueue.h"
+
+namespace binary_graph {
+
+namespace {
+
+constexpr char kMagic[8] = {'R', 'D', 'X', 'G', 'R', 'A', 'P', 'H'};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_nodes;
+  uint64_t num_edges;
+  uint64_t strings_size;
+};
+static_assert(sizeof(Header) == 32, "The header is part of the format");
+
+struct NodeEntry {
+  uint32_t kind;
+  uint32_t name;
+  uint32_t label;
+};
+static_assert(sizeof(NodeEntry) == 12, "The nodes are part of the format");
+
+size_t padding(size_t size) { return (8 - size % 8) % 8; }
+
+bool write_padded(const void* data, size_t size, FILE* fd) {
+  static const char zeros[8] = {};
+  return fwrite(data, 1, size, fd) == size &&
+         fwrite(zeros, 1, padding(size), fd) == padding(size);
+}
+
+// Each distinct string goes in once.
+class Strings {
+ public:
+  Strings() : m_data(1, '\0') {}
+
+  uint32_t intern(const std::string& s) {
+    if (s.empty()) {
+      return 0;
+    }
+    auto it = m_offsets.find(s);
+    if (it != m_offsets.end()) {
+      return it->second;
+    }
+    uint32_t offset = m_data.size();
+    m_data.insert(m_data.end(), s.begin(), s.end());
+    m_data.push_back('\0');
+    m_offsets.emplace(s, offset);
+    return offset;
+  }
+
+  const std::vector<char>& data() const { return m_data; }
+
+ private:
+  std::vector<char> m_data;
+  std::unordered_map<std::string, uint32_t> m_offsets;
+};
+
+} // namespace
+
+bool write(const Graph& graph, const std::string& filename) {
+  always_assert(graph.nodes.size() == graph.edges.size());
+  auto num_nodes = graph.nodes.size();
+
+  // The edges of each node are sorted, and laid out in parallel.
+  std::vector<std::vector<Edge>> sorted(num_nodes);
+  auto sort_wq = workqueue_foreach<size_t>([&](size_t i) {
+    auto& edges = sorted[i];
+    edges = graph.edges[i];
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  });
+  for (size_t i = 0; i < num_nodes; ++i) {
+    sort_wq.add_item(i);
+  }
+  sort_wq.run_all();
+
+  std::vector<uint64_t> offsets(num_nodes + 1, 0);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    offsets[i + 1] = offsets[i] + sorted[i].size();
+  }
+  auto num_edges = offsets[num_nodes];
+  std::vector<uint32_t> targets(num_edges);
+  std::vector<uint8_t> kinds(num_edges);
+  auto fill_wq = workqueue_foreach<size_t>([&](size_t i) {
+    auto pos = offsets[i];
+    for (const auto& edge : sorted[i]) {
+      always_assert(edge.target < num_nodes);
+      targets[pos] = edge.target;
+      kinds[pos] = edge.kind;
+      ++pos;
+    }
+  });
+  for (size_t i = 0; i < num_nodes; ++i) {
+    fill_wq.add_item(i);
+  }
+  fill_wq.run_all();
+
+  Strings strings;
+  std::vector<NodeEntry> nodes;
+  nodes.reserve(num_nodes);
+  for (const auto& node : graph.nodes) {
+    nodes.push_back(NodeEntry{static_cast<uint32_t>(node.kind),
+                              strings.intern(node.name),
+                              strings.intern(node.label)});
+  }
+
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_nodes = num_nodes;
+  header.num_edges = num_edges;
+  header.strings_size = strings.data().size();
+
+  FILE* fd = fopen(filename.c_str(), "wb");
+  if (fd == nullptr) {
+    return false;
+  }
+  bool ok = write_padded(&header, sizeof(header), fd) &&
+            write_padded(nodes.data(), nodes.size() * sizeof(NodeEntry), fd) &&
+            write_padded(offsets.data(), offsets.size() * sizeof(uint64_t),
+                         fd) &&
+            write_padded(targets.data(), targets.size() * sizeof(uint32_t),
+                         fd) &&
+            write_padded(kinds.data(), kinds.size(), fd) &&
+            write_padded(strings.data().data(), strings.data().size(), fd);
+  return fclose(fd) == 0 && ok;
+}
+
+Graph read(const std::string& filename) {
+  FILE* fd = fopen(filename.c_str(), "rb");
+  always_assert_log(fd != nullptr, "Can't open %s", filename.c_str());
+  auto read_padded = [&](void* data, size_t size) {
+    char pad[8];
+    always_assert_log(fread(data, 1, size, fd) == size &&
+                          fread(pad, 1, padding(size), fd) == padding(size),
+                      "%s is truncated",
+                      filename.c_str());
+  };
+
+  Header header;
+  read_padded(&header, sizeof(header));
+  always_assert_log(memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+                        header.version == kVersion,
+                    "%s is not a graph of version %u",
+                    filename.c_str(),
+                    kVersion);
+  std::vector<NodeEntry> nodes(header.num_nodes);
+  read_padded(nodes.data(), nodes.size() * sizeof(NodeEntry));
+  std::vector<uint64_t> offsets(header.num_nodes + 1);
+  read_padded(offsets.data(), offsets.size() * sizeof(uint64_t));
+  std::vector<uint32_t> targets(header.num_edges);
+  read_padded(targets.data(), targets.size() * sizeof(uint32_t));
+  std::vector<uint8_t> kinds(header.num_edges);
+  read_padded(kinds.data(), kinds.size());
+  std::vector<char> strings(header.strings_size);
+  read_padded(strings.data(), strings.size());
+  fclose(fd);
+
+  Graph graph;
+  for (uint32_t i = 0; i < header.num_nodes; ++i) {
+    graph.add_node(static_cast<NodeKind>(nodes[i].kind),
+                   &strings[nodes[i].name],
+                   &strings[nodes[i].label]);
+    for (auto e = offsets[i]; e < offsets[i + 1]; ++e) {
+      graph.edges[i].push_back(Edge{targets[e], kinds[e]});
+    }
+  }
+  return graph;
+}
+
+} // namespace binary_graph
@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * A compact file format for the graphs that passes dump for offline analysis,
+ * like the reference graph and the reachability graph. Rather than a line of
+ * text per edge, which takes minutes to parse for an app, the file holds a
+ * table of nodes and the edges in compressed sparse row form, which a reader
+ * can mmap and use as is. tools/python/binary_graph.py is such a reader.
+ *
+ * All integers are little endian, and every section starts 8-byte aligned:
+ *
+ *   header   "RDXGRAPH", u32 version, u32 num_nodes, u64 num_edges,
+ *            u64 strings_size
+ *   nodes    num_nodes x {u32 kind, u32 name, u32 label}, where name and
+ *            label are offsets into the strings
+ *   offsets  (num_nodes + 1) x u64: the edges out of node i are the entries
+ *            offsets[i] to offsets[i + 1] of the two arrays below
+ *   targets  num_edges x u32, the node each edge goes to
+ *   kinds    num_edges x u8, what each edge stands for
+ *   strings  NUL-terminated strings, each written once. Offset 0 is "".
+ *
+ * The edges out of a node are sorted by target, then kind. What the edge
+ * kinds mean is up to the pass that writes the graph.
+ */
+namespace binary_graph {
+
+enum class NodeKind : uint32_t {
+  CLASS = 0,
+  // A type that is referenced, but has no class in the scope.
+  TYPE = 1,
+  METHOD = 2,
+  FIELD = 3,
+  ANNO = 4,
+  SEED = 5,
+};
+
+struct Edge {
+  uint32_t target;
+  uint8_t kind;
+
+  bool operator<(const Edge& that) const {
+    return target != that.target ? target < that.target : kind < that.kind;
+  }
+  bool operator==(const Edge& that) const {
+    return target == that.target && kind == that.kind;
+  }
+};
+
+/*
+ * The nodes are added first, by a single thread. After that, the edges of
+ * different nodes can be filled in from different threads.
+ */
+struct Graph {
+  struct Node {
+    NodeKind kind;
+    std::string name;
+    // Anything else worth knowing about the node, like the store it is in.
+    std::string label;
+  };
+
+  std::vector<Node> nodes;
+  // The edges out of each node, in any order.
+  std::vector<std::vector<Edge>> edges;
+
+  uint32_t add_node(NodeKind kind, std::string name, std::string label = "") {
+    nodes.push_back(Node{kind, std::move(name), std::move(label)});
+    edges.emplace_back();
+    return nodes.size() - 1;
+  }
+};
+
+constexpr uint32_t kVersion = 1;
+
+// Returns false, with errno set, if the file can't be written.
+bool write(const Graph& graph, const std::string& filename);
+
+// Reads back what write() wrote. Duplicate edges come back once. Meant for
+// tests, the analyses read the file from Python.
+Graph read(const std::string& filename);
+
+} // namespace binary_graph
@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "PowersetAbstractDomain.h"
+
+namespace bvad_impl {
+
+/*
+ * A set of small unsigned integers with a fixed capacity, stored as one bit
+ * per possible element in 64-bit words. Unlike SparseSetValue, joins, meets
+ * and comparisons handle 64 elements at a time and the whole set takes
+ * capacity / 8 bytes, which matters when there are many copies of it. The
+ * elements are enumerated in increasing order.
+ */
+class BitVectorValue final
+    : public PowersetImplementation<uint16_t,
+                                    const BitVectorValue&,
+                                    BitVectorValue> {
+ public:
+  using Kind = typename AbstractValue<BitVectorValue>::Kind;
+
+  class const_iterator
+      : public std::iterator<std::forward_iterator_tag, uint16_t> {
+   public:
+    uint16_t operator*() const {
+      return m_word_idx * 64 + __builtin_ctzll(m_word);
+    }
+
+    const_iterator& operator++() {
+      m_word &= m_word - 1;
+      skip_empty_words();
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      auto result = *this;
+      ++*this;
+      return result;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return m_word_idx == other.m_word_idx && m_word == other.m_word;
+    }
+
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    const_iterator(const std::vector<uint64_t>& words, size_t word_idx)
+        : m_words(&words),
+          m_word_idx(word_idx),
+          m_word(word_idx < words.size() ? words[word_idx] : 0) {
+      skip_empty_words();
+    }
+
+    void skip_empty_words() {
+      while (m_word == 0 && m_word_idx < m_words->size()) {
+        ++m_word_idx;
+        m_word = m_word_idx < m_words->size() ? (*m_words)[m_word_idx] : 0;
+      }
+    }
+
+    const std::vector<uint64_t>* m_words;
+    size_t m_word_idx;
+    // The bits of the current word that haven't been visited yet.
+    uint64_t m_word;
+
+    friend class BitVectorValue;
+  };
+
+  // Default constructor to pass sanity check in
+  // AbstractValue's destructor.
+  BitVectorValue() : m_capacity(0) {}
+
+  // Constructor that sets the maximum number
+  // of elements this set can hold.
+  explicit BitVectorValue(uint16_t max_size)
+      : m_capacity(max_size), m_words((max_size + 63) / 64) {}
+
+  void clear() override { std::fill(m_words.begin(), m_words.end(), 0); }
+
+  const BitVectorValue& elements() const override { return *(this); }
+
+  // Returning a vector that contains all the elements in the set.
+  // (for test use)
+  std::vector<uint16_t> vals() const {
+    return std::vector<uint16_t>(begin(), end());
+  }
+
+  Kind kind() const override { return Kind::Value; }
+
+  bool contains(const uint16_t& candidate) const override {
+    return candidate < m_capacity &&
+           (m_words[candidate / 64] & bit(candidate)) != 0;
+  }
+
+  bool leq(const BitVectorValue& other) const override {
+    for (size_t i = 0; i < m_words.size(); ++i) {
+      if (m_words[i] & ~other.word(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool equals(const BitVectorValue& other) const override {
+    auto n = std::max(m_words.size(), other.m_words.size());
+    for (size_t i = 0; i < n; ++i) {
+      if (word(i) != other.word(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Elements beyond the capacity are ignored.
+  void add(const uint16_t& elem) override {
+    if (elem < m_capacity) {
+      m_words[elem / 64] |= bit(elem);
+    }
+  }
+
+  void remove(const uint16_t& elem) override {
+    if (elem < m_capacity) {
+      m_words[elem / 64] &= ~bit(elem);
+    }
+  }
+
+  const_iterator begin() const { return const_iterator(m_words, 0); }
+
+  const_iterator end() const {
+    return const_iterator(m_words, m_words.size());
+  }
+
+  Kind join_with(const BitVectorValue& other) override {
+    if (other.m_capacity > m_capacity) {
+      m_words.resize(other.m_words.size());
+      m_capacity = other.m_capacity;
+    }
+    auto n = other.m_words.size();
+    auto* words = m_words.data();
+    const auto* other_words = other.m_words.data();
+    for (size_t i = 0; i < n; ++i) {
+      words[i] |= other_words[i];
+    }
+    return Kind::Value;
+  }
+
+  Kind widen_with(const BitVectorValue& other) override {
+    return join_with(other);
+  }
+
+  Kind meet_with(const BitVectorValue& other) override {
+    for (size_t i = 0; i < m_words.size(); ++i) {
+      m_words[i] &= other.word(i);
+    }
+    return Kind::Value;
+  }
+
+  Kind narrow_with(const BitVectorValue& other) override {
+    return meet_with(other);
+  }
+
+  // Removes all the elements of other from this set.
+  void difference_with(const BitVectorValue& other) {
+    auto n = std::min(m_words.size(), other.m_words.size());
+    auto* words = m_words.data();
+    const auto* other_words = other.m_words.data();
+    for (size_t i = 0; i < n; ++i) {
+      words[i] &= ~other_words[i];
+    }
+  }
+
+  size_t size() const override {
+    size_t result = 0;
+    for (auto w : m_words) {
+      result += __builtin_popcountll(w);
+    }
+    return result;
+  }
+
+ private:
+  static uint64_t bit(uint16_t elem) { return uint64_t(1) << (elem % 64); }
+
+  uint64_t word(size_t i) const { return i < m_words.size() ? m_words[i] : 0; }
+
+  uint16_t m_capacity;
+  std::vector<uint64_t> m_words;
+  friend class BitVectorAbstractDomain;
+};
+
+} // namespace bvad_impl
+
+/*
+ * A powerset domain of small unsigned integers with the same interface as
+ * SparseSetAbstractDomain, implemented as a bit vector. On top of the lattice
+ * operations it offers the set difference, which together with the join is
+ * what gen/kill transfer functions need.
+ */
+class BitVectorAbstractDomain final
+    : public PowersetAbstractDomain<uint16_t,
+                                    bvad_impl::BitVectorValue,
+                                    const bvad_impl::BitVectorValue&,
+                                    BitVectorAbstractDomain> {
+ public:
+  using Value = bvad_impl::BitVectorValue;
+
+  using AbstractValueKind = typename AbstractValue<Value>::Kind;
+
+  BitVectorAbstractDomain()
+      : PowersetAbstractDomain<uint16_t,
+                               Value,
+                               const Value&,
+                               BitVectorAbstractDomain>() {}
+
+  BitVectorAbstractDomain(AbstractValueKind kind)
+      : PowersetAbstractDomain<uint16_t,
+                               Value,
+                               const Value&,
+                               BitVectorAbstractDomain>(kind) {}
+
+  explicit BitVectorAbstractDomain(uint16_t max_size) {
+    this->set_to_value(Value(max_size));
+  }
+
+  static BitVectorAbstractDomain bottom() {
+    return BitVectorAbstractDomain(AbstractValueKind::Bottom);
+  }
+
+  static BitVectorAbstractDomain top() {
+    return BitVectorAbstractDomain(AbstractValueKind::Top);
+  }
+
+  /*
+   * Removes the elements of other from this set. This is only defined when
+   * both are proper sets; Bottom and Top are left unchanged.
+   */
+  void difference_with(const BitVectorAbstractDomain& other) {
+    if (this->is_value() && other.is_value()) {
+      this->get_value()->difference_with(*other.get_value());
+    }
+  }
+};
@@ -11,17 +11,11 @@
 
 #include "VirtualScope.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace call_graph {
 
-Edge::Edge(DexMethod* caller, DexMethod* callee, FatMethod::iterator invoke_it)
-    : m_caller(caller), m_callee(callee), m_invoke_it(invoke_it) {}
-
 Graph::Graph(const Scope& scope, bool include_virtuals) {
-  MethodRefCache resolved_refs;
-  auto resolver = [&](DexMethodRef* method, MethodSearch search) {
-    return resolve_method(method, search, resolved_refs);
-  };
   auto non_virtual_vec =
       include_virtuals ? devirtualize(scope) : std::vector<DexMethod*>();
   auto non_virtual = std::unordered_set<const DexMethod*>(
@@ -29,50 +23,100 @@ Graph::Graph(const Scope& scope, bool include_virtuals) {
   auto is_definitely_virtual = [&](const DexMethod* method) {
     return method->is_virtual() && non_virtual.count(method) == 0;
   };
-  walk::code(scope, [&](DexMethod* caller, IRCode& code) {
+
+  // Find the calls of each method in parallel, and then put them together
+  // in scope order, so that the graph doesn't depend on the scheduling.
+  std::vector<DexMethod*> callers;
+  for (const auto* cls : scope) {
+    for (auto* method : cls->get_dmethods()) {
+      if (method->get_code() != nullptr) {
+        callers.push_back(method);
+      }
+    }
+    for (auto* method : cls->get_vmethods()) {
+      if (method->get_code() != nullptr) {
+        callers.push_back(method);
+      }
+    }
+  }
+  std::vector<std::vector<Edge>> calls(callers.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    auto caller = callers[i];
+    auto& code = *caller->get_code();
     for (auto& mie : InstructionIterable(code)) {
       auto insn = mie.insn;
       if (is_invoke(insn->opcode())) {
-        auto callee = resolver(insn->get_method(), opcode_to_search(insn));
+        auto callee =
+            resolve_method_cached(insn->get_method(), opcode_to_search(insn));
         if (callee == nullptr || is_definitely_virtual(callee)) {
           continue;
         }
         if (callee->is_concrete()) {
-          add_edge(caller, callee, code.iterator_to(mie));
+          calls[i].emplace_back(caller, callee, code.iterator_to(mie));
         }
       }
     }
   });
+  for (size_t i = 0; i < callers.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  m_methods.push_back(nullptr);
+  size_t num_calls = 0;
+  for (const auto& edges : calls) {
+    for (const auto& edge : edges) {
+      make_node(edge.caller());
+      make_node(edge.callee());
+    }
+    num_calls += edges.size();
+  }
 
   // Add edges from the single "ghost" entry node to all the 'real' entry
   // nodes in the graph. We consider a node to be a potential entry point if
   // it is virtual or if it is marked by a Proguard keep rule.
-  for (auto& pair : m_nodes) {
-    auto method = pair.first;
+  m_edges.reserve(num_calls + m_methods.size());
+  for (size_t id = 1; id < m_methods.size(); ++id) {
+    auto method = m_methods[id];
     if (is_definitely_virtual(method) || root(method)) {
-      auto edge = std::make_shared<Edge>(
-          nullptr, const_cast<DexMethod*>(method), FatMethod::iterator());
-      m_entry.m_successors.emplace_back(edge);
-      pair.second.m_predecessors.emplace_back(edge);
+      m_edges.emplace_back(nullptr, method, FatMethod::iterator());
     }
   }
-}
-
-Node& Graph::make_node(DexMethod* m) {
-  auto it = m_nodes.find(m);
-  if (it != m_nodes.end()) {
-    return it->second;
+  for (auto& edges : calls) {
+    m_edges.insert(m_edges.end(), edges.begin(), edges.end());
+    std::vector<Edge>().swap(edges);
   }
-  m_nodes.emplace(m, Node(m));
-  return m_nodes.at(m);
+
+  // Counting sort of the edges by caller, and then by callee.
+  auto index_edges = [&](std::vector<uint32_t>& offsets,
+                         std::vector<const Edge*>& index,
+                         DexMethod* (Edge::*endpoint)() const) {
+    offsets.assign(m_methods.size() + 1, 0);
+    for (const auto& edge : m_edges) {
+      auto method = (edge.*endpoint)();
+      ++offsets[method == nullptr ? 1 : node_id(method) + 1];
+    }
+    for (size_t i = 1; i < offsets.size(); ++i) {
+      offsets[i] += offsets[i - 1];
+    }
+    index.resize(m_edges.size());
+    auto next = offsets;
+    for (const auto& edge : m_edges) {
+      auto method = (edge.*endpoint)();
+      index[next[method == nullptr ? 0 : node_id(method)]++] = &edge;
+    }
+  };
+  index_edges(m_callee_offsets, m_callees, &Edge::caller);
+  index_edges(m_caller_offsets, m_callers, &Edge::callee);
 }
 
-void Graph::add_edge(DexMethod* caller,
-                     DexMethod* callee,
-                     FatMethod::iterator invoke_it) {
-  auto edge = std::make_shared<Edge>(caller, callee, invoke_it);
-  make_node(caller).m_successors.emplace_back(edge);
-  make_node(callee).m_predecessors.emplace_back(edge);
+uint32_t Graph::make_node(DexMethod* m) {
+  auto& id = m_node_ids[m];
+  if (id == 0) {
+    id = m_methods.size();
+    m_methods.push_back(m);
+  }
+  return id;
 }
 
 } // namespace call_graph
@@ -9,12 +9,15 @@
 
 #pragma once
 
-#include <unordered_map>
+#include <vector>
 
+#include "Debug.h"
 #include "DexClass.h"
+#include "DexIdMap.h"
 #include "IRCode.h"
 #include "Resolver.h"
 #include "FixpointIterators.h"
+#include "Show.h"
 
 /*
  * Call graph representation that implements the standard graph interface API
@@ -34,7 +37,8 @@ namespace call_graph {
 
 class Edge {
  public:
-  Edge(DexMethod* caller, DexMethod* callee, FatMethod::iterator invoke_it);
+  Edge(DexMethod* caller, DexMethod* callee, FatMethod::iterator invoke_it)
+      : m_caller(caller), m_callee(callee), m_invoke_it(invoke_it) {}
   FatMethod::iterator invoke_iterator() const { return m_invoke_it; }
   DexMethod* caller() const { return m_caller; }
   DexMethod* callee() const { return m_callee; }
@@ -45,70 +49,133 @@ class Edge {
   FatMethod::iterator m_invoke_it;
 };
 
-using Edges = std::vector<std::shared_ptr<Edge>>;
+/*
+ * The edges into or out of a node, as a view into the graph that is valid
+ * for as long as the graph is.
+ */
+class Edges {
+ public:
+  using iterator = const Edge* const*;
+
+  Edges(iterator begin, iterator end) : m_begin(begin), m_end(end) {}
+  iterator begin() const { return m_begin; }
+  iterator end() const { return m_end; }
+  size_t size() const { return m_end - m_begin; }
+  bool empty() const { return m_begin == m_end; }
+  const Edge* operator[](size_t i) const { return m_begin[i]; }
+
+ private:
+  iterator m_begin;
+  iterator m_end;
+};
+
+class Graph;
 
 class Node {
  public:
-  /* implicit */ Node(DexMethod* m): m_method(m) {}
   DexMethod* method() const { return m_method; }
   bool operator==(const Node& that) const { return method() == that.method(); }
-  const Edges& callers() const { return m_predecessors; }
-  const Edges& callees() const { return m_successors; }
+  Edges callers() const;
+  Edges callees() const;
 
  private:
+  Node(const Graph* graph, uint32_t id, DexMethod* method)
+      : m_graph(graph), m_id(id), m_method(method) {}
+
+  const Graph* m_graph;
+  uint32_t m_id;
   DexMethod* m_method;
-  Edges m_predecessors;
-  Edges m_successors;
 
   friend class Graph;
 };
 
+/*
+ * The nodes are numbered densely, the ghost entry node being 0, and the edges
+ * are kept in compressed sparse row form: the callees of node i are the
+ * m_callees[m_callee_offsets[i]] ... m_callees[m_callee_offsets[i + 1] - 1],
+ * and likewise for the callers. The graph is built from the invoke
+ * instructions of the methods in parallel.
+ */
 class Graph {
  public:
   explicit Graph(const Scope&, bool include_virtuals = false);
 
-  const Node& entry() const { return m_entry; }
+  Graph(const Graph&) = delete;
+  Graph& operator=(const Graph&) = delete;
+
+  Node entry() const { return Node(this, 0, nullptr); }
 
-  const Node& node(const DexMethod* m) const {
+  // The method must be in the graph, i.e. be the caller or the callee of an
+  // edge.
+  Node node(const DexMethod* m) const {
     if (m == nullptr) {
-      return m_entry;
+      return entry();
     }
-    return m_nodes.at(const_cast<DexMethod*>(m));
+    auto id = node_id(m);
+    always_assert_log(id != 0, "%s is not in the call graph", SHOW(m));
+    return Node(this, id, m_methods[id]);
   }
 
+  // The number of the node of the method, or 0 if it isn't in the graph.
+  uint32_t node_id(const DexMethod* m) const { return m_node_ids.at(m); }
+
+  size_t num_nodes() const { return m_methods.size(); }
+  size_t num_edges() const { return m_edges.size(); }
+
  private:
-  Node& make_node(DexMethod*);
+  Edges callers(uint32_t id) const {
+    return Edges(m_callers.data() + m_caller_offsets[id],
+                 m_callers.data() + m_caller_offsets[id + 1]);
+  }
+  Edges callees(uint32_t id) const {
+    return Edges(m_callees.data() + m_callee_offsets[id],
+                 m_callees.data() + m_callee_offsets[id + 1]);
+  }
+
+  uint32_t make_node(DexMethod*);
 
-  void add_edge(DexMethod* caller,
-                DexMethod* callee,
-                FatMethod::iterator invoke_it);
+  // Indexed by node id.
+  std::vector<DexMethod*> m_methods;
+  MethodIdMap<uint32_t> m_node_ids;
+  std::vector<Edge> m_edges;
+  std::vector<uint32_t> m_callee_offsets;
+  std::vector<const Edge*> m_callees;
+  std::vector<uint32_t> m_caller_offsets;
+  std::vector<const Edge*> m_callers;
 
-  Node m_entry = Node(nullptr);
-  std::unordered_map<DexMethod*, Node> m_nodes;
+  friend class Node;
 };
 
+inline Edges Node::callers() const { return m_graph->callers(m_id); }
+
+inline Edges Node::callees() const { return m_graph->callees(m_id); }
+
 class GraphInterface : public FixpointIteratorGraphSpec<GraphInterface> {
  public:
   using Graph = call_graph::Graph;
   using NodeId = DexMethod*;
-  using EdgeId = std::shared_ptr<Edge>;
+  using EdgeId = const Edge*;
 
   ~GraphInterface() = delete;
 
   static const NodeId entry(const Graph& graph) {
     return graph.entry().method();
   }
-  static std::vector<EdgeId> predecessors(const Graph& graph, const NodeId& m) {
+  static Edges predecessors(const Graph& graph, const NodeId& m) {
     return graph.node(m).callers();
   }
-  static std::vector<EdgeId> successors(const Graph& graph, const NodeId& m) {
+  static Edges successors(const Graph& graph, const NodeId& m) {
     return graph.node(m).callees();
   }
   static const NodeId source(const Graph& graph, const EdgeId& e) {
-    return graph.node(e->caller()).method();
+    return e->caller();
   }
   static const NodeId target(const Graph& graph, const EdgeId& e) {
-    return graph.node(e->callee()).method();
+    return e->callee();
+  }
+  // See fp_impl::has_node_index.
+  static size_t node_index(const Graph& graph, const NodeId& m) {
+    return m == nullptr ? 0 : graph.node_id(m);
   }
 };
 
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+/*
+ * A hash map split into n_slots independently locked partitions. A key always
+ * lives in the slot selected by its hash, so threads operating on unrelated
+ * keys only contend when their keys happen to share a slot.
+ *
+ * Accesses go through with_slot(), which runs a function on the slot owning
+ * the key while holding that slot's lock. This keeps lookup-then-insert
+ * sequences atomic without exposing the underlying mutexes.
+ */
+template <class Key,
+          class Value,
+          class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>,
+          size_t n_slots = 31>
+class ConcurrentMap {
+ public:
+  using Slot = std::unordered_map<Key, Value, Hash, KeyEqual>;
+
+  template <class Fn>
+  auto with_slot(const Key& key, Fn fn) -> decltype(fn(std::declval<Slot&>())) {
+    size_t i = slot_index(key);
+    std::lock_guard<std::mutex> lock(m_locks[i]);
+    return fn(m_slots[i]);
+  }
+
+  /*
+   * Runs a function on the slots owning two keys while holding both of their
+   * locks, e.g. to move an entry from one key to another. The locks are taken
+   * in slot order, so concurrent calls cannot deadlock. Both slots are the
+   * same one if the keys share it.
+   */
+  template <class Fn>
+  auto with_slots(const Key& a, const Key& b, Fn fn)
+      -> decltype(fn(std::declval<Slot&>(), std::declval<Slot&>())) {
+    size_t i = slot_index(a);
+    size_t j = slot_index(b);
+    if (i == j) {
+      std::lock_guard<std::mutex> lock(m_locks[i]);
+      return fn(m_slots[i], m_slots[i]);
+    }
+    std::lock_guard<std::mutex> first(m_locks[std::min(i, j)]);
+    std::lock_guard<std::mutex> second(m_locks[std::max(i, j)]);
+    return fn(m_slots[i], m_slots[j]);
+  }
+
+  /*
+   * Visits every entry. This does not take any lock, so it must not run
+   * concurrently with modifications.
+   */
+  template <class Fn>
+  void for_each(Fn fn) const {
+    for (const auto& slot : m_slots) {
+      for (const auto& entry : slot) {
+        fn(entry);
+      }
+    }
+  }
+
+  size_t size() const {
+    size_t result = 0;
+    for (size_t i = 0; i < n_slots; ++i) {
+      std::lock_guard<std::mutex> lock(m_locks[i]);
+      result += m_slots[i].size();
+    }
+    return result;
+  }
+
+ private:
+  size_t slot_index(const Key& key) const { return Hash()(key) % n_slots; }
+
+  std::array<Slot, n_slots> m_slots;
+  mutable std::array<std::mutex, n_slots> m_locks;
+};
@@ -10,12 +10,14 @@
 #include "ConfigFiles.h"
 
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "Debug.h"
 #include "DexClass.h"
+#include "WorkQueue.h"
 
 ConfigFiles::ConfigFiles(const Json::Value& config) :
     m_proguard_map(
@@ -82,3 +84,90 @@ std::vector<std::string> ConfigFiles::load_coldstart_methods() {
   }
   return coldstart_methods;
 }
+
+namespace {
+
+/*
+ * Resolves each name of the list in parallel, into the slot of the same
+ * index, and ranks the resolved entries by their first occurrence.
+ */
+template <typename Ref>
+void resolve_list(const std::vector<std::string>& names,
+                  const std::function<Ref*(const std::string&)>& resolve,
+                  std::vector<Ref*>* refs,
+                  std::unordered_map<const Ref*, size_t>* ranks) {
+  refs->assign(names.size(), nullptr);
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { (*refs)[i] = resolve(names[i]); });
+  for (size_t i = 0; i < names.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  ranks->clear();
+  for (size_t i = 0; i < refs->size(); ++i) {
+    if ((*refs)[i] != nullptr) {
+      ranks->emplace((*refs)[i], i);
+    }
+  }
+}
+
+// The coldstart method list leaves out the colon of full descriptors.
+DexMethodRef* get_coldstart_method(std::string descriptor) {
+  if (descriptor.find(':') == std::string::npos) {
+    auto lparen = descriptor.find('(');
+    if (lparen == std::string::npos) {
+      return nullptr;
+    }
+    descriptor.insert(lparen, ":");
+  }
+  return DexMethod::get_method(descriptor);
+}
+
+} // namespace
+
+void ConfigFiles::resolve_coldstart_classes() {
+  std::lock_guard<std::mutex> guard(m_coldstart_lock);
+  if (m_coldstart_classes_resolved) {
+    return;
+  }
+  resolve_list<DexType>(
+      get_coldstart_classes(),
+      [](const std::string& name) { return DexType::get_type(name.c_str()); },
+      &m_coldstart_types,
+      &m_coldstart_class_ranks);
+  m_coldstart_classes_resolved = true;
+}
+
+void ConfigFiles::resolve_coldstart_methods() {
+  std::lock_guard<std::mutex> guard(m_coldstart_lock);
+  if (m_coldstart_methods_resolved) {
+    return;
+  }
+  resolve_list<DexMethodRef>(get_coldstart_methods(),
+                             get_coldstart_method,
+                             &m_coldstart_method_refs,
+                             &m_coldstart_method_ranks);
+  m_coldstart_methods_resolved = true;
+}
+
+const std::vector<DexType*>& ConfigFiles::get_coldstart_types() {
+  resolve_coldstart_classes();
+  return m_coldstart_types;
+}
+
+const std::unordered_map<const DexType*, size_t>&
+ConfigFiles::get_coldstart_class_ranks() {
+  resolve_coldstart_classes();
+  return m_coldstart_class_ranks;
+}
+
+const std::vector<DexMethodRef*>& ConfigFiles::get_coldstart_method_refs() {
+  resolve_coldstart_methods();
+  return m_coldstart_method_refs;
+}
+
+const std::unordered_map<const DexMethodRef*, size_t>&
+ConfigFiles::get_coldstart_method_ranks() {
+  resolve_coldstart_methods();
+  return m_coldstart_method_ranks;
+}
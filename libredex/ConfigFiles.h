@@ -12,6 +12,8 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <mutex>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <json/json.h>
@@ -40,6 +42,23 @@ struct ConfigFiles {
     return m_coldstart_methods;
   }
 
+  /*
+   * The coldstart classes resolved once into types, in list order and
+   * parallel to get_coldstart_classes(): names that aren't types, like the
+   * markers, are nullptr. The rank of a type is the position of its first
+   * occurrence in the list.
+   */
+  const std::vector<DexType*>& get_coldstart_types();
+  const std::unordered_map<const DexType*, size_t>& get_coldstart_class_ranks();
+
+  /*
+   * The same for the coldstart methods, parallel to get_coldstart_methods().
+   * Entries that don't name a known method are nullptr.
+   */
+  const std::vector<DexMethodRef*>& get_coldstart_method_refs();
+  const std::unordered_map<const DexMethodRef*, size_t>&
+  get_coldstart_method_ranks();
+
   const std::unordered_set<DexType*> get_no_optimizations_annos() const {
     return m_no_optimizations_annos;
   }
@@ -76,6 +95,8 @@ struct ConfigFiles {
  private:
   std::vector<std::string> load_coldstart_classes();
   std::vector<std::string> load_coldstart_methods();
+  void resolve_coldstart_classes();
+  void resolve_coldstart_methods();
 
  private:
   bool m_move_map{false};
@@ -85,6 +106,14 @@ struct ConfigFiles {
   std::string m_coldstart_method_filename;
   std::vector<std::string> m_coldstart_classes;
   std::vector<std::string> m_coldstart_methods;
+  // Resolved on first use, by then all the classes have been loaded.
+  std::mutex m_coldstart_lock;
+  bool m_coldstart_classes_resolved{false};
+  bool m_coldstart_methods_resolved{false};
+  std::vector<DexType*> m_coldstart_types;
+  std::unordered_map<const DexType*, size_t> m_coldstart_class_ranks;
+  std::vector<DexMethodRef*> m_coldstart_method_refs;
+  std::unordered_map<const DexMethodRef*, size_t> m_coldstart_method_ranks;
   std::string m_printseeds; // Filename to dump computed seeds.
 
   // global no optimizations annotations
@@ -507,6 +507,7 @@ Block* ControlFlowGraph::create_block() {
   size_t id = m_blocks.size();
   Block* b = new Block(this, id);
   m_blocks.emplace(id, b);
+  invalidate_caches();
   return b;
 }
 
@@ -516,7 +517,7 @@ void ControlFlowGraph::calculate_exit_block() {
   }
   auto exit_blocks = find_exit_blocks(*this);
   if (exit_blocks.size() == 1) {
-    m_exit_block = exit_blocks.at(0);
+    set_exit_block(exit_blocks.at(0));
   } else {
     auto ghost_exit_block = create_block();
     set_exit_block(ghost_exit_block);
@@ -530,6 +531,7 @@ void ControlFlowGraph::add_edge(Block* p, Block* s, EdgeType type) {
   auto edge = std::make_shared<Edge>(p, s, type);
   p->m_succs.emplace_back(edge);
   s->m_preds.emplace_back(edge);
+  invalidate_caches();
 }
 
 void ControlFlowGraph::remove_all_edges(Block* p, Block* s) {
@@ -545,6 +547,7 @@ void ControlFlowGraph::remove_all_edges(Block* p, Block* s) {
                                     return e->src() == p;
                                   }),
                    s->preds().end());
+  invalidate_caches();
 }
 
 std::ostream& ControlFlowGraph::write_dot_format(std::ostream& o) const {
@@ -744,6 +747,151 @@ ControlFlowGraph::immediate_dominators() const {
   return postorder_dominator;
 }
 
+std::shared_ptr<const WeakTopologicalOrdering<Block*>> ControlFlowGraph::wto(
+    bool backwards) const {
+  auto& wto = backwards ? m_backward_wto : m_forward_wto;
+  if (wto == nullptr) {
+    auto* root = backwards ? m_exit_block : m_entry_block;
+    wto = std::make_shared<const WeakTopologicalOrdering<Block*>>(
+        root, [backwards](Block* const& b) {
+          std::vector<Block*> next;
+          for (const auto& e : backwards ? b->preds() : b->succs()) {
+            next.push_back(backwards ? e->src() : e->target());
+          }
+          return next;
+        });
+  }
+  return wto;
+}
+
+std::shared_ptr<const DominatorTree> ControlFlowGraph::dominators() const {
+  if (m_dominators == nullptr) {
+    m_dominators = std::make_shared<const DominatorTree>(*this);
+  }
+  return m_dominators;
+}
+
+namespace cfg {
+
+constexpr uint32_t DominatorTree::kUnreachable;
+
+DominatorTree::DominatorTree(const ControlFlowGraph& cfg) {
+  size_t num_ids = 0;
+  for (auto* b : cfg.blocks()) {
+    num_ids = std::max(num_ids, b->id() + 1);
+  }
+  m_nodes.resize(num_ids);
+  auto entry = const_cast<Block*>(cfg.entry_block());
+  if (entry == nullptr) {
+    return;
+  }
+
+  // Number the reachable blocks in postorder, without recursing.
+  std::vector<Block*> postorder;
+  std::vector<bool> visited(num_ids);
+  std::vector<std::pair<Block*, size_t>> stack{{entry, 0}};
+  visited[entry->id()] = true;
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    auto block = top.first;
+    if (top.second < block->succs().size()) {
+      auto succ = block->succs()[top.second++]->target();
+      if (!visited[succ->id()]) {
+        visited[succ->id()] = true;
+        stack.emplace_back(succ, 0);
+      }
+      continue;
+    }
+    postorder.push_back(block);
+    stack.pop_back();
+  }
+  m_rpo.assign(postorder.rbegin(), postorder.rend());
+  for (size_t i = 0; i < m_rpo.size(); ++i) {
+    m_nodes[m_rpo[i]->id()].rpo = i;
+  }
+
+  // Iterate to the fixpoint, walking up the partial tree from both blocks
+  // until the fingers meet. The entry is its own idom while this runs.
+  auto intersect = [&](Block* b1, Block* b2) {
+    while (b1 != b2) {
+      while (m_nodes[b1->id()].rpo > m_nodes[b2->id()].rpo) {
+        b1 = m_nodes[b1->id()].idom;
+      }
+      while (m_nodes[b2->id()].rpo > m_nodes[b1->id()].rpo) {
+        b2 = m_nodes[b2->id()].idom;
+      }
+    }
+    return b1;
+  };
+  m_nodes[entry->id()].idom = entry;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < m_rpo.size(); ++i) {
+      auto block = m_rpo[i];
+      Block* new_idom = nullptr;
+      for (const auto& pred : block->preds()) {
+        auto src = pred->src();
+        if (!is_reachable(src) || m_nodes[src->id()].idom == nullptr) {
+          continue;
+        }
+        new_idom = new_idom == nullptr ? src : intersect(src, new_idom);
+      }
+      if (m_nodes[block->id()].idom != new_idom) {
+        m_nodes[block->id()].idom = new_idom;
+        changed = true;
+      }
+    }
+  }
+  m_nodes[entry->id()].idom = nullptr;
+
+  for (size_t i = 1; i < m_rpo.size(); ++i) {
+    auto block = m_rpo[i];
+    m_nodes[m_nodes[block->id()].idom->id()].children.push_back(block);
+  }
+
+  // A join point is in the frontier of every block from each of its
+  // predecessors up to, but not including, its idom.
+  for (auto block : m_rpo) {
+    if (block->preds().size() < 2) {
+      continue;
+    }
+    auto idom = m_nodes[block->id()].idom;
+    for (const auto& pred : block->preds()) {
+      auto runner = pred->src();
+      if (!is_reachable(runner)) {
+        continue;
+      }
+      while (runner != idom) {
+        auto& frontier = m_nodes[runner->id()].frontier;
+        if (frontier.empty() || frontier.back() != block) {
+          frontier.push_back(block);
+        }
+        runner = m_nodes[runner->id()].idom;
+      }
+    }
+  }
+
+  // Number the tree so that dominates() is two comparisons.
+  uint32_t counter = 0;
+  std::vector<std::pair<Block*, size_t>> tree_stack{{entry, 0}};
+  m_nodes[entry->id()].preorder = counter++;
+  while (!tree_stack.empty()) {
+    auto& top = tree_stack.back();
+    auto& node = m_nodes[top.first->id()];
+    if (top.second < node.children.size()) {
+      auto child = node.children[top.second++];
+      m_nodes[child->id()].preorder = counter++;
+      tree_stack.emplace_back(child, 0);
+      continue;
+    }
+    node.postorder = counter++;
+    tree_stack.pop_back();
+  }
+}
+
+} // namespace cfg
+
 void ControlFlowGraph::remove_succ_edges(Block* b) {
   std::vector<std::pair<Block*, Block*>> remove_edges;
   for (auto& s : b->succs()) {
@@ -39,6 +39,10 @@ namespace transform {
 void replace_block(IRCode*, Block*, Block*);
 }
 
+namespace cfg {
+class DominatorTree;
+}
+
 namespace cfg {
 
 class Edge final {
@@ -158,8 +162,14 @@ class ControlFlowGraph {
   const Block* exit_block() const { return m_exit_block; }
   Block* entry_block() { return m_entry_block; }
   Block* exit_block() { return m_exit_block; }
-  void set_entry_block(Block* b) { m_entry_block = b; }
-  void set_exit_block(Block* b) { m_exit_block = b; }
+  void set_entry_block(Block* b) {
+    m_entry_block = b;
+    invalidate_caches();
+  }
+  void set_exit_block(Block* b) {
+    m_exit_block = b;
+    invalidate_caches();
+  }
   /*
    * Determine where the exit block is. If there is more than one, create a
    * "ghost" block that is the successor to all of them.
@@ -189,6 +199,24 @@ class ControlFlowGraph {
   // Do writes to this CFG propagate back to IR and Dex code?
   bool editable() const { return m_editable; }
 
+  /*
+   * The weak topological ordering of the blocks reachable from the entry
+   * block, or from the exit block following the edges backwards. It only
+   * depends on the edges, so it is computed once and shared by all the
+   * fixpoint iterators that run on this graph, until a block or an edge is
+   * added or removed.
+   */
+  std::shared_ptr<const WeakTopologicalOrdering<Block*>> wto(
+      bool backwards) const;
+
+  /*
+   * The dominator tree and dominance frontiers of the blocks reachable from
+   * the entry block. Like the WTO, it is computed on demand and kept until a
+   * block or an edge is added or removed, so that it stays valid while the
+   * instructions of an editable CFG change.
+   */
+  std::shared_ptr<const cfg::DominatorTree> dominators() const;
+
  private:
   using BranchToTargets =
       std::unordered_map<MethodItemEntry*, std::vector<Block*>>;
@@ -252,12 +280,88 @@ class ControlFlowGraph {
 
   void remove_all_edges(Block* pred, Block* succ);
 
+  // Drops what only depends on the blocks and edges.
+  void invalidate_caches() {
+    m_forward_wto.reset();
+    m_backward_wto.reset();
+    m_dominators.reset();
+  }
+
   Blocks m_blocks;
   Block* m_entry_block{nullptr};
   Block* m_exit_block{nullptr};
   bool m_editable;
+  mutable std::shared_ptr<const WeakTopologicalOrdering<Block*>> m_forward_wto;
+  mutable std::shared_ptr<const WeakTopologicalOrdering<Block*>> m_backward_wto;
+  mutable std::shared_ptr<const cfg::DominatorTree> m_dominators;
+};
+
+namespace cfg {
+
+/*
+ * The dominator tree of the blocks reachable from the entry block, and their
+ * dominance frontiers, after K. D. Cooper et al., A Simple, Fast Dominance
+ * Algorithm. The blocks are looked up by id.
+ */
+class DominatorTree {
+ public:
+  explicit DominatorTree(const ControlFlowGraph& cfg);
+
+  bool is_reachable(const Block* b) const {
+    return b->id() < m_nodes.size() && m_nodes[b->id()].rpo != kUnreachable;
+  }
+
+  // nullptr for the entry block and for unreachable blocks.
+  Block* idom(const Block* b) const {
+    return is_reachable(b) ? m_nodes[b->id()].idom : nullptr;
+  }
+
+  // Whether every path from the entry to b goes through a. Every reachable
+  // block dominates itself.
+  bool dominates(const Block* a, const Block* b) const {
+    if (!is_reachable(a) || !is_reachable(b)) {
+      return false;
+    }
+    const auto& na = m_nodes[a->id()];
+    const auto& nb = m_nodes[b->id()];
+    return na.preorder <= nb.preorder && nb.postorder <= na.postorder;
+  }
+
+  // The blocks that b is the immediate dominator of.
+  const std::vector<Block*>& children(const Block* b) const {
+    return is_reachable(b) ? m_nodes[b->id()].children : m_empty;
+  }
+
+  // The blocks that b doesn't strictly dominate, but that have a predecessor
+  // that b dominates.
+  const std::vector<Block*>& frontier(const Block* b) const {
+    return is_reachable(b) ? m_nodes[b->id()].frontier : m_empty;
+  }
+
+  // The reachable blocks, in reverse postorder of the CFG.
+  const std::vector<Block*>& reverse_postorder() const { return m_rpo; }
+
+ private:
+  static constexpr uint32_t kUnreachable = ~0u;
+
+  struct Node {
+    Block* idom{nullptr};
+    uint32_t rpo{kUnreachable};
+    // The numbering of a depth-first walk of the dominator tree.
+    uint32_t preorder{0};
+    uint32_t postorder{0};
+    std::vector<Block*> children;
+    std::vector<Block*> frontier;
+  };
+
+  // Indexed by block id.
+  std::vector<Node> m_nodes;
+  std::vector<Block*> m_rpo;
+  std::vector<Block*> m_empty;
 };
 
+} // namespace cfg
+
 namespace cfg {
 
 // A static-method-only API for use with the monotonic fixpoint iterator.
@@ -282,6 +386,17 @@ class GraphInterface : public FixpointIteratorGraphSpec<GraphInterface> {
   }
   static NodeId source(const Graph&, const EdgeId& e) { return e->src(); }
   static NodeId target(const Graph&, const EdgeId& e) { return e->target(); }
+
+  // See fp_impl::has_cached_wto and fp_impl::has_node_index.
+  static std::shared_ptr<const WeakTopologicalOrdering<NodeId>> wto(
+      const Graph& graph) {
+    return graph.wto(/* backwards */ false);
+  }
+  static std::shared_ptr<const WeakTopologicalOrdering<NodeId>> backwards_wto(
+      const Graph& graph) {
+    return graph.wto(/* backwards */ true);
+  }
+  static size_t node_index(const Graph&, const NodeId& b) { return b->id(); }
 };
 
 } // namespace cfg
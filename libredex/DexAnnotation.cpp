@@ -630,17 +630,18 @@ void DexAnnotationDirectory::gather_annotations(
 void DexAnnotationDirectory::vencode(
     DexOutputIdx* dodx,
     std::vector<uint32_t>& annodirout,
-    std::map<ParamAnnotations*, uint32_t>& xrefmap,
-    std::map<DexAnnotationSet*, uint32_t>& asetmap) {
+    std::unordered_map<ParamAnnotations*, uint32_t>& xrefmap,
+    std::unordered_map<DexAnnotationSet*, uint32_t>& asetmap) {
   uint32_t classoff = 0;
   uint32_t cntaf = 0;
   uint32_t cntam = 0;
   uint32_t cntamp = 0;
   if (m_class) {
-    always_assert_log(asetmap.count(m_class) != 0,
+    auto it = asetmap.find(m_class);
+    always_assert_log(it != asetmap.end(),
                       "Uninitialized aset %p '%s'",
                       m_class, show(m_class).c_str());
-    classoff = asetmap[m_class];
+    classoff = it->second;
   }
   if (m_field) {
     cntaf = (uint32_t) m_field->size();
@@ -664,10 +665,11 @@ void DexAnnotationDirectory::vencode(
     for (auto const& p : *m_field) {
       DexAnnotationSet* das = p.second;
       annodirout.push_back(dodx->fieldidx(p.first));
-      always_assert_log(asetmap.count(das) != 0,
+      auto it = asetmap.find(das);
+      always_assert_log(it != asetmap.end(),
                         "Uninitialized aset %p '%s'",
                         das, show(das).c_str());
-      annodirout.push_back(asetmap[das]);
+      annodirout.push_back(it->second);
     }
   }
   if (m_method) {
@@ -677,10 +679,11 @@ void DexAnnotationDirectory::vencode(
       DexAnnotationSet* das = p.second;
       uint32_t midx = dodx->methodidx(m);
       annodirout.push_back(midx);
-      always_assert_log(asetmap.count(das) != 0,
+      auto it = asetmap.find(das);
+      always_assert_log(it != asetmap.end(),
                         "Uninitialized aset %p '%s'",
                         das, show(das).c_str());
-      annodirout.push_back(asetmap[das]);
+      annodirout.push_back(it->second);
     }
   }
   if (m_method_param) {
@@ -690,9 +693,10 @@ void DexAnnotationDirectory::vencode(
     for (auto const& p : *m_method_param) {
       ParamAnnotations* pa = p.second;
       annodirout.push_back(dodx->methodidx(p.first));
+      auto it = xrefmap.find(pa);
       always_assert_log(
-          xrefmap.count(pa) != 0, "Uninitialized ParamAnnotations %p", pa);
-      annodirout.push_back(xrefmap[pa]);
+          it != xrefmap.end(), "Uninitialized ParamAnnotations %p", pa);
+      annodirout.push_back(it->second);
     }
   }
 }
@@ -705,16 +709,17 @@ void DexAnnotationSet::gather_annotations(std::vector<DexAnnotation*>& list) {
 
 void DexAnnotationSet::vencode(DexOutputIdx* dodx,
                                std::vector<uint32_t>& asetout,
-                               std::map<DexAnnotation*, uint32_t>& annoout) {
+                               std::unordered_map<DexAnnotation*, uint32_t>& annoout) {
   asetout.push_back((uint32_t)m_annotations.size());
   std::sort(
       m_annotations.begin(), m_annotations.end(), type_annotation_compare);
   for (auto anno : m_annotations) {
-    always_assert_log(annoout.count(anno) != 0,
+    auto it = annoout.find(anno);
+    always_assert_log(it != annoout.end(),
                       "Uninitialized annotation %p '%s', bailing\n",
                       anno,
                       show(anno).c_str());
-    asetout.push_back(annoout[anno]);
+    asetout.push_back(it->second);
   }
 }
 
@@ -14,6 +14,7 @@
 #include <list>
 #include <map>
 #include <sstream>
+#include <unordered_map>
 
 #include "Gatherable.h"
 #include "Show.h"
@@ -393,7 +394,7 @@ class DexAnnotationSet : public Gatherable {
   }
   void vencode(DexOutputIdx* dodx,
                std::vector<uint32_t>& asetout,
-               std::map<DexAnnotation*, uint32_t>& annoout);
+               std::unordered_map<DexAnnotation*, uint32_t>& annoout);
   void gather_annotations(std::vector<DexAnnotation*>& alist);
 };
 
@@ -470,8 +471,8 @@ class DexAnnotationDirectory {
   void gather_xrefs(std::vector<ParamAnnotations*>& xrefs);
   void vencode(DexOutputIdx* dodx,
                std::vector<uint32_t>& annodirout,
-               std::map<ParamAnnotations*, uint32_t>& xrefmap,
-               std::map<DexAnnotationSet*, uint32_t>& asetmap);
+               std::unordered_map<ParamAnnotations*, uint32_t>& xrefmap,
+               std::unordered_map<DexAnnotationSet*, uint32_t>& asetmap);
 
   friend std::string show(const DexAnnotationDirectory*);
 };
@@ -68,44 +68,21 @@ DexFieldRef* DexField::make_field(const std::string& full_descriptor) {
   return DexField::make_field(cls, name, type);
 }
 
-DexDebugEntry::DexDebugEntry(DexDebugEntry&& that)
-    : type(that.type), addr(that.addr) {
-  switch (type) {
-  case DexDebugEntryType::Position:
-    new (&pos) std::unique_ptr<DexPosition>(std::move(that.pos));
-    break;
-  case DexDebugEntryType::Instruction:
-    new (&insn) std::unique_ptr<DexDebugInstruction>(std::move(that.insn));
-    break;
-  }
-}
-
-DexDebugEntry::~DexDebugEntry() {
-  switch (type) {
-  case DexDebugEntryType::Position:
-    pos.~unique_ptr<DexPosition>();
-    break;
-  case DexDebugEntryType::Instruction:
-    insn.~unique_ptr<DexDebugInstruction>();
-    break;
-  }
-}
-
 /*
  * Evaluate the debug opcodes to figure out their absolute addresses and line
  * numbers.
  */
 static std::vector<DexDebugEntry> eval_debug_instructions(
     DexDebugItem* dbg,
-    std::vector<std::unique_ptr<DexDebugInstruction>>& insns,
+    const std::vector<DexDebugInstruction>& insns,
     uint32_t absolute_line) {
   std::vector<DexDebugEntry> entries;
   uint32_t pc = 0;
-  for (auto& opcode : insns) {
-    auto op = opcode->opcode();
+  for (const auto& opcode : insns) {
+    auto op = opcode.opcode();
     switch (op) {
     case DBG_ADVANCE_LINE: {
-      absolute_line += opcode->value();
+      absolute_line += opcode.value();
       continue;
     }
     case DBG_END_LOCAL:
@@ -116,19 +93,18 @@ static std::vector<DexDebugEntry> eval_debug_instructions(
     case DBG_END_SEQUENCE:
     case DBG_SET_PROLOGUE_END:
     case DBG_SET_EPILOGUE_BEGIN: {
-      entries.emplace_back(pc, std::move(opcode));
+      entries.emplace_back(pc, opcode);
       break;
     }
     case DBG_ADVANCE_PC: {
-      pc += opcode->uvalue();
+      pc += opcode.uvalue();
       continue;
     }
     default: {
       uint8_t adjustment = op - DBG_FIRST_SPECIAL;
       absolute_line += DBG_LINE_BASE + (adjustment % DBG_LINE_RANGE);
       pc += adjustment / DBG_LINE_RANGE;
-      entries.emplace_back(
-          pc, std::make_unique<DexPosition>(absolute_line));
+      entries.emplace_back(pc, DexPosition::make(absolute_line));
       break;
     }
     }
@@ -144,11 +120,11 @@ DexDebugItem::DexDebugItem(DexIdx* idx, uint32_t offset) {
     DexString* str = decode_noindexable_string(idx, encdata);
     m_param_names.push_back(str);
   }
-  std::vector<std::unique_ptr<DexDebugInstruction>> insns;
-  DexDebugInstruction* dbgp;
-  while ((dbgp = DexDebugInstruction::make_instruction(idx, &encdata)) !=
-         nullptr) {
-    insns.emplace_back(dbgp);
+  std::vector<DexDebugInstruction> insns;
+  for (auto insn = DexDebugInstruction::make_instruction(idx, &encdata);
+       insn.opcode() != DBG_END_SEQUENCE;
+       insn = DexDebugInstruction::make_instruction(idx, &encdata)) {
+    insns.push_back(insn);
   }
   m_dbg_entries = eval_debug_instructions(this, insns, line_start);
 }
@@ -166,25 +142,6 @@ uint32_t DexDebugItem::get_line_start() const {
   return 0;
 }
 
-DexDebugItem::DexDebugItem(const DexDebugItem& that)
-    : m_param_names(that.m_param_names) {
-  std::unordered_map<DexPosition*, DexPosition*> pos_map;
-  for (auto& entry : that.m_dbg_entries) {
-    switch (entry.type) {
-    case DexDebugEntryType::Position: {
-      auto pos = std::make_unique<DexPosition>(*entry.pos);
-      pos_map[entry.pos.get()] = pos.get();
-      pos->parent = pos_map[pos->parent];
-      m_dbg_entries.emplace_back(entry.addr, std::move(pos));
-      break;
-    }
-    case DexDebugEntryType::Instruction:
-      m_dbg_entries.emplace_back(entry.addr, entry.insn->clone());
-      break;
-    }
-  }
-}
-
 std::unique_ptr<DexDebugItem> DexDebugItem::get_dex_debug(DexIdx* idx,
                                                           uint32_t offset) {
   if (offset == 0) return nullptr;
@@ -196,12 +153,12 @@ namespace {
 /*
  * Convert DexDebugEntries into debug opcodes.
  */
-std::vector<std::unique_ptr<DexDebugInstruction>> generate_debug_instructions(
+std::vector<DexDebugInstruction> generate_debug_instructions(
     DexDebugItem* debugitem,
     DexOutputIdx* dodx,
     PositionMapper* pos_mapper,
     uint32_t* line_start) {
-  std::vector<std::unique_ptr<DexDebugInstruction>> dbgops;
+  std::vector<DexDebugInstruction> dbgops;
   uint32_t prev_addr = 0;
   boost::optional<uint32_t> prev_line;
   auto& entries = debugitem->get_entries();
@@ -210,16 +167,16 @@ std::vector<std::unique_ptr<DexDebugInstruction>> generate_debug_instructions(
     // find all entries that belong to the same address, and group them by type
     auto addr = it->addr;
     std::vector<DexPosition*> positions;
-    std::vector<DexDebugInstruction*> insns;
+    std::vector<const DexDebugInstruction*> insns;
     for (; it != entries.end() && it->addr == addr; ++it) {
       switch (it->type) {
         case DexDebugEntryType::Position:
           if (it->pos->file != nullptr) {
-            positions.push_back(it->pos.get());
+            positions.push_back(it->pos);
           }
           break;
         case DexDebugEntryType::Instruction:
-          insns.push_back(it->insn.get());
+          insns.push_back(&it->insn);
           break;
       }
     }
@@ -243,30 +200,26 @@ std::vector<std::unique_ptr<DexDebugInstruction>> generate_debug_instructions(
       prev_line = line;
       if (line_delta < DBG_LINE_BASE ||
               line_delta >= (DBG_LINE_RANGE + DBG_LINE_BASE)) {
-        dbgops.emplace_back(new DexDebugInstruction(
-              DBG_ADVANCE_LINE, line_delta));
+        dbgops.emplace_back(DBG_ADVANCE_LINE, line_delta);
         line_delta = 0;
       }
       auto special = (line_delta - DBG_LINE_BASE) +
                        (addr_delta * DBG_LINE_RANGE) + DBG_FIRST_SPECIAL;
       if (special & ~0xff) {
-        dbgops.emplace_back(new DexDebugInstruction(
-              DBG_ADVANCE_PC, uint32_t(addr_delta)));
+        dbgops.emplace_back(DBG_ADVANCE_PC, uint32_t(addr_delta));
         special = line_delta - DBG_LINE_BASE + DBG_FIRST_SPECIAL;
       }
-      dbgops.emplace_back(new DexDebugInstruction(
-            static_cast<DexDebugItemOpcode>(special)));
+      dbgops.emplace_back(static_cast<DexDebugItemOpcode>(special));
       line_delta = 0;
       addr_delta = 0;
     }
 
     for (auto insn : insns) {
       if (addr_delta != 0) {
-        dbgops.emplace_back(new DexDebugInstruction(
-              DBG_ADVANCE_PC, addr_delta));
+        dbgops.emplace_back(DBG_ADVANCE_PC, addr_delta);
         addr_delta = 0;
       }
-      dbgops.emplace_back(insn->clone());
+      dbgops.push_back(*insn);
     }
   }
   return dbgops;
@@ -291,17 +244,37 @@ int DexDebugItem::encode(DexOutputIdx* dodx, PositionMapper* pos_mapper,
     encdata = write_uleb128p1(encdata, idx);
   }
   for (auto& dbgop : dbgops) {
-    dbgop->encode(dodx, encdata);
+    dbgop.encode(dodx, encdata);
   }
   encdata = write_uleb128(encdata, DBG_END_SEQUENCE);
   return (int) (encdata - output);
 }
 
+uint32_t DexDebugItem::count_emitted_positions() {
+  // Mirrors the grouping in generate_debug_instructions: one position is
+  // emitted per address that has at least one bound position.
+  uint32_t count = 0;
+  auto& entries = get_entries();
+  for (auto it = entries.begin(); it != entries.end();) {
+    auto addr = it->addr;
+    bool has_position = false;
+    for (; it != entries.end() && it->addr == addr; ++it) {
+      if (it->type == DexDebugEntryType::Position && it->pos->file != nullptr) {
+        has_position = true;
+      }
+    }
+    if (has_position) {
+      ++count;
+    }
+  }
+  return count;
+}
+
 void DexDebugItem::bind_positions(DexMethod* method, DexString* file) {
   for (auto& entry : m_dbg_entries) {
     switch (entry.type) {
     case DexDebugEntryType::Position:
-      entry.pos->bind(method, file);
+      entry.pos = entry.pos->bind(method, file);
       break;
     case DexDebugEntryType::Instruction:
       break;
@@ -464,7 +437,15 @@ DexMethod::DexMethod(DexType* type, DexString* name, DexProto* proto)
 
 DexMethod::~DexMethod() = default;
 
+std::atomic<uint32_t> DexMethod::s_code_epoch{0};
+
+std::atomic<uint32_t> WalkMark::s_walk{0};
+
 void DexMethod::set_code(std::unique_ptr<IRCode> code) {
+  if (is_balloon_deferred()) {
+    m_dex_code.reset();
+    m_balloon_deferred.store(false, std::memory_order_release);
+  }
   m_code = std::move(code);
 }
 
@@ -472,6 +453,27 @@ void DexMethod::balloon() {
   assert(m_code == nullptr);
   m_code = std::make_unique<IRCode>(this);
   m_dex_code.reset();
+  m_balloon_deferred.store(false, std::memory_order_release);
+}
+
+namespace {
+
+// Serializes the ballooning of deferred methods. Striped, so that methods
+// are ballooned concurrently when parallel walkers get to them.
+std::mutex& deferred_balloon_lock(const DexMethod* method) {
+  constexpr size_t kNumStripes = 64;
+  static std::mutex locks[kNumStripes];
+  return locks[std::hash<const DexMethod*>()(method) % kNumStripes];
+}
+
+} // namespace
+
+void DexMethod::balloon_deferred() {
+  std::lock_guard<std::mutex> lock(deferred_balloon_lock(this));
+  if (m_balloon_deferred.load(std::memory_order_relaxed)) {
+    TRACE(MTRANS, 5, "Ballooning deferred %s\n", SHOW(this));
+    balloon();
+  }
 }
 
 void DexMethod::sync() {
@@ -554,6 +556,7 @@ DexMethodRef* DexMethod::make_method(
 }
 
 void DexClass::remove_method(const DexMethod* m) {
+  RedexContext::advance_member_epoch();
   auto& meths = m->is_virtual() ? m_vmethods : m_dmethods;
   auto it = std::find(meths.begin(), meths.end(), m);
   DEBUG_ONLY bool erased = false;
@@ -600,6 +603,10 @@ void DexMethod::make_concrete(DexAccessFlags access,
 void DexMethod::make_non_concrete() {
   m_access = static_cast<DexAccessFlags>(0);
   m_concrete = false;
+  if (is_balloon_deferred()) {
+    m_dex_code.reset();
+    m_balloon_deferred.store(false, std::memory_order_release);
+  }
   m_code.reset();
   m_virtual = false;
   m_param_anno.clear();
@@ -610,7 +617,8 @@ void DexMethod::make_non_concrete() {
  */
 void DexClass::load_class_data_item(DexIdx* idx,
                                     uint32_t cdi_off,
-                                    DexEncodedValueArray* svalues) {
+                                    DexEncodedValueArray* svalues,
+                                    bool balloon) {
   if (cdi_off == 0) return;
   const uint8_t* encd = idx->get_uleb_data(cdi_off);
   uint32_t sfield_count = read_uleb128(&encd);
@@ -644,41 +652,46 @@ void DexClass::load_class_data_item(DexIdx* idx,
     df->make_concrete(access_flags);
     m_ifields.push_back(df);
   }
-  ndex = 0;
-  for (uint32_t i = 0; i < dmethod_count; i++) {
-    ndex += read_uleb128(&encd);
+  auto load_method = [&](uint32_t ndex, bool is_virtual) {
     auto access_flags = (DexAccessFlags)read_uleb128(&encd);
     uint32_t code_off = read_uleb128(&encd);
     DexMethod* dm = static_cast<DexMethod*>(idx->get_methodidx(ndex));
+    if (balloon && code_off != 0) {
+      // The IR needs to know whether the method is static.
+      dm->make_concrete(access_flags, is_virtual);
+      dm->set_code(std::make_unique<IRCode>(dm, idx, code_off, m_source_file));
+      return dm;
+    }
     std::unique_ptr<DexCode> dc = DexCode::get_dex_code(idx, code_off);
     if (dc && dc->get_debug_item()) {
       dc->get_debug_item()->bind_positions(dm, m_source_file);
     }
-    dm->make_concrete(access_flags, std::move(dc), false);
-    m_dmethods.push_back(dm);
+    dm->make_concrete(access_flags, std::move(dc), is_virtual);
+    return dm;
+  };
+  ndex = 0;
+  for (uint32_t i = 0; i < dmethod_count; i++) {
+    ndex += read_uleb128(&encd);
+    m_dmethods.push_back(load_method(ndex, false));
   }
   ndex = 0;
   for (uint32_t i = 0; i < vmethod_count; i++) {
     ndex += read_uleb128(&encd);
-    auto access_flags = (DexAccessFlags)read_uleb128(&encd);
-    uint32_t code_off = read_uleb128(&encd);
-    DexMethod* dm = static_cast<DexMethod*>(idx->get_methodidx(ndex));
-    auto dc = DexCode::get_dex_code(idx, code_off);
-    if (dc && dc->get_debug_item()) {
-      dc->get_debug_item()->bind_positions(dm, m_source_file);
-    }
-    dm->make_concrete(access_flags, std::move(dc), true);
-    m_vmethods.push_back(dm);
+    m_vmethods.push_back(load_method(ndex, true));
   }
 }
 
-std::unique_ptr<IRCode> DexMethod::release_code() { return std::move(m_code); }
+std::unique_ptr<IRCode> DexMethod::release_code() {
+  get_code();
+  return std::move(m_code);
+}
 
 void DexClass::add_method(DexMethod* m) {
   always_assert_log(m->is_concrete() || m->is_external(),
                     "Method %s must be concrete",
                     SHOW(m));
   always_assert(m->get_class() == get_type());
+  RedexContext::advance_member_epoch();
   if (m->is_virtual()) {
     insert_sorted(m_vmethods, m, compare_dexmethods);
   } else {
@@ -691,6 +704,7 @@ void DexClass::add_field(DexField* f) {
                     "Field %s must be concrete",
                     SHOW(f));
   always_assert(f->get_class() == get_type());
+  RedexContext::advance_member_epoch();
   bool is_static = f->get_access() & DexAccessFlags::ACC_STATIC;
   if (is_static) {
     insert_sorted(m_sfields, f, compare_dexfields);
@@ -700,6 +714,7 @@ void DexClass::add_field(DexField* f) {
 }
 
 void DexClass::remove_field(const DexField* f) {
+  RedexContext::advance_member_epoch();
   bool is_static = f->get_access() & DexAccessFlags::ACC_STATIC;
   auto& fields = is_static ? m_sfields : m_ifields;
   DEBUG_ONLY bool erase = false;
@@ -939,7 +954,8 @@ DexAnnotationDirectory* DexClass::get_annotation_directory() {
 
 DexClass::DexClass(DexIdx* idx,
                    const dex_class_def* cdef,
-                   const std::string& dex_location)
+                   const std::string& dex_location,
+                   bool balloon)
     : m_access_flags((DexAccessFlags)cdef->access_flags),
       m_super_class(idx->get_typeidx(cdef->super_idx)),
       m_self(idx->get_typeidx(cdef->typeidx)),
@@ -951,8 +967,7 @@ DexClass::DexClass(DexIdx* idx,
   load_class_annotations(idx, cdef->annotations_off);
   auto deva = std::unique_ptr<DexEncodedValueArray>(
       load_static_values(idx, cdef->static_values_off));
-  load_class_data_item(idx, cdef->class_data_offset, deva.get());
-  g_redex->publish_class(this);
+  load_class_data_item(idx, cdef->class_data_offset, deva.get(), balloon);
 }
 
 void DexTypeList::gather_types(std::vector<DexType*>& ltype) const {
@@ -1097,7 +1112,16 @@ void DexField::gather_methods(std::vector<DexMethodRef*>& lmethod) const {
 
 void DexMethod::gather_types(std::vector<DexType*>& ltype) const {
   // We handle m_spec.cls and proto in the first-layer gather.
-  if (m_code) m_code->gather_types(ltype);
+  if (is_balloon_deferred()) {
+    std::lock_guard<std::mutex> lock(deferred_balloon_lock(this));
+    if (is_balloon_deferred()) {
+      m_dex_code->gather_types(ltype);
+    } else {
+      m_code->gather_types(ltype);
+    }
+  } else if (m_code) {
+    m_code->gather_types(ltype);
+  }
   if (m_anno) m_anno->gather_types(ltype);
   auto param_anno = get_param_anno();
   if (param_anno) {
@@ -1110,7 +1134,16 @@ void DexMethod::gather_types(std::vector<DexType*>& ltype) const {
 
 void DexMethod::gather_strings(std::vector<DexString*>& lstring) const {
   // We handle m_name and proto in the first-layer gather.
-  if (m_code) m_code->gather_strings(lstring);
+  if (is_balloon_deferred()) {
+    std::lock_guard<std::mutex> lock(deferred_balloon_lock(this));
+    if (is_balloon_deferred()) {
+      m_dex_code->gather_strings(lstring);
+    } else {
+      m_code->gather_strings(lstring);
+    }
+  } else if (m_code) {
+    m_code->gather_strings(lstring);
+  }
   if (m_anno) m_anno->gather_strings(lstring);
   auto param_anno = get_param_anno();
   if (param_anno) {
@@ -1122,7 +1155,16 @@ void DexMethod::gather_strings(std::vector<DexString*>& lstring) const {
 }
 
 void DexMethod::gather_fields(std::vector<DexFieldRef*>& lfield) const {
-  if (m_code) m_code->gather_fields(lfield);
+  if (is_balloon_deferred()) {
+    std::lock_guard<std::mutex> lock(deferred_balloon_lock(this));
+    if (is_balloon_deferred()) {
+      m_dex_code->gather_fields(lfield);
+    } else {
+      m_code->gather_fields(lfield);
+    }
+  } else if (m_code) {
+    m_code->gather_fields(lfield);
+  }
   if (m_anno) m_anno->gather_fields(lfield);
   auto param_anno = get_param_anno();
   if (param_anno) {
@@ -1134,7 +1176,16 @@ void DexMethod::gather_fields(std::vector<DexFieldRef*>& lfield) const {
 }
 
 void DexMethod::gather_methods(std::vector<DexMethodRef*>& lmethod) const {
-  if (m_code) m_code->gather_methods(lmethod);
+  if (is_balloon_deferred()) {
+    std::lock_guard<std::mutex> lock(deferred_balloon_lock(this));
+    if (is_balloon_deferred()) {
+      m_dex_code->gather_methods(lmethod);
+    } else {
+      m_code->gather_methods(lmethod);
+    }
+  } else if (m_code) {
+    m_code->gather_methods(lmethod);
+  }
   if (m_anno) m_anno->gather_methods(lmethod);
   auto param_anno = get_param_anno();
   if (param_anno) {
@@ -1165,3 +1216,36 @@ uint32_t DexCode::size() const {
   }
   return size;
 }
+
+void DexCode::gather_types(std::vector<DexType*>& ltype) const {
+  for (auto const& opc : get_instructions()) {
+    opc->gather_types(ltype);
+  }
+  for (auto const& tri : m_tries) {
+    for (auto const& catz : tri->m_catches) {
+      if (catz.first != nullptr) {
+        ltype.push_back(catz.first);
+      }
+    }
+  }
+  if (m_dbg) m_dbg->gather_types(ltype);
+}
+
+void DexCode::gather_strings(std::vector<DexString*>& lstring) const {
+  for (auto const& opc : get_instructions()) {
+    opc->gather_strings(lstring);
+  }
+  if (m_dbg) m_dbg->gather_strings(lstring);
+}
+
+void DexCode::gather_fields(std::vector<DexFieldRef*>& lfield) const {
+  for (auto const& opc : get_instructions()) {
+    opc->gather_fields(lfield);
+  }
+}
+
+void DexCode::gather_methods(std::vector<DexMethodRef*>& lmethod) const {
+  for (auto const& opc : get_instructions()) {
+    opc->gather_methods(lmethod);
+  }
+}
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <boost/utility/string_ref.hpp>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
@@ -68,16 +70,18 @@ std::string proguard_name(const DexFieldRef* field);
 class DexString {
   friend struct RedexContext;
 
-  std::string m_storage;
+  // NUL-terminated MUTF-8 data, owned by RedexContext
+  const char* m_storage;
+  uint32_t m_size;
   uint32_t m_utfsize;
 
   // See UNIQUENESS above for the rationale for the private constructor pattern.
-  DexString(std::string nstr, uint32_t utfsize) :
-    m_storage(std::move(nstr)), m_utfsize(utfsize) {
+  DexString(const char* storage, uint32_t size, uint32_t utfsize) :
+    m_storage(storage), m_size(size), m_utfsize(utfsize) {
   }
 
  public:
-  uint32_t size() const { return static_cast<uint32_t>(m_storage.size()); }
+  uint32_t size() const { return m_size; }
 
   // UTF-aware length
   uint32_t length() const;
@@ -112,8 +116,13 @@ class DexString {
     return size() == m_utfsize;
   }
 
-  const char* c_str() const { return m_storage.c_str(); }
-  const std::string& str() const { return m_storage; }
+  const char* c_str() const { return m_storage; }
+  // A copy of the data. Compare and search with str_ref() instead, which
+  // doesn't allocate.
+  std::string str() const { return std::string(m_storage, m_size); }
+  boost::string_ref str_ref() const {
+    return boost::string_ref(m_storage, m_size);
+  }
 
   uint32_t get_entry_size() const {
     uint32_t len = uleb128_encoding_size(m_utfsize);
@@ -175,6 +184,7 @@ class DexType {
   friend struct RedexContext;
 
   DexString* m_name;
+  uint32_t m_id{0};
 
   // See UNIQUENESS above for the rationale for the private constructor pattern.
   DexType(DexString* dstring) {
@@ -218,6 +228,9 @@ class DexType {
 
   DexString* get_name() const { return m_name; }
   const char* c_str() const { return get_name()->c_str(); }
+
+  // Dense and stable, see DexIdMap.h.
+  uint32_t get_id() const { return m_id; }
 };
 
 /* Non-optimizing DexSpec compliant ordering */
@@ -231,6 +244,27 @@ struct dextypes_comparator {
   }
 };
 
+/*
+ * A visited mark for whole-program walks, like the reachability analysis,
+ * that may run on several threads at once. A mark holds the number of the
+ * walk that set it, so a new walk starts out with nothing marked without
+ * having to clear anything.
+ */
+class WalkMark {
+ public:
+  static uint32_t new_walk() { return ++s_walk; }
+
+  // Returns true if this call is the one that set the mark.
+  bool set(uint32_t walk) {
+    return m_walk.load() != walk && m_walk.exchange(walk) != walk;
+  }
+  bool is_set(uint32_t walk) const { return m_walk.load() == walk; }
+
+ private:
+  std::atomic<uint32_t> m_walk{0};
+  static std::atomic<uint32_t> s_walk;
+};
+
 /**
  * A DexFieldRef is a reference to a DexField.
  * A reference may or may not map to a definition.
@@ -254,6 +288,7 @@ class DexFieldRef {
   DexFieldSpec m_spec;
   bool m_concrete;
   bool m_external;
+  uint32_t m_id{0};
 
   ~DexFieldRef() {}
   DexFieldRef(DexType* container, DexString* name, DexType* type) {
@@ -273,6 +308,8 @@ class DexFieldRef {
    DexString* get_name() const { return m_spec.name; }
    const char* c_str() const { return get_name()->c_str(); }
    DexType* get_type() const { return m_spec.type; }
+   // Dense and stable, see DexIdMap.h.
+   uint32_t get_id() const { return m_id; }
 
    void gather_types_shallow(std::vector<DexType*>& ltype) const;
    void gather_strings_shallow(std::vector<DexString*>& lstring) const;
@@ -280,6 +317,9 @@ class DexFieldRef {
    void change(const DexFieldSpec& ref, bool rename_on_collision = false) {
      g_redex->mutate_field(this, ref, rename_on_collision);
    }
+
+   // Set on the fields that compute_reachable_objects() reaches.
+   mutable WalkMark reach_mark;
 };
 
 class DexField : public DexFieldRef {
@@ -301,6 +341,9 @@ class DexField : public DexFieldRef {
 
  public:
   ReferencedState rstate; // Tracks whether this field can be deleted or renamed
+  // Set on fields that are reachable if their class is, see
+  // compute_reachable_objects().
+  mutable WalkMark reach_cond_mark;
 
   // DexField retrieval/creation
 
@@ -557,28 +600,22 @@ struct DexDebugEntry final {
   DexDebugEntryType type;
   uint32_t addr;
   union {
-    std::unique_ptr<DexPosition> pos;
-    std::unique_ptr<DexDebugInstruction> insn;
+    // Interned, see DexPosition.h.
+    DexPosition* pos;
+    DexDebugInstruction insn;
   };
-  DexDebugEntry(uint32_t addr, std::unique_ptr<DexPosition> pos)
-      : type(DexDebugEntryType::Position), addr(addr), pos(std::move(pos)) {}
-  DexDebugEntry(uint32_t addr, std::unique_ptr<DexDebugInstruction> insn)
-      : type(DexDebugEntryType::Instruction),
-        addr(addr),
-        insn(std::move(insn)) {}
-  // should only be copied via DexDebugItem's copy ctor, which is responsible
-  // for remapping DexPositions' parent pointer
-  DexDebugEntry(const DexDebugEntry&) = delete;
-  DexDebugEntry(DexDebugEntry&& other);
-  ~DexDebugEntry();
+  DexDebugEntry(uint32_t addr, DexPosition* pos)
+      : type(DexDebugEntryType::Position), addr(addr), pos(pos) {}
+  DexDebugEntry(uint32_t addr, DexDebugInstruction insn)
+      : type(DexDebugEntryType::Instruction), addr(addr), insn(insn) {}
   void gather_strings(std::vector<DexString*>& lstring) const {
     if (type == DexDebugEntryType::Instruction) {
-      insn->gather_strings(lstring);
+      insn.gather_strings(lstring);
     }
   }
   void gather_types(std::vector<DexType*>& ltype) const {
     if (type == DexDebugEntryType::Instruction) {
-      insn->gather_types(ltype);
+      insn.gather_types(ltype);
     }
   }
 };
@@ -590,12 +627,15 @@ class DexDebugItem {
 
  public:
   DexDebugItem() = default;
-  DexDebugItem(const DexDebugItem&);
+  DexDebugItem(const DexDebugItem&) = default;
   static std::unique_ptr<DexDebugItem> get_dex_debug(DexIdx* idx,
                                                      uint32_t offset);
 
  public:
   std::vector<DexDebugEntry>& get_entries() { return m_dbg_entries; }
+  const std::vector<DexDebugEntry>& get_entries() const {
+    return m_dbg_entries;
+  }
   void set_entries(std::vector<DexDebugEntry> dbg_entries) {
     m_dbg_entries.swap(dbg_entries);
   }
@@ -606,6 +646,8 @@ class DexDebugItem {
 
   /* Returns number of bytes encoded, *output has no alignment requirements */
   int encode(DexOutputIdx* dodx, PositionMapper* pos_mapper, uint8_t* output);
+  /* Number of positions encode() will pass to pos_mapper->position_to_line */
+  uint32_t count_emitted_positions();
 
   void gather_types(std::vector<DexType*>& ltype) const;
   void gather_strings(std::vector<DexString*>& lstring) const;
@@ -706,6 +748,11 @@ class DexCode {
    */
   uint32_t size() const;
 
+  void gather_types(std::vector<DexType*>& ltype) const;
+  void gather_strings(std::vector<DexString*>& lstring) const;
+  void gather_fields(std::vector<DexFieldRef*>& lfield) const;
+  void gather_methods(std::vector<DexMethodRef*>& lmethod) const;
+
   friend std::string show(const DexCode*);
 };
 
@@ -732,6 +779,7 @@ class DexMethodRef {
   DexMethodSpec m_spec;
   bool m_concrete;
   bool m_external;
+  uint32_t m_id{0};
 
   ~DexMethodRef() {}
   DexMethodRef(DexType* type, DexString* name, DexProto* proto) :
@@ -749,6 +797,8 @@ class DexMethodRef {
    DexString* get_name() const { return m_spec.name; }
    const char* c_str() const { return get_name()->c_str(); }
    DexProto* get_proto() const { return m_spec.proto; }
+   // Dense and stable, see DexIdMap.h.
+   uint32_t get_id() const { return m_id; }
 
    void gather_types_shallow(std::vector<DexType*>& ltype) const;
    void gather_strings_shallow(std::vector<DexString*>& lstring) const;
@@ -756,6 +806,9 @@ class DexMethodRef {
    void change(const DexMethodSpec& ref, bool rename_on_collision = false) {
      g_redex->mutate_method(this, ref, rename_on_collision);
    }
+
+   // Set on the methods that compute_reachable_objects() reaches.
+   mutable WalkMark reach_mark;
 };
 
 class DexMethod : public DexMethodRef {
@@ -765,6 +818,12 @@ class DexMethod : public DexMethodRef {
   DexAnnotationSet* m_anno;
   std::unique_ptr<DexCode> m_dex_code;
   std::unique_ptr<IRCode> m_code;
+  // Set while m_dex_code is waiting to be ballooned, see defer_balloon().
+  std::atomic<bool> m_balloon_deferred{false};
+  // The code epoch in which get_code() was last called, see
+  // advance_code_epoch().
+  std::atomic<uint32_t> m_code_epoch{0};
+  static std::atomic<uint32_t> s_code_epoch;
   DexAccessFlags m_access;
   bool m_virtual;
   ParamAnnotations m_param_anno;
@@ -777,6 +836,9 @@ class DexMethod : public DexMethodRef {
  public:
   // Tracks whether this method can be deleted or renamed
   ReferencedState rstate;
+  // Set on methods that are reachable if their class is, see
+  // compute_reachable_objects().
+  mutable WalkMark reach_cond_mark;
 
   // DexMethod retrieval/creation
 
@@ -850,8 +912,22 @@ class DexMethod : public DexMethodRef {
   DexAnnotationSet* get_anno_set() { return m_anno; }
   const DexCode* get_dex_code() const { return m_dex_code.get(); }
   DexCode* get_dex_code() { return m_dex_code.get(); }
-  IRCode* get_code() { return m_code.get(); }
-  const IRCode* get_code() const { return m_code.get(); }
+  IRCode* get_code() {
+    auto epoch = s_code_epoch.load(std::memory_order_relaxed);
+    if (m_code_epoch.load(std::memory_order_relaxed) != epoch) {
+      m_code_epoch.store(epoch, std::memory_order_relaxed);
+    }
+    if (m_balloon_deferred.load(std::memory_order_acquire)) {
+      balloon_deferred();
+    }
+    return m_code.get();
+  }
+  const IRCode* get_code() const {
+    return const_cast<DexMethod*>(this)->get_code();
+  }
+  // The code as it is, without stamping the code epoch or ballooning deferred
+  // code. For tools that look at the program without working on it.
+  IRCode* peek_code() const { return m_code.get(); }
   std::unique_ptr<IRCode> release_code();
   bool is_virtual() const { return m_virtual; }
   DexAccessFlags get_access() const {
@@ -953,6 +1029,33 @@ class DexMethod : public DexMethodRef {
    */
   void balloon();
   void sync();
+
+  /*
+   * Leaves the DexCode in place until get_code() is first called, which then
+   * balloons it. Safe to call get_code() concurrently on such a method.
+   * Methods that are never asked for their code are emitted from their
+   * original DexCode.
+   */
+  void defer_balloon() {
+    if (m_dex_code) {
+      m_balloon_deferred.store(true, std::memory_order_release);
+    }
+  }
+  bool is_balloon_deferred() const {
+    return m_balloon_deferred.load(std::memory_order_acquire);
+  }
+
+  /*
+   * Code epochs let the PassManager tell which methods have not had their
+   * code asked for lately. get_code() stamps a method with the current epoch.
+   */
+  static uint32_t advance_code_epoch() { return ++s_code_epoch; }
+  uint32_t get_code_epoch() const {
+    return m_code_epoch.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void balloon_deferred();
 };
 
 using dexcode_to_offset = std::unordered_map<DexCode*, uint32_t>;
@@ -977,15 +1080,22 @@ class DexClass {
   void load_class_annotations(DexIdx* idx, uint32_t anno_off);
   void load_class_data_item(DexIdx* idx,
                             uint32_t cdi_off,
-                            DexEncodedValueArray* svalues);
+                            DexEncodedValueArray* svalues,
+                            bool balloon);
 
   friend struct ClassCreator;
 
  public:
   ReferencedState rstate;
+  // Set on the classes that compute_reachable_objects() reaches.
+  mutable WalkMark reach_mark;
+  // The class isn't published to g_redex yet; DexLoader does that once all
+  // the classes of the dex are loaded. With `balloon`, the code of the
+  // methods is decoded straight into IR.
   DexClass(DexIdx* idx,
            const dex_class_def* cdef,
-           const std::string& dex_location);
+           const std::string& dex_location,
+           bool balloon);
 
  public:
   const std::vector<DexMethod*>& get_dmethods() const { return m_dmethods; }
@@ -1071,12 +1181,14 @@ class DexClass {
     always_assert_log(
         !m_external, "Unexpected external class %s\n", SHOW(m_self));
     m_super_class = super_class;
+    RedexContext::advance_member_epoch();
   }
 
   void set_interfaces(DexTypeList* intfs) {
     always_assert_log(!m_external,
         "Unexpected external class %s\n", SHOW(m_self));
     m_interfaces = intfs;
+    RedexContext::advance_member_epoch();
   }
 
   void clear_annotations() {
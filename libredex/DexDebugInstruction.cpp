@@ -14,51 +14,73 @@
 #include "DexDebugInstruction.h"
 #include "DexClass.h"
 #include "DexOutput.h"
+#include "RedexContext.h"
 
-void DexDebugOpcodeSetFile::gather_strings(
-    std::vector<DexString*>& lstring) const {
-  if (m_str) lstring.push_back(m_str);
+const DexDebugLocal* DexDebugLocal::make(DexString* name,
+                                         DexType* type,
+                                         DexString* sig) {
+  return g_redex->make_debug_local(name, type, sig);
 }
 
-void DexDebugOpcodeSetFile::encode(DexOutputIdx* dodx, uint8_t*& encdata) {
-  DexDebugInstruction::encode(dodx, encdata);
-  uint32_t fidx = DEX_NO_INDEX;
-  if (m_str) {
-    fidx = dodx->stringidx(m_str);
-  }
-  encdata = write_uleb128p1(encdata, fidx);
-}
-
-void DexDebugOpcodeStartLocal::gather_strings(
+void DexDebugInstruction::gather_strings(
     std::vector<DexString*>& lstring) const {
-  if (m_name) lstring.push_back(m_name);
-  if (m_sig) lstring.push_back(m_sig);
+  switch (m_opcode) {
+  case DBG_SET_FILE:
+    if (m_file) lstring.push_back(m_file);
+    break;
+  case DBG_START_LOCAL:
+  case DBG_START_LOCAL_EXTENDED:
+    if (m_local->name) lstring.push_back(m_local->name);
+    if (m_local->sig) lstring.push_back(m_local->sig);
+    break;
+  default:
+    break;
+  }
 }
 
-void DexDebugOpcodeStartLocal::gather_types(
-    std::vector<DexType*>& ltype) const {
-  if (m_type) ltype.push_back(m_type);
+void DexDebugInstruction::gather_types(std::vector<DexType*>& ltype) const {
+  switch (m_opcode) {
+  case DBG_START_LOCAL:
+  case DBG_START_LOCAL_EXTENDED:
+    if (m_local->type) ltype.push_back(m_local->type);
+    break;
+  default:
+    break;
+  }
 }
 
-void DexDebugOpcodeStartLocal::encode(DexOutputIdx* dodx, uint8_t*& encdata) {
-  DexDebugInstruction::encode(dodx, encdata);
-  uint32_t nidx = DEX_NO_INDEX;
-  uint32_t tidx = DEX_NO_INDEX;
-  if (m_name) {
-    nidx = dodx->stringidx(m_name);
+void DexDebugInstruction::encode(DexOutputIdx* dodx, uint8_t*& encdata) const {
+  *encdata++ = (uint8_t)m_opcode;
+  switch (m_opcode) {
+  case DBG_SET_FILE: {
+    uint32_t fidx = DEX_NO_INDEX;
+    if (m_file) {
+      fidx = dodx->stringidx(m_file);
+    }
+    encdata = write_uleb128p1(encdata, fidx);
+    return;
   }
-  if (m_type) {
-    tidx = dodx->typeidx(m_type);
+  case DBG_START_LOCAL:
+  case DBG_START_LOCAL_EXTENDED: {
+    encdata = write_uleb128(encdata, m_uvalue);
+    uint32_t nidx = DEX_NO_INDEX;
+    uint32_t tidx = DEX_NO_INDEX;
+    if (m_local->name) {
+      nidx = dodx->stringidx(m_local->name);
+    }
+    if (m_local->type) {
+      tidx = dodx->typeidx(m_local->type);
+    }
+    encdata = write_uleb128p1(encdata, nidx);
+    encdata = write_uleb128p1(encdata, tidx);
+    if (m_local->sig) {
+      encdata = write_uleb128p1(encdata, dodx->stringidx(m_local->sig));
+    }
+    return;
   }
-  encdata = write_uleb128p1(encdata, nidx);
-  encdata = write_uleb128p1(encdata, tidx);
-  if (m_sig) {
-    encdata = write_uleb128p1(encdata, dodx->stringidx(m_sig));
+  default:
+    break;
   }
-}
-
-void DexDebugInstruction::encode(DexOutputIdx* dodx, uint8_t*& encdata) {
-  *encdata++ = (uint8_t)m_opcode;
   if (m_signed) {
     encdata = write_sleb128(encdata, m_value);
     return;
@@ -67,41 +89,39 @@ void DexDebugInstruction::encode(DexOutputIdx* dodx, uint8_t*& encdata) {
   encdata = write_uleb128(encdata, m_uvalue);
 }
 
-DexDebugInstruction* DexDebugInstruction::make_instruction(
+DexDebugInstruction DexDebugInstruction::make_instruction(
     DexIdx* idx, const uint8_t** encdata_ptr) {
   auto& encdata = *encdata_ptr;
   uint8_t opcode = *encdata++;
   switch (opcode) {
-  case DBG_END_SEQUENCE:
-    return nullptr;
   case DBG_ADVANCE_PC:
   case DBG_END_LOCAL:
   case DBG_RESTART_LOCAL: {
     uint32_t v = read_uleb128(&encdata);
-    return new DexDebugInstruction((DexDebugItemOpcode)opcode, v);
+    return DexDebugInstruction((DexDebugItemOpcode)opcode, v);
   }
   case DBG_ADVANCE_LINE: {
     int32_t v = (uint32_t)read_sleb128(&encdata);
-    return new DexDebugInstruction((DexDebugItemOpcode)opcode, v);
+    return DexDebugInstruction((DexDebugItemOpcode)opcode, v);
   }
   case DBG_START_LOCAL: {
     uint32_t rnum = read_uleb128(&encdata);
     DexString* name = decode_noindexable_string(idx, encdata);
     DexType* type = decode_noindexable_type(idx, encdata);
-    return new DexDebugOpcodeStartLocal(rnum, name, type);
+    return make_start_local(rnum, name, type);
   }
   case DBG_START_LOCAL_EXTENDED: {
     uint32_t rnum = read_uleb128(&encdata);
     DexString* name = decode_noindexable_string(idx, encdata);
     DexType* type = decode_noindexable_type(idx, encdata);
     DexString* sig = decode_noindexable_string(idx, encdata);
-    return new DexDebugOpcodeStartLocal(rnum, name, type, sig);
+    return make_start_local(rnum, name, type, sig);
   }
   case DBG_SET_FILE: {
     DexString* str = decode_noindexable_string(idx, encdata);
-    return new DexDebugOpcodeSetFile(str);
+    return make_set_file(str);
   }
   default:
-    return new DexDebugInstruction((DexDebugItemOpcode)opcode);
+    return DexDebugInstruction((DexDebugItemOpcode)opcode);
   };
 }
@@ -9,10 +9,9 @@
 
 #pragma once
 
-#include <list>
+#include <vector>
 
 #include "DexDefs.h"
-#include "Gatherable.h"
 #include "Util.h"
 
 class DexIdx;
@@ -20,39 +19,84 @@ class DexOutputIdx;
 class DexString;
 class DexType;
 
-class DexDebugInstruction : public Gatherable {
+/*
+ * The name, type and signature of a local variable started by
+ * DBG_START_LOCAL(_EXTENDED). Like DexPositions, these are interned in the
+ * RedexContext and immutable, so that a DexDebugInstruction only has to hold
+ * a pointer to one.
+ */
+struct DexDebugLocal final {
+  DexString* const name;
+  DexType* const type;
+  // nullptr unless the local was started by DBG_START_LOCAL_EXTENDED.
+  DexString* const sig;
+
+  static const DexDebugLocal* make(DexString* name,
+                                   DexType* type,
+                                   DexString* sig = nullptr);
+
  private:
+  DexDebugLocal(DexString* name, DexType* type, DexString* sig)
+      : name(name), type(type), sig(sig) {}
+
+  friend struct RedexContext;
+};
+
+/*
+ * A debug opcode along with its operands. This is a small value type, with an
+ * opcode, a 32-bit operand and a pointer that is either the file of a
+ * DBG_SET_FILE or the interned local of a DBG_START_LOCAL(_EXTENDED), so it
+ * is held by value in the MethodItemEntries and DexDebugEntries and copied
+ * freely.
+ */
+class DexDebugInstruction final {
+ private:
+  DexDebugItemOpcode m_opcode;
+  bool m_signed;
   union {
     uint32_t m_uvalue;
     int32_t m_value;
   };
-  bool m_signed;
-
- protected:
-  DexDebugItemOpcode m_opcode;
+  union {
+    DexString* m_file;
+    const DexDebugLocal* m_local;
+  };
 
  public:
   DexDebugInstruction(DexDebugItemOpcode op, uint32_t v = DEX_NO_INDEX)
-      : Gatherable() {
-    m_opcode = op;
-    m_uvalue = v;
-    m_signed = false;
-  }
+      : m_opcode(op), m_signed(false), m_uvalue(v), m_local(nullptr) {}
 
-  DexDebugInstruction(DexDebugItemOpcode op, int32_t v) : Gatherable() {
-    m_opcode = op;
-    m_value = v;
-    m_signed = true;
+  DexDebugInstruction(DexDebugItemOpcode op, int32_t v)
+      : m_opcode(op), m_signed(true), m_value(v), m_local(nullptr) {}
+
+  static DexDebugInstruction make_set_file(DexString* file) {
+    DexDebugInstruction insn(DBG_SET_FILE);
+    insn.m_file = file;
+    return insn;
   }
 
- public:
-  virtual void encode(DexOutputIdx* dodx, uint8_t*& encdata);
-  static DexDebugInstruction* make_instruction(DexIdx* idx,
-                                               const uint8_t** encdata_ptr);
-  virtual std::unique_ptr<DexDebugInstruction> clone() const {
-    return std::make_unique<DexDebugInstruction>(*this);
+  static DexDebugInstruction make_start_local(uint32_t rnum,
+                                              DexString* name,
+                                              DexType* type,
+                                              DexString* sig = nullptr) {
+    DexDebugInstruction insn(
+        sig != nullptr ? DBG_START_LOCAL_EXTENDED : DBG_START_LOCAL, rnum);
+    insn.m_local = DexDebugLocal::make(name, type, sig);
+    return insn;
   }
 
+  void encode(DexOutputIdx* dodx, uint8_t*& encdata) const;
+
+  /*
+   * Decodes the next debug opcode. The caller should stop at the
+   * DBG_END_SEQUENCE, which has no operands.
+   */
+  static DexDebugInstruction make_instruction(DexIdx* idx,
+                                              const uint8_t** encdata_ptr);
+
+  void gather_strings(std::vector<DexString*>& lstring) const;
+  void gather_types(std::vector<DexType*>& ltype) const;
+
   DexDebugItemOpcode opcode() const { return m_opcode; }
 
   uint32_t uvalue() const { return m_uvalue; }
@@ -64,58 +108,24 @@ class DexDebugInstruction : public Gatherable {
   void set_uvalue(uint32_t uv) { m_uvalue = uv; }
 
   void set_value(int32_t v) { m_value = v; }
-};
 
-class DexDebugOpcodeSetFile : public DexDebugInstruction {
- private:
-  DexString* m_str;
-
- public:
-  DexDebugOpcodeSetFile(DexString* str) : DexDebugInstruction(DBG_SET_FILE) {
-    m_str = str;
+  // Only for DBG_SET_FILE.
+  DexString* file() const {
+    assert(m_opcode == DBG_SET_FILE);
+    return m_file;
   }
 
-  virtual void encode(DexOutputIdx* dodx, uint8_t*& encdata);
-  virtual void gather_strings(std::vector<DexString*>& lstring) const;
-
-  virtual std::unique_ptr<DexDebugInstruction> clone() const {
-    return std::make_unique<DexDebugOpcodeSetFile>(*this);
-  }
+  // Only for DBG_START_LOCAL(_EXTENDED).
+  DexString* name() const { return local()->name; }
 
-  DexString* file() const { return m_str; }
+  DexType* type() const { return local()->type; }
 
-  void set_file(DexString* file) { m_str = file; }
-};
+  DexString* sig() const { return local()->sig; }
 
-class DexDebugOpcodeStartLocal : public DexDebugInstruction {
  private:
-  DexString* m_name;
-  DexType* m_type;
-  DexString* m_sig;
-
- public:
-  DexDebugOpcodeStartLocal(uint32_t rnum,
-                           DexString* name,
-                           DexType* type,
-                           DexString* sig = nullptr)
-      : DexDebugInstruction(DBG_START_LOCAL, rnum) {
-    m_name = name;
-    m_type = type;
-    m_sig = sig;
-    if (sig) m_opcode = DBG_START_LOCAL_EXTENDED;
+  const DexDebugLocal* local() const {
+    assert(m_opcode == DBG_START_LOCAL ||
+           m_opcode == DBG_START_LOCAL_EXTENDED);
+    return m_local;
   }
-
-  virtual void encode(DexOutputIdx* dodx, uint8_t*& encdata);
-  virtual void gather_strings(std::vector<DexString*>& lstring) const;
-  virtual void gather_types(std::vector<DexType*>& ltype) const;
-
-  virtual std::unique_ptr<DexDebugInstruction> clone() const {
-    return std::make_unique<DexDebugOpcodeStartLocal>(*this);
-  }
-
-  DexString* name() const { return m_name; }
-
-  DexType* type() const { return m_type; }
-
-  DexString* sig() const { return m_sig; }
 };
@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "DexClass.h"
+
+/*
+ * Side tables keyed by the ids that RedexContext gives every DexType,
+ * DexFieldRef and DexMethodRef it makes. Since the ids are dense, a lookup is
+ * an index into a vector rather than the hashing of a pointer. The ids are
+ * plain unsigned integers too, so sets of them can also go into a
+ * PatriciaTreeSet<uint32_t>.
+ *
+ * The tables grow to fit any id they store, so entities made after a table
+ * was created can go in as well. Like for std::vector, writes must not race
+ * with other accesses, but a table that is no longer written to can be read
+ * from any number of threads.
+ */
+template <class Ref, class T>
+class DexIdMap {
+ public:
+  // Returns a default T for anything that was never stored.
+  const T& at(const Ref* ref) const {
+    auto id = ref->get_id();
+    return id < m_values.size() ? m_values[id] : m_default;
+  }
+
+  T& operator[](const Ref* ref) {
+    auto id = ref->get_id();
+    if (id >= m_values.size()) {
+      m_values.resize(id + 1);
+    }
+    return m_values[id];
+  }
+
+  void clear() { m_values.clear(); }
+
+ private:
+  std::vector<T> m_values;
+  T m_default{};
+};
+
+template <class T>
+using TypeIdMap = DexIdMap<DexType, T>;
+template <class T>
+using FieldIdMap = DexIdMap<DexFieldRef, T>;
+template <class T>
+using MethodIdMap = DexIdMap<DexMethodRef, T>;
+
+template <class Ref>
+class DexIdBitSet {
+ public:
+  bool contains(const Ref* ref) const {
+    auto id = ref->get_id();
+    return id / 64 < m_words.size() && (m_words[id / 64] & bit(id)) != 0;
+  }
+
+  // Returns true if ref was not in the set before.
+  bool insert(const Ref* ref) {
+    auto id = ref->get_id();
+    if (id / 64 >= m_words.size()) {
+      m_words.resize(id / 64 + 1);
+    }
+    auto& word = m_words[id / 64];
+    if (word & bit(id)) {
+      return false;
+    }
+    word |= bit(id);
+    return true;
+  }
+
+  void erase(const Ref* ref) {
+    auto id = ref->get_id();
+    if (id / 64 < m_words.size()) {
+      m_words[id / 64] &= ~bit(id);
+    }
+  }
+
+  size_t size() const {
+    size_t result = 0;
+    for (auto word : m_words) {
+      result += __builtin_popcountll(word);
+    }
+    return result;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  // Adds everything in that to this set.
+  void union_with(const DexIdBitSet& that) {
+    if (that.m_words.size() > m_words.size()) {
+      m_words.resize(that.m_words.size());
+    }
+    for (size_t i = 0; i < that.m_words.size(); ++i) {
+      m_words[i] |= that.m_words[i];
+    }
+  }
+
+  void clear() { m_words.clear(); }
+
+ private:
+  static uint64_t bit(uint32_t id) { return uint64_t(1) << (id % 64); }
+
+  std::vector<uint64_t> m_words;
+};
+
+using TypeBitSet = DexIdBitSet<DexType>;
+using FieldBitSet = DexIdBitSet<DexFieldRef>;
+using MethodBitSet = DexIdBitSet<DexMethodRef>;
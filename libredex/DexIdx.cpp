@@ -9,9 +9,12 @@
 
 #include "DexIdx.h"
 
+#include <exception>
+#include <mutex>
 #include <sstream>
 
 #include "DexClass.h"
+#include "WorkQueue.h"
 
 #define INIT_DMAP_ID(TYPE, CACHETYPE)                                   \
   always_assert_log(                                                    \
@@ -38,6 +41,69 @@ DexIdx::~DexIdx() {
   free(m_proto_cache);
 }
 
+namespace {
+
+/*
+ * Calls `decode` on each index below `size`, in chunks on a work queue, and
+ * rethrows the first exception any of them threw, e.g. for an offset out of
+ * range.
+ */
+template <typename Decode>
+void decode_in_chunks(uint32_t size, const Decode& decode) {
+  // Big enough that queueing a chunk costs little next to decoding it.
+  const uint32_t chunk_size = 4096;
+  if (size <= chunk_size) {
+    for (uint32_t i = 0; i < size; ++i) {
+      decode(i);
+    }
+    return;
+  }
+  std::mutex exception_lock;
+  std::exception_ptr exception;
+  auto wq = workqueue_foreach<uint32_t>([&](uint32_t begin) {
+    try {
+      auto end = size - begin < chunk_size ? size : begin + chunk_size;
+      for (uint32_t i = begin; i < end; ++i) {
+        decode(i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(exception_lock);
+      if (!exception) {
+        exception = std::current_exception();
+      }
+    }
+  });
+  for (uint32_t begin = 0; begin < size; begin += chunk_size) {
+    wq.add_item(begin);
+  }
+  wq.run_all();
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+} // namespace
+
+void DexIdx::decode_all() {
+  // Each table only refers to the ones decoded before it, which are complete
+  // by then, so the workers never write to the same cache.
+  decode_in_chunks(m_string_ids_size, [this](uint32_t i) {
+    m_string_cache[i] = get_stringidx_fromdex(i);
+  });
+  decode_in_chunks(m_type_ids_size, [this](uint32_t i) {
+    m_type_cache[i] = get_typeidx_fromdex(i);
+  });
+  decode_in_chunks(m_proto_ids_size, [this](uint32_t i) {
+    m_proto_cache[i] = get_protoidx_fromdex(i);
+  });
+  decode_in_chunks(m_field_ids_size, [this](uint32_t i) {
+    m_field_cache[i] = get_fieldidx_fromdex(i);
+  });
+  decode_in_chunks(m_method_ids_size, [this](uint32_t i) {
+    m_method_cache[i] = get_methodidx_fromdex(i);
+  });
+}
+
 DexString* DexIdx::get_stringidx_fromdex(uint32_t stridx) {
   assert(stridx < m_string_ids_size);
   uint32_t stroff = m_string_ids[stridx].offset;
@@ -47,7 +113,9 @@ DexString* DexIdx::get_stringidx_fromdex(uint32_t stridx) {
   const uint8_t* dstr = m_dexbase + stroff;
   /* Strip off uleb128 size encoding */
   int utfsize = read_uleb128(&dstr);
-  return DexString::make_string((const char*)dstr, utfsize);
+  // The loader keeps the dex mapped for as long as g_redex lives, so the
+  // string can point straight at the NUL-terminated data in the file.
+  return g_redex->make_string_no_copy((const char*)dstr, utfsize);
 }
 
 DexType* DexIdx::get_typeidx_fromdex(uint32_t typeidx) {
@@ -52,6 +52,16 @@ class DexIdx {
   explicit DexIdx(const dex_header* dh);
   ~DexIdx();
 
+  /*
+   * Decodes every entry of the id tables up front, each table in parallel
+   * chunks, and in the order they depend on each other: strings, types,
+   * protos, fields, then methods. Each entry is interned once, and the
+   * getters below only read from then on, so that classes can be decoded
+   * from several threads at once. Without it, the getters fill the caches
+   * as they go, which is only safe from a single thread.
+   */
+  void decode_all();
+
   DexString* get_stringidx(uint32_t stridx) {
     if (m_string_cache[stridx] == nullptr) {
       m_string_cache[stridx] = get_stringidx_fromdex(stridx);
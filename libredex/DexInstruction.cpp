@@ -740,8 +740,10 @@ void DexInstruction::encode(DexOutputIdx* dodx, uint16_t*& insns) {
 
 uint16_t DexInstruction::size() const { return m_count + 1; }
 
-DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
-                                                 const uint16_t** insns_ptr) {
+bool DexInstruction::decode(
+    DexIdx* idx,
+    const uint16_t** insns_ptr,
+    const std::function<void(const DexInstruction&)>& fn) {
   auto& insns = *insns_ptr;
   auto fopcode = static_cast<DexOpcode>(*insns++);
   DexOpcode opcode = static_cast<DexOpcode>(fopcode & 0xff);
@@ -750,17 +752,20 @@ DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
     if (fopcode == FOPCODE_PACKED_SWITCH) {
       int count = (*insns--) * 2 + 4;
       insns += count;
-      return new DexOpcodeData(insns - count, count - 1);
+      fn(DexOpcodeData(insns - count, count - 1));
+      return true;
     } else if (fopcode == FOPCODE_SPARSE_SWITCH) {
       int count = (*insns--) * 4 + 2;
       insns += count;
-      return new DexOpcodeData(insns - count, count - 1);
+      fn(DexOpcodeData(insns - count, count - 1));
+      return true;
     } else if (fopcode == FOPCODE_FILLED_ARRAY) {
       uint16_t ewidth = *insns++;
       uint32_t size = *((uint32_t*)insns);
       int count = (ewidth * size + 1) / 2 + 4;
       insns += count - 2;
-      return new DexOpcodeData(insns - count, count - 1);
+      fn(DexOpcodeData(insns - count, count - 1));
+      return true;
     }
   }
   /* Format 10, fall through for NOP */
@@ -834,7 +839,8 @@ DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
   case DOPCODE_DIV_DOUBLE_2ADDR:
   case DOPCODE_REM_DOUBLE_2ADDR:
   case DOPCODE_ARRAY_LENGTH:
-    return new DexInstruction(fopcode);
+    fn(DexInstruction(fopcode));
+    return true;
   /* Format 20 */
   case DOPCODE_MOVE_FROM16:
   case DOPCODE_MOVE_WIDE_FROM16:
@@ -927,7 +933,8 @@ DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
   case DOPCODE_SHR_INT_LIT8:
   case DOPCODE_USHR_INT_LIT8: {
     uint16_t arg = *insns++;
-    return new DexInstruction(fopcode, arg);
+    fn(DexInstruction(fopcode, arg));
+    return true;
   }
 
   /* Format 30 */
@@ -941,12 +948,14 @@ DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
   case DOPCODE_PACKED_SWITCH:
   case DOPCODE_SPARSE_SWITCH: {
     insns += 2;
-    return new DexInstruction(insns - 3, 2);
+    fn(DexInstruction(insns - 3, 2));
+    return true;
   }
   /* Format 50 */
   case DOPCODE_CONST_WIDE: {
     insns += 4;
-    return new DexInstruction(insns - 5, 4);
+    fn(DexInstruction(insns - 5, 4));
+    return true;
   }
   /* Field ref: */
   case DOPCODE_IGET:
@@ -979,7 +988,8 @@ DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
   case DOPCODE_SPUT_SHORT: {
     uint16_t fidx = *insns++;
     DexFieldRef* field = idx->get_fieldidx(fidx);
-    return new DexOpcodeField(fopcode, field);
+    fn(DexOpcodeField(fopcode, field));
+    return true;
   }
   /* MethodRef: */
   case DOPCODE_INVOKE_VIRTUAL:
@@ -995,19 +1005,22 @@ DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
     uint16_t midx = *insns++;
     uint16_t arg = *insns++;
     DexMethodRef* meth = idx->get_methodidx(midx);
-    return new DexOpcodeMethod(fopcode, meth, arg);
+    fn(DexOpcodeMethod(fopcode, meth, arg));
+    return true;
   }
   /* StringRef: */
   case DOPCODE_CONST_STRING: {
     uint16_t sidx = *insns++;
     DexString* str = idx->get_stringidx(sidx);
-    return new DexOpcodeString(fopcode, str);
+    fn(DexOpcodeString(fopcode, str));
+    return true;
   }
   case DOPCODE_CONST_STRING_JUMBO: {
     uint32_t sidx = *insns++;
     sidx |= (*insns++) << 16;
     DexString* str = idx->get_stringidx(sidx);
-    return new DexOpcodeString(fopcode, str);
+    fn(DexOpcodeString(fopcode, str));
+    return true;
   }
   case DOPCODE_CONST_CLASS:
   case DOPCODE_CHECK_CAST:
@@ -1016,21 +1029,32 @@ DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
   case DOPCODE_NEW_ARRAY: {
     uint16_t tidx = *insns++;
     DexType* type = idx->get_typeidx(tidx);
-    return new DexOpcodeType(fopcode, type);
+    fn(DexOpcodeType(fopcode, type));
+    return true;
   }
   case DOPCODE_FILLED_NEW_ARRAY:
   case DOPCODE_FILLED_NEW_ARRAY_RANGE: {
     uint16_t tidx = *insns++;
     uint16_t arg = *insns++;
     DexType* type = idx->get_typeidx(tidx);
-    return new DexOpcodeType(fopcode, type, arg);
+    fn(DexOpcodeType(fopcode, type, arg));
+    return true;
   }
   default:
     fprintf(stderr, "Unknown opcode %02x\n", opcode);
-    return nullptr;
+    return false;
   }
 }
 
+DexInstruction* DexInstruction::make_instruction(DexIdx* idx,
+                                                 const uint16_t** insns_ptr) {
+  DexInstruction* result = nullptr;
+  decode(idx, insns_ptr, [&result](const DexInstruction& insn) {
+    result = insn.clone();
+  });
+  return result;
+}
+
 DexInstruction* DexInstruction::make_instruction(DexOpcode op) {
   switch (op) {
   /* Field ref: */
@@ -11,6 +11,7 @@
 
 #include <assert.h>
 #include <cstring>
+#include <functional>
 #include <list>
 #include <string>
 #include <utility>
@@ -82,6 +83,14 @@ class DexInstruction : public Gatherable {
  public:
   static DexInstruction* make_instruction(DexIdx* idx,
                                           const uint16_t** insns_ptr);
+  /*
+   * Same as make_instruction(), but the instruction lives on the stack for
+   * the duration of the call to `fn` only, so that a caller that only reads
+   * it allocates nothing. Returns false for an unknown opcode.
+   */
+  static bool decode(DexIdx* idx,
+                     const uint16_t** insns_ptr,
+                     const std::function<void(const DexInstruction&)>& fn);
   /* Creates the right subclass of DexInstruction for the given opcode */
   static DexInstruction* make_instruction(DexOpcode);
   virtual void encode(DexOutputIdx* dodx, uint16_t*& insns);
@@ -9,6 +9,7 @@
 
 #include <boost/iostreams/device/mapped_file.hpp>
 
+#include "AsyncIO.h"
 #include "DexLoader.h"
 #include "DexDefs.h"
 #include "DexAccess.h"
@@ -22,17 +23,22 @@
 #include <vector>
 
 class DexLoader {
-  DexIdx* m_idx;
+  DexIdx* m_idx{nullptr};
   const dex_class_def* m_class_defs;
   DexClasses* m_classes;
-  boost::iostreams::mapped_file m_file;
+  // Shared with g_redex, since the DexStrings we load point into the mapping.
+  std::shared_ptr<boost::iostreams::mapped_file> m_file;
   std::string m_dex_location;
+  // Whether to decode the code of the methods straight into IR.
+  bool m_balloon;
 
  public:
-  explicit DexLoader(const char* location) : m_dex_location(location) {}
+  DexLoader(const char* location, bool balloon)
+      : m_file(std::make_shared<boost::iostreams::mapped_file>()),
+        m_dex_location(location),
+        m_balloon(balloon) {}
   ~DexLoader() {
     if (m_idx) delete m_idx;
-    if (m_file.is_open()) m_file.close();
   }
   DexClasses load_dex(const char* location, dex_stats_t* stats);
   void load_dex_class(int num);
@@ -80,6 +86,18 @@ static std::vector<std::exception_ptr> exc_reducer(
   }
 }
 
+// The methods loaded with balloon = true have no DexCode. Their count leaves
+// out the nops and payloads, which the IR doesn't keep.
+static size_t num_instructions(const DexMethod* method) {
+  if (auto code = method->get_dex_code()) {
+    return code->get_instructions().size();
+  }
+  if (auto code = method->peek_code()) {
+    return code->count_opcodes();
+  }
+  return 0;
+}
+
 void DexLoader::gather_input_stats(dex_stats_t* stats, const dex_header* dh) {
   stats->num_types += dh->type_ids_size;
   stats->num_classes += dh->class_defs_size;
@@ -145,16 +163,10 @@ void DexLoader::gather_input_stats(dex_stats_t* stats, const dex_header* dh) {
     stats->num_methods +=
         clz->get_vmethods().size() + clz->get_dmethods().size();
     for (auto* meth : clz->get_vmethods()) {
-      DexCode* code = meth->get_dex_code();
-      if (code) {
-        stats->num_instructions += code->get_instructions().size();
-      }
+      stats->num_instructions += num_instructions(meth);
     }
     for (auto* meth : clz->get_dmethods()) {
-      DexCode* code = meth->get_dex_code();
-      if (code) {
-        stats->num_instructions += code->get_instructions().size();
-      }
+      stats->num_instructions += num_instructions(meth);
     }
   }
   for (uint32_t meth_idx = 0; meth_idx < dh->method_ids_size; ++meth_idx) {
@@ -168,28 +180,31 @@ void DexLoader::gather_input_stats(dex_stats_t* stats, const dex_header* dh) {
 
 void DexLoader::load_dex_class(int num) {
   const dex_class_def* cdef = m_class_defs + num;
-  DexClass* dc = new DexClass(m_idx, cdef, m_dex_location);
+  DexClass* dc = new DexClass(m_idx, cdef, m_dex_location, m_balloon);
   m_classes->at(num) = dc;
 }
 
 DexClasses DexLoader::load_dex(const char* location, dex_stats_t* stats) {
-  m_file.open(location, boost::iostreams::mapped_file::readonly);
-  if (!m_file.is_open()) {
+  m_file->open(location, boost::iostreams::mapped_file::readonly);
+  if (!m_file->is_open()) {
     fprintf(stderr, "error: cannot create memory-mapped file: %s\n", location);
     exit(EXIT_FAILURE);
   }
-  auto dh = reinterpret_cast<const dex_header*>(m_file.const_data());
-  validate_dex_header(dh, m_file.size());
+  g_redex->keep_alive(m_file);
+  auto dh = reinterpret_cast<const dex_header*>(m_file->const_data());
+  validate_dex_header(dh, m_file->size());
   if (dh->class_defs_size == 0) {
     return DexClasses(0);
   }
   m_idx = new DexIdx(dh);
+  // The classes below are decoded in parallel, and only read the tables.
+  m_idx->decode_all();
   auto off = (uint64_t)dh->class_defs_off;
   auto limit = off + dh->class_defs_size * sizeof(dex_class_def);
-  always_assert_log(off < m_file.size(), "class_defs_off out of range");
-  always_assert_log(limit <= m_file.size(), "invalid class_defs_size");
+  always_assert_log(off < m_file->size(), "class_defs_off out of range");
+  always_assert_log(limit <= m_file->size(), "invalid class_defs_size");
   m_class_defs =
-      reinterpret_cast<const dex_class_def*>(m_file.const_data() + off);
+      reinterpret_cast<const dex_class_def*>(m_file->const_data() + off);
   DexClasses classes(dh->class_defs_size);
   m_classes = &classes;
 
@@ -216,6 +231,12 @@ DexClasses DexLoader::load_dex(const char* location, dex_stats_t* stats) {
   return classes;
 }
 
+static void publish_classes(const DexClasses& classes) {
+  for (auto* cls : classes) {
+    g_redex->publish_class(cls);
+  }
+}
+
 static void mt_balloon(DexMethod* method) { method->balloon(); }
 
 static void balloon_all(const Scope& scope) {
@@ -237,12 +258,46 @@ DexClasses load_classes_from_dex(const char* location,
                                  dex_stats_t* stats,
                                  bool balloon) {
   TRACE(MAIN, 1, "Loading classes from dex from %s\n", location);
-  DexLoader dl(location);
+  // With balloon, the methods come out of the loader ballooned already.
+  DexLoader dl(location, balloon);
   auto classes = dl.load_dex(location, stats);
-  if (balloon) {
-    balloon_all(classes);
-  }
+  publish_classes(classes);
   return classes;
 }
 
+std::vector<DexClasses> load_classes_from_dexes(
+    const std::vector<std::string>& locations,
+    std::vector<dex_stats_t>* stats,
+    bool balloon) {
+  std::vector<DexClasses> dexen(locations.size());
+  stats->assign(locations.size(), dex_stats_t());
+  // Each file still loads its classes on a queue of its own, nested in this
+  // one, which is mostly useful to the files that are much bigger than the
+  // others.
+  // Have the kernel read all the files ahead, so that those loaded last are
+  // already in memory when a worker gets to them.
+  for (const auto& location : locations) {
+    async_io::prefetch_file(location);
+  }
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    const auto& location = locations[i];
+    TRACE(MAIN, 1, "Loading classes from dex from %s\n", location.c_str());
+    DexLoader dl(location.c_str(), balloon);
+    dexen[i] = dl.load_dex(location.c_str(), &stats->at(i));
+  });
+  for (size_t i = 0; i < locations.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  for (const auto& classes : dexen) {
+    publish_classes(classes);
+  }
+  return dexen;
+}
+
 void balloon_for_test(const Scope& scope) { balloon_all(scope); }
+
+void defer_balloon_all(const Scope& scope) {
+  walk::methods(scope, [](DexMethod* m) { m->defer_balloon(); });
+}
@@ -9,6 +9,9 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "DexClass.h"
 #include "DexIdx.h"
 #include "DexDefs.h"
@@ -17,4 +20,21 @@
 DexClasses load_classes_from_dex(const char* location, bool balloon = true);
 DexClasses load_classes_from_dex(const char* location, dex_stats_t* stats, bool balloon = true);
 
+/*
+ * Loads several dex files concurrently. Their classes are only published to
+ * g_redex once all of them are loaded, one file after another in the order
+ * of `locations`, so duplicate classes are found and reported exactly as if
+ * the files had been loaded one by one. `stats` gets one entry per file.
+ */
+std::vector<DexClasses> load_classes_from_dexes(
+    const std::vector<std::string>& locations,
+    std::vector<dex_stats_t>* stats,
+    bool balloon = true);
+
 void balloon_for_test(const Scope& scope);
+
+/*
+ * Instead of ballooning all the methods up front, balloon each one when its
+ * code is first asked for. Load the classes with balloon = false first.
+ */
+void defer_balloon_all(const Scope& scope);
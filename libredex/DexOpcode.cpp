@@ -13,7 +13,29 @@
 
 namespace dex_opcode {
 
-OpcodeFormat format(DexOpcode opcode) {
+namespace {
+
+/*
+ * The switches below define the properties of the opcodes. They are evaluated
+ * at compile time to fill in the table that the functions further down look
+ * up.
+ */
+namespace switches {
+
+constexpr bool is_valid(DexOpcode op) {
+  switch (op) {
+#define OP(op, ...) case DOPCODE_##op:
+    DOPS
+#undef OP
+  case FOPCODE_PACKED_SWITCH:
+  case FOPCODE_SPARSE_SWITCH:
+  case FOPCODE_FILLED_ARRAY:
+    return true;
+  }
+  return false;
+}
+
+constexpr OpcodeFormat format(DexOpcode opcode) {
   switch (opcode) {
 #define OP(op, code, fmt, ...) \
   case code:                   \
@@ -29,11 +51,7 @@ OpcodeFormat format(DexOpcode opcode) {
   always_assert_log(false, "Unexpected opcode 0x%x", opcode);
 }
 
-bool dest_is_src(DexOpcode op) {
-  return format(op) == FMT_f12x_2;
-}
-
-bool has_literal(DexOpcode op) {
+constexpr bool has_literal(DexOpcode op) {
   auto fmt = format(op);
   switch (fmt) {
   case FMT_f11n:
@@ -50,7 +68,7 @@ bool has_literal(DexOpcode op) {
   not_reached();
 }
 
-bool has_offset(DexOpcode op) {
+constexpr bool has_offset(DexOpcode op) {
   switch (format(op)) {
   case FMT_f10t:
   case FMT_f20t:
@@ -65,14 +83,14 @@ bool has_offset(DexOpcode op) {
   not_reached();
 }
 
-bool has_range(DexOpcode op) {
+constexpr bool has_range(DexOpcode op) {
   auto fmt = format(op);
   if (fmt == FMT_f3rc || fmt == FMT_f5rc)
     return true;
   return false;
 }
 
-bool is_commutative(DexOpcode op) {
+constexpr bool is_commutative(DexOpcode op) {
   return op == DOPCODE_ADD_INT || op == DOPCODE_MUL_INT ||
          (op >= DOPCODE_AND_INT && op <= DOPCODE_XOR_INT) ||
          op == DOPCODE_ADD_LONG || op == DOPCODE_MUL_LONG ||
@@ -81,7 +99,7 @@ bool is_commutative(DexOpcode op) {
          op == DOPCODE_ADD_DOUBLE || op == DOPCODE_MUL_DOUBLE;
 }
 
-bool is_branch(DexOpcode op) {
+constexpr bool is_branch(DexOpcode op) {
   switch (op) {
   case DOPCODE_PACKED_SWITCH:
   case DOPCODE_SPARSE_SWITCH:
@@ -106,7 +124,7 @@ bool is_branch(DexOpcode op) {
   }
 }
 
-bool is_conditional_branch(DexOpcode op) {
+constexpr bool is_conditional_branch(DexOpcode op) {
   switch (op) {
   case DOPCODE_IF_EQ:
   case DOPCODE_IF_NE:
@@ -126,7 +144,7 @@ bool is_conditional_branch(DexOpcode op) {
   }
 }
 
-bool is_goto(DexOpcode op) {
+constexpr bool is_goto(DexOpcode op) {
   switch (op) {
   case DOPCODE_GOTO_32:
   case DOPCODE_GOTO_16:
@@ -137,6 +155,214 @@ bool is_goto(DexOpcode op) {
   }
 }
 
+constexpr unsigned dests_size(DexOpcode op) {
+  switch (format(op)) {
+  case FMT_f00x:
+  case FMT_f10x:
+  case FMT_f11x_s:
+  case FMT_f10t:
+  case FMT_f20t:
+  case FMT_f21t:
+  case FMT_f21c_s:
+  case FMT_f23x_s:
+  case FMT_f22t:
+  case FMT_f22c_s:
+  case FMT_f30t:
+  case FMT_f31t:
+  case FMT_f35c:
+  case FMT_f3rc:
+  case FMT_f41c_s:
+  case FMT_f52c_s:
+  case FMT_f5rc:
+  case FMT_f57c:
+  case FMT_fopcode:
+    return 0;
+  case FMT_f12x:
+  case FMT_f12x_2:
+  case FMT_f11n:
+  case FMT_f11x_d:
+  case FMT_f22x:
+  case FMT_f21s:
+  case FMT_f21h:
+  case FMT_f21c_d:
+  case FMT_f23x_d:
+  case FMT_f22b:
+  case FMT_f22s:
+  case FMT_f22c_d:
+  case FMT_f32x:
+  case FMT_f31i:
+  case FMT_f31c:
+  case FMT_f51l:
+  case FMT_f41c_d:
+  case FMT_f52c_d:
+  case FMT_iopcode:
+    return 1;
+  case FMT_f20bc:
+  case FMT_f22cs:
+  case FMT_f35ms:
+  case FMT_f35mi:
+  case FMT_f3rms:
+  case FMT_f3rmi:
+    always_assert_log(false, "Unimplemented opcode `%s'", SHOW(op));
+  }
+  not_reached();
+}
+
+constexpr unsigned min_srcs_size(DexOpcode op) {
+  switch (format(op)) {
+  case FMT_f00x:
+  case FMT_f10x:
+  case FMT_f11n:
+  case FMT_f11x_d:
+  case FMT_f10t:
+  case FMT_f20t:
+  case FMT_f21s:
+  case FMT_f21h:
+  case FMT_f21c_d:
+  case FMT_f30t:
+  case FMT_f31i:
+  case FMT_f31c:
+  case FMT_f3rc:
+  case FMT_f51l:
+  case FMT_f5rc:
+  case FMT_f41c_d:
+  case FMT_fopcode:
+  case FMT_iopcode:
+    return 0;
+  case FMT_f12x:
+  case FMT_f11x_s:
+  case FMT_f22x:
+  case FMT_f21t:
+  case FMT_f21c_s:
+  case FMT_f22b:
+  case FMT_f22s:
+  case FMT_f22c_d:
+  case FMT_f32x:
+  case FMT_f31t:
+  case FMT_f41c_s:
+  case FMT_f52c_d:
+    return 1;
+  case FMT_f12x_2:
+  case FMT_f23x_d:
+  case FMT_f22t:
+  case FMT_f22c_s:
+  case FMT_f52c_s:
+    return 2;
+  case FMT_f23x_s:
+    return 3;
+  case FMT_f35c:
+  case FMT_f57c:
+    return 0;
+  case FMT_f20bc:
+  case FMT_f22cs:
+  case FMT_f35ms:
+  case FMT_f35mi:
+  case FMT_f3rms:
+  case FMT_f3rmi:
+    always_assert_log(false, "Unimplemented opcode `%s'", SHOW(op));
+  }
+  not_reached();
+}
+
+} // namespace switches
+
+constexpr impl::Properties compute_properties(DexOpcode op) {
+  impl::Properties props{};
+  props.valid = true;
+  props.format = switches::format(op);
+  props.dests_size = switches::dests_size(op);
+  props.min_srcs_size = switches::min_srcs_size(op);
+  props.has_literal = switches::has_literal(op);
+  props.has_offset = switches::has_offset(op);
+  props.has_range = switches::has_range(op);
+  props.is_commutative = switches::is_commutative(op);
+  props.is_branch = switches::is_branch(op);
+  props.is_conditional_branch = switches::is_conditional_branch(op);
+  props.is_goto = switches::is_goto(op);
+  return props;
+}
+
+// The opcodes proper fit in a byte. The fopcodes are handled separately.
+constexpr size_t TABLE_SIZE = 0x100;
+
+struct Table {
+  impl::Properties entries[TABLE_SIZE];
+};
+
+constexpr Table make_table() {
+  Table table{};
+  for (size_t i = 0; i < TABLE_SIZE; ++i) {
+    auto op = static_cast<DexOpcode>(i);
+    if (switches::is_valid(op)) {
+      table.entries[i] = compute_properties(op);
+    }
+  }
+  return table;
+}
+
+constexpr Table s_table = make_table();
+
+// All the fopcodes share their properties.
+constexpr impl::Properties s_fopcode_properties =
+    compute_properties(FOPCODE_PACKED_SWITCH);
+
+constexpr impl::Properties s_invalid_properties{};
+
+// Returns s_invalid_properties for opcodes that don't exist.
+const impl::Properties& lookup(DexOpcode op) {
+  if (op < TABLE_SIZE) {
+    return s_table.entries[op];
+  }
+  return is_fopcode(op) ? s_fopcode_properties : s_invalid_properties;
+}
+
+} // namespace
+
+namespace impl {
+
+const Properties& properties(DexOpcode op) {
+  const auto& props = lookup(op);
+  always_assert_log(props.valid, "Unexpected opcode 0x%x", op);
+  return props;
+}
+
+Properties properties_from_switches(DexOpcode op) {
+  always_assert_log(switches::is_valid(op), "Unexpected opcode 0x%x", op);
+  return compute_properties(op);
+}
+
+} // namespace impl
+
+OpcodeFormat format(DexOpcode op) { return impl::properties(op).format; }
+
+bool has_literal(DexOpcode op) { return impl::properties(op).has_literal; }
+
+bool has_offset(DexOpcode op) { return impl::properties(op).has_offset; }
+
+bool has_range(DexOpcode op) { return impl::properties(op).has_range; }
+
+// The predicates below used to answer false for opcodes that don't exist,
+// rather than fail.
+bool is_commutative(DexOpcode op) { return lookup(op).is_commutative; }
+
+bool is_branch(DexOpcode op) { return lookup(op).is_branch; }
+
+bool is_conditional_branch(DexOpcode op) {
+  return lookup(op).is_conditional_branch;
+}
+
+bool is_goto(DexOpcode op) { return lookup(op).is_goto; }
+
+unsigned dests_size(DexOpcode op) { return impl::properties(op).dests_size; }
+
+unsigned min_srcs_size(DexOpcode op) {
+  return impl::properties(op).min_srcs_size;
+}
+
+bool dest_is_src(DexOpcode op) {
+  return format(op) == FMT_f12x_2;
+}
+
 DexOpcode invert_conditional_branch(DexOpcode op) {
   switch (op) {
   case DOPCODE_IF_EQ:
@@ -268,113 +494,4 @@ bit_width_t dest_bit_width(DexOpcode op) {
   not_reached();
 }
 
-unsigned dests_size(DexOpcode op) {
-  switch (dex_opcode::format(op)) {
-  case FMT_f00x:
-  case FMT_f10x:
-  case FMT_f11x_s:
-  case FMT_f10t:
-  case FMT_f20t:
-  case FMT_f21t:
-  case FMT_f21c_s:
-  case FMT_f23x_s:
-  case FMT_f22t:
-  case FMT_f22c_s:
-  case FMT_f30t:
-  case FMT_f31t:
-  case FMT_f35c:
-  case FMT_f3rc:
-  case FMT_f41c_s:
-  case FMT_f52c_s:
-  case FMT_f5rc:
-  case FMT_f57c:
-  case FMT_fopcode:
-    return 0;
-  case FMT_f12x:
-  case FMT_f12x_2:
-  case FMT_f11n:
-  case FMT_f11x_d:
-  case FMT_f22x:
-  case FMT_f21s:
-  case FMT_f21h:
-  case FMT_f21c_d:
-  case FMT_f23x_d:
-  case FMT_f22b:
-  case FMT_f22s:
-  case FMT_f22c_d:
-  case FMT_f32x:
-  case FMT_f31i:
-  case FMT_f31c:
-  case FMT_f51l:
-  case FMT_f41c_d:
-  case FMT_f52c_d:
-  case FMT_iopcode:
-    return 1;
-  case FMT_f20bc:
-  case FMT_f22cs:
-  case FMT_f35ms:
-  case FMT_f35mi:
-  case FMT_f3rms:
-  case FMT_f3rmi:
-    always_assert_log(false, "Unimplemented opcode `%s'", SHOW(op));
-  }
-  not_reached();
-}
-
-unsigned min_srcs_size(DexOpcode op) {
-  switch (dex_opcode::format(op)) {
-  case FMT_f00x:
-  case FMT_f10x:
-  case FMT_f11n:
-  case FMT_f11x_d:
-  case FMT_f10t:
-  case FMT_f20t:
-  case FMT_f21s:
-  case FMT_f21h:
-  case FMT_f21c_d:
-  case FMT_f30t:
-  case FMT_f31i:
-  case FMT_f31c:
-  case FMT_f3rc:
-  case FMT_f51l:
-  case FMT_f5rc:
-  case FMT_f41c_d:
-  case FMT_fopcode:
-  case FMT_iopcode:
-    return 0;
-  case FMT_f12x:
-  case FMT_f11x_s:
-  case FMT_f22x:
-  case FMT_f21t:
-  case FMT_f21c_s:
-  case FMT_f22b:
-  case FMT_f22s:
-  case FMT_f22c_d:
-  case FMT_f32x:
-  case FMT_f31t:
-  case FMT_f41c_s:
-  case FMT_f52c_d:
-    return 1;
-  case FMT_f12x_2:
-  case FMT_f23x_d:
-  case FMT_f22t:
-  case FMT_f22c_s:
-  case FMT_f52c_s:
-    return 2;
-  case FMT_f23x_s:
-    return 3;
-  case FMT_f35c:
-  case FMT_f57c:
-    return 0;
-  case FMT_f20bc:
-  case FMT_f22cs:
-  case FMT_f35ms:
-  case FMT_f35mi:
-  case FMT_f3rms:
-  case FMT_f3rmi:
-    always_assert_log(false, "Unimplemented opcode `%s'", SHOW(op));
-  }
-  not_reached();
-}
-
 } // namespace dex_opcode
@@ -365,4 +365,32 @@ inline bool is_sput(DexOpcode op) {
   return op >= DOPCODE_SPUT && op <= DOPCODE_SPUT_SHORT;
 }
 
+namespace impl {
+
+/*
+ * The properties of an opcode, as looked up by the functions above. They are
+ * kept in a table that is generated at compile time from the switches in
+ * DexOpcode.cpp.
+ */
+struct Properties {
+  bool valid{false};
+  OpcodeFormat format{FMT_f00x};
+  uint8_t dests_size{0};
+  uint8_t min_srcs_size{0};
+  bool has_literal{false};
+  bool has_offset{false};
+  bool has_range{false};
+  bool is_commutative{false};
+  bool is_branch{false};
+  bool is_conditional_branch{false};
+  bool is_goto{false};
+};
+
+const Properties& properties(DexOpcode);
+
+// Evaluates the switches that the table is generated from, for testing.
+Properties properties_from_switches(DexOpcode);
+
+} // namespace impl
+
 } // namespace dex_opcode
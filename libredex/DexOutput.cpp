@@ -8,6 +8,7 @@
  */
 
 #include <algorithm>
+#include <iterator>
 #include <memory>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -16,6 +17,8 @@
 #include <unordered_set>
 #include <functional>
 #include <exception>
+#include <fstream>
+#include <future>
 #include <assert.h>
 
 #ifdef _MSC_VER
@@ -29,13 +32,17 @@
 #define O_CREAT _O_CREAT
 #define O_TRUNC _O_TRUNC
 #define O_WRONLY _O_WRONLY
+#else
+#include <sys/mman.h>
 #endif
 
+#include "AsyncIO.h"
 #include "Debug.h"
 #include "DexClass.h"
 #include "DexOutput.h"
 #include "DexUtil.h"
 #include "IRCode.h"
+#include "InstructionLowering.h"
 #include "Pass.h"
 #include "Resolver.h"
 #include "Sha1.h"
@@ -43,6 +50,8 @@
 #include "Walkers.h"
 #include "WorkQueue.h"
 
+#include <locator_table.h>
+
 /*
  * For adler32...
  */
@@ -116,6 +125,80 @@ std::vector<DexString*> GatheredTypes::keep_cls_strings_together_emitlist() {
         compare_dexstrings));
 }
 
+void GatheredTypes::number_profiled_method_strings(
+    const MethodOrder& order,
+    std::unordered_map<const DexString*, unsigned int>& strings) {
+  // Number the strings of the profiled methods in the order that those run,
+  // so that the string data they touch ends up next to each other.
+  std::vector<DexMethod*> profiled;
+  for (auto meth : get_dexmethod_emitlist()) {
+    if (order.count(meth)) {
+      profiled.push_back(meth);
+    }
+  }
+  sort_dexmethod_emitlist_method_profile_order(profiled, order);
+  unsigned int index = strings.size();
+  for (auto meth : profiled) {
+    std::vector<DexString*> method_strings;
+    meth->gather_strings(method_strings);
+    for (auto s : method_strings) {
+      if (!strings.count(s)) {
+        strings[s] = index++;
+      }
+    }
+  }
+  TRACE(CUSTOMSORT, 1, "found %lu strings in %lu profiled methods\n",
+      strings.size(),
+      profiled.size());
+}
+
+std::vector<DexString*>
+GatheredTypes::get_method_profile_order_dexstring_emitlist(
+    const MethodOrder& order) {
+  std::unordered_map<const DexString*, unsigned int> profile_strings;
+  number_profiled_method_strings(order, profile_strings);
+  return get_dexstring_emitlist(CustomSort<DexString, cmp_dstring>(
+        profile_strings,
+        compare_dexstrings));
+}
+
+std::vector<DexString*> GatheredTypes::get_coldstart_dexstring_emitlist(
+    const ClassOrder& classes,
+    const MethodOrder& methods,
+    std::unordered_set<const DexString*>* startup_strings) {
+  // Loading a class resolves the types it refers to, so those names come
+  // first, in class load order. The strings of the methods follow.
+  std::vector<DexClass*> coldstart_classes;
+  for (auto cls : *m_classes) {
+    if (classes.count(cls->get_type())) {
+      coldstart_classes.push_back(cls);
+    }
+  }
+  std::stable_sort(coldstart_classes.begin(), coldstart_classes.end(),
+    [&](const DexClass* a, const DexClass* b) {
+      return classes.at(a->get_type()) < classes.at(b->get_type());
+    }
+  );
+  std::unordered_map<const DexString*, unsigned int> coldstart_strings;
+  unsigned int index = 0;
+  for (auto cls : coldstart_classes) {
+    std::vector<DexType*> cls_types;
+    cls->gather_types(cls_types);
+    for (auto t : cls_types) {
+      if (!coldstart_strings.count(t->get_name())) {
+        coldstart_strings[t->get_name()] = index++;
+      }
+    }
+  }
+  number_profiled_method_strings(methods, coldstart_strings);
+  for (const auto& p : coldstart_strings) {
+    startup_strings->insert(p.first);
+  }
+  return get_dexstring_emitlist(CustomSort<DexString, cmp_dstring>(
+        coldstart_strings,
+        compare_dexstrings));
+}
+
 std::vector<DexMethod*> GatheredTypes::get_dexmethod_emitlist() {
   std::vector<DexMethod*> methlist;
   for (auto cls : *m_classes) {
@@ -152,6 +235,13 @@ void GatheredTypes::sort_dexmethod_emitlist_clinit_order(
   );
 }
 
+void GatheredTypes::sort_dexmethod_emitlist_method_profile_order(
+    std::vector<DexMethod*>& lmeth, const MethodOrder& order) {
+  std::stable_sort(lmeth.begin(), lmeth.end(),
+    CustomSort<DexMethod, cmp_dmethod>(order, compare_dexmethods)
+  );
+}
+
 DexOutputIdx* GatheredTypes::get_dodx(const uint8_t* base) {
   /*
    * These are symbol table indices.  Symbols which are used
@@ -309,34 +399,153 @@ void GatheredTypes::build_method_map() {
   }
 }
 
-void GatheredTypes::gather_components() {
-  // Gather references reachable from each class.
-  for (auto const& cls : *m_classes) {
-    cls->gather_strings(m_lstring);
-    cls->gather_types(m_ltype);
-    cls->gather_fields(m_lfield);
-    cls->gather_methods(m_lmethod);
-  }
+namespace {
 
-  // Remove duplicates to speed up the later loops.
-  sort_unique(m_lstring);
-  sort_unique(m_ltype);
+// Classes are gathered in chunks of this many, so that each work item does
+// enough to be worth scheduling but a big dex still splits evenly.
+constexpr size_t kGatherChunkSize = 64;
+
+struct gathered_refs {
+  std::vector<DexString*> strings;
+  std::vector<DexType*> types;
+  std::vector<DexFieldRef*> fields;
+  std::vector<DexMethodRef*> methods;
+};
 
-  // Gather types and strings needed for field and method refs.
-  sort_unique(m_lmethod);
-  for (auto meth : m_lmethod) {
-    meth->gather_types_shallow(m_ltype);
-    meth->gather_strings_shallow(m_lstring);
+/*
+ * Merges vectors that sort_unique() has already been applied to into the
+ * first of them, keeping the result sorted and free of duplicates.
+ */
+template <class T>
+void merge_unique(std::vector<std::vector<T>*>& parts) {
+  // Merge pairwise so that every element is only copied log(n) times.
+  for (size_t step = 1; step < parts.size(); step *= 2) {
+    for (size_t i = 0; i + step < parts.size(); i += 2 * step) {
+      auto& into = *parts[i];
+      auto& from = *parts[i + step];
+      std::vector<T> merged;
+      merged.reserve(into.size() + from.size());
+      std::set_union(into.begin(),
+                     into.end(),
+                     from.begin(),
+                     from.end(),
+                     std::back_inserter(merged),
+                     std::less<T>());
+      into.swap(merged);
+      std::vector<T>().swap(from);
+    }
   }
+}
 
-  sort_unique(m_lfield);
-  for (auto field : m_lfield) {
-    field->gather_types_shallow(m_ltype);
-    field->gather_strings_shallow(m_lstring);
+/*
+ * Runs gather on each chunk of items in parallel, applies sort_unique() to
+ * what each chunk found and merges the chunks into `out`, which must already
+ * have been applied sort_unique() to.
+ */
+template <class Item>
+void gather_in_parallel(
+    const std::vector<Item>& items,
+    const std::function<void(Item, gathered_refs&)>& gather,
+    gathered_refs& out) {
+  if (items.empty()) {
+    return;
+  }
+  size_t num_chunks = (items.size() + kGatherChunkSize - 1) / kGatherChunkSize;
+  std::vector<gathered_refs> chunks(num_chunks);
+  auto wq = workqueue_foreach<size_t>([&](size_t chunk) {
+    auto& refs = chunks[chunk];
+    auto end = std::min(items.size(), (chunk + 1) * kGatherChunkSize);
+    for (size_t i = chunk * kGatherChunkSize; i < end; ++i) {
+      gather(items[i], refs);
+    }
+    sort_unique(refs.strings);
+    sort_unique(refs.types);
+    sort_unique(refs.fields);
+    sort_unique(refs.methods);
+  });
+  for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+    wq.add_item(chunk);
   }
+  wq.run_all();
+
+  std::vector<std::vector<DexString*>*> strings{&out.strings};
+  std::vector<std::vector<DexType*>*> types{&out.types};
+  std::vector<std::vector<DexFieldRef*>*> fields{&out.fields};
+  std::vector<std::vector<DexMethodRef*>*> methods{&out.methods};
+  for (auto& refs : chunks) {
+    strings.push_back(&refs.strings);
+    types.push_back(&refs.types);
+    fields.push_back(&refs.fields);
+    methods.push_back(&refs.methods);
+  }
+  // The four kinds of refs don't depend on each other, so merge them at the
+  // same time.
+  auto merge_wq = workqueue_foreach<int>(
+      [&](int kind) {
+        switch (kind) {
+        case 0:
+          merge_unique(strings);
+          break;
+        case 1:
+          merge_unique(types);
+          break;
+        case 2:
+          merge_unique(fields);
+          break;
+        case 3:
+          merge_unique(methods);
+          break;
+        }
+      },
+      std::min(4u, workqueue_default_num_threads()));
+  for (int kind = 0; kind < 4; ++kind) {
+    merge_wq.add_item(kind);
+  }
+  merge_wq.run_all();
+}
+
+} // namespace
+
+void GatheredTypes::gather_components() {
+  gathered_refs refs;
+  refs.strings.swap(m_lstring);
+  sort_unique(refs.strings);
+
+  // Gather references reachable from each class.
+  const auto& classes = *m_classes;
+  gather_in_parallel<DexClass*>(
+      classes, [](DexClass* cls, gathered_refs& out) {
+        cls->gather_strings(out.strings);
+        cls->gather_types(out.types);
+        cls->gather_fields(out.fields);
+        cls->gather_methods(out.methods);
+      },
+      refs);
+
+  // Gather types and strings needed for field and method refs. These only add
+  // strings and types, so the field and method lists are final already.
+  gathered_refs shallow;
+  shallow.strings.swap(refs.strings);
+  shallow.types.swap(refs.types);
+  gather_in_parallel<DexMethodRef*>(
+      refs.methods, [](DexMethodRef* meth, gathered_refs& out) {
+        meth->gather_types_shallow(out.types);
+        meth->gather_strings_shallow(out.strings);
+      },
+      shallow);
+  gather_in_parallel<DexFieldRef*>(
+      refs.fields, [](DexFieldRef* field, gathered_refs& out) {
+        field->gather_types_shallow(out.types);
+        field->gather_strings_shallow(out.strings);
+      },
+      shallow);
+
+  m_lstring.swap(shallow.strings);
+  m_ltype.swap(shallow.types);
+  m_lfield.swap(refs.fields);
+  m_lmethod.swap(refs.methods);
 
   // Gather strings needed for each type.
-  sort_unique(m_ltype);
   for (auto type : m_ltype) {
     if (type) m_lstring.push_back(type->get_name());
   }
@@ -344,11 +553,14 @@ void GatheredTypes::gather_components() {
   sort_unique(m_lstring);
 }
 
-constexpr uint32_t k_max_dex_size = 16 * 1024 * 1024;
-typedef std::map<DexAnnotation*, uint32_t> annomap_t;
-typedef std::map<DexAnnotationSet*, uint32_t> asetmap_t;
-typedef std::map<ParamAnnotations*, uint32_t> xrefmap_t;
-typedef std::map<DexAnnotationDirectory*, uint32_t> adirmap_t;
+// Address space reserved for the output of a dex. Pages are only backed by
+// memory once written to, so this can be generous.
+constexpr uint32_t k_max_dex_size = 64 * 1024 * 1024;
+constexpr uint32_t kPageSize = 4096;
+typedef std::unordered_map<DexAnnotation*, uint32_t> annomap_t;
+typedef std::unordered_map<DexAnnotationSet*, uint32_t> asetmap_t;
+typedef std::unordered_map<ParamAnnotations*, uint32_t> xrefmap_t;
+typedef std::unordered_map<DexAnnotationDirectory*, uint32_t> adirmap_t;
 
 class DexOutput {
 public:
@@ -369,12 +581,18 @@ public:
   std::unordered_map<DexTypeList*, uint32_t> m_tl_emit_offsets;
   std::vector<std::pair<DexCode*, dex_code_item*>> m_code_item_emits;
   std::vector<std::pair<std::string, uint32_t>> m_method_bytecode_offsets;
+  std::string m_method_mapping;
+  std::string m_class_mapping;
+  std::string m_pg_mapping;
+  std::string m_bytecode_offset_mapping;
   std::unordered_map<DexClass*, uint32_t> m_cdi_offsets;
   std::unordered_map<DexClass*, uint32_t> m_static_values;
   dex_header hdr;
   std::vector<dex_map_item> m_map_items;
   LocatorIndex* m_locator_index;
   ConfigFiles& m_config_files;
+  const MethodOrder* m_method_order;
+  const ClassOrder* m_class_order;
 
   void insert_map_item(uint16_t typeidx, uint32_t size, uint32_t offset);
   void generate_string_data(SortMode mode = SortMode::DEFAULT);
@@ -409,7 +627,6 @@ public:
   void generate_map();
   void finalize_header();
   void init_header_offsets();
-  void write_symbol_files();
   void align_output() { m_offset = (m_offset + 3) & ~3; }
   void emit_locator(Locator locator);
   std::unique_ptr<Locator> locator_for_descriptor(
@@ -427,12 +644,64 @@ public:
     const std::string& method_mapping_path,
     const std::string& class_mapping_path,
     const std::string& pg_mapping_path,
-    const std::string& bytecode_offset_path);
+    const std::string& bytecode_offset_path,
+    const MethodOrder* method_order,
+    const ClassOrder* class_order);
   ~DexOutput();
   void prepare(SortMode string_mode, const std::vector<SortMode>& code_mode);
-  void write();
+  void write(async_io::AsyncWriter* writer);
+
+  // The steps of prepare() and write(), split so that several dexes can be
+  // emitted concurrently while the position map and the symbol files are still
+  // produced in dex order.
+  void prepare_code(SortMode string_mode,
+                    const std::vector<SortMode>& code_mode);
+  uint32_t count_emitted_positions();
+  void finish(PositionMapper* pos_mapper);
+  // With a writer, the output buffer goes to it, and the dex can't be
+  // written again.
+  void write_dex(async_io::AsyncWriter* writer);
+  // Formatting the mappings only reads this dex, so it can run alongside the
+  // other dexes. Writing them out has to happen in dex order.
+  void format_symbol_files();
+  void write_symbol_files(async_io::AsyncWriter* writer);
 };
 
+namespace {
+
+/*
+ * The output is zeroed, as parts of it are skipped over and filled in
+ * later. Anonymous mappings are zero-filled a page at a time on first write,
+ * so only the pages a dex actually uses are ever touched.
+ */
+uint8_t* alloc_output() {
+#ifdef _MSC_VER
+  auto output = (uint8_t*)calloc(k_max_dex_size, 1);
+  always_assert_log(output != nullptr, "Can't allocate dex output buffer\n");
+#else
+  auto output = (uint8_t*)mmap(nullptr,
+                               k_max_dex_size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                               -1,
+                               0);
+  always_assert_log(output != MAP_FAILED,
+                    "Can't map dex output buffer: %s\n",
+                    strerror(errno));
+#endif
+  return output;
+}
+
+void free_output(uint8_t* output) {
+#ifdef _MSC_VER
+  free(output);
+#else
+  munmap(output, k_max_dex_size);
+#endif
+}
+
+} // namespace
+
 DexOutput::DexOutput(
   const char* path,
   DexClasses* classes,
@@ -443,12 +712,15 @@ DexOutput::DexOutput(
   const std::string& method_mapping_filename,
   const std::string& class_mapping_filename,
   const std::string& pg_mapping_filename,
-  const std::string& bytecode_offset_filename)
-    : m_config_files(config_files)
+  const std::string& bytecode_offset_filename,
+  const MethodOrder* method_order,
+  const ClassOrder* class_order)
+    : m_config_files(config_files),
+      m_method_order(method_order),
+      m_class_order(class_order)
 {
   m_classes = classes;
-  m_output = (uint8_t*)malloc(k_max_dex_size);
-  memset(m_output, 0, k_max_dex_size);
+  m_output = alloc_output();
   m_offset = 0;
   m_gtypes = new GatheredTypes(classes);
   dodx = m_gtypes->get_dodx(m_output);
@@ -465,7 +737,9 @@ DexOutput::DexOutput(
 DexOutput::~DexOutput() {
   delete m_gtypes;
   delete dodx;
-  free(m_output);
+  if (m_output != nullptr) {
+    free_output(m_output);
+  }
 }
 
 void DexOutput::insert_map_item(uint16_t maptype,
@@ -537,12 +811,23 @@ void DexOutput::generate_string_data(SortMode mode) {
    * this should be ordered by access for page-cache efficiency.
    */
   std::vector<DexString*> string_order;
+  std::unordered_set<const DexString*> startup_strings;
   if (mode == SortMode::CLASS_ORDER) {
     TRACE(CUSTOMSORT, 2, "using class order for string pool sorting\n");
     string_order = m_gtypes->get_cls_order_dexstring_emitlist();
   } else if (mode == SortMode::CLASS_STRINGS) {
     TRACE(CUSTOMSORT, 2, "using class names pack for string pool sorting\n");
     string_order = m_gtypes->keep_cls_strings_together_emitlist();
+  } else if (mode == SortMode::METHOD_PROFILE_ORDER &&
+             m_method_order != nullptr) {
+    TRACE(CUSTOMSORT, 2, "using method profile order for string pool sorting\n");
+    string_order =
+        m_gtypes->get_method_profile_order_dexstring_emitlist(*m_method_order);
+  } else if (mode == SortMode::COLDSTART_ORDER && m_method_order != nullptr &&
+             m_class_order != nullptr) {
+    TRACE(CUSTOMSORT, 2, "using coldstart order for string pool sorting\n");
+    string_order = m_gtypes->get_coldstart_dexstring_emitlist(
+        *m_class_order, *m_method_order, &startup_strings);
   } else {
     TRACE(CUSTOMSORT, 2, "using default string pool sorting\n");
     string_order = m_gtypes->get_dexstring_emitlist();
@@ -551,6 +836,7 @@ void DexOutput::generate_string_data(SortMode mode) {
 
   std::unordered_set<DexString*> type_names = m_gtypes->index_type_names();
   unsigned locator_size = 0;
+  std::unordered_set<uint32_t> startup_pages;
 
   // If we're generating locator strings, we need to include them in
   // the total count of strings in this section.
@@ -576,9 +862,22 @@ void DexOutput::generate_string_data(SortMode mode) {
     TRACE(CUSTOMSORT, 3, "str emit %s\n", SHOW(str));
     stringids[idx].offset = m_offset;
     str->encode(m_output + m_offset);
+    if (startup_strings.count(str)) {
+      for (uint32_t page = m_offset / kPageSize;
+           page <= (m_offset + str->get_entry_size() - 1) / kPageSize;
+           ++page) {
+        startup_pages.insert(page);
+      }
+    }
     m_offset += str->get_entry_size();
     m_stats.num_strings++;
   }
+  if (!startup_strings.empty()) {
+    m_stats.num_hot_string_pages = startup_pages.size();
+    TRACE(CUSTOMSORT, 1, "%lu startup strings on %lu pages\n",
+        startup_strings.size(),
+        startup_pages.size());
+  }
 
   if (m_locator_index != nullptr) {
     TRACE(LOC, 1, "Used %u bytes for locator strings\n", locator_size);
@@ -742,8 +1041,9 @@ void DexOutput::generate_class_data_items() {
 static void sync_all(const Scope& scope) {
   constexpr bool serial = false; // for debugging
   auto wq = workqueue_foreach<DexMethod*>([](DexMethod* m){m->sync();});
+  // Methods whose ballooning is still deferred keep their DexCode.
   walk::code(scope,
-            [](DexMethod*) { return true; },
+            [](DexMethod* m) { return !m->is_balloon_deferred(); },
             [&](DexMethod* m, IRCode&) {
               if (serial) {
                 TRACE(MTRANS, 2, "Syncing %s\n", SHOW(m));
@@ -755,6 +1055,27 @@ static void sync_all(const Scope& scope) {
   wq.run_all();
 }
 
+/*
+ * An upper bound on what DexCode::encode() writes: the instructions, padding,
+ * and the try items and handlers with every uleb128 at its widest.
+ */
+static size_t code_item_size_bound(DexCode* code) {
+  constexpr size_t max_uleb128 = 5;
+  size_t size = sizeof(dex_code_item);
+  for (auto const& insn : code->get_instructions()) {
+    size += insn->size() * sizeof(uint16_t);
+  }
+  const auto& tries = code->get_tries();
+  if (!tries.empty()) {
+    size += sizeof(uint16_t) + tries.size() * sizeof(dex_tries_item);
+    size += max_uleb128;
+    for (const auto& dextry : tries) {
+      size += max_uleb128 + dextry->m_catches.size() * 2 * max_uleb128;
+    }
+  }
+  return size;
+}
+
 void DexOutput::generate_code_items(const std::vector<SortMode>& mode) {
   /*
    * Optimization note:  We should pass a sort routine to the
@@ -764,6 +1085,8 @@ void DexOutput::generate_code_items(const std::vector<SortMode>& mode) {
   uint32_t ci_start = m_offset;
   sync_all(*m_classes);
 
+  uint32_t hot_code_end = 0;
+
   // Get all methods.
   std::vector<DexMethod*> lmeth = m_gtypes->get_dexmethod_emitlist();
 
@@ -780,32 +1103,78 @@ void DexOutput::generate_code_items(const std::vector<SortMode>& mode) {
         m_gtypes->sort_dexmethod_emitlist_clinit_order(lmeth);
         break;
 
+      case SortMode::METHOD_PROFILE_ORDER:
+        if (m_method_order == nullptr) {
+          break;
+        }
+        TRACE(CUSTOMSORT, 2, "using method profile order for bytecode sorting\n");
+        m_gtypes->sort_dexmethod_emitlist_method_profile_order(
+            lmeth, *m_method_order);
+        break;
       case SortMode::CLASS_STRINGS:
         TRACE(CUSTOMSORT, 2, "Unsupport bytecode sorting method SortMode::CLASS_STRINGS");
         break;
+      case SortMode::COLDSTART_ORDER:
+        TRACE(CUSTOMSORT, 2, "Unsupport bytecode sorting method SortMode::COLDSTART_ORDER");
+        break;
       case SortMode::DEFAULT:
         TRACE(CUSTOMSORT, 2, "using default sorting order");
         m_gtypes->sort_dexmethod_emitlist_default_order(lmeth);
         break;
     }
   }
+  std::vector<std::pair<DexMethod*, DexCode*>> emits;
   for (DexMethod* meth : lmeth) {
     if (meth->get_access() & (DEX_ACCESS_ABSTRACT | DEX_ACCESS_NATIVE)) {
       // There is no code item for ABSTRACT or NATIVE methods.
       continue;
     }
-    TRACE(CUSTOMSORT, 3, "method emit %s %s\n", SHOW(meth->get_class()), SHOW(meth));
     DexCode* code = meth->get_dex_code();
     always_assert_log(
         meth->is_concrete() && code != nullptr,
         "Undefined method in generate_code_items()\n\t prototype: %s\n", SHOW(meth));
+    emits.emplace_back(meth, code);
+  }
+
+  // Code items don't refer to their own offset, so they are encoded in
+  // parallel into scratch buffers, then laid out in emit order.
+  std::vector<std::vector<uint32_t>> encoded(emits.size());
+  std::vector<uint32_t> sizes(emits.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    auto code = emits[i].second;
+    auto bound = code_item_size_bound(code);
+    encoded[i].resize((bound + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+    sizes[i] = code->encode(dodx, encoded[i].data());
+    always_assert(sizes[i] <= bound);
+  });
+  for (size_t i = 0; i < emits.size(); ++i) {
+    wq.add_item(i, emits[i].second->get_instructions().size());
+  }
+  wq.run_all();
+
+  for (size_t i = 0; i < emits.size(); ++i) {
+    DexMethod* meth = emits[i].first;
+    DexCode* code = emits[i].second;
+    TRACE(CUSTOMSORT, 3, "method emit %s %s\n", SHOW(meth->get_class()), SHOW(meth));
     align_output();
-    int size = code->encode(dodx, (uint32_t*)(m_output + m_offset));
+    uint32_t size = sizes[i];
+    memcpy(m_output + m_offset, encoded[i].data(), size);
+    std::vector<uint32_t>().swap(encoded[i]);
     m_method_bytecode_offsets.emplace_back(meth->get_name()->c_str(), m_offset);
     m_code_item_emits.emplace_back(code,
                                    (dex_code_item*)(m_output + m_offset));
     m_offset += size;
     m_stats.num_instructions += code->get_instructions().size();
+    if (m_method_order != nullptr && m_method_order->count(meth)) {
+      hot_code_end = m_offset;
+    }
+  }
+  if (hot_code_end != 0) {
+    // All of the profiled code sits in [ci_start, hot_code_end). That is
+    // the region cold start pages in, so the smaller the better.
+    m_stats.num_hot_code_bytes = hot_code_end - ci_start;
+    TRACE(CUSTOMSORT, 1, "%d bytes of code span the profiled methods\n",
+        m_stats.num_hot_code_bytes);
   }
   insert_map_item(TYPE_CODE_ITEM, (uint32_t) m_code_item_emits.size(), ci_start);
 }
@@ -848,26 +1217,40 @@ static bool annotation_cmp(const DexAnnotationDirectory* a,
   return (a->viz_score() < b->viz_score());
 }
 
+namespace {
+
+/*
+ * Maps the encoding of an annotation item to the offset where it was first
+ * written, so that identical items are emitted once. Each item is hashed and
+ * looked up once, the items themselves are only compared on a hash collision.
+ */
+template <typename Word>
+using EncodingOffsets = std::unordered_map<std::vector<Word>,
+                                           uint32_t,
+                                           boost::hash<std::vector<Word>>>;
+
+} // namespace
+
 void DexOutput::unique_annotations(annomap_t& annomap,
                                    std::vector<DexAnnotation*>& annolist) {
   int annocnt = 0;
   uint32_t mentry_offset = m_offset;
-  std::map<std::vector<uint8_t>, uint32_t> annotation_byte_offsets;
+  EncodingOffsets<uint8_t> annotation_byte_offsets;
   for (auto anno : annolist) {
     if (annomap.count(anno)) continue;
     std::vector<uint8_t> annotation_bytes;
     anno->vencode(dodx, annotation_bytes);
-    if (annotation_byte_offsets.count(annotation_bytes)) {
-      annomap[anno] = annotation_byte_offsets[annotation_bytes];
+    auto emplaced =
+        annotation_byte_offsets.emplace(std::move(annotation_bytes), m_offset);
+    annomap[anno] = emplaced.first->second;
+    if (!emplaced.second) {
       continue;
     }
-    /* Insert new annotation in tracking structs */
-    annotation_byte_offsets[annotation_bytes] = m_offset;
-    annomap[anno] = m_offset;
     /* Not a dupe, encode... */
+    const auto& bytes = emplaced.first->first;
     uint8_t* annoout = (uint8_t*)(m_output + m_offset);
-    memcpy(annoout, &annotation_bytes[0], annotation_bytes.size());
-    m_offset += annotation_bytes.size();
+    memcpy(annoout, bytes.data(), bytes.size());
+    m_offset += bytes.size();
     annocnt++;
   }
   if (annocnt) {
@@ -881,22 +1264,21 @@ void DexOutput::unique_asets(annomap_t& annomap,
                              std::vector<DexAnnotationSet*>& asetlist) {
   int asetcnt = 0;
   uint32_t mentry_offset = m_offset;
-  std::map<std::vector<uint32_t>, uint32_t> aset_offsets;
+  EncodingOffsets<uint32_t> aset_offsets;
   for (auto aset : asetlist) {
     if (asetmap.count(aset)) continue;
     std::vector<uint32_t> aset_bytes;
     aset->vencode(dodx, aset_bytes, annomap);
-    if (aset_offsets.count(aset_bytes)) {
-      asetmap[aset] = aset_offsets[aset_bytes];
+    auto emplaced = aset_offsets.emplace(std::move(aset_bytes), m_offset);
+    asetmap[aset] = emplaced.first->second;
+    if (!emplaced.second) {
       continue;
     }
-    /* Insert new aset in tracking structs */
-    aset_offsets[aset_bytes] = m_offset;
-    asetmap[aset] = m_offset;
     /* Not a dupe, encode... */
+    const auto& words = emplaced.first->first;
     uint8_t* asetout = (uint8_t*)(m_output + m_offset);
-    memcpy(asetout, &aset_bytes[0], aset_bytes.size() * sizeof(uint32_t));
-    m_offset += aset_bytes.size() * sizeof(uint32_t);
+    memcpy(asetout, words.data(), words.size() * sizeof(uint32_t));
+    m_offset += words.size() * sizeof(uint32_t);
     asetcnt++;
   }
   if (asetcnt) {
@@ -909,28 +1291,28 @@ void DexOutput::unique_xrefs(asetmap_t& asetmap,
                              std::vector<ParamAnnotations*>& xreflist) {
   int xrefcnt = 0;
   uint32_t mentry_offset = m_offset;
-  std::map<std::vector<uint32_t>, uint32_t> xref_offsets;
+  EncodingOffsets<uint32_t> xref_offsets;
   for (auto xref : xreflist) {
     if (xrefmap.count(xref)) continue;
     std::vector<uint32_t> xref_bytes;
     xref_bytes.push_back((unsigned int) xref->size());
     for (auto param : *xref) {
       DexAnnotationSet* das = param.second;
-      always_assert_log(asetmap.count(das) != 0,
+      auto it = asetmap.find(das);
+      always_assert_log(it != asetmap.end(),
                         "Uninitialized aset %p '%s'", das, SHOW(das));
-      xref_bytes.push_back(asetmap[das]);
+      xref_bytes.push_back(it->second);
     }
-    if (xref_offsets.count(xref_bytes)) {
-      xrefmap[xref] = xref_offsets[xref_bytes];
+    auto emplaced = xref_offsets.emplace(std::move(xref_bytes), m_offset);
+    xrefmap[xref] = emplaced.first->second;
+    if (!emplaced.second) {
       continue;
     }
-    /* Insert new xref in tracking structs */
-    xref_offsets[xref_bytes] = m_offset;
-    xrefmap[xref] = m_offset;
     /* Not a dupe, encode... */
+    const auto& words = emplaced.first->first;
     uint8_t* xrefout = (uint8_t*)(m_output + m_offset);
-    memcpy(xrefout, &xref_bytes[0], xref_bytes.size() * sizeof(uint32_t));
-    m_offset += xref_bytes.size() * sizeof(uint32_t);
+    memcpy(xrefout, words.data(), words.size() * sizeof(uint32_t));
+    m_offset += words.size() * sizeof(uint32_t);
     xrefcnt++;
   }
   if (xrefcnt) {
@@ -944,22 +1326,21 @@ void DexOutput::unique_adirs(asetmap_t& asetmap,
                              std::vector<DexAnnotationDirectory*>& adirlist) {
   int adircnt = 0;
   uint32_t mentry_offset = m_offset;
-  std::map<std::vector<uint32_t>, uint32_t> adir_offsets;
+  EncodingOffsets<uint32_t> adir_offsets;
   for (auto adir : adirlist) {
     if (adirmap.count(adir)) continue;
     std::vector<uint32_t> adir_bytes;
     adir->vencode(dodx, adir_bytes, xrefmap, asetmap);
-    if (adir_offsets.count(adir_bytes)) {
-      adirmap[adir] = adir_offsets[adir_bytes];
+    auto emplaced = adir_offsets.emplace(std::move(adir_bytes), m_offset);
+    adirmap[adir] = emplaced.first->second;
+    if (!emplaced.second) {
       continue;
     }
-    /* Insert new adir in tracking structs */
-    adir_offsets[adir_bytes] = m_offset;
-    adirmap[adir] = m_offset;
     /* Not a dupe, encode... */
+    const auto& words = emplaced.first->first;
     uint8_t* adirout = (uint8_t*)(m_output + m_offset);
-    memcpy(adirout, &adir_bytes[0], adir_bytes.size() * sizeof(uint32_t));
-    m_offset += adir_bytes.size() * sizeof(uint32_t);
+    memcpy(adirout, words.data(), words.size() * sizeof(uint32_t));
+    m_offset += words.size() * sizeof(uint32_t);
     adircnt++;
   }
   if (adircnt) {
@@ -1019,21 +1400,80 @@ void DexOutput::generate_annotations() {
   }
 }
 
+/*
+ * An upper bound on what DexDebugItem::encode() writes. Each entry turns into
+ * at most a pc advance plus either a line advance and a special opcode, or a
+ * debug instruction with up to four uleb128 operands.
+ */
+static size_t debug_item_size_bound(DexDebugItem* dbg) {
+  constexpr size_t max_uleb128 = 5;
+  constexpr size_t max_entry_size = (1 + max_uleb128) + (1 + 4 * max_uleb128);
+  return 2 * max_uleb128 + 1 +
+         dbg->get_param_names().size() * max_uleb128 +
+         dbg->get_entries().size() * max_entry_size;
+}
+
 void DexOutput::generate_debug_items() {
   uint32_t dbg_start = m_offset;
-  int dbgcount = 0;
+  std::vector<std::pair<DexDebugItem*, dex_code_item*>> dbg_emits;
   for (auto& it : m_code_item_emits) {
-    DexCode* dc = it.first;
-    dex_code_item* dci = it.second;
-    auto dbg = dc->get_debug_item();
+    auto dbg = it.first->get_debug_item();
     if (dbg == nullptr) continue;
-    dbgcount++;
+    dbg_emits.emplace_back(dbg, it.second);
+  }
+
+  // Positions are numbered in emission order, so each chunk of debug items
+  // maps its positions through a shard that starts where the positions of the
+  // previous chunks end. Merging the shards in order gives the same numbering
+  // as encoding the items one by one.
+  constexpr size_t k_chunk_size = 256;
+  size_t num_chunks = (dbg_emits.size() + k_chunk_size - 1) / k_chunk_size;
+  auto chunk_end = [&](size_t c) {
+    return std::min(dbg_emits.size(), (c + 1) * k_chunk_size);
+  };
+  std::vector<uint32_t> num_positions(num_chunks);
+  auto count_wq = workqueue_foreach<size_t>([&](size_t c) {
+    for (size_t i = c * k_chunk_size; i < chunk_end(c); ++i) {
+      num_positions[c] += dbg_emits[i].first->count_emitted_positions();
+    }
+  });
+  for (size_t c = 0; c < num_chunks; ++c) {
+    count_wq.add_item(c);
+  }
+  count_wq.run_all();
+
+  std::vector<std::unique_ptr<PositionMapper>> shards;
+  uint32_t line_base = m_pos_mapper->next_line_base();
+  for (size_t c = 0; c < num_chunks; ++c) {
+    shards.emplace_back(m_pos_mapper->make_shard(line_base));
+    line_base += num_positions[c];
+  }
+  std::vector<std::vector<uint8_t>> encoded(dbg_emits.size());
+  auto encode_wq = workqueue_foreach<size_t>([&](size_t c) {
+    for (size_t i = c * k_chunk_size; i < chunk_end(c); ++i) {
+      auto dbg = dbg_emits[i].first;
+      auto bound = debug_item_size_bound(dbg);
+      encoded[i].resize(bound);
+      size_t size = dbg->encode(dodx, shards[c].get(), encoded[i].data());
+      always_assert(size <= bound);
+      encoded[i].resize(size);
+    }
+  });
+  for (size_t c = 0; c < num_chunks; ++c) {
+    encode_wq.add_item(c);
+  }
+  encode_wq.run_all();
+
+  for (size_t c = 0; c < num_chunks; ++c) {
+    m_pos_mapper->merge_shard(shards[c].get());
+  }
+  for (size_t i = 0; i < dbg_emits.size(); ++i) {
     // No align requirement for debug items.
-    int size = dbg->encode(dodx, m_pos_mapper, m_output + m_offset);
-    dci->debug_info_off = m_offset;
-    m_offset += size;
+    dbg_emits[i].second->debug_info_off = m_offset;
+    memcpy(m_output + m_offset, encoded[i].data(), encoded[i].size());
+    m_offset += encoded[i].size();
   }
-  insert_map_item(TYPE_DEBUG_INFO_ITEM, dbgcount, dbg_start);
+  insert_map_item(TYPE_DEBUG_INFO_ITEM, dbg_emits.size(), dbg_start);
 }
 
 void DexOutput::generate_map() {
@@ -1056,6 +1496,28 @@ void DexOutput::generate_map() {
  * with the jumbo-ness of their stridx.
  */
 static void fix_method_jumbos(DexMethod* method, const DexOutputIdx* dodx) {
+  if (method->is_balloon_deferred()) {
+    // The DexCode can be emitted as is, unless one of its const-strings
+    // changes size. Then the branches around it need to be recomputed, which
+    // goes through IRCode.
+    bool needs_fixing = false;
+    for (auto insn : method->get_dex_code()->get_instructions()) {
+      auto op = insn->opcode();
+      if (op == DOPCODE_CONST_STRING || op == DOPCODE_CONST_STRING_JUMBO) {
+        auto str = static_cast<DexOpcodeString*>(insn)->get_string();
+        bool jumbo = (dodx->stringidx(str) >> 16) != 0;
+        if (jumbo != (op == DOPCODE_CONST_STRING_JUMBO)) {
+          needs_fixing = true;
+          break;
+        }
+      }
+    }
+    if (!needs_fixing) {
+      return;
+    }
+    method->get_code();
+    instruction_lowering::lower(method);
+  }
   auto code = method->get_code();
   if (!code) return; // nothing to do for native methods
 
@@ -1131,35 +1593,69 @@ void DexOutput::init_header_offsets() {
 }
 
 void DexOutput::finalize_header() {
+  always_assert_log(m_offset <= k_max_dex_size,
+                    "Dex output of %u bytes is over the %u byte limit\n",
+                    m_offset,
+                    k_max_dex_size);
   hdr.data_size = m_offset - hdr.data_off;
   hdr.file_size = m_offset;
-  int skip;
-  skip = sizeof(hdr.magic) + sizeof(hdr.checksum) + sizeof(hdr.signature);
   memcpy(m_output, &hdr, sizeof(hdr));
+  // The checksum covers the signature, but everything after the signature is
+  // final already, so its Adler-32 is computed while the signature is.
+  auto sig_off = sizeof(hdr.magic) + sizeof(hdr.checksum);
+  auto tail_off = sig_off + sizeof(hdr.signature);
+  auto tail_size = hdr.file_size - tail_off;
+  auto tail_adler = std::async(std::launch::async, [&] {
+    auto adler = adler32(0L, Z_NULL, 0);
+    return adler32(adler, (const Bytef*)(m_output + tail_off), tail_size);
+  });
   Sha1Context context;
   sha1_init(&context);
-  sha1_update(&context, m_output + skip, hdr.file_size - skip);
+  sha1_update(&context, m_output + tail_off, tail_size);
   sha1_final(hdr.signature, &context);
   memcpy(m_output, &hdr, sizeof(hdr));
-  uint32_t adler = (uint32_t)adler32(0L, Z_NULL, 0);
-  skip = sizeof(hdr.magic) + sizeof(hdr.checksum);
-  adler = (uint32_t) adler32(adler, (const Bytef*)(m_output + skip), hdr.file_size - skip);
-  hdr.checksum = adler;
+  auto adler = adler32(0L, Z_NULL, 0);
+  adler = adler32(adler, (const Bytef*)(m_output + sig_off), sizeof(hdr.signature));
+  adler = adler32_combine(adler, tail_adler.get(), tail_size);
+  hdr.checksum = (uint32_t) adler;
   memcpy(m_output, &hdr, sizeof(hdr));
 }
 
 namespace {
 
-void write_method_mapping(
-  const std::string& filename,
-  const DexOutputIdx* dodx,
-  uint8_t* dex_signature
-) {
+void append_uint(std::string& out, uint32_t value) {
+  char buf[10];
+  char* end = buf + sizeof(buf);
+  char* p = end;
+  do {
+    *--p = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  out.append(p, end);
+}
+
+void append_to_file(const std::string& filename, const std::string& contents) {
   if (filename.empty()) return;
   FILE* fd = fopen(filename.c_str(), "a");
-  assert_log(fd, "Can't open method mapping file %s: %s\n",
+  assert_log(fd, "Can't open mapping file %s: %s\n",
              filename.c_str(),
              strerror(errno));
+  fwrite(contents.data(), 1, contents.size(), fd);
+  fclose(fd);
+}
+
+void format_method_mapping(
+  std::string& out,
+  const DexOutputIdx* dodx,
+  uint8_t* dex_signature
+) {
+  //
+  // Turns out, the checksum can change on-device. (damn you dexopt)
+  // The signature, however, is never recomputed. Let's log the top 4 bytes,
+  // in little-endian (since that's faster to compute on-device).
+  //
+  uint32_t signature = *reinterpret_cast<uint32_t*>(dex_signature);
+  out.reserve(dodx->method_to_idx().size() * 64);
   for (auto& it : dodx->method_to_idx()) {
     auto method = it.first;
     auto idx = it.second;
@@ -1203,33 +1699,29 @@ void write_method_mapping(
     // We only want the name here.
     auto begin = deobf_method.find('.') + 1;
     auto end = deobf_method.rfind(':');
-    auto deobf_method_name = deobf_method.substr(begin, end-begin);
-
-    //
-    // Turns out, the checksum can change on-device. (damn you dexopt)
-    // The signature, however, is never recomputed. Let's log the top 4 bytes,
-    // in little-endian (since that's faster to compute on-device).
-    //
-    uint32_t signature = *reinterpret_cast<uint32_t*>(dex_signature);
 
-    fprintf(fd, "%u %u %s %s\n",
-            idx,
-            signature,
-            deobf_method_name.c_str(),
-            deobf_class.c_str());
+    append_uint(out, idx);
+    out += ' ';
+    append_uint(out, signature);
+    out += ' ';
+    out.append(deobf_method, begin, end - begin);
+    out += ' ';
+    out += deobf_class;
+    out += '\n';
   }
-  fclose(fd);
 }
 
-void write_class_mapping(
-  const std::string& filename,
+void format_class_mapping(
+  std::string& out,
   DexClasses* classes,
   const size_t class_defs_size,
   uint8_t* dex_signature
 ) {
-  if (filename.empty()) return;
-  FILE* fd = fopen(filename.c_str(), "a");
-
+  //
+  // See format_method_mapping above for why checksum is insufficient.
+  //
+  uint32_t signature = *reinterpret_cast<uint32_t*>(dex_signature);
+  out.reserve(class_defs_size * 64);
   for (uint32_t idx = 0; idx < class_defs_size; idx++) {
 
     DexClass* cls = classes->at(idx);
@@ -1241,14 +1733,13 @@ void write_class_mapping(
       return proguard_name(cls);
     }();
 
-    //
-    // See write_method_mapping above for why checksum is insufficient.
-    //
-    uint32_t signature = *reinterpret_cast<uint32_t*>(dex_signature);
-    fprintf(fd, "%u %u %s\n", idx, signature, deobf_class.c_str());
+    append_uint(out, idx);
+    out += ' ';
+    append_uint(out, signature);
+    out += ' ';
+    out += deobf_class;
+    out += '\n';
   }
-
-  fclose(fd);
 }
 
 const char* deobf_primitive(char type) {
@@ -1277,9 +1768,7 @@ const char* deobf_primitive(char type) {
   }
 }
 
-void write_pg_mapping(const std::string& filename, DexClasses* classes) {
-  if (filename.empty()) return;
-
+void format_pg_mapping(std::string& out, DexClasses* classes) {
   auto deobf_class = [&](DexClass* cls) {
     if (cls) {
       auto deobname = cls->get_deobfuscated_name();
@@ -1298,37 +1787,35 @@ void write_pg_mapping(const std::string& filename, DexClasses* classes) {
         }
         DexType* inner_type = DexType::get_type(&type_str[dim]);
         DexClass* inner_cls = inner_type ? type_class(inner_type) : nullptr;
-        std::string result;
         if (inner_cls) {
-          result = JavaNameUtil::internal_to_external(deobf_class(inner_cls));
+          out += JavaNameUtil::internal_to_external(deobf_class(inner_cls));
         } else if (inner_type && is_primitive(inner_type)) {
-          result = deobf_primitive(type_str[dim]);
+          out += deobf_primitive(type_str[dim]);
         } else {
-          result = JavaNameUtil::internal_to_external(&type_str[dim]);
+          out += JavaNameUtil::internal_to_external(&type_str[dim]);
         }
         for (int i = 0 ; i < dim ; ++i) {
-          result = result + "[]";
+          out += "[]";
         }
-        return result;
       } else {
         DexClass* cls = type_class(type);
         if (cls) {
-          return JavaNameUtil::internal_to_external(deobf_class(cls));
+          out += JavaNameUtil::internal_to_external(deobf_class(cls));
         } else if (is_primitive(type)) {
-          return std::string(deobf_primitive(type->c_str()[0]));
+          out += deobf_primitive(type->c_str()[0]);
         } else {
-          return JavaNameUtil::internal_to_external(type->c_str());
+          out += JavaNameUtil::internal_to_external(type->c_str());
         }
       }
+      return;
     }
-    return proguard_name(type);
+    out += proguard_name(type);
   };
 
   auto deobf_meth = [&](DexMethod* method) {
     if (method) {
       // Example: 672:672:boolean customShouldDelayInitMessage(android.os.Handler,android.os.Message)
       auto* proto = method->get_proto();
-      std::ostringstream ss;
       auto* code = method->get_dex_code();
       auto* dbg = code ? code->get_debug_item() : nullptr;
       if (dbg) {
@@ -1348,107 +1835,124 @@ void write_pg_mapping(const std::string& filename, DexClasses* classes) {
         if (line_end > static_cast<uint32_t>(std::numeric_limits<int32_t>::max())) {
           line_end = 0;
         }
-        ss << line_start << ":" << line_end << ":";
+        append_uint(out, line_start);
+        out += ':';
+        append_uint(out, line_end);
+        out += ':';
       }
-      auto* rtype = proto->get_rtype();
-      auto rtype_str = deobf_type(rtype);
-      ss << rtype_str;
-      ss << " " << method->get_simple_deobfuscated_name() << "(";
-      auto args = proto->get_args()->get_type_list();
+      deobf_type(proto->get_rtype());
+      out += ' ';
+      out += method->get_simple_deobfuscated_name();
+      out += '(';
+      auto& args = proto->get_args()->get_type_list();
       for (auto iter = args.begin() ; iter != args.end() ; ++iter) {
-        auto* atype = *iter;
-        auto atype_str = deobf_type(atype);
-        ss << atype_str;
+        deobf_type(*iter);
         if (iter + 1 != args.end()) {
-          ss << ",";
+          out += ',';
         }
       }
-      ss << ")";
-      return ss.str();
+      out += ')';
+      return;
     }
-    return proguard_name(method);
+    out += proguard_name(method);
   };
 
   auto deobf_field = [&](DexField* field) {
     if (field) {
-      std::ostringstream ss;
-      ss << deobf_type(field->get_type())
-      << " "
-      << field->get_simple_deobfuscated_name();
-      return ss.str();
+      deobf_type(field->get_type());
+      out += ' ';
+      out += field->get_simple_deobfuscated_name();
+      return;
     }
-    return proguard_name(field);
+    out += proguard_name(field);
   };
 
-  std::ofstream ofs(filename.c_str(), std::ofstream::out | std::ofstream::app);
+  auto field_line = [&](DexField* field) {
+    out += "    ";
+    deobf_field(field);
+    out += " -> ";
+    out += field->c_str();
+    out += '\n';
+  };
+
+  auto meth_line = [&](DexMethod* meth) {
+    out += "    ";
+    deobf_meth(meth);
+    out += " -> ";
+    out += meth->c_str();
+    out += '\n';
+  };
 
   for (auto cls : *classes) {
-    auto deobf_cls = deobf_class(cls);
-    ofs << JavaNameUtil::internal_to_external(deobf_cls) << " -> "
-        << JavaNameUtil::internal_to_external(cls->get_type()->c_str())
-        << ":" << std::endl;
+    out += JavaNameUtil::internal_to_external(deobf_class(cls));
+    out += " -> ";
+    out += JavaNameUtil::internal_to_external(cls->get_type()->c_str());
+    out += ":\n";
     for (auto field : cls->get_ifields()) {
-      auto deobf = deobf_field(field);
-      ofs << "    " << deobf << " -> " << field->c_str() << std::endl;
+      field_line(field);
     }
     for (auto field : cls->get_sfields()) {
-      auto deobf = deobf_field(field);
-      ofs << "    " << deobf << " -> " << field->c_str() << std::endl;
+      field_line(field);
     }
     for (auto meth : cls->get_dmethods()) {
-      auto deobf = deobf_meth(meth);
-      ofs << "    " << deobf << " -> " << meth->c_str() << std::endl;
+      meth_line(meth);
     }
     for (auto meth : cls->get_vmethods()) {
-      auto deobf = deobf_meth(meth);
-      ofs << "    " << deobf << " -> " << meth->c_str() << std::endl;
+      meth_line(meth);
     }
   }
 }
 
-void write_bytecode_offset_mapping(
-  const std::string& filename,
+void format_bytecode_offset_mapping(
+  std::string& out,
   const std::vector<std::pair<std::string, uint32_t>>& method_offsets
 ) {
-  if (filename.empty()) { return; }
-
-  auto fd = fopen(filename.c_str(), "a");
-  assert_log(fd, "Can't open bytecode offset file %s: %s\n",
-             filename.c_str(),
-             strerror(errno));
-
+  out.reserve(method_offsets.size() * 32);
   for (const auto& item : method_offsets) {
-    fprintf(fd, "%u %s\n", item.second, item.first.c_str());
+    append_uint(out, item.second);
+    out += ' ';
+    out += item.first;
+    out += '\n';
   }
-
-  fclose(fd);
 }
 
 } // namespace
 
-void DexOutput::write_symbol_files() {
-  write_method_mapping(
-    m_method_mapping_filename,
-    dodx,
-    hdr.signature
-  );
-  write_class_mapping(
-    m_class_mapping_filename,
-    m_classes,
-    hdr.class_defs_size,
-    hdr.signature
-  );
-  write_pg_mapping(
-    m_pg_mapping_filename,
-    m_classes
-  );
-  write_bytecode_offset_mapping(
-    m_bytecode_offset_filename,
-    m_method_bytecode_offsets
-  );
+void DexOutput::format_symbol_files() {
+  if (!m_method_mapping_filename.empty()) {
+    format_method_mapping(m_method_mapping, dodx, hdr.signature);
+  }
+  if (!m_class_mapping_filename.empty()) {
+    format_class_mapping(
+        m_class_mapping, m_classes, hdr.class_defs_size, hdr.signature);
+  }
+  if (!m_pg_mapping_filename.empty()) {
+    format_pg_mapping(m_pg_mapping, m_classes);
+  }
+  if (!m_bytecode_offset_filename.empty()) {
+    format_bytecode_offset_mapping(m_bytecode_offset_mapping,
+                                   m_method_bytecode_offsets);
+  }
 }
 
-void DexOutput::prepare(SortMode string_mode, const std::vector<SortMode>& code_mode) {
+void DexOutput::write_symbol_files(async_io::AsyncWriter* writer) {
+  std::pair<const std::string*, std::string*> files[] = {
+      {&m_method_mapping_filename, &m_method_mapping},
+      {&m_class_mapping_filename, &m_class_mapping},
+      {&m_pg_mapping_filename, &m_pg_mapping},
+      {&m_bytecode_offset_filename, &m_bytecode_offset_mapping}};
+  for (const auto& file : files) {
+    if (writer != nullptr && !file.first->empty()) {
+      writer->write(*file.first, std::move(*file.second), /* append */ true);
+    } else {
+      append_to_file(*file.first, *file.second);
+    }
+    std::string().swap(*file.second);
+  }
+}
+
+void DexOutput::prepare_code(SortMode string_mode,
+                             const std::vector<SortMode>& code_mode) {
   fix_jumbos(m_classes, dodx);
   init_header_offsets();
   generate_static_values();
@@ -1462,13 +1966,41 @@ void DexOutput::prepare(SortMode string_mode, const std::vector<SortMode>& code_
   generate_method_data();
   generate_class_data();
   generate_annotations();
+}
+
+uint32_t DexOutput::count_emitted_positions() {
+  uint32_t count = 0;
+  for (auto& it : m_code_item_emits) {
+    auto dbg = it.first->get_debug_item();
+    if (dbg != nullptr) {
+      count += dbg->count_emitted_positions();
+    }
+  }
+  return count;
+}
+
+void DexOutput::finish(PositionMapper* pos_mapper) {
+  m_pos_mapper = pos_mapper;
   generate_debug_items();
   generate_map();
   align_output();
   finalize_header();
 }
 
-void DexOutput::write() {
+void DexOutput::prepare(SortMode string_mode, const std::vector<SortMode>& code_mode) {
+  prepare_code(string_mode, code_mode);
+  finish(m_pos_mapper);
+}
+
+void DexOutput::write_dex(async_io::AsyncWriter* writer) {
+  if (writer != nullptr) {
+    auto output = m_output;
+    m_output = nullptr;
+    writer->write(
+        m_filename, output, m_offset, [output] { free_output(output); });
+    m_stats.num_bytes = m_offset;
+    return;
+  }
   struct stat st;
   int fd = open(m_filename, O_CREAT | O_TRUNC | O_WRONLY, 0660);
   if (fd == -1) {
@@ -1480,8 +2012,12 @@ void DexOutput::write() {
     m_stats.num_bytes = st.st_size;
   }
   close(fd);
+}
 
-  write_symbol_files();
+void DexOutput::write(async_io::AsyncWriter* writer) {
+  write_dex(writer);
+  format_symbol_files();
+  write_symbol_files(writer);
 }
 
 static SortMode make_sort_bytecode(const std::string& sort_bytecode) {
@@ -1489,52 +2025,151 @@ static SortMode make_sort_bytecode(const std::string& sort_bytecode) {
     return SortMode::CLASS_ORDER;
   } else if (sort_bytecode == "clinit_order") {
     return SortMode::CLINIT_FIRST;
+  } else if (sort_bytecode == "method_profile_order") {
+    return SortMode::METHOD_PROFILE_ORDER;
   } else {
     return SortMode::DEFAULT;
   }
 }
 
-dex_stats_t
-write_classes_to_dex(
-  std::string filename,
-  DexClasses* classes,
-  LocatorIndex* locator_index,
-  size_t dex_number,
-  ConfigFiles& cfg,
-  const Json::Value& json_cfg,
-  PositionMapper* pos_mapper)
-{
-  auto method_mapping_filename = cfg.metafile(
+namespace {
+
+struct DexOutputOptions {
+  std::string method_mapping_filename;
+  std::string class_mapping_filename;
+  std::string pg_mapping_filename;
+  std::string bytecode_offset_filename;
+  SortMode string_sort_mode{SortMode::DEFAULT};
+  std::vector<SortMode> code_sort_mode;
+  // Only filled in when one of the sort modes is METHOD_PROFILE_ORDER, or
+  // COLDSTART_ORDER for the latter.
+  std::unique_ptr<MethodOrder> method_order;
+  std::unique_ptr<ClassOrder> class_order;
+};
+
+/*
+ * The method trace to lay out code and strings by: the "method_profile_order"
+ * file, which lists one method per line in the order they first ran, or the
+ * coldstart method list when there is none.
+ */
+std::unique_ptr<MethodOrder> load_method_order(ConfigFiles& cfg,
+                                               const Json::Value& json_cfg) {
+  std::unique_ptr<MethodOrder> order(new MethodOrder());
+  unsigned int index = 0;
+  auto filename = json_cfg.get("method_profile_order", "").asString();
+  if (filename.empty()) {
+    const auto& refs = cfg.get_coldstart_method_refs();
+    for (auto ref : refs) {
+      if (ref != nullptr && ref->is_def()) {
+        auto meth = static_cast<DexMethod*>(ref);
+        if (!order->count(meth)) {
+          (*order)[meth] = index++;
+        }
+      }
+    }
+    TRACE(CUSTOMSORT, 1, "resolved %lu of %lu coldstart methods\n",
+        order->size(),
+        refs.size());
+    return order;
+  }
+  std::vector<std::string> descriptors;
+  std::ifstream profile(filename);
+  if (!profile) {
+    fprintf(stderr, "Failed to open method profile order: `%s'\n",
+            filename.c_str());
+  }
+  std::string descriptor;
+  while (std::getline(profile, descriptor)) {
+    if (descriptor.length() > 0) {
+      descriptors.push_back(
+          cfg.get_proguard_map().translate_method(descriptor));
+    }
+  }
+  for (const auto& name : descriptors) {
+    auto meth = find_method(name);
+    if (meth != nullptr && !order->count(meth)) {
+      (*order)[meth] = index++;
+    }
+  }
+  TRACE(CUSTOMSORT, 1, "resolved %lu of %lu profiled methods\n",
+      order->size(),
+      descriptors.size());
+  return order;
+}
+
+std::unique_ptr<ClassOrder> load_class_order(ConfigFiles& cfg) {
+  std::unique_ptr<ClassOrder> order(new ClassOrder());
+  unsigned int index = 0;
+  for (auto type : cfg.get_coldstart_types()) {
+    if (type != nullptr && !order->count(type)) {
+      (*order)[type] = index++;
+    }
+  }
+  return order;
+}
+
+DexOutputOptions make_dex_output_options(ConfigFiles& cfg,
+                                         const Json::Value& json_cfg) {
+  DexOutputOptions opts;
+  opts.method_mapping_filename = cfg.metafile(
     json_cfg.get("method_mapping", "").asString());
-  auto class_mapping_filename = cfg.metafile(
+  opts.class_mapping_filename = cfg.metafile(
     json_cfg.get("class_mapping", "").asString());
-  auto pg_mapping_filename = cfg.metafile(
+  opts.pg_mapping_filename = cfg.metafile(
     json_cfg.get("proguard_map_output", "").asString());
-  auto bytecode_offset_filename = cfg.metafile(
+  opts.bytecode_offset_filename = cfg.metafile(
     json_cfg.get("bytecode_offset_map", "").asString());
 
   auto sort_strings = json_cfg.get("string_sort_mode", "").asString();
-  SortMode string_sort_mode = SortMode::DEFAULT;
   if (sort_strings == "class_strings") {
-    string_sort_mode = SortMode::CLASS_STRINGS;
+    opts.string_sort_mode = SortMode::CLASS_STRINGS;
   } else if (sort_strings == "class_order") {
-    string_sort_mode = SortMode::CLASS_ORDER;
+    opts.string_sort_mode = SortMode::CLASS_ORDER;
+  } else if (sort_strings == "method_profile_order") {
+    opts.string_sort_mode = SortMode::METHOD_PROFILE_ORDER;
+  } else if (sort_strings == "coldstart_order") {
+    opts.string_sort_mode = SortMode::COLDSTART_ORDER;
   }
 
   auto sort_bytecode_cfg = json_cfg.get("bytecode_sort_mode", Json::Value());
-  std::vector<SortMode> code_sort_mode;
-
   if (sort_bytecode_cfg.isString()) {
-    code_sort_mode.push_back(make_sort_bytecode(sort_bytecode_cfg.asString()));
+    opts.code_sort_mode.push_back(
+        make_sort_bytecode(sort_bytecode_cfg.asString()));
   } else if (sort_bytecode_cfg.isArray()) {
     for (auto val : sort_bytecode_cfg) {
-      code_sort_mode.push_back(make_sort_bytecode(val.asString()));
+      opts.code_sort_mode.push_back(make_sort_bytecode(val.asString()));
     }
   }
-  if (code_sort_mode.empty()) {
-    code_sort_mode.push_back(SortMode::DEFAULT);
+  if (opts.code_sort_mode.empty()) {
+    opts.code_sort_mode.push_back(SortMode::DEFAULT);
+  }
+  if (opts.string_sort_mode == SortMode::COLDSTART_ORDER) {
+    opts.class_order = load_class_order(cfg);
   }
+  if (opts.string_sort_mode == SortMode::METHOD_PROFILE_ORDER ||
+      opts.string_sort_mode == SortMode::COLDSTART_ORDER ||
+      std::find(opts.code_sort_mode.begin(),
+                opts.code_sort_mode.end(),
+                SortMode::METHOD_PROFILE_ORDER) != opts.code_sort_mode.end()) {
+    opts.method_order = load_method_order(cfg, json_cfg);
+  }
+  return opts;
+}
 
+} // namespace
+
+dex_stats_t
+write_classes_to_dex(
+  std::string filename,
+  DexClasses* classes,
+  LocatorIndex* locator_index,
+  size_t dex_number,
+  ConfigFiles& cfg,
+  const Json::Value& json_cfg,
+  PositionMapper* pos_mapper,
+  async_io::AsyncWriter* writer)
+{
+  auto opts = make_dex_output_options(cfg, json_cfg);
   DexOutput dout = DexOutput(
     filename.c_str(),
     classes,
@@ -1542,16 +2177,89 @@ write_classes_to_dex(
     dex_number,
     cfg,
     pos_mapper,
-    method_mapping_filename,
-    class_mapping_filename,
-    pg_mapping_filename,
-    bytecode_offset_filename);
-
-  dout.prepare(string_sort_mode, code_sort_mode);
-  dout.write();
+    opts.method_mapping_filename,
+    opts.class_mapping_filename,
+    opts.pg_mapping_filename,
+    opts.bytecode_offset_filename,
+    opts.method_order.get(),
+    opts.class_order.get());
+
+  dout.prepare(opts.string_sort_mode, opts.code_sort_mode);
+  dout.write(writer);
   return dout.m_stats;
 }
 
+std::vector<dex_stats_t> write_classes_to_dexes(
+  const std::vector<DexOutputTarget>& targets,
+  LocatorIndex* locator_index,
+  ConfigFiles& cfg,
+  const Json::Value& json_cfg,
+  PositionMapper* pos_mapper,
+  unsigned int num_threads,
+  async_io::AsyncWriter* writer)
+{
+  auto opts = make_dex_output_options(cfg, json_cfg);
+  std::vector<std::unique_ptr<DexOutput>> outputs;
+  for (const auto& target : targets) {
+    outputs.emplace_back(new DexOutput(
+      target.filename.c_str(),
+      target.classes,
+      locator_index,
+      target.dex_number,
+      cfg,
+      pos_mapper,
+      opts.method_mapping_filename,
+      opts.class_mapping_filename,
+      opts.pg_mapping_filename,
+      opts.bytecode_offset_filename,
+      opts.method_order.get(),
+      opts.class_order.get()));
+  }
+
+  // Everything up to the debug info is independent of the other dexes.
+  std::vector<uint32_t> num_positions(outputs.size());
+  auto prepare_wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        outputs[i]->prepare_code(opts.string_sort_mode, opts.code_sort_mode);
+        num_positions[i] = outputs[i]->count_emitted_positions();
+      },
+      num_threads);
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    prepare_wq.add_item(i);
+  }
+  prepare_wq.run_all();
+
+  // The line numbers of a dex's debug info depend on how many positions the
+  // preceding dexes emitted, so hand each dex a shard starting at that offset.
+  std::vector<std::unique_ptr<PositionMapper>> shards;
+  uint32_t line_base = 0;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    shards.emplace_back(pos_mapper->make_shard(line_base));
+    line_base += num_positions[i];
+  }
+  auto finish_wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        outputs[i]->finish(shards[i].get());
+        outputs[i]->write_dex(writer);
+        outputs[i]->format_symbol_files();
+      },
+      num_threads);
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    finish_wq.add_item(i);
+  }
+  finish_wq.run_all();
+
+  // The symbol files are shared by all dexes, so the formatted mappings are
+  // appended to them in order.
+  std::vector<dex_stats_t> stats;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    outputs[i]->write_symbol_files(writer);
+    pos_mapper->merge_shard(shards[i].get());
+    stats.push_back(outputs[i]->m_stats);
+  }
+  return stats;
+}
+
 LocatorIndex
 make_locator_index(DexStoresVector& stores)
 {
@@ -1583,3 +2291,94 @@ make_locator_index(DexStoresVector& stores)
 
   return index;
 }
+
+std::string make_locator_table(const LocatorIndex& index) {
+  using facebook::LocatorTableEntry;
+  using facebook::LocatorTableHeader;
+  using facebook::locator_table_hash;
+
+  std::vector<std::pair<const char*, const Locator*>> classes;
+  for (const auto& pair : index) {
+    classes.emplace_back(pair.first->c_str(), &pair.second);
+  }
+  std::sort(classes.begin(),
+            classes.end(),
+            [](const std::pair<const char*, const Locator*>& a,
+               const std::pair<const char*, const Locator*>& b) {
+              return strcmp(a.first, b.first) < 0;
+            });
+
+  // About four classes per bucket keeps the seeds cheap to find.
+  uint32_t num_entries = classes.size();
+  uint32_t num_buckets = std::max(1u, num_entries / 4);
+  std::vector<std::vector<uint32_t>> buckets(num_buckets);
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    buckets[locator_table_hash(classes[i].first, 0) % num_buckets].push_back(i);
+  }
+  // The largest buckets go first, while most entries are still free.
+  std::vector<uint32_t> order(num_buckets);
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  std::vector<uint32_t> seeds(num_buckets);
+  std::vector<int64_t> slots(num_entries, -1);
+  std::vector<uint32_t> bucket_slots;
+  for (auto bucket : order) {
+    const auto& members = buckets[bucket];
+    if (members.empty()) {
+      break;
+    }
+    for (uint32_t seed = 1;; ++seed) {
+      always_assert_log(seed != 0, "No seed for locator table bucket");
+      bucket_slots.clear();
+      bool ok = true;
+      for (auto i : members) {
+        auto slot = locator_table_hash(classes[i].first, seed) % num_entries;
+        if (slots[slot] != -1 ||
+            std::find(bucket_slots.begin(), bucket_slots.end(), slot) !=
+                bucket_slots.end()) {
+          ok = false;
+          break;
+        }
+        bucket_slots.push_back(slot);
+      }
+      if (ok) {
+        seeds[bucket] = seed;
+        for (size_t j = 0; j < members.size(); ++j) {
+          slots[bucket_slots[j]] = members[j];
+        }
+        break;
+      }
+    }
+  }
+
+  std::string strings;
+  std::vector<LocatorTableEntry> entries(num_entries);
+  for (uint32_t slot = 0; slot < num_entries; ++slot) {
+    const auto& cls = classes[slots[slot]];
+    auto& entry = entries[slot];
+    entry.name_off = strings.size();
+    entry.strnr = cls.second->strnr;
+    entry.dexnr = cls.second->dexnr;
+    entry.clsnr = cls.second->clsnr;
+    strings.append(cls.first).push_back('\0');
+  }
+
+  LocatorTableHeader header;
+  memcpy(header.magic, facebook::locator_table_magic, sizeof(header.magic));
+  header.num_buckets = num_buckets;
+  header.num_entries = num_entries;
+  header.strings_size = strings.size();
+
+  std::string table;
+  table.append((const char*)&header, sizeof(header));
+  table.append((const char*)seeds.data(), seeds.size() * sizeof(uint32_t));
+  table.append((const char*)entries.data(),
+               entries.size() * sizeof(LocatorTableEntry));
+  table.append(strings);
+  return table;
+}
@@ -30,13 +30,33 @@ typedef std::unordered_map<DexMethodRef*, uint32_t> dexmethod_to_idx;
 using LocatorIndex = std::unordered_map<DexString*, Locator>;
 LocatorIndex make_locator_index(DexStoresVector& stores);
 
+/*
+ * Serializes the index as a locator table (see liblocator/locator_table.h),
+ * the perfect hash alternative to locator strings.
+ */
+std::string make_locator_table(const LocatorIndex& index);
+
 enum class SortMode {
   CLASS_ORDER,
   CLASS_STRINGS,
   CLINIT_FIRST,
+  METHOD_PROFILE_ORDER,
+  COLDSTART_ORDER,
   DEFAULT
 };
 
+/*
+ * Position of each method in an ordered method trace, e.g. the coldstart
+ * method list. Used by SortMode::METHOD_PROFILE_ORDER.
+ */
+using MethodOrder = std::unordered_map<const DexMethod*, unsigned int>;
+
+/*
+ * Position of each class in the coldstart class list. Used, along with a
+ * MethodOrder, by SortMode::COLDSTART_ORDER.
+ */
+using ClassOrder = std::unordered_map<const DexType*, unsigned int>;
+
 class DexOutputIdx {
  private:
   dexstring_to_idx* m_string;
@@ -91,6 +111,14 @@ class DexOutputIdx {
   uint32_t get_offset(uint32_t* ptr) { return get_offset((uint8_t*)ptr); }
 };
 
+namespace async_io {
+class AsyncWriter;
+}
+
+/*
+ * With a writer, the dex and the symbol files are written in the background,
+ * and are only complete once the writer has been flushed.
+ */
 dex_stats_t write_classes_to_dex(
   std::string filename,
   DexClasses* classes,
@@ -98,7 +126,29 @@ dex_stats_t write_classes_to_dex(
   size_t dex_number,
   ConfigFiles& cfg,
   const Json::Value& json_cfg,
-  PositionMapper* line_mapper);
+  PositionMapper* line_mapper,
+  async_io::AsyncWriter* writer = nullptr);
+
+struct DexOutputTarget {
+  std::string filename;
+  DexClasses* classes;
+  size_t dex_number;
+};
+
+/*
+ * Emits several dexes concurrently. The dexes, the symbol files and the
+ * position map are identical to what calling write_classes_to_dex on each
+ * target in order would produce; the stats are returned in the same order.
+ * A writer is used as by write_classes_to_dex.
+ */
+std::vector<dex_stats_t> write_classes_to_dexes(
+  const std::vector<DexOutputTarget>& targets,
+  LocatorIndex* locator_index /* nullable */,
+  ConfigFiles& cfg,
+  const Json::Value& json_cfg,
+  PositionMapper* line_mapper,
+  unsigned int num_threads,
+  async_io::AsyncWriter* writer = nullptr);
 
 typedef bool (*cmp_dstring)(const DexString*, const DexString*);
 typedef bool (*cmp_dtype)(const DexType*, const DexType*);
@@ -156,6 +206,9 @@ class GatheredTypes {
   void build_cls_load_map();
   void build_cls_map();
   void build_method_map();
+  void number_profiled_method_strings(
+      const MethodOrder& order,
+      std::unordered_map<const DexString*, unsigned int>& strings);
 
  public:
   GatheredTypes(DexClasses* classes);
@@ -164,6 +217,14 @@ class GatheredTypes {
   std::vector<DexString*> get_dexstring_emitlist(T cmp = compare_dexstrings);
   std::vector<DexString*> get_cls_order_dexstring_emitlist();
   std::vector<DexString*> keep_cls_strings_together_emitlist();
+  std::vector<DexString*> get_method_profile_order_dexstring_emitlist(
+      const MethodOrder& order);
+  // The strings of the coldstart classes and methods come first, and get
+  // added to `startup_strings`.
+  std::vector<DexString*> get_coldstart_dexstring_emitlist(
+      const ClassOrder& classes,
+      const MethodOrder& methods,
+      std::unordered_set<const DexString*>* startup_strings);
   std::vector<DexMethod*> get_dexmethod_emitlist();
 
   void gather_class(int num);
@@ -171,6 +232,8 @@ class GatheredTypes {
   void sort_dexmethod_emitlist_default_order(std::vector<DexMethod*>& lmeth);
   void sort_dexmethod_emitlist_cls_order(std::vector<DexMethod*>& lmeth);
   void sort_dexmethod_emitlist_clinit_order(std::vector<DexMethod*>& lmeth);
+  void sort_dexmethod_emitlist_method_profile_order(
+      std::vector<DexMethod*>& lmeth, const MethodOrder& order);
 
   std::unordered_set<DexString*> index_type_names();
 };
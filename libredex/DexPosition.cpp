@@ -15,12 +15,16 @@
 #include "DexPosition.h"
 #include "DexUtil.h"
 
-DexPosition::DexPosition(uint32_t line) : line(line), parent(nullptr) {}
+DexPosition* DexPosition::make(DexMethod* method,
+                               DexString* file,
+                               uint32_t line,
+                               DexPosition* parent) {
+  return g_redex->make_position(method, file, line, parent);
+}
 
-void DexPosition::bind(DexMethod* method_, DexString* file_) {
+DexPosition* DexPosition::bind(DexMethod* method_, DexString* file_) const {
   always_assert(method_ != nullptr);
-  this->method = method_;
-  this->file = file_;
+  return make(method_, file_, line, parent);
 }
 
 bool DexPosition::operator==(const DexPosition& that) const {
@@ -31,7 +35,8 @@ bool DexPosition::operator==(const DexPosition& that) const {
 }
 
 void RealPositionMapper::register_position(DexPosition* pos) {
-  m_pos_line_map[pos] = -1;
+  // Positions are shared, this one may have been emitted already.
+  m_pos_line_map.emplace(pos, -1);
 }
 
 uint32_t RealPositionMapper::get_line(DexPosition* pos) {
@@ -39,12 +44,35 @@ uint32_t RealPositionMapper::get_line(DexPosition* pos) {
 }
 
 uint32_t RealPositionMapper::position_to_line(DexPosition* pos) {
-  auto idx = m_positions.size();
+  auto idx = m_line_base + m_positions.size();
   m_positions.emplace_back(pos);
   m_pos_line_map[pos] = idx;
   return get_line(pos);
 }
 
+PositionMapper* RealPositionMapper::make_shard(uint32_t line_base) {
+  auto shard = new RealPositionMapper("", "");
+  shard->m_line_base = line_base;
+  return shard;
+}
+
+void RealPositionMapper::merge_shard(PositionMapper* shard) {
+  auto real_shard = static_cast<RealPositionMapper*>(shard);
+  always_assert_log(
+      real_shard->m_line_base == next_line_base(),
+      "Position map shards must be merged in emission order\n");
+  m_positions.insert(m_positions.end(),
+                     real_shard->m_positions.begin(),
+                     real_shard->m_positions.end());
+  for (const auto& pair : real_shard->m_pos_line_map) {
+    if (pair.second == -1) {
+      m_pos_line_map.emplace(pair.first, -1);
+    } else {
+      m_pos_line_map[pair.first] = pair.second;
+    }
+  }
+}
+
 void RealPositionMapper::write_map() {
   if (m_filename != "") {
     write_map_v1();
@@ -19,17 +19,44 @@ class DexMethod;
 class DexString;
 class DexDebugItem;
 
+/*
+ * Positions are interned in the RedexContext, keyed by all four of their
+ * fields, and are immutable. The copies of a method's code, the entries that
+ * restore a call site's position after the inlined code, and the callees
+ * inlined more than once under the same call site share their DexPositions
+ * instead of each holding clones. Since a parent is interned before its
+ * children, equal positions are always the same object.
+ */
 struct DexPosition final {
-  DexMethod* method{nullptr};
-  DexString* file{nullptr};
-  uint32_t line;
+  DexMethod* const method;
+  DexString* const file;
+  const uint32_t line;
   // when a function gets inlined for the first time, all its DexPositions will
   // have the DexPosition of the callsite as their parent.
-  DexPosition* parent;
-  DexPosition(uint32_t line);
+  DexPosition* const parent;
+
+  static DexPosition* make(DexMethod* method,
+                           DexString* file,
+                           uint32_t line,
+                           DexPosition* parent = nullptr);
+
+  // A position read from a debug item, before it is bound to its method.
+  static DexPosition* make(uint32_t line) {
+    return make(nullptr, nullptr, line);
+  }
 
-  void bind(DexMethod* method_, DexString* file_);
+  // The same position in another method and file.
+  DexPosition* bind(DexMethod* method_, DexString* file_) const;
   bool operator==(const DexPosition&) const;
+
+ private:
+  DexPosition(DexMethod* method,
+              DexString* file,
+              uint32_t line,
+              DexPosition* parent)
+      : method(method), file(file), line(line), parent(parent) {}
+
+  friend struct RedexContext;
 };
 
 class PositionMapper {
@@ -39,6 +66,16 @@ class PositionMapper {
   virtual uint32_t position_to_line(DexPosition*) = 0;
   virtual void register_position(DexPosition* pos) = 0;
   virtual void write_map() = 0;
+  /*
+   * When several dexes are encoded concurrently, each one maps its positions
+   * through a shard whose line numbers start after the first `line_base`
+   * positions. Merging the shards back in dex order leaves the mapper in the
+   * same state as a serial emission would have.
+   */
+  virtual PositionMapper* make_shard(uint32_t line_base) = 0;
+  virtual void merge_shard(PositionMapper* shard) = 0;
+  // Where a shard for the positions mapped after the current ones starts.
+  virtual uint32_t next_line_base() const = 0;
   static PositionMapper* make(const std::string& map_filename,
                               const std::string& map_filename_v2);
 };
@@ -55,6 +92,7 @@ class RealPositionMapper : public PositionMapper {
   std::string m_filename_v2;
   std::vector<DexPosition*> m_positions;
   std::unordered_map<DexPosition*, int64_t> m_pos_line_map;
+  uint32_t m_line_base{0};
  protected:
   uint32_t get_line(DexPosition*);
   void write_map_v1();
@@ -67,6 +105,11 @@ class RealPositionMapper : public PositionMapper {
   virtual uint32_t position_to_line(DexPosition*);
   virtual void register_position(DexPosition* pos);
   virtual void write_map();
+  virtual PositionMapper* make_shard(uint32_t line_base);
+  virtual void merge_shard(PositionMapper* shard);
+  virtual uint32_t next_line_base() const {
+    return m_line_base + m_positions.size();
+  }
 };
 
 class NoopPositionMapper : public PositionMapper {
@@ -77,4 +120,9 @@ class NoopPositionMapper : public PositionMapper {
   }
   virtual void register_position(DexPosition* pos) {}
   virtual void write_map() {}
+  virtual PositionMapper* make_shard(uint32_t line_base) {
+    return new NoopPositionMapper();
+  }
+  virtual void merge_shard(PositionMapper* shard) {}
+  virtual uint32_t next_line_base() const { return 0; }
 };
@@ -411,6 +411,8 @@ dex_stats_t&
   lhs.num_type_lists += rhs.num_type_lists;
   lhs.num_bytes += rhs.num_bytes;
   lhs.num_instructions += rhs.num_instructions;
+  lhs.num_hot_code_bytes += rhs.num_hot_code_bytes;
+  lhs.num_hot_string_pages += rhs.num_hot_string_pages;
   return lhs;
 }
 
@@ -505,3 +507,18 @@ bool relocate_method_if_no_changes(DexMethod* method, DexType* to_type) {
 
   return true;
 }
+
+DexMethod* find_method(std::string descriptor) {
+  if (descriptor.find(':') == std::string::npos) {
+    auto lparen = descriptor.find('(');
+    if (lparen == std::string::npos) {
+      return nullptr;
+    }
+    descriptor.insert(lparen, ":");
+  }
+  auto ref = DexMethod::get_method(descriptor);
+  if (ref == nullptr || !ref->is_def()) {
+    return nullptr;
+  }
+  return static_cast<DexMethod*>(ref);
+}
@@ -238,6 +238,13 @@ void relocate_method(DexMethod* method, DexType* to_type);
  */
 bool relocate_method_if_no_changes(DexMethod* method, DexType* to_type);
 
+/**
+ * Looks up the method definition with the given descriptor, which may be a
+ * full one (Lcls;.name:(args)rtype) or lack the colon, as in the coldstart
+ * method list. Returns nullptr if there is no such definition.
+ */
+DexMethod* find_method(std::string descriptor);
+
 /**
  * Merge the 2 visibility access flags. Return the most permissive visibility.
  */
@@ -366,6 +373,13 @@ struct dex_stats_t {
   int num_type_lists = 0;
   int num_bytes = 0;
   int num_instructions = 0;
+  // Size of the code items spanning all the methods of the method profile,
+  // when emitting code in SortMode::METHOD_PROFILE_ORDER.
+  int num_hot_code_bytes = 0;
+  // Number of 4K pages of string data holding strings that the coldstart
+  // classes and methods reference, when emitting strings in
+  // SortMode::COLDSTART_ORDER.
+  int num_hot_string_pages = 0;
 };
 
 dex_stats_t&
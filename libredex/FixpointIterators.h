@@ -12,11 +12,15 @@
 #include <algorithm>
 #include <cstddef>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
 #include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include <boost/optional.hpp>
+
 #include "AbstractDomain.h"
 #include "Debug.h"
 #include "WeakTopologicalOrdering.h"
@@ -53,6 +57,18 @@ class MonotonicFixpointIteratorContext final {
     return it->second;
   }
 
+  /*
+   * The number of iterations over all the SCCs, i.e. a measure of how hard
+   * the graph was to analyze.
+   */
+  uint64_t get_total_iterations() const { return m_total_iterations; }
+
+  /*
+   * The number of times the entry state of an SCC head was set to Top because
+   * it ran out of iterations (see FixpointIterationOptions::max_iterations).
+   */
+  uint32_t get_iteration_limit_hits() const { return m_iteration_limit_hits; }
+
  private:
   explicit MonotonicFixpointIteratorContext(const Domain& init)
       : m_init(init) {}
@@ -71,20 +87,43 @@ class MonotonicFixpointIteratorContext final {
   void increase_iteration_count_for(const NodeId& node) {
     increase_iteration_count(node, &m_local_iterations);
     increase_iteration_count(node, &m_global_iterations);
+    ++m_total_iterations;
   }
 
   void reset_local_iteration_count_for(const NodeId& node) {
     m_local_iterations.erase(node);
   }
 
-  const Domain& m_init;
+  // The context outlives run(), so that the iteration counts can be looked
+  // at afterwards.
+  const Domain m_init;
   std::unordered_map<NodeId, uint32_t, NodeHash> m_global_iterations;
   std::unordered_map<NodeId, uint32_t, NodeHash> m_local_iterations;
+  uint64_t m_total_iterations{0};
+  uint32_t m_iteration_limit_hits{0};
 
   template <typename T1, typename T2, typename T3>
   friend class MonotonicFixpointIterator;
 };
 
+/*
+ * The knobs of the iteration over the SCCs of a MonotonicFixpointIterator.
+ */
+struct FixpointIterationOptions {
+  // The number of iterations over an SCC whose new entry state is joined into
+  // the current entry state of the head, before the default extrapolate()
+  // starts widening.
+  uint32_t widening_delay{1};
+  // Once the increasing iterations over an SCC have reached a post-fixpoint,
+  // the number of decreasing iterations that refine() the entry state of the
+  // head.
+  uint32_t narrowing_iterations{0};
+  // When the head of an SCC has been analyzed that many times in total, its
+  // entry state is set to Top, which makes the SCC stable at the next
+  // iteration. Zero means no limit.
+  uint32_t max_iterations{0};
+};
+
 template <typename Derived>
 class FixpointIteratorGraphSpec {
 
@@ -94,19 +133,21 @@ class FixpointIteratorGraphSpec {
     using EdgeId = typename Derived::EdgeId;
 
     // The graph is specified by its root node together with the successors,
-    // predecessors, and edge source/target functions.
+    // predecessors, and edge source/target functions. The successors and
+    // predecessors may be any range of EdgeIds, e.g. a view into the graph
+    // rather than a copy.
     static_assert(std::is_same<decltype(Derived::entry(std::declval<Graph>())),
                                NodeId>::value,
                   "No implementation of entry()");
     static_assert(
-        std::is_same<decltype(Derived::predecessors(std::declval<Graph>(),
-                                                    std::declval<NodeId>())),
-                     std::vector<EdgeId>>::value,
+        std::is_convertible<decltype(*std::begin(Derived::predecessors(
+                                std::declval<Graph>(), std::declval<NodeId>()))),
+                            EdgeId>::value,
         "No implementation of predecessors()");
     static_assert(
-        std::is_same<decltype(Derived::successors(std::declval<Graph>(),
-                                                  std::declval<NodeId>())),
-                     std::vector<EdgeId>>::value,
+        std::is_convertible<decltype(*std::begin(Derived::successors(
+                                std::declval<Graph>(), std::declval<NodeId>()))),
+                            EdgeId>::value,
         "No implementation of successors()");
     static_assert(
         std::is_same<decltype(Derived::source(std::declval<Graph>(),
@@ -121,6 +162,180 @@ class FixpointIteratorGraphSpec {
   }
 };
 
+namespace fp_impl {
+
+template <typename... Ts>
+struct make_void {
+  using type = void;
+};
+
+/*
+ * A GraphInterface may provide
+ *
+ *   static std::shared_ptr<const WeakTopologicalOrdering<NodeId>> wto(
+ *       const Graph& graph);
+ *
+ * to share the weak topological ordering of a graph between all the fixpoint
+ * iterators that run on it. It may return null, in which case the iterator
+ * computes its own.
+ */
+template <typename GraphInterface, typename = void>
+struct has_cached_wto : std::false_type {};
+
+template <typename GraphInterface>
+struct has_cached_wto<
+    GraphInterface,
+    typename make_void<decltype(GraphInterface::wto(
+        std::declval<const typename GraphInterface::Graph&>()))>::type>
+    : std::true_type {};
+
+/*
+ * A GraphInterface may also number its nodes densely with
+ *
+ *   static size_t node_index(const Graph& graph, const NodeId& node);
+ *
+ * in which case the fixpoint iterators keep the states of the nodes in
+ * vectors indexed by those numbers instead of hash tables.
+ */
+template <typename GraphInterface, typename = void>
+struct has_node_index : std::false_type {};
+
+template <typename GraphInterface>
+struct has_node_index<
+    GraphInterface,
+    typename make_void<decltype(GraphInterface::node_index(
+        std::declval<const typename GraphInterface::Graph&>(),
+        std::declval<const typename GraphInterface::NodeId&>()))>::type>
+    : std::true_type {};
+
+template <typename GraphInterface, typename NodeHash>
+using Wto =
+    WeakTopologicalOrdering<typename GraphInterface::NodeId, NodeHash>;
+
+template <typename GraphInterface, typename NodeHash>
+std::shared_ptr<const Wto<GraphInterface, NodeHash>> make_wto(
+    const typename GraphInterface::Graph& graph) {
+  using NodeId = typename GraphInterface::NodeId;
+  return std::make_shared<const Wto<GraphInterface, NodeHash>>(
+      GraphInterface::entry(graph), [&graph](const NodeId& x) {
+        const auto& succ_edges = GraphInterface::successors(graph, x);
+        std::vector<NodeId> succ_nodes;
+        std::transform(succ_edges.begin(),
+                       succ_edges.end(),
+                       std::back_inserter(succ_nodes),
+                       std::bind(&GraphInterface::target,
+                                 std::ref(graph),
+                                 std::placeholders::_1));
+        return succ_nodes;
+      });
+}
+
+template <typename GraphInterface, typename NodeHash>
+std::shared_ptr<const Wto<GraphInterface, NodeHash>> get_wto(
+    const typename GraphInterface::Graph& graph, std::false_type) {
+  return make_wto<GraphInterface, NodeHash>(graph);
+}
+
+template <typename GraphInterface, typename NodeHash>
+std::shared_ptr<const Wto<GraphInterface, NodeHash>> get_wto(
+    const typename GraphInterface::Graph& graph, std::true_type) {
+  auto wto = GraphInterface::wto(graph);
+  if (wto == nullptr) {
+    return make_wto<GraphInterface, NodeHash>(graph);
+  }
+  return wto;
+}
+
+template <typename GraphInterface, typename NodeHash>
+std::shared_ptr<const Wto<GraphInterface, NodeHash>> get_wto(
+    const typename GraphInterface::Graph& graph) {
+  // A cached WTO is always built with the default hash.
+  using use_cache = std::integral_constant<
+      bool,
+      has_cached_wto<GraphInterface>::value &&
+          std::is_same<NodeHash,
+                       std::hash<typename GraphInterface::NodeId>>::value>;
+  return get_wto<GraphInterface, NodeHash>(graph, use_cache());
+}
+
+/*
+ * The abstract states attached to the nodes of a graph, kept in a hash table.
+ */
+template <typename GraphInterface,
+          typename Domain,
+          typename NodeHash,
+          typename = void>
+class NodeStates final {
+ public:
+  using Graph = typename GraphInterface::Graph;
+  using NodeId = typename GraphInterface::NodeId;
+
+  NodeStates(const Graph&, size_t size_hint) : m_states(size_hint) {}
+
+  // Returns null if the node has no state.
+  const Domain* find(const NodeId& node) const {
+    auto it = m_states.find(node);
+    return it == m_states.end() ? nullptr : &it->second;
+  }
+
+  // Default-constructs the state of the node if it has none. References to
+  // other states remain valid.
+  Domain& operator[](const NodeId& node) { return m_states[node]; }
+
+  void clear() { m_states.clear(); }
+
+ private:
+  std::unordered_map<NodeId, Domain, NodeHash> m_states;
+};
+
+/*
+ * The abstract states attached to the nodes of a graph, kept in a vector
+ * indexed by node numbers.
+ */
+template <typename GraphInterface, typename Domain, typename NodeHash>
+class NodeStates<GraphInterface,
+                 Domain,
+                 NodeHash,
+                 std::enable_if_t<has_node_index<GraphInterface>::value>>
+    final {
+ public:
+  using Graph = typename GraphInterface::Graph;
+  using NodeId = typename GraphInterface::NodeId;
+
+  NodeStates(const Graph& graph, size_t size_hint) : m_graph(graph) {
+    m_states.reserve(size_hint);
+  }
+
+  const Domain* find(const NodeId& node) const {
+    auto idx = GraphInterface::node_index(m_graph, node);
+    if (idx >= m_states.size() || !m_states[idx]) {
+      return nullptr;
+    }
+    return &*m_states[idx];
+  }
+
+  // Unlike in the hash table, this may move the other states, so callers must
+  // not hold on to them across calls.
+  Domain& operator[](const NodeId& node) {
+    auto idx = GraphInterface::node_index(m_graph, node);
+    if (idx >= m_states.size()) {
+      m_states.resize(idx + 1);
+    }
+    if (!m_states[idx]) {
+      m_states[idx] = Domain();
+    }
+    return *m_states[idx];
+  }
+
+  void clear() { m_states.clear(); }
+
+ private:
+  const Graph& m_graph;
+  std::vector<boost::optional<Domain>> m_states;
+};
+
+} // namespace fp_impl
+
 /*
  * This is the implementation of a monotonically increasing chaotic fixpoint
  * iteration sequence with widening over a control-flow graph using the
@@ -161,23 +376,15 @@ class MonotonicFixpointIterator {
    * the constructor, so as to prevent unnecessary resizing of the underlying
    * hashtables during the iteration.
    */
-  MonotonicFixpointIterator(const Graph& graph, size_t cfg_size_hint = 4)
+  MonotonicFixpointIterator(
+      const Graph& graph,
+      size_t cfg_size_hint = 4,
+      const FixpointIterationOptions& options = FixpointIterationOptions())
       : m_graph(graph),
-        m_wto(GraphInterface::entry(graph),
-              [=, &graph](const NodeId& x) {
-                std::vector<EdgeId> succ_edges =
-                    GraphInterface::successors(graph, x);
-                std::vector<NodeId> succ_nodes;
-                std::transform(succ_edges.begin(),
-                               succ_edges.end(),
-                               std::back_inserter(succ_nodes),
-                               std::bind(&GraphInterface::target,
-                                         std::ref(graph),
-                                         std::placeholders::_1));
-                return succ_nodes;
-              }),
-        m_entry_states(cfg_size_hint),
-        m_exit_states(cfg_size_hint) {}
+        m_options(options),
+        m_wto(fp_impl::get_wto<GraphInterface, NodeHash>(graph)),
+        m_entry_states(graph, cfg_size_hint),
+        m_exit_states(graph, cfg_size_hint) {}
 
   /*
    * This method implements the semantic transformer for each node in the
@@ -217,20 +424,33 @@ class MonotonicFixpointIterator {
    * very significant impact on the precision of the final result. This method
    * gives the user a way to parameterize the application of the widening
    * operator. A default widening strategy is provided, which applies the join
-   * at the first iteration and then the widening at all subsequent iterations
-   * until the limit is reached.
+   * at the first `widening_delay` iterations and then the widening at all
+   * subsequent iterations until the limit is reached.
    */
   virtual void extrapolate(const Context& context,
                            const NodeId& node,
                            Domain* current_state,
                            const Domain& new_state) const {
-    if (context.get_local_iterations_for(node) == 0) {
+    if (context.get_local_iterations_for(node) < m_options.widening_delay) {
       current_state->join_with(new_state);
     } else {
       current_state->widen_with(new_state);
     }
   }
 
+  /*
+   * This method is invoked on the head of an SCC at each decreasing iteration
+   * (see FixpointIterationOptions::narrowing_iterations). Like extrapolate(),
+   * it lets the user choose how the entry state of the head is refined, which
+   * is done with the narrowing by default.
+   */
+  virtual void refine(const Context& /* context */,
+                      const NodeId& /* node */,
+                      Domain* current_state,
+                      const Domain& new_state) const {
+    current_state->narrow_with(new_state);
+  }
+
   /*
    * Executes the fixpoint iterator given an abstract value describing the
    * initial program configuration. This method can be invoked multiple times
@@ -240,19 +460,28 @@ class MonotonicFixpointIterator {
   void run(const Domain& init) {
     std::lock_guard<std::recursive_mutex> guard(m_lock);
     clear();
-    Context context(init);
-    for (const WtoComponent<NodeId>& component : m_wto) {
-      analyze_component(&context, component);
+    m_context.reset(new Context(init));
+    for (const WtoComponent<NodeId>& component : *m_wto) {
+      analyze_component(m_context.get(), component);
     }
   }
 
+  /*
+   * Returns the context of the last run, with the iteration counts.
+   */
+  const Context& get_context() const {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    always_assert(m_context != nullptr);
+    return *m_context;
+  }
+
   /*
    * Returns the invariant computed by the fixpoint iterator at a node entry.
    */
   Domain get_entry_state_at(const NodeId& node) const {
     std::lock_guard<std::recursive_mutex> guard(m_lock);
-    auto it = m_entry_states.find(node);
-    return (it == m_entry_states.end()) ? Domain::bottom() : it->second;
+    auto state = m_entry_states.find(node);
+    return (state == nullptr) ? Domain::bottom() : *state;
   }
 
   /*
@@ -260,7 +489,7 @@ class MonotonicFixpointIterator {
    */
   Domain get_exit_state_at(const NodeId& node) const {
     std::lock_guard<std::recursive_mutex> guard(m_lock);
-    auto it = m_exit_states.find(node);
+    auto state = m_exit_states.find(node);
     // It's impossible to get rid of this condition by initializing all exit
     // states to _|_ prior to starting the fixpoint iteration. The reason is
     // that we only have a partial view of the control-flow graph, i.e., all
@@ -275,7 +504,7 @@ class MonotonicFixpointIterator {
     // When computing the entry state of A, we perform the join of the exit
     // states of all its predecessors, which include U. Since U is invisible to
     // the fixpoint iterator, there is no way to initialize its exit state.
-    return (it == m_exit_states.end()) ? Domain::bottom() : it->second;
+    return (state == nullptr) ? Domain::bottom() : *state;
   }
 
  private:
@@ -322,22 +551,36 @@ class MonotonicFixpointIterator {
     analyze_node(node, &exit_state);
   }
 
+  // Analyzes the head of an SCC from its current entry state.
+  void analyze_head(const NodeId& head) {
+    Domain exit_state = m_entry_states[head];
+    analyze_node(head, &exit_state);
+    m_exit_states[head] = std::move(exit_state);
+  }
+
+  void analyze_scc_body(Context* context, const WtoComponent<NodeId>& scc) {
+    analyze_head(scc.head_node());
+    for (const auto& component : scc) {
+      analyze_component(context, component);
+    }
+  }
+
   void analyze_scc(Context* context, const WtoComponent<NodeId>& scc) {
     NodeId head = scc.head_node();
-    bool iterate = true;
-    for (context->reset_local_iteration_count_for(head); iterate;
+    // The entry state of the head is only computed from its predecessors when
+    // entering the SCC. The iterations then extrapolate it from the states
+    // coming in through the back edges, so that the widening sticks.
+    compute_entry_state(context, head, &m_entry_states[head]);
+    for (context->reset_local_iteration_count_for(head);;
          context->increase_iteration_count_for(head)) {
-      analyze_vertex(context, head);
-      for (const auto& component : scc) {
-        analyze_component(context, component);
-      }
+      analyze_scc_body(context, scc);
       // The current state of the iteration is represented by a pointer to the
-      // slot associated with the head node in the hash table of entry states.
-      // The state is updated in place within the hash table via side effects,
-      // which avoids costly copies and allocations.
-      Domain* current_state = &m_entry_states[head];
+      // slot associated with the head node in the table of entry states. The
+      // state is updated in place within the table via side effects, which
+      // avoids costly copies and allocations.
       Domain new_state;
       compute_entry_state(context, head, &new_state);
+      Domain* current_state = &m_entry_states[head];
       if (new_state.leq(*current_state)) {
         // At this point we know that the monotonic iteration sequence has
         // converged and current_state is a post-fixpoint. However, since all
@@ -348,18 +591,40 @@ class MonotonicFixpointIterator {
         // widening). Since new_state may be more precise than current_state,
         // it's better to use it as the final result of the iteration sequence.
         *current_state = std::move(new_state);
-        iterate = false;
+        break;
+      }
+      if (m_options.max_iterations != 0 &&
+          context->get_global_iterations_for(head) + 1 >=
+              m_options.max_iterations) {
+        // Top is always a post-fixpoint, hence the next iteration is the last.
+        current_state->set_to_top();
+        ++context->m_iteration_limit_hits;
       } else {
         extrapolate(*context, head, current_state, new_state);
       }
     }
+
+    for (uint32_t i = 0; i < m_options.narrowing_iterations; ++i) {
+      analyze_scc_body(context, scc);
+      Domain new_state;
+      compute_entry_state(context, head, &new_state);
+      Domain* current_state = &m_entry_states[head];
+      Domain refined_state = *current_state;
+      refine(*context, head, &refined_state, new_state);
+      if (current_state->leq(refined_state)) {
+        break;
+      }
+      *current_state = std::move(refined_state);
+    }
   }
 
   mutable std::recursive_mutex m_lock;
   const Graph& m_graph;
-  WeakTopologicalOrdering<NodeId, NodeHash> m_wto;
-  std::unordered_map<NodeId, Domain, NodeHash> m_entry_states;
-  std::unordered_map<NodeId, Domain, NodeHash> m_exit_states;
+  const FixpointIterationOptions m_options;
+  std::unique_ptr<Context> m_context;
+  std::shared_ptr<const WeakTopologicalOrdering<NodeId, NodeHash>> m_wto;
+  fp_impl::NodeStates<GraphInterface, Domain, NodeHash> m_entry_states;
+  fp_impl::NodeStates<GraphInterface, Domain, NodeHash> m_exit_states;
 };
 
 template <typename GraphInterface>
@@ -388,12 +653,12 @@ class BackwardsFixpointIterationAdaptor
   static NodeId exit(const Graph& graph) {
     return GraphInterface::entry(graph);
   }
-  static std::vector<EdgeId> predecessors(const Graph& graph,
-                                          const NodeId& node) {
+  static auto predecessors(const Graph& graph, const NodeId& node)
+      -> decltype(GraphInterface::successors(graph, node)) {
     return GraphInterface::successors(graph, node);
   }
-  static std::vector<EdgeId> successors(const Graph& graph,
-                                        const NodeId& node) {
+  static auto successors(const Graph& graph, const NodeId& node)
+      -> decltype(GraphInterface::predecessors(graph, node)) {
     return GraphInterface::predecessors(graph, node);
   }
   static NodeId source(const Graph& graph, const EdgeId& edge) {
@@ -402,4 +667,17 @@ class BackwardsFixpointIterationAdaptor
   static NodeId target(const Graph& graph, const EdgeId& edge) {
     return GraphInterface::source(graph, edge);
   }
+
+  // Only defined if the underlying GraphInterface provides backwards_wto().
+  template <typename GI = GraphInterface>
+  static auto wto(const Graph& graph) -> decltype(GI::backwards_wto(graph)) {
+    return GI::backwards_wto(graph);
+  }
+
+  // Only defined if the underlying GraphInterface provides node_index().
+  template <typename GI = GraphInterface>
+  static auto node_index(const Graph& graph, const NodeId& node)
+      -> decltype(GI::node_index(graph, node)) {
+    return GI::node_index(graph, node);
+  }
 };
@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "HierarchyCache.h"
+
+#include "Timer.h"
+
+const ClassHierarchy& HierarchyCache::get_class_hierarchy_locked() {
+  if (m_class_hierarchy == nullptr) {
+    Timer t("Building class hierarchy");
+    m_class_hierarchy = std::make_unique<ClassHierarchy>(
+        build_type_hierarchy(*m_scope.get()));
+  }
+  return *m_class_hierarchy;
+}
+
+const ClassHierarchy& HierarchyCache::get_class_hierarchy() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  return get_class_hierarchy_locked();
+}
+
+const SignatureMap& HierarchyCache::get_signature_map_locked() {
+  if (m_signature_map == nullptr) {
+    const auto& ch = get_class_hierarchy_locked();
+    Timer t("Building signature map");
+    m_signature_map = std::make_unique<SignatureMap>(build_signature_map(ch));
+  }
+  return *m_signature_map;
+}
+
+const SignatureMap& HierarchyCache::get_signature_map() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  return get_signature_map_locked();
+}
+
+const ClassScopes& HierarchyCache::get_class_scopes() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (m_class_scopes == nullptr) {
+    Timer t("Building class scopes");
+    m_class_scopes =
+        std::make_unique<ClassScopes>(*m_scope.get());
+  }
+  return *m_class_scopes;
+}
+
+const TypeSystem& HierarchyCache::get_type_system() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (m_type_system == nullptr) {
+    Timer t("Building type system");
+    m_type_system = std::make_unique<TypeSystem>(*m_scope.get());
+  }
+  return *m_type_system;
+}
+
+const HierarchyIndex& HierarchyCache::get_hierarchy_index() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (m_hierarchy_index == nullptr) {
+    const auto& ch = get_class_hierarchy_locked();
+    Timer t("Building hierarchy index");
+    m_hierarchy_index = std::make_unique<HierarchyIndex>(ch);
+  }
+  return *m_hierarchy_index;
+}
+
+const SideEffectSummaries& HierarchyCache::get_side_effect_summaries() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (m_side_effect_summaries == nullptr) {
+    const auto& sig_map = get_signature_map_locked();
+    m_side_effect_summaries = std::make_unique<SideEffectSummaries>(
+        *m_scope.get(), devirtualize(sig_map));
+  }
+  return *m_side_effect_summaries;
+}
+
+void HierarchyCache::invalidate(bool hierarchy_changed,
+                                bool signatures_changed) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  if (hierarchy_changed) {
+    m_class_hierarchy.reset();
+    m_hierarchy_index.reset();
+  }
+  if (hierarchy_changed || signatures_changed) {
+    m_signature_map.reset();
+    m_class_scopes.reset();
+    m_type_system.reset();
+    m_side_effect_summaries.reset();
+  }
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "ClassHierarchy.h"
+#include "DexUtil.h"
+#include "HierarchyIndex.h"
+#include "ScopeView.h"
+#include "SideEffectSummaries.h"
+#include "TypeSystem.h"
+#include "VirtualScope.h"
+
+/*
+ * The hierarchy analyses that many passes start by building, computed over
+ * the scope of all stores as a ScopeView has it. Each one is built the first
+ * time it's asked for and kept until invalidated, so passes that don't
+ * disturb the hierarchy share a single copy. PassManager keeps one for the passes it runs; see
+ * PassManager::get_hierarchy_cache().
+ *
+ * The class hierarchy and the hierarchy index only depend on the classes, their
+ * super classes and interfaces. The signature map, class scopes and type system also depend on
+ * the names, protos and virtual-ness of the methods. The side effect summaries
+ * also depend on the code, but passes keep what methods do, so they are
+ * dropped along with the signature map.
+ */
+class HierarchyCache {
+ public:
+  explicit HierarchyCache(ScopeView& scope) : m_scope(scope) {}
+
+  const ClassHierarchy& get_class_hierarchy();
+  const SignatureMap& get_signature_map();
+  const ClassScopes& get_class_scopes();
+  const TypeSystem& get_type_system();
+  const HierarchyIndex& get_hierarchy_index();
+  const SideEffectSummaries& get_side_effect_summaries();
+
+  /*
+   * Drop what a pass made stale. Changing the hierarchy invalidates
+   * everything; changing method signatures keeps the class hierarchy.
+   */
+  void invalidate(bool hierarchy_changed, bool signatures_changed);
+
+  void invalidate_all() { invalidate(true, true); }
+
+ private:
+  const ClassHierarchy& get_class_hierarchy_locked();
+  const SignatureMap& get_signature_map_locked();
+
+  ScopeView& m_scope;
+  std::mutex m_lock;
+  std::unique_ptr<ClassHierarchy> m_class_hierarchy;
+  std::unique_ptr<SignatureMap> m_signature_map;
+  std::unique_ptr<ClassScopes> m_class_scopes;
+  std::unique_ptr<TypeSystem> m_type_system;
+  std::unique_ptr<HierarchyIndex> m_hierarchy_index;
+  std::unique_ptr<SideEffectSummaries> m_side_effect_summaries;
+};
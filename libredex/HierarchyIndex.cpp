@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "HierarchyIndex.h"
+
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "DexUtil.h"
+
+HierarchyIndex::HierarchyIndex(const ClassHierarchy& hierarchy) {
+  // The roots are the types that aren't the child of any other, sorted so
+  // that the numbering doesn't depend on the order of the hash table.
+  std::unordered_set<const DexType*> children;
+  for (const auto& pair : hierarchy) {
+    children.insert(pair.second.begin(), pair.second.end());
+  }
+  TypeSet roots;
+  for (const auto& pair : hierarchy) {
+    if (children.count(pair.first) == 0) {
+      roots.insert(pair.first);
+    }
+  }
+
+  uint32_t time = 0;
+  // The stack holds the types being visited, along with the position of the
+  // next child to visit.
+  std::vector<std::pair<const DexType*, TypeSet::const_iterator>> stack;
+  auto enter = [&](const DexType* type, const DexType* super) {
+    m_intervals[type] = Interval{time++, 0};
+    SparseBitSet interfaces;
+    if (super != nullptr) {
+      interfaces = m_interfaces.at(super);
+    }
+    auto cls = type_class(type);
+    if (cls != nullptr) {
+      for (auto intf : cls->get_interfaces()->get_type_list()) {
+        interfaces.union_with(interface_closure(intf));
+      }
+    }
+    m_interfaces[type] = std::move(interfaces);
+    auto it = hierarchy.find(type);
+    stack.emplace_back(type,
+                       it != hierarchy.end() ? it->second.begin()
+                                             : TypeSet::const_iterator());
+  };
+  for (const auto* root : roots) {
+    enter(root, nullptr);
+    while (!stack.empty()) {
+      const auto* type = stack.back().first;
+      auto it = hierarchy.find(type);
+      auto& next = stack.back().second;
+      if (it != hierarchy.end() && next != it->second.end()) {
+        const auto* child = *next++;
+        // A malformed hierarchy could reach a type twice.
+        if (m_intervals.count(child) == 0) {
+          enter(child, type);
+        }
+        continue;
+      }
+      m_intervals[type].post = time++;
+      stack.pop_back();
+    }
+  }
+}
+
+uint32_t HierarchyIndex::interface_id(const DexType* intf) {
+  auto it = m_interface_ids.find(intf);
+  if (it != m_interface_ids.end()) {
+    return it->second;
+  }
+  uint32_t id = m_interface_ids.size();
+  m_interface_ids.emplace(intf, id);
+  return id;
+}
+
+const SparseBitSet& HierarchyIndex::interface_closure(const DexType* intf) {
+  auto it = m_interfaces.find(intf);
+  if (it != m_interfaces.end()) {
+    return it->second;
+  }
+  // Insert the interface itself before visiting its super interfaces, which
+  // stops the recursion on cyclic hierarchies.
+  SparseBitSet closure;
+  closure.insert(interface_id(intf));
+  m_interfaces[intf] = closure;
+  auto cls = type_class(intf);
+  if (cls != nullptr) {
+    for (auto super : cls->get_interfaces()->get_type_list()) {
+      closure.union_with(interface_closure(super));
+    }
+  }
+  // The recursive calls may have rehashed the table.
+  auto& result = m_interfaces[intf];
+  result = std::move(closure);
+  return result;
+}
+
+bool HierarchyIndex::is_subclass(const DexType* parent,
+                                 const DexType* child) const {
+  if (parent == child) {
+    return true;
+  }
+  auto child_it = m_intervals.find(child);
+  if (child_it == m_intervals.end()) {
+    for (auto cls = type_class(child); cls != nullptr;
+         cls = type_class(cls->get_super_class())) {
+      if (cls->get_super_class() == parent) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // All the super classes of an indexed class are indexed too.
+  auto parent_it = m_intervals.find(parent);
+  if (parent_it == m_intervals.end()) {
+    return false;
+  }
+  return parent_it->second.pre <= child_it->second.pre &&
+         child_it->second.post <= parent_it->second.post;
+}
+
+bool HierarchyIndex::implements(const DexType* cls,
+                                const DexType* intf) const {
+  auto id_it = m_interface_ids.find(intf);
+  auto it = m_interfaces.find(cls);
+  if (it == m_interfaces.end()) {
+    return cls != intf && check_cast(cls, intf);
+  }
+  return id_it != m_interface_ids.end() && cls != intf &&
+         it->second.contains(id_it->second);
+}
+
+bool HierarchyIndex::is_subtype(const DexType* parent,
+                                const DexType* child) const {
+  if (parent == child) {
+    return true;
+  }
+  auto child_it = m_interfaces.find(child);
+  if (child_it == m_interfaces.end()) {
+    return check_cast(child, parent);
+  }
+  auto id_it = m_interface_ids.find(parent);
+  if (id_it != m_interface_ids.end()) {
+    return child_it->second.contains(id_it->second);
+  }
+  if (m_intervals.count(child) == 0) {
+    // An interface, whose only super class is java.lang.Object.
+    return check_cast(child, parent);
+  }
+  return is_subclass(parent, child);
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "ClassHierarchy.h"
+#include "DexClass.h"
+#include "SparseBitSet.h"
+
+/*
+ * Answers subtype queries in constant time, where check_cast() and the
+ * subclass checks of VirtualScope.cpp walk up the super classes and
+ * interfaces of the child.
+ *
+ * The classes of a ClassHierarchy form a forest, which is numbered by a
+ * depth-first traversal: each class gets the interval between the times the
+ * traversal enters and leaves it, and a class is a subclass of another iff
+ * its interval is nested in the other's. The interfaces are numbered densely,
+ * and each class and interface keeps the set of all the interfaces it
+ * implements or extends, directly or not.
+ *
+ * The index reflects the hierarchy it was built from. Types it doesn't know
+ * about, e.g. classes outside of the scope that aren't the super class of
+ * any class in it, fall back on walking the hierarchy.
+ */
+class HierarchyIndex final {
+ public:
+  explicit HierarchyIndex(const ClassHierarchy& hierarchy);
+
+  /*
+   * Whether child is parent or one of its subclasses. Both types are expected
+   * to be classes.
+   */
+  bool is_subclass(const DexType* parent, const DexType* child) const;
+
+  /*
+   * Whether cls implements intf, or intf is among the super interfaces of the
+   * interface cls.
+   */
+  bool implements(const DexType* cls, const DexType* intf) const;
+
+  /*
+   * Whether a value of type child can be cast to type parent, like
+   * check_cast(child, parent) in DexUtil.h.
+   */
+  bool is_subtype(const DexType* parent, const DexType* child) const;
+
+  size_t class_count() const { return m_intervals.size(); }
+
+  size_t interface_count() const { return m_interface_ids.size(); }
+
+ private:
+  struct Interval {
+    uint32_t pre;
+    uint32_t post;
+  };
+
+  uint32_t interface_id(const DexType* intf);
+  const SparseBitSet& interface_closure(const DexType* intf);
+
+  std::unordered_map<const DexType*, Interval> m_intervals;
+  std::unordered_map<const DexType*, uint32_t> m_interface_ids;
+  // For classes, all the interfaces they implement. For interfaces, their
+  // super interfaces and themselves.
+  std::unordered_map<const DexType*, SparseBitSet> m_interfaces;
+};
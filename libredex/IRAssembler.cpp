@@ -12,6 +12,8 @@
 #include <boost/functional/hash.hpp>
 #include <sstream>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 
 namespace {
 
@@ -40,9 +42,6 @@ std::unordered_map<std::string, IROpcode> string_to_opcode_table = {
 };
 #undef OP
 
-using LabelDefs = std::unordered_map<std::string, MethodItemEntry*>;
-using LabelRefs = std::unordered_map<const IRInstruction*, std::string>;
-
 uint16_t reg_from_str(const std::string& reg_str) {
   always_assert(reg_str.at(0) == 'v');
   uint16_t reg;
@@ -112,8 +111,9 @@ s_expr to_s_expr(const DexPosition* pos) {
   });
 }
 
+// Sets label_str to the label a branch goes to.
 std::unique_ptr<IRInstruction> instruction_from_s_expr(
-    const std::string& opcode_str, const s_expr& e, LabelRefs* label_refs) {
+    const std::string& opcode_str, const s_expr& e, std::string* label_str) {
   auto op_it = string_to_opcode_table.find(opcode_str);
   always_assert_log(op_it != string_to_opcode_table.end(),
                     "'%s' is not a valid opcode",
@@ -192,10 +192,8 @@ std::unique_ptr<IRInstruction> instruction_from_s_expr(
   }
   if (is_branch(op)) {
     always_assert_log(!is_switch(op), "Not yet supported");
-    std::string label_str;
-    s_patn({s_patn(&label_str)}, tail)
+    s_patn({s_patn(label_str)}, tail)
         .must_match(tail, "Expecting label for " + opcode_str);
-    label_refs->emplace(insn.get(), label_str);
   }
 
   always_assert_log(tail.is_nil(),
@@ -205,7 +203,7 @@ std::unique_ptr<IRInstruction> instruction_from_s_expr(
   return insn;
 }
 
-std::unique_ptr<DexPosition> position_from_s_expr(const s_expr& e) {
+DexPosition* position_from_s_expr(const s_expr& e) {
   std::string method_str;
   std::string file_str;
   std::string line_str;
@@ -219,43 +217,173 @@ std::unique_ptr<DexPosition> position_from_s_expr(const s_expr& e) {
   uint32_t line;
   std::istringstream in(line_str);
   in >> line;
-  auto pos = std::make_unique<DexPosition>(line);
-  pos->bind(dex_method, file);
-  return pos;
+  return DexPosition::make(dex_method, file, line);
 }
 
-/*
- * Connect label defs to label refs via creation of MFLOW_TARGET instances
- */
-void handle_labels(IRCode* code,
-                   const LabelDefs& label_defs,
-                   const LabelRefs label_refs) {
-  for (auto& mie : InstructionIterable(code)) {
-    auto* insn = mie.insn;
-    if (label_refs.count(insn)) {
-      auto target_mie = label_defs.at(label_refs.at(insn));
-      auto target = new BranchTarget();
-      target->type = BRANCH_SIMPLE;
-      target->src = &mie;
-      // Since one label can be the target of multiple branches, but one
-      // MFLOW_TARGET can only point to one branching opcode, we may need to
-      // create additional MFLOW_TARGET items here.
-      if (target_mie->type == MFLOW_FALLTHROUGH) {
-        target_mie->type = MFLOW_TARGET;
-        target_mie->target = target;
-      } else {
-        always_assert(target_mie->type == MFLOW_TARGET);
-        auto new_target_mie = new MethodItemEntry(target);
-        code->insert_before(code->iterator_to(*target_mie), *new_target_mie);
-      }
-    }
+constexpr char kBinaryMagic[8] = {'R', 'D', 'X', 'I', 'R', 'B', 'I', 'N'};
+constexpr uint32_t kBinaryVersion = 1;
+
+enum class BinaryEntry : uint8_t {
+  INSTRUCTION = 0,
+  LABEL = 1,
+};
+
+template <typename T>
+void write_int(std::string& out, T value) {
+  static_assert(std::is_integral<T>::value, "only integers");
+  // Little endian, whatever the host is.
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    out.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
   }
 }
 
+void write_str(std::string& out, const std::string& str) {
+  write_int<uint32_t>(out, str.size());
+  out += str;
+}
+
+class BinaryReader {
+ public:
+  BinaryReader(const std::string& in, size_t pos) : m_in(in), m_pos(pos) {}
+
+  template <typename T>
+  T read_int() {
+    check(sizeof(T));
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      value |= uint64_t(static_cast<uint8_t>(m_in[m_pos++])) << (8 * i);
+    }
+    return static_cast<T>(value);
+  }
+
+  std::string read_str() {
+    auto size = read_int<uint32_t>();
+    check(size);
+    auto pos = m_pos;
+    m_pos += size;
+    return m_in.substr(pos, size);
+  }
+
+  bool at_end() const { return m_pos == m_in.size(); }
+
+ private:
+  void check(size_t size) const {
+    always_assert_log(m_in.size() - m_pos >= size, "Truncated binary IR");
+  }
+
+  const std::string& m_in;
+  size_t m_pos;
+};
+
 } // namespace
 
 namespace assembler {
 
+CodeBuilder::CodeBuilder() : m_code(std::make_unique<IRCode>()) {}
+
+CodeBuilder::Label CodeBuilder::make_label() {
+  m_labels.push_back(nullptr);
+  return m_labels.size() - 1;
+}
+
+bool CodeBuilder::is_placed(Label label) const {
+  return m_labels.at(label) != nullptr;
+}
+
+void CodeBuilder::place(Label label) {
+  always_assert_log(!is_placed(label), "Label %u placed twice", label);
+  // A MFLOW_FALLTHROUGH that becomes a MFLOW_TARGET if something branches to
+  // it.
+  auto maybe_target = new MethodItemEntry();
+  m_labels[label] = maybe_target;
+  m_code->push_back(*maybe_target);
+}
+
+IRInstruction* CodeBuilder::push(IRInstruction* insn) {
+  m_code->push_back(insn);
+  return insn;
+}
+
+IRInstruction* CodeBuilder::push(IROpcode op,
+                                 std::initializer_list<uint16_t> regs) {
+  auto insn = new IRInstruction(op);
+  auto reg = regs.begin();
+  if (insn->dests_size()) {
+    always_assert_log(reg != regs.end(), "Expected dest reg for %s", SHOW(op));
+    insn->set_dest(*reg++);
+  }
+  if (opcode::has_variable_srcs_size(op)) {
+    insn->set_arg_word_count(regs.end() - reg);
+  }
+  always_assert_log(static_cast<size_t>(regs.end() - reg) == insn->srcs_size(),
+                    "Wrong number of regs for %s",
+                    SHOW(op));
+  for (size_t i = 0; reg != regs.end(); ++i, ++reg) {
+    insn->set_src(i, *reg);
+  }
+  return push(insn);
+}
+
+IRInstruction* CodeBuilder::push(IROpcode op,
+                                 std::initializer_list<uint16_t> regs,
+                                 int64_t literal) {
+  return push(op, regs)->set_literal(literal);
+}
+
+IRInstruction* CodeBuilder::branch(IRInstruction* insn, Label target) {
+  always_assert(is_branch(insn->opcode()) && !is_switch(insn->opcode()));
+  always_assert(target < m_labels.size());
+  auto mie = new MethodItemEntry(insn);
+  m_code->push_back(*mie);
+  m_branches.emplace_back(mie, target);
+  return insn;
+}
+
+IRInstruction* CodeBuilder::branch(IROpcode op,
+                                   std::initializer_list<uint16_t> srcs,
+                                   Label target) {
+  auto insn = new IRInstruction(op);
+  always_assert_log(srcs.size() == insn->srcs_size(),
+                    "Wrong number of regs for %s",
+                    SHOW(op));
+  size_t i = 0;
+  for (auto src : srcs) {
+    insn->set_src(i++, src);
+  }
+  return branch(insn, target);
+}
+
+void CodeBuilder::push_position(DexPosition* pos) { m_code->push_back(pos); }
+
+std::unique_ptr<IRCode> CodeBuilder::release() {
+  // Connect the branches to their labels via MFLOW_TARGET instances.
+  for (const auto& pair : m_branches) {
+    auto target_mie = m_labels[pair.second];
+    always_assert_log(
+        target_mie != nullptr, "Label %u was never placed", pair.second);
+    auto target = new BranchTarget();
+    target->type = BRANCH_SIMPLE;
+    target->src = pair.first;
+    // Since one label can be the target of multiple branches, but one
+    // MFLOW_TARGET can only point to one branching opcode, we may need to
+    // create additional MFLOW_TARGET items here.
+    if (target_mie->type == MFLOW_FALLTHROUGH) {
+      target_mie->type = MFLOW_TARGET;
+      target_mie->target = target;
+    } else {
+      always_assert(target_mie->type == MFLOW_TARGET);
+      auto new_target_mie = new MethodItemEntry(target);
+      m_code->insert_before(m_code->iterator_to(*target_mie), *new_target_mie);
+    }
+  }
+  m_labels.clear();
+  m_branches.clear();
+  auto code = std::move(m_code);
+  m_code = std::make_unique<IRCode>();
+  return code;
+}
+
+
 s_expr to_s_expr(const IRCode* code) {
   std::vector<s_expr> exprs;
   std::unordered_map<const IRInstruction*, std::string> insn_to_label;
@@ -290,7 +418,7 @@ s_expr to_s_expr(const IRCode* code) {
       case MFLOW_DEBUG:
         always_assert_log(false, "Not yet implemented");
       case MFLOW_POSITION:
-        exprs.emplace_back(::to_s_expr(it->pos.get()));
+        exprs.emplace_back(::to_s_expr(it->pos));
         break;
       case MFLOW_TARGET:
         exprs.emplace_back(insn_to_label.at(it->target->src->insn));
@@ -306,39 +434,49 @@ s_expr to_s_expr(const IRCode* code) {
 
 std::unique_ptr<IRCode> ircode_from_s_expr(const s_expr& e) {
   s_expr insns_expr;
-  auto code = std::make_unique<IRCode>();
+  CodeBuilder builder;
   always_assert(s_patn({}, insns_expr).match_with(e));
   always_assert_log(insns_expr.size() > 0, "Empty instruction list?! %s");
-  LabelDefs label_defs;
-  LabelRefs label_refs;
+  std::unordered_map<std::string, CodeBuilder::Label> labels;
+  auto get_label = [&](const std::string& name) {
+    auto it = labels.find(name);
+    if (it == labels.end()) {
+      it = labels.emplace(name, builder.make_label()).first;
+    }
+    return it->second;
+  };
 
   for (size_t i = 0; i < insns_expr.size(); ++i) {
     std::string keyword;
     if (s_patn(&keyword).match_with(insns_expr[i])) {
       always_assert_log(keyword[0] == ':', "Labels must start with ':'");
-      auto label = keyword;
+      auto label = get_label(keyword);
       always_assert_log(
-          label_defs.count(label) == 0, "Duplicate label %s", label.c_str());
-      // We insert a MFLOW_FALLTHROUGH that may become a MFLOW_TARGET if
-      // something points to it
-      auto maybe_target = new MethodItemEntry();
-      label_defs.emplace(label, maybe_target);
-      code->push_back(*maybe_target);
+          !builder.is_placed(label), "Duplicate label %s", keyword.c_str());
+      builder.place(label);
     } else {
       s_expr tail;
       always_assert(s_patn({s_patn(&keyword)}, tail).match_with(insns_expr[i]));
       if (keyword == ".pos") {
-        code->push_back(position_from_s_expr(tail));
+        builder.push_position(position_from_s_expr(tail));
       } else {
-        auto insn = instruction_from_s_expr(keyword, tail, &label_refs);
+        std::string label_str;
+        auto insn = instruction_from_s_expr(keyword, tail, &label_str);
         always_assert(insn != nullptr);
-        code->push_back(insn.release());
+        if (is_branch(insn->opcode())) {
+          builder.branch(insn.release(), get_label(label_str));
+        } else {
+          builder.push(insn.release());
+        }
       }
     }
   }
-  handle_labels(code.get(), label_defs, label_refs);
-
-  return code;
+  for (const auto& pair : labels) {
+    always_assert_log(builder.is_placed(pair.second),
+                      "Undefined label %s",
+                      pair.first.c_str());
+  }
+  return builder.release();
 }
 
 std::unique_ptr<IRCode> ircode_from_string(const std::string& s) {
@@ -356,4 +494,155 @@ std::unique_ptr<IRCode> ircode_from_string(const std::string& s) {
   return ircode_from_s_expr(expr);
 }
 
+std::string to_binary(const IRCode* code) {
+  std::string out(kBinaryMagic, sizeof(kBinaryMagic));
+  write_int(out, kBinaryVersion);
+  write_int<uint32_t>(out, code->get_registers_size());
+  // Each MFLOW_TARGET is a label, numbered in order. The branches are
+  // written with the number of their label.
+  std::unordered_map<const IRInstruction*, uint32_t> insn_to_label;
+  for (const auto& mie : *code) {
+    if (mie.type == MFLOW_TARGET) {
+      always_assert_log(
+          mie.target->type == BRANCH_SIMPLE, "Not yet implemented");
+      uint32_t label = insn_to_label.size();
+      insn_to_label.emplace(mie.target->src->insn, label);
+    }
+  }
+  write_int<uint32_t>(out, insn_to_label.size());
+  uint32_t next_label = 0;
+  for (const auto& mie : *code) {
+    switch (mie.type) {
+    case MFLOW_OPCODE: {
+      auto insn = mie.insn;
+      auto op = insn->opcode();
+      write_int(out, static_cast<uint8_t>(BinaryEntry::INSTRUCTION));
+      write_int<uint16_t>(out, op);
+      if (insn->dests_size()) {
+        write_int<uint16_t>(out, insn->dest());
+      }
+      if (opcode::has_variable_srcs_size(op)) {
+        write_int<uint16_t>(out, insn->srcs_size());
+      }
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        write_int<uint16_t>(out, insn->src(i));
+      }
+      switch (opcode::ref(op)) {
+      case opcode::Ref::None:
+        break;
+      case opcode::Ref::Data:
+        always_assert_log(false, "Not yet supported");
+        break;
+      case opcode::Ref::Field:
+        write_str(out, show(insn->get_field()));
+        break;
+      case opcode::Ref::Method:
+        write_str(out, show(insn->get_method()));
+        break;
+      case opcode::Ref::String:
+        write_str(out, insn->get_string()->str());
+        break;
+      case opcode::Ref::Literal:
+        write_int<int64_t>(out, insn->get_literal());
+        break;
+      case opcode::Ref::Type:
+        write_str(out, insn->get_type()->get_name()->str());
+        break;
+      }
+      if (is_branch(op)) {
+        always_assert_log(!is_switch(op), "Not yet supported");
+        write_int<uint32_t>(out, insn_to_label.at(insn));
+      }
+      break;
+    }
+    case MFLOW_TARGET:
+      write_int(out, static_cast<uint8_t>(BinaryEntry::LABEL));
+      write_int<uint32_t>(out, next_label++);
+      break;
+    case MFLOW_TRY:
+    case MFLOW_CATCH:
+    case MFLOW_DEBUG:
+    case MFLOW_POSITION:
+      always_assert_log(false, "Not yet implemented");
+    case MFLOW_FALLTHROUGH:
+      break;
+    case MFLOW_DEX_OPCODE:
+      not_reached();
+    }
+  }
+  return out;
+}
+
+std::unique_ptr<IRCode> ircode_from_binary(const std::string& in) {
+  always_assert_log(
+      in.compare(0, sizeof(kBinaryMagic), kBinaryMagic, sizeof(kBinaryMagic)) ==
+          0,
+      "Not binary IR");
+  BinaryReader reader(in, sizeof(kBinaryMagic));
+  auto version = reader.read_int<uint32_t>();
+  always_assert_log(version == kBinaryVersion,
+                    "Binary IR of version %u, expected %u",
+                    version,
+                    kBinaryVersion);
+  auto registers_size = reader.read_int<uint32_t>();
+  auto num_labels = reader.read_int<uint32_t>();
+  CodeBuilder builder;
+  for (uint32_t i = 0; i < num_labels; ++i) {
+    builder.make_label();
+  }
+  while (!reader.at_end()) {
+    auto entry = static_cast<BinaryEntry>(reader.read_int<uint8_t>());
+    if (entry == BinaryEntry::LABEL) {
+      auto label = reader.read_int<uint32_t>();
+      always_assert_log(label < num_labels, "Bad label %u", label);
+      builder.place(label);
+      continue;
+    }
+    always_assert_log(entry == BinaryEntry::INSTRUCTION, "Bad binary IR");
+    auto op = static_cast<IROpcode>(reader.read_int<uint16_t>());
+    auto insn = std::make_unique<IRInstruction>(op);
+    if (insn->dests_size()) {
+      insn->set_dest(reader.read_int<uint16_t>());
+    }
+    if (opcode::has_variable_srcs_size(op)) {
+      insn->set_arg_word_count(reader.read_int<uint16_t>());
+    }
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      insn->set_src(i, reader.read_int<uint16_t>());
+    }
+    switch (opcode::ref(op)) {
+    case opcode::Ref::None:
+      break;
+    case opcode::Ref::Data:
+      always_assert_log(false, "Not yet supported");
+      break;
+    case opcode::Ref::Field:
+      insn->set_field(DexField::make_field(reader.read_str()));
+      break;
+    case opcode::Ref::Method:
+      insn->set_method(DexMethod::make_method(reader.read_str()));
+      break;
+    case opcode::Ref::String:
+      insn->set_string(DexString::make_string(reader.read_str()));
+      break;
+    case opcode::Ref::Literal:
+      insn->set_literal(reader.read_int<int64_t>());
+      break;
+    case opcode::Ref::Type:
+      insn->set_type(DexType::make_type(reader.read_str().c_str()));
+      break;
+    }
+    if (is_branch(op)) {
+      auto label = reader.read_int<uint32_t>();
+      always_assert_log(label < num_labels, "Bad label %u", label);
+      builder.branch(insn.release(), label);
+    } else {
+      builder.push(insn.release());
+    }
+  }
+  auto code = builder.release();
+  code->set_registers_size(registers_size);
+  return code;
+}
+
 } // assembler
@@ -9,12 +9,19 @@
 
 #pragma once
 
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "IRCode.h"
 #include "S_Expression.h"
 
 /*
  * This module provides an easy way to create / serialize sequences of
- * IRInstructions using S-expressions.
+ * IRInstructions using S-expressions, or programmatically with CodeBuilder.
  *
  * Example:
  *
@@ -39,6 +46,64 @@
 
 namespace assembler {
 
+/*
+ * Builds IRCode without going through text, for code that is generated, like
+ * the huge methods of the benchmarks. Branches go to labels, which can be
+ * placed before or after the branches that use them, and are connected when
+ * the code is released.
+ *
+ *   CodeBuilder b;
+ *   auto loop = b.make_label();
+ *   b.place(loop);
+ *   b.push(OPCODE_ADD_INT_LIT8, {0, 0}, 1);
+ *   b.branch(OPCODE_IF_NEZ, {0}, loop);
+ *   b.push(OPCODE_RETURN_VOID, {});
+ *   auto code = b.release();
+ */
+class CodeBuilder {
+ public:
+  using Label = uint32_t;
+
+  CodeBuilder();
+
+  Label make_label();
+
+  bool is_placed(Label label) const;
+
+  // Places the label after what has been pushed so far.
+  void place(Label label);
+
+  // Takes ownership of insn.
+  IRInstruction* push(IRInstruction* insn);
+
+  // The dest register, if the opcode has one, then the src registers, in the
+  // order of the text form.
+  IRInstruction* push(IROpcode op, std::initializer_list<uint16_t> regs);
+
+  IRInstruction* push(IROpcode op,
+                      std::initializer_list<uint16_t> regs,
+                      int64_t literal);
+
+  // Takes ownership of insn, which must be a branch, but not a switch.
+  IRInstruction* branch(IRInstruction* insn, Label target);
+
+  IRInstruction* branch(IROpcode op,
+                        std::initializer_list<uint16_t> srcs,
+                        Label target);
+
+  // Takes ownership of pos.
+  void push_position(DexPosition* pos);
+
+  // All the labels that branches go to must have been placed.
+  std::unique_ptr<IRCode> release();
+
+ private:
+  std::unique_ptr<IRCode> m_code;
+  // Where each label was placed, or null.
+  std::vector<MethodItemEntry*> m_labels;
+  std::vector<std::pair<MethodItemEntry*, Label>> m_branches;
+};
+
 s_expr to_s_expr(const IRCode* code);
 
 inline std::string to_string(const IRCode* code) {
@@ -49,4 +114,15 @@ std::unique_ptr<IRCode> ircode_from_s_expr(const s_expr&);
 
 std::unique_ptr<IRCode> ircode_from_string(const std::string&);
 
+/*
+ * A binary form of the same code as to_s_expr(), which is much faster to
+ * read back, for fixtures too big to keep as text. The references to
+ * strings, types, fields and methods are stored by name, and are made when
+ * the code is read. Like the text form, it has no try-catch or debug info,
+ * and no positions either.
+ */
+std::string to_binary(const IRCode* code);
+
+std::unique_ptr<IRCode> ircode_from_binary(const std::string&);
+
 } // assembler
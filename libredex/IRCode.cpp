@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <boost/bimap/bimap.hpp>
 #include <boost/bimap/unordered_set_of.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/numeric/conversion/cast.hpp>
 #include <memory>
 #include <unordered_set>
@@ -46,10 +47,10 @@ MethodItemEntry::MethodItemEntry(const MethodItemEntry& that)
     target = that.target;
     break;
   case MFLOW_DEBUG:
-    new (&dbgop) std::unique_ptr<DexDebugInstruction>(that.dbgop->clone());
+    dbgop = that.dbgop;
     break;
   case MFLOW_POSITION:
-    new (&pos) std::unique_ptr<DexPosition>(new DexPosition(*that.pos));
+    pos = that.pos;
     break;
   case MFLOW_FALLTHROUGH:
     break;
@@ -68,11 +69,7 @@ MethodItemEntry::~MethodItemEntry() {
       delete target;
       break;
     case MFLOW_DEBUG:
-      dbgop.~unique_ptr<DexDebugInstruction>();
-      break;
     case MFLOW_POSITION:
-      pos.~unique_ptr<DexPosition>();
-      break;
     case MFLOW_OPCODE:
     case MFLOW_DEX_OPCODE:
     case MFLOW_FALLTHROUGH:
@@ -96,7 +93,7 @@ void MethodItemEntry::gather_strings(std::vector<DexString*>& lstring) const {
   case MFLOW_TARGET:
     break;
   case MFLOW_DEBUG:
-    dbgop->gather_strings(lstring);
+    dbgop.gather_strings(lstring);
     break;
   case MFLOW_POSITION:
     // although DexPosition contains strings, these strings don't find their
@@ -122,7 +119,6 @@ void MethodItemEntry::gather_methods(std::vector<DexMethodRef*>& lmethod) const
   case MFLOW_TARGET:
     break;
   case MFLOW_DEBUG:
-    dbgop->gather_methods(lmethod);
     break;
   case MFLOW_POSITION:
     break;
@@ -146,7 +142,6 @@ void MethodItemEntry::gather_fields(std::vector<DexFieldRef*>& lfield) const {
   case MFLOW_TARGET:
     break;
   case MFLOW_DEBUG:
-    dbgop->gather_fields(lfield);
     break;
   case MFLOW_POSITION:
     break;
@@ -173,7 +168,7 @@ void MethodItemEntry::gather_types(std::vector<DexType*>& ltype) const {
   case MFLOW_TARGET:
     break;
   case MFLOW_DEBUG:
-    dbgop->gather_types(ltype);
+    dbgop.gather_types(ltype);
     break;
   case MFLOW_POSITION:
     break;
@@ -401,15 +396,6 @@ static bool multi_target_compare_index(const BranchTarget* a,
   return (a->index < b->index);
 }
 
-static bool multi_contains_gaps(const std::vector<BranchTarget*>& targets) {
-  int32_t key = targets.front()->index;
-  for (auto target : targets) {
-    if (target->index != key) return true;
-    key++;
-  }
-  return false;
-}
-
 static void insert_multi_branch_target(FatMethod* fm,
                                        int32_t index,
                                        MethodItemEntry* target,
@@ -429,19 +415,23 @@ static int32_t read_int32(const uint16_t*& data) {
   return result;
 }
 
+/*
+ * `data` is the switch payload past its ident, and `target_at` maps an
+ * address to the entry that starts there.
+ */
+template <typename TargetAt>
 static void shard_multi_target(FatMethod* fm,
-                               DexOpcodeData* fopcode,
+                               uint16_t ftype,
+                               const uint16_t* data,
                                MethodItemEntry* src,
-                               const EntryAddrBiMap& bm) {
-  const uint16_t* data = fopcode->data();
+                               uint32_t base,
+                               const TargetAt& target_at) {
   uint16_t entries = *data++;
-  auto ftype = fopcode->opcode();
-  uint32_t base = bm.by<Entry>().at(src);
   if (ftype == FOPCODE_PACKED_SWITCH) {
     int32_t index = read_int32(data);
     for (int i = 0; i < entries; i++) {
       uint32_t targetaddr = base + read_int32(data);
-      auto target = bm.by<Addr>().at(targetaddr);
+      auto target = target_at(targetaddr);
       insert_multi_branch_target(fm, index, target, src);
       index++;
     }
@@ -450,7 +440,7 @@ static void shard_multi_target(FatMethod* fm,
     for (int i = 0; i < entries; i++) {
       int32_t index = read_int32(data);
       uint32_t targetaddr = base + read_int32(tdata);
-      auto target = bm.by<Addr>().at(targetaddr);
+      auto target = target_at(targetaddr);
       insert_multi_branch_target(fm, index, target, src);
     }
   } else {
@@ -470,7 +460,14 @@ static void generate_branch_targets(
         if (dex_opcode::is_switch(insn->opcode())) {
           auto* fopcode_entry = get_target(mentry, bm);
           auto* fopcode = entry_to_data.at(fopcode_entry);
-          shard_multi_target(fm, fopcode, mentry, bm);
+          shard_multi_target(fm,
+                             fopcode->opcode(),
+                             fopcode->data(),
+                             mentry,
+                             bm.by<Entry>().at(mentry),
+                             [&bm](uint32_t addr) {
+                               return bm.by<Addr>().at(addr);
+                             });
           delete fopcode;
           // TODO: erase fopcode from map
         } else {
@@ -490,10 +487,10 @@ static void associate_debug_entries(FatMethod* fm,
     MethodItemEntry* mentry;
     switch (entry.type) {
       case DexDebugEntryType::Instruction:
-        mentry = new MethodItemEntry(std::move(entry.insn));
+        mentry = new MethodItemEntry(entry.insn);
         break;
       case DexDebugEntryType::Position:
-        mentry = new MethodItemEntry(std::move(entry.pos));
+        mentry = new MethodItemEntry(entry.pos);
         break;
     }
     fm->insert(fm->iterator_to(*insert_point), *mentry);
@@ -568,6 +565,68 @@ void generate_load_params(const DexMethod* method,
   code->set_registers_size(param_reg);
 }
 
+/*
+ * Translates everything but the payload of a fill-array-data, which is up to
+ * the caller. `*move_result_pseudo_out` is set to the instruction that has to
+ * follow, if any.
+ */
+IRInstruction* ir_from_dex_insn(const DexInstruction* dex_insn,
+                                IRInstruction** move_result_pseudo_out) {
+  auto dex_op = dex_insn->opcode();
+  auto op = opcode::from_dex_opcode(dex_op);
+  auto* insn = new IRInstruction(op);
+
+  IRInstruction* move_result_pseudo{nullptr};
+  if (insn->dests_size()) {
+    insn->set_dest(dex_insn->dest());
+  } else if (opcode::may_throw(op)) {
+    if (op == OPCODE_CHECK_CAST) {
+      move_result_pseudo =
+          new IRInstruction(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT);
+      move_result_pseudo->set_dest(dex_insn->src(0));
+    } else if (dex_insn->dests_size()) {
+      IROpcode move_op;
+      if (opcode_impl::dest_is_wide(op)) {
+        move_op = IOPCODE_MOVE_RESULT_PSEUDO_WIDE;
+      } else if (opcode_impl::dest_is_object(op)) {
+        move_op = IOPCODE_MOVE_RESULT_PSEUDO_OBJECT;
+      } else {
+        move_op = IOPCODE_MOVE_RESULT_PSEUDO;
+      }
+      move_result_pseudo = new IRInstruction(move_op);
+      move_result_pseudo->set_dest(dex_insn->dest());
+    }
+  }
+
+  insn->set_arg_word_count(dex_insn->srcs_size()); // XXX: should we have a better API?
+  for (size_t i = 0; i < dex_insn->srcs_size(); ++i) {
+    insn->set_src(i, dex_insn->src(i));
+  }
+  if (dex_opcode::has_range(dex_op)) {
+    insn->set_arg_word_count(dex_insn->range_size());
+    for (size_t i = 0; i < dex_insn->range_size(); ++i) {
+      insn->set_src(i, dex_insn->range_base() + i);
+    }
+  }
+  if (dex_insn->has_string()) {
+    insn->set_string(
+        static_cast<const DexOpcodeString*>(dex_insn)->get_string());
+  } else if (dex_insn->has_type()) {
+    insn->set_type(static_cast<const DexOpcodeType*>(dex_insn)->get_type());
+  } else if (dex_insn->has_field()) {
+    insn->set_field(static_cast<const DexOpcodeField*>(dex_insn)->get_field());
+  } else if (dex_insn->has_method()) {
+    insn->set_method(
+        static_cast<const DexOpcodeMethod*>(dex_insn)->get_method());
+  } else if (dex_opcode::has_literal(dex_op)) {
+    insn->set_literal(dex_insn->get_literal());
+  }
+
+  insn->normalize_registers();
+  *move_result_pseudo_out = move_result_pseudo;
+  return insn;
+}
+
 void translate_dex_to_ir(
     FatMethod* fmethod,
     const EntryAddrBiMap& bm,
@@ -577,60 +636,12 @@ void translate_dex_to_ir(
       continue;
     }
     auto* dex_insn = it->dex_insn;
-    auto dex_op = dex_insn->opcode();
-    auto op = opcode::from_dex_opcode(dex_op);
-    auto* insn = new IRInstruction(op);
-
-    IRInstruction* move_result_pseudo{nullptr};
-    if (insn->dests_size()) {
-      insn->set_dest(dex_insn->dest());
-    } else if (opcode::may_throw(op)) {
-      if (op == OPCODE_CHECK_CAST) {
-        move_result_pseudo =
-            new IRInstruction(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT);
-        move_result_pseudo->set_dest(dex_insn->src(0));
-      } else if (dex_insn->dests_size()) {
-        IROpcode move_op;
-        if (opcode_impl::dest_is_wide(op)) {
-          move_op = IOPCODE_MOVE_RESULT_PSEUDO_WIDE;
-        } else if (opcode_impl::dest_is_object(op)) {
-          move_op = IOPCODE_MOVE_RESULT_PSEUDO_OBJECT;
-        } else {
-          move_op = IOPCODE_MOVE_RESULT_PSEUDO;
-        }
-        move_result_pseudo = new IRInstruction(move_op);
-        move_result_pseudo->set_dest(dex_insn->dest());
-      }
-    }
-
-    insn->set_arg_word_count(dex_insn->srcs_size()); // XXX: should we have a better API?
-    for (size_t i = 0; i < dex_insn->srcs_size(); ++i) {
-      insn->set_src(i, dex_insn->src(i));
-    }
-    if (dex_opcode::has_range(dex_op)) {
-      insn->set_arg_word_count(dex_insn->range_size());
-      for (size_t i = 0; i < dex_insn->range_size(); ++i) {
-        insn->set_src(i, dex_insn->range_base() + i);
-      }
-    }
-    if (dex_insn->has_string()) {
-      insn->set_string(
-          static_cast<const DexOpcodeString*>(dex_insn)->get_string());
-    } else if (dex_insn->has_type()) {
-      insn->set_type(static_cast<const DexOpcodeType*>(dex_insn)->get_type());
-    } else if (dex_insn->has_field()) {
-      insn->set_field(static_cast<const DexOpcodeField*>(dex_insn)->get_field());
-    } else if (dex_insn->has_method()) {
-      insn->set_method(
-          static_cast<const DexOpcodeMethod*>(dex_insn)->get_method());
-    } else if (dex_opcode::has_literal(dex_op)) {
-      insn->set_literal(dex_insn->get_literal());
-    } else if (op == OPCODE_FILL_ARRAY_DATA) {
+    IRInstruction* move_result_pseudo;
+    auto* insn = ir_from_dex_insn(dex_insn, &move_result_pseudo);
+    if (insn->opcode() == OPCODE_FILL_ARRAY_DATA) {
       insn->set_data(entry_to_data.at(get_target(&*it, bm)));
     }
 
-    insn->normalize_registers();
-
     it->type = MFLOW_OPCODE;
     it->insn = insn;
     if (move_result_pseudo != nullptr) {
@@ -679,48 +690,173 @@ void balloon(DexMethod* method, FatMethod* fmethod) {
   }
 }
 
-/**
- * Map the `DexPositions` to a newly created clone. At the same time, it
- * preserves the relationship between a position and it's parent.
+/*
+ * Does what balloon() does, but straight from the code_item in the mapped
+ * dex, without making a DexCode first. Each instruction is decoded on the
+ * stack and translated right away. The branches, tries and debug entries are
+ * tied to the instructions through a table indexed by address, once all of
+ * them are in.
  */
-std::unordered_map<DexPosition*, std::unique_ptr<DexPosition>>
-get_old_to_new_position_copies(FatMethod* fmethod) {
-  std::unordered_map<DexPosition*, std::unique_ptr<DexPosition>>
-      old_position_to_new;
-  for (auto& mie : *fmethod) {
-    if (mie.type == MFLOW_POSITION) {
-      old_position_to_new.emplace(mie.pos.get(),
-                                  std::make_unique<DexPosition>(*mie.pos));
+void decode_code_item(DexIdx* idx,
+                      uint32_t code_off,
+                      DexDebugItem* dbg,
+                      FatMethod* fmethod) {
+  auto code_item =
+      reinterpret_cast<const dex_code_item*>(idx->get_uint_data(code_off));
+  const uint16_t* insns = reinterpret_cast<const uint16_t*>(code_item + 1);
+  uint32_t insns_size = code_item->insns_size;
+
+  // The entry that starts at each address, or null in the middle of an
+  // instruction.
+  std::vector<MethodItemEntry*> entries(insns_size, nullptr);
+  auto entry_at = [&](uint32_t addr) {
+    always_assert_log(addr < insns_size && entries[addr] != nullptr,
+                      "Invalid opcode target %08x at offset 0x%08x",
+                      addr,
+                      code_off);
+    return entries[addr];
+  };
+  // Tries and debug entries may also go at the very end.
+  auto insert_point = [&](uint32_t addr) {
+    return addr == insns_size ? fmethod->end()
+                              : fmethod->iterator_to(*entry_at(addr));
+  };
+
+  // The branches and fill-array-data instructions, with their address and
+  // the address they refer to.
+  struct Reference {
+    MethodItemEntry* src;
+    uint32_t addr;
+    uint32_t target;
+  };
+  std::vector<Reference> refs;
+  std::unordered_map<uint32_t, std::unique_ptr<DexOpcodeData>> array_payloads;
+
+  uint32_t addr = 0;
+  std::function<void(const DexInstruction&)> add_insn =
+      [&](const DexInstruction& dex_insn) {
+        auto dex_op = dex_insn.opcode();
+        if (dex_op == DOPCODE_NOP || dex_opcode::is_fopcode(dex_op)) {
+          // As in balloon(), so that the try items and debug entries next
+          // to them find their address.
+          entries[addr] = new MethodItemEntry();
+          fmethod->push_back(*entries[addr]);
+          if (dex_op == FOPCODE_FILLED_ARRAY) {
+            array_payloads.emplace(
+                addr,
+                std::unique_ptr<DexOpcodeData>(
+                    static_cast<const DexOpcodeData&>(dex_insn).clone()));
+          }
+          return;
+        }
+        IRInstruction* move_result_pseudo;
+        auto insn = ir_from_dex_insn(&dex_insn, &move_result_pseudo);
+        entries[addr] = new MethodItemEntry(insn);
+        fmethod->push_back(*entries[addr]);
+        if (move_result_pseudo != nullptr) {
+          fmethod->push_back(*(new MethodItemEntry(move_result_pseudo)));
+        }
+        if (dex_opcode::is_branch(dex_op) ||
+            dex_op == DOPCODE_FILL_ARRAY_DATA) {
+          refs.push_back(
+              Reference{entries[addr], addr, addr + dex_insn.offset()});
+        }
+      };
+  const uint16_t* cdata = insns;
+  while (addr < insns_size) {
+    always_assert_log(DexInstruction::decode(idx, &cdata, add_insn),
+                      "Failed to parse method at offset 0x%08x",
+                      code_off);
+    addr = cdata - insns;
+  }
+  always_assert_log(addr == insns_size,
+                    "Last instruction overruns the method at offset 0x%08x",
+                    code_off);
+
+  for (const auto& ref : refs) {
+    auto op = ref.src->insn->opcode();
+    if (op == OPCODE_FILL_ARRAY_DATA) {
+      entry_at(ref.target);
+      auto it = array_payloads.find(ref.target);
+      always_assert_log(it != array_payloads.end(),
+                        "No array payload at %08x at offset 0x%08x",
+                        ref.target,
+                        code_off);
+      ref.src->insn->set_data(it->second->clone());
+    } else if (op == OPCODE_PACKED_SWITCH || op == OPCODE_SPARSE_SWITCH) {
+      entry_at(ref.target);
+      auto ftype = insns[ref.target];
+      always_assert_log(
+          ftype == FOPCODE_PACKED_SWITCH || ftype == FOPCODE_SPARSE_SWITCH,
+          "No switch payload at %08x at offset 0x%08x",
+          ref.target,
+          code_off);
+      shard_multi_target(
+          fmethod, ftype, insns + ref.target + 1, ref.src, ref.addr, entry_at);
+    } else {
+      insert_branch_target(fmethod, entry_at(ref.target), ref.src);
     }
   }
 
-  for (auto& old_to_new : old_position_to_new) {
-    DexPosition* old_pos = old_to_new.first;
-    auto new_pos = old_to_new.second.get();
-
-    // There may be dangling pointers to parent positions that have been deleted
-    // So, we can't use the [] operator here because it would add
-    // nullptr as a value in the map which would cause a segfault on a later
-    // iteration of the loop. `.at()` is also not an option for the same reason.
-    new_pos->parent = nullptr;
-    if (old_pos->parent != nullptr) {
-      auto search = old_position_to_new.find(old_pos->parent);
-      if (search != old_position_to_new.end()) {
-        new_pos->parent = search->second.get();
+  if (code_item->tries_size) {
+    // The tries are 4-byte aligned.
+    const uint16_t* tries_data = insns + insns_size + (insns_size & 1);
+    auto tries = reinterpret_cast<const dex_tries_item*>(tries_data);
+    auto handlers = reinterpret_cast<const uint8_t*>(
+        tries + code_item->tries_size);
+    for (uint32_t i = 0; i < code_item->tries_size; i++) {
+      const uint8_t* handler = handlers + tries[i].handler_off;
+      int32_t count = read_sleb128(&handler);
+      bool has_catchall = count <= 0;
+      count = std::abs(count);
+      MethodItemEntry* catch_start = nullptr;
+      CatchEntry* last_catch = nullptr;
+      auto add_catch = [&](DexType* type, uint32_t handler_addr) {
+        auto catch_mei = new MethodItemEntry(type);
+        catch_start = catch_start == nullptr ? catch_mei : catch_start;
+        if (last_catch != nullptr) {
+          last_catch->next = catch_mei;
+        }
+        last_catch = catch_mei->centry;
+        fmethod->insert(insert_point(handler_addr), *catch_mei);
+      };
+      while (count--) {
+        uint32_t tidx = read_uleb128(&handler);
+        uint32_t handler_addr = read_uleb128(&handler);
+        add_catch(idx->get_typeidx(tidx), handler_addr);
       }
+      if (has_catchall) {
+        add_catch(nullptr, read_uleb128(&handler));
+      }
+      auto start_addr = tries[i].start_addr;
+      fmethod->insert(insert_point(start_addr),
+                      *(new MethodItemEntry(TRY_START, catch_start)));
+      fmethod->insert(insert_point(start_addr + tries[i].insn_count),
+                      *(new MethodItemEntry(TRY_END, catch_start)));
     }
   }
 
-  return old_position_to_new;
+  if (dbg != nullptr) {
+    for (auto& entry : dbg->get_entries()) {
+      MethodItemEntry* mentry;
+      switch (entry.type) {
+      case DexDebugEntryType::Instruction:
+        mentry = new MethodItemEntry(entry.insn);
+        break;
+      case DexDebugEntryType::Position:
+        mentry = new MethodItemEntry(entry.pos);
+        break;
+      }
+      fmethod->insert(insert_point(entry.addr), *mentry);
+    }
+    dbg->get_entries().clear();
+  }
 }
 
 // TODO: merge this and MethodSplicer.
 FatMethod* deep_copy_fmethod(FatMethod* old_fmethod) {
   FatMethod* fmethod = new FatMethod();
 
-  std::unordered_map<DexPosition*, std::unique_ptr<DexPosition>>
-      old_position_to_new = get_old_to_new_position_copies(old_fmethod);
-
   // Create a clone for each of the entries
   // and a mapping from old pointers to new pointers.
   std::unordered_map<MethodItemEntry*, MethodItemEntry*> old_mentry_to_new;
@@ -757,11 +893,11 @@ FatMethod* deep_copy_fmethod(FatMethod* old_fmethod) {
       copy_mie->insn = new IRInstruction(*mie.insn);
       break;
     case MFLOW_DEBUG:
-      new (&copy_mie->dbgop)
-          std::unique_ptr<DexDebugInstruction>(mie.dbgop->clone());
+      copy_mie->dbgop = mie.dbgop;
       break;
     case MFLOW_POSITION:
-      copy_mie->pos = std::move(old_position_to_new[mie.pos.get()]);
+      // Positions are immutable, the copy shares them.
+      copy_mie->pos = mie.pos;
       break;
     case MFLOW_FALLTHROUGH:
       break;
@@ -789,6 +925,22 @@ IRCode::IRCode(DexMethod* method): m_fmethod(new FatMethod()) {
   m_dbg = dc->release_debug_item();
 }
 
+IRCode::IRCode(DexMethod* method,
+               DexIdx* idx,
+               uint32_t code_off,
+               DexString* source_file)
+    : m_fmethod(new FatMethod()) {
+  auto code_item =
+      reinterpret_cast<const dex_code_item*>(idx->get_uint_data(code_off));
+  generate_load_params(
+      method, code_item->registers_size - code_item->ins_size, this);
+  m_dbg = DexDebugItem::get_dex_debug(idx, code_item->debug_info_off);
+  if (m_dbg) {
+    m_dbg->bind_positions(method, source_file);
+  }
+  decode_code_item(idx, code_off, m_dbg.get(), m_fmethod);
+}
+
 IRCode::IRCode(DexMethod* method, size_t temp_regs)
     : m_fmethod(new FatMethod()) {
   always_assert(method->get_dex_code() == nullptr);
@@ -821,6 +973,7 @@ void IRCode::remove_branch_targets(IRInstruction *branch_inst) {
 }
 
 void IRCode::replace_branch(IRInstruction* from, IRInstruction* to) {
+  mark_modified();
   always_assert(is_branch(from->opcode()));
   always_assert(is_branch(to->opcode()));
   for (auto& mentry : *m_fmethod) {
@@ -840,13 +993,13 @@ void IRCode::replace_branch(IRInstruction* from, IRInstruction* to) {
 void IRCode::remove_debug_line_info(Block* block) {
   for (MethodItemEntry& mie : *block) {
     if (mie.type == MFLOW_POSITION) {
-      mie.pos.release();
       mie.type = MFLOW_FALLTHROUGH;
     }
   }
 }
 
 void IRCode::replace_opcode_with_infinite_loop(IRInstruction* from) {
+  mark_modified();
   IRInstruction* to = new IRInstruction(OPCODE_GOTO);
   auto miter = m_fmethod->begin();
   for (; miter != m_fmethod->end(); miter++) {
@@ -873,6 +1026,7 @@ void IRCode::replace_opcode_with_infinite_loop(IRInstruction* from) {
 
 void IRCode::replace_opcode(IRInstruction* to_delete,
                             std::vector<IRInstruction*> replacements) {
+  mark_modified();
   auto it = m_fmethod->begin();
   for (; it != m_fmethod->end(); it++) {
     if (it->type == MFLOW_OPCODE && it->insn == to_delete) {
@@ -896,6 +1050,7 @@ void IRCode::replace_opcode(IRInstruction* from, IRInstruction* to) {
 
 void IRCode::insert_after(IRInstruction* position,
                           const std::vector<IRInstruction*>& opcodes) {
+  mark_modified();
   /* The nullptr case handling is strange-ish..., this will not work as expected
    *if
    * a method has a branch target as it's first instruction.
@@ -926,11 +1081,13 @@ void IRCode::insert_after(IRInstruction* position,
 
 FatMethod::iterator IRCode::insert_before(
     const FatMethod::iterator& position, MethodItemEntry& mie) {
+  mark_modified();
   return m_fmethod->insert(position, mie);
 }
 
 FatMethod::iterator IRCode::insert_after(
     const FatMethod::iterator& position, MethodItemEntry& mie) {
+  mark_modified();
   always_assert(position != m_fmethod->end());
   return m_fmethod->insert(std::next(position), mie);
 }
@@ -948,6 +1105,7 @@ FatMethod::iterator IRCode::insert_after(
  * block boundaries.)
  */
 void IRCode::remove_switch_case(IRInstruction* insn) {
+  mark_modified();
 
   TRACE(MTRANS, 3, "Removing switch case from: %s\n", SHOW(m_fmethod));
   // Check if we are inside switch method.
@@ -1030,6 +1188,7 @@ size_t IRCode::sum_opcode_sizes() const {
 }
 
 void IRCode::remove_opcode(const FatMethod::iterator& it) {
+  mark_modified();
   always_assert(it->type == MFLOW_OPCODE);
   auto insn = it->insn;
   always_assert(!opcode::is_move_result_pseudo(insn->opcode()));
@@ -1165,13 +1324,18 @@ const char* DEBUG_ONLY show_reg_map(RegMap& map) {
 } // namespace
 
 void IRCode::build_cfg(bool editable) {
+  if (m_cfg && !m_cfg->editable() && !editable && m_cfg_epoch == m_epoch) {
+    return;
+  }
   clear_cfg();
   m_cfg = std::make_unique<ControlFlowGraph>(m_fmethod, editable);
+  m_cfg_epoch = m_epoch;
 }
 
 void IRCode::clear_cfg() {
   if (m_cfg && m_cfg->editable()) {
     m_fmethod = m_cfg->linearize();
+    mark_modified();
   }
 
   m_cfg.reset();
@@ -1251,10 +1415,12 @@ void gather_debug_entries(
     const std::unordered_map<MethodItemEntry*, uint32_t>& entry_to_addr,
     std::vector<DexDebugEntry>* entries) {
   bool next_pos_is_root{false};
-  // A root is the first DexPosition that precedes an opcode
-  std::unordered_set<DexPosition*> roots;
+  // A root is the first DexPosition entry that precedes an opcode. Positions
+  // are interned, so the roots are tracked by entry: the same position may
+  // also be carried by entries that don't need to be emitted.
+  std::unordered_set<const MethodItemEntry*> roots;
   // The last root that we encountered on our reverse walk of the FatMethod
-  DexPosition* last_root_pos{nullptr};
+  const MethodItemEntry* last_root{nullptr};
   for (auto it = fmethod->rbegin(); it != fmethod->rend(); ++it) {
     auto& mie = *it;
     if (mie.type == MFLOW_DEX_OPCODE) {
@@ -1262,31 +1428,36 @@ void gather_debug_entries(
     } else if (mie.type == MFLOW_POSITION && next_pos_is_root) {
       next_pos_is_root = false;
       // Check for consecutive duplicates
-      if (last_root_pos != nullptr && *last_root_pos == *mie.pos) {
-        roots.erase(last_root_pos);
+      if (last_root != nullptr && *last_root->pos == *mie.pos) {
+        roots.erase(last_root);
       }
-      last_root_pos = mie.pos.get();
-      roots.emplace(last_root_pos);
+      last_root = &mie;
+      roots.emplace(last_root);
     }
   }
   // DexPositions have parent pointers that refer to other DexPositions in the
-  // same method body; we want to recursively preserve the referents as well.
-  // The rest of the DexPositions can be eliminated.
-  std::unordered_set<DexPosition*> positions_to_keep;
-  for (DexPosition* pos : roots) {
-    positions_to_keep.emplace(pos);
-    DexPosition* parent{pos->parent};
-    while (parent != nullptr && positions_to_keep.count(parent) == 0) {
-      positions_to_keep.emplace(parent);
+  // same method body; we want to recursively preserve the referents as well,
+  // by keeping the first entry of each of them. The rest of the DexPositions
+  // can be eliminated.
+  std::unordered_set<DexPosition*> root_positions;
+  for (auto root : roots) {
+    root_positions.emplace(root->pos);
+  }
+  std::unordered_set<DexPosition*> parents_to_keep;
+  for (auto root : roots) {
+    DexPosition* parent{root->pos->parent};
+    while (parent != nullptr && root_positions.count(parent) == 0 &&
+           parents_to_keep.count(parent) == 0) {
+      parents_to_keep.emplace(parent);
       parent = parent->parent;
     }
   }
   for (auto& mie : *fmethod) {
     if (mie.type == MFLOW_DEBUG) {
-      entries->emplace_back(entry_to_addr.at(&mie), std::move(mie.dbgop));
+      entries->emplace_back(entry_to_addr.at(&mie), mie.dbgop);
     } else if (mie.type == MFLOW_POSITION &&
-               positions_to_keep.count(mie.pos.get()) != 0) {
-      entries->emplace_back(entry_to_addr.at(&mie), std::move(mie.pos));
+               (roots.count(&mie) != 0 || parents_to_keep.erase(mie.pos))) {
+      entries->emplace_back(entry_to_addr.at(&mie), mie.pos);
     }
   }
 }
@@ -1294,6 +1465,7 @@ void gather_debug_entries(
 } // namespace
 
 std::unique_ptr<DexCode> IRCode::sync(const DexMethod* method) {
+  mark_modified();
   auto dex_code = std::make_unique<DexCode>();
   try {
     calculate_ins_size(method, &*dex_code);
@@ -1414,7 +1586,9 @@ bool IRCode::try_sync(DexCode* code) {
     auto multi_insn = multiopcode->dex_insn;
     std::sort(targets.begin(), targets.end(), multi_target_compare_index);
     always_assert_log(!targets.empty(), "need to have targets");
-    if (multi_contains_gaps(targets)) {
+    auto min_key = targets.front()->index;
+    auto max_key = targets.back()->index;
+    if (!use_packed_switch(min_key, max_key, targets.size())) {
       // Emit sparse.
       const size_t count = (targets.size() * 4) + 2;
       auto sparse_payload = std::make_unique<uint16_t[]>(count);
@@ -1443,15 +1617,24 @@ bool IRCode::try_sync(DexCode* code) {
       multi_insn->set_opcode(DOPCODE_SPARSE_SWITCH);
       addr += count;
     } else {
-      // Emit packed.
-      const size_t count = (targets.size() * 2) + 4;
+      // Emit packed. The keys in between that have no case fall through to
+      // the instruction after the switch.
+      const size_t num_slots = int64_t(max_key) - min_key + 1;
+      const size_t count = (num_slots * 2) + 4;
       auto packed_payload = std::make_unique<uint16_t[]>(count);
       packed_payload[0] = FOPCODE_PACKED_SWITCH;
-      packed_payload[1] = targets.size();
+      packed_payload[1] = num_slots;
       uint32_t* psdata = (uint32_t*)&packed_payload[2];
-      *psdata++ = targets.front()->index;
-      for (BranchTarget* target : targets) {
-        *psdata++ = multi_targets[target] - entry_to_addr.at(multiopcode);
+      *psdata++ = min_key;
+      auto target_it = targets.begin();
+      for (int64_t key = min_key; key <= max_key; ++key) {
+        if ((*target_it)->index == key) {
+          *psdata++ =
+              multi_targets[*target_it] - entry_to_addr.at(multiopcode);
+          ++target_it;
+        } else {
+          *psdata++ = multi_insn->size();
+        }
       }
       // Emit align nop
       if (addr & 1) {
@@ -1544,6 +1727,32 @@ bool InstructionIterable::structural_equals(const InstructionIterable& other) {
   return it1 == this->end() && it2 == other.end();
 }
 
+size_t InstructionIterable::structural_hash() const {
+  size_t seed = 0;
+  for (const auto& mie : *this) {
+    auto insn = mie.insn;
+    boost::hash_combine(seed, static_cast<uint16_t>(insn->opcode()));
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      boost::hash_combine(seed, insn->src(i));
+    }
+    if (insn->dests_size() > 0) {
+      boost::hash_combine(seed, insn->dest());
+    }
+    if (insn->has_literal()) {
+      boost::hash_combine(seed, insn->get_literal());
+    } else if (insn->has_string()) {
+      boost::hash_combine(seed, insn->get_string());
+    } else if (insn->has_type()) {
+      boost::hash_combine(seed, insn->get_type());
+    } else if (insn->has_field()) {
+      boost::hash_combine(seed, insn->get_field());
+    } else if (insn->has_method()) {
+      boost::hash_combine(seed, insn->get_method());
+    }
+  }
+  return seed;
+}
+
 IRInstruction* primary_instruction_of_move_result_pseudo(
     FatMethod::iterator it) {
   --it;
@@ -1558,3 +1767,10 @@ IRInstruction* move_result_pseudo_of(FatMethod::iterator it) {
                 opcode::is_move_result_pseudo(it->insn->opcode()));
   return it->insn;
 }
+
+bool use_packed_switch(int32_t min_key, int32_t max_key, size_t num_keys) {
+  // The sizes of the payloads, in code units.
+  uint64_t packed_size = 4 + 2 * (int64_t(max_key) - min_key + 1);
+  uint64_t sparse_size = 2 + 4 * uint64_t(num_keys);
+  return packed_size <= sparse_size;
+}
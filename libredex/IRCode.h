@@ -21,6 +21,7 @@
 #include "DexClass.h"
 #include "DexDebugInstruction.h"
 #include "IRInstruction.h"
+#include "SlabAllocator.h"
 
 enum TryEntryType {
   TRY_START = 0,
@@ -29,7 +30,7 @@ enum TryEntryType {
 
 std::string show(TryEntryType t);
 
-struct TryEntry {
+struct TryEntry : public SlabAllocated<TryEntry> {
   TryEntryType type;
   MethodItemEntry* catch_start;
   TryEntry(TryEntryType type, MethodItemEntry* catch_start):
@@ -66,7 +67,7 @@ enum BranchTargetType {
 };
 
 struct MethodItemEntry;
-struct BranchTarget {
+struct BranchTarget : public SlabAllocated<BranchTarget> {
   BranchTargetType type;
   MethodItemEntry* src;
   int32_t index;
@@ -108,7 +109,7 @@ enum MethodItemType {
  * that is necessary when inserting into a FatMethod; it gets done when the
  * FatMethod gets translated back into a DexMethod by IRCode::sync().
  */
-struct MethodItemEntry {
+struct MethodItemEntry : public SlabAllocated<MethodItemEntry> {
   boost::intrusive::list_member_hook<> list_hook_;
   MethodItemType type;
 
@@ -120,8 +121,9 @@ struct MethodItemEntry {
     // code. Do NOT use it in passes!
     DexInstruction* dex_insn;
     BranchTarget* target;
-    std::unique_ptr<DexDebugInstruction> dbgop;
-    std::unique_ptr<DexPosition> pos;
+    DexDebugInstruction dbgop;
+    // Interned, see DexPosition.h.
+    DexPosition* pos;
   };
   explicit MethodItemEntry(const MethodItemEntry&);
   MethodItemEntry(DexInstruction* dex_insn) {
@@ -140,10 +142,9 @@ struct MethodItemEntry {
     this->type = MFLOW_TARGET;
     this->target = bt;
   }
-  MethodItemEntry(std::unique_ptr<DexDebugInstruction> dbgop)
-      : type(MFLOW_DEBUG), dbgop(std::move(dbgop)) {}
-  MethodItemEntry(std::unique_ptr<DexPosition> pos)
-      : type(MFLOW_POSITION), pos(std::move(pos)) {}
+  MethodItemEntry(const DexDebugInstruction& dbgop)
+      : type(MFLOW_DEBUG), dbgop(dbgop) {}
+  MethodItemEntry(DexPosition* pos) : type(MFLOW_POSITION), pos(pos) {}
 
   MethodItemEntry(): type(MFLOW_FALLTHROUGH) {}
   ~MethodItemEntry();
@@ -203,6 +204,13 @@ class IRCode {
 
   FatMethod* m_fmethod;
   std::unique_ptr<ControlFlowGraph> m_cfg;
+  // The epoch of the code when m_cfg was built.
+  uint64_t m_cfg_epoch {0};
+  uint64_t m_epoch {0};
+  // The epoch and fingerprint of the code when it last passed the type checker.
+  bool m_type_checked {false};
+  uint64_t m_type_checked_epoch {0};
+  uint64_t m_type_checked_fingerprint {0};
 
   uint16_t m_registers_size {0};
   // TODO(jezng): we shouldn't be storing / exposing the DexDebugItem... just
@@ -234,6 +242,13 @@ class IRCode {
   IRCode();
 
   explicit IRCode(DexMethod*);
+
+  /*
+   * Decodes the code_item at `code_off` straight into IR, without going
+   * through a DexCode, which saves making a DexInstruction for each
+   * instruction. The method must be concrete already.
+   */
+  IRCode(DexMethod*, DexIdx* idx, uint32_t code_off, DexString* source_file);
   /*
    * Construct an IRCode for a DexMethod that has no DexCode (that is, a new
    * method that we are creating instead of something from an input dex file.)
@@ -281,6 +296,7 @@ class IRCode {
 
   /* Return the control flow graph of this method as a vector of blocks. */
   ControlFlowGraph& cfg() { return *m_cfg; }
+  bool cfg_built() const { return m_cfg != nullptr; }
 
   // Build a Control Flow Graph
   //  * A non editable CFG's blocks have begin and end pointers into the big
@@ -289,8 +305,36 @@ class IRCode {
   //    MethodItemEntries taken from IRCode)
   // Changes to an editable CFG are reflected in IRCode after `clear_cfg` is
   // called
+  // A non editable CFG is kept around, and building it again is free as long
+  // as the code hasn't been modified since.
   void build_cfg(bool editable = false);
 
+  /*
+   * The modification epoch changes whenever the code is modified through
+   * the methods of this class, which is how build_cfg() knows that the CFG it
+   * built last is out of date. Code that edits the MethodItemEntries directly
+   * -- e.g. turns them into MFLOW_FALLTHROUGH -- must call mark_modified()
+   * itself.
+   */
+  uint64_t epoch() const { return m_epoch; }
+  void mark_modified() { ++m_epoch; }
+
+  /*
+   * The PassManager marks the code once the type checker accepts it, so that
+   * it can skip it until it is modified again. Instructions edited in place
+   * don't change the epoch, which is what the fingerprint of the instructions
+   * is for.
+   */
+  bool type_checked(uint64_t fingerprint) const {
+    return m_type_checked && m_type_checked_epoch == m_epoch &&
+           m_type_checked_fingerprint == fingerprint;
+  }
+  void mark_type_checked(uint64_t fingerprint) {
+    m_type_checked = true;
+    m_type_checked_epoch = m_epoch;
+    m_type_checked_fingerprint = fingerprint;
+  }
+
   // if the cfg was editable, linearize it back into m_fmethod
   void clear_cfg();
 
@@ -319,11 +363,13 @@ class IRCode {
 
   template <class... Args>
   void push_back(Args&&... args) {
+    mark_modified();
     m_fmethod->push_back(*(new MethodItemEntry(std::forward<Args>(args)...)));
   }
 
   /* Passes memory ownership of "mie" to callee. */
   void push_back(MethodItemEntry& mie) {
+    mark_modified();
     m_fmethod->push_back(mie);
   }
 
@@ -346,6 +392,7 @@ class IRCode {
   template <class... Args>
   FatMethod::iterator insert_before(const FatMethod::iterator& position,
                                     Args&&... args) {
+    mark_modified();
     return m_fmethod->insert(
         position, *(new MethodItemEntry(std::forward<Args>(args)...)));
   }
@@ -354,6 +401,7 @@ class IRCode {
   FatMethod::iterator insert_after(const FatMethod::iterator& position,
                                    Args&&... args) {
     always_assert(position != m_fmethod->end());
+    mark_modified();
     return m_fmethod->insert(
         std::next(position),
         *(new MethodItemEntry(std::forward<Args>(args)...)));
@@ -386,6 +434,12 @@ class IRCode {
    */
   size_t count_opcodes() const;
 
+  /*
+   * Returns the number of entries, instructions or not. Unlike
+   * count_opcodes(), this takes constant time.
+   */
+  size_t count_entries() const { return m_fmethod->size(); }
+
   FatMethod::iterator begin() { return m_fmethod->begin(); }
   FatMethod::iterator end() { return m_fmethod->end(); }
   FatMethod::const_iterator begin() const { return m_fmethod->begin(); }
@@ -396,9 +450,11 @@ class IRCode {
   FatMethod::reverse_iterator rend() { return m_fmethod->rend(); }
 
   FatMethod::iterator erase(FatMethod::iterator it) {
+    mark_modified();
     return m_fmethod->erase(it);
   }
   FatMethod::iterator erase_and_dispose(FatMethod::iterator it) {
+    mark_modified();
     return m_fmethod->erase_and_dispose(it, FatMethodDisposer());
   }
 
@@ -499,9 +555,25 @@ class InstructionIterable {
   }
 
   bool structural_equals(const InstructionIterable& other);
+
+  /*
+   * Hashes the instructions the way structural_equals() compares them: their
+   * opcodes, registers and operands, in order.
+   */
+  size_t structural_hash() const;
 };
 
 IRInstruction* primary_instruction_of_move_result_pseudo(
     FatMethod::iterator it);
 
 IRInstruction* move_result_pseudo_of(FatMethod::iterator it);
+
+/*
+ * Whether a switch on `num_keys` case keys between `min_key` and `max_key` is
+ * emitted as a packed-switch rather than a sparse-switch. The table of a
+ * packed-switch also has slots for the missing keys in between, which fall
+ * through, so it is used while it is no larger than the keys and targets of
+ * the sparse-switch. Dispatching on it is then a lookup instead of a binary
+ * search.
+ */
+bool use_packed_switch(int32_t min_key, int32_t max_key, size_t num_keys);
@@ -9,6 +9,8 @@
 
 #include "IRInstruction.h"
 
+#include <algorithm>
+
 #include "DexClass.h"
 #include "DexUtil.h"
 
@@ -25,7 +27,57 @@ DexOpcode convert_3to2addr(DexOpcode op) {
 }
 
 IRInstruction::IRInstruction(IROpcode op) : m_opcode(op) {
-  m_srcs.resize(opcode_impl::min_srcs_size(op));
+  set_arg_word_count(opcode_impl::min_srcs_size(op));
+}
+
+IRInstruction::IRInstruction(const IRInstruction& that)
+    : m_opcode(that.m_opcode), m_dest(that.m_dest), m_literal(that.m_literal) {
+  set_arg_word_count(that.m_num_srcs);
+  std::copy(that.srcs_data(), that.srcs_data() + m_num_srcs, srcs_data());
+}
+
+IRInstruction& IRInstruction::operator=(const IRInstruction& that) {
+  if (this != &that) {
+    m_opcode = that.m_opcode;
+    m_dest = that.m_dest;
+    m_literal = that.m_literal;
+    set_arg_word_count(that.m_num_srcs);
+    std::copy(that.srcs_data(), that.srcs_data() + m_num_srcs, srcs_data());
+  }
+  return *this;
+}
+
+IRInstruction::~IRInstruction() {
+  if (srcs_on_heap()) {
+    delete[] m_heap_srcs;
+  }
+}
+
+IRInstruction* IRInstruction::set_arg_word_count(uint16_t count) {
+  if (count == m_num_srcs) {
+    return this;
+  }
+  uint16_t* old_srcs = srcs_data();
+  bool old_on_heap = srcs_on_heap();
+  uint16_t kept = std::min(count, m_num_srcs);
+  if (count > MAX_INLINE_SRCS) {
+    auto new_srcs = new uint16_t[count]();
+    std::copy(old_srcs, old_srcs + kept, new_srcs);
+    if (old_on_heap) {
+      delete[] old_srcs;
+    }
+    m_heap_srcs = new_srcs;
+  } else if (old_on_heap) {
+    uint16_t tmp[MAX_INLINE_SRCS];
+    std::copy(old_srcs, old_srcs + kept, tmp);
+    delete[] old_srcs;
+    std::copy(tmp, tmp + kept, m_inline_srcs);
+  }
+  if (count <= MAX_INLINE_SRCS) {
+    std::fill(m_inline_srcs + kept, m_inline_srcs + count, 0);
+  }
+  m_num_srcs = count;
+  return this;
 }
 
 // Structural equality of opcodes except branches offsets are ignored
@@ -33,7 +85,8 @@ IRInstruction::IRInstruction(IROpcode op) : m_opcode(op) {
 bool IRInstruction::operator==(const IRInstruction& that) const {
   return m_opcode == that.m_opcode &&
     m_string == that.m_string && // just test one member of the union
-    m_srcs == that.m_srcs &&
+    m_num_srcs == that.m_num_srcs &&
+    std::equal(srcs_data(), srcs_data() + m_num_srcs, that.srcs_data()) &&
     m_dest == that.m_dest &&
     m_literal == that.m_literal;
 }
@@ -210,7 +263,8 @@ void IRInstruction::denormalize_registers() {
       }
     }
     if (has_wide) {
-      m_srcs = srcs;
+      set_arg_word_count(srcs.size());
+      std::copy(srcs.begin(), srcs.end(), srcs_data());
     }
   }
 }
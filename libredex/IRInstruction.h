@@ -9,7 +9,11 @@
 
 #pragma once
 
+#include <boost/range/iterator_range.hpp>
+#include <vector>
+
 #include "DexInstruction.h"
+#include "SlabAllocator.h"
 
 /*
  * Our IR is very similar to the Dalvik instruction set, but with a few tweaks
@@ -106,9 +110,12 @@
  *   B2: <catches exceptions from B1>
  *     invoke-static {v0} LQux;.a(LFoo;)V
  */
-class IRInstruction final {
+class IRInstruction final : public SlabAllocated<IRInstruction> {
  public:
   explicit IRInstruction(IROpcode op);
+  IRInstruction(const IRInstruction&);
+  IRInstruction& operator=(const IRInstruction&);
+  ~IRInstruction();
 
   /*
    * Ensures that wide registers only have their first register referenced
@@ -152,7 +159,7 @@ class IRInstruction final {
    */
   size_t dests_size() const { return opcode_impl::dests_size(m_opcode); }
 
-  size_t srcs_size() const { return m_srcs.size(); }
+  size_t srcs_size() const { return m_num_srcs; }
 
   bool has_move_result_pseudo() const {
     return opcode_impl::has_move_result_pseudo(m_opcode);
@@ -195,9 +202,17 @@ class IRInstruction final {
     always_assert_log(dests_size(), "No dest for %s", SHOW(m_opcode));
     return m_dest;
   }
-  uint16_t src(size_t i) const { return m_srcs.at(i); }
-  const std::vector<uint16_t>& srcs() const { return m_srcs; }
-  uint16_t arg_word_count() const { return m_srcs.size(); }
+  uint16_t src(size_t i) const {
+    always_assert(i < m_num_srcs);
+    return srcs_data()[i];
+  }
+  boost::iterator_range<const uint16_t*> srcs() const {
+    return boost::make_iterator_range(srcs_data(), srcs_data() + m_num_srcs);
+  }
+  std::vector<uint16_t> srcs_vec() const {
+    return std::vector<uint16_t>(srcs_data(), srcs_data() + m_num_srcs);
+  }
+  uint16_t arg_word_count() const { return m_num_srcs; }
 
   /*
    * Setters for logical parts of the instruction.
@@ -212,13 +227,12 @@ class IRInstruction final {
     return this;
   }
   IRInstruction* set_src(size_t i, uint16_t vreg) {
-    m_srcs.at(i) = vreg;
-    return this;
-  }
-  IRInstruction* set_arg_word_count(uint16_t count) {
-    m_srcs.resize(count);
+    always_assert(i < m_num_srcs);
+    srcs_data()[i] = vreg;
     return this;
   }
+  // Registers that are added are zeroed; the existing ones are kept.
+  IRInstruction* set_arg_word_count(uint16_t count);
 
   int64_t get_literal() const {
     always_assert(has_literal());
@@ -318,9 +332,27 @@ class IRInstruction final {
   uint64_t hash();
 
  private:
+  /*
+   * Every opcode except the /range invokes has at most this many sources, so
+   * they are stored in the instruction itself. Longer lists go to the heap.
+   */
+  static constexpr uint16_t MAX_INLINE_SRCS = 5;
+
+  bool srcs_on_heap() const { return m_num_srcs > MAX_INLINE_SRCS; }
+  uint16_t* srcs_data() {
+    return srcs_on_heap() ? m_heap_srcs : m_inline_srcs;
+  }
+  const uint16_t* srcs_data() const {
+    return srcs_on_heap() ? m_heap_srcs : m_inline_srcs;
+  }
+
   IROpcode m_opcode;
-  std::vector<uint16_t> m_srcs;
+  uint16_t m_num_srcs{0};
   uint16_t m_dest{0};
+  union {
+    uint16_t m_inline_srcs[MAX_INLINE_SRCS];
+    uint16_t* m_heap_srcs;
+  };
   union {
     // Zero-initialize this union with the uint64_t member instead of a
     // pointer-type member so that it works properly even on 32-bit machines
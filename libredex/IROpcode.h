@@ -290,4 +290,26 @@ bool dest_is_wide(IROpcode);
 
 bool dest_is_object(IROpcode);
 
+/*
+ * The properties of an opcode, as looked up by most of the functions above
+ * and in namespace opcode. They are kept in a table that is generated at
+ * compile time from the switches in IROpcode.cpp.
+ */
+struct Properties {
+  opcode::Ref ref{opcode::Ref::None};
+  // Only set for non-internal opcodes.
+  DexOpcode dex_opcode{};
+  bool is_internal{false};
+  bool may_throw{false};
+  opcode::Branchingness branchingness{opcode::BRANCH_NONE};
+  bool has_range_form{false};
+  bool has_variable_srcs_size{false};
+  bool dest_is_wide{false};
+};
+
+const Properties& properties(IROpcode);
+
+// Evaluates the switches that the table is generated from, for testing.
+Properties properties_from_switches(IROpcode);
+
 } // namespace opcode_impl
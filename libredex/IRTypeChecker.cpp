@@ -29,7 +29,7 @@
 #include "IRCode.h"
 #include "IROpcode.h"
 #include "Match.h"
-#include "PatriciaTreeMapAbstractEnvironment.h"
+#include "RegisterAbstractEnvironment.h"
 #include "Show.h"
 
 std::ostream& operator<<(std::ostream& output, const IRType& type) {
@@ -147,7 +147,7 @@ constexpr register_t RESULT_REGISTER =
     std::numeric_limits<register_t>::max() - 1;
 
 using TypeEnvironment =
-    PatriciaTreeMapAbstractEnvironment<register_t, TypeDomain>;
+    RegisterAbstractEnvironment<register_t, TypeDomain>;
 
 // We abort the type checking process at the first error encountered.
 class TypeCheckingException final : public std::runtime_error {
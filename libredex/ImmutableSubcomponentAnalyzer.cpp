@@ -24,6 +24,7 @@
 #include "IRInstruction.h"
 #include "IROpcode.h"
 #include "PatriciaTreeMapAbstractEnvironment.h"
+#include "WorkQueue.h"
 
 std::string AccessPath::to_string() const {
   std::ostringstream out;
@@ -240,6 +241,21 @@ class Analyzer final
     return abs_path.access_path();
   }
 
+  AccessPathMap get_access_paths(IRInstruction* insn) const {
+    AccessPathMap paths;
+    auto it = m_environments.find(insn);
+    if (it == m_environments.end() || !it->second.is_value()) {
+      return paths;
+    }
+    for (const auto& binding : it->second.bindings()) {
+      auto path_opt = binding.second.access_path();
+      if (binding.first != RESULT_REGISTER && path_opt) {
+        paths.emplace(binding.first, *path_opt);
+      }
+    }
+    return paths;
+  }
+
   void populate_environments() {
     // We reserve enough space for the map in order to avoid repeated rehashing
     // during the computation.
@@ -311,3 +327,78 @@ boost::optional<AccessPath> ImmutableSubcomponentAnalyzer::get_access_path(
   }
   return m_analyzer->get_access_path(reg, insn);
 }
+
+AccessPathMap ImmutableSubcomponentAnalyzer::get_access_paths(
+    IRInstruction* insn) const {
+  if (m_analyzer == nullptr) {
+    return AccessPathMap();
+  }
+  return m_analyzer->get_access_paths(insn);
+}
+
+ImmutableSubcomponentAnalyzerCache::Entry&
+ImmutableSubcomponentAnalyzerCache::get_entry(DexMethod* method) {
+  std::lock_guard<std::mutex> lock(m_entries_mutex);
+  auto& entry = m_entries[method];
+  if (entry == nullptr) {
+    entry = std::make_unique<Entry>();
+  }
+  return *entry;
+}
+
+std::shared_ptr<const ImmutableSubcomponentAnalyzer>
+ImmutableSubcomponentAnalyzerCache::get(DexMethod* method) {
+  // Entries are never removed from the map, hence the reference stays valid
+  // once the lock on the map is released.
+  Entry& entry = get_entry(method);
+  std::lock_guard<std::mutex> lock(entry.mutex);
+  IRCode* code = method->get_code();
+  uint64_t epoch = code == nullptr ? 0 : code->epoch();
+  if (entry.analyzer == nullptr || entry.code != code ||
+      entry.epoch != epoch) {
+    entry.analyzer = std::make_shared<const ImmutableSubcomponentAnalyzer>(
+        method, m_is_immutable_getter);
+    entry.code = code;
+    entry.epoch = epoch;
+  }
+  return entry.analyzer;
+}
+
+std::unordered_map<DexMethod*,
+                   std::unordered_map<IRInstruction*, AccessPathMap>>
+ImmutableSubcomponentAnalyzerCache::get_access_paths(
+    const std::vector<DexMethod*>& methods) {
+  std::unordered_map<DexMethod*,
+                     std::unordered_map<IRInstruction*, AccessPathMap>>
+      result;
+  for (DexMethod* method : methods) {
+    if (method->get_code() != nullptr) {
+      result[method];
+    }
+  }
+  // The map doesn't change shape from here on, so that each worker can fill
+  // in the slot of its method without locking.
+  auto wq = workqueue_foreach<DexMethod*>([&](DexMethod* method) {
+    auto analyzer = get(method);
+    auto& paths = result.at(method);
+    for (auto& mie : InstructionIterable(method->get_code())) {
+      paths.emplace(mie.insn, analyzer->get_access_paths(mie.insn));
+    }
+  });
+  for (const auto& pair : result) {
+    wq.add_item(pair.first);
+  }
+  wq.run_all();
+  return result;
+}
+
+void ImmutableSubcomponentAnalyzerCache::invalidate(DexMethod* method) {
+  Entry& entry = get_entry(method);
+  std::lock_guard<std::mutex> lock(entry.mutex);
+  entry.analyzer.reset();
+}
+
+void ImmutableSubcomponentAnalyzerCache::clear() {
+  std::lock_guard<std::mutex> lock(m_entries_mutex);
+  m_entries.clear();
+}
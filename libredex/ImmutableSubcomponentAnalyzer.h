@@ -12,8 +12,10 @@
 #include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/optional.hpp>
@@ -101,6 +103,9 @@ bool operator==(const AccessPath& x, const AccessPath& y);
 
 std::ostream& operator<<(std::ostream& o, const AccessPath& path);
 
+// The access paths held by registers, keyed by register.
+using AccessPathMap = std::unordered_map<size_t, AccessPath>;
+
 class ImmutableSubcomponentAnalyzer final {
  public:
   // If we don't declare a destructor for this class, a default destructor will
@@ -127,6 +132,66 @@ class ImmutableSubcomponentAnalyzer final {
   boost::optional<AccessPath> get_access_path(size_t reg,
                                               IRInstruction* insn) const;
 
+  /*
+   * Returns the access paths of all the registers that reference a
+   * subcomponent of an immutable structure at the given instruction, with the
+   * same convention as get_access_path().
+   */
+  AccessPathMap get_access_paths(IRInstruction* insn) const;
+
  private:
   std::unique_ptr<isa_impl::Analyzer> m_analyzer;
 };
+
+/*
+ * Clients that query the same methods repeatedly can share the results of the
+ * analysis through this cache, which keeps one analyzer per method for a given
+ * predicate. An analyzer is recomputed when the code of its method has been
+ * modified since it was built, as told by the modification epoch of IRCode.
+ * Instructions edited in place don't change the epoch, and code that does that
+ * must call invalidate() itself.
+ *
+ * The cache may be used from multiple threads. A method is never analyzed by
+ * two threads at once, since the analysis builds the CFG of the method.
+ */
+class ImmutableSubcomponentAnalyzerCache final {
+ public:
+  explicit ImmutableSubcomponentAnalyzerCache(
+      std::function<bool(DexMethodRef*)> is_immutable_getter)
+      : m_is_immutable_getter(is_immutable_getter) {}
+
+  /*
+   * Returns the analyzer for the current code of the method, analyzing it if
+   * needed. The analyzer remains valid as long as the code isn't modified.
+   */
+  std::shared_ptr<const ImmutableSubcomponentAnalyzer> get(DexMethod* method);
+
+  /*
+   * Analyzes all the methods in parallel, and returns the access paths at
+   * each instruction of each method with code.
+   */
+  std::unordered_map<DexMethod*,
+                     std::unordered_map<IRInstruction*, AccessPathMap>>
+  get_access_paths(const std::vector<DexMethod*>& methods);
+
+  void invalidate(DexMethod* method);
+
+  // Unlike the other methods, this one must not run concurrently with any
+  // other use of the cache.
+  void clear();
+
+ private:
+  struct Entry {
+    std::mutex mutex;
+    // The code that was analyzed, and its epoch at the time.
+    IRCode* code{nullptr};
+    uint64_t epoch{0};
+    std::shared_ptr<const ImmutableSubcomponentAnalyzer> analyzer;
+  };
+
+  Entry& get_entry(DexMethod* method);
+
+  std::function<bool(DexMethodRef*)> m_is_immutable_getter;
+  std::mutex m_entries_mutex;
+  std::unordered_map<DexMethod*, std::unique_ptr<Entry>> m_entries;
+};
@@ -0,0 +1,172 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "IncrementalCache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "Debug.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "ProgramSnapshot.h"
+#include "Resolver.h"
+#include "Show.h"
+
+/*
+ * Each entry is a file named after the hash of its key, laid out as:
+ *
+ *   uint64_t key size, key, uint64_t stats size, stats, uint64_t code size,
+ *   code
+ *
+ * where the code is as program_snapshot::write_code() lays it out. The whole
+ * key is kept, so that entries whose keys only share a hash are told apart.
+ */
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// Bump this when what goes into a key changes.
+constexpr int kCacheVersion = 1;
+
+void describe(std::ostream& out, const DexMethod* method) {
+  if (method == nullptr) {
+    out << "unresolved\n";
+    return;
+  }
+  out << show(method) << ' ' << method->get_access() << ' '
+      << method->is_external() << ' ' << method->rstate.flags() << '\n';
+}
+
+void describe(std::ostream& out, const DexField* field) {
+  if (field == nullptr) {
+    out << "unresolved\n";
+    return;
+  }
+  out << show(field) << ' ' << field->get_access() << ' '
+      << field->is_external() << ' ' << field->rstate.flags() << '\n';
+}
+
+void describe(std::ostream& out, const DexType* type) {
+  auto cls = type_class(type);
+  if (cls == nullptr) {
+    out << show(type) << " undefined\n";
+    return;
+  }
+  out << show(type) << ' ' << cls->get_access() << ' ' << cls->is_external()
+      << ' ' << show(cls->get_super_class()) << ' ' << cls->rstate.flags()
+      << '\n';
+}
+
+bool read_sized(std::istream& in, std::string* str) {
+  uint64_t size;
+  if (!in.read((char*)&size, sizeof(size))) {
+    return false;
+  }
+  str->resize(size);
+  return static_cast<bool>(in.read(&(*str)[0], size));
+}
+
+void write_sized(std::ostream& out, const std::string& str) {
+  uint64_t size = str.size();
+  out.write((const char*)&size, sizeof(size));
+  out.write(str.data(), str.size());
+}
+
+} // namespace
+
+IncrementalCache::IncrementalCache(const std::string& dir,
+                                   const std::string& pass_name,
+                                   const Json::Value& pass_config)
+    : m_dir(dir + "/" + pass_name) {
+  fs::create_directories(m_dir);
+  std::ostringstream context;
+  context << "version " << kCacheVersion << '\n'
+          << pass_name << '\n'
+          << Json::FastWriter().write(pass_config);
+  m_context = context.str();
+}
+
+std::string IncrementalCache::make_key(DexMethod* method) const {
+  auto code = method->get_code();
+  always_assert(code != nullptr);
+  std::ostringstream key;
+  key << m_context << show(method) << ' ' << method->get_access() << '\n';
+  write_sized(key, program_snapshot::write_code(code));
+  for (auto& mie : InstructionIterable(code)) {
+    auto insn = mie.insn;
+    if (insn->has_method()) {
+      describe(key, resolve_method(insn->get_method(), opcode_to_search(insn)));
+    } else if (insn->has_field()) {
+      describe(key, resolve_field(insn->get_field()));
+    } else if (insn->has_type()) {
+      describe(key, insn->get_type());
+    }
+  }
+  return key.str();
+}
+
+std::string IncrementalCache::path_of(const std::string& key) const {
+  char name[17];
+  snprintf(name,
+           sizeof(name),
+           "%016llx",
+           (unsigned long long)std::hash<std::string>()(key));
+  return m_dir + "/" + name;
+}
+
+bool IncrementalCache::load(const std::string& key,
+                            size_t stats_size,
+                            DexMethod* method,
+                            std::string* stats) {
+  std::ifstream in(path_of(key), std::ios::binary);
+  std::string entry_key;
+  std::string code;
+  if (!in || !read_sized(in, &entry_key) || entry_key != key ||
+      !read_sized(in, stats) || stats->size() != stats_size ||
+      !read_sized(in, &code)) {
+    ++m_misses;
+    return false;
+  }
+  method->set_code(program_snapshot::read_code(code));
+  ++m_hits;
+  return true;
+}
+
+void IncrementalCache::store(const std::string& key,
+                             DexMethod* method,
+                             const std::string& stats) {
+  auto code = method->get_code();
+  if (code == nullptr) {
+    return;
+  }
+  // Other runs may use the same cache, so the entry only appears once it is
+  // complete.
+  auto path = path_of(key);
+  auto tmp_path = path + fs::unique_path(".%%%%-%%%%.tmp").string();
+  {
+    std::ofstream out(tmp_path, std::ios::binary);
+    write_sized(out, key);
+    write_sized(out, stats);
+    write_sized(out, program_snapshot::write_code(code));
+    if (!out) {
+      out.close();
+      fs::remove(tmp_path);
+      return;
+    }
+  }
+  fs::rename(tmp_path, path);
+}
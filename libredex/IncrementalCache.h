@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include <json/json.h>
+
+#include "DexClass.h"
+
+/*
+ * A disk cache of what an intraprocedural pass did to each method, so that a
+ * later run of redex over mostly the same app only optimizes the methods
+ * that changed. PassManager keeps one per pass when "incremental_cache_dir"
+ * is set in the config; see PassManager::get_incremental_cache().
+ *
+ * An entry is keyed on the code of the method before the pass, its
+ * signature and access flags, the config of the pass, and what the code
+ * refers to: the methods, fields and types it resolves to, with their access
+ * flags and keep state. A pass may only use the cache if the result for a
+ * method depends on nothing else.
+ *
+ * The entries hold the code after the pass and the stats the pass returned
+ * for the method, as they are in memory. The cache has to be cleared
+ * whenever redex itself changes.
+ */
+class IncrementalCache {
+ public:
+  IncrementalCache(const std::string& dir,
+                   const std::string& pass_name,
+                   const Json::Value& pass_config);
+
+  /*
+   * Runs `optimize(method)`, which returns its stats, unless the code of
+   * the method was optimized the same way before, in which case the code
+   * and the stats come from the cache. The method must have code. Can be
+   * called from several threads.
+   */
+  template <typename Stats, typename Fn>
+  Stats optimize(DexMethod* method, Fn optimize) {
+    static_assert(std::is_trivially_copyable<Stats>::value,
+                  "Stats are cached as they are in memory");
+    auto key = make_key(method);
+    std::string stats_bytes;
+    if (load(key, sizeof(Stats), method, &stats_bytes)) {
+      Stats stats;
+      memcpy(&stats, stats_bytes.data(), sizeof(Stats));
+      return stats;
+    }
+    Stats stats = optimize(method);
+    store(key, method, std::string((const char*)&stats, sizeof(Stats)));
+    return stats;
+  }
+
+  size_t hits() const { return m_hits; }
+  size_t misses() const { return m_misses; }
+
+ private:
+  std::string make_key(DexMethod* method) const;
+
+  // Replaces the code of `method` if there is an entry for `key`.
+  bool load(const std::string& key,
+            size_t stats_size,
+            DexMethod* method,
+            std::string* stats);
+
+  void store(const std::string& key,
+             DexMethod* method,
+             const std::string& stats);
+
+  std::string path_of(const std::string& key) const;
+
+  std::string m_dir;
+  std::string m_context;
+  std::atomic<size_t> m_hits{0};
+  std::atomic<size_t> m_misses{0};
+};
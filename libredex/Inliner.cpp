@@ -145,6 +145,29 @@ bool method_ok(DexType* type, DexMethodRef* meth) {
 
 }
 
+MultiMethodInliner::InliningInfo& MultiMethodInliner::InliningInfo::operator+=(
+    const InliningInfo& other) {
+  calls_inlined += other.calls_inlined;
+  recursive += other.recursive;
+  not_found += other.not_found;
+  blacklisted += other.blacklisted;
+  throws += other.throws;
+  multi_ret += other.multi_ret;
+  need_vmethod += other.need_vmethod;
+  invoke_super += other.invoke_super;
+  write_over_ins += other.write_over_ins;
+  escaped_virtual += other.escaped_virtual;
+  non_pub_virtual += other.non_pub_virtual;
+  escaped_field += other.escaped_field;
+  non_pub_field += other.non_pub_field;
+  non_pub_ctor += other.non_pub_ctor;
+  cross_store += other.cross_store;
+  caller_too_large += other.caller_too_large;
+  cold_caller += other.cold_caller;
+  calls_removed += other.calls_removed;
+  return *this;
+}
+
 MultiMethodInliner::MultiMethodInliner(
     const std::vector<DexClass*>& scope,
     DexStoresVector& stores,
@@ -160,7 +183,7 @@ MultiMethodInliner::MultiMethodInliner(
   walk::opcodes(scope, [](DexMethod* meth) { return true; },
       [&](DexMethod* meth, IRInstruction* insn) {
         if (is_invoke(insn->opcode())) {
-          auto callee = resolver(insn->get_method(), opcode_to_search(insn));
+          auto callee = resolve(insn->get_method(), opcode_to_search(insn));
           if (callee != nullptr && callee->is_concrete() &&
               candidates.find(callee) != candidates.end()) {
             callee_caller[callee].push_back(meth);
@@ -170,51 +193,154 @@ MultiMethodInliner::MultiMethodInliner(
       });
 }
 
-void MultiMethodInliner::inline_methods() {
+DexMethod* MultiMethodInliner::resolve(DexMethodRef* ref, MethodSearch search) {
+  using Slot = decltype(m_resolved_refs)::Slot;
+  auto key = std::make_pair(ref, search);
+  DexMethod* def = nullptr;
+  bool cached = m_resolved_refs.with_slot(key, [&](Slot& slot) {
+    auto it = slot.find(key);
+    if (it == slot.end()) {
+      return false;
+    }
+    def = it->second;
+    return true;
+  });
+  if (cached) {
+    return def;
+  }
+  {
+    // Resolvers usually keep a cache of their own which isn't thread-safe.
+    std::lock_guard<std::mutex> guard(m_resolver_lock);
+    def = resolver(ref, search);
+  }
+  // Failures are cached too: refs to external methods never resolve, and
+  // they'd otherwise all go through the lock above.
+  m_resolved_refs.with_slot(key, [&](Slot& slot) { slot[key] = def; });
+  return def;
+}
+
+void MultiMethodInliner::inline_methods(unsigned int num_threads) {
   // we want to inline bottom up, so as a first step we identify all the
-  // top level callers, then we recurse into all inlinable callees until we
-  // hit a leaf and we start inlining from there
-  for (auto it : caller_callee) {
+  // top level callers, then we walk into all inlinable callees until we
+  // hit a leaf. A caller can only be inlined into once all its callees are
+  // complete.
+  std::unordered_set<DexMethod*> visiting;
+  std::unordered_map<DexMethod*, std::vector<DexMethod*>> dag_callees;
+  std::vector<DexMethod*> order;
+  for (auto& it : caller_callee) {
     auto caller = it.first;
-    TraceContext context(caller->get_deobfuscated_name());
     // if the caller is not a top level keep going, it will be traversed
-    // when inlining a top level caller
+    // when walking a top level caller
     if (callee_caller.find(caller) != callee_caller.end()) continue;
-    std::unordered_set<DexMethod*> visited;
-    visited.insert(caller);
-    caller_inline(caller, it.second, visited);
+    build_dag(caller, visiting, dag_callees, order);
+  }
+
+  // For every caller, the number of its callees that are still being inlined
+  // into, and the callers waiting on it.
+  std::unordered_map<DexMethod*, size_t> index;
+  for (size_t i = 0; i < order.size(); ++i) {
+    index[order[i]] = i;
+  }
+  std::vector<std::atomic<size_t>> pending(order.size());
+  std::vector<std::vector<size_t>> dependents(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    std::unordered_set<DexMethod*> waits_on;
+    for (auto callee : dag_callees.at(order[i])) {
+      auto callee_idx = index.find(callee);
+      if (callee_idx != index.end() && waits_on.insert(callee).second) {
+        dependents[callee_idx->second].push_back(i);
+      }
+    }
+    pending[i] = waits_on.size();
   }
+
+  std::vector<InlineResults> worker_results(num_threads);
+  WorkQueue<size_t, InlineResults*, std::nullptr_t>* queue;
+  auto wq = WorkQueue<size_t, InlineResults*, std::nullptr_t>(
+      [&](InlineResults*& results, size_t i) -> std::nullptr_t {
+        auto caller = order[i];
+        TraceContext context(caller->get_deobfuscated_name());
+        inline_callees(caller, dag_callees.at(caller), *results);
+        for (auto dependent : dependents[i]) {
+          if (--pending[dependent] == 0) {
+            queue->add_item(dependent);
+          }
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &worker_results[thread_idx]; },
+      num_threads);
+  queue = &wq;
+  wq.set_wait_for_dynamic_items(true);
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (pending[i] == 0) {
+      wq.add_item(i);
+    }
+  }
+  wq.run_all();
+
+  InlineResults results;
+  for (auto& worker_result : worker_results) {
+    results.info += worker_result.info;
+    results.inlined.insert(worker_result.inlined.begin(),
+                           worker_result.inlined.end());
+    results.make_static.insert(worker_result.make_static.begin(),
+                               worker_result.make_static.end());
+  }
+  merge_results(results);
 }
 
-void MultiMethodInliner::caller_inline(
+void MultiMethodInliner::build_dag(
     DexMethod* caller,
-    const std::vector<DexMethod*>& callees,
-    std::unordered_set<DexMethod*>& visited) {
-  std::vector<DexMethod*> nonrecursive_callees;
+    std::unordered_set<DexMethod*>& visiting,
+    std::unordered_map<DexMethod*, std::vector<DexMethod*>>& dag_callees,
+    std::vector<DexMethod*>& order) {
+  visiting.insert(caller);
+  auto& nonrecursive_callees = dag_callees[caller];
+  const auto& callees = caller_callee.at(caller);
   nonrecursive_callees.reserve(callees.size());
-  // recurse into the callees in case they have something to inline on
-  // their own. We want to inline bottom up so that a callee is
-  // completely resolved by the time it is inlined.
   for (auto callee : callees) {
     // if the call chain hits a call loop, ignore and keep going
-    if (visited.count(callee) > 0) {
+    if (visiting.count(callee) > 0) {
       info.recursive++;
       continue;
     }
     nonrecursive_callees.push_back(callee);
-
-    auto maybe_caller = caller_callee.find(callee);
-    if (maybe_caller != caller_callee.end()) {
-      visited.insert(callee);
-      caller_inline(callee, maybe_caller->second, visited);
-      visited.erase(callee);
+    if (dag_callees.count(callee) == 0 && caller_callee.count(callee) > 0) {
+      build_dag(callee, visiting, dag_callees, order);
     }
   }
-  inline_callees(caller, nonrecursive_callees);
+  visiting.erase(caller);
+  order.push_back(caller);
+}
+
+void MultiMethodInliner::merge_results(const InlineResults& results) {
+  info += results.info;
+  inlined.insert(results.inlined.begin(), results.inlined.end());
+  m_make_static.insert(results.make_static.begin(), results.make_static.end());
+  std::vector<DexMethod*> callees(results.inlined.begin(),
+                                  results.inlined.end());
+  std::sort(callees.begin(), callees.end(), compare_dexmethods);
+  for (auto callee : callees) {
+    TRACE(MMINL,
+          6,
+          "checking visibility usage of members in %s\n",
+          SHOW(callee));
+    change_visibility(callee);
+  }
 }
 
 void MultiMethodInliner::inline_callees(
     DexMethod* caller, const std::vector<DexMethod*>& callees) {
+  InlineResults results;
+  inline_callees(caller, callees, results);
+  merge_results(results);
+}
+
+void MultiMethodInliner::inline_callees(DexMethod* caller,
+                                        const std::vector<DexMethod*>& callees,
+                                        InlineResults& results) {
   size_t found = 0;
 
   // walk the caller opcodes collecting all candidates to inline
@@ -225,7 +351,7 @@ void MultiMethodInliner::inline_callees(
   for (auto it = ii.begin(); it != end; ++it) {
     auto insn = it->insn;
     if (!is_invoke(insn->opcode())) continue;
-    auto callee = resolver(insn->get_method(), opcode_to_search(insn));
+    auto callee = resolve(insn->get_method(), opcode_to_search(insn));
     if (callee == nullptr) continue;
     if (std::find(callees.begin(), callees.end(), callee) == callees.end()) {
       continue;
@@ -237,7 +363,7 @@ void MultiMethodInliner::inline_callees(
   }
   if (found != callees.size()) {
     always_assert(found <= callees.size());
-    info.not_found += callees.size() - found;
+    results.info.not_found += callees.size() - found;
   }
 
   // attempt to inline all inlinable candidates
@@ -246,7 +372,15 @@ void MultiMethodInliner::inline_callees(
     auto callee = inlinable.first;
     auto insn = inlinable.second;
 
-    if (!is_inlinable(caller, callee, estimated_insn_size)) {
+    if (is_removable_call(caller, callee, insn)) {
+      TRACE(INL, 2, "caller: %s\tremoved call: %s\n", SHOW(caller),
+            SHOW(callee));
+      caller->get_code()->remove_opcode(insn);
+      results.info.calls_removed++;
+      results.inlined.insert(callee);
+      continue;
+    }
+    if (!is_inlinable(caller, callee, estimated_insn_size, results)) {
       continue;
     }
 
@@ -254,36 +388,129 @@ void MultiMethodInliner::inline_callees(
         SHOW(callee), caller->get_code()->get_registers_size(),
         SHOW(caller),
         callee->get_code()->get_registers_size());
-    inliner::inline_method(caller->get_code(), callee->get_code(), insn);
+    auto tmpl = get_inline_template(callee);
+    inliner::inline_method(caller->get_code(), *tmpl, insn);
     TRACE(INL, 2, "caller: %s\tcallee: %s\n", SHOW(caller), SHOW(callee));
-    estimated_insn_size += callee->get_code()->sum_opcode_sizes();
-    TRACE(MMINL,
-          6,
-          "checking visibility usage of members in %s\n",
-          SHOW(callee));
-    change_visibility(callee);
-    info.calls_inlined++;
-    inlined.insert(callee);
+    estimated_insn_size += tmpl->code_size();
+    results.info.calls_inlined++;
+    results.inlined.insert(callee);
   }
 }
 
+std::shared_ptr<const inliner::InlineTemplate>
+MultiMethodInliner::get_inline_template(const DexMethod* callee) {
+  using Slot = decltype(m_inline_templates)::Slot;
+  auto code = callee->get_code();
+  auto callers = callee_caller.find(const_cast<DexMethod*>(callee));
+  if (callers == callee_caller.end() || callers->second.size() < 2) {
+    return std::make_shared<const inliner::InlineTemplate>(code);
+  }
+  std::shared_ptr<const inliner::InlineTemplate> tmpl;
+  m_inline_templates.with_slot(callee, [&](Slot& slot) {
+    auto it = slot.find(callee);
+    if (it == slot.end()) {
+      return;
+    }
+    if (it->second.tmpl->is_current(code)) {
+      tmpl = it->second.tmpl;
+    }
+    if (--it->second.uses_left == 0) {
+      slot.erase(it);
+    }
+  });
+  if (tmpl != nullptr) {
+    return tmpl;
+  }
+  // Made outside of the lock; should two threads race, both templates are
+  // the same.
+  tmpl = std::make_shared<const inliner::InlineTemplate>(code);
+  m_inline_templates.with_slot(callee, [&](Slot& slot) {
+    slot[callee] = CachedTemplate{tmpl, callers->second.size() - 1};
+  });
+  return tmpl;
+}
+
+bool MultiMethodInliner::is_removable_call(const DexMethod* caller,
+                                           const DexMethod* callee,
+                                           FatMethod::iterator invoke) {
+  // The object that a constructor initializes can't be used without it.
+  if (m_config.side_effects == nullptr || is_init(callee) ||
+      !side_effects::is_removable(m_config.side_effects->get(callee))) {
+    return false;
+  }
+  auto code = caller->get_code();
+  for (auto it = std::next(invoke); it != code->end(); ++it) {
+    if (it->type == MFLOW_OPCODE) {
+      return !is_move_result(it->insn->opcode());
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<const MultiMethodInliner::CalleeSummary>
+MultiMethodInliner::get_callee_summary(const DexMethod* callee) {
+  using Slot = decltype(m_callee_summaries)::Slot;
+  auto code = callee->get_code();
+  std::shared_ptr<const CalleeSummary> summary;
+  m_callee_summaries.with_slot(callee, [&](Slot& slot) {
+    auto it = slot.find(callee);
+    if (it != slot.end() && it->second->code == code &&
+        it->second->code_epoch == code->epoch()) {
+      summary = it->second;
+    }
+  });
+  if (summary != nullptr) {
+    return summary;
+  }
+  auto fresh = std::make_shared<CalleeSummary>();
+  fresh->code = code;
+  fresh->code_epoch = code->epoch();
+  fresh->code_size = code->sum_opcode_sizes();
+  fresh->registers_size = code->get_registers_size();
+  InliningInfo unused;
+  fresh->cross_store = cross_store_reference(callee, unused);
+  fresh->external_catch = has_external_catch(callee);
+  fresh->same_class.blocked = cannot_inline_opcodes(
+      callee, /* same_class */ true, fresh->same_class.results);
+  fresh->other_class.blocked = cannot_inline_opcodes(
+      callee, /* same_class */ false, fresh->other_class.results);
+  summary = fresh;
+  m_callee_summaries.with_slot(callee,
+                               [&](Slot& slot) { slot[callee] = summary; });
+  return summary;
+}
+
 /**
  * Defines the set of rules that determine whether a function is inlinable.
  */
 bool MultiMethodInliner::is_inlinable(const DexMethod* caller,
                                       const DexMethod* callee,
-                                      size_t estimated_insn_size) {
+                                      size_t estimated_insn_size,
+                                      InlineResults& results) {
+  auto& info = results.info;
+  auto summary = get_callee_summary(callee);
   // don't inline cross store references
-  if (cross_store_reference(callee)) {
+  if (summary->cross_store) {
+    info.cross_store++;
     return false;
   }
-  if (is_blacklisted(callee)) return false;
-  if (caller_is_blacklisted(caller)) return false;
-  if (has_external_catch(callee)) return false;
-  if (cannot_inline_opcodes(caller, callee)) {
+  if (is_blacklisted(callee, info)) return false;
+  if (caller_is_blacklisted(caller, info)) return false;
+  if (caller_is_cold(caller, callee, info)) return false;
+  if (summary->external_catch) return false;
+  const auto& opcode_checks = caller->get_class() == callee->get_class()
+                                  ? summary->same_class
+                                  : summary->other_class;
+  info += opcode_checks.results.info;
+  results.make_static.insert(opcode_checks.results.make_static.begin(),
+                             opcode_checks.results.make_static.end());
+  if (opcode_checks.blocked) {
     return false;
   }
-  if (caller_too_large(caller->get_class(), estimated_insn_size, callee)) {
+  if (caller_too_large(caller->get_class(),
+                       estimated_insn_size,
+                       summary->code_size,
+                       info)) {
     return false;
   }
 
@@ -295,7 +522,8 @@ bool MultiMethodInliner::is_inlinable(const DexMethod* caller,
  * Typically used to prevent inlining / deletion of methods that are called
  * via reflection.
  */
-bool MultiMethodInliner::is_blacklisted(const DexMethod* callee) {
+bool MultiMethodInliner::is_blacklisted(const DexMethod* callee,
+                                        InliningInfo& info) {
   auto cls = type_class(callee->get_class());
   // Enums are all blacklisted
   if (is_enum(cls)) {
@@ -313,7 +541,8 @@ bool MultiMethodInliner::is_blacklisted(const DexMethod* callee) {
 
 bool MultiMethodInliner::caller_too_large(DexType* caller_type,
                                           size_t estimated_insn_size,
-                                          const DexMethod* callee) {
+                                          size_t callee_insn_size,
+                                          InliningInfo& info) {
   if (!m_config.enforce_method_size_limit) {
     return false;
   }
@@ -325,8 +554,7 @@ bool MultiMethodInliner::caller_too_large(DexType* caller_type,
   // INSTRUCTION_BUFFER is added because the final method size is often larger
   // than our estimate -- during the sync phase, we may have to pick larger
   // branch opcodes to encode large jumps.
-  auto insns_size = callee->get_code()->sum_opcode_sizes();
-  if (estimated_insn_size + insns_size >
+  if (estimated_insn_size + callee_insn_size >
       MAX_INSTRUCTION_SIZE - INSTRUCTION_BUFFER) {
     info.caller_too_large++;
     return true;
@@ -334,7 +562,23 @@ bool MultiMethodInliner::caller_too_large(DexType* caller_type,
   return false;
 }
 
-bool MultiMethodInliner::caller_is_blacklisted(const DexMethod* caller) {
+bool MultiMethodInliner::caller_is_cold(const DexMethod* caller,
+                                        const DexMethod* callee,
+                                        InliningInfo& info) {
+  if (!m_config.profile_guided || m_config.hot_methods.count(caller)) {
+    return false;
+  }
+  // Inlining a callee into its only caller doesn't add any code.
+  auto callers = callee_caller.find(const_cast<DexMethod*>(callee));
+  if (callers == callee_caller.end() || callers->second.size() <= 1) {
+    return false;
+  }
+  info.cold_caller++;
+  return true;
+}
+
+bool MultiMethodInliner::caller_is_blacklisted(const DexMethod* caller,
+                                               InliningInfo& info) {
   auto cls = caller->get_class();
   if (m_config.caller_black_list.count(cls)) {
     info.blacklisted++;
@@ -362,15 +606,17 @@ bool MultiMethodInliner::has_external_catch(const DexMethod* callee) {
 /**
  * Analyze opcodes in the callee to see if they are problematic for inlining.
  */
-bool MultiMethodInliner::cannot_inline_opcodes(const DexMethod* caller,
-                                               const DexMethod* callee) {
+bool MultiMethodInliner::cannot_inline_opcodes(const DexMethod* callee,
+                                               bool same_class,
+                                               InlineResults& results) {
+  auto& info = results.info;
   int ret_count = 0;
   for (auto& mie : InstructionIterable(callee->get_code())) {
     auto insn = mie.insn;
-    if (create_vmethod(insn)) return true;
-    if (nonrelocatable_invoke_super(insn, callee, caller)) return true;
-    if (unknown_virtual(insn, callee, caller)) return true;
-    if (unknown_field(insn, callee, caller)) return true;
+    if (create_vmethod(insn, results)) return true;
+    if (nonrelocatable_invoke_super(insn, same_class, info)) return true;
+    if (unknown_virtual(insn, same_class, info)) return true;
+    if (unknown_field(insn, same_class, info)) return true;
     if (!m_config.throws_inline && insn->opcode() == OPCODE_THROW) {
       info.throws++;
       return true;
@@ -395,10 +641,12 @@ bool MultiMethodInliner::cannot_inline_opcodes(const DexMethod* caller,
  * referenced by a callee is visible and accessible in the caller context.
  * This step would not be needed if we changed all private instance to static.
  */
-bool MultiMethodInliner::create_vmethod(IRInstruction* insn) {
+bool MultiMethodInliner::create_vmethod(IRInstruction* insn,
+                                        InlineResults& results) {
+  auto& info = results.info;
   auto opcode = insn->opcode();
   if (opcode == OPCODE_INVOKE_DIRECT) {
-    auto method = resolver(insn->get_method(), MethodSearch::Direct);
+    auto method = resolve(insn->get_method(), MethodSearch::Direct);
     if (method == nullptr) {
       info.need_vmethod++;
       return true;
@@ -413,7 +661,7 @@ bool MultiMethodInliner::create_vmethod(IRInstruction* insn) {
       return false;
     }
     if (!is_native(method) && !keep(method)) {
-      m_make_static.insert(method);
+      results.make_static.insert(method);
     } else {
       info.need_vmethod++;
       return true;
@@ -428,10 +676,10 @@ bool MultiMethodInliner::create_vmethod(IRInstruction* insn) {
  * Inlining an invoke_super off its class hierarchy would break the verifier.
  */
 bool MultiMethodInliner::nonrelocatable_invoke_super(IRInstruction* insn,
-                                                     const DexMethod* callee,
-                                                     const DexMethod* caller) {
+                                                     bool same_class,
+                                                     InliningInfo& info) {
   if (insn->opcode() == OPCODE_INVOKE_SUPER) {
-    if (callee->get_class() == caller->get_class()) {
+    if (same_class) {
       return false;
     }
     info.invoke_super++;
@@ -449,17 +697,17 @@ bool MultiMethodInliner::nonrelocatable_invoke_super(IRInstruction* insn,
  */
 
 bool MultiMethodInliner::unknown_virtual(IRInstruction* insn,
-                                         const DexMethod* callee,
-                                         const DexMethod* caller) {
+                                         bool same_class,
+                                         InliningInfo& info) {
   // if the caller and callee are in the same class, we don't have to worry
   // about unknown virtuals -- private / protected methods will remain
   // accessible
-  if (caller->get_class() == callee->get_class()) {
+  if (same_class) {
     return false;
   }
   if (insn->opcode() == OPCODE_INVOKE_VIRTUAL) {
     auto method = insn->get_method();
-    auto res_method = resolver(method, MethodSearch::Virtual);
+    auto res_method = resolve(method, MethodSearch::Virtual);
     if (res_method == nullptr) {
       // if it's not known to redex but it's a common java/android API method
       if (method_ok(method->get_class(), method)) {
@@ -497,12 +745,12 @@ bool MultiMethodInliner::unknown_virtual(IRInstruction* insn,
  * we don't know we have no idea whether the field was public or not anyway.
  */
 bool MultiMethodInliner::unknown_field(IRInstruction* insn,
-                                       const DexMethod* callee,
-                                       const DexMethod* caller) {
+                                       bool same_class,
+                                       InliningInfo& info) {
   // if the caller and callee are in the same class, we don't have to worry
   // about unknown fields -- private / protected fields will remain
   // accessible
-  if (caller->get_class() == callee->get_class()) {
+  if (same_class) {
     return false;
   }
   if (is_ifield_op(insn->opcode()) || is_sfield_op(insn->opcode())) {
@@ -521,7 +769,8 @@ bool MultiMethodInliner::unknown_field(IRInstruction* insn,
   return false;
 }
 
-bool MultiMethodInliner::cross_store_reference(const DexMethod* callee) {
+bool MultiMethodInliner::cross_store_reference(const DexMethod* callee,
+                                               InliningInfo& info) {
   size_t store_idx = xstores.get_store_idx(callee->get_class());
   for (auto& mie : InstructionIterable(callee->get_code())) {
     auto insn = mie.insn;
@@ -601,8 +850,11 @@ void select_inlinable(
     const std::unordered_set<DexMethod*>& methods,
     MethodRefCache& resolved_refs,
     std::unordered_set<DexMethod*>* inlinable,
-    bool multiple_callers) {
+    bool multiple_callers,
+    const std::unordered_set<const DexMethod*>* hot_methods,
+    size_t hot_callee_size) {
   std::unordered_map<DexMethod*, int> calls;
+  std::unordered_set<DexMethod*> called_from_hot;
   for (const auto& method : methods) {
     calls[method] = 0;
   }
@@ -615,6 +867,9 @@ void select_inlinable(
           if (callee != nullptr && callee->is_concrete()
               && methods.count(callee) > 0) {
             calls[callee]++;
+            if (hot_methods != nullptr && hot_methods->count(meth)) {
+              called_from_hot.insert(callee);
+            }
           }
         }
       });
@@ -646,6 +901,12 @@ void select_inlinable(
       }
     }
   }
+  // The inliner only duplicates these into their hot callers.
+  for (auto callee : called_from_hot) {
+    if (callee->get_code()->count_opcodes() <= hot_callee_size) {
+      inlinable->insert(callee);
+    }
+  }
 }
 
 namespace {
@@ -656,22 +917,16 @@ using RegMap = transform::RegMap;
  * Expands the caller register file by the size of the callee register file,
  * and allocates the high registers to the callee. E.g. if we have a caller
  * with registers_size of M and a callee with registers_size N, this function
- * will resize the caller's register file to M + N and map register k in the
- * callee to M + k in the caller. It also inserts move instructions to map the
- * callee arguments to the newly allocated registers.
+ * will resize the caller's register file to M + N and returns M, the offset
+ * that maps register k in the callee to M + k in the caller. It also inserts
+ * move instructions to map the callee arguments to the newly allocated
+ * registers.
  */
-std::unique_ptr<RegMap> gen_callee_reg_map(
-    IRCode* caller_code,
-    const IRCode* callee_code,
-    FatMethod::iterator invoke_it) {
+uint16_t gen_callee_reg_offset(IRCode* caller_code,
+                               const IRCode* callee_code,
+                               FatMethod::iterator invoke_it) {
   auto callee_reg_start = caller_code->get_registers_size();
   auto insn = invoke_it->insn;
-  auto reg_map = std::make_unique<RegMap>();
-
-  // generate the callee register map
-  for (auto i = 0; i < callee_code->get_registers_size(); ++i) {
-    reg_map->emplace(i, callee_reg_start + i);
-  }
 
   // generate and insert the move instructions
   auto param_insns = InstructionIterable(callee_code->get_param_instructions());
@@ -703,7 +958,7 @@ std::unique_ptr<RegMap> gen_callee_reg_map(
   }
   caller_code->set_registers_size(callee_reg_start +
                                   callee_code->get_registers_size());
-  return reg_map;
+  return callee_reg_start;
 }
 
 /**
@@ -757,27 +1012,43 @@ void remap_callee_for_tail_call(const IRCode* caller_code,
   transform::remap_registers(callee_code, reg_map);
 }
 
+/*
+ * Drops the debug entries that mustn't be copied into a caller: the
+ * DBG_SET_PROLOGUE_END, and the end and restart of locals that the callee
+ * didn't start, i.e. of its parameters.
+ *
+ * The parameter names are part of the debug info for the method.
+ * The technically correct solution would be to make a start
+ * local for each of them.  However, that would also imply another
+ * end local after the tail to correctly set what the register
+ * is at the end.  This would bloat the debug info parameters for
+ * a corner case.
+ *
+ * Instead, we just delete locals lifetime information for parameters.
+ * This is an exceedingly rare case triggered by goofy code that
+ * reuses parameters as locals.
+ */
 void cleanup_callee_debug(IRCode* callee_code) {
   std::unordered_set<uint16_t> valid_regs;
   auto it = callee_code->begin();
   while (it != callee_code->end()) {
     auto& mei = *it++;
     if (mei.type == MFLOW_DEBUG) {
-      switch(mei.dbgop->opcode()) {
+      switch(mei.dbgop.opcode()) {
       case DBG_SET_PROLOGUE_END:
-        callee_code->erase(callee_code->iterator_to(mei));
+        callee_code->erase_and_dispose(callee_code->iterator_to(mei));
         break;
       case DBG_START_LOCAL:
       case DBG_START_LOCAL_EXTENDED: {
-        auto reg = mei.dbgop->uvalue();
+        auto reg = mei.dbgop.uvalue();
         valid_regs.insert(reg);
         break;
       }
       case DBG_END_LOCAL:
       case DBG_RESTART_LOCAL: {
-        auto reg = mei.dbgop->uvalue();
+        auto reg = mei.dbgop.uvalue();
         if (valid_regs.find(reg) == valid_regs.end()) {
-          callee_code->erase(callee_code->iterator_to(mei));
+          callee_code->erase_and_dispose(callee_code->iterator_to(mei));
         }
         break;
       }
@@ -790,34 +1061,79 @@ void cleanup_callee_debug(IRCode* callee_code) {
 } // namespace
 
 /*
- * For splicing a callee's FatMethod into a caller.
+ * For splicing the FatMethod of an InlineTemplate into a caller.
  */
 class MethodSplicer {
   IRCode* m_mtcaller;
-  IRCode* m_mtcallee;
   // We need a map of MethodItemEntry we have created because a branch
   // points to another MethodItemEntry which may have been created or not
   std::unordered_map<MethodItemEntry*, MethodItemEntry*> m_entry_map;
-  // for remapping the parent position pointers
+  // the callee positions, rebound under the invoke position
   std::unordered_map<DexPosition*, DexPosition*> m_pos_map;
-  const RegMap& m_callee_reg_map;
+  uint16_t m_callee_reg_offset;
   DexPosition* m_invoke_position;
   MethodItemEntry* m_active_catch;
-  std::unordered_set<uint16_t> m_valid_dbg_regs;
 
  public:
   MethodSplicer(IRCode* mtcaller,
-                IRCode* mtcallee,
-                const RegMap& callee_reg_map,
+                uint16_t callee_reg_offset,
                 DexPosition* invoke_position,
                 MethodItemEntry* active_catch)
       : m_mtcaller(mtcaller),
-        m_mtcallee(mtcallee),
-        m_callee_reg_map(callee_reg_map),
+        m_callee_reg_offset(callee_reg_offset),
         m_invoke_position(invoke_position),
         m_active_catch(active_catch) {
     m_entry_map[nullptr] = nullptr;
-    m_pos_map[nullptr] = nullptr;
+  }
+
+  /*
+   * Moves the registers of a cloned callee entry past the caller's.
+   */
+  void offset_registers(MethodItemEntry& mei) const {
+    switch (mei.type) {
+    case MFLOW_OPCODE: {
+      auto insn = mei.insn;
+      if (insn->dests_size()) {
+        insn->set_dest(insn->dest() + m_callee_reg_offset);
+      }
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        insn->set_src(i, insn->src(i) + m_callee_reg_offset);
+      }
+      break;
+    }
+    case MFLOW_DEBUG:
+      switch (mei.dbgop.opcode()) {
+      case DBG_START_LOCAL:
+      case DBG_START_LOCAL_EXTENDED:
+      case DBG_END_LOCAL:
+      case DBG_RESTART_LOCAL:
+        mei.dbgop.set_uvalue(mei.dbgop.uvalue() + m_callee_reg_offset);
+        break;
+      default:
+        break;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  /*
+   * The callee position, with the invoke position at the root of its chain of
+   * parents.
+   */
+  DexPosition* remap_position(DexPosition* pos) {
+    if (pos == nullptr) {
+      return m_invoke_position;
+    }
+    auto it = m_pos_map.find(pos);
+    if (it != m_pos_map.end()) {
+      return it->second;
+    }
+    auto remapped = DexPosition::make(
+        pos->method, pos->file, pos->line, remap_position(pos->parent));
+    m_pos_map.emplace(pos, remapped);
+    return remapped;
   }
 
   MethodItemEntry* clone(MethodItemEntry* mei) {
@@ -850,8 +1166,7 @@ class MethodSplicer {
     case MFLOW_DEBUG:
       return cloned_mei;
     case MFLOW_POSITION:
-      m_pos_map[mei->pos.get()] = cloned_mei->pos.get();
-      cloned_mei->pos->parent = m_pos_map.at(cloned_mei->pos->parent);
+      cloned_mei->pos = remap_position(mei->pos);
       return cloned_mei;
     case MFLOW_FALLTHROUGH:
       return cloned_mei;
@@ -865,15 +1180,12 @@ class MethodSplicer {
                   FatMethod::iterator fcallee_start,
                   FatMethod::iterator fcallee_end) {
     for (auto it = fcallee_start; it != fcallee_end; ++it) {
-      if (should_skip_debug(&*it)) {
-        continue;
-      }
       if (it->type == MFLOW_OPCODE &&
           opcode::is_load_param(it->insn->opcode())) {
         continue;
       }
       auto mei = clone(&*it);
-      transform::remap_registers(*mei, m_callee_reg_map);
+      offset_registers(*mei);
       if (mei->type == MFLOW_TRY && m_active_catch != nullptr) {
         auto tentry = mei->tentry;
         // try ranges cannot be nested, so we flatten them here
@@ -890,9 +1202,6 @@ class MethodSplicer {
             break;
         }
       } else {
-        if (mei->type == MFLOW_POSITION && mei->pos->parent == nullptr) {
-          mei->pos->parent = m_invoke_position;
-        }
         // if a handler list does not terminate in a catch-all, have it point to
         // the parent's active catch handler. TODO: Make this more precise by
         // checking if the parent catch type is a subtype of the callee's.
@@ -904,58 +1213,38 @@ class MethodSplicer {
       }
     }
   }
-
- private:
-  /* We need to skip two cases:
-   * Duplicate DBG_SET_PROLOGUE_END
-   * Uninitialized parameters
-   *
-   * The parameter names are part of the debug info for the method.
-   * The technically correct solution would be to make a start
-   * local for each of them.  However, that would also imply another
-   * end local after the tail to correctly set what the register
-   * is at the end.  This would bloat the debug info parameters for
-   * a corner case.
-   *
-   * Instead, we just delete locals lifetime information for parameters.
-   * This is an exceedingly rare case triggered by goofy code that
-   * reuses parameters as locals.
-   */
-  bool should_skip_debug(const MethodItemEntry* mei) {
-    if (mei->type != MFLOW_DEBUG) {
-      return false;
-    }
-    switch (mei->dbgop->opcode()) {
-    case DBG_SET_PROLOGUE_END:
-      return true;
-    case DBG_START_LOCAL:
-    case DBG_START_LOCAL_EXTENDED: {
-      auto reg = mei->dbgop->uvalue();
-      m_valid_dbg_regs.insert(reg);
-      return false;
-    }
-    case DBG_END_LOCAL:
-    case DBG_RESTART_LOCAL: {
-      auto reg = mei->dbgop->uvalue();
-      if (m_valid_dbg_regs.find(reg) == m_valid_dbg_regs.end()) {
-        return true;
-      }
-    }
-    default:
-      return false;
-    }
-  }
 };
 
 namespace inliner {
 
+InlineTemplate::InlineTemplate(const IRCode* callee)
+    : m_callee(callee),
+      m_callee_epoch(callee->epoch()),
+      m_code(std::make_unique<IRCode>(*callee)),
+      m_code_size(callee->sum_opcode_sizes()) {
+  cleanup_callee_debug(m_code.get());
+  m_ret = std::find_if(
+      m_code->begin(), m_code->end(), [](const MethodItemEntry& mei) {
+        return mei.type == MFLOW_OPCODE && is_return(mei.insn->opcode());
+      });
+  // try items can span across a return opcode
+  m_ret_catch = transform::find_active_catch(m_code.get(), m_ret);
+}
+
 void inline_method(IRCode* caller_code,
                    IRCode* callee_code,
                    FatMethod::iterator pos) {
+  inline_method(caller_code, InlineTemplate(callee_code), pos);
+}
+
+void inline_method(IRCode* caller_code,
+                   const InlineTemplate& callee,
+                   FatMethod::iterator pos) {
+  auto callee_code = callee.m_code.get();
   TRACE(INL, 5, "caller code:\n%s\n", SHOW(caller_code));
   TRACE(INL, 5, "callee code:\n%s\n", SHOW(callee_code));
 
-  auto callee_reg_map = gen_callee_reg_map(caller_code, callee_code, pos);
+  auto callee_reg_offset = gen_callee_reg_offset(caller_code, callee_code, pos);
 
   // find the move-result after the invoke, if any. Must be the first
   // instruction after the invoke
@@ -971,9 +1260,8 @@ void inline_method(IRCode* caller_code,
   auto position_it = --FatMethod::reverse_iterator(pos);
   while (++position_it != caller_code->rend()
       && position_it->type != MFLOW_POSITION);
-  std::unique_ptr<DexPosition> pos_nullptr;
-  auto& invoke_position =
-    position_it == caller_code->rend() ? pos_nullptr : position_it->pos;
+  auto invoke_position =
+    position_it == caller_code->rend() ? nullptr : position_it->pos;
   if (invoke_position) {
     TRACE(INL, 3, "Inlining call at %s:%d\n",
           invoke_position->file->c_str(),
@@ -985,20 +1273,13 @@ void inline_method(IRCode* caller_code,
 
   // Copy the callee up to the return. Everything else we push at the end
   // of the caller
-  auto splice = MethodSplicer(caller_code,
-                              callee_code,
-                              *callee_reg_map,
-                              invoke_position.get(),
-                              caller_catch);
-  auto ret_it = std::find_if(
-      callee_code->begin(), callee_code->end(), [](const MethodItemEntry& mei) {
-        return mei.type == MFLOW_OPCODE && is_return(mei.insn->opcode());
-      });
+  auto splice = MethodSplicer(
+      caller_code, callee_reg_offset, invoke_position, caller_catch);
+  auto ret_it = callee.m_ret;
   splice(pos, callee_code->begin(), ret_it);
 
   // try items can span across a return opcode
-  auto callee_catch =
-      splice.clone(transform::find_active_catch(callee_code, ret_it));
+  auto callee_catch = splice.clone(callee.m_ret_catch);
   if (callee_catch != nullptr) {
     caller_code->insert_before(pos,
                                *(new MethodItemEntry(TRY_END, callee_catch)));
@@ -1009,9 +1290,8 @@ void inline_method(IRCode* caller_code,
   }
 
   if (move_res != caller_code->end() && ret_it != callee_code->end()) {
-    auto ret_insn = std::make_unique<IRInstruction>(*ret_it->insn);
-    transform::remap_registers(ret_insn.get(), *callee_reg_map);
-    IRInstruction* move = move_result(ret_insn.get(), move_res->insn);
+    IRInstruction* move = move_result(ret_it->insn, move_res->insn);
+    move->set_src(0, move->src(0) + callee_reg_offset);
     auto move_mei = new MethodItemEntry(move);
     caller_code->insert_before(pos, *move_mei);
   }
@@ -1019,8 +1299,7 @@ void inline_method(IRCode* caller_code,
   // original position
   if (invoke_position) {
     caller_code->insert_before(pos,
-                    *(new MethodItemEntry(
-                        std::make_unique<DexPosition>(*invoke_position))));
+                               *(new MethodItemEntry(invoke_position)));
   }
 
   // remove invoke
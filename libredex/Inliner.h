@@ -11,13 +11,21 @@
 
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "ConcurrentContainers.h"
 #include "DexClass.h"
 #include "DexStore.h"
 #include "IRCode.h"
 #include "Resolver.h"
+#include "SideEffectSummaries.h"
+#include "WorkQueue.h"
 
 namespace inliner {
 
@@ -40,6 +48,42 @@ void inline_tail_call(DexMethod* caller,
                       DexMethod* callee,
                       FatMethod::iterator pos);
 
+/*
+ * A callee made ready to be inlined at many call sites. Its code is copied
+ * once, without the debug entries that don't survive inlining, and each
+ * call site then only copies that, with the callee registers shifted past
+ * the caller's.
+ *
+ * The template doesn't follow later changes to the callee, see is_current().
+ * Call sites may inline the same template concurrently.
+ */
+class InlineTemplate {
+ public:
+  explicit InlineTemplate(const IRCode* callee);
+
+  // Whether the callee hasn't been modified since the template was made.
+  bool is_current(const IRCode* callee) const {
+    return callee == m_callee && callee->epoch() == m_callee_epoch;
+  }
+
+  // The sum_opcode_sizes() of the callee.
+  size_t code_size() const { return m_code_size; }
+
+ private:
+  friend void inline_method(IRCode*,
+                            const InlineTemplate&,
+                            FatMethod::iterator);
+
+  const IRCode* m_callee;
+  uint64_t m_callee_epoch;
+  std::unique_ptr<IRCode> m_code;
+  // The first return of m_code, or its end.
+  FatMethod::iterator m_ret;
+  // The catch handler that is active at m_ret, if any.
+  MethodItemEntry* m_ret_catch;
+  size_t m_code_size;
+};
+
 /*
  * Inline `callee` into `caller` at `pos`.
  * This is a general-purpose inliner.
@@ -48,6 +92,10 @@ void inline_method(IRCode* caller,
                    IRCode* callee,
                    FatMethod::iterator pos);
 
+void inline_method(IRCode* caller,
+                   const InlineTemplate& callee,
+                   FatMethod::iterator pos);
+
 } // namespace inliner
 
 /**
@@ -67,6 +115,40 @@ class MultiMethodInliner {
     std::unordered_set<DexType*> black_list;
     std::unordered_set<DexType*> caller_black_list;
     std::unordered_set<DexType*> whitelist_no_method_limit;
+    // Profile-guided inlining. Inlining a callee that has several callers
+    // duplicates its code, so those callees only get inlined into the hot
+    // methods, and the cold ones are left alone.
+    bool profile_guided{false};
+    std::unordered_set<const DexMethod*> hot_methods;
+    // When set, the calls whose result isn't used to callees that have no
+    // side effects are removed rather than inlined.
+    const SideEffectSummaries* side_effects{nullptr};
+  };
+
+  /**
+   * Info about inlining.
+   */
+  struct InliningInfo {
+    size_t calls_inlined{0};
+    size_t recursive{0};
+    size_t not_found{0};
+    size_t blacklisted{0};
+    size_t throws{0};
+    size_t multi_ret{0};
+    size_t need_vmethod{0};
+    size_t invoke_super{0};
+    size_t write_over_ins{0};
+    size_t escaped_virtual{0};
+    size_t non_pub_virtual{0};
+    size_t escaped_field{0};
+    size_t non_pub_field{0};
+    size_t non_pub_ctor{0};
+    size_t cross_store{0};
+    size_t caller_too_large{0};
+    size_t cold_caller{0};
+    size_t calls_removed{0};
+
+    InliningInfo& operator+=(const InliningInfo& other);
   };
 
   MultiMethodInliner(
@@ -82,8 +164,12 @@ class MultiMethodInliner {
 
   /**
    * attempt inlining for all candidates.
+   * Callers whose callees have all been inlined into already are independent
+   * of each other, so they get processed concurrently, on num_threads
+   * workers.
    */
-  void inline_methods();
+  void inline_methods(
+      unsigned int num_threads = workqueue_default_num_threads());
 
   /**
    * Return the count of unique inlined methods.
@@ -100,14 +186,82 @@ class MultiMethodInliner {
 
  private:
   /**
-   * Inline all callees into caller.
-   * Recurse in a callee if that has inlinable candidates of its own.
-   * Inlining is bottom up.
+   * Everything that inlining into a caller records, besides the new code of
+   * the caller itself. When inlining in parallel each worker accumulates its
+   * own, and they are merged once all workers are done.
    */
-  void caller_inline(
+  struct InlineResults {
+    InliningInfo info;
+    std::unordered_set<DexMethod*> inlined;
+    std::unordered_set<DexMethod*> make_static;
+  };
+
+  /**
+   * What is_inlinable() needs to know of a callee, gathered in one walk of
+   * its code the first time one of its call sites is considered, so that
+   * deciding on the others is a lookup. It is gathered again if the code of
+   * the callee changed since.
+   */
+  struct CalleeSummary {
+    const IRCode* code;
+    uint64_t code_epoch;
+    size_t code_size;
+    uint16_t registers_size;
+    bool cross_store;
+    bool external_catch;
+    // What cannot_inline_opcodes() finds for a caller of the callee's own
+    // class, and for a caller of another class.
+    struct OpcodeChecks {
+      bool blocked;
+      // What the checks recorded up to the opcode that blocked, if any.
+      InlineResults results;
+    };
+    OpcodeChecks same_class;
+    OpcodeChecks other_class;
+  };
+
+  std::shared_ptr<const CalleeSummary> get_callee_summary(
+      const DexMethod* callee);
+
+  /**
+   * Compute the order in which callers get inlined into. Starting from each
+   * top level caller, walk depth first into the callees that have inlinable
+   * candidates of their own. A call back into a method that is still being
+   * walked closes a loop: it is ignored, which leaves an acyclic graph in
+   * `dag_callees`. Each caller is visited once and appended to `order` after
+   * all of its callees.
+   */
+  void build_dag(
       DexMethod* caller,
-      const std::vector<DexMethod*>& callees,
-      std::unordered_set<DexMethod*>& visited);
+      std::unordered_set<DexMethod*>& visiting,
+      std::unordered_map<DexMethod*, std::vector<DexMethod*>>& dag_callees,
+      std::vector<DexMethod*>& order);
+
+  void inline_callees(DexMethod* caller,
+                      const std::vector<DexMethod*>& callees,
+                      InlineResults& results);
+
+  /**
+   * Fold results into the inliner's own, and fix the visibility of the
+   * members referenced by the callees that got inlined. The latter rewrites
+   * the callees' code, so it can only happen once no caller is reading it.
+   */
+  void merge_results(const InlineResults& results);
+
+  /**
+   * Thread-safe front end of `resolver` for the inlining phase. The
+   * constructor resolves every invoke in scope through it, so this is
+   * normally a lookup in `m_resolved_refs`.
+   */
+  DexMethod* resolve(DexMethodRef* ref, MethodSearch search);
+
+  /**
+   * Return true if the call at `invoke` only computes a result that the
+   * caller doesn't use, so that it can be removed instead of inlined.
+   */
+  bool is_removable_call(const DexMethod* caller,
+                         const DexMethod* callee,
+                         FatMethod::iterator invoke);
 
   /**
    * Return true if the callee is inlinable into the caller.
@@ -115,16 +269,17 @@ class MultiMethodInliner {
    */
   bool is_inlinable(const DexMethod* caller,
                     const DexMethod* callee,
-                    size_t estimated_insn_size);
+                    size_t estimated_insn_size,
+                    InlineResults& results);
 
   /**
    * Return true if the method is related to enum (java.lang.Enum and derived).
    * Cannot inline enum methods because they can be called by code we do
    * not own.
    */
-  bool is_blacklisted(const DexMethod* callee);
+  bool is_blacklisted(const DexMethod* callee, InliningInfo& info);
 
-  bool caller_is_blacklisted(const DexMethod* caller);
+  bool caller_is_blacklisted(const DexMethod* caller, InliningInfo& info);
 
   /**
    * Return true if the callee contains external catch exception types
@@ -137,13 +292,15 @@ class MultiMethodInliner {
    * or impossible to inline.
    * Some of the opcodes are defined by the methods below.
    */
-  bool cannot_inline_opcodes(const DexMethod* caller, const DexMethod* callee);
+  bool cannot_inline_opcodes(const DexMethod* callee,
+                             bool same_class,
+                             InlineResults& results);
 
   /**
    * Return true if inlining would require a method called from the callee
    * (candidate) to turn into a virtual method (e.g. private to public).
    */
-  bool create_vmethod(IRInstruction* insn);
+  bool create_vmethod(IRInstruction* insn, InlineResults& results);
 
   /**
    * Return true if a callee contains an invoke super to a different method
@@ -151,8 +308,8 @@ class MultiMethodInliner {
    * invoke-super can only exist within the class the call lives in.
    */
   bool nonrelocatable_invoke_super(IRInstruction* insn,
-                                   const DexMethod* callee,
-                                   const DexMethod* caller);
+                                   bool same_class,
+                                   InliningInfo& info);
 
   /**
    * Return true if a callee overrides one of the input registers.
@@ -168,8 +325,8 @@ class MultiMethodInliner {
    * was package/protected and we move the call out of context.
    */
   bool unknown_virtual(IRInstruction* insn,
-                       const DexMethod* caller,
-                       const DexMethod* callee);
+                       bool same_class,
+                       InliningInfo& info);
 
   /**
    * Return true if the callee contains a call to an unknown field.
@@ -178,14 +335,14 @@ class MultiMethodInliner {
    * was package/protected and we move the access out of context.
    */
   bool unknown_field(IRInstruction* insn,
-                     const DexMethod* callee,
-                     const DexMethod* caller);
+                     bool same_class,
+                     InliningInfo& info);
 
   /**
    * Return true if a caller is in a DEX in a store and any opcode in callee
    * refers to a DexMember in a different store .
    */
-  bool cross_store_reference(const DexMethod* context);
+  bool cross_store_reference(const DexMethod* context, InliningInfo& info);
 
   /**
    * Some versions of ART (5.0.0 - 5.0.2) will fail to verify a method if it
@@ -197,7 +354,16 @@ class MultiMethodInliner {
    */
   bool caller_too_large(DexType* caller_type,
                         size_t estimated_insn_size,
-                        const DexMethod* callee);
+                        size_t callee_insn_size,
+                        InliningInfo& info);
+
+  /**
+   * In profile-guided mode, return true if inlining the callee would
+   * duplicate code into a caller that the profile doesn't mark as hot.
+   */
+  bool caller_is_cold(const DexMethod* caller,
+                      const DexMethod* callee,
+                      InliningInfo& info);
 
   /**
    * Staticize required methods (stored in `m_make_static`) and update
@@ -214,6 +380,34 @@ class MultiMethodInliner {
    */
   std::function<DexMethod*(DexMethodRef*, MethodSearch)> resolver;
 
+  struct RefSearchHash {
+    size_t operator()(const std::pair<DexMethodRef*, MethodSearch>& p) const {
+      return std::hash<DexMethodRef*>()(p.first) * 31 +
+             static_cast<size_t>(p.second);
+    }
+  };
+  ConcurrentMap<std::pair<DexMethodRef*, MethodSearch>,
+                DexMethod*,
+                RefSearchHash>
+      m_resolved_refs;
+  std::mutex m_resolver_lock;
+
+  /**
+   * The template of a callee with several call sites, made when it is first
+   * inlined and dropped once it's been inlined at all of them.
+   */
+  std::shared_ptr<const inliner::InlineTemplate> get_inline_template(
+      const DexMethod* callee);
+
+  struct CachedTemplate {
+    std::shared_ptr<const inliner::InlineTemplate> tmpl;
+    size_t uses_left;
+  };
+  ConcurrentMap<const DexMethod*, CachedTemplate> m_inline_templates;
+
+  ConcurrentMap<const DexMethod*, std::shared_ptr<const CalleeSummary>>
+      m_callee_summaries;
+
   /**
    * Checker for cross stores contaminations.
    */
@@ -235,27 +429,6 @@ class MultiMethodInliner {
       caller_callee;
 
  private:
-  /**
-   * Info about inlining.
-   */
-  struct InliningInfo {
-    size_t calls_inlined{0};
-    size_t recursive{0};
-    size_t not_found{0};
-    size_t blacklisted{0};
-    size_t throws{0};
-    size_t multi_ret{0};
-    size_t need_vmethod{0};
-    size_t invoke_super{0};
-    size_t write_over_ins{0};
-    size_t escaped_virtual{0};
-    size_t non_pub_virtual{0};
-    size_t escaped_field{0};
-    size_t non_pub_field{0};
-    size_t non_pub_ctor{0};
-    size_t cross_store{0};
-    size_t caller_too_large{0};
-  };
   InliningInfo info;
 
   const std::vector<DexClass*>& m_scope;
@@ -272,10 +445,14 @@ class MultiMethodInliner {
 
 /**
  * Add the single-callsite methods to the inlinable set.
+ * If `hot_methods` is given, the methods of up to `hot_callee_size` opcodes
+ * that are called from at least one hot method are added as well.
  */
 void select_inlinable(
     const Scope& scope,
     const std::unordered_set<DexMethod*>& methods,
     MethodRefCache& resolved_refs,
     std::unordered_set<DexMethod*>* inlinable,
-    bool multiple_callee = false);
+    bool multiple_callee = false,
+    const std::unordered_set<const DexMethod*>* hot_methods = nullptr,
+    size_t hot_callee_size = 0);
@@ -42,20 +42,22 @@ static bool signed_int_fits_high16(int64_t v) {
  */
 
 /*
- * Returns an array of move opcodes of the appropriate type, sorted by
- * increasing size.
+ * The move opcodes of each type, sorted by increasing size.
  */
-static std::array<DexOpcode, 3> move_opcode_tuple(IROpcode op) {
+static constexpr DexOpcode s_move_opcodes[][3] = {
+    {DOPCODE_MOVE, DOPCODE_MOVE_FROM16, DOPCODE_MOVE_16},
+    {DOPCODE_MOVE_WIDE, DOPCODE_MOVE_WIDE_FROM16, DOPCODE_MOVE_WIDE_16},
+    {DOPCODE_MOVE_OBJECT, DOPCODE_MOVE_OBJECT_FROM16, DOPCODE_MOVE_OBJECT_16},
+};
+
+static const DexOpcode* move_opcode_tuple(IROpcode op) {
   switch (op) {
   case OPCODE_MOVE:
-    return {{DOPCODE_MOVE, DOPCODE_MOVE_FROM16, DOPCODE_MOVE_16}};
+    return s_move_opcodes[0];
   case OPCODE_MOVE_WIDE:
-    return {
-        {DOPCODE_MOVE_WIDE, DOPCODE_MOVE_WIDE_FROM16, DOPCODE_MOVE_WIDE_16}};
+    return s_move_opcodes[1];
   case OPCODE_MOVE_OBJECT:
-    return {{DOPCODE_MOVE_OBJECT,
-             DOPCODE_MOVE_OBJECT_FROM16,
-             DOPCODE_MOVE_OBJECT_16}};
+    return s_move_opcodes[2];
   default:
     not_reached();
   }
@@ -68,11 +70,11 @@ DexOpcode select_move_opcode(const IRInstruction* insn) {
   auto dest_width = required_bit_width(insn->dest());
   auto src_width = required_bit_width(insn->src(0));
   if (dest_width <= 4 && src_width <= 4) {
-    return move_tuple.at(0);
+    return move_tuple[0];
   } else if (dest_width <= 8) {
-    return move_tuple.at(1);
+    return move_tuple[1];
   } else {
-    return move_tuple.at(2);
+    return move_tuple[2];
   }
 }
 
@@ -108,28 +110,18 @@ DexOpcode select_const_opcode(const IRInstruction* insn) {
   }
 }
 
-bool try_2addr_conversion(MethodItemEntry* mie) {
-  auto* insn = mie->dex_insn;
-  auto op = insn->opcode();
-  if (dex_opcode::is_commutative(op) && insn->dest() == insn->src(1) &&
-      insn->dest() <= 0xf && insn->src(0) <= 0xf) {
-    auto* new_insn = new DexInstruction(convert_3to2addr(op));
-    new_insn->set_dest(insn->dest());
-    new_insn->set_src(1, insn->src(0));
-    delete mie->dex_insn;
-    mie->dex_insn = new_insn;
-    return true;
+boost::optional<DexOpcode> select_2addr_opcode(const IRInstruction* insn,
+                                               uint16_t dest) {
+  auto op = opcode::to_dex_opcode(insn->opcode());
+  if (dex_opcode::is_commutative(op) && dest == insn->src(1) && dest <= 0xf &&
+      insn->src(0) <= 0xf) {
+    return convert_3to2addr(op);
   } else if (op >= DOPCODE_ADD_INT && op <= DOPCODE_REM_DOUBLE &&
-             insn->dest() == insn->src(0) && insn->dest() <= 0xf &&
+             dest == insn->src(0) && dest <= 0xf &&
              insn->src(1) <= 0xf) {
-    auto* new_insn = new DexInstruction(convert_3to2addr(op));
-    new_insn->set_dest(insn->dest());
-    new_insn->set_src(1, insn->src(1));
-    delete mie->dex_insn;
-    mie->dex_insn = new_insn;
-    return true;
+    return convert_3to2addr(op);
   }
-  return false;
+  return boost::none;
 }
 
 } // namespace impl
@@ -291,12 +283,36 @@ static void lower_to_range_instruction(DexMethod* method, IRCode* code, FatMetho
   it->replace_ir_with_dex(dex_insn);
 }
 
-static void lower_simple_instruction(DexMethod*, IRCode*, FatMethod::iterator* it_) {
+/*
+ * Returns whether the instruction was converted to its /2addr form.
+ */
+static bool lower_simple_instruction(DexMethod*,
+                                     IRCode*,
+                                     FatMethod::iterator* it_) {
   auto& it = *it_;
   const auto* insn = it->insn;
   auto op = insn->opcode();
 
   DexInstruction* dex_insn;
+  if (op >= OPCODE_ADD_INT && op <= OPCODE_REM_DOUBLE) {
+    // Pick the /2addr form up front rather than rewriting the instruction
+    // after the fact.
+    auto dest = insn->has_move_result_pseudo()
+                    ? move_result_pseudo_of(it)->dest()
+                    : insn->dest();
+    auto op_2addr = select_2addr_opcode(insn, dest);
+    if (op_2addr) {
+      dex_insn = new DexInstruction(*op_2addr);
+      dex_insn->set_dest(dest);
+      dex_insn->set_src(1,
+                        dest == insn->src(0) ? insn->src(1) : insn->src(0));
+      it->replace_ir_with_dex(dex_insn);
+      if (insn->has_move_result_pseudo()) {
+        remove_move_result_pseudo(++it);
+      }
+      return true;
+    }
+  }
   if (is_move(op)) {
     dex_insn = new DexInstruction(select_move_opcode(insn));
   } else if (op >= OPCODE_CONST && op <= OPCODE_CONST_WIDE) {
@@ -323,6 +339,7 @@ static void lower_simple_instruction(DexMethod*, IRCode*, FatMethod::iterator* i
   if (insn->has_move_result_pseudo()) {
     remove_move_result_pseudo(++it);
   }
+  return false;
 }
 
 Stats lower(DexMethod* method) {
@@ -331,6 +348,8 @@ Stats lower(DexMethod* method) {
   always_assert(code != nullptr);
   // Check the load-param opcodes make sense before removing them
   check_load_params(method);
+  // The instructions are rewritten in place below.
+  code->mark_modified();
   for (auto it = code->begin(); it != code->end(); ++it) {
     if (it->type != MFLOW_OPCODE) {
       continue;
@@ -348,18 +367,70 @@ Stats lower(DexMethod* method) {
     } else if (needs_range_conversion(insn)) {
       lower_to_range_instruction(method, code, &it);
     } else {
-      lower_simple_instruction(method, code, &it);
+      stats.to_2addr += lower_simple_instruction(method, code, &it);
     }
     // TODO: /lit8 and /lit16 instructions
   }
-  for (auto it = code->begin(); it != code->end(); ++it) {
-    always_assert(it->type != MFLOW_OPCODE);
-    if (it->type != MFLOW_DEX_OPCODE) {
-      continue;
+  return stats;
+}
+
+/*
+ * Whether lower() would succeed on this code, without changing it.
+ */
+static bool can_lower(const IRCode* code, bool regalloc_has_run) {
+  auto registers_size = code->get_registers_size();
+  // Registers below v16 fit in every instruction format. With more than that,
+  // only register allocation makes sure each register fits its instruction.
+  if (!regalloc_has_run && registers_size > 16) {
+    return false;
+  }
+  auto fits = [registers_size](uint16_t reg, bool is_wide) {
+    return reg + (is_wide ? 2 : 1) <= registers_size;
+  };
+  // The parameters have to be contiguous and at the end of the frame.
+  uint32_t ins_size = 0;
+  for (auto& mie : InstructionIterable(code->get_param_instructions())) {
+    ins_size += mie.insn->dest_is_wide() ? 2 : 1;
+  }
+  if (ins_size > registers_size) {
+    return false;
+  }
+  uint32_t next_ins = registers_size - ins_size;
+  for (auto& mie : InstructionIterable(code->get_param_instructions())) {
+    if (mie.insn->dest() != next_ins) {
+      return false;
     }
-    stats.to_2addr += try_2addr_conversion(&*it);
+    next_ins += mie.insn->dest_is_wide() ? 2 : 1;
   }
-  return stats;
+  for (auto& mie : InstructionIterable(code)) {
+    auto insn = mie.insn;
+    if (insn->dests_size() && !fits(insn->dest(), insn->dest_is_wide())) {
+      return false;
+    }
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      if (!fits(insn->src(i), insn->src_is_wide(i))) {
+        return false;
+      }
+    }
+    if (needs_range_conversion(insn) && !has_contiguous_srcs(insn)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool unballoon(DexMethod* method, bool regalloc_has_run) {
+  if (method->is_balloon_deferred()) {
+    return false;
+  }
+  auto* code = method->get_code();
+  if (code == nullptr || !can_lower(code, regalloc_has_run)) {
+    return false;
+  }
+  lower(method);
+  method->sync();
+  method->defer_balloon();
+  return true;
 }
 
 Stats run(DexStoresVector& stores) {
@@ -369,7 +440,9 @@ Stats run(DexStoresVector& stores) {
       scope,
       [](Data&, DexMethod* m) {
         Stats stats;
-        if (m->get_code() == nullptr) {
+        // Deferred methods were never changed, and their DexCode is already
+        // lowered.
+        if (m->is_balloon_deferred() || m->get_code() == nullptr) {
           return stats;
         }
         stats.accumulate(lower(m));
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <boost/optional.hpp>
+
 #include "IRCode.h"
 #include "IRInstruction.h"
 #include "Pass.h"
@@ -28,7 +30,9 @@ struct Stats {
  * Convert IRInstructions to DexInstructions while doing the following:
  *
  *   - Check consistency of load-param opcodes
- *   - Pick the smallest opcode that can address its operands.
+ *   - Pick the smallest opcode that can address its operands, including the
+ *     /2addr forms of binary operations. Each IRInstruction is converted to
+ *     a single DexInstruction with its final opcode.
  *   - Insert move instructions as necessary for check-cast instructions that
  *     have different src and dest registers.
  *   - Record the number of instructions converted to /2ddr form, also the
@@ -38,13 +42,31 @@ Stats lower(DexMethod*);
 
 Stats run(DexStoresVector&);
 
+/*
+ * Lowers a method's IRCode and syncs it back to DexCode, deferring ballooning
+ * it again until its code is next asked for. This lets methods that are not
+ * being worked on give up the memory their IR takes.
+ *
+ * Returns false, leaving the method alone, if it has no ballooned code or its
+ * code cannot be lowered as it is. Before register allocation has run, that is
+ * the case for any method with more than 16 registers or whose parameters are
+ * not at the end of its frame.
+ */
+bool unballoon(DexMethod*, bool regalloc_has_run);
+
 namespace impl {
 
 DexOpcode select_move_opcode(const IRInstruction* insn);
 
 DexOpcode select_const_opcode(const IRInstruction* insn);
 
-bool try_2addr_conversion(MethodItemEntry*);
+/*
+ * Returns the /2addr opcode that the given binary operation can be lowered
+ * to, if its dest is also one of its sources and its registers fit in 4 bits.
+ * The dest is that of the instruction, or of its move-result-pseudo.
+ */
+boost::optional<DexOpcode> select_2addr_opcode(const IRInstruction* insn,
+                                               uint16_t dest);
 
 } // namespace impl
 
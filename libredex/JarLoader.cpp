@@ -7,9 +7,15 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <boost/filesystem.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 
+#include <atomic>
 #include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <zlib.h>
 
@@ -23,7 +29,9 @@
 #include "Creators.h"
 #include "DexClass.h"
 #include "JarLoader.h"
+#include "Sha1.h"
 #include "Util.h"
+#include "WorkQueue.h"
 
 /******************
  * Begin Class Loading code.
@@ -172,7 +180,7 @@ static DexType *make_dextype_from_cref(std::vector<cp_entry> &cpool,
   return DexType::make_type(nbuffer);
 }
 
-static bool extract_utf8(std::vector<cp_entry> &cpool, uint16_t utf8ref,
+static bool extract_utf8(const std::vector<cp_entry> &cpool, uint16_t utf8ref,
                          char *out, uint32_t size) {
   const cp_entry &utf8cpe = cpool[utf8ref];
   if (utf8cpe.tag != CP_CONST_UTF8) {
@@ -198,11 +206,7 @@ static DexField *make_dexfield(std::vector<cp_entry> &cpool,
   }
   DexString *name = DexString::make_string(nbuffer);
   DexType *desc = DexType::make_type(dbuffer);
-  DexField *field =
-      static_cast<DexField*>(DexField::make_field(self, name, desc));
-  field->set_access((DexAccessFlags)finfo.aflags);
-  field->set_external();
-  return field;
+  return static_cast<DexField*>(DexField::make_field(self, name, desc));
 }
 
 static DexType *simpleTypeB;
@@ -306,7 +310,8 @@ static DexTypeList *extract_arguments(const char* &buf) {
 }
 
 static DexMethod *make_dexmethod(std::vector<cp_entry> &cpool,
-                               DexType *self, cp_method_info &finfo) {
+                                 DexType *self, cp_method_info &finfo,
+                                 uint32_t *access_out, bool *is_virtual_out) {
   char dbuffer[MAX_CLASS_NAMELEN];
   char nbuffer[MAX_CLASS_NAMELEN];
   if (!extract_utf8(cpool, finfo.nameNdx, nbuffer, MAX_CLASS_NAMELEN) ||
@@ -324,11 +329,6 @@ static DexMethod *make_dexmethod(std::vector<cp_entry> &cpool,
   DexProto *proto = DexProto::make_proto(rtype, tlist);
   DexMethod *method = static_cast<DexMethod*>(
       DexMethod::make_method(self, name, proto));
-  if (method->is_concrete()) {
-    fprintf(stderr, "Pre-concrete method attempted to load '%s', bailing\n",
-        SHOW(method));
-    return nullptr;
-  }
   uint32_t access = finfo.aflags;
   bool is_virt = true;
   if (nbuffer[0] == '<') {
@@ -338,15 +338,52 @@ static DexMethod *make_dexmethod(std::vector<cp_entry> &cpool,
     }
   } else if (access & (ACC_PRIVATE | ACC_STATIC))
     is_virt = false;
-  method->set_access((DexAccessFlags)access);
-  method->set_virtual(is_virt);
-  method->set_external();
+  *access_out = access;
+  *is_virtual_out = is_virt;
   return method;
 }
 
+namespace {
+
+struct parsed_field {
+  DexField* field;
+  uint16_t access;
+  uint8_t* attributes;
+};
+
+struct parsed_method {
+  DexMethod* method;
+  uint32_t access;
+  bool is_virtual;
+  uint8_t* attributes;
+};
+
+/*
+ * What parse_class() gets out of a class file. It only interns the types,
+ * strings and member refs it contains; everything that modifies the members
+ * or publishes the class waits for create_class(). That way, the class files
+ * of a jar can be parsed in parallel and still be created in order.
+ *
+ * The constant pool and the attributes point into the buffer that the class
+ * file was decompressed into.
+ */
+struct parsed_class {
+  // Null if the class was already loaded, unless it was parsed for a
+  // snapshot, which has to hold every class of the jar.
+  DexType* self{nullptr};
+  DexType* super{nullptr};
+  uint16_t access{0};
+  std::vector<DexType*> interfaces;
+  std::vector<parsed_field> fields;
+  std::vector<parsed_method> methods;
+  std::vector<cp_entry> cpool;
+};
+
+}
+
 static bool parse_class(uint8_t* buffer,
-                        Scope* classes,
-                        attribute_hook_t attr_hook) {
+                        parsed_class* pc,
+                        bool skip_loaded = true) {
   uint32_t magic = read32(buffer);
   uint16_t vminor DEBUG_ONLY = read16(buffer);
   uint16_t vmajor DEBUG_ONLY = read16(buffer);
@@ -355,7 +392,7 @@ static bool parse_class(uint8_t* buffer,
     fprintf(stderr, "Bad class magic %08x, Bailing\n", magic);
     return false;
   }
-  std::vector<cp_entry> cpool;
+  auto& cpool = pc->cpool;
   cpool.resize(cp_count);
   /* The zero'th entry is always empty.  Java is annoying. */
   for (int i=1; i<cp_count; i++) {
@@ -372,24 +409,83 @@ static bool parse_class(uint8_t* buffer,
   uint16_t super = read16(buffer);
   uint16_t ifcount = read16(buffer);
   DexType *self = make_dextype_from_cref(cpool, clazz);
-  if (type_class(self)) {
+  bool loaded = type_class(self) != nullptr;
+  if (loaded && skip_loaded) {
     return true;
   }
-  ClassCreator cc(self);
-  cc.set_external();
+  pc->self = self;
   if (super != 0) {
-    DexType *sclazz = make_dextype_from_cref(cpool, super);
-    cc.set_super(sclazz);
+    pc->super = make_dextype_from_cref(cpool, super);
   }
-  cc.set_access((DexAccessFlags)aflags);
+  pc->access = aflags;
   if (ifcount) {
     for (int i=0; i < ifcount; i++) {
       uint16_t iface = read16(buffer);
-      DexType *iftype = make_dextype_from_cref(cpool, iface);
-      cc.add_interface(iftype);
+      pc->interfaces.push_back(make_dextype_from_cref(cpool, iface));
     }
   }
   uint16_t fcount = read16(buffer);
+  for (int i=0; i < fcount; i++) {
+    cp_field_info cpfield;
+    cpfield.aflags = read16(buffer);
+    cpfield.nameNdx = read16(buffer);
+    cpfield.descNdx = read16(buffer);
+    uint8_t* attrPtr = buffer;
+    skip_attributes(buffer);
+    DexField *field = make_dexfield(cpool, self, cpfield);
+    if (field == nullptr)
+      return false;
+    pc->fields.push_back({field, cpfield.aflags, attrPtr});
+  }
+
+  uint16_t mcount = read16(buffer);
+  if (mcount) {
+    for (int i=0; i < mcount; i++) {
+      cp_method_info cpmethod;
+      cpmethod.aflags = read16(buffer);
+      cpmethod.nameNdx = read16(buffer);
+      cpmethod.descNdx = read16(buffer);
+
+      uint8_t* attrPtr = buffer;
+      skip_attributes(buffer);
+      parsed_method pm;
+      pm.method = make_dexmethod(cpool, self, cpmethod, &pm.access,
+                                 &pm.is_virtual);
+      if (pm.method == nullptr)
+        return false;
+      if (!loaded && pm.method->is_concrete()) {
+        fprintf(stderr, "Pre-concrete method attempted to load '%s', bailing\n",
+            SHOW(pm.method));
+        return false;
+      }
+      pm.attributes = attrPtr;
+      pc->methods.push_back(pm);
+    }
+  }
+  return true;
+}
+
+/*
+ * Creates the class that parse_class() found, unless another one of the same
+ * type was created in the meantime. The attribute hook reads the attributes
+ * from the class file, so its buffer must still be around if there is one.
+ */
+static void create_class(const parsed_class& pc,
+                         Scope* classes,
+                         attribute_hook_t attr_hook) {
+  if (pc.self == nullptr || type_class(pc.self)) {
+    return;
+  }
+  const auto& cpool = pc.cpool;
+  ClassCreator cc(pc.self);
+  cc.set_external();
+  if (pc.super != nullptr) {
+    cc.set_super(pc.super);
+  }
+  cc.set_access((DexAccessFlags)pc.access);
+  for (auto* iftype : pc.interfaces) {
+    cc.add_interface(iftype);
+  }
 
   auto invoke_attr_hook = [&](
       boost::variant<DexField*, DexMethod*> field_or_method, uint8_t* attrPtr) {
@@ -414,36 +510,20 @@ static bool parse_class(uint8_t* buffer,
     }
   };
 
-  for (int i=0; i < fcount; i++) {
-    cp_field_info cpfield;
-    cpfield.aflags = read16(buffer);
-    cpfield.nameNdx = read16(buffer);
-    cpfield.descNdx = read16(buffer);
-    uint8_t* attrPtr = buffer;
-    skip_attributes(buffer);
-    DexField *field = make_dexfield(cpool, self, cpfield);
-    if (field == nullptr)
-      return false;
+  for (const auto& pf : pc.fields) {
+    auto* field = pf.field;
+    field->set_access((DexAccessFlags)pf.access);
+    field->set_external();
     cc.add_field(field);
-    invoke_attr_hook({field}, attrPtr);
+    invoke_attr_hook({field}, pf.attributes);
   }
-
-  uint16_t mcount = read16(buffer);
-  if (mcount) {
-    for (int i=0; i < mcount; i++) {
-      cp_method_info cpmethod;
-      cpmethod.aflags = read16(buffer);
-      cpmethod.nameNdx = read16(buffer);
-      cpmethod.descNdx = read16(buffer);
-
-      uint8_t* attrPtr = buffer;
-      skip_attributes(buffer);
-      DexMethod *method = make_dexmethod(cpool, self, cpmethod);
-      if (method == nullptr)
-        return false;
-      cc.add_method(method);
-      invoke_attr_hook({method}, attrPtr);
-    }
+  for (const auto& pm : pc.methods) {
+    auto* method = pm.method;
+    method->set_access((DexAccessFlags)pm.access);
+    method->set_virtual(pm.is_virtual);
+    method->set_external();
+    cc.add_method(method);
+    invoke_attr_hook({method}, pm.attributes);
   }
   DexClass *dc = cc.create();
   if (classes != nullptr) {
@@ -478,7 +558,6 @@ static bool parse_class(uint8_t* buffer,
   }
 
 #endif
-  return true;
 }
 
 /******************
@@ -628,34 +707,73 @@ static bool get_jar_entries(const uint8_t *mapping, pk_cdir_end &pce,
   return true;
 }
 
-static int jar_uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
-                   uLong sourceLen) {
-  z_stream stream;
-  int err;
+static const int kStartBufferSize = 128 * 1024;
+
+namespace {
+
+/*
+ * Decompresses class files into a buffer that it reuses for all of them,
+ * with a single inflate stream that is reset between them rather than set up
+ * from scratch. Each thread loading a jar has its own.
+ */
+class jar_inflater {
+ public:
+  jar_inflater() : m_buffer(kStartBufferSize) {
+    memset(&m_stream, 0, sizeof(m_stream));
+    m_init_rv = inflateInit2(&m_stream, -MAX_WBITS);
+  }
+
+  ~jar_inflater() {
+    if (m_init_rv == Z_OK) {
+      inflateEnd(&m_stream);
+    }
+  }
+
+  jar_inflater(const jar_inflater&) = delete;
+  jar_inflater& operator=(const jar_inflater&) = delete;
+
+  bool decompress_class(const jar_entry &file, const uint8_t *mapping);
+
+  // The class file that decompress_class() last succeeded on.
+  uint8_t* buffer() { return m_buffer.data(); }
 
-  stream.next_in = (Bytef *)source;
-  stream.avail_in = (uInt)sourceLen;
-  stream.next_out = dest;
-  stream.avail_out = (uInt)*destLen;
-  stream.zalloc = (alloc_func)0;
-  stream.zfree = (free_func)0;
+  // A copy of that class file, which outlives the next decompression.
+  std::vector<uint8_t> copy_buffer() const {
+    return std::vector<uint8_t>(m_buffer.begin(), m_buffer.begin() + m_size);
+  }
+
+ private:
+  int inflate_entry(uLongf *destLen, const Bytef *source, uLong sourceLen);
 
-  err = inflateInit2(&stream, -MAX_WBITS);
+  z_stream m_stream;
+  int m_init_rv;
+  std::vector<uint8_t> m_buffer;
+  size_t m_size{0};
+};
+
+}
+
+int jar_inflater::inflate_entry(uLongf *destLen, const Bytef *source,
+                                uLong sourceLen) {
+  if (m_init_rv != Z_OK) return m_init_rv;
+  int err = inflateReset(&m_stream);
   if (err != Z_OK) return err;
 
-  err = inflate(&stream, Z_FINISH);
+  m_stream.next_in = (Bytef *)source;
+  m_stream.avail_in = (uInt)sourceLen;
+  m_stream.next_out = m_buffer.data();
+  m_stream.avail_out = (uInt)*destLen;
+
+  err = inflate(&m_stream, Z_FINISH);
   if (err != Z_STREAM_END) {
-    inflateEnd(&stream);
     return err;
   }
-  *destLen = stream.total_out;
-
-  err = inflateEnd(&stream);
-  return err;
+  *destLen = m_stream.total_out;
+  return Z_OK;
 }
 
-static bool decompress_class(jar_entry &file, const uint8_t *mapping,
-                             uint8_t *outbuffer, ssize_t bufsize) {
+bool jar_inflater::decompress_class(const jar_entry &file,
+                                    const uint8_t *mapping) {
   if (file.cd_entry.comp_method != kCompMethodDeflate) {
     fprintf(stderr, "Unknown compression method %d, Bailing\n",
             file.cd_entry.comp_method);
@@ -688,8 +806,14 @@ static bool decompress_class(jar_entry &file, const uint8_t *mapping,
   }
   lfile += pkf.fname_len;
   lfile += pkf.extra_len;
-  uLongf dlen = bufsize;
-  int zlibrv = jar_uncompress(outbuffer, &dlen, lfile, pkf.comp_size);
+  if (m_buffer.size() < pkf.ucomp_size) {
+    auto bufsize = m_buffer.size();
+    while (bufsize < pkf.ucomp_size)
+      bufsize *= 2;
+    m_buffer.resize(bufsize);
+  }
+  uLongf dlen = m_buffer.size();
+  int zlibrv = inflate_entry(&dlen, lfile, pkf.comp_size);
   if (zlibrv != Z_OK) {
     fprintf(stderr, "uncompress failed with code %d, Bailing\n", zlibrv);
     return false;
@@ -698,58 +822,134 @@ static bool decompress_class(jar_entry &file, const uint8_t *mapping,
     fprintf(stderr, "mis-match on uncompressed size, Bailing\n");
     return false;
   }
+  m_size = dlen;
   return true;
 }
 
-static const int kStartBufferSize = 128 * 1024;
+static bool is_class_file(const jar_entry& file) {
+  static char classEndString[] = ".class";
+  static size_t classEndStringLen = strlen(classEndString);
+  if (file.cd_entry.ucomp_size == 0)
+    return false;
+  if (file.cd_entry.fname_len < (classEndStringLen  + 1))
+    return false;
+  uint8_t *endcomp = file.filename +
+    (file.cd_entry.fname_len - classEndStringLen);
+  return memcmp(endcomp, classEndString, classEndStringLen) == 0;
+}
 
+/*
+ * Decompresses and parses the class files in parallel. The results come out
+ * in the order of the entries.
+ *
+ * If buffers_out is given, it gets a copy of each class file, which the
+ * constant pool and the attributes of its parsed class point into. Otherwise
+ * they are gone once the class is parsed, and the constant pools are
+ * cleared.
+ */
+static bool parse_class_files(
+    const std::vector<const jar_entry*>& class_files,
+    const uint8_t* mapping,
+    std::vector<parsed_class>* parsed_out,
+    bool skip_loaded,
+    std::vector<std::vector<uint8_t>>* buffers_out = nullptr) {
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<std::unique_ptr<jar_inflater>> inflaters;
+  for (size_t i = 0; i < num_threads; ++i) {
+    inflaters.emplace_back(std::make_unique<jar_inflater>());
+  }
+  auto& parsed = *parsed_out;
+  parsed.resize(class_files.size());
+  if (buffers_out != nullptr) {
+    buffers_out->resize(class_files.size());
+  }
+  std::atomic<bool> failed{false};
+  auto wq = WorkQueue<size_t, jar_inflater*, std::nullptr_t>(
+      [&](jar_inflater*& inflater, size_t i) -> std::nullptr_t {
+        if (failed) {
+          return nullptr;
+        }
+        if (!inflater->decompress_class(*class_files[i], mapping)) {
+          failed = true;
+          return nullptr;
+        }
+        auto buffer = inflater->buffer();
+        if (buffers_out != nullptr) {
+          (*buffers_out)[i] = inflater->copy_buffer();
+          buffer = (*buffers_out)[i].data();
+        }
+        if (!parse_class(buffer, &parsed[i], skip_loaded)) {
+          failed = true;
+        }
+        if (buffers_out == nullptr) {
+          // The constant pool points into the buffer, which the next class
+          // file will overwrite.
+          parsed[i].cpool.clear();
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return inflaters[thread_idx].get(); },
+      num_threads);
+  for (size_t i = 0; i < class_files.size(); ++i) {
+    wq.add_item(i, class_files[i]->cd_entry.ucomp_size);
+  }
+  wq.run_all();
+  return !failed;
+}
+
+/*
+ * The class files are decompressed and parsed in parallel, and the classes
+ * are then created in the order of the entries. Attribute hooks read the
+ * class files while their classes are being created, so with a hook the
+ * class files are kept around until then.
+ *
+ * If parsed_out is given, it gets every class of the jar, including the ones
+ * that were already loaded.
+ */
 static bool process_jar_entries(std::vector<jar_entry>& files,
                                 const uint8_t* mapping,
                                 Scope* classes,
-                                attribute_hook_t attr_hook) {
-  ssize_t bufsize = kStartBufferSize;
-  uint8_t *outbuffer = (uint8_t*)malloc(bufsize);
-  static char classEndString[] = ".class";
-  static size_t classEndStringLen = strlen(classEndString);
+                                attribute_hook_t attr_hook,
+                                std::vector<parsed_class>* parsed_out) {
   init_basic_types();
-  for (auto &file : files) {
-    if (file.cd_entry.ucomp_size == 0)
-      continue;
-    if (file.cd_entry.fname_len < (classEndStringLen  + 1))
-      continue;
-
-    // Skip non-class files
-    uint8_t *endcomp = file.filename +
-      (file.cd_entry.fname_len - classEndStringLen);
-    if (memcmp(endcomp, classEndString, classEndStringLen) != 0)
-      continue;
-
-    // Resize output if necessary.
-    if (bufsize < file.cd_entry.ucomp_size) {
-      while(bufsize < file.cd_entry.ucomp_size)
-        bufsize *= 2;
-      free(outbuffer);
-      outbuffer = (uint8_t*)malloc(bufsize);
-    }
-
-    if (!decompress_class(file, mapping, outbuffer, bufsize)) {
-      free(outbuffer);
-      return false;
+  std::vector<const jar_entry*> class_files;
+  for (const auto& file : files) {
+    if (is_class_file(file)) {
+      class_files.push_back(&file);
     }
+  }
 
-    if (!parse_class(outbuffer, classes, attr_hook)) {
-      free(outbuffer);
+  if (attr_hook != nullptr) {
+    always_assert(parsed_out == nullptr);
+    std::vector<parsed_class> parsed;
+    std::vector<std::vector<uint8_t>> buffers;
+    if (!parse_class_files(class_files, mapping, &parsed, true, &buffers)) {
       return false;
     }
+    for (const auto& pc : parsed) {
+      create_class(pc, classes, attr_hook);
+    }
+    return true;
+  }
+
+  std::vector<parsed_class> local_parsed;
+  auto& parsed = parsed_out != nullptr ? *parsed_out : local_parsed;
+  bool skip_loaded = parsed_out == nullptr;
+  if (!parse_class_files(class_files, mapping, &parsed, skip_loaded)) {
+    return false;
+  }
+  for (const auto& pc : parsed) {
+    create_class(pc, classes, nullptr);
   }
-  free(outbuffer);
   return true;
 }
 
 static bool process_jar(const uint8_t* mapping,
                         ssize_t size,
                         Scope* classes,
-                        attribute_hook_t attr_hook) {
+                        attribute_hook_t attr_hook,
+                        std::vector<parsed_class>* parsed_out = nullptr) {
   pk_cdir_end pce;
   std::vector<jar_entry> files;
   if (!find_central_directory(mapping, size, pce))
@@ -758,7 +958,7 @@ static bool process_jar(const uint8_t* mapping,
     return false;
   if (!get_jar_entries(mapping, pce, files))
     return false;
-  if (!process_jar_entries(files, mapping, classes, attr_hook)) {
+  if (!process_jar_entries(files, mapping, classes, attr_hook, parsed_out)) {
     return false;
   }
   return true;
@@ -782,6 +982,431 @@ bool load_jar_file(const char* location,
   return true;
 }
 
+/******************
+ * Begin Jar Snapshot code.
+ *
+ * A snapshot holds what create_class() needs for every class of a jar, so
+ * that later runs can skip decompressing and parsing it. It is only meant to
+ * be read back by the same build of redex on the same machine, so it is laid
+ * out in host byte order:
+ *
+ *   snapshot_header
+ *   snapshot_string strings[num_strings]
+ *   uint32_t words[num_words]
+ *   char string_data[]
+ *
+ * Each string is NUL-terminated in string_data. The words describe one
+ * class after another, naming types and members by string index:
+ *
+ *   self, super (or kNoIndex), access,
+ *   interface count, interfaces...,
+ *   field count, { name, type, access }...,
+ *   method count, { name, return type, arg count, args..., access,
+ *                   is_virtual }...
+ */
+
+namespace {
+
+constexpr char kSnapshotMagic[8] = {'r', 'e', 'd', 'e', 'x', 'j', 's', 'n'};
+constexpr uint32_t kSnapshotVersion = 1;
+constexpr uint32_t kNoIndex = 0xffffffff;
+constexpr size_t kSha1Size = 20;
+
+struct snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint8_t jar_sha1[kSha1Size];
+  uint32_t num_strings;
+  uint32_t num_words;
+  uint32_t num_classes;
+  uint32_t string_data_size;
+};
+
+struct snapshot_string {
+  uint32_t offset;
+  uint32_t utfsize;
+};
+
+void sha1_of(const uint8_t* data, size_t size, uint8_t* digest) {
+  Sha1Context context;
+  sha1_init(&context);
+  // sha1_update takes 32-bit lengths.
+  constexpr size_t kChunkSize = 1 << 30;
+  while (size > 0) {
+    auto len = std::min(size, kChunkSize);
+    sha1_update(&context, data, (unsigned int)len);
+    data += len;
+    size -= len;
+  }
+  sha1_final(digest, &context);
+}
+
+std::string snapshot_path(const std::string& snapshot_dir,
+                          const uint8_t* digest) {
+  static const char* kHex = "0123456789abcdef";
+  std::string name;
+  for (size_t i = 0; i < kSha1Size; ++i) {
+    name += kHex[digest[i] >> 4];
+    name += kHex[digest[i] & 0xf];
+  }
+  return snapshot_dir + "/" + name + ".jarsnapshot";
+}
+
+class snapshot_writer {
+ public:
+  explicit snapshot_writer(const std::vector<parsed_class>& parsed) {
+    for (const auto& pc : parsed) {
+      if (pc.self != nullptr) {
+        add_class(pc);
+      }
+    }
+  }
+
+  bool write(const std::string& path, const uint8_t* jar_sha1) const {
+    namespace fs = boost::filesystem;
+    snapshot_header header;
+    memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.version = kSnapshotVersion;
+    memcpy(header.jar_sha1, jar_sha1, kSha1Size);
+    header.num_strings = m_strings.size();
+    header.num_words = m_words.size();
+    header.num_classes = m_num_classes;
+    header.string_data_size = m_string_data.size();
+
+    // Write to a unique temporary file first, so that concurrent runs never
+    // see a partial snapshot.
+    boost::system::error_code ec;
+    auto dir = fs::path(path).parent_path();
+    fs::create_directories(dir, ec);
+    auto tmp = dir / fs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp");
+    {
+      std::ofstream out(tmp.string(), std::ios::binary);
+      out.write((const char*)&header, sizeof(header));
+      out.write((const char*)m_strings.data(),
+                m_strings.size() * sizeof(snapshot_string));
+      out.write((const char*)m_words.data(),
+                m_words.size() * sizeof(uint32_t));
+      out.write(m_string_data.data(), m_string_data.size());
+      if (!out) {
+        fs::remove(tmp, ec);
+        return false;
+      }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+      fs::remove(tmp, ec);
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  void add_class(const parsed_class& pc) {
+    ++m_num_classes;
+    add_type(pc.self);
+    if (pc.super != nullptr) {
+      add_type(pc.super);
+    } else {
+      m_words.push_back(kNoIndex);
+    }
+    m_words.push_back(pc.access);
+    m_words.push_back(pc.interfaces.size());
+    for (auto* iface : pc.interfaces) {
+      add_type(iface);
+    }
+    m_words.push_back(pc.fields.size());
+    for (const auto& pf : pc.fields) {
+      add_string(pf.field->get_name());
+      add_type(pf.field->get_type());
+      m_words.push_back(pf.access);
+    }
+    m_words.push_back(pc.methods.size());
+    for (const auto& pm : pc.methods) {
+      auto* proto = pm.method->get_proto();
+      add_string(pm.method->get_name());
+      add_type(proto->get_rtype());
+      const auto& args = proto->get_args()->get_type_list();
+      m_words.push_back(args.size());
+      for (auto* arg : args) {
+        add_type(arg);
+      }
+      m_words.push_back(pm.access);
+      m_words.push_back(pm.is_virtual);
+    }
+  }
+
+  void add_type(const DexType* type) { add_string(type->get_name()); }
+
+  void add_string(const DexString* str) {
+    auto it = m_string_idx.find(str);
+    if (it == m_string_idx.end()) {
+      it = m_string_idx.emplace(str, m_strings.size()).first;
+      m_strings.push_back({(uint32_t)m_string_data.size(), str->length()});
+      m_string_data.insert(
+          m_string_data.end(), str->c_str(), str->c_str() + str->size() + 1);
+    }
+    m_words.push_back(it->second);
+  }
+
+  std::unordered_map<const DexString*, uint32_t> m_string_idx;
+  std::vector<snapshot_string> m_strings;
+  std::vector<uint32_t> m_words;
+  std::vector<char> m_string_data;
+  uint32_t m_num_classes{0};
+};
+
+/*
+ * Reads a snapshot back into parsed classes. Any inconsistency makes it fail
+ * rather than crash, so a stale or truncated snapshot just gets rebuilt.
+ * Classes that are already loaded are skipped without interning anything.
+ */
+class snapshot_reader {
+ public:
+  bool read(const std::string& path,
+            const uint8_t* jar_sha1,
+            std::vector<parsed_class>* parsed) {
+    if (!boost::filesystem::exists(path)) {
+      return false;
+    }
+    boost::iostreams::mapped_file file;
+    try {
+      file.open(path, boost::iostreams::mapped_file::readonly);
+    } catch (const std::exception&) {
+      return false;
+    }
+    if (!file.is_open() || file.size() < sizeof(snapshot_header)) {
+      return false;
+    }
+    auto data = file.const_data();
+    snapshot_header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+        header.version != kSnapshotVersion ||
+        memcmp(header.jar_sha1, jar_sha1, kSha1Size) != 0) {
+      return false;
+    }
+    uint64_t expected_size = sizeof(header) +
+                             uint64_t(header.num_strings) *
+                                 sizeof(snapshot_string) +
+                             uint64_t(header.num_words) * sizeof(uint32_t) +
+                             header.string_data_size;
+    if (file.size() != expected_size || header.string_data_size == 0 ||
+        data[file.size() - 1] != '\0') {
+      return false;
+    }
+    m_strings = (const snapshot_string*)(data + sizeof(header));
+    m_num_strings = header.num_strings;
+    m_words = (const uint32_t*)(m_strings + header.num_strings);
+    m_end = m_words + header.num_words;
+    m_string_data = (const char*)m_end;
+    m_string_data_size = header.string_data_size;
+    m_interned.assign(m_num_strings, nullptr);
+
+    init_basic_types();
+    parsed->reserve(header.num_classes);
+    for (uint32_t i = 0; i < header.num_classes; ++i) {
+      parsed->emplace_back();
+      if (!read_class(&parsed->back())) {
+        return false;
+      }
+    }
+    return m_words == m_end;
+  }
+
+ private:
+  bool next(uint32_t* word) {
+    if (m_words == m_end) {
+      return false;
+    }
+    *word = *m_words++;
+    return true;
+  }
+
+  bool skip(uint64_t count) {
+    if (uint64_t(m_end - m_words) < count) {
+      return false;
+    }
+    m_words += count;
+    return true;
+  }
+
+  bool next_string(DexString** str) {
+    uint32_t idx;
+    return next(&idx) && string_at(idx, str);
+  }
+
+  bool next_type(DexType** type) {
+    uint32_t idx;
+    return next(&idx) && type_at(idx, type);
+  }
+
+  bool string_at(uint32_t idx, DexString** str) {
+    if (idx >= m_num_strings) {
+      return false;
+    }
+    if (m_interned[idx] == nullptr) {
+      auto offset = m_strings[idx].offset;
+      if (offset >= m_string_data_size) {
+        return false;
+      }
+      m_interned[idx] = DexString::make_string(m_string_data + offset,
+                                               m_strings[idx].utfsize);
+    }
+    *str = m_interned[idx];
+    return true;
+  }
+
+  bool type_at(uint32_t idx, DexType** type) {
+    DexString* name;
+    if (!string_at(idx, &name)) {
+      return false;
+    }
+    *type = DexType::make_type(name);
+    return true;
+  }
+
+  bool read_class(parsed_class* pc) {
+    DexType* self;
+    uint32_t super, access, count;
+    if (!next_type(&self) || !next(&super) || !next(&access)) {
+      return false;
+    }
+    if (type_class(self)) {
+      // Skip over the rest of the class.
+      if (!next(&count) || !skip(count)) {
+        return false;
+      }
+      if (!next(&count) || !skip(count * uint64_t(3))) {
+        return false;
+      }
+      if (!next(&count)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < count; ++i) {
+        uint32_t num_args;
+        if (!skip(2) || !next(&num_args) || !skip(num_args) || !skip(2)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    pc->self = self;
+    if (super != kNoIndex && !type_at(super, &pc->super)) {
+      return false;
+    }
+    pc->access = access;
+
+    if (!next(&count)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      DexType* iface;
+      if (!next_type(&iface)) {
+        return false;
+      }
+      pc->interfaces.push_back(iface);
+    }
+
+    if (!next(&count)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      DexString* name;
+      DexType* type;
+      uint32_t field_access;
+      if (!next_string(&name) || !next_type(&type) || !next(&field_access)) {
+        return false;
+      }
+      auto* field =
+          static_cast<DexField*>(DexField::make_field(self, name, type));
+      pc->fields.push_back({field, (uint16_t)field_access, nullptr});
+    }
+
+    if (!next(&count)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      DexString* name;
+      DexType* rtype;
+      uint32_t num_args;
+      if (!next_string(&name) || !next_type(&rtype) || !next(&num_args)) {
+        return false;
+      }
+      std::deque<DexType*> args;
+      for (uint32_t j = 0; j < num_args; ++j) {
+        DexType* arg;
+        if (!next_type(&arg)) {
+          return false;
+        }
+        args.push_back(arg);
+      }
+      parsed_method pm;
+      uint32_t is_virtual;
+      if (!next(&pm.access) || !next(&is_virtual)) {
+        return false;
+      }
+      auto* proto = DexProto::make_proto(
+          rtype, DexTypeList::make_type_list(std::move(args)));
+      pm.method =
+          static_cast<DexMethod*>(DexMethod::make_method(self, name, proto));
+      if (pm.method->is_concrete()) {
+        return false;
+      }
+      pm.is_virtual = is_virtual != 0;
+      pm.attributes = nullptr;
+      pc->methods.push_back(pm);
+    }
+    return true;
+  }
+
+  const snapshot_string* m_strings{nullptr};
+  uint32_t m_num_strings{0};
+  const uint32_t* m_words{nullptr};
+  const uint32_t* m_end{nullptr};
+  const char* m_string_data{nullptr};
+  uint32_t m_string_data_size{0};
+  std::vector<DexString*> m_interned;
+};
+
+}
+
+bool load_jar_file_cached(const char* location,
+                          const std::string& snapshot_dir,
+                          Scope* classes) {
+  boost::iostreams::mapped_file file;
+  file.open(location, boost::iostreams::mapped_file::readonly);
+  if (!file.is_open()) {
+    fprintf(stderr, "error: cannot open jar file: %s\n", location);
+    return false;
+  }
+  auto mapping = reinterpret_cast<const uint8_t*>(file.const_data());
+  uint8_t digest[kSha1Size];
+  sha1_of(mapping, file.size(), digest);
+  auto path = snapshot_path(snapshot_dir, digest);
+
+  std::vector<parsed_class> parsed;
+  snapshot_reader reader;
+  if (reader.read(path, digest, &parsed)) {
+    for (const auto& pc : parsed) {
+      create_class(pc, classes, nullptr);
+    }
+    return true;
+  }
+
+  parsed.clear();
+  if (!process_jar(mapping, file.size(), classes, nullptr, &parsed)) {
+    fprintf(stderr, "error: cannot process jar: %s\n", location);
+    return false;
+  }
+  if (!snapshot_writer(parsed).write(path, digest)) {
+    fprintf(stderr,
+            "warning: cannot write jar snapshot %s for %s\n",
+            path.c_str(),
+            location);
+  }
+  return true;
+}
+
 //#define LOCAL_MAIN
 #ifdef LOCAL_MAIN
 int main(int argc, char *argv[]) {
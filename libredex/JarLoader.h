@@ -15,6 +15,7 @@ class DexMethod;
 #include "boost/variant.hpp"
 
 #include <functional>
+#include <string>
 
 namespace JarLoaderUtil {
 uint32_t read32(uint8_t*& buffer);
@@ -29,3 +30,14 @@ using attribute_hook_t =
 bool load_jar_file(const char* location,
                    Scope* classes = nullptr,
                    attribute_hook_t = nullptr);
+
+/*
+ * Loads the classes of a jar like load_jar_file does, but through a snapshot
+ * of the jar kept in snapshot_dir and named after the SHA1 of its contents.
+ * The first load of a jar writes the snapshot; later loads map it instead of
+ * decompressing and parsing the class files. A missing, stale or unreadable
+ * snapshot is rebuilt from the jar.
+ */
+bool load_jar_file_cached(const char* location,
+                          const std::string& snapshot_dir,
+                          Scope* classes = nullptr);
@@ -10,7 +10,9 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <functional>
+#include <initializer_list>
 #include <type_traits>
 #include <vector>
 
@@ -61,14 +63,14 @@ inline bool has_code(const DexMethodRef* meth) {
 
 namespace m {
 
-// N.B. recursive template for matching opcode pattern against insn sequence
+// N.B. recursive template for matching opcode pattern against insn sequence.
+// `Insns` is anything that indexes instructions, like a vector or an
+// insn_window.
 template<typename T, typename N>
 struct insns_matcher {
-  static bool matches_at(
-    int at,
-    const std::vector<IRInstruction*>& insns,
-    const T& t) {
-    const auto& insn = insns.at(at);
+  template <typename Insns>
+  static bool matches_at(size_t at, const Insns& insns, const T& t) {
+    const auto& insn = insns[at];
     typename std::tuple_element<N::value, T>::type insn_match = std::get<N::value>(t);
     return insn_match.matches(insn) &&
         insns_matcher<T, std::integral_constant<size_t, N::value+1> >::matches_at(at+1, insns, t);
@@ -78,14 +80,68 @@ struct insns_matcher {
 // N.B. base case of recursive template where N = opcode pattern length
 template<typename T>
 struct insns_matcher<T, std::integral_constant<size_t, std::tuple_size<T>::value> > {
-  static bool matches_at(
-    int at,
-    const std::vector<IRInstruction*>& insns,
-    const T& t) {
+  template <typename Insns>
+  static bool matches_at(size_t at, const Insns& insns, const T& t) {
     return true;
   }
 };
 
+/**
+ * The last N instructions pushed, oldest first, in a ring that never
+ * allocates. It is how a pattern of N instructions slides over a method
+ * without copying the method into a vector first.
+ */
+template <size_t N>
+class insn_window {
+  static_assert(N > 0, "an empty pattern has no window");
+
+ public:
+  void push(IRInstruction* insn) { m_ring[m_pushed++ % N] = insn; }
+
+  void clear() { m_pushed = 0; }
+
+  size_t size() const { return std::min(m_pushed, N); }
+
+  bool full() const { return m_pushed >= N; }
+
+  IRInstruction* operator[](size_t i) const {
+    return m_ring[(m_pushed - size() + i) % N];
+  }
+
+  std::array<IRInstruction*, N> to_array() const {
+    std::array<IRInstruction*, N> insns;
+    for (size_t i = 0; i < N; ++i) {
+      insns[i] = (*this)[i];
+    }
+    return insns;
+  }
+
+ private:
+  std::array<IRInstruction*, N> m_ring;
+  size_t m_pushed{0};
+};
+
+/**
+ * Calls `f` with the window of every sequence of instructions in `insns`
+ * that matches `p`, in order. `insns` is anything that iterates over
+ * MethodItemEntries, like an InstructionIterable, and is walked once.
+ */
+template <typename P,
+          typename Insns,
+          typename Fn,
+          size_t N = std::tuple_size<P>::value>
+void for_each_match(Insns&& insns, const P& p, Fn f) {
+  insn_window<N> window;
+  for (auto& mie : insns) {
+    window.push(mie.insn);
+    if (window.full() &&
+        insns_matcher<P, std::integral_constant<size_t, 0>>::matches_at(
+            0, window, p)) {
+      f(static_cast<const insn_window<N>&>(window));
+    }
+  }
+}
+
 // Find all sequences in `insns` that match `p` and put them into `matches`
 template <typename P, size_t N = std::tuple_size<P>::value>
 void find_matches(const std::vector<IRInstruction*>& insns,
@@ -108,6 +164,101 @@ void find_matches(const std::vector<IRInstruction*>& insns,
   }
 }
 
+/**
+ * A set of opcodes as a bitmask. It can be built at compile time, and a
+ * lookup is a shift and a mask rather than a hash.
+ */
+class opcode_set {
+  static constexpr size_t kBitsPerWord = 64;
+  static constexpr size_t kWords = 4;
+  static_assert(IOPCODE_MOVE_RESULT_PSEUDO_WIDE < kWords * kBitsPerWord,
+                "opcode_set is too small for the IROpcodes");
+
+ public:
+  constexpr opcode_set() : m_words{} {}
+
+  constexpr opcode_set(std::initializer_list<IROpcode> opcodes) : m_words{} {
+    for (auto op : opcodes) {
+      m_words[op / kBitsPerWord] |= uint64_t(1) << (op % kBitsPerWord);
+    }
+  }
+
+  constexpr bool contains(IROpcode op) const {
+    return (m_words[op / kBitsPerWord] >> (op % kBitsPerWord)) & 1;
+  }
+
+  constexpr opcode_set operator|(const opcode_set& that) const {
+    opcode_set result;
+    for (size_t i = 0; i < kWords; ++i) {
+      result.m_words[i] = m_words[i] | that.m_words[i];
+    }
+    return result;
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (auto word : m_words) {
+      n += __builtin_popcountll(word);
+    }
+    return n;
+  }
+
+  // Calls `f` with each opcode, in increasing order.
+  template <typename Fn>
+  void for_each(Fn f) const {
+    for (size_t i = 0; i < kWords; ++i) {
+      for (auto word = m_words[i]; word != 0; word &= word - 1) {
+        f(static_cast<IROpcode>(i * kBitsPerWord + __builtin_ctzll(word)));
+      }
+    }
+  }
+
+ private:
+  uint64_t m_words[kWords];
+};
+
+/**
+ * What the placeholders of a pattern are bound to, when the placeholders are
+ * the enumerators 0 to N - 1 of Key. The first instruction to mention a
+ * placeholder binds it, and the later ones match only the same value.
+ */
+template <typename Key, typename Value, size_t N>
+class captures {
+  static_assert(N <= 64, "the bound placeholders are a 64-bit mask");
+
+ public:
+  bool bind(Key key, const Value& value) {
+    auto i = index(key);
+    if (m_bound & (uint64_t(1) << i)) {
+      return m_values[i] == value;
+    }
+    m_bound |= uint64_t(1) << i;
+    m_values[i] = value;
+    return true;
+  }
+
+  bool contains(Key key) const {
+    return m_bound & (uint64_t(1) << index(key));
+  }
+
+  const Value& at(Key key) const {
+    always_assert(contains(key));
+    return m_values[index(key)];
+  }
+
+  void clear() { m_bound = 0; }
+
+ private:
+  static size_t index(Key key) {
+    auto i = static_cast<size_t>(key);
+    always_assert(i < N);
+    return i;
+  }
+
+  std::array<Value, N> m_values;
+  uint64_t m_bound{0};
+};
+
 /** N-ary match template */
 template <
   typename T,
@@ -364,6 +515,15 @@ inline match_t<IRInstruction, std::tuple<IROpcode>> is_opcode(IROpcode opcode) {
           opcode};
 }
 
+/** Matches instructions whose opcode is in the set */
+inline match_t<IRInstruction, std::tuple<opcode_set>> is_opcode_in(
+    const opcode_set& opcodes) {
+  return {[](const IRInstruction* insn, const opcode_set& opcodes) {
+            return opcodes.contains(insn->opcode());
+          },
+          opcodes};
+}
+
 /** Matchers that map from IRInstruction -> other types */
 template <typename P>
 match_t<IRInstruction, std::tuple<match_t<DexMethodRef, P>>> opcode_method(
@@ -409,18 +569,15 @@ template <typename ...T>
       auto code = meth->get_code();
       if (code) {
         const size_t N = std::tuple_size<std::tuple<T...> >::value;
-        std::vector<IRInstruction*> insns;
+        // Slide a window of N instructions along the code, so that nothing
+        // is copied.
+        insn_window<N> window;
         for (auto& mie : InstructionIterable(code)) {
-          insns.push_back(mie.insn);
-        }
-        // No way to match if we have less insns than N
-        if (insns.size() < N) {
-          return false;
-        }
-        // Try to match starting at i, we advance along insns until the length of the tuple
-        // would cause us to extend beyond the end of insns to make the match.
-        for (size_t i = 0 ; i <= insns.size() - N ; ++i) {
-          if (insns_matcher<std::tuple<T...>, std::integral_constant<size_t, 0> >::matches_at(i, insns, t)) {
+          window.push(mie.insn);
+          if (window.full() &&
+              insns_matcher<std::tuple<T...>,
+                            std::integral_constant<size_t, 0>>::
+                  matches_at(0, window, t)) {
             return true;
           }
         }
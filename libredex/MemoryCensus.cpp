@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "MemoryCensus.h"
+
+#include "ControlFlow.h"
+#include "DexAnnotation.h"
+#include "DexInstruction.h"
+#include "DexPosition.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "RedexContext.h"
+
+namespace memory_census {
+
+namespace {
+
+void count_interned(Census& census) {
+  auto counts = g_redex->count_interned();
+  census["interned.strings"].add(counts.strings, sizeof(DexString));
+  census["interned.string_data"].count += counts.strings;
+  census["interned.string_data"].bytes += counts.string_data_bytes;
+  census["interned.types"].add(counts.types, sizeof(DexType));
+  census["interned.fields"].add(counts.fields, sizeof(DexFieldRef));
+  census["interned.type_lists"].add(counts.type_lists, sizeof(DexTypeList));
+  census["interned.protos"].add(counts.protos, sizeof(DexProto));
+  census["interned.methods"].add(counts.methods, sizeof(DexMethodRef));
+  census["interned.positions"].add(counts.positions, sizeof(DexPosition));
+  census["interned.debug_locals"].add(counts.debug_locals,
+                                      sizeof(DexDebugLocal));
+  // What the arenas hold on to beyond the objects above.
+  census["arena.string_data"].add(1, counts.string_data_arena_bytes);
+  census["arena.refs"].add(1, counts.ref_arena_bytes);
+}
+
+void count_anno_set(const DexAnnotationSet* set,
+                    const char* category,
+                    Census& census) {
+  if (set == nullptr) {
+    return;
+  }
+  census[category].add(1, sizeof(DexAnnotationSet));
+  for (auto anno : set->get_annotations()) {
+    census["annotation"].add(1, sizeof(DexAnnotation));
+    census["annotation.elements"].add(anno->anno_elems().size(),
+                                      sizeof(DexAnnotationElement));
+  }
+}
+
+void count_entry(const MethodItemEntry& mie, Census& census) {
+  census["ir.entries"].add(1, sizeof(MethodItemEntry));
+  switch (mie.type) {
+  case MFLOW_TRY:
+    census["ir.try"].add(1, sizeof(TryEntry));
+    break;
+  case MFLOW_CATCH:
+    census["ir.catch"].add(1, sizeof(CatchEntry));
+    break;
+  case MFLOW_OPCODE:
+    census["ir.opcode"].add(1, sizeof(IRInstruction));
+    break;
+  case MFLOW_DEX_OPCODE:
+    census["ir.dex_opcode"].add(1, sizeof(DexInstruction));
+    break;
+  case MFLOW_TARGET:
+    census["ir.target"].add(1, sizeof(BranchTarget));
+    break;
+  // Debug instructions live inside the entry and positions are interned.
+  case MFLOW_DEBUG:
+    census["ir.debug"].count++;
+    break;
+  case MFLOW_POSITION:
+    census["ir.position"].count++;
+    break;
+  case MFLOW_FALLTHROUGH:
+    census["ir.fallthrough"].count++;
+    break;
+  }
+}
+
+void count_code(IRCode* code, Census& census) {
+  census["ir.code"].add(1, sizeof(IRCode));
+  if (code->get_debug_item() != nullptr) {
+    census["ir.debug_item"].add(1, sizeof(DexDebugItem));
+  }
+  if (!code->cfg_built()) {
+    for (const auto& mie : *code) {
+      count_entry(mie, census);
+    }
+    return;
+  }
+  auto& cfg = code->cfg();
+  census["cfg"].add(1, sizeof(ControlFlowGraph));
+  for (auto block : cfg.blocks()) {
+    census["cfg.blocks"].add(1, sizeof(Block));
+    // Each edge is shared by the preds of its target.
+    census["cfg.edges"].add(block->succs().size(), sizeof(cfg::Edge));
+    // A non-editable CFG points into the IRCode's entries.
+    if (cfg.editable()) {
+      for (const auto& mie : *block) {
+        count_entry(mie, census);
+      }
+    }
+  }
+  if (!cfg.editable()) {
+    for (const auto& mie : *code) {
+      count_entry(mie, census);
+    }
+  }
+}
+
+void count_dex_code(const DexCode* code, Census& census) {
+  census["dex_code"].add(1, sizeof(DexCode));
+  census["dex_code.instructions"].add(code->get_instructions().size(),
+                                      sizeof(DexInstruction));
+  auto dbg = code->get_debug_item();
+  if (dbg != nullptr) {
+    census["dex_code.debug_item"].add(1, sizeof(DexDebugItem));
+    census["dex_code.debug_entries"].add(
+        dbg->get_entries().size(),
+        sizeof(DexDebugEntry));
+  }
+}
+
+// Definitions are interned as refs, so only what they add to a ref is
+// counted here.
+void count_field(const DexField* field, Census& census) {
+  census["fields"].add(1, sizeof(DexField) - sizeof(DexFieldRef));
+  count_anno_set(field->get_anno_set(), "annotation_sets.field", census);
+}
+
+void count_method(DexMethod* method, Census& census) {
+  census["methods"].add(1, sizeof(DexMethod) - sizeof(DexMethodRef));
+  count_anno_set(method->get_anno_set(), "annotation_sets.method", census);
+  auto param_annos = method->get_param_anno();
+  if (param_annos != nullptr) {
+    for (const auto& pair : *param_annos) {
+      count_anno_set(pair.second, "annotation_sets.param", census);
+    }
+  }
+  auto code = method->peek_code();
+  if (code != nullptr) {
+    count_code(code, census);
+  } else if (method->get_dex_code() != nullptr) {
+    count_dex_code(method->get_dex_code(), census);
+  }
+}
+
+} // namespace
+
+Census take(const Scope& scope) {
+  Census census;
+  count_interned(census);
+  for (auto cls : scope) {
+    census["classes"].add(1, sizeof(DexClass));
+    count_anno_set(cls->get_anno_set(), "annotation_sets.class", census);
+    for (const auto* fields : {&cls->get_sfields(), &cls->get_ifields()}) {
+      for (auto field : *fields) {
+        count_field(field, census);
+      }
+    }
+    for (const auto* methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+      for (auto method : *methods) {
+        count_method(method, census);
+      }
+    }
+  }
+  return census;
+}
+
+Json::Value to_json(const Census& census) {
+  Json::Value result(Json::objectValue);
+  size_t total = 0;
+  for (const auto& pair : census) {
+    Json::Value entry;
+    entry["count"] = Json::UInt64(pair.second.count);
+    entry["bytes"] = Json::UInt64(pair.second.bytes);
+    result[pair.first] = entry;
+    total += pair.second.bytes;
+  }
+  result["total_bytes"] = Json::UInt64(total);
+  return result;
+}
+
+} // namespace memory_census
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <json/json.h>
+
+#include "DexClass.h"
+
+/*
+ * Counts the objects of the program model and estimates the bytes they take,
+ * so that the effect of memory optimizations can be checked between passes.
+ *
+ * The bytes are the sizes of the objects themselves plus the arrays they own,
+ * without what the allocator adds. Interned objects are counted once, from
+ * the RedexContext, and not again by those who point at them.
+ *
+ * Taking the census doesn't balloon deferred code nor stamp the code epoch:
+ * methods whose code is still a DexCode are counted under "dex_code".
+ */
+namespace memory_census {
+
+struct Entry {
+  size_t count{0};
+  size_t bytes{0};
+
+  void add(size_t n, size_t size) {
+    count += n;
+    bytes += n * size;
+  }
+};
+
+// By category, e.g. "ir.opcode" or "interned.strings".
+using Census = std::map<std::string, Entry>;
+
+Census take(const Scope& scope);
+
+// {"<category>": {"count": ..., "bytes": ...}, ..., "total_bytes": ...}
+Json::Value to_json(const Census& census);
+
+} // namespace memory_census
@@ -9,42 +9,31 @@
 
 #include "MethodDevirtualizer.h"
 
+#include <atomic>
+
 #include "Mutators.h"
 #include "Resolver.h"
 #include "VirtualScope.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
-using CallSiteReferences =
-    std::map<const DexMethod*, std::vector<IRInstruction*>>;
-
-struct CallCounter {
-  uint32_t virtuals{0};
-  uint32_t supers{0};
-  uint32_t directs{0};
-
-  static CallCounter plus(CallCounter a, CallCounter b) {
-    a.virtuals += b.virtuals;
-    a.supers += b.supers;
-    a.directs += b.directs;
-    return a;
-  }
-};
-
 void patch_call_site(DexMethod* callee,
                      IRInstruction* method_inst,
-                     CallCounter& counter) {
+                     std::atomic<uint32_t>& virtuals,
+                     std::atomic<uint32_t>& supers,
+                     std::atomic<uint32_t>& directs) {
   auto op = method_inst->opcode();
   if (is_invoke_virtual(op)) {
     method_inst->set_opcode(OPCODE_INVOKE_STATIC);
-    counter.virtuals++;
+    virtuals++;
   } else if (is_invoke_super(op)) {
     method_inst->set_opcode(OPCODE_INVOKE_STATIC);
-    counter.supers++;
+    supers++;
   } else if (is_invoke_direct(op)) {
     method_inst->set_opcode(OPCODE_INVOKE_STATIC);
-    counter.directs++;
+    directs++;
   } else {
     always_assert_log(false, SHOW(op));
   }
@@ -52,60 +41,50 @@ void patch_call_site(DexMethod* callee,
   method_inst->set_method(callee);
 }
 
+/*
+ * Rewrites the calls to the methods that are about to become static, in one
+ * sweep over the code for both the methods that keep `this` and the ones that
+ * drop it. The targets are non-static methods, which are found by resolving
+ * the references with MethodSearch::Any whatever the kind of invoke.
+ */
 void fix_call_sites(const std::vector<DexClass*>& scope,
-                    const std::unordered_set<DexMethod*>& target_methods,
-                    DevirtualizerMetrics& metrics,
-                    bool drop_this = false) {
-  const auto fixer = [&target_methods, drop_this](std::nullptr_t,
-                                                  DexMethod* m) -> CallCounter {
-    CallCounter call_counter;
-    IRCode* code = m->get_code();
-    if (code == nullptr) {
-      return call_counter;
+                    const std::unordered_set<DexMethod*>& keep_this,
+                    const std::unordered_set<DexMethod*>& drop_this,
+                    DevirtualizerMetrics& metrics) {
+  if (keep_this.empty() && drop_this.empty()) {
+    return;
+  }
+  std::atomic<uint32_t> virtuals{0};
+  std::atomic<uint32_t> supers{0};
+  std::atomic<uint32_t> directs{0};
+  walk::parallel::opcodes(scope, [&](DexMethod*, IRInstruction* insn) {
+    if (!insn->has_method()) {
+      return;
+    }
+    auto method = resolve_method_cached(insn->get_method(), MethodSearch::Any);
+    if (method == nullptr) {
+      return;
+    }
+    bool drops_this = drop_this.count(method) != 0;
+    if (!drops_this && keep_this.count(method) == 0) {
+      return;
     }
 
-    for (const MethodItemEntry& mie : InstructionIterable(code)) {
-      IRInstruction* insn = mie.insn;
-      if (!insn->has_method()) {
-        continue;
-      }
-
-      MethodSearch type = drop_this ? MethodSearch::Any : MethodSearch::Virtual;
-      auto method = resolve_method(insn->get_method(), type);
-      if (method == nullptr || !target_methods.count(method)) {
-        continue;
-      }
-
-      always_assert(drop_this || !is_invoke_static(insn->opcode()));
-      patch_call_site(method, insn, call_counter);
+    always_assert(drops_this || !is_invoke_static(insn->opcode()));
+    patch_call_site(method, insn, virtuals, supers, directs);
 
-      if (drop_this) {
-        auto nargs = insn->arg_word_count();
-        for (uint16_t i = 0; i < nargs - 1; i++) {
-          insn->set_src(i, insn->src(i + 1));
-        }
-        insn->set_arg_word_count(nargs - 1);
+    if (drops_this) {
+      auto nargs = insn->arg_word_count();
+      for (uint16_t i = 0; i < nargs - 1; i++) {
+        insn->set_src(i, insn->src(i + 1));
       }
+      insn->set_arg_word_count(nargs - 1);
     }
+  });
 
-    return call_counter;
-  };
-
-  CallCounter call_counter =
-      walk::parallel::reduce_methods<std::nullptr_t, CallCounter, Scope>(
-          scope,
-          fixer,
-          [](CallCounter a, CallCounter b) -> CallCounter {
-            a.virtuals += b.virtuals;
-            a.supers += b.supers;
-            a.directs += b.directs;
-            return a;
-          },
-          [](int) { return nullptr; });
-
-  metrics.num_virtual_calls += call_counter.virtuals;
-  metrics.num_super_calls += call_counter.supers;
-  metrics.num_direct_calls += call_counter.directs;
+  metrics.num_virtual_calls += virtuals;
+  metrics.num_super_calls += supers;
+  metrics.num_direct_calls += directs;
 }
 
 void make_methods_static(const std::unordered_set<DexMethod*>& methods,
@@ -140,10 +119,10 @@ bool uses_this(const DexMethod* method) {
 }
 
 std::vector<DexMethod*> get_devirtualizable_vmethods(
-    const std::vector<DexClass*>& scope,
+    const SignatureMap& signature_map,
     const std::vector<DexClass*>& targets) {
   std::vector<DexMethod*> ret;
-  auto vmethods = devirtualize(scope);
+  auto vmethods = devirtualize(signature_map);
   auto targets_set =
       std::unordered_set<DexClass*>(targets.begin(), targets.end());
   for (auto m : vmethods) {
@@ -198,6 +177,7 @@ void MethodDevirtualizer::verify_and_split(
     const std::vector<DexMethod*>& candidates,
     std::unordered_set<DexMethod*>& using_this,
     std::unordered_set<DexMethod*>& not_using_this) {
+  std::vector<DexMethod*> eligible;
   for (const auto m : candidates) {
     if (!m_config.ignore_keep && keep(m)) {
       TRACE(VIRT, 2, "failed to devirt method %s: keep %d\n", SHOW(m), keep(m));
@@ -213,36 +193,60 @@ void MethodDevirtualizer::verify_and_split(
             is_native(m));
       continue;
     }
-    if (uses_this(m)) {
-      using_this.insert(m);
+    eligible.push_back(m);
+  }
+
+  // Scanning the code for uses of `this` is the expensive part, and each
+  // method is independent of the others.
+  std::vector<char> uses(eligible.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { uses[i] = uses_this(eligible[i]); });
+  for (size_t i = 0; i < eligible.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  for (size_t i = 0; i < eligible.size(); ++i) {
+    if (uses[i]) {
+      using_this.insert(eligible[i]);
     } else {
-      not_using_this.insert(m);
+      not_using_this.insert(eligible[i]);
     }
   }
 }
 
-void MethodDevirtualizer::staticize_methods_not_using_this(
+void MethodDevirtualizer::staticize_methods(
     const std::vector<DexClass*>& scope,
-    const std::unordered_set<DexMethod*>& methods) {
-  fix_call_sites(scope, methods, m_metrics, true /* drop_this */);
-  make_methods_static(methods, false);
-  TRACE(VIRT, 1, "Staticized %lu methods not using this\n", methods.size());
-  m_metrics.num_methods_not_using_this += methods.size();
+    const std::unordered_set<DexMethod*>& using_this,
+    const std::unordered_set<DexMethod*>& not_using_this) {
+  fix_call_sites(scope, using_this, not_using_this, m_metrics);
+  make_methods_static(not_using_this, false);
+  make_methods_static(using_this, true);
+  TRACE(VIRT,
+        1,
+        "Staticized %lu methods not using this\n",
+        not_using_this.size());
+  TRACE(VIRT, 1, "Staticized %lu methods using this\n", using_this.size());
+  m_metrics.num_methods_not_using_this += not_using_this.size();
+  m_metrics.num_methods_using_this += using_this.size();
 }
 
-void MethodDevirtualizer::staticize_methods_using_this(
-    const std::vector<DexClass*>& scope,
-    const std::unordered_set<DexMethod*>& methods) {
-  fix_call_sites(scope, methods, m_metrics, false /* drop_this */);
-  make_methods_static(methods, true);
-  TRACE(VIRT, 1, "Staticized %lu methods using this\n", methods.size());
-  m_metrics.num_methods_using_this += methods.size();
+DevirtualizerMetrics MethodDevirtualizer::devirtualize_methods(
+    const Scope& scope, const std::vector<DexClass*>& target_classes) {
+  ClassHierarchy class_hierarchy = build_type_hierarchy(scope);
+  auto signature_map = build_signature_map(class_hierarchy);
+  return devirtualize_methods(scope, target_classes, signature_map);
 }
 
 DevirtualizerMetrics MethodDevirtualizer::devirtualize_methods(
-    const Scope& scope, const std::vector<DexClass*>& target_classes) {
+    const Scope& scope,
+    const std::vector<DexClass*>& target_classes,
+    const SignatureMap& signature_map) {
   reset_metrics();
-  auto vmethods = get_devirtualizable_vmethods(scope, target_classes);
+  // The methods to staticize, keeping or dropping `this`.
+  std::unordered_set<DexMethod*> keep_this, drop_this;
+
+  auto vmethods = get_devirtualizable_vmethods(signature_map, target_classes);
   std::unordered_set<DexMethod*> using_this, not_using_this;
   verify_and_split(vmethods, using_this, not_using_this);
   TRACE(VIRT,
@@ -252,13 +256,15 @@ DevirtualizerMetrics MethodDevirtualizer::devirtualize_methods(
         not_using_this.size());
 
   if (m_config.vmethods_not_using_this) {
-    staticize_methods_not_using_this(scope, not_using_this);
+    drop_this.insert(not_using_this.begin(), not_using_this.end());
   }
 
   if (m_config.vmethods_using_this) {
-    staticize_methods_using_this(scope, using_this);
+    keep_this.insert(using_this.begin(), using_this.end());
   }
 
+  // Staticizing the vmethods doesn't change which dmethods are candidates,
+  // so both kinds are collected before any call site is rewritten.
   auto dmethods = get_devirtualizable_dmethods(scope, target_classes);
   using_this.clear();
   not_using_this.clear();
@@ -270,13 +276,14 @@ DevirtualizerMetrics MethodDevirtualizer::devirtualize_methods(
         not_using_this.size());
 
   if (m_config.dmethods_not_using_this) {
-    staticize_methods_not_using_this(scope, not_using_this);
+    drop_this.insert(not_using_this.begin(), not_using_this.end());
   }
 
   if (m_config.dmethods_using_this) {
-    staticize_methods_using_this(scope, using_this);
+    keep_this.insert(using_this.begin(), using_this.end());
   }
 
+  staticize_methods(scope, keep_this, drop_this);
   return m_metrics;
 }
 
@@ -287,13 +294,14 @@ DevirtualizerMetrics MethodDevirtualizer::devirtualize_vmethods(
   std::unordered_set<DexMethod*> using_this, not_using_this;
   verify_and_split(candidates, using_this, not_using_this);
 
-  if (m_config.vmethods_using_this) {
-    staticize_methods_using_this(scope, using_this);
+  if (!m_config.vmethods_using_this) {
+    using_this.clear();
   }
 
-  if (m_config.vmethods_not_using_this) {
-    staticize_methods_not_using_this(scope, not_using_this);
+  if (!m_config.vmethods_not_using_this) {
+    not_using_this.clear();
   }
 
+  staticize_methods(scope, using_this, not_using_this);
   return m_metrics;
 }
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "Pass.h"
+#include "VirtualScope.h"
 
 struct DevirtualizerConfigs {
   bool vmethods_not_using_this = true;
@@ -61,6 +62,15 @@ class MethodDevirtualizer {
   DevirtualizerMetrics devirtualize_methods(
       const Scope& scope, const std::vector<DexClass*>& target_classes);
 
+  /*
+   * Same as above, with the signature map of `scope` already at hand, e.g.
+   * the one from PassManager::get_hierarchy_cache().
+   */
+  DevirtualizerMetrics devirtualize_methods(
+      const Scope& scope,
+      const std::vector<DexClass*>& target_classes,
+      const SignatureMap& signature_map);
+
   // Assuming vmethods.
   DevirtualizerMetrics devirtualize_vmethods(
       const Scope& scope, const std::vector<DexMethod*>& methods);
@@ -71,13 +81,11 @@ class MethodDevirtualizer {
 
   void reset_metrics() { m_metrics = DevirtualizerMetrics(); }
 
-  void staticize_methods_using_this(
-      const std::vector<DexClass*>& scope,
-      const std::unordered_set<DexMethod*>& methods);
-
-  void staticize_methods_not_using_this(
-      const std::vector<DexClass*>& scope,
-      const std::unordered_set<DexMethod*>& methods);
+  // Rewrites the calls to all the methods in a single sweep over the code
+  // before making them static.
+  void staticize_methods(const std::vector<DexClass*>& scope,
+                         const std::unordered_set<DexMethod*>& using_this,
+                         const std::unordered_set<DexMethod*>& not_using_this);
 
   void verify_and_split(const std::vector<DexMethod*>& candidates,
                         std::unordered_set<DexMethod*>& using_this,
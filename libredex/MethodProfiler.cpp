@@ -0,0 +1,161 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "MethodProfiler.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "DexClass.h"
+#include "IRCode.h"
+#include "Show.h"
+
+namespace method_profiler {
+
+namespace detail {
+std::atomic<size_t> s_top_n{0};
+}
+
+namespace {
+
+bool slower(const Sample& a, const Sample& b) {
+  return a.seconds > b.seconds;
+}
+
+// A min-heap of the slowest samples the thread has seen, so that the fastest
+// of them is the one to compare against.
+struct ThreadSamples {
+  std::vector<Sample> heap;
+};
+
+struct Registry {
+  std::mutex lock;
+  std::vector<std::unique_ptr<ThreadSamples>> threads;
+};
+
+Registry& registry() {
+  static Registry* r = new Registry();
+  return *r;
+}
+
+ThreadSamples& thread_samples() {
+  static thread_local ThreadSamples* samples = nullptr;
+  if (samples == nullptr) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.threads.emplace_back(std::make_unique<ThreadSamples>());
+    samples = r.threads.back().get();
+  }
+  return *samples;
+}
+
+thread_local const std::string* t_phase{nullptr};
+
+const std::string& no_phase() {
+  static const std::string* name = new std::string("(no pass)");
+  return *name;
+}
+
+void count_code(DexMethod* method, Sample* sample) {
+  sample->instructions = 0;
+  sample->blocks = 0;
+  // Don't balloon methods just to count them.
+  if (method->is_balloon_deferred() || method->get_code() == nullptr) {
+    return;
+  }
+  sample->blocks = 1;
+  for (const auto& mie : *method->get_code()) {
+    switch (mie.type) {
+    case MFLOW_OPCODE:
+    case MFLOW_DEX_OPCODE:
+      ++sample->instructions;
+      break;
+    case MFLOW_TARGET:
+    case MFLOW_TRY:
+    case MFLOW_CATCH:
+      ++sample->blocks;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+} // namespace
+
+void enable(size_t top_n) { detail::s_top_n = top_n; }
+
+ScopedPhase::ScopedPhase(std::string name)
+    : m_outer(t_phase), m_name(std::move(name)) {
+  t_phase = &m_name;
+}
+
+ScopedPhase::~ScopedPhase() { t_phase = m_outer; }
+
+const std::string* current_phase() {
+  if (!enabled()) {
+    return nullptr;
+  }
+  return t_phase != nullptr ? t_phase : &no_phase();
+}
+
+MethodTimer::~MethodTimer() {
+  if (m_phase == nullptr) {
+    return;
+  }
+  double seconds = std::chrono::duration<double>(clock::now() - m_start).count();
+  auto& heap = thread_samples().heap;
+  size_t top_n = detail::s_top_n.load(std::memory_order_relaxed);
+  if (heap.size() >= top_n) {
+    if (heap.front().seconds >= seconds) {
+      return;
+    }
+    std::pop_heap(heap.begin(), heap.end(), slower);
+    heap.pop_back();
+  }
+  Sample sample;
+  sample.phase = *m_phase;
+  sample.method = show(m_method);
+  sample.seconds = seconds;
+  count_code(m_method, &sample);
+  heap.push_back(std::move(sample));
+  std::push_heap(heap.begin(), heap.end(), slower);
+}
+
+std::vector<Sample> slowest() {
+  auto& r = registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+  std::vector<Sample> all;
+  for (const auto& thread : r.threads) {
+    all.insert(all.end(), thread->heap.begin(), thread->heap.end());
+  }
+  std::sort(all.begin(), all.end(), [](const Sample& a, const Sample& b) {
+    if (a.seconds != b.seconds) {
+      return a.seconds > b.seconds;
+    }
+    return a.method < b.method;
+  });
+  // A method may be visited more than once in a phase; keep its slowest.
+  std::set<std::pair<std::string, std::string>> seen;
+  std::vector<Sample> result;
+  size_t top_n = detail::s_top_n.load(std::memory_order_relaxed);
+  for (auto& sample : all) {
+    if (result.size() == top_n) {
+      break;
+    }
+    if (seen.emplace(sample.phase, sample.method).second) {
+      result.push_back(std::move(sample));
+    }
+  }
+  return result;
+}
+
+} // namespace method_profiler
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class DexMethod;
+
+/*
+ * Finds the methods that some phase (usually a pass) spends the most time on.
+ * When a pass regresses, it's usually because of a few huge or pathological
+ * methods; this tells which.
+ *
+ * The parallel walkers time the walker on every method they visit, and
+ * attribute it to the phase of the thread that started the walk. Each thread
+ * keeps its own top N, so the only cost of a method that isn't among the
+ * slowest is reading the clock twice.
+ */
+namespace method_profiler {
+
+using clock = std::chrono::steady_clock;
+
+namespace detail {
+extern std::atomic<size_t> s_top_n;
+}
+
+inline bool enabled() {
+  return detail::s_top_n.load(std::memory_order_relaxed) != 0;
+}
+
+/*
+ * Keeps the `top_n` slowest (phase, method) pairs from now on.
+ */
+void enable(size_t top_n);
+
+/*
+ * Names what the calling thread does until the end of the scope.
+ */
+class ScopedPhase {
+ public:
+  explicit ScopedPhase(std::string name);
+  ~ScopedPhase();
+
+ private:
+  const std::string* m_outer;
+  std::string m_name;
+};
+
+/*
+ * The phase of the calling thread, or nullptr if the profiler is off.
+ * Capture it before handing methods out to other threads.
+ */
+const std::string* current_phase();
+
+/*
+ * Times the method from construction to destruction, if `phase` isn't null.
+ */
+class MethodTimer {
+ public:
+  MethodTimer(const std::string* phase, DexMethod* method)
+      : m_phase(phase), m_method(method) {
+    if (m_phase != nullptr) {
+      m_start = clock::now();
+    }
+  }
+
+  ~MethodTimer();
+
+ private:
+  const std::string* m_phase;
+  DexMethod* m_method;
+  clock::time_point m_start;
+};
+
+struct Sample {
+  std::string phase;
+  std::string method;
+  double seconds;
+  size_t instructions;
+  // Basic block boundaries: branch targets, try regions and catch handlers.
+  size_t blocks;
+};
+
+/*
+ * The slowest (phase, method) pairs seen so far, slowest first. No thread may
+ * be timing a method while this runs.
+ */
+std::vector<Sample> slowest();
+
+} // namespace method_profiler
@@ -0,0 +1,305 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "MethodShards.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "ConfigFiles.h"
+#include "Debug.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "PassManager.h"
+#include "PassRegistry.h"
+#include "ProgramSnapshot.h"
+#include "Timer.h"
+#include "Walkers.h"
+#include "WorkQueue.h"
+
+namespace {
+
+constexpr const char* kContextDir = "context";
+constexpr const char* kManifest = "manifest.json";
+constexpr const char* kDefaultCommand =
+    "{redex} --shard-worker {dir} --shard {shard}";
+
+std::string shard_path(const std::string& dir,
+                       const char* prefix,
+                       size_t shard,
+                       const char* extension) {
+  return dir + "/" + prefix + "-" + std::to_string(shard) + extension;
+}
+
+void write_json(const std::string& filename, const Json::Value& value) {
+  std::ofstream out(filename);
+  Json::StyledStreamWriter writer;
+  writer.write(out, value);
+  always_assert_log(out, "Failed to write %s", filename.c_str());
+}
+
+Json::Value read_json(const std::string& filename) {
+  Json::Value value;
+  std::ifstream in(filename);
+  always_assert_log(in, "Failed to read %s", filename.c_str());
+  in >> value;
+  return value;
+}
+
+void write_string(std::ostream& out, const std::string& s) {
+  uint32_t size = s.size();
+  out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  out.write(s.data(), size);
+}
+
+bool read_string(std::istream& in, std::string* s) {
+  uint32_t size;
+  if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+    return false;
+  }
+  s->resize(size);
+  return static_cast<bool>(in.read(&(*s)[0], size));
+}
+
+// The code of each method, in the order the methods are given.
+void write_code_file(const std::string& filename,
+                     const std::vector<DexMethod*>& methods) {
+  std::vector<std::string> codes(methods.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    codes[i] = program_snapshot::write_code(methods[i]->get_code());
+  });
+  for (size_t i = 0; i < methods.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  std::ofstream out(filename, std::ios::binary);
+  for (size_t i = 0; i < methods.size(); ++i) {
+    write_string(out, show(methods[i]));
+    write_string(out, codes[i]);
+  }
+  always_assert_log(out, "Failed to write %s", filename.c_str());
+}
+
+// Gives each method of the file its code, and returns the methods.
+std::vector<DexMethod*> read_code_file(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  always_assert_log(in, "Failed to read %s", filename.c_str());
+  std::vector<DexMethod*> methods;
+  std::vector<std::string> codes;
+  std::string descriptor;
+  std::string code;
+  while (read_string(in, &descriptor)) {
+    always_assert_log(read_string(in, &code), "%s is cut short",
+                      filename.c_str());
+    auto method = DexMethod::get_method(descriptor);
+    always_assert_log(method != nullptr && method->is_def(),
+                      "%s has code for unknown method %s",
+                      filename.c_str(),
+                      descriptor.c_str());
+    methods.push_back(static_cast<DexMethod*>(method));
+    codes.push_back(std::move(code));
+  }
+
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    methods[i]->set_code(program_snapshot::read_code(codes[i]));
+  });
+  for (size_t i = 0; i < methods.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  return methods;
+}
+
+void replace_all(std::string* s,
+                 const std::string& from,
+                 const std::string& to) {
+  for (auto pos = s->find(from); pos != std::string::npos;
+       pos = s->find(from, pos + to.size())) {
+    s->replace(pos, from.size(), to);
+  }
+}
+
+std::string this_executable() {
+  boost::system::error_code ec;
+  auto path = boost::filesystem::read_symlink("/proc/self/exe", ec);
+  return ec ? "redex-all" : path.string();
+}
+
+} // namespace
+
+namespace method_shards {
+
+void write(const std::string& dir,
+           DexStoresVector& stores,
+           ConfigFiles& cfg,
+           const Json::Value& worker_config,
+           const Json::Value& worker_state,
+           size_t num_shards) {
+  Timer t("Writing method shards");
+  always_assert(num_shards > 0);
+  namespace fs = boost::filesystem;
+  // Results of an earlier run must not be taken for those of this one.
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  auto scope = build_class_scope(stores);
+  std::vector<DexMethod*> methods;
+  std::vector<size_t> sizes;
+  walk::methods(scope, [&](DexMethod* method) {
+    auto code = method->get_code();
+    if (code != nullptr) {
+      methods.push_back(method);
+      sizes.push_back(code->count_opcodes());
+    }
+  });
+
+  // The largest methods go first, each to the shard with the fewest
+  // instructions so far.
+  std::vector<size_t> order(methods.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sizes[a] > sizes[b];
+  });
+  std::vector<std::vector<DexMethod*>> shards(num_shards);
+  std::vector<size_t> shard_sizes(num_shards);
+  for (auto i : order) {
+    auto lightest = std::min_element(shard_sizes.begin(), shard_sizes.end()) -
+                    shard_sizes.begin();
+    shards[lightest].push_back(methods[i]);
+    shard_sizes[lightest] += sizes[i];
+  }
+  for (size_t shard = 0; shard < num_shards; ++shard) {
+    write_code_file(shard_path(dir, "shard", shard, ".bin"), shards[shard]);
+  }
+
+  // The context is the snapshot of the classes with their code taken out,
+  // which the snapshot writer then sees as an empty DexCode.
+  std::vector<std::unique_ptr<IRCode>> detached;
+  detached.reserve(methods.size());
+  for (auto method : methods) {
+    detached.push_back(method->release_code());
+    method->set_dex_code(std::make_unique<DexCode>());
+  }
+  program_snapshot::write(dir + "/" + kContextDir, stores, cfg, Json::Value());
+  for (size_t i = 0; i < methods.size(); ++i) {
+    methods[i]->set_dex_code(nullptr);
+    methods[i]->set_code(std::move(detached[i]));
+  }
+
+  Json::Value manifest;
+  manifest["num_shards"] = Json::UInt(num_shards);
+  manifest["config"] = worker_config;
+  manifest["state"] = worker_state;
+  write_json(dir + "/" + kManifest, manifest);
+}
+
+void run_workers(const std::string& dir,
+                 size_t num_shards,
+                 const std::string& command) {
+  Timer t("Running " + std::to_string(num_shards) + " shard workers");
+  auto redex = this_executable();
+  std::vector<int> statuses(num_shards);
+  std::vector<std::thread> workers;
+  for (size_t shard = 0; shard < num_shards; ++shard) {
+    auto cmd = command.empty() ? std::string(kDefaultCommand) : command;
+    replace_all(&cmd, "{redex}", redex);
+    replace_all(&cmd, "{dir}", dir);
+    replace_all(&cmd, "{shard}", std::to_string(shard));
+    workers.emplace_back([cmd, shard, &statuses] {
+      TRACE(PM, 2, "Running shard worker: %s\n", cmd.c_str());
+      statuses[shard] = std::system(cmd.c_str());
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  for (size_t shard = 0; shard < num_shards; ++shard) {
+    always_assert_log(statuses[shard] == 0,
+                      "The worker of shard %zu of %s failed with status %d",
+                      shard,
+                      dir.c_str(),
+                      statuses[shard]);
+  }
+}
+
+std::vector<Json::Value> read_results(const std::string& dir,
+                                      size_t num_shards) {
+  Timer t("Reading method shard results");
+  std::vector<Json::Value> results;
+  for (size_t shard = 0; shard < num_shards; ++shard) {
+    read_code_file(shard_path(dir, "result", shard, ".bin"));
+    results.push_back(read_json(shard_path(dir, "result", shard, ".json")));
+  }
+  return results;
+}
+
+int run_worker(const std::string& dir, size_t shard) {
+  Timer t("Shard worker " + std::to_string(shard));
+  auto manifest = read_json(dir + "/" + kManifest);
+  always_assert_log(shard < manifest["num_shards"].asUInt(),
+                    "%s has no shard %zu",
+                    dir.c_str(),
+                    shard);
+
+  DexStoresVector stores;
+  program_snapshot::read(
+      dir + "/" + kContextDir, &stores, /* lazy_balloon */ true);
+  // Only the methods of this shard have code. The others had theirs taken
+  // out, and are left without any, so that the passes skip them.
+  walk::parallel::methods(build_class_scope(stores), [](DexMethod* method) {
+    if (method->is_balloon_deferred()) {
+      method->set_code(nullptr);
+    }
+  });
+  auto methods = read_code_file(shard_path(dir, "shard", shard, ".bin"));
+
+  const auto& config = manifest["config"];
+  const auto& state = manifest["state"];
+  ConfigFiles cfg(config);
+  PassManager manager(PassRegistry::get().get_passes(),
+                      config,
+                      state.get("verify_none_mode", false).asBool());
+  if (state.get("proguard_rules", false).asBool()) {
+    // The keep rules have already been applied to the ReferencedState of
+    // the context, but passes skip their work without any.
+    manager.set_testing_mode();
+  }
+  manager.resume_from_snapshot(state);
+  manager.run_passes(stores, Scope(), cfg);
+
+  write_code_file(shard_path(dir, "result", shard, ".bin"), methods);
+  Json::Value result;
+  Json::Value passes(Json::arrayValue);
+  for (const auto& pass_info : manager.get_pass_info()) {
+    Json::Value metrics(Json::objectValue);
+    for (const auto& pair : pass_info.metrics) {
+      metrics[pair.first] = pair.second;
+    }
+    Json::Value pass;
+    pass["name"] = pass_info.name;
+    pass["metrics"] = metrics;
+    passes.append(pass);
+  }
+  result["passes"] = passes;
+  result["regalloc_has_run"] = manager.regalloc_has_run();
+  write_json(shard_path(dir, "result", shard, ".json"), result);
+  return EXIT_SUCCESS;
+}
+
+} // namespace method_shards
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "DexClass.h"
+#include "DexStore.h"
+
+class ConfigFiles;
+
+/*
+ * Runs passes that only rewrite each method on its own (see
+ * Pass::is_method_local()) in worker processes, each on a shard of the
+ * methods, so that they can be spread over several machines. The PassManager
+ * does so for the passes listed in the "sharded_passes" config.
+ *
+ * The coordinator writes a directory with:
+ *
+ *   context/            a program snapshot of the classes without their code
+ *                       (see ProgramSnapshot.h), which every worker loads
+ *   manifest.json       the config of the workers, and the state they start
+ *                       from
+ *   shard-<n>.bin       the code of the methods of shard n
+ *
+ * It then starts a worker per shard, and waits for all of them. Each worker
+ * loads the context, gives the methods of its shard their code, runs the
+ * passes and writes:
+ *
+ *   result-<n>.bin      the code of the methods of shard n after the passes
+ *   result-<n>.json     the metrics of the passes, and the state after them
+ *
+ * The code files hold a record per method: its u32-length-prefixed
+ * descriptor, like "LFoo;.bar:(I)V", then its u32-length-prefixed code, as
+ * program_snapshot::write_code() lays it out. Like snapshots, the files are
+ * only meant to be read by the same build of redex, in host byte order.
+ */
+namespace method_shards {
+
+/*
+ * Splits the methods of the stores that have code into `num_shards` shards
+ * of about the same number of instructions, and writes them to `dir` along
+ * with the context. The workers run the passes of `worker_config`, which is
+ * a redex-all config, and resume from `worker_state` (see
+ * PassManager::resume_from_snapshot()). Its "verify_none_mode" and
+ * "proguard_rules" say whether the coordinator runs in verify-none mode, and
+ * whether it has keep rules.
+ */
+void write(const std::string& dir,
+           DexStoresVector& stores,
+           ConfigFiles& cfg,
+           const Json::Value& worker_config,
+           const Json::Value& worker_state,
+           size_t num_shards);
+
+/*
+ * Runs a worker per shard of `dir` with `command`, a shell command in which
+ * "{dir}" and "{shard}" are replaced by the directory and the shard number,
+ * and "{redex}" by the path of this executable. All the workers run at once,
+ * and any of them failing aborts. The default runs
+ * "{redex} --shard-worker {dir} --shard {shard}"; to run the workers on other
+ * machines, the command can go through e.g. ssh to a host that sees the
+ * directory at the same path.
+ */
+void run_workers(const std::string& dir,
+                 size_t num_shards,
+                 const std::string& command = "");
+
+/*
+ * Replaces the code of the methods of every shard with what its worker
+ * wrote, and returns the results of the workers, in shard order.
+ */
+std::vector<Json::Value> read_results(const std::string& dir,
+                                      size_t num_shards);
+
+/*
+ * The worker: runs the passes on shard `shard` of `dir`. Expects a fresh
+ * RedexContext, and returns the exit code of the process.
+ */
+int run_worker(const std::string& dir, size_t shard);
+
+} // namespace method_shards
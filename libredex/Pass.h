@@ -166,6 +166,81 @@ class Pass {
   virtual void eval_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) {};
   virtual void run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) = 0;
 
+  /**
+   * Whether the pass works on one store at a time. If so, PassManager calls
+   * run_pass_on_store for each store instead of run_pass, and may run it on
+   * several stores at once: a store is only processed once the stores it
+   * depends on (see DexMetadata) are done.
+   *
+   * run_pass_on_store may only modify the classes of stores[store_idx] and
+   * look at those of the stores it depends on, and whatever state the pass
+   * keeps across stores must be thread safe. run_pass should still run the
+   * pass on every store, for callers that don't go through PassManager.
+   */
+  virtual bool is_store_local() const { return false; }
+  virtual void run_pass_on_store(DexStoresVector& stores,
+                                 size_t store_idx,
+                                 ConfigFiles& cfg,
+                                 PassManager& mgr) {}
+
+  /**
+   * Whether run_pass may add or remove classes, or change their super class
+   * or interfaces.
+   *
+   * The PassManager keeps the hierarchy analyses it hands out (see
+   * PassManager::get_hierarchy_cache()) across passes that don't, so
+   * override these to return false wherever that holds. Be conservative:
+   * a pass that wrongly claims not to change anything leaves later passes
+   * with stale analyses.
+   */
+  virtual bool changes_class_hierarchy() const { return true; }
+
+  /**
+   * Whether run_pass may add, remove or rename methods, change their protos,
+   * or make virtual methods direct or vice versa.
+   */
+  virtual bool changes_method_signatures() const { return true; }
+
+  /**
+   * Whether run_pass only rewrites the code of each method, from that code
+   * and the classes, fields and methods themselves, without looking at the
+   * code of other methods or keeping state across methods. Metrics must add
+   * up over the methods.
+   *
+   * PassManager can then run the pass in other processes, each on a shard of
+   * the methods (see MethodShards.h), if the config asks it to.
+   */
+  virtual bool is_method_local() const { return false; }
+
+  /**
+   * The parts of the program that run_pass may look at or modify.
+   *
+   * PassManager may run adjacent passes concurrently when neither of them
+   * writes anything that the other reads or writes; the result is the same as
+   * running them in the configured order. A pass that narrows these must not
+   * touch anything else, including through shared caches, and must only
+   * call metric functions on the PassManager from the thread that run_pass
+   * was called on. Other threads fail an assertion when they do.
+   */
+  enum Touches : unsigned {
+    TOUCHES_NOTHING = 0,
+    // Method bodies.
+    TOUCHES_CODE = 1u << 0,
+    // Classes, fields and methods themselves: their existence, names, access
+    // flags, protos and super types.
+    TOUCHES_HIERARCHY = 1u << 1,
+    TOUCHES_ANNOTATIONS = 1u << 2,
+    // Source files and debug info items. The debug and position entries of
+    // a method body that has been loaded into IR are part of its code.
+    TOUCHES_DEBUG_INFO = 1u << 3,
+    // Anything outside of the dexes, e.g. the apk's resources and assets.
+    TOUCHES_RESOURCES = 1u << 4,
+    TOUCHES_EVERYTHING = ~0u,
+  };
+
+  virtual unsigned reads() const { return TOUCHES_EVERYTHING; }
+  virtual unsigned writes() const { return TOUCHES_EVERYTHING; }
+
  private:
   std::string m_name;
 };
@@ -9,31 +9,53 @@
 
 #include "PassManager.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
 #if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <execinfo.h>
 #include <signal.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #endif
 #include <unordered_set>
 
+#include <boost/functional/hash.hpp>
+
+#include "Arena.h"
+#include "AsyncIO.h"
 #include "ConfigFiles.h"
 #include "Debug.h"
 #include "DexClass.h"
 #include "DexLoader.h"
 #include "DexOutput.h"
 #include "DexUtil.h"
+#include "HierarchyCache.h"
+#include "IncrementalCache.h"
 #include "InstructionLowering.h"
 #include "InterDex.h"
 #include "IRCode.h"
 #include "IRTypeChecker.h"
+#include "MallocSites.h"
+#include "MemoryCensus.h"
+#include "MethodProfiler.h"
+#include "MethodShards.h"
 #include "PrintSeeds.h"
+#include "ProgramSnapshot.h"
 #include "ProguardMatcher.h"
 #include "ProguardPrintConfiguration.h"
 #include "ProguardReporting.h"
 #include "ReachableClasses.h"
+#include "ScopeView.h"
+#include "StoreDependencies.h"
 #include "Timer.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 redex::ProguardConfiguration empty_pg_config() {
   redex::ProguardConfiguration pg_config;
@@ -56,6 +78,11 @@ PassManager::PassManager(const std::vector<Pass*>& passes,
       m_pg_config(pg_config),
       m_testing_mode(false),
       m_verify_none_mode(verify_none_mode) {
+  unsigned int num_jobs =
+      config.get("jobs", boost::thread::hardware_concurrency()).asUInt();
+  m_thread_pool = std::make_unique<ThreadPool>(
+      std::max(1u, num_jobs), config.get("pin_threads", false).asBool());
+  m_previous_thread_pool = ThreadPool::set_current(m_thread_pool.get());
   init(config);
   if (getenv("PROFILE_COMMAND") && getenv("PROFILE_PASS")) {
     std::string pass_name{getenv("PROFILE_PASS")};
@@ -70,6 +97,10 @@ PassManager::PassManager(const std::vector<Pass*>& passes,
   }
 }
 
+PassManager::~PassManager() {
+  ThreadPool::set_current(m_previous_thread_pool);
+}
+
 void PassManager::init(const Json::Value& config) {
   if (config["redex"].isMember("passes")) {
     auto passes_from_config = config["redex"]["passes"];
@@ -82,32 +113,319 @@ void PassManager::init(const Json::Value& config) {
   }
 }
 
+namespace {
+
+// Returns false and describes the first type error in `error` if the code of
+// the method is inconsistent.
+bool type_check(DexMethod* dex_method,
+                bool polymorphic_constants,
+                bool verify_moves,
+                std::string* error) {
+  IRTypeChecker checker(dex_method);
+  if (polymorphic_constants) {
+    checker.enable_polymorphic_constants();
+  }
+  if (verify_moves) {
+    checker.verify_moves();
+  }
+  checker.run();
+  if (checker.fail()) {
+    *error = checker.what();
+    return false;
+  }
+  return true;
+}
+
+// Hashes everything in the instructions that the type checker looks at.
+uint64_t fingerprint_instructions(const IRCode& code) {
+  size_t seed = code.get_registers_size();
+  for (const auto& mie : code) {
+    boost::hash_combine(seed, static_cast<int>(mie.type));
+    if (mie.type != MFLOW_OPCODE) {
+      continue;
+    }
+    const IRInstruction* insn = mie.insn;
+    boost::hash_combine(seed, static_cast<int>(insn->opcode()));
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      boost::hash_combine(seed, insn->src(i));
+    }
+    if (insn->dests_size() > 0) {
+      boost::hash_combine(seed, insn->dest());
+    }
+    if (insn->has_type()) {
+      boost::hash_combine(seed, insn->get_type());
+    }
+    if (insn->has_field()) {
+      boost::hash_combine(seed, insn->get_field());
+    }
+    if (insn->has_method()) {
+      boost::hash_combine(seed, insn->get_method());
+    }
+    if (insn->has_literal()) {
+      boost::hash_combine(seed, insn->get_literal());
+    }
+  }
+  return seed;
+}
+
+void report_inconsistency(DexMethod* dex_method, const std::string& error) {
+  fprintf(
+      stderr, "ABORT! Inconsistency found in Dex code. %s\n", error.c_str());
+  fprintf(stderr, "Code:\n%s\n", SHOW(dex_method->get_code()));
+}
+
+} // namespace
+
+void PassManager::check_method(DexMethod* dex_method,
+                               bool polymorphic_constants,
+                               bool verify_moves) {
+  std::string error;
+  if (!type_check(dex_method, polymorphic_constants, verify_moves, &error)) {
+    report_inconsistency(dex_method, error);
+    exit(EXIT_FAILURE);
+  }
+}
+
 void PassManager::run_type_checker(const Scope& scope,
                                    bool polymorphic_constants,
-                                   bool verify_moves) {
+                                   bool verify_moves,
+                                   bool fail_fast,
+                                   bool only_modified) {
   TRACE(PM, 1, "Running IRTypeChecker...\n");
   Timer t("IRTypeChecker");
-  walk::parallel::methods(scope, [=](DexMethod* dex_method) {
-    IRTypeChecker checker(dex_method);
-    if (polymorphic_constants) {
-      checker.enable_polymorphic_constants();
-    }
-    if (verify_moves) {
-      checker.verify_moves();
-    }
-    checker.run();
-    if (checker.fail()) {
-      std::string msg = checker.what();
-      fprintf(
-          stderr, "ABORT! Inconsistency found in Dex code. %s\n", msg.c_str());
-      fprintf(stderr, "Code:\n%s\n", SHOW(dex_method->get_code()));
-      exit(EXIT_FAILURE);
+  method_profiler::ScopedPhase profiler_phase("IRTypeChecker");
+  auto phase = method_profiler::current_phase();
+  std::atomic<bool> failed{false};
+  std::mutex errors_lock;
+  std::vector<std::pair<DexMethod*, std::string>> errors;
+  // The unit of work is a single method rather than a class, so that the
+  // classes with a lot of code don't hold up the end of the walk.
+  auto wq = workqueue_foreach<DexMethod*>(
+      [&](DexMethod* dex_method) {
+        if (fail_fast && failed.load(std::memory_order_relaxed)) {
+          return;
+        }
+        method_profiler::MethodTimer timer(phase, dex_method);
+        auto code = dex_method->get_code();
+        auto fingerprint = fingerprint_instructions(*code);
+        if (only_modified && code->type_checked(fingerprint)) {
+          return;
+        }
+        std::string error;
+        if (!type_check(
+                dex_method, polymorphic_constants, verify_moves, &error)) {
+          failed = true;
+          std::lock_guard<std::mutex> guard(errors_lock);
+          errors.emplace_back(dex_method, std::move(error));
+          return;
+        }
+        code->mark_type_checked(fingerprint);
+      },
+      walk::parallel::default_num_threads());
+  walk::methods(scope, [&](DexMethod* dex_method) {
+    // Deferred methods have either never been ballooned or were checked when
+    // they were unballooned, so don't balloon them just to check them.
+    if (dex_method->is_balloon_deferred()) {
+      return;
+    }
+    auto code = dex_method->get_code();
+    if (code != nullptr) {
+      wq.add_item(dex_method, code->count_opcodes());
+    }
+  });
+  wq.run_all();
+  if (errors.empty()) {
+    return;
+  }
+  // Report the errors in a deterministic order, regardless of which workers
+  // found them.
+  std::sort(errors.begin(), errors.end(), [](const auto& a, const auto& b) {
+    return compare_dexmethods(a.first, b.first);
+  });
+  for (const auto& error : errors) {
+    report_inconsistency(error.first, error.second);
+  }
+  exit(EXIT_FAILURE);
+}
+
+size_t PassManager::unballoon_cold_methods(const Scope& scope,
+                                           uint32_t epoch,
+                                           uint32_t cold_after,
+                                           bool polymorphic_constants,
+                                           bool verify_moves) {
+  Timer t("Unballooning cold methods");
+  std::atomic<size_t> unballooned{0};
+  bool regalloc_has_run = m_regalloc_has_run;
+  walk::parallel::methods(scope, [&](DexMethod* method) {
+    if (method->is_balloon_deferred() ||
+        epoch - method->get_code_epoch() < cold_after ||
+        method->get_code() == nullptr) {
+      return;
+    }
+    // The final type check skips deferred methods, so check them now.
+    check_method(method, polymorphic_constants, verify_moves);
+    if (instruction_lowering::unballoon(method, regalloc_has_run)) {
+      ++unballooned;
     }
   });
+  return unballooned;
 }
 
 const std::string PASS_ORDER_KEY = "pass_order";
 
+// The pass that the calling thread is running, while several passes run
+// concurrently.
+thread_local PassManager::PassInfo* t_current_pass_info{nullptr};
+
+bool passes_conflict(const Pass* a, const Pass* b) {
+  return (a->writes() & (b->reads() | b->writes())) != 0 ||
+         (b->writes() & a->reads()) != 0;
+}
+
+// Provided by allocators that count their calls, see util/MallocDebug.cpp.
+extern "C" size_t redex_malloc_count() __attribute__((weak));
+// Provided by allocators that sample allocation sites, see MallocSites.h.
+extern "C" size_t redex_malloc_take_sites(RedexMallocSite* sites,
+                                          size_t max_sites)
+    __attribute__((weak));
+
+/*
+ * The allocation sites sampled since the last call, the heaviest first.
+ * Empty unless the allocator samples them.
+ */
+std::vector<PassManager::PassInfo::Profile::AllocationSite>
+take_allocation_sites(size_t max_sites) {
+  std::vector<PassManager::PassInfo::Profile::AllocationSite> result;
+  if (redex_malloc_take_sites == nullptr || max_sites == 0) {
+    return result;
+  }
+  std::vector<RedexMallocSite> sites(max_sites);
+  sites.resize(redex_malloc_take_sites(sites.data(), sites.size()));
+  for (auto& site : sites) {
+    PassManager::PassInfo::Profile::AllocationSite entry;
+    entry.count = site.count;
+    entry.bytes = site.bytes;
+    int depth = 0;
+    while (depth < int(kMallocSiteFrames) && site.frames[depth] != nullptr) {
+      ++depth;
+    }
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+    char** symbols = backtrace_symbols(site.frames, depth);
+    if (symbols != nullptr) {
+      entry.backtrace.assign(symbols, symbols + depth);
+      free(symbols);
+    }
+#endif
+    result.push_back(std::move(entry));
+  }
+  return result;
+}
+
+struct ResourceUsage {
+  std::chrono::steady_clock::time_point wall;
+  double cpu_s{0};
+  int64_t rss_kb{0};
+  int64_t peak_rss_kb{0};
+  int64_t huge_pages_kb{-1};
+  int64_t allocations{-1};
+};
+
+/*
+ * Resets the high-water mark of the RSS, so that the next sample reports the
+ * peak since now rather than since the process started. Linux only.
+ */
+void reset_peak_rss() {
+#ifdef __linux__
+  FILE* fd = fopen("/proc/self/clear_refs", "w");
+  if (fd != nullptr) {
+    fputs("5", fd);
+    fclose(fd);
+  }
+#endif
+}
+
+ResourceUsage sample_resource_usage() {
+  ResourceUsage usage;
+  usage.wall = std::chrono::steady_clock::now();
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    usage.cpu_s = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                  (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#ifdef __APPLE__
+    usage.peak_rss_kb = ru.ru_maxrss / 1024;
+#else
+    usage.peak_rss_kb = ru.ru_maxrss;
+#endif
+  }
+#endif
+#ifdef __linux__
+  // Unlike ru_maxrss, VmHWM honors reset_peak_rss().
+  FILE* fd = fopen("/proc/self/status", "r");
+  if (fd != nullptr) {
+    char line[256];
+    while (fgets(line, sizeof(line), fd) != nullptr) {
+      long kb;
+      if (sscanf(line, "VmRSS: %ld kB", &kb) == 1) {
+        usage.rss_kb = kb;
+      } else if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+        usage.peak_rss_kb = kb;
+      }
+    }
+    fclose(fd);
+  }
+  // Whether the huge pages asked for with madvise() were granted only shows
+  // here, which makes runs with and without them comparable.
+  fd = fopen("/proc/self/smaps_rollup", "r");
+  if (fd != nullptr) {
+    char line[256];
+    while (fgets(line, sizeof(line), fd) != nullptr) {
+      long kb;
+      if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+        usage.huge_pages_kb = kb;
+      }
+    }
+    fclose(fd);
+  }
+#endif
+  if (redex_malloc_count != nullptr) {
+    usage.allocations = redex_malloc_count();
+  }
+  return usage;
+}
+
+/*
+ * A cheap summary of each method's code, to tell which methods a pass has
+ * changed. Edits that keep the instruction count and size go unnoticed.
+ */
+using CodeFingerprints = std::unordered_map<const DexMethod*, size_t>;
+
+CodeFingerprints fingerprint_code(const Scope& scope) {
+  CodeFingerprints fingerprints;
+  walk::code(scope, [&](DexMethod* method, IRCode& code) {
+    fingerprints.emplace(method,
+                         code.count_opcodes() * 31 + code.sum_opcode_sizes());
+  });
+  return fingerprints;
+}
+
+size_t count_methods_touched(const CodeFingerprints& before,
+                             const CodeFingerprints& after) {
+  size_t touched = 0;
+  for (const auto& pair : after) {
+    auto it = before.find(pair.first);
+    if (it == before.end() || it->second != pair.second) {
+      ++touched;
+    }
+  }
+  for (const auto& pair : before) {
+    if (after.count(pair.first) == 0) {
+      ++touched;
+    }
+  }
+  return touched;
+}
+
 /*
  * Appends the PID of the current process to :cmd and invokes it.
  */
@@ -134,6 +452,53 @@ pid_t spawn_profiler(const std::string& cmd) {
 #endif
 }
 
+/*
+ * Groups the stores into waves, such that every store comes after the stores
+ * it depends on, and the stores of a wave don't depend on each other. A store
+ * goes in the wave after the latest one of its dependencies. Returns nothing
+ * if the dependencies are cyclic.
+ */
+std::vector<std::vector<size_t>> store_waves(const DexStoresVector& stores) {
+  StoreDependencies deps(stores);
+  std::vector<size_t> closure_size(stores.size());
+  for (size_t i = 0; i < stores.size(); ++i) {
+    for (size_t j = 0; j < stores.size(); ++j) {
+      if (i == j || !deps.can_refer_to(i, j)) {
+        continue;
+      }
+      if (deps.can_refer_to(j, i)) {
+        return {};
+      }
+      ++closure_size[i];
+    }
+  }
+  // The dependencies of a store have smaller closures than its own.
+  std::vector<size_t> order(stores.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return closure_size[a] < closure_size[b];
+  });
+  std::vector<size_t> level(stores.size());
+  std::vector<std::vector<size_t>> waves;
+  for (auto i : order) {
+    for (size_t j = 0; j < stores.size(); ++j) {
+      if (i != j && deps.can_refer_to(i, j)) {
+        level[i] = std::max(level[i], level[j] + 1);
+      }
+    }
+    if (level[i] >= waves.size()) {
+      waves.resize(level[i] + 1);
+    }
+    waves[level[i]].push_back(i);
+  }
+  for (auto& wave : waves) {
+    std::sort(wave.begin(), wave.end());
+  }
+  return waves;
+}
+
 pid_t kill_and_wait(pid_t pid, int sig) {
 #ifdef _POSIX_VERSION
   kill(pid, sig);
@@ -147,39 +512,50 @@ pid_t kill_and_wait(pid_t pid, int sig) {
 void PassManager::run_passes(DexStoresVector& stores,
                              const Scope& external_classes,
                              ConfigFiles& cfg) {
-  DexStoreClassesIterator it(stores);
-  Scope scope = build_class_scope(it);
-  {
-    Timer t("Initializing reachable classes");
-    init_reachable_classes(
-        scope, m_config, m_pg_config, cfg.get_no_optimizations_annos());
-  }
-  {
-    Timer t("Processing proguard rules");
-    process_proguard_rules(
-        cfg.get_proguard_map(), scope, external_classes, &m_pg_config);
-  }
-  char* seeds_output_file = std::getenv("REDEX_SEEDS_FILE");
-  if (seeds_output_file) {
-    std::string seed_filename = seeds_output_file;
-    Timer t("Writing seeds file " + seed_filename);
-    std::ofstream seeds_file(seed_filename);
-    redex::print_seeds(seeds_file, cfg.get_proguard_map(), scope, false, false);
-  }
-  if (!cfg.get_printseeds().empty()) {
-    Timer t("Writing seeds to file " + cfg.get_printseeds());
-    std::ofstream seeds_file(cfg.get_printseeds());
-    redex::print_seeds(seeds_file, cfg.get_proguard_map(), scope);
-    std::ofstream config_file(cfg.get_printseeds() + ".pro");
-    redex::show_configuration(config_file, scope, m_pg_config);
-    std::ofstream incoming(cfg.get_printseeds() + ".incoming");
-    redex::print_classes(incoming, cfg.get_proguard_map(), scope);
-    std::ofstream shrinking_file(cfg.get_printseeds() + ".allowshrinking");
-    redex::print_seeds(
-        shrinking_file, cfg.get_proguard_map(), scope, true, false);
-    std::ofstream obfuscation_file(cfg.get_printseeds() + ".allowobfuscation");
-    redex::print_seeds(
-        obfuscation_file, cfg.get_proguard_map(), scope, false, true);
+  m_scope_view = std::make_unique<ScopeView>(stores);
+  auto scope = m_scope_view->get();
+  // Writes the -printseeds reports in the background.
+  async_io::AsyncWriter report_writer;
+  // Where to resume from a snapshot, whose ReferencedState already has what
+  // the keep rules and reachability analysis put there.
+  size_t resume_at = m_resume_state.get("resume_at", 0).asUInt();
+  // Shard workers start from the keep state of their coordinator.
+  bool reachability_done =
+      m_resume_state.get("reachability_done", false).asBool();
+  if (resume_at == 0 && !reachability_done) {
+    {
+      Timer t("Initializing reachable classes");
+      init_reachable_classes(
+          *scope, m_config, m_pg_config, cfg.get_no_optimizations_annos());
+    }
+    {
+      Timer t("Processing proguard rules");
+      process_proguard_rules(
+          cfg.get_proguard_map(), *scope, external_classes, &m_pg_config);
+    }
+    char* seeds_output_file = std::getenv("REDEX_SEEDS_FILE");
+    if (seeds_output_file || !cfg.get_printseeds().empty()) {
+      Timer t("Formatting the seeds");
+      // All the reports come out of one parallel walk, and are written while
+      // the passes run.
+      auto reports =
+          redex::format_seeds_reports(cfg.get_proguard_map(), *scope);
+      if (seeds_output_file) {
+        report_writer.write(seeds_output_file, reports.seeds);
+      }
+      if (!cfg.get_printseeds().empty()) {
+        const auto& prefix = cfg.get_printseeds();
+        std::ostringstream config;
+        redex::show_configuration(config, *scope, m_pg_config);
+        report_writer.write(prefix, std::move(reports.seeds));
+        report_writer.write(prefix + ".pro", config.str());
+        report_writer.write(prefix + ".incoming", std::move(reports.classes));
+        report_writer.write(prefix + ".allowshrinking",
+                            std::move(reports.allowshrinking));
+        report_writer.write(prefix + ".allowobfuscation",
+                            std::move(reports.allowobfuscation));
+      }
+    }
   }
 
   // Count the number of appearances of each pass name.
@@ -204,6 +580,18 @@ void PassManager::run_passes(DexStoresVector& stores,
     m_pass_info[i].total_repeat = pass_repeats.at(pass);
     m_pass_info[i].name = pass->name() + "#" + std::to_string(count + 1);
     m_pass_info[i].metrics[PASS_ORDER_KEY] = i;
+    if (i < resume_at) {
+      const auto& saved = m_resume_state["passes"][Json::ArrayIndex(i)];
+      always_assert_log(saved["name"].asString() == m_pass_info[i].name,
+                        "The snapshot was taken with %s as pass %zu, not %s",
+                        saved["name"].asString().c_str(),
+                        i,
+                        m_pass_info[i].name.c_str());
+      for (const auto& key : saved["metrics"].getMemberNames()) {
+        m_pass_info[i].metrics[key] = saved["metrics"][key].asInt();
+      }
+      continue;
+    }
     m_current_pass_info = &m_pass_info[i];
     pass->eval_pass(stores, cfg, *this);
     m_current_pass_info = nullptr;
@@ -218,47 +606,471 @@ void PassManager::run_passes(DexStoresVector& stores,
       type_checker_args.get("polymorphic_constants", false).asBool() ||
       verify_none_enabled();
   bool verify_moves = type_checker_args.get("verify_moves", false).asBool();
+  // Stop checking at the first inconsistency instead of reporting them all.
+  bool fail_fast = type_checker_args.get("fail_fast", false).asBool();
+  // Only check again the methods whose code changed since it was last
+  // checked. Passes that may change method signatures or the class hierarchy
+  // can break the code they don't touch, so everything gets checked after
+  // them, and before generating the output.
+  bool incremental = type_checker_args.get("incremental", false).asBool();
+  bool signatures_changed = true;
   std::unordered_set<std::string> trigger_passes;
 
   for (auto& trigger_pass : type_checker_args["run_after_passes"]) {
     trigger_passes.insert(trigger_pass.asString());
   }
 
-  for (size_t i = 0; i < m_activated_passes.size(); ++i) {
-    Pass* pass = m_activated_passes[i];
-    TRACE(PM, 1, "Running %s...\n", pass->name().c_str());
-    Timer t(pass->name() + " (run)");
-    m_current_pass_info = &m_pass_info[i];
-    bool run_profiler{m_profiler_info && m_profiler_info->pass == pass};
-    pid_t profiler{-1};
-    if (run_profiler) {
-      fprintf(stderr, "Running profiler...\n");
-      profiler = spawn_profiler(m_profiler_info->command);
+  auto wants_type_checker = [&](const Pass* pass) {
+    return run_after_each_pass || trigger_passes.count(pass->name()) > 0;
+  };
+  // Profiled and benchmarked passes run alone.
+  auto is_profiled = [&](const Pass* pass) {
+    return (m_profiler_info && m_profiler_info->pass == pass) ||
+           (m_bench_pass_info && m_bench_pass_info->pass == pass);
+  };
+  bool concurrent_passes = m_config.get("concurrent_passes", true).asBool();
+  bool profile_methods_touched =
+      m_config.get("profile_methods_touched", false).asBool();
+  // Keeps this many of the slowest (pass, method) pairs, see MethodProfiler.h.
+  int64_t profile_slowest_methods =
+      m_config.get("profile_slowest_methods", 0).asInt64();
+  if (profile_slowest_methods > 0) {
+    method_profiler::enable(profile_slowest_methods);
+  }
+  // Once the RSS goes over this many MB after a pass, methods whose code no
+  // pass asked for in the last "unballoon_after_passes" batches of passes are
+  // lowered back to DexCode, and ballooned again if a later pass wants them.
+  // Walking the code of every method, as "profile_methods_touched" and the
+  // type checker do, keeps all of them in use.
+  int64_t unballoon_rss_threshold_kb =
+      m_config.get("unballoon_rss_threshold_mb", 0).asInt64() * 1024;
+  uint32_t unballoon_after_passes =
+      std::max(1u, m_config.get("unballoon_after_passes", 1).asUInt());
+  // Hashes the program after every batch of passes, to find the first pass
+  // whose output differs between runs.
+  bool hash_program = m_config.get("hash_program_after_passes", false).asBool();
+  // How many of the sites that allocated the most to report for each pass,
+  // when the allocator samples them.
+  size_t malloc_top_sites = m_config.get("malloc_top_sites", 10).asUInt();
+  auto elapsed_s = [](std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  };
+
+  // Writes a program snapshot after this pass, which is either the name of a
+  // pass, for its first run, or the name of one of its runs, like "Pass#2".
+  auto snapshot_after_pass =
+      m_config.get("snapshot_after_pass", "").asString();
+  size_t snapshot_index = m_activated_passes.size();
+  if (!snapshot_after_pass.empty()) {
+    for (size_t i = 0; i < m_pass_info.size(); ++i) {
+      if (m_pass_info[i].name == snapshot_after_pass ||
+          (m_pass_info[i].repeat == 0 &&
+           m_pass_info[i].pass->name() == snapshot_after_pass)) {
+        snapshot_index = i;
+        break;
+      }
     }
-    pass->run_pass(stores, cfg, *this);
-    if (run_profiler) {
-      fprintf(stderr, "Waiting for profiler to finish...\n");
-      kill_and_wait(profiler, SIGINT);
+    always_assert_log(snapshot_index < m_activated_passes.size(),
+                      "No activated pass named %s!",
+                      snapshot_after_pass.c_str());
+    always_assert_log(!m_config.get("snapshot_dir", "").asString().empty(),
+                      "snapshot_after_pass needs a snapshot_dir");
+  }
+  // Takes a memory census after these passes, which are named like
+  // snapshot_after_pass, except that the name of a pass means all its runs.
+  std::vector<bool> wants_census(m_pass_info.size());
+  for (const auto& name : m_config.get("memory_census_after_passes",
+                                       Json::arrayValue)) {
+    bool found = false;
+    for (size_t i = 0; i < m_pass_info.size(); ++i) {
+      if (m_pass_info[i].name == name.asString() ||
+          m_pass_info[i].pass->name() == name.asString()) {
+        wants_census[i] = true;
+        found = true;
+      }
     }
-    if (run_after_each_pass || trigger_passes.count(pass->name()) > 0) {
-      scope = build_class_scope(it);
-      run_type_checker(scope, polymorphic_constants, verify_moves);
+    always_assert_log(
+        found, "No activated pass named %s!", name.asString().c_str());
+  }
+  if (!m_resume_state.isNull()) {
+    m_regalloc_has_run =
+        m_resume_state.get("regalloc_has_run", false).asBool();
+  }
+
+  // Runs of the passes listed in "sharded_passes" run in worker processes,
+  // each on a shard of the methods, see MethodShards.h. Profiled and
+  // benchmarked passes run here.
+  std::vector<bool> sharded(m_pass_info.size());
+  for (const auto& name :
+       m_config.get("sharded_passes", Json::objectValue)
+           .get("passes", Json::arrayValue)) {
+    bool found = false;
+    for (size_t i = 0; i < m_pass_info.size(); ++i) {
+      const Pass* pass = m_pass_info[i].pass;
+      if (pass->name() == name.asString()) {
+        always_assert_log(pass->is_method_local(),
+                          "%s can't run on shards of the methods",
+                          pass->name().c_str());
+        sharded[i] = i >= resume_at && !is_profiled(pass);
+        found = true;
+      }
     }
-    m_current_pass_info = nullptr;
+    always_assert_log(
+        found, "No activated pass named %s!", name.asString().c_str());
+  }
+
+  m_hierarchy_cache = std::make_unique<HierarchyCache>(*m_scope_view);
+  size_t begin = resume_at;
+  while (begin < m_activated_passes.size()) {
+    // Extend the batch with the following passes for as long as they can
+    // overlap with every pass already in it. A pass that wants the type
+    // checker, a snapshot or a memory census after it always ends its batch.
+    // Sharded passes are batched with the sharded passes that follow them
+    // instead, and run one after the other in the workers.
+    size_t end = begin + 1;
+    auto ends_batch = [&](size_t i) {
+      return wants_type_checker(m_activated_passes[i]) ||
+             i == snapshot_index || wants_census[i];
+    };
+    while (sharded[begin] && end < m_activated_passes.size() &&
+           sharded[end] && !ends_batch(end - 1)) {
+      ++end;
+    }
+    while (!sharded[begin] && concurrent_passes &&
+           end < m_activated_passes.size() && !sharded[end] &&
+           !ends_batch(end - 1)) {
+      Pass* next = m_activated_passes[end];
+      if (is_profiled(next) || is_profiled(m_activated_passes[begin])) {
+        break;
+      }
+      bool fits = true;
+      for (size_t j = begin; j < end && fits; ++j) {
+        fits = m_activated_passes[j] != next &&
+               !passes_conflict(m_activated_passes[j], next);
+      }
+      if (!fits) {
+        break;
+      }
+      ++end;
+    }
+
+    CodeFingerprints fingerprints_before;
+    if (profile_methods_touched) {
+      fingerprints_before = fingerprint_code(*m_scope_view->get());
+    }
+    reset_peak_rss();
+    // Drop what was sampled in between passes.
+    take_allocation_sites(malloc_top_sites);
+    auto usage_before = sample_resource_usage();
+    auto code_epoch = DexMethod::advance_code_epoch();
+
+    bool bench_run = false;
+    if (m_bench_pass_info &&
+        m_bench_pass_info->pass == m_activated_passes[begin]) {
+      bench_run = fork_bench_runs();
+      if (!bench_run) {
+        m_hierarchy_cache.reset();
+        m_scope_view.reset();
+        return;
+      }
+    }
+
+    if (sharded[begin]) {
+      run_sharded(begin, end, stores, cfg);
+      for (size_t j = begin; j < end; ++j) {
+        m_pass_info[j].profile.wall_s = elapsed_s(usage_before.wall);
+      }
+    } else if (end - begin == 1) {
+      Pass* pass = m_activated_passes[begin];
+      TRACE(PM, 1, "Running %s...\n", pass->name().c_str());
+      Timer t(pass->name() + " (run)");
+      method_profiler::ScopedPhase profiler_phase(pass->name());
+      m_current_pass_info = &m_pass_info[begin];
+      bool run_profiler = is_profiled(pass);
+      pid_t profiler{-1};
+      if (run_profiler) {
+        fprintf(stderr, "Running profiler...\n");
+        profiler = spawn_profiler(m_profiler_info->command);
+      }
+      run_pass(pass, stores, cfg);
+      m_pass_info[begin].profile.wall_s = elapsed_s(usage_before.wall);
+      if (run_profiler) {
+        fprintf(stderr, "Waiting for profiler to finish...\n");
+        kill_and_wait(profiler, SIGINT);
+      }
+      m_current_pass_info = nullptr;
+      if (bench_run) {
+        double wall_s = m_pass_info[begin].profile.wall_s;
+        always_assert(write(m_bench_pass_info->report_fd,
+                            &wall_s,
+                            sizeof(wall_s)) == sizeof(wall_s));
+        fflush(nullptr);
+        _exit(EXIT_SUCCESS);
+      }
+    } else {
+      Timer t("Running " + std::to_string(end - begin) +
+              " passes concurrently");
+      m_running_concurrently = true;
+      m_thread_pool->run(end - begin, [&](size_t k) {
+        Pass* pass = m_activated_passes[begin + k];
+        TRACE(PM, 1, "Running %s...\n", pass->name().c_str());
+        Timer t(pass->name() + " (run)");
+        method_profiler::ScopedPhase profiler_phase(pass->name());
+        auto start = std::chrono::steady_clock::now();
+        t_current_pass_info = &m_pass_info[begin + k];
+        run_pass(pass, stores, cfg);
+        t_current_pass_info->profile.wall_s = elapsed_s(start);
+        t_current_pass_info = nullptr;
+      });
+      m_running_concurrently = false;
+    }
+
+    for (size_t j = begin; j < end; ++j) {
+      auto arena_it = m_scratch_arenas.find(&m_pass_info[j]);
+      if (arena_it != m_scratch_arenas.end()) {
+        m_pass_info[j].profile.scratch_kb =
+            arena_it->second->bytes_reserved() / 1024;
+        m_scratch_arenas.erase(arena_it);
+      }
+    }
+    auto usage_after = sample_resource_usage();
+    auto allocation_sites = take_allocation_sites(malloc_top_sites);
+    // Passes may have replaced classes of a dex in place.
+    m_scope_view->invalidate();
+    int64_t methods_touched = -1;
+    if (profile_methods_touched) {
+      methods_touched = count_methods_touched(
+          fingerprints_before, fingerprint_code(*m_scope_view->get()));
+    }
+    if (wants_census[end - 1]) {
+      Timer t("Taking a memory census after " + m_pass_info[end - 1].name);
+      m_pass_info[end - 1].memory_census = memory_census::to_json(
+          memory_census::take(*m_scope_view->get()));
+    }
+    if (hash_program) {
+      Timer t("Hashing the program after " + m_pass_info[end - 1].name);
+      m_pass_info[end - 1].program_hash = program_hash::hash(stores);
+    }
+    for (size_t j = begin; j < end; ++j) {
+      auto& profile = m_pass_info[j].profile;
+      profile.cpu_s = usage_after.cpu_s - usage_before.cpu_s;
+      profile.peak_rss_kb = usage_after.peak_rss_kb;
+      profile.rss_delta_kb = usage_after.rss_kb - usage_before.rss_kb;
+      profile.huge_pages_kb = usage_after.huge_pages_kb;
+      profile.methods_touched = methods_touched;
+      if (usage_before.allocations >= 0) {
+        profile.allocations =
+            usage_after.allocations - usage_before.allocations;
+      }
+      profile.allocation_sites = allocation_sites;
+    }
+
+    if (unballoon_rss_threshold_kb > 0 &&
+        usage_after.rss_kb > unballoon_rss_threshold_kb) {
+      auto unballooned = unballoon_cold_methods(*m_scope_view->get(),
+                                                code_epoch,
+                                                unballoon_after_passes,
+                                                polymorphic_constants,
+                                                verify_moves);
+      TRACE(PM,
+            1,
+            "RSS is %ldMB, unballooned %zu cold methods\n",
+            usage_after.rss_kb / 1024,
+            unballooned);
+    }
+
+    for (size_t j = begin; j < end; ++j) {
+      auto cache_it = m_incremental_caches.find(&m_pass_info[j]);
+      if (cache_it != m_incremental_caches.end()) {
+        auto& metrics = m_pass_info[j].metrics;
+        metrics["incremental_cache_hits"] = cache_it->second->hits();
+        metrics["incremental_cache_misses"] = cache_it->second->misses();
+        m_incremental_caches.erase(cache_it);
+      }
+    }
+
+    // Passes may have edited the member lists of classes directly.
+    RedexContext::advance_member_epoch();
+    for (size_t j = begin; j < end; ++j) {
+      m_hierarchy_cache->invalidate(
+          m_activated_passes[j]->changes_class_hierarchy(),
+          m_activated_passes[j]->changes_method_signatures());
+      signatures_changed |=
+          m_activated_passes[j]->changes_class_hierarchy() ||
+          m_activated_passes[j]->changes_method_signatures();
+    }
+    if (wants_type_checker(m_activated_passes[end - 1])) {
+      scope = m_scope_view->get();
+      run_type_checker(*scope,
+                       polymorphic_constants,
+                       verify_moves,
+                       fail_fast,
+                       incremental && !signatures_changed);
+      signatures_changed = false;
+    }
+    if (end - 1 == snapshot_index) {
+      write_snapshot(m_config["snapshot_dir"].asString(), stores, cfg, end);
+    }
+    begin = end;
   }
+  m_hierarchy_cache.reset();
 
   // Always run the type checker before generating the optimized dex code.
-  scope = build_class_scope(it);
-  run_type_checker(scope, polymorphic_constants, verify_moves);
+  scope = m_scope_view->get();
+  run_type_checker(*scope,
+                   polymorphic_constants,
+                   verify_moves,
+                   fail_fast,
+                   /* only_modified */ false);
 
   if (!cfg.get_printseeds().empty()) {
     Timer t("Writing outgoing classes to file " + cfg.get_printseeds() +
             ".outgoing");
     // Recompute the scope.
-    scope = build_class_scope(it);
-    std::ofstream outgoing(cfg.get_printseeds() + ".outgoing");
-    redex::print_classes(outgoing, cfg.get_proguard_map(), scope);
+    scope = m_scope_view->get();
+    report_writer.write(cfg.get_printseeds() + ".outgoing",
+                        redex::format_classes(cfg.get_proguard_map(), *scope));
   }
+  report_writer.flush();
+  m_scope_view.reset();
+}
+
+void PassManager::write_snapshot(const std::string& dir,
+                                 DexStoresVector& stores,
+                                 ConfigFiles& cfg,
+                                 size_t resume_at) {
+  TRACE(PM, 1, "Writing a program snapshot to %s...\n", dir.c_str());
+  Json::Value state;
+  state["resume_at"] = Json::UInt(resume_at);
+  state["regalloc_has_run"] = m_regalloc_has_run;
+  Json::Value passes(Json::arrayValue);
+  for (size_t i = 0; i < resume_at; ++i) {
+    Json::Value pass;
+    pass["name"] = m_pass_info[i].name;
+    Json::Value metrics(Json::objectValue);
+    for (const auto& pair : m_pass_info[i].metrics) {
+      metrics[pair.first] = pair.second;
+    }
+    pass["metrics"] = metrics;
+    passes.append(pass);
+  }
+  state["passes"] = passes;
+  program_snapshot::write(dir, stores, cfg, state);
+}
+
+void PassManager::run_sharded(size_t begin,
+                              size_t end,
+                              DexStoresVector& stores,
+                              ConfigFiles& cfg) {
+  auto sharding = m_config["sharded_passes"];
+  auto dir = sharding["dir"].asString();
+  always_assert_log(!dir.empty(), "sharded_passes needs a dir");
+  auto num_shards = std::max(1u, sharding.get("num_shards", 1).asUInt());
+  // Each run of sharded passes gets a directory of its own.
+  dir += "/" + std::to_string(begin);
+  Timer t("Running " + std::to_string(end - begin) + " passes on " +
+          std::to_string(num_shards) + " shards");
+
+  // The workers run the passes as they are configured here, and leave the
+  // rest of what this run does to it.
+  Json::Value worker_config = m_config;
+  for (const char* key : {"sharded_passes",
+                          "snapshot_after_pass",
+                          "memory_census_after_passes",
+                          "hash_program_after_passes",
+                          "proguard_map",
+                          "printseeds",
+                          "trace_timeline"}) {
+    worker_config.removeMember(key);
+  }
+  Json::Value passes(Json::arrayValue);
+  for (size_t j = begin; j < end; ++j) {
+    // The name as configured, which the config of the pass is under.
+    passes.append(m_config["redex"].isMember("passes")
+                      ? m_config["redex"]["passes"][Json::ArrayIndex(j)]
+                      : Json::Value(m_activated_passes[j]->name()));
+  }
+  worker_config["redex"]["passes"] = passes;
+  Json::Value worker_state;
+  worker_state["reachability_done"] = true;
+  worker_state["regalloc_has_run"] = m_regalloc_has_run;
+  worker_state["verify_none_mode"] = m_verify_none_mode;
+  worker_state["proguard_rules"] = !no_proguard_rules();
+
+  method_shards::write(
+      dir, stores, cfg, worker_config, worker_state, num_shards);
+  method_shards::run_workers(
+      dir, num_shards, sharding.get("worker_command", "").asString());
+  // The metrics of the workers add up, except for the order of the passes.
+  for (const auto& result : method_shards::read_results(dir, num_shards)) {
+    for (size_t j = begin; j < end; ++j) {
+      const auto& metrics =
+          result["passes"][Json::ArrayIndex(j - begin)]["metrics"];
+      for (const auto& key : metrics.getMemberNames()) {
+        if (key != PASS_ORDER_KEY) {
+          m_pass_info[j].metrics[key] += metrics[key].asInt();
+        }
+      }
+    }
+    m_regalloc_has_run |= result["regalloc_has_run"].asBool();
+  }
+}
+
+void PassManager::set_bench_pass(const std::string& pass_name,
+                                 size_t iterations) {
+  auto pass_it = std::find_if(
+      m_activated_passes.begin(),
+      m_activated_passes.end(),
+      [&pass_name](const Pass* pass) { return pass->name() == pass_name; });
+  always_assert_log(pass_it != m_activated_passes.end(),
+                    "No activated pass named %s!",
+                    pass_name.c_str());
+  m_bench_pass_info = BenchPassInfo{*pass_it, iterations};
+}
+
+bool PassManager::fork_bench_runs() {
+#ifdef _POSIX_VERSION
+  auto& info = *m_bench_pass_info;
+  for (size_t i = 0; i < info.iterations; ++i) {
+    int fds[2];
+    always_assert_log(pipe(fds) == 0, "Failed to create a pipe");
+    // Flush first, so that the output buffered so far isn't written by every
+    // process.
+    fflush(nullptr);
+    auto child = fork();
+    always_assert_log(child != -1, "Failed to fork");
+    if (child == 0) {
+      close(fds[0]);
+      info.report_fd = fds[1];
+      // Only the forking thread exists in the child, and the destructor of
+      // the pool would wait forever for the others. Leak it and start anew.
+      auto num_threads = m_thread_pool->size();
+      auto pinned = m_thread_pool->num_nodes() > 0;
+      m_thread_pool.release();
+      m_thread_pool = std::make_unique<ThreadPool>(num_threads, pinned);
+      ThreadPool::set_current(m_thread_pool.get());
+      return true;
+    }
+    // The runs are one at a time, so that they don't compete for the CPUs.
+    close(fds[1]);
+    double wall_s;
+    auto n = read(fds[0], &wall_s, sizeof(wall_s));
+    close(fds[0]);
+    int status;
+    waitpid(child, &status, 0);
+    always_assert_log(n == sizeof(wall_s) && WIFEXITED(status) &&
+                          WEXITSTATUS(status) == EXIT_SUCCESS,
+                      "Benchmark run %zu of %s failed",
+                      i,
+                      info.pass->name().c_str());
+    m_bench_pass_times.push_back(wall_s);
+  }
+#else
+  fprintf(stderr, "fork_bench_runs() is a no-op\n");
+#endif
+  return false;
 }
 
 void PassManager::activate_pass(const char* name, const Json::Value& cfg) {
@@ -280,18 +1092,113 @@ void PassManager::activate_pass(const char* name, const Json::Value& cfg) {
   always_assert_log(false, "No pass named %s!", name);
 }
 
+HierarchyCache& PassManager::get_hierarchy_cache() {
+  always_assert_log(m_hierarchy_cache != nullptr, "No pass is running");
+  return *m_hierarchy_cache;
+}
+
+ScopeView& PassManager::get_scope_view() {
+  always_assert_log(m_scope_view != nullptr, "No pass is running");
+  return *m_scope_view;
+}
+
+void PassManager::run_pass(Pass* pass,
+                           DexStoresVector& stores,
+                           ConfigFiles& cfg) {
+  if (!pass->is_store_local()) {
+    pass->run_pass(stores, cfg, *this);
+    return;
+  }
+  std::vector<std::vector<size_t>> waves;
+  if (m_config.get("store_parallel_passes", true).asBool()) {
+    waves = store_waves(stores);
+    if (waves.empty() && !stores.empty()) {
+      TRACE(PM, 1, "Store dependencies are cyclic, running %s serially\n",
+            pass->name().c_str());
+    }
+  }
+  if (waves.empty()) {
+    for (size_t i = 0; i < stores.size(); ++i) {
+      pass->run_pass_on_store(stores, i, cfg, *this);
+    }
+    return;
+  }
+  auto info = current_pass_info();
+  for (const auto& wave : waves) {
+    m_thread_pool->run(wave.size(), [&](size_t k) {
+      auto store_idx = wave[k];
+      TRACE(PM, 2, "Running %s on store %s\n", pass->name().c_str(),
+            stores[store_idx].get_name().c_str());
+      // The calling thread runs indices too, from within its own pass.
+      auto previous = t_current_pass_info;
+      t_current_pass_info = info;
+      pass->run_pass_on_store(stores, store_idx, cfg, *this);
+      t_current_pass_info = previous;
+    });
+  }
+}
+
+IncrementalCache* PassManager::get_incremental_cache() {
+  auto dir = m_config.get("incremental_cache_dir", "").asString();
+  if (dir.empty()) {
+    return nullptr;
+  }
+  auto info = running_pass_info("an incremental cache");
+  std::lock_guard<std::mutex> lock(m_incremental_caches_lock);
+  auto& cache = m_incremental_caches[info];
+  if (cache == nullptr) {
+    const auto& name = info->pass->name();
+    cache = std::make_unique<IncrementalCache>(
+        dir, name, m_config.get(name, Json::Value()));
+  }
+  return cache.get();
+}
+
+Arena& PassManager::get_scratch_arena() {
+  auto info = running_pass_info("a scratch arena");
+  std::lock_guard<std::mutex> lock(m_scratch_arenas_lock);
+  auto& arena = m_scratch_arenas[info];
+  if (arena == nullptr) {
+    arena = std::make_unique<Arena>();
+  }
+  return *arena;
+}
+
+PassManager::PassInfo* PassManager::current_pass_info() const {
+  return t_current_pass_info != nullptr ? t_current_pass_info
+                                        : m_current_pass_info;
+}
+
+PassManager::PassInfo* PassManager::running_pass_info(const char* what) const {
+  auto info = current_pass_info();
+  // The pool threads that work for the concurrent passes can't tell which
+  // one they work for, so that work must hand what it records back to the
+  // thread of its pass instead.
+  always_assert_log(info != nullptr || !m_running_concurrently,
+                    "Asked for %s from a thread that doesn't run any of the "
+                    "passes running concurrently\n",
+                    what);
+  always_assert_log(info != nullptr, "Asked for %s with no pass running\n",
+                    what);
+  return info;
+}
+
 void PassManager::incr_metric(const std::string& key, int value) {
-  always_assert_log(m_current_pass_info != nullptr, "No current pass!");
-  (m_current_pass_info->metrics)[key] += value;
+  auto info = running_pass_info("a metric");
+  std::lock_guard<std::mutex> lock(m_metrics_lock);
+  (info->metrics)[key] += value;
 }
 
 void PassManager::set_metric(const std::string& key, int value) {
-  always_assert_log(m_current_pass_info != nullptr, "No current pass!");
-  (m_current_pass_info->metrics)[key] = value;
+  auto info = running_pass_info("a metric");
+  std::lock_guard<std::mutex> lock(m_metrics_lock);
+  (info->metrics)[key] = value;
 }
 
 int PassManager::get_metric(const std::string& key) {
-  return (m_current_pass_info->metrics)[key];
+  auto info = running_pass_info("a metric");
+  std::lock_guard<std::mutex> lock(m_metrics_lock);
+  return (info->metrics)[key];
 }
 
 const std::vector<PassManager::PassInfo>& PassManager::get_pass_info() const {
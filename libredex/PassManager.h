@@ -10,15 +10,25 @@
 #pragma once
 
 #include "Pass.h"
+#include "ProgramHash.h"
 #include "ProguardConfiguration.h"
+#include "ThreadPool.h"
 
+#include <atomic>
 #include <boost/optional.hpp>
 #include <json/json.h>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+class Arena;
+class HierarchyCache;
+class IncrementalCache;
+class ScopeView;
+
 class PassManager {
  public:
   PassManager(const std::vector<Pass*>& passes,
@@ -30,6 +40,8 @@ class PassManager {
               const Json::Value& config = Json::Value(Json::objectValue),
               bool verify_none_mode = false);
 
+  ~PassManager();
+
   struct PassInfo {
     const Pass* pass;
     size_t order; // zero-based
@@ -37,6 +49,48 @@ class PassManager {
     size_t total_repeat;
     std::string name;
     std::unordered_map<std::string, int> metrics;
+
+    // What run_pass cost. Passes that ran concurrently are each charged the
+    // CPU time, memory, allocations and touched methods of their whole group.
+    struct Profile {
+      double wall_s{0};
+      // User and system time, summed over all threads.
+      double cpu_s{0};
+      // The highest RSS reached during the pass, where the platform can reset
+      // the high-water mark between passes, or since the process started.
+      int64_t peak_rss_kb{0};
+      int64_t rss_delta_kb{0};
+      // Methods that gained, lost or changed the size of their code. Only
+      // counted if "profile_methods_touched" is set in the config.
+      int64_t methods_touched{-1};
+      // Only counted if the allocator provides redex_malloc_count(), as the
+      // one in util/MallocDebug.cpp does.
+      int64_t allocations{-1};
+      // The size of the scratch arena released when the pass returned.
+      int64_t scratch_kb{0};
+      // The anonymous memory backed by transparent huge pages once the pass
+      // returned, see "arena_huge_pages". Linux only.
+      int64_t huge_pages_kb{-1};
+      // The sites that allocated the most bytes, "malloc_top_sites" of them
+      // at most. Only sampled if the allocator provides
+      // redex_malloc_take_sites(), as the one in util/MallocDebug.cpp does.
+      struct AllocationSite {
+        // Symbolized frames, innermost first.
+        std::vector<std::string> backtrace;
+        uint64_t count;
+        uint64_t bytes;
+      };
+      std::vector<AllocationSite> allocation_sites;
+    } profile;
+
+    // The memory census taken after the pass, if "memory_census_after_passes"
+    // asked for one, see MemoryCensus.h. Null otherwise.
+    Json::Value memory_census;
+
+    // The hash of the program after the pass, if "hash_program_after_passes"
+    // is set, see ProgramHash.h. Passes that ran concurrently are hashed
+    // together, after the last of them.
+    boost::optional<program_hash::Hash> program_hash;
   };
 
   void run_passes(DexStoresVector&,
@@ -61,7 +115,7 @@ class PassManager {
   // do not use ProGuard configuration keep rules.
   void set_testing_mode() { m_testing_mode = true; }
 
-  const PassInfo* get_current_pass_info() const { return m_current_pass_info; }
+  const PassInfo* get_current_pass_info() const { return current_pass_info(); }
 
   void record_running_regalloc() {
     m_regalloc_has_run = true;
@@ -71,14 +125,139 @@ class PassManager {
     return m_regalloc_has_run;
   }
 
+  /**
+   * Hierarchy analyses over all the stores being optimized. They are built
+   * on first use and shared by every pass until a pass that declares it
+   * changes the class hierarchy or method signatures has run, so they
+   * reflect the state of the classes at the start of the current pass. A
+   * pass that needs them again after changing the hierarchy itself must
+   * invalidate them first.
+   *
+   * Only available from within run_pass.
+   */
+  HierarchyCache& get_hierarchy_cache();
+
+  /**
+   * The classes of all the stores being optimized, flattened once and
+   * reused until the stores change, instead of calling build_class_scope()
+   * again. Passes that replace classes of a dex in place must invalidate it.
+   *
+   * Only available from within run_pass.
+   */
+  ScopeView& get_scope_view();
+
+  /**
+   * The cache of per-method results of the pass being run, see
+   * IncrementalCache.h, or nullptr unless "incremental_cache_dir" is set in
+   * the config. Its hits and misses become metrics of the pass.
+   *
+   * Only available from within run_pass.
+   */
+  IncrementalCache* get_incremental_cache();
+
+  /**
+   * An arena for the temporaries of the pass being run, to be used through
+   * ArenaAllocator, e.g. with the containers of the arena namespace. It's
+   * released as a whole once the pass returns, so nothing allocated in it
+   * may outlive the pass. How much was released is reported in the profile
+   * of the pass.
+   *
+   * Only available from within run_pass.
+   */
+  Arena& get_scratch_arena();
+
+  // The pool that parallel work runs on while this PassManager is alive.
+  // Its size comes from the "jobs" config key, and "pin_threads" spreads its
+  // threads over the NUMA nodes.
+  ThreadPool& get_thread_pool() { return *m_thread_pool; }
+  const ThreadPool& get_thread_pool() const { return *m_thread_pool; }
+
+  /**
+   * Benchmarks the first run of the pass named `pass_name`. run_passes()
+   * runs the passes before it as usual, and then runs it `iterations` times,
+   * each in a forked process that starts from the state the previous passes
+   * left. It returns without running the passes after it. POSIX only.
+   */
+  void set_bench_pass(const std::string& pass_name, size_t iterations);
+
+  // The wall time of each benchmark run of the pass, in seconds.
+  const std::vector<double>& get_bench_pass_times() const {
+    return m_bench_pass_times;
+  }
+
+  /**
+   * Makes run_passes() resume from a program snapshot, see ProgramSnapshot.h.
+   * `saved_state` is what program_snapshot::read() returned along with the
+   * stores. The passes up to the one the snapshot was taken after are not
+   * run again, and their metrics are the ones they had then. The config must
+   * activate the same passes up to there. A snapshot without a resume point,
+   * like the intermediate output of an earlier stage, runs all the passes.
+   *
+   * Snapshots are taken when "snapshot_after_pass" and "snapshot_dir" are
+   * set in the config.
+   */
+  void resume_from_snapshot(const Json::Value& saved_state) {
+    m_resume_state = saved_state;
+  }
+
  private:
   void activate_pass(const char* name, const Json::Value& cfg);
 
   void init(const Json::Value& config);
 
+  PassInfo* current_pass_info() const;
+
+  // The pass that metrics, caches and scratch arenas go to. Fails when there
+  // is none, including on threads that don't run a pass while several passes
+  // run concurrently.
+  PassInfo* running_pass_info(const char* what) const;
+
+  // Runs the pass, on all the stores at once, or store by store if it is
+  // store local.
+  void run_pass(Pass* pass, DexStoresVector& stores, ConfigFiles& cfg);
+
+  static void check_method(DexMethod* dex_method,
+                           bool polymorphic_constants,
+                           bool verify_moves);
+
+  // Type checks every method of the scope and aborts if any of them is
+  // inconsistent. All the inconsistencies are reported, unless `fail_fast` is
+  // set, in which case the check stops at the first one. With
+  // `only_modified`, the methods whose code passed the last check and hasn't
+  // changed since are skipped.
   static void run_type_checker(const Scope& scope,
                                bool polymorphic_constants,
-                               bool verify_moves);
+                               bool verify_moves,
+                               bool fail_fast,
+                               bool only_modified);
+
+  // Runs the passes from `begin` to `end`, which are all method local, in a
+  // worker process per shard of the methods, and takes their code and
+  // metrics back. See MethodShards.h.
+  void run_sharded(size_t begin,
+                   size_t end,
+                   DexStoresVector& stores,
+                   ConfigFiles& cfg);
+
+  // Forks a process per benchmark run of the pass about to run. Returns
+  // true in the forked processes, and false in this one once they have all
+  // reported their time.
+  bool fork_bench_runs();
+
+  // Writes a program snapshot of the stores, from which a later run can
+  // resume with the pass at `resume_at`.
+  void write_snapshot(const std::string& dir,
+                      DexStoresVector& stores,
+                      ConfigFiles& cfg,
+                      size_t resume_at);
+
+  // Lowers the methods whose code has not been asked for in the last
+  // `cold_after` code epochs back to DexCode. Returns how many were lowered.
+  size_t unballoon_cold_methods(const Scope& scope,
+                                uint32_t epoch,
+                                uint32_t cold_after,
+                                bool polymorphic_constants,
+                                bool verify_moves);
 
   Json::Value m_config;
   std::vector<Pass*> m_registered_passes;
@@ -86,13 +265,34 @@ class PassManager {
 
   // Per-pass information and metrics
   std::vector<PassManager::PassInfo> m_pass_info;
+  // The pass being run or evaluated, unless several passes are running
+  // concurrently.
   PassInfo* m_current_pass_info;
+  std::atomic<bool> m_running_concurrently{false};
 
   redex::ProguardConfiguration m_pg_config;
   bool m_testing_mode;
   bool m_verify_none_mode;
   bool m_regalloc_has_run = false;
 
+  std::unique_ptr<ThreadPool> m_thread_pool;
+
+  // Store local passes update their metrics from several threads.
+  std::mutex m_metrics_lock;
+
+  // Only set while run_passes is running.
+  std::unique_ptr<HierarchyCache> m_hierarchy_cache;
+  std::unique_ptr<ScopeView> m_scope_view;
+  ThreadPool* m_previous_thread_pool{nullptr};
+
+  std::mutex m_incremental_caches_lock;
+  std::unordered_map<const PassInfo*, std::unique_ptr<IncrementalCache>>
+      m_incremental_caches;
+
+  std::mutex m_scratch_arenas_lock;
+  std::unordered_map<const PassInfo*, std::unique_ptr<Arena>>
+      m_scratch_arenas;
+
   struct ProfilerInfo {
     std::string command;
     const Pass* pass;
@@ -101,4 +301,17 @@ class PassManager {
   };
 
   boost::optional<ProfilerInfo> m_profiler_info;
+
+  struct BenchPassInfo {
+    const Pass* pass;
+    size_t iterations;
+    // Where a forked run writes its time.
+    int report_fd{-1};
+  };
+
+  boost::optional<BenchPassInfo> m_bench_pass_info;
+  std::vector<double> m_bench_pass_times;
+
+  // Null unless resuming from a snapshot.
+  Json::Value m_resume_state;
 };
@@ -13,11 +13,13 @@
 #include <functional>
 #include <iostream>
 #include <iterator>
-#include <memory>
 #include <stack>
 #include <type_traits>
 #include <utility>
 
+#include <boost/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+
 #include "Debug.h"
 #include "PatriciaTreeUtil.h"
 #include "Util.h"
@@ -39,40 +41,43 @@ using CombiningFunction = std::function<T(const T&, const T&)>;
 
 template <typename IntegerType, typename Value>
 inline const typename Value::type* find_value(
-    IntegerType key, std::shared_ptr<PatriciaTree<IntegerType, Value>> tree);
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree);
 
 template <typename IntegerType, typename Value>
-inline bool leq(std::shared_ptr<PatriciaTree<IntegerType, Value>> tree1,
-                std::shared_ptr<PatriciaTree<IntegerType, Value>> tree2);
+inline bool leq(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree1,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree2);
 
 template <typename IntegerType, typename Value>
-inline bool equals(std::shared_ptr<PatriciaTree<IntegerType, Value>> tree1,
-                   std::shared_ptr<PatriciaTree<IntegerType, Value>> tree2);
+inline bool equals(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree1,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree2);
 
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> combine_new_leaf(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> combine_new_leaf(
     const CombiningFunction<typename Value::type>& combine,
     IntegerType key,
     const typename Value::type& value);
 
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> update(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> update(
     const CombiningFunction<typename Value::type>& combine,
     IntegerType key,
     const typename Value::type& value,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> tree);
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree);
 
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> merge(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> merge(
     const CombiningFunction<typename Value::type>& combine,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> t);
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& t);
 
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> intersect(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> intersect(
     const ptmap_impl::CombiningFunction<typename Value::type>& combine,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> t);
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& t);
 
 template <typename T>
 T snd(const T&, const T& second) {
@@ -294,7 +299,7 @@ class PatriciaTreeMap final {
     return x;
   }
 
-  std::shared_ptr<ptmap_impl::PatriciaTree<IntegerType, Value>> m_tree;
+  boost::intrusive_ptr<ptmap_impl::PatriciaTree<IntegerType, Value>> m_tree;
 
   template <typename T, typename V>
   friend std::ostream& operator<<(std::ostream&, const PatriciaTreeMap<T, V>&);
@@ -322,7 +327,9 @@ namespace ptmap_impl {
 using namespace pt_util;
 
 template <typename IntegerType, typename Value>
-class PatriciaTree {
+class PatriciaTree
+    : public boost::intrusive_ref_counter<PatriciaTree<IntegerType, Value>,
+                                         boost::thread_safe_counter> {
  public:
   // A Patricia tree is an immutable structure.
   PatriciaTree& operator=(const PatriciaTree& other) = delete;
@@ -346,8 +353,8 @@ class PatriciaTreeBranch final : public PatriciaTree<IntegerType, Value> {
   PatriciaTreeBranch(
       IntegerType prefix,
       IntegerType branching_bit,
-      std::shared_ptr<PatriciaTree<IntegerType, Value>> left_tree,
-      std::shared_ptr<PatriciaTree<IntegerType, Value>> right_tree)
+      const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& left_tree,
+      const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& right_tree)
       : m_prefix(prefix),
         m_stacking_bit(branching_bit),
         m_left_tree(left_tree),
@@ -359,19 +366,21 @@ class PatriciaTreeBranch final : public PatriciaTree<IntegerType, Value> {
 
   IntegerType branching_bit() const { return m_stacking_bit; }
 
-  std::shared_ptr<PatriciaTree<IntegerType, Value>> left_tree() const {
+  const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& left_tree()
+      const {
     return m_left_tree;
   }
 
-  std::shared_ptr<PatriciaTree<IntegerType, Value>> right_tree() const {
+  const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& right_tree()
+      const {
     return m_right_tree;
   }
 
  private:
   IntegerType m_prefix;
   IntegerType m_stacking_bit;
-  std::shared_ptr<PatriciaTree<IntegerType, Value>> m_left_tree;
-  std::shared_ptr<PatriciaTree<IntegerType, Value>> m_right_tree;
+  boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> m_left_tree;
+  boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> m_right_tree;
 };
 
 template <typename IntegerType, typename Value>
@@ -396,17 +405,17 @@ class PatriciaTreeLeaf final : public PatriciaTree<IntegerType, Value> {
 };
 
 template <typename IntegerType, typename Value>
-std::shared_ptr<PatriciaTreeBranch<IntegerType, Value>> join(
+boost::intrusive_ptr<PatriciaTreeBranch<IntegerType, Value>> join(
     IntegerType prefix0,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> tree0,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree0,
     IntegerType prefix1,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> tree1) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree1) {
   IntegerType m = get_branching_bit(prefix0, prefix1);
   if (is_zero_bit(prefix0, m)) {
-    return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+    return make_node<PatriciaTreeBranch<IntegerType, Value>>(
         mask(prefix0, m), m, tree0, tree1);
   } else {
-    return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+    return make_node<PatriciaTreeBranch<IntegerType, Value>>(
         mask(prefix0, m), m, tree1, tree0);
   }
 }
@@ -414,18 +423,18 @@ std::shared_ptr<PatriciaTreeBranch<IntegerType, Value>> join(
 // This function is used to prevent the creation of branch nodes with only one
 // child.
 template <typename IntegerType, typename Value>
-std::shared_ptr<PatriciaTree<IntegerType, Value>> make_branch(
+boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> make_branch(
     IntegerType prefix,
     IntegerType branching_bit,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> left_tree,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> right_tree) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& left_tree,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& right_tree) {
   if (left_tree == nullptr) {
     return right_tree;
   }
   if (right_tree == nullptr) {
     return left_tree;
   }
-  return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+  return make_node<PatriciaTreeBranch<IntegerType, Value>>(
       prefix, branching_bit, left_tree, right_tree);
 }
 
@@ -433,20 +442,21 @@ std::shared_ptr<PatriciaTree<IntegerType, Value>> make_branch(
 // not present in :tree.
 template <typename IntegerType, typename Value>
 inline const typename Value::type* find_value(
-    IntegerType key, std::shared_ptr<PatriciaTree<IntegerType, Value>> tree) {
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree) {
   if (tree == nullptr) {
     return nullptr;
   }
   if (tree->is_leaf()) {
     auto leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree);
     if (key == leaf->key()) {
       return &leaf->value();
     }
     return nullptr;
   }
   auto branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree);
   if (is_zero_bit(key, branch->branching_bit())) {
     return find_value(key, branch->left_tree());
   } else {
@@ -455,8 +465,9 @@ inline const typename Value::type* find_value(
 }
 
 template <typename IntegerType, typename Value>
-inline bool leq(std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
-                std::shared_ptr<PatriciaTree<IntegerType, Value>> t) {
+inline bool leq(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& t) {
   if (s == t) {
     // This conditions allows the leq to run in sublinear time when comparing
     // Patricia trees that share some structure.
@@ -473,14 +484,14 @@ inline bool leq(std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
       return false;
     }
     auto s_leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(s);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(s);
     auto t_leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
     return Value::leq(s_leaf->value(), t_leaf->value());
   }
   if (t->is_leaf()) {
     auto leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
     auto* s_value = find_value(leaf->key(), s);
     if (s_value == nullptr) {
       return false;
@@ -488,17 +499,15 @@ inline bool leq(std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
     return Value::leq(*s_value, leaf->value());
   }
   auto s_branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(s);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(s);
   auto t_branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
   IntegerType m = s_branch->branching_bit();
   IntegerType n = t_branch->branching_bit();
   IntegerType p = s_branch->prefix();
   IntegerType q = t_branch->prefix();
-  auto s0 = s_branch->left_tree();
-  auto s1 = s_branch->right_tree();
-  auto t0 = t_branch->left_tree();
-  auto t1 = t_branch->right_tree();
+  const auto& s0 = s_branch->left_tree();
+  const auto& s1 = s_branch->right_tree();
   if (m == n && p == q) {
     return leq(s_branch->left_tree(), t_branch->left_tree()) &&
            leq(s_branch->right_tree(), t_branch->right_tree());
@@ -514,8 +523,9 @@ inline bool leq(std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
 // A Patricia tree is a canonical representation of the set of keys it contains.
 // Hence, set equality is equivalent to structural equality of Patricia trees.
 template <typename IntegerType, typename Value>
-inline bool equals(std::shared_ptr<PatriciaTree<IntegerType, Value>> tree1,
-                   std::shared_ptr<PatriciaTree<IntegerType, Value>> tree2) {
+inline bool equals(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree1,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree2) {
   if (tree1 == tree2) {
     // This conditions allows the equality test to run in sublinear time when
     // comparing Patricia trees that share some structure.
@@ -532,9 +542,9 @@ inline bool equals(std::shared_ptr<PatriciaTree<IntegerType, Value>> tree1,
       return false;
     }
     auto leaf1 =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree1);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree1);
     auto leaf2 =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree2);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree2);
     return leaf1->key() == leaf2->key() &&
            Value::equals(leaf1->value(), leaf2->value());
   }
@@ -542,9 +552,9 @@ inline bool equals(std::shared_ptr<PatriciaTree<IntegerType, Value>> tree1,
     return false;
   }
   auto branch1 =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree1);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree1);
   auto branch2 =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree2);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree2);
   return branch1->prefix() == branch2->prefix() &&
          branch1->branching_bit() == branch2->branching_bit() &&
          equals(branch1->left_tree(), branch2->left_tree()) &&
@@ -555,17 +565,17 @@ inline bool equals(std::shared_ptr<PatriciaTree<IntegerType, Value>> tree1,
 // value with combine(bound_value, :value). Note that the existing value is
 // always the first parameter to :combine and the new value is the second.
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> update(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> update(
     const ptmap_impl::CombiningFunction<typename Value::type>& combine,
     IntegerType key,
     const typename Value::type& value,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> tree) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree) {
   if (tree == nullptr) {
     return combine_new_leaf<IntegerType, Value>(combine, key, value);
   }
   if (tree->is_leaf()) {
     auto leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(tree);
     if (key == leaf->key()) {
       return combine_leaf(combine, value, leaf);
     }
@@ -576,7 +586,7 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> update(
     return join<IntegerType, Value>(key, new_leaf, leaf->key(), leaf);
   }
   auto branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(tree);
   if (match_prefix(key, branch->prefix(), branch->branching_bit())) {
     if (is_zero_bit(key, branch->branching_bit())) {
       auto new_left_tree = update(combine, key, value, branch->left_tree());
@@ -608,10 +618,10 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> update(
 // We keep the notations of the paper so as to make the implementation easier
 // to follow.
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> merge(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> merge(
     const ptmap_impl::CombiningFunction<typename Value::type>& combine,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> t) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& t) {
   if (s == t) {
     // This conditional is what allows the union operation to complete in
     // sublinear time when the operands share some structure.
@@ -625,26 +635,26 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> merge(
   }
   if (s->is_leaf()) {
     auto leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(s);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(s);
     return update(combine, leaf->key(), leaf->value(), t);
   }
   if (t->is_leaf()) {
     auto leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
     return update(combine, leaf->key(), leaf->value(), s);
   }
   auto s_branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(s);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(s);
   auto t_branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
   IntegerType m = s_branch->branching_bit();
   IntegerType n = t_branch->branching_bit();
   IntegerType p = s_branch->prefix();
   IntegerType q = t_branch->prefix();
-  auto s0 = s_branch->left_tree();
-  auto s1 = s_branch->right_tree();
-  auto t0 = t_branch->left_tree();
-  auto t1 = t_branch->right_tree();
+  const auto& s0 = s_branch->left_tree();
+  const auto& s1 = s_branch->right_tree();
+  const auto& t0 = t_branch->left_tree();
+  const auto& t1 = t_branch->right_tree();
   if (m == n && p == q) {
     // The two trees have the same prefix. We just merge the subtrees.
     auto new_left = merge(combine, s0, t0);
@@ -655,7 +665,7 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> merge(
     if (new_left == t0 && new_right == t1) {
       return t;
     }
-    return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+    return make_node<PatriciaTreeBranch<IntegerType, Value>>(
         p, m, new_left, new_right);
   }
   if (m < n && match_prefix(q, p, m)) {
@@ -665,14 +675,14 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> merge(
       if (s0 == new_left) {
         return s;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+      return make_node<PatriciaTreeBranch<IntegerType, Value>>(
           p, m, new_left, s1);
     } else {
       auto new_right = merge(combine, s1, t);
       if (s1 == new_right) {
         return s;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+      return make_node<PatriciaTreeBranch<IntegerType, Value>>(
           p, m, s0, new_right);
     }
   }
@@ -683,14 +693,14 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> merge(
       if (t0 == new_left) {
         return t;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+      return make_node<PatriciaTreeBranch<IntegerType, Value>>(
           q, n, new_left, t1);
     } else {
       auto new_right = merge(combine, s, t1);
       if (t1 == new_right) {
         return t;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType, Value>>(
+      return make_node<PatriciaTreeBranch<IntegerType, Value>>(
           q, n, t0, new_right);
     }
   }
@@ -700,16 +710,16 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> merge(
 
 // Combine :value with the value in :leaf.
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> combine_leaf(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> combine_leaf(
     const ptmap_impl::CombiningFunction<typename Value::type>& combine,
     const typename Value::type& value,
-    std::shared_ptr<PatriciaTreeLeaf<IntegerType, Value>> leaf) {
+    const boost::intrusive_ptr<PatriciaTreeLeaf<IntegerType, Value>>& leaf) {
   auto combined_value = combine(leaf->value(), value);
   if (combined_value.is_top()) {
     return nullptr;
   }
   if (!combined_value.equals(leaf->value())) {
-    return std::make_shared<PatriciaTreeLeaf<IntegerType, Value>>(
+    return make_node<PatriciaTreeLeaf<IntegerType, Value>>(
         leaf->key(), combined_value);
   }
   return leaf;
@@ -717,20 +727,20 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> combine_leaf(
 
 // Create a new leaf with a Top value and combine :value into it.
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> combine_new_leaf(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> combine_new_leaf(
     const ptmap_impl::CombiningFunction<typename Value::type>& combine,
     IntegerType key,
     const typename Value::type& value) {
-  auto new_leaf = std::make_shared<PatriciaTreeLeaf<IntegerType, Value>>(
+  auto new_leaf = make_node<PatriciaTreeLeaf<IntegerType, Value>>(
       key, Value::default_value());
   return combine_leaf(combine, value, new_leaf);
 }
 
 template <typename IntegerType, typename Value>
-inline std::shared_ptr<PatriciaTree<IntegerType, Value>> intersect(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType, Value>> intersect(
     const ptmap_impl::CombiningFunction<typename Value::type>& combine,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> s,
-    std::shared_ptr<PatriciaTree<IntegerType, Value>> t) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& t) {
   if (s == t) {
     // This conditional is what allows the intersection operation to complete in
     // sublinear time when the operands share some structure.
@@ -741,7 +751,7 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> intersect(
   }
   if (s->is_leaf()) {
     auto leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(s);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(s);
     auto* value = find_value(leaf->key(), t);
     if (value == nullptr) {
       return nullptr;
@@ -750,7 +760,7 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> intersect(
   }
   if (t->is_leaf()) {
     auto leaf =
-        std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
     auto* value = find_value(leaf->key(), s);
     if (value == nullptr) {
       return nullptr;
@@ -758,17 +768,17 @@ inline std::shared_ptr<PatriciaTree<IntegerType, Value>> intersect(
     return combine_leaf(combine, *value, leaf);
   }
   auto s_branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(s);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(s);
   auto t_branch =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
   IntegerType m = s_branch->branching_bit();
   IntegerType n = t_branch->branching_bit();
   IntegerType p = s_branch->prefix();
   IntegerType q = t_branch->prefix();
-  auto s0 = s_branch->left_tree();
-  auto s1 = s_branch->right_tree();
-  auto t0 = t_branch->left_tree();
-  auto t1 = t_branch->right_tree();
+  const auto& s0 = s_branch->left_tree();
+  const auto& s1 = s_branch->right_tree();
+  const auto& t0 = t_branch->left_tree();
+  const auto& t1 = t_branch->right_tree();
   if (m == n && p == q) {
     // The two trees have the same prefix. We merge the intersection of the
     // corresponding subtrees.
@@ -814,7 +824,7 @@ class PatriciaTreeIterator final
   PatriciaTreeIterator() {}
 
   explicit PatriciaTreeIterator(
-      const std::shared_ptr<PatriciaTree<IntegerType, Value>>& tree) {
+      const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree) {
     if (tree == nullptr) {
       return;
     }
@@ -865,24 +875,26 @@ class PatriciaTreeIterator final
  private:
   // The argument is never null.
   void go_to_next_leaf(
-      const std::shared_ptr<PatriciaTree<IntegerType, Value>>& tree) {
+      const boost::intrusive_ptr<PatriciaTree<IntegerType, Value>>& tree) {
     auto t = tree;
     // We go to the leftmost leaf, storing the branches that we're traversing
     // on the stack. By definition of a Patricia tree, a branch node always
     // has two children, hence the leftmost leaf always exists.
     while (t->is_branch()) {
       auto branch =
-          std::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
+          boost::static_pointer_cast<PatriciaTreeBranch<IntegerType, Value>>(t);
       m_stack.push(branch);
       t = branch->left_tree();
       // A branch node always has two children.
       assert(t != nullptr);
     }
-    m_leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
+    m_leaf =
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType, Value>>(t);
   }
 
-  std::stack<std::shared_ptr<PatriciaTreeBranch<IntegerType, Value>>> m_stack;
-  std::shared_ptr<PatriciaTreeLeaf<IntegerType, Value>> m_leaf;
+  std::stack<boost::intrusive_ptr<PatriciaTreeBranch<IntegerType, Value>>>
+      m_stack;
+  boost::intrusive_ptr<PatriciaTreeLeaf<IntegerType, Value>> m_leaf;
 };
 
 } // namespace ptmap_impl
@@ -14,12 +14,13 @@
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
-#include <memory>
 #include <stack>
 #include <type_traits>
 #include <utility>
 
 #include <boost/functional/hash.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
 
 #include "Debug.h"
 #include "PatriciaTreeUtil.h"
@@ -38,44 +39,49 @@ template <typename IntegerType>
 class PatriciaTreeIterator;
 
 template <typename IntegerType>
-inline bool contains(IntegerType key,
-                     std::shared_ptr<PatriciaTree<IntegerType>> tree);
+inline bool contains(
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree);
 
 template <typename IntegerType>
-inline bool is_subset_of(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
-                         std::shared_ptr<PatriciaTree<IntegerType>> tree2);
+inline bool is_subset_of(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree1,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree2);
 
 template <typename IntegerType>
-inline bool equals(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
-                   std::shared_ptr<PatriciaTree<IntegerType>> tree2);
+inline bool equals(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree1,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree2);
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> insert(
-    IntegerType key, std::shared_ptr<PatriciaTree<IntegerType>> tree);
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> insert(
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree);
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> remove(
-    IntegerType key, std::shared_ptr<PatriciaTree<IntegerType>> tree);
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> remove(
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree);
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> filter(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> filter(
     const std::function<bool(IntegerType)>& predicate,
-    std::shared_ptr<PatriciaTree<IntegerType>> tree);
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree);
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> merge(
-    std::shared_ptr<PatriciaTree<IntegerType>> s,
-    std::shared_ptr<PatriciaTree<IntegerType>> t);
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> merge(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& t);
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> intersect(
-    std::shared_ptr<PatriciaTree<IntegerType>> s,
-    std::shared_ptr<PatriciaTree<IntegerType>> t);
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> intersect(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& t);
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> diff(
-    std::shared_ptr<PatriciaTree<IntegerType>> s,
-    std::shared_ptr<PatriciaTree<IntegerType>> t);
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> diff(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& t);
 
 } // namespace pt_impl
 
@@ -279,7 +285,7 @@ class PatriciaTreeSet final {
     return x;
   }
 
-  std::shared_ptr<pt_impl::PatriciaTree<IntegerType>> m_tree;
+  boost::intrusive_ptr<pt_impl::PatriciaTree<IntegerType>> m_tree;
 
   template <typename T>
   friend std::ostream& operator<<(std::ostream&, const PatriciaTreeSet<T>&);
@@ -307,7 +313,9 @@ namespace pt_impl {
 using namespace pt_util;
 
 template <typename IntegerType>
-class PatriciaTree {
+class PatriciaTree
+    : public boost::intrusive_ref_counter<PatriciaTree<IntegerType>,
+                                         boost::thread_safe_counter> {
  public:
   // A Patricia tree is an immutable structure.
   PatriciaTree& operator=(const PatriciaTree& other) = delete;
@@ -343,10 +351,11 @@ class PatriciaTree {
 template <typename IntegerType>
 class PatriciaTreeBranch final : public PatriciaTree<IntegerType> {
  public:
-  PatriciaTreeBranch(IntegerType prefix,
-                     IntegerType branching_bit,
-                     std::shared_ptr<PatriciaTree<IntegerType>> left_tree,
-                     std::shared_ptr<PatriciaTree<IntegerType>> right_tree)
+  PatriciaTreeBranch(
+      IntegerType prefix,
+      IntegerType branching_bit,
+      const boost::intrusive_ptr<PatriciaTree<IntegerType>>& left_tree,
+      const boost::intrusive_ptr<PatriciaTree<IntegerType>>& right_tree)
       : m_prefix(prefix),
         m_branching_bit(branching_bit),
         m_left_tree(left_tree),
@@ -365,19 +374,19 @@ class PatriciaTreeBranch final : public PatriciaTree<IntegerType> {
 
   IntegerType branching_bit() const { return m_branching_bit; }
 
-  std::shared_ptr<PatriciaTree<IntegerType>> left_tree() const {
+  const boost::intrusive_ptr<PatriciaTree<IntegerType>>& left_tree() const {
     return m_left_tree;
   }
 
-  std::shared_ptr<PatriciaTree<IntegerType>> right_tree() const {
+  const boost::intrusive_ptr<PatriciaTree<IntegerType>>& right_tree() const {
     return m_right_tree;
   }
 
  private:
   IntegerType m_prefix;
   IntegerType m_branching_bit;
-  std::shared_ptr<PatriciaTree<IntegerType>> m_left_tree;
-  std::shared_ptr<PatriciaTree<IntegerType>> m_right_tree;
+  boost::intrusive_ptr<PatriciaTree<IntegerType>> m_left_tree;
+  boost::intrusive_ptr<PatriciaTree<IntegerType>> m_right_tree;
 };
 
 template <typename IntegerType>
@@ -397,17 +406,17 @@ class PatriciaTreeLeaf final : public PatriciaTree<IntegerType> {
 };
 
 template <typename IntegerType>
-std::shared_ptr<PatriciaTreeBranch<IntegerType>> join(
+boost::intrusive_ptr<PatriciaTreeBranch<IntegerType>> join(
     IntegerType prefix0,
-    std::shared_ptr<PatriciaTree<IntegerType>> tree0,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree0,
     IntegerType prefix1,
-    std::shared_ptr<PatriciaTree<IntegerType>> tree1) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree1) {
   IntegerType m = get_branching_bit(prefix0, prefix1);
   if (is_zero_bit(prefix0, m)) {
-    return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+    return make_node<PatriciaTreeBranch<IntegerType>>(
         mask(prefix0, m), m, tree0, tree1);
   } else {
-    return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+    return make_node<PatriciaTreeBranch<IntegerType>>(
         mask(prefix0, m), m, tree1, tree0);
   }
 }
@@ -415,32 +424,34 @@ std::shared_ptr<PatriciaTreeBranch<IntegerType>> join(
 // This function is used by remove() to prevent the creation of branch nodes
 // with only one child.
 template <typename IntegerType>
-std::shared_ptr<PatriciaTree<IntegerType>> make_branch(
+boost::intrusive_ptr<PatriciaTree<IntegerType>> make_branch(
     IntegerType prefix,
     IntegerType branching_bit,
-    std::shared_ptr<PatriciaTree<IntegerType>> left_tree,
-    std::shared_ptr<PatriciaTree<IntegerType>> right_tree) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& left_tree,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& right_tree) {
   if (left_tree == nullptr) {
     return right_tree;
   }
   if (right_tree == nullptr) {
     return left_tree;
   }
-  return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+  return make_node<PatriciaTreeBranch<IntegerType>>(
       prefix, branching_bit, left_tree, right_tree);
 }
 
 template <typename IntegerType>
-inline bool contains(IntegerType key,
-                     std::shared_ptr<PatriciaTree<IntegerType>> tree) {
+inline bool contains(
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree) {
   if (tree == nullptr) {
     return false;
   }
   if (tree->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
     return key == leaf->key();
   }
-  auto branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
+  auto branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
   if (is_zero_bit(key, branch->branching_bit())) {
     return contains(key, branch->left_tree());
   } else {
@@ -449,8 +460,9 @@ inline bool contains(IntegerType key,
 }
 
 template <typename IntegerType>
-inline bool is_subset_of(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
-                         std::shared_ptr<PatriciaTree<IntegerType>> tree2) {
+inline bool is_subset_of(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree1,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree2) {
   if (tree1 == tree2) {
     // This conditions allows the inclusion test to run in sublinear time
     // when comparing Patricia trees that share some structure.
@@ -463,16 +475,17 @@ inline bool is_subset_of(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
     return false;
   }
   if (tree1->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree1);
+    auto leaf =
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree1);
     return contains(leaf->key(), tree2);
   }
   if (tree2->is_leaf()) {
     return false;
   }
   auto branch1 =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree1);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree1);
   auto branch2 =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree2);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree2);
   if (branch1->prefix() == branch2->prefix() &&
       branch1->branching_bit() == branch2->branching_bit()) {
     return is_subset_of(branch1->left_tree(), branch2->left_tree()) &&
@@ -495,8 +508,9 @@ inline bool is_subset_of(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
 // A Patricia tree is a canonical representation of the set of keys it contains.
 // Hence, set equality is equivalent to structural equality of Patricia trees.
 template <typename IntegerType>
-inline bool equals(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
-                   std::shared_ptr<PatriciaTree<IntegerType>> tree2) {
+inline bool equals(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree1,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree2) {
   if (tree1 == tree2) {
     // This conditions allows the equality test to run in sublinear time
     // when comparing Patricia trees that share some structure.
@@ -517,17 +531,19 @@ inline bool equals(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
     if (tree2->is_branch()) {
       return false;
     }
-    auto leaf1 = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree1);
-    auto leaf2 = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree2);
+    auto leaf1 =
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree1);
+    auto leaf2 =
+        boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree2);
     return leaf1->key() == leaf2->key();
   }
   if (tree2->is_leaf()) {
     return false;
   }
   auto branch1 =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree1);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree1);
   auto branch2 =
-      std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree2);
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree2);
   return branch1->prefix() == branch2->prefix() &&
          branch1->branching_bit() == branch2->branching_bit() &&
          equals(branch1->left_tree(), branch2->left_tree()) &&
@@ -535,30 +551,32 @@ inline bool equals(std::shared_ptr<PatriciaTree<IntegerType>> tree1,
 }
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> insert(
-    IntegerType key, std::shared_ptr<PatriciaTree<IntegerType>> tree) {
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> insert(
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree) {
   if (tree == nullptr) {
-    return std::make_shared<PatriciaTreeLeaf<IntegerType>>(key);
+    return make_node<PatriciaTreeLeaf<IntegerType>>(key);
   }
   if (tree->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
     if (key == leaf->key()) {
       return leaf;
     }
     return join<IntegerType>(
         key,
-        std::make_shared<PatriciaTreeLeaf<IntegerType>>(key),
+        make_node<PatriciaTreeLeaf<IntegerType>>(key),
         leaf->key(),
         leaf);
   }
-  auto branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
+  auto branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
   if (match_prefix(key, branch->prefix(), branch->branching_bit())) {
     if (is_zero_bit(key, branch->branching_bit())) {
       auto new_left_tree = insert(key, branch->left_tree());
       if (new_left_tree == branch->left_tree()) {
         return branch;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+      return make_node<PatriciaTreeBranch<IntegerType>>(
           branch->prefix(),
           branch->branching_bit(),
           new_left_tree,
@@ -568,7 +586,7 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> insert(
       if (new_right_tree == branch->right_tree()) {
         return branch;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+      return make_node<PatriciaTreeBranch<IntegerType>>(
           branch->prefix(),
           branch->branching_bit(),
           branch->left_tree(),
@@ -576,25 +594,27 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> insert(
     }
   }
   return join<IntegerType>(key,
-                           std::make_shared<PatriciaTreeLeaf<IntegerType>>(key),
+                           make_node<PatriciaTreeLeaf<IntegerType>>(key),
                            branch->prefix(),
                            branch);
 }
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> remove(
-    IntegerType key, std::shared_ptr<PatriciaTree<IntegerType>> tree) {
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> remove(
+    IntegerType key,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree) {
   if (tree == nullptr) {
     return nullptr;
   }
   if (tree->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
     if (key == leaf->key()) {
       return nullptr;
     }
     return leaf;
   }
-  auto branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
+  auto branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
   if (match_prefix(key, branch->prefix(), branch->branching_bit())) {
     if (is_zero_bit(key, branch->branching_bit())) {
       auto new_left_tree = remove(key, branch->left_tree());
@@ -620,17 +640,18 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> remove(
 }
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> filter(
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> filter(
     const std::function<bool(IntegerType key)>& predicate,
-    std::shared_ptr<PatriciaTree<IntegerType>> tree) {
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree) {
   if (tree == nullptr) {
     return nullptr;
   }
   if (tree->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(tree);
     return predicate(leaf->key()) ? leaf : nullptr;
   }
-  auto branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
+  auto branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(tree);
   auto new_left_tree = filter(predicate, branch->left_tree());
   auto new_right_tree = filter(predicate, branch->right_tree());
   if (new_left_tree == branch->left_tree() &&
@@ -647,9 +668,9 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> filter(
 // We keep the notations of the paper so as to make the implementation easier
 // to follow.
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> merge(
-    std::shared_ptr<PatriciaTree<IntegerType>> s,
-    std::shared_ptr<PatriciaTree<IntegerType>> t) {
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> merge(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& t) {
   if (s == t) {
     // This conditional is what allows the union operation to complete in
     // sublinear time when the operands share some structure.
@@ -665,23 +686,25 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> merge(
   // Otherwise, if s and t are both leaves, we would end up inserting s into t.
   // This would violate the assumptions required by `reference_equals()`.
   if (t->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
     return insert(leaf->key(), s);
   }
   if (s->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(s);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(s);
     return insert(leaf->key(), t);
   }
-  auto s_branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(s);
-  auto t_branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
+  auto s_branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(s);
+  auto t_branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
   IntegerType m = s_branch->branching_bit();
   IntegerType n = t_branch->branching_bit();
   IntegerType p = s_branch->prefix();
   IntegerType q = t_branch->prefix();
-  auto s0 = s_branch->left_tree();
-  auto s1 = s_branch->right_tree();
-  auto t0 = t_branch->left_tree();
-  auto t1 = t_branch->right_tree();
+  const auto& s0 = s_branch->left_tree();
+  const auto& s1 = s_branch->right_tree();
+  const auto& t0 = t_branch->left_tree();
+  const auto& t1 = t_branch->right_tree();
   if (m == n && p == q) {
     // The two trees have the same prefix. We just merge the subtrees.
     auto new_left = merge(s0, t0);
@@ -692,7 +715,7 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> merge(
     if (new_left == t0 && new_right == t1) {
       return t;
     }
-    return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+    return make_node<PatriciaTreeBranch<IntegerType>>(
         p, m, new_left, new_right);
   }
   if (m < n && match_prefix(q, p, m)) {
@@ -702,14 +725,14 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> merge(
       if (s0 == new_left) {
         return s;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+      return make_node<PatriciaTreeBranch<IntegerType>>(
           p, m, new_left, s1);
     } else {
       auto new_right = merge(s1, t);
       if (s1 == new_right) {
         return s;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+      return make_node<PatriciaTreeBranch<IntegerType>>(
           p, m, s0, new_right);
     }
   }
@@ -720,14 +743,14 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> merge(
       if (t0 == new_left) {
         return t;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+      return make_node<PatriciaTreeBranch<IntegerType>>(
           q, n, new_left, t1);
     } else {
       auto new_right = merge(s, t1);
       if (t1 == new_right) {
         return t;
       }
-      return std::make_shared<PatriciaTreeBranch<IntegerType>>(
+      return make_node<PatriciaTreeBranch<IntegerType>>(
           q, n, t0, new_right);
     }
   }
@@ -736,9 +759,9 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> merge(
 }
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> intersect(
-    std::shared_ptr<PatriciaTree<IntegerType>> s,
-    std::shared_ptr<PatriciaTree<IntegerType>> t) {
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> intersect(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& t) {
   if (s == t) {
     // This conditional is what allows the intersection operation to complete in
     // sublinear time when the operands share some structure.
@@ -748,23 +771,25 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> intersect(
     return nullptr;
   }
   if (s->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(s);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(s);
     return contains(leaf->key(), t) ? leaf : nullptr;
   }
   if (t->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
     return contains(leaf->key(), s) ? leaf : nullptr;
   }
-  auto s_branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(s);
-  auto t_branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
+  auto s_branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(s);
+  auto t_branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
   IntegerType m = s_branch->branching_bit();
   IntegerType n = t_branch->branching_bit();
   IntegerType p = s_branch->prefix();
   IntegerType q = t_branch->prefix();
-  auto s0 = s_branch->left_tree();
-  auto s1 = s_branch->right_tree();
-  auto t0 = t_branch->left_tree();
-  auto t1 = t_branch->right_tree();
+  const auto& s0 = s_branch->left_tree();
+  const auto& s1 = s_branch->right_tree();
+  const auto& t0 = t_branch->left_tree();
+  const auto& t1 = t_branch->right_tree();
   if (m == n && p == q) {
     // The two trees have the same prefix. We merge the intersection of the
     // corresponding subtrees.
@@ -783,9 +808,9 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> intersect(
 }
 
 template <typename IntegerType>
-inline std::shared_ptr<PatriciaTree<IntegerType>> diff(
-    std::shared_ptr<PatriciaTree<IntegerType>> s,
-    std::shared_ptr<PatriciaTree<IntegerType>> t) {
+inline boost::intrusive_ptr<PatriciaTree<IntegerType>> diff(
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& s,
+    const boost::intrusive_ptr<PatriciaTree<IntegerType>>& t) {
   if (s == t) {
     // This conditional is what allows the intersection operation to complete in
     // sublinear time when the operands share some structure.
@@ -798,23 +823,25 @@ inline std::shared_ptr<PatriciaTree<IntegerType>> diff(
     return s;
   }
   if (s->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(s);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(s);
     return contains(leaf->key(), t) ? nullptr : leaf;
   }
   if (t->is_leaf()) {
-    auto leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
+    auto leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
     return remove(leaf->key(), s);
   }
-  auto s_branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(s);
-  auto t_branch = std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
+  auto s_branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(s);
+  auto t_branch =
+      boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
   IntegerType m = s_branch->branching_bit();
   IntegerType n = t_branch->branching_bit();
   IntegerType p = s_branch->prefix();
   IntegerType q = t_branch->prefix();
-  auto s0 = s_branch->left_tree();
-  auto s1 = s_branch->right_tree();
-  auto t0 = t_branch->left_tree();
-  auto t1 = t_branch->right_tree();
+  const auto& s0 = s_branch->left_tree();
+  const auto& s1 = s_branch->right_tree();
+  const auto& t0 = t_branch->left_tree();
+  const auto& t1 = t_branch->right_tree();
   if (m == n && p == q) {
     // The two trees have the same prefix. We merge the difference of the
     // corresponding subtrees.
@@ -851,7 +878,7 @@ class PatriciaTreeIterator final
   PatriciaTreeIterator() {}
 
   explicit PatriciaTreeIterator(
-      const std::shared_ptr<PatriciaTree<IntegerType>>& tree) {
+      const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree) {
     if (tree == nullptr) {
       return;
     }
@@ -897,24 +924,25 @@ class PatriciaTreeIterator final
 
  private:
   // The argument is never null.
-  void go_to_next_leaf(const std::shared_ptr<PatriciaTree<IntegerType>>& tree) {
+  void go_to_next_leaf(
+      const boost::intrusive_ptr<PatriciaTree<IntegerType>>& tree) {
     auto t = tree;
     // We go to the leftmost leaf, storing the branches that we're traversing
     // on the stack. By definition of a Patricia tree, a branch node always
     // has two children, hence the leftmost leaf always exists.
     while (t->is_branch()) {
       auto branch =
-          std::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
+          boost::static_pointer_cast<PatriciaTreeBranch<IntegerType>>(t);
       m_stack.push(branch);
       t = branch->left_tree();
       // A branch node always has two children.
       assert(t != nullptr);
     }
-    m_leaf = std::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
+    m_leaf = boost::static_pointer_cast<PatriciaTreeLeaf<IntegerType>>(t);
   }
 
-  std::stack<std::shared_ptr<PatriciaTreeBranch<IntegerType>>> m_stack;
-  std::shared_ptr<PatriciaTreeLeaf<IntegerType>> m_leaf;
+  std::stack<boost::intrusive_ptr<PatriciaTreeBranch<IntegerType>>> m_stack;
+  boost::intrusive_ptr<PatriciaTreeLeaf<IntegerType>> m_leaf;
 };
 
 } // namespace pt_impl
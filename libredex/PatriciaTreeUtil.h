@@ -9,8 +9,22 @@
 
 #pragma once
 
+#include <utility>
+
+#include <boost/intrusive_ptr.hpp>
+
 namespace pt_util {
 
+/*
+ * The nodes of Patricia trees carry their own reference count (see
+ * boost::intrusive_ref_counter), which saves the separate control block and
+ * the extra pointer per edge that std::shared_ptr would need.
+ */
+template <typename Node, typename... Args>
+inline boost::intrusive_ptr<Node> make_node(Args&&... args) {
+  return boost::intrusive_ptr<Node>(new Node(std::forward<Args>(args)...));
+}
+
 template <typename IntegerType>
 inline IntegerType is_zero_bit(IntegerType k, IntegerType m) {
   return (k & m) == 0;
@@ -11,7 +11,9 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <deque>
+#include <fstream>
 #include <iomanip>
 #include <iterator>
 #include <limits>
@@ -26,6 +28,7 @@
 #include <boost/container/flat_set.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/functional/hash_fwd.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/optional.hpp>
 
 #include "ControlFlow.h"
@@ -43,6 +46,7 @@
 #include "RedexContext.h"
 #include "Trace.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 s_expr PointsToVariable::to_s_expr() const {
   return s_expr({s_expr("V"), s_expr(m_id)});
@@ -1563,6 +1567,346 @@ std::ostream& operator<<(std::ostream& o, const PointsToMethodSemantics& s) {
   return o;
 }
 
+namespace pts_impl {
+
+/*
+ * Binary stub files are laid out like program snapshots (see
+ * ProgramSnapshot.cpp), with an index of the methods in front of the words:
+ *
+ *   stubs_header
+ *   stubs_string strings[num_strings]
+ *   uint32_t method_offsets[num_methods]
+ *   uint32_t words[num_words]
+ *   char string_data[]
+ *
+ * Each string is NUL-terminated in string_data. The semantics of the i-th
+ * method starts at words[method_offsets[i]]:
+ *
+ *   method (class, name, return type, arg count, args...), MethodKind,
+ *   variable counter, action count, actions...
+ *
+ * An action is its PointsToOperationKind, then what the operation refers to
+ * (a string, a type, a field as class, name and type, a parameter, a
+ * SpecialPointsToEdge or a method; nothing for the others), then its argument
+ * count and a (key, variable id) pair for each argument. Since each method can
+ * be found on its own, they are decoded in parallel.
+ */
+
+constexpr char kStubsMagic[8] = {'r', 'e', 'd', 'e', 'x', 'p', 't', 's'};
+constexpr uint32_t kStubsVersion = 1;
+
+struct stubs_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_strings;
+  uint32_t num_methods;
+  uint32_t num_words;
+  uint32_t string_data_size;
+};
+
+struct stubs_string {
+  uint32_t offset;
+  uint32_t size;
+};
+
+class StubWriter {
+ public:
+  void add(const PointsToMethodSemantics& semantics) {
+    m_method_offsets.push_back(m_words.size());
+    add_method(semantics.m_dex_method);
+    m_words.push_back(semantics.m_kind);
+    m_words.push_back(semantics.m_variable_counter);
+    m_words.push_back(semantics.m_points_to_actions.size());
+    for (const auto& action : semantics.m_points_to_actions) {
+      add_action(action);
+    }
+  }
+
+  void write(const std::string& file_name) const {
+    stubs_header header;
+    memcpy(header.magic, kStubsMagic, sizeof(kStubsMagic));
+    header.version = kStubsVersion;
+    header.num_strings = m_strings.size();
+    header.num_methods = m_method_offsets.size();
+    header.num_words = m_words.size();
+    header.string_data_size = m_string_data.size();
+    std::ofstream out(file_name, std::ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)m_strings.data(),
+              m_strings.size() * sizeof(stubs_string));
+    out.write((const char*)m_method_offsets.data(),
+              m_method_offsets.size() * sizeof(uint32_t));
+    out.write((const char*)m_words.data(), m_words.size() * sizeof(uint32_t));
+    out.write(m_string_data.data(), m_string_data.size());
+    always_assert_log(out, "Failed to write %s", file_name.c_str());
+  }
+
+ private:
+  void add_string(const DexString* str) {
+    auto it = m_string_index.find(str);
+    if (it == m_string_index.end()) {
+      it = m_string_index.emplace(str, m_strings.size()).first;
+      m_strings.push_back({(uint32_t)m_string_data.size(), str->size()});
+      m_string_data.insert(
+          m_string_data.end(), str->c_str(), str->c_str() + str->size() + 1);
+    }
+    m_words.push_back(it->second);
+  }
+
+  void add_type(const DexType* type) { add_string(type->get_name()); }
+
+  void add_method(const DexMethodRef* dex_method) {
+    add_type(dex_method->get_class());
+    add_string(dex_method->get_name());
+    DexProto* proto = dex_method->get_proto();
+    add_type(proto->get_rtype());
+    const auto& args = proto->get_args()->get_type_list();
+    m_words.push_back(args.size());
+    for (DexType* arg : args) {
+      add_type(arg);
+    }
+  }
+
+  void add_action(const PointsToAction& action) {
+    const PointsToOperation& operation = action.m_operation;
+    m_words.push_back(operation.kind);
+    switch (operation.kind) {
+    case PTS_CONST_STRING: {
+      add_string(operation.dex_string);
+      break;
+    }
+    case PTS_CONST_CLASS:
+    case PTS_NEW_OBJECT:
+    case PTS_CHECK_CAST: {
+      add_type(operation.dex_type);
+      break;
+    }
+    case PTS_GET_EXCEPTION:
+    case PTS_GET_CLASS:
+    case PTS_RETURN:
+    case PTS_DISJUNCTION: {
+      break;
+    }
+    case PTS_LOAD_PARAM: {
+      m_words.push_back(operation.parameter);
+      break;
+    }
+    case PTS_IGET:
+    case PTS_SGET:
+    case PTS_IPUT:
+    case PTS_SPUT: {
+      add_type(operation.dex_field->get_class());
+      add_string(operation.dex_field->get_name());
+      add_type(operation.dex_field->get_type());
+      break;
+    }
+    case PTS_IGET_SPECIAL:
+    case PTS_IPUT_SPECIAL: {
+      m_words.push_back(operation.special_edge);
+      break;
+    }
+    case PTS_INVOKE_VIRTUAL:
+    case PTS_INVOKE_SUPER:
+    case PTS_INVOKE_DIRECT:
+    case PTS_INVOKE_INTERFACE:
+    case PTS_INVOKE_STATIC: {
+      add_method(operation.dex_method);
+      break;
+    }
+    }
+    m_words.push_back(action.m_arguments.size());
+    for (const auto& arg : action.m_arguments) {
+      m_words.push_back(static_cast<uint32_t>(arg.first));
+      m_words.push_back(static_cast<uint32_t>(arg.second.m_id));
+    }
+  }
+
+  std::unordered_map<const DexString*, uint32_t> m_string_index;
+  std::vector<stubs_string> m_strings;
+  std::vector<uint32_t> m_method_offsets;
+  std::vector<uint32_t> m_words;
+  std::vector<char> m_string_data;
+};
+
+/*
+ * Reads the stubs of a file written by StubWriter, which is mapped rather than
+ * read. Any inconsistency in the file is fatal, as for the text format.
+ */
+class StubReader {
+ public:
+  explicit StubReader(const std::string& file_name) : m_what(file_name) {
+    m_file.open(file_name, boost::iostreams::mapped_file::readonly);
+    check(m_file.is_open());
+    const char* data = m_file.const_data();
+    size_t size = m_file.size();
+    check(size >= sizeof(stubs_header));
+    memcpy(&m_header, data, sizeof(m_header));
+    check(m_header.version == kStubsVersion);
+    uint64_t expected_size =
+        sizeof(m_header) +
+        uint64_t(m_header.num_strings) * sizeof(stubs_string) +
+        (uint64_t(m_header.num_methods) + m_header.num_words) *
+            sizeof(uint32_t) +
+        m_header.string_data_size;
+    check(size == expected_size);
+    auto strings = (const stubs_string*)(data + sizeof(m_header));
+    m_method_offsets = (const uint32_t*)(strings + m_header.num_strings);
+    m_words = m_method_offsets + m_header.num_methods;
+    auto string_data = (const char*)(m_words + m_header.num_words);
+
+    // The strings are interned up front, so that the workers decoding the
+    // methods only read from the reader.
+    m_interned.reserve(m_header.num_strings);
+    for (uint32_t i = 0; i < m_header.num_strings; ++i) {
+      check(strings[i].offset + uint64_t(strings[i].size) <
+                m_header.string_data_size &&
+            string_data[strings[i].offset + strings[i].size] == '\0');
+      m_interned.push_back(
+          DexString::make_string(string_data + strings[i].offset));
+    }
+  }
+
+  static bool is_stub_file(const std::string& file_name) {
+    std::ifstream file_input(file_name, std::ios::binary);
+    char magic[sizeof(kStubsMagic)];
+    return file_input.read(magic, sizeof(magic)) &&
+           memcmp(magic, kStubsMagic, sizeof(kStubsMagic)) == 0;
+  }
+
+  size_t num_methods() const { return m_header.num_methods; }
+
+  PointsToMethodSemantics read_method(size_t i) const {
+    check(m_method_offsets[i] < m_header.num_words);
+    Cursor cursor{m_words + m_method_offsets[i],
+                  m_words + m_header.num_words};
+    DexMethodRef* dex_method = next_method(cursor);
+    uint32_t kind = next(cursor);
+    check(kind <= PTS_STUB);
+    uint32_t variable_counter = next(cursor);
+    uint32_t num_actions = next(cursor);
+    check(num_actions <= m_header.num_words);
+    PointsToMethodSemantics semantics(
+        dex_method, static_cast<MethodKind>(kind), variable_counter, num_actions);
+    for (uint32_t j = 0; j < num_actions; ++j) {
+      semantics.add(next_action(cursor));
+    }
+    return semantics;
+  }
+
+ private:
+  struct Cursor {
+    const uint32_t* word;
+    const uint32_t* end;
+  };
+
+  void check(bool ok) const {
+    always_assert_log(ok, "Corrupt points-to stubs %s", m_what.c_str());
+  }
+
+  uint32_t next(Cursor& cursor) const {
+    check(cursor.word != cursor.end);
+    return *cursor.word++;
+  }
+
+  DexString* next_string(Cursor& cursor) const {
+    auto idx = next(cursor);
+    check(idx < m_interned.size());
+    return m_interned[idx];
+  }
+
+  DexType* next_type(Cursor& cursor) const {
+    return DexType::make_type(next_string(cursor));
+  }
+
+  DexMethodRef* next_method(Cursor& cursor) const {
+    DexType* type = next_type(cursor);
+    DexString* name = next_string(cursor);
+    DexType* rtype = next_type(cursor);
+    uint32_t num_args = next(cursor);
+    std::deque<DexType*> args;
+    for (uint32_t i = 0; i < num_args; ++i) {
+      args.push_back(next_type(cursor));
+    }
+    return DexMethod::make_method(
+        type,
+        name,
+        DexProto::make_proto(rtype,
+                             DexTypeList::make_type_list(std::move(args))));
+  }
+
+  PointsToOperation next_operation(Cursor& cursor) const {
+    uint32_t kind = next(cursor);
+    check(kind <= PTS_DISJUNCTION);
+    auto op_kind = static_cast<PointsToOperationKind>(kind);
+    switch (op_kind) {
+    case PTS_CONST_STRING: {
+      return PointsToOperation(op_kind, next_string(cursor));
+    }
+    case PTS_CONST_CLASS:
+    case PTS_NEW_OBJECT:
+    case PTS_CHECK_CAST: {
+      return PointsToOperation(op_kind, next_type(cursor));
+    }
+    case PTS_GET_EXCEPTION:
+    case PTS_GET_CLASS:
+    case PTS_RETURN:
+    case PTS_DISJUNCTION: {
+      return PointsToOperation(op_kind);
+    }
+    case PTS_LOAD_PARAM: {
+      return PointsToOperation(op_kind, static_cast<size_t>(next(cursor)));
+    }
+    case PTS_IGET:
+    case PTS_SGET:
+    case PTS_IPUT:
+    case PTS_SPUT: {
+      DexType* container = next_type(cursor);
+      DexString* name = next_string(cursor);
+      DexType* type = next_type(cursor);
+      return PointsToOperation(op_kind,
+                               DexField::make_field(container, name, type));
+    }
+    case PTS_IGET_SPECIAL:
+    case PTS_IPUT_SPECIAL: {
+      uint32_t edge = next(cursor);
+      check(edge == PTS_ARRAY_ELEMENT);
+      return PointsToOperation(op_kind, static_cast<SpecialPointsToEdge>(edge));
+    }
+    case PTS_INVOKE_VIRTUAL:
+    case PTS_INVOKE_SUPER:
+    case PTS_INVOKE_DIRECT:
+    case PTS_INVOKE_INTERFACE:
+    case PTS_INVOKE_STATIC: {
+      return PointsToOperation(op_kind, next_method(cursor));
+    }
+    }
+    not_reached();
+  }
+
+  PointsToAction next_action(Cursor& cursor) const {
+    PointsToOperation operation = next_operation(cursor);
+    uint32_t num_args = next(cursor);
+    check(num_args <= size_t(cursor.end - cursor.word) / 2);
+    std::vector<std::pair<int32_t, PointsToVariable>> arguments;
+    arguments.reserve(num_args);
+    for (uint32_t i = 0; i < num_args; ++i) {
+      auto key = static_cast<int32_t>(next(cursor));
+      auto id = static_cast<int32_t>(next(cursor));
+      arguments.push_back({key, PointsToVariable(id)});
+    }
+    return PointsToAction(operation, arguments);
+  }
+
+  std::string m_what;
+  boost::iostreams::mapped_file m_file;
+  stubs_header m_header;
+  const uint32_t* m_method_offsets{nullptr};
+  const uint32_t* m_words{nullptr};
+  std::vector<DexString*> m_interned;
+};
+
+} // namespace pts_impl
+
 PointsToSemantics::PointsToSemantics(const Scope& scope, bool generate_stubs)
     : m_generate_stubs(generate_stubs), m_type_system(scope) {
   // We size the hash table so as to fit all the methods in scope.
@@ -1592,6 +1936,10 @@ PointsToSemantics::PointsToSemantics(const Scope& scope, bool generate_stubs)
 }
 
 void PointsToSemantics::load_stubs(const std::string& file_name) {
+  if (pts_impl::StubReader::is_stub_file(file_name)) {
+    load_binary_stubs(file_name);
+    return;
+  }
   std::ifstream file_input(file_name);
   s_expr_istream s_expr_input(file_input);
   while (s_expr_input.good()) {
@@ -1605,13 +1953,53 @@ void PointsToSemantics::load_stubs(const std::string& file_name) {
     auto semantics_opt = PointsToMethodSemantics::from_s_expr(expr);
     always_assert_log(
         semantics_opt, "Couldn't parse S-expression: %s\n", expr.str().c_str());
-    DexMethodRef* dex_method = semantics_opt->get_method();
-    auto it = m_method_semantics.find(dex_method);
-    if (it == m_method_semantics.end()) {
-      m_method_semantics.emplace(dex_method, *semantics_opt);
-    } else {
-      TRACE(PTA, 2, "Collision with stub for method %s\n", SHOW(dex_method));
-    }
+    add_stub(*semantics_opt);
+  }
+}
+
+void PointsToSemantics::load_binary_stubs(const std::string& file_name) {
+  pts_impl::StubReader reader(file_name);
+  std::vector<boost::optional<PointsToMethodSemantics>> stubs(
+      reader.num_methods());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { stubs[i] = reader.read_method(i); });
+  for (size_t i = 0; i < stubs.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  for (const auto& stub : stubs) {
+    add_stub(*stub);
+  }
+}
+
+void PointsToSemantics::write_stubs(const std::string& file_name) const {
+  // The methods are written in a fixed order, so that the file only depends
+  // on the semantics.
+  std::vector<const PointsToMethodSemantics*> all_semantics;
+  all_semantics.reserve(m_method_semantics.size());
+  for (const auto& entry : m_method_semantics) {
+    all_semantics.push_back(&entry.second);
+  }
+  std::sort(all_semantics.begin(),
+            all_semantics.end(),
+            [](const PointsToMethodSemantics* s1,
+               const PointsToMethodSemantics* s2) {
+              return compare_dexmethods(s1->get_method(), s2->get_method());
+            });
+  pts_impl::StubWriter writer;
+  for (const auto* semantics : all_semantics) {
+    writer.add(*semantics);
+  }
+  writer.write(file_name);
+}
+
+void PointsToSemantics::add_stub(const PointsToMethodSemantics& semantics) {
+  DexMethodRef* dex_method = semantics.get_method();
+  auto it = m_method_semantics.find(dex_method);
+  if (it == m_method_semantics.end()) {
+    m_method_semantics.emplace(dex_method, semantics);
+  } else {
+    TRACE(PTA, 2, "Collision with stub for method %s\n", SHOW(dex_method));
   }
 }
 
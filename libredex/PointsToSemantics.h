@@ -94,8 +94,14 @@
  * code.
  */
 
-// Forward declaration.
+// Forward declarations.
 class PointsToSemantics;
+class PointsToSolver;
+
+namespace pts_impl {
+class StubReader;
+class StubWriter;
+} // namespace pts_impl
 
 /*
  * A points-to variable denotes a set of abstract object instances. It is
@@ -134,6 +140,9 @@ class PointsToVariable final {
   int32_t m_id;
 
   friend class PointsToMethodSemantics;
+  friend class PointsToSolver;
+  friend class pts_impl::StubReader;
+  friend class pts_impl::StubWriter;
   friend size_t hash_value(const PointsToVariable&);
   friend bool operator==(const PointsToVariable&, const PointsToVariable&);
   friend bool operator<(const PointsToVariable&, const PointsToVariable&);
@@ -424,6 +433,9 @@ class PointsToAction final {
   // operation (like the left-hand side of an assignment operation) have a
   // negative index.
   boost::container::flat_map<int32_t, PointsToVariable> m_arguments;
+
+  friend class pts_impl::StubReader;
+  friend class pts_impl::StubWriter;
 };
 
 std::ostream& operator<<(std::ostream& o, const PointsToAction& a);
@@ -461,6 +473,9 @@ class PointsToMethodSemantics {
     return PointsToVariable(m_variable_counter++);
   }
 
+  // The variables of the method are numbered from 0 to this count (excluded).
+  size_t get_variable_count() const { return m_variable_counter; }
+
   const std::vector<PointsToAction>& get_points_to_actions() const {
     return m_points_to_actions;
   }
@@ -487,6 +502,7 @@ class PointsToMethodSemantics {
   size_t m_variable_counter;
   std::vector<PointsToAction> m_points_to_actions;
 
+  friend class pts_impl::StubWriter;
   friend std::ostream& operator<<(std::ostream&,
                                   const PointsToMethodSemantics&);
 };
@@ -522,12 +538,20 @@ class PointsToSemantics final {
   PointsToSemantics(const Scope& scope, bool generate_stubs = false);
 
   /*
-   * The stubs are stored in the specified text file as S-expressions. In case
-   * of a collision between a method in the APK and a stub, the stub is
-   * discarded.
+   * The stubs are stored in the specified file, either as S-expressions in a
+   * text file, or in the binary format written by write_stubs(), which is
+   * mapped and decoded in parallel. In case of a collision between a method
+   * in the APK and a stub, the stub is discarded.
    */
   void load_stubs(const std::string& file_name);
 
+  /*
+   * Writes the points-to semantics of all methods in the binary format that
+   * load_stubs() reads. Built once with `generate_stubs` set, e.g., from
+   * android.jar, the file then stands for the library in later analyses.
+   */
+  void write_stubs(const std::string& file_name) const;
+
   iterator begin() { return m_method_semantics.begin(); }
 
   iterator end() { return m_method_semantics.end(); }
@@ -544,6 +568,10 @@ class PointsToSemantics final {
 
   void generate_points_to_actions(DexMethod* dex_method);
 
+  void load_binary_stubs(const std::string& file_name);
+
+  void add_stub(const PointsToMethodSemantics& semantics);
+
   bool m_generate_stubs;
   TypeSystem m_type_system;
   PointsToSemanticsUtils m_utils;
@@ -0,0 +1,644 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "PointsToSolver.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "Debug.h"
+#include "DexUtil.h"
+#include "ReachableClasses.h"
+#include "Resolver.h"
+#include "Trace.h"
+
+namespace {
+
+uint64_t edge_key(uint32_t src, uint32_t dst) {
+  return (uint64_t(src) << 32) | dst;
+}
+
+} // namespace
+
+PointsToSolver::PointsToSolver(
+    PointsToSemantics& semantics,
+    const std::function<bool(DexMethodRef*)>& is_entry_point)
+    : m_semantics(semantics) {
+  // Field 0 stands for the elements of arrays.
+  m_field_index.emplace(nullptr, 0);
+  m_external_site = new_site(PTS_SITE_EXTERNAL, nullptr);
+  m_class_site = new_site(PTS_SITE_CLASS, get_class_type());
+  m_outside_world = new_node();
+  add_object(m_outside_world, m_external_site);
+
+  // All the methods get their nodes before any constraint is generated, since
+  // the calls to static and direct methods are bound right away.
+  for (const auto& entry : m_semantics) {
+    const PointsToMethodSemantics& method_semantics = entry.second;
+    if (method_semantics.kind() != PTS_APK &&
+        method_semantics.kind() != PTS_STUB) {
+      continue;
+    }
+    DexMethodRef* method = method_semantics.get_method();
+    MethodNodes nodes;
+    nodes.this_node = new_node();
+    nodes.return_node = new_node();
+    nodes.num_params = method->get_proto()->get_args()->get_type_list().size();
+    nodes.first_param = m_representative.size();
+    for (uint32_t i = 0; i < nodes.num_params; ++i) {
+      new_node();
+    }
+    nodes.num_variables = method_semantics.get_variable_count();
+    nodes.first_variable = m_representative.size();
+    for (uint32_t i = 0; i < nodes.num_variables; ++i) {
+      new_node();
+    }
+    m_method_nodes.emplace(method, nodes);
+  }
+  for (const auto& entry : m_semantics) {
+    if (m_method_nodes.count(entry.second.get_method())) {
+      generate_constraints(entry.second);
+    }
+  }
+
+  for (const auto& entry : m_method_nodes) {
+    DexMethodRef* method = entry.first;
+    bool is_entry = is_entry_point
+                        ? is_entry_point(method)
+                        : method->is_def() &&
+                              !can_delete(static_cast<DexMethod*>(method));
+    if (!is_entry) {
+      continue;
+    }
+    const MethodNodes& nodes = entry.second;
+    add_edge(m_outside_world, nodes.this_node);
+    for (uint32_t i = 0; i < nodes.num_params; ++i) {
+      add_edge(m_outside_world, nodes.first_param + i);
+    }
+    add_edge(nodes.return_node, m_outside_world);
+  }
+
+  solve();
+  TRACE(PTA,
+        1,
+        "Points-to solver: %lu nodes, %lu allocation sites, %lu call sites\n",
+        m_representative.size(),
+        m_sites.size(),
+        m_call_sites.size());
+}
+
+void PointsToSolver::generate_constraints(
+    const PointsToMethodSemantics& semantics) {
+  DexMethodRef* method = semantics.get_method();
+  const MethodNodes& nodes = m_method_nodes.at(method);
+  const auto& actions = semantics.get_points_to_actions();
+  for (size_t i = 0; i < actions.size(); ++i) {
+    const PointsToAction& action = actions[i];
+    const PointsToOperation& operation = action.operation();
+    switch (operation.kind) {
+    case PTS_CONST_STRING: {
+      auto it = m_string_sites.find(operation.dex_string);
+      if (it == m_string_sites.end()) {
+        it = m_string_sites
+                 .emplace(operation.dex_string,
+                          new_site(PTS_SITE_STRING, get_string_type()))
+                 .first;
+      }
+      add_object(node_of(nodes, action.dest()), it->second);
+      break;
+    }
+    case PTS_CONST_CLASS:
+    case PTS_GET_CLASS: {
+      add_object(node_of(nodes, action.dest()), m_class_site);
+      break;
+    }
+    case PTS_GET_EXCEPTION: {
+      // Thrown objects aren't modeled, so a caught exception could be
+      // anything.
+      add_edge(m_outside_world, node_of(nodes, action.dest()));
+      break;
+    }
+    case PTS_NEW_OBJECT: {
+      auto site = new_site(
+          PTS_SITE_NEW_OBJECT, operation.dex_type, method, i);
+      m_new_object_sites.emplace(std::make_pair(method, i), site);
+      add_object(node_of(nodes, action.dest()), site);
+      break;
+    }
+    case PTS_LOAD_PARAM: {
+      if (operation.parameter < nodes.num_params) {
+        add_edge(nodes.first_param + operation.parameter,
+                 node_of(nodes, action.dest()));
+      }
+      break;
+    }
+    case PTS_CHECK_CAST: {
+      add_edge(node_of(nodes, action.src()), node_of(nodes, action.dest()));
+      break;
+    }
+    case PTS_IGET:
+    case PTS_IGET_SPECIAL: {
+      uint32_t field =
+          operation.kind == PTS_IGET ? field_index(operation.dex_field) : 0;
+      add_constraint(node_of(nodes, action.instance()),
+                     {Constraint::LOAD, field, node_of(nodes, action.dest())});
+      break;
+    }
+    case PTS_SGET: {
+      add_edge(static_field_node(operation.dex_field),
+               node_of(nodes, action.dest()));
+      break;
+    }
+    case PTS_IPUT:
+    case PTS_IPUT_SPECIAL: {
+      uint32_t field =
+          operation.kind == PTS_IPUT ? field_index(operation.dex_field) : 0;
+      add_constraint(node_of(nodes, action.lhs()),
+                     {Constraint::STORE, field, node_of(nodes, action.rhs())});
+      break;
+    }
+    case PTS_SPUT: {
+      add_edge(node_of(nodes, action.rhs()),
+               static_field_node(operation.dex_field));
+      break;
+    }
+    case PTS_INVOKE_VIRTUAL:
+    case PTS_INVOKE_SUPER:
+    case PTS_INVOKE_DIRECT:
+    case PTS_INVOKE_INTERFACE:
+    case PTS_INVOKE_STATIC: {
+      CallSite call_site;
+      call_site.operation = operation;
+      call_site.dest =
+          action.has_dest() ? node_of(nodes, action.dest()) : kNoNode;
+      call_site.receiver = operation.is_static_call()
+                               ? kNoNode
+                               : node_of(nodes, action.instance());
+      for (const auto& arg : action.get_arguments()) {
+        call_site.args.emplace_back(arg.first, node_of(nodes, arg.second));
+      }
+      uint32_t index = m_call_sites.size();
+      m_call_sites.push_back(std::move(call_site));
+      m_call_site_index.emplace(std::make_pair(method, i), index);
+      if (operation.kind == PTS_INVOKE_VIRTUAL ||
+          operation.kind == PTS_INVOKE_INTERFACE) {
+        add_constraint(m_call_sites[index].receiver,
+                       {Constraint::CALL, index, kNoNode});
+        break;
+      }
+      MethodSearch search =
+          operation.kind == PTS_INVOKE_STATIC
+              ? MethodSearch::Static
+              : operation.kind == PTS_INVOKE_DIRECT ? MethodSearch::Direct
+                                                    : MethodSearch::Virtual;
+      DexMethodRef* callee = resolve_method(operation.dex_method, search);
+      bind(index, callee != nullptr ? callee : operation.dex_method);
+      break;
+    }
+    case PTS_RETURN: {
+      add_edge(node_of(nodes, action.src()), nodes.return_node);
+      break;
+    }
+    case PTS_DISJUNCTION: {
+      NodeId dest = node_of(nodes, action.dest());
+      for (const auto& arg : action.get_arguments()) {
+        add_edge(node_of(nodes, arg.second), dest);
+      }
+      break;
+    }
+    }
+  }
+}
+
+PointsToSolver::NodeId PointsToSolver::node_of(const MethodNodes& nodes,
+                                               PointsToVariable v) const {
+  if (v == PointsToVariable::null_variable()) {
+    return kNoNode;
+  }
+  if (v == PointsToVariable::this_variable()) {
+    return nodes.this_node;
+  }
+  auto var_id = static_cast<uint32_t>(v.m_id);
+  always_assert(var_id < nodes.num_variables);
+  return nodes.first_variable + var_id;
+}
+
+const PointsToSolver::MethodNodes* PointsToSolver::method_nodes(
+    DexMethodRef* method) const {
+  auto it = m_method_nodes.find(method);
+  return it == m_method_nodes.end() ? nullptr : &it->second;
+}
+
+uint32_t PointsToSolver::field_index(DexFieldRef* field) {
+  DexFieldRef* resolved = resolve_field(field, FieldSearch::Instance);
+  if (resolved != nullptr) {
+    field = resolved;
+  }
+  return m_field_index.emplace(field, m_field_index.size()).first->second;
+}
+
+PointsToSolver::NodeId PointsToSolver::field_node(AllocationSiteId object,
+                                                  uint32_t field) {
+  // What the outside world holds is the outside world's.
+  if (object == m_external_site) {
+    return m_outside_world;
+  }
+  auto it = m_field_nodes.find(edge_key(object, field));
+  if (it != m_field_nodes.end()) {
+    return it->second;
+  }
+  NodeId node = new_node();
+  m_field_nodes.emplace(edge_key(object, field), node);
+  m_object_fields[object].push_back(node);
+  if (m_points_to[find(m_outside_world)].contains(object)) {
+    add_edge(node, m_outside_world);
+  }
+  return node;
+}
+
+PointsToSolver::NodeId PointsToSolver::static_field_node(DexFieldRef* field) {
+  DexFieldRef* resolved = resolve_field(field, FieldSearch::Static);
+  if (resolved != nullptr) {
+    field = resolved;
+  }
+  auto it = m_static_field_nodes.find(field);
+  if (it != m_static_field_nodes.end()) {
+    return it->second;
+  }
+  NodeId node = new_node();
+  m_static_field_nodes.emplace(field, node);
+  add_edge(node, m_outside_world);
+  return node;
+}
+
+AllocationSiteId PointsToSolver::new_site(AllocationSiteKind kind,
+                                          DexType* type,
+                                          DexMethodRef* method,
+                                          size_t action_index) {
+  m_sites.push_back(AllocationSite{kind, type, method, action_index});
+  m_object_fields.emplace_back();
+  return m_sites.size() - 1;
+}
+
+PointsToSolver::NodeId PointsToSolver::new_node() {
+  NodeId node = m_representative.size();
+  m_representative.push_back(node);
+  m_points_to.emplace_back();
+  m_delta.emplace_back();
+  m_successors.emplace_back();
+  m_constraints.emplace_back();
+  m_in_worklist.push_back(false);
+  return node;
+}
+
+PointsToSolver::NodeId PointsToSolver::find(NodeId node) const {
+  NodeId root = node;
+  while (m_representative[root] != root) {
+    root = m_representative[root];
+  }
+  while (m_representative[node] != root) {
+    NodeId next = m_representative[node];
+    m_representative[node] = root;
+    node = next;
+  }
+  return root;
+}
+
+void PointsToSolver::add_edge(NodeId src, NodeId dst) {
+  if (src == kNoNode || dst == kNoNode) {
+    return;
+  }
+  src = find(src);
+  dst = find(dst);
+  if (src == dst || !m_edges.insert(edge_key(src, dst)).second) {
+    return;
+  }
+  m_successors[src].push_back(dst);
+  propagate(m_points_to[src], dst);
+}
+
+void PointsToSolver::add_object(NodeId node, AllocationSiteId object) {
+  if (node == kNoNode) {
+    return;
+  }
+  node = find(node);
+  if (m_points_to[node].insert(object)) {
+    m_delta[node].insert(object);
+    if (!m_in_worklist[node]) {
+      m_in_worklist[node] = true;
+      m_worklist.push_back(node);
+    }
+  }
+}
+
+void PointsToSolver::add_constraint(NodeId node, const Constraint& constraint) {
+  if (node == kNoNode) {
+    return;
+  }
+  node = find(node);
+  m_constraints[node].push_back(constraint);
+  // The objects already in the set have to go through the new constraint.
+  if (!m_points_to[node].empty()) {
+    m_delta[node] = m_points_to[node];
+    if (!m_in_worklist[node]) {
+      m_in_worklist[node] = true;
+      m_worklist.push_back(node);
+    }
+  }
+}
+
+void PointsToSolver::propagate(const SparseBitSet& objects, NodeId dst) {
+  auto added = objects.difference(m_points_to[dst]);
+  if (added.empty()) {
+    return;
+  }
+  m_points_to[dst].union_with(added);
+  m_delta[dst].union_with(added);
+  if (!m_in_worklist[dst]) {
+    m_in_worklist[dst] = true;
+    m_worklist.push_back(dst);
+  }
+}
+
+void PointsToSolver::bind(uint32_t call_site, DexMethodRef* callee) {
+  CallSite& site = m_call_sites[call_site];
+  if (!site.targets.insert(callee).second) {
+    return;
+  }
+  const MethodNodes* nodes = method_nodes(callee);
+  if (nodes == nullptr) {
+    bind_to_outside_world(call_site);
+    return;
+  }
+  for (const auto& arg : site.args) {
+    if (arg.first < nodes->num_params) {
+      add_edge(arg.second, nodes->first_param + arg.first);
+    }
+  }
+  add_edge(nodes->return_node, site.dest);
+  // The receiver of a virtual call only passes the objects that dispatch to
+  // the callee, see dispatch().
+  if (site.operation.kind != PTS_INVOKE_VIRTUAL &&
+      site.operation.kind != PTS_INVOKE_INTERFACE) {
+    add_edge(site.receiver, nodes->this_node);
+  }
+}
+
+void PointsToSolver::bind_to_outside_world(uint32_t call_site) {
+  CallSite& site = m_call_sites[call_site];
+  if (site.is_bound_to_outside_world) {
+    return;
+  }
+  site.is_bound_to_outside_world = true;
+  for (const auto& arg : site.args) {
+    add_edge(arg.second, m_outside_world);
+  }
+  add_edge(site.receiver, m_outside_world);
+  add_edge(m_outside_world, site.dest);
+}
+
+void PointsToSolver::dispatch(uint32_t call_site, AllocationSiteId receiver) {
+  DexType* type = m_sites[receiver].type;
+  DexMethodRef* callee =
+      type == nullptr
+          ? nullptr
+          : resolve_virtual_callee(m_call_sites[call_site].operation, type);
+  if (callee == nullptr) {
+    m_call_sites[call_site].is_complete = false;
+    bind_to_outside_world(call_site);
+    return;
+  }
+  bind(call_site, callee);
+  const MethodNodes* nodes = method_nodes(callee);
+  if (nodes != nullptr) {
+    add_object(nodes->this_node, receiver);
+  }
+}
+
+DexMethodRef* PointsToSolver::resolve_virtual_callee(
+    const PointsToOperation& operation, DexType* type) {
+  auto key = std::make_pair(type, operation.dex_method);
+  auto it = m_virtual_callees.find(key);
+  if (it != m_virtual_callees.end()) {
+    return it->second;
+  }
+  // Arrays only have the methods of java.lang.Object.
+  const DexClass* cls = type_class(is_array(type) ? get_object_type() : type);
+  DexMethodRef* callee =
+      cls == nullptr ? nullptr
+                     : resolve_method(cls,
+                                      operation.dex_method->get_name(),
+                                      operation.dex_method->get_proto(),
+                                      MethodSearch::Virtual);
+  m_virtual_callees.emplace(key, callee);
+  return callee;
+}
+
+void PointsToSolver::solve() {
+  while (!m_worklist.empty()) {
+    NodeId node = m_worklist.back();
+    m_worklist.pop_back();
+    m_in_worklist[node] = false;
+    if (find(node) == node) {
+      process(node);
+    }
+  }
+}
+
+void PointsToSolver::process(NodeId node) {
+  SparseBitSet delta;
+  std::swap(delta, m_delta[node]);
+  if (delta.empty()) {
+    return;
+  }
+
+  // The fields of the objects that reach the outside world do too.
+  if (node == find(m_outside_world)) {
+    for (AllocationSiteId object : delta) {
+      auto fields = m_object_fields[object];
+      for (NodeId field : fields) {
+        add_edge(field, node);
+      }
+    }
+  }
+
+  // The constraints may add nodes, which invalidates references into the
+  // node vectors, hence the copies.
+  auto constraints = m_constraints[node];
+  for (const auto& constraint : constraints) {
+    for (AllocationSiteId object : delta) {
+      switch (constraint.kind) {
+      case Constraint::LOAD: {
+        add_edge(field_node(object, constraint.index), constraint.other);
+        break;
+      }
+      case Constraint::STORE: {
+        add_edge(constraint.other, field_node(object, constraint.index));
+        break;
+      }
+      case Constraint::CALL: {
+        dispatch(constraint.index, object);
+        break;
+      }
+      }
+    }
+  }
+
+  auto successors = m_successors[node];
+  for (NodeId successor : successors) {
+    NodeId src = find(node);
+    NodeId dst = find(successor);
+    if (src == dst) {
+      continue;
+    }
+    propagate(delta, dst);
+    // An edge between two nodes with the same set may close a cycle.
+    if (m_points_to[src] == m_points_to[dst] &&
+        m_checked_edges.insert(edge_key(src, dst)).second) {
+      detect_cycle(dst);
+    }
+  }
+}
+
+void PointsToSolver::detect_cycle(NodeId start) {
+  // Tarjan's algorithm, from `start`, with an explicit stack. Each strongly
+  // connected component is collapsed as soon as it's found.
+  struct Frame {
+    NodeId node;
+    size_t next_successor;
+  };
+  std::unordered_map<NodeId, uint32_t> index;
+  std::unordered_map<NodeId, uint32_t> lowlink;
+  std::vector<NodeId> component_stack;
+  std::unordered_set<NodeId> on_stack;
+  std::vector<Frame> frames;
+
+  auto visit = [&](NodeId node) {
+    uint32_t i = index.size();
+    index.emplace(node, i);
+    lowlink.emplace(node, i);
+    component_stack.push_back(node);
+    on_stack.insert(node);
+    frames.push_back({node, 0});
+  };
+
+  visit(find(start));
+  while (!frames.empty()) {
+    Frame& frame = frames.back();
+    NodeId node = frame.node;
+    if (frame.next_successor < m_successors[node].size()) {
+      NodeId successor = find(m_successors[node][frame.next_successor++]);
+      if (successor == node) {
+        continue;
+      }
+      if (!index.count(successor)) {
+        visit(successor);
+      } else if (on_stack.count(successor)) {
+        lowlink[node] = std::min(lowlink[node], index[successor]);
+      }
+      continue;
+    }
+    frames.pop_back();
+    if (!frames.empty()) {
+      NodeId parent = frames.back().node;
+      lowlink[parent] = std::min(lowlink[parent], lowlink[node]);
+    }
+    if (lowlink[node] != index[node]) {
+      continue;
+    }
+    std::vector<NodeId> component;
+    NodeId member;
+    do {
+      member = component_stack.back();
+      component_stack.pop_back();
+      on_stack.erase(member);
+      component.push_back(member);
+    } while (member != node);
+    if (component.size() == 1) {
+      continue;
+    }
+    for (NodeId other : component) {
+      if (other != node) {
+        merge(other, node);
+      }
+    }
+    // The merged node has to go through the edges and constraints that each
+    // of its parts didn't have.
+    m_delta[node] = m_points_to[node];
+    if (!m_in_worklist[node]) {
+      m_in_worklist[node] = true;
+      m_worklist.push_back(node);
+    }
+  }
+}
+
+void PointsToSolver::merge(NodeId node, NodeId into) {
+  m_representative[node] = into;
+  m_points_to[into].union_with(m_points_to[node]);
+  auto& successors = m_successors[into];
+  successors.insert(successors.end(),
+                    m_successors[node].begin(),
+                    m_successors[node].end());
+  auto& constraints = m_constraints[into];
+  constraints.insert(constraints.end(),
+                     m_constraints[node].begin(),
+                     m_constraints[node].end());
+  m_points_to[node] = SparseBitSet();
+  m_delta[node] = SparseBitSet();
+  std::vector<NodeId>().swap(m_successors[node]);
+  std::vector<Constraint>().swap(m_constraints[node]);
+}
+
+boost::optional<AllocationSiteId> PointsToSolver::get_allocation_site(
+    DexMethodRef* method, size_t action_index) const {
+  auto it = m_new_object_sites.find(std::make_pair(method, action_index));
+  if (it == m_new_object_sites.end()) {
+    return boost::none;
+  }
+  return it->second;
+}
+
+const SparseBitSet& PointsToSolver::points_to(DexMethodRef* method,
+                                              PointsToVariable v) const {
+  static const SparseBitSet empty;
+  const MethodNodes* nodes = method_nodes(method);
+  NodeId node = nodes == nullptr ? kNoNode : node_of(*nodes, v);
+  return node == kNoNode ? empty : m_points_to[find(node)];
+}
+
+const SparseBitSet& PointsToSolver::returned_by(DexMethodRef* method) const {
+  static const SparseBitSet empty;
+  const MethodNodes* nodes = method_nodes(method);
+  return nodes == nullptr ? empty : m_points_to[find(nodes->return_node)];
+}
+
+bool PointsToSolver::may_alias(DexMethodRef* method1,
+                               PointsToVariable v1,
+                               DexMethodRef* method2,
+                               PointsToVariable v2) const {
+  return points_to(method1, v1).intersects(points_to(method2, v2));
+}
+
+PointsToSolver::CallTargets PointsToSolver::get_callees(
+    DexMethodRef* method, size_t action_index) const {
+  CallTargets result;
+  auto it = m_call_site_index.find(std::make_pair(method, action_index));
+  if (it == m_call_site_index.end()) {
+    result.is_complete = false;
+    return result;
+  }
+  const CallSite& site = m_call_sites[it->second];
+  result.methods = site.targets;
+  result.is_complete = site.is_complete;
+  return result;
+}
+
+bool PointsToSolver::may_escape(AllocationSiteId site) const {
+  return m_points_to[find(m_outside_world)].contains(site);
+}
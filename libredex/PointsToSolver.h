@@ -0,0 +1,238 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+
+#include "DexClass.h"
+#include "PointsToSemantics.h"
+#include "SparseBitSet.h"
+
+/*
+ * An inclusion-based (Andersen-style) solver for the points-to equations of
+ * PointsToSemantics, over the whole program and without context sensitivity.
+ * Abstract objects are allocation sites, numbered densely, and each points-to
+ * set is a SparseBitSet of them.
+ *
+ * The solver works on a graph whose nodes are the variables of all methods,
+ * plus the parameters, `this` and the return value of each method, and a node
+ * per field of each abstract object (or per static field). An edge from a
+ * node to another says that the set of the latter includes the set of the
+ * former. Field accesses and virtual calls add edges as the sets of their
+ * instances and receivers grow, the callees of a virtual call being resolved
+ * on the fly from the types of the objects that the receiver points to.
+ *
+ * Two techniques keep this tractable on large programs:
+ *
+ *  - Difference propagation: a node only pushes along its edges the objects
+ *    it gained since it was last processed, rather than its whole set.
+ *
+ *  - Lazy cycle detection: all the nodes on a cycle end up with the same set.
+ *    When an edge joins two nodes with equal sets, we look for a cycle
+ *    through it (once per edge), and collapse the nodes of the cycle into
+ *    one. See B. Hardekopf and C. Lin. The Ant and the Grasshopper: Fast and
+ *    Accurate Pointer Analysis for Millions of Lines of Code. PLDI 2007.
+ *
+ * Everything the analyzed code can't see is summed up by a single node, the
+ * outside world. The objects passed to methods that have no semantics
+ * (native methods, library methods without stubs), stored into static fields
+ * or into the fields of objects from the outside world, and returned by entry
+ * points flow into it. In turn, the outside world flows into the parameters
+ * of entry points, the results of methods without semantics and the caught
+ * exceptions. The outside world holds one abstract object of its own, which
+ * stands for all the objects that it creates.
+ */
+
+using AllocationSiteId = uint32_t;
+
+enum AllocationSiteKind {
+  PTS_SITE_NEW_OBJECT, // A PTS_NEW_OBJECT action
+  PTS_SITE_STRING, // All the occurrences of a string constant
+  PTS_SITE_CLASS, // All the java.lang.Class objects
+  PTS_SITE_EXTERNAL, // The objects created by the outside world
+};
+
+struct AllocationSite {
+  AllocationSiteKind kind;
+  // The dynamic type of the objects, or nullptr for external objects.
+  DexType* type;
+  // For PTS_SITE_NEW_OBJECT, the method and the index of the action in its
+  // points-to actions.
+  DexMethodRef* method;
+  size_t action_index;
+};
+
+class PointsToSolver final {
+ public:
+  struct CallTargets {
+    // The methods that the call may dispatch to.
+    std::unordered_set<DexMethodRef*> methods;
+    // False if the call may also reach code that we know nothing about, e.g.,
+    // because the receiver may be an external object.
+    bool is_complete{true};
+  };
+
+  /*
+   * Solves the equations of all the methods in `semantics` with actions. The
+   * parameters of the entry points, which are called from the outside world,
+   * may point to any external object. By default, the entry points are the
+   * methods that can't be deleted.
+   */
+  explicit PointsToSolver(
+      PointsToSemantics& semantics,
+      const std::function<bool(DexMethodRef*)>& is_entry_point = nullptr);
+
+  PointsToSolver(const PointsToSolver&) = delete;
+  PointsToSolver& operator=(const PointsToSolver&) = delete;
+
+  size_t allocation_site_count() const { return m_sites.size(); }
+
+  const AllocationSite& get_allocation_site(AllocationSiteId site) const {
+    return m_sites.at(site);
+  }
+
+  // The allocation site of the PTS_NEW_OBJECT action at `action_index` in the
+  // points-to actions of the method, if there is one.
+  boost::optional<AllocationSiteId> get_allocation_site(
+      DexMethodRef* method, size_t action_index) const;
+
+  // The objects that a variable of a method may point to. The set is empty
+  // for the null variable and for the methods that weren't analyzed.
+  const SparseBitSet& points_to(DexMethodRef* method, PointsToVariable v) const;
+
+  // The objects that a method may return.
+  const SparseBitSet& returned_by(DexMethodRef* method) const;
+
+  bool may_alias(DexMethodRef* method1,
+                 PointsToVariable v1,
+                 DexMethodRef* method2,
+                 PointsToVariable v2) const;
+
+  // The targets of the invoke action at `action_index` in the points-to
+  // actions of the method.
+  CallTargets get_callees(DexMethodRef* method, size_t action_index) const;
+
+  // Whether the objects of the allocation site may be seen by the outside
+  // world, directly or through the fields of other objects.
+  bool may_escape(AllocationSiteId site) const;
+
+ private:
+  using NodeId = uint32_t;
+
+  static constexpr NodeId kNoNode = 0xffffffff;
+
+  // The nodes of a method with actions.
+  struct MethodNodes {
+    NodeId this_node;
+    NodeId return_node;
+    NodeId first_param;
+    uint32_t num_params;
+    NodeId first_variable;
+    uint32_t num_variables;
+  };
+
+  // A constraint that adds edges as the set of a node grows.
+  struct Constraint {
+    enum Kind { LOAD, STORE, CALL } kind;
+    // The field for LOAD and STORE, the call site for CALL.
+    uint32_t index;
+    // The destination of a LOAD, the source of a STORE.
+    NodeId other;
+  };
+
+  struct CallSite {
+    PointsToOperation operation;
+    NodeId dest;
+    NodeId receiver;
+    std::vector<std::pair<size_t, NodeId>> args;
+    std::unordered_set<DexMethodRef*> targets;
+    bool is_complete{true};
+    bool is_bound_to_outside_world{false};
+  };
+
+  void generate_constraints(const PointsToMethodSemantics& semantics);
+  NodeId node_of(const MethodNodes& nodes, PointsToVariable v) const;
+  const MethodNodes* method_nodes(DexMethodRef* method) const;
+  uint32_t field_index(DexFieldRef* field);
+  NodeId field_node(AllocationSiteId object, uint32_t field);
+  NodeId static_field_node(DexFieldRef* field);
+  AllocationSiteId new_site(AllocationSiteKind kind,
+                            DexType* type,
+                            DexMethodRef* method = nullptr,
+                            size_t action_index = 0);
+
+  NodeId new_node();
+  NodeId find(NodeId node) const;
+  void add_edge(NodeId src, NodeId dst);
+  void add_object(NodeId node, AllocationSiteId object);
+  void add_constraint(NodeId node, const Constraint& constraint);
+  void propagate(const SparseBitSet& objects, NodeId dst);
+
+  void bind(uint32_t call_site, DexMethodRef* callee);
+  void bind_to_outside_world(uint32_t call_site);
+  void dispatch(uint32_t call_site, AllocationSiteId receiver);
+  DexMethodRef* resolve_virtual_callee(const PointsToOperation& operation,
+                                       DexType* type);
+
+  void solve();
+  void process(NodeId node);
+  void detect_cycle(NodeId node);
+  void merge(NodeId node, NodeId into);
+
+  PointsToSemantics& m_semantics;
+
+  std::vector<AllocationSite> m_sites;
+  std::unordered_map<DexString*, AllocationSiteId> m_string_sites;
+  std::unordered_map<std::pair<DexMethodRef*, size_t>,
+                     AllocationSiteId,
+                     boost::hash<std::pair<DexMethodRef*, size_t>>>
+      m_new_object_sites;
+  AllocationSiteId m_class_site;
+  AllocationSiteId m_external_site;
+
+  std::unordered_map<DexMethodRef*, MethodNodes> m_method_nodes;
+  std::vector<CallSite> m_call_sites;
+  std::unordered_map<std::pair<DexMethodRef*, size_t>,
+                     uint32_t,
+                     boost::hash<std::pair<DexMethodRef*, size_t>>>
+      m_call_site_index;
+  std::unordered_map<std::pair<DexType*, DexMethodRef*>,
+                     DexMethodRef*,
+                     boost::hash<std::pair<DexType*, DexMethodRef*>>>
+      m_virtual_callees;
+
+  // The fields are numbered, the array elements being field 0.
+  std::unordered_map<DexFieldRef*, uint32_t> m_field_index;
+  std::unordered_map<uint64_t, NodeId> m_field_nodes;
+  std::unordered_map<DexFieldRef*, NodeId> m_static_field_nodes;
+  // The field nodes of each object, by allocation site.
+  std::vector<std::vector<NodeId>> m_object_fields;
+
+  NodeId m_outside_world;
+
+  // The nodes, indexed by NodeId. A node that was merged into another one
+  // keeps a link to it in m_representative, and nothing else.
+  mutable std::vector<NodeId> m_representative;
+  std::vector<SparseBitSet> m_points_to;
+  std::vector<SparseBitSet> m_delta;
+  std::vector<std::vector<NodeId>> m_successors;
+  std::vector<std::vector<Constraint>> m_constraints;
+  std::unordered_set<uint64_t> m_edges;
+  std::unordered_set<uint64_t> m_checked_edges;
+  std::vector<NodeId> m_worklist;
+  std::vector<bool> m_in_worklist;
+};
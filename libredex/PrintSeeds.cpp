@@ -11,6 +11,9 @@
 #include "ProguardReporting.h"
 #include "ReachableClasses.h"
 #include "ReferencedState.h"
+#include "WorkQueue.h"
+
+#include <sstream>
 
 template <class Container>
 void print_method_seeds(std::ostream& output,
@@ -69,6 +72,52 @@ void show_class(std::ostream& output,
   output << name << std::endl;
 }
 
+namespace {
+
+void print_class_seeds(std::ostream& output,
+                       const ProguardMap& pg_map,
+                       const DexClass* cls,
+                       const bool allowshrinking_filter,
+                       const bool allowobfuscation_filter) {
+  auto deob = cls->get_deobfuscated_name();
+  if (deob.empty()) {
+    std::cerr << "WARNING: this class has no deobu name: "
+              << cls->get_name()->c_str() << std::endl;
+    deob = cls->get_name()->c_str();
+  }
+  std::string name = redex::dexdump_name_to_dot_name(deob);
+  if (keep(cls)) {
+    show_class(
+        output, cls, name, allowshrinking_filter, allowobfuscation_filter);
+  }
+  print_field_seeds(output,
+                    pg_map,
+                    name,
+                    cls->get_ifields(),
+                    allowshrinking_filter,
+                    allowobfuscation_filter);
+  print_field_seeds(output,
+                    pg_map,
+                    name,
+                    cls->get_sfields(),
+                    allowshrinking_filter,
+                    allowobfuscation_filter);
+  print_method_seeds(output,
+                     pg_map,
+                     name,
+                     cls->get_dmethods(),
+                     allowshrinking_filter,
+                     allowobfuscation_filter);
+  print_method_seeds(output,
+                     pg_map,
+                     name,
+                     cls->get_vmethods(),
+                     allowshrinking_filter,
+                     allowobfuscation_filter);
+}
+
+} // namespace
+
 // Print out the seeds computed in classes by Redex to the specified ostream.
 // The ProGuard map is used to help deobfuscate type descriptors.
 void redex::print_seeds(std::ostream& output,
@@ -77,40 +126,49 @@ void redex::print_seeds(std::ostream& output,
                         const bool allowshrinking_filter,
                         const bool allowobfuscation_filter) {
   for (const auto& cls : classes) {
-    auto deob = cls->get_deobfuscated_name();
-    if (deob.empty()) {
-      std::cerr << "WARNING: this class has no deobu name: "
-                << cls->get_name()->c_str() << std::endl;
-      deob = cls->get_name()->c_str();
-    }
-    std::string name = redex::dexdump_name_to_dot_name(deob);
-    if (keep(cls)) {
-      show_class(
-          output, cls, name, allowshrinking_filter, allowobfuscation_filter);
+    print_class_seeds(
+        output, pg_map, cls, allowshrinking_filter, allowobfuscation_filter);
+  }
+}
+
+redex::SeedsReports redex::format_seeds_reports(const ProguardMap& pg_map,
+                                                const Scope& classes) {
+  struct ClassReports {
+    std::string seeds;
+    std::string allowshrinking;
+    std::string allowobfuscation;
+    std::string classes;
+  };
+  std::vector<ClassReports> class_reports(classes.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    const auto cls = classes[i];
+    auto& reports = class_reports[i];
+    std::ostringstream out;
+    print_class_seeds(out, pg_map, cls, false, false);
+    reports.seeds = out.str();
+    out.str("");
+    print_class_seeds(out, pg_map, cls, true, false);
+    reports.allowshrinking = out.str();
+    out.str("");
+    print_class_seeds(out, pg_map, cls, false, true);
+    reports.allowobfuscation = out.str();
+    if (!cls->is_external()) {
+      out.str("");
+      redex::print_class(out, pg_map, cls);
+      reports.classes = out.str();
     }
-    print_field_seeds(output,
-                      pg_map,
-                      name,
-                      cls->get_ifields(),
-                      allowshrinking_filter,
-                      allowobfuscation_filter);
-    print_field_seeds(output,
-                      pg_map,
-                      name,
-                      cls->get_sfields(),
-                      allowshrinking_filter,
-                      allowobfuscation_filter);
-    print_method_seeds(output,
-                       pg_map,
-                       name,
-                       cls->get_dmethods(),
-                       allowshrinking_filter,
-                       allowobfuscation_filter);
-    print_method_seeds(output,
-                       pg_map,
-                       name,
-                       cls->get_vmethods(),
-                       allowshrinking_filter,
-                       allowobfuscation_filter);
+  });
+  for (size_t i = 0; i < classes.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  SeedsReports result;
+  for (auto& reports : class_reports) {
+    result.seeds += reports.seeds;
+    result.allowshrinking += reports.allowshrinking;
+    result.allowobfuscation += reports.allowobfuscation;
+    result.classes += reports.classes;
   }
+  return result;
 }
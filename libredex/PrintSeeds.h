@@ -10,6 +10,7 @@
 #pragma once
 
 #include <iostream>
+#include <string>
 
 #include "DexClass.h"
 #include "DexUtil.h"
@@ -21,4 +22,17 @@ void print_seeds(std::ostream& output,
                  const Scope& classes,
                  const bool allowshrinking_filter = false,
                  const bool allowobfuscation_filter = false);
+
+// What print_seeds() prints with each of the filters, and what
+// print_classes() prints, all formatted in one parallel walk over the
+// classes.
+struct SeedsReports {
+  std::string seeds;
+  std::string allowshrinking;
+  std::string allowobfuscation;
+  std::string classes;
+};
+
+SeedsReports format_seeds_reports(const ProguardMap& pg_map,
+                                  const Scope& classes);
 }
@@ -0,0 +1,209 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ProgramHash.h"
+
+#include <boost/functional/hash.hpp>
+#include <unordered_map>
+
+#include "IRCode.h"
+#include "Show.h"
+#include "WorkQueue.h"
+
+namespace program_hash {
+
+namespace {
+
+void combine_string(size_t& seed, const std::string& s) {
+  boost::hash_combine(seed, std::hash<std::string>()(s));
+}
+
+void hash_insn(size_t& seed, IRInstruction* insn) {
+  boost::hash_combine(seed, static_cast<int>(insn->opcode()));
+  for (size_t i = 0; i < insn->srcs_size(); ++i) {
+    boost::hash_combine(seed, insn->src(i));
+  }
+  if (insn->dests_size() > 0) {
+    boost::hash_combine(seed, insn->dest());
+  }
+  if (insn->has_string()) {
+    combine_string(seed, insn->get_string()->str());
+  }
+  if (insn->has_type()) {
+    combine_string(seed, show(insn->get_type()));
+  }
+  if (insn->has_field()) {
+    combine_string(seed, show(insn->get_field()));
+  }
+  if (insn->has_method()) {
+    combine_string(seed, show(insn->get_method()));
+  }
+  if (insn->has_literal()) {
+    boost::hash_combine(seed, insn->get_literal());
+  }
+  if (insn->has_data()) {
+    auto data = insn->get_data();
+    boost::hash_range(seed, data->data(), data->data() + data->data_size());
+  }
+}
+
+void hash_position(size_t& seed, const DexPosition* pos) {
+  // Inlined positions are chained to the position of their call site.
+  for (; pos != nullptr; pos = pos->parent) {
+    boost::hash_combine(seed, pos->line);
+    if (pos->file != nullptr) {
+      combine_string(seed, pos->file->str());
+    }
+    if (pos->method != nullptr) {
+      combine_string(seed, show(pos->method));
+    }
+  }
+}
+
+// Hashes a member list in order, each member by its own name and what
+// `hash_member` adds.
+template <class Member, class HashMember>
+void hash_members(size_t& seed,
+                  const std::vector<Member*>& members,
+                  HashMember hash_member) {
+  boost::hash_combine(seed, members.size());
+  for (auto member : members) {
+    combine_string(seed, show(member));
+    boost::hash_combine(seed, static_cast<uint32_t>(member->get_access()));
+    hash_member(seed, member);
+  }
+}
+
+struct ClassHash {
+  size_t classes{0};
+  size_t code{0};
+};
+
+ClassHash hash_class(DexClass* cls) {
+  ClassHash result;
+  size_t& seed = result.classes;
+  combine_string(seed, show(cls));
+  boost::hash_combine(seed, static_cast<uint32_t>(cls->get_access()));
+  combine_string(seed, show(cls->get_super_class()));
+  combine_string(seed, show(cls->get_interfaces()));
+  auto no_more = [](size_t&, const DexField*) {};
+  hash_members(seed, cls->get_sfields(), [](size_t& seed, DexField* field) {
+    if (field->get_static_value() != nullptr) {
+      combine_string(seed, show(field->get_static_value()));
+    }
+  });
+  hash_members(seed, cls->get_ifields(), no_more);
+  auto hash_method = [&result](size_t&, DexMethod* method) {
+    auto code = method->get_code();
+    if (code == nullptr) {
+      return;
+    }
+    size_t code_seed = std::hash<std::string>()(show(method));
+    boost::hash_combine(code_seed, hash_code(*code));
+    boost::hash_combine(result.code, code_seed);
+  };
+  hash_members(seed, cls->get_dmethods(), hash_method);
+  hash_members(seed, cls->get_vmethods(), hash_method);
+  return result;
+}
+
+} // namespace
+
+uint64_t hash_code(const IRCode& code) {
+  // Branches and try regions point at other entries, which are hashed by
+  // their position in the list.
+  std::unordered_map<const MethodItemEntry*, size_t> index;
+  size_t i = 0;
+  for (const auto& mie : code) {
+    index.emplace(&mie, i++);
+  }
+  size_t seed = code.get_registers_size();
+  for (const auto& mie : code) {
+    boost::hash_combine(seed, static_cast<int>(mie.type));
+    switch (mie.type) {
+    case MFLOW_TRY:
+      boost::hash_combine(seed, static_cast<int>(mie.tentry->type));
+      boost::hash_combine(seed, index.at(mie.tentry->catch_start));
+      break;
+    case MFLOW_CATCH:
+      if (mie.centry->catch_type != nullptr) {
+        combine_string(seed, show(mie.centry->catch_type));
+      }
+      if (mie.centry->next != nullptr) {
+        boost::hash_combine(seed, index.at(mie.centry->next));
+      }
+      break;
+    case MFLOW_OPCODE:
+      hash_insn(seed, mie.insn);
+      break;
+    case MFLOW_TARGET:
+      boost::hash_combine(seed, static_cast<int>(mie.target->type));
+      boost::hash_combine(seed, index.at(mie.target->src));
+      if (mie.target->type == BRANCH_MULTI) {
+        boost::hash_combine(seed, mie.target->index);
+      }
+      break;
+    case MFLOW_DEBUG:
+      boost::hash_combine(seed, static_cast<int>(mie.dbgop.opcode()));
+      boost::hash_combine(seed, mie.dbgop.uvalue());
+      break;
+    case MFLOW_POSITION:
+      hash_position(seed, mie.pos);
+      break;
+    case MFLOW_DEX_OPCODE:
+    case MFLOW_FALLTHROUGH:
+      break;
+    }
+  }
+  return seed;
+}
+
+Hash hash(const DexStoresVector& stores) {
+  std::vector<DexClass*> classes;
+  Hash result;
+  size_t class_order = 0;
+  for (const auto& store : stores) {
+    combine_string(class_order, store.get_name());
+    for (const auto& dex : store.get_dexen()) {
+      boost::hash_combine(class_order, dex.size());
+      for (auto cls : dex) {
+        combine_string(class_order, show(cls));
+        classes.push_back(cls);
+      }
+    }
+  }
+  result.class_order = class_order;
+
+  std::vector<ClassHash> class_hashes(classes.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { class_hashes[i] = hash_class(classes[i]); });
+  for (size_t i = 0; i < classes.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  // Summed, so that the order of the classes doesn't matter.
+  for (const auto& class_hash : class_hashes) {
+    result.classes += class_hash.classes;
+    result.code += class_hash.code;
+  }
+  return result;
+}
+
+std::string to_string(const Hash& hash) {
+  char buf[3 * 17];
+  snprintf(buf,
+           sizeof(buf),
+           "%016llx %016llx %016llx",
+           static_cast<unsigned long long>(hash.class_order),
+           static_cast<unsigned long long>(hash.classes),
+           static_cast<unsigned long long>(hash.code));
+  return buf;
+}
+
+} // namespace program_hash
@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "DexClass.h"
+#include "DexStore.h"
+
+/*
+ * Hashes the state of the program, to check that runs of the same pipeline
+ * with different thread counts or schedules leave the same program behind.
+ *
+ * Only names and contents are hashed, never addresses, so the hashes of two
+ * processes can be compared. The hash is split in three, so that a
+ * difference tells whether the classes were laid out differently, declare
+ * different things, or have different code.
+ *
+ * Hashing balloons the methods whose code is still a DexCode.
+ */
+namespace program_hash {
+
+struct Hash {
+  // The names of the classes, store by store and dex by dex, in order.
+  uint64_t class_order{0};
+  // What the classes declare, their members in order, but not their code.
+  // Doesn't depend on the order of the classes.
+  uint64_t classes{0};
+  // The code of all the methods. Doesn't depend on the order of the classes.
+  uint64_t code{0};
+
+  bool operator==(const Hash& that) const {
+    return class_order == that.class_order && classes == that.classes &&
+           code == that.code;
+  }
+  bool operator!=(const Hash& that) const { return !(*this == that); }
+};
+
+Hash hash(const DexStoresVector& stores);
+
+// The instructions, branches, try regions and positions of the code.
+uint64_t hash_code(const IRCode& code);
+
+// "<class_order> <classes> <code>", each in hex.
+std::string to_string(const Hash& hash);
+
+} // namespace program_hash
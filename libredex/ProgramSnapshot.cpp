@@ -0,0 +1,875 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ProgramSnapshot.h"
+
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "ConfigFiles.h"
+#include "Debug.h"
+#include "DexClass.h"
+#include "DexLoader.h"
+#include "DexOutput.h"
+#include "DexPosition.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "Timer.h"
+#include "Walkers.h"
+
+/*
+ * program.snapshot is laid out like the jar snapshots of JarLoader.cpp:
+ *
+ *   snapshot_header
+ *   snapshot_string strings[num_strings]
+ *   uint32_t words[num_words]
+ *   char string_data[]
+ *
+ * Each string is NUL-terminated in string_data. Types, members and names are
+ * string indices, or kNoIndex where they may be missing. The words describe
+ * one class after another:
+ *
+ *   self, deobfuscated name, rstate flags, keep count,
+ *   field count, { name, type, deobfuscated name, flags, keep count }...,
+ *   method count, { name, proto, deobfuscated name, flags, keep count,
+ *                   has code, [code] }...
+ *
+ * where a proto is its return type, arg count and args, and code is:
+ *
+ *   registers size, param name count (kNoIndex without a debug item),
+ *   param names..., entry count, entries...
+ *
+ * Every entry starts with its MethodItemType, and entries point to each
+ * other by their index in the method:
+ *
+ *   MFLOW_OPCODE: opcode, dest, src count, srcs..., then what the opcode
+ *     refers to: a literal (low word, high word), a string, a type, a field
+ *     (class, name, type), a method (class, name, proto) or data (its
+ *     opcode, 16-bit unit count, and the units, two to a word)
+ *   MFLOW_TRY: TryEntryType, first catch
+ *   MFLOW_CATCH: catch type, next catch
+ *   MFLOW_TARGET: BranchTargetType, branch, case key
+ *   MFLOW_DEBUG: debug opcode, value, and for set-file the file, for
+ *     start-local the name, type and signature
+ *   MFLOW_POSITION: line, method (class, name, proto; kNoIndex if unbound),
+ *     file, parent
+ *   MFLOW_FALLTHROUGH: nothing
+ *
+ * The code of a single method, as write_code() lays it out, has no classes,
+ * and its words are just the code.
+ */
+
+namespace {
+
+constexpr char kSnapshotMagic[8] = {'r', 'e', 'd', 'e', 'x', 'p', 's', 'n'};
+constexpr uint32_t kSnapshotVersion = 2;
+constexpr uint32_t kNoIndex = 0xffffffff;
+
+const char* kSnapshotJson = "snapshot.json";
+const char* kProgramSnapshot = "program.snapshot";
+
+struct snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_strings;
+  uint32_t num_words;
+  uint32_t num_classes;
+  uint32_t string_data_size;
+};
+
+struct snapshot_string {
+  uint32_t offset;
+  uint32_t size;
+};
+
+std::string dex_path(const std::string& dir,
+                     const std::string& store_name,
+                     size_t dex_number) {
+  return dir + "/" + store_name + "/" + std::to_string(dex_number) + ".dex";
+}
+
+template <typename Fn>
+void for_each_method(const DexClass* cls, Fn fn) {
+  for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+    for (auto method : *methods) {
+      fn(method);
+    }
+  }
+}
+
+class snapshot_writer {
+ public:
+  void add_class(DexClass* cls) {
+    ++m_num_classes;
+    add_type(cls->get_type());
+    add_string(cls->get_deobfuscated_name());
+    add_state(cls->rstate);
+    m_words.push_back(cls->get_sfields().size() + cls->get_ifields().size());
+    for (auto fields : {&cls->get_sfields(), &cls->get_ifields()}) {
+      for (auto field : *fields) {
+        add_string(field->get_name());
+        add_type(field->get_type());
+        add_string(field->get_deobfuscated_name());
+        add_state(field->rstate);
+      }
+    }
+    m_words.push_back(cls->get_dmethods().size() +
+                      cls->get_vmethods().size());
+    for_each_method(cls, [&](DexMethod* method) {
+      add_string(method->get_name());
+      add_proto(method->get_proto());
+      add_string(method->get_deobfuscated_name());
+      add_state(method->rstate);
+      // The DexCode of deferred methods goes into the dexes.
+      auto code = method->is_balloon_deferred() ? nullptr : method->get_code();
+      m_words.push_back(code != nullptr);
+      if (code != nullptr) {
+        add_code(code);
+      }
+    });
+  }
+
+  void write(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary);
+    write(out);
+    always_assert_log(out, "Failed to write %s", path.c_str());
+  }
+
+  void write(std::ostream& out) const {
+    snapshot_header header;
+    memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.version = kSnapshotVersion;
+    header.num_strings = m_strings.size();
+    header.num_words = m_words.size();
+    header.num_classes = m_num_classes;
+    header.string_data_size = m_string_data.size();
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)m_strings.data(),
+              m_strings.size() * sizeof(snapshot_string));
+    out.write((const char*)m_words.data(), m_words.size() * sizeof(uint32_t));
+    out.write(m_string_data.data(), m_string_data.size());
+  }
+
+  void add_code(IRCode* code) {
+    m_words.push_back(code->get_registers_size());
+    auto dbg = code->get_debug_item();
+    if (dbg == nullptr) {
+      m_words.push_back(kNoIndex);
+    } else {
+      m_words.push_back(dbg->get_param_names().size());
+      for (auto name : dbg->get_param_names()) {
+        add_string(name);
+      }
+    }
+
+    // The positions of the method go in a table, parents first, so that they
+    // can be interned in order when the code is read back.
+    std::unordered_map<const DexPosition*, uint32_t> position_index;
+    std::vector<const DexPosition*> positions;
+    std::vector<const DexPosition*> chain;
+    std::unordered_map<const MethodItemEntry*, uint32_t> entry_index;
+    for (const auto& mie : *code) {
+      if (mie.type == MFLOW_POSITION) {
+        for (const DexPosition* pos = mie.pos;
+             pos != nullptr && position_index.count(pos) == 0;
+             pos = pos->parent) {
+          chain.push_back(pos);
+        }
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+          position_index.emplace(*it, positions.size());
+          positions.push_back(*it);
+        }
+        chain.clear();
+      }
+      entry_index.emplace(&mie, entry_index.size());
+    }
+    auto index_of = [&](const MethodItemEntry* mie) {
+      if (mie == nullptr) {
+        return kNoIndex;
+      }
+      auto it = entry_index.find(mie);
+      always_assert(it != entry_index.end());
+      return it->second;
+    };
+
+    m_words.push_back(positions.size());
+    for (auto pos : positions) {
+      m_words.push_back(pos->line);
+      add_method(pos->method);
+      add_string(pos->file);
+      m_words.push_back(pos->parent == nullptr
+                            ? kNoIndex
+                            : position_index.at(pos->parent));
+    }
+
+    m_words.push_back(entry_index.size());
+    for (const auto& mie : *code) {
+      m_words.push_back(mie.type);
+      switch (mie.type) {
+      case MFLOW_OPCODE:
+        add_instruction(mie.insn);
+        break;
+      case MFLOW_TRY:
+        m_words.push_back(mie.tentry->type);
+        m_words.push_back(index_of(mie.tentry->catch_start));
+        break;
+      case MFLOW_CATCH:
+        add_type(mie.centry->catch_type);
+        m_words.push_back(index_of(mie.centry->next));
+        break;
+      case MFLOW_TARGET:
+        m_words.push_back(mie.target->type);
+        m_words.push_back(index_of(mie.target->src));
+        m_words.push_back(mie.target->index);
+        break;
+      case MFLOW_DEBUG:
+        add_debug_instruction(mie.dbgop);
+        break;
+      case MFLOW_POSITION:
+        m_words.push_back(position_index.at(mie.pos));
+        break;
+      case MFLOW_FALLTHROUGH:
+        break;
+      case MFLOW_DEX_OPCODE:
+        always_assert_log(false, "Unexpected lowered instruction");
+      }
+    }
+  }
+
+ private:
+  void add_instruction(const IRInstruction* insn) {
+    m_words.push_back(insn->opcode());
+    m_words.push_back(insn->dests_size() ? insn->dest() : 0);
+    m_words.push_back(insn->srcs_size());
+    for (auto src : insn->srcs()) {
+      m_words.push_back(src);
+    }
+    switch (opcode::ref(insn->opcode())) {
+    case opcode::Ref::None:
+      break;
+    case opcode::Ref::Literal: {
+      auto literal = static_cast<uint64_t>(insn->get_literal());
+      m_words.push_back(literal & 0xffffffff);
+      m_words.push_back(literal >> 32);
+      break;
+    }
+    case opcode::Ref::String:
+      add_string(insn->get_string());
+      break;
+    case opcode::Ref::Type:
+      add_type(insn->get_type());
+      break;
+    case opcode::Ref::Field:
+      add_type(insn->get_field()->get_class());
+      add_string(insn->get_field()->get_name());
+      add_type(insn->get_field()->get_type());
+      break;
+    case opcode::Ref::Method:
+      add_method(insn->get_method());
+      break;
+    case opcode::Ref::Data: {
+      auto data = insn->get_data();
+      m_words.push_back(data->opcode());
+      m_words.push_back(data->data_size());
+      for (size_t i = 0; i < data->data_size(); i += 2) {
+        uint32_t word = data->data()[i];
+        if (i + 1 < data->data_size()) {
+          word |= uint32_t(data->data()[i + 1]) << 16;
+        }
+        m_words.push_back(word);
+      }
+      break;
+    }
+    }
+  }
+
+  void add_debug_instruction(const DexDebugInstruction& dbgop) {
+    m_words.push_back(dbgop.opcode());
+    m_words.push_back(dbgop.uvalue());
+    switch (dbgop.opcode()) {
+    case DBG_SET_FILE:
+      add_string(dbgop.file());
+      break;
+    case DBG_START_LOCAL:
+    case DBG_START_LOCAL_EXTENDED:
+      add_string(dbgop.name());
+      add_type(dbgop.type());
+      add_string(dbgop.sig());
+      break;
+    default:
+      break;
+    }
+  }
+
+  void add_method(const DexMethodRef* method) {
+    if (method == nullptr) {
+      m_words.push_back(kNoIndex);
+      return;
+    }
+    add_type(method->get_class());
+    add_string(method->get_name());
+    add_proto(method->get_proto());
+  }
+
+  void add_proto(const DexProto* proto) {
+    add_type(proto->get_rtype());
+    const auto& args = proto->get_args()->get_type_list();
+    m_words.push_back(args.size());
+    for (auto arg : args) {
+      add_type(arg);
+    }
+  }
+
+  void add_state(const ReferencedState& rstate) {
+    m_words.push_back(rstate.flags());
+    m_words.push_back(rstate.keep_count());
+  }
+
+  void add_type(const DexType* type) {
+    add_string(type == nullptr ? nullptr : type->get_name());
+  }
+
+  void add_string(const DexString* str) {
+    if (str == nullptr) {
+      m_words.push_back(kNoIndex);
+      return;
+    }
+    add_string(std::string(str->c_str()));
+  }
+
+  void add_string(const std::string& str) {
+    auto it = m_string_index.find(str);
+    if (it == m_string_index.end()) {
+      it = m_string_index.emplace(str, m_strings.size()).first;
+      m_strings.push_back(
+          {(uint32_t)m_string_data.size(), (uint32_t)str.size()});
+      m_string_data.insert(
+          m_string_data.end(), str.c_str(), str.c_str() + str.size() + 1);
+    }
+    m_words.push_back(it->second);
+  }
+
+  std::unordered_map<std::string, uint32_t> m_string_index;
+  std::vector<snapshot_string> m_strings;
+  std::vector<uint32_t> m_words;
+  std::vector<char> m_string_data;
+  uint32_t m_num_classes{0};
+};
+
+/*
+ * Applies program.snapshot to the classes loaded from the dexes of the
+ * snapshot. Unlike a jar snapshot, there is nothing to fall back on, so any
+ * inconsistency is fatal.
+ */
+class snapshot_reader {
+ public:
+  explicit snapshot_reader(const std::string& path) : m_what(path) {
+    m_file.open(path, boost::iostreams::mapped_file::readonly);
+    check(m_file.is_open());
+    init(m_file.const_data(), m_file.size());
+  }
+
+  snapshot_reader(const char* data, size_t size, const std::string& what)
+      : m_what(what) {
+    init(data, size);
+  }
+
+  void read() {
+    for (uint32_t i = 0; i < m_header.num_classes; ++i) {
+      read_class();
+    }
+    check(m_words == m_end);
+  }
+
+  std::unique_ptr<IRCode> read_code() {
+    check(m_header.num_classes == 0);
+    auto code = next_code();
+    check(m_words == m_end);
+    return code;
+  }
+
+ private:
+  void init(const char* data, size_t size) {
+    check(size >= sizeof(snapshot_header));
+    memcpy(&m_header, data, sizeof(m_header));
+    check(memcmp(m_header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) ==
+              0 &&
+          m_header.version == kSnapshotVersion);
+    uint64_t expected_size =
+        sizeof(m_header) +
+        uint64_t(m_header.num_strings) * sizeof(snapshot_string) +
+        uint64_t(m_header.num_words) * sizeof(uint32_t) +
+        m_header.string_data_size;
+    check(size == expected_size);
+    m_strings = (const snapshot_string*)(data + sizeof(m_header));
+    m_words = (const uint32_t*)(m_strings + m_header.num_strings);
+    m_end = m_words + m_header.num_words;
+    m_string_data = (const char*)m_end;
+    m_interned.assign(m_header.num_strings, nullptr);
+  }
+
+  void check(bool ok) {
+    always_assert_log(ok, "Corrupt program snapshot %s", m_what.c_str());
+  }
+
+  uint32_t next() {
+    check(m_words != m_end);
+    return *m_words++;
+  }
+
+  std::string next_name() {
+    auto idx = next();
+    check(idx < m_header.num_strings &&
+          m_strings[idx].offset + uint64_t(m_strings[idx].size) <
+              m_header.string_data_size);
+    return std::string(m_string_data + m_strings[idx].offset,
+                       m_strings[idx].size);
+  }
+
+  DexString* next_string() {
+    auto idx = next();
+    if (idx == kNoIndex) {
+      return nullptr;
+    }
+    check(idx < m_header.num_strings &&
+          m_strings[idx].offset < m_header.string_data_size);
+    if (m_interned[idx] == nullptr) {
+      m_interned[idx] =
+          DexString::make_string(m_string_data + m_strings[idx].offset);
+    }
+    return m_interned[idx];
+  }
+
+  DexType* next_type() {
+    auto name = next_string();
+    return name == nullptr ? nullptr : DexType::make_type(name);
+  }
+
+  DexProto* next_proto() {
+    auto rtype = next_type();
+    check(rtype != nullptr);
+    auto num_args = next();
+    std::deque<DexType*> args;
+    for (uint32_t i = 0; i < num_args; ++i) {
+      args.push_back(next_type());
+      check(args.back() != nullptr);
+    }
+    return DexProto::make_proto(rtype,
+                                DexTypeList::make_type_list(std::move(args)));
+  }
+
+  DexMethodRef* next_method() {
+    auto cls = next_type();
+    if (cls == nullptr) {
+      return nullptr;
+    }
+    auto name = next_string();
+    check(name != nullptr);
+    return DexMethod::make_method(cls, name, next_proto());
+  }
+
+  void next_state(ReferencedState* rstate) {
+    auto flags = next();
+    rstate->restore(flags, next());
+  }
+
+  void read_class() {
+    auto self = next_type();
+    auto cls = type_class(self);
+    check(cls != nullptr && !cls->is_external());
+    cls->set_deobfuscated_name(next_name());
+    next_state(&cls->rstate);
+
+    auto num_fields = next();
+    check(num_fields ==
+          cls->get_sfields().size() + cls->get_ifields().size());
+    for (uint32_t i = 0; i < num_fields; ++i) {
+      auto name = next_string();
+      auto type = next_type();
+      auto ref = DexField::get_field(self, name, type);
+      check(ref != nullptr && ref->is_def());
+      auto field = static_cast<DexField*>(ref);
+      field->set_deobfuscated_name(next_name());
+      next_state(&field->rstate);
+    }
+
+    auto num_methods = next();
+    check(num_methods ==
+          cls->get_dmethods().size() + cls->get_vmethods().size());
+    for (uint32_t i = 0; i < num_methods; ++i) {
+      auto name = next_string();
+      auto ref = DexMethod::get_method(self, name, next_proto());
+      check(ref != nullptr && ref->is_def());
+      auto method = static_cast<DexMethod*>(ref);
+      method->set_deobfuscated_name(next_name());
+      next_state(&method->rstate);
+      if (next()) {
+        // Drop the placeholder that the dex has.
+        method->set_dex_code(nullptr);
+        method->set_code(next_code());
+      }
+    }
+  }
+
+  std::unique_ptr<IRCode> next_code() {
+    auto code = std::make_unique<IRCode>();
+    code->set_registers_size(next());
+    auto num_param_names = next();
+    if (num_param_names != kNoIndex) {
+      auto dbg = std::make_unique<DexDebugItem>();
+      for (uint32_t i = 0; i < num_param_names; ++i) {
+        dbg->get_param_names().push_back(next_string());
+      }
+      code->set_debug_item(std::move(dbg));
+    }
+
+    // The try entries need their first catch, which comes after them, so
+    // they are made once all the others are.
+    struct PendingTry {
+      TryEntryType type;
+      uint32_t catch_start;
+    };
+    auto num_positions = next();
+    std::vector<DexPosition*> positions;
+    positions.reserve(num_positions);
+    for (uint32_t i = 0; i < num_positions; ++i) {
+      auto line = next();
+      auto method = static_cast<DexMethod*>(next_method());
+      auto file = next_string();
+      auto parent = next();
+      check(parent == kNoIndex || parent < i);
+      positions.push_back(DexPosition::make(
+          method, file, line, parent == kNoIndex ? nullptr : positions[parent]));
+    }
+
+    auto num_entries = next();
+    std::vector<MethodItemEntry*> entries(num_entries, nullptr);
+    std::unordered_map<uint32_t, PendingTry> tries;
+    std::vector<std::pair<CatchEntry*, uint32_t>> catch_nexts;
+    std::vector<std::pair<BranchTarget*, uint32_t>> target_srcs;
+    for (uint32_t i = 0; i < num_entries; ++i) {
+      auto type = static_cast<MethodItemType>(next());
+      switch (type) {
+      case MFLOW_OPCODE:
+        entries[i] = new MethodItemEntry(next_instruction());
+        break;
+      case MFLOW_TRY: {
+        auto try_type = static_cast<TryEntryType>(next());
+        tries.emplace(i, PendingTry{try_type, next()});
+        break;
+      }
+      case MFLOW_CATCH:
+        entries[i] = new MethodItemEntry(next_type());
+        catch_nexts.emplace_back(entries[i]->centry, next());
+        break;
+      case MFLOW_TARGET: {
+        auto target = new BranchTarget();
+        target->type = static_cast<BranchTargetType>(next());
+        target_srcs.emplace_back(target, next());
+        target->index = static_cast<int32_t>(next());
+        entries[i] = new MethodItemEntry(target);
+        break;
+      }
+      case MFLOW_DEBUG:
+        entries[i] = new MethodItemEntry(next_debug_instruction());
+        break;
+      case MFLOW_POSITION: {
+        auto index = next();
+        check(index < num_positions);
+        entries[i] = new MethodItemEntry(positions[index]);
+        break;
+      }
+      case MFLOW_FALLTHROUGH:
+        entries[i] = new MethodItemEntry();
+        break;
+      default:
+        check(false);
+      }
+    }
+
+    auto entry_at = [&](uint32_t index) -> MethodItemEntry* {
+      if (index == kNoIndex) {
+        return nullptr;
+      }
+      check(index < num_entries && entries[index] != nullptr);
+      return entries[index];
+    };
+    for (const auto& pair : catch_nexts) {
+      pair.first->next = entry_at(pair.second);
+    }
+    for (const auto& pair : target_srcs) {
+      pair.first->src = entry_at(pair.second);
+      check(pair.first->src != nullptr);
+    }
+    for (const auto& pair : tries) {
+      auto catch_start = entry_at(pair.second.catch_start);
+      check(catch_start != nullptr && catch_start->type == MFLOW_CATCH);
+      entries[pair.first] = new MethodItemEntry(pair.second.type, catch_start);
+    }
+    for (auto mie : entries) {
+      code->push_back(*mie);
+    }
+    return code;
+  }
+
+  IRInstruction* next_instruction() {
+    auto insn = new IRInstruction(static_cast<IROpcode>(next()));
+    auto dest = next();
+    if (insn->dests_size()) {
+      insn->set_dest(dest);
+    }
+    auto num_srcs = next();
+    insn->set_arg_word_count(num_srcs);
+    for (uint32_t i = 0; i < num_srcs; ++i) {
+      insn->set_src(i, next());
+    }
+    switch (opcode::ref(insn->opcode())) {
+    case opcode::Ref::None:
+      break;
+    case opcode::Ref::Literal: {
+      uint64_t low = next();
+      uint64_t high = next();
+      insn->set_literal(static_cast<int64_t>(low | (high << 32)));
+      break;
+    }
+    case opcode::Ref::String:
+      insn->set_string(next_string());
+      break;
+    case opcode::Ref::Type:
+      insn->set_type(next_type());
+      break;
+    case opcode::Ref::Field: {
+      auto cls = next_type();
+      auto name = next_string();
+      insn->set_field(DexField::make_field(cls, name, next_type()));
+      break;
+    }
+    case opcode::Ref::Method:
+      insn->set_method(next_method());
+      break;
+    case opcode::Ref::Data: {
+      std::vector<uint16_t> units;
+      units.push_back(next());
+      auto count = next();
+      for (uint32_t i = 0; i < count; i += 2) {
+        auto word = next();
+        units.push_back(word & 0xffff);
+        if (i + 1 < count) {
+          units.push_back(word >> 16);
+        }
+      }
+      insn->set_data(new DexOpcodeData(units.data(), count));
+      break;
+    }
+    }
+    return insn;
+  }
+
+  DexDebugInstruction next_debug_instruction() {
+    auto op = static_cast<DexDebugItemOpcode>(next());
+    auto value = next();
+    switch (op) {
+    case DBG_SET_FILE:
+      return DexDebugInstruction::make_set_file(next_string());
+    case DBG_START_LOCAL:
+    case DBG_START_LOCAL_EXTENDED: {
+      auto name = next_string();
+      auto type = next_type();
+      return DexDebugInstruction::make_start_local(
+          value, name, type, next_string());
+    }
+    case DBG_ADVANCE_LINE:
+      return DexDebugInstruction(op, static_cast<int32_t>(value));
+    default:
+      return DexDebugInstruction(op, value);
+    }
+  }
+
+  std::string m_what;
+  boost::iostreams::mapped_file m_file;
+  snapshot_header m_header;
+  const snapshot_string* m_strings{nullptr};
+  const uint32_t* m_words{nullptr};
+  const uint32_t* m_end{nullptr};
+  const char* m_string_data{nullptr};
+  std::vector<DexString*> m_interned;
+};
+
+} // namespace
+
+namespace program_snapshot {
+
+void write(const std::string& dir,
+           DexStoresVector& stores,
+           ConfigFiles& cfg,
+           const Json::Value& saved_state) {
+  Timer t("Writing program snapshot");
+  namespace fs = boost::filesystem;
+  fs::create_directories(dir);
+
+  snapshot_writer writer;
+  Json::Value stores_json(Json::arrayValue);
+  for (auto& store : stores) {
+    Json::Value store_json;
+    store_json["name"] = store.get_name();
+    Json::Value dependencies(Json::arrayValue);
+    for (const auto& dependency : store.get_dependencies()) {
+      dependencies.append(dependency);
+    }
+    store_json["dependencies"] = dependencies;
+    Json::Value dexes(Json::arrayValue);
+    for (const auto& dex : store.get_dexen()) {
+      for (auto cls : dex) {
+        writer.add_class(cls);
+      }
+      dexes.append(Json::UInt(dex.size()));
+    }
+    store_json["dexes"] = dexes;
+    stores_json.append(store_json);
+  }
+  writer.write(dir + "/" + kProgramSnapshot);
+
+  // The dex writer would need the IRCode lowered, so it gets an empty
+  // DexCode in its place while the dexes are written.
+  std::vector<std::pair<DexMethod*, std::unique_ptr<IRCode>>> detached;
+  for (auto& store : stores) {
+    for (const auto& dex : store.get_dexen()) {
+      for (auto cls : dex) {
+        for_each_method(cls, [&](DexMethod* method) {
+          if (!method->is_balloon_deferred() &&
+              method->get_code() != nullptr) {
+            detached.emplace_back(method, method->release_code());
+            method->set_dex_code(std::make_unique<DexCode>());
+          }
+        });
+      }
+    }
+  }
+  Json::Value no_output_config(Json::objectValue);
+  std::unique_ptr<PositionMapper> pos_mapper(PositionMapper::make("", ""));
+  for (auto& store : stores) {
+    fs::create_directories(dir + "/" + store.get_name());
+    auto& dexen = store.get_dexen();
+    for (size_t i = 0; i < dexen.size(); ++i) {
+      if (dexen[i].empty()) {
+        continue;
+      }
+      write_classes_to_dex(dex_path(dir, store.get_name(), i),
+                           &dexen[i],
+                           nullptr,
+                           i,
+                           cfg,
+                           no_output_config,
+                           pos_mapper.get());
+    }
+  }
+  for (auto& pair : detached) {
+    pair.first->set_dex_code(nullptr);
+    pair.first->set_code(std::move(pair.second));
+  }
+
+  Json::Value root;
+  root["version"] = kSnapshotVersion;
+  root["stores"] = stores_json;
+  root["state"] = saved_state;
+  std::ofstream out(dir + "/" + kSnapshotJson);
+  Json::StyledStreamWriter json_writer;
+  json_writer.write(out, root);
+  always_assert_log(out, "Failed to write the program snapshot to %s",
+                    dir.c_str());
+}
+
+Json::Value read(const std::string& dir,
+                 DexStoresVector* stores,
+                 bool lazy_balloon) {
+  Timer t("Loading program snapshot");
+  always_assert(stores->empty());
+  Json::Value root;
+  {
+    std::ifstream in(dir + "/" + kSnapshotJson);
+    always_assert_log(in, "No program snapshot in %s", dir.c_str());
+    in >> root;
+  }
+  always_assert_log(root["version"].asUInt() == kSnapshotVersion,
+                    "The program snapshot in %s is from another version",
+                    dir.c_str());
+
+  // The non-empty dexes are all loaded at once, and then added to their
+  // stores in order.
+  std::vector<std::string> dex_paths;
+  std::vector<std::vector<int>> store_dexes;
+  for (const auto& store_json : root["stores"]) {
+    auto name = store_json["name"].asString();
+    if (name == "classes") {
+      stores->emplace_back(name);
+    } else {
+      DexMetadata metadata;
+      metadata.set_id(name);
+      for (const auto& dependency : store_json["dependencies"]) {
+        metadata.get_dependencies().push_back(dependency.asString());
+      }
+      stores->emplace_back(metadata);
+    }
+    store_dexes.emplace_back();
+    for (size_t i = 0; i < store_json["dexes"].size(); ++i) {
+      if (store_json["dexes"][Json::ArrayIndex(i)].asUInt() == 0) {
+        store_dexes.back().push_back(-1);
+      } else {
+        store_dexes.back().push_back(dex_paths.size());
+        dex_paths.push_back(dex_path(dir, name, i));
+      }
+    }
+  }
+  std::vector<dex_stats_t> dexes_stats;
+  auto dexen = load_classes_from_dexes(dex_paths, &dexes_stats, false);
+  for (size_t i = 0; i < stores->size(); ++i) {
+    for (auto index : store_dexes[i]) {
+      (*stores)[i].add_classes(index < 0 ? DexClasses()
+                                         : std::move(dexen[index]));
+    }
+  }
+
+  snapshot_reader(dir + "/" + kProgramSnapshot).read();
+
+  // What is left with DexCode was deferred when the snapshot was taken.
+  walk::parallel::methods(build_class_scope(*stores), [&](DexMethod* method) {
+    if (method->get_dex_code() == nullptr) {
+      return;
+    }
+    if (lazy_balloon) {
+      method->defer_balloon();
+    } else {
+      method->balloon();
+    }
+  });
+  return root["state"];
+}
+
+std::string write_code(IRCode* code) {
+  snapshot_writer writer;
+  writer.add_code(code);
+  std::ostringstream out;
+  writer.write(out);
+  return out.str();
+}
+
+std::unique_ptr<IRCode> read_code(const std::string& bytes) {
+  return snapshot_reader(bytes.data(), bytes.size(), "code").read_code();
+}
+
+} // namespace program_snapshot
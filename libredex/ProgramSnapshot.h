@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <json/json.h>
+
+#include "DexStore.h"
+
+class ConfigFiles;
+class IRCode;
+
+/*
+ * A program snapshot saves the stores being optimized between two passes, so
+ * that a later run can load them and resume with the passes after that point
+ * instead of running the whole pipeline again. It is a directory with:
+ *
+ *   snapshot.json       the stores and their dexes, and the state that the
+ *                       caller saved along with them (the PassManager saves
+ *                       the metrics of the passes that ran)
+ *   <store>/<n>.dex     the classes of each dex, as they were at the time
+ *   program.snapshot    what the dexes leave out: the IRCode of the ballooned
+ *                       methods, and the deobfuscated name and ReferencedState
+ *                       of every class and member
+ *
+ * Methods whose ballooning is deferred keep their DexCode in the dexes. The
+ * IRCode is saved as it is, so it does not have to be lowerable, and a
+ * snapshot can be taken before register allocation.
+ *
+ * Snapshots are only meant to be read back by the same build of redex, and
+ * are laid out in host byte order. State that lives outside of the classes,
+ * like what the passes keep in ConfigFiles or in statics, is not saved.
+ */
+namespace program_snapshot {
+
+/*
+ * Writes the stores to `dir`, which is created if needed. The stores are
+ * left as they were.
+ */
+void write(const std::string& dir,
+           DexStoresVector& stores,
+           ConfigFiles& cfg,
+           const Json::Value& saved_state);
+
+/*
+ * Loads the stores of the snapshot in `dir` into `stores`, which must be
+ * empty, and returns the state that was saved with them. The methods that had
+ * DexCode are ballooned, unless `lazy_balloon` is set, in which case their
+ * ballooning is deferred.
+ */
+Json::Value read(const std::string& dir,
+                 DexStoresVector* stores,
+                 bool lazy_balloon);
+
+/*
+ * The code of one method, laid out like the code in program.snapshot. The
+ * same code always gives the same bytes, so they can also be compared and
+ * hashed to tell whether the code changed.
+ */
+std::string write_code(IRCode* code);
+
+std::unique_ptr<IRCode> read_code(const std::string& bytes);
+
+} // namespace program_snapshot
@@ -84,6 +84,9 @@ struct ProguardConfiguration {
   std::vector<std::string> keepattributes;
   std::vector<std::string> dontwarn;
   std::vector<std::string> keeppackagenames;
+  // Rules dropped by process_proguard_rules for repeating an earlier one.
+  size_t duplicate_keep_rules{0};
+  size_t duplicate_assumenosideeffects_rules{0};
 };
 
 } // namespace redex
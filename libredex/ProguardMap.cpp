@@ -44,9 +44,14 @@ std::string convert_scalar_type(std::string type) {
 std::string convert_field(const std::string &cls,
     const std::string &type,
     const std::string &name) {
-  std::stringstream ss;
-  ss << cls << "." << name << ":" << type;
-  return ss.str();
+  std::string field;
+  field.reserve(cls.size() + name.size() + type.size() + 2);
+  field += cls;
+  field += '.';
+  field += name;
+  field += ':';
+  field += type;
+  return field;
 }
 
 std::string convert_method(
@@ -55,16 +60,26 @@ std::string convert_method(
   const std::string &methodname,
   const std::string &args
 ) {
-  std::stringstream ss;
-  ss << cls << "." << methodname << ":(" << args << ")" << rtype;
-  return ss.str();
+  std::string method;
+  method.reserve(cls.size() + methodname.size() + args.size() + rtype.size() +
+                 4);
+  method += cls;
+  method += '.';
+  method += methodname;
+  method += ":(";
+  method += args;
+  method += ')';
+  method += rtype;
+  return method;
 }
 
 std::string translate_type(const std::string& type, const ProguardMap& pm) {
-  auto base_start = type.find_first_not_of("[");
-  auto array_prefix = type.substr(0, base_start);
-  auto base_type = type.substr(base_start);
-  array_prefix += pm.translate_class(base_type);
+  auto base_start = type.find_first_not_of('[');
+  if (base_start == 0) {
+    return pm.translate_class(type);
+  }
+  std::string array_prefix(type, 0, base_start);
+  array_prefix += pm.translate_class(type.substr(base_start));
   return array_prefix;
 }
 
@@ -124,12 +139,23 @@ bool literal(const char*& p, char s) {
 ProguardMap::ProguardMap(const std::string& filename) {
   if (!filename.empty()) {
     Timer t("Parsing proguard map");
-    std::ifstream fp(filename);
+    std::ifstream fp(filename, std::ios::binary);
     always_assert_log(fp, "Can't open proguard map: %s\n", filename.c_str());
-    parse_proguard_map(fp);
+    std::string contents;
+    fp.seekg(0, std::ios::end);
+    contents.resize(fp.tellg());
+    fp.seekg(0);
+    fp.read(&contents[0], contents.size());
+    parse_proguard_map(contents);
   }
 }
 
+ProguardMap::ProguardMap(std::istream& is) {
+  std::string contents{std::istreambuf_iterator<char>(is),
+                       std::istreambuf_iterator<char>()};
+  parse_proguard_map(contents);
+}
+
 std::string ProguardMap::translate_class(const std::string& cls) const {
   return find_or_same(cls, m_classMap);
 }
@@ -154,28 +180,45 @@ std::string ProguardMap::deobfuscate_method(const std::string& method) const {
   return find_or_same(method, m_obfMethodMap);
 }
 
-void ProguardMap::parse_proguard_map(std::istream& fp) {
+void ProguardMap::parse_proguard_map(const std::string& contents) {
+  // The members refer to classes that may only be mapped further down, so
+  // all the classes are read first. The line buffer is reused throughout.
   std::string line;
-  while (std::getline(fp, line)) {
-    parse_class(line);
-  }
-  fp.clear();
-  fp.seekg(0);
-  assert_log(!fp.fail(), "Can't use ProguardMap with non-seekable stream");
-  while (std::getline(fp, line)) {
+  auto for_each_line = [&](const std::function<void()>& f) {
+    size_t begin = 0;
+    while (begin < contents.size()) {
+      auto end = contents.find('\n', begin);
+      if (end == std::string::npos) {
+        end = contents.size();
+      }
+      line.assign(contents, begin, end - begin);
+      f();
+      begin = end + 1;
+    }
+  };
+  size_t num_classes = 0;
+  for_each_line([&] {
+    // Member lines are indented.
+    if (!line.empty() && !isspace(line[0]) && parse_class(line)) {
+      ++num_classes;
+    }
+  });
+  m_classMap.reserve(num_classes);
+  m_obfClassMap.reserve(num_classes);
+  for_each_line([&] {
     if (parse_class(line)) {
-      continue;
+      return;
     }
     if (parse_field(line)) {
-      continue;
+      return;
     }
     if (parse_method(line)) {
-      continue;
+      return;
     }
     always_assert_log(false,
                       "Bogus line encountered in proguard map: %s\n",
                       line.c_str());
-  }
+  });
 }
 
 bool ProguardMap::parse_class(const std::string& line) {
@@ -336,28 +379,33 @@ std::string proguard_name(const DexClass* cls) {
 std::string proguard_name(const DexMethodRef* method) {
   // Format:
   //  <class descriptor>.<method name>:(<arg descriptors>)<return descriptor>
-  std::stringstream ss;
-  ss << proguard_name(method->get_class()) << "." << method->get_name()->c_str()
-      << ":" << "(";
+  std::string name;
+  name += method->get_class()->get_name()->c_str();
+  name += '.';
+  name += method->get_name()->c_str();
+  name += ":(";
 
   auto proto = method->get_proto();
 
   for (auto& arg_type: proto->get_args()->get_type_list()) {
-    ss << proguard_name(arg_type);
+    name += arg_type->get_name()->c_str();
   }
-  ss << ")";
+  name += ')';
 
-  ss << proguard_name(proto->get_rtype());
-  assert(ss.str() == show(method));
-  return ss.str();
+  name += proto->get_rtype()->get_name()->c_str();
+  assert(name == show(method));
+  return name;
 }
 
 std::string proguard_name(const DexFieldRef* field) {
-  std::stringstream ss;
-  ss << proguard_name(field->get_class()) << "." << field->get_name()->c_str()
-      << ":" << proguard_name(field->get_type());
-  assert(ss.str() == show(field));
-  return ss.str();
+  std::string name;
+  name += field->get_class()->get_name()->c_str();
+  name += '.';
+  name += field->get_name()->c_str();
+  name += ':';
+  name += field->get_type()->get_name()->c_str();
+  assert(name == show(field));
+  return name;
 }
 
 std::string convert_type(std::string type) {
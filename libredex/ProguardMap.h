@@ -47,9 +47,7 @@ struct ProguardMap {
   /**
    * Construct map from a given stream.
    */
-  explicit ProguardMap(std::istream& is) {
-    parse_proguard_map(is);
-  }
+  explicit ProguardMap(std::istream& is);
 
   /**
    * Translate un-obfuscated class name to obfuscated name.
@@ -85,7 +83,7 @@ struct ProguardMap {
                               m_methodMap.empty() ; }
 
  private:
-  void parse_proguard_map(std::istream& fp);
+  void parse_proguard_map(const std::string& contents);
 
   bool parse_class(const std::string& line);
   bool parse_field(const std::string& line);
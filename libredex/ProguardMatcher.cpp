@@ -7,11 +7,15 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
+#include <boost/functional/hash.hpp>
 #include <boost/regex.hpp>
 #include <iostream>
+#include <iterator>
 #include <thread>
 
 #include "ClassHierarchy.h"
+#include "DexIdMap.h"
 #include "DexUtil.h"
 #include "IRCode.h"
 #include "ProguardMatcher.h"
@@ -26,21 +30,60 @@ namespace redex {
 
 namespace {
 
-using RegexMap = std::unordered_map<std::string, boost::regex>;
+/**
+ * Matches names against a ProGuard pattern. Uses a WildcardPattern, unless
+ * the pattern has something in it that only the regex formed by
+ * ProguardRegex would understand.
+ */
+class NameMatcher {
+ public:
+  // For a type pattern, as form_type_regex() takes.
+  static NameMatcher type(const std::string& pattern) {
+    NameMatcher matcher;
+    if (!matcher.m_pattern.append_type(pattern)) {
+      matcher.m_regex = std::make_shared<const boost::regex>(
+          proguard_parser::form_type_regex(pattern));
+    }
+    matcher.m_pattern.finish();
+    return matcher;
+  }
 
-std::unique_ptr<boost::regex> make_rx(const std::string& s,
-                                      bool convert = true) {
+  // For the "name:descriptor" of a field or method.
+  static NameMatcher member(const MemberSpecification& spec) {
+    NameMatcher matcher;
+    bool ok = matcher.m_pattern.append_member(spec.name);
+    matcher.m_pattern.append_literal(':');
+    if (!ok || !matcher.m_pattern.append_type(spec.descriptor)) {
+      matcher.m_regex = std::make_shared<const boost::regex>(
+          proguard_parser::form_member_regex(spec.name) + "\\:" +
+          proguard_parser::form_type_regex(spec.descriptor));
+    }
+    matcher.m_pattern.finish();
+    return matcher;
+  }
+
+  bool match(const char* s) const {
+    return m_regex ? boost::regex_match(s, *m_regex) : m_pattern.matches(s);
+  }
+  bool match(const std::string& s) const { return match(s.c_str()); }
+
+ private:
+  proguard_parser::WildcardPattern m_pattern;
+  std::shared_ptr<const boost::regex> m_regex;
+};
+
+std::shared_ptr<const NameMatcher> make_rx(const std::string& s,
+                                           bool convert = true) {
   if (s.empty()) return nullptr;
   auto wc = convert ? proguard_parser::convert_wildcard_type(s) : s;
-  auto rx = proguard_parser::form_type_regex(wc);
-  return std::make_unique<boost::regex>(rx);
+  return std::make_shared<const NameMatcher>(NameMatcher::type(wc));
 }
 
-bool match_annotation_rx(const DexClass* cls, const boost::regex& annorx) {
+bool match_annotation_rx(const DexClass* cls, const NameMatcher& annorx) {
   const auto* annos = cls->get_anno_set();
   if (!annos) return false;
   for (const auto& anno : annos->get_annotations()) {
-    if (boost::regex_match(anno->type()->c_str(), annorx)) {
+    if (annorx.match(anno->type()->c_str())) {
       return true;
     }
   }
@@ -49,7 +92,8 @@ bool match_annotation_rx(const DexClass* cls, const boost::regex& annorx) {
 
 /**
  * Helper class that holds the conditions for a class-level match on a keep
- * rule.
+ * rule. Copies share the compiled patterns, which are safe to match against
+ * from several threads, but each has its own cache.
  */
 struct ClassMatcher {
   explicit ClassMatcher(const KeepSpec& ks)
@@ -83,7 +127,7 @@ struct ClassMatcher {
  private:
   bool match_name(const DexClass* cls) const {
     const auto& deob_name = cls->get_deobfuscated_name();
-    return boost::regex_match(deob_name, *m_cls);
+    return m_cls->match(deob_name);
   }
 
   bool match_access(const DexClass* cls) const {
@@ -110,7 +154,7 @@ struct ClassMatcher {
       }
     }
     const auto& deob_name = cls->get_deobfuscated_name();
-    return boost::regex_match(deob_name, *m_extends);
+    return m_extends->match(deob_name);
   }
 
   bool search_interfaces(const DexClass* cls) {
@@ -160,16 +204,135 @@ struct ClassMatcher {
   DexAccessFlags setFlags_;
   DexAccessFlags unsetFlags_;
   std::string m_class_name;
-  std::unique_ptr<boost::regex> m_cls;
-  std::unique_ptr<boost::regex> m_anno;
-  std::unique_ptr<boost::regex> m_extends;
-  std::unique_ptr<boost::regex> m_extends_anno;
+  std::shared_ptr<const NameMatcher> m_cls;
+  std::shared_ptr<const NameMatcher> m_anno;
+  std::shared_ptr<const NameMatcher> m_extends;
+  std::shared_ptr<const NameMatcher> m_extends_anno;
 
   std::unordered_map<const DexClass*, bool> m_extends_result_cache;
 };
 
+// Characters that form_type_regex() leaves as they are and that have no special
+// meaning in a regex, so that they only match themselves.
+bool is_literal_type_char(char ch) {
+  return isalnum(ch) || ch == '_' || ch == '$' || ch == '/' || ch == ';';
+}
+
+/**
+ * An index over the classes in scope, so that a keep rule only has its
+ * regexes run on the classes that it could possibly match.
+ */
+class ClassIndex {
+ public:
+  explicit ClassIndex(const Scope& classes) : m_classes(classes) {
+    m_names.reserve(classes.size());
+    for (size_t i = 0; i < classes.size(); ++i) {
+      const auto* cls = classes[i];
+      m_names.emplace_back(cls->get_deobfuscated_name(), i);
+      const auto* annos = cls->get_anno_set();
+      if (annos == nullptr) {
+        continue;
+      }
+      for (const auto& anno : annos->get_annotations()) {
+        auto& annotated = m_annotated[anno->type()->get_name()->str()];
+        if (annotated.empty() || annotated.back() != i) {
+          annotated.push_back(i);
+        }
+      }
+    }
+    std::sort(m_names.begin(), m_names.end());
+  }
+
+  /**
+   * Collects the classes, in scope order, that have the literal prefix of
+   * the spec's class name and carry its annotation, if it names one without
+   * wildcards. Every class that the spec matches is among them. Returns false
+   * if the spec could match any class.
+   */
+  bool find_candidates(const ClassSpecification& spec,
+                       std::vector<DexClass*>* candidates) const {
+    const std::vector<size_t>* annotated = nullptr;
+    const auto& anno = spec.annotationType;
+    if (!anno.empty() &&
+        std::all_of(anno.begin(), anno.end(), is_literal_type_char)) {
+      auto it = m_annotated.find(anno);
+      annotated = it != m_annotated.end() ? &it->second : &m_none;
+    }
+    std::vector<size_t> named;
+    bool has_prefix = find_by_prefix(spec.className, &named);
+    if (!has_prefix && annotated == nullptr) {
+      return false;
+    }
+    std::vector<size_t> positions;
+    if (!has_prefix) {
+      positions = *annotated;
+    } else if (annotated == nullptr) {
+      positions = std::move(named);
+    } else {
+      std::set_intersection(named.begin(),
+                            named.end(),
+                            annotated->begin(),
+                            annotated->end(),
+                            std::back_inserter(positions));
+    }
+    candidates->clear();
+    candidates->reserve(positions.size());
+    for (auto i : positions) {
+      candidates->push_back(m_classes[i]);
+    }
+    return true;
+  }
+
+ private:
+  // Collects the positions, sorted, of the classes whose deobfuscated name
+  // starts with the literal prefix of class_name. Returns false if there is
+  // no prefix worth using.
+  bool find_by_prefix(const std::string& class_name,
+                      std::vector<size_t>* positions) const {
+    // ClassMatcher doesn't check the names of these at all.
+    if (class_name == "*" || class_name == "**") {
+      return false;
+    }
+    auto desc = proguard_parser::convert_wildcard_type(class_name);
+    if (desc.find_first_of("!|") != std::string::npos) {
+      return false;
+    }
+    size_t len = 0;
+    while (len < desc.size() && is_literal_type_char(desc[len])) {
+      ++len;
+    }
+    // Every class descriptor starts with L.
+    if (len <= 1) {
+      return false;
+    }
+    auto prefix = desc.substr(0, len);
+    auto it = std::lower_bound(
+        m_names.begin(), m_names.end(), std::make_pair(prefix, size_t(0)));
+    for (; it != m_names.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+      positions->push_back(it->second);
+    }
+    std::sort(positions->begin(), positions->end());
+    return true;
+  }
+
+  const Scope& m_classes;
+  // The deobfuscated names of the classes and their positions in scope,
+  // sorted by name, so that the classes with a given prefix are adjacent.
+  std::vector<std::pair<std::string, size_t>> m_names;
+  // The positions in scope of the classes with each annotation type.
+  std::unordered_map<std::string, std::vector<size_t>> m_annotated;
+  const std::vector<size_t> m_none;
+};
+
 } // namespace
 
+// The rstate changes that applying a keep rule to a class makes, in the order
+// they are to be made. The matching that finds them only reads the classes,
+// so it can run on many classes in parallel; see process_keep.
+using Marks = std::vector<std::function<void()>>;
+
 // Updates a class, field or method to add keep modifiers.
 // Note: includedescriptorclasses and allowoptimization are not implemented.
 template <class DexMember>
@@ -219,26 +382,12 @@ inline bool is_blanket_keepnames_rule(const KeepSpec& keep_rule) {
   return false;
 }
 
-boost::regex& register_matcher(RegexMap& regex_map, const std::string& regex) {
-  auto where = regex_map.find(regex);
-  if (where == regex_map.end()) {
-    regex_map.emplace(regex, boost::regex{regex});
-    return regex_map.at(regex);
-  }
-  return where->second;
-}
-
 template <class DexMember>
-bool has_annotation(RegexMap& regex_map,
-                    const DexMember* member,
-                    const std::string& annotation) {
+bool has_annotation(const DexMember* member, const NameMatcher& annorx) {
   auto annos = member->get_anno_set();
   if (annos != nullptr) {
-    auto annotation_regex = proguard_parser::form_type_regex(annotation);
-    const boost::regex& annotation_matcher =
-        register_matcher(regex_map, annotation_regex);
     for (const auto& anno : annos->get_annotations()) {
-      if (boost::regex_match(anno->type()->c_str(), annotation_matcher)) {
+      if (annorx.match(anno->type()->c_str())) {
         return true;
       }
     }
@@ -258,113 +407,174 @@ std::string extract_field_name(std::string qualified_fieldname) {
 
 std::string extract_method_name_and_type(std::string qualified_fieldname) {
   auto p = qualified_fieldname.find(";.");
+  if (p == std::string::npos) {
+    return qualified_fieldname;
+  }
   return qualified_fieldname.substr(p + 2);
 }
 
-bool field_level_match(RegexMap& regex_map,
-                       const redex::MemberSpecification& fieldSpecification,
-                       const DexField* field,
-                       const boost::regex& fieldname_regex) {
-  // Check for annotation guards.
-  if (!(fieldSpecification.annotationType.empty())) {
-    if (!has_annotation(regex_map, field, fieldSpecification.annotationType)) {
+std::string dequalified_name(const DexField* field) {
+  return extract_field_name(field->get_deobfuscated_name());
+}
+
+std::string dequalified_name(const DexMethod* method) {
+  return extract_method_name_and_type(method->get_deobfuscated_name());
+}
+
+/**
+ * The "name:descriptor" part of the deobfuscated name of every field and
+ * method in scope, which is what the member specifications are matched
+ * against. It is worked out once per member, instead of once per member for
+ * every rule that looks at it.
+ */
+class MemberNames {
+ public:
+  explicit MemberNames(const Scope& classes) {
+    for (const auto* cls : classes) {
+      for (const auto* field : cls->get_ifields()) {
+        m_fields[field] = dequalified_name(field);
+      }
+      for (const auto* field : cls->get_sfields()) {
+        m_fields[field] = dequalified_name(field);
+      }
+      for (const auto* method : cls->get_dmethods()) {
+        m_methods[method] = dequalified_name(method);
+      }
+      for (const auto* method : cls->get_vmethods()) {
+        m_methods[method] = dequalified_name(method);
+      }
+    }
+  }
+
+  bool match(const NameMatcher& matcher, const DexField* field) const {
+    return match(matcher, field, m_fields.at(field));
+  }
+
+  bool match(const NameMatcher& matcher, const DexMethod* method) const {
+    return match(matcher, method, m_methods.at(method));
+  }
+
+ private:
+  template <class DexMember>
+  static bool match(const NameMatcher& matcher,
+                    const DexMember* member,
+                    const std::string& name) {
+    // The names always have a ':' in them, so an empty one is for a member
+    // that was not in scope.
+    if (name.empty()) {
+      return matcher.match(dequalified_name(member));
+    }
+    return matcher.match(name);
+  }
+
+  FieldIdMap<std::string> m_fields;
+  MethodIdMap<std::string> m_methods;
+};
+
+/**
+ * A member specification, compiled once per rule: the patterns for its
+ * "name:descriptor" and its annotation guard. Matching only reads them, so
+ * all the threads matching a rule share them.
+ */
+struct MemberMatcher {
+  explicit MemberMatcher(const MemberSpecification& spec)
+      : spec(spec),
+        name(NameMatcher::member(spec)),
+        annotation(make_rx(spec.annotationType, false)) {}
+
+  template <class DexMember>
+  bool match(const MemberNames& names, const DexMember* member) const {
+    // Check for annotation guards.
+    if (annotation && !has_annotation(member, *annotation)) {
+      return false;
+    }
+    // Check for access match.
+    if (!access_matches(spec.requiredSetAccessFlags,
+                        spec.requiredUnsetAccessFlags,
+                        member->get_access())) {
       return false;
     }
+    return names.match(name, member);
   }
-  // Check for access match.
-  if (!access_matches(fieldSpecification.requiredSetAccessFlags,
-                      fieldSpecification.requiredUnsetAccessFlags,
-                      field->get_access())) {
-    return false;
+
+  const MemberSpecification& spec;
+  NameMatcher name;
+  std::shared_ptr<const NameMatcher> annotation;
+};
+
+// The compiled member specifications of a rule.
+struct RuleMatcher {
+  RuleMatcher(const KeepSpec& keep_rule, const MemberNames& names)
+      : names(names) {
+    for (const auto& spec : keep_rule.class_spec.fieldSpecifications) {
+      fields.emplace_back(spec);
+    }
+    for (const auto& spec : keep_rule.class_spec.methodSpecifications) {
+      methods.emplace_back(spec);
+    }
   }
-  // Match field name against regex.
-  auto dequalified_name = extract_field_name(field->get_deobfuscated_name());
-  return boost::regex_match(dequalified_name, fieldname_regex);
-}
+
+  const MemberNames& names;
+  std::vector<MemberMatcher> fields;
+  std::vector<MemberMatcher> methods;
+};
 
 template <class Container>
-void keep_fields(RegexMap& regex_map,
+void keep_fields(const MemberNames& names,
                  const redex::KeepSpec& keep_rule,
                  bool apply_modifiers,
                  const Container& fields,
-                 const redex::MemberSpecification& fieldSpecification,
+                 const MemberMatcher& field_matcher,
                  const std::function<void(DexField*)>& keeper,
-                 const boost::regex& fieldname_regex) {
+                 Marks& marks) {
+  const auto& fieldSpecification = field_matcher.spec;
   for (DexField* field : fields) {
-    if (!field_level_match(
-            regex_map, fieldSpecification, field, fieldname_regex)) {
+    if (!field_matcher.match(names, field)) {
       continue;
     }
-    if (apply_modifiers) {
-      apply_keep_modifiers(keep_rule, field);
-    }
-    keeper(field);
-    if (field->rstate.report_whyareyoukeeping()) {
-      TRACE(PGR,
-            2,
-            "whyareyoukeeping Field %s kept by %s\n",
-            SHOW(field),
-            show_keep(keep_rule).c_str());
-    }
-    fieldSpecification.count++;
+    marks.emplace_back(
+        [&keep_rule, apply_modifiers, &fieldSpecification, keeper, field]() {
+          if (apply_modifiers) {
+            apply_keep_modifiers(keep_rule, field);
+          }
+          keeper(field);
+          if (field->rstate.report_whyareyoukeeping()) {
+            TRACE(PGR,
+                  2,
+                  "whyareyoukeeping Field %s kept by %s\n",
+                  SHOW(field),
+                  show_keep(keep_rule).c_str());
+          }
+          fieldSpecification.count++;
+        });
   }
 }
 
-std::string field_regex(const MemberSpecification& field_spec) {
-  std::stringstream ss;
-  ss << proguard_parser::form_member_regex(field_spec.name);
-  ss << "\\:";
-  ss << proguard_parser::form_type_regex(field_spec.descriptor);
-  return ss.str();
-}
-
-void apply_field_keeps(RegexMap& regex_map,
+void apply_field_keeps(const RuleMatcher& rule,
                        const DexClass* cls,
                        const redex::KeepSpec& keep_rule,
                        bool apply_modifiers,
-                       const std::function<void(DexField*)>& keeper) {
-  for (const auto& field_spec : keep_rule.class_spec.fieldSpecifications) {
-    auto fieldname_regex = field_regex(field_spec);
-    const boost::regex& matcher = register_matcher(regex_map, fieldname_regex);
-    keep_fields(regex_map,
+                       const std::function<void(DexField*)>& keeper,
+                       Marks& marks) {
+  for (const auto& field_matcher : rule.fields) {
+    keep_fields(rule.names,
                 keep_rule,
                 apply_modifiers,
                 cls->get_ifields(),
-                field_spec,
+                field_matcher,
                 keeper,
-                matcher);
-    keep_fields(regex_map,
+                marks);
+    keep_fields(rule.names,
                 keep_rule,
                 apply_modifiers,
                 cls->get_sfields(),
-                field_spec,
+                field_matcher,
                 keeper,
-                matcher);
+                marks);
   }
 }
 
-bool method_level_match(RegexMap& regex_map,
-                        const redex::MemberSpecification& methodSpecification,
-                        const DexMethod* method,
-                        const boost::regex& method_regex) {
-  // Check to see if the method match is guarded by an annotation match.
-  if (!(methodSpecification.annotationType.empty())) {
-    if (!has_annotation(
-            regex_map, method, methodSpecification.annotationType)) {
-      return false;
-    }
-  }
-  if (!access_matches(methodSpecification.requiredSetAccessFlags,
-                      methodSpecification.requiredUnsetAccessFlags,
-                      method->get_access())) {
-    return false;
-  }
-  auto dequalified_name =
-      extract_method_name_and_type(method->get_deobfuscated_name());
-  return boost::regex_match(dequalified_name.c_str(), method_regex);
-}
-
-void keep_clinits(DexClass* cls) {
+void keep_clinits(DexClass* cls, Marks& marks) {
   for (auto method : cls->get_dmethods()) {
     if (is_clinit(method) && method->get_code()) {
       auto ii = InstructionIterable(method->get_code());
@@ -373,7 +583,7 @@ void keep_clinits(DexClass* cls) {
         ++it;
       }
       if (!(it->insn->opcode() == OPCODE_RETURN_VOID && (++it) == ii.end())) {
-        method->rstate.set_keep();
+        marks.emplace_back([method]() { method->rstate.set_keep(); });
       }
       break;
     }
@@ -381,65 +591,57 @@ void keep_clinits(DexClass* cls) {
 }
 
 template <class Container>
-void keep_methods(RegexMap& regex_map,
+void keep_methods(const MemberNames& names,
                   const KeepSpec& keep_rule,
                   bool apply_modifiers,
-                  const redex::MemberSpecification& methodSpecification,
+                  const MemberMatcher& method_matcher,
                   const Container& methods,
-                  const boost::regex& method_regex,
-                  const std::function<void(DexMethod*)>& keeper) {
+                  const std::function<void(DexMethod*)>& keeper,
+                  Marks& marks) {
+  const auto& methodSpecification = method_matcher.spec;
   for (DexMethod* method : methods) {
-    if (method_level_match(
-            regex_map, methodSpecification, method, method_regex)) {
-      if (apply_modifiers) {
-        apply_keep_modifiers(keep_rule, method);
-      }
-      keeper(method);
-      if (method->rstate.report_whyareyoukeeping()) {
-        TRACE(PGR,
-              2,
-              "whyareyoukeeping Method %s kept by %s\n",
-              SHOW(method),
-              show_keep(keep_rule).c_str());
-      }
-      methodSpecification.count++;
+    if (!method_matcher.match(names, method)) {
+      continue;
     }
+    marks.emplace_back(
+        [&keep_rule, apply_modifiers, &methodSpecification, keeper, method]() {
+          if (apply_modifiers) {
+            apply_keep_modifiers(keep_rule, method);
+          }
+          keeper(method);
+          if (method->rstate.report_whyareyoukeeping()) {
+            TRACE(PGR,
+                  2,
+                  "whyareyoukeeping Method %s kept by %s\n",
+                  SHOW(method),
+                  show_keep(keep_rule).c_str());
+          }
+          methodSpecification.count++;
+        });
   }
 }
 
-std::string method_regex(const MemberSpecification& method_spec) {
-  auto qualified_method_regex =
-      proguard_parser::form_member_regex(method_spec.name);
-  qualified_method_regex += "\\:";
-  qualified_method_regex +=
-      proguard_parser::form_type_regex(method_spec.descriptor);
-  return qualified_method_regex;
-}
-
-void apply_method_keeps(RegexMap& regex_map,
+void apply_method_keeps(const RuleMatcher& rule,
                         const DexClass* cls,
                         const redex::KeepSpec& keep_rule,
                         bool apply_modifiers,
-                        const std::function<void(DexMethod*)>& keeper) {
-  auto methodSpecifications = keep_rule.class_spec.methodSpecifications;
-  for (auto& method_spec : methodSpecifications) {
-    auto qualified_method_regex = method_regex(method_spec);
-    const boost::regex& method_regex =
-        register_matcher(regex_map, qualified_method_regex);
-    keep_methods(regex_map,
+                        const std::function<void(DexMethod*)>& keeper,
+                        Marks& marks) {
+  for (const auto& method_matcher : rule.methods) {
+    keep_methods(rule.names,
                  keep_rule,
                  apply_modifiers,
-                 method_spec,
+                 method_matcher,
                  cls->get_vmethods(),
-                 method_regex,
-                 keeper);
-    keep_methods(regex_map,
+                 keeper,
+                 marks);
+    keep_methods(rule.names,
                  keep_rule,
                  apply_modifiers,
-                 method_spec,
+                 method_matcher,
                  cls->get_dmethods(),
-                 method_regex,
-                 keeper);
+                 keeper,
+                 marks);
   }
 }
 
@@ -465,43 +667,47 @@ DexClass* find_single_class(const ProguardMap& pg_map,
   return type_class(typ);
 }
 
-std::vector<DexMethod*> all_method_matches(
-    RegexMap& regex_map,
-    const DexClass* cls,
-    const MemberSpecification& method_keep,
-    const boost::regex& method_regex) {
-  std::vector<DexMethod*> matches;
-  for (const auto& method : cls->get_vmethods()) {
-    if (method_level_match(regex_map, method_keep, method, method_regex)) {
-      matches.push_back(method);
-    }
-  }
-  for (const auto& method : cls->get_dmethods()) {
-    if (method_level_match(regex_map, method_keep, method, method_regex)) {
-      matches.push_back(method);
+template <class Container>
+bool any_matches(const MemberNames& names,
+                 const MemberMatcher& matcher,
+                 const Container& members) {
+  for (const auto* member : members) {
+    if (matcher.match(names, member)) {
+      return true;
     }
   }
-  return matches;
+  return false;
 }
 
-// Find all matching methods in class cls.
-void matching_methods(RegexMap& regex_map,
-                      std::vector<MemberSpecification>& method_keeps,
+// Whether class cls has a method that matches the method keep rule.
+bool has_matching_method(const MemberNames& names,
+                         const MemberMatcher& method_keep,
+                         const DexClass* cls) {
+  return any_matches(names, method_keep, cls->get_vmethods()) ||
+         any_matches(names, method_keep, cls->get_dmethods());
+}
+
+// Whether class cls has a field that matches the field keep rule.
+bool has_matching_field(const MemberNames& names,
+                        const MemberMatcher& field_keep,
+                        const DexClass* cls) {
+  return any_matches(names, field_keep, cls->get_ifields()) ||
+         any_matches(names, field_keep, cls->get_sfields());
+}
+
+// Find all matching methods in class cls. Sets matched[i] if the i-th method
+// keep rule matches.
+void matching_methods(const RuleMatcher& rule,
                       const DexClass* cls,
-                      bool search_super_classes) {
+                      bool search_super_classes,
+                      std::vector<bool>& matched) {
   const DexClass* class_to_search = cls;
   while (class_to_search != nullptr && !class_to_search->is_external()) {
-    for (auto& method_keep : method_keeps) {
-      auto qualified_method_regex = method_regex(method_keep);
-      const boost::regex& matcher =
-          register_matcher(regex_map, qualified_method_regex);
-      std::vector<DexMethod*> matched_methods =
-          all_method_matches(regex_map, class_to_search, method_keep, matcher);
-      if (matched_methods.empty()) {
-        continue;
+    for (size_t i = 0; i < rule.methods.size(); ++i) {
+      if (has_matching_method(rule.names, rule.methods[i], class_to_search)) {
+        // Record a match for this method level keep rule.
+        matched[i] = true;
       }
-      // Record a match for this method level keep rule.
-      method_keep.mark_conditionally = true;
     }
     if (!search_super_classes) {
       break;
@@ -514,43 +720,19 @@ void matching_methods(RegexMap& regex_map,
   }
 }
 
-std::vector<DexField*> all_field_matches(
-    RegexMap& regex_map,
-    const DexClass* cls,
-    const MemberSpecification& field_keep) {
-  auto fieldtype_regex = field_regex(field_keep);
-  auto ifields = cls->get_ifields();
-  auto sfields = cls->get_sfields();
-  std::vector<DexField*> matches;
-  const boost::regex& matcher = register_matcher(regex_map, fieldtype_regex);
-  for (const auto& field : ifields) {
-    if (field_level_match(regex_map, field_keep, field, matcher)) {
-      matches.push_back(field);
-    }
-  }
-  for (const auto& field : sfields) {
-    if (field_level_match(regex_map, field_keep, field, matcher)) {
-      matches.push_back(field);
-    }
-  }
-  return matches;
-}
-
-// Find all matching fields in class cls.
-void matching_fields(RegexMap& regex_map,
-                     std::vector<MemberSpecification>& field_keeps,
+// Find all matching fields in class cls. Sets matched[i] if the i-th field
+// keep rule matches.
+void matching_fields(const RuleMatcher& rule,
                      const DexClass* cls,
-                     bool search_super_classes) {
+                     bool search_super_classes,
+                     std::vector<bool>& matched) {
   const DexClass* class_to_search = cls;
   while (class_to_search != nullptr && !class_to_search->is_external()) {
-    for (auto& field_keep : field_keeps) {
-      auto matched_fields =
-          all_field_matches(regex_map, class_to_search, field_keep);
-      if (matched_fields.empty()) {
-        continue;
+    for (size_t i = 0; i < rule.fields.size(); ++i) {
+      if (has_matching_field(rule.names, rule.fields[i], class_to_search)) {
+        // Record a match for this field keep rule.
+        matched[i] = true;
       }
-      // Record a match for this field keep rule.
-      field_keep.mark_conditionally = true;
     }
     if (!search_super_classes) {
       break;
@@ -563,37 +745,33 @@ void matching_fields(RegexMap& regex_map,
   }
 }
 
-bool all_conditionally_matched(
-    const std::vector<MemberSpecification>& members) {
+bool all_conditionally_matched(const std::vector<bool>& matched) {
   return std::all_of(
-      members.begin(), members.end(), [](const MemberSpecification& m) {
-        return m.mark_conditionally;
-      });
-}
-
-bool process_mark_conditionally(RegexMap& regex_map,
-                                KeepSpec& keep_rule,
-                                const DexClass* cls) {
-  if (keep_rule.class_spec.fieldSpecifications.empty() &&
-      keep_rule.class_spec.methodSpecifications.empty()) {
-    std::cerr << "WARNING: A keepclasseswithmembers rule for class "
-              << keep_rule.class_spec.className
-              << " has no field or member specifications.\n";
-  }
-  // Clear conditional marks.
-  for (auto& field_spec : keep_rule.class_spec.fieldSpecifications) {
-    field_spec.mark_conditionally = false;
-  }
-  for (auto& method_spec : keep_rule.class_spec.methodSpecifications) {
-    method_spec.mark_conditionally = false;
-  }
-  matching_fields(
-      regex_map, keep_rule.class_spec.fieldSpecifications, cls, false);
-  matching_methods(
-      regex_map, keep_rule.class_spec.methodSpecifications, cls, false);
+      matched.begin(), matched.end(), [](bool m) { return m; });
+}
+
+// The matches are recorded locally rather than in the MemberSpecifications,
+// since the same rule is matched against several classes at once.
+bool process_mark_conditionally(const RuleMatcher& rule,
+                                const KeepSpec& keep_rule,
+                                const DexClass* cls,
+                                Marks& marks) {
+  const auto& field_specs = keep_rule.class_spec.fieldSpecifications;
+  const auto& method_specs = keep_rule.class_spec.methodSpecifications;
+  if (field_specs.empty() && method_specs.empty()) {
+    marks.emplace_back([&keep_rule]() {
+      std::cerr << "WARNING: A keepclasseswithmembers rule for class "
+                << keep_rule.class_spec.className
+                << " has no field or member specifications.\n";
+    });
+  }
+  std::vector<bool> fields_matched(field_specs.size(), false);
+  std::vector<bool> methods_matched(method_specs.size(), false);
+  matching_fields(rule, cls, false, fields_matched);
+  matching_methods(rule, cls, false, methods_matched);
   // Make sure every field and method keep rule is matched.
-  return all_conditionally_matched(keep_rule.class_spec.fieldSpecifications) &&
-         all_conditionally_matched(keep_rule.class_spec.methodSpecifications);
+  return all_conditionally_matched(fields_matched) &&
+         all_conditionally_matched(methods_matched);
 }
 
 // Once a match has been made against a class i.e. the class name
@@ -602,70 +780,77 @@ bool process_mark_conditionally(RegexMap& regex_map,
 // bits to the class, members and appropriate classes and members
 // in the class hierarchy.
 //
-// Parallelization note: We parallelize process_keep, and this function will be
-// eventually executed concurrently. There are potential races in rstate:
-// (1) m_keep, (2) m_(un)set_allow(shrinking|obfuscation), (3)
-// m_blanket_keepnames, and (4) m_keep_count. We use an atomic value for
-// m_keep_count, but the other boolean values are always overwritten. These WAW
-// (write-after-write) races are benign and do not affect the results.
-void mark_class_and_members_for_keep(RegexMap& regex_map,
-                                     KeepSpec& keep_rule,
-                                     DexClass* cls) {
+// Parallelization note: This function runs concurrently for different
+// classes, so it only reads the classes and records what to mark in `marks`.
+// The marks are made in class order afterwards, since apply_keep_modifiers
+// depends on what earlier rules and classes have kept.
+void mark_class_and_members_for_keep(const RuleMatcher& rule,
+                                     const KeepSpec& keep_rule,
+                                     DexClass* cls,
+                                     Marks& marks) {
   // First check to see if we need to mark conditionally to see if all
   // field and method rules match i.e. we have a -keepclasseswithmembers
   // rule to process.
   if (keep_rule.mark_conditionally) {
     // If this class does not incur at least one match for each field
     // and method rule, then don't mark this class or its members.
-    if (!process_mark_conditionally(regex_map, keep_rule, cls)) {
+    if (!process_mark_conditionally(rule, keep_rule, cls, marks)) {
       return;
     }
   }
-  // Mark descriptor classes
-  if (keep_rule.includedescriptorclasses) {
-    std::cerr << "WARNING: 'includedescriptorclasses' keep modifier is NOT "
-                 "implemented: "
-              << redex::show_keep(keep_rule) << std::endl;
-  }
-  if (keep_rule.allowoptimization) {
-    std::cerr
-        << "WARNING: 'allowoptimization' keep modifier is NOT implemented: "
-        << redex::show_keep(keep_rule) << std::endl;
-  }
-  keep_rule.count++;
-  if (keep_rule.mark_classes || keep_rule.mark_conditionally) {
-    apply_keep_modifiers(keep_rule, cls);
-    cls->rstate.set_keep();
-    if (cls->rstate.report_whyareyoukeeping()) {
-      TRACE(
-          PGR,
-          2,
-          "whyareyoukeeping Class %s kept by %s\n",
-          redex::dexdump_name_to_dot_name(cls->get_deobfuscated_name()).c_str(),
-          show_keep(keep_rule).c_str());
-    }
-    if (!keep_rule.allowobfuscation) {
-      cls->rstate.increment_keep_count();
+  marks.emplace_back([&keep_rule, cls]() {
+    // Mark descriptor classes
+    if (keep_rule.includedescriptorclasses) {
+      std::cerr << "WARNING: 'includedescriptorclasses' keep modifier is NOT "
+                   "implemented: "
+                << redex::show_keep(keep_rule) << std::endl;
     }
-    if (is_blanket_keepnames_rule(keep_rule)) {
-      cls->rstate.set_blanket_keepnames();
+    if (keep_rule.allowoptimization) {
+      std::cerr
+          << "WARNING: 'allowoptimization' keep modifier is NOT implemented: "
+          << redex::show_keep(keep_rule) << std::endl;
     }
+    keep_rule.count++;
+    if (keep_rule.mark_classes || keep_rule.mark_conditionally) {
+      apply_keep_modifiers(keep_rule, cls);
+      cls->rstate.set_keep();
+      if (cls->rstate.report_whyareyoukeeping()) {
+        TRACE(PGR,
+              2,
+              "whyareyoukeeping Class %s kept by %s\n",
+              redex::dexdump_name_to_dot_name(cls->get_deobfuscated_name())
+                  .c_str(),
+              show_keep(keep_rule).c_str());
+      }
+      if (!keep_rule.allowobfuscation) {
+        cls->rstate.increment_keep_count();
+      }
+      if (is_blanket_keepnames_rule(keep_rule)) {
+        cls->rstate.set_blanket_keepnames();
+      }
+    }
+  });
+  if (keep_rule.mark_classes || keep_rule.mark_conditionally) {
     // Mark non-empty <clinit> methods as seeds.
-    keep_clinits(cls);
+    keep_clinits(cls, marks);
   }
   // Walk up the hierarchy performing seed marking.
   DexClass* class_to_mark = cls;
   bool apply_modifiers = true;
   while (class_to_mark != nullptr && !class_to_mark->is_external()) {
     // Mark unconditionally.
-    apply_field_keeps(
-        regex_map, class_to_mark, keep_rule, apply_modifiers, [](DexField* f) {
-          f->rstate.set_keep();
-        });
-    apply_method_keeps(
-        regex_map, class_to_mark, keep_rule, apply_modifiers, [](DexMethod* m) {
-          m->rstate.set_keep();
-        });
+    apply_field_keeps(rule,
+                      class_to_mark,
+                      keep_rule,
+                      apply_modifiers,
+                      [](DexField* f) { f->rstate.set_keep(); },
+                      marks);
+    apply_method_keeps(rule,
+                       class_to_mark,
+                       keep_rule,
+                       apply_modifiers,
+                       [](DexMethod* m) { m->rstate.set_keep(); },
+                       marks);
     apply_modifiers = false;
     auto typ = class_to_mark->get_super_class();
     if (typ == nullptr) {
@@ -676,30 +861,41 @@ void mark_class_and_members_for_keep(RegexMap& regex_map,
 }
 
 // This function is also executed concurrently.
-void process_whyareyoukeeping(RegexMap& regex_map,
-                              KeepSpec& keep_rule,
-                              DexClass* cls) {
-  cls->rstate.set_whyareyoukeeping();
-
-  apply_field_keeps(regex_map, cls, keep_rule, false, [](DexField* f) {
-    f->rstate.set_whyareyoukeeping();
-  });
+void process_whyareyoukeeping(const RuleMatcher& rule,
+                              const KeepSpec& keep_rule,
+                              DexClass* cls,
+                              Marks& marks) {
+  marks.emplace_back([cls]() { cls->rstate.set_whyareyoukeeping(); });
+
+  apply_field_keeps(rule,
+                    cls,
+                    keep_rule,
+                    false,
+                    [](DexField* f) { f->rstate.set_whyareyoukeeping(); },
+                    marks);
   // Set any method-level keep whyareyoukeeping bits.
-  apply_method_keeps(regex_map, cls, keep_rule, false, [](DexMethod* m) {
-    m->rstate.set_whyareyoukeeping();
-  });
+  apply_method_keeps(rule,
+                     cls,
+                     keep_rule,
+                     false,
+                     [](DexMethod* m) { m->rstate.set_whyareyoukeeping(); },
+                     marks);
 }
 
 // This function is also executed concurrently.
-void process_assumenosideeffects(RegexMap& regex_map,
-                                 KeepSpec& keep_rule,
-                                 DexClass* cls) {
-  cls->rstate.set_assumenosideeffects();
+void process_assumenosideeffects(const RuleMatcher& rule,
+                                 const KeepSpec& keep_rule,
+                                 DexClass* cls,
+                                 Marks& marks) {
+  marks.emplace_back([cls]() { cls->rstate.set_assumenosideeffects(); });
 
   // Apply any method-level keep specifications.
-  apply_method_keeps(regex_map, cls, keep_rule, false, [](DexMethod* m) {
-    m->rstate.set_assumenosideeffects();
-  });
+  apply_method_keeps(rule,
+                     cls,
+                     keep_rule,
+                     false,
+                     [](DexMethod* m) { m->rstate.set_assumenosideeffects(); },
+                     marks);
 }
 
 /*
@@ -724,49 +920,62 @@ void build_extends_or_implements_hierarchy(const Scope& scope,
   }
 }
 
-void process_keep(
-    const ProguardMap& pg_map,
-    std::vector<KeepSpec>& keep_rules,
-    const Scope& classes,
-    const Scope& external_classes,
-    const ClassHierarchy& hierarchy,
-    std::function<void(RegexMap&, KeepSpec&, DexClass*)> keep_processor,
-    const std::string& name) {
+using KeepProcessor = std::function<void(
+    const RuleMatcher&, const KeepSpec&, DexClass*, Marks&)>;
+
+void apply_marks(Marks& marks) {
+  for (const auto& mark : marks) {
+    mark();
+  }
+  marks.clear();
+}
+
+// The rules are applied one after the other, in order. A rule that may match
+// many classes is matched against chunks of consecutive candidate classes in
+// parallel, each thread with its own ClassMatcher, and the marks of the chunks
+// are then made in class order. The result is the same as matching the classes
+// one by one. The member specifications of a rule are compiled once and shared
+// by the threads.
+void process_keep(const ProguardMap& pg_map,
+                  std::vector<KeepSpec>& keep_rules,
+                  const Scope& classes,
+                  const Scope& external_classes,
+                  const ClassHierarchy& hierarchy,
+                  const ClassIndex& index,
+                  const MemberNames& member_names,
+                  const KeepProcessor& keep_processor,
+                  const std::string& name) {
   Timer t("Process keep for " + name);
 
   auto process_single_keep = [&keep_processor](ClassMatcher& class_match,
-                                               KeepSpec& keep_rule,
+                                               const KeepSpec& keep_rule,
                                                DexClass* cls,
-                                               RegexMap& regex_map) {
+                                               const RuleMatcher& rule,
+                                               Marks& marks) {
     // Skip external classes.
     if (cls == nullptr || cls->is_external()) {
       return;
     }
     if (class_match.match(cls)) {
-      keep_processor(regex_map, keep_rule, cls);
+      keep_processor(rule, keep_rule, cls, marks);
     }
   };
 
-  // We only parallelize if keep_rule needs to be applied to all classes.
-  auto wq = workqueue_foreach<KeepSpec*>(
-      [&process_single_keep, &classes](KeepSpec* keep_rule) {
-        RegexMap regex_map;
-        ClassMatcher class_match(*keep_rule);
-
-        for (const auto& cls : classes) {
-          process_single_keep(class_match, *keep_rule, cls, regex_map);
-        }
-      });
+  constexpr size_t kClassesPerChunk = 256;
+  std::vector<DexClass*> candidates;
+  std::vector<Marks> chunk_marks;
 
   for (auto& keep_rule : keep_rules) {
-    RegexMap regex_map;
+    RuleMatcher rule(keep_rule, member_names);
     ClassMatcher class_match(keep_rule);
+    Marks marks;
 
     // This case is very fast. Just process it immediately in the main thread.
     const auto& className = keep_rule.class_spec.className;
     if (!classname_contains_wildcard(className)) {
       DexClass* cls = find_single_class(pg_map, className);
-      process_single_keep(class_match, keep_rule, cls, regex_map);
+      process_single_keep(class_match, keep_rule, cls, rule, marks);
+      apply_marks(marks);
       continue;
     }
 
@@ -778,20 +987,50 @@ void process_keep(
       if (super != nullptr) {
         TypeSet children;
         get_all_children(hierarchy, super->get_type(), children);
-        process_single_keep(class_match, keep_rule, super, regex_map);
+        process_single_keep(class_match, keep_rule, super, rule, marks);
         for (auto const* type : children) {
           process_single_keep(
-              class_match, keep_rule, type_class(type), regex_map);
+              class_match, keep_rule, type_class(type), rule, marks);
         }
       }
+      apply_marks(marks);
       continue;
     }
 
-    // Otherwise, it might take a longer time. Add to the work queue.
-    wq.add_item(&keep_rule);
+    // Otherwise, it might take a longer time. Narrow the classes down to
+    // those the rule could match, if possible, and match them in parallel.
+    const Scope* targets = &classes;
+    if (index.find_candidates(keep_rule.class_spec, &candidates)) {
+      targets = &candidates;
+    }
+    size_t num_chunks =
+        (targets->size() + kClassesPerChunk - 1) / kClassesPerChunk;
+    chunk_marks.resize(std::max(chunk_marks.size(), num_chunks));
+    WorkQueue<size_t, ClassMatcher, std::nullptr_t> wq(
+        [&](ClassMatcher& thread_class_match, size_t chunk) -> std::nullptr_t {
+          auto end =
+              std::min(targets->size(), (chunk + 1) * kClassesPerChunk);
+          for (size_t i = chunk * kClassesPerChunk; i < end; ++i) {
+            process_single_keep(thread_class_match,
+                                keep_rule,
+                                (*targets)[i],
+                                rule,
+                                chunk_marks[chunk]);
+          }
+          return nullptr;
+        },
+        [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+        [&](unsigned int) { return class_match; },
+        std::min<size_t>(workqueue_default_num_threads(),
+                         std::max<size_t>(1, num_chunks)));
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+      wq.add_item(chunk);
+    }
+    wq.run_all();
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+      apply_marks(chunk_marks[chunk]);
+    }
   }
-
-  wq.run_all();
 }
 
 inline bool operator==(const MemberSpecification& lhs,
@@ -822,18 +1061,59 @@ inline bool operator==(const KeepSpec& lhs, const KeepSpec& rhs) {
          lhs.class_spec == rhs.class_spec;
 }
 
-void filter_duplicate_rules(std::vector<KeepSpec>* keep_rules) {
+// Hashes the same fields the operator== above compare.
+size_t hash_value(const MemberSpecification& spec) {
+  size_t seed = 0;
+  boost::hash_combine(seed, static_cast<uint32_t>(spec.requiredSetAccessFlags));
+  boost::hash_combine(seed,
+                      static_cast<uint32_t>(spec.requiredUnsetAccessFlags));
+  boost::hash_combine(seed, spec.annotationType);
+  boost::hash_combine(seed, spec.name);
+  boost::hash_combine(seed, spec.descriptor);
+  return seed;
+}
+
+size_t hash_value(const KeepSpec& spec) {
+  size_t seed = 0;
+  boost::hash_combine(seed, spec.includedescriptorclasses);
+  boost::hash_combine(seed, spec.allowshrinking);
+  boost::hash_combine(seed, spec.allowoptimization);
+  boost::hash_combine(seed, spec.allowobfuscation);
+  const auto& class_spec = spec.class_spec;
+  boost::hash_combine(seed, class_spec.className);
+  boost::hash_combine(seed, class_spec.annotationType);
+  boost::hash_combine(seed, class_spec.extendsClassName);
+  boost::hash_combine(seed, class_spec.extendsAnnotationType);
+  boost::hash_combine(seed, static_cast<uint32_t>(class_spec.setAccessFlags));
+  boost::hash_combine(seed,
+                      static_cast<uint32_t>(class_spec.unsetAccessFlags));
+  boost::hash_range(seed,
+                    class_spec.fieldSpecifications.begin(),
+                    class_spec.fieldSpecifications.end());
+  boost::hash_range(seed,
+                    class_spec.methodSpecifications.begin(),
+                    class_spec.methodSpecifications.end());
+  return seed;
+}
+
+// Returns the number of rules removed.
+size_t filter_duplicate_rules(std::vector<KeepSpec>* keep_rules) {
+  // Keeps the first of each set of equal rules, in their original order.
   std::vector<KeepSpec> unique;
-  for (const auto& rule : *keep_rules) {
-    auto it = std::find(unique.begin(), unique.end(), rule);
-    if (it == unique.end()) {
-      unique.push_back(rule);
+  std::unordered_map<size_t, std::vector<size_t>> unique_by_hash;
+  for (auto& rule : *keep_rules) {
+    auto& candidates = unique_by_hash[hash_value(rule)];
+    auto it = std::find_if(
+        candidates.begin(), candidates.end(),
+        [&](size_t i) { return unique[i] == rule; });
+    if (it == candidates.end()) {
+      candidates.push_back(unique.size());
+      unique.push_back(std::move(rule));
     }
   }
-  keep_rules->clear();
-  for (const auto& rule : unique) {
-    keep_rules->push_back(rule);
-  }
+  size_t removed = keep_rules->size() - unique.size();
+  *keep_rules = std::move(unique);
+  return removed;
 }
 
 void process_proguard_rules(const ProguardMap& pg_map,
@@ -841,8 +1121,14 @@ void process_proguard_rules(const ProguardMap& pg_map,
                             const Scope& external_classes,
                             ProguardConfiguration* pg_config) {
   // Filter out duplicate rules to speed up processing.
-  filter_duplicate_rules(&pg_config->keep_rules);
-  filter_duplicate_rules(&pg_config->assumenosideeffects_rules);
+  pg_config->duplicate_keep_rules =
+      filter_duplicate_rules(&pg_config->keep_rules);
+  pg_config->duplicate_assumenosideeffects_rules =
+      filter_duplicate_rules(&pg_config->assumenosideeffects_rules);
+  TRACE(PGR, 1, "Removed %lu duplicate keep and %lu duplicate "
+        "assumenosideeffects rules\n",
+        pg_config->duplicate_keep_rules,
+        pg_config->duplicate_assumenosideeffects_rules);
   // Now process each of the different kinds of rules as well
   // as -assumenosideeffects and -whyareyoukeeping.
 
@@ -852,12 +1138,16 @@ void process_proguard_rules(const ProguardMap& pg_map,
   // may, for instance, forbid renaming of all classes that inherit from a
   // given external class.
   build_extends_or_implements_hierarchy(external_classes, &hierarchy);
+  ClassIndex index(classes);
+  MemberNames member_names(classes);
 
   process_keep(pg_map,
                pg_config->whyareyoukeeping_rules,
                classes,
                external_classes,
                hierarchy,
+               index,
+               member_names,
                process_whyareyoukeeping,
                "whyareyoukeeping");
 
@@ -866,6 +1156,8 @@ void process_proguard_rules(const ProguardMap& pg_map,
                classes,
                external_classes,
                hierarchy,
+               index,
+               member_names,
                mark_class_and_members_for_keep,
                "classes and members");
 
@@ -874,6 +1166,8 @@ void process_proguard_rules(const ProguardMap& pg_map,
                classes,
                external_classes,
                hierarchy,
+               index,
+               member_names,
                process_assumenosideeffects,
                "assumenosideeffects");
 
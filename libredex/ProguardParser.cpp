@@ -14,6 +14,7 @@
 #include "ProguardMap.h"
 #include "ProguardParser.h"
 #include "ProguardRegex.h"
+#include "WorkQueue.h"
 
 namespace redex {
 namespace proguard_parser {
@@ -971,10 +972,9 @@ void parse(std::vector<unique_ptr<Token>>::iterator it,
   }
 }
 
-void parse(istream& config,
+void parse(std::vector<unique_ptr<Token>>& tokens,
            ProguardConfiguration* pg_config,
            const std::string& filename) {
-  std::vector<unique_ptr<Token>> tokens = lex(config);
   bool ok = true;
   // Check for bad tokens.
   for (auto& tok : tokens) {
@@ -998,6 +998,24 @@ void parse(istream& config,
   }
 }
 
+void parse(istream& config,
+           ProguardConfiguration* pg_config,
+           const std::string& filename) {
+  std::vector<unique_ptr<Token>> tokens = lex(config);
+  parse(tokens, pg_config, filename);
+}
+
+void parse_includes(ProguardConfiguration* pg_config) {
+  for (const auto& included_filename : pg_config->includes) {
+    if (pg_config->already_included.find(included_filename) !=
+        pg_config->already_included.end()) {
+      continue;
+    }
+    pg_config->already_included.emplace(included_filename);
+    parse_file(included_filename, pg_config);
+  }
+}
+
 void parse_file(const std::string& filename, ProguardConfiguration* pg_config) {
   ifstream config(filename);
   // First try relative path.
@@ -1013,13 +1031,36 @@ void parse_file(const std::string& filename, ProguardConfiguration* pg_config) {
 
   parse(config, pg_config, filename);
   // Parse the included files.
-  for (const auto& included_filename : pg_config->includes) {
-    if (pg_config->already_included.find(included_filename) !=
-        pg_config->already_included.end()) {
+  parse_includes(pg_config);
+}
+
+void parse_files(const std::vector<std::string>& filenames,
+                 ProguardConfiguration* pg_config) {
+  // Lexing doesn't depend on the configuration, so the files are lexed
+  // concurrently. Parsing a file can change how the next ones are found and
+  // read (-basedirectory, -include), so they are parsed in order. Files that
+  // are only found relative to -basedirectory are left to parse_file.
+  std::vector<std::unique_ptr<std::vector<unique_ptr<Token>>>> lexed(
+      filenames.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    ifstream config(filenames[i]);
+    if (config.is_open()) {
+      lexed[i] = std::make_unique<std::vector<unique_ptr<Token>>>(lex(config));
+    }
+  });
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    if (lexed[i] == nullptr) {
+      parse_file(filenames[i], pg_config);
       continue;
     }
-    pg_config->already_included.emplace(included_filename);
-    parse_file(included_filename, pg_config);
+    parse(*lexed[i], pg_config, filenames[i]);
+    lexed[i].reset();
+    parse_includes(pg_config);
   }
 }
 
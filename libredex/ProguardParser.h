@@ -20,6 +20,12 @@ namespace redex {
 namespace proguard_parser {
 
 void parse_file(const std::string& filename, ProguardConfiguration* pg_config);
+/*
+ * Same as calling parse_file() on each file in order, with the files lexed
+ * concurrently.
+ */
+void parse_files(const std::vector<std::string>& filenames,
+                 ProguardConfiguration* pg_config);
 void parse(istream& config,
            ProguardConfiguration* pg_config,
            const std::string& filename = "");
@@ -207,6 +207,8 @@ void redex::show_configuration(std::ostream& output,
     total += cls->get_vmethods().size() + cls->get_dmethods().size() +
              cls->get_ifields().size() + cls->get_sfields().size();
   }
+  output << "# " << config.duplicate_keep_rules
+         << " duplicate keep rules removed" << std::endl;
   for (const auto& keep : config.keep_rules) {
     output << redex::show_keep(keep) << std::endl;
   }
@@ -7,8 +7,10 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
 #include <cstring>
 
+#include "Debug.h"
 #include "ProguardRegex.h"
 #include "ProguardMap.h"
 
@@ -164,5 +166,249 @@ std::string convert_wildcard_type(std::string typ) {
   return wildcard_descriptor;
 }
 
+namespace {
+
+// Characters that the regexes formed above pass through as they are, but that
+// a regex doesn't take literally.
+bool is_regex_special(char ch) {
+  return ch != '\0' && strchr("\\^$|+(){}[]", ch) != nullptr;
+}
+
+} // namespace
+
+WildcardPattern::WildcardPattern() { m_end = add_state(); }
+
+uint32_t WildcardPattern::add_state() {
+  m_states.emplace_back();
+  return m_states.size() - 1;
+}
+
+void WildcardPattern::add_char(CharClass cls, char ch) {
+  auto next = add_state();
+  auto& state = m_states[m_end];
+  state.cls = cls;
+  state.ch = ch;
+  state.next = next;
+  m_end = next;
+}
+
+void WildcardPattern::add_star(CharClass cls) {
+  auto loop = m_end;
+  auto body = add_state();
+  auto exit = add_state();
+  m_states[loop].epsilons = {body, exit};
+  m_states[body].cls = cls;
+  m_states[body].next = loop;
+  m_end = exit;
+}
+
+void WildcardPattern::add_segments() {
+  auto first = m_end;
+  auto segment = add_state();
+  auto more = add_state();
+  auto slash = add_state();
+  auto after_slash = add_state();
+  auto exit = add_state();
+  m_states[first].cls = NOT_SLASH;
+  m_states[first].next = segment;
+  m_states[segment].epsilons = {more, slash, exit};
+  m_states[more].cls = NOT_SLASH;
+  m_states[more].next = segment;
+  m_states[slash].cls = LITERAL;
+  m_states[slash].ch = '/';
+  m_states[slash].next = after_slash;
+  m_states[after_slash].cls = NOT_SLASH;
+  m_states[after_slash].next = segment;
+  m_end = exit;
+}
+
+void WildcardPattern::add_any_type(CharClass primitive) {
+  // \\[*(?:primitive|L.*;), from m_end to a new end.
+  auto from = m_end;
+  auto exit = add_state();
+  auto array = add_state();
+  auto prim = add_state();
+  auto cls = add_state();
+  auto cls_name = add_state();
+  auto cls_char = add_state();
+  auto semicolon = add_state();
+  m_states[from].epsilons = {array, prim, cls};
+  m_states[array].cls = LITERAL;
+  m_states[array].ch = '[';
+  m_states[array].next = from;
+  m_states[prim].cls = primitive;
+  m_states[prim].next = exit;
+  m_states[cls].cls = LITERAL;
+  m_states[cls].ch = 'L';
+  m_states[cls].next = cls_name;
+  m_states[cls_name].epsilons = {cls_char, semicolon};
+  m_states[cls_char].cls = ANY;
+  m_states[cls_char].next = cls_name;
+  m_states[semicolon].cls = LITERAL;
+  m_states[semicolon].ch = ';';
+  m_states[semicolon].next = exit;
+  m_end = exit;
+}
+
+void WildcardPattern::add_any_types() {
+  // (?:type)*, where type is as above but can't be void.
+  auto loop = m_end;
+  auto body = add_state();
+  m_end = body;
+  add_any_type(PRIMITIVE_NOT_VOID);
+  auto exit = add_state();
+  m_states[m_end].epsilons = {loop};
+  m_states[loop].epsilons = {body, exit};
+  m_end = exit;
+}
+
+bool WildcardPattern::append_member(const std::string& proguard_regex) {
+  // See form_member_regex().
+  if (proguard_regex.empty()) {
+    add_star(ANY);
+    return true;
+  }
+  for (const char ch : proguard_regex) {
+    if (ch == '*') {
+      add_star(ANY);
+    } else if (ch == '?' || ch == '.') {
+      add_char(ANY);
+    } else if (is_regex_special(ch)) {
+      return false;
+    } else {
+      add_char(LITERAL, ch);
+    }
+  }
+  return true;
+}
+
+bool WildcardPattern::append_type(const std::string& proguard_regex) {
+  // See form_type_regex().
+  if (proguard_regex.empty()) {
+    add_star(ANY);
+    return true;
+  }
+  std::string pattern = proguard_regex == "L*;" ? "L**;" : proguard_regex;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    const char ch = pattern[i];
+    auto next_is = [&](size_t k, char want) {
+      return i + k < pattern.size() && pattern[i + k] == want;
+    };
+    if (ch == '%') {
+      add_char(PRIMITIVE);
+    } else if (ch == '$' || ch == '/' || ch == '(' || ch == ')' ||
+               ch == '[') {
+      add_char(LITERAL, ch);
+    } else if (ch == '?') {
+      add_char(NOT_SLASH);
+    } else if (ch == '*') {
+      if (next_is(1, '*') && next_is(2, '*')) {
+        add_any_type(PRIMITIVE);
+        i += 2;
+      } else if (next_is(1, '*')) {
+        add_segments();
+        i++;
+      } else {
+        add_star(NOT_SLASH);
+      }
+    } else if (ch == '.') {
+      if (next_is(1, '.') && next_is(2, '.')) {
+        add_any_types();
+        i += 2;
+      } else {
+        add_char(ANY);
+      }
+    } else if (is_regex_special(ch)) {
+      return false;
+    } else {
+      add_char(LITERAL, ch);
+    }
+  }
+  return true;
+}
+
+void WildcardPattern::append_literal(char ch) { add_char(LITERAL, ch); }
+
+void WildcardPattern::finish() {
+  auto num_states = m_states.size();
+  m_words = (num_states + 63) / 64;
+  m_closures.assign(num_states * m_words, 0);
+  std::vector<uint32_t> stack;
+  for (uint32_t s = 0; s < num_states; ++s) {
+    auto closure = &m_closures[s * m_words];
+    stack.push_back(s);
+    while (!stack.empty()) {
+      auto t = stack.back();
+      stack.pop_back();
+      auto& word = closure[t / 64];
+      auto bit = uint64_t(1) << (t % 64);
+      if (word & bit) {
+        continue;
+      }
+      word |= bit;
+      for (auto e : m_states[t].epsilons) {
+        stack.push_back(e);
+      }
+    }
+  }
+}
+
+bool WildcardPattern::accepts(CharClass cls, char want, char c) {
+  switch (cls) {
+  case ANY:
+    return c != '\n';
+  case LITERAL:
+    return c == want;
+  case NOT_SLASH:
+    return c != '/';
+  case PRIMITIVE:
+    return strchr("BSIJZFDCV", c) != nullptr;
+  case PRIMITIVE_NOT_VOID:
+    return strchr("BSIJZFDC", c) != nullptr;
+  case NONE:
+    return false;
+  }
+  not_reached();
+}
+
+bool WildcardPattern::matches(const char* s) const {
+  always_assert_log(m_words > 0, "WildcardPattern used before finish()");
+  // The set of states we could be in after each character, simulating all
+  // paths through the automaton at once.
+  uint64_t small[2][4];
+  std::vector<uint64_t> large;
+  uint64_t* current = small[0];
+  uint64_t* next = small[1];
+  if (m_words > 4) {
+    large.resize(2 * m_words);
+    current = large.data();
+    next = large.data() + m_words;
+  }
+  std::copy_n(&m_closures[0], m_words, current);
+  for (; *s != '\0'; ++s) {
+    char c = *s;
+    std::fill_n(next, m_words, 0);
+    bool alive = false;
+    for (size_t w = 0; w < m_words; ++w) {
+      for (auto bits = current[w]; bits != 0; bits &= bits - 1) {
+        const auto& state = m_states[w * 64 + __builtin_ctzll(bits)];
+        if (!accepts(state.cls, state.ch, c)) {
+          continue;
+        }
+        auto closure = &m_closures[state.next * m_words];
+        for (size_t k = 0; k < m_words; ++k) {
+          next[k] |= closure[k];
+        }
+        alive = true;
+      }
+    }
+    if (!alive) {
+      return false;
+    }
+    std::swap(current, next);
+  }
+  return (current[m_end / 64] >> (m_end % 64)) & 1;
+}
+
 } // namespace proguard_parser
 } // namespace redex
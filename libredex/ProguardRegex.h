@@ -9,7 +9,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace redex {
 namespace proguard_parser {
@@ -18,5 +20,72 @@ std::string form_member_regex(std::string proguard_regex);
 std::string form_type_regex(std::string proguard_regex);
 std::string convert_wildcard_type(std::string typ);
 
+/*
+ * Matches strings against ProGuard wildcard patterns without going through a
+ * regex. It accepts the patterns that form_member_regex and form_type_regex
+ * take, and matches exactly the strings that the regexes they form match, in
+ * time linear in the length of the string.
+ *
+ * Build a pattern by appending its parts, then call finish(). The appends
+ * return false if a part has a character that the regexes would give a
+ * special meaning to, e.g. '|' or '+'. Such a pattern must be matched with
+ * the regex instead.
+ *
+ * A finished pattern is safe to match against from several threads.
+ */
+class WildcardPattern {
+ public:
+  WildcardPattern();
+
+  bool append_member(const std::string& proguard_regex);
+  bool append_type(const std::string& proguard_regex);
+  void append_literal(char ch);
+  void finish();
+
+  bool matches(const char* s) const;
+  bool matches(const std::string& s) const { return matches(s.c_str()); }
+
+ private:
+  enum CharClass : uint8_t {
+    // Any character. Anything but '\n', strictly, just like a regex's '.'.
+    ANY,
+    LITERAL,
+    NOT_SLASH,
+    PRIMITIVE,
+    PRIMITIVE_NOT_VOID,
+    // Consumes nothing; only has epsilon transitions.
+    NONE,
+  };
+
+  struct State {
+    CharClass cls{NONE};
+    char ch{0};
+    // Where consuming a character leads.
+    uint32_t next{0};
+    std::vector<uint32_t> epsilons;
+  };
+
+  uint32_t add_state();
+  // Makes the current end state consume a character of cls, and moves the
+  // end past it.
+  void add_char(CharClass cls, char ch = 0);
+  // The end state loops over any number of characters of cls.
+  void add_star(CharClass cls);
+  // A run of one or more characters that are not slashes, separated by
+  // single slashes.
+  void add_segments();
+  // Arrays of primitive or L...; types.
+  void add_any_type(CharClass primitive);
+  void add_any_types();
+
+  static bool accepts(CharClass cls, char want, char c);
+
+  std::vector<State> m_states;
+  uint32_t m_end{0};
+  // The epsilon closure of each state, as a bitset of m_words words.
+  std::vector<uint64_t> m_closures;
+  size_t m_words{0};
+};
+
 } // namespace proguard_parser
 } // namespace redex
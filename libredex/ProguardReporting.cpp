@@ -10,6 +10,9 @@
 #include "ProguardReporting.h"
 #include "DexClass.h"
 #include "ReachableClasses.h"
+#include "WorkQueue.h"
+
+#include <sstream>
 
 std::string extract_suffix(std::string class_name) {
   auto i = class_name.find_last_of(".");
@@ -227,3 +230,25 @@ void redex::print_classes(std::ostream& output,
     }
   }
 }
+
+std::string redex::format_classes(const ProguardMap& pg_map,
+                                  const Scope& classes) {
+  std::vector<std::string> class_strings(classes.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    if (!classes[i]->is_external()) {
+      std::ostringstream out;
+      redex::print_class(out, pg_map, classes[i]);
+      class_strings[i] = out.str();
+    }
+  });
+  for (size_t i = 0; i < classes.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  std::string result;
+  for (const auto& str : class_strings) {
+    result += str;
+  }
+  return result;
+}
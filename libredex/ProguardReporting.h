@@ -47,4 +47,7 @@ void print_class(std::ostream& output,
 void print_classes(std::ostream& output,
                    const ProguardMap& pg_map,
                    const Scope& classes);
+
+// What print_classes() prints, with the classes formatted in parallel.
+std::string format_classes(const ProguardMap& pg_map, const Scope& classes);
 }
@@ -8,6 +8,7 @@
  */
 
 #include "ReachableClasses.h"
+#include <algorithm>
 
 #include <chrono>
 #include <fstream>
@@ -74,6 +75,26 @@ void blacklist(DexType* type, DexString *name, bool declared) {
   }
 }
 
+/*
+ * Whether the method may call a method on one of the named classes. Code
+ * whose ballooning is deferred is scanned as is, so that the methods that make
+ * no such calls stay deferred.
+ */
+bool may_invoke_on(const DexMethod* method,
+                   const std::unordered_set<const DexType*>& classes) {
+  if (!method->is_balloon_deferred()) {
+    return true;
+  }
+  for (auto insn : method->get_dex_code()->get_instructions()) {
+    if (insn->has_method() &&
+        classes.count(
+            static_cast<DexOpcodeMethod*>(insn)->get_method()->get_class())) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void analyze_reflection(const Scope& scope) {
   enum ReflectionType {
     GET_FIELD,
@@ -92,7 +113,7 @@ void analyze_reflection(const Scope& scope) {
 
   const std::unordered_map<std::string,
                            std::unordered_map<std::string, ReflectionType>>
-      refls = {
+      refl_names = {
           {JAVA_LANG_CLASS,
            {
                {"getField", GET_FIELD},
@@ -114,7 +135,48 @@ void analyze_reflection(const Scope& scope) {
            }},
       };
 
-  walk::parallel::code(scope, [&refls](DexMethod* method, IRCode& code) {
+  // Types and strings are interned, so invokes are matched by identity. Names
+  // that were never interned can't be referenced by any code.
+  std::unordered_map<const DexType*,
+                     std::unordered_map<const DexString*, ReflectionType>>
+      refls;
+  std::unordered_set<const DexType*> refl_classes;
+  for (const auto& pair : refl_names) {
+    auto type = DexType::get_type(pair.first.c_str());
+    if (type == nullptr) {
+      continue;
+    }
+    for (const auto& method_pair : pair.second) {
+      auto name = DexString::get_string(method_pair.first.c_str());
+      if (name != nullptr) {
+        refls[type][name] = method_pair.second;
+        refl_classes.insert(type);
+      }
+    }
+  }
+  if (refls.empty()) {
+    return;
+  }
+
+  // The members to blacklist are gathered per thread, then marked.
+  struct BlacklistRequest {
+    DexType* type;
+    DexString* name;
+    bool is_method;
+    bool declared;
+  };
+  using Requests = std::vector<BlacklistRequest>;
+  std::vector<std::unique_ptr<Requests>> thread_requests;
+  walk::parallel::reduce_methods<Requests*, std::nullptr_t>(
+    scope,
+    [&](Requests*& requests, DexMethod* method) {
+      if (!may_invoke_on(method, refl_classes)) {
+        return nullptr;
+      }
+      auto code = method->get_code();
+      if (code == nullptr) {
+        return nullptr;
+      }
       std::unique_ptr<SimpleReflectionAnalysis> analysis = nullptr;
       for (auto& mie : InstructionIterable(code)) {
         IRInstruction* insn = mie.insn;
@@ -123,14 +185,13 @@ void analyze_reflection(const Scope& scope) {
         }
 
         // See if it matches something in refls
-        auto& method_name = insn->get_method()->get_name()->str();
-        auto& method_class_name = insn->get_method()->get_class()->get_name()->str();
-        auto method_map = refls.find(method_class_name);
+        auto callee = insn->get_method();
+        auto method_map = refls.find(callee->get_class());
         if (method_map == refls.end()) {
           continue;
         }
 
-        auto refl_entry = method_map->second.find(method_name);
+        auto refl_entry = method_map->second.find(callee->get_name());
         if (refl_entry == method_map->second.end()) {
           continue;
         }
@@ -151,40 +212,38 @@ void analyze_reflection(const Scope& scope) {
         if ((arg_cls && arg_cls->kind == AbstractObjectKind::CLASS) &&
             (arg_str && arg_str->kind == AbstractObjectKind::STRING)) {
           TRACE(PGR, 4, "SRA ANALYZE: %s: type:%d %s.%s cls: %d %s %s str: %d %s %s\n",
-                insn->get_method()->get_name()->str().c_str(),
+                callee->get_name()->c_str(),
                 refl_type,
-                method_class_name.c_str(),
-                method_name.c_str(),
+                SHOW(callee->get_class()),
+                callee->get_name()->c_str(),
                 arg_cls->kind, SHOW(arg_cls->dex_type), SHOW(arg_cls->dex_string),
                 arg_str->kind, SHOW(arg_str->dex_type), SHOW(arg_str->dex_string)
                 );
-        switch (refl_type) {
-          case GET_FIELD:
-            blacklist<DexField*>(arg_cls->dex_type, arg_str->dex_string, true);
-            break;
-          case GET_DECLARED_FIELD:
-            blacklist<DexField*>(arg_cls->dex_type, arg_str->dex_string, false);
-            break;
-          case GET_METHOD:
-            blacklist<DexMethod*>(arg_cls->dex_type, arg_str->dex_string, true);
-            break;
-          case GET_DECLARED_METHOD:
-            blacklist<DexMethod*>(arg_cls->dex_type, arg_str->dex_string, false);
-            break;
-          case INT_UPDATER:
-            blacklist<DexField*>(arg_cls->dex_type, arg_str->dex_string, true);
-            break;
-          case LONG_UPDATER:
-            blacklist<DexField*>(arg_cls->dex_type, arg_str->dex_string, true);
-            break;
-          case REF_UPDATER:
-            blacklist<DexField*>(arg_cls->dex_type, arg_str->dex_string, true);
-            break;
-          }
+          bool is_method =
+              refl_type == GET_METHOD || refl_type == GET_DECLARED_METHOD;
+          bool declared =
+              refl_type != GET_DECLARED_FIELD && refl_type != GET_DECLARED_METHOD;
+          requests->push_back(
+              {arg_cls->dex_type, arg_str->dex_string, is_method, declared});
         }
       }
+      return nullptr;
+    },
+    [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+    [&](unsigned int) {
+      thread_requests.emplace_back(std::make_unique<Requests>());
+      return thread_requests.back().get();
+    });
+
+  for (const auto& requests : thread_requests) {
+    for (const auto& request : *requests) {
+      if (request.is_method) {
+        blacklist<DexMethod*>(request.type, request.name, request.declared);
+      } else {
+        blacklist<DexField*>(request.type, request.name, request.declared);
+      }
     }
-  );
+  }
 }
 
 template<typename DexMember>
@@ -390,8 +449,27 @@ void init_permanently_reachable_classes(
                              m::on_class<DexMethodRef>("Ljava/lang/Class;")) &&
                          m::has_n_args(1)));
 
+    // Only look at the classes that may call Class.forName, so that the
+    // rest of the deferred code stays deferred.
+    const std::unordered_set<const DexType*> java_lang_class{
+        DexType::get_type("Ljava/lang/Class;")};
+    Scope callers;
+    for (auto cls : scope) {
+      auto may_call = [&](DexMethod* m) {
+        return may_invoke_on(m, java_lang_class);
+      };
+      if (std::any_of(cls->get_dmethods().begin(),
+                      cls->get_dmethods().end(),
+                      may_call) ||
+          std::any_of(cls->get_vmethods().begin(),
+                      cls->get_vmethods().end(),
+                      may_call)) {
+        callers.push_back(cls);
+      }
+    }
+
     walk::parallel::matching_opcodes(
-        scope,
+        callers,
         match,
         [&](const DexMethod* meth, const std::vector<IRInstruction*>& insns) {
           auto const_string = insns[0];
@@ -441,9 +519,11 @@ void init_permanently_reachable_classes(
     }
 
     // Classnames present in native libraries (lib/*/*.so)
-    for (std::string classname : get_native_classes(apk_dir)) {
+    auto is_known_type = [](const char* name) {
+      return DexType::get_type(name) != nullptr;
+    };
+    for (std::string classname : get_native_classes(apk_dir, is_known_type)) {
       auto type = DexType::get_type(classname.c_str());
-      if (type == nullptr) continue;
       TRACE(PGR, 3, "native_lib: %s\n", classname.c_str());
       mark_reachable_by_classname(type, false);
     }
@@ -528,3 +608,42 @@ std::string ReferencedState::str() const {
   s << m_keep_count;
   return s.str();
 }
+
+uint32_t ReferencedState::flags() const {
+  const bool bits[] = {m_bytype,
+                       m_bystring,
+                       m_computed,
+                       m_keep,
+                       m_assumenosideeffects,
+                       m_blanket_keepnames,
+                       m_whyareyoukeeping,
+                       m_set_allowshrinking,
+                       m_unset_allowshrinking,
+                       m_set_allowobfuscation,
+                       m_unset_allowobfuscation,
+                       m_keep_name};
+  uint32_t flags = 0;
+  for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); ++i) {
+    flags |= uint32_t(bits[i]) << i;
+  }
+  return flags;
+}
+
+void ReferencedState::restore(uint32_t flags, uint32_t keep_count) {
+  bool* bits[] = {&m_bytype,
+                  &m_bystring,
+                  &m_computed,
+                  &m_keep,
+                  &m_assumenosideeffects,
+                  &m_blanket_keepnames,
+                  &m_whyareyoukeeping,
+                  &m_set_allowshrinking,
+                  &m_unset_allowshrinking,
+                  &m_set_allowobfuscation,
+                  &m_unset_allowobfuscation,
+                  &m_keep_name};
+  for (size_t i = 0; i < sizeof(bits) / sizeof(bits[0]); ++i) {
+    *bits[i] = (flags >> i) & 1;
+  }
+  m_keep_count = keep_count;
+}
@@ -9,10 +9,12 @@
 
 #include "ReachableObjects.h"
 
+#include "DexIdMap.h"
 #include "DexUtil.h"
 #include "Pass.h"
 #include "ReachableClasses.h"
 #include "Resolver.h"
+#include "WorkQueue.h"
 
 using namespace reachable_objects;
 
@@ -21,15 +23,16 @@ using namespace reachable_objects;
  *
  * Conceptually we start at roots, which are defined by -keep rules in the
  * config file, and perform a depth-first search to find all references.
- * Elements visited in this manner will be retained, and are found in the
- * marked_* sets.
+ * Elements visited in this manner will be retained, and carry the reach_mark
+ * of the walk. The search runs on several threads, which share the pending
+ * elements through a WorkQueue.
  *
  * -keepclassmembers rules are a bit more complicated, because they require
  * "conditional" marking: these members are kept only if their containing class
  * is determined to be kept. The conditional marking logic is also used to
- * retain (or not) implementations of interface methods. These elements are
- * placed in the cond_marked_* sets; care must be taken to promote
- * conditionally marked elements to fully marked.
+ * retain (or not) implementations of interface methods. These elements get the
+ * reach_cond_mark; care must be taken to promote conditionally marked elements
+ * to fully marked.
  */
 
 namespace {
@@ -81,12 +84,7 @@ struct InheritanceGraph {
 
   const std::set<const DexType*, dextypes_comparator>& get_descendants(
       const DexType* type) const {
-    if (m_inheritors.count(type)) {
-      return m_inheritors.at(type);
-    } else {
-      static std::set<const DexType*, dextypes_comparator> empty;
-      return empty;
-    }
+    return m_inheritors.at(type);
   }
 
  private:
@@ -107,9 +105,7 @@ struct InheritanceGraph {
   }
 
  private:
-  std::unordered_map<const DexType*,
-                     std::set<const DexType*, dextypes_comparator>>
-      m_inheritors;
+  TypeIdMap<std::set<const DexType*, dextypes_comparator>> m_inheritors;
 };
 
 bool implements_library_method(const DexMethod* to_check, const DexClass* cls) {
@@ -145,22 +141,34 @@ bool implements_library_method(InheritanceGraph& graph,
 }
 
 class Reachable {
+  // What a worker of the mark phase collects on its own. These are merged
+  // once all workers are done.
+  struct Local {
+    int num_ignore_check_strings{0};
+    ReachableObjectGraph retainers_of;
+    // Objects this worker has marked but not visited yet.
+    std::vector<ReachableObject> stack;
+  };
+
+  // A batch of objects to visit, or of classes to look for seeds in.
+  struct Batch {
+    bool seeds;
+    std::vector<ReachableObject> objects;
+  };
+  using MarkQueue = WorkQueue<Batch, Local*, std::nullptr_t>;
+
+  // Past this many pending objects, a worker hands some of them to the queue
+  // so that idle workers can steal them.
+  static constexpr size_t kBatchSize = 64;
+
   DexStoresVector& m_stores;
   const std::unordered_set<const DexType*>& m_ignore_string_literals;
   const std::unordered_set<const DexType*>& m_ignore_string_literal_annos;
   std::unordered_set<const DexType*> m_ignore_system_annos;
   bool m_record_reachability;
   InheritanceGraph m_inheritance_graph;
-  int m_num_ignore_check_strings = 0;
-  std::unordered_set<const DexClass*> m_marked_classes;
-  std::unordered_set<const DexFieldRef*> m_marked_fields;
-  std::unordered_set<const DexMethodRef*> m_marked_methods;
-  std::unordered_set<const DexField*> m_cond_marked_fields;
-  std::unordered_set<const DexMethod*> m_cond_marked_methods;
-  std::vector<const DexClass*> m_class_stack;
-  std::vector<const DexFieldRef*> m_field_stack;
-  std::vector<const DexMethodRef*> m_method_stack;
-  ReachableObjectGraph m_retainers_of;
+  uint32_t m_walk;
+  MarkQueue* m_queue{nullptr};
 
  public:
   Reachable(
@@ -174,7 +182,8 @@ class Reachable {
         m_ignore_string_literal_annos(ignore_string_literal_annos),
         m_ignore_system_annos(ignore_system_annos),
         m_record_reachability(record_reachability),
-        m_inheritance_graph(stores) {
+        m_inheritance_graph(stores),
+        m_walk(WalkMark::new_walk()) {
     // To keep the backward compatability of this code, ensure that the
     // "MemberClasses" annotation is always in m_ignore_system_annos.
     m_ignore_system_annos.emplace(
@@ -182,135 +191,116 @@ class Reachable {
   }
 
  private:
-  void mark(const DexClass* cls) {
-    if (!cls) return;
-    m_marked_classes.emplace(cls);
+  // Returns true if the object was not marked before.
+  template <class T>
+  bool mark(const T* t) {
+    return t != nullptr && t->reach_mark.set(m_walk);
   }
 
-  void mark(const DexFieldRef* field) {
-    if (!field) return;
-    m_marked_fields.emplace(field);
+  template <class T>
+  bool marked(const T* t) {
+    return t != nullptr && t->reach_mark.is_set(m_walk);
   }
 
-  void mark(const DexMethodRef* method) {
-    if (!method) return;
-    m_marked_methods.emplace(method);
+  template <class T>
+  void push_marked(Local& local, const T* t) {
+    local.stack.emplace_back(t);
   }
 
-  bool marked(const DexClass* cls) { return m_marked_classes.count(cls); }
-
-  bool marked(const DexFieldRef* field) { return m_marked_fields.count(field); }
-
-  bool marked(const DexMethodRef* method) {
-    return m_marked_methods.count(method);
-  }
-
-  void push_seed(const DexType* type) {
+  void push_seed(Local& local, const DexType* type) {
     type = get_array_type_or_self(type);
-    push_seed(type_class(type));
+    push_seed(local, type_class(type));
   }
 
   template <class Parent>
-  void push(const Parent* parent, const DexType* type) {
+  void push(Local& local, const Parent* parent, const DexType* type) {
     type = get_array_type_or_self(type);
-    push(parent, type_class(type));
+    push(local, parent, type_class(type));
   }
 
-  void push_seed(const DexClass* cls) {
-    if (!cls || marked(cls)) return;
-    record_is_seed(cls);
-    mark(cls);
-    m_class_stack.emplace_back(cls);
+  void push_seed(Local& local, const DexClass* cls) {
+    if (!mark(cls)) return;
+    record_is_seed(local, cls);
+    push_marked(local, cls);
   }
 
   template <class Parent>
-  void push(const Parent* parent, const DexClass* cls) {
+  void push(Local& local, const Parent* parent, const DexClass* cls) {
     // FIXME: Bug! Even if cls is already marked, we need to record its
     // reachability from parent to cls.
-    if (!cls || marked(cls)) return;
-    record_reachability(parent, cls);
-    mark(cls);
-    m_class_stack.emplace_back(cls);
+    if (!mark(cls)) return;
+    record_reachability(local, parent, cls);
+    push_marked(local, cls);
   }
 
-  void push_seed(const DexField* field) {
-    if (!field || marked(field)) return;
-    record_is_seed(field);
-    mark(field);
-    m_field_stack.emplace_back(field);
+  void push_seed(Local& local, const DexField* field) {
+    if (!mark(field)) return;
+    record_is_seed(local, field);
+    push_marked(local, field);
   }
 
-  void push_cond(const DexField* field) {
-    if (!field || marked(field)) return;
-    TRACE(REACH, 4, "Conditionally marking field: %s\n", SHOW(field));
-    auto clazz = type_class(field->get_class());
-
+  /*
+   * A member that is only reachable if its class is gets a conditional mark,
+   * which visit(cls) looks for. The mark is set before looking at the class,
+   * and the class is marked before it is visited, so a member whose class is
+   * being marked concurrently is picked up by at least one of the two.
+   */
+  template <class Member>
+  void push_cond(Local& local, const Member* member) {
+    if (!member || marked(member)) return;
+    TRACE(REACH, 4, "Conditionally marking %s\n", SHOW(member));
+    member->reach_cond_mark.set(m_walk);
+    auto clazz = type_class(member->get_class());
     if (marked(clazz)) {
-      push(clazz, field);
-    } else {
-      m_cond_marked_fields.emplace(field);
+      push(local, clazz, member);
     }
   }
 
   template <class Parent>
-  void push(const Parent* parent, const DexFieldRef* field) {
-    if (!field || marked(field)) return;
+  void push(Local& local, const Parent* parent, const DexFieldRef* field) {
+    if (!mark(field)) return;
     if (field->is_def()) {
-      gather_and_push(static_cast<const DexField*>(field));
+      gather_and_push(local, static_cast<const DexField*>(field));
     }
-    record_reachability(parent, field);
-    mark(field);
-    m_field_stack.emplace_back(field);
+    record_reachability(local, parent, field);
+    push_marked(local, field);
   }
 
-  void push_seed(const DexMethod* method) {
-    if (!method || marked(method)) return;
-    record_is_seed(method);
-    mark(method);
-    m_method_stack.emplace_back(method);
+  void push_seed(Local& local, const DexMethod* method) {
+    if (!mark(method)) return;
+    record_is_seed(local, method);
+    push_marked(local, method);
   }
 
   template <class Parent>
-  void push(const Parent* parent, const DexMethodRef* method) {
-    if (!method || marked(method)) return;
-    record_reachability(parent, method);
-    mark(method);
-    m_method_stack.emplace_back(method);
+  void push(Local& local, const Parent* parent, const DexMethodRef* method) {
+    if (!mark(method)) return;
+    record_reachability(local, parent, method);
+    push_marked(local, method);
   }
 
-  void push_cond(const DexMethod* method) {
-    if (!method || marked(method)) return;
-    TRACE(REACH, 4, "Conditionally marking method: %s\n", SHOW(method));
-    auto clazz = type_class(method->get_class());
-    if (marked(clazz)) {
-      push(clazz, method);
-    } else {
-      m_cond_marked_methods.emplace(method);
-    }
-  }
-
-  void gather_and_push(DexMethod* meth) {
+  void gather_and_push(Local& local, DexMethod* meth) {
     auto* type = meth->get_class();
     auto* cls = type_class(type);
     bool check_strings = true;
     if (m_ignore_string_literals.count(type)) {
-      ++m_num_ignore_check_strings;
+      ++local.num_ignore_check_strings;
       check_strings = false;
     }
     if (cls && check_strings) {
       for (const auto& ignore_anno_type : m_ignore_string_literal_annos) {
         if (has_anno(cls, ignore_anno_type)) {
-          ++m_num_ignore_check_strings;
+          ++local.num_ignore_check_strings;
           check_strings = false;
           break;
         }
       }
     }
-    gather_and_push(meth, check_strings);
+    gather_and_push(local, meth, check_strings);
   }
 
   template <typename T>
-  void gather_and_push(T t, bool check_strings = true) {
+  void gather_and_push(Local& local, T t, bool check_strings = true) {
     std::vector<DexString*> strings;
     std::vector<DexType*> types;
     std::vector<DexFieldRef*> fields;
@@ -326,36 +316,67 @@ class Reachable {
         if (!typestr) continue;
         auto type = DexType::get_type(typestr);
         if (!type) continue;
-        push(t, type);
+        push(local, t, type);
       }
     }
     for (auto const& type : types) {
-      push(t, type);
+      push(local, t, type);
     }
     for (auto const& field : fields) {
-      push(t, field);
+      push(local, t, field);
     }
     for (auto const& method : methods) {
-      push(t, method);
+      push(local, t, method);
     }
   }
 
-  void visit(const DexClass* cls) {
+  void push_seeds(Local& local, const DexClass* cls) {
+    if (root(cls) || is_canary(cls)) {
+      TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(cls));
+      push_seed(local, cls);
+    }
+    for (auto const& f : cls->get_ifields()) {
+      if (root(f) || is_volatile(f)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
+        push_cond(local, f);
+      }
+    }
+    for (auto const& f : cls->get_sfields()) {
+      if (root(f)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
+        push_cond(local, f);
+      }
+    }
+    for (auto const& m : cls->get_dmethods()) {
+      if (root(m)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
+        push_cond(local, m);
+      }
+    }
+    for (auto const& m : cls->get_vmethods()) {
+      if (root(m) || implements_library_method(m_inheritance_graph, m, cls)) {
+        TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
+        push_cond(local, m);
+      }
+    }
+  }
+
+  void visit(Local& local, const DexClass* cls) {
     TRACE(REACH, 4, "Visiting class: %s\n", SHOW(cls));
     for (auto& m : cls->get_dmethods()) {
       if (is_clinit(m)) {
-        push(cls, m);
+        push(local, cls, m);
       } else if (is_init(m)) {
         // Push the parameterless constructor, in case it's constructed via
         // .class or Class.forName()
         if (m->get_proto()->get_args()->get_type_list().size() == 0) {
-          push(cls, m);
+          push(local, cls, m);
         }
       }
     }
-    push(cls, type_class(cls->get_super_class()));
+    push(local, cls, type_class(cls->get_super_class()));
     for (auto const& t : cls->get_interfaces()->get_type_list()) {
-      push(cls, t);
+      push(local, cls, t);
     }
     const DexAnnotationSet* annoset = cls->get_anno_set();
     if (annoset) {
@@ -368,55 +389,55 @@ class Reachable {
                 SHOW(anno->type()));
           continue;
         }
-        record_reachability(cls, anno);
-        gather_and_push(anno);
+        record_reachability(local, cls, anno);
+        gather_and_push(local, anno);
       }
     }
     for (auto const& m : cls->get_ifields()) {
-      if (m_cond_marked_fields.count(m)) {
-        push(cls, m);
+      if (m->reach_cond_mark.is_set(m_walk)) {
+        push(local, cls, m);
       }
     }
     for (auto const& m : cls->get_sfields()) {
-      if (m_cond_marked_fields.count(m)) {
-        push(cls, m);
+      if (m->reach_cond_mark.is_set(m_walk)) {
+        push(local, cls, m);
       }
     }
     for (auto const& m : cls->get_dmethods()) {
-      if (m_cond_marked_methods.count(m)) {
-        push(cls, m);
+      if (m->reach_cond_mark.is_set(m_walk)) {
+        push(local, cls, m);
       }
     }
     for (auto const& m : cls->get_vmethods()) {
-      if (m_cond_marked_methods.count(m)) {
-        push(cls, m);
+      if (m->reach_cond_mark.is_set(m_walk)) {
+        push(local, cls, m);
       }
     }
   }
 
-  void visit(DexFieldRef* field) {
+  void visit(Local& local, DexFieldRef* field) {
     TRACE(REACH, 4, "Visiting field: %s\n", SHOW(field));
     if (!field->is_concrete()) {
       auto const& realfield = resolve_field(
           field->get_class(), field->get_name(), field->get_type());
-      push(field, realfield);
+      push(local, field, realfield);
     }
-    push(field, field->get_class());
-    push(field, field->get_type());
+    push(local, field, field->get_class());
+    push(local, field, field->get_type());
   }
 
-  void visit(DexMethodRef* method) {
+  void visit(Local& local, DexMethodRef* method) {
     TRACE(REACH, 4, "Visiting method: %s\n", SHOW(method));
     auto resolved_method = resolve(method, type_class(method->get_class()));
     if (resolved_method != nullptr) {
       TRACE(REACH, 5, "    Resolved to: %s\n", SHOW(resolved_method));
-      push(method, resolved_method);
-      gather_and_push(resolved_method);
+      push(local, method, resolved_method);
+      gather_and_push(local, resolved_method);
     }
-    push(method, method->get_class());
-    push(method, method->get_proto()->get_rtype());
+    push(local, method, method->get_class());
+    push(local, method, method->get_proto()->get_rtype());
     for (auto const& t : method->get_proto()->get_args()->get_type_list()) {
-      push(method, t);
+      push(local, method, t);
     }
     if (method->is_def() && (static_cast<DexMethod*>(method)->is_virtual() ||
                              !method->is_concrete())) {
@@ -433,7 +454,7 @@ class Reachable {
           }
           for (auto const& m : child_cls->get_vmethods()) {
             if (signatures_match(method, m)) {
-              push_cond(m);
+              push_cond(local, m);
             }
           }
           child = child_cls->get_super_class();
@@ -442,6 +463,47 @@ class Reachable {
     }
   }
 
+  void visit(Local& local, const ReachableObject& obj) {
+    switch (obj.type) {
+    case ReachableObjectType::CLASS:
+      visit(local, obj.cls);
+      return;
+    case ReachableObjectType::FIELD:
+      visit(local, const_cast<DexFieldRef*>(obj.field));
+      return;
+    case ReachableObjectType::METHOD:
+      visit(local, const_cast<DexMethodRef*>(obj.method));
+      return;
+    case ReachableObjectType::ANNO:
+    case ReachableObjectType::SEED:
+      not_reached();
+    }
+  }
+
+  // Visits everything reachable from the batch, unless it gets to be too
+  // much, in which case the oldest pending objects go back to the queue.
+  void run(Local& local, const Batch& batch) {
+    for (auto const& obj : batch.objects) {
+      if (batch.seeds) {
+        push_seeds(local, obj.cls);
+      } else {
+        local.stack.push_back(obj);
+      }
+    }
+    while (!local.stack.empty()) {
+      if (local.stack.size() >= 2 * kBatchSize) {
+        auto first = local.stack.begin();
+        auto last = first + kBatchSize;
+        m_queue->add_item(
+            Batch{false, std::vector<ReachableObject>(first, last)});
+        local.stack.erase(first, last);
+      }
+      auto obj = local.stack.back();
+      local.stack.pop_back();
+      visit(local, obj);
+    }
+  }
+
   /*
    * We use templates to specialize record_reachability(parent, child) such
    * that:
@@ -454,12 +516,15 @@ class Reachable {
    *
    *  3. If either argument is a DexType*, we extract the corresponding
    *     DexClass* and then call the right version of record_reachability().
+   *
+   * Every object is recorded by the one worker that marked it, so the
+   * workers' graphs never overlap.
    */
   template <class Seed>
-  void record_is_seed(Seed* seed) {
+  void record_is_seed(Local& local, Seed* seed) {
     if (m_record_reachability) {
       assert(seed != nullptr);
-      m_retainers_of[ReachableObject(seed)].emplace(SEED_SINGLETON);
+      local.retainers_of[ReachableObject(seed)].emplace(SEED_SINGLETON);
     }
   }
 
@@ -474,79 +539,60 @@ class Reachable {
   };
 
   template <class Parent, class Object>
-  void record_reachability(Parent* parent, Object* object) {
+  void record_reachability(Local& local, Parent* parent, Object* object) {
     if (m_record_reachability) {
       RecordImpl<Parent, Object>::record_reachability(
-          parent, object, m_retainers_of);
+          parent, object, local.retainers_of);
     }
   }
 
  public:
+  /*
+   * Workers first look for the seeds among a share of the classes, then walk
+   * from them, stealing from each other once they run out of their own work.
+   */
   ReachableObjects mark(int* num_ignore_check_strings) {
+    auto num_threads = workqueue_default_num_threads();
+    std::vector<Local> locals(num_threads);
+    MarkQueue queue(
+        [&](Local*& local, Batch batch) -> std::nullptr_t {
+          run(*local, batch);
+          return nullptr;
+        },
+        [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+        [&](unsigned int thread_idx) { return &locals[thread_idx]; },
+        num_threads);
+    queue.set_wait_for_dynamic_items(true);
+    m_queue = &queue;
+    Batch seeds{true, {}};
     for (auto const& dex : DexStoreClassesIterator(m_stores)) {
       for (auto const& cls : dex) {
-        if (root(cls) || is_canary(cls)) {
-          TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(cls));
-          push_seed(cls);
-        }
-        for (auto const& f : cls->get_ifields()) {
-          if (root(f) || is_volatile(f)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
-            push_cond(f);
-          }
-        }
-        for (auto const& f : cls->get_sfields()) {
-          if (root(f)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(f));
-            push_cond(f);
-          }
-        }
-        for (auto const& m : cls->get_dmethods()) {
-          if (root(m)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
-            push_cond(m);
-          }
-        }
-        for (auto const& m : cls->get_vmethods()) {
-          if (root(m) ||
-              implements_library_method(m_inheritance_graph, m, cls)) {
-            TRACE(REACH, 3, "Visiting seed: %s\n", SHOW(m));
-            push_cond(m);
-          }
+        seeds.objects.emplace_back(cls);
+        if (seeds.objects.size() == kBatchSize) {
+          queue.add_item(std::move(seeds));
+          seeds = Batch{true, {}};
         }
       }
     }
-    while (true) {
-      if (!m_class_stack.empty()) {
-        auto cls = m_class_stack.back();
-        m_class_stack.pop_back();
-        visit(cls);
-        continue;
-      }
-      if (!m_field_stack.empty()) {
-        auto field = m_field_stack.back();
-        m_field_stack.pop_back();
-        visit(const_cast<DexFieldRef*>(field));
-        continue;
-      }
-      if (!m_method_stack.empty()) {
-        auto method = m_method_stack.back();
-        m_method_stack.pop_back();
-        visit(const_cast<DexMethodRef*>(method));
-        continue;
-      }
-      break;
+    if (!seeds.objects.empty()) {
+      queue.add_item(std::move(seeds));
     }
+    queue.run_all();
+    m_queue = nullptr;
 
+    ReachableObjects ret;
+    ret.walk = m_walk;
+    int num_ignored = 0;
+    for (auto& local : locals) {
+      num_ignored += local.num_ignore_check_strings;
+      for (auto& retainers : local.retainers_of) {
+        ret.retainers_of[retainers.first].insert(retainers.second.begin(),
+                                                 retainers.second.end());
+      }
+    }
     if (num_ignore_check_strings) {
-      *num_ignore_check_strings = m_num_ignore_check_strings;
+      *num_ignore_check_strings = num_ignored;
     }
-
-    ReachableObjects ret;
-    ret.marked_fields = std::move(m_marked_fields);
-    ret.marked_classes = std::move(m_marked_classes);
-    ret.marked_methods = std::move(m_marked_methods);
-    ret.retainers_of = std::move(m_retainers_of);
     return ret;
   }
 };
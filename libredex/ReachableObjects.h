@@ -150,11 +150,24 @@ using ReachableObjectGraph = std::unordered_map<ReachableObject,
 
 } // namespace
 
+/*
+ * Reachable classes and members carry the reach_mark of the walk that found
+ * them, which only tells them apart until the next walk starts.
+ */
 struct ReachableObjects {
-  std::unordered_set<const DexClass*> marked_classes;
-  std::unordered_set<const DexFieldRef*> marked_fields;
-  std::unordered_set<const DexMethodRef*> marked_methods;
+  uint32_t walk{0};
+  // Only recorded if asked for. It takes far more memory than the marks.
   reachable_objects::ReachableObjectGraph retainers_of;
+
+  bool marked(const DexClass* cls) const {
+    return cls->reach_mark.is_set(walk);
+  }
+  bool marked(const DexFieldRef* field) const {
+    return field->reach_mark.is_set(walk);
+  }
+  bool marked(const DexMethodRef* method) const {
+    return method->reach_mark.is_set(walk);
+  }
 };
 
 ReachableObjects compute_reachable_objects(
@@ -13,63 +13,93 @@
 #include <mutex>
 #include <unordered_set>
 
+#include <boost/functional/hash.hpp>
+
 #include "Debug.h"
 #include "DexClass.h"
 
 RedexContext* g_redex;
 
-RedexContext::RedexContext() {}
+std::atomic<uint64_t> RedexContext::s_member_epoch{0};
+
+RedexContext::RedexContext() { advance_member_epoch(); }
 
 RedexContext::~RedexContext() {
-  // Delete DexStrings.
-  for (auto const& p : s_string_map) {
-    delete p.second;
-  }
-  // Delete DexTypes.  NB: This table intentionally contains aliases (multiple
-  // DexStrings map to the same DexType), so we have to dedup the set of types
-  // before deleting to avoid double-frees.
-  std::unordered_set<DexType*> delete_types;
-  for (auto const& p : s_type_map) {
-    delete_types.emplace(p.second);
-  }
-  for (auto const& t : delete_types) {
-    delete t;
-  }
+  advance_member_epoch();
+
+  // DexStrings, DexTypes, DexProtos and DexMethods live in m_ref_arena and are
+  // released along with it.
+
   // Delete DexFields.
-  for (auto const& it : s_field_map) {
-    delete static_cast<DexField*>(it.second);
-  }
+  s_field_map.for_each(
+      [](const std::pair<const DexFieldSpec, DexFieldRef*>& it) {
+        delete static_cast<DexField*>(it.second);
+      });
   // Delete DexTypeLists.
   for (auto const& p : s_typelist_map) {
     delete p.second;
   }
-  // Delete DexProtos.
-  for (auto const& p1 : s_proto_map) {
-    for (auto const& p2 : p1.second) {
-      delete p2.second;
-    }
-  }
-  // Delete DexMethods.
-  for (auto const& it : s_method_map) {
-    delete it.second;
+}
+
+RedexContext::InternedCounts RedexContext::count_interned() {
+  InternedCounts counts;
+  counts.strings = s_string_map.size();
+  s_string_map.for_each(
+      [&](const std::pair<const char* const, DexString*>& it) {
+        // The character data is NUL-terminated.
+        counts.string_data_bytes += it.second->size() + 1;
+      });
+  counts.types = s_type_map.size();
+  counts.fields = s_field_map.size();
+  {
+    std::lock_guard<std::mutex> lock(s_typelist_lock);
+    counts.type_lists = s_typelist_map.size();
   }
+  s_proto_map.for_each(
+      [&](const std::pair<DexType* const,
+                          std::unordered_map<DexTypeList*, DexProto*>>& it) {
+        counts.protos += it.second.size();
+      });
+  counts.methods = s_method_map.size();
+  counts.positions = s_position_map.size();
+  counts.debug_locals = s_debug_local_map.size();
+  counts.string_data_arena_bytes = m_string_data_arena.bytes_reserved();
+  counts.ref_arena_bytes = m_ref_arena.bytes_reserved();
+  return counts;
 }
 
 DexString* RedexContext::make_string(const char* nstr, uint32_t utfsize) {
+  return intern_string(nstr, utfsize, /* copy */ true);
+}
+
+DexString* RedexContext::make_string_no_copy(const char* nstr,
+                                             uint32_t utfsize) {
+  return intern_string(nstr, utfsize, /* copy */ false);
+}
+
+DexString* RedexContext::intern_string(const char* nstr,
+                                       uint32_t utfsize,
+                                       bool copy) {
   always_assert(nstr != nullptr);
-  std::lock_guard<std::mutex> lock(s_string_lock);
-  auto it = s_string_map.find(nstr);
-  if (it == s_string_map.end()) {
-    // note DexStrings are keyed by the c_str() of the underlying std::string
-    // The c_str is valid until a the string is destroyed, or until a non-const
-    // function is called on the string (but note the std::string itself is
-    // const)
-    auto rv = new DexString(nstr, utfsize);
-    s_string_map.emplace(rv->c_str(), rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+  return s_string_map.with_slot(nstr, [&](StringMap::Slot& map) {
+    auto it = map.find(nstr);
+    if (it == map.end()) {
+      // note DexStrings are keyed by the character data they point to, which
+      // lives as long as the context
+      auto size = strlen(nstr);
+      auto storage = copy ? m_string_data_arena.copy_string(nstr, size) : nstr;
+      auto rv = make_ref<DexString>(storage, size, utfsize);
+      map.emplace(rv->c_str(), rv);
+      return rv;
+    } else {
+      return it->second;
+    }
+  });
+}
+
+void RedexContext::keep_alive(std::shared_ptr<void> storage) {
+  std::lock_guard<std::mutex> lock(m_kept_alive_lock);
+  m_kept_alive.push_back(std::move(storage));
 }
 
 DexString* RedexContext::get_string(const char* nstr, uint32_t utfsize) {
@@ -78,23 +108,25 @@ DexString* RedexContext::get_string(const char* nstr, uint32_t utfsize) {
   }
   // We need to use the lock to prevent undefined behavior if this method is
   // called while the map is being modified.
-  std::lock_guard<std::mutex> lock(s_string_lock);
-  auto find = s_string_map.find(nstr);
-  auto result = find != s_string_map.end() ? find->second : nullptr;
-  return result;
+  return s_string_map.with_slot(nstr, [&](StringMap::Slot& map) {
+    auto find = map.find(nstr);
+    return find != map.end() ? find->second : nullptr;
+  });
 }
 
 DexType* RedexContext::make_type(DexString* dstring) {
   always_assert(dstring != nullptr);
-  std::lock_guard<std::mutex> lock(s_type_lock);
-  auto it = s_type_map.find(dstring);
-  if (it == s_type_map.end()) {
-    auto rv = new DexType(dstring);
-    s_type_map.emplace(dstring, rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+  return s_type_map.with_slot(dstring, [&](TypeMap::Slot& map) {
+    auto it = map.find(dstring);
+    if (it == map.end()) {
+      auto rv = make_ref<DexType>(dstring);
+      rv->m_id = m_num_type_ids++;
+      map.emplace(dstring, rv);
+      return rv;
+    } else {
+      return it->second;
+    }
+  });
 }
 
 DexType* RedexContext::get_type(DexString* dstring) {
@@ -103,40 +135,43 @@ DexType* RedexContext::get_type(DexString* dstring) {
   }
   // We need to use the lock to prevent undefined behavior if this method is
   // called while the map is being modified.
-  std::lock_guard<std::mutex> lock(s_type_lock);
-  auto find = s_type_map.find(dstring);
-  auto result = find != s_type_map.end() ? find->second : nullptr;
-  return result;
+  return s_type_map.with_slot(dstring, [&](TypeMap::Slot& map) {
+    auto find = map.find(dstring);
+    return find != map.end() ? find->second : nullptr;
+  });
 }
 
 void RedexContext::alias_type_name(DexType* type, DexString* new_name) {
-  std::lock_guard<std::mutex> lock(s_type_lock);
-  always_assert_log(
-      !s_type_map.count(new_name),
-      "Bailing, attempting to alias a symbol that already exists! '%s'\n",
-      new_name->c_str());
-  type->m_name = new_name;
-  s_type_map.emplace(new_name, type);
+  s_type_map.with_slot(new_name, [&](TypeMap::Slot& map) {
+    always_assert_log(
+        !map.count(new_name),
+        "Bailing, attempting to alias a symbol that already exists! '%s'\n",
+        new_name->c_str());
+    type->m_name = new_name;
+    map.emplace(new_name, type);
+  });
 }
 
 DexFieldRef* RedexContext::make_field(const DexType* container,
                                       const DexString* name,
                                       const DexType* type) {
   always_assert(container != nullptr && name != nullptr && type != nullptr);
-  std::lock_guard<std::mutex> lock(s_field_lock);
   DexFieldSpec r(const_cast<DexType*>(container),
                 const_cast<DexString*>(name),
                 const_cast<DexType*>(type));
-  auto it = s_field_map.find(r);
-  if (it == s_field_map.end()) {
-    auto rv = new DexField(const_cast<DexType*>(container),
-                           const_cast<DexString*>(name),
-                           const_cast<DexType*>(type));
-    s_field_map.emplace(r, rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+  return s_field_map.with_slot(r, [&](FieldMap::Slot& map) -> DexFieldRef* {
+    auto it = map.find(r);
+    if (it == map.end()) {
+      auto rv = new DexField(const_cast<DexType*>(container),
+                             const_cast<DexString*>(name),
+                             const_cast<DexType*>(type));
+      rv->m_id = m_num_field_ids++;
+      map.emplace(r, rv);
+      return rv;
+    } else {
+      return it->second;
+    }
+  });
 }
 
 DexFieldRef* RedexContext::get_field(const DexType* container,
@@ -150,38 +185,45 @@ DexFieldRef* RedexContext::get_field(const DexType* container,
                 const_cast<DexType*>(type));
   // Still need to perform the locking in case a make_method call on another
   // thread is modifying the map.
-  std::lock_guard<std::mutex> lock(s_field_lock);
-  auto it = s_field_map.find(r);
-  if (it == s_field_map.end()) {
-    return nullptr;
-  } else {
-    return it->second;
-  }
+  return s_field_map.with_slot(r, [&](FieldMap::Slot& map) -> DexFieldRef* {
+    auto it = map.find(r);
+    return it != map.end() ? it->second : nullptr;
+  });
 }
 
 void RedexContext::mutate_field(
     DexFieldRef* field, const DexFieldSpec& ref, bool rename_on_collision) {
-  std::lock_guard<std::mutex> lock(s_field_lock);
-  DexFieldSpec& r = field->m_spec;
-  s_field_map.erase(r);
-  r.cls = ref.cls != nullptr ? ref.cls : field->m_spec.cls;
-  r.name = ref.name != nullptr ? ref.name : field->m_spec.name;
-  r.type = ref.type != nullptr ? ref.type : field->m_spec.type;
-  field->m_spec = r;
-
-  if (rename_on_collision && s_field_map.find(r) != s_field_map.end()) {
+  advance_member_epoch();
+  const DexFieldSpec old = field->m_spec;
+  DexFieldSpec r(ref.cls != nullptr ? ref.cls : old.cls,
+                 ref.name != nullptr ? ref.name : old.name,
+                 ref.type != nullptr ? ref.type : old.type);
+
+  // The old and the new signature generally live in different slots. Both
+  // stay locked while the field moves, so that nobody sees it under neither
+  // signature nor claims the new one in between.
+  auto try_move = [&]() {
+    return s_field_map.with_slots(
+        old, r, [&](FieldMap::Slot& from, FieldMap::Slot& to) {
+          auto it = to.find(r);
+          if (it != to.end() && it->second != field) {
+            return false;
+          }
+          from.erase(old);
+          to.emplace(r, field);
+          field->m_spec = r;
+          return true;
+        });
+  };
+  if (rename_on_collision) {
     uint32_t i = 0;
-    while (true) {
-      r.name = DexString::make_string(
-          ("f$" + std::to_string(i++)).c_str());
-      if (s_field_map.find(r) == s_field_map.end()) {
-        break;
-      }
+    while (!try_move()) {
+      r.name = DexString::make_string(("f$" + std::to_string(i++)).c_str());
     }
+    return;
   }
-  always_assert_log(s_field_map.find(r) == s_field_map.end(),
+  always_assert_log(try_move(),
                     "Another field with the same signature already exists");
-  s_field_map.emplace(r, field);
 }
 
 DexTypeList* RedexContext::make_type_list(std::deque<DexType*>&& p) {
@@ -209,24 +251,30 @@ DexProto* RedexContext::make_proto(DexType* rtype,
                                    DexTypeList* args,
                                    DexString* shorty) {
   always_assert(rtype != nullptr && args != nullptr && shorty != nullptr);
-  std::lock_guard<std::mutex> lock(s_proto_lock);
-  if (s_proto_map[rtype].count(args) == 0) {
-    auto rv = new DexProto(rtype, args, shorty);
-    s_proto_map[rtype][args] = rv;
-    return rv;
-  }
-  return s_proto_map[rtype][args];
+  return s_proto_map.with_slot(rtype, [&](ProtoMap::Slot& map) {
+    auto& protos = map[rtype];
+    auto it = protos.find(args);
+    if (it == protos.end()) {
+      auto rv = make_ref<DexProto>(rtype, args, shorty);
+      protos.emplace(args, rv);
+      return rv;
+    }
+    return it->second;
+  });
 }
 
 DexProto* RedexContext::get_proto(DexType* rtype, DexTypeList* args) {
   if (rtype == nullptr || args == nullptr) {
     return nullptr;
   }
-  std::lock_guard<std::mutex> lock(s_proto_lock);
-  if (s_proto_map[rtype].count(args) == 0) {
-    return nullptr;
-  }
-  return s_proto_map[rtype][args];
+  return s_proto_map.with_slot(rtype, [&](ProtoMap::Slot& map) -> DexProto* {
+    auto protos = map.find(rtype);
+    if (protos == map.end()) {
+      return nullptr;
+    }
+    auto it = protos->second.find(args);
+    return it != protos->second.end() ? it->second : nullptr;
+  });
 }
 
 DexMethodRef* RedexContext::make_method(DexType* type,
@@ -234,15 +282,17 @@ DexMethodRef* RedexContext::make_method(DexType* type,
                                         DexProto* proto) {
   always_assert(type != nullptr && name != nullptr && proto != nullptr);
   DexMethodSpec r(type, name, proto);
-  std::lock_guard<std::mutex> lock(s_method_lock);
-  auto it = s_method_map.find(r);
-  if (it == s_method_map.end()) {
-    auto rv = new DexMethod(type, name, proto);
-    s_method_map.emplace(r, rv);
-    return rv;
-  } else {
-    return it->second;
-  }
+  return s_method_map.with_slot(r, [&](MethodMap::Slot& map) -> DexMethodRef* {
+    auto it = map.find(r);
+    if (it == map.end()) {
+      auto rv = make_ref<DexMethod>(type, name, proto);
+      rv->m_id = m_num_method_ids++;
+      map.emplace(r, rv);
+      return rv;
+    } else {
+      return it->second;
+    }
+  });
 }
 
 DexMethodRef* RedexContext::get_method(DexType* type,
@@ -254,47 +304,119 @@ DexMethodRef* RedexContext::get_method(DexType* type,
   DexMethodSpec r(type, name, proto);
   // Still need to perform the locking in case a make_method call on another
   // thread is modifying the map.
-  std::lock_guard<std::mutex> lock(s_method_lock);
-  auto it = s_method_map.find(r);
-  if (it == s_method_map.end()) {
-    return nullptr;
-  } else {
-    return it->second;
-  }
+  return s_method_map.with_slot(r, [&](MethodMap::Slot& map) -> DexMethodRef* {
+    auto it = map.find(r);
+    return it != map.end() ? it->second : nullptr;
+  });
 }
 
 void RedexContext::erase_method(DexMethodRef* method) {
-  std::lock_guard<std::mutex> lock(s_method_lock);
-  s_method_map.erase(method->m_spec);
+  advance_member_epoch();
+  s_method_map.with_slot(method->m_spec, [&](MethodMap::Slot& map) {
+    map.erase(method->m_spec);
+  });
 }
 
 void RedexContext::mutate_method(DexMethodRef* method,
                                  const DexMethodSpec& ref,
                                  bool rename_on_collision /* = false */) {
-  std::lock_guard<std::mutex> lock(s_method_lock);
-  DexMethodSpec& r = method->m_spec;
-  s_method_map.erase(r);
-
-  r.cls = ref.cls != nullptr ? ref.cls : method->m_spec.cls;
-  r.name = ref.name != nullptr ? ref.name : method->m_spec.name;
-  r.proto = ref.proto != nullptr ? ref.proto : method->m_spec.proto;
-  if (s_method_map.find(r) != s_method_map.end() && rename_on_collision) {
-    std::string original_name(r.name->c_str());
+  advance_member_epoch();
+  const DexMethodSpec old = method->m_spec;
+  DexMethodSpec r(ref.cls != nullptr ? ref.cls : old.cls,
+                  ref.name != nullptr ? ref.name : old.name,
+                  ref.proto != nullptr ? ref.proto : old.proto);
+
+  // See mutate_field for why both slots stay locked during the move.
+  auto try_move = [&]() {
+    return s_method_map.with_slots(
+        old, r, [&](MethodMap::Slot& from, MethodMap::Slot& to) {
+          auto it = to.find(r);
+          if (it != to.end() && it->second != method) {
+            return false;
+          }
+          from.erase(old);
+          to.emplace(r, method);
+          method->m_spec = r;
+          return true;
+        });
+  };
+  if (rename_on_collision) {
     uint32_t i = 0;
-    while (true) {
-      r.name = DexString::make_string(
-          ("r$" + std::to_string(i++)).c_str());
-      if (s_method_map.find(r) == s_method_map.end()) {
-        break;
-      }
+    while (!try_move()) {
+      r.name = DexString::make_string(("r$" + std::to_string(i++)).c_str());
     }
+    return;
   }
-  always_assert_log(s_method_map.find(r) == s_method_map.end(),
+  always_assert_log(try_move(),
                     "Another method of the same signature already exists");
-  s_method_map.emplace(r, method);
+}
+
+size_t RedexContext::position_hash::operator()(
+    const DexPosition* pos) const {
+  size_t seed = 0;
+  boost::hash_combine(seed, pos->method);
+  boost::hash_combine(seed, pos->file);
+  boost::hash_combine(seed, pos->line);
+  boost::hash_combine(seed, pos->parent);
+  return seed;
+}
+
+bool RedexContext::position_eq::operator()(const DexPosition* a,
+                                           const DexPosition* b) const {
+  // The parents are interned, so they are equal iff they are the same.
+  return a->method == b->method && a->file == b->file && a->line == b->line &&
+         a->parent == b->parent;
+}
+
+DexPosition* RedexContext::make_position(DexMethod* method,
+                                         DexString* file,
+                                         uint32_t line,
+                                         DexPosition* parent) {
+  DexPosition key(method, file, line, parent);
+  return s_position_map.with_slot(&key, [&](PositionMap::Slot& map) {
+    auto it = map.find(&key);
+    if (it == map.end()) {
+      auto rv = make_ref<DexPosition>(method, file, line, parent);
+      map.emplace(rv, rv);
+      return rv;
+    } else {
+      return it->second;
+    }
+  });
+}
+
+size_t RedexContext::debug_local_hash::operator()(
+    const DexDebugLocal* local) const {
+  size_t seed = 0;
+  boost::hash_combine(seed, local->name);
+  boost::hash_combine(seed, local->type);
+  boost::hash_combine(seed, local->sig);
+  return seed;
+}
+
+bool RedexContext::debug_local_eq::operator()(const DexDebugLocal* a,
+                                              const DexDebugLocal* b) const {
+  return a->name == b->name && a->type == b->type && a->sig == b->sig;
+}
+
+const DexDebugLocal* RedexContext::make_debug_local(DexString* name,
+                                                   DexType* type,
+                                                   DexString* sig) {
+  DexDebugLocal key(name, type, sig);
+  return s_debug_local_map.with_slot(&key, [&](DebugLocalMap::Slot& map) {
+    auto it = map.find(&key);
+    if (it == map.end()) {
+      const DexDebugLocal* rv = make_ref<DexDebugLocal>(name, type, sig);
+      map.emplace(rv, rv);
+      return rv;
+    } else {
+      return it->second;
+    }
+  });
 }
 
 void RedexContext::publish_class(DexClass* cls) {
+  advance_member_epoch();
   std::lock_guard<std::mutex> l(m_type_system_mutex);
   const DexType* type = cls->get_type();
   if (m_type_to_class.find(type) != end(m_type_to_class)) {
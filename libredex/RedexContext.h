@@ -10,16 +10,20 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <cstring>
 #include <deque>
 #include <functional>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <unordered_map>
 #include <vector>
 
+#include "Arena.h"
+#include "ConcurrentContainers.h"
 #include "DexMemberRefs.h"
 
 class DexDebugInstruction;
@@ -29,9 +33,11 @@ class DexFieldRef;
 class DexTypeList;
 class DexProto;
 class DexMethodRef;
+class DexMethod;
 class DexClass;
 struct DexFieldSpec;
 struct DexDebugEntry;
+struct DexDebugLocal;
 struct DexPosition;
 struct RedexContext;
 
@@ -42,8 +48,17 @@ struct RedexContext {
   ~RedexContext();
 
   DexString* make_string(const char* nstr, uint32_t utfsize);
+  // Like make_string, but if the string is new, the DexString points straight
+  // at nstr instead of copying it. nstr must be NUL-terminated and stay valid
+  // for the lifetime of the context, e.g. by passing its backing storage to
+  // keep_alive().
+  DexString* make_string_no_copy(const char* nstr, uint32_t utfsize);
   DexString* get_string(const char* nstr, uint32_t utfsize);
 
+  // Ties the lifetime of some storage (typically the mapping of an input dex)
+  // to the lifetime of the context.
+  void keep_alive(std::shared_ptr<void> storage);
+
   DexType* make_type(DexString* dstring);
   DexType* get_type(DexString* dstring);
   void alias_type_name(DexType* type, DexString* new_name);
@@ -80,6 +95,60 @@ struct RedexContext {
   DexDebugEntry* make_dbg_entry(DexDebugInstruction* opcode);
   DexDebugEntry* make_dbg_entry(DexPosition* pos);
 
+  // parent must be an interned position too.
+  DexPosition* make_position(DexMethod* method,
+                             DexString* file,
+                             uint32_t line,
+                             DexPosition* parent);
+
+  const DexDebugLocal* make_debug_local(DexString* name,
+                                        DexType* type,
+                                        DexString* sig);
+
+  /*
+   * Every DexType, DexFieldRef and DexMethodRef gets an id when it is made.
+   * Ids are dense per kind, starting at 0, and never change. These return
+   * how many ids of each kind have been handed out so far.
+   */
+  uint32_t num_type_ids() const { return m_num_type_ids; }
+  uint32_t num_field_ids() const { return m_num_field_ids; }
+  uint32_t num_method_ids() const { return m_num_method_ids; }
+
+  /*
+   * How many of each kind of interned object there are, and the bytes taken
+   * by the character data of the strings and by the arenas. Must not run
+   * concurrently with interning.
+   */
+  struct InternedCounts {
+    size_t strings{0};
+    size_t string_data_bytes{0};
+    size_t types{0};
+    size_t fields{0};
+    size_t type_lists{0};
+    size_t protos{0};
+    size_t methods{0};
+    size_t positions{0};
+    size_t debug_locals{0};
+    size_t string_data_arena_bytes{0};
+    size_t ref_arena_bytes{0};
+  };
+  InternedCounts count_interned();
+
+  /*
+   * The member epoch changes whenever resolving a member ref may give a
+   * different answer: a class is published, gains or loses members, or
+   * changes its super class or interfaces, or a member ref is renamed or
+   * erased. It is shared by all contexts, so that caches keyed by refs can't
+   * mix up the refs of successive contexts. Code that edits the member lists
+   * of a class directly must call advance_member_epoch() itself.
+   */
+  static uint64_t member_epoch() {
+    return s_member_epoch.load(std::memory_order_relaxed);
+  }
+  static void advance_member_epoch() {
+    s_member_epoch.fetch_add(1, std::memory_order_relaxed);
+  }
+
   void publish_class(DexClass*);
   DexClass* type_class(const DexType* t);
   template <class TypeClassWalkerFn = void(const DexType*, const DexClass*)>
@@ -99,36 +168,99 @@ struct RedexContext {
   }
 
  private:
-  struct carray_cmp {
+  struct carray_hash {
+    // FNV-1a over the MUTF-8 bytes
+    size_t operator()(const char* s) const {
+      size_t hash = 14695981039346656037ULL;
+      for (; *s != '\0'; ++s) {
+        hash = (hash ^ static_cast<unsigned char>(*s)) * 1099511628211ULL;
+      }
+      return hash;
+    }
+  };
+
+  struct carray_eq {
     bool operator()(const char* a, const char* b) const {
-      return (strcmp(a, b) < 0);
+      return strcmp(a, b) == 0;
     }
   };
 
+  // DexStrings (and their character data), DexTypes, DexProtos, DexMethods
+  // DexPositions and DexDebugLocals are immutable once interned and live until the context
+  // goes away, so they are bump-allocated and released wholesale instead of
+  // freed one by one.
+  Arena m_string_data_arena;
+  Arena m_ref_arena;
+
+  std::mutex m_kept_alive_lock;
+  std::vector<std::shared_ptr<void>> m_kept_alive;
+
+  DexString* intern_string(const char* nstr, uint32_t utfsize, bool copy);
+
+  template <class T, class... Args>
+  T* make_ref(Args&&... args) {
+    return new (m_ref_arena.allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  // The interning tables below are striped so that threads loading classes
+  // or creating refs concurrently don't all serialize on a single lock.
+
   // DexString
-  std::map<const char*, DexString*, carray_cmp> s_string_map;
-  std::mutex s_string_lock;
+  using StringMap =
+      ConcurrentMap<const char*, DexString*, carray_hash, carray_eq>;
+  StringMap s_string_map;
 
   // DexType
-  std::unordered_map<DexString*, DexType*> s_type_map;
-  std::mutex s_type_lock;
+  using TypeMap = ConcurrentMap<DexString*, DexType*>;
+  TypeMap s_type_map;
 
   // DexFieldRef
-  std::unordered_map<DexFieldSpec, DexFieldRef*> s_field_map;
-  std::mutex s_field_lock;
+  using FieldMap = ConcurrentMap<DexFieldSpec, DexFieldRef*>;
+  FieldMap s_field_map;
 
   // DexTypeList
   std::map<std::deque<DexType*>, DexTypeList*> s_typelist_map;
   std::mutex s_typelist_lock;
 
   // DexProto
-  std::unordered_map<DexType*, std::unordered_map<DexTypeList*, DexProto*>>
-      s_proto_map;
-  std::mutex s_proto_lock;
+  using ProtoMap =
+      ConcurrentMap<DexType*, std::unordered_map<DexTypeList*, DexProto*>>;
+  ProtoMap s_proto_map;
 
   // DexMethod
-  std::unordered_map<DexMethodSpec, DexMethodRef*> s_method_map;
-  std::mutex s_method_lock;
+  using MethodMap = ConcurrentMap<DexMethodSpec, DexMethodRef*>;
+  MethodMap s_method_map;
+
+  // DexPosition, keyed by the positions themselves
+  struct position_hash {
+    size_t operator()(const DexPosition* pos) const;
+  };
+  struct position_eq {
+    bool operator()(const DexPosition* a, const DexPosition* b) const;
+  };
+  using PositionMap =
+      ConcurrentMap<const DexPosition*, DexPosition*, position_hash, position_eq>;
+  PositionMap s_position_map;
+
+  // DexDebugLocal, keyed by the locals themselves
+  struct debug_local_hash {
+    size_t operator()(const DexDebugLocal* local) const;
+  };
+  struct debug_local_eq {
+    bool operator()(const DexDebugLocal* a, const DexDebugLocal* b) const;
+  };
+  using DebugLocalMap = ConcurrentMap<const DexDebugLocal*,
+                                      const DexDebugLocal*,
+                                      debug_local_hash,
+                                      debug_local_eq>;
+  DebugLocalMap s_debug_local_map;
+
+  std::atomic<uint32_t> m_num_type_ids{0};
+  std::atomic<uint32_t> m_num_field_ids{0};
+  std::atomic<uint32_t> m_num_method_ids{0};
+
+  static std::atomic<uint64_t> s_member_epoch;
 
   // Type-to-class map and class hierarchy
   std::mutex m_type_system_mutex;
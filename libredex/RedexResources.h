@@ -9,9 +9,13 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <string>
 #include <unordered_set>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
 
 #include "androidfw/ResourceTypes.h"
 
@@ -29,6 +33,29 @@ size_t write_serialized_data(
     const size_t& length);
 void unmap_and_close(int file_descriptor, void* file_pointer, size_t length);
 
+/*
+ * A whole file mapped read-only with map_file(), for the code that only
+ * scans files, so that they are never copied. Like read_entire_file(), the
+ * contents are empty if anything went wrong.
+ */
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  boost::string_ref contents() const {
+    return boost::string_ref(m_data, m_size);
+  }
+
+ private:
+  int m_file_descriptor{-1};
+  const char* m_data{nullptr};
+  size_t m_size{0};
+};
+
 std::string get_string_attribute_value(const android::ResXMLTree& parser,
                                        const android::String16& attribute_name);
 bool has_raw_attribute_value(
@@ -37,12 +64,34 @@ bool has_raw_attribute_value(
     android::Res_value& out_value);
 std::unordered_set<std::string> get_manifest_classes(
     const std::string& filename);
+/*
+ * The libraries are scanned in parallel. When `is_known` is given, only the
+ * names it accepts are returned; it is called from several threads.
+ */
 std::unordered_set<std::string> get_native_classes(
-    const std::string& apk_directory);
+    const std::string& apk_directory,
+    const std::function<bool(const char*)>& is_known = nullptr);
 std::unordered_set<std::string> get_layout_classes(
     const std::string& apk_directory);
 std::unordered_set<std::string> get_xml_files(
     const std::string& directory);
+
+// What scan_xml_files() gathered from a set of binary XML files.
+struct XmlScanResult {
+  // The classes that elements refer to, as in get_layout_classes().
+  std::unordered_set<std::string> classes;
+  // The resource ids that attributes refer to, as in
+  // get_xml_reference_attributes().
+  std::unordered_set<uint32_t> reference_attributes;
+  // The strings to find that are in the string pool of some file.
+  std::unordered_set<std::string> string_pool_hits;
+};
+
+// Parses each of the files once, in parallel, and gathers everything above.
+// Files that can't be read or parsed are skipped.
+XmlScanResult scan_xml_files(
+    const std::vector<std::string>& files,
+    const std::unordered_set<std::string>& strings_to_find = {});
 std::unordered_set<uint32_t> get_xml_reference_attributes(
     const std::string& filename);
 int inline_xml_reference_attributes(
@@ -63,9 +112,21 @@ int replace_in_xml_string_pool(
     android::Vector<char>* out_data,
     size_t* out_num_renamed);
 
+// Like replace_in_xml_string_pool(), but overwrites the strings where they
+// are in the given bytes, so that nothing else in the file moves. Each
+// replacement has to fit in the room of the string it replaces, the rest of
+// which is zeroed. Returns false, having written nothing, if one doesn't or
+// the pool can't be read.
+bool replace_in_xml_string_pool_in_place(
+    void* data,
+    const size_t len,
+    const std::map<std::string, std::string>& shortened_names,
+    size_t* out_num_renamed);
+
 // Replaces all strings in the ResStringPool for the given file with their
-// replacements. Writes all changes to disk, clobbering the given file.
-// Same return codes as replace_in_xml_string_pool.
+// replacements, in place when they all fit (see above), and otherwise by
+// reserializing the whole file. Writes all changes to disk, clobbering the
+// given file. Same return codes as replace_in_xml_string_pool.
 int rename_classes_in_layout(
     const std::string& file_path,
     const std::map<std::string, std::string>& shortened_names,
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <string>
 
 class ReferencedState {
@@ -80,6 +81,12 @@ class ReferencedState {
 
   std::string str() const;
 
+  // The flags packed into a word, and the keep count. Together they are all
+  // of the state, so that it can be saved and restored, see ProgramSnapshot.h.
+  uint32_t flags() const;
+  uint32_t keep_count() const { return m_keep_count; }
+  void restore(uint32_t flags, uint32_t keep_count);
+
   bool can_delete() const { return !m_bytype && (!m_keep || allowshrinking()); }
   bool can_rename() const {
     return !m_keep_name && !m_bystring && (!m_keep || allowobfuscation()) &&
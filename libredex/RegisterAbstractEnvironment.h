@@ -0,0 +1,520 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/container/flat_map.hpp>
+
+#include "AbstractDomain.h"
+#include "Debug.h"
+
+namespace rae_impl {
+
+template <typename Register, typename Domain>
+class RegisterValue;
+
+} // namespace rae_impl
+
+/*
+ * An abstract environment for the registers of a method, i.e. small integers
+ * that are numbered densely from 0.
+ *
+ * The bindings are stored in a flat vector indexed by the register, cut into
+ * fixed-size blocks. Each block records which of its slots are bound in a
+ * bitmask, so that Top bindings are not stored, and it is shared between the
+ * copies of an environment until one of them writes to it. The lattice
+ * operations then walk the two environments block by block, skip the blocks
+ * they share and only look at the slots that are set in the masks.
+ *
+ * The few registers outside of the dense range, like the pseudo-registers
+ * that the analyses use for the result of an invoke, are kept in a small
+ * sorted map on the side.
+ *
+ * This has the same interface as PatriciaTreeMapAbstractEnvironment, see
+ * HashedAbstractEnvironment.h for more details about abstract environments.
+ */
+template <typename Register, typename Domain>
+class RegisterAbstractEnvironment final
+    : public AbstractDomainScaffolding<
+          rae_impl::RegisterValue<Register, Domain>,
+          RegisterAbstractEnvironment<Register, Domain>> {
+ public:
+  using Value = rae_impl::RegisterValue<Register, Domain>;
+
+  using AbstractValueKind = typename AbstractValue<Value>::Kind;
+
+  /*
+   * The default constructor produces the Top value.
+   */
+  RegisterAbstractEnvironment()
+      : AbstractDomainScaffolding<Value, RegisterAbstractEnvironment>() {}
+
+  RegisterAbstractEnvironment(AbstractValueKind kind)
+      : AbstractDomainScaffolding<Value, RegisterAbstractEnvironment>(kind) {}
+
+  RegisterAbstractEnvironment(
+      std::initializer_list<std::pair<Register, Domain>> l) {
+    for (const auto& p : l) {
+      if (p.second.is_bottom()) {
+        this->set_to_bottom();
+        return;
+      }
+      this->get_value()->set(p.first, p.second);
+    }
+    this->normalize();
+  }
+
+  /*
+   * The number of registers that are bound to a value other than Top.
+   */
+  size_t size() const {
+    assert(this->kind() == AbstractValueKind::Value);
+    return this->get_value()->size();
+  }
+
+  /*
+   * Calls f on each register that is bound to a value other than Top, in
+   * increasing order of registers.
+   */
+  void for_each_binding(
+      const std::function<void(Register, const Domain&)>& f) const {
+    if (this->is_value()) {
+      this->get_value()->for_each_binding(f);
+    }
+  }
+
+  Domain get(Register reg) const {
+    if (this->is_bottom()) {
+      return Domain::bottom();
+    }
+    return this->get_value()->get(reg);
+  }
+
+  RegisterAbstractEnvironment& set(Register reg, const Domain& value) {
+    if (this->is_bottom()) {
+      return *this;
+    }
+    if (value.is_bottom()) {
+      this->set_to_bottom();
+      return *this;
+    }
+    this->get_value()->set(reg, value);
+    this->normalize();
+    return *this;
+  }
+
+  RegisterAbstractEnvironment& update(
+      Register reg, std::function<Domain(const Domain&)> operation) {
+    if (this->is_bottom()) {
+      return *this;
+    }
+    return set(reg, operation(this->get_value()->get(reg)));
+  }
+
+  static RegisterAbstractEnvironment bottom() {
+    return RegisterAbstractEnvironment(AbstractValueKind::Bottom);
+  }
+
+  static RegisterAbstractEnvironment top() {
+    return RegisterAbstractEnvironment(AbstractValueKind::Top);
+  }
+
+  std::string str() const;
+};
+
+template <typename Register, typename Domain>
+inline std::ostream& operator<<(
+    std::ostream& o, const RegisterAbstractEnvironment<Register, Domain>& e) {
+  using AbstractValueKind =
+      typename RegisterAbstractEnvironment<Register,
+                                           Domain>::AbstractValueKind;
+  switch (e.kind()) {
+  case AbstractValueKind::Bottom: {
+    o << "_|_";
+    break;
+  }
+  case AbstractValueKind::Top: {
+    o << "T";
+    break;
+  }
+  case AbstractValueKind::Value: {
+    o << "[#" << e.size() << "]";
+    o << "{";
+    bool first = true;
+    e.for_each_binding([&](Register reg, const Domain& value) {
+      if (!first) {
+        o << ", ";
+      }
+      first = false;
+      o << reg << " -> " << value;
+    });
+    o << "}";
+    break;
+  }
+  }
+  return o;
+}
+
+template <typename Register, typename Domain>
+inline std::string RegisterAbstractEnvironment<Register, Domain>::str() const {
+  std::ostringstream ss;
+  ss << *this;
+  return ss.str();
+}
+
+namespace rae_impl {
+
+/*
+ * The definition of an element of a register environment. Like in
+ * PatriciaTreeMapAbstractEnvironment, bindings to Top are not stored and
+ * bindings to Bottom never make it here, as the whole environment is set to
+ * Bottom instead. The Meet and Narrowing operations return Kind::Bottom as soon
+ * as a binding to Bottom is about to be created.
+ *
+ * A null block, as well as the part of the register range past the last
+ * block, have all of their registers bound to Top. Blocks are never left with
+ * an empty mask, and there is no null block at the end, so an element with no
+ * blocks and no sparse bindings is Top.
+ */
+template <typename Register, typename Domain>
+class RegisterValue final : public AbstractValue<RegisterValue<Register, Domain>> {
+ public:
+  using Kind = typename AbstractValue<RegisterValue<Register, Domain>>::Kind;
+
+  static_assert(std::is_unsigned<Register>::value,
+                "Register must be an unsigned integer type");
+
+  static constexpr size_t kBlockSize = 64;
+
+  // Dex code has at most 2^16 registers, the registers above are looked up in
+  // the sparse map.
+  static constexpr uint64_t kDenseLimit = uint64_t(1) << 16;
+
+  RegisterValue() = default;
+
+  void clear() override {
+    m_blocks.clear();
+    m_sparse.clear();
+  }
+
+  Kind kind() const override {
+    return m_blocks.empty() && m_sparse.empty() ? Kind::Top : Kind::Value;
+  }
+
+  size_t size() const {
+    size_t result = m_sparse.size();
+    for (const auto& block : m_blocks) {
+      if (block != nullptr) {
+        result += __builtin_popcountll(block->mask);
+      }
+    }
+    return result;
+  }
+
+  void for_each_binding(
+      const std::function<void(Register, const Domain&)>& f) const {
+    for (size_t b = 0; b < m_blocks.size(); ++b) {
+      const auto& block = m_blocks[b];
+      if (block == nullptr) {
+        continue;
+      }
+      for (auto mask = block->mask; mask != 0; mask &= mask - 1) {
+        auto slot = __builtin_ctzll(mask);
+        f(static_cast<Register>(b * kBlockSize + slot), block->values[slot]);
+      }
+    }
+    for (const auto& pair : m_sparse) {
+      f(pair.first, pair.second);
+    }
+  }
+
+  Domain get(Register reg) const {
+    if (reg >= kDenseLimit) {
+      auto it = m_sparse.find(reg);
+      return it == m_sparse.end() ? Domain::top() : it->second;
+    }
+    auto b = reg / kBlockSize;
+    auto slot = reg % kBlockSize;
+    if (b >= m_blocks.size() || m_blocks[b] == nullptr ||
+        (m_blocks[b]->mask & bit(slot)) == 0) {
+      return Domain::top();
+    }
+    return m_blocks[b]->values[slot];
+  }
+
+  void set(Register reg, const Domain& value) {
+    assert(!value.is_bottom());
+    if (reg >= kDenseLimit) {
+      if (value.is_top()) {
+        m_sparse.erase(reg);
+      } else {
+        m_sparse[reg] = value;
+      }
+      return;
+    }
+    auto b = reg / kBlockSize;
+    auto slot = reg % kBlockSize;
+    if (value.is_top()) {
+      if (b >= m_blocks.size() || m_blocks[b] == nullptr ||
+          (m_blocks[b]->mask & bit(slot)) == 0) {
+        return;
+      }
+      auto block = mutable_block(b);
+      block->mask &= ~bit(slot);
+      block->values[slot] = Domain::top();
+      if (block->mask == 0) {
+        m_blocks[b] = nullptr;
+        trim();
+      }
+      return;
+    }
+    if (b >= m_blocks.size()) {
+      m_blocks.resize(b + 1);
+    }
+    auto block = mutable_block(b);
+    block->mask |= bit(slot);
+    block->values[slot] = value;
+  }
+
+  bool leq(const RegisterValue& other) const override {
+    // Every register that is bound in other must be bound to a smaller value
+    // here, since Top is only below itself.
+    for (size_t b = 0; b < other.m_blocks.size(); ++b) {
+      const auto& theirs = other.m_blocks[b];
+      if (theirs == nullptr) {
+        continue;
+      }
+      if (b >= m_blocks.size() || m_blocks[b] == nullptr) {
+        return false;
+      }
+      const auto& ours = m_blocks[b];
+      if (ours == theirs) {
+        continue;
+      }
+      if ((ours->mask & theirs->mask) != theirs->mask) {
+        return false;
+      }
+      for (auto mask = theirs->mask; mask != 0; mask &= mask - 1) {
+        auto slot = __builtin_ctzll(mask);
+        if (!ours->values[slot].leq(theirs->values[slot])) {
+          return false;
+        }
+      }
+    }
+    for (const auto& pair : other.m_sparse) {
+      auto it = m_sparse.find(pair.first);
+      if (it == m_sparse.end() || !it->second.leq(pair.second)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool equals(const RegisterValue& other) const override {
+    if (m_blocks.size() != other.m_blocks.size() ||
+        m_sparse.size() != other.m_sparse.size()) {
+      return false;
+    }
+    for (size_t b = 0; b < m_blocks.size(); ++b) {
+      const auto& ours = m_blocks[b];
+      const auto& theirs = other.m_blocks[b];
+      if (ours == theirs) {
+        continue;
+      }
+      if (ours == nullptr || theirs == nullptr ||
+          ours->mask != theirs->mask) {
+        return false;
+      }
+      for (auto mask = ours->mask; mask != 0; mask &= mask - 1) {
+        auto slot = __builtin_ctzll(mask);
+        if (!ours->values[slot].equals(theirs->values[slot])) {
+          return false;
+        }
+      }
+    }
+    auto it = other.m_sparse.begin();
+    for (const auto& pair : m_sparse) {
+      if (pair.first != it->first || !pair.second.equals(it->second)) {
+        return false;
+      }
+      ++it;
+    }
+    return true;
+  }
+
+  Kind join_with(const RegisterValue& other) override {
+    return join_like_operation(
+        other, [](const Domain& x, const Domain& y) { return x.join(y); });
+  }
+
+  Kind widen_with(const RegisterValue& other) override {
+    return join_like_operation(
+        other, [](const Domain& x, const Domain& y) { return x.join(y); });
+  }
+
+  Kind meet_with(const RegisterValue& other) override {
+    return meet_like_operation(
+        other, [](const Domain& x, const Domain& y) { return x.meet(y); });
+  }
+
+  Kind narrow_with(const RegisterValue& other) override {
+    return meet_like_operation(
+        other, [](const Domain& x, const Domain& y) { return x.meet(y); });
+  }
+
+ private:
+  struct Block {
+    uint64_t mask{0};
+    std::vector<Domain> values;
+
+    Block() : values(kBlockSize, Domain::top()) {}
+  };
+
+  static uint64_t bit(size_t slot) { return uint64_t(1) << slot; }
+
+  // Returns block b, after making a copy of it if it is shared.
+  Block* mutable_block(size_t b) {
+    auto& block = m_blocks[b];
+    if (block == nullptr) {
+      block = std::make_shared<Block>();
+    } else if (block.use_count() > 1) {
+      block = std::make_shared<Block>(*block);
+    }
+    return block.get();
+  }
+
+  void trim() {
+    while (!m_blocks.empty() && m_blocks.back() == nullptr) {
+      m_blocks.pop_back();
+    }
+  }
+
+  // The registers that are bound on only one side become Top.
+  Kind join_like_operation(
+      const RegisterValue& other,
+      const std::function<Domain(const Domain&, const Domain&)>& operation) {
+    if (m_blocks.size() > other.m_blocks.size()) {
+      m_blocks.resize(other.m_blocks.size());
+    }
+    for (size_t b = 0; b < m_blocks.size(); ++b) {
+      const auto& theirs = other.m_blocks[b];
+      if (m_blocks[b] == theirs) {
+        continue;
+      }
+      if (m_blocks[b] == nullptr) {
+        continue;
+      }
+      if (theirs == nullptr) {
+        m_blocks[b] = nullptr;
+        continue;
+      }
+      auto both = m_blocks[b]->mask & theirs->mask;
+      auto block = mutable_block(b);
+      for (auto mask = block->mask & ~both; mask != 0; mask &= mask - 1) {
+        block->values[__builtin_ctzll(mask)] = Domain::top();
+      }
+      block->mask = both;
+      for (auto mask = both; mask != 0; mask &= mask - 1) {
+        auto slot = __builtin_ctzll(mask);
+        auto result = operation(block->values[slot], theirs->values[slot]);
+        if (result.is_top()) {
+          block->mask &= ~bit(slot);
+          result = Domain::top();
+        }
+        block->values[slot] = std::move(result);
+      }
+      if (block->mask == 0) {
+        m_blocks[b] = nullptr;
+      }
+    }
+    trim();
+
+    for (auto it = m_sparse.begin(); it != m_sparse.end();) {
+      auto theirs = other.m_sparse.find(it->first);
+      if (theirs == other.m_sparse.end()) {
+        it = m_sparse.erase(it);
+        continue;
+      }
+      it->second = operation(it->second, theirs->second);
+      if (it->second.is_top()) {
+        it = m_sparse.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return kind();
+  }
+
+  // The registers that are bound on only one side keep their binding.
+  Kind meet_like_operation(
+      const RegisterValue& other,
+      const std::function<Domain(const Domain&, const Domain&)>& operation) {
+    if (m_blocks.size() < other.m_blocks.size()) {
+      m_blocks.resize(other.m_blocks.size());
+    }
+    for (size_t b = 0; b < other.m_blocks.size(); ++b) {
+      const auto& theirs = other.m_blocks[b];
+      if (m_blocks[b] == theirs || theirs == nullptr) {
+        continue;
+      }
+      if (m_blocks[b] == nullptr) {
+        m_blocks[b] = theirs;
+        continue;
+      }
+      auto block = mutable_block(b);
+      for (auto mask = theirs->mask; mask != 0; mask &= mask - 1) {
+        auto slot = __builtin_ctzll(mask);
+        if ((block->mask & bit(slot)) == 0) {
+          block->values[slot] = theirs->values[slot];
+          continue;
+        }
+        auto result = operation(block->values[slot], theirs->values[slot]);
+        if (result.is_bottom()) {
+          clear();
+          return Kind::Bottom;
+        }
+        block->values[slot] = std::move(result);
+      }
+      block->mask |= theirs->mask;
+    }
+
+    for (const auto& pair : other.m_sparse) {
+      auto it = m_sparse.find(pair.first);
+      if (it == m_sparse.end()) {
+        m_sparse.emplace(pair.first, pair.second);
+        continue;
+      }
+      it->second = operation(it->second, pair.second);
+      if (it->second.is_bottom()) {
+        clear();
+        return Kind::Bottom;
+      }
+    }
+    return kind();
+  }
+
+  std::vector<std::shared_ptr<Block>> m_blocks;
+  boost::container::flat_map<Register, Domain> m_sparse;
+
+  template <typename T1, typename T2>
+  friend class ::RegisterAbstractEnvironment;
+};
+
+} // namespace rae_impl
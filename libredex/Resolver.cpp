@@ -10,6 +10,8 @@
 #include "Resolver.h"
 #include "DexUtil.h"
 
+#include <boost/functional/hash.hpp>
+
 namespace {
 
 inline bool match(const DexString* name,
@@ -160,3 +162,53 @@ DexMethod* find_top_intf_impl(
   }
   return top_impl;
 }
+
+namespace {
+
+using MethodKey = std::pair<DexMethodRef*, MethodSearch>;
+using FieldKey = std::pair<DexFieldRef*, FieldSearch>;
+
+struct ResolutionCache {
+  uint64_t epoch{0};
+  std::unordered_map<MethodKey, DexMethod*, boost::hash<MethodKey>> methods;
+  std::unordered_map<FieldKey, DexField*, boost::hash<FieldKey>> fields;
+};
+
+ResolutionCache& current_resolution_cache() {
+  thread_local ResolutionCache cache;
+  auto epoch = RedexContext::member_epoch();
+  if (cache.epoch != epoch) {
+    cache.methods.clear();
+    cache.fields.clear();
+    cache.epoch = epoch;
+  }
+  return cache;
+}
+
+} // namespace
+
+DexMethod* resolve_method_cached(DexMethodRef* method, MethodSearch search) {
+  if (method->is_def()) return static_cast<DexMethod*>(method);
+  auto& methods = current_resolution_cache().methods;
+  auto key = std::make_pair(method, search);
+  auto it = methods.find(key);
+  if (it != methods.end()) {
+    return it->second;
+  }
+  auto def = resolve_method(method, search);
+  methods.emplace(key, def);
+  return def;
+}
+
+DexField* resolve_field_cached(DexFieldRef* field, FieldSearch search) {
+  if (field->is_def()) return static_cast<DexField*>(field);
+  auto& fields = current_resolution_cache().fields;
+  auto key = std::make_pair(field, search);
+  auto it = fields.find(key);
+  if (it != fields.end()) {
+    return it->second;
+  }
+  auto def = resolve_field(field, search);
+  fields.emplace(key, def);
+  return def;
+}
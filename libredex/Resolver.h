@@ -42,7 +42,7 @@ enum class MethodSearch {
 /**
  * Helper to map an opcode to a MethodSearch rule.
  */
-inline MethodSearch opcode_to_search(IRInstruction* insn) {
+inline MethodSearch opcode_to_search(const IRInstruction* insn) {
   auto opcode = insn->opcode();
   always_assert(is_invoke(opcode));
   switch (opcode) {
@@ -155,6 +155,17 @@ inline DexMethod* resolve_method(
   return mdef;
 }
 
+/**
+ * Resolve a method through a cache shared by the whole process, keyed by the
+ * ref and the search. Unlike MethodRefCache, clients don't have to keep a
+ * cache around, and the cache is dropped whenever the member epoch changes
+ * (see RedexContext::member_epoch()), so that it follows the classes as they
+ * are modified.
+ * Each thread fills its own copy of the cache, hence lookups never wait on
+ * other threads.
+ */
+DexMethod* resolve_method_cached(DexMethodRef* method, MethodSearch search);
+
 /**
  * Given a scope defined by DexClass, a name and a proto look for the vmethod
  * on the top ancestor. Essentially finds where the method was introduced.
@@ -202,3 +213,9 @@ inline DexField* resolve_field(
   return resolve_field(
       field->get_class(), field->get_name(), field->get_type(), search);
 }
+
+/**
+ * Same as resolve_field, through the cache of resolve_method_cached.
+ */
+DexField* resolve_field_cached(DexFieldRef* field,
+                               FieldSearch search = FieldSearch::Any);
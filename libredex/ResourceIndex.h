@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "androidfw/ResourceTypes.h"
+
+/*
+ * What the reachability queries need to know about the resources of a
+ * resources.arsc, read from its ResTable once: the type and name of each
+ * resource, the resources that its values refer to across all
+ * configurations, and the strings among its values.
+ *
+ * Everything is kept in flat arrays indexed by the position of the id in the
+ * sorted list of ids, so that a query is a walk over arrays rather than a
+ * series of ResTable lookups. The index can be written to a file and read
+ * back by a later stage, as long as resources.arsc doesn't change in
+ * between. Reading a file that isn't an index throws std::runtime_error.
+ */
+class ResourceIndex {
+ public:
+  static ResourceIndex build(const android::ResTable& table);
+
+  static ResourceIndex read(const std::string& path);
+  void write(const std::string& path) const;
+
+  // Sorted.
+  const std::vector<uint32_t>& ids() const { return m_ids; }
+
+  bool contains(uint32_t id) const { return position_of(id) != kNone; }
+
+  // Empty for the ids that aren't in the index.
+  const std::string& type_name(uint32_t id) const;
+  const std::string& name(uint32_t id) const;
+
+  // The ids of each resource name, as get_js_resources_by_parsing() takes
+  // them.
+  std::map<std::string, std::vector<uint32_t>> name_to_ids() const;
+
+  // The ids of the resources whose name starts with one of the prefixes.
+  std::unordered_set<uint32_t> ids_by_name_prefix(
+      const std::vector<std::string>& prefixes) const;
+
+  /*
+   * Like walk_references_for_resource(): adds `id` and all the resources
+   * that it refers to, directly or not, to `nodes_visited`, and the strings
+   * that they hold to `leaf_string_values`. Resources already in
+   * `nodes_visited` are not walked again, so that calls can share it.
+   */
+  void walk_references(uint32_t id,
+                       std::unordered_set<uint32_t>& nodes_visited,
+                       std::unordered_set<std::string>& leaf_string_values) const;
+
+  bool operator==(const ResourceIndex& that) const;
+
+ private:
+  static constexpr uint32_t kNone = 0xffffffff;
+
+  uint32_t position_of(uint32_t id) const;
+
+  std::vector<uint32_t> m_ids;
+  // Indices into m_strings.
+  std::vector<uint32_t> m_type_names;
+  std::vector<uint32_t> m_names;
+  // The references of the resource at position i are the ids in
+  // m_references[m_reference_offsets[i]] to
+  // m_references[m_reference_offsets[i + 1]], which may or may not be in the
+  // index. Its strings are laid out the same way, as indices into m_strings.
+  std::vector<uint32_t> m_reference_offsets;
+  std::vector<uint32_t> m_references;
+  std::vector<uint32_t> m_string_offsets;
+  std::vector<uint32_t> m_string_values;
+  // Each distinct type name, name and string value once.
+  std::vector<std::string> m_strings;
+};
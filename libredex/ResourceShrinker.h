@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+
+/*
+ * Removes resources from a resources.arsc, and the strings that only they
+ * used. The entries of the other resources keep their ids: the slots of the
+ * removed ones are left empty, and the configurations of a type that are left
+ * without any entry are dropped.
+ *
+ * The key strings of each package and the value strings of the table are
+ * compacted, keeping the order, and the styles, of the strings that are
+ * left. The type strings are kept as they are, since the index of a type is
+ * part of the ids of its resources.
+ *
+ * The table is read and written in one pass over its chunks, after a first
+ * one to find what the remaining entries use. Chunks it doesn't know about
+ * are copied as they are.
+ */
+namespace resource_shrinker {
+
+struct Stats {
+  size_t resources_removed{0};
+  size_t key_strings_removed{0};
+  size_t value_strings_removed{0};
+};
+
+/*
+ * Writes the table in `data` to `out`, without the resources that aren't in
+ * `kept`. Returns false, having written nothing, if the table can't be read,
+ * or uses a layout that isn't supported, like sparse types.
+ */
+bool shrink(const void* data,
+            size_t size,
+            const std::unordered_set<uint32_t>& kept,
+            std::string* out,
+            Stats* stats);
+
+} // namespace resource_shrinker
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "SSA.h"
+
+#include <algorithm>
+
+#include "IRCode.h"
+
+namespace ssa {
+
+SSAForm::SSAForm(const ControlFlowGraph& cfg)
+    : m_dominators(cfg.dominators()) {
+  make_value(0, nullptr, nullptr, nullptr);
+  size_t num_ids = 0;
+  size_t num_regs = 0;
+  for (auto* b : cfg.blocks()) {
+    num_ids = std::max(num_ids, b->id() + 1);
+    for (const auto& mie : InstructionIterable(*b)) {
+      auto insn = mie.insn;
+      if (insn->dests_size()) {
+        num_regs = std::max(num_regs, size_t(insn->dest()) + 1);
+      }
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        num_regs = std::max(num_regs, size_t(insn->src(i)) + 1);
+      }
+    }
+  }
+  m_block_phis.resize(num_ids);
+  place_phis(m_dominators->reverse_postorder(), num_regs);
+  rename(num_regs);
+}
+
+ValueId SSAForm::make_value(uint16_t reg,
+                            Block* block,
+                            IRInstruction* insn,
+                            Phi* phi) {
+  m_values.push_back(Value{reg, block, insn, phi, {}});
+  return m_values.size() - 1;
+}
+
+void SSAForm::add_use(ValueId v, IRInstruction* insn, Phi* phi, size_t operand) {
+  m_values[v].uses.push_back(Use{insn, phi, operand});
+}
+
+void SSAForm::place_phis(const std::vector<Block*>& blocks, size_t num_regs) {
+  // The blocks that write each register, and whether the register is read
+  // before being written in some block. Only those registers can need phis.
+  std::vector<std::vector<Block*>> def_blocks(num_regs);
+  std::vector<bool> live_across(num_regs);
+  std::vector<bool> written(num_regs);
+  for (auto* b : blocks) {
+    std::fill(written.begin(), written.end(), false);
+    for (const auto& mie : InstructionIterable(*b)) {
+      auto insn = mie.insn;
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        if (!written[insn->src(i)]) {
+          live_across[insn->src(i)] = true;
+        }
+      }
+      if (insn->dests_size()) {
+        auto reg = insn->dest();
+        if (!written[reg]) {
+          written[reg] = true;
+          def_blocks[reg].push_back(b);
+        }
+      }
+    }
+  }
+
+  // Place the phis of each register at the iterated dominance frontier of
+  // its definitions.
+  std::vector<uint32_t> has_phi(m_block_phis.size(), 0);
+  std::vector<uint32_t> on_worklist(m_block_phis.size(), 0);
+  std::vector<Block*> worklist;
+  for (size_t reg = 0; reg < num_regs; ++reg) {
+    if (!live_across[reg]) {
+      continue;
+    }
+    // Tag the blocks with reg + 1 rather than clearing the side tables for
+    // every register.
+    uint32_t tag = reg + 1;
+    for (auto* b : def_blocks[reg]) {
+      on_worklist[b->id()] = tag;
+      worklist.push_back(b);
+    }
+    while (!worklist.empty()) {
+      auto* b = worklist.back();
+      worklist.pop_back();
+      for (auto* df : m_dominators->frontier(b)) {
+        if (has_phi[df->id()] == tag) {
+          continue;
+        }
+        has_phi[df->id()] = tag;
+        m_phis.emplace_back(new Phi{df, uint16_t(reg), UNDEFINED, {}});
+        auto phi = m_phis.back().get();
+        phi->value = make_value(reg, df, nullptr, phi);
+        m_block_phis[df->id()].push_back(phi);
+        if (on_worklist[df->id()] != tag) {
+          on_worklist[df->id()] = tag;
+          worklist.push_back(df);
+        }
+      }
+    }
+  }
+}
+
+void SSAForm::rename(size_t num_regs) {
+  // The current value of each register along the walk of the dominator tree.
+  std::vector<std::vector<ValueId>> stacks(num_regs);
+  auto current = [&](uint16_t reg) {
+    return stacks[reg].empty() ? UNDEFINED : stacks[reg].back();
+  };
+  // The phis that the throw edges out of the current block feed.
+  std::vector<std::pair<const cfg::Edge*, Phi*>> throw_phis;
+  auto add_arg = [&](Phi* phi, const cfg::Edge* edge, ValueId v) {
+    add_use(v, nullptr, phi, phi->args.size());
+    phi->args.emplace_back(edge, v);
+  };
+
+  struct Frame {
+    Block* block;
+    size_t next_child;
+    // The registers that the block pushed values for.
+    std::vector<uint16_t> pushed;
+  };
+  auto entry = m_dominators->reverse_postorder().empty()
+                   ? nullptr
+                   : m_dominators->reverse_postorder().front();
+  std::vector<Frame> frames;
+  if (entry != nullptr) {
+    frames.push_back(Frame{entry, 0, {}});
+  }
+  bool entering = true;
+  while (!frames.empty()) {
+    auto& frame = frames.back();
+    auto* b = frame.block;
+    if (entering) {
+      for (auto* phi : phis(b)) {
+        stacks[phi->reg].push_back(phi->value);
+        frame.pushed.push_back(phi->reg);
+      }
+      throw_phis.clear();
+      for (const auto& succ : b->succs()) {
+        if (succ->type() != EDGE_THROW) {
+          continue;
+        }
+        for (auto* phi : phis(succ->target())) {
+          throw_phis.emplace_back(succ.get(), phi);
+          add_arg(phi, succ.get(), current(phi->reg));
+        }
+      }
+      for (auto& mie : InstructionIterable(*b)) {
+        auto insn = mie.insn;
+        m_use_offsets[insn] = m_uses.size();
+        for (size_t i = 0; i < insn->srcs_size(); ++i) {
+          auto v = current(insn->src(i));
+          m_uses.push_back(v);
+          add_use(v, insn, nullptr, i);
+        }
+        if (insn->dests_size()) {
+          auto reg = insn->dest();
+          auto v = make_value(reg, b, insn, nullptr);
+          m_defs[insn] = v;
+          stacks[reg].push_back(v);
+          frame.pushed.push_back(reg);
+          for (const auto& pair : throw_phis) {
+            if (pair.second->reg == reg) {
+              add_arg(pair.second, pair.first, v);
+            }
+          }
+        }
+      }
+      for (const auto& succ : b->succs()) {
+        if (succ->type() == EDGE_THROW) {
+          continue;
+        }
+        for (auto* phi : phis(succ->target())) {
+          add_arg(phi, succ.get(), current(phi->reg));
+        }
+      }
+    }
+    const auto& children = m_dominators->children(b);
+    if (frame.next_child < children.size()) {
+      auto* child = children[frame.next_child++];
+      frames.push_back(Frame{child, 0, {}});
+      entering = true;
+      continue;
+    }
+    for (auto reg : frame.pushed) {
+      stacks[reg].pop_back();
+    }
+    frames.pop_back();
+    entering = false;
+  }
+}
+
+} // namespace ssa
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "ControlFlow.h"
+#include "IRInstruction.h"
+
+namespace ssa {
+
+/*
+ * A value is an SSA name: a register of a single definition, which is an
+ * instruction or a phi node. Value 0 is what registers that nothing defines
+ * on some path hold, e.g. at the entry of a method without load-params.
+ */
+using ValueId = uint32_t;
+constexpr ValueId UNDEFINED = 0;
+
+struct Phi;
+
+/*
+ * An operand that reads a value: source `operand` of `insn`, or argument
+ * `operand` of `phi` when insn is null.
+ */
+struct Use {
+  IRInstruction* insn;
+  Phi* phi;
+  size_t operand;
+};
+
+struct Value {
+  uint16_t reg;
+  // The block of the definition, null for UNDEFINED.
+  Block* block;
+  // The defining instruction, null for phis and UNDEFINED.
+  IRInstruction* insn;
+  Phi* phi;
+  std::vector<Use> uses;
+};
+
+/*
+ * Joins the values that a register has on the edges into a block. A goto or
+ * branch edge brings the value at the end of its source block. Since an
+ * exception can be thrown half way through a block, a throw edge brings each
+ * value that the register has in its source block instead, from the one at
+ * its start on.
+ */
+struct Phi {
+  Block* block;
+  uint16_t reg;
+  ValueId value;
+  std::vector<std::pair<const cfg::Edge*, ValueId>> args;
+};
+
+/*
+ * A semi-pruned SSA view of a ControlFlowGraph: phi nodes are placed at the
+ * iterated dominance frontiers of the definitions of the registers that are
+ * read in some block before being written there, and every value knows its
+ * uses. Sparse analyses can then follow the def-use chains instead of
+ * iterating over every block.
+ *
+ * The view doesn't rewrite the instructions, and only covers the blocks that
+ * are reachable from the entry. A wide value is named by its first register.
+ * It uses the dominator tree that the CFG caches, but is a snapshot of the
+ * instructions: build it again after changing them.
+ */
+class SSAForm {
+ public:
+  explicit SSAForm(const ControlFlowGraph& cfg);
+
+  SSAForm(const SSAForm&) = delete;
+  SSAForm& operator=(const SSAForm&) = delete;
+
+  const cfg::DominatorTree& dominators() const { return *m_dominators; }
+
+  size_t num_values() const { return m_values.size(); }
+  const Value& value(ValueId v) const { return m_values.at(v); }
+  const std::vector<Use>& uses(ValueId v) const { return m_values.at(v).uses; }
+
+  // The value that insn defines, UNDEFINED if it has no dest or is in an
+  // unreachable block.
+  ValueId def(const IRInstruction* insn) const {
+    auto it = m_defs.find(insn);
+    return it == m_defs.end() ? UNDEFINED : it->second;
+  }
+
+  // The value that source i of insn reads.
+  ValueId use(const IRInstruction* insn, size_t i) const {
+    auto it = m_use_offsets.find(insn);
+    return it == m_use_offsets.end() ? UNDEFINED : m_uses[it->second + i];
+  }
+
+  const std::vector<Phi*>& phis(const Block* b) const {
+    return b->id() < m_block_phis.size() ? m_block_phis[b->id()] : m_no_phis;
+  }
+
+  size_t num_phis() const { return m_phis.size(); }
+
+ private:
+  void place_phis(const std::vector<Block*>& blocks, size_t num_regs);
+  void rename(size_t num_regs);
+
+  ValueId make_value(uint16_t reg, Block* block, IRInstruction* insn, Phi* phi);
+  void add_use(ValueId v, IRInstruction* insn, Phi* phi, size_t operand);
+
+  std::shared_ptr<const cfg::DominatorTree> m_dominators;
+  std::vector<Value> m_values;
+  std::vector<std::unique_ptr<Phi>> m_phis;
+  // Indexed by block id.
+  std::vector<std::vector<Phi*>> m_block_phis;
+  std::vector<Phi*> m_no_phis;
+  std::unordered_map<const IRInstruction*, ValueId> m_defs;
+  // The values read by each instruction start at its offset in m_uses.
+  std::unordered_map<const IRInstruction*, uint32_t> m_use_offsets;
+  std::vector<ValueId> m_uses;
+};
+
+} // namespace ssa
@@ -17,17 +17,20 @@
 #include <iomanip>
 #include <istream>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <ostream>
 #include <sstream>
-#include <stack>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/functional/hash.hpp>
 #include <boost/functional/hash_fwd.hpp>
 #include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
 
+#include "Arena.h"
 #include "Debug.h"
 
 namespace s_expr_impl {
@@ -73,11 +76,14 @@ class Pattern;
  *   auto e3 = s_expr({s_expr("l2"), e1});
  *
  * The disposal of S-expressions is managed by shared pointers under the hood.
+ * The nodes that s_expr_istream parses live in an arena of the parser's, which
+ * goes away with the last of them.
  */
 class s_expr final {
  public:
   /*
-   * The default constructor returns the empty list `()`.
+   * The default constructor returns the empty list `()`. All the empty lists
+   * made this way share one node, so it doesn't allocate.
    */
   s_expr();
 
@@ -170,8 +176,8 @@ class s_expr final {
   std::string str() const;
 
  private:
-  // Appends an element to a list. This operation is used during parsing.
-  void add_element(const s_expr& element);
+  explicit s_expr(std::shared_ptr<s_expr_impl::Component> component)
+      : m_component(std::move(component)) {}
 
   // By construction, m_component can never be null.
   std::shared_ptr<s_expr_impl::Component> m_component;
@@ -223,7 +229,11 @@ class s_expr_istream final {
   s_expr_istream& operator=(const s_expr_istream&) = delete;
 
   s_expr_istream(std::istream& input)
-      : m_input(input), m_status(Status::Good), m_what("OK") {}
+      : m_input(input),
+        m_status(Status::Good),
+        m_what("OK"),
+        // Small chunks, as most inputs are a few lines of test IR.
+        m_arena(std::make_shared<Arena>(16 << 10)) {}
 
   s_expr_istream& operator>>(s_expr& expr);
 
@@ -255,10 +265,37 @@ class s_expr_istream final {
 
   void set_status(Status status, const std::string& what_arg);
 
-  std::stack<s_expr> m_stack;
+  // Allocates a node in the arena, along with its reference count.
+  template <class Node, class... Args>
+  s_expr make_node(Args&&... args);
+
+  // Returns the string atom for s. The same string always gets the same
+  // atom, so that a symbol repeated throughout the input is stored once.
+  s_expr intern(const std::string& s);
+
+  // Hands a parsed S-expression to the list being parsed, if any. Returns
+  // true if it was a whole S-expression instead.
+  bool add_element(const s_expr& element, s_expr& expr);
+
+  struct StringRefHash {
+    size_t operator()(boost::string_ref s) const {
+      return boost::hash_range(s.begin(), s.end());
+    }
+  };
+
   std::istream& m_input;
   Status m_status;
   std::string m_what;
+  std::shared_ptr<Arena> m_arena;
+  // The elements of all the lists being parsed, outermost first, and where
+  // each list starts. A list is only made once it is complete, with exactly
+  // the elements it needs.
+  std::vector<s_expr> m_elements;
+  std::vector<size_t> m_list_starts;
+  // The keys point into the string of their atom.
+  std::unordered_map<boost::string_ref, s_expr, StringRefHash> m_symbols;
+  // Reused to read each string atom.
+  std::string m_token;
 };
 
 /*
@@ -496,8 +533,6 @@ class List final : public Component {
     return s_expr(std::next(m_list.begin(), index), m_list.end());
   }
 
-  void add_element(const s_expr& element) { m_list.push_back(element); }
-
   bool equals(const std::shared_ptr<Component>& other) const {
     if (this == other.get()) {
       // Since S-expressions can share structure, checking for pointer equality
@@ -537,6 +572,44 @@ class List final : public Component {
   std::vector<s_expr> m_list;
 };
 
+/*
+ * Allocates the nodes of a parser from its arena. Each node holds on to the
+ * arena, so that the arena lives as long as any of them. Freeing a node does
+ * nothing, its memory goes back with the arena.
+ */
+template <class T>
+class NodeAllocator {
+ public:
+  using value_type = T;
+
+  explicit NodeAllocator(std::shared_ptr<Arena> arena)
+      : m_arena(std::move(arena)) {}
+
+  template <class U>
+  NodeAllocator(const NodeAllocator<U>& that) : m_arena(that.arena()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t) {}
+
+  const std::shared_ptr<Arena>& arena() const { return m_arena; }
+
+  template <class U>
+  bool operator==(const NodeAllocator<U>& that) const {
+    return m_arena == that.arena();
+  }
+
+  template <class U>
+  bool operator!=(const NodeAllocator<U>& that) const {
+    return m_arena != that.arena();
+  }
+
+ private:
+  std::shared_ptr<Arena> m_arena;
+};
+
 class Pattern {
  public:
   virtual ~Pattern() {}
@@ -642,7 +715,10 @@ class ListPattern final : public Pattern {
 
 } // namespace s_expr_impl
 
-inline s_expr::s_expr() : m_component(std::make_shared<s_expr_impl::List>()) {}
+inline s_expr::s_expr() {
+  static const auto nil = std::make_shared<s_expr_impl::List>();
+  m_component = nil;
+}
 
 inline s_expr::s_expr(int32_t n)
     : m_component(std::make_shared<s_expr_impl::Int32Atom>(n)) {}
@@ -725,17 +801,11 @@ inline std::string s_expr::str() const {
   return out.str();
 }
 
-inline void s_expr::add_element(const s_expr& element) {
-  always_assert(m_component->kind() == s_expr_impl::ComponentKind::List);
-  auto list = std::static_pointer_cast<s_expr_impl::List>(m_component);
-  list->add_element(element);
-}
-
 inline s_expr_istream& s_expr_istream::operator>>(s_expr& expr) {
   for (;;) {
     skip_white_spaces();
     if (!m_input.good()) {
-      if (!m_stack.empty()) {
+      if (!m_list_starts.empty()) {
         set_status(Status::Fail, "Incomplete S-expression");
       } else {
         set_status(Status::EOI, "End of input");
@@ -745,23 +815,25 @@ inline s_expr_istream& s_expr_istream::operator>>(s_expr& expr) {
     char next_char = m_input.peek();
     switch (next_char) {
     case '(': {
-      m_stack.emplace();
+      m_list_starts.push_back(m_elements.size());
       m_input.get();
       break;
     }
     case ')': {
-      if (m_stack.empty()) {
+      if (m_list_starts.empty()) {
         set_status(Status::Fail, "Extra ')' encountered");
         return *this;
       }
       m_input.get();
-      s_expr list = m_stack.top();
-      m_stack.pop();
-      if (m_stack.empty()) {
-        expr = list;
+      auto first = m_elements.begin() + m_list_starts.back();
+      s_expr list = first == m_elements.end()
+                        ? s_expr()
+                        : make_node<s_expr_impl::List>(first, m_elements.end());
+      m_elements.erase(first, m_elements.end());
+      m_list_starts.pop_back();
+      if (add_element(list, expr)) {
         return *this;
       }
-      m_stack.top().add_element(list);
       break;
     }
     case '#': {
@@ -772,27 +844,20 @@ inline s_expr_istream& s_expr_istream::operator>>(s_expr& expr) {
         set_status(Status::Fail, "Error parsing int32_t literal");
         return *this;
       }
-      s_expr atom(n);
-      if (m_stack.empty()) {
-        expr = atom;
+      if (add_element(make_node<s_expr_impl::Int32Atom>(n), expr)) {
         return *this;
       }
-      m_stack.top().add_element(atom);
       break;
     }
     case '"': {
-      std::string s;
-      m_input >> std::quoted(s);
+      m_input >> std::quoted(m_token);
       if (m_input.fail()) {
         set_status(Status::Fail, "Error parsing string literal");
         return *this;
       }
-      s_expr atom(s);
-      if (m_stack.empty()) {
-        expr = atom;
+      if (add_element(intern(m_token), expr)) {
         return *this;
       }
-      m_stack.top().add_element(atom);
       break;
     }
     case ';': {
@@ -807,23 +872,45 @@ inline s_expr_istream& s_expr_istream::operator>>(s_expr& expr) {
         set_status(Status::Fail, out.str());
         return *this;
       }
-      std::ostringstream symbol;
+      m_token.clear();
       while (m_input.good() && s_expr_impl::is_symbol_char(next_char)) {
-        symbol << next_char;
+        m_token.push_back(next_char);
         m_input.get();
         next_char = m_input.peek();
       }
-      s_expr atom(symbol.str());
-      if (m_stack.empty()) {
-        expr = atom;
+      if (add_element(intern(m_token), expr)) {
         return *this;
       }
-      m_stack.top().add_element(atom);
     }
     }
   }
 }
 
+template <class Node, class... Args>
+inline s_expr s_expr_istream::make_node(Args&&... args) {
+  return s_expr(std::allocate_shared<Node>(
+      s_expr_impl::NodeAllocator<Node>(m_arena), std::forward<Args>(args)...));
+}
+
+inline s_expr s_expr_istream::intern(const std::string& s) {
+  auto it = m_symbols.find(boost::string_ref(s));
+  if (it != m_symbols.end()) {
+    return it->second;
+  }
+  auto atom = make_node<s_expr_impl::StringAtom>(s);
+  m_symbols.emplace(boost::string_ref(atom.get_string()), atom);
+  return atom;
+}
+
+inline bool s_expr_istream::add_element(const s_expr& element, s_expr& expr) {
+  if (m_list_starts.empty()) {
+    expr = element;
+    return true;
+  }
+  m_elements.push_back(element);
+  return false;
+}
+
 inline void s_expr_istream::skip_white_spaces() {
   for (;;) {
     char c = m_input.peek();
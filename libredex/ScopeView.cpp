@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ScopeView.h"
+
+#include "Debug.h"
+#include "Show.h"
+
+ScopeView::Stamp ScopeView::stamp() const {
+  Stamp stamp;
+  for (auto& store : m_stores) {
+    for (const auto& dex : store.get_dexen()) {
+      stamp.emplace_back(dex.data(), dex.size());
+    }
+  }
+  return stamp;
+}
+
+void ScopeView::refresh_locked() {
+  auto current = stamp();
+  if (m_scope != nullptr && current == m_stamp) {
+    return;
+  }
+  auto scope = std::make_shared<Scope>();
+  m_locations.clear();
+  m_positions.clear();
+  for (size_t store_idx = 0; store_idx < m_stores.size(); ++store_idx) {
+    const auto& dexen = m_stores[store_idx].get_dexen();
+    for (size_t dex_idx = 0; dex_idx < dexen.size(); ++dex_idx) {
+      const auto& dex = dexen[dex_idx];
+      scope->insert(scope->end(), dex.begin(), dex.end());
+      m_locations.insert(
+          m_locations.end(), dex.size(), Location{store_idx, dex_idx});
+    }
+  }
+  m_scope = std::move(scope);
+  m_stamp = std::move(current);
+  ++m_version;
+}
+
+std::shared_ptr<const Scope> ScopeView::get() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  refresh_locked();
+  return m_scope;
+}
+
+ScopeView::Location ScopeView::get_location(const DexClass* cls) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  refresh_locked();
+  if (m_positions.empty()) {
+    for (size_t i = 0; i < m_scope->size(); ++i) {
+      m_positions.emplace((*m_scope)[i], i);
+    }
+  }
+  auto it = m_positions.find(cls);
+  always_assert_log(
+      it != m_positions.end(), "%s isn't in any store", SHOW(cls));
+  return m_locations[it->second];
+}
+
+size_t ScopeView::version() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  refresh_locked();
+  return m_version;
+}
+
+void ScopeView::invalidate() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  m_scope.reset();
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "DexClass.h"
+#include "DexStore.h"
+
+/*
+ * The classes of all the stores in one flat list, in the order of
+ * build_class_scope(), kept from one use to the next instead of being
+ * flattened again each time.
+ *
+ * The view notices when classes are added to or removed from a dex, or dexes
+ * and stores come and go: it remembers the buffer and the size of each dex,
+ * and rebuilds the list when any of them changed. Code that replaces classes
+ * of a dex in place, without changing its size, must call invalidate().
+ *
+ * get() hands out a snapshot, which stays valid for whoever holds it even
+ * after the view has moved on.
+ */
+class ScopeView {
+ public:
+  struct Location {
+    size_t store;
+    size_t dex;
+  };
+
+  explicit ScopeView(DexStoresVector& stores) : m_stores(stores) {}
+
+  std::shared_ptr<const Scope> get();
+
+  // The store and the dex of a class of the scope.
+  Location get_location(const DexClass* cls);
+
+  // Changes every time the list is rebuilt.
+  size_t version();
+
+  void invalidate();
+
+ private:
+  using Stamp = std::vector<std::pair<DexClass* const*, size_t>>;
+
+  Stamp stamp() const;
+  void refresh_locked();
+
+  DexStoresVector& m_stores;
+  std::mutex m_lock;
+  Stamp m_stamp;
+  std::shared_ptr<const Scope> m_scope;
+  // Where each class of m_scope lives, by its position in it.
+  std::vector<Location> m_locations;
+  // The position of each class, built on first use.
+  std::unordered_map<const DexClass*, size_t> m_positions;
+  size_t m_version{0};
+};
@@ -879,18 +879,14 @@ std::string show(const DexDebugInstruction* insn) {
   case DBG_ADVANCE_LINE:
     ss << "DBG_ADVANCE_LINE " << insn->value();
     break;
-  case DBG_START_LOCAL: {
-    auto sl = static_cast<const DexDebugOpcodeStartLocal*>(insn);
-    ss << "DBG_START_LOCAL v" << sl->uvalue() << " " << show(sl->name())
-        << ":" << show(sl->type());
+  case DBG_START_LOCAL:
+    ss << "DBG_START_LOCAL v" << insn->uvalue() << " " << show(insn->name())
+        << ":" << show(insn->type());
     break;
-  }
-  case DBG_START_LOCAL_EXTENDED: {
-    auto sl = static_cast<const DexDebugOpcodeStartLocal*>(insn);
-    ss << "DBG_START_LOCAL v" << sl->uvalue() << " " << show(sl->name())
-        << ":" << show(sl->type()) << ";" << show(sl->sig());
+  case DBG_START_LOCAL_EXTENDED:
+    ss << "DBG_START_LOCAL v" << insn->uvalue() << " " << show(insn->name())
+        << ":" << show(insn->type()) << ";" << show(insn->sig());
     break;
-  }
   case DBG_END_LOCAL:
     ss << "DBG_END_LOCAL v" << insn->uvalue();
     break;
@@ -903,11 +899,9 @@ std::string show(const DexDebugInstruction* insn) {
   case DBG_SET_EPILOGUE_BEGIN:
     ss << "DBG_SET_EPILOGUE_BEGIN";
     break;
-  case DBG_SET_FILE: {
-    auto sf = static_cast<const DexDebugOpcodeSetFile*>(insn);
-    ss << "DBG_SET_FILE " << show(sf->file());
+  case DBG_SET_FILE:
+    ss << "DBG_SET_FILE " << show(insn->file());
     break;
-  }
   default: {
     auto adjusted_opcode = insn->opcode() - DBG_FIRST_SPECIAL;
     auto line = DBG_LINE_BASE + (adjusted_opcode % DBG_LINE_RANGE);
@@ -929,7 +923,7 @@ std::string show(const DexDebugEntry* entry) {
   ss << std::hex;
   switch (entry->type) {
     case DexDebugEntryType::Instruction:
-      ss << "INSTRUCTION: [0x" << entry->addr << "] " << show(entry->insn);
+      ss << "INSTRUCTION: [0x" << entry->addr << "] " << show(&entry->insn);
       break;
     case DexDebugEntryType::Position:
       ss << "POSITION: [0x" << entry->addr << "] " << show(entry->pos);
@@ -980,7 +974,7 @@ std::string show(const MethodItemEntry& mei) {
     ss << "CATCH: " << show(mei.centry->catch_type);
     return ss.str();
   case MFLOW_DEBUG:
-    ss << "DEBUG: " << show(mei.dbgop);
+    ss << "DEBUG: " << show(&mei.dbgop);
     return ss.str();
   case MFLOW_POSITION:
     ss << "POSITION: " << show(mei.pos);
@@ -0,0 +1,484 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "SideEffectSummaries.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "ReachableClasses.h"
+#include "Resolver.h"
+#include "Timer.h"
+#include "WorkQueue.h"
+
+using namespace side_effects;
+
+namespace {
+
+// What an object operand refers to, as far as a flow insensitive look at the
+// registers can tell.
+enum class Receiver { OTHER, THIS, FRESH };
+
+struct Call {
+  uint32_t callee;
+  Receiver receiver;
+};
+
+struct LocalSummary {
+  // The effects of the instructions other than the calls to the summarized
+  // methods.
+  Effects effects{NONE};
+  std::vector<Call> calls;
+};
+
+Effects at_call_site(Effects effects, Receiver receiver) {
+  if (effects & WRITES_RECEIVER) {
+    effects &= ~WRITES_RECEIVER;
+    if (receiver == Receiver::THIS) {
+      effects |= WRITES_RECEIVER;
+    } else if (receiver == Receiver::OTHER) {
+      effects |= WRITES;
+    }
+  }
+  return effects;
+}
+
+/*
+ * Classifies the registers of a method that only one instruction writes: the
+ * receiver of an instance method, and the objects it allocates.
+ */
+class Registers {
+ public:
+  explicit Registers(const DexMethod* method) {
+    std::unordered_map<uint16_t, size_t> writes;
+    std::unordered_map<uint16_t, const IRInstruction*> defs;
+    const IRInstruction* this_def = nullptr;
+    const IRInstruction* prev = nullptr;
+    std::unordered_set<const IRInstruction*> fresh_defs;
+    for (const auto& mie : InstructionIterable(method->get_code())) {
+      auto insn = mie.insn;
+      auto op = insn->opcode();
+      if (this_def == nullptr && !is_static(method) &&
+          opcode::is_load_param(op)) {
+        this_def = insn;
+      }
+      if (prev != nullptr &&
+          (op == IOPCODE_MOVE_RESULT_PSEUDO_OBJECT ||
+           op == OPCODE_MOVE_RESULT_OBJECT) &&
+          (prev->opcode() == OPCODE_NEW_INSTANCE ||
+           prev->opcode() == OPCODE_NEW_ARRAY ||
+           prev->opcode() == OPCODE_FILLED_NEW_ARRAY)) {
+        fresh_defs.emplace(insn);
+      }
+      if (insn->dests_size()) {
+        ++writes[insn->dest()];
+        defs[insn->dest()] = insn;
+        if (insn->dest_is_wide()) {
+          ++writes[insn->dest() + 1];
+        }
+      }
+      prev = insn;
+    }
+    for (const auto& pair : writes) {
+      if (pair.second != 1) {
+        continue;
+      }
+      auto it = defs.find(pair.first);
+      if (it == defs.end()) {
+        continue;
+      }
+      if (it->second == this_def) {
+        m_kinds.emplace(pair.first, Receiver::THIS);
+      } else if (fresh_defs.count(it->second)) {
+        m_kinds.emplace(pair.first, Receiver::FRESH);
+      }
+    }
+  }
+
+  Receiver kind(uint16_t reg) const {
+    auto it = m_kinds.find(reg);
+    return it == m_kinds.end() ? Receiver::OTHER : it->second;
+  }
+
+ private:
+  std::unordered_map<uint16_t, Receiver> m_kinds;
+};
+
+Effects write_effects(Receiver receiver) {
+  switch (receiver) {
+  case Receiver::FRESH:
+    return NONE;
+  case Receiver::THIS:
+    return WRITES_RECEIVER;
+  case Receiver::OTHER:
+    return WRITES;
+  }
+  not_reached();
+}
+
+// Whether initializing `cls` is already done by the time a method of
+// `caller` runs: it is the class of the caller or one of its super classes.
+bool is_initialized_in(const DexType* cls, const DexType* caller) {
+  for (auto type = caller; type != nullptr;) {
+    if (type == cls) {
+      return true;
+    }
+    auto caller_cls = type_class(type);
+    type = caller_cls == nullptr ? nullptr : caller_cls->get_super_class();
+  }
+  return false;
+}
+
+// Every constructor ends up calling this one, which does nothing.
+bool is_object_init(const DexMethod* method) {
+  return method->get_class() == get_object_type() && is_init(method);
+}
+
+/*
+ * Tarjan's algorithm, without recursion. Returns the strongly connected
+ * components in reverse topological order: each one after all the ones it
+ * calls.
+ */
+std::vector<std::vector<uint32_t>> find_sccs(
+    const std::vector<LocalSummary>& summaries) {
+  const uint32_t UNVISITED = std::numeric_limits<uint32_t>::max();
+  size_t n = summaries.size();
+  std::vector<uint32_t> index(n, UNVISITED);
+  std::vector<uint32_t> lowlink(n, 0);
+  std::vector<bool> on_stack(n, false);
+  std::vector<uint32_t> stack;
+  std::vector<std::vector<uint32_t>> sccs;
+  // The node and the next call to look at.
+  std::vector<std::pair<uint32_t, size_t>> frames;
+  uint32_t next_index = 0;
+  for (uint32_t root = 1; root < n; ++root) {
+    if (index[root] != UNVISITED) {
+      continue;
+    }
+    frames.emplace_back(root, 0);
+    index[root] = lowlink[root] = next_index++;
+    stack.push_back(root);
+    on_stack[root] = true;
+    while (!frames.empty()) {
+      auto node = frames.back().first;
+      auto& next_call = frames.back().second;
+      const auto& calls = summaries[node].calls;
+      if (next_call < calls.size()) {
+        auto callee = calls[next_call++].callee;
+        if (index[callee] == UNVISITED) {
+          index[callee] = lowlink[callee] = next_index++;
+          stack.push_back(callee);
+          on_stack[callee] = true;
+          frames.emplace_back(callee, 0);
+        } else if (on_stack[callee]) {
+          lowlink[node] = std::min(lowlink[node], index[callee]);
+        }
+        continue;
+      }
+      frames.pop_back();
+      if (!frames.empty()) {
+        auto parent = frames.back().first;
+        lowlink[parent] = std::min(lowlink[parent], lowlink[node]);
+      }
+      if (lowlink[node] == index[node]) {
+        sccs.emplace_back();
+        uint32_t member;
+        do {
+          member = stack.back();
+          stack.pop_back();
+          on_stack[member] = false;
+          sccs.back().push_back(member);
+        } while (member != node);
+      }
+    }
+  }
+  return sccs;
+}
+
+} // namespace
+
+SideEffectSummaries::SideEffectSummaries(const Scope& scope)
+    : SideEffectSummaries(scope, devirtualize(scope)) {}
+
+SideEffectSummaries::SideEffectSummaries(
+    const Scope& scope, const std::vector<DexMethod*>& non_virtual)
+    : m_non_virtual(non_virtual.begin(), non_virtual.end()) {
+  summarize(scope);
+}
+
+const DexMethod* SideEffectSummaries::resolve_callee(
+    const IRInstruction* insn) const {
+  auto callee =
+      resolve_method_cached(insn->get_method(), opcode_to_search(insn));
+  if (callee == nullptr) {
+    return nullptr;
+  }
+  auto op = insn->opcode();
+  if ((op == OPCODE_INVOKE_VIRTUAL || op == OPCODE_INVOKE_INTERFACE) &&
+      callee->is_virtual() && !m_non_virtual.count(callee)) {
+    return nullptr;
+  }
+  return callee;
+}
+
+Effects SideEffectSummaries::get_invoke(const IRInstruction* insn) const {
+  auto callee = resolve_callee(insn);
+  if (callee == nullptr) {
+    return UNKNOWN;
+  }
+  if (is_object_init(callee)) {
+    return NONE;
+  }
+  if (assumenosideeffects(callee)) {
+    return READS;
+  }
+  return get(callee);
+}
+
+void SideEffectSummaries::summarize(const Scope& scope) {
+  Timer t("Summarizing side effects");
+  m_methods.push_back(nullptr);
+  for (const auto* cls : scope) {
+    for (auto* method : cls->get_dmethods()) {
+      if (method->get_code() != nullptr) {
+        m_ids[method] = m_methods.size();
+        m_methods.push_back(method);
+      }
+    }
+    for (auto* method : cls->get_vmethods()) {
+      if (method->get_code() != nullptr) {
+        m_ids[method] = m_methods.size();
+        m_methods.push_back(method);
+      }
+    }
+  }
+
+  std::vector<LocalSummary> locals(m_methods.size());
+  auto wq = workqueue_foreach<uint32_t>([&](uint32_t id) {
+    auto method = m_methods[id];
+    auto& local = locals[id];
+    Registers registers(method);
+    auto call = [&](const DexMethod* callee, Receiver receiver) {
+      auto callee_id = m_ids.at(callee);
+      if (callee_id == 0) {
+        local.effects |= UNKNOWN;
+      } else {
+        local.calls.push_back(Call{callee_id, receiver});
+      }
+    };
+    // Runs the static initializers that accessing `type` may run.
+    auto initialize = [&](const DexType* type) {
+      for (; type != nullptr && !is_initialized_in(type, method->get_class());
+           type = type_class(type)->get_super_class()) {
+        auto cls = type_class(type);
+        if (cls == nullptr || cls->is_external()) {
+          return;
+        }
+        auto clinit = cls->get_clinit();
+        if (clinit != nullptr && clinit->get_code() != nullptr) {
+          call(clinit, Receiver::OTHER);
+        }
+      }
+    };
+    if (is_synchronized(method)) {
+      local.effects |= WRITES;
+    }
+    for (const auto& mie : InstructionIterable(method->get_code())) {
+      auto insn = mie.insn;
+      auto op = insn->opcode();
+      switch (op) {
+      case OPCODE_IGET:
+      case OPCODE_IGET_WIDE:
+      case OPCODE_IGET_OBJECT:
+      case OPCODE_IGET_BOOLEAN:
+      case OPCODE_IGET_BYTE:
+      case OPCODE_IGET_CHAR:
+      case OPCODE_IGET_SHORT:
+        local.effects |= READS;
+        break;
+      case OPCODE_AGET:
+      case OPCODE_AGET_WIDE:
+      case OPCODE_AGET_OBJECT:
+      case OPCODE_AGET_BOOLEAN:
+      case OPCODE_AGET_BYTE:
+      case OPCODE_AGET_CHAR:
+      case OPCODE_AGET_SHORT:
+        local.effects |= READS | THROWS;
+        break;
+      case OPCODE_SGET:
+      case OPCODE_SGET_WIDE:
+      case OPCODE_SGET_OBJECT:
+      case OPCODE_SGET_BOOLEAN:
+      case OPCODE_SGET_BYTE:
+      case OPCODE_SGET_CHAR:
+      case OPCODE_SGET_SHORT: {
+        local.effects |= READS;
+        auto field = resolve_field(insn->get_field(), FieldSearch::Static);
+        initialize(field == nullptr ? insn->get_field()->get_class()
+                                    : field->get_class());
+        break;
+      }
+      case OPCODE_IPUT:
+      case OPCODE_IPUT_WIDE:
+      case OPCODE_IPUT_OBJECT:
+      case OPCODE_IPUT_BOOLEAN:
+      case OPCODE_IPUT_BYTE:
+      case OPCODE_IPUT_CHAR:
+      case OPCODE_IPUT_SHORT:
+        local.effects |= write_effects(registers.kind(insn->src(1)));
+        break;
+      case OPCODE_APUT:
+      case OPCODE_APUT_WIDE:
+      case OPCODE_APUT_OBJECT:
+      case OPCODE_APUT_BOOLEAN:
+      case OPCODE_APUT_BYTE:
+      case OPCODE_APUT_CHAR:
+      case OPCODE_APUT_SHORT:
+        local.effects |= THROWS | write_effects(registers.kind(insn->src(1)));
+        break;
+      case OPCODE_FILL_ARRAY_DATA:
+        local.effects |= write_effects(registers.kind(insn->src(0)));
+        break;
+      case OPCODE_SPUT:
+      case OPCODE_SPUT_WIDE:
+      case OPCODE_SPUT_OBJECT:
+      case OPCODE_SPUT_BOOLEAN:
+      case OPCODE_SPUT_BYTE:
+      case OPCODE_SPUT_CHAR:
+      case OPCODE_SPUT_SHORT: {
+        auto field = resolve_field(insn->get_field(), FieldSearch::Static);
+        auto cls = field == nullptr ? insn->get_field()->get_class()
+                                    : field->get_class();
+        // Initializing a class isn't observable until it's done.
+        if (!is_clinit(method) || cls != method->get_class()) {
+          local.effects |= WRITES;
+        }
+        initialize(cls);
+        break;
+      }
+      case OPCODE_NEW_INSTANCE:
+        local.effects |= ALLOCATES;
+        initialize(insn->get_type());
+        break;
+      case OPCODE_NEW_ARRAY:
+        local.effects |= ALLOCATES | THROWS;
+        break;
+      case OPCODE_FILLED_NEW_ARRAY:
+        local.effects |= ALLOCATES;
+        break;
+      case OPCODE_MONITOR_ENTER:
+      case OPCODE_MONITOR_EXIT:
+        local.effects |= WRITES;
+        break;
+      case OPCODE_THROW:
+      case OPCODE_CHECK_CAST:
+      case OPCODE_DIV_INT:
+      case OPCODE_REM_INT:
+      case OPCODE_DIV_LONG:
+      case OPCODE_REM_LONG:
+        local.effects |= THROWS;
+        break;
+      case OPCODE_DIV_INT_LIT16:
+      case OPCODE_REM_INT_LIT16:
+      case OPCODE_DIV_INT_LIT8:
+      case OPCODE_REM_INT_LIT8:
+        if (insn->get_literal() == 0) {
+          local.effects |= THROWS;
+        }
+        break;
+      case OPCODE_INVOKE_VIRTUAL:
+      case OPCODE_INVOKE_SUPER:
+      case OPCODE_INVOKE_DIRECT:
+      case OPCODE_INVOKE_STATIC:
+      case OPCODE_INVOKE_INTERFACE: {
+        auto callee = resolve_callee(insn);
+        if (callee == nullptr) {
+          local.effects |= UNKNOWN;
+          break;
+        }
+        if (op == OPCODE_INVOKE_STATIC) {
+          initialize(callee->get_class());
+        }
+        if (is_object_init(callee)) {
+          break;
+        }
+        if (assumenosideeffects(callee)) {
+          local.effects |= READS;
+          break;
+        }
+        call(callee,
+             op == OPCODE_INVOKE_STATIC ? Receiver::OTHER
+                                        : registers.kind(insn->src(0)));
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  });
+  for (uint32_t id = 1; id < m_methods.size(); ++id) {
+    wq.add_item(id);
+  }
+  wq.run_all();
+
+  // Summarize the components in waves: each one after the components that
+  // it calls, along with the others whose callees are done.
+  auto sccs = find_sccs(locals);
+  std::vector<uint32_t> scc_of(m_methods.size());
+  std::vector<uint32_t> wave_of(sccs.size(), 0);
+  std::vector<std::vector<uint32_t>> waves;
+  for (uint32_t i = 0; i < sccs.size(); ++i) {
+    for (auto id : sccs[i]) {
+      scc_of[id] = i;
+    }
+    uint32_t wave = 0;
+    for (auto id : sccs[i]) {
+      for (const auto& call : locals[id].calls) {
+        auto callee_scc = scc_of[call.callee];
+        if (callee_scc != i) {
+          wave = std::max(wave, wave_of[callee_scc] + 1);
+        }
+      }
+    }
+    wave_of[i] = wave;
+    if (waves.size() <= wave) {
+      waves.resize(wave + 1);
+    }
+    waves[wave].push_back(i);
+  }
+
+  m_effects.assign(m_methods.size(), NONE);
+  for (const auto& wave : waves) {
+    auto scc_wq = workqueue_foreach<uint32_t>([&](uint32_t i) {
+      const auto& scc = sccs[i];
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        for (auto id : scc) {
+          auto effects = locals[id].effects;
+          for (const auto& call : locals[id].calls) {
+            effects |= at_call_site(m_effects[call.callee], call.receiver);
+          }
+          if (effects != m_effects[id]) {
+            m_effects[id] = effects;
+            changed = true;
+          }
+        }
+      }
+    });
+    for (auto i : wave) {
+      scc_wq.add_item(i);
+    }
+    scc_wq.run_all();
+  }
+}
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "DexClass.h"
+#include "DexIdMap.h"
+#include "VirtualScope.h"
+
+namespace side_effects {
+
+/*
+ * What calling a method may do, as a set of flags.
+ */
+using Effects = uint8_t;
+
+constexpr Effects NONE = 0;
+// Reads fields or array elements.
+constexpr Effects READS = 1 << 0;
+// Writes fields of the receiver, and of no other object.
+constexpr Effects WRITES_RECEIVER = 1 << 1;
+// Writes fields or array elements of other objects, or synchronizes.
+constexpr Effects WRITES = 1 << 2;
+constexpr Effects ALLOCATES = 1 << 3;
+// Throws an exception other than a NullPointerException.
+constexpr Effects THROWS = 1 << 4;
+// Calls code that wasn't analyzed.
+constexpr Effects UNKNOWN = 1 << 5;
+
+/*
+ * Whether a call with these effects can be removed when its result isn't
+ * used: it may read and allocate, but nothing else.
+ */
+inline bool is_removable(Effects effects) {
+  return (effects & ~(READS | ALLOCATES)) == 0;
+}
+
+} // namespace side_effects
+
+/*
+ * The effects of every method of a scope that has code, computed bottom up
+ * over the strongly connected components of the call graph. The components
+ * that don't call each other are summarized in parallel, and the methods of
+ * a component are iterated to a fixpoint.
+ *
+ * A call adds the effects of its callee when the callee is known: a static or
+ * direct method, or a virtual method that nothing overrides. The writes of a
+ * callee to its receiver become writes to `this` if the caller calls it on
+ * its own receiver, and disappear if the caller calls it on an object it just
+ * allocated, e.g. a constructor. Other calls are UNKNOWN, unless the callee
+ * is marked -assumenosideeffects. Accessing another class than the caller's
+ * own and its super classes may run its static initializer, which has the
+ * effects of a call, except for the writes to the fields of its class.
+ *
+ * Like -assumenosideeffects and LocalDce, the summaries ignore the
+ * NullPointerExceptions that accessing null references throws, and assume
+ * that methods terminate.
+ *
+ * The summaries stay sound while passes keep what methods do; PassManager
+ * shares one through HierarchyCache::get_side_effect_summaries().
+ */
+class SideEffectSummaries {
+ public:
+  explicit SideEffectSummaries(const Scope& scope);
+
+  // `non_virtual` are the virtual methods that nothing overrides, see
+  // devirtualize().
+  SideEffectSummaries(const Scope& scope,
+                      const std::vector<DexMethod*>& non_virtual);
+
+  SideEffectSummaries(const SideEffectSummaries&) = delete;
+  SideEffectSummaries& operator=(const SideEffectSummaries&) = delete;
+
+  // UNKNOWN for the methods without code or outside of the scope.
+  side_effects::Effects get(const DexMethod* method) const {
+    auto id = m_ids.at(method);
+    return id == 0 ? side_effects::UNKNOWN : m_effects[id];
+  }
+
+  /*
+   * The effects of the callee of an invoke instruction, resolved the way the
+   * summaries do: UNKNOWN when it may be one of several methods.
+   */
+  side_effects::Effects get_invoke(const IRInstruction* insn) const;
+
+  size_t size() const { return m_methods.size() - 1; }
+
+ private:
+  // Returns the callee whose summary an invoke gets, or null if the call is
+  // UNKNOWN.
+  const DexMethod* resolve_callee(const IRInstruction* insn) const;
+
+  void summarize(const Scope& scope);
+
+  // Indexed by id, 0 standing for the methods that aren't summarized.
+  std::vector<DexMethod*> m_methods;
+  std::vector<side_effects::Effects> m_effects;
+  MethodIdMap<uint32_t> m_ids;
+  std::unordered_set<const DexMethod*> m_non_virtual;
+};
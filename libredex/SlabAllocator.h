@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "Debug.h"
+
+/*
+ * A pool of equally sized cells for the small objects that make up ballooned
+ * code: MethodItemEntry, IRInstruction, BranchTarget and TryEntry.
+ *
+ * Cells are carved out of large slabs. Each thread allocates from and frees
+ * to its own free list, so those calls take no lock, and the entries of a
+ * method that was built on one thread end up next to each other in memory.
+ * Slabs are never returned to the system, but their cells are reused by later
+ * allocations of the same type. A thread's free list is handed over to the
+ * other threads when it exits.
+ */
+template <size_t CellSize, size_t CellAlign>
+class SlabPool {
+ public:
+  static void* allocate() {
+    auto& list = local();
+    if (list.head == nullptr) {
+      refill(list);
+    }
+    Cell* cell = list.head;
+    list.head = cell->next;
+    return cell;
+  }
+
+  static void deallocate(void* p) {
+    auto& list = local();
+    auto cell = static_cast<Cell*>(p);
+    cell->next = list.head;
+    list.head = cell;
+  }
+
+ private:
+  struct Cell {
+    Cell* next;
+  };
+
+  static constexpr size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+  }
+
+  static constexpr size_t CELL_ALIGN =
+      CellAlign > alignof(Cell) ? CellAlign : alignof(Cell);
+  static constexpr size_t CELL_SIZE =
+      round_up(CellSize > sizeof(Cell) ? CellSize : sizeof(Cell), CELL_ALIGN);
+  static constexpr size_t CELLS_PER_SLAB =
+      (64 * 1024) / CELL_SIZE > 0 ? (64 * 1024) / CELL_SIZE : 1;
+
+  static_assert(CELL_ALIGN <= alignof(std::max_align_t),
+                "Slabs are only aligned for fundamental types");
+
+  struct FreeList {
+    Cell* head{nullptr};
+    ~FreeList() {
+      if (head == nullptr) {
+        return;
+      }
+      Cell* tail = head;
+      while (tail->next != nullptr) {
+        tail = tail->next;
+      }
+      auto& g = global();
+      std::lock_guard<std::mutex> lock(g.lock);
+      tail->next = g.orphans;
+      g.orphans = head;
+      head = nullptr;
+    }
+  };
+
+  // Cells left behind by threads that have exited, and the slabs themselves.
+  // Never destroyed, since objects in the pool may outlive static
+  // destructors.
+  struct Global {
+    std::mutex lock;
+    Cell* orphans{nullptr};
+    std::vector<void*> slabs;
+  };
+
+  static Global& global() {
+    static Global* g = new Global();
+    return *g;
+  }
+
+  static FreeList& local() {
+    static thread_local FreeList list;
+    return list;
+  }
+
+  static void refill(FreeList& list) {
+    auto& g = global();
+    std::lock_guard<std::mutex> lock(g.lock);
+    if (g.orphans != nullptr) {
+      list.head = g.orphans;
+      g.orphans = nullptr;
+      return;
+    }
+    auto slab = static_cast<char*>(malloc(CELL_SIZE * CELLS_PER_SLAB));
+    always_assert_log(slab != nullptr, "SlabPool out of memory\n");
+    g.slabs.push_back(slab);
+    // Thread the cells so that they are handed out in address order.
+    Cell* next = nullptr;
+    for (size_t i = CELLS_PER_SLAB; i-- > 0;) {
+      auto cell = reinterpret_cast<Cell*>(slab + i * CELL_SIZE);
+      cell->next = next;
+      next = cell;
+    }
+    list.head = next;
+  }
+};
+
+/*
+ * Derive T from SlabAllocated<T> to have `new T(...)` and `delete t` go
+ * through a SlabPool instead of malloc.
+ */
+template <class T>
+struct SlabAllocated {
+  static void* operator new(size_t size) {
+    always_assert(size == sizeof(T));
+    return SlabPool<sizeof(T), alignof(T)>::allocate();
+  }
+
+  static void operator delete(void* p) {
+    if (p != nullptr) {
+      SlabPool<sizeof(T), alignof(T)>::deallocate(p);
+    }
+  }
+};
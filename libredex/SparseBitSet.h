@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+/*
+ * A set of unsigned integers stored as the sorted list of its non-empty
+ * 64-bit words, each tagged with its position. Unlike BitVectorValue, there
+ * is no capacity and the set only takes room for the words that have some
+ * element, which suits sets drawn from a large range of dense ids, most of
+ * which are small. Unions and differences handle 64 elements at a time. The
+ * elements are enumerated in increasing order.
+ */
+class SparseBitSet final {
+ private:
+  struct Word {
+    uint32_t index;
+    uint64_t bits;
+
+    bool operator==(const Word& other) const {
+      return index == other.index && bits == other.bits;
+    }
+  };
+
+ public:
+  class const_iterator
+      : public std::iterator<std::forward_iterator_tag, uint32_t> {
+   public:
+    uint32_t operator*() const {
+      return m_word->index * 64 + __builtin_ctzll(m_bits);
+    }
+
+    const_iterator& operator++() {
+      m_bits &= m_bits - 1;
+      if (m_bits == 0 && m_word != m_end) {
+        ++m_word;
+        m_bits = m_word != m_end ? m_word->bits : 0;
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      auto result = *this;
+      ++*this;
+      return result;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return m_word == other.m_word && m_bits == other.m_bits;
+    }
+
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    const_iterator(const std::vector<Word>::const_iterator& word,
+                   const std::vector<Word>::const_iterator& end)
+        : m_word(word), m_end(end), m_bits(word != end ? word->bits : 0) {}
+
+    std::vector<Word>::const_iterator m_word;
+    std::vector<Word>::const_iterator m_end;
+    uint64_t m_bits;
+
+    friend class SparseBitSet;
+  };
+
+  SparseBitSet() = default;
+
+  const_iterator begin() const {
+    return const_iterator(m_words.begin(), m_words.end());
+  }
+
+  const_iterator end() const {
+    return const_iterator(m_words.end(), m_words.end());
+  }
+
+  bool empty() const { return m_words.empty(); }
+
+  size_t size() const {
+    size_t result = 0;
+    for (const auto& word : m_words) {
+      result += __builtin_popcountll(word.bits);
+    }
+    return result;
+  }
+
+  bool contains(uint32_t element) const {
+    auto it = find_word(element / 64);
+    return it != m_words.end() && it->index == element / 64 &&
+           (it->bits & bit(element)) != 0;
+  }
+
+  // Returns true if the element wasn't in the set.
+  bool insert(uint32_t element) {
+    auto it = find_word(element / 64);
+    if (it == m_words.end() || it->index != element / 64) {
+      m_words.insert(it, Word{element / 64, bit(element)});
+      return true;
+    }
+    if ((it->bits & bit(element)) != 0) {
+      return false;
+    }
+    it->bits |= bit(element);
+    return true;
+  }
+
+  // Adds the elements of `other`. Returns true if anything was added.
+  bool union_with(const SparseBitSet& other) {
+    if (other.empty()) {
+      return false;
+    }
+    std::vector<Word> result;
+    result.reserve(m_words.size() + other.m_words.size());
+    bool changed = false;
+    auto it = m_words.begin();
+    auto other_it = other.m_words.begin();
+    while (it != m_words.end() || other_it != other.m_words.end()) {
+      if (other_it == other.m_words.end() ||
+          (it != m_words.end() && it->index < other_it->index)) {
+        result.push_back(*it++);
+      } else if (it == m_words.end() || other_it->index < it->index) {
+        result.push_back(*other_it++);
+        changed = true;
+      } else {
+        changed |= (other_it->bits & ~it->bits) != 0;
+        result.push_back(Word{it->index, it->bits | other_it->bits});
+        ++it;
+        ++other_it;
+      }
+    }
+    if (changed) {
+      m_words = std::move(result);
+    }
+    return changed;
+  }
+
+  // The elements of this set that aren't in `other`.
+  SparseBitSet difference(const SparseBitSet& other) const {
+    SparseBitSet result;
+    auto other_it = other.m_words.begin();
+    for (const auto& word : m_words) {
+      while (other_it != other.m_words.end() && other_it->index < word.index) {
+        ++other_it;
+      }
+      uint64_t bits = word.bits;
+      if (other_it != other.m_words.end() && other_it->index == word.index) {
+        bits &= ~other_it->bits;
+      }
+      if (bits != 0) {
+        result.m_words.push_back(Word{word.index, bits});
+      }
+    }
+    return result;
+  }
+
+  bool intersects(const SparseBitSet& other) const {
+    auto other_it = other.m_words.begin();
+    for (const auto& word : m_words) {
+      while (other_it != other.m_words.end() && other_it->index < word.index) {
+        ++other_it;
+      }
+      if (other_it == other.m_words.end()) {
+        return false;
+      }
+      if (other_it->index == word.index && (other_it->bits & word.bits) != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void clear() { m_words.clear(); }
+
+  friend bool operator==(const SparseBitSet& s1, const SparseBitSet& s2) {
+    return s1.m_words == s2.m_words;
+  }
+
+  friend bool operator!=(const SparseBitSet& s1, const SparseBitSet& s2) {
+    return !(s1 == s2);
+  }
+
+ private:
+  static uint64_t bit(uint32_t element) { return uint64_t(1) << (element % 64); }
+
+  std::vector<Word>::iterator find_word(uint32_t index) {
+    return std::lower_bound(
+        m_words.begin(), m_words.end(), index, [](const Word& w, uint32_t i) {
+          return w.index < i;
+        });
+  }
+
+  std::vector<Word>::const_iterator find_word(uint32_t index) const {
+    return std::lower_bound(
+        m_words.begin(), m_words.end(), index, [](const Word& w, uint32_t i) {
+          return w.index < i;
+        });
+  }
+
+  std::vector<Word> m_words;
+};
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "StoreDependencies.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "DexIdMap.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "Trace.h"
+#include "Walkers.h"
+#include "WorkQueue.h"
+
+StoreDependencies::StoreDependencies(const DexStoresVector& stores)
+    : m_words((stores.size() + 63) / 64),
+      m_closures(stores.size() * m_words) {
+  std::unordered_map<std::string, size_t> store_idxs;
+  for (size_t i = 0; i < stores.size(); ++i) {
+    store_idxs.emplace(stores[i].get_name(), i);
+  }
+  std::vector<std::vector<size_t>> deps(stores.size());
+  for (size_t i = 0; i < stores.size(); ++i) {
+    auto closure = &m_closures[i * m_words];
+    closure[i / 64] |= uint64_t(1) << (i % 64);
+    closure[0] |= 1;
+    for (const auto& name : stores[i].get_dependencies()) {
+      auto it = store_idxs.find(name);
+      if (it == store_idxs.end()) {
+        TRACE(VERIFY, 2, "Store %s depends on unknown store %s\n",
+              stores[i].get_name().c_str(), name.c_str());
+        continue;
+      }
+      deps[i].push_back(it->second);
+    }
+  }
+
+  // Grow the closures until they are stable, which also copes with cyclic
+  // dependencies.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < stores.size(); ++i) {
+      auto closure = &m_closures[i * m_words];
+      for (auto dep : deps[i]) {
+        auto dep_closure = &m_closures[dep * m_words];
+        for (size_t w = 0; w < m_words; ++w) {
+          auto word = closure[w] | dep_closure[w];
+          if (word != closure[w]) {
+            closure[w] = word;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+}
+
+namespace {
+
+using TypeRef = std::pair<const DexClass*, const DexType*>;
+
+struct StoreTypes {
+  // One plus the index of the store that defines each type, zero if none
+  // does.
+  TypeIdMap<size_t> store_of;
+  // The types that the classes of each store may refer to.
+  std::vector<TypeBitSet> allowed;
+
+  explicit StoreTypes(const DexStoresVector& stores) {
+    std::vector<TypeBitSet> defined(stores.size());
+    for (size_t i = 0; i < stores.size(); ++i) {
+      for (const auto& classes : stores[i].get_dexen()) {
+        for (const auto& cls : classes) {
+          store_of[cls->get_type()] = i + 1;
+          defined[i].insert(cls->get_type());
+        }
+      }
+    }
+    StoreDependencies deps(stores);
+    allowed.resize(stores.size());
+    for (size_t i = 0; i < stores.size(); ++i) {
+      for (size_t j = 0; j < stores.size(); ++j) {
+        if (deps.can_refer_to(i, j)) {
+          allowed[i].union_with(defined[j]);
+        }
+      }
+    }
+  }
+};
+
+const DexType* referenced_type(const IRInstruction* insn) {
+  // TODO: walk through annotations, and the types in method signatures
+  if (insn->has_type()) {
+    return insn->get_type();
+  }
+  if (insn->has_field()) {
+    return insn->get_field()->get_class();
+  }
+  if (insn->has_method()) {
+    // For virtual methods, the class may not define the method, and true
+    // verification would require that the binding refers to a valid class.
+    return insn->get_method()->get_class();
+  }
+  return nullptr;
+}
+
+} // namespace
+
+std::vector<IllegalStoreRef> find_illegal_store_refs(
+    const DexStoresVector& stores) {
+  StoreTypes types(stores);
+  std::vector<std::unique_ptr<std::vector<TypeRef>>> thread_refs;
+  auto wq = WorkQueue<DexClass*, std::vector<TypeRef>*, std::nullptr_t>(
+      [&](std::vector<TypeRef>*& refs, DexClass* cls) -> std::nullptr_t {
+        const auto& allowed =
+            types.allowed[types.store_of.at(cls->get_type()) - 1];
+        TypeBitSet seen;
+        auto scan = [&](const std::vector<DexMethod*>& methods) {
+          for (auto method : methods) {
+            auto code = method->get_code();
+            if (code == nullptr) {
+              continue;
+            }
+            for (const auto& mie : InstructionIterable(code)) {
+              auto type = referenced_type(mie.insn);
+              if (type == nullptr || types.store_of.at(type) == 0 ||
+                  allowed.contains(type) || !seen.insert(type)) {
+                continue;
+              }
+              refs->emplace_back(cls, type);
+            }
+          }
+        };
+        scan(cls->get_dmethods());
+        scan(cls->get_vmethods());
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int /*thread_index*/) {
+        thread_refs.emplace_back(std::make_unique<std::vector<TypeRef>>());
+        return thread_refs.back().get();
+      },
+      walk::parallel::default_num_threads());
+  for (const auto& store : stores) {
+    for (const auto& classes : store.get_dexen()) {
+      for (const auto& cls : classes) {
+        wq.add_item(cls);
+      }
+    }
+  }
+  wq.run_all();
+
+  std::vector<IllegalStoreRef> result;
+  for (const auto& refs : thread_refs) {
+    for (const auto& ref : *refs) {
+      result.push_back(
+          IllegalStoreRef{ref.first,
+                          types.store_of.at(ref.first->get_type()) - 1,
+                          type_class(ref.second),
+                          types.store_of.at(ref.second) - 1});
+    }
+  }
+  std::sort(result.begin(),
+            result.end(),
+            [](const IllegalStoreRef& a, const IllegalStoreRef& b) {
+              if (a.referrer_store != b.referrer_store) {
+                return a.referrer_store < b.referrer_store;
+              }
+              if (a.referrer != b.referrer) {
+                return compare_dexclasses(a.referrer, b.referrer);
+              }
+              return compare_dexclasses(a.reference, b.reference);
+            });
+  return result;
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DexClass.h"
+#include "DexStore.h"
+
+/**
+ * The stores that the classes of each store may refer to: the store itself,
+ * the root store, and the transitive closure of the dependencies in its
+ * metadata. The closures are computed once, as bitsets over the store indices.
+ *
+ * Ex: STC depends on STB. STB depends on STA.
+ *
+ * STC -> { STC, STB, STA, root }
+ * STB -> { STB, STA, root }
+ * STA -> { STA, root }
+ */
+class StoreDependencies {
+ public:
+  explicit StoreDependencies(const DexStoresVector& stores);
+
+  bool can_refer_to(size_t store_idx, size_t dep_idx) const {
+    return (m_closures[store_idx * m_words + dep_idx / 64] &
+            (uint64_t(1) << (dep_idx % 64))) != 0;
+  }
+
+ private:
+  size_t m_words;
+  std::vector<uint64_t> m_closures;
+};
+
+struct IllegalStoreRef {
+  const DexClass* referrer;
+  size_t referrer_store;
+  const DexClass* reference;
+  size_t reference_store;
+};
+
+/**
+ * Finds the instructions whose type, field or method belongs to a class of a
+ * store that the store of their method can't refer to. The classes are
+ * scanned in parallel. Each pair of classes is reported once, sorted by the
+ * referring store and then by the names of the classes.
+ *
+ * References to classes that are in none of the stores aren't checked.
+ */
+std::vector<IllegalStoreRef> find_illegal_store_refs(
+    const DexStoresVector& stores);
@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <string>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#endif
+
+#include "Debug.h"
+
+namespace {
+
+std::atomic<ThreadPool*> s_current_pool{nullptr};
+
+/*
+ * The CPUs of each NUMA node that this process is allowed to run on, by
+ * node. Nodes without any such CPU are left out.
+ */
+std::vector<std::vector<int>> numa_node_cpus() {
+  std::vector<std::vector<int>> result;
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return result;
+  }
+  DIR* dir = opendir("/sys/devices/system/node");
+  if (dir == nullptr) {
+    return result;
+  }
+  std::map<int, std::vector<int>> nodes;
+  while (auto entry = readdir(dir)) {
+    int node;
+    if (sscanf(entry->d_name, "node%d", &node) != 1) {
+      continue;
+    }
+    auto path = std::string("/sys/devices/system/node/") + entry->d_name +
+                "/cpulist";
+    FILE* fd = fopen(path.c_str(), "r");
+    if (fd == nullptr) {
+      continue;
+    }
+    // A list of ranges, like "0-15,32-47".
+    std::vector<int> cpus;
+    int first;
+    while (fscanf(fd, "%d", &first) == 1) {
+      int last = first;
+      int c = fgetc(fd);
+      if (c == '-') {
+        if (fscanf(fd, "%d", &last) != 1) {
+          break;
+        }
+        c = fgetc(fd);
+      }
+      for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+          cpus.push_back(cpu);
+        }
+      }
+      if (c != ',') {
+        break;
+      }
+    }
+    fclose(fd);
+    if (!cpus.empty()) {
+      nodes.emplace(node, std::move(cpus));
+    }
+  }
+  closedir(dir);
+  for (auto& node : nodes) {
+    result.push_back(std::move(node.second));
+  }
+#endif
+  return result;
+}
+
+void pin_current_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  // Failing is harmless: the thread then runs wherever the scheduler likes.
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+} // namespace
+
+struct ThreadPool::Batch {
+  const std::function<void(size_t)>* fn;
+  size_t size;
+  std::atomic<size_t> next{0};
+
+  std::mutex lock;
+  std::condition_variable finished;
+  size_t num_done{0};
+  std::exception_ptr error;
+
+  Batch(const std::function<void(size_t)>* fn, size_t size)
+      : fn(fn), size(size) {}
+};
+
+ThreadPool::ThreadPool(size_t num_threads, bool pin_to_nodes) {
+  always_assert(num_threads >= 1);
+  if (pin_to_nodes) {
+    m_node_cpus = numa_node_cpus();
+    // With a single node, pinning would only get in the way of the scheduler.
+    if (m_node_cpus.size() < 2) {
+      m_node_cpus.clear();
+    }
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    // Same stack size as WorkQueue has always used for its own threads.
+    boost::thread::attributes attrs;
+    attrs.set_stack_size(8 * 1024 * 1024);
+    m_threads.emplace_back(attrs, [this, i] { worker_loop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_stopping = true;
+  }
+  m_work_available.notify_all();
+  for (auto& thread : m_threads) {
+    thread.join();
+  }
+}
+
+ThreadPool* ThreadPool::current() { return s_current_pool.load(); }
+
+ThreadPool* ThreadPool::set_current(ThreadPool* pool) {
+  return s_current_pool.exchange(pool);
+}
+
+bool ThreadPool::run_one(Batch& batch) {
+  size_t i = batch.next.fetch_add(1);
+  if (i >= batch.size) {
+    return false;
+  }
+  std::exception_ptr error;
+  try {
+    (*batch.fn)(i);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  std::lock_guard<std::mutex> guard(batch.lock);
+  if (error && !batch.error) {
+    batch.error = error;
+  }
+  if (++batch.num_done == batch.size) {
+    batch.finished.notify_all();
+  }
+  return true;
+}
+
+void ThreadPool::remove_batch(const std::shared_ptr<Batch>& batch) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  auto it = std::find(m_batches.begin(), m_batches.end(), batch);
+  if (it != m_batches.end()) {
+    m_batches.erase(it);
+  }
+}
+
+void ThreadPool::worker_loop(size_t index) {
+  // Before the thread allocates anything, so that it all lands on its node.
+  if (!m_node_cpus.empty()) {
+    pin_current_thread(m_node_cpus[index % m_node_cpus.size()]);
+  }
+  while (true) {
+    std::shared_ptr<Batch> batch;
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_work_available.wait(
+          lock, [this] { return m_stopping || !m_batches.empty(); });
+      if (m_batches.empty()) {
+        return;
+      }
+      batch = m_batches.front();
+    }
+    while (run_one(*batch)) {
+    }
+    remove_batch(batch);
+  }
+}
+
+void ThreadPool::run(size_t n, const std::function<void(size_t)>& fn) {
+  if (n == 0) {
+    return;
+  }
+  auto batch = std::make_shared<Batch>(&fn, n);
+  if (n > 1) {
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_batches.push_back(batch);
+    }
+    m_work_available.notify_all();
+  }
+  while (run_one(*batch)) {
+  }
+  remove_batch(batch);
+  std::unique_lock<std::mutex> lock(batch->lock);
+  batch->finished.wait(lock, [&] { return batch->num_done == batch->size; });
+  if (batch->error) {
+    std::rethrow_exception(batch->error);
+  }
+}
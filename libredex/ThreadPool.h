@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <boost/thread/thread.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * A fixed set of threads that outlive any single parallel job, so that the
+ * many WorkQueues created over a Redex run don't each pay for spawning and
+ * joining their own threads.
+ *
+ * run(n, fn) calls fn(0) ... fn(n - 1) concurrently and blocks until they
+ * have all returned. The calling thread executes indices too, rather than
+ * just waiting, which makes it safe to call run() from inside a task: a
+ * nested job always makes progress, even when every pool thread is busy.
+ *
+ * PassManager owns the process-wide pool and installs it as current() for
+ * its lifetime. Code running outside of a PassManager (e.g. unit tests) sees
+ * no current pool, and WorkQueue falls back to spawning its own threads.
+ *
+ * On a Linux host with several NUMA nodes, a pool built with pin_to_nodes
+ * spreads its threads round-robin over the nodes and keeps each one on the
+ * CPUs of its node. The memory that a thread touches first, like the slabs of
+ * its SlabPool free lists, then lives on the node it runs on.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads, bool pin_to_nodes = false);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const { return m_threads.size(); }
+
+  // The number of NUMA nodes the threads are spread over, or 0 if they
+  // aren't pinned.
+  size_t num_nodes() const { return m_node_cpus.size(); }
+
+  /*
+   * If any call of fn throws, run() still waits for the other indices to
+   * finish and then rethrows the first exception.
+   */
+  void run(size_t n, const std::function<void(size_t)>& fn);
+
+  static ThreadPool* current();
+
+  /*
+   * Makes pool the current one and returns the previously current pool, so
+   * that the caller can restore it when pool goes away.
+   */
+  static ThreadPool* set_current(ThreadPool* pool);
+
+ private:
+  struct Batch;
+
+  void worker_loop(size_t index);
+
+  // Runs one unclaimed index of batch. Returns false if there was none left.
+  static bool run_one(Batch& batch);
+
+  void remove_batch(const std::shared_ptr<Batch>& batch);
+
+  // The CPUs of each node that the threads are pinned to.
+  std::vector<std::vector<int>> m_node_cpus;
+  std::vector<boost::thread> m_threads;
+  std::mutex m_lock;
+  std::condition_variable m_work_available;
+  std::deque<std::shared_ptr<Batch>> m_batches;
+  bool m_stopping{false};
+};
@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Timeline.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+#include "Debug.h"
+
+namespace timeline {
+
+namespace detail {
+std::atomic<bool> s_enabled{false};
+}
+
+namespace {
+
+struct Event {
+  const char* category;
+  std::string name;
+  clock::time_point start;
+  clock::time_point end;
+  Args args;
+};
+
+// Each thread appends to its own buffer. Buffers are owned by the registry
+// rather than the threads, so that events outlive the threads recording them.
+struct ThreadEvents {
+  size_t tid;
+  std::vector<Event> events;
+};
+
+struct Registry {
+  std::mutex lock;
+  clock::time_point origin{clock::now()};
+  std::vector<std::unique_ptr<ThreadEvents>> threads;
+};
+
+Registry& registry() {
+  static Registry* r = new Registry();
+  return *r;
+}
+
+ThreadEvents& thread_events() {
+  static thread_local ThreadEvents* events = nullptr;
+  if (events == nullptr) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.threads.emplace_back(std::make_unique<ThreadEvents>());
+    events = r.threads.back().get();
+    events->tid = r.threads.size();
+  }
+  return *events;
+}
+
+void append_json_string(std::string& out, const std::string& s) {
+  out += '"';
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+void append_us(std::string& out, clock::duration d) {
+  out += std::to_string(
+      std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+}
+
+} // namespace
+
+void enable() {
+  // Make sure the origin predates every event.
+  registry();
+  detail::s_enabled = true;
+}
+
+void record(const char* category,
+            std::string name,
+            clock::time_point start,
+            clock::time_point end,
+            Args args) {
+  thread_events().events.push_back(
+      Event{category, std::move(name), start, end, std::move(args)});
+}
+
+void write(const std::string& filename) {
+  auto& r = registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+  FILE* fd = fopen(filename.c_str(), "w");
+  always_assert_log(fd != nullptr, "Can't open timeline: %s\n",
+                    filename.c_str());
+  std::string out;
+  out += "{\"traceEvents\":[\n";
+  bool first = true;
+  for (const auto& thread : r.threads) {
+    for (const auto& e : thread->events) {
+      if (!first) {
+        out += ",\n";
+      }
+      first = false;
+      out += "{\"ph\":\"X\",\"pid\":1,\"tid\":";
+      out += std::to_string(thread->tid);
+      out += ",\"cat\":\"";
+      out += e.category;
+      out += "\",\"name\":";
+      append_json_string(out, e.name);
+      out += ",\"ts\":";
+      append_us(out, e.start - r.origin);
+      out += ",\"dur\":";
+      append_us(out, e.end - e.start);
+      if (!e.args.empty()) {
+        out += ",\"args\":{";
+        for (size_t i = 0; i < e.args.size(); ++i) {
+          if (i > 0) {
+            out += ',';
+          }
+          out += '"';
+          out += e.args[i].first;
+          out += "\":";
+          out += std::to_string(e.args[i].second);
+        }
+        out += '}';
+      }
+      out += '}';
+    }
+    if (out.size() >= (1 << 16)) {
+      fwrite(out.data(), 1, out.size(), fd);
+      out.clear();
+    }
+  }
+  out += "\n]}\n";
+  fwrite(out.data(), 1, out.size(), fd);
+  fclose(fd);
+}
+
+} // namespace timeline
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Records what each thread was doing and when, so that serial phases and load
+ * imbalance between workers show up on a timeline. The result is written in
+ * the Chrome trace-event format, which chrome://tracing and Perfetto load.
+ *
+ * Recording is off unless enable() is called, and then costs one append to a
+ * per-thread buffer per event.
+ */
+namespace timeline {
+
+using clock = std::chrono::steady_clock;
+using Args = std::vector<std::pair<const char*, uint64_t>>;
+
+namespace detail {
+extern std::atomic<bool> s_enabled;
+}
+
+inline bool enabled() {
+  return detail::s_enabled.load(std::memory_order_relaxed);
+}
+
+void enable();
+
+/*
+ * Records a complete event [start, end) on the calling thread. `category`
+ * must be a string literal; `args` show up as the event's arguments.
+ */
+void record(const char* category,
+            std::string name,
+            clock::time_point start,
+            clock::time_point end,
+            Args args = Args());
+
+/*
+ * Writes all recorded events to `filename`. No thread may be recording
+ * while this runs.
+ */
+void write(const std::string& filename);
+
+} // namespace timeline
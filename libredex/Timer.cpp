@@ -9,6 +9,7 @@
 
 #include "Timer.h"
 
+#include "Timeline.h"
 #include "Trace.h"
 
 unsigned Timer::s_indent = 0;
@@ -30,6 +31,14 @@ Timer::~Timer() {
         4 * s_indent, "",
         m_msg.c_str(),
         duration_s);
+  if (timeline::enabled()) {
+    auto timeline_end = timeline::clock::now();
+    timeline::record("timer",
+                     m_msg,
+                     timeline_end - std::chrono::duration_cast<
+                                        timeline::clock::duration>(end - m_start),
+                     timeline_end);
+  }
 
   {
     std::lock_guard<std::mutex> guard(s_lock);
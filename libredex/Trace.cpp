@@ -19,10 +19,25 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 namespace {
 
+struct Tracer;
+
+/*
+ * With TRACE_BUFFER set, each thread collects its lines and only takes the
+ * output lock once the buffer is full, or when the thread or the process
+ * exits. Lines stay whole but the ones from different threads are no longer
+ * interleaved in time order.
+ */
+struct ThreadBuffer {
+  std::string data;
+  ThreadBuffer();
+  ~ThreadBuffer();
+};
+
 struct Tracer {
 
   bool m_show_timestamps{false};
@@ -35,6 +50,7 @@ struct Tracer {
     const char* envfile = getenv("TRACEFILE");
     const char* show_timestamps = getenv("SHOW_TIMESTAMPS");
     const char* show_tracemodule = getenv("SHOW_TRACEMODULE");
+    const char* buffer_size = getenv("TRACE_BUFFER");
     m_method_filter = getenv("TRACE_METHOD_FILTER");
     if (!traceenv) {
       return;
@@ -52,6 +68,8 @@ struct Tracer {
     std::cerr << "TRACE_METHOD_FILTER="
               << (m_method_filter == nullptr ? "" : m_method_filter)
               << std::endl;
+    std::cerr << "TRACE_BUFFER=" << (buffer_size == nullptr ? "" : buffer_size)
+              << std::endl;
 
     init_trace_modules(traceenv);
     init_trace_file(envfile);
@@ -62,6 +80,9 @@ struct Tracer {
     if (show_tracemodule) {
       m_show_tracemodule = true;
     }
+    if (buffer_size) {
+      m_buffer_size = strtoul(buffer_size, nullptr, 10);
+    }
 
 #define TM(x) m_module_id_name_map[static_cast<int>(x)] = #x;
     TMS
@@ -69,6 +90,14 @@ struct Tracer {
   }
 
   ~Tracer() {
+    {
+      std::lock_guard<std::mutex> guard(TraceContext::s_trace_mutex);
+      for (auto buffer : m_buffers) {
+        write_locked(buffer->data);
+      }
+      m_buffers.clear();
+      m_alive = false;
+    }
     if (m_file != nullptr && m_file != stderr) {
       fclose(m_file);
     }
@@ -85,7 +114,10 @@ struct Tracer {
         return;
       }
     }
-    std::lock_guard<std::mutex> guard(TraceContext::s_trace_mutex);
+    // Lines are formatted without holding the lock, so that tracing threads
+    // only contend on the write itself.
+    thread_local std::string line;
+    line.clear();
     if (m_show_timestamps) {
       auto t = std::time(nullptr);
       struct tm local_tm;
@@ -96,16 +128,57 @@ struct Tracer {
 #endif
       std::array<char, 40> buf;
       std::strftime(buf.data(), sizeof(buf), "%c", &local_tm);
-      fprintf(m_file, "[%s]", buf.data());
+      line += '[';
+      line += buf.data();
+      line += ']';
       if (!m_show_tracemodule) {
-        fprintf(m_file, " ");
+        line += ' ';
       }
     }
     if (m_show_tracemodule) {
-      fprintf(m_file, "[%s:%d] ", m_module_id_name_map[module].c_str(), level);
+      line += '[';
+      line += m_module_id_name_map.at(module);
+      line += ':';
+      line += std::to_string(level);
+      line += "] ";
+    }
+    va_list ap_copy;
+    va_copy(ap_copy, ap);
+    auto prefix_size = line.size();
+    auto size = vsnprintf(nullptr, 0, fmt, ap_copy);
+    va_end(ap_copy);
+    if (size > 0) {
+      line.resize(prefix_size + size + 1);
+      vsnprintf(&line[prefix_size], size + 1, fmt, ap);
+      line.resize(prefix_size + size);
+    }
+
+    if (m_buffer_size == 0) {
+      std::lock_guard<std::mutex> guard(TraceContext::s_trace_mutex);
+      write_locked(line);
+      return;
+    }
+    thread_local ThreadBuffer buffer;
+    buffer.data += line;
+    if (buffer.data.size() >= m_buffer_size) {
+      std::lock_guard<std::mutex> guard(TraceContext::s_trace_mutex);
+      write_locked(buffer.data);
+    }
+  }
+
+  void add_buffer(ThreadBuffer* buffer) {
+    std::lock_guard<std::mutex> guard(TraceContext::s_trace_mutex);
+    if (m_alive) {
+      m_buffers.insert(buffer);
+    }
+  }
+
+  void remove_buffer(ThreadBuffer* buffer) {
+    std::lock_guard<std::mutex> guard(TraceContext::s_trace_mutex);
+    if (m_alive) {
+      write_locked(buffer->data);
+      m_buffers.erase(buffer);
     }
-    vfprintf(m_file, fmt, ap);
-    fflush(m_file);
   }
 
  private:
@@ -160,12 +233,29 @@ struct Tracer {
   }
 
  private:
+  // Expects TraceContext::s_trace_mutex to be held. Clears `data`.
+  void write_locked(std::string& data) {
+    if (data.empty()) {
+      return;
+    }
+    fwrite(data.data(), 1, data.size(), m_file);
+    fflush(m_file);
+    data.clear();
+  }
+
   FILE* m_file{nullptr};
   long m_level{0};
+  size_t m_buffer_size{0};
+  bool m_alive{true};
+  std::unordered_set<ThreadBuffer*> m_buffers;
   std::array<long, N_TRACE_MODULES> m_traces;
 };
 
 static Tracer tracer;
+
+ThreadBuffer::ThreadBuffer() { tracer.add_buffer(this); }
+
+ThreadBuffer::~ThreadBuffer() { tracer.remove_buffer(this); }
 }
 
 #ifdef NDEBUG
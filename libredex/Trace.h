@@ -19,6 +19,7 @@
   TM(ADD_REDEX_TXT)      \
   TM(ACCESS)             \
   TM(ANNO)               \
+  TM(BBREORDER)          \
   TM(BIND)               \
   TM(BRIDGE)             \
   TM(BUILDERS)           \
@@ -29,19 +30,24 @@
   TM(CLP_LITHO)          \
   TM(CONSTP)             \
   TM(CPG)                \
+  TM(CSE)                \
   TM(CUSTOMSORT)         \
   TM(DBGSTRIP)           \
   TM(DC)                 \
   TM(DCE)                \
   TM(DEDUP_BLOCKS)       \
+  TM(DEDUP_METHODS)      \
   TM(DEDUP_RES)          \
   TM(DELINIT)            \
   TM(DELMET)             \
   TM(DRAC)               \
   TM(EMPTY)              \
+  TM(ENUM)               \
   TM(FINALINLINE)        \
   TM(HOTNESS)            \
   TM(ICONSTP)            \
+  TM(IFCHAIN)            \
+  TM(INSTRUMENT)         \
   TM(IDEX)               \
   TM(INL)                \
   TM(INLINIT)            \
@@ -70,6 +76,7 @@
   TM(RME)                \
   TM(RMGOTO)             \
   TM(RMU)                \
+  TM(SCALAR_REPL)        \
   TM(SHORTEN)            \
   TM(SINK)               \
   TM(SINL)               \
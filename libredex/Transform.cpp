@@ -63,7 +63,7 @@ void remap_registers(MethodItemEntry& mei, const RegMap& reg_map) {
     remap_registers(mei.insn, reg_map);
     break;
   case MFLOW_DEBUG:
-    remap_debug(*mei.dbgop, reg_map);
+    remap_debug(mei.dbgop, reg_map);
     break;
   default:
     break;
@@ -120,6 +120,7 @@ size_t remove_unreachable_blocks(IRCode* code) {
     // Remove all successor edges. Note that we don't need to try and remove
     // predecessors since by definition, unreachable blocks have no preds
     cfg.remove_succ_edges(b);
+    code->mark_modified();
     insns_removed += remove_block(code, b);
   }
 
@@ -149,6 +150,7 @@ FatMethod::iterator find_last_instruction(Block* block) {
 // if new_block is null, just delete old_block and don't reroute
 void replace_block(IRCode* code, Block* old_block, Block* new_block) {
   const ControlFlowGraph& cfg = code->cfg();
+  code->mark_modified();
   std::vector<MethodItemEntry*> will_move;
   if (new_block != nullptr) {
     // make a copy of the targets we're going to move
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <functional>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "ControlFlow.h"
@@ -19,6 +20,8 @@
 #include "DexClass.h"
 #include "IRCode.h"
 #include "Match.h"
+#include "MethodProfiler.h"
+#include "ThreadPool.h"
 #include "WorkQueue.h"
 
 /**
@@ -285,13 +288,16 @@ class walk {
                                const Walker& walker) {
     iterate_code(
         cls, all_methods, [&predicate, &walker](DexMethod* m, IRCode& ir_code) {
-          std::vector<IRInstruction*> insns;
-          for (auto& mie : InstructionIterable(ir_code)) {
-            insns.emplace_back(mie.insn);
-          }
-
+          // The walker may change the code, so all the matches are found
+          // before it sees any.
           std::vector<std::vector<IRInstruction*>> matches;
-          m::find_matches(insns, predicate, matches);
+          m::for_each_match(
+              InstructionIterable(ir_code),
+              predicate,
+              [&matches](const m::insn_window<N>& window) {
+                auto insns = window.to_array();
+                matches.emplace_back(insns.begin(), insns.end());
+              });
           for (const std::vector<IRInstruction*>& matching_insns : matches) {
             walker(m, matching_insns);
           }
@@ -310,11 +316,13 @@ class walk {
           std::vector<std::vector<IRInstruction*>> method_matches;
           ir_code.build_cfg();
           for (Block* block : ir_code.cfg().blocks()) {
-            std::vector<IRInstruction*> insns;
-            for (const MethodItemEntry& mie : InstructionIterable(block)) {
-              insns.emplace_back(mie.insn);
-            }
-            m::find_matches(insns, predicate, method_matches);
+            m::for_each_match(
+                InstructionIterable(block),
+                predicate,
+                [&method_matches](const m::insn_window<N>& window) {
+                  auto insns = window.to_array();
+                  method_matches.emplace_back(insns.begin(), insns.end());
+                });
           }
 
           for (const std::vector<IRInstruction*>& matching_insns :
@@ -330,8 +338,9 @@ class walk {
   /**
    * The parallel:: methods have very similar signatures (and names) to their
    * sequential counterparts.
-   * The unit of parallelization is a DexClass. The reason is that we don't want
-   * to create too many tasks on the WorkQueue, paying the overhead for each.
+   * The unit of parallelization is a DexClass, or a chunk of methods for
+   * reduce_code(). The reason is that we don't want to create too many tasks
+   * on the WorkQueue, paying the overhead for each.
    */
   class parallel {
    public:
@@ -361,7 +370,7 @@ class walk {
       auto wq = workqueue_foreach<DexClass*>(
           [&walker](DexClass* cls) { walk::iterate_methods(cls, walker); },
           num_threads);
-      run_all(wq, classes);
+      run_all_by_code_size(wq, classes);
     }
 
     /**
@@ -381,15 +390,18 @@ class walk {
                                  DataInitializerFn data_initializer,
                                  const Output& init = Output(),
                                  size_t num_threads = default_num_threads()) {
+      auto phase = method_profiler::current_phase();
       auto wq = WorkQueue<DexClass*, Data, Output>(
           [&](Data& data, DexClass* cls) {
             Output out = init;
             for (auto dmethod : cls->get_dmethods()) {
               TraceContext context(dmethod->get_deobfuscated_name());
+              method_profiler::MethodTimer timer(phase, dmethod);
               out = reducer(out, walker(data, dmethod));
             }
             for (auto vmethod : cls->get_vmethods()) {
               TraceContext context(vmethod->get_deobfuscated_name());
+              method_profiler::MethodTimer timer(phase, vmethod);
               out = reducer(out, walker(data, vmethod));
             }
             return out;
@@ -399,11 +411,110 @@ class walk {
           num_threads);
 
       for (const auto& cls : classes) {
-        wq.add_item(cls);
+        wq.add_item(cls, code_size_hint(cls));
       };
       return wq.run_all();
     }
 
+    /**
+     * Call `walker` on the code of all methods in `classes` in parallel, with
+     * the accumulator of the thread it runs on, and return the sum of the
+     * accumulators.
+     *
+     * The methods are handed out in chunks of about `grain_size` opcodes:
+     * small classes share a chunk, and the methods of large ones are spread
+     * over several. Each thread gets an `Accumulator` from `init` and the
+     * accumulators are summed with `+=` in the order of the threads, so sums
+     * of counters come out the same whichever thread walked what.
+     */
+    template <class Accumulator,
+              class Classes,
+              class Walker = void(Accumulator&, DexMethod*, IRCode&),
+              class Init = Accumulator(unsigned int),
+              class = decltype(std::declval<const Init&>()(0u))>
+    static Accumulator reduce_code(const Classes& classes,
+                                   const Walker& walker,
+                                   const Init& init,
+                                   size_t grain_size = kDefaultGrainSize,
+                                   size_t num_threads = default_num_threads()) {
+      std::vector<DexMethod*> methods;
+      // Where each chunk ends in `methods`, and its size.
+      std::vector<std::pair<size_t, size_t>> chunks;
+      size_t chunk_size = 0;
+      for (const auto& cls : classes) {
+        walk::iterate_methods(cls, [&](DexMethod* m) {
+          if (m->peek_code() == nullptr && m->get_dex_code() == nullptr) {
+            return;
+          }
+          methods.push_back(m);
+          chunk_size += std::max<size_t>(1, method_size_hint(m));
+          if (chunk_size >= grain_size) {
+            chunks.emplace_back(methods.size(), chunk_size);
+            chunk_size = 0;
+          }
+        });
+      }
+      if (chunk_size > 0) {
+        chunks.emplace_back(methods.size(), chunk_size);
+      }
+
+      std::vector<Accumulator> accumulators;
+      accumulators.reserve(num_threads);
+      for (size_t i = 0; i < num_threads; ++i) {
+        accumulators.emplace_back(init(i));
+      }
+      auto phase = method_profiler::current_phase();
+      auto wq = WorkQueue<size_t, Accumulator*, std::nullptr_t>(
+          [&](Accumulator*& acc, size_t chunk) -> std::nullptr_t {
+            size_t begin = chunk == 0 ? 0 : chunks[chunk - 1].first;
+            for (size_t i = begin; i < chunks[chunk].first; ++i) {
+              auto m = methods[i];
+              auto code = m->get_code();
+              if (code == nullptr) {
+                continue;
+              }
+              TraceContext context(m->get_deobfuscated_name());
+              method_profiler::MethodTimer timer(phase, m);
+              walker(*acc, m, *code);
+            }
+            return nullptr;
+          },
+          [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+          [&](unsigned int thread_idx) { return &accumulators[thread_idx]; },
+          num_threads);
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        wq.add_item(i, chunks[i].second);
+      }
+      wq.run_all();
+
+      Accumulator result = std::move(accumulators[0]);
+      for (size_t i = 1; i < accumulators.size(); ++i) {
+        result += accumulators[i];
+      }
+      return result;
+    }
+
+    /**
+     * Same as `reduce_code()` but with default-constructed accumulators.
+     */
+    template <class Accumulator,
+              class Classes,
+              class Walker = void(Accumulator&, DexMethod*, IRCode&)>
+    static Accumulator reduce_code(const Classes& classes,
+                                   const Walker& walker,
+                                   size_t grain_size = kDefaultGrainSize,
+                                   size_t num_threads = default_num_threads()) {
+      return reduce_code<Accumulator>(
+          classes,
+          walker,
+          [](unsigned int) { return Accumulator(); },
+          grain_size,
+          num_threads);
+    }
+
+    // In opcodes, enough work per chunk that handing it out costs little.
+    static constexpr size_t kDefaultGrainSize = 1024;
+
     /**
      * Call `walker` on all fields in `classes` in parallel.
      */
@@ -426,12 +537,21 @@ class walk {
                      MethodFilterFn filter,
                      CodeWalkerFn walker,
                      size_t num_threads = default_num_threads()) {
+      auto phase = method_profiler::current_phase();
       auto wq = workqueue_foreach<DexClass*>(
-          [&filter, &walker](DexClass* cls) {
-            walk::iterate_code(cls, filter, walker);
+          [&filter, &walker, phase](DexClass* cls) {
+            if (phase == nullptr) {
+              walk::iterate_code(cls, filter, walker);
+              return;
+            }
+            walk::iterate_code(
+                cls, filter, [&walker, phase](DexMethod* m, IRCode& code) {
+                  method_profiler::MethodTimer timer(phase, m);
+                  walker(m, code);
+                });
           },
           num_threads);
-      run_all(wq, classes);
+      run_all_by_code_size(wq, classes);
     }
 
     /**
@@ -453,12 +573,23 @@ class walk {
                         MethodFilterFn filter,
                         InsnWalkerFn walker,
                         size_t num_threads = default_num_threads()) {
+      auto phase = method_profiler::current_phase();
       auto wq = workqueue_foreach<DexClass*>(
-          [&filter, &walker](DexClass* cls) {
-            walk::iterate_opcodes(cls, filter, walker);
+          [&filter, &walker, phase](DexClass* cls) {
+            if (phase == nullptr) {
+              walk::iterate_opcodes(cls, filter, walker);
+              return;
+            }
+            walk::iterate_code(
+                cls, filter, [&walker, phase](DexMethod* m, IRCode& code) {
+                  method_profiler::MethodTimer timer(phase, m);
+                  for (const MethodItemEntry& mie : InstructionIterable(code)) {
+                    walker(m, mie.insn);
+                  }
+                });
           },
           num_threads);
-      run_all(wq, classes);
+      run_all_by_code_size(wq, classes);
     }
 
     /**
@@ -503,7 +634,7 @@ class walk {
             walk::iterate_matching(cls, predicate, walker);
           },
           num_threads);
-      run_all(wq, classes);
+      run_all_by_code_size(wq, classes);
     }
 
     /**
@@ -526,16 +657,21 @@ class walk {
             walk::iterate_matching_block(cls, predicate, walker);
           },
           num_threads);
-      run_all(wq, classes);
+      run_all_by_code_size(wq, classes);
     }
 
     /**
      * This code usually runs on a processor with Hyperthreading, where the
      * number of physical cores is half the number of logical cores. Setting
      * num_threads to that number often gets us good results, so that's the
-     * default.
+     * default. When a thread pool is running, its size was configured
+     * explicitly and takes precedence.
      */
     static unsigned int default_num_threads() {
+      auto pool = ThreadPool::current();
+      if (pool != nullptr) {
+        return pool->size();
+      }
       unsigned int threads = std::thread::hardware_concurrency() / 2;
       return std::max(1u, threads);
     }
@@ -548,5 +684,34 @@ class walk {
       };
       wq.run_all();
     }
+
+    /**
+     * Same as run_all(), but hints the queue with the amount of code in each
+     * class so that classes with huge methods get started first.
+     */
+    template <class WQ, class Classes>
+    static void run_all_by_code_size(WQ& wq, const Classes& classes) {
+      for (const auto& cls : classes) {
+        wq.add_item(cls, code_size_hint(cls));
+      };
+      wq.run_all();
+    }
+
+    static size_t code_size_hint(const DexClass* cls) {
+      size_t size = 0;
+      walk::iterate_methods(
+          cls, [&](DexMethod* m) { size += method_size_hint(m); });
+      return size;
+    }
+
+    // Sizing up the code mustn't cost a walk over it, nor count as an access
+    // that keeps it ballooned.
+    static size_t method_size_hint(const DexMethod* m) {
+      if (m->is_balloon_deferred()) {
+        return m->get_dex_code()->get_instructions().size();
+      }
+      auto code = m->peek_code();
+      return code != nullptr ? code->count_entries() : 0;
+    }
   };
 };
@@ -10,14 +10,22 @@
 #pragma once
 
 #include "Debug.h"
+#include "ThreadPool.h"
+#include "Timeline.h"
 
 #include <algorithm>
+#include <atomic>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 #include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <numeric>
 #include <queue>
 #include <random>
+#include <vector>
 
 namespace workqueue_impl {
 
@@ -39,26 +47,182 @@ inline std::vector<int> create_permutation(int num, unsigned int thread_idx) {
   return attempts;
 }
 
+// See workqueue_shuffle_schedules().
+inline std::atomic<uint64_t>& shuffle_seed() {
+  static std::atomic<uint64_t> seed{0};
+  return seed;
+}
+
+inline std::atomic<uint64_t>& shuffled_runs() {
+  static std::atomic<uint64_t> runs{0};
+  return runs;
+}
+
+/**
+ * The queue and worker index the current thread is running tasks for, so that
+ * tasks added from inside a worker go straight to that worker's deque.
+ */
+struct CurrentWorker {
+  const void* queue{nullptr};
+  size_t idx{0};
+};
+
+inline CurrentWorker& current_worker() {
+  static thread_local CurrentWorker worker;
+  return worker;
+}
+
+/**
+ * A Chase-Lev work-stealing deque (see "Correct and Efficient Work-Stealing
+ * for Weak Memory Models", Le et al., PPoPP'13). The owning worker pushes and
+ * takes at the bottom without locking; other workers steal from the top.
+ *
+ * Elements are pointers so that every slot can be read and written
+ * atomically, whatever the type of the tasks is. Buffers are only freed when
+ * the deque is destroyed, since a thief may still be reading an old one
+ * after the owner has grown it.
+ */
+template <class T>
+class WorkStealingDeque {
+ public:
+  enum class StealResult { SUCCESS, EMPTY, CONTENDED };
+
+  WorkStealingDeque() { m_buffer = new_buffer(64); }
+
+  ~WorkStealingDeque() {
+    for (auto buf : m_buffers) {
+      delete[] buf->slots;
+      delete buf;
+    }
+  }
+
+  // Owner only.
+  void push(T* item) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    Buffer* buf = m_buffer.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(buf->capacity) - 1) {
+      buf = grow(buf, t, b);
+    }
+    buf->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. Returns nullptr if the deque is empty.
+  T* take() {
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Buffer* buf = m_buffer.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* item = buf->get(b);
+    if (t == b) {
+      // Last element: race against thieves for it.
+      if (!m_top.compare_exchange_strong(t,
+                                         t + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread.
+  StealResult steal(T** item) {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return StealResult::EMPTY;
+    }
+    Buffer* buf = m_buffer.load(std::memory_order_acquire);
+    *item = buf->get(t);
+    if (!m_top.compare_exchange_strong(t,
+                                       t + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+      return StealResult::CONTENDED;
+    }
+    return StealResult::SUCCESS;
+  }
+
+ private:
+  struct Buffer {
+    size_t capacity;
+    std::atomic<T*>* slots;
+
+    T* get(int64_t i) const {
+      return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+    void put(int64_t i, T* item) {
+      slots[i & (capacity - 1)].store(item, std::memory_order_relaxed);
+    }
+  };
+
+  Buffer* new_buffer(size_t capacity) {
+    auto buf = new Buffer();
+    buf->capacity = capacity;
+    buf->slots = new std::atomic<T*>[capacity];
+    m_buffers.push_back(buf);
+    return buf;
+  }
+
+  Buffer* grow(Buffer* old_buf, int64_t t, int64_t b) {
+    Buffer* buf = new_buffer(old_buf->capacity * 2);
+    for (int64_t i = t; i < b; ++i) {
+      buf->put(i, old_buf->get(i));
+    }
+    m_buffer.store(buf, std::memory_order_release);
+    return buf;
+  }
+
+  std::atomic<int64_t> m_top{0};
+  std::atomic<int64_t> m_bottom{0};
+  std::atomic<Buffer*> m_buffer;
+  // Only touched by the owner.
+  std::vector<Buffer*> m_buffers;
+};
+
 } // namespace workqueue_impl
 
+/**
+ * The number of threads queues use unless told otherwise: the size of the
+ * current thread pool if there is one, else the number of hardware threads.
+ */
+inline unsigned int workqueue_default_num_threads() {
+  auto pool = ThreadPool::current();
+  if (pool != nullptr) {
+    return pool->size();
+  }
+  return std::max(1u, boost::thread::hardware_concurrency());
+}
+
+/**
+ * Makes the queues that run from now on deal their items out to the workers
+ * in a random order, drawn from `seed` and how many queues ran before,
+ * instead of largest first. Output that depends on which worker ran what, or
+ * in which order, then changes from one run to the next. Meant for checking
+ * determinism, see --determinism-check in redex-all. A seed of 0 turns it
+ * off.
+ */
+inline void workqueue_shuffle_schedules(uint64_t seed) {
+  workqueue_impl::shuffle_seed() = seed;
+}
+
 template <class Input, class Data, class Output>
 struct WorkerState {
-  std::queue<Input> queue;
-  boost::mutex queue_mtx;
+  workqueue_impl::WorkStealingDeque<Input> queue;
   Data data;
   Output result;
 
   WorkerState(const Data& initial) : data(initial) {}
-
-  bool pop_task(Input& task) {
-    boost::lock_guard<boost::mutex> guard(queue_mtx);
-    if (!queue.empty()) {
-      task = std::move(queue.front());
-      queue.pop();
-      return true;
-    }
-    return false;
-  }
 };
 
 template <class Input, class Data, class Output>
@@ -71,10 +235,55 @@ class WorkQueue {
   std::vector<std::unique_ptr<WorkerState<Input, Data, Output>>> m_states;
 
   const size_t m_num_threads{1};
-  size_t m_insert_idx{0};
+
+  // Items added before run_all(), along with their size hints.
+  std::vector<Input> m_items;
+  std::vector<size_t> m_item_sizes;
+  bool m_has_size_hints{false};
+  bool m_wait_for_dynamic_items{false};
+
+  // Items added while running. They are owned here so that the deques can
+  // hold stable pointers to them; the ones added by threads that aren't
+  // workers of this queue wait in `external` until a worker picks them up.
+  //
+  // With m_wait_for_dynamic_items, a worker that finds nothing to do only
+  // exits once no item is left unfinished, since those may add more. Until
+  // then it sleeps on `added`, which is signalled with every dynamic item.
+  struct DynamicItems {
+    boost::mutex mtx;
+    boost::condition_variable added;
+    std::atomic<size_t> num_added{0};
+    std::atomic<size_t> unfinished{0};
+    std::vector<std::unique_ptr<Input>> items;
+    std::queue<Input*> external;
+  };
+  std::unique_ptr<DynamicItems> m_dynamic{std::make_unique<DynamicItems>()};
 
   void consume(WorkerState<Input, Data, Output>* state, Input task) {
-    state->result = m_reducer(state->result, m_mapper(state->data, task));
+    try {
+      state->result = m_reducer(state->result, m_mapper(state->data, task));
+    } catch (...) {
+      finish_item();
+      throw;
+    }
+    finish_item();
+  }
+
+  void finish_item() {
+    if (m_dynamic->unfinished.fetch_sub(1) == 1) {
+      boost::lock_guard<boost::mutex> guard(m_dynamic->mtx);
+      m_dynamic->added.notify_all();
+    }
+  }
+
+  bool pop_external(Input** task) {
+    boost::lock_guard<boost::mutex> guard(m_dynamic->mtx);
+    if (m_dynamic->external.empty()) {
+      return false;
+    }
+    *task = m_dynamic->external.front();
+    m_dynamic->external.pop();
+    return true;
   }
 
  public:
@@ -86,6 +295,24 @@ class WorkQueue {
 
   void add_item(Input task);
 
+  /**
+   * Same as add_item, with an estimate of how much work the item represents
+   * (e.g. its number of instructions). Items added before run_all() are
+   * started in decreasing order of size, so that a few huge items don't end
+   * up running last while all other workers sit idle.
+   */
+  void add_item(Input task, size_t size_hint);
+
+  /**
+   * For queues whose items add more items while they run. A worker that runs
+   * out of items then waits for the running ones to finish, and picks up what
+   * they add, instead of returning. Without it, idle workers go back to the
+   * pool right away, and items added late run on the workers still busy.
+   */
+  void set_wait_for_dynamic_items(bool wait) {
+    m_wait_for_dynamic_items = wait;
+  }
+
   void set_mapper(std::function<Output(Data&, Input)> mapper) {
     m_mapper = mapper;
   }
@@ -95,7 +322,8 @@ class WorkQueue {
   }
 
   /**
-   * Spawn threads and evaluate function.  This method blocks.
+   * Evaluate the function on the current thread pool, or on freshly spawned
+   * threads if there is none.  This method blocks.
    */
   Output run_all(const Output& init_output = Output());
 };
@@ -121,8 +349,7 @@ WorkQueue<Input, Data, Output>::WorkQueue(
 template <class Input>
 WorkQueue<Input, std::nullptr_t /*Data*/, std::nullptr_t /*Output*/>
 workqueue_foreach(const std::function<void(Input)>& func,
-                  unsigned int num_threads =
-                      std::max(1u, boost::thread::hardware_concurrency())) {
+                  unsigned int num_threads = workqueue_default_num_threads()) {
   using Data = std::nullptr_t;
   using Output = std::nullptr_t;
   return WorkQueue<Input, Data, Output>(
@@ -143,8 +370,7 @@ template <class Input, class Output>
 WorkQueue<Input, std::nullptr_t /*Data*/, Output> workqueue_mapreduce(
     const std::function<Output(Input)>& mapper,
     const std::function<Output(Output, Output)>& reducer,
-    unsigned int num_threads =
-        std::max(1u, boost::thread::hardware_concurrency())) {
+    unsigned int num_threads = workqueue_default_num_threads()) {
   using Data = std::nullptr_t;
   return WorkQueue<Input, Data, Output>(
       [mapper](Data&, Input a) -> Output { return mapper(a); },
@@ -156,53 +382,168 @@ WorkQueue<Input, std::nullptr_t /*Data*/, Output> workqueue_mapreduce(
 template <class Input, class Data, class Output>
 void WorkQueue<Input, Data, Output>::add_item(Input task) {
   if (m_currently_running) {
-    auto insert_idx = rand() % m_num_threads;
-    boost::lock_guard<boost::mutex> guard(m_states[insert_idx]->queue_mtx);
-    m_states[insert_idx]->queue.push(task);
+    auto& worker = workqueue_impl::current_worker();
+    boost::lock_guard<boost::mutex> guard(m_dynamic->mtx);
+    m_dynamic->items.emplace_back(std::make_unique<Input>(std::move(task)));
+    auto item = m_dynamic->items.back().get();
+    m_dynamic->unfinished++;
+    if (worker.queue == this) {
+      m_states[worker.idx]->queue.push(item);
+    } else {
+      m_dynamic->external.push(item);
+    }
+    m_dynamic->num_added++;
+    m_dynamic->added.notify_one();
+  } else {
+    m_items.push_back(std::move(task));
+    m_item_sizes.push_back(0);
+  }
+}
+
+template <class Input, class Data, class Output>
+void WorkQueue<Input, Data, Output>::add_item(Input task, size_t size_hint) {
+  if (m_currently_running) {
+    add_item(std::move(task));
   } else {
-    m_insert_idx = (m_insert_idx + 1) % m_num_threads;
-    m_states[m_insert_idx]->queue.push(task);
+    m_items.push_back(std::move(task));
+    m_item_sizes.push_back(size_hint);
+    m_has_size_hints = true;
   }
 }
 
 /*
- * Each worker thread pulls from its own queue first, and then once finished
- * looks randomly at other queues to try and steal work.
+ * Each worker thread pulls from its own deque first, and then once finished
+ * looks randomly at other deques to try and steal work.
  */
 template <class Input, class Data, class Output>
 Output WorkQueue<Input, Data, Output>::run_all(const Output& init_output) {
+  // Deal the items out round-robin, largest first if we have size hints.
+  // Owners take from the bottom of their deque, so push in reverse to have
+  // them start with their first (i.e. largest) item.
+  std::vector<size_t> order(m_items.size());
+  std::iota(order.begin(), order.end(), 0);
+  uint64_t shuffle_seed = workqueue_impl::shuffle_seed();
+  if (shuffle_seed != 0) {
+    std::mt19937_64 rng(shuffle_seed + workqueue_impl::shuffled_runs()++);
+    std::shuffle(order.begin(), order.end(), rng);
+  } else if (m_has_size_hints) {
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return m_item_sizes[a] > m_item_sizes[b];
+    });
+  }
+  for (size_t i = order.size(); i-- > 0;) {
+    m_states[i % m_num_threads]->queue.push(&m_items[order[i]]);
+  }
+
+  m_dynamic->unfinished = m_items.size();
   m_currently_running = true;
-  std::vector<boost::thread> all_threads;
+  // With the timeline on, each worker records one span for its whole run,
+  // with how many items it ran and stole, and one span per wait for work.
+  bool record_timeline = timeline::enabled();
   auto worker = [&](WorkerState<Input, Data, Output>* state, size_t state_idx) {
+    // A pool thread may already be running a worker of an outer queue that
+    // is waiting on this one, so restore whatever was there on exit.
+    auto& current = workqueue_impl::current_worker();
+    auto outer = current;
+    current.queue = this;
+    current.idx = state_idx;
     state->result = init_output;
     auto attempts =
         workqueue_impl::create_permutation(m_num_threads, state_idx);
+    timeline::clock::time_point worker_start;
+    if (record_timeline) {
+      worker_start = timeline::clock::now();
+    }
+    uint64_t num_items = 0;
+    uint64_t num_steals = 0;
     while (true) {
-      auto have_task = false;
-      for (auto idx : attempts) {
-        auto other_state = m_states[idx].get();
-        Input task;
-        have_task = other_state->pop_task(task);
-        if (have_task) {
-          consume(state, task);
-          break;
-        }
+      size_t num_added = m_dynamic->num_added;
+      Input* task = state->queue.take();
+      if (task == nullptr && !pop_external(&task)) {
+        // Keep sweeping the other deques until they all look empty. A
+        // contended steal means there was work, so it's worth another sweep.
+        bool contended;
+        do {
+          contended = false;
+          for (auto idx : attempts) {
+            if (idx == static_cast<int>(state_idx)) {
+              continue;
+            }
+            auto result = m_states[idx]->queue.steal(&task);
+            if (result == workqueue_impl::WorkStealingDeque<
+                              Input>::StealResult::SUCCESS) {
+              ++num_steals;
+              break;
+            }
+            task = nullptr;
+            if (result == workqueue_impl::WorkStealingDeque<
+                              Input>::StealResult::CONTENDED) {
+              contended = true;
+            }
+          }
+        } while (task == nullptr && contended);
       }
-      if (!have_task) {
+      if (task == nullptr && !m_wait_for_dynamic_items) {
+        if (record_timeline) {
+          timeline::record("workqueue",
+                           "worker " + std::to_string(state_idx),
+                           worker_start,
+                           timeline::clock::now(),
+                           {{"items", num_items}, {"steals", num_steals}});
+        }
+        current = outer;
         return;
       }
+      if (task == nullptr) {
+        // Nothing to do right now. Wait for either a new item, or for the
+        // running ones to finish without adding any.
+        timeline::clock::time_point idle_start;
+        if (record_timeline) {
+          idle_start = timeline::clock::now();
+        }
+        boost::unique_lock<boost::mutex> lock(m_dynamic->mtx);
+        m_dynamic->added.wait(lock, [&] {
+          return m_dynamic->num_added != num_added ||
+                 m_dynamic->unfinished == 0;
+        });
+        bool done = m_dynamic->unfinished == 0;
+        lock.unlock();
+        if (record_timeline) {
+          auto now = timeline::clock::now();
+          timeline::record("workqueue", "idle", idle_start, now);
+          if (done) {
+            timeline::record("workqueue",
+                             "worker " + std::to_string(state_idx),
+                             worker_start,
+                             now,
+                             {{"items", num_items}, {"steals", num_steals}});
+          }
+        }
+        if (done) {
+          current = outer;
+          return;
+        }
+        continue;
+      }
+      ++num_items;
+      consume(state, *task);
     }
   };
 
-  for (size_t i = 0; i < m_num_threads; ++i) {
-    boost::thread::attributes attrs;
-    attrs.set_stack_size(8 * 1024 * 1024);
-    all_threads.emplace_back(attrs,
-                             boost::bind<void>(worker, m_states[i].get(), i));
-  }
-
-  for (auto& thread : all_threads) {
-    thread.join();
+  auto pool = ThreadPool::current();
+  if (pool != nullptr) {
+    pool->run(m_num_threads, [&](size_t i) { worker(m_states[i].get(), i); });
+  } else {
+    std::vector<boost::thread> all_threads;
+    for (size_t i = 0; i < m_num_threads; ++i) {
+      boost::thread::attributes attrs;
+      attrs.set_stack_size(8 * 1024 * 1024);
+      all_threads.emplace_back(attrs,
+                               boost::bind<void>(worker, m_states[i].get(), i));
+    }
+    for (auto& thread : all_threads) {
+      thread.join();
+    }
   }
 
   Output result = init_output;
@@ -210,5 +551,10 @@ Output WorkQueue<Input, Data, Output>::run_all(const Output& init_output) {
     result = m_reducer(result, thread_state->result);
   }
   m_currently_running = false;
+  m_items.clear();
+  m_item_sizes.clear();
+  m_has_size_hints = false;
+  m_dynamic->items.clear();
+  m_dynamic->num_added = 0;
   return result;
 }
@@ -10,9 +10,12 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <functional>
 #include <fstream>
 #include <map>
 #include <boost/regex.hpp>
@@ -23,6 +26,12 @@
 #include <unordered_set>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #ifdef _MSC_VER
 #include "CompatWindows.h"
 #endif
@@ -36,7 +45,10 @@
 #include "utils/Serialize.h"
 #include "utils/TypeHelpers.h"
 
+#include "AhoCorasick.h"
+#include "RedexResources.h"
 #include "StringUtil.h"
+#include "WorkQueue.h"
 
 constexpr size_t MIN_CLASSNAME_LENGTH = 10;
 constexpr size_t MAX_CLASSNAME_LENGTH = 500;
@@ -104,77 +116,206 @@ std::string dotname_to_dexname(const std::string& classname) {
   return dexname;
 }
 
-void extract_by_pattern(
-    const std::string& string_to_search,
-    boost::regex regex,
-    std::unordered_set<std::string>& result) {
-  boost::smatch m;
-  std::string s = string_to_search;
-  while (boost::regex_search (s, m, regex)) {
-    if (m.size() > 1) {
-        result.insert(m[1].str());
-    }
-    s = m.suffix().str();
-  }
+namespace {
+
+// The literal parts of the patterns that extract_js_resources() looks for.
+enum JsAnchor : size_t {
+  QUOTE,
+  // "<sound>.m4a" and "<sound>.ogg"
+  M4A_END,
+  OGG_END,
+  // uri: "<uri>"
+  URI,
+  // registerAsset(<registration>)
+  REGISTER_ASSET,
+};
+
+const AhoCorasick& js_anchors() {
+  static const AhoCorasick anchors(
+      {"\"", ".m4a\"", ".ogg\"", "uri:", "registerAsset("});
+  return anchors;
 }
 
-void extract_js_sounds(
-    const std::string& file_contents,
-    std::unordered_set<std::string>& result) {
-  static boost::regex sound_regex("\"([^\\\"]+)\\.(m4a|ogg)\"");
-  extract_by_pattern(file_contents, sound_regex, result);
+inline bool is_word_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
 }
 
-void extract_js_uris(
-    const std::string& file_contents,
-    std::unordered_set<std::string>& result) {
-  static boost::regex uri_regex("\\buri:\\s*\"([^\\\"]+)\"");
-  extract_by_pattern(file_contents, uri_regex, result);
+inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+         c == '\r';
 }
 
-void extract_js_asset_registrations(
-    const std::string& file_contents,
-    std::unordered_set<std::string>& result) {
-  static boost::regex register_regex("registerAsset\\((.+?)\\)");
+// Adds the asset that a registerAsset() call registers, if it names one.
+void add_js_asset_registration(const std::string& registration,
+                               std::unordered_set<std::string>& result) {
   static boost::regex name_regex("name:\\\"(.+?)\\\"");
   static boost::regex location_regex("httpServerLocation:\\\"/assets/(.+?)\\\"");
   static boost::regex special_char_regex("[^a-z0-9_]");
+  boost::smatch m;
+  if (!boost::regex_search (registration, m, location_regex) || m.size() == 0) {
+    return;
+  }
+  std::stringstream asset_path;
+  asset_path << m[1].str() << '/'; // location
+  if (!boost::regex_search (registration, m, name_regex) || m.size() == 0) {
+    return;
+  }
+  asset_path << m[1].str(); // name
+  std::string full_path = asset_path.str();
+  boost::replace_all(full_path, "/", "_");;
+  boost::algorithm::to_lower(full_path);
+
+  std::stringstream stripped_asset_path;
+  std::ostream_iterator<char, char> oi(stripped_asset_path);
+  boost::regex_replace(oi, full_path.begin(), full_path.end(),
+    special_char_regex, "", boost::match_default | boost::format_all);
+
+  result.emplace(stripped_asset_path.str());
+}
+
+} // namespace
+
+/*
+ * Returns the resources that a JS bundle refers to: the sounds in string
+ * literals (`"<name>.m4a"` and `"<name>.ogg"`), the values of `uri:`
+ * properties and the assets passed to `registerAsset()`.
+ *
+ * This finds what the regexes
+ *
+ *   "([^"]+)\.(m4a|ogg)"
+ *   \buri:\s*"([^"]+)"
+ *   registerAsset\((.+?)\)
+ *
+ * would find, each searched for separately over the whole bundle, but in a
+ * single pass that only looks for their literal parts, and checks the rest
+ * around each occurrence. As with successive searches, the matches of a
+ * pattern don't overlap.
+ */
+std::unordered_set<std::string> extract_js_resources(boost::string_ref file_contents) {
+  const char* begin = file_contents.begin();
+  const char* end = file_contents.end();
+  std::unordered_set<std::string> result;
   std::unordered_set<std::string> registrations;
-  extract_by_pattern(file_contents, register_regex, registrations);
-  for (std::string registration : registrations) {
-    boost::smatch m;
-    if (!boost::regex_search (registration, m, location_regex) || m.size() == 0) {
-      continue;
+  // The last two quotes seen.
+  const char* last_quote = nullptr;
+  const char* previous_quote = nullptr;
+  // Where the next match of each kind may start.
+  const char* sound_start = begin;
+  const char* uri_start = begin;
+  const char* register_start = begin;
+
+  js_anchors().search(begin, end, [&](size_t anchor, const char* match_end) {
+    switch (anchor) {
+    case QUOTE:
+      previous_quote = last_quote;
+      last_quote = match_end - 1;
+      break;
+    case M4A_END:
+    case OGG_END: {
+      // The opening quote is the one before the closing one, which may or
+      // may not have been seen yet.
+      auto closing_quote = match_end - 1;
+      auto opening_quote =
+          last_quote == closing_quote ? previous_quote : last_quote;
+      auto name_end = match_end - 5;
+      if (opening_quote != nullptr && opening_quote >= sound_start &&
+          opening_quote + 1 < name_end) {
+        result.emplace(opening_quote + 1, name_end);
+        sound_start = match_end;
+      }
+      break;
     }
-    std::stringstream asset_path;
-    asset_path << m[1].str() << '/'; // location
-    if (!boost::regex_search (registration, m, name_regex) || m.size() == 0) {
-      continue;
+    case URI: {
+      auto match_start = match_end - 4;
+      if (match_start < uri_start ||
+          (match_start > begin && is_word_char(match_start[-1]))) {
+        break;
+      }
+      auto p = match_end;
+      while (p < end && is_space(*p)) {
+        ++p;
+      }
+      if (p == end || *p != '"') {
+        break;
+      }
+      auto value_start = p + 1;
+      auto value_end = std::find(value_start, end, '"');
+      if (value_end == end || value_end == value_start) {
+        break;
+      }
+      result.emplace(value_start, value_end);
+      uri_start = value_end + 1;
+      break;
     }
-    asset_path << m[1].str(); // name
-    std::string full_path = asset_path.str();
-    boost::replace_all(full_path, "/", "_");;
-    boost::algorithm::to_lower(full_path);
+    case REGISTER_ASSET: {
+      if (match_end - 14 < register_start || match_end == end) {
+        break;
+      }
+      // At least one character, up to the first ')' after it.
+      auto registration_end = std::find(match_end + 1, end, ')');
+      if (registration_end == end) {
+        break;
+      }
+      registrations.emplace(match_end, registration_end);
+      register_start = registration_end + 1;
+      break;
+    }
+    }
+  });
+
+  for (const auto& registration : registrations) {
+    add_js_asset_registration(registration, result);
+  }
+  return result;
+}
 
-    std::stringstream stripped_asset_path;
-    std::ostream_iterator<char, char> oi(stripped_asset_path);
-    boost::regex_replace(oi, full_path.begin(), full_path.end(),
-      special_char_regex, "", boost::match_default | boost::format_all);
+namespace {
 
-    result.emplace(stripped_asset_path.str());
+// Adds the class that the element the parser is at refers to, if any.
+void gather_layout_class(const android::ResXMLTree& parser,
+                         std::unordered_set<std::string>& result) {
+  static const android::String16 name("name");
+  static const android::String16 klazz("class");
+  size_t len;
+  android::String16 tag(parser.getElementName(&len));
+  std::string classname = convert_from_string16(tag);
+  if (!strcmp(classname.c_str(), "fragment") || !strcmp(classname.c_str(), "view")) {
+    classname = get_string_attribute_value(parser, klazz);
+    if (classname.empty()) {
+      classname = get_string_attribute_value(parser, name);
+    }
+  }
+  std::string converted = std::string("L") + classname + std::string(";");
+
+  bool is_classname = converted.find('.') != std::string::npos;
+  if (is_classname) {
+    std::replace(converted.begin(), converted.end(), '.', '/');
+    result.insert(converted);
   }
 }
 
-std::unordered_set<std::string> extract_js_resources(const std::string& file_contents) {
-  std::unordered_set<std::string> result;
-  extract_js_sounds(file_contents, result);
-  extract_js_uris(file_contents, result);
-  extract_js_asset_registrations(file_contents, result);
-  return result;
+// Adds the resource ids that the attributes of the element the parser is at
+// refer to.
+void gather_reference_attributes(const android::ResXMLTree& parser,
+                                 std::unordered_set<uint32_t>& result) {
+  const size_t attr_count = parser.getAttributeCount();
+  for (size_t i = 0; i < attr_count; ++i) {
+    if (parser.getAttributeDataType(i) == android::Res_value::TYPE_REFERENCE ||
+        parser.getAttributeDataType(i) == android::Res_value::TYPE_ATTRIBUTE) {
+      android::Res_value outValue;
+      parser.getAttributeValue(i, &outValue);
+      if (outValue.data > PACKAGE_RESID_START) {
+        result.emplace(outValue.data);
+      }
+    }
+  }
 }
 
+} // namespace
+
 std::unordered_set<uint32_t> extract_xml_reference_attributes(
-    const std::string& file_contents,
+    boost::string_ref file_contents,
     const std::string& filename) {
   android::ResXMLTree parser;
   parser.setTo(file_contents.data(), file_contents.size());
@@ -187,17 +328,7 @@ std::unordered_set<uint32_t> extract_xml_reference_attributes(
   do {
     type = parser.next();
     if (type == android::ResXMLParser::START_TAG) {
-      const size_t attr_count = parser.getAttributeCount();
-      for (size_t i = 0; i < attr_count; ++i) {
-        if (parser.getAttributeDataType(i) == android::Res_value::TYPE_REFERENCE ||
-            parser.getAttributeDataType(i) == android::Res_value::TYPE_ATTRIBUTE) {
-          android::Res_value outValue;
-          parser.getAttributeValue(i, &outValue);
-          if (outValue.data > PACKAGE_RESID_START) {
-            result.emplace(outValue.data);
-          }
-        }
-      }
+      gather_reference_attributes(parser, result);
     }
   } while (type != android::ResXMLParser::BAD_DOCUMENT &&
            type != android::ResXMLParser::END_DOCUMENT);
@@ -260,7 +391,7 @@ void walk_references_for_resource(
  * Parse AndroidManifest from buffer, return a list of class names that are
  * referenced
  */
-std::unordered_set<std::string> extract_classes_from_manifest(const std::string& manifest_contents) {
+std::unordered_set<std::string> extract_classes_from_manifest(boost::string_ref manifest_contents) {
 
   // Tags
   android::String16 activity("activity");
@@ -329,16 +460,13 @@ std::unordered_set<std::string> extract_classes_from_manifest(const std::string&
   return result;
 }
 
-std::unordered_set<std::string> extract_classes_from_layout(const std::string& layout_contents) {
+std::unordered_set<std::string> extract_classes_from_layout(boost::string_ref layout_contents) {
 
   android::ResXMLTree parser;
   parser.setTo(layout_contents.data(), layout_contents.size());
 
   std::unordered_set<std::string> result;
 
-  android::String16 name("name");
-  android::String16 klazz("class");
-
   if (parser.getError() != android::NO_ERROR) {
     return result;
   }
@@ -347,88 +475,196 @@ std::unordered_set<std::string> extract_classes_from_layout(const std::string& l
   do {
     type = parser.next();
     if (type == android::ResXMLParser::START_TAG) {
-      size_t len;
-      android::String16 tag(parser.getElementName(&len));
-      std::string classname = convert_from_string16(tag);
-      if (!strcmp(classname.c_str(), "fragment") || !strcmp(classname.c_str(), "view")) {
-        classname = get_string_attribute_value(parser, klazz);
-        if (classname.empty()) {
-          classname = get_string_attribute_value(parser, name);
-        }
-      }
-      std::string converted = std::string("L") + classname + std::string(";");
-
-      bool is_classname = converted.find('.') != std::string::npos;
-      if (is_classname) {
-        std::replace(converted.begin(), converted.end(), '.', '/');
-        result.insert(converted);
-      }
+      gather_layout_class(parser, result);
     }
   } while (type != android::ResXMLParser::BAD_DOCUMENT &&
            type != android::ResXMLParser::END_DOCUMENT);
   return result;
 }
 
+namespace {
+
+inline bool is_classname_start(char c) {
+  // All classnames start with a package, which starts with a lowercase
+  // letter. Some of them are preceded by an 'L' and followed by a ';' in
+  // native libraries while others are not.
+  return (c >= 'a' && c <= 'z') || c == 'L';
+}
+
+inline bool is_classname_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '/' || c == '_' || c == '$';
+}
+
 /*
- * Returns all strings that look like java class names from a native library.
- *
- * Return values will be formatted the way that the dex spec formats class names:
+ * The scanners below classify 16 bytes at a time, as bitmasks with a bit per
+ * byte (4 bits per byte on NEON, which has no movemask), and only look at
+ * bytes one by one for the tail.
+ */
+#if defined(__SSE2__)
+
+inline __m128i in_range(__m128i v, char lo, char hi) {
+  auto clamped =
+      _mm_min_epu8(_mm_max_epu8(v, _mm_set1_epi8(lo)), _mm_set1_epi8(hi));
+  return _mm_cmpeq_epi8(clamped, v);
+}
+
+inline uint32_t classname_start_mask(const char* p) {
+  auto v = _mm_loadu_si128((const __m128i*)p);
+  auto start = _mm_or_si128(in_range(v, 'a', 'z'),
+                            _mm_cmpeq_epi8(v, _mm_set1_epi8('L')));
+  return _mm_movemask_epi8(start);
+}
+
+inline uint32_t non_classname_char_mask(const char* p) {
+  auto v = _mm_loadu_si128((const __m128i*)p);
+  auto letters = _mm_or_si128(in_range(v, 'a', 'z'), in_range(v, 'A', 'Z'));
+  auto others = _mm_or_si128(
+      _mm_or_si128(in_range(v, '0', '9'), _mm_cmpeq_epi8(v, _mm_set1_epi8('/'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('$'))));
+  return ~_mm_movemask_epi8(_mm_or_si128(letters, others)) & 0xffff;
+}
+
+inline size_t first_in_mask(uint32_t mask) { return __builtin_ctz(mask); }
+
+#define HAS_SIMD_CLASSNAME_SCAN 1
+
+#elif defined(__ARM_NEON)
+
+inline uint8x16_t in_range(uint8x16_t v, char lo, char hi) {
+  return vandq_u8(vcgeq_u8(v, vdupq_n_u8(lo)), vcleq_u8(v, vdupq_n_u8(hi)));
+}
+
+inline uint64_t to_mask(uint8x16_t bytes) {
+  return vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(bytes), 4)), 0);
+}
+
+inline uint64_t classname_start_mask(const char* p) {
+  auto v = vld1q_u8((const uint8_t*)p);
+  return to_mask(vorrq_u8(in_range(v, 'a', 'z'), vceqq_u8(v, vdupq_n_u8('L'))));
+}
+
+inline uint64_t non_classname_char_mask(const char* p) {
+  auto v = vld1q_u8((const uint8_t*)p);
+  auto letters = vorrq_u8(in_range(v, 'a', 'z'), in_range(v, 'A', 'Z'));
+  auto others = vorrq_u8(
+      vorrq_u8(in_range(v, '0', '9'), vceqq_u8(v, vdupq_n_u8('/'))),
+      vorrq_u8(vceqq_u8(v, vdupq_n_u8('_')), vceqq_u8(v, vdupq_n_u8('$'))));
+  return to_mask(vmvnq_u8(vorrq_u8(letters, others)));
+}
+
+inline size_t first_in_mask(uint64_t mask) { return __builtin_ctzll(mask) / 4; }
+
+#define HAS_SIMD_CLASSNAME_SCAN 1
+
+#endif
+
+// The first character at or after `p` that can start a classname, or `end`.
+const char* find_classname_start(const char* p, const char* end) {
+#ifdef HAS_SIMD_CLASSNAME_SCAN
+  for (; p + 16 <= end; p += 16) {
+    auto mask = classname_start_mask(p);
+    if (mask != 0) {
+      return p + first_in_mask(mask);
+    }
+  }
+#endif
+  while (p < end && !is_classname_start(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+// The first character at or after `p` that can't be in a classname, or `end`.
+const char* find_classname_end(const char* p, const char* end) {
+#ifdef HAS_SIMD_CLASSNAME_SCAN
+  for (; p + 16 <= end; p += 16) {
+    auto mask = non_classname_char_mask(p);
+    if (mask != 0) {
+      return p + first_in_mask(mask);
+    }
+  }
+#endif
+  while (p < end && is_classname_char(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+/*
+ * Calls fn(name, size) on every string of `lib_contents` that looks like a
+ * java class name, formatted the way that the dex spec formats class names:
  *
  *   "Ljava/lang/String;"
  *
+ * `name` is null-terminated, and only valid during the call.
  */
-std::unordered_set<std::string> extract_classes_from_native_lib(const std::string& lib_contents) {
-  std::unordered_set<std::string> classes;
+template <typename Fn>
+void for_each_native_lib_classname(boost::string_ref lib_contents, Fn fn) {
   char buffer[MAX_CLASSNAME_LENGTH + 2]; // +2 for the trailing ";\0"
   const char* inptr = lib_contents.data();
-  char* outptr = buffer;
   const char* end = inptr + lib_contents.size();
 
-  size_t length = 0;
-
-  while (inptr < end) {
-    outptr = buffer;
-    length = 0;
-    // All classnames start with a package, which starts with a lowercase
-    // letter. Some of them are preceded by an 'L' and followed by a ';' in
-    // native libraries while others are not.
-    if ((*inptr >= 'a' && *inptr <= 'z') || *inptr == 'L') {
-
-      if (*inptr != 'L') {
-        *outptr++ = 'L';
-        length++;
-      }
-
-      while (( // This loop is safe since lib_contents.data() ends with a \0
-                 (*inptr >= 'a' && *inptr <= 'z') ||
-                 (*inptr >= 'A' && *inptr <= 'Z') ||
-                 (*inptr >= '0' && *inptr <= '9') ||
-                 *inptr == '/' || *inptr == '_' || *inptr == '$')
-             && length < MAX_CLASSNAME_LENGTH) {
-
-        *outptr++ = *inptr++;
-        length++;
-      }
-      if (length >= MIN_CLASSNAME_LENGTH) {
-        *outptr++ = ';';
-        *outptr = '\0';
-        classes.insert(std::string(buffer));
-      }
+  while ((inptr = find_classname_start(inptr, end)) < end) {
+    char* outptr = buffer;
+    size_t length = 0;
+    if (*inptr != 'L') {
+      *outptr++ = 'L';
+      length++;
     }
-    inptr++;
+    auto limit =
+        inptr + std::min<size_t>(end - inptr, MAX_CLASSNAME_LENGTH - length);
+    auto name_end = find_classname_end(inptr, limit);
+    memcpy(outptr, inptr, name_end - inptr);
+    outptr += name_end - inptr;
+    length += name_end - inptr;
+    if (length >= MIN_CLASSNAME_LENGTH) {
+      *outptr++ = ';';
+      *outptr = '\0';
+      fn(buffer, length + 1);
+    }
+    // The character that ended the name can't start one.
+    inptr = name_end + 1;
   }
+}
+
+} // namespace
+
+/*
+ * Returns all strings that look like java class names from a native library.
+ *
+ * Return values will be formatted the way that the dex spec formats class names:
+ *
+ *   "Ljava/lang/String;"
+ *
+ */
+std::unordered_set<std::string> extract_classes_from_native_lib(boost::string_ref lib_contents) {
+  std::unordered_set<std::string> classes;
+  for_each_native_lib_classname(
+      lib_contents,
+      [&](const char* name, size_t size) { classes.emplace(name, size); });
   return classes;
 }
 
 /*
  * Reads an entire file into a std::string. Returns an empty string if
- * anything went wrong (e.g. file not found).
+ * anything went wrong (e.g. file not found). Only for the code that changes
+ * the contents; see MappedFile otherwise.
  */
 std::string read_entire_file(const std::string& filename) {
-  std::ifstream in(filename, std::ios::in | std::ios::binary);
-  std::stringstream sstr;
-  sstr << in.rdbuf();
-  return sstr.str();
+  std::ifstream in(filename, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!in) {
+    return std::string();
+  }
+  std::string contents;
+  contents.resize(in.tellg());
+  in.seekg(0);
+  if (!in.read(&contents[0], contents.size())) {
+    return std::string();
+  }
+  return contents;
 }
 
 void write_entire_file(
@@ -439,10 +675,10 @@ void write_entire_file(
 }
 
 std::unordered_set<std::string> get_manifest_classes(const std::string& filename) {
-  std::string manifest = read_entire_file(filename);
+  MappedFile manifest(filename);
   std::unordered_set<std::string> classes;
-  if (manifest.size()) {
-    classes = extract_classes_from_manifest(manifest);
+  if (manifest.contents().size()) {
+    classes = extract_classes_from_manifest(manifest.contents());
   } else {
     fprintf(stderr, "Unable to read manifest file: %s\n", filename.data());
   }
@@ -487,10 +723,10 @@ std::unordered_set<std::string> get_js_files(const std::string& directory) {
 
 std::unordered_set<std::string> get_candidate_js_resources(
     const std::string& filename) {
-  std::string file_contents = read_entire_file(filename);
+  MappedFile file(filename);
   std::unordered_set<std::string> js_candidate_resources;
-  if (file_contents.size()) {
-    js_candidate_resources = extract_js_resources(file_contents);
+  if (file.contents().size()) {
+    js_candidate_resources = extract_js_resources(file.contents());
   } else {
     fprintf(stderr, "Unable to read file: %s\n", filename.data());
   }
@@ -505,10 +741,19 @@ std::unordered_set<uint32_t> get_js_resources_by_parsing(
   std::unordered_set<std::string> js_candidate_resources;
   std::unordered_set<uint32_t> js_resources;
 
+  using Candidates = std::unordered_set<std::string>;
+  auto wq = workqueue_mapreduce<std::string, Candidates>(
+      get_candidate_js_resources, [](Candidates a, Candidates b) {
+        if (a.size() < b.size()) {
+          std::swap(a, b);
+        }
+        a.insert(b.begin(), b.end());
+        return a;
+      });
   for (auto& f : get_js_files(directory)) {
-    auto c = get_candidate_js_resources(f);
-    js_candidate_resources.insert(c.begin(), c.end());
+    wq.add_item(f);
   }
+  js_candidate_resources = wq.run_all();
 
   // The actual resources are the intersection of the real resources and the
   // candidate resources (since our current javascript processing produces
@@ -549,7 +794,7 @@ std::unordered_set<uint32_t> get_resources_by_name_prefix(
 }
 
 void ensure_file_contents(
-    const std::string& file_contents,
+    boost::string_ref file_contents,
     const std::string& filename) {
   if (!file_contents.size()) {
     fprintf(stderr, "Unable to read file: %s\n", filename.data());
@@ -559,9 +804,9 @@ void ensure_file_contents(
 
 std::unordered_set<uint32_t> get_xml_reference_attributes(
     const std::string& filename) {
-  std::string file_contents = read_entire_file(filename);
-  ensure_file_contents(file_contents, filename);
-  return extract_xml_reference_attributes(file_contents, filename);
+  MappedFile file(filename);
+  ensure_file_contents(file.contents(), filename);
+  return extract_xml_reference_attributes(file.contents(), filename);
 }
 
 bool is_drawable_attribute(
@@ -722,14 +967,82 @@ std::vector<std::string> find_layout_files(const std::string& apk_directory) {
 }
 
 std::unordered_set<std::string> get_layout_classes(const std::string& apk_directory) {
-  std::vector<std::string> tmp = find_layout_files(apk_directory);
-  std::unordered_set<std::string> all_classes;
-  for (auto layout_file : tmp) {
-    std::string contents = read_entire_file(layout_file);
-    std::unordered_set<std::string> classes_from_layout = extract_classes_from_layout(contents);
-    all_classes.insert(classes_from_layout.begin(), classes_from_layout.end());
+  return scan_xml_files(find_layout_files(apk_directory)).classes;
+}
+
+namespace {
+
+void scan_xml_contents(boost::string_ref contents,
+                       const std::unordered_set<std::string>& strings_to_find,
+                       XmlScanResult& result) {
+  android::ResXMLTree parser;
+  parser.setTo(contents.data(), contents.size());
+  if (parser.getError() != android::NO_ERROR) {
+    return;
+  }
+
+  if (!strings_to_find.empty()) {
+    const auto& pool = parser.getStrings();
+    for (size_t i = 0; i < pool.size(); ++i) {
+      size_t u16_len;
+      auto wide_chars = pool.stringAt(i, &u16_len);
+      if (wide_chars == nullptr) {
+        continue;
+      }
+      android::String8 string8(android::String16(wide_chars, u16_len));
+      std::string str(string8.string());
+      if (strings_to_find.count(str)) {
+        result.string_pool_hits.insert(std::move(str));
+      }
+    }
   }
-  return all_classes;
+
+  android::ResXMLParser::event_code_t type;
+  do {
+    type = parser.next();
+    if (type == android::ResXMLParser::START_TAG) {
+      gather_layout_class(parser, result.classes);
+      gather_reference_attributes(parser, result.reference_attributes);
+    }
+  } while (type != android::ResXMLParser::BAD_DOCUMENT &&
+           type != android::ResXMLParser::END_DOCUMENT);
+}
+
+XmlScanResult merge_scan_results(XmlScanResult a, XmlScanResult b) {
+  if (a.classes.size() < b.classes.size()) {
+    std::swap(a.classes, b.classes);
+  }
+  a.classes.insert(b.classes.begin(), b.classes.end());
+  if (a.reference_attributes.size() < b.reference_attributes.size()) {
+    std::swap(a.reference_attributes, b.reference_attributes);
+  }
+  a.reference_attributes.insert(b.reference_attributes.begin(),
+                                b.reference_attributes.end());
+  if (a.string_pool_hits.size() < b.string_pool_hits.size()) {
+    std::swap(a.string_pool_hits, b.string_pool_hits);
+  }
+  a.string_pool_hits.insert(b.string_pool_hits.begin(),
+                            b.string_pool_hits.end());
+  return a;
+}
+
+} // namespace
+
+XmlScanResult scan_xml_files(
+    const std::vector<std::string>& files,
+    const std::unordered_set<std::string>& strings_to_find) {
+  auto wq = workqueue_mapreduce<const std::string*, XmlScanResult>(
+      [&](const std::string* filename) {
+        XmlScanResult result;
+        MappedFile file(*filename);
+        scan_xml_contents(file.contents(), strings_to_find, result);
+        return result;
+      },
+      merge_scan_results);
+  for (const auto& file : files) {
+    wq.add_item(&file);
+  }
+  return wq.run_all();
 }
 
 /**
@@ -759,15 +1072,34 @@ std::vector<std::string> find_native_library_files(const std::string& apk_direct
 /**
  * Return all potential java class names located in native libraries.
  */
-std::unordered_set<std::string> get_native_classes(const std::string& apk_directory) {
+std::unordered_set<std::string> get_native_classes(
+    const std::string& apk_directory,
+    const std::function<bool(const char*)>& is_known) {
   std::vector<std::string> native_libs = find_native_library_files(apk_directory);
-  std::unordered_set<std::string> all_classes;
-  for (auto native_lib : native_libs) {
-    std::string contents = read_entire_file(native_lib);
-    std::unordered_set<std::string> classes_from_layout = extract_classes_from_native_lib(contents);
-    all_classes.insert(classes_from_layout.begin(), classes_from_layout.end());
+  using ClassNames = std::unordered_set<std::string>;
+  auto wq = workqueue_mapreduce<const std::string*, ClassNames>(
+      [&](const std::string* native_lib) {
+        ClassNames classes;
+        MappedFile file(*native_lib);
+        for_each_native_lib_classname(
+            file.contents(), [&](const char* name, size_t size) {
+              if (!is_known || is_known(name)) {
+                classes.emplace(name, size);
+              }
+            });
+        return classes;
+      },
+      [](ClassNames a, ClassNames b) {
+        if (a.size() < b.size()) {
+          std::swap(a, b);
+        }
+        a.insert(b.begin(), b.end());
+        return a;
+      });
+  for (const auto& native_lib : native_libs) {
+    wq.add_item(&native_lib);
   }
-  return all_classes;
+  return wq.run_all();
 }
 
 void* map_file(
@@ -802,6 +1134,25 @@ void unmap_and_close(int file_descriptor, void* file_pointer, size_t length) {
   close(file_descriptor);
 }
 
+MappedFile::MappedFile(const std::string& filename) {
+  size_t length = 0;
+  try {
+    m_data = static_cast<const char*>(
+        map_file(filename.c_str(), m_file_descriptor, length));
+  } catch (const std::runtime_error&) {
+    // Missing, unreadable or empty (which can't be mapped).
+    m_data = nullptr;
+    return;
+  }
+  m_size = length;
+}
+
+MappedFile::~MappedFile() {
+  if (m_data != nullptr) {
+    unmap_and_close(m_file_descriptor, const_cast<char*>(m_data), m_size);
+  }
+}
+
 size_t write_serialized_data(
   const android::Vector<char>& cVec,
   int file_descriptor,
@@ -914,6 +1265,170 @@ int replace_in_xml_string_pool(
   return android::OK;
 }
 
+namespace {
+
+/*
+ * The length of a string in a pool is one unit, or two when it doesn't fit
+ * in one with the high bit clear; units are bytes in a UTF-8 pool and
+ * char16_t in a UTF-16 one. Returns nullptr if the length runs past `end`.
+ */
+template <typename T>
+T* decode_pool_string_length(T* p, const T* end, size_t* out_length) {
+  constexpr size_t kBits = sizeof(T) * 8;
+  constexpr size_t kHighBit = size_t(1) << (kBits - 1);
+  if (p >= end) {
+    return nullptr;
+  }
+  if (*p & kHighBit) {
+    if (p + 1 >= end) {
+      return nullptr;
+    }
+    *out_length = (size_t(*p & ~kHighBit) << kBits) | p[1];
+    return p + 2;
+  }
+  *out_length = *p;
+  return p + 1;
+}
+
+template <typename T>
+size_t pool_string_length_units(size_t length) {
+  return length < (size_t(1) << (sizeof(T) * 8 - 1)) ? 1 : 2;
+}
+
+template <typename T>
+T* encode_pool_string_length(T* p, size_t length) {
+  constexpr size_t kBits = sizeof(T) * 8;
+  constexpr size_t kHighBit = size_t(1) << (kBits - 1);
+  if (pool_string_length_units<T>(length) == 2) {
+    *p++ = T(kHighBit | (length >> kBits));
+  }
+  *p++ = T(length);
+  return p;
+}
+
+} // namespace
+
+bool replace_in_xml_string_pool_in_place(
+  void* data,
+  const size_t len,
+  const std::map<std::string, std::string>& shortened_names,
+  size_t* out_num_renamed) {
+  const auto chunk_size = sizeof(android::ResChunk_header);
+  if (len < chunk_size + sizeof(android::ResStringPool_header)) {
+    return false;
+  }
+  auto pool_ptr = (android::ResStringPool_header*) ((char*) data + chunk_size);
+  if (dtohs(pool_ptr->header.type) != android::RES_STRING_POOL_TYPE) {
+    return false;
+  }
+
+  // Everything is checked against the bounds of the pool, since we're about
+  // to write into it.
+  size_t pool_size = dtohl(pool_ptr->header.size);
+  size_t header_size = dtohs(pool_ptr->header.headerSize);
+  size_t num_strings = dtohl(pool_ptr->stringCount);
+  size_t strings_start = dtohl(pool_ptr->stringsStart);
+  size_t strings_end = dtohl(pool_ptr->styleCount) > 0
+    ? dtohl(pool_ptr->stylesStart)
+    : pool_size;
+  if (pool_size > len - chunk_size ||
+      header_size > pool_size ||
+      num_strings > (pool_size - header_size) / sizeof(uint32_t) ||
+      strings_start > strings_end ||
+      strings_end > pool_size) {
+    return false;
+  }
+  auto pool_begin = (char*) pool_ptr;
+  auto offsets = (const uint32_t*) (pool_begin + header_size);
+  char* strings = pool_begin + strings_start;
+  const char* strings_limit = pool_begin + strings_end;
+  bool is_utf8 =
+    (dtohl(pool_ptr->flags) & android::ResStringPool_header::UTF8_FLAG) != 0;
+
+  // The bytes of a string run from its length to its terminator. Only once
+  // all the replacements are known to fit is anything written.
+  struct Patch {
+    char* begin;
+    char* end;
+    const std::string* replacement;
+  };
+  std::vector<Patch> patches;
+  for (size_t i = 0; i < num_strings; i++) {
+    size_t offset = dtohl(offsets[i]);
+    if (offset >= strings_end - strings_start) {
+      return false;
+    }
+    char* begin = strings + offset;
+    std::string existing_str;
+    char* end;
+    if (is_utf8) {
+      auto p = (uint8_t*) begin;
+      auto limit = (const uint8_t*) strings_limit;
+      size_t u16_len;
+      size_t u8_len;
+      p = decode_pool_string_length(p, limit, &u16_len);
+      p = p ? decode_pool_string_length(p, limit, &u8_len) : nullptr;
+      if (p == nullptr || u8_len >= (size_t) (limit - p) || p[u8_len] != 0) {
+        return false;
+      }
+      existing_str.assign((const char*) p, u8_len);
+      end = (char*) (p + u8_len + 1);
+    } else {
+      auto p = (char16_t*) begin;
+      auto limit = (const char16_t*) strings_limit;
+      size_t u16_len;
+      p = decode_pool_string_length(p, limit, &u16_len);
+      if (p == nullptr || u16_len >= (size_t) (limit - p) || p[u16_len] != 0) {
+        return false;
+      }
+      existing_str = android::String8(p, u16_len).string();
+      end = (char*) (p + u16_len + 1);
+    }
+
+    auto replacement = shortened_names.find(existing_str);
+    if (replacement == shortened_names.end()) {
+      continue;
+    }
+    const auto& str = replacement->second;
+    size_t u16_len = android::String16(str.c_str(), str.size()).size();
+    size_t needed = is_utf8
+      ? pool_string_length_units<uint8_t>(u16_len) +
+          pool_string_length_units<uint8_t>(str.size()) + str.size() + 1
+      : (pool_string_length_units<char16_t>(u16_len) + u16_len + 1) *
+          sizeof(char16_t);
+    if ((is_utf8 && str.size() > 0x7fff) || needed > (size_t) (end - begin)) {
+      return false;
+    }
+    patches.push_back(Patch{begin, end, &str});
+  }
+
+  for (const auto& patch : patches) {
+    const auto& str = *patch.replacement;
+    android::String16 s16(str.c_str(), str.size());
+    char* p;
+    if (is_utf8) {
+      auto u8 = (uint8_t*) patch.begin;
+      u8 = encode_pool_string_length(u8, s16.size());
+      u8 = encode_pool_string_length(u8, str.size());
+      memcpy(u8, str.data(), str.size());
+      p = (char*) (u8 + str.size());
+    } else {
+      auto u16 = (char16_t*) patch.begin;
+      u16 = encode_pool_string_length(u16, s16.size());
+      memcpy(u16, s16.string(), s16.size() * sizeof(char16_t));
+      p = (char*) (u16 + s16.size());
+    }
+    // The terminator, and zeroes where the rest of the old string was.
+    memset(p, 0, patch.end - p);
+  }
+  if (!patches.empty()) {
+    pool_ptr->flags =
+      htodl(dtohl(pool_ptr->flags) & ~android::ResStringPool_header::SORTED_FLAG);
+  }
+  *out_num_renamed = patches.size();
+  return true;
+}
+
 int rename_classes_in_layout(
   const std::string& file_path,
   const std::map<std::string, std::string>& shortened_names,
@@ -924,6 +1439,13 @@ int rename_classes_in_layout(
   size_t len;
   auto fp = map_file(file_path.c_str(), file_desc, len, true);
 
+  if (replace_in_xml_string_pool_in_place(
+        fp, len, shortened_names, out_num_renamed)) {
+    unmap_and_close(file_desc, fp, len);
+    *out_size_delta = 0;
+    return android::OK;
+  }
+
   android::Vector<char> serialized;
   auto status = replace_in_xml_string_pool(
     fp,
@@ -0,0 +1,288 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ResourceIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "utils/String8.h"
+
+/*
+ * The file is laid out as the magic number, then each array of the index as
+ * a uint64_t count followed by its elements, and the strings as a uint32_t
+ * size followed by their bytes. Numbers are in the byte order of the host.
+ */
+
+namespace {
+
+constexpr char kMagic[] = "RDXRIDX1";
+
+// Ids up to this one are the framework's, which resources.arsc doesn't hold.
+constexpr uint32_t kPackageResidStart = 0x7f000000;
+
+std::string to_string(const char* str8,
+                      const char16_t* str16,
+                      size_t length) {
+  if (str8 != nullptr) {
+    return std::string(str8, length);
+  }
+  if (str16 != nullptr) {
+    return std::string(android::String8(str16, length).string());
+  }
+  return std::string();
+}
+
+void write_array(std::ostream& out, const std::vector<uint32_t>& array) {
+  uint64_t count = array.size();
+  out.write((const char*)&count, sizeof(count));
+  out.write((const char*)array.data(), array.size() * sizeof(uint32_t));
+}
+
+void read_array(std::istream& in, std::vector<uint32_t>& array) {
+  uint64_t count;
+  if (!in.read((char*)&count, sizeof(count)) || count > (1u << 30)) {
+    throw std::runtime_error("Truncated resource index");
+  }
+  array.resize(count);
+  if (!in.read((char*)array.data(), count * sizeof(uint32_t))) {
+    throw std::runtime_error("Truncated resource index");
+  }
+}
+
+} // namespace
+
+ResourceIndex ResourceIndex::build(const android::ResTable& table) {
+  ResourceIndex index;
+  std::unordered_map<std::string, uint32_t> string_indices;
+  auto intern = [&](std::string str) {
+    auto it = string_indices.find(str);
+    if (it != string_indices.end()) {
+      return it->second;
+    }
+    uint32_t string_index = index.m_strings.size();
+    string_indices.emplace(str, string_index);
+    index.m_strings.push_back(std::move(str));
+    return string_index;
+  };
+
+  android::SortedVector<uint32_t> ids;
+  table.getResourceIds(&ids);
+  index.m_reference_offsets.push_back(0);
+  index.m_string_offsets.push_back(0);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    uint32_t id = ids[i];
+    android::ResTable::resource_name name;
+    if (!table.getResourceName(id, /* allowUtf8 */ true, &name)) {
+      continue;
+    }
+    index.m_ids.push_back(id);
+    index.m_type_names.push_back(
+        intern(to_string(name.type8, name.type, name.typeLen)));
+    index.m_names.push_back(
+        intern(to_string(name.name8, name.name, name.nameLen)));
+
+    android::Vector<android::Res_value> values;
+    table.getAllValuesForResource(id, values);
+    auto package_index = table.getResourcePackageIndex(id);
+    std::vector<uint32_t> references;
+    std::vector<uint32_t> strings;
+    for (size_t j = 0; j < values.size(); ++j) {
+      const auto& value = values[j];
+      if (value.dataType == android::Res_value::TYPE_STRING) {
+        auto str = table.getString8FromIndex(package_index, value.data);
+        strings.push_back(intern(std::string(str.string())));
+      } else if ((value.dataType == android::Res_value::TYPE_REFERENCE ||
+                  value.dataType == android::Res_value::TYPE_ATTRIBUTE) &&
+                 value.data > kPackageResidStart) {
+        references.push_back(value.data);
+      }
+    }
+    for (auto* array : {&references, &strings}) {
+      std::sort(array->begin(), array->end());
+      array->erase(std::unique(array->begin(), array->end()), array->end());
+    }
+    index.m_references.insert(
+        index.m_references.end(), references.begin(), references.end());
+    index.m_reference_offsets.push_back(index.m_references.size());
+    index.m_string_values.insert(
+        index.m_string_values.end(), strings.begin(), strings.end());
+    index.m_string_offsets.push_back(index.m_string_values.size());
+  }
+  return index;
+}
+
+void ResourceIndex::write(const std::string& path) const {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(kMagic, sizeof(kMagic));
+  for (const auto* array : {&m_ids,
+                            &m_type_names,
+                            &m_names,
+                            &m_reference_offsets,
+                            &m_references,
+                            &m_string_offsets,
+                            &m_string_values}) {
+    write_array(out, *array);
+  }
+  uint64_t count = m_strings.size();
+  out.write((const char*)&count, sizeof(count));
+  for (const auto& str : m_strings) {
+    uint32_t size = str.size();
+    out.write((const char*)&size, sizeof(size));
+    out.write(str.data(), str.size());
+  }
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Unable to write resource index: " + path);
+  }
+}
+
+ResourceIndex ResourceIndex::read(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!in.read(magic, sizeof(magic)) ||
+      memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("Not a resource index: " + path);
+  }
+  ResourceIndex index;
+  for (auto* array : {&index.m_ids,
+                      &index.m_type_names,
+                      &index.m_names,
+                      &index.m_reference_offsets,
+                      &index.m_references,
+                      &index.m_string_offsets,
+                      &index.m_string_values}) {
+    read_array(in, *array);
+  }
+  uint64_t count;
+  if (!in.read((char*)&count, sizeof(count)) || count > (1u << 30)) {
+    throw std::runtime_error("Truncated resource index: " + path);
+  }
+  index.m_strings.resize(count);
+  for (auto& str : index.m_strings) {
+    uint32_t size;
+    if (!in.read((char*)&size, sizeof(size))) {
+      throw std::runtime_error("Truncated resource index: " + path);
+    }
+    str.resize(size);
+    if (!in.read(&str[0], size)) {
+      throw std::runtime_error("Truncated resource index: " + path);
+    }
+  }
+
+  // Everything that queries index into has to be in bounds.
+  size_t num_ids = index.m_ids.size();
+  auto strings_in_bounds = [&](const std::vector<uint32_t>& indices) {
+    return std::all_of(indices.begin(), indices.end(), [&](uint32_t i) {
+      return i < index.m_strings.size();
+    });
+  };
+  auto offsets_in_bounds = [&](const std::vector<uint32_t>& offsets,
+                               size_t size) {
+    return offsets.size() == num_ids + 1 && offsets.front() == 0 &&
+           offsets.back() == size &&
+           std::is_sorted(offsets.begin(), offsets.end());
+  };
+  if (index.m_type_names.size() != num_ids ||
+      index.m_names.size() != num_ids ||
+      !std::is_sorted(index.m_ids.begin(), index.m_ids.end()) ||
+      !offsets_in_bounds(index.m_reference_offsets,
+                         index.m_references.size()) ||
+      !offsets_in_bounds(index.m_string_offsets,
+                         index.m_string_values.size()) ||
+      !strings_in_bounds(index.m_type_names) ||
+      !strings_in_bounds(index.m_names) ||
+      !strings_in_bounds(index.m_string_values)) {
+    throw std::runtime_error("Corrupt resource index: " + path);
+  }
+  return index;
+}
+
+uint32_t ResourceIndex::position_of(uint32_t id) const {
+  auto it = std::lower_bound(m_ids.begin(), m_ids.end(), id);
+  return it != m_ids.end() && *it == id ? it - m_ids.begin() : kNone;
+}
+
+const std::string& ResourceIndex::type_name(uint32_t id) const {
+  static const std::string empty;
+  auto position = position_of(id);
+  return position == kNone ? empty : m_strings[m_type_names[position]];
+}
+
+const std::string& ResourceIndex::name(uint32_t id) const {
+  static const std::string empty;
+  auto position = position_of(id);
+  return position == kNone ? empty : m_strings[m_names[position]];
+}
+
+std::map<std::string, std::vector<uint32_t>> ResourceIndex::name_to_ids()
+    const {
+  std::map<std::string, std::vector<uint32_t>> result;
+  for (size_t i = 0; i < m_ids.size(); ++i) {
+    result[m_strings[m_names[i]]].push_back(m_ids[i]);
+  }
+  return result;
+}
+
+std::unordered_set<uint32_t> ResourceIndex::ids_by_name_prefix(
+    const std::vector<std::string>& prefixes) const {
+  std::unordered_set<uint32_t> result;
+  for (size_t i = 0; i < m_ids.size(); ++i) {
+    const auto& name = m_strings[m_names[i]];
+    for (const auto& prefix : prefixes) {
+      if (name.compare(0, prefix.size(), prefix) == 0) {
+        result.insert(m_ids[i]);
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+void ResourceIndex::walk_references(
+    uint32_t id,
+    std::unordered_set<uint32_t>& nodes_visited,
+    std::unordered_set<std::string>& leaf_string_values) const {
+  if (!nodes_visited.insert(id).second) {
+    return;
+  }
+  std::vector<uint32_t> to_explore{id};
+  while (!to_explore.empty()) {
+    auto position = position_of(to_explore.back());
+    to_explore.pop_back();
+    if (position == kNone) {
+      continue;
+    }
+    for (auto i = m_string_offsets[position];
+         i < m_string_offsets[position + 1];
+         ++i) {
+      leaf_string_values.insert(m_strings[m_string_values[i]]);
+    }
+    for (auto i = m_reference_offsets[position];
+         i < m_reference_offsets[position + 1];
+         ++i) {
+      if (nodes_visited.insert(m_references[i]).second) {
+        to_explore.push_back(m_references[i]);
+      }
+    }
+  }
+}
+
+bool ResourceIndex::operator==(const ResourceIndex& that) const {
+  return m_ids == that.m_ids && m_type_names == that.m_type_names &&
+         m_names == that.m_names &&
+         m_reference_offsets == that.m_reference_offsets &&
+         m_references == that.m_references &&
+         m_string_offsets == that.m_string_offsets &&
+         m_string_values == that.m_string_values &&
+         m_strings == that.m_strings;
+}
@@ -0,0 +1,652 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ResourceShrinker.h"
+
+#include <cstring>
+#include <vector>
+
+#include "androidfw/ResourceTypes.h"
+#include "utils/ByteOrder.h"
+
+using android::ResChunk_header;
+using android::ResStringPool_header;
+using android::ResStringPool_span;
+using android::ResTable_entry;
+using android::ResTable_map;
+using android::ResTable_map_entry;
+using android::ResTable_package;
+using android::ResTable_type;
+using android::Res_value;
+
+namespace {
+
+constexpr uint32_t kDropped = 0xffffffff;
+
+uint16_t read_u16(const uint8_t* p) {
+  uint16_t value;
+  memcpy(&value, p, sizeof(value));
+  return dtohs(value);
+}
+
+uint32_t read_u32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return dtohl(value);
+}
+
+void write_u32(uint8_t* p, uint32_t value) {
+  value = htodl(value);
+  memcpy(p, &value, sizeof(value));
+}
+
+void append_u32(std::string* out, uint32_t value) {
+  value = htodl(value);
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void set_u32(std::string* out, size_t offset, uint32_t value) {
+  write_u32(reinterpret_cast<uint8_t*>(&(*out)[offset]), value);
+}
+
+void append_chunk(std::string* out, const ResChunk_header* chunk) {
+  out->append(reinterpret_cast<const char*>(chunk), dtohl(chunk->size));
+}
+
+// Sets the size of the chunk that starts at `start` to what has been written
+// since.
+void end_chunk(std::string* out, size_t start) {
+  set_u32(out, start + offsetof(ResChunk_header, size), out->size() - start);
+}
+
+// The chunk at `begin`, if it is well formed and ends by `end`.
+const ResChunk_header* chunk_at(const uint8_t* begin, const uint8_t* end) {
+  if (end < begin ||
+      static_cast<size_t>(end - begin) < sizeof(ResChunk_header)) {
+    return nullptr;
+  }
+  auto chunk = reinterpret_cast<const ResChunk_header*>(begin);
+  size_t header_size = dtohs(chunk->headerSize);
+  size_t size = dtohl(chunk->size);
+  if (header_size < sizeof(ResChunk_header) || size < header_size ||
+      size > static_cast<size_t>(end - begin)) {
+    return nullptr;
+  }
+  return chunk;
+}
+
+// The children of a chunk, which follow its header.
+template <typename Fn>
+bool for_each_child(const ResChunk_header* parent, Fn fn) {
+  auto begin = reinterpret_cast<const uint8_t*>(parent);
+  auto end = begin + dtohl(parent->size);
+  for (auto p = begin + dtohs(parent->headerSize); p < end;) {
+    auto chunk = chunk_at(p, end);
+    if (chunk == nullptr || !fn(chunk)) {
+      return false;
+    }
+    p += dtohl(chunk->size);
+  }
+  return true;
+}
+
+/*
+ * A string pool that can be written back with only the strings marked as
+ * used. The strings are copied as they are encoded.
+ */
+class StringPool {
+ public:
+  bool init(const ResChunk_header* chunk) {
+    if (dtohs(chunk->type) != android::RES_STRING_POOL_TYPE ||
+        dtohs(chunk->headerSize) < sizeof(ResStringPool_header)) {
+      return false;
+    }
+    m_header = reinterpret_cast<const ResStringPool_header*>(chunk);
+    m_base = reinterpret_cast<const uint8_t*>(chunk);
+    size_t size = dtohl(chunk->size);
+    size_t header_size = dtohs(chunk->headerSize);
+    size_t count = dtohl(m_header->stringCount);
+    size_t style_count = dtohl(m_header->styleCount);
+    if (style_count > count ||
+        (size - header_size) / sizeof(uint32_t) < count + style_count) {
+      return false;
+    }
+    m_utf8 = (dtohl(m_header->flags) & ResStringPool_header::UTF8_FLAG) != 0;
+    size_t strings_start = dtohl(m_header->stringsStart);
+    size_t styles_start = dtohl(m_header->stylesStart);
+    size_t strings_end =
+        style_count > 0 && styles_start > strings_start ? styles_start : size;
+    if (count > 0 && (strings_start > strings_end || strings_end > size)) {
+      return false;
+    }
+    if (style_count > 0 && styles_start > size) {
+      return false;
+    }
+
+    auto offsets = m_base + header_size;
+    m_strings.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      size_t begin = strings_start + read_u32(offsets + i * sizeof(uint32_t));
+      size_t encoded = begin < strings_end
+                           ? encoded_size(m_base + begin, strings_end - begin)
+                           : 0;
+      if (encoded == 0) {
+        return false;
+      }
+      m_strings[i] = {begin, encoded};
+    }
+    m_styles.resize(style_count);
+    auto style_offsets = offsets + count * sizeof(uint32_t);
+    for (size_t i = 0; i < style_count; ++i) {
+      size_t begin =
+          styles_start + read_u32(style_offsets + i * sizeof(uint32_t));
+      // Spans until the END marker.
+      size_t end = begin;
+      while (true) {
+        if (end + sizeof(uint32_t) > size) {
+          return false;
+        }
+        if (read_u32(m_base + end) == ResStringPool_span::END) {
+          break;
+        }
+        if (end + sizeof(ResStringPool_span) > size) {
+          return false;
+        }
+        end += sizeof(ResStringPool_span);
+      }
+      m_styles[i] = {begin, end};
+    }
+    m_used.assign(count, false);
+    return true;
+  }
+
+  void mark(uint32_t index) {
+    if (index < m_used.size()) {
+      m_used[index] = true;
+    }
+  }
+
+  uint32_t new_index(uint32_t index) const {
+    return index < m_new_index.size() ? m_new_index[index] : kDropped;
+  }
+
+  size_t num_dropped() const {
+    size_t dropped = 0;
+    for (auto index : m_new_index) {
+      dropped += index == kDropped;
+    }
+    return dropped;
+  }
+
+  /*
+   * Numbers the used strings in order, along with the strings that name the
+   * spans of their styles. Styled strings come first in a pool, so they
+   * still do.
+   */
+  void compact() {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 0; i < m_styles.size(); ++i) {
+        if (!m_used[i]) {
+          continue;
+        }
+        for_each_span(i, [&](uint32_t name) {
+          if (name < m_used.size() && !m_used[name]) {
+            m_used[name] = true;
+            changed = true;
+          }
+        });
+      }
+    }
+    m_new_index.assign(m_used.size(), kDropped);
+    uint32_t next = 0;
+    for (size_t i = 0; i < m_used.size(); ++i) {
+      if (m_used[i]) {
+        m_new_index[i] = next++;
+      }
+    }
+  }
+
+  void write(std::string* out) const {
+    size_t start = out->size();
+    size_t header_size = dtohs(m_header->header.headerSize);
+    out->append(reinterpret_cast<const char*>(m_header), header_size);
+
+    std::string strings;
+    std::vector<uint32_t> string_offsets;
+    std::string styles;
+    std::vector<uint32_t> style_offsets;
+    for (size_t i = 0; i < m_strings.size(); ++i) {
+      if (m_new_index[i] == kDropped) {
+        continue;
+      }
+      string_offsets.push_back(strings.size());
+      strings.append(reinterpret_cast<const char*>(m_base) +
+                         m_strings[i].first,
+                     m_strings[i].second);
+      if (i < m_styles.size()) {
+        style_offsets.push_back(styles.size());
+        auto span = m_base + m_styles[i].first;
+        for (; span < m_base + m_styles[i].second;
+             span += sizeof(ResStringPool_span)) {
+          append_u32(&styles, new_index(read_u32(span)));
+          styles.append(reinterpret_cast<const char*>(span) +
+                            sizeof(uint32_t),
+                        sizeof(ResStringPool_span) - sizeof(uint32_t));
+        }
+        append_u32(&styles, ResStringPool_span::END);
+      }
+    }
+    strings.append((4 - strings.size() % 4) % 4, '\0');
+    if (!style_offsets.empty()) {
+      // The styles end with an extra span's worth of END markers.
+      append_u32(&styles, ResStringPool_span::END);
+      append_u32(&styles, ResStringPool_span::END);
+    }
+
+    for (auto offset : string_offsets) {
+      append_u32(out, offset);
+    }
+    for (auto offset : style_offsets) {
+      append_u32(out, offset);
+    }
+    size_t strings_start = out->size() - start;
+    *out += strings;
+    size_t styles_start = out->size() - start;
+    *out += styles;
+
+    set_u32(out,
+            start + offsetof(ResStringPool_header, stringCount),
+            string_offsets.size());
+    set_u32(out,
+            start + offsetof(ResStringPool_header, styleCount),
+            style_offsets.size());
+    set_u32(out,
+            start + offsetof(ResStringPool_header, stringsStart),
+            string_offsets.empty() ? 0 : strings_start);
+    set_u32(out,
+            start + offsetof(ResStringPool_header, stylesStart),
+            style_offsets.empty() ? 0 : styles_start);
+    end_chunk(out, start);
+  }
+
+ private:
+  // The size of the encoded string at `p`, with its length and terminator,
+  // or 0 if it runs past `available` bytes.
+  size_t encoded_size(const uint8_t* p, size_t available) const {
+    size_t pos = 0;
+    size_t length;
+    if (m_utf8) {
+      // The length in UTF-16 units, then in bytes, each in one byte or two.
+      for (int i = 0; i < 2; ++i) {
+        if (pos + 1 > available) {
+          return 0;
+        }
+        length = p[pos++];
+        if (length & 0x80) {
+          if (pos + 1 > available) {
+            return 0;
+          }
+          length = ((length & 0x7f) << 8) | p[pos++];
+        }
+      }
+      pos += length + 1;
+    } else {
+      if (pos + 2 > available) {
+        return 0;
+      }
+      length = read_u16(p);
+      pos += 2;
+      if (length & 0x8000) {
+        if (pos + 2 > available) {
+          return 0;
+        }
+        length = ((length & 0x7fff) << 16) | read_u16(p + pos);
+        pos += 2;
+      }
+      pos += (length + 1) * sizeof(uint16_t);
+    }
+    return pos <= available ? pos : 0;
+  }
+
+  template <typename Fn>
+  void for_each_span(size_t style, Fn fn) const {
+    for (auto span = m_base + m_styles[style].first;
+         span < m_base + m_styles[style].second;
+         span += sizeof(ResStringPool_span)) {
+      fn(read_u32(span));
+    }
+  }
+
+  const ResStringPool_header* m_header{nullptr};
+  const uint8_t* m_base{nullptr};
+  bool m_utf8{false};
+  // The offset and encoded size of each string, from the start of the chunk.
+  std::vector<std::pair<size_t, size_t>> m_strings;
+  // Where the spans of each style begin and end.
+  std::vector<std::pair<size_t, size_t>> m_styles;
+  std::vector<bool> m_used;
+  std::vector<uint32_t> m_new_index;
+};
+
+// An entry of a type chunk, with its key and value or map.
+struct Entry {
+  const uint8_t* data;
+  size_t size;
+  bool complex;
+  size_t header_size;
+  size_t count;
+};
+
+class Shrinker {
+ public:
+  Shrinker(const std::unordered_set<uint32_t>& kept,
+           resource_shrinker::Stats* stats)
+      : m_kept(kept), m_stats(stats) {}
+
+  bool run(const void* data, size_t size, std::string* out) {
+    auto begin = static_cast<const uint8_t*>(data);
+    auto table = chunk_at(begin, begin + size);
+    if (table == nullptr || dtohs(table->type) != android::RES_TABLE_TYPE) {
+      return false;
+    }
+    if (!for_each_child(table, [&](const ResChunk_header* chunk) {
+          return find_used(chunk);
+        })) {
+      return false;
+    }
+    if (m_values == nullptr) {
+      return false;
+    }
+    m_value_pool.compact();
+    for (auto& package : m_packages) {
+      package.keys.compact();
+    }
+
+    size_t start = out->size();
+    out->append(reinterpret_cast<const char*>(table),
+                dtohs(table->headerSize));
+    size_t package_index = 0;
+    for_each_child(table, [&](const ResChunk_header* chunk) {
+      if (chunk == m_values) {
+        m_value_pool.write(out);
+      } else if (dtohs(chunk->type) == android::RES_TABLE_PACKAGE_TYPE) {
+        write_package(m_packages[package_index++], out);
+      } else {
+        append_chunk(out, chunk);
+      }
+      return true;
+    });
+    end_chunk(out, start);
+
+    m_stats->resources_removed += m_removed.size();
+    m_stats->value_strings_removed += m_value_pool.num_dropped();
+    for (const auto& package : m_packages) {
+      m_stats->key_strings_removed += package.keys.num_dropped();
+    }
+    return true;
+  }
+
+ private:
+  struct Package {
+    const ResTable_package* header;
+    const ResChunk_header* key_chunk;
+    StringPool keys;
+  };
+
+  static bool read_entry(const ResTable_type* type,
+                         uint32_t offset,
+                         Entry* entry) {
+    auto base = reinterpret_cast<const uint8_t*>(type);
+    size_t type_size = dtohl(type->header.size);
+    size_t begin = dtohl(type->entriesStart) + offset;
+    if (begin + sizeof(ResTable_entry) > type_size) {
+      return false;
+    }
+    auto header = reinterpret_cast<const ResTable_entry*>(base + begin);
+    entry->data = base + begin;
+    entry->header_size = dtohs(header->size);
+    entry->complex = (dtohs(header->flags) & ResTable_entry::FLAG_COMPLEX) != 0;
+    if (entry->complex) {
+      if (entry->header_size < sizeof(ResTable_map_entry) ||
+          begin + entry->header_size > type_size) {
+        return false;
+      }
+      // The parent, then the count.
+      entry->count = read_u32(entry->data + sizeof(ResTable_entry) +
+                              sizeof(android::ResTable_ref));
+      entry->size = entry->header_size + entry->count * sizeof(ResTable_map);
+    } else {
+      if (entry->header_size < sizeof(ResTable_entry) ||
+          begin + entry->header_size + sizeof(Res_value) > type_size) {
+        return false;
+      }
+      entry->count = 1;
+      entry->size = entry->header_size +
+                    read_u16(entry->data + entry->header_size +
+                             offsetof(Res_value, size));
+    }
+    return begin + entry->size <= type_size;
+  }
+
+  // Calls fn with the offset of each value of the entry, from its start.
+  template <typename Fn>
+  static void for_each_value(const Entry& entry, Fn fn) {
+    if (!entry.complex) {
+      fn(entry.header_size);
+      return;
+    }
+    for (size_t i = 0; i < entry.count; ++i) {
+      fn(entry.header_size + i * sizeof(ResTable_map) +
+         offsetof(ResTable_map, value));
+    }
+  }
+
+  // Calls fn with the id and offset of each entry of the type chunk.
+  template <typename Fn>
+  static bool for_each_entry(uint32_t package_id,
+                             const ResTable_type* type,
+                             Fn fn) {
+    auto base = reinterpret_cast<const uint8_t*>(type);
+    size_t header_size = dtohs(type->header.headerSize);
+    size_t count = dtohl(type->entryCount);
+    // Sparse types keep their offsets in another layout.
+    if (header_size < sizeof(ResTable_type) || type->res0 != 0 ||
+        (dtohl(type->header.size) - header_size) / sizeof(uint32_t) < count) {
+      return false;
+    }
+    uint32_t type_id = (package_id << 24) | (type->id << 16);
+    for (size_t i = 0; i < count; ++i) {
+      if (!fn(type_id | i, read_u32(base + header_size + i * 4))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool find_used(const ResChunk_header* chunk) {
+    auto type = dtohs(chunk->type);
+    if (type == android::RES_STRING_POOL_TYPE) {
+      if (m_values != nullptr) {
+        return false;
+      }
+      m_values = chunk;
+      return m_value_pool.init(chunk);
+    }
+    if (type != android::RES_TABLE_PACKAGE_TYPE) {
+      return true;
+    }
+    // The values of the package refer to the value strings, which come
+    // first.
+    if (m_values == nullptr ||
+        dtohs(chunk->headerSize) < offsetof(ResTable_package, typeIdOffset)) {
+      return false;
+    }
+    m_packages.emplace_back();
+    auto& package = m_packages.back();
+    package.header = reinterpret_cast<const ResTable_package*>(chunk);
+    package.key_chunk = nullptr;
+    uint32_t package_id = dtohl(package.header->id);
+    size_t key_strings = dtohl(package.header->keyStrings);
+    auto base = reinterpret_cast<const uint8_t*>(chunk);
+    // The key strings come before the types.
+    return for_each_child(chunk, [&](const ResChunk_header* child) {
+      if (reinterpret_cast<const uint8_t*>(child) - base ==
+          static_cast<ptrdiff_t>(key_strings)) {
+        package.key_chunk = child;
+        return package.keys.init(child);
+      }
+      if (dtohs(child->type) != android::RES_TABLE_TYPE_TYPE) {
+        return true;
+      }
+      if (package.key_chunk == nullptr) {
+        return false;
+      }
+      auto type_chunk = reinterpret_cast<const ResTable_type*>(child);
+      return for_each_entry(package_id, type_chunk, [&](uint32_t id,
+                                                        uint32_t offset) {
+        if (offset == ResTable_type::NO_ENTRY) {
+          return true;
+        }
+        Entry entry;
+        if (!read_entry(type_chunk, offset, &entry)) {
+          return false;
+        }
+        if (m_kept.count(id) == 0) {
+          return true;
+        }
+        package.keys.mark(read_u32(entry.data + offsetof(ResTable_entry, key)));
+        for_each_value(entry, [&](size_t value) {
+          if (entry.data[value + offsetof(Res_value, dataType)] ==
+              Res_value::TYPE_STRING) {
+            m_value_pool.mark(
+                read_u32(entry.data + value + offsetof(Res_value, data)));
+          }
+        });
+        return true;
+      });
+    });
+  }
+
+  void write_package(const Package& package, std::string* out) {
+    size_t start = out->size();
+    auto chunk = &package.header->header;
+    auto base = reinterpret_cast<const uint8_t*>(chunk);
+    out->append(reinterpret_cast<const char*>(chunk),
+                dtohs(chunk->headerSize));
+    size_t type_strings = dtohl(package.header->typeStrings);
+    uint32_t package_id = dtohl(package.header->id);
+    for_each_child(chunk, [&](const ResChunk_header* child) {
+      size_t offset = reinterpret_cast<const uint8_t*>(child) - base;
+      if (offset == type_strings) {
+        set_u32(out,
+                start + offsetof(ResTable_package, typeStrings),
+                out->size() - start);
+        append_chunk(out, child);
+      } else if (child == package.key_chunk) {
+        set_u32(out,
+                start + offsetof(ResTable_package, keyStrings),
+                out->size() - start);
+        package.keys.write(out);
+      } else if (dtohs(child->type) == android::RES_TABLE_TYPE_TYPE) {
+        write_type(package,
+                   package_id,
+                   reinterpret_cast<const ResTable_type*>(child),
+                   out);
+      } else {
+        append_chunk(out, child);
+      }
+      return true;
+    });
+    end_chunk(out, start);
+  }
+
+  // Writes the kept entries of the type, unless there are none.
+  void write_type(const Package& package,
+                  uint32_t package_id,
+                  const ResTable_type* type,
+                  std::string* out) {
+    size_t start = out->size();
+    size_t header_size = dtohs(type->header.headerSize);
+    size_t count = dtohl(type->entryCount);
+    out->append(reinterpret_cast<const char*>(type), header_size);
+    size_t offsets = out->size();
+    out->append(count * sizeof(uint32_t), '\0');
+    std::string entries;
+    bool any = false;
+    for_each_entry(package_id, type, [&](uint32_t id, uint32_t offset) {
+      size_t index = id & 0xffff;
+      if (offset == ResTable_type::NO_ENTRY) {
+        set_u32(out, offsets + index * 4, ResTable_type::NO_ENTRY);
+        return true;
+      }
+      if (m_kept.count(id) == 0) {
+        m_removed.insert(id);
+        set_u32(out, offsets + index * 4, ResTable_type::NO_ENTRY);
+        return true;
+      }
+      Entry entry;
+      read_entry(type, offset, &entry);
+      set_u32(out, offsets + index * 4, entries.size());
+      size_t entry_start = entries.size();
+      entries.append(reinterpret_cast<const char*>(entry.data), entry.size);
+      auto copy = reinterpret_cast<uint8_t*>(&entries[entry_start]);
+      auto key = copy + offsetof(ResTable_entry, key);
+      write_u32(key, package.keys.new_index(read_u32(key)));
+      for_each_value(entry, [&](size_t value) {
+        if (copy[value + offsetof(Res_value, dataType)] ==
+            Res_value::TYPE_STRING) {
+          auto data = copy + value + offsetof(Res_value, data);
+          write_u32(data, m_value_pool.new_index(read_u32(data)));
+        }
+      });
+      any = true;
+      return true;
+    });
+    if (!any) {
+      // A configuration without any entry left is dropped altogether.
+      out->resize(start);
+      return;
+    }
+    set_u32(out,
+            start + offsetof(ResTable_type, entriesStart),
+            out->size() - start);
+    *out += entries;
+    end_chunk(out, start);
+  }
+
+  const std::unordered_set<uint32_t>& m_kept;
+  resource_shrinker::Stats* m_stats;
+  const ResChunk_header* m_values{nullptr};
+  StringPool m_value_pool;
+  std::vector<Package> m_packages;
+  std::unordered_set<uint32_t> m_removed;
+};
+
+} // namespace
+
+namespace resource_shrinker {
+
+bool shrink(const void* data,
+            size_t size,
+            const std::unordered_set<uint32_t>& kept,
+            std::string* out,
+            Stats* stats) {
+  std::string result;
+  Stats result_stats;
+  if (!Shrinker(kept, &result_stats).run(data, size, &result)) {
+    return false;
+  }
+  *out = std::move(result);
+  *stats = result_stats;
+  return true;
+}
+
+} // namespace resource_shrinker
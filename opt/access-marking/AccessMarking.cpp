@@ -9,10 +9,14 @@
 
 #include "AccessMarking.h"
 
+#include <atomic>
 #include <unordered_map>
 
+#include "ArenaAllocator.h"
 #include "ClassHierarchy.h"
 #include "DexUtil.h"
+#include "HierarchyCache.h"
+#include "HierarchyIndex.h"
 #include "IRCode.h"
 #include "Mutators.h"
 #include "ReachableClasses.h"
@@ -35,37 +39,50 @@ size_t mark_classes_final(const Scope& scope, const ClassHierarchy& ch) {
   return n_classes_finalized;
 }
 
-const DexMethod* find_override(const DexMethod* method,
-                               const DexClass* cls,
-                               const ClassHierarchy& ch) {
-  TypeSet children;
-  get_all_children(ch, cls->get_type(), children);
-  for (auto const& childtype : children) {
-    auto const& child = type_class(childtype);
-    assert(child);
-    for (auto const& child_method : child->get_vmethods()) {
-      if (signatures_match(method, child_method)) {
-        return child_method;
+/*
+ * Whether a subclass of the class of `method` overrides it. Overrides have the
+ * same name and proto as the method, so they are among the virtual scopes of
+ * its signature.
+ */
+bool is_overridden(const DexMethod* method,
+                   const SignatureMap& sm,
+                   const HierarchyIndex& index) {
+  auto protos = sm.find(method->get_name());
+  if (protos == sm.end()) {
+    return false;
+  }
+  auto scopes = protos->second.find(method->get_proto());
+  if (scopes == protos->second.end()) {
+    return false;
+  }
+  auto type = method->get_class();
+  for (const auto& virtual_scope : scopes->second) {
+    for (const auto& vmeth : virtual_scope.methods) {
+      auto child = vmeth.first->get_class();
+      if (child != type && index.is_subclass(type, child)) {
+        return true;
       }
     }
   }
-  return nullptr;
+  return false;
 }
 
-size_t mark_methods_final(const Scope& scope, const ClassHierarchy& ch) {
-  size_t n_methods_finalized = 0;
-  for (auto const& cls : scope) {
+size_t mark_methods_final(const Scope& scope,
+                          const SignatureMap& sm,
+                          const HierarchyIndex& index) {
+  std::atomic<size_t> n_methods_finalized{0};
+  walk::parallel::classes(scope, [&](DexClass* cls) {
     for (auto const& method : cls->get_vmethods()) {
       if (keep(method) || is_abstract(method) || is_final(method)) {
         continue;
       }
-      if (!find_override(method, cls, ch)) {
+      if (!is_overridden(method, sm, index)) {
         TRACE(ACCESS, 2, "Finalizing method: %s\n", SHOW(method));
         set_final(method);
         ++n_methods_finalized;
       }
     }
-  }
+  });
   return n_methods_finalized;
 }
 
@@ -80,41 +97,64 @@ std::vector<DexMethod*> direct_methods(const std::vector<DexClass*>& scope) {
 }
 
 std::unordered_set<DexMethod*> find_private_methods(
-    const std::vector<DexClass*>& scope, const std::vector<DexMethod*>& cv) {
-  std::unordered_set<DexMethod*> candidates;
+    const std::vector<DexClass*>& scope,
+    const std::vector<DexMethod*>& cv,
+    Arena& scratch) {
+  // The candidates, and whether they are called from another class.
+  arena::unordered_map<DexMethod*, size_t> candidate_ids(0, scratch);
+  arena::vector<DexMethod*> candidates(scratch);
   for (auto m : cv) {
     TRACE(ACCESS, 3, "Considering for privatization: %s\n", SHOW(m));
-    if (!is_clinit(m) && !keep(m) && !is_abstract(m) && !is_private(m)) {
-      candidates.emplace(m);
+    if (!is_clinit(m) && !keep(m) && !is_abstract(m) && !is_private(m) &&
+        candidate_ids.emplace(m, candidates.size()).second) {
+      candidates.push_back(m);
     }
   }
-  walk::opcodes(
-      scope,
-      [](DexMethod*) { return true; },
-      [&](DexMethod* caller, IRInstruction* inst) {
-        if (!inst->has_method()) return;
-        auto callee = resolve_method(inst->get_method(), MethodSearch::Any);
-        if (callee == nullptr || callee->get_class() == caller->get_class()) {
-          return;
-        }
-        candidates.erase(callee);
-      });
-  return candidates;
+  std::vector<std::atomic<bool>> called_from_outside(candidates.size());
+  walk::parallel::opcodes(scope, [&](DexMethod* caller, IRInstruction* inst) {
+    if (!inst->has_method()) return;
+    auto callee = resolve_method_cached(inst->get_method(), MethodSearch::Any);
+    if (callee == nullptr || callee->get_class() == caller->get_class()) {
+      return;
+    }
+    auto it = candidate_ids.find(callee);
+    if (it != candidate_ids.end()) {
+      called_from_outside[it->second] = true;
+    }
+  });
+  std::unordered_set<DexMethod*> privates;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (!called_from_outside[i]) {
+      privates.emplace(candidates[i]);
+    }
+  }
+  return privates;
 }
 
 void fix_call_sites_private(const std::vector<DexClass*>& scope,
-                            const std::unordered_set<DexMethod*>& privates) {
-  walk::parallel::code(scope, [&](DexMethod* caller, IRCode& code) {
-    for (const MethodItemEntry& mie : InstructionIterable(code)) {
-      IRInstruction* insn = mie.insn;
-      if (!insn->has_method()) continue;
-      auto callee = resolve_method(insn->get_method(), opcode_to_search(insn));
-      // should be safe to read `privates` here because there are no writers
-      if (callee != nullptr && privates.count(callee)) {
-        insn->set_method(callee);
-        if (!is_static(callee)) {
-          insn->set_opcode(OPCODE_INVOKE_DIRECT);
-        }
+                            const std::unordered_set<DexMethod*>& privates,
+                            Arena& scratch) {
+  if (privates.empty()) {
+    return;
+  }
+  // Resolution keeps the name of a method reference, so invokes of other names
+  // can't target the privatized methods and aren't resolved at all.
+  arena::unordered_set<const DexString*> names(0, scratch);
+  for (auto method : privates) {
+    names.insert(method->get_name());
+  }
+  walk::parallel::opcodes(scope, [&](DexMethod*, IRInstruction* insn) {
+    if (!insn->has_method() ||
+        names.count(insn->get_method()->get_name()) == 0) {
+      return;
+    }
+    auto callee =
+        resolve_method_cached(insn->get_method(), opcode_to_search(insn));
+    // should be safe to read `privates` here because there are no writers
+    if (callee != nullptr && privates.count(callee)) {
+      insn->set_method(callee);
+      if (!is_static(callee)) {
+        insn->set_opcode(OPCODE_INVOKE_DIRECT);
       }
     }
   });
@@ -136,15 +176,17 @@ void AccessMarkingPass::run_pass(DexStoresVector& stores,
                                  ConfigFiles& cfg,
                                  PassManager& pm) {
   auto scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
-  SignatureMap sm = build_signature_map(ch);
+  auto& hierarchy_cache = pm.get_hierarchy_cache();
+  const auto& ch = hierarchy_cache.get_class_hierarchy();
+  const auto& sm = hierarchy_cache.get_signature_map();
   if (m_finalize_classes) {
     auto n_classes_final = mark_classes_final(scope, ch);
     pm.incr_metric("finalized_classes", n_classes_final);
     TRACE(ACCESS, 1, "Finalized %lu classes\n", n_classes_final);
   }
   if (m_finalize_methods) {
-    auto n_methods_final = mark_methods_final(scope, ch);
+    auto n_methods_final =
+        mark_methods_final(scope, sm, hierarchy_cache.get_hierarchy_index());
     pm.incr_metric("finalized_methods", n_methods_final);
     TRACE(ACCESS, 1, "Finalized %lu methods\n", n_methods_final);
   }
@@ -152,8 +194,9 @@ void AccessMarkingPass::run_pass(DexStoresVector& stores,
   auto dmethods = direct_methods(scope);
   candidates.insert(candidates.end(), dmethods.begin(), dmethods.end());
   if (m_privatize_methods) {
-    auto privates = find_private_methods(scope, candidates);
-    fix_call_sites_private(scope, privates);
+    auto& scratch = pm.get_scratch_arena();
+    auto privates = find_private_methods(scope, candidates, scratch);
+    fix_call_sites_private(scope, privates, scratch);
     mark_methods_private(privates);
     pm.incr_metric("privatized_methods", privates.size());
     TRACE(ACCESS, 1, "Privatized %lu methods\n", privates.size());
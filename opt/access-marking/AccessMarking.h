@@ -23,6 +23,8 @@ class AccessMarkingPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+
  private:
   bool m_finalize_classes;
   bool m_finalize_methods;
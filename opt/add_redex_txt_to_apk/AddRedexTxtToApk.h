@@ -17,4 +17,9 @@ class AddRedexTxtToApkPass : public Pass {
   AddRedexTxtToApkPass() : Pass("AddRedexTxtToApkPass") {}
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual unsigned reads() const override { return TOUCHES_NOTHING; }
+  virtual unsigned writes() const override { return TOUCHES_RESOURCES; }
 };
@@ -15,153 +15,118 @@
 #include <unordered_set>
 #include <unordered_map>
 
+#include "BinaryGraph.h"
+#include "ConfigFiles.h"
 #include "Walkers.h"
 #include "DexClass.h"
 #include "IRInstruction.h"
 #include "DexUtil.h"
 #include "Resolver.h"
+#include "WorkQueue.h"
 
 void CreateReferenceGraphPass::build_super_and_interface_refs(
-    const Scope& scope,
-    refs_t& class_refs) {
-  for (const auto* child : scope) {
-    std::function<void(const DexType*)> recurse =
-      [&class_refs, &child, &recurse] (const DexType* super) {
-        if (super != nullptr) {
-          class_refs[child].emplace(super);
-          const auto super_cls_or_int = type_class(super);
-          if (super_cls_or_int != nullptr) {
-            recurse(super_cls_or_int->get_super_class());
-            for (const auto* interface : super_cls_or_int->get_interfaces()->get_type_list()) {
-              recurse(interface);
-            }
+    const DexClass* cls,
+    class_refs_t& class_refs) const {
+  std::function<void(const DexType*)> recurse =
+    [&class_refs, &recurse] (const DexType* super) {
+      if (super != nullptr) {
+        class_refs[super] |= REF_IN_CLASS_STRUCTURE;
+        const auto super_cls_or_int = type_class(super);
+        if (super_cls_or_int != nullptr) {
+          recurse(super_cls_or_int->get_super_class());
+          for (const auto* interface : super_cls_or_int->get_interfaces()->get_type_list()) {
+            recurse(interface);
           }
         }
-    };
-    recurse(child->get_type());
-  }
+      }
+  };
+  recurse(cls->get_type());
 }
 
 template <class T>
 void CreateReferenceGraphPass::get_annots(
     const T* thing_with_annots,
-    const DexClass* enclosing_class,
-    refs_t& class_refs) {
+    uint8_t kind,
+    class_refs_t& class_refs) {
   const auto& thing_anno_set = thing_with_annots->get_anno_set();
   if (thing_anno_set != nullptr) {
     for (const auto* annot : thing_anno_set->get_annotations()) {
-      class_refs[enclosing_class].emplace(annot->type());
+      class_refs[annot->type()] |= kind;
     }
   }
 }
 
-CreateReferenceGraphPass::MethodWalkerFn
-CreateReferenceGraphPass::method_ref_builder(
-    const Scope& scope,
-    refs_t& class_refs) {
-  return ([this, &class_refs](const DexMethod* method) {
-    const auto* enclosing_class = type_class(method->get_class());
+void CreateReferenceGraphPass::build_annot_refs(
+    const DexClass* cls,
+    class_refs_t& class_refs) const {
+  get_annots(cls, REF_IN_ANNOTATION, class_refs);
+  for (const auto* meth : cls->get_dmethods()) {
+    get_annots(meth, REF_IN_ANNOTATION, class_refs);
+  }
+  for (const auto* meth : cls->get_vmethods()) {
+    get_annots(meth, REF_IN_ANNOTATION, class_refs);
+  }
+  for (const auto* field : cls->get_sfields()) {
+    get_annots(field, REF_IN_ANNOTATION, class_refs);
+  }
+  for (const auto* field : cls->get_ifields()) {
+    get_annots(field, REF_IN_ANNOTATION, class_refs);
+  }
+}
+
+void CreateReferenceGraphPass::build_member_refs(
+    const DexClass* cls,
+    class_refs_t& class_refs) const {
+  auto method_refs = [&](const DexMethod* method) {
     // do not add annotations to a method call. Only to method definition
-    get_annots(method, enclosing_class, class_refs);
+    get_annots(method, REF_IN_CLASS_STRUCTURE, class_refs);
 
     std::vector<DexType*> types;
     method->get_proto()->gather_types(types);
     for (const auto* t : types) {
-      if (t) class_refs[enclosing_class].emplace(t);
+      if (t) class_refs[t] |= REF_IN_CLASS_STRUCTURE;
     }
-  });
-}
-
-CreateReferenceGraphPass::FieldWalkerFn
-CreateReferenceGraphPass::field_ref_builder(
-    const Scope& scope,
-    refs_t& class_refs) {
-  return ([this, &class_refs](DexField* field) {
-    const auto* enclosing_class = type_class(field->get_class());
-
+  };
+  auto field_refs = [&](DexField* field) {
     const DexField* field_maybe_resolved;
     if (config.resolve_fields) {
       field_maybe_resolved = resolve_field(field);
     } else {
       field_maybe_resolved = field;
     }
-    get_annots(field_maybe_resolved, enclosing_class, class_refs);
+    get_annots(field_maybe_resolved, REF_IN_CLASS_STRUCTURE, class_refs);
     const auto* t = field_maybe_resolved->get_type();
-    if (t) class_refs[enclosing_class].emplace(t);
-  });
-}
-
-void CreateReferenceGraphPass::build_class_annot_refs(
-    const Scope& scope,
-    refs_t& class_refs) {
-  for (const auto* cls : scope) {
-    get_annots(cls, cls, class_refs);
-  }
-}
-
-CreateReferenceGraphPass::MethodWalkerFn
-CreateReferenceGraphPass::method_annot_ref_builder(
-    const Scope& scope,
-    refs_t& class_refs) {
-  return ([this, &scope, &class_refs](const DexMethod* meth) {
-   for (const auto* cls : scope) {
-     get_annots(meth, cls, class_refs);
-    }
-  });
-}
-
-CreateReferenceGraphPass::FieldWalkerFn
-CreateReferenceGraphPass::field_annot_ref_builder(
-    const Scope& scope,
-    refs_t& class_refs) {
-  return ([this, &scope, &class_refs](const DexField* field) {
-    for (const auto* cls : scope) {
-     get_annots(field, cls, class_refs);
-    }
-  });
-}
-
-CreateReferenceGraphPass::MethodWalkerFn
-CreateReferenceGraphPass::exception_ref_builder(
-    const Scope& scope,
-    refs_t& class_refs) {
-  return ([&class_refs](const DexMethod* meth) {
-    const auto* enclosing_class = type_class(meth->get_class());
-
-    std::vector<DexType*> catch_types;
-    meth->get_code()->gather_catch_types(catch_types);
-    for (auto type : catch_types) {
-      class_refs[enclosing_class].emplace(type);
-    }
-  });
+    if (t) class_refs[t] |= REF_IN_CLASS_STRUCTURE;
+  };
+  for (const auto* meth : cls->get_dmethods()) method_refs(meth);
+  for (const auto* meth : cls->get_vmethods()) method_refs(meth);
+  for (auto* field : cls->get_sfields()) field_refs(field);
+  for (auto* field : cls->get_ifields()) field_refs(field);
 }
 
-CreateReferenceGraphPass::InstructionWalkerFn
-CreateReferenceGraphPass::instruction_ref_builder(
-    const Scope& scope,
-    refs_t& class_refs) {
-  return ([this, &class_refs](const DexMethod* meth, IRInstruction* insn) {
-    const auto* enclosing_class = type_class(meth->get_class());
-
+void CreateReferenceGraphPass::build_code_refs(
+    const DexClass* cls,
+    class_refs_t& class_refs) const {
+  auto add = [&class_refs](const DexType* t) {
+    if (t) class_refs[t] |= REF_IN_CODE;
+  };
+  auto insn_refs = [&](IRInstruction* insn) {
     if (insn->has_type()) {
-      const auto* tref = insn->get_type();
-      if (tref) class_refs[enclosing_class].emplace(tref);
+      add(insn->get_type());
       return;
     }
     if (insn->has_field()) {
       auto* field = insn->get_field();
-      if (CreateReferenceGraphPass::config.resolve_fields) {
+      if (config.resolve_fields) {
         field = resolve_field(field);
       }
-      const auto* field_owner = field->get_class();
-      const auto* field_type = field->get_type();
-      if (field_owner) class_refs[enclosing_class].emplace(field_owner);
-      if (field_type) class_refs[enclosing_class].emplace(field_type);
+      add(field->get_class());
+      add(field->get_type());
       return;
     }
     if (insn->has_method()) {
       auto* method = insn->get_method();
-      if (CreateReferenceGraphPass::config.resolve_methods) {
+      if (config.resolve_methods) {
         method = resolve_method(method, MethodSearch::Any);
       }
 
@@ -169,59 +134,69 @@ CreateReferenceGraphPass::instruction_ref_builder(
       std::vector<DexType*> types;
       method->get_proto()->gather_types(types);
       for (const auto* t : types) {
-        if (t) class_refs[enclosing_class].emplace(t);
+        add(t);
       }
-
+    }
+  };
+  auto method_refs = [&](const DexMethod* meth) {
+    auto code = meth->get_code();
+    if (code == nullptr) {
       return;
     }
-  });
+    std::vector<DexType*> catch_types;
+    code->gather_catch_types(catch_types);
+    for (auto type : catch_types) {
+      add(type);
+    }
+    for (const auto& mie : InstructionIterable(code)) {
+      insn_refs(mie.insn);
+    }
+  };
+  for (const auto* meth : cls->get_dmethods()) method_refs(meth);
+  for (const auto* meth : cls->get_vmethods()) method_refs(meth);
 }
 
-void CreateReferenceGraphPass::gather_all(const Scope& scope, refs_t& class_refs) {
-  for (const auto* cls : scope) {
-    std::vector<DexType*> types;
-    cls->gather_types(types);
-    for (const auto* t : types) {
-      if (t) class_refs[cls].emplace(t);
-    }
+void CreateReferenceGraphPass::gather_all(
+    const DexClass* cls,
+    class_refs_t& class_refs) const {
+  std::vector<DexType*> types;
+  cls->gather_types(types);
+  for (const auto* t : types) {
+    if (t) class_refs[t] |= REF_ANYWHERE;
   }
 }
 
-void CreateReferenceGraphPass::build_refs(const Scope& scope, refs_t& class_refs) {
-  if (CreateReferenceGraphPass::config.gather_all) {
-    gather_all(scope, class_refs);
+CreateReferenceGraphPass::class_refs_t CreateReferenceGraphPass::build_refs(
+    const DexClass* cls) const {
+  class_refs_t class_refs;
+  if (config.gather_all) {
+    gather_all(cls, class_refs);
   } else {
-    if (CreateReferenceGraphPass::config.refs_in_annotations) {
-      build_class_annot_refs(scope, class_refs);
-      walk::methods(scope, method_annot_ref_builder(scope, class_refs));
-      walk::fields(scope, field_annot_ref_builder(scope, class_refs));
+    if (config.refs_in_annotations) {
+      build_annot_refs(cls, class_refs);
     }
-    if (CreateReferenceGraphPass::config.refs_in_class_structure) {
-      build_super_and_interface_refs(scope, class_refs);
-      walk::methods(scope, method_ref_builder(scope, class_refs));
-      walk::fields(scope, field_ref_builder(scope, class_refs));
+    if (config.refs_in_class_structure) {
+      build_super_and_interface_refs(cls, class_refs);
+      build_member_refs(cls, class_refs);
     }
-    if (CreateReferenceGraphPass::config.refs_in_code) {
-      walk::methods(scope, exception_ref_builder(scope, class_refs));
-      walk::opcodes(
-        scope,
-        [](const DexMethod*) { return true; },
-        instruction_ref_builder(scope, class_refs)
-      );
+    if (config.refs_in_code) {
+      build_code_refs(cls, class_refs);
     }
   }
+  return class_refs;
 }
 
-void CreateReferenceGraphPass::createAndOutputRefGraph(
-    DexStore& store,
-    type_to_store_map_t type_to_store) {
-  refs_t class_refs;
-  auto scope = build_class_scope(store.get_dexen());
-  build_refs(scope, class_refs);
-
-  for (auto& ref : class_refs) {
-    const auto source = ref.first;
-    for (const auto& target : ref.second) {
+void CreateReferenceGraphPass::trace_ref_graph(
+    const DexStore& store,
+    const std::vector<const DexClass*>& classes,
+    const std::vector<class_refs_t>& refs,
+    size_t begin,
+    size_t end,
+    const type_to_store_map_t& type_to_store) const {
+  for (size_t i = begin; i < end; i++) {
+    const auto source = classes[i];
+    for (const auto& ref : refs[i]) {
+      const auto target = ref.first;
       std::string target_store_name;
       auto find = type_to_store.find(target);
       if (find != type_to_store.end()) {
@@ -241,21 +216,90 @@ void CreateReferenceGraphPass::createAndOutputRefGraph(
   }
 }
 
+/**
+ * The classes are the nodes, labelled with their store, along with the types
+ * that are referenced but have no class, which are labelled "external".
+ */
+void CreateReferenceGraphPass::write_ref_graph(
+    const std::string& filename,
+    const std::vector<const DexClass*>& classes,
+    const std::vector<class_refs_t>& refs,
+    const type_to_store_map_t& type_to_store) const {
+  binary_graph::Graph graph;
+  std::unordered_map<const DexType*, uint32_t> type_to_node;
+  for (const auto* cls : classes) {
+    type_to_node[cls->get_type()] = graph.add_node(
+        binary_graph::NodeKind::CLASS,
+        cls->get_deobfuscated_name(),
+        type_to_store.at(cls->get_type())->get_name());
+  }
+  for (const auto& class_refs : refs) {
+    for (const auto& ref : class_refs) {
+      if (type_to_node.count(ref.first) == 0) {
+        type_to_node[ref.first] =
+            graph.add_node(binary_graph::NodeKind::TYPE,
+                           ref.first->get_name()->str(),
+                           "external");
+      }
+    }
+  }
+
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    auto& edges = graph.edges[i];
+    for (const auto& ref : refs[i]) {
+      edges.push_back(binary_graph::Edge{type_to_node.at(ref.first),
+                                         ref.second});
+    }
+  });
+  for (size_t i = 0; i < classes.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  if (!binary_graph::write(graph, filename)) {
+    perror("Error writing the reference graph");
+  }
+}
+
 void CreateReferenceGraphPass::run_pass(
     DexStoresVector& stores,
-    ConfigFiles& cfg, /* unused */
+    ConfigFiles& cfg,
     PassManager& mgr /* unused */) {
 
   type_to_store_map_t type_to_store;
+  std::vector<const DexClass*> classes;
+  // Where the classes of each store end in `classes`.
+  std::vector<size_t> store_ends;
   for (auto& store : stores) {
     auto scope = build_class_scope(store.get_dexen());
     for (const auto* cls : scope) {
       type_to_store[cls->get_type()] = &store;
+      classes.push_back(cls);
     }
+    store_ends.push_back(classes.size());
   }
 
-  for (auto& store : stores) {
-    createAndOutputRefGraph(store, type_to_store);
+  // The classes of all the stores are scanned in parallel.
+  std::vector<class_refs_t> refs(classes.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { refs[i] = build_refs(classes[i]); });
+  for (size_t i = 0; i < classes.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  size_t begin = 0;
+  for (size_t i = 0; i < stores.size(); i++) {
+    trace_ref_graph(
+        stores[i], classes, refs, begin, store_ends[i], type_to_store);
+    begin = store_ends[i];
+  }
+
+  if (!config.ref_output_filename.empty()) {
+    write_ref_graph(cfg.metafile(config.ref_output_filename),
+                    classes,
+                    refs,
+                    type_to_store);
   }
 }
 
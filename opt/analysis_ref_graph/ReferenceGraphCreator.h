@@ -11,7 +11,7 @@
 
 #include "Pass.h"
 
-#include <set>
+#include <map>
 #include <string>
 #include <unordered_map>
 
@@ -28,10 +28,23 @@ class CreateReferenceGraphPass : public Pass {
 
     pc.get("resolve_fields", false, config.resolve_fields);
     pc.get("resolve_methods", false, config.resolve_methods);
+
+    // Where to write the graph in the format of BinaryGraph.h, if anywhere.
+    pc.get("ref_output_filename", "", config.ref_output_filename);
   }
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  // What the edges of the binary graph stand for: a mask of the ways the
+  // class refers to the type.
+  enum RefKind : uint8_t {
+    REF_IN_ANNOTATION = 1,
+    REF_IN_CLASS_STRUCTURE = 2,
+    REF_IN_CODE = 4,
+    // gather_all doesn't tell the ways apart.
+    REF_ANYWHERE = 8,
+  };
+
  private:
   struct Config {
     std::string ref_output_filename;
@@ -47,61 +60,43 @@ class CreateReferenceGraphPass : public Pass {
   };
   Config config;
 
-  // refs_t is the "graph" type. It is a map from every class in the scope
-  // to the types each refer to
+  // class_refs_t is the part of the "graph" out of one class: the types it
+  // refers to, each with the RefKinds of the references.
   //
   // Use the config file to decide which types of references to collect
-  using refs_t = std::unordered_map<const DexClass*, std::set<const DexType*, dextypes_comparator>>;
+  using class_refs_t =
+      std::map<const DexType*, uint8_t, dextypes_comparator>;
   using type_to_store_map_t = std::unordered_map<const DexType*, DexStore*>;
 
-  using MethodWalkerFn = std::function<void(DexMethod*)>;
-  using FieldWalkerFn = std::function<void(DexField*)>;
-  using AnnotationWalkerFn = std::function<void(DexAnnotation*)>;
-  using InstructionWalkerFn = std::function<void(DexMethod*, IRInstruction*)>;
-
-  void build_super_and_interface_refs(
-      const Scope& scope,
-      refs_t& class_refs);
-
   template <class T>
-  void get_annots(
-      const T* thing_with_annots,
-      const DexClass* enclosing_class,
-      refs_t& class_refs);
-
-  MethodWalkerFn method_ref_builder(
-      const Scope& scope,
-      refs_t& class_refs);
-
-  FieldWalkerFn field_ref_builder(
-      const Scope& scope,
-      refs_t& class_refs);
+  static void get_annots(const T* thing_with_annots,
+                         uint8_t kind,
+                         class_refs_t& class_refs);
 
-  void build_class_annot_refs(
-      const Scope& scope,
-      refs_t& class_refs);
+  void build_super_and_interface_refs(const DexClass* cls,
+                                      class_refs_t& class_refs) const;
 
-  MethodWalkerFn method_annot_ref_builder(
-      const Scope& scope,
-      refs_t& class_refs);
+  void build_annot_refs(const DexClass* cls, class_refs_t& class_refs) const;
 
-  FieldWalkerFn field_annot_ref_builder(
-      const Scope& scope,
-      refs_t& class_refs);
+  void build_member_refs(const DexClass* cls, class_refs_t& class_refs) const;
 
-  MethodWalkerFn exception_ref_builder(
-      const Scope& scope,
-      refs_t& class_refs);
+  void build_code_refs(const DexClass* cls, class_refs_t& class_refs) const;
 
-  InstructionWalkerFn instruction_ref_builder(
-      const Scope& scope,
-      refs_t& class_refs);
+  void gather_all(const DexClass* cls, class_refs_t& class_refs) const;
 
-  void gather_all(const Scope& scope, refs_t& class_refs);
+  // Only reads the class, so classes can be done in parallel.
+  class_refs_t build_refs(const DexClass* cls) const;
 
-  void build_refs(const Scope& scope, refs_t& class_refs);
+  // Traces the classes from begin to end, all of the store.
+  void trace_ref_graph(const DexStore& store,
+                       const std::vector<const DexClass*>& classes,
+                       const std::vector<class_refs_t>& refs,
+                       size_t begin,
+                       size_t end,
+                       const type_to_store_map_t& type_to_store) const;
 
-  void createAndOutputRefGraph(
-      DexStore& store,
-      type_to_store_map_t type_to_store);
+  void write_ref_graph(const std::string& filename,
+                       const std::vector<const DexClass*>& classes,
+                       const std::vector<class_refs_t>& refs,
+                       const type_to_store_map_t& type_to_store) const;
 };
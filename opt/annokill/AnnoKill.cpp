@@ -17,6 +17,7 @@
 #include "DexUtil.h"
 #include "Resolver.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 constexpr const char* METRIC_ANNO_KILLED = "num_anno_killed";
 constexpr const char* METRIC_ANNO_TOTAL = "num_anno_total";
@@ -107,196 +108,249 @@ AnnoKill::AnnoKill(Scope& scope,
   }
 }
 
-AnnoKill::AnnoSet AnnoKill::get_referenced_annos() {
-  AnnoKill::AnnoSet all_annos;
+namespace {
 
-  // all used annotations
-  auto annos_in_aset = [&](DexAnnotationSet* aset) {
-    if (!aset) {
-      return;
-    }
-    for (const auto& anno : aset->get_annotations()) {
-      all_annos.insert(anno->type());
+void mark_referenced_annos(const DexMethod* meth,
+                           IRInstruction* insn,
+                           const AnnoKill::AnnoSet& all_annos,
+                           AnnoKill::AnnoSet& referenced_annos) {
+  if (insn->has_type()) {
+    auto type = insn->get_type();
+    if (all_annos.count(type) > 0) {
+      referenced_annos.insert(type);
+      TRACE(ANNO,
+            3,
+            "Annotation referenced in type opcode\n\t%s.%s:%s - %s\n",
+            SHOW(meth->get_class()),
+            SHOW(meth->get_name()),
+            SHOW(meth->get_proto()),
+            SHOW(insn));
+    }
+  } else if (insn->has_field()) {
+    auto field = insn->get_field();
+    auto fdef = resolve_field(field,
+                              is_sfield_op(insn->opcode())
+                                  ? FieldSearch::Static
+                                  : FieldSearch::Instance);
+    if (fdef != nullptr) field = fdef;
+
+    bool referenced = false;
+    auto owner = field->get_class();
+    if (all_annos.count(owner) > 0) {
+      referenced = true;
+      referenced_annos.insert(owner);
+    }
+    auto type = field->get_type();
+    if (all_annos.count(type) > 0) {
+      referenced = true;
+      referenced_annos.insert(type);
+    }
+    if (referenced) {
+      TRACE(ANNO,
+            3,
+            "Annotation referenced in field opcode\n\t%s.%s:%s - %s\n",
+            SHOW(meth->get_class()),
+            SHOW(meth->get_name()),
+            SHOW(meth->get_proto()),
+            SHOW(insn));
+    }
+  } else if (insn->has_method()) {
+    auto method = insn->get_method();
+    DexMethod* methdef = resolve_method(method, opcode_to_search(insn));
+    if (methdef != nullptr) method = methdef;
+
+    bool referenced = false;
+    auto owner = method->get_class();
+    if (all_annos.count(owner) > 0) {
+      referenced = true;
+      referenced_annos.insert(owner);
+    }
+    auto proto = method->get_proto();
+    auto rtype = proto->get_rtype();
+    if (all_annos.count(rtype) > 0) {
+      referenced = true;
+      referenced_annos.insert(rtype);
+    }
+    auto arg_list = proto->get_args();
+    for (const auto& arg : arg_list->get_type_list()) {
+      if (all_annos.count(arg) > 0) {
+        referenced = true;
+        referenced_annos.insert(arg);
+      }
     }
-  };
-
-  for (const auto& cls : m_scope) {
-    // all annotations referenced in classes
-    annos_in_aset(cls->get_anno_set());
-
-    // all classes marked as annotation
-    if (is_annotation(cls)) {
-      all_annos.insert(cls->get_type());
+    if (referenced) {
+      TRACE(ANNO,
+            3,
+            "Annotation referenced in method opcode\n\t%s.%s:%s - %s\n",
+            SHOW(meth->get_class()),
+            SHOW(meth->get_name()),
+            SHOW(meth->get_proto()),
+            SHOW(insn));
     }
   }
+}
 
-  // all annotations in methods
-  walk::methods(m_scope, [&](DexMethod* method) {
-    annos_in_aset(method->get_anno_set());
-    auto param_annos = method->get_param_anno();
-    if (!param_annos) {
-      return;
+} // namespace
+
+AnnoKill::AnnoIndex AnnoKill::build_anno_index() {
+  std::vector<AnnoIndex> class_indices(m_scope.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    auto cls = m_scope[i];
+    auto& index = class_indices[i];
+    auto add_aset = [&](DexAnnotationSet* aset) {
+      for (const auto& anno : aset->get_annotations()) {
+        auto& asets = index.asets[anno->type()];
+        if (asets.empty() || asets.back() != aset) {
+          asets.push_back(aset);
+        }
+      }
+    };
+    if (cls->get_anno_set()) {
+      index.classes.push_back(cls);
+      add_aset(cls->get_anno_set());
+    }
+    for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+      for (auto method : *methods) {
+        if (method->get_anno_set()) {
+          index.methods.push_back(method);
+          add_aset(method->get_anno_set());
+        }
+        auto param_annos = method->get_param_anno();
+        if (param_annos && !param_annos->empty()) {
+          index.param_methods.push_back(method);
+          for (auto pa : *param_annos) {
+            add_aset(pa.second);
+          }
+        }
+      }
     }
-    for (auto pa : *param_annos) {
-      annos_in_aset(pa.second);
+    for (auto fields : {&cls->get_ifields(), &cls->get_sfields()}) {
+      for (auto field : *fields) {
+        if (field->get_anno_set()) {
+          index.fields.push_back(field);
+          add_aset(field->get_anno_set());
+        }
+      }
     }
   });
-  // all annotations in fields
-  walk::fields(m_scope,
-              [&](DexField* field) { annos_in_aset(field->get_anno_set()); });
-
-  AnnoKill::AnnoSet referenced_annos;
-
-  // mark an annotation as "unremovable" if a field is typed with that
-  // annotation
-  walk::fields(m_scope, [&](DexField* field) {
-    // don't look at fields defined on the annotation itself
-    const auto field_cls_type = field->get_class();
-    if (all_annos.count(field_cls_type) > 0) {
-      return;
-    }
-
-    const auto field_cls = type_class(field_cls_type);
-    if (field_cls != nullptr && is_annotation(field_cls)) {
-      return;
+  for (size_t i = 0; i < m_scope.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  AnnoIndex index;
+  for (auto& class_index : class_indices) {
+    index.classes.insert(index.classes.end(),
+                         class_index.classes.begin(),
+                         class_index.classes.end());
+    index.methods.insert(index.methods.end(),
+                         class_index.methods.begin(),
+                         class_index.methods.end());
+    index.param_methods.insert(index.param_methods.end(),
+                               class_index.param_methods.begin(),
+                               class_index.param_methods.end());
+    index.fields.insert(index.fields.end(),
+                        class_index.fields.begin(),
+                        class_index.fields.end());
+    for (auto& it : class_index.asets) {
+      auto& asets = index.asets[it.first];
+      asets.insert(asets.end(), it.second.begin(), it.second.end());
     }
+  }
+  return index;
+}
 
-    auto ftype = field->get_type();
-    if (all_annos.count(ftype) > 0) {
-      TRACE(ANNO,
-            3,
-            "Field typed with an annotation type %s.%s:%s\n",
-            SHOW(field->get_class()),
-            SHOW(field->get_name()),
-            SHOW(ftype));
-      referenced_annos.insert(ftype);
-    }
-  });
+AnnoKill::AnnoSet AnnoKill::get_referenced_annos(const AnnoIndex& index) {
+  AnnoKill::AnnoSet all_annos;
 
-  // mark an annotation as "unremovable" if a method signature contains a type
-  // with that annotation
-  walk::methods(m_scope, [&](DexMethod* meth) {
-    // don't look at methods defined on the annotation itself
-    const auto meth_cls_type = meth->get_class();
-    if (all_annos.count(meth_cls_type) > 0) {
-      return;
+  // all used annotations
+  for (const auto& it : index.asets) {
+    all_annos.insert(const_cast<DexType*>(it.first));
+  }
+  // all classes marked as annotation
+  for (const auto& cls : m_scope) {
+    if (is_annotation(cls)) {
+      all_annos.insert(cls->get_type());
     }
+  }
 
-    const auto meth_cls = type_class(meth_cls_type);
-    if (meth_cls != nullptr && is_annotation(meth_cls)) {
-      return;
-    }
+  // Each worker gathers the annotations referenced by its classes.
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<AnnoKill::AnnoSet> referenced(num_threads);
+  auto wq = WorkQueue<DexClass*, AnnoKill::AnnoSet*, std::nullptr_t>(
+      [&](AnnoKill::AnnoSet*& referenced_annos,
+          DexClass* cls) -> std::nullptr_t {
+        // don't look at members defined on the annotation itself
+        if (all_annos.count(cls->get_type()) > 0 || is_annotation(cls)) {
+          return nullptr;
+        }
 
-    const auto& has_anno = [&](DexType* type) {
-      if (all_annos.count(type) > 0) {
-        TRACE(ANNO,
-              3,
-              "Method contains annotation type in signature %s.%s:%s\n",
-              SHOW(meth->get_class()),
-              SHOW(meth->get_name()),
-              SHOW(meth->get_proto()));
-        referenced_annos.insert(type);
-      }
-    };
+        // mark an annotation as "unremovable" if a field is typed with that
+        // annotation
+        for (auto fields : {&cls->get_ifields(), &cls->get_sfields()}) {
+          for (auto field : *fields) {
+            auto ftype = field->get_type();
+            if (all_annos.count(ftype) > 0) {
+              TRACE(ANNO,
+                    3,
+                    "Field typed with an annotation type %s.%s:%s\n",
+                    SHOW(field->get_class()),
+                    SHOW(field->get_name()),
+                    SHOW(ftype));
+              referenced_annos->insert(ftype);
+            }
+          }
+        }
 
-    const auto proto = meth->get_proto();
-    has_anno(proto->get_rtype());
-    for (const auto& arg : proto->get_args()->get_type_list()) {
-      has_anno(arg);
-    }
-  });
+        for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+          for (auto meth : *methods) {
+            // mark an annotation as "unremovable" if a method signature
+            // contains a type with that annotation
+            const auto& has_anno = [&](DexType* type) {
+              if (all_annos.count(type) > 0) {
+                TRACE(ANNO,
+                      3,
+                      "Method contains annotation type in signature "
+                      "%s.%s:%s\n",
+                      SHOW(meth->get_class()),
+                      SHOW(meth->get_name()),
+                      SHOW(meth->get_proto()));
+                referenced_annos->insert(type);
+              }
+            };
 
-  // mark an annotation as "unremovable" if any opcode references the annotation
-  // type
-  walk::opcodes(
-      m_scope,
-      [](DexMethod*) { return true; },
-      [&](DexMethod* meth, IRInstruction* insn) {
-        // don't look at methods defined on the annotation itself
-        const auto meth_cls_type = meth->get_class();
-        if (all_annos.count(meth_cls_type) > 0) {
-          return;
-        }
-        const auto meth_cls = type_class(meth_cls_type);
-        if (meth_cls != nullptr && is_annotation(meth_cls)) {
-          return;
-        }
+            const auto proto = meth->get_proto();
+            has_anno(proto->get_rtype());
+            for (const auto& arg : proto->get_args()->get_type_list()) {
+              has_anno(arg);
+            }
 
-        if (insn->has_type()) {
-          auto type = insn->get_type();
-          if (all_annos.count(type) > 0) {
-            referenced_annos.insert(type);
-            TRACE(ANNO,
-                  3,
-                  "Annotation referenced in type opcode\n\t%s.%s:%s - %s\n",
-                  SHOW(meth->get_class()),
-                  SHOW(meth->get_name()),
-                  SHOW(meth->get_proto()),
-                  SHOW(insn));
-          }
-        } else if (insn->has_field()) {
-          auto field = insn->get_field();
-          auto fdef = resolve_field(field,
-                                    is_sfield_op(insn->opcode())
-                                        ? FieldSearch::Static
-                                        : FieldSearch::Instance);
-          if (fdef != nullptr) field = fdef;
-
-          bool referenced = false;
-          auto owner = field->get_class();
-          if (all_annos.count(owner) > 0) {
-            referenced = true;
-            referenced_annos.insert(owner);
-          }
-          auto type = field->get_type();
-          if (all_annos.count(type) > 0) {
-            referenced = true;
-            referenced_annos.insert(type);
-          }
-          if (referenced) {
-            TRACE(ANNO,
-                  3,
-                  "Annotation referenced in field opcode\n\t%s.%s:%s - %s\n",
-                  SHOW(meth->get_class()),
-                  SHOW(meth->get_name()),
-                  SHOW(meth->get_proto()),
-                  SHOW(insn));
-          }
-        } else if (insn->has_method()) {
-          auto method = insn->get_method();
-          DexMethod* methdef = resolve_method(method, opcode_to_search(insn));
-          if (methdef != nullptr) method = methdef;
-
-          bool referenced = false;
-          auto owner = method->get_class();
-          if (all_annos.count(owner) > 0) {
-            referenced = true;
-            referenced_annos.insert(owner);
-          }
-          auto proto = method->get_proto();
-          auto rtype = proto->get_rtype();
-          if (all_annos.count(rtype) > 0) {
-            referenced = true;
-            referenced_annos.insert(rtype);
-          }
-          auto arg_list = proto->get_args();
-          for (const auto& arg : arg_list->get_type_list()) {
-            if (all_annos.count(arg) > 0) {
-              referenced = true;
-              referenced_annos.insert(arg);
+            // mark an annotation as "unremovable" if any opcode references
+            // the annotation type
+            auto code = meth->get_code();
+            if (code == nullptr) {
+              continue;
+            }
+            for (const auto& mie : InstructionIterable(code)) {
+              mark_referenced_annos(
+                  meth, mie.insn, all_annos, *referenced_annos);
             }
-          }
-          if (referenced) {
-            TRACE(ANNO,
-                  3,
-                  "Annotation referenced in method opcode\n\t%s.%s:%s - %s\n",
-                  SHOW(meth->get_class()),
-                  SHOW(meth->get_name()),
-                  SHOW(meth->get_proto()),
-                  SHOW(insn));
           }
         }
-      });
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &referenced[thread_idx]; },
+      num_threads);
+  for (auto cls : m_scope) {
+    wq.add_item(cls);
+  }
+  wq.run_all();
+
+  AnnoKill::AnnoSet referenced_annos;
+  for (const auto& annos : referenced) {
+    referenced_annos.insert(annos.begin(), annos.end());
+  }
   return referenced_annos;
 }
 
@@ -341,6 +395,13 @@ void AnnoKill::count_annotation(const DexAnnotation* da) {
   }
 }
 
+void AnnoKill::count_aset(DexAnnotationSet* aset) {
+  m_stats.annotations += aset->size();
+  for (const auto& da : aset->get_annotations()) {
+    count_annotation(da);
+  }
+}
+
 void AnnoKill::cleanup_aset(DexAnnotationSet* aset,
                             const AnnoKill::AnnoSet& referenced_annos,
                             const std::unordered_set<const DexType*>& keep_annos) {
@@ -497,21 +558,47 @@ std::unordered_set<const DexType*> AnnoKill::build_anno_keep(DexAnnotationSet* a
 }
 
 bool AnnoKill::kill_annotations() {
-  const auto& referenced_annos = get_referenced_annos();
+  const auto& index = build_anno_index();
+  const auto& referenced_annos = get_referenced_annos(index);
   if (!m_only_force_kill) {
     m_kill = get_removable_annotation_instances();
   }
 
-  for (auto clazz : m_scope) {
+  // When only forcing the removal of a few annotation types, the index tells
+  // which sets can lose anything. All other sets are only accounted for.
+  std::unordered_set<DexAnnotationSet*> targets;
+  if (m_only_force_kill) {
+    auto add_targets = [&](const DexType* type) {
+      auto it = index.asets.find(type);
+      if (it != index.asets.end()) {
+        targets.insert(it->second.begin(), it->second.end());
+      }
+    };
+    for (auto type : m_kill) {
+      add_targets(type);
+    }
+    for (auto type : m_force_kill) {
+      add_targets(type);
+    }
+    if (m_kill_bad_signatures) {
+      add_targets(DexType::get_type("Ldalvik/annotation/Signature;"));
+    }
+  }
+  auto is_target = [&](DexAnnotationSet* aset) {
+    return !m_only_force_kill || aset->size() == 0 || targets.count(aset) > 0;
+  };
+
+  for (auto clazz : index.classes) {
     DexAnnotationSet* aset = clazz->get_anno_set();
-    if (!aset) {
+    m_stats.class_asets++;
+    if (!is_target(aset)) {
+      count_aset(aset);
       continue;
     }
     auto keep_list = build_anno_keep(aset);
     auto& class_hier_keep_list = m_anno_class_hierarchy_keep[clazz->get_type()];
     keep_list.insert(class_hier_keep_list.begin(), class_hier_keep_list.end());
 
-    m_stats.class_asets++;
     cleanup_aset(aset, referenced_annos, keep_list);
     if (aset->size() == 0) {
       TRACE(ANNO,
@@ -523,64 +610,79 @@ bool AnnoKill::kill_annotations() {
     }
   }
 
-  walk::methods(m_scope, [&](DexMethod* method) {
-    // Method annotations
+  // Method annotations
+  for (auto method : index.methods) {
     auto method_aset = method->get_anno_set();
-    if (method_aset) {
-      m_stats.method_asets++;
-      auto keep_list = build_anno_keep(method_aset);
-      cleanup_aset(method_aset, referenced_annos, keep_list);
-      if (method_aset->size() == 0) {
-        TRACE(ANNO,
-              3,
-              "Clearing annotations for method %s.%s:%s\n",
-              SHOW(method->get_class()),
-              SHOW(method->get_name()),
-              SHOW(method->get_proto()));
-        method->clear_annotations();
-        m_stats.method_asets_cleared++;
-      }
+    m_stats.method_asets++;
+    if (!is_target(method_aset)) {
+      count_aset(method_aset);
+      continue;
+    }
+    auto keep_list = build_anno_keep(method_aset);
+    cleanup_aset(method_aset, referenced_annos, keep_list);
+    if (method_aset->size() == 0) {
+      TRACE(ANNO,
+            3,
+            "Clearing annotations for method %s.%s:%s\n",
+            SHOW(method->get_class()),
+            SHOW(method->get_name()),
+            SHOW(method->get_proto()));
+      method->clear_annotations();
+      m_stats.method_asets_cleared++;
     }
+  }
 
-    // Parameter annotations.
+  // Parameter annotations.
+  for (auto method : index.param_methods) {
     auto param_annos = method->get_param_anno();
-    if (param_annos) {
-      m_stats.method_param_asets += param_annos->size();
-      bool clear_pas = true;
-      for (auto pa : *param_annos) {
-        auto param_aset = pa.second;
-        if (param_aset->size() == 0) {
-          continue;
-        }
-        auto keep_list = build_anno_keep(param_aset);
-        cleanup_aset(param_aset, referenced_annos, keep_list);
-        if (param_aset->size() == 0) {
-          continue;
-        }
+    m_stats.method_param_asets += param_annos->size();
+    bool any_target = false;
+    for (auto pa : *param_annos) {
+      if (pa.second->size() > 0 && is_target(pa.second)) {
+        any_target = true;
+        break;
+      }
+    }
+    bool clear_pas = true;
+    for (auto pa : *param_annos) {
+      auto param_aset = pa.second;
+      if (param_aset->size() == 0) {
+        continue;
+      }
+      if (!any_target) {
+        count_aset(param_aset);
         clear_pas = false;
+        continue;
       }
-      if (clear_pas) {
-        TRACE(ANNO,
-              3,
-              "Clearing parameter annotations for method parameters %s.%s:%s\n",
-              SHOW(method->get_class()),
-              SHOW(method->get_name()),
-              SHOW(method->get_proto()));
-        m_stats.method_param_asets_cleared += param_annos->size();
-        for (auto pa : *param_annos) {
-          delete pa.second;
-        }
-        param_annos->clear();
+      auto keep_list = build_anno_keep(param_aset);
+      cleanup_aset(param_aset, referenced_annos, keep_list);
+      if (param_aset->size() == 0) {
+        continue;
       }
+      clear_pas = false;
     }
-  });
+    if (clear_pas) {
+      TRACE(ANNO,
+            3,
+            "Clearing parameter annotations for method parameters %s.%s:%s\n",
+            SHOW(method->get_class()),
+            SHOW(method->get_name()),
+            SHOW(method->get_proto()));
+      m_stats.method_param_asets_cleared += param_annos->size();
+      for (auto pa : *param_annos) {
+        delete pa.second;
+      }
+      param_annos->clear();
+    }
+  }
 
-  walk::fields(m_scope, [&](DexField* field) {
+  for (auto field : index.fields) {
     DexAnnotationSet* aset = field->get_anno_set();
-    if (!aset) {
-      return;
-    }
     m_stats.field_asets++;
+    if (!is_target(aset)) {
+      count_aset(aset);
+      continue;
+    }
     auto keep_list = build_anno_keep(aset);
     cleanup_aset(aset, referenced_annos, keep_list);
     if (aset->size() == 0) {
@@ -593,7 +695,7 @@ bool AnnoKill::kill_annotations() {
       field->clear_annotations();
       m_stats.field_asets_cleared++;
     }
-  });
+  }
 
   bool classes_removed = false;
   // We're done removing annotation instances, go ahead and remove annotation
@@ -13,6 +13,7 @@
 
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -56,10 +57,23 @@ class AnnoKill {
   AnnoKillStats get_stats() const { return m_stats; }
 
  private:
+  // The annotated classes, methods and fields of the scope, in scope order,
+  // along with the annotation sets that hold each annotation type.
+  struct AnnoIndex {
+    std::vector<DexClass*> classes;
+    std::vector<DexMethod*> methods;
+    std::vector<DexMethod*> param_methods;
+    std::vector<DexField*> fields;
+    std::unordered_map<const DexType*, std::vector<DexAnnotationSet*>> asets;
+  };
+
+  // Builds the index in parallel, one class at a time.
+  AnnoIndex build_anno_index();
+
   // Gets the set of all annotations referenced in code
   // either by the use of SomeClass.class, as a parameter of a method
   // call or if the annotation is a field of a class.
-  AnnoSet get_referenced_annos();
+  AnnoSet get_referenced_annos(const AnnoIndex& index);
 
   // Retrieves the list of annotation instances that match the given set
   // of annotation types to be removed.
@@ -70,6 +84,8 @@ class AnnoKill {
     const AnnoSet& referenced_annos,
     const std::unordered_set<const DexType*>& keep_annos = std::unordered_set<const DexType*>{});
   void count_annotation(const DexAnnotation* da);
+  // Only accounts for the annotations of a set that has nothing to remove.
+  void count_aset(DexAnnotationSet* aset);
 
   Scope& m_scope;
   bool m_only_force_kill;
@@ -0,0 +1,541 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "BlockReordering.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_set>
+#include <vector>
+
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "PassManager.h"
+#include "ScopeView.h"
+#include "Walkers.h"
+
+namespace block_reordering {
+
+namespace {
+
+constexpr const char* COLD_METHOD_INFIX = "$cold$";
+
+// A cold block to move to a helper.
+struct ColdBlock {
+  DexMethod* method;
+  // In code order, ending with the throw.
+  std::vector<IRInstruction*> insns;
+};
+
+struct MethodResult {
+  Stats stats;
+  std::vector<ColdBlock> cold_blocks;
+};
+
+bool has_try(IRCode* code) {
+  for (const auto& mie : *code) {
+    if (mie.type == MFLOW_TRY || mie.type == MFLOW_CATCH) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t count_of(const BlockCounts& counts, const Block* block) {
+  auto it = counts.find(block->id());
+  return it == counts.end() ? 0 : it->second;
+}
+
+MethodItemEntry* last_insn(Block* block) {
+  for (auto it = block->rbegin(); it != block->rend(); ++it) {
+    if (it->type == MFLOW_OPCODE) {
+      return &*it;
+    }
+  }
+  return nullptr;
+}
+
+bool falls_through(Block* block) {
+  auto last = last_insn(block);
+  if (last == nullptr) {
+    return true;
+  }
+  auto op = last->insn->opcode();
+  return op != OPCODE_GOTO && !is_return(op) && op != OPCODE_THROW;
+}
+
+/*
+ * The order to lay the blocks out in: the entry first, then chains that
+ * follow the most executed successor, started from the hottest block not yet
+ * placed, then the blocks that never ran in their original order.
+ */
+std::vector<Block*> layout(const std::vector<Block*>& blocks,
+                           const BlockCounts& counts) {
+  std::vector<Block*> order;
+  std::vector<bool> placed(blocks.size(), false);
+  // Hotter first, then the block that used to come next, then code order.
+  auto better = [&](Block* a, Block* b, const Block* prev) {
+    auto count_a = count_of(counts, a);
+    auto count_b = count_of(counts, b);
+    if (count_a != count_b) {
+      return count_a > count_b;
+    }
+    if (prev != nullptr && (a->id() == prev->id() + 1) !=
+                               (b->id() == prev->id() + 1)) {
+      return a->id() == prev->id() + 1;
+    }
+    return a->id() < b->id();
+  };
+
+  Block* current = blocks.front();
+  while (current != nullptr) {
+    placed[current->id()] = true;
+    order.push_back(current);
+    Block* next = nullptr;
+    for (const auto& edge : current->succs()) {
+      auto succ = edge->target();
+      if (!placed[succ->id()] && count_of(counts, succ) > 0 &&
+          (next == nullptr || better(succ, next, current))) {
+        next = succ;
+      }
+    }
+    if (next == nullptr) {
+      for (auto block : blocks) {
+        if (!placed[block->id()] && count_of(counts, block) > 0 &&
+            (next == nullptr || better(block, next, nullptr))) {
+          next = block;
+        }
+      }
+    }
+    current = next;
+  }
+  for (auto block : blocks) {
+    if (!placed[block->id()]) {
+      order.push_back(block);
+    }
+  }
+  return order;
+}
+
+// What we need to know about a block once its entries are relinked.
+struct BlockInfo {
+  std::vector<MethodItemEntry*> entries;
+  // Marks the start of the block while it is being relinked.
+  MethodItemEntry* anchor;
+  // The block it falls through to, if any.
+  Block* fallthrough{nullptr};
+  // The branch, goto or switch that ends the block, if any.
+  MethodItemEntry* branch{nullptr};
+  // The position in effect when the block starts, and whether the block sets
+  // its own before its first instruction.
+  DexPosition* incoming_position{nullptr};
+  bool has_own_position{false};
+};
+
+/*
+ * Relinks the entries of the code in the order of the blocks, and fixes the
+ * edges the new order breaks.
+ */
+void relink(IRCode* code,
+            const std::vector<Block*>& blocks,
+            const std::vector<Block*>& order,
+            Stats& stats) {
+  std::vector<BlockInfo> infos(blocks.size());
+  DexPosition* position = nullptr;
+  for (auto block : blocks) {
+    auto& info = infos[block->id()];
+    info.incoming_position = position;
+    bool seen_insn = false;
+    for (auto it = block->begin(); it != block->end(); ++it) {
+      info.entries.push_back(&*it);
+      if (it->type == MFLOW_OPCODE) {
+        seen_insn = true;
+      } else if (it->type == MFLOW_POSITION) {
+        info.has_own_position |= !seen_insn;
+        position = it->pos;
+      }
+    }
+    if (falls_through(block) && block->id() + 1 < blocks.size()) {
+      info.fallthrough = blocks[block->id() + 1];
+    }
+    auto last = last_insn(block);
+    if (last != nullptr && is_branch(last->insn->opcode())) {
+      info.branch = last;
+    }
+  }
+
+  while (code->begin() != code->end()) {
+    code->erase(code->begin());
+  }
+  const Block* prev = nullptr;
+  for (auto block : order) {
+    auto& info = infos[block->id()];
+    info.anchor = new MethodItemEntry();
+    code->push_back(*info.anchor);
+    bool moved = prev == nullptr || prev->id() + 1 != block->id();
+    bool needs_position = moved && !info.has_own_position &&
+                          info.incoming_position != nullptr;
+    for (auto mie : info.entries) {
+      if (needs_position && mie->type != MFLOW_TARGET) {
+        code->push_back(info.incoming_position);
+        needs_position = false;
+      }
+      code->push_back(*mie);
+    }
+    prev = block;
+  }
+
+  auto start_of = [&](const Block* block) {
+    return code->iterator_to(*infos[block->id()].anchor);
+  };
+  std::vector<MethodItemEntry*> redundant_gotos;
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto block = order[i];
+    auto next = i + 1 < order.size() ? order[i + 1] : nullptr;
+    auto& info = infos[block->id()];
+    auto branch = info.branch;
+    if (branch != nullptr && branch->insn->opcode() == OPCODE_GOTO &&
+        block->succs().size() == 1 && block->succs()[0]->target() == next) {
+      redundant_gotos.push_back(branch);
+      continue;
+    }
+    auto fallthrough = info.fallthrough;
+    if (fallthrough == nullptr || fallthrough == next) {
+      continue;
+    }
+    if (branch != nullptr && is_conditional_branch(branch->insn->opcode()) &&
+        next != nullptr) {
+      // Branch to the old fallthrough and fall through to the target.
+      const auto& next_entries = infos[next->id()].entries;
+      auto target = std::find_if(
+          next_entries.begin(), next_entries.end(), [&](MethodItemEntry* mie) {
+            return mie->type == MFLOW_TARGET && mie->target->src == branch;
+          });
+      if (target != next_entries.end()) {
+        branch->insn->set_opcode(
+            opcode::invert_conditional_branch(branch->insn->opcode()));
+        code->erase(code->iterator_to(**target));
+        code->insert_after(start_of(fallthrough), **target);
+        ++stats.branches_inverted;
+        continue;
+      }
+    }
+    auto goto_it = code->insert_before(
+        next == nullptr ? code->end() : start_of(next),
+        new IRInstruction(OPCODE_GOTO));
+    code->insert_after(start_of(fallthrough), new BranchTarget(&*goto_it));
+    ++stats.gotos_added;
+  }
+  for (auto mie : redundant_gotos) {
+    code->remove_opcode(code->iterator_to(*mie));
+    ++stats.gotos_removed;
+  }
+  for (auto block : order) {
+    code->erase_and_dispose(start_of(block));
+  }
+}
+
+/*
+ * Whether the block can move to a static method of the same class: it ends
+ * in a throw, and neither reads a register it didn't write nor depends on the
+ * frame of the method.
+ */
+bool can_outline(Block* block) {
+  std::unordered_set<uint16_t> written;
+  IRInstruction* last = nullptr;
+  for (auto it = block->begin(); it != block->end(); ++it) {
+    if (it->type != MFLOW_OPCODE) {
+      continue;
+    }
+    auto insn = it->insn;
+    auto op = insn->opcode();
+    if (last == nullptr &&
+        (is_move_result(op) || opcode::is_move_result_pseudo(op))) {
+      return false;
+    }
+    switch (op) {
+    case OPCODE_INVOKE_SUPER:
+    case OPCODE_MONITOR_ENTER:
+    case OPCODE_MONITOR_EXIT:
+    case OPCODE_MOVE_EXCEPTION:
+      return false;
+    default:
+      break;
+    }
+    if (opcode::is_load_param(op)) {
+      return false;
+    }
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      if (written.count(insn->src(i)) == 0) {
+        return false;
+      }
+    }
+    if (insn->dests_size() > 0) {
+      written.insert(insn->dest());
+      if (insn->dest_is_wide()) {
+        written.insert(insn->dest() + 1);
+      }
+    }
+    last = insn;
+  }
+  return last != nullptr && last->opcode() == OPCODE_THROW;
+}
+
+// The cold blocks of the method that can move to a helper.
+std::vector<ColdBlock> find_cold_blocks(DexMethod* method,
+                                        const std::vector<Block*>& blocks,
+                                        const BlockCounts& counts) {
+  std::vector<ColdBlock> cold_blocks;
+  for (auto block : blocks) {
+    if (block == blocks.front() || count_of(counts, block) > 0 ||
+        block->preds().empty() || !can_outline(block)) {
+      continue;
+    }
+    ColdBlock cold{method, {}};
+    for (auto it = block->begin(); it != block->end(); ++it) {
+      if (it->type == MFLOW_OPCODE) {
+        cold.insns.push_back(it->insn);
+      }
+    }
+    // The call that replaces it takes five code units.
+    size_t size = 0;
+    for (auto insn : cold.insns) {
+      size += insn->size();
+    }
+    if (size > 5) {
+      cold_blocks.push_back(std::move(cold));
+    }
+  }
+  return cold_blocks;
+}
+
+MethodResult reorder_method(DexMethod* method,
+                            const BlockCounts& counts,
+                            const Config& config) {
+  MethodResult result;
+  auto code = method->get_code();
+  if (has_try(code)) {
+    return result;
+  }
+  code->build_cfg();
+  const auto& blocks = code->cfg().blocks();
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    always_assert(blocks[i]->id() == i);
+  }
+  if (count_of(counts, blocks.front()) < config.hot_method_min_count) {
+    return result;
+  }
+  // The profile was taken from other code.
+  for (const auto& pair : counts) {
+    if (pair.first >= blocks.size()) {
+      TRACE(BBREORDER, 2, "Stale profile for %s\n", SHOW(method));
+      return result;
+    }
+  }
+
+  if (config.outline_cold_blocks &&
+      code->sum_opcode_sizes() >= config.outline_min_method_size &&
+      !is_interface(type_class(method->get_class()))) {
+    result.cold_blocks = find_cold_blocks(method, blocks, counts);
+  }
+  auto order = layout(blocks, counts);
+  bool same = true;
+  for (size_t i = 0; i < order.size(); ++i) {
+    same &= order[i]->id() == i;
+  }
+  if (!same) {
+    relink(code, blocks, order, result.stats);
+    ++result.stats.methods_reordered;
+    TRACE(BBREORDER, 5, "Reordered %s:\n%s\n", SHOW(method), SHOW(code));
+  }
+  code->clear_cfg();
+  return result;
+}
+
+DexMethod* make_cold_method(const ColdBlock& cold) {
+  auto method = cold.method;
+  auto type = method->get_class();
+  auto proto = DexProto::make_proto(DexType::make_type("Ljava/lang/Throwable;"),
+                                    DexTypeList::make_type_list({}));
+  DexString* name;
+  for (size_t i = 0;; ++i) {
+    name = DexString::make_string(method->get_name()->str() +
+                                  COLD_METHOD_INFIX + std::to_string(i));
+    if (DexMethod::get_method(type, name, proto) == nullptr) {
+      break;
+    }
+  }
+  auto cold_method =
+      static_cast<DexMethod*>(DexMethod::make_method(type, name, proto));
+  cold_method->make_concrete(ACC_PRIVATE | ACC_STATIC, false);
+  auto code = std::make_unique<IRCode>(
+      cold_method, method->get_code()->get_registers_size());
+  for (auto insn : cold.insns) {
+    if (insn->opcode() == OPCODE_THROW) {
+      // The cold block ends the method by throwing, so its copy hands the
+      // exception back instead, for call_cold_method to throw in its place.
+      code->push_back(
+          (new IRInstruction(OPCODE_RETURN_OBJECT))->set_src(0, insn->src(0)));
+    } else {
+      code->push_back(new IRInstruction(*insn));
+    }
+  }
+  cold_method->set_code(std::move(code));
+  type_class(type)->add_method(cold_method);
+  return cold_method;
+}
+
+// Replaces the block with a call to the cold method and a throw.
+void call_cold_method(const ColdBlock& cold, DexMethod* cold_method) {
+  auto code = cold.method->get_code();
+  auto exception = cold.insns.back()->src(0);
+  auto invoke = new IRInstruction(OPCODE_INVOKE_STATIC);
+  invoke->set_method(cold_method)->set_arg_word_count(0);
+  auto move = new IRInstruction(OPCODE_MOVE_RESULT_OBJECT);
+  move->set_dest(exception);
+  auto thr = new IRInstruction(OPCODE_THROW);
+  thr->set_src(0, exception);
+  // Removing an instruction also deletes its move-result-pseudo.
+  std::vector<IRInstruction*> to_remove;
+  for (auto it = cold.insns.begin() + 1; it != cold.insns.end(); ++it) {
+    if (!opcode::is_move_result_pseudo((*it)->opcode())) {
+      to_remove.push_back(*it);
+    }
+  }
+  for (auto insn : to_remove) {
+    code->remove_opcode(insn);
+  }
+  code->replace_opcode(cold.insns.front(), {invoke, move, thr});
+}
+
+} // namespace
+
+Profile read_profile(std::istream& metadata, std::istream& counts) {
+  // The method and block that each block probe counts.
+  std::unordered_map<uint64_t, std::pair<std::string, uint32_t>> probes;
+  std::string line;
+  while (std::getline(metadata, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    auto first = line.find(',');
+    auto second = line.find(',', first + 1);
+    auto third = line.find(',', second + 1);
+    if (third == std::string::npos ||
+        line.compare(first + 1, second - first - 1, "block") != 0) {
+      continue;
+    }
+    probes.emplace(std::stoull(line.substr(0, first)),
+                   std::make_pair(line.substr(second + 1, third - second - 1),
+                                  std::stoul(line.substr(third + 1))));
+  }
+
+  Profile profile;
+  while (std::getline(counts, line)) {
+    auto comma = line.find(',');
+    if (comma == std::string::npos) {
+      continue;
+    }
+    auto it = probes.find(std::stoull(line.substr(0, comma)));
+    if (it != probes.end()) {
+      profile[it->second.first][it->second.second] +=
+          std::stoull(line.substr(comma + 1));
+    }
+  }
+  return profile;
+}
+
+Stats& Stats::operator+=(const Stats& that) {
+  methods_reordered += that.methods_reordered;
+  branches_inverted += that.branches_inverted;
+  gotos_added += that.gotos_added;
+  gotos_removed += that.gotos_removed;
+  cold_blocks_outlined += that.cold_blocks_outlined;
+  return *this;
+}
+
+Stats reorder(const Scope& scope,
+              const Profile& profile,
+              const Config& config) {
+  auto result = walk::parallel::reduce_methods<std::nullptr_t, MethodResult>(
+      scope,
+      [&](std::nullptr_t, DexMethod* method) {
+        if (method->get_code() == nullptr) {
+          return MethodResult();
+        }
+        auto it = profile.find(show_deobfuscated(method));
+        if (it == profile.end()) {
+          return MethodResult();
+        }
+        return reorder_method(method, it->second, config);
+      },
+      [](MethodResult a, MethodResult b) {
+        a.stats += b.stats;
+        a.cold_blocks.insert(
+            a.cold_blocks.end(), b.cold_blocks.begin(), b.cold_blocks.end());
+        return a;
+      },
+      [](int) { return nullptr; });
+
+  // Adding methods to classes isn't thread safe, and the names of the cold
+  // methods depend on what is already there.
+  auto& cold_blocks = result.cold_blocks;
+  std::stable_sort(cold_blocks.begin(),
+                   cold_blocks.end(),
+                   [](const ColdBlock& a, const ColdBlock& b) {
+                     return compare_dexmethods(a.method, b.method);
+                   });
+  for (const auto& cold : cold_blocks) {
+    call_cold_method(cold, make_cold_method(cold));
+    ++result.stats.cold_blocks_outlined;
+  }
+  return result.stats;
+}
+
+} // namespace block_reordering
+
+void BlockReorderingPass::run_pass(DexStoresVector& /* unused */,
+                                   ConfigFiles& /* unused */,
+                                   PassManager& mgr) {
+  if (m_metadata_file.empty() || m_profile_file.empty()) {
+    TRACE(BBREORDER, 1, "No block profile, nothing to do\n");
+    return;
+  }
+  std::ifstream metadata(m_metadata_file);
+  std::ifstream counts(m_profile_file);
+  if (!metadata || !counts) {
+    fprintf(stderr,
+            "Failed to open block profile: `%s' or `%s'\n",
+            m_metadata_file.c_str(),
+            m_profile_file.c_str());
+    return;
+  }
+  auto profile = block_reordering::read_profile(metadata, counts);
+
+  block_reordering::Config config;
+  config.hot_method_min_count = m_hot_method_min_count;
+  config.outline_cold_blocks = m_outline_cold_blocks;
+  config.outline_min_method_size = m_outline_min_method_size;
+  auto scope = mgr.get_scope_view().get();
+  auto stats = block_reordering::reorder(*scope, profile, config);
+  mgr.incr_metric("methods_reordered", stats.methods_reordered);
+  mgr.incr_metric("branches_inverted", stats.branches_inverted);
+  mgr.incr_metric("gotos_added", stats.gotos_added);
+  mgr.incr_metric("gotos_removed", stats.gotos_removed);
+  mgr.incr_metric("cold_blocks_outlined", stats.cold_blocks_outlined);
+  TRACE(BBREORDER,
+        1,
+        "Reordered %d methods, outlined %d cold blocks\n",
+        stats.methods_reordered,
+        stats.cold_blocks_outlined);
+}
+
+static BlockReorderingPass s_pass;
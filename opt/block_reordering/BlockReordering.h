@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <istream>
+#include <string>
+#include <unordered_map>
+
+#include "DexClass.h"
+#include "Pass.h"
+
+/*
+ * Lays out the blocks of the methods that a profile says are hot so that the
+ * hot path runs straight through: each block is followed by its most
+ * executed successor, and the blocks that never ran go to the end of the
+ * method, in their original order. Conditional branches are inverted, and
+ * gotos added or removed, so that the likely edge is the fallthrough.
+ *
+ * In hot methods that are large, the cold blocks that end in a throw and
+ * only use values they compute themselves, e.g.
+ *
+ *   new-instance v0, Ljava/lang/IllegalStateException;
+ *   const-string v1, "unexpected state"
+ *   invoke-direct {v0, v1}, Ljava/lang/IllegalStateException;.<init>:(...)V
+ *   throw v0
+ *
+ * are moved to a private static method of the same class, which returns the
+ * exception for the caller to throw. That keeps the hot methods under the
+ * size limits of ART's inliner and JIT.
+ *
+ * The profile is the block counts of a build instrumented by
+ * InstrumentationPass with the "block" strategy. The pass must run at the
+ * same place in the pipeline as the instrumentation did, so that the blocks
+ * have the same ids. Methods with try regions are left alone.
+ *
+ * Options:
+ *   "instrument_metadata": the metadata file InstrumentationPass wrote
+ *   "block_profile": the counts of its probes, one "id,count" per line
+ *   "hot_method_min_count": how often the entry of a method must have run
+ *     for it to be laid out, 1 by default
+ *   "outline_cold_blocks": true by default
+ *   "outline_min_method_size": the size in code units from which hot methods
+ *     have their cold blocks outlined, 64 by default
+ */
+class BlockReorderingPass : public Pass {
+ public:
+  BlockReorderingPass() : Pass("BlockReorderingPass") {}
+
+  virtual void configure_pass(const PassConfig& pc) override {
+    pc.get("instrument_metadata", "", m_metadata_file);
+    pc.get("block_profile", "", m_profile_file);
+    pc.get("hot_method_min_count", 1, m_hot_method_min_count);
+    pc.get("outline_cold_blocks", true, m_outline_cold_blocks);
+    pc.get("outline_min_method_size", 64, m_outline_min_method_size);
+  }
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+ private:
+  std::string m_metadata_file;
+  std::string m_profile_file;
+  int64_t m_hot_method_min_count;
+  bool m_outline_cold_blocks;
+  int64_t m_outline_min_method_size;
+};
+
+namespace block_reordering {
+
+// How often each block of a method ran, by the id of the block.
+using BlockCounts = std::unordered_map<uint32_t, uint64_t>;
+
+// The block counts of each method, by its deobfuscated name.
+using Profile = std::unordered_map<std::string, BlockCounts>;
+
+Profile read_profile(std::istream& metadata, std::istream& counts);
+
+struct Config {
+  uint64_t hot_method_min_count{1};
+  bool outline_cold_blocks{true};
+  size_t outline_min_method_size{64};
+};
+
+struct Stats {
+  size_t methods_reordered{0};
+  size_t branches_inverted{0};
+  size_t gotos_added{0};
+  size_t gotos_removed{0};
+  size_t cold_blocks_outlined{0};
+
+  Stats& operator+=(const Stats& that);
+};
+
+Stats reorder(const Scope& scope, const Profile& profile, const Config& config);
+
+} // namespace block_reordering
@@ -11,8 +11,10 @@
 
 #include <stdio.h>
 #include <string>
+#include <memory>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -163,22 +165,37 @@ class BridgeRemover {
   std::unordered_multimap<MethodRef, DexMethod*, MethodRefHash>
       m_potential_bridgee_refs;
 
+  /*
+   * Matching the bridge pattern only reads the code of each method, so the
+   * candidates are found in parallel, each worker collecting its own pairs.
+   */
   void find_bridges() {
-    walk::methods(*m_scope,
-                 [&](DexMethod* m) {
-                   if (has_bridgelike_access(m)) {
-                     auto bridgee = find_bridgee(m);
-                     if (!bridgee) return;
-                     m_bridges_to_bridgees.emplace(m, bridgee);
-                     TRACE(BRIDGE,
-                           5,
-                           "Bridge:%p:%s\nBridgee:%p:%s\n",
-                           m,
-                           SHOW(m),
-                           bridgee,
-                           SHOW(bridgee));
-                   }
-                 });
+    using BridgePairs = std::vector<std::pair<DexMethod*, DexMethod*>>;
+    std::vector<std::unique_ptr<BridgePairs>> thread_pairs;
+    walk::parallel::reduce_methods<BridgePairs*, std::nullptr_t>(
+        *m_scope,
+        [](BridgePairs*& pairs, DexMethod* m) {
+          if (!has_bridgelike_access(m)) return nullptr;
+          auto bridgee = find_bridgee(m);
+          if (!bridgee) return nullptr;
+          pairs->emplace_back(m, bridgee);
+          TRACE(BRIDGE,
+                5,
+                "Bridge:%p:%s\nBridgee:%p:%s\n",
+                m,
+                SHOW(m),
+                bridgee,
+                SHOW(bridgee));
+          return nullptr;
+        },
+        [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+        [&](unsigned int /*thread_index*/) {
+          thread_pairs.emplace_back(std::make_unique<BridgePairs>());
+          return thread_pairs.back().get();
+        });
+    for (const auto& pairs : thread_pairs) {
+      m_bridges_to_bridgees.insert(pairs->begin(), pairs->end());
+    }
   }
 
   void search_hierarchy_for_matches(DexMethod* bridge, DexMethod* bridgee) {
@@ -255,8 +272,11 @@ class BridgeRemover {
     }
   }
 
-  void exclude_referenced_bridgee(DexMethod* code_method, IRCode& code) {
-    for (auto& mie : InstructionIterable(&code)) {
+  void exclude_referenced_bridgee(
+      DexMethod* code_method,
+      const IRCode& code,
+      std::unordered_set<DexMethod*>& referenced_bridges) const {
+    for (auto& mie : InstructionIterable(code)) {
       auto inst = mie.insn;
       if (!is_invoke(inst->opcode())) continue;
       auto method = inst->get_method();
@@ -275,7 +295,7 @@ class BridgeRemover {
               SHOW(method->get_proto()),
               SHOW(code_method),
               SHOW(referenced_bridge));
-        m_bridges_to_bridgees.erase(referenced_bridge);
+        referenced_bridges.insert(referenced_bridge);
       }
     }
   }
@@ -326,11 +346,31 @@ class BridgeRemover {
       m_bridges_to_bridgees.erase(kill);
     }
 
-    walk::code(*m_scope,
-              [](DexMethod*) { return true; },
-              [&](DexMethod* m, IRCode& code) {
-                exclude_referenced_bridgee(m, code);
-              });
+    // All the invokes of the scope are checked against the table of
+    // potential references in a single parallel walk. The bridges they block
+    // are only removed from the candidates once the walk is done, since the
+    // workers read the table concurrently.
+    using BridgeSet = std::unordered_set<DexMethod*>;
+    std::vector<std::unique_ptr<BridgeSet>> thread_bridges;
+    walk::parallel::reduce_methods<BridgeSet*, std::nullptr_t>(
+        *m_scope,
+        [&](BridgeSet*& referenced_bridges, DexMethod* m) {
+          auto code = m->get_code();
+          if (code != nullptr) {
+            exclude_referenced_bridgee(m, *code, *referenced_bridges);
+          }
+          return nullptr;
+        },
+        [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+        [&](unsigned int /*thread_index*/) {
+          thread_bridges.emplace_back(std::make_unique<BridgeSet>());
+          return thread_bridges.back().get();
+        });
+    for (const auto& referenced_bridges : thread_bridges) {
+      for (auto bridge : *referenced_bridges) {
+        m_bridges_to_bridgees.erase(bridge);
+      }
+    }
   }
 
   void inline_bridges() {
@@ -15,9 +15,11 @@
 
 #include "Walkers.h"
 #include "DexClass.h"
+#include "DexIdMap.h"
 #include "DexUtil.h"
 #include "IRInstruction.h"
 #include "Resolver.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -77,6 +79,42 @@ size_t illegal_elements(const MethodInsns& method_to_insns,
   return num_illegal_cross_store_refs;
 }
 
+void merge_method_insns(const MethodInsns& from, MethodInsns* to) {
+  // Each method is checked by a single worker.
+  to->insert(from.begin(), from.end());
+}
+
+template <class Key, class Comparator>
+void merge_method_insns(const std::map<Key, MethodInsns, Comparator>& from,
+                        std::map<Key, MethodInsns, Comparator>* to) {
+  for (const auto& pair : from) {
+    merge_method_insns(pair.second, &(*to)[pair.first]);
+  }
+}
+
+/**
+ * The problems found in the instructions, gathered separately by each worker.
+ */
+struct InsnFindings {
+  std::map<const DexType*, MethodInsns, dextypes_comparator> bad_type_insns;
+  std::map<const DexField*, MethodInsns, dexfields_comparator> bad_field_insns;
+  std::map<const DexMethod*, MethodInsns, dexmethods_comparator> bad_meth_insns;
+  MethodInsns illegal_type;
+  MethodInsns illegal_field_type;
+  MethodInsns illegal_field_cls;
+  MethodInsns illegal_method_call;
+
+  void merge(const InsnFindings& other) {
+    merge_method_insns(other.bad_type_insns, &bad_type_insns);
+    merge_method_insns(other.bad_field_insns, &bad_field_insns);
+    merge_method_insns(other.bad_meth_insns, &bad_meth_insns);
+    merge_method_insns(other.illegal_type, &illegal_type);
+    merge_method_insns(other.illegal_field_type, &illegal_field_type);
+    merge_method_insns(other.illegal_field_cls, &illegal_field_cls);
+    merge_method_insns(other.illegal_method_call, &illegal_method_call);
+  }
+};
+
 /**
  * Performs 2 kind of verifications:
  * 1- no references should be to a DexClass that is "internal"
@@ -88,17 +126,14 @@ size_t illegal_elements(const MethodInsns& method_to_insns,
  */
 class Breadcrumbs {
   const Scope& scope;
-  std::unordered_set<const DexClass*> classes;
+  // The types of the classes in scope, and the members they define.
+  TypeBitSet classes;
+  FieldBitSet fields;
+  MethodBitSet methods;
   std::map<const DexType*, Fields, dextypes_comparator> bad_fields;
   std::map<const DexType*, Methods, dextypes_comparator> bad_methods;
-  std::map<const DexType*, MethodInsns, dextypes_comparator> bad_type_insns;
-  std::map<const DexField*, MethodInsns, dexfields_comparator> bad_field_insns;
-  std::map<const DexMethod*, MethodInsns, dexmethods_comparator> bad_meth_insns;
   std::map<const DexType*, Fields, dextypes_comparator> illegal_field;
-  MethodInsns illegal_type;
-  MethodInsns illegal_field_type;
-  MethodInsns illegal_field_cls;
-  MethodInsns illegal_method_call;
+  InsnFindings insns;
   XStoreRefs xstores;
   bool multiple_root_store_dexes;
 
@@ -107,7 +142,13 @@ class Breadcrumbs {
   explicit Breadcrumbs(const Scope& scope, DexStoresVector& stores)
     : scope(scope),
       xstores(stores) {
-    classes.insert(scope.begin(), scope.end());
+    for (const auto& cls : scope) {
+      classes.insert(cls->get_type());
+      for (auto field : cls->get_ifields()) fields.insert(field);
+      for (auto field : cls->get_sfields()) fields.insert(field);
+      for (auto method : cls->get_dmethods()) methods.insert(method);
+      for (auto method : cls->get_vmethods()) methods.insert(method);
+    }
     multiple_root_store_dexes = stores[0].get_dexen().size() > 1;
   }
 
@@ -123,6 +164,9 @@ class Breadcrumbs {
     size_t bad_type_insns_count = 0;
     size_t bad_field_insns_count = 0;
     size_t bad_meths_insns_count = 0;
+    const auto& bad_type_insns = insns.bad_type_insns;
+    const auto& bad_field_insns = insns.bad_field_insns;
+    const auto& bad_meth_insns = insns.bad_meth_insns;
     if (bad_fields.size() > 0 ||
         bad_methods.size() > 0 ||
         bad_type_insns.size() > 0 ||
@@ -146,32 +190,35 @@ class Breadcrumbs {
         }
       }
       for (const auto& bad_insns : bad_type_insns) {
-        for (const auto& insns : bad_insns.second) {
-          for (const auto& insn : insns.second) {
+        for (const auto& method_insns : bad_insns.second) {
+          for (const auto& insn : method_insns.second) {
             bad_type_insns_count++;
             ss << "Reference to deleted type " <<
                 SHOW(bad_insns.first) << " in instruction " <<
-                SHOW(insn) << " in method " << SHOW(insns.first) << std::endl;
+                SHOW(insn) << " in method " << SHOW(method_insns.first) <<
+                std::endl;
           }
         }
       }
       for (const auto& bad_insns : bad_field_insns) {
-        for (const auto& insns : bad_insns.second) {
-          for (const auto& insn : insns.second) {
+        for (const auto& method_insns : bad_insns.second) {
+          for (const auto& insn : method_insns.second) {
             bad_field_insns_count++;
             ss << "Reference to deleted field " <<
                 SHOW(bad_insns.first) << " in instruction " <<
-                SHOW(insn) << " in method " << SHOW(insns.first) << std::endl;
+                SHOW(insn) << " in method " << SHOW(method_insns.first) <<
+                std::endl;
           }
         }
       }
       for (const auto& bad_insns : bad_meth_insns) {
-        for (const auto& insns : bad_insns.second) {
-          for (const auto& insn : insns.second) {
+        for (const auto& method_insns : bad_insns.second) {
+          for (const auto& insn : method_insns.second) {
             bad_meths_insns_count++;
             ss << "Reference to deleted method " <<
                 SHOW(bad_insns.first) << " in instruction " <<
-                SHOW(insn) << " in method " << SHOW(insns.first) << std::endl;
+                SHOW(insn) << " in method " << SHOW(method_insns.first) <<
+                std::endl;
           }
         }
       }
@@ -218,13 +265,13 @@ class Breadcrumbs {
     }
 
     size_t num_illegal_type_refs =
-      illegal_elements(illegal_type, "type refs", ss);
+      illegal_elements(insns.illegal_type, "type refs", ss);
     size_t num_illegal_field_type_refs =
-      illegal_elements(illegal_field_type, "field type refs", ss);
+      illegal_elements(insns.illegal_field_type, "field type refs", ss);
     size_t num_illegal_field_cls =
-      illegal_elements(illegal_field_cls, "field class refs", ss);
+      illegal_elements(insns.illegal_field_cls, "field class refs", ss);
     size_t num_illegal_method_calls =
-      illegal_elements(illegal_method_call, "method call", ss);
+      illegal_elements(insns.illegal_method_call, "method call", ss);
 
     size_t num_illegal_cross_store_refs =
       num_illegal_fields + num_illegal_type_refs +
@@ -253,10 +300,10 @@ class Breadcrumbs {
   }
 
  private:
-  bool is_illegal_cross_store(const DexType* caller, const DexType* callee) {
+  bool is_illegal_cross_store(const DexType* caller,
+                              const DexType* callee) const {
     // Skip deleted types, as we don't know the store for those.
-    if (classes.count(type_class(caller)) == 0 ||
-        classes.count(type_class(callee)) == 0) {
+    if (!classes.contains(caller) || !classes.contains(callee)) {
       return false;
     }
 
@@ -276,15 +323,27 @@ class Breadcrumbs {
     return false;
   }
 
-  const DexType* check_type(const DexType* type) {
+  const DexType* check_type(const DexType* type) const {
+    if (classes.contains(type)) return nullptr;
     const auto& cls = type_class(type);
     if (cls == nullptr) return nullptr;
     if (cls->is_external()) return nullptr;
-    if (classes.count(cls) > 0) return nullptr;
     return type;
   }
 
-  const DexType* check_method(const DexMethodRef* method) {
+  // Whether the class of the field or method defines it. Only the classes
+  // outside of the scope are searched.
+  bool class_contains(const DexField* field) const {
+    if (classes.contains(field->get_class())) return fields.contains(field);
+    return ::class_contains(field);
+  }
+
+  bool class_contains(const DexMethod* method) const {
+    if (classes.contains(method->get_class())) return methods.contains(method);
+    return ::class_contains(method);
+  }
+
+  const DexType* check_method(const DexMethodRef* method) const {
     const auto& proto = method->get_proto();
     auto type = check_type(proto->get_rtype());
     if (type != nullptr) return type;
@@ -298,10 +357,11 @@ class Breadcrumbs {
   }
 
   void bad_type(
+      InsnFindings& findings,
       const DexType* type,
       const DexMethod* method,
-      const IRInstruction* insn) {
-    bad_type_insns[type][method].emplace_back(insn);
+      const IRInstruction* insn) const {
+    findings.bad_type_insns[type][method].emplace_back(insn);
   }
 
   // verify that all field definitions are of a type not deleted
@@ -332,49 +392,53 @@ class Breadcrumbs {
   }
 
   // verify that all opcodes are to non deleted references
-  void check_type_opcode(const DexMethod* method, IRInstruction* insn) {
+  void check_type_opcode(InsnFindings& findings,
+                         const DexMethod* method,
+                         IRInstruction* insn) const {
     const DexType* type = insn->get_type();
     type = check_type(type);
     if (type != nullptr) {
-      bad_type(type, method, insn);
+      bad_type(findings, type, method, insn);
     } else {
       const auto cls = method->get_class();
       if (is_illegal_cross_store(cls, insn->get_type())) {
-        illegal_type[method].emplace_back(insn);
+        findings.illegal_type[method].emplace_back(insn);
       }
     }
   }
 
-  void check_field_opcode(const DexMethod* method, IRInstruction* insn) {
+  void check_field_opcode(InsnFindings& findings,
+                          const DexMethod* method,
+                          IRInstruction* insn) const {
     auto field = insn->get_field();
     const DexType* type = check_type(field->get_class());
     if (type != nullptr) {
-      bad_type(type, method, insn);
+      bad_type(findings, type, method, insn);
       return;
     }
 
     auto cls = method->get_class();
     if (is_illegal_cross_store(cls, field->get_class())) {
-      illegal_field_type[method].emplace_back(insn);
+      findings.illegal_field_type[method].emplace_back(insn);
     }
 
     type = check_type(field->get_type());
     if (type != nullptr) {
-      bad_type(type, method, insn);
+      bad_type(findings, type, method, insn);
       return;
     }
 
     if (is_illegal_cross_store(cls, field->get_type())) {
-      illegal_field_cls[method].emplace_back(insn);
+      findings.illegal_field_cls[method].emplace_back(insn);
     }
 
-    auto res_field = resolve_field(field);
+    auto res_field = resolve_field_cached(field);
     if (res_field != nullptr) {
       // a resolved field can only differ in the owner class
       if (field != res_field) {
         type = check_type(field->get_class());
         if (type != nullptr) {
-          bad_type(type, method, insn);
+          bad_type(findings, type, method, insn);
           return;
         }
       }
@@ -382,31 +446,34 @@ class Breadcrumbs {
       // the class of the field is around but the field may have
       // been deleted so let's verify the field exists on the class
       if (field->is_def() && !class_contains(static_cast<DexField*>(field))) {
-        bad_field_insns[static_cast<DexField*>(field)][method].
-            emplace_back(insn);
+        findings.bad_field_insns[static_cast<DexField*>(field)][method]
+            .emplace_back(insn);
         return;
       }
     }
   }
 
-  void check_method_opcode(const DexMethod* method, IRInstruction* insn) {
+  void check_method_opcode(InsnFindings& findings,
+                           const DexMethod* method,
+                           IRInstruction* insn) const {
     const auto& meth = insn->get_method();
     const DexType* type = check_method(meth);
     if (type != nullptr) {
-      bad_type(type, method, insn);
+      bad_type(findings, type, method, insn);
       return;
     }
     if (is_illegal_cross_store(method->get_class(), meth->get_class())) {
-      illegal_method_call[method].emplace_back(insn);
+      findings.illegal_method_call[method].emplace_back(insn);
     }
 
-    DexMethod* res_meth = resolve_method(meth, opcode_to_search(insn));
+    DexMethod* res_meth =
+        resolve_method_cached(meth, opcode_to_search(insn));
     if (res_meth != nullptr) {
       // a resolved method can only differ in the owner class
       if (res_meth != meth) {
         type = check_type(res_meth->get_class());
         if (type != nullptr) {
-          bad_type(type, method, insn);
+          bad_type(findings, type, method, insn);
           return;
         }
       }
@@ -416,7 +483,7 @@ class Breadcrumbs {
       if (meth->is_def()) {
         const auto meth_def = static_cast<DexMethod*>(meth);
         if (!class_contains(meth_def)) {
-          bad_meth_insns[meth_def][method].emplace_back(insn);
+          findings.bad_meth_insns[meth_def][method].emplace_back(insn);
           return;
         }
       }
@@ -424,21 +491,47 @@ class Breadcrumbs {
   }
 
   void check_opcodes() {
-    walk::opcodes(scope,
-      [](DexMethod*) { return true; },
-      [&](DexMethod* method, IRInstruction* insn) {
-        if (insn->has_type()) {
-          check_type_opcode(method, insn);
-          return;
-        }
-        if (insn->has_field()) {
-          check_field_opcode(method, insn);
-          return;
-        }
-        if (insn->has_method()) {
-          check_method_opcode(method, insn);
-        }
-      });
+    auto num_threads = workqueue_default_num_threads();
+    std::vector<InsnFindings> findings(num_threads);
+    auto wq = WorkQueue<DexClass*, InsnFindings*, std::nullptr_t>(
+        [&](InsnFindings*& local, DexClass* cls) -> std::nullptr_t {
+          for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+            for (auto method : *methods) {
+              auto code = method->get_code();
+              if (code == nullptr) continue;
+              for (const auto& mie : InstructionIterable(code)) {
+                check_opcode(*local, method, mie.insn);
+              }
+            }
+          }
+          return nullptr;
+        },
+        [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+        [&](unsigned int thread_idx) { return &findings[thread_idx]; },
+        num_threads);
+    for (auto cls : scope) {
+      wq.add_item(cls);
+    }
+    wq.run_all();
+    for (const auto& local : findings) {
+      insns.merge(local);
+    }
+  }
+
+  void check_opcode(InsnFindings& findings,
+                    const DexMethod* method,
+                    IRInstruction* insn) const {
+    if (insn->has_type()) {
+      check_type_opcode(findings, method, insn);
+      return;
+    }
+    if (insn->has_field()) {
+      check_field_opcode(findings, method, insn);
+      return;
+    }
+    if (insn->has_method()) {
+      check_method_opcode(findings, method, insn);
+    }
   }
 };
 
@@ -28,6 +28,13 @@ class CheckBreadcrumbsPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual unsigned reads() const override {
+    return TOUCHES_CODE | TOUCHES_HIERARCHY;
+  }
+  virtual unsigned writes() const override { return TOUCHES_NOTHING; }
+
 private:
   bool fail;
   bool fail_if_illegal_refs;
@@ -18,6 +18,9 @@ struct ConstPropConfig {
   bool fold_arithmetic{false};
   bool include_virtuals{false};
   bool dynamic_input_checks{false};
+  // Optimize methods with the sparse conditional analysis on SSA form rather
+  // than the dense fixpoint iteration.
+  bool sparse{false};
   // The maximum number of times we will try to refine our model of the heap.
   // Setting this to zero means that we will not attempt to analyze the heap at
   // all; i.e. all fields will be treated as containing Top.
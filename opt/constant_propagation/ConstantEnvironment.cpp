@@ -23,6 +23,7 @@ int64_t SignedConstantDomain::max_element() const {
     return -1;
   case sign_domain::Interval::GEZ:
   case sign_domain::Interval::GTZ:
+  case sign_domain::Interval::NEZ:
   case sign_domain::Interval::ALL:
     return std::numeric_limits<int64_t>::max();
   case sign_domain::Interval::SIZE:
@@ -44,6 +45,7 @@ int64_t SignedConstantDomain::min_element() const {
     return 1;
   case sign_domain::Interval::LEZ:
   case sign_domain::Interval::LTZ:
+  case sign_domain::Interval::NEZ:
   case sign_domain::Interval::ALL:
     return std::numeric_limits<int64_t>::min();
   case sign_domain::Interval::SIZE:
@@ -15,6 +15,7 @@
 #include "ControlFlow.h"
 #include "FixpointIterators.h"
 #include "PatriciaTreeMapAbstractEnvironment.h"
+#include "RegisterAbstractEnvironment.h"
 #include "ReducedProductAbstractDomain.h"
 #include "SignDomain.h"
 
@@ -100,7 +101,7 @@ using reg_t = uint32_t;
 constexpr reg_t RESULT_REGISTER = std::numeric_limits<reg_t>::max();
 
 using ConstantEnvironment =
-    PatriciaTreeMapAbstractEnvironment<reg_t, SignedConstantDomain>;
+    RegisterAbstractEnvironment<reg_t, SignedConstantDomain>;
 
 using ConstantStaticFieldEnvironment =
     PatriciaTreeMapAbstractEnvironment<DexField*, SignedConstantDomain>;
@@ -11,6 +11,8 @@
 
 #include "ConstantPropagationAnalysis.h"
 #include "ConstantPropagationTransform.h"
+#include "IncrementalCache.h"
+#include "SparseConstantPropagation.h"
 #include "Walkers.h"
 
 using namespace constant_propagation;
@@ -19,6 +21,7 @@ void ConstantPropagationPass::configure_pass(const PassConfig& pc) {
   pc.get(
       "replace_moves_with_consts", false, m_config.replace_moves_with_consts);
   pc.get("fold_arithmetic", false, m_config.fold_arithmetic);
+  pc.get("sparse", false, m_config.sparse);
   std::vector<std::string> blacklist_names;
   pc.get("blacklist", {}, blacklist_names);
 
@@ -35,6 +38,7 @@ void ConstantPropagationPass::run_pass(DexStoresVector& stores,
                                        ConfigFiles&,
                                        PassManager& mgr) {
   auto scope = build_class_scope(stores);
+  auto cache = mgr.get_incremental_cache();
 
   using Data = std::nullptr_t;
   auto stats = walk::parallel::reduce_methods<Data, Transform::Stats>(
@@ -43,23 +47,32 @@ void ConstantPropagationPass::run_pass(DexStoresVector& stores,
         if (method->get_code() == nullptr) {
           return Transform::Stats();
         }
-        auto& code = *method->get_code();
         // Skipping blacklisted classes
         if (m_config.blacklist.count(method->get_class()) > 0) {
           TRACE(CONSTP, 2, "Skipping %s\n", SHOW(method));
           return Transform::Stats();
         }
 
-        TRACE(CONSTP, 2, "Method: %s\n", SHOW(method));
+        auto propagate = [&](DexMethod* method) {
+          TRACE(CONSTP, 2, "Method: %s\n", SHOW(method));
+          auto& code = *method->get_code();
+          code.build_cfg();
+          auto& cfg = code.cfg();
 
-        code.build_cfg();
-        auto& cfg = code.cfg();
-
-        TRACE(CONSTP, 5, "CFG: %s\n", SHOW(cfg));
-        intraprocedural::FixpointIterator fp_iter(cfg, m_config);
-        fp_iter.run(ConstantEnvironment());
-        constant_propagation::Transform tf(m_config);
-        return tf.apply(fp_iter, &code);
+          TRACE(CONSTP, 5, "CFG: %s\n", SHOW(cfg));
+          constant_propagation::Transform tf(m_config);
+          if (m_config.sparse) {
+            sparse::Analyzer analyzer(cfg, m_config);
+            analyzer.run(intraprocedural::initial_environment(method));
+            return tf.apply(analyzer, &code);
+          }
+          intraprocedural::FixpointIterator fp_iter(cfg, m_config);
+          fp_iter.run(intraprocedural::initial_environment(method));
+          return tf.apply(fp_iter, &code);
+        };
+        return cache != nullptr
+                   ? cache->optimize<Transform::Stats>(method, propagate)
+                   : propagate(method);
       },
 
       [](Transform::Stats a, Transform::Stats b) { // reducer
@@ -71,6 +84,9 @@ void ConstantPropagationPass::run_pass(DexStoresVector& stores,
 
   mgr.incr_metric("num_branch_propagated", stats.branches_removed);
   mgr.incr_metric("num_materialized_consts", stats.materialized_consts);
+  mgr.incr_metric("num_unreachable_instructions_removed",
+                  stats.unreachable_instructions_removed);
+  mgr.incr_metric("num_null_checks_removed", stats.null_checks_removed);
 
   TRACE(CONSTP, 1, "num_branch_propagated: %d\n", stats.branches_removed);
   TRACE(CONSTP,
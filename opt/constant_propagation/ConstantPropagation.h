@@ -23,6 +23,10 @@ class ConstantPropagationPass : public Pass {
                         ConfigFiles& cfg,
                         PassManager& mgr) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual bool is_method_local() const override { return true; }
+
  private:
   ConstPropConfig m_config;
 };
@@ -19,6 +19,8 @@ std::enable_if_t<std::is_integral<T>::value, int> fpclassify(T x) {
 }
 #endif
 
+#include <algorithm>
+
 #include "DexUtil.h"
 #include "Resolver.h"
 #include "Transform.h"
@@ -135,8 +137,10 @@ namespace constant_propagation {
 
 namespace intraprocedural {
 
-void FixpointIterator::analyze_instruction(const IRInstruction* insn,
-                                           ConstantEnvironment* env) const {
+void analyze_instruction(const IRInstruction* insn,
+                         ConstantEnvironment* env,
+                         const ConstPropConfig& config,
+                         const ConstantStaticFieldEnvironment& field_env) {
   TRACE(CONSTP, 5, "Analyzing instruction: %s\n", SHOW(insn));
   auto op = insn->opcode();
   switch (op) {
@@ -157,11 +161,15 @@ void FixpointIterator::analyze_instruction(const IRInstruction* insn,
     env->set(insn->dest(), SignedConstantDomain(insn->get_literal()));
     break;
   }
-  case OPCODE_MOVE:
-  case OPCODE_MOVE_OBJECT: {
+  case OPCODE_MOVE: {
     analyze_non_branch(insn, env);
     break;
   }
+  case OPCODE_MOVE_OBJECT: {
+    // The sign of a reference is whether it is null.
+    env->set(insn->dest(), env->get(insn->src(0)));
+    break;
+  }
   case OPCODE_MOVE_WIDE: {
     analyze_non_branch(insn, env);
     break;
@@ -201,7 +209,31 @@ void FixpointIterator::analyze_instruction(const IRInstruction* insn,
   case OPCODE_SGET_CHAR:
   case OPCODE_SGET_SHORT: {
     auto field = resolve_field(insn->get_field());
-    env->set(RESULT_REGISTER, m_field_env.get(field));
+    env->set(RESULT_REGISTER, field_env.get(field));
+    break;
+  }
+
+  case OPCODE_CONST_STRING:
+  case OPCODE_CONST_CLASS:
+  case OPCODE_NEW_INSTANCE:
+  case OPCODE_NEW_ARRAY:
+  case OPCODE_FILLED_NEW_ARRAY: {
+    env->set(RESULT_REGISTER,
+             SignedConstantDomain(sign_domain::Interval::NEZ));
+    break;
+  }
+
+  case OPCODE_CHECK_CAST: {
+    env->set(RESULT_REGISTER, env->get(insn->src(0)));
+    break;
+  }
+
+  case OPCODE_INSTANCE_OF: {
+    auto src = env->get(insn->src(0));
+    env->set(RESULT_REGISTER,
+             src.interval() == sign_domain::Interval::EQZ
+                 ? SignedConstantDomain(0)
+                 : SignedConstantDomain::top());
     break;
   }
 
@@ -209,7 +241,7 @@ void FixpointIterator::analyze_instruction(const IRInstruction* insn,
   case OPCODE_ADD_INT_LIT8: {
     // add-int/lit8 is the most common arithmetic instruction: about .29% of
     // all instructions. All other arithmetic instructions are less than .05%
-    if (m_config.fold_arithmetic) {
+    if (config.fold_arithmetic) {
       int32_t lit = insn->get_literal();
       auto add_in_bounds = [lit](int64_t v) -> boost::optional<int64_t> {
         if (addition_out_of_bounds(lit, v)) {
@@ -240,11 +272,89 @@ void FixpointIterator::analyze_instruction(const IRInstruction* insn,
   }
 }
 
+bool is_null_check(const IRInstruction* insn) {
+  auto op = insn->opcode();
+  if (op != OPCODE_INVOKE_STATIC && op != OPCODE_INVOKE_VIRTUAL) {
+    return false;
+  }
+  auto method = insn->get_method();
+  auto cls = method->get_class()->get_name()->str_ref();
+  auto name = method->get_name()->str_ref();
+  if (op == OPCODE_INVOKE_VIRTUAL) {
+    return name == "getClass" && method->get_proto()->get_args()->size() == 0;
+  }
+  if (cls == "Ljava/util/Objects;") {
+    return name == "requireNonNull";
+  }
+  if (cls == "Lkotlin/jvm/internal/Intrinsics;") {
+    return name == "checkNotNull" || name == "checkParameterIsNotNull" ||
+           name == "checkExpressionValueIsNotNull" ||
+           name == "checkNotNullParameter" ||
+           name == "checkNotNullExpressionValue";
+  }
+  return false;
+}
+
+void analyze_dereferences(const IRInstruction* insn, ConstantEnvironment* env) {
+  auto op = insn->opcode();
+  boost::optional<reg_t> reg;
+  if (is_iget(op) || (op >= OPCODE_AGET && op <= OPCODE_AGET_SHORT) ||
+      op == OPCODE_ARRAY_LENGTH || op == OPCODE_FILL_ARRAY_DATA ||
+      op == OPCODE_MONITOR_ENTER || op == OPCODE_MONITOR_EXIT) {
+    reg = insn->src(0);
+  } else if (is_iput(op) || (op >= OPCODE_APUT && op <= OPCODE_APUT_SHORT)) {
+    reg = insn->src(1);
+  } else if (is_invoke(op) && (op != OPCODE_INVOKE_STATIC ||
+                               is_null_check(insn))) {
+    reg = insn->src(0);
+  }
+  if (reg) {
+    env->set(*reg,
+             env->get(*reg).meet(
+                 SignedConstantDomain(sign_domain::Interval::NEZ)));
+  }
+}
+
+ConstantEnvironment initial_environment(const DexMethod* method) {
+  ConstantEnvironment env;
+  if (!is_static(method)) {
+    auto code = method->get_code();
+    auto first = InstructionIterable(code->get_param_instructions()).begin();
+    env.set(first->insn->dest(),
+            SignedConstantDomain(sign_domain::Interval::NEZ));
+  }
+  return env;
+}
+
+void FixpointIterator::analyze_instruction(const IRInstruction* insn,
+                                           ConstantEnvironment* env) const {
+  analyze_dereferences(insn, env);
+  intraprocedural::analyze_instruction(insn, env, m_config, m_field_env);
+}
+
 void FixpointIterator::analyze_node(const NodeId& block,
                                     ConstantEnvironment* state_at_entry) const {
   TRACE(CONSTP, 5, "Analyzing block: %d\n", block->id());
+  // The handlers of a block that may throw are entered with its exit state,
+  // where a null dereference by its last instruction mustn't have made the
+  // register non-null yet.
+  const IRInstruction* throwing_insn = nullptr;
+  auto last_insn_it = transform::find_last_instruction(block);
+  if (last_insn_it != block->end() &&
+      std::any_of(block->succs().begin(),
+                  block->succs().end(),
+                  [](const std::shared_ptr<cfg::Edge>& edge) {
+                    return edge->type() == EDGE_THROW;
+                  })) {
+    throwing_insn = last_insn_it->insn;
+  }
   for (auto& mie : InstructionIterable(block)) {
-    analyze_instruction(mie.insn, state_at_entry);
+    if (mie.insn == throwing_insn) {
+      intraprocedural::analyze_instruction(
+          mie.insn, state_at_entry, m_config, m_field_env);
+    } else {
+      analyze_instruction(mie.insn, state_at_entry);
+    }
   }
 }
 
@@ -257,7 +367,7 @@ void FixpointIterator::analyze_node(const NodeId& block,
  * environment, set the environment to bottom upon entry into the unreachable
  * block.
  */
-static void analyze_if(const IRInstruction* insn,
+void analyze_if(const IRInstruction* insn,
                        ConstantEnvironment* state,
                        bool is_true_branch) {
   if (state->is_bottom()) {
@@ -283,8 +393,11 @@ static void analyze_if(const IRInstruction* insn,
     state->set(insn->src(0), scd_left.meet(SignedConstantDomain(0)));
     break;
   }
-  case OPCODE_IF_NE:
-  case OPCODE_IF_NEZ: {
+  case OPCODE_IF_NEZ:
+    state->set(insn->src(0),
+               scd_left.meet(SignedConstantDomain(sign_domain::Interval::NEZ)));
+    break;
+  case OPCODE_IF_NE: {
     auto cd_left = scd_left.constant_domain();
     auto cd_right = scd_right.constant_domain();
     if (!(cd_left.is_value() && cd_right.is_value())) {
@@ -17,6 +17,43 @@ namespace constant_propagation {
 
 namespace intraprocedural {
 
+/*
+ * The effect of an instruction on the registers, which the sparse analysis
+ * shares with the fixpoint iterator below.
+ */
+void analyze_instruction(const IRInstruction* insn,
+                         ConstantEnvironment* env,
+                         const ConstPropConfig& config,
+                         const ConstantStaticFieldEnvironment& field_env);
+
+/*
+ * Refines the registers that an if-* instruction compares on one of its
+ * edges, or sets the environment to bottom if the edge is never taken.
+ */
+void analyze_if(const IRInstruction* insn,
+                ConstantEnvironment* state,
+                bool is_true_branch);
+
+/*
+ * Whether `insn` is a call that only checks that its first source is not
+ * null: Objects.requireNonNull(), the Intrinsics.check*NotNull*() methods that
+ * kotlinc emits for the parameters and the platform types, and getClass(),
+ * which javac emits for the same purpose when its result is unused.
+ */
+bool is_null_check(const IRInstruction* insn);
+
+/*
+ * Makes the references that `insn` dereferences non-null, since it would
+ * have thrown a NullPointerException otherwise. Unlike analyze_instruction,
+ * this only holds on the normal exit of `insn`.
+ */
+void analyze_dereferences(const IRInstruction* insn, ConstantEnvironment* env);
+
+/*
+ * The environment at the entry of `method`, where `this` is non-null.
+ */
+ConstantEnvironment initial_environment(const DexMethod* method);
+
 class FixpointIterator final
     : public MonotonicFixpointIterator<cfg::GraphInterface,
                                        ConstantEnvironment> {
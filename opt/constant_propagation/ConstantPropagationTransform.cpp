@@ -9,20 +9,21 @@
 
 #include "ConstantPropagationTransform.h"
 
+#include <algorithm>
+
 #include "Transform.h"
 
 namespace constant_propagation {
 
 /*
  * Replace an instruction that has a single destination register with a `const`
- * load. `env` holds the state of the registers after `insn` has been
- * evaluated. So, `env.get(dest)` holds the _new_ value of the destination
- * register.
+ * load. `value` is the _new_ value of the destination register, after `insn`
+ * has been evaluated.
  */
 void Transform::replace_with_const(IRInstruction* insn,
-                                   const ConstantEnvironment& env,
+                                   const SignedConstantDomain& value,
                                    bool is_wide) {
-  auto cst = env.get(insn->dest()).constant_domain().get_constant();
+  auto cst = value.constant_domain().get_constant();
   if (!cst) {
     return;
   }
@@ -37,21 +38,21 @@ void Transform::replace_with_const(IRInstruction* insn,
 }
 
 void Transform::simplify_instruction(IRInstruction* insn,
-                                     const ConstantEnvironment& env) {
+                                     const SignedConstantDomain& value) {
   switch (insn->opcode()) {
   case OPCODE_MOVE:
     if (m_config.replace_moves_with_consts) {
-      replace_with_const(insn, env, false /* is_wide */);
+      replace_with_const(insn, value, false /* is_wide */);
     }
     break;
   case OPCODE_MOVE_WIDE:
     if (m_config.replace_moves_with_consts) {
-      replace_with_const(insn, env, true /* is_wide */);
+      replace_with_const(insn, value, true /* is_wide */);
     }
     break;
   case OPCODE_ADD_INT_LIT16:
   case OPCODE_ADD_INT_LIT8: {
-    replace_with_const(insn, env, false /* is_wide */);
+    replace_with_const(insn, value, false /* is_wide */);
     break;
   }
 
@@ -59,6 +60,24 @@ void Transform::simplify_instruction(IRInstruction* insn,
   }
 }
 
+/*
+ * Remove a null check of a reference that is known to be non-null. The ones
+ * that return their argument are only removed when the result is unused,
+ * i.e. when `next` is not a move-result, and the ones that end their block
+ * are kept.
+ */
+void Transform::remove_null_check(IRInstruction* insn,
+                                  const SignedConstantDomain& value,
+                                  const IRInstruction* next) {
+  if (value.interval() != sign_domain::Interval::NEZ || next == nullptr ||
+      is_move_result(next->opcode())) {
+    return;
+  }
+  TRACE(CONSTP, 5, "Removing redundant null check %s\n", SHOW(insn));
+  m_insn_replacements.emplace_back(insn, new IRInstruction(OPCODE_NOP));
+  ++m_stats.null_checks_removed;
+}
+
 /*
  * If the last instruction in a basic block is an if-* instruction, determine
  * whether it is dead (i.e. whether the branch always taken or never taken).
@@ -97,6 +116,56 @@ void Transform::eliminate_dead_branch(
   }
 }
 
+/*
+ * Same as above, and a switch that only one of its edges leaves becomes either
+ * a goto to its case or nothing, when it always falls through to the default
+ * case.
+ */
+void Transform::eliminate_dead_branch(const sparse::Analyzer& analyzer,
+                                      Block* block) {
+  auto insn_it = transform::find_last_instruction(block);
+  if (insn_it == block->end()) {
+    return;
+  }
+  auto* insn = insn_it->insn;
+  auto op = insn->opcode();
+  if (!is_conditional_branch(op) && !is_switch(op)) {
+    return;
+  }
+  const cfg::Edge* taken = nullptr;
+  for (auto& edge : block->succs()) {
+    if (edge->type() == EDGE_THROW || !analyzer.is_executable(edge.get())) {
+      continue;
+    }
+    if (taken != nullptr) {
+      return;
+    }
+    taken = edge.get();
+  }
+  if (taken == nullptr) {
+    return;
+  }
+  auto is_fallthrough = taken->type() == EDGE_GOTO;
+  TRACE(CONSTP,
+        2,
+        "Changed %s as it always %s\n",
+        SHOW(insn),
+        is_fallthrough ? "falls through" : "jumps");
+  ++m_stats.branches_removed;
+  if (is_fallthrough) {
+    m_insn_replacements.emplace_back(insn, new IRInstruction(OPCODE_NOP));
+  } else if (is_conditional_branch(op)) {
+    m_insn_replacements.emplace_back(insn, new IRInstruction(OPCODE_GOTO));
+  } else {
+    for (auto& mie : *taken->target()) {
+      if (mie.type == MFLOW_TARGET && mie.target->src->insn == insn) {
+        m_switch_replacements.emplace_back(insn, mie.target->index);
+        break;
+      }
+    }
+  }
+}
+
 void Transform::apply_changes(IRCode* code) {
   for (auto const& p : m_insn_replacements) {
     IRInstruction* old_op = p.first;
@@ -118,6 +187,25 @@ void Transform::apply_changes(IRCode* code) {
       }
     }
   }
+  for (auto const& p : m_switch_replacements) {
+    IRInstruction* old_op = p.first;
+    // Keep one of the targets of the case, as the target of the goto.
+    bool kept = false;
+    for (auto& mie : *code) {
+      if (mie.type != MFLOW_TARGET || mie.target->src->insn != old_op) {
+        continue;
+      }
+      if (!kept && mie.target->index == p.second) {
+        mie.target->type = BRANCH_SIMPLE;
+        kept = true;
+      } else {
+        delete mie.target;
+        mie.type = MFLOW_FALLTHROUGH;
+      }
+    }
+    TRACE(CONSTP, 4, "Replacing switch %s with a goto\n", SHOW(old_op));
+    code->replace_branch(old_op, new IRInstruction(OPCODE_GOTO));
+  }
 }
 
 Transform::Stats Transform::apply(
@@ -130,9 +218,23 @@ Transform::Stats Transform::apply(
     if (env.is_bottom()) {
       continue;
     }
+    // The null check before `insn`, and the value that it checks.
+    IRInstruction* null_check = nullptr;
+    SignedConstantDomain checked;
     for (auto& mie : InstructionIterable(block)) {
-      intra_cp.analyze_instruction(mie.insn, &env);
-      simplify_instruction(mie.insn, env);
+      auto insn = mie.insn;
+      if (null_check != nullptr) {
+        remove_null_check(null_check, checked, insn);
+        null_check = nullptr;
+      }
+      if (intraprocedural::is_null_check(insn)) {
+        null_check = insn;
+        checked = env.get(insn->src(0));
+      }
+      intra_cp.analyze_instruction(insn, &env);
+      if (insn->dests_size()) {
+        simplify_instruction(insn, env.get(insn->dest()));
+      }
     }
     eliminate_dead_branch(intra_cp, block, env);
   }
@@ -140,4 +242,43 @@ Transform::Stats Transform::apply(
   return m_stats;
 }
 
+Transform::Stats Transform::apply(const sparse::Analyzer& analyzer,
+                                  IRCode* code) {
+  auto& cfg = code->cfg();
+  for (const auto& block : cfg.blocks()) {
+    if (!analyzer.is_executable(block)) {
+      continue;
+    }
+    IRInstruction* null_check = nullptr;
+    for (auto& mie : InstructionIterable(block)) {
+      auto insn = mie.insn;
+      if (null_check != nullptr) {
+        remove_null_check(null_check, analyzer.get_use(null_check, 0), insn);
+        null_check = nullptr;
+      }
+      if (intraprocedural::is_null_check(insn)) {
+        null_check = insn;
+      }
+      if (insn->dests_size()) {
+        simplify_instruction(insn, analyzer.get_def(insn));
+      }
+    }
+    eliminate_dead_branch(analyzer, block);
+  }
+  bool branches_changed =
+      !m_switch_replacements.empty() ||
+      std::any_of(m_insn_replacements.begin(),
+                  m_insn_replacements.end(),
+                  [](const std::pair<IRInstruction*, IRInstruction*>& p) {
+                    return is_branch(p.first->opcode());
+                  });
+  apply_changes(code);
+  if (branches_changed) {
+    code->build_cfg();
+    m_stats.unreachable_instructions_removed +=
+        transform::remove_unreachable_blocks(code);
+  }
+  return m_stats;
+}
+
 } // namespace constant_propagation
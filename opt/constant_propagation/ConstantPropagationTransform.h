@@ -12,23 +12,32 @@
 #include "ConstantEnvironment.h"
 #include "ConstantPropagationAnalysis.h"
 #include "IRCode.h"
+#include "SparseConstantPropagation.h"
 
 namespace constant_propagation {
 
 /**
  * Optimize the given code by removing dead branches and converting move
- * instructions to const instructions when the values are known.
+ * instructions to const instructions when the values are known, and by
+ * removing the null checks of the references that are known to be non-null.
  */
 class Transform final {
  public:
   struct Stats {
     size_t branches_removed{0};
     size_t materialized_consts{0};
+    size_t unreachable_instructions_removed{0};
+    size_t null_checks_removed{0};
     Stats operator+(const Stats& that) const {
       Stats result;
       result.branches_removed = branches_removed + that.branches_removed;
       result.materialized_consts =
           materialized_consts + that.materialized_consts;
+      result.unreachable_instructions_removed =
+          unreachable_instructions_removed +
+          that.unreachable_instructions_removed;
+      result.null_checks_removed =
+          null_checks_removed + that.null_checks_removed;
       return result;
     }
   };
@@ -37,6 +46,12 @@ class Transform final {
 
   Stats apply(const intraprocedural::FixpointIterator&, IRCode*);
 
+  /*
+   * Also folds the switches that only take one of their cases, and removes
+   * the blocks that are then unreachable.
+   */
+  Stats apply(const sparse::Analyzer&, IRCode*);
+
  private:
   /*
    * The methods in this class queue up their transformations in
@@ -45,18 +60,29 @@ class Transform final {
    */
   void apply_changes(IRCode*);
 
-  void simplify_instruction(IRInstruction*, const ConstantEnvironment&);
+  // `value` is the value of the destination register after the instruction.
+  void simplify_instruction(IRInstruction*, const SignedConstantDomain& value);
+
+  // `value` is the value of the checked register, and `next` the instruction
+  // that follows the check in its block, if any.
+  void remove_null_check(IRInstruction*,
+                         const SignedConstantDomain& value,
+                         const IRInstruction* next);
 
   void eliminate_dead_branch(const intraprocedural::FixpointIterator& intra_cp,
                              Block*,
                              const ConstantEnvironment&);
 
+  void eliminate_dead_branch(const sparse::Analyzer&, Block*);
+
   void replace_with_const(IRInstruction*,
-                          const ConstantEnvironment&,
+                          const SignedConstantDomain& value,
                           bool is_wide);
 
   const ConstPropConfig& m_config;
   std::vector<std::pair<IRInstruction*, IRInstruction*>> m_insn_replacements;
+  // The switches that always jump to the case of the given key.
+  std::vector<std::pair<IRInstruction*, int32_t>> m_switch_replacements;
   Stats m_stats;
 };
 
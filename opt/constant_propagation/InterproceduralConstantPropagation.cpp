@@ -9,11 +9,16 @@
 
 #include "InterproceduralConstantPropagation.h"
 
+#include <deque>
+#include <unordered_set>
+
 #include "ConstantEnvironment.h"
 #include "ConstantPropagationAnalysis.h"
 #include "ConstantPropagationTransform.h"
+#include "SparseConstantPropagation.h"
 #include "Timer.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 using namespace constant_propagation;
 using namespace constant_propagation::interprocedural;
@@ -33,6 +38,21 @@ static ConstantEnvironment env_with_params(const IRCode* code,
   return env;
 }
 
+/*
+ * Join value into the values that may have been written to field so far.
+ */
+void join_field_value(
+    std::unordered_map<DexField*, SignedConstantDomain>* field_values,
+    DexField* field,
+    const SignedConstantDomain& value) {
+  auto it = field_values->find(field);
+  if (it == field_values->end()) {
+    field_values->emplace(field, value);
+  } else {
+    it->second.join_with(value);
+  }
+}
+
 /*
  * Initialize field_env with the encoded values of primitive fields. If no
  * encoded value is present, initialize them with a zero value (which is
@@ -116,6 +136,201 @@ namespace constant_propagation {
 
 namespace interprocedural {
 
+FixpointIterator::FixpointIterator(const call_graph::Graph& call_graph,
+                                   const ConstPropConfig& config)
+    : m_call_graph(call_graph), m_config(config) {
+  build_components();
+}
+
+/*
+ * Finds the strongly connected components of the part of the call graph that
+ * is reachable from the entry point, using Tarjan's algorithm. The recursion
+ * is turned into an explicit stack since call chains can get very deep.
+ */
+void FixpointIterator::build_components() {
+  struct Frame {
+    DexMethod* method;
+    size_t next_callee;
+  };
+  std::unordered_map<const DexMethod*, size_t> index;
+  std::unordered_map<const DexMethod*, size_t> lowlink;
+  std::unordered_set<const DexMethod*> on_stack;
+  std::vector<DexMethod*> stack;
+  std::vector<Frame> frames;
+  auto visit = [&](DexMethod* method) {
+    auto idx = index.size();
+    index[method] = idx;
+    lowlink[method] = idx;
+    stack.push_back(method);
+    on_stack.insert(method);
+    frames.push_back({method, 0});
+  };
+
+  visit(m_call_graph.entry().method());
+  while (!frames.empty()) {
+    auto method = frames.back().method;
+    const auto& callees = m_call_graph.node(method).callees();
+    if (frames.back().next_callee < callees.size()) {
+      auto callee = callees[frames.back().next_callee++]->callee();
+      auto it = index.find(callee);
+      if (it == index.end()) {
+        visit(callee);
+      } else if (on_stack.count(callee)) {
+        lowlink[method] = std::min(lowlink[method], it->second);
+      }
+      continue;
+    }
+    frames.pop_back();
+    if (!frames.empty()) {
+      auto caller = frames.back().method;
+      lowlink[caller] = std::min(lowlink[caller], lowlink[method]);
+    }
+    if (lowlink[method] != index[method]) {
+      continue;
+    }
+    Component component;
+    DexMethod* member;
+    do {
+      member = stack.back();
+      stack.pop_back();
+      on_stack.erase(member);
+      m_component_of[member] = m_components.size();
+      component.methods.push_back(member);
+    } while (member != method);
+    m_components.push_back(std::move(component));
+  }
+
+  for (size_t i = 0; i < m_components.size(); ++i) {
+    auto& component = m_components[i];
+    component.is_recursive = component.methods.size() > 1;
+    for (auto method : component.methods) {
+      m_states[method];
+      for (const auto& edge : m_call_graph.node(method).callees()) {
+        auto j = m_component_of.at(edge->callee());
+        if (i == j) {
+          component.is_recursive = true;
+          continue;
+        }
+        component.successors.push_back(j);
+        ++m_components[j].num_predecessors;
+      }
+    }
+  }
+  TRACE(ICONSTP,
+        2,
+        "Call graph has %lu reachable methods in %lu components\n",
+        m_states.size(),
+        m_components.size());
+}
+
+Domain FixpointIterator::compute_entry_state(const DexMethod* method,
+                                             const Domain& init) const {
+  Domain entry_state = Domain::bottom();
+  if (method == m_call_graph.entry().method()) {
+    entry_state.join_with(init);
+  }
+  for (const auto& edge : m_call_graph.node(method).callers()) {
+    entry_state.join_with(
+        analyze_edge(edge, get_exit_state_at(edge->caller())));
+  }
+  return entry_state;
+}
+
+void FixpointIterator::analyze_component(const Component& component,
+                                         const Domain& init) {
+  if (!component.is_recursive) {
+    auto method = component.methods.front();
+    auto& state = m_states.at(method);
+    state.entry = compute_entry_state(method, init);
+    if (!state.entry.is_bottom()) {
+      state.exit = state.entry;
+      analyze_node(method, &state.exit);
+    }
+    return;
+  }
+
+  // The callers in other components are all done, so only the methods whose
+  // callers in this component have new exit states need to be looked at
+  // again. A method is analyzed once with the join of its arguments, and with
+  // their widening afterwards.
+  std::deque<DexMethod*> worklist(component.methods.begin(),
+                                  component.methods.end());
+  std::unordered_set<const DexMethod*> queued(component.methods.begin(),
+                                              component.methods.end());
+  std::unordered_set<const DexMethod*> analyzed;
+  auto component_idx = m_component_of.at(component.methods.front());
+  while (!worklist.empty()) {
+    auto method = worklist.front();
+    worklist.pop_front();
+    queued.erase(method);
+    auto& state = m_states.at(method);
+    auto entry_state = compute_entry_state(method, init);
+    if (entry_state.is_bottom()) {
+      continue;
+    }
+    if (analyzed.count(method) == 0) {
+      analyzed.insert(method);
+      state.entry = entry_state;
+    } else if (entry_state.leq(state.entry)) {
+      continue;
+    } else {
+      state.entry.widen_with(entry_state);
+    }
+    auto exit_state = state.entry;
+    analyze_node(method, &exit_state);
+    if (exit_state.equals(state.exit)) {
+      continue;
+    }
+    state.exit = std::move(exit_state);
+    for (const auto& edge : m_call_graph.node(method).callees()) {
+      auto callee = edge->callee();
+      if (m_component_of.at(callee) == component_idx &&
+          queued.insert(callee).second) {
+        worklist.push_back(callee);
+      }
+    }
+  }
+}
+
+void FixpointIterator::run(const Domain& init) {
+  for (auto& pair : m_states) {
+    pair.second = MethodState();
+  }
+  // A component is queued once all the components calling into it are done.
+  std::vector<std::atomic<size_t>> pending(m_components.size());
+  for (size_t i = 0; i < m_components.size(); ++i) {
+    pending[i] = m_components[i].num_predecessors;
+  }
+  WorkQueue<size_t, std::nullptr_t, std::nullptr_t>* queue;
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    const auto& component = m_components[i];
+    analyze_component(component, init);
+    for (auto successor : component.successors) {
+      if (--pending[successor] == 0) {
+        queue->add_item(successor);
+      }
+    }
+  });
+  queue = &wq;
+  wq.set_wait_for_dynamic_items(true);
+  for (size_t i = 0; i < m_components.size(); ++i) {
+    if (pending[i] == 0) {
+      wq.add_item(i);
+    }
+  }
+  wq.run_all();
+}
+
+Domain FixpointIterator::get_entry_state_at(const DexMethod* method) const {
+  auto it = m_states.find(method);
+  return it == m_states.end() ? Domain::bottom() : it->second.entry;
+}
+
+Domain FixpointIterator::get_exit_state_at(const DexMethod* method) const {
+  auto it = m_states.find(method);
+  return it == m_states.end() ? Domain::bottom() : it->second.exit;
+}
+
 void FixpointIterator::analyze_node(DexMethod* const& method,
                                     Domain* current_state) const {
   // The entry node has no associated method.
@@ -147,7 +362,7 @@ void FixpointIterator::analyze_node(DexMethod* const& method,
 }
 
 Domain FixpointIterator::analyze_edge(
-    const std::shared_ptr<call_graph::Edge>& edge,
+    const call_graph::Edge* edge,
     const Domain& exit_state_at_source) const {
   Domain entry_state_at_dest;
   auto it = edge->invoke_iterator();
@@ -179,6 +394,8 @@ static IROpcode opcode_for_interval(const sign_domain::Interval intv) {
     return OPCODE_IF_GEZ;
   case Interval::LEZ:
     return OPCODE_IF_LEZ;
+  case Interval::NEZ:
+    return OPCODE_IF_NEZ;
   }
 }
 
@@ -332,12 +549,20 @@ class Propagator {
                       args.str().c_str());
               }
 
-              intraprocedural::FixpointIterator intra_cp(
-                  code.cfg(), m_config, fp_iter.get_field_environment());
               auto env = env_with_params(&code, args.get(INPUT_ARGS));
-              intra_cp.run(env);
               Transform tf(m_config);
-              auto stats = tf.apply(intra_cp, &code);
+              Transform::Stats stats;
+              if (m_config.sparse) {
+                sparse::Analyzer analyzer(
+                    code.cfg(), m_config, fp_iter.get_field_environment());
+                analyzer.run(env);
+                stats = tf.apply(analyzer, &code);
+              } else {
+                intraprocedural::FixpointIterator intra_cp(
+                    code.cfg(), m_config, fp_iter.get_field_environment());
+                intra_cp.run(env);
+                stats = tf.apply(intra_cp, &code);
+              }
 
               if (m_config.dynamic_input_checks) {
                 insert_runtime_input_checks(
@@ -364,38 +589,56 @@ class Propagator {
    */
   void join_all_field_values(const FixpointIterator& fp_iter,
                              ConstantStaticFieldEnvironment* field_env) {
-    walk::methods(m_scope, [&](DexMethod* method) {
-      IRCode* code = method->get_code();
-      if (code == nullptr) {
-        return;
-      }
-      auto& cfg = code->cfg();
-      auto args = fp_iter.get_entry_state_at(method);
-      // If the callgraph isn't complete, reachable methods may appear
-      // unreachable
-      if (args.is_bottom()) {
-        args.set_to_top();
-      }
-      intraprocedural::FixpointIterator intra_cp(code->cfg(), m_config);
-      intra_cp.run(env_with_params(code, args.get(nullptr)));
-      for (Block* b : cfg.blocks()) {
-        auto state = intra_cp.get_entry_state_at(b);
-        for (auto& mie : InstructionIterable(b)) {
-          auto* insn = mie.insn;
-          auto op = insn->opcode();
-          if (is_sput(op)) {
-            auto value = state.get(insn->src(0));
-            auto field = resolve_field(insn->get_field());
-            if (field != nullptr) {
-              field_env->update(field, [&value](auto current_value) {
-                return current_value.join(value);
-              });
+    using Data = std::nullptr_t;
+    using FieldValues = std::unordered_map<DexField*, SignedConstantDomain>;
+    auto field_values = walk::parallel::reduce_methods<Data, FieldValues>(
+        m_scope,
+        [&](Data&, DexMethod* method) {
+          FieldValues values;
+          IRCode* code = method->get_code();
+          if (code == nullptr) {
+            return values;
+          }
+          auto& cfg = code->cfg();
+          auto args = fp_iter.get_entry_state_at(method);
+          // If the callgraph isn't complete, reachable methods may appear
+          // unreachable
+          if (args.is_bottom()) {
+            args.set_to_top();
+          }
+          intraprocedural::FixpointIterator intra_cp(code->cfg(), m_config);
+          intra_cp.run(env_with_params(code, args.get(nullptr)));
+          for (Block* b : cfg.blocks()) {
+            auto state = intra_cp.get_entry_state_at(b);
+            for (auto& mie : InstructionIterable(b)) {
+              auto* insn = mie.insn;
+              auto op = insn->opcode();
+              if (is_sput(op)) {
+                auto value = state.get(insn->src(0));
+                auto field = resolve_field(insn->get_field());
+                if (field != nullptr) {
+                  join_field_value(&values, field, value);
+                }
+              }
+              intra_cp.analyze_instruction(insn, &state);
             }
           }
-          intra_cp.analyze_instruction(insn, &state);
-        }
-      }
-    });
+          return values;
+        },
+        [](FieldValues a, FieldValues b) { // reducer
+          for (auto& pair : b) {
+            join_field_value(&a, pair.first, pair.second);
+          }
+          return a;
+        },
+        [&](unsigned int) { // data initializer
+          return nullptr;
+        });
+    for (auto& pair : field_values) {
+      field_env->update(pair.first, [&pair](auto current_value) {
+        return current_value.join(pair.second);
+      });
+    }
   }
 
   const Stats& get_stats() const { return m_stats; }
@@ -434,6 +677,8 @@ void InterproceduralConstantPropagationPass::run_pass(DexStoresVector& stores,
   mgr.incr_metric("branches_removed", stats.transform_stats.branches_removed);
   mgr.incr_metric("materialized_consts",
                   stats.transform_stats.materialized_consts);
+  mgr.incr_metric("unreachable_instructions_removed",
+                  stats.transform_stats.unreachable_instructions_removed);
   mgr.incr_metric("constant_fields", stats.constant_fields);
 }
 
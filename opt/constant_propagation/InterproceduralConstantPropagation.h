@@ -10,6 +10,8 @@
 #pragma once
 
 #include <atomic>
+#include <unordered_map>
+#include <vector>
 
 #include "CallGraph.h"
 #include "ConstPropConfig.h"
@@ -51,20 +53,34 @@ constexpr IRInstruction* INPUT_ARGS = nullptr;
 
 /*
  * Performs interprocedural constant propagation of stack / register values.
+ *
+ * The state of a method summarizes its analysis: the arguments it may be
+ * called with on entry, and the arguments it passes to each of its callees on
+ * exit. The strongly connected components of the call graph are analyzed in
+ * parallel, each of them as soon as all the components calling into it are
+ * done. Within a recursive component, a method is only analyzed again when
+ * its arguments grow, so the iteration only ever looks at the summaries of
+ * the other methods.
  */
-class FixpointIterator
-    : public MonotonicFixpointIterator<call_graph::GraphInterface, Domain> {
+class FixpointIterator {
  public:
   FixpointIterator(const call_graph::Graph& call_graph,
-                   const ConstPropConfig& config)
-      : MonotonicFixpointIterator(call_graph),
-        m_config(config) {}
+                   const ConstPropConfig& config);
+
+  void analyze_node(DexMethod* const& method, Domain* current_state) const;
+
+  Domain analyze_edge(const call_graph::Edge* edge,
+                      const Domain& exit_state_at_source) const;
 
-  void analyze_node(DexMethod* const& method,
-                    Domain* current_state) const override;
+  /*
+   * This method can be invoked multiple times, e.g. after the field
+   * environment has been updated.
+   */
+  void run(const Domain& init);
 
-  Domain analyze_edge(const std::shared_ptr<call_graph::Edge>& edge,
-                      const Domain& exit_state_at_source) const override;
+  Domain get_entry_state_at(const DexMethod* method) const;
+
+  Domain get_exit_state_at(const DexMethod* method) const;
 
   ConstantStaticFieldEnvironment get_field_environment() const {
     return m_field_env;
@@ -75,8 +91,33 @@ class FixpointIterator
   }
 
  private:
+  struct Component {
+    std::vector<DexMethod*> methods;
+    // The components that this one calls into, once per call graph edge.
+    std::vector<size_t> successors;
+    size_t num_predecessors{0};
+    bool is_recursive{false};
+  };
+
+  struct MethodState {
+    Domain entry{Domain::bottom()};
+    Domain exit{Domain::bottom()};
+  };
+
+  void build_components();
+
+  Domain compute_entry_state(const DexMethod* method, const Domain& init) const;
+
+  void analyze_component(const Component& component, const Domain& init);
+
+  const call_graph::Graph& m_call_graph;
   ConstPropConfig m_config;
   ConstantStaticFieldEnvironment m_field_env;
+  std::vector<Component> m_components;
+  std::unordered_map<const DexMethod*, size_t> m_component_of;
+  // Holds an entry for every method reachable from the entry point before
+  // the iteration starts, so that the workers never insert into it.
+  std::unordered_map<const DexMethod*, MethodState> m_states;
 };
 
 void insert_runtime_input_checks(const ConstantEnvironment&,
@@ -101,6 +142,7 @@ class InterproceduralConstantPropagationPass : public Pass {
     pc.get("fold_arithmetic", false, m_config.fold_arithmetic);
     pc.get("include_virtuals", false, m_config.include_virtuals);
     pc.get("dynamic_input_checks", false, m_config.dynamic_input_checks);
+    pc.get("sparse", false, m_config.sparse);
     int64_t max_heap_analysis_iterations;
     pc.get("max_heap_analysis_iterations", 0, max_heap_analysis_iterations);
     always_assert(max_heap_analysis_iterations >= 0);
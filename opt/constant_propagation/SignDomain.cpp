@@ -12,13 +12,18 @@
 namespace sign_domain {
 
 /*
- *             ALL
- *            /    \
- *          LEZ    GEZ
- *         /  \   /   \
- *       LTZ   EQZ   GTZ
- *         \    |     /
- *            EMPTY
+ *              ALL
+ *           /   |   \
+ *        LEZ   NEZ   GEZ
+ *         | \ /   \ / |
+ *         |  X     X  |
+ *         | / \   / \ |
+ *        LTZ   EQZ   GTZ
+ *           \   |   /
+ *             EMPTY
+ *
+ * where LEZ is above LTZ and EQZ, NEZ is above LTZ and GTZ, and GEZ is above
+ * EQZ and GTZ.
  */
 
 Lattice lattice({Interval::EMPTY,
@@ -27,6 +32,7 @@ Lattice lattice({Interval::EMPTY,
                  Interval::EQZ,
                  Interval::LEZ,
                  Interval::GEZ,
+                 Interval::NEZ,
                  Interval::ALL},
                 {{Interval::EMPTY, Interval::LTZ},
                  {Interval::EMPTY, Interval::GTZ},
@@ -35,8 +41,11 @@ Lattice lattice({Interval::EMPTY,
                  {Interval::EQZ, Interval::LEZ},
                  {Interval::GTZ, Interval::GEZ},
                  {Interval::EQZ, Interval::GEZ},
+                 {Interval::LTZ, Interval::NEZ},
+                 {Interval::GTZ, Interval::NEZ},
                  {Interval::LEZ, Interval::ALL},
-                 {Interval::GEZ, Interval::ALL}});
+                 {Interval::GEZ, Interval::ALL},
+                 {Interval::NEZ, Interval::ALL}});
 
 std::ostream& operator<<(std::ostream& os, Interval interval) {
   switch (interval) {
@@ -58,6 +67,9 @@ std::ostream& operator<<(std::ostream& os, Interval interval) {
   case Interval::LEZ:
     os << "LEZ";
     return os;
+  case Interval::NEZ:
+    os << "NEZ";
+    return os;
   case Interval::ALL:
     os << "ALL";
     return os;
@@ -95,6 +107,8 @@ bool contains(Interval interval, int64_t point) {
     return point <= 0;
   case Interval::GEZ:
     return point >= 0;
+  case Interval::NEZ:
+    return point != 0;
   case Interval::ALL:
     return true;
   case Interval::SIZE:
@@ -26,6 +26,7 @@ enum class Interval {
   EQZ, // {0}
   GEZ, // [0, ∞)
   LEZ, // (-∞, 0]
+  NEZ, // (-∞, 0) ∪ (0, ∞) -- Also the non-null references
   ALL, // (-∞, +∞) -- Top type
 
   SIZE // The number of items in Interval
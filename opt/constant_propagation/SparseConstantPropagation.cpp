@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "SparseConstantPropagation.h"
+
+#include "ConstantPropagationAnalysis.h"
+#include "IRCode.h"
+#include "Transform.h"
+
+namespace constant_propagation {
+
+namespace sparse {
+
+Analyzer::Analyzer(const ControlFlowGraph& cfg,
+                   const ConstPropConfig& config,
+                   ConstantStaticFieldEnvironment field_env)
+    : m_config(config), m_field_env(field_env), m_ssa(cfg) {
+  // The blocks are in the order of the code, where a move-result always
+  // follows the instruction whose result it gets, even in another block.
+  const IRInstruction* prev = nullptr;
+  size_t num_ids = 0;
+  for (auto* b : cfg.blocks()) {
+    num_ids = std::max(num_ids, b->id() + 1);
+    for (const auto& mie : *b) {
+      if (mie.type == MFLOW_TARGET && mie.target->type == BRANCH_MULTI) {
+        m_cases[mie.target->src->insn].emplace_back(mie.target->index, b);
+      } else if (mie.type == MFLOW_OPCODE) {
+        if (prev != nullptr && is_move_result(mie.insn->opcode())) {
+          m_results.emplace(prev, mie.insn);
+        }
+        m_block_of.emplace(mie.insn, b);
+        prev = mie.insn;
+      }
+    }
+  }
+  m_executable_blocks.resize(num_ids, false);
+}
+
+void Analyzer::run(const ConstantEnvironment& params) {
+  m_params = params;
+  m_values.assign(m_ssa.num_values(), SignedConstantDomain::bottom());
+  // Registers that nothing defines on some path hold anything.
+  m_values[ssa::UNDEFINED] = SignedConstantDomain::top();
+  const auto& blocks = m_ssa.dominators().reverse_postorder();
+  if (blocks.empty()) {
+    return;
+  }
+  m_executable_blocks[blocks.front()->id()] = true;
+  for (const auto& mie : InstructionIterable(*blocks.front())) {
+    visit_instruction(mie.insn);
+  }
+  visit_branch(blocks.front());
+
+  while (!m_edge_worklist.empty() || !m_value_worklist.empty()) {
+    while (!m_edge_worklist.empty()) {
+      auto edge = m_edge_worklist.back();
+      m_edge_worklist.pop_back();
+      visit_edge(edge);
+    }
+    while (!m_value_worklist.empty()) {
+      auto v = m_value_worklist.back();
+      m_value_worklist.pop_back();
+      for (const auto& use : m_ssa.uses(v)) {
+        if (use.insn == nullptr) {
+          if (is_executable(use.phi->block)) {
+            visit_phi(use.phi);
+          }
+          continue;
+        }
+        auto block = m_block_of.at(use.insn);
+        if (!is_executable(block)) {
+          continue;
+        }
+        visit_instruction(use.insn);
+        if (use.insn == transform::find_last_instruction(block)->insn) {
+          visit_branch(block);
+        }
+      }
+    }
+  }
+}
+
+void Analyzer::visit_edge(const cfg::Edge* edge) {
+  auto block = edge->target();
+  for (auto phi : m_ssa.phis(block)) {
+    visit_phi(phi);
+  }
+  if (is_executable(block)) {
+    return;
+  }
+  m_executable_blocks[block->id()] = true;
+  for (const auto& mie : InstructionIterable(*block)) {
+    visit_instruction(mie.insn);
+  }
+  visit_branch(block);
+}
+
+void Analyzer::visit_phi(const ssa::Phi* phi) {
+  auto value = SignedConstantDomain::bottom();
+  for (const auto& arg : phi->args) {
+    if (is_executable(arg.first)) {
+      value.join_with(m_values[arg.second]);
+    }
+  }
+  set_value(phi->value, value);
+}
+
+void Analyzer::visit_instruction(const IRInstruction* insn) {
+  auto op = insn->opcode();
+  if (opcode::is_load_param(op)) {
+    set_value(m_ssa.def(insn), m_params.get(insn->dest()));
+    return;
+  }
+  if (is_move_result(op)) {
+    // The instruction that this one follows sets its value.
+    return;
+  }
+  bool has_result = insn->has_move_result() || insn->has_move_result_pseudo();
+  if (!insn->dests_size() && !has_result) {
+    return;
+  }
+  ConstantEnvironment env;
+  for (size_t i = 0; i < insn->srcs_size(); ++i) {
+    env.set(insn->src(i), get_use(insn, i));
+  }
+  intraprocedural::analyze_instruction(insn, &env, m_config, m_field_env);
+  if (insn->dests_size()) {
+    set_value(m_ssa.def(insn), env.get(insn->dest()));
+    return;
+  }
+  auto it = m_results.find(insn);
+  if (it != m_results.end()) {
+    set_value(m_ssa.def(it->second), env.get(RESULT_REGISTER));
+  }
+}
+
+void Analyzer::visit_branch(Block* block) {
+  auto last = transform::find_last_instruction(block);
+  auto insn = last == block->end() ? nullptr : last->insn;
+  auto op = insn == nullptr ? OPCODE_NOP : insn->opcode();
+  const Block* case_target = nullptr;
+  bool has_case_target = false;
+  if (is_switch(op)) {
+    auto key = get_use(insn, 0).constant_domain().get_constant();
+    if (key) {
+      has_case_target = true;
+      auto it = m_cases.find(insn);
+      if (it != m_cases.end()) {
+        for (const auto& c : it->second) {
+          if (c.first == *key) {
+            case_target = c.second;
+            break;
+          }
+        }
+      }
+    }
+  }
+  for (const auto& edge : block->succs()) {
+    if (is_executable(edge.get())) {
+      continue;
+    }
+    bool taken = true;
+    if (edge->type() == EDGE_THROW) {
+      // Whether the instruction throws isn't known.
+    } else if (is_conditional_branch(op)) {
+      ConstantEnvironment env;
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        env.set(insn->src(i), get_use(insn, i));
+      }
+      intraprocedural::analyze_if(insn, &env, edge->type() == EDGE_BRANCH);
+      taken = !env.is_bottom();
+    } else if (has_case_target) {
+      // The default case falls through to the next block.
+      taken = case_target == nullptr ? edge->type() == EDGE_GOTO
+                                     : edge->type() == EDGE_BRANCH &&
+                                           edge->target() == case_target;
+    }
+    if (taken) {
+      m_executable_edges.emplace(edge.get());
+      m_edge_worklist.push_back(edge.get());
+    }
+  }
+}
+
+void Analyzer::set_value(ssa::ValueId v, const SignedConstantDomain& value) {
+  if (v == ssa::UNDEFINED) {
+    return;
+  }
+  // Joining makes sure that values only go up, so that the analysis ends.
+  auto joined = m_values[v].join(value);
+  if (joined != m_values[v]) {
+    m_values[v] = joined;
+    m_value_worklist.push_back(v);
+  }
+}
+
+SignedConstantDomain Analyzer::get_def(const IRInstruction* insn) const {
+  auto it = m_results.find(insn);
+  auto v = m_ssa.def(it == m_results.end() ? insn : it->second);
+  return v == ssa::UNDEFINED ? SignedConstantDomain::top() : m_values.at(v);
+}
+
+} // namespace sparse
+
+} // namespace constant_propagation
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ConstPropConfig.h"
+#include "ConstantEnvironment.h"
+#include "ControlFlow.h"
+#include "SSA.h"
+
+namespace constant_propagation {
+
+namespace sparse {
+
+/*
+ * Sparse conditional constant propagation (Wegman & Zadeck) over the SSA
+ * view of a CFG. Values start at bottom and the blocks as not executable;
+ * an edge becomes executable when its source is and its branch may take it,
+ * and a value is only evaluated again when one of its operands changes, by
+ * following the def-use chains. A switch on a constant only makes the edge
+ * of its case executable.
+ *
+ * The instructions are evaluated like the dense analysis does, with
+ * intraprocedural::analyze_instruction(). Unlike it, the values of the
+ * registers that a branch compares aren't refined on its edges, and neither
+ * are the references that an instruction dereferences.
+ */
+class Analyzer final {
+ public:
+  Analyzer(const ControlFlowGraph& cfg,
+           const ConstPropConfig& config,
+           ConstantStaticFieldEnvironment field_env =
+               ConstantStaticFieldEnvironment());
+
+  /*
+   * `params` binds the destinations of the load-param instructions, like the
+   * environment that intraprocedural::FixpointIterator::run() starts with.
+   */
+  void run(const ConstantEnvironment& params);
+
+  bool is_executable(const Block* block) const {
+    return m_executable_blocks.at(block->id());
+  }
+
+  bool is_executable(const cfg::Edge* edge) const {
+    return m_executable_edges.count(edge) != 0;
+  }
+
+  // The value that `insn` defines, or that the move-result following it gets.
+  SignedConstantDomain get_def(const IRInstruction* insn) const;
+
+  // The value that source i of `insn` reads.
+  SignedConstantDomain get_use(const IRInstruction* insn, size_t i) const {
+    return m_values.at(m_ssa.use(insn, i));
+  }
+
+ private:
+  void visit_edge(const cfg::Edge* edge);
+  void visit_phi(const ssa::Phi* phi);
+  void visit_instruction(const IRInstruction* insn);
+  // Makes the successors of an executable block that it may take executable.
+  void visit_branch(Block* block);
+  void set_value(ssa::ValueId v, const SignedConstantDomain& value);
+
+  const ConstPropConfig& m_config;
+  ConstantStaticFieldEnvironment m_field_env;
+  ssa::SSAForm m_ssa;
+  ConstantEnvironment m_params;
+
+  std::vector<SignedConstantDomain> m_values;
+  std::vector<bool> m_executable_blocks;
+  std::unordered_set<const cfg::Edge*> m_executable_edges;
+  std::unordered_map<const IRInstruction*, Block*> m_block_of;
+  // The move-result instruction that follows an instruction with a result.
+  std::unordered_map<const IRInstruction*, const IRInstruction*> m_results;
+  // The cases of each switch, and the blocks they jump to.
+  std::unordered_map<const IRInstruction*,
+                     std::vector<std::pair<int32_t, const Block*>>>
+      m_cases;
+
+  std::vector<const cfg::Edge*> m_edge_worklist;
+  std::vector<ssa::ValueId> m_value_worklist;
+};
+
+} // namespace sparse
+
+} // namespace constant_propagation
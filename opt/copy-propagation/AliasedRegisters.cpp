@@ -10,129 +10,107 @@
 #include "AliasedRegisters.h"
 
 #include <algorithm>
-#ifdef __GNUC__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wshadow"
-#endif
-#include <boost/graph/adjacency_list.hpp>
-#ifdef __GNUC__
-#pragma GCC diagnostic pop
-#endif
 #include <boost/optional.hpp>
-#include <boost/range/iterator_range.hpp>
 #include <limits>
 #include <numeric>
-#include <unordered_set>
 
-// Implemented by an undirected graph where nodes are Registers and edges are an
-// alias between them.
+// An alias group is a set of values that are all aliases of each other.
+// Each group is stored as a flat vector of its members, and the registers of
+// a group are kept in insertion order, oldest first.
 //
-// An alias group is a fully connected clique of nodes.
-// Every node in a group is aliased to every other node.
-//
-// Data structure invariant: The graph is a forest of cliques
-// Corollary: There are no edges that are not part of a clique.
+// Data structure invariant: every value is in at most one group, and every
+// group has at least two members.
 //
 // The aliasing relation is an equivalence relation. An alias group is an
 // equivalence class of this relation.
-//   Reflexive : a node is trivially equivalent to itself
-//   Symmetric : edges in the graph are undirected
-//   Transitive: `AliasedRegisters::move` adds an edge to every node in the
-//               group, creating a clique
+//   Reflexive : a value is trivially equivalent to itself
+//   Symmetric : membership of a group doesn't depend on the order of values
+//   Transitive: `AliasedRegisters::move` adds `moving` to the whole group of
+//               `group`
+//
+// The pairs of values in the same group are the "edges" of the lattice
+// described below.
 
 namespace aliased_registers {
 
+const AliasedRegisters::Groups& AliasedRegisters::groups() const {
+  static const Groups s_empty;
+  return m_groups ? *m_groups : s_empty;
+}
+
+// Copy the groups if another state shares them.
+AliasedRegisters::Groups& AliasedRegisters::mutable_groups() {
+  if (!m_groups) {
+    m_groups = std::make_shared<Groups>();
+  } else if (m_groups.use_count() > 1) {
+    m_groups = std::make_shared<Groups>(*m_groups);
+  }
+  return *m_groups;
+}
+
 // Move `moving` into the alias group of `group`
 //
-// Create an edge from `moving` to every vertex in the alias group of
-// `group`.
+// `moving` becomes an alias of every value in the alias group of `group`.
 //
-// We want alias groups to be fully connected cliques.
+// We want alias groups to be transitively closed.
 // Here's an example to show why:
 //
 //   move v1, v2
 //   move v0, v1 # (call `AliasedRegisters::move(v0, v1)` here)
 //   const v1, 0
 //
-// At this point, v0 and v2 still hold the same value, but if we had just
-// added an edge from v0 to v1, then we would have lost this information.
+// At this point, v0 and v2 still hold the same value, but if we had only
+// recorded that v0 is an alias of v1, then we would have lost this
+// information.
+//
+// `moving` is the newest member of the group, so it goes to the end. If this
+// call creates a new group, `group` is its oldest member.
 void AliasedRegisters::move(const Value& moving, const Value& group) {
   // Only need to do something if they're not already in same group
   if (!are_aliases(moving, group)) {
     // remove from the old group
     break_alias(moving);
-    vertex_t v_moving = find_or_create(moving);
-    vertex_t v_group = find_or_create(group);
-
-    const auto& grp = vertices_in_group(v_group);
-    track_insert_order(moving, v_moving, group, v_group, grp);
-
-    // add edge to every node in new group
-    for (vertex_t v : grp) {
-      boost::add_edge(v_moving, v, m_graph);
+    auto& all = mutable_groups();
+    auto search = find(group);
+    if (search) {
+      all[search->first].push_back(moving);
+    } else {
+      all.push_back(Group{group, moving});
     }
   }
 }
 
-// Set the insertion number of `v_moving` to 1 + the max of `group`.
-// `v_moving` is the newest member of `group` so it should have the highest
-// insertion number.
-//
-// If this call creates a new clique (of size two), also set the insertion
-// number of v_group
-void AliasedRegisters::track_insert_order(const Value& moving,
-                                          vertex_t v_moving,
-                                          const Value& group,
-                                          vertex_t v_group,
-                                          const std::vector<vertex_t>& grp) {
-  always_assert(!grp.empty());
-  if (grp.size() == 1 && group.is_register()) {
-    // We're creating a new clique from a solitary vertex. The group
-    // register is the oldest, followed by moving.
-    m_insert_order[v_group] = 0;
-  }
-
-  if (moving.is_register()) {
-    m_insert_order[v_moving] =
-        1 + std::accumulate(
-                grp.begin(), grp.end(), 0, [this](size_t acc, vertex_t v) {
-                  // use operator[] to ignore non-register group members
-                  return std::max(acc, m_insert_order[v]);
-                });
-  }
-}
-
 // Remove r from its alias group
 void AliasedRegisters::break_alias(const Value& r) {
-  const auto& v = find(r);
-  const auto& end = boost::vertices(m_graph).second;
-  if (v != end) {
-    // clear removes all edges incident to r
-    boost::clear_vertex(*v, m_graph);
-
-    if (r.is_register()) {
-      // v is not in a clique any more so it has no insert order
-      clear_insert_number(*v);
+  auto search = find(r);
+  if (!search) {
+    return;
+  }
+  auto& all = mutable_groups();
+  auto& grp = all[search->first];
+  grp.erase(grp.begin() + search->second);
+  if (grp.size() < 2) {
+    // The last member isn't aliased to anything any more.
+    if (search->first != all.size() - 1) {
+      grp = std::move(all.back());
     }
+    all.pop_back();
   }
 }
 
-// Call this when `v` should no longer have an insertion number (because it does
-// not belong to a clique).
-void AliasedRegisters::clear_insert_number(vertex_t v) {
-  m_insert_order.erase(v);
-}
-
-// if there is an edge between r1 to r2, then they are aliases.
-// We only need to check for single edge paths because `move` adds an edge to
-// every node in the alias group, thus maintaining transitive closure of the
-// graph
+// r1 and r2 are aliases iff they are in the same group. `move` keeps the
+// groups transitively closed.
 bool AliasedRegisters::are_aliases(const Value& r1, const Value& r2) const {
   if (r1 == r2) {
     return true;
   }
 
-  return has_edge_between(r1, r2);
+  auto search = find(r1);
+  if (!search) {
+    return false;
+  }
+  const auto& grp = groups()[search->first];
+  return std::find(grp.begin(), grp.end(), r2) != grp.end();
 }
 
 // Return a representative for this register.
@@ -154,161 +132,94 @@ Register AliasedRegisters::get_representative(
     const Value& orig, const boost::optional<Register>& max_addressable) const {
   always_assert(orig.is_register());
 
-  // if r is not in the graph, then it has no representative
-  const auto& v = find(orig);
-  const auto& end = boost::vertices(m_graph).second;
-  if (v == end) {
-    return orig.reg();
-  }
-
-  // intentionally copy the vector so we can safely remove from it
-  std::vector<vertex_t> group = vertices_in_group(*v);
-  // filter out non registers and other ineligible registers
-  group.erase(std::remove_if(group.begin(),
-                             group.end(),
-                             [this, &max_addressable](vertex_t elem) {
-                               // return true to remove it
-                               const Value& val = m_graph[elem];
-                               if (!val.is_register()) {
-                                 return true;
-                               }
-                               return max_addressable &&
-                                      val.reg() > *max_addressable;
-                             }),
-              group.end());
-
-  if (group.empty()) {
+  // if r is not in a group, then it has no representative
+  auto search = find(orig);
+  if (!search) {
     return orig.reg();
   }
 
-  // We want the oldest element. It has the lowest insertion number
-  const Value& representative = m_graph[*std::min_element(
-      group.begin(), group.end(), [this](vertex_t a, vertex_t b) {
-        return m_insert_order.at(a) < m_insert_order.at(b);
-      })];
-  return representative.reg();
-}
-
-// if `r` is in the graph, return the vertex holding it.
-// if not, return the `end` iterator of the vertices
-const boost::range_detail::integer_iterator<AliasedRegisters::vertex_t>
-AliasedRegisters::find(const Value& r) const {
-  const auto& iters = boost::vertices(m_graph);
-  const auto& begin = iters.first;
-  const auto& end = iters.second;
-  for (auto it = begin; it != end; ++it) {
-    if (m_graph[*it] == r) {
-      return it;
+  // The registers of a group are ordered from the oldest to the newest.
+  for (const Value& val : groups()[search->first]) {
+    if (val.is_register() &&
+        (!max_addressable || val.reg() <= *max_addressable)) {
+      return val.reg();
     }
   }
-  return end;
+  return orig.reg();
 }
 
-// returns the vertex holding `r` or creates a new (unconnected)
-// vertex if `r` is not in m_graph
-AliasedRegisters::vertex_t AliasedRegisters::find_or_create(const Value& r) {
-  const auto& it = find(r);
-  const auto& end = boost::vertices(m_graph).second;
-  if (it != end) {
-    return *it;
-  } else {
-    return boost::add_vertex(r, m_graph);
-  }
-}
-
-// return true if there is a path of length exactly 1 from r1 to r2
-bool AliasedRegisters::has_edge_between(const Value& r1,
-                                        const Value& r2) const {
-  // make sure we have both vertices
-  const auto& search1 = find(r1);
-  const auto& search2 = find(r2);
-  const auto& end = boost::vertices(m_graph).second;
-  if (search1 == end || search2 == end) {
-    return false;
-  }
-
-  return are_adjacent(*search1, *search2);
-}
-
-bool AliasedRegisters::are_adjacent(vertex_t v1, vertex_t v2) const {
-  // and check that they have an edge between them
-  const auto& adj = boost::adjacent_vertices(v1, m_graph);
-  const auto& adj_begin = adj.first;
-  const auto& adj_end = adj.second;
-  const auto& edge_search = std::find(adj_begin, adj_end, v2);
-  return edge_search != adj_end;
-}
-
-// return a vector of v and all of it's neighbors (in no particular order)
-std::vector<AliasedRegisters::vertex_t> AliasedRegisters::vertices_in_group(
-    vertex_t v) const {
-  std::vector<vertex_t> result;
-  result.push_back(v);
-  const auto& adj = boost::adjacent_vertices(v, m_graph);
-  const auto& adj_begin = adj.first;
-  const auto& adj_end = adj.second;
-  for (auto it = adj_begin; it != adj_end; ++it) {
-    result.push_back(*it);
+boost::optional<std::pair<size_t, size_t>> AliasedRegisters::find(
+    const Value& r) const {
+  const auto& all = groups();
+  for (size_t i = 0; i < all.size(); ++i) {
+    const auto& grp = all[i];
+    for (size_t j = 0; j < grp.size(); ++j) {
+      if (grp[j] == r) {
+        return std::make_pair(i, j);
+      }
+    }
   }
-  return result;
+  return boost::none;
 }
 
-// return true if v has any neighboring vertices
-bool AliasedRegisters::has_neighbors(vertex_t v) {
-  const auto& adj = boost::adjacent_vertices(v, m_graph);
-  const auto& begin = adj.first;
-  const auto& end = adj.second;
-  return begin != end;
+size_t AliasedRegisters::num_edges() const {
+  const auto& all = groups();
+  return std::accumulate(
+      all.begin(), all.end(), size_t(0), [](size_t acc, const Group& grp) {
+        return acc + grp.size() * (grp.size() - 1) / 2;
+      });
 }
 
 // ---- extends AbstractValue ----
 
-void AliasedRegisters::clear() {
-  m_graph.clear();
-  m_insert_order.clear();
-}
+void AliasedRegisters::clear() { m_groups.reset(); }
 
 AliasedRegisters::Kind AliasedRegisters::kind() const {
-  return (boost::num_edges(m_graph) > 0) ? AliasedRegisters::Kind::Value
-                                         : AliasedRegisters::Kind::Top;
+  return groups().empty() ? AliasedRegisters::Kind::Top
+                          : AliasedRegisters::Kind::Value;
 }
 
 // The lattice looks like this:
 //
-//             T (graphs with no edges)
-//      graphs with 1 edge                  ^  join moves up (edge intersection)
-//      graphs with 2 edges                 |
+//             T (no aliases)
+//      states with 1 edge                  ^  join moves up (edge intersection)
+//      states with 2 edges                 |
 //            ...                           v  meet moves down (edge union)
-//      graphs with n edges
+//      states with n edges
 //            ...
 //            _|_
 //
 // So, leq is the superset relation on the edge set
 bool AliasedRegisters::leq(const AliasedRegisters& other) const {
-  if (boost::num_edges(m_graph) < boost::num_edges(other.m_graph)) {
+  if (m_groups == other.m_groups) {
+    return true;
+  }
+  if (num_edges() < other.num_edges()) {
     // this cannot be a superset of other if this has fewer edges
     return false;
   }
 
-  // for all edges in other (the potential subset), make sure this contains that
-  // edge.
-  const auto& iters = boost::edges(other.m_graph);
-  const auto& begin = iters.first;
-  const auto& end = iters.second;
-  for (auto it = begin; it != end; ++it) {
-    const Value& r1 = other.m_graph[boost::source(*it, other.m_graph)];
-    const Value& r2 = other.m_graph[boost::target(*it, other.m_graph)];
-    if (!has_edge_between(r1, r2)) {
+  // for all groups in other (the potential subset), make sure this has all of
+  // their members in a single group.
+  const auto& all = groups();
+  for (const auto& other_grp : other.groups()) {
+    auto search = find(other_grp.front());
+    if (!search) {
       return false;
     }
+    const auto& grp = all[search->first];
+    for (const Value& val : other_grp) {
+      if (std::find(grp.begin(), grp.end(), val) == grp.end()) {
+        return false;
+      }
+    }
   }
   return true;
 }
 
 // returns true iff they have exactly the same edges between the same Values
 bool AliasedRegisters::equals(const AliasedRegisters& other) const {
-  return boost::num_edges(m_graph) == boost::num_edges(other.m_graph) &&
-         leq(other);
+  return num_edges() == other.num_edges() && leq(other);
 }
 
 AliasedRegisters::Kind AliasedRegisters::narrow_with(
@@ -324,15 +235,14 @@ AliasedRegisters::Kind AliasedRegisters::widen_with(
 // alias group union
 AliasedRegisters::Kind AliasedRegisters::meet_with(
     const AliasedRegisters& other) {
-
-  const auto& iters = boost::edges(other.m_graph);
-  const auto& begin = iters.first;
-  const auto& end = iters.second;
-  for (auto it = begin; it != end; ++it) {
-    const Value& r1 = other.m_graph[boost::source(*it, other.m_graph)];
-    const Value& r2 = other.m_graph[boost::target(*it, other.m_graph)];
-    if (!this->are_aliases(r1, r2)) {
-      this->merge_groups_of(r1, r2, other);
+  if (m_groups != other.m_groups) {
+    for (const auto& other_grp : other.groups()) {
+      const Value& first = other_grp.front();
+      for (size_t i = 1; i < other_grp.size(); ++i) {
+        if (!this->are_aliases(first, other_grp[i])) {
+          this->merge_groups_of(first, other_grp[i], other);
+        }
+      }
     }
   }
   return AliasedRegisters::Kind::Value;
@@ -341,162 +251,151 @@ AliasedRegisters::Kind AliasedRegisters::meet_with(
 void AliasedRegisters::merge_groups_of(const Value& r1,
                                        const Value& r2,
                                        const AliasedRegisters& other) {
-  vertex_t v1 = find_or_create(r1);
-  vertex_t v2 = find_or_create(r2);
-
-  const auto& group1 = vertices_in_group(v1);
-  const auto& group2 = vertices_in_group(v2);
-  std::vector<vertex_t> union_group;
-  union_group.reserve(group1.size() + group2.size());
-  union_group.insert(union_group.begin(), group1.begin(), group1.end());
-  union_group.insert(union_group.begin(), group2.begin(), group2.end());
-
-  handle_insert_order_at_merge(union_group, other);
-  for (vertex_t g1 : group1) {
-    for (vertex_t g2 : group2) {
-      boost::add_edge(g1, g2, m_graph);
-    }
+  auto search1 = find(r1);
+  auto search2 = find(r2);
+  const auto& all = groups();
+  Group union_group;
+  if (search1) {
+    union_group = all[search1->first];
+  } else {
+    union_group.push_back(r1);
   }
+  if (search2) {
+    const auto& group2 = all[search2->first];
+    union_group.insert(union_group.end(), group2.begin(), group2.end());
+  } else {
+    union_group.push_back(r2);
+  }
+  // Order the union by the groups as they were before the merge.
+  sort_by_insert_order(&union_group, other);
+
+  // Remove the old groups, the one with the higher index first so that the
+  // index of the other stays valid.
+  auto& groups = mutable_groups();
+  std::vector<size_t> old_groups;
+  if (search1) {
+    old_groups.push_back(search1->first);
+  }
+  if (search2) {
+    old_groups.push_back(search2->first);
+  }
+  std::sort(old_groups.rbegin(), old_groups.rend());
+  for (size_t i : old_groups) {
+    groups.erase(groups.begin() + i);
+  }
+  groups.push_back(std::move(union_group));
 }
 
 // edge intersection
+//
+// Any subset of a group is also a group, so the intersection splits each group
+// of this by the groups of other.
 AliasedRegisters::Kind AliasedRegisters::join_with(
     const AliasedRegisters& other) {
-
-  // fill `deletes` with edges that aren't in `other`
-  std::vector<std::pair<vertex_t, vertex_t>> deletes;
-  const auto& iters = boost::edges(this->m_graph);
-  const auto& begin = iters.first;
-  const auto& end = iters.second;
-  for (auto it = begin; it != end; ++it) {
-    vertex_t v1 = boost::source(*it, this->m_graph);
-    vertex_t v2 = boost::target(*it, this->m_graph);
-    const Value& r1 = this->m_graph[v1];
-    const Value& r2 = this->m_graph[v2];
-    if (!other.has_edge_between(r1, r2)) {
-      deletes.emplace_back(v1, v2);
-    }
-  }
-
-  // This maintains a forest of cliques because any subset of nodes of a clique
-  // is also a clique
-  for (const auto& edge : deletes) {
-    boost::remove_edge(edge.first, edge.second, this->m_graph);
+  if (m_groups == other.m_groups) {
+    return AliasedRegisters::Kind::Value;
   }
 
-  handle_edge_intersection_insert_order(other);
-  return AliasedRegisters::Kind::Value;
-}
-
-void AliasedRegisters::handle_edge_intersection_insert_order(
-    const AliasedRegisters& other) {
-  // Clear out stale values in m_insert_order for vertices removed from cliques.
-  const auto& iters = boost::vertices(this->m_graph);
-  const auto& begin = iters.first;
-  const auto& end = iters.second;
-  for (auto it = begin; it != end; ++it) {
-    if (!has_neighbors(*it)) {
-      clear_insert_number(*it);
+  Groups result;
+  for (const auto& grp : groups()) {
+    // The parts of grp, by the index of their group in other.
+    std::vector<std::pair<size_t, Group>> parts;
+    for (const Value& val : grp) {
+      auto other_search = other.find(val);
+      if (!other_search) {
+        continue;
+      }
+      auto part = std::find_if(parts.begin(),
+                               parts.end(),
+                               [&](const std::pair<size_t, Group>& p) {
+                                 return p.first == other_search->first;
+                               });
+      if (part == parts.end()) {
+        parts.emplace_back(other_search->first, Group{val});
+      } else {
+        part->second.push_back(val);
+      }
+    }
+    for (auto& part : parts) {
+      if (part.second.size() > 1) {
+        // Assign new insertion order while taking into account both orders.
+        sort_by_insert_order(&part.second, other);
+        result.push_back(std::move(part.second));
+      }
     }
   }
 
-  // Assign new insertion numbers while taking into account both insertion maps.
-  for (auto& group : all_groups()) {
-    handle_insert_order_at_merge(group, other);
+  if (result.empty()) {
+    m_groups.reset();
+  } else {
+    m_groups = std::make_shared<Groups>(std::move(result));
   }
+  return AliasedRegisters::Kind::Value;
 }
 
-// Merge the ordering in other.m_insert_order into this->m_insert_order.
+// Merge the ordering of the groups of other into the ordering of this.
 //
-// When both graphs know about an edge (and they don't agree about insertion
+// When both states know about an edge (and they don't agree about insertion
 // order), use register number.
-// When only one graph knows about an edge, use insertion order from that graph.
-// When neither graph knows about the edge, use register number.
+// When only one state knows about an edge, use insertion order from that state.
+// When neither state knows about the edge, use register number.
 // This function can be used (carefully) for both union and intersection.
-void AliasedRegisters::handle_insert_order_at_merge(
-    const std::vector<vertex_t>& group, const AliasedRegisters& other) {
-  renumber_insert_order(group, [this, &other](vertex_t a, vertex_t b) {
-    // return true if a occurs before b.
-    // return false if they compare equal or if b occurs before a.
-
-    // `a` and `b` only index into this, not other.
-    const Value& val_a = this->m_graph[a];
-    const Value& val_b = this->m_graph[b];
-    auto other_a = other.find(val_a);
-    auto other_b = other.find(val_b);
-
-    bool this_has_edge = this->are_adjacent(a, b);
-    bool other_has_edge = other.are_aliases(val_a, val_b);
-
-    if (this_has_edge && other_has_edge) {
-      // Intersection case should always come here
-      bool this_less_than =
-          this->m_insert_order.at(a) < this->m_insert_order.at(b);
-
-      bool other_less_than =
-          other.m_insert_order.at(*other_a) < other.m_insert_order.at(*other_b);
-
-      if (this_less_than == other_less_than) {
-        // The graphs agree on the order of these two vertices.
-        // Preserve that order.
-        return this_less_than;
-      } else {
-        // The graphs do not agree. Choose a deterministic order
-        return val_a.reg() < val_b.reg();
-      }
-    } else if (this_has_edge) {
-      return this->m_insert_order.at(a) < this->m_insert_order.at(b);
-    } else if (other_has_edge) {
-      return other.m_insert_order.at(*other_a) <
-             other.m_insert_order.at(*other_b);
+void AliasedRegisters::sort_by_insert_order(
+    Group* group, const AliasedRegisters& other) const {
+  // Look up each register once in both states. Non registers have no
+  // insertion order; move them to the end.
+  struct Member {
+    Value val;
+    boost::optional<std::pair<size_t, size_t>> in_this;
+    boost::optional<std::pair<size_t, size_t>> in_other;
+  };
+  std::vector<Member> registers;
+  Group others;
+  for (const Value& val : *group) {
+    if (val.is_register()) {
+      registers.push_back(Member{val, find(val), other.find(val)});
     } else {
-      return val_a.reg() < val_b.reg();
+      others.push_back(val);
     }
-  });
-}
-
-// Rewrite the insertion number of all registers in `group` in an order defined
-// by less_than
-void AliasedRegisters::renumber_insert_order(
-    std::vector<vertex_t> group,
-    const std::function<bool(vertex_t, vertex_t)>& less_than) {
-
-  // Filter out non registers.
-  group.erase(
-      std::remove_if(group.begin(),
-                     group.end(),
-                     [this](vertex_t v) { return !m_graph[v].is_register(); }),
-      group.end());
-
-  // Assign new insertion numbers based on sorting.
-  std::sort(group.begin(), group.end(), less_than);
-  size_t i = 0;
-  for (vertex_t v : group) {
-    this->m_insert_order[v] = i;
-    ++i;
   }
-}
 
-// return all groups (not including singletons)
-std::vector<std::vector<AliasedRegisters::vertex_t>>
-AliasedRegisters::all_groups() {
-  std::vector<std::vector<vertex_t>> result;
-  std::unordered_set<vertex_t> visited;
-
-  const auto& iters = boost::vertices(this->m_graph);
-  const auto& begin = iters.first;
-  const auto& end = iters.second;
-  for (auto it = begin; it != end; ++it) {
-    if (visited.count(*it) == 0) {
-      const auto& group = vertices_in_group(*it);
-      for (vertex_t v : group) {
-        visited.insert(v);
-      }
-      if (group.size() > 1) {
-        result.emplace_back(std::move(group));
-      }
-    }
+  auto same_group = [](const boost::optional<std::pair<size_t, size_t>>& a,
+                       const boost::optional<std::pair<size_t, size_t>>& b) {
+    return a && b && a->first == b->first;
+  };
+  std::sort(registers.begin(),
+            registers.end(),
+            [&same_group](const Member& a, const Member& b) {
+              // return true if a occurs before b.
+              // return false if they compare equal or if b occurs before a.
+              bool this_has_edge = same_group(a.in_this, b.in_this);
+              bool other_has_edge = same_group(a.in_other, b.in_other);
+
+              if (this_has_edge && other_has_edge) {
+                // Intersection case should always come here
+                bool this_less_than = a.in_this->second < b.in_this->second;
+                bool other_less_than = a.in_other->second < b.in_other->second;
+                if (this_less_than == other_less_than) {
+                  // The states agree on the order of these two registers.
+                  // Preserve that order.
+                  return this_less_than;
+                } else {
+                  // The states do not agree. Choose a deterministic order
+                  return a.val.reg() < b.val.reg();
+                }
+              } else if (this_has_edge) {
+                return a.in_this->second < b.in_this->second;
+              } else if (other_has_edge) {
+                return a.in_other->second < b.in_other->second;
+              } else {
+                return a.val.reg() < b.val.reg();
+              }
+            });
+
+  group->clear();
+  for (const auto& member : registers) {
+    group->push_back(member.val);
   }
-  return result;
+  group->insert(group->end(), others.begin(), others.end());
 }
 } // namespace aliased_registers
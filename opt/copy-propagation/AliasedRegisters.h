@@ -9,17 +9,12 @@
 
 #pragma once
 
-#ifdef __GNUC__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wshadow"
-#endif
-#include <boost/graph/adjacency_list.hpp>
-#ifdef __GNUC__
-#pragma GCC diagnostic pop
-#endif
+#include <boost/container/small_vector.hpp>
 #include <boost/optional.hpp>
-#include <boost/range/iterator_range.hpp>
 #include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "AbstractDomain.h"
 #include "DexClass.h"
@@ -181,63 +176,38 @@ class AliasedRegisters final : public AbstractValue<AliasedRegisters> {
   Kind narrow_with(const AliasedRegisters& other) override;
 
  private:
-  // An undirected graph where register values are vertices
-  // and an edge means they are aliased.
-  // Using a set for the edge container makes sure we can't have parallel edges
-  using Graph = boost::adjacency_list<boost::setS, // out edge container
-                                      boost::vecS, // vertex container
-                                      boost::undirectedS, // undirected graph
-                                      Value>; // node property
-  using vertex_t = boost::graph_traits<Graph>::vertex_descriptor;
-  Graph m_graph;
-
-  // For keeping track of the oldest representative.
+  // The members of an alias group. The registers are ordered from the oldest
+  // to the newest member of the group, which is what we use to choose the
+  // representative. The other values can't be representatives and their
+  // position is meaningless.
+  using Group = boost::container::small_vector<Value, 4>;
+  using Groups = std::vector<Group>;
+
+  // Every group has at least two members: values that aren't aliased to
+  // anything aren't stored.
   //
-  // When adding a vertex to a group, it gets 1 + the max insertion number of
-  // the group. When choosing a representative, we prefer lower insertion
-  // numbers. Vertices in a group are guaranteed to have an entry in this map.
-  // Do not query this map if the vertex is not in a group.
-  //
-  // We only track the insertion for registers because they're the only type
-  // that could be chosen as a representative.
-  using InsertionOrder = std::unordered_map<vertex_t, size_t>;
-  InsertionOrder m_insert_order;
-
-  const boost::range_detail::integer_iterator<vertex_t> find(
-      const Value& r) const;
+  // The groups are shared between the copies of a state, e.g. the entry and
+  // exit states of the blocks, and only copied when one of them is modified.
+  std::shared_ptr<Groups> m_groups;
 
-  vertex_t find_or_create(const Value& r);
+  const Groups& groups() const;
+  Groups& mutable_groups();
 
-  bool has_edge_between(const Value& r1, const Value& r2) const;
-  bool are_adjacent(vertex_t v1, vertex_t v2) const;
+  // Return the index of the group of `r` and the position of `r` in it, or
+  // none if `r` isn't aliased to anything.
+  boost::optional<std::pair<size_t, size_t>> find(const Value& r) const;
 
-  // return a vector of all vertices in v's alias group (including v itself)
-  std::vector<vertex_t> vertices_in_group(vertex_t v) const;
+  // The number of pairs of aliased values.
+  size_t num_edges() const;
 
   // merge r1's group with r2. This operation is symmetric
   void merge_groups_of(const Value& r1,
                        const Value& r2,
                        const AliasedRegisters& other);
 
-  // return all groups (not including singletons)
-  std::vector<std::vector<vertex_t>> all_groups();
-
-  void track_insert_order(const Value& moving,
-                          vertex_t v_moving,
-                          const Value& group,
-                          vertex_t v_group,
-                          const std::vector<vertex_t>& grp);
-  void clear_insert_number(vertex_t v);
-  void handle_edge_intersection_insert_order(const AliasedRegisters& other);
-  void handle_insert_order_at_merge(const std::vector<vertex_t>& group,
-                                    const AliasedRegisters& other);
-
-  void renumber_insert_order(
-      std::vector<vertex_t> group,
-      const std::function<bool(vertex_t, vertex_t)>& less_than);
-
-  // return true if v has any neighboring vertices
-  bool has_neighbors(vertex_t v);
+  // Reorder the registers of `group`, which is the union or the intersection
+  // of groups of this and `other`, by taking both orders into account.
+  void sort_by_insert_order(Group* group, const AliasedRegisters& other) const;
 };
 
 class AliasDomain
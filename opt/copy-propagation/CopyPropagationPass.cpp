@@ -375,20 +375,18 @@ Stats Stats::operator+(const Stats& other) {
                replaced_sources + other.replaced_sources};
 }
 
+Stats& Stats::operator+=(const Stats& other) {
+  moves_eliminated += other.moves_eliminated;
+  replaced_sources += other.replaced_sources;
+  return *this;
+}
+
 Stats CopyPropagation::run(Scope scope) {
-  using Data = std::nullptr_t;
-  using Output = Stats;
-  return walk::parallel::reduce_methods<Data, Output>(
+  return walk::parallel::reduce_code<Stats>(
       scope,
-      [this](Data&, DexMethod* m) {
-        IRCode* code = m->get_code();
-        if (code == nullptr) {
-          return Stats();
-        }
-
-        const std::string& before_code =
-            m_config.debug ? show(m->get_code()) : "";
-        const auto& result = run(code);
+      [this](Stats& stats, DexMethod* m, IRCode& code) {
+        const std::string& before_code = m_config.debug ? show(&code) : "";
+        stats += run(&code);
 
         if (m_config.debug) {
           // Run the IR type checker
@@ -406,11 +404,8 @@ Stats CopyPropagation::run(Scope scope) {
             always_assert(false);
           }
         }
-        return result;
       },
-      [](Output a, Output b) { return a + b; },
-      [](unsigned int /* thread_index */) { return nullptr; },
-      Output(),
+      walk::parallel::kDefaultGrainSize,
       m_config.debug ? 1 : walk::parallel::default_num_threads());
 }
 
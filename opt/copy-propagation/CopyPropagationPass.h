@@ -17,6 +17,10 @@ class CopyPropagationPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual bool is_method_local() const override { return true; }
+
   virtual void configure_pass(const PassConfig& pc) override {
 
     // This option can only be safely enabled in verify-none. `run_pass` will
@@ -70,6 +74,7 @@ struct Stats {
       : moves_eliminated(elim), replaced_sources(replaced) {}
 
   Stats operator+(const Stats& other);
+  Stats& operator+=(const Stats& other);
 };
 
 class CopyPropagation final {
@@ -0,0 +1,400 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "CommonSubexpressionElimination.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
+
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "PassManager.h"
+#include "Resolver.h"
+#include "SSA.h"
+#include "ScopeView.h"
+#include "Walkers.h"
+
+namespace {
+
+using ssa::ValueId;
+
+/*
+ * What an instruction computes: its opcode, its type, field or method, its
+ * literal, and the value numbers of its operands.
+ */
+struct Expression {
+  IROpcode opcode;
+  const void* ref;
+  int64_t literal;
+  std::vector<ValueId> srcs;
+
+  bool operator==(const Expression& that) const {
+    return opcode == that.opcode && ref == that.ref &&
+           literal == that.literal && srcs == that.srcs;
+  }
+};
+
+struct ExpressionHash {
+  size_t operator()(const Expression& e) const {
+    size_t seed = boost::hash<int>()(e.opcode);
+    boost::hash_combine(seed, e.ref);
+    boost::hash_combine(seed, e.literal);
+    boost::hash_range(seed, e.srcs.begin(), e.srcs.end());
+    return seed;
+  }
+};
+
+bool is_commutative(IROpcode op) {
+  switch (op) {
+  case OPCODE_ADD_INT:
+  case OPCODE_MUL_INT:
+  case OPCODE_AND_INT:
+  case OPCODE_OR_INT:
+  case OPCODE_XOR_INT:
+  case OPCODE_ADD_LONG:
+  case OPCODE_MUL_LONG:
+  case OPCODE_AND_LONG:
+  case OPCODE_OR_LONG:
+  case OPCODE_XOR_LONG:
+    return true;
+  default:
+    return false;
+  }
+}
+
+IROpcode move_opcode(const IRInstruction* insn) {
+  if (insn->dest_is_wide()) {
+    return OPCODE_MOVE_WIDE;
+  }
+  return opcode_impl::dest_is_object(insn->opcode()) ? OPCODE_MOVE_OBJECT
+                                                     : OPCODE_MOVE;
+}
+
+bool is_move_result_any(IROpcode op) {
+  return is_move_result(op) || opcode::is_move_result_pseudo(op);
+}
+
+bool has_throw_succ(Block* b) {
+  for (const auto& succ : b->succs()) {
+    if (succ->type() == EDGE_THROW) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * An instruction that recomputes the result of an instruction that dominates
+ * it. The primary instruction computes the value and the result one writes
+ * it; they are different for the instructions with a move-result(-pseudo).
+ */
+struct Rewrite {
+  IRInstruction* primary;
+  IRInstruction* result;
+  IRInstruction* source;
+};
+
+} // namespace
+
+namespace cse_impl {
+
+Stats Stats::operator+(const Stats& other) const {
+  return Stats{instructions_eliminated + other.instructions_eliminated,
+               field_loads_eliminated + other.field_loads_eliminated,
+               getter_calls_eliminated + other.getter_calls_eliminated};
+}
+
+bool CommonSubexpressionElimination::is_candidate(
+    const DexMethod* method, const IRInstruction* insn) const {
+  auto op = insn->opcode();
+  // The unary, binary and literal arithmetic opcodes are contiguous. The
+  // divisions are included: an earlier one that didn't throw has already
+  // checked the divisor.
+  if (op >= OPCODE_NEG_INT && op <= OPCODE_USHR_INT_LIT8) {
+    return true;
+  }
+  switch (op) {
+  case OPCODE_CMPL_FLOAT:
+  case OPCODE_CMPG_FLOAT:
+  case OPCODE_CMPL_DOUBLE:
+  case OPCODE_CMPG_DOUBLE:
+  case OPCODE_CMP_LONG:
+  case OPCODE_CONST_CLASS:
+  case OPCODE_ARRAY_LENGTH:
+    return true;
+  case OPCODE_IGET:
+  case OPCODE_IGET_WIDE:
+  case OPCODE_IGET_OBJECT:
+  case OPCODE_IGET_BOOLEAN:
+  case OPCODE_IGET_BYTE:
+  case OPCODE_IGET_CHAR:
+  case OPCODE_IGET_SHORT:
+  case OPCODE_SGET:
+  case OPCODE_SGET_WIDE:
+  case OPCODE_SGET_OBJECT:
+  case OPCODE_SGET_BOOLEAN:
+  case OPCODE_SGET_BYTE:
+  case OPCODE_SGET_CHAR:
+  case OPCODE_SGET_SHORT: {
+    if (!m_config.final_field_loads) {
+      return false;
+    }
+    bool is_static = is_sget(op);
+    auto field = resolve_field(insn->get_field(),
+                               is_static ? FieldSearch::Static
+                                         : FieldSearch::Instance);
+    if (field == nullptr || !field->is_concrete() || !is_final(field)) {
+      return false;
+    }
+    // The initializers of the class write its final fields.
+    return method->get_class() != field->get_class() ||
+           (is_static ? !is_clinit(method) : !is_init(method));
+  }
+  case OPCODE_INVOKE_VIRTUAL:
+  case OPCODE_INVOKE_INTERFACE:
+    return insn->srcs_size() == 1 &&
+           m_config.immutable_getters.count(insn->get_method());
+  default:
+    return false;
+  }
+}
+
+Stats CommonSubexpressionElimination::run(DexMethod* method) {
+  Stats stats;
+  auto code = method->get_code();
+  if (code == nullptr) {
+    return stats;
+  }
+  code->build_cfg();
+  auto& cfg = code->cfg();
+  ssa::SSAForm ssa(cfg);
+  const auto& dominators = ssa.dominators();
+
+  // The value number of each SSA value: the first value that is known to be
+  // equal to it.
+  std::vector<ValueId> numbers(ssa.num_values());
+  std::iota(numbers.begin(), numbers.end(), 0);
+
+  std::unordered_map<Expression, IRInstruction*, ExpressionHash> available;
+  std::vector<Rewrite> rewrites;
+
+  struct Frame {
+    Block* block;
+    size_t next_child;
+    // The expressions that the block made available to the blocks it
+    // dominates.
+    std::vector<Expression> added;
+  };
+  std::vector<Frame> frames;
+  if (!dominators.reverse_postorder().empty()) {
+    frames.push_back(Frame{dominators.reverse_postorder().front(), 0, {}});
+  }
+  bool entering = true;
+  while (!frames.empty()) {
+    auto& frame = frames.back();
+    auto* b = frame.block;
+    if (entering) {
+      // If the block can throw to a handler, its last instruction may not
+      // have run in the blocks that it dominates.
+      IRInstruction* last_throwing = nullptr;
+      if (has_throw_succ(b)) {
+        for (auto it = b->rbegin(); it != b->rend(); ++it) {
+          if (it->type == MFLOW_OPCODE) {
+            last_throwing = it->insn;
+            break;
+          }
+        }
+      }
+      for (auto it = b->begin(); it != b->end(); ++it) {
+        if (it->type != MFLOW_OPCODE) {
+          continue;
+        }
+        auto result = it->insn;
+        if (!result->dests_size()) {
+          continue;
+        }
+        auto op = result->opcode();
+        if (is_move(op)) {
+          numbers[ssa.def(result)] = numbers[ssa.use(result, 0)];
+          continue;
+        }
+        auto primary = result;
+        if (is_move_result_any(op)) {
+          auto prev = it;
+          do {
+            --prev;
+          } while (prev->type != MFLOW_OPCODE);
+          primary = prev->insn;
+        }
+        if (!is_candidate(method, primary)) {
+          continue;
+        }
+        Expression e{primary->opcode(), nullptr, 0, {}};
+        if (primary->has_type()) {
+          e.ref = primary->get_type();
+        } else if (primary->has_field()) {
+          e.ref = primary->get_field();
+        } else if (primary->has_method()) {
+          e.ref = primary->get_method();
+        }
+        if (primary->has_literal()) {
+          e.literal = primary->get_literal();
+        }
+        bool defined = true;
+        for (size_t i = 0; i < primary->srcs_size(); ++i) {
+          auto v = numbers[ssa.use(primary, i)];
+          defined &= v != ssa::UNDEFINED;
+          e.srcs.push_back(v);
+        }
+        if (!defined) {
+          continue;
+        }
+        if (is_commutative(e.opcode)) {
+          std::sort(e.srcs.begin(), e.srcs.end());
+        }
+        auto found = available.find(e);
+        if (found != available.end()) {
+          auto source = found->second;
+          rewrites.push_back(Rewrite{primary, result, source});
+          numbers[ssa.def(result)] = numbers[ssa.def(source)];
+        } else if (result != last_throwing) {
+          available.emplace(e, result);
+          frame.added.push_back(std::move(e));
+        }
+      }
+    }
+    const auto& children = dominators.children(b);
+    if (frame.next_child < children.size()) {
+      auto* child = children[frame.next_child++];
+      frames.push_back(Frame{child, 0, {}});
+      entering = true;
+      continue;
+    }
+    for (const auto& e : frame.added) {
+      available.erase(e);
+    }
+    frames.pop_back();
+    entering = false;
+  }
+  if (rewrites.empty()) {
+    return stats;
+  }
+
+  // The register of a source still holds its result at the rewrites if
+  // nothing else writes it. Otherwise copy the result to a new register.
+  std::unordered_map<uint16_t, size_t> writes;
+  for (const auto& mie : InstructionIterable(code)) {
+    if (mie.insn->dests_size()) {
+      auto reg = mie.insn->dest();
+      ++writes[reg];
+      if (mie.insn->dest_is_wide()) {
+        ++writes[reg + 1];
+      }
+    }
+  }
+  std::unordered_map<const IRInstruction*, uint16_t> source_regs;
+  std::unordered_map<const IRInstruction*, uint16_t> copies;
+  std::unordered_map<const IRInstruction*, const Rewrite*> by_primary;
+  for (const auto& rewrite : rewrites) {
+    by_primary.emplace(rewrite.primary, &rewrite);
+    auto source = rewrite.source;
+    if (source_regs.count(source)) {
+      continue;
+    }
+    auto reg = source->dest();
+    bool wide = source->dest_is_wide();
+    if (writes.at(reg) == 1 && (!wide || writes.at(reg + 1) == 1)) {
+      source_regs.emplace(source, reg);
+      continue;
+    }
+    auto temp = code->allocate_temp();
+    if (wide) {
+      code->allocate_temp();
+    }
+    source_regs.emplace(source, temp);
+    copies.emplace(source, temp);
+  }
+
+  for (auto it = code->begin(); it != code->end(); ++it) {
+    if (it->type != MFLOW_OPCODE) {
+      continue;
+    }
+    auto insn = it->insn;
+    auto copy = copies.find(insn);
+    if (copy != copies.end()) {
+      auto move = new IRInstruction(move_opcode(insn));
+      move->set_dest(copy->second)->set_src(0, insn->dest());
+      it = code->insert_after(it, move);
+      continue;
+    }
+    auto found = by_primary.find(insn);
+    if (found == by_primary.end()) {
+      continue;
+    }
+    const auto& rewrite = *found->second;
+    auto result = rewrite.result;
+    auto move = new IRInstruction(move_opcode(result));
+    move->set_dest(result->dest())
+        ->set_src(0, source_regs.at(rewrite.source));
+    code->insert_before(it, move);
+    ++stats.instructions_eliminated;
+    if (insn->has_field()) {
+      ++stats.field_loads_eliminated;
+    } else if (insn->has_method()) {
+      ++stats.getter_calls_eliminated;
+    }
+    if (insn->has_method()) {
+      auto result_it = std::next(it);
+      while (result_it->type != MFLOW_OPCODE) {
+        ++result_it;
+      }
+      always_assert(result_it->insn == result);
+      code->remove_opcode(result_it);
+    }
+    // Also removes the move-result-pseudo, if any.
+    code->remove_opcode(it);
+  }
+  return stats;
+}
+
+Stats CommonSubexpressionElimination::run(const Scope& scope) {
+  using Data = std::nullptr_t;
+  using Output = Stats;
+  return walk::parallel::reduce_methods<Data, Output>(
+      scope,
+      [this](Data&, DexMethod* m) { return run(m); },
+      [](Output a, Output b) { return a + b; },
+      [](unsigned int /* thread_index */) { return nullptr; });
+}
+
+} // namespace cse_impl
+
+void CommonSubexpressionEliminationPass::run_pass(DexStoresVector&,
+                                                  ConfigFiles&,
+                                                  PassManager& mgr) {
+  auto scope = mgr.get_scope_view().get();
+  cse_impl::CommonSubexpressionElimination impl(m_config);
+  auto stats = impl.run(*scope);
+  mgr.incr_metric("instructions_eliminated", stats.instructions_eliminated);
+  mgr.incr_metric("field_loads_eliminated", stats.field_loads_eliminated);
+  mgr.incr_metric("getter_calls_eliminated", stats.getter_calls_eliminated);
+  TRACE(CSE,
+        1,
+        "%d instructions eliminated, %d field loads, %d getter calls\n",
+        stats.instructions_eliminated,
+        stats.field_loads_eliminated,
+        stats.getter_calls_eliminated);
+}
+
+static CommonSubexpressionEliminationPass s_pass;
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <unordered_set>
+
+#include "Pass.h"
+
+/*
+ * Removes the instructions that recompute a value which an instruction that
+ * dominates them already computed. The values are numbered on the SSA view of
+ * the CFG while walking its dominator tree, so that
+ *
+ *   iget v1, v0, LFoo;.bar:I   // bar is final
+ *   ...
+ *   if-eqz v2, :else
+ *   iget v3, v0, LFoo;.bar:I
+ *   add-int v4, v3, v3
+ *
+ * becomes
+ *
+ *   iget v1, v0, LFoo;.bar:I
+ *   ...
+ *   if-eqz v2, :else
+ *   move v3, v1
+ *   add-int v4, v3, v3
+ *
+ * and a later `add-int v5, v1, v1` becomes a move from v4. The candidates are
+ * the instructions whose result only depends on their operands: arithmetic,
+ * comparisons, conversions, const-class and array-length; the loads of final
+ * fields, outside of the initializers that write them; and, as in
+ * ImmutableSubcomponentAnalyzer, the calls of the getters of immutable
+ * objects that the config lists. When the register of the first result is
+ * written again, it is copied to a new temporary; RegAllocPass is expected to
+ * coalesce the moves away.
+ */
+class CommonSubexpressionEliminationPass : public Pass {
+ public:
+  CommonSubexpressionEliminationPass()
+      : Pass("CommonSubexpressionEliminationPass") {}
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+
+  virtual void configure_pass(const PassConfig& pc) override {
+    std::vector<std::string> getter_names;
+    pc.get("immutable_getters", {}, getter_names);
+    for (const auto& name : getter_names) {
+      auto meth = DexMethod::get_method(name);
+      if (meth == nullptr) continue;
+      m_config.immutable_getters.emplace(meth);
+    }
+    pc.get("final_field_loads", true, m_config.final_field_loads);
+  }
+
+  struct Config {
+    // Instance methods without arguments that return the same value whenever
+    // they are called on the same object.
+    std::unordered_set<DexMethodRef*> immutable_getters;
+    bool final_field_loads{true};
+  } m_config;
+};
+
+namespace cse_impl {
+
+struct Stats {
+  size_t instructions_eliminated{0};
+  size_t field_loads_eliminated{0};
+  size_t getter_calls_eliminated{0};
+
+  Stats operator+(const Stats& other) const;
+};
+
+class CommonSubexpressionElimination final {
+ public:
+  explicit CommonSubexpressionElimination(
+      const CommonSubexpressionEliminationPass::Config& config)
+      : m_config(config) {}
+
+  Stats run(const Scope& scope);
+
+  Stats run(DexMethod* method);
+
+ private:
+  bool is_candidate(const DexMethod* method, const IRInstruction* insn) const;
+
+  const CommonSubexpressionEliminationPass::Config& m_config;
+};
+
+} // namespace cse_impl
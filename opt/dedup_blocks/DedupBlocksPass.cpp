@@ -38,17 +38,25 @@ namespace {
 
 using hash_t = std::size_t;
 
+// Hashes the code of a block, but not where its branches go.
+hash_t code_fingerprint(Block* block) {
+  return InstructionIterable(block).structural_hash();
+}
+
 struct BlockAsKey {
   IRCode* code;
   Block* block;
+  // Computed once, so that hashing is cheap and so that most blocks that
+  // differ never get to the full comparison.
+  hash_t fingerprint;
 
-  BlockAsKey(IRCode* c, Block* b) : code(c), block(b) {}
+  BlockAsKey(IRCode* c, Block* b)
+      : code(c), block(b), fingerprint(code_fingerprint(b)) {}
 
   bool operator==(const BlockAsKey& other) const {
-    return same_successors(other) && same_try_regions(other) &&
-           same_code(other);
+    return fingerprint == other.fingerprint && same_successors(other) &&
+           same_try_regions(other) && same_code(other);
   }
-
   // Structural equality of opcodes except branch targets are ignored
   // because they are unknown until we sync back to DexInstructions.
   bool same_code(const BlockAsKey& other) const {
@@ -89,12 +97,28 @@ struct BlockAsKey {
 };
 
 struct BlockHasher {
-  hash_t operator()(const BlockAsKey& key) const {
-    hash_t result = 0;
-    for (auto& mie : InstructionIterable(key.block)) {
-      result ^= mie.insn->hash();
-    }
-    return result;
+  hash_t operator()(const BlockAsKey& key) const { return key.fingerprint; }
+};
+
+// Only the code of a block, for comparing blocks of different methods, where
+// successors and try regions can't be the same.
+struct BlockCodeAsKey {
+  Block* block;
+  hash_t fingerprint;
+
+  explicit BlockCodeAsKey(Block* b)
+      : block(b), fingerprint(code_fingerprint(b)) {}
+
+  bool operator==(const BlockCodeAsKey& other) const {
+    return fingerprint == other.fingerprint &&
+           InstructionIterable(block).structural_equals(
+               InstructionIterable(other.block));
+  }
+};
+
+struct BlockCodeHasher {
+  hash_t operator()(const BlockCodeAsKey& key) const {
+    return key.fingerprint;
   }
 };
 
@@ -118,6 +142,10 @@ class DedupBlocksImpl {
         deduplicate(dups, method);
       }
     });
+    if (m_config.report_cross_method_dups) {
+      walk::parallel::classes(
+          m_scope, [this](DexClass* cls) { count_cross_method_dups(cls); });
+    }
     report_stats();
   }
 
@@ -126,6 +154,11 @@ class DedupBlocksImpl {
       std::unordered_map<BlockAsKey, std::unordered_set<Block*>, BlockHasher>;
   const char* METRIC_BLOCKS_REMOVED = "blocks_removed";
   const char* METRIC_ELIGIBLE_BLOCKS = "eligible_blocks";
+  const char* METRIC_CROSS_METHOD_BLOCKS = "cross_method_dup_blocks";
+  const char* METRIC_CROSS_METHOD_INSNS = "cross_method_dup_insns";
+  const char* METRIC_CROSS_METHOD_TAILS = "cross_method_dup_tails";
+  // Smaller blocks wouldn't get any smaller by calling a shared copy.
+  static constexpr size_t kMinSharedBlockSize = 3;
   const std::vector<DexClass*>& m_scope;
   PassManager& m_mgr;
   const DedupBlocksPass::Config& m_config;
@@ -134,6 +167,9 @@ class DedupBlocksImpl {
   std::mutex lock;
   std::atomic_int m_num_eligible_blocks{0};
   std::atomic_int m_num_blocks_removed{0};
+  std::atomic_int m_num_cross_method_blocks{0};
+  std::atomic_int m_num_cross_method_insns{0};
+  std::atomic_int m_num_cross_method_tails{0};
   // map from block size to number of blocks with that size
   std::unordered_map<size_t, size_t> m_dup_sizes;
 
@@ -153,6 +189,56 @@ class DedupBlocksImpl {
     return duplicates;
   }
 
+  /*
+   * Find blocks that more than one method of the class has an exact copy of.
+   * These can't be merged within a method, but they could be moved out to a
+   * method the copies share. This only counts them, to tell how much that
+   * would save. Tails are blocks that return or throw, which can be moved out
+   * whole, with nothing after them to get back to.
+   */
+  void count_cross_method_dups(DexClass* cls) {
+    std::unordered_map<BlockCodeAsKey,
+                       std::vector<std::pair<DexMethod*, Block*>>,
+                       BlockCodeHasher>
+        copies;
+    auto add_blocks = [&](DexMethod* method) {
+      auto code = method->get_code();
+      if (code == nullptr || m_config.method_black_list.count(method) != 0) {
+        return;
+      }
+      code->build_cfg();
+      for (Block* block : code->cfg().blocks()) {
+        if (num_opcodes(block) >= kMinSharedBlockSize && !is_catch(block)) {
+          copies[BlockCodeAsKey{block}].emplace_back(method, block);
+        }
+      }
+    };
+    for (auto method : cls->get_dmethods()) {
+      add_blocks(method);
+    }
+    for (auto method : cls->get_vmethods()) {
+      add_blocks(method);
+    }
+
+    for (const auto& entry : copies) {
+      const auto& blocks = entry.second;
+      std::unordered_set<DexMethod*> methods;
+      for (const auto& pair : blocks) {
+        methods.insert(pair.first);
+      }
+      if (methods.size() < 2) {
+        continue;
+      }
+      // All but one of the copies are redundant.
+      auto extra = blocks.size() - 1;
+      m_num_cross_method_blocks += extra;
+      m_num_cross_method_insns += extra * num_opcodes(entry.first.block);
+      if (entry.first.block->succs().empty()) {
+        m_num_cross_method_tails += extra;
+      }
+    }
+  }
+
   // remove all but one of a duplicate set. Reroute the predecessors to the
   // canonical block
   void deduplicate(const duplicates_t& dups, DexMethod* method) {
@@ -313,6 +399,21 @@ class DedupBlocksImpl {
     }
 
     TRACE(DEDUP_BLOCKS, 1, "%d blocks removed\n", removed);
+
+    if (m_config.report_cross_method_dups) {
+      int blocks = m_num_cross_method_blocks.load();
+      int insns = m_num_cross_method_insns.load();
+      int tails = m_num_cross_method_tails.load();
+      m_mgr.incr_metric(METRIC_CROSS_METHOD_BLOCKS, blocks);
+      m_mgr.incr_metric(METRIC_CROSS_METHOD_INSNS, insns);
+      m_mgr.incr_metric(METRIC_CROSS_METHOD_TAILS, tails);
+      TRACE(DEDUP_BLOCKS,
+            1,
+            "%d blocks (%d instructions, %d tails) copied across methods\n",
+            blocks,
+            insns,
+            tails);
+    }
   }
 
   // remove sets with only one block
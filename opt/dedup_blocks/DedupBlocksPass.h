@@ -17,6 +17,9 @@ class DedupBlocksPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+
   virtual void configure_pass(const PassConfig& pc) override {
     std::vector<std::string> method_black_list_names;
     pc.get("method_black_list", {}, method_black_list_names);
@@ -25,9 +28,12 @@ class DedupBlocksPass : public Pass {
       if (meth == nullptr || !meth->is_def()) continue;
       m_config.method_black_list.emplace(static_cast<DexMethod*>(meth));
     }
+    pc.get("report_cross_method_dups", false, m_config.report_cross_method_dups);
   }
 
   struct Config {
     std::unordered_set<DexMethod*> method_black_list;
+    // Also count the blocks that several methods of a class have copies of.
+    bool report_cross_method_dups = false;
   } m_config;
 };
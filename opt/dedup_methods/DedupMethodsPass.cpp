@@ -0,0 +1,350 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "DedupMethodsPass.h"
+
+#include <atomic>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Deleter.h"
+#include "DexAccess.h"
+#include "DexClass.h"
+#include "DexStore.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "PassManager.h"
+#include "ReachableClasses.h"
+#include "Resolver.h"
+#include "Walkers.h"
+#include "WorkQueue.h"
+
+/*
+ * Generated lambdas, accessors and other boilerplate end up as many copies of
+ * the same method body spread over the app. This pass keeps one copy.
+ *
+ * Candidate methods are hashed in parallel with the fingerprint DedupBlocks
+ * uses for blocks. Methods with the same fingerprint, proto and store are then
+ * compared in full, also in parallel, to split them into groups of identical
+ * methods. The first method of a group in scope order is the canonical one;
+ * the invokes of the others are redirected to it and the others are deleted.
+ */
+
+namespace {
+
+using hash_t = std::size_t;
+
+/*
+ * Only positions and debug entries may differ between identical methods.
+ * Everything else is compared in order, with branch sources, try regions and
+ * catch chains compared by their position in that order.
+ */
+std::vector<const MethodItemEntry*> significant_entries(IRCode* code) {
+  std::vector<const MethodItemEntry*> entries;
+  for (const auto& mie : *code) {
+    if (mie.type == MFLOW_POSITION || mie.type == MFLOW_DEBUG ||
+        mie.type == MFLOW_FALLTHROUGH) {
+      continue;
+    }
+    entries.push_back(&mie);
+  }
+  return entries;
+}
+
+bool same_body(IRCode* code1, IRCode* code2) {
+  if (code1->get_registers_size() != code2->get_registers_size()) {
+    return false;
+  }
+  auto entries1 = significant_entries(code1);
+  auto entries2 = significant_entries(code2);
+  if (entries1.size() != entries2.size()) {
+    return false;
+  }
+  std::unordered_map<const MethodItemEntry*, size_t> index1;
+  std::unordered_map<const MethodItemEntry*, size_t> index2;
+  for (size_t i = 0; i < entries1.size(); ++i) {
+    index1[entries1[i]] = i;
+    index2[entries2[i]] = i;
+  }
+  auto same_entry = [&](const MethodItemEntry* mie1,
+                        const MethodItemEntry* mie2) {
+    if (mie1 == nullptr || mie2 == nullptr) {
+      return mie1 == mie2;
+    }
+    return index1.at(mie1) == index2.at(mie2);
+  };
+
+  for (size_t i = 0; i < entries1.size(); ++i) {
+    auto mie1 = entries1[i];
+    auto mie2 = entries2[i];
+    if (mie1->type != mie2->type) {
+      return false;
+    }
+    switch (mie1->type) {
+    case MFLOW_OPCODE:
+      if (*mie1->insn != *mie2->insn) {
+        return false;
+      }
+      break;
+    case MFLOW_TARGET:
+      if (mie1->target->type != mie2->target->type ||
+          (mie1->target->type == BRANCH_MULTI &&
+           mie1->target->index != mie2->target->index) ||
+          !same_entry(mie1->target->src, mie2->target->src)) {
+        return false;
+      }
+      break;
+    case MFLOW_TRY:
+      if (mie1->tentry->type != mie2->tentry->type ||
+          !same_entry(mie1->tentry->catch_start, mie2->tentry->catch_start)) {
+        return false;
+      }
+      break;
+    case MFLOW_CATCH:
+      if (mie1->centry->catch_type != mie2->centry->catch_type ||
+          !same_entry(mie1->centry->next, mie2->centry->next)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Calling a static method initializes its class. Only classes whose
+ * initialization has no side effects can be skipped or added that way.
+ */
+bool has_trivial_init(const DexClass* cls) {
+  while (cls != nullptr) {
+    if (cls->get_clinit() != nullptr) {
+      return false;
+    }
+    auto super = cls->get_super_class();
+    if (super == nullptr || super == get_object_type()) {
+      return true;
+    }
+    cls = type_class_internal(super);
+  }
+  // The hierarchy leaves the app, so its initialization is unknown.
+  return false;
+}
+
+class DedupMethodsImpl {
+ public:
+  DedupMethodsImpl(Scope& scope,
+                   const DexStoresVector& stores,
+                   const DedupMethodsPass::Config& config)
+      : m_scope(scope), m_xstores(stores), m_config(config) {}
+
+  void run() {
+    gather_candidates();
+    find_duplicates();
+    redirect_callers();
+    m_deleted = delete_methods(m_scope, m_removable);
+  }
+
+  size_t candidates() const { return m_candidates.size(); }
+  size_t redirected() const { return m_canonical.size(); }
+  size_t invokes_rewritten() const { return m_invokes_rewritten; }
+  size_t deleted() const { return m_deleted; }
+
+ private:
+  Scope& m_scope;
+  XStoreRefs m_xstores;
+  const DedupMethodsPass::Config& m_config;
+
+  // In scope order.
+  std::vector<DexMethod*> m_candidates;
+  // Each redirected duplicate to its canonical copy.
+  std::unordered_map<DexMethod*, DexMethod*> m_canonical;
+  std::unordered_set<DexMethod*> m_removable;
+  size_t m_invokes_rewritten{0};
+  size_t m_deleted{0};
+
+  bool is_candidate(DexMethod* method) {
+    auto code = method->get_code();
+    if (code == nullptr || method->is_virtual() || is_constructor(method) ||
+        is_native(method) || is_synchronized(method) || !can_delete(method)) {
+      return false;
+    }
+    if (code->count_opcodes() < static_cast<size_t>(m_config.min_method_size)) {
+      return false;
+    }
+    if (!is_static(method)) {
+      // Only merged with the private methods of the same class.
+      return true;
+    }
+    // Private static methods are only called from their own class, which is
+    // initialized by then.
+    auto cls = type_class(method->get_class());
+    return is_private(method) || has_trivial_init(cls);
+  }
+
+  void gather_candidates() {
+    for (auto cls : m_scope) {
+      if (is_interface(cls) || cls->is_external()) {
+        continue;
+      }
+      for (auto method : cls->get_dmethods()) {
+        if (is_candidate(method)) {
+          m_candidates.push_back(method);
+        }
+      }
+    }
+    TRACE(DEDUP_METHODS, 2, "%lu candidate methods\n", m_candidates.size());
+  }
+
+  void find_duplicates() {
+    std::vector<hash_t> fingerprints(m_candidates.size());
+    auto hash_wq = workqueue_foreach<size_t>([&](size_t i) {
+      fingerprints[i] =
+          InstructionIterable(m_candidates[i]->get_code()).structural_hash();
+    });
+    for (size_t i = 0; i < m_candidates.size(); ++i) {
+      hash_wq.add_item(i, m_candidates[i]->get_code()->count_opcodes());
+    }
+    hash_wq.run_all();
+
+    // Methods that may be identical. Instance methods can only be merged
+    // within their class, and no method can move to another store.
+    using BucketKey = std::tuple<hash_t, DexProto*, bool, size_t, DexType*>;
+    std::map<BucketKey, size_t> bucket_index;
+    std::vector<std::vector<DexMethod*>> buckets;
+    for (size_t i = 0; i < m_candidates.size(); ++i) {
+      auto method = m_candidates[i];
+      auto owner = method->get_class();
+      BucketKey key{fingerprints[i],
+                    method->get_proto(),
+                    is_static(method),
+                    m_xstores.get_store_idx(owner),
+                    is_static(method) ? nullptr : owner};
+      auto it = bucket_index.find(key);
+      if (it == bucket_index.end()) {
+        it = bucket_index.emplace(key, buckets.size()).first;
+        buckets.emplace_back();
+      }
+      buckets[it->second].push_back(method);
+    }
+
+    // Split each bucket into groups of identical methods, in scope order.
+    std::vector<std::vector<std::vector<DexMethod*>>> groups(buckets.size());
+    auto group_wq = workqueue_foreach<size_t>([&](size_t b) {
+      for (auto method : buckets[b]) {
+        bool found = false;
+        for (auto& group : groups[b]) {
+          if (same_body(group.front()->get_code(), method->get_code())) {
+            group.push_back(method);
+            found = true;
+            break;
+          }
+        }
+        if (!found) {
+          groups[b].push_back({method});
+        }
+      }
+    });
+    for (size_t b = 0; b < buckets.size(); ++b) {
+      if (buckets[b].size() > 1) {
+        group_wq.add_item(b, buckets[b].size());
+      }
+    }
+    group_wq.run_all();
+
+    for (const auto& bucket_groups : groups) {
+      for (const auto& group : bucket_groups) {
+        if (group.size() > 1) {
+          merge_group(group);
+        }
+      }
+    }
+  }
+
+  void merge_group(const std::vector<DexMethod*>& group) {
+    DexMethod* canon = nullptr;
+    for (auto method : group) {
+      if (!is_static(method) ||
+          has_trivial_init(type_class(method->get_class()))) {
+        canon = method;
+        break;
+      }
+    }
+    if (canon == nullptr) {
+      return;
+    }
+    auto canon_cls = type_class(canon->get_class());
+    for (auto method : group) {
+      if (method == canon) {
+        continue;
+      }
+      TRACE(DEDUP_METHODS, 3, "%s => %s\n", SHOW(method), SHOW(canon));
+      m_canonical[method] = canon;
+      m_removable.insert(method);
+      if (method->get_class() != canon->get_class()) {
+        // The callers of the copies may live anywhere.
+        set_public(canon);
+        set_public(canon_cls);
+      }
+    }
+  }
+
+  void redirect_callers() {
+    if (m_canonical.empty()) {
+      return;
+    }
+    std::atomic<size_t> rewritten{0};
+    walk::parallel::opcodes(
+        m_scope,
+        [](DexMethod*) { return true; },
+        [&](DexMethod*, IRInstruction* insn) {
+          if (!is_invoke(insn->opcode())) {
+            return;
+          }
+          auto callee =
+              resolve_method(insn->get_method(), opcode_to_search(insn));
+          if (callee == nullptr) {
+            return;
+          }
+          auto it = m_canonical.find(callee);
+          if (it != m_canonical.end()) {
+            insn->set_method(it->second);
+            ++rewritten;
+          }
+        });
+    m_invokes_rewritten = rewritten;
+  }
+};
+
+} // namespace
+
+void DedupMethodsPass::run_pass(DexStoresVector& stores,
+                                ConfigFiles& /* unused */,
+                                PassManager& mgr) {
+  auto scope = build_class_scope(stores);
+  DedupMethodsImpl impl(scope, stores, m_config);
+  impl.run();
+
+  mgr.incr_metric("candidate_methods", impl.candidates());
+  mgr.incr_metric("duplicate_methods", impl.redirected());
+  mgr.incr_metric("invokes_rewritten", impl.invokes_rewritten());
+  mgr.incr_metric("methods_removed", impl.deleted());
+  TRACE(DEDUP_METHODS,
+        1,
+        "%lu duplicate methods, %lu invokes rewritten, %lu methods removed\n",
+        impl.redirected(),
+        impl.invokes_rewritten(),
+        impl.deleted());
+}
+
+static DedupMethodsPass s_pass;
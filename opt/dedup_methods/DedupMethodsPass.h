@@ -0,0 +1,38 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include "Pass.h"
+
+/**
+ * Finds direct methods whose code is identical across the whole app, points
+ * the callers of all copies to one canonical copy, and deletes the rest.
+ *
+ * Only methods that can be called by an exact reference get merged: static
+ * methods, and private methods of the same class. Virtual methods can be
+ * reached through overrides, so they are left alone.
+ */
+class DedupMethodsPass : public Pass {
+ public:
+  DedupMethodsPass() : Pass("DedupMethodsPass") {}
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+
+  virtual void configure_pass(const PassConfig& pc) override {
+    pc.get("min_method_size", 3, m_config.min_method_size);
+  }
+
+  struct Config {
+    // Methods with fewer instructions are not worth a lookup.
+    int64_t min_method_size = 3;
+  } m_config;
+};
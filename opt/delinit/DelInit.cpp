@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_set>
@@ -132,28 +133,43 @@ void find_referenced_classes(const Scope& scope) {
       }
     });
 
-  walk::code(
-    scope,
-    [](DexMethod*) { return true; },
-    [&](DexMethod* meth, IRCode& code) {
-      for (const auto& mie :
-           InstructionIterable(meth->get_code())) {
-        auto opcode = mie.insn;
-        // Matches any stringref that name-aliases a type.
-        if (opcode->has_string()) {
-          DexString* dsclzref = opcode->get_string();
-          DexType* dtexclude =
-            get_dextype_from_dotname(dsclzref->c_str());
-          if (dtexclude == nullptr) continue;
-          TRACE(PGR, 3, "string_ref: %s\n", SHOW(dtexclude));
-          referenced_classes.insert(type_class(dtexclude));
+  // String and type references are gathered per thread, then merged.
+  std::vector<std::unique_ptr<std::unordered_set<const DexClass*>>>
+      thread_classes;
+  walk::parallel::reduce_methods<std::unordered_set<const DexClass*>*,
+                                 std::nullptr_t>(
+      scope,
+      [](std::unordered_set<const DexClass*>*& classes, DexMethod* meth) {
+        auto code = meth->get_code();
+        if (code == nullptr) {
+          return nullptr;
         }
-        if (opcode->has_type()) {
-          TRACE(PGR, 3, "type_ref: %s\n", SHOW(opcode->get_type()));
-          referenced_classes.insert(type_class(opcode->get_type()));
+        for (const auto& mie : InstructionIterable(code)) {
+          auto opcode = mie.insn;
+          // Matches any stringref that name-aliases a type.
+          if (opcode->has_string()) {
+            DexString* dsclzref = opcode->get_string();
+            DexType* dtexclude = get_dextype_from_dotname(dsclzref->c_str());
+            if (dtexclude == nullptr) continue;
+            TRACE(PGR, 3, "string_ref: %s\n", SHOW(dtexclude));
+            classes->insert(type_class(dtexclude));
+          }
+          if (opcode->has_type()) {
+            TRACE(PGR, 3, "type_ref: %s\n", SHOW(opcode->get_type()));
+            classes->insert(type_class(opcode->get_type()));
+          }
         }
-      }
-    });
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int /*thread_index*/) {
+        thread_classes.emplace_back(
+            std::make_unique<std::unordered_set<const DexClass*>>());
+        return thread_classes.back().get();
+      });
+  for (const auto& classes : thread_classes) {
+    referenced_classes.insert(classes->begin(), classes->end());
+  }
 }
 
 bool can_remove(const DexClass* cls) {
@@ -389,32 +405,54 @@ void DeadRefs::collect_dmethods(Scope& scope) {
  */
 void DeadRefs::track_callers(Scope& scope) {
   called.clear();
-  walk::opcodes(scope,
-      [](DexMethod*) { return true; },
-      [&](DexMethod* m, IRInstruction* insn) {
-        if (insn->has_method()) {
-          auto callee =
-              resolve_method(insn->get_method(), opcode_to_search(insn));
-          if (callee == nullptr || !callee->is_concrete()) return;
-          if (vmethods.count(callee) > 0) {
-            vmethods.erase(callee);
-          }
-          called.insert(callee);
-          return;
+  // Each thread gathers the members its methods reference.
+  struct Refs {
+    MethodSet called;
+    FieldSet fields;
+  };
+  std::vector<std::unique_ptr<Refs>> thread_refs;
+  walk::parallel::reduce_methods<Refs*, std::nullptr_t>(
+      scope,
+      [](Refs*& refs, DexMethod* m) {
+        auto code = m->get_code();
+        if (code == nullptr) {
+          return nullptr;
         }
-        if (insn->has_field()) {
-          auto field = resolve_field(insn->get_field(),
-              is_ifield_op(insn->opcode()) ?
-                  FieldSearch::Instance :
-                  is_sfield_op(insn->opcode()) ?
-                      FieldSearch::Static : FieldSearch::Any);
-          if (field == nullptr || !field->is_concrete()) return;
-          if (ifields.count(field) > 0) {
-            ifields.erase(field);
+        for (const auto& mie : InstructionIterable(code)) {
+          auto insn = mie.insn;
+          if (insn->has_method()) {
+            auto callee =
+                resolve_method(insn->get_method(), opcode_to_search(insn));
+            if (callee == nullptr || !callee->is_concrete()) continue;
+            refs->called.insert(callee);
+            continue;
+          }
+          if (insn->has_field()) {
+            auto field = resolve_field(insn->get_field(),
+                is_ifield_op(insn->opcode()) ?
+                    FieldSearch::Instance :
+                    is_sfield_op(insn->opcode()) ?
+                        FieldSearch::Static : FieldSearch::Any);
+            if (field == nullptr || !field->is_concrete()) continue;
+            refs->fields.insert(field);
           }
-          return;
         }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int /*thread_index*/) {
+        thread_refs.emplace_back(std::make_unique<Refs>());
+        return thread_refs.back().get();
       });
+  for (const auto& refs : thread_refs) {
+    for (auto callee : refs->called) {
+      vmethods.erase(callee);
+      called.insert(callee);
+    }
+    for (auto field : refs->fields) {
+      ifields.erase(field);
+    }
+  }
   TRACE(DELINIT, 3,
       "Unreachable (not called) %ld vmethods and %ld ifields\n",
       vmethods.size(), ifields.size());
@@ -456,6 +494,7 @@ int DeadRefs::remove_unreachable() {
       SHOW(field->get_class()), SHOW(field->get_name()),
       SHOW(field->get_type()));
   }
+  RedexContext::advance_member_epoch();
   del_init_res.deleted_ifields += ifieldcnt;
   TRACE(DELINIT, 2, "Removed %d ifields\n", ifieldcnt);
 
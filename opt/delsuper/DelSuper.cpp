@@ -10,6 +10,7 @@
 #include "DelSuper.h"
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -19,6 +20,7 @@
 #include "IRInstruction.h"
 #include "DexUtil.h"
 #include "ReachableClasses.h"
+#include "WorkQueue.h"
 
 
 namespace {
@@ -52,20 +54,20 @@ private:
   const std::vector<DexClass*>& m_scope;
   // trivial return invoke super method -> invoked super method
   std::unordered_map<DexMethod*, DexMethod*> m_delmeths;
-  int m_num_methods;
+  std::atomic_int m_num_methods;
   int m_num_passed;
-  int m_num_trivial;
+  std::atomic_int m_num_trivial;
   int m_num_relaxed_vis;
   int m_num_cls_relaxed_vis;
-  int m_num_private;
-  int m_num_culled_no_code;
-  int m_num_culled_too_short;
-  int m_num_culled_not_trivial;
-  int m_num_culled_static;
-  int m_num_culled_name_differs;
-  int m_num_culled_proto_differs;
-  int m_num_culled_return_move_result_differs;
-  int m_num_culled_args_differs;
+  std::atomic_int m_num_private;
+  std::atomic_int m_num_culled_no_code;
+  std::atomic_int m_num_culled_too_short;
+  std::atomic_int m_num_culled_not_trivial;
+  std::atomic_int m_num_culled_static;
+  std::atomic_int m_num_culled_name_differs;
+  std::atomic_int m_num_culled_proto_differs;
+  std::atomic_int m_num_culled_return_move_result_differs;
+  std::atomic_int m_num_culled_args_differs;
   int m_num_culled_super_is_non_public_sdk;
   int m_num_culled_super_cls_non_public;
   int m_num_culled_super_not_def;
@@ -142,10 +144,10 @@ private:
    * - Method return src register must match move-result dest register
    * - Method args must all go into invoke without rearrangement
    *
-   * Returns the super method, or null if this is not a trivial return invoke
-   * super.
+   * Returns the invoke-super instruction, or null if this is not a trivial
+   * return invoke super. This only reads the method, so it runs in parallel.
    */
-  DexMethod* get_trivial_return_invoke_super(const DexMethod* meth) {
+  IRInstruction* get_trivial_return_invoke_super(const DexMethod* meth) {
     const auto* code = meth->get_code();
 
     // Must have code
@@ -227,6 +229,16 @@ private:
       return nullptr;
     }
 
+    return insns[0];
+  }
+
+  /**
+   * Returns the super method invoked by a trivial return invoke super, after
+   * making it and its class public, or null if that can't be done.
+   * Several methods may delegate to the same super method, so this runs
+   * serially.
+   */
+  DexMethod* get_public_super(DexMethodRef* invoked_meth) {
     // If the invoked method does not have access flags, we can't operate
     // on it at all.
     if (!invoked_meth->is_def()) {
@@ -280,23 +292,39 @@ public:
   }
 
   void run(bool do_delete, PassManager& mgr) {
+    std::vector<DexMethod*> methods;
     walk::methods(m_scope,
-      [&](DexMethod* meth) {
-        m_num_methods++;
-        auto invoked_meth = get_trivial_return_invoke_super(meth);
-        if (invoked_meth) {
-          TRACE(SUPER, 5, "Found trivial return invoke-super: %s\n",
-            SHOW(meth));
-          m_delmeths.emplace(meth, invoked_meth);
-          m_num_passed++;
-        }
-      });
+                  [&](DexMethod* meth) { methods.push_back(meth); });
+    m_num_methods = methods.size();
+    std::vector<IRInstruction*> invokes(methods.size());
+    auto wq = workqueue_foreach<size_t>([&](size_t i) {
+      invokes[i] = get_trivial_return_invoke_super(methods[i]);
+    });
+    for (size_t i = 0; i < methods.size(); ++i) {
+      auto code = methods[i]->get_code();
+      wq.add_item(i, code ? code->count_opcodes() : 0);
+    }
+    wq.run_all();
+
+    for (size_t i = 0; i < methods.size(); ++i) {
+      if (invokes[i] == nullptr) {
+        continue;
+      }
+      auto meth = methods[i];
+      auto invoked_meth = get_public_super(invokes[i]->get_method());
+      if (invoked_meth) {
+        TRACE(SUPER, 5, "Found trivial return invoke-super: %s\n",
+          SHOW(meth));
+        m_delmeths.emplace(meth, invoked_meth);
+        m_num_passed++;
+      }
+    }
     if (do_delete) {
       // we technically don't have to rewrite the opcodes -- we could just
       // remove the method declarations and the runtime semantics would be
       // unchanged -- but this ensures that we have no more references to
       // that method_id and can avoid emitting it in the dex output.
-      walk::opcodes(m_scope,
+      walk::parallel::opcodes(m_scope,
                    [](DexMethod* meth) { return true; },
                    [&](DexMethod* meth, IRInstruction* insn) {
                      if (is_invoke(insn->opcode())) {
@@ -325,20 +353,21 @@ public:
   }
 
   void print_stats(bool do_delete, PassManager& mgr) {
-    TRACE(SUPER, 1, "Examined %d total methods\n", m_num_methods);
-    TRACE(SUPER, 1, "Found %d candidate trivial methods\n", m_num_trivial);
+    TRACE(SUPER, 1, "Examined %d total methods\n", m_num_methods.load());
+    TRACE(SUPER, 1, "Found %d candidate trivial methods\n",
+      m_num_trivial.load());
     TRACE(SUPER, 5, "Culled %d due to super not defined\n",
       m_num_culled_super_not_def);
     TRACE(SUPER, 5, "Culled %d due to method is static\n",
-      m_num_culled_static);
+      m_num_culled_static.load());
     TRACE(SUPER, 5, "Culled %d due to method name doesn't match super\n",
-      m_num_culled_name_differs);
+      m_num_culled_name_differs.load());
     TRACE(SUPER, 5, "Culled %d due to method proto doesn't match super\n",
-      m_num_culled_proto_differs);
+      m_num_culled_proto_differs.load());
     TRACE(SUPER, 5, "Culled %d due to method doesn't return move result\n",
-      m_num_culled_return_move_result_differs);
+      m_num_culled_return_move_result_differs.load());
     TRACE(SUPER, 5, "Culled %d due to method args doesn't match super\n",
-      m_num_culled_args_differs);
+      m_num_culled_args_differs.load());
     TRACE(SUPER, 5, "Culled %d due to non-public super method in sdk\n",
       m_num_culled_super_is_non_public_sdk);
     TRACE(SUPER, 5, "Culled %d due to non-public super class in sdk\n",
@@ -9,12 +9,15 @@
 
 #include "FinalInline.h"
 
+#include <algorithm>
+#include <memory>
 #include <stdio.h>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "ConstantPropagationAnalysis.h"
 #include "Debug.h"
 #include "DexAccess.h"
 #include "DexClass.h"
@@ -26,6 +29,7 @@
 #include "ReachableClasses.h"
 #include "Resolver.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -36,6 +40,8 @@ class FinalInlineImpl {
 
   const Scope& m_full_scope;
   FinalInlinePass::Config& m_config;
+  // The static fields that replace_encodable_clinits() gave an encoded value.
+  size_t m_encoded_fields{0};
 
   bool is_cls_blacklisted(DexClass* clazz) {
     for (auto& type : m_config.black_list_types) {
@@ -51,10 +57,39 @@ class FinalInlineImpl {
     return false;
   }
 
+  /*
+   * Call `fn` on each class of the scope in parallel, and return the results
+   * in the order of the scope, so that merging them is deterministic.
+   */
+  template <typename Result>
+  std::vector<Result> map_classes(const std::function<Result(DexClass*)>& fn) {
+    std::vector<Result> results(m_full_scope.size());
+    auto wq = workqueue_foreach<size_t>(
+        [&](size_t i) { results[i] = fn(m_full_scope[i]); });
+    for (size_t i = 0; i < m_full_scope.size(); ++i) {
+      wq.add_item(i);
+    }
+    wq.run_all();
+    return results;
+  }
+
   std::unordered_set<DexField*> get_called_field_defs(const Scope& scope) {
-    std::vector<DexFieldRef*> field_refs;
-    walk::methods(scope,
-                 [&](DexMethod* method) { method->gather_fields(field_refs); });
+    auto field_refs =
+        walk::parallel::reduce_methods<std::nullptr_t,
+                                       std::vector<DexFieldRef*>,
+                                       Scope>(
+            scope,
+            [](std::nullptr_t, DexMethod* method) {
+              std::vector<DexFieldRef*> refs;
+              method->gather_fields(refs);
+              return refs;
+            },
+            [](std::vector<DexFieldRef*> a,
+               const std::vector<DexFieldRef*>& b) {
+              a.insert(a.end(), b.begin(), b.end());
+              return a;
+            },
+            [](int) { return nullptr; });
     sort_unique(field_refs);
     /* Okay, now we have a complete list of field refs
      * for this particular dex.  Map to the def actually invoked.
@@ -150,6 +185,7 @@ class FinalInlineImpl {
                                    }),
                     sfields.end());
     }
+    RedexContext::advance_member_epoch();
     return smallscope.size();
   }
 
@@ -218,29 +254,34 @@ class FinalInlineImpl {
 
   // returns the total number of inlines
   size_t inline_field_values() {
-    std::unordered_set<DexField*> inline_field;
     uint32_t aflags = ACC_STATIC | ACC_FINAL;
-    for (auto clazz : m_full_scope) {
-      if (is_cls_blacklisted(clazz)) {
-        continue;
-      }
-      std::unordered_map<DexField*, bool> blank_statics;
-      get_sput_in_clinit(clazz, blank_statics);
-      auto sfields = clazz->get_sfields();
-      for (auto sfield : sfields) {
-        if ((sfield->get_access() & aflags) != aflags ||
-            blank_statics[sfield]) {
-          continue;
-        }
-        auto value = sfield->get_static_value();
-        if (value == nullptr && !is_primitive(sfield->get_type())) {
-          continue;
-        }
-        if (value != nullptr && !value->is_evtype_primitive()) {
-          continue;
-        }
-        inline_field.insert(sfield);
-      }
+    auto inline_fields_by_class =
+        map_classes<std::vector<DexField*>>([&](DexClass* clazz) {
+          std::vector<DexField*> fields;
+          if (is_cls_blacklisted(clazz)) {
+            return fields;
+          }
+          std::unordered_map<DexField*, bool> blank_statics;
+          get_sput_in_clinit(clazz, blank_statics);
+          for (auto sfield : clazz->get_sfields()) {
+            if ((sfield->get_access() & aflags) != aflags ||
+                blank_statics[sfield]) {
+              continue;
+            }
+            auto value = sfield->get_static_value();
+            if (value == nullptr && !is_primitive(sfield->get_type())) {
+              continue;
+            }
+            if (value != nullptr && !value->is_evtype_primitive()) {
+              continue;
+            }
+            fields.push_back(sfield);
+          }
+          return fields;
+        });
+    std::unordered_set<DexField*> inline_field;
+    for (const auto& fields : inline_fields_by_class) {
+      inline_field.insert(fields.begin(), fields.end());
     }
 
     return walk::parallel::reduce_methods<std::nullptr_t, size_t, Scope>(
@@ -284,24 +325,6 @@ class FinalInlineImpl {
     );
   }
 
-  /*
-   * Verify that we can handle converting the literal contained in the
-   * const op into an encoded value.
-   */
-  bool validate_const_for_encoded_value(IRInstruction* op) {
-    if (!is_const(op->opcode())) {
-      return false;
-    }
-    switch (op->opcode()) {
-    case OPCODE_CONST:
-    case OPCODE_CONST_STRING:
-    case OPCODE_CONST_WIDE:
-      return true;
-    default:
-      return false;
-    }
-  }
-
   /*
    * Verify that we can convert the field in the sput into an encoded value.
    */
@@ -332,81 +355,143 @@ class FinalInlineImpl {
     return true;
   }
 
+  // Whether the instruction only computes a value that the evaluation below
+  // can follow, without any side effect and without throwing.
+  static bool is_evaluable(IROpcode op) {
+    switch (op) {
+    case OPCODE_NOP:
+    case OPCODE_CONST:
+    case OPCODE_CONST_WIDE:
+    case OPCODE_CONST_STRING:
+    case IOPCODE_MOVE_RESULT_PSEUDO_OBJECT:
+    case OPCODE_MOVE:
+    case OPCODE_MOVE_WIDE:
+    case OPCODE_MOVE_OBJECT:
+    case OPCODE_ADD_INT_LIT8:
+    case OPCODE_ADD_INT_LIT16:
+      return true;
+    default:
+      return false;
+    }
+  }
+
   /*
-   * Attempt to replace the clinit with corresponding encoded values.
+   * Evaluate the straight-line code that the clinit starts with, as long as
+   * it only computes constants and stores them into the static final fields
+   * of the class, with the abstract interpreter of constant propagation. As
+   * nothing can observe the fields in between, the values they end up with
+   * can be their encoded values instead, and the sputs go away. The whole
+   * clinit is removed if that's all it does. Returns whether it was.
    */
   bool try_replace_clinit(DexClass* clazz, DexMethod* clinit) {
-    std::vector<std::pair<IRInstruction*, IRInstruction*>> const_sputs;
-    auto ii = InstructionIterable(clinit->get_code());
-    auto end = ii.end();
-    // Verify the entire opcodes in this clinit are (const, sput)* pairs
-    // followed by return-void.
-    for (auto it = ii.begin(); it != end; ++it) {
-      auto first_op = it->insn;
-      ++it;
-      if (it == end) {
-        if (first_op->opcode() != OPCODE_RETURN_VOID) {
-          TRACE(FINALINLINE,
-                8,
-                "Can't replace: %s :: Last opcode is not return void\n",
-                SHOW(clinit));
-          return false;
+    auto code = clinit->get_code();
+    ConstPropConfig config;
+    config.fold_arithmetic = true;
+    ConstantEnvironment env;
+    // Constant propagation only tracks numbers, so the strings are followed
+    // on the side.
+    std::unordered_map<reg_t, DexString*> strings;
+    DexString* result_string = nullptr;
+    // The sputs of each field, in the order that the fields are first set.
+    std::vector<DexField*> fields;
+    std::unordered_map<DexField*, std::vector<FatMethod::iterator>> sputs;
+    // The last value that each field is set to, or null for the fields that
+    // are set to something that can't be encoded.
+    std::unordered_map<DexField*, std::unique_ptr<DexEncodedValue>> values;
+    bool returns = false;
+    for (auto it = code->begin(); it != code->end(); ++it) {
+      // A branch target ends the straight-line code, as does anything that
+      // may throw.
+      if (it->type == MFLOW_TARGET || it->type == MFLOW_TRY ||
+          it->type == MFLOW_CATCH) {
+        break;
+      }
+      if (it->type != MFLOW_OPCODE) {
+        continue;
+      }
+      auto insn = it->insn;
+      auto op = insn->opcode();
+      if (op == OPCODE_RETURN_VOID) {
+        returns = true;
+        break;
+      }
+      if (is_sput(op)) {
+        if (!validate_sput_for_encoded_value(clazz, insn)) {
+          break;
+        }
+        auto field = resolve_field(insn->get_field(), FieldSearch::Static);
+        if (sputs.count(field) == 0) {
+          fields.push_back(field);
+        }
+        sputs[field].push_back(it);
+        auto& value = values[field];
+        if (sputs[field].size() > 1 && value == nullptr) {
+          continue;
+        }
+        value.reset();
+        if (op == OPCODE_SPUT_OBJECT) {
+          auto str = strings.find(insn->src(0));
+          if (str != strings.end() &&
+              field->get_type() == get_string_type()) {
+            TRACE(FINALINLINE, 8, "- String Field: %s, \"%s\"\n", SHOW(field),
+                  SHOW(str->second));
+            value.reset(new DexEncodedValueString(str->second));
+          }
+        } else {
+          auto cst = env.get(insn->src(0)).constant_domain().get_constant();
+          if (cst) {
+            TRACE(FINALINLINE, 9, "- Integer Field: %s, %lu\n", SHOW(field),
+                  static_cast<uint64_t>(*cst));
+            value.reset(DexEncodedValue::zero_for_type(field->get_type()));
+            value->value(static_cast<uint64_t>(*cst));
+          }
         }
+        continue;
+      }
+      if (!is_evaluable(op)) {
         break;
       }
-      auto sput_op = it->insn;
-      bool condition_const = validate_const_for_encoded_value(first_op);
-      bool condition_sput =
-          condition_const && validate_sput_for_encoded_value(clazz, sput_op);
-      bool condition_register_match =
-          condition_sput && first_op->dest() == sput_op->src(0);
-      if (!condition_register_match) {
-        TRACE(FINALINLINE,
-              8,
-              "Can't replace: %s :: Can't validate :: const :: %s :: sput :: "
-              "%s :: register match :: %s\n",
-              SHOW(clinit),
-              condition_const ? "True" : "False",
-              condition_sput ? "True" : "False",
-              condition_register_match ? "True" : "False");
-        TRACE(FINALINLINE, 8, "%s\n", SHOW(clinit->get_code()));
-        return false;
-      }
-      const_sputs.emplace_back(first_op, sput_op);
+      if (op == OPCODE_CONST_STRING) {
+        result_string = insn->get_string();
+      } else if (insn->dests_size() > 0) {
+        strings.erase(insn->dest());
+        if (insn->dest_is_wide()) {
+          strings.erase(insn->dest() + 1);
+        }
+        if (op == IOPCODE_MOVE_RESULT_PSEUDO_OBJECT) {
+          strings[insn->dest()] = result_string;
+        } else if (op == OPCODE_MOVE_OBJECT && strings.count(insn->src(0))) {
+          strings[insn->dest()] = strings.at(insn->src(0));
+        }
+      }
+      constant_propagation::intraprocedural::analyze_instruction(
+          insn, &env, config, ConstantStaticFieldEnvironment());
     }
 
-    // Attach encoded values and remove the clinit
-    TRACE(FINALINLINE,
-          8,
-          "Replacing <clinit> %s: %lu pairs...\n",
-          SHOW(clinit),
-          const_sputs.size());
-    for (auto& pair : const_sputs) {
-      auto const_op = pair.first;
-      auto sput_op = pair.second;
-      auto field = resolve_field(sput_op->get_field(), FieldSearch::Static);
-      DexEncodedValue* ev;
-      if (const_op->opcode() == OPCODE_CONST_STRING) {
-        TRACE(FINALINLINE,
-              8,
-              "- String Field: %s, \"%s\"\n",
-              SHOW(field),
-              SHOW(const_op->get_string()));
-        ev = new DexEncodedValueString(const_op->get_string());
-      } else {
-        TRACE(FINALINLINE,
-              9,
-              "- Integer Field: %s, %lu\n",
-              SHOW(field),
-              static_cast<uint64_t>(const_op->get_literal()));
-        ev = DexEncodedValue::zero_for_type(field->get_type());
-        ev->value(static_cast<uint64_t>(const_op->get_literal()));
-      }
-      field->make_concrete(field->get_access(), ev);
+    bool encodes_all = std::all_of(
+        fields.begin(), fields.end(),
+        [&](DexField* field) { return values.at(field) != nullptr; });
+    bool removes_clinit = returns && encodes_all;
+    for (auto field : fields) {
+      auto& value = values.at(field);
+      if (value == nullptr) {
+        continue;
+      }
+      field->make_concrete(field->get_access(), value.release());
+      if (!removes_clinit) {
+        for (auto it : sputs.at(field)) {
+          code->remove_opcode(it);
+        }
+      }
+      ++m_encoded_fields;
     }
-    clazz->remove_method(clinit);
-
-    return true;
+    TRACE(FINALINLINE, 8, "%s <clinit> %s: %lu fields...\n",
+          removes_clinit ? "Replacing" : "Trimming", SHOW(clinit),
+          fields.size());
+    if (removes_clinit) {
+      clazz->remove_method(clinit);
+    }
+    return removes_clinit;
   }
 
   size_t replace_encodable_clinits() {
@@ -489,26 +574,33 @@ class FinalInlineImpl {
     // Build dependency map (static -> [statics] that depend on it)
     TRACE(FINALINLINE, 2, "Building dependency map\n");
     std::unordered_map<DexField*, std::vector<FieldDependency>> deps =
-        find_dependencies(m_full_scope);
+        find_dependencies();
 
     // Collect static finals whose values are known. These serve as the starting
     // point of the dependency resolution process.
+    auto resolved_by_class =
+        map_classes<std::vector<DexField*>>([&](DexClass* clazz) {
+          std::vector<DexField*> fields;
+          std::unordered_map<DexField*, bool> blank_statics;
+          // TODO: Should we allow static finals that are initialized w/ const,
+          // sput?
+          get_sput_in_clinit(clazz, blank_statics);
+          for (auto sfield : clazz->get_sfields()) {
+            if (!(is_static(sfield) && is_final(sfield)) ||
+                blank_statics[sfield]) {
+              continue;
+            }
+            fields.push_back(sfield);
+          }
+          return fields;
+        });
     std::deque<DexField*> resolved;
-    for (auto clazz : m_full_scope) {
-      std::unordered_map<DexField*, bool> blank_statics;
-      // TODO: Should we allow static finals that are initialized w/ const,
-      // sput?
-      get_sput_in_clinit(clazz, blank_statics);
-      auto sfields = clazz->get_sfields();
-      for (auto sfield : sfields) {
-        if (!(is_static(sfield) && is_final(sfield)) || blank_statics[sfield]) {
-          continue;
-        }
-        resolved.push_back(sfield);
-      }
+    for (const auto& fields : resolved_by_class) {
+      resolved.insert(resolved.end(), fields.begin(), fields.end());
     }
 
-    // Resolve dependencies (tsort)
+    // Resolve dependencies (tsort). This edits the clinits, so it stays
+    // sequential.
     size_t nresolved = 0;
     while (!resolved.empty()) {
       auto cur = resolved.front();
@@ -537,18 +629,32 @@ class FinalInlineImpl {
     return nresolved;
   }
 
-  std::unordered_map<DexField*, std::vector<FieldDependency>> find_dependencies(
-      const Scope& scope) {
-    std::unordered_map<DexField*, std::vector<FieldDependency>> result;
-    for (auto clazz : scope) {
+  // The clinits are analyzed in parallel, and their dependencies merged in
+  // the order of the scope.
+  std::unordered_map<DexField*, std::vector<FieldDependency>>
+  find_dependencies() {
+    using Dependencies =
+        std::unordered_map<DexField*, std::vector<FieldDependency>>;
+    auto deps_by_class = map_classes<Dependencies>([&](DexClass* clazz) {
+      Dependencies deps;
       if (is_cls_blacklisted(clazz)) {
-        continue;
+        return deps;
       }
       auto clinit = clazz->get_clinit();
       if (clinit == nullptr) {
-        continue;
+        return deps;
+      }
+      find_dependencies(clazz, clinit, deps);
+      return deps;
+    });
+    Dependencies result;
+    for (auto& deps : deps_by_class) {
+      for (auto& pair : deps) {
+        auto& field_deps = result[pair.first];
+        field_deps.insert(field_deps.end(),
+                          std::make_move_iterator(pair.second.begin()),
+                          std::make_move_iterator(pair.second.end()));
       }
-      find_dependencies(clazz, clinit, result);
     }
     return result;
   };
@@ -631,6 +737,13 @@ size_t FinalInlinePass::propagate_constants_for_test(Scope& scope,
   return impl.propagate_constants();
 }
 
+size_t FinalInlinePass::replace_encodable_clinits_for_test(Scope& scope) {
+  FinalInlinePass::Config config{};
+
+  FinalInlineImpl impl(scope, config);
+  return impl.replace_encodable_clinits();
+}
+
 void FinalInlinePass::run_pass(DexStoresVector& stores,
                                ConfigFiles& cfg,
                                PassManager& mgr) {
@@ -659,6 +772,7 @@ void FinalInlinePass::run_pass(DexStoresVector& stores,
   if (m_config.replace_encodable_clinits) {
     auto nreplaced = impl.replace_encodable_clinits();
     mgr.incr_metric("encodable_clinits_replaced", nreplaced);
+    mgr.incr_metric("encodable_clinit_fields", impl.m_encoded_fields);
   }
 
   size_t num_finals_inlined = impl.inline_field_values();
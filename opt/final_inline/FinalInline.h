@@ -67,6 +67,7 @@ class FinalInlinePass : public Pass {
   static size_t propagate_constants_for_test(Scope& scope,
                                              bool inline_string_fields,
                                              bool inline_wide_fields);
+  static size_t replace_encodable_clinits_for_test(Scope& scope);
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
@@ -230,6 +230,7 @@ void HotnessScorePass::run_pass(DexStoresVector& /*stores*/,
                                 ConfigFiles& cfg,
                                 PassManager& /*mgr*/) {
   const auto& coldstart_classes = cfg.get_coldstart_classes();
+  const auto& coldstart_types = cfg.get_coldstart_types();
   if (coldstart_classes.size() == 0) {
     TRACE(HOTNESS, 1, "Empty or no coldstart_classes file\n");
     return;
@@ -239,7 +240,8 @@ void HotnessScorePass::run_pass(DexStoresVector& /*stores*/,
   int hotness = 0;
   int cold_class_count = 0;
   std::array<std::vector<DexClass*>, 3> scopes;
-  for (const auto& cls_name : coldstart_classes) {
+  for (size_t i = 0; i < coldstart_classes.size(); ++i) {
+    const auto& cls_name = coldstart_classes[i];
     if (cls_name == m_warm_marker) {
       hotness = 1;
       TRACE(
@@ -250,7 +252,7 @@ void HotnessScorePass::run_pass(DexStoresVector& /*stores*/,
           HOTNESS, 5, "%d\tPARTITION\tMARKER\t%s\n", g_trial, cls_name.c_str());
     } else {
       ++cold_class_count;
-      auto type = DexType::get_type(cls_name.c_str());
+      auto type = coldstart_types[i];
       if (type) {
         DexClass* cls = type_class(type);
         if (cls != nullptr && !cls->is_external()) {
@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "IfChainToSwitchPass.h"
+
+#include <algorithm>
+#include <boost/optional.hpp>
+#include <map>
+#include <memory>
+#include <unordered_set>
+
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "Liveness.h"
+#include "Trace.h"
+#include "Transform.h"
+#include "Walkers.h"
+
+namespace if_chain_to_switch {
+
+namespace {
+
+// A block that ends with a compare of a register with a constant.
+struct Link {
+  Block* block;
+  FatMethod::iterator branch;
+  // The const right before the branch that loads the key, unless the branch
+  // is an if-eqz/if-nez.
+  boost::optional<FatMethod::iterator> key_load;
+  uint16_t reg;
+  int32_t key;
+  // Where the branch goes when the register is equal to the key or not.
+  Block* equal;
+  Block* not_equal;
+};
+
+Block* successor(Block* block, EdgeType type) {
+  for (const auto& edge : block->succs()) {
+    if (edge->type() == type) {
+      return edge->target();
+    }
+  }
+  return nullptr;
+}
+
+boost::optional<Link> match_link(Block* block) {
+  auto branch = transform::find_last_instruction(block);
+  if (branch == block->end()) {
+    return boost::none;
+  }
+  auto insn = branch->insn;
+  auto op = insn->opcode();
+  Link link;
+  link.block = block;
+  link.branch = branch;
+  if (op == OPCODE_IF_EQZ || op == OPCODE_IF_NEZ) {
+    link.reg = insn->src(0);
+    link.key = 0;
+  } else if (op == OPCODE_IF_EQ || op == OPCODE_IF_NE) {
+    auto it = branch;
+    do {
+      if (it == block->begin()) {
+        return boost::none;
+      }
+      --it;
+    } while (it->type != MFLOW_OPCODE);
+    auto load = it->insn;
+    if (load->opcode() != OPCODE_CONST || insn->src(0) == insn->src(1)) {
+      return boost::none;
+    }
+    if (load->dest() == insn->src(1)) {
+      link.reg = insn->src(0);
+    } else if (load->dest() == insn->src(0)) {
+      link.reg = insn->src(1);
+    } else {
+      return boost::none;
+    }
+    link.key_load = it;
+    link.key = load->get_literal();
+  } else {
+    return boost::none;
+  }
+  auto taken = successor(block, EDGE_BRANCH);
+  auto not_taken = successor(block, EDGE_GOTO);
+  if (taken == nullptr || not_taken == nullptr || taken == not_taken) {
+    return boost::none;
+  }
+  bool jumps_if_equal = op == OPCODE_IF_EQZ || op == OPCODE_IF_EQ;
+  link.equal = jumps_if_equal ? taken : not_taken;
+  link.not_equal = jumps_if_equal ? not_taken : taken;
+  return link;
+}
+
+struct Chain {
+  std::vector<Link> links;
+  // The first block that each key leads to, by key.
+  std::map<int32_t, Block*> cases;
+  Block* default_block;
+};
+
+// The longest chain that starts with the compare at the end of `head`.
+boost::optional<Chain> find_chain(Block* head,
+                                  const std::unordered_set<Block*>& claimed) {
+  auto first = match_link(head);
+  if (!first) {
+    return boost::none;
+  }
+  Chain chain;
+  chain.links.push_back(*first);
+  std::unordered_set<Block*> blocks{head};
+  auto next = first->not_equal;
+  while (next->preds().size() == 1 && blocks.count(next) == 0 &&
+         claimed.count(next) == 0) {
+    auto link = match_link(next);
+    if (!link || link->reg != first->reg) {
+      break;
+    }
+    // The block must do nothing but the compare.
+    auto first_insn = link->key_load ? *link->key_load : link->branch;
+    if (InstructionIterable(next).begin().unwrap() != first_insn) {
+      break;
+    }
+    chain.links.push_back(*link);
+    blocks.insert(next);
+    next = link->not_equal;
+  }
+  chain.default_block = next;
+  for (const auto& link : chain.links) {
+    // A later compare with the same key is never true.
+    chain.cases.emplace(link.key, link.equal);
+  }
+  return chain;
+}
+
+// The consts that load the keys are removed along with the compares, so the
+// registers they load mustn't be read wherever the chain leads to.
+bool keys_are_dead(const Chain& chain,
+                   const regalloc::LivenessFixpointIterator& liveness) {
+  std::vector<Block*> targets{chain.default_block};
+  for (const auto& link : chain.links) {
+    targets.push_back(link.equal);
+  }
+  for (const auto& link : chain.links) {
+    if (!link.key_load) {
+      continue;
+    }
+    auto reg = (*link.key_load)->insn->dest();
+    for (auto target : targets) {
+      if (liveness.get_live_in_vars_at(target).contains(reg)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Replaces the compare of the first block of `chain` with a switch that goes
+// to the cases, followed by a goto to the default block. This leaves the
+// other blocks of the chain unreachable.
+void replace_with_switch(IRCode* code, const Chain& chain) {
+  const auto& head = chain.links.front();
+  auto min_key = chain.cases.begin()->first;
+  auto max_key = chain.cases.rbegin()->first;
+  auto insn = new IRInstruction(
+      use_packed_switch(min_key, max_key, chain.cases.size())
+          ? OPCODE_PACKED_SWITCH
+          : OPCODE_SPARSE_SWITCH);
+  insn->set_arg_word_count(1)->set_src(0, head.reg);
+  auto switch_it = code->insert_before(head.branch, insn);
+  auto goto_it =
+      code->insert_before(head.branch, new IRInstruction(OPCODE_GOTO));
+  for (const auto& key_and_block : chain.cases) {
+    code->insert_before(key_and_block.second->begin(),
+                        new BranchTarget(&*switch_it, key_and_block.first));
+  }
+  code->insert_before(chain.default_block->begin(),
+                      new BranchTarget(&*goto_it));
+  if (head.key_load) {
+    code->remove_opcode(*head.key_load);
+  }
+  code->remove_opcode(head.branch);
+}
+
+} // namespace
+
+Stats convert(IRCode* code, size_t min_cases) {
+  Stats stats;
+  code->build_cfg();
+  auto& cfg = code->cfg();
+  std::unique_ptr<regalloc::LivenessFixpointIterator> liveness;
+  std::unordered_set<Block*> claimed;
+  std::vector<Chain> chains;
+  for (Block* block : cfg.blocks()) {
+    if (claimed.count(block) != 0) {
+      continue;
+    }
+    auto chain = find_chain(block, claimed);
+    // With two keys or more, one of them isn't 0, so the register is an
+    // integer and not a reference that is compared with null.
+    if (!chain || chain->cases.size() < std::max<size_t>(min_cases, 2)) {
+      continue;
+    }
+    if (liveness == nullptr) {
+      cfg.calculate_exit_block();
+      liveness = std::make_unique<regalloc::LivenessFixpointIterator>(cfg);
+      liveness->run(regalloc::LivenessDomain(code->get_registers_size()));
+    }
+    if (!keys_are_dead(*chain, *liveness)) {
+      continue;
+    }
+    for (const auto& link : chain->links) {
+      claimed.insert(link.block);
+    }
+    chains.push_back(std::move(*chain));
+  }
+  if (chains.empty()) {
+    return stats;
+  }
+  for (const auto& chain : chains) {
+    TRACE(IFCHAIN, 3, "Replacing %zu compares with a switch of %zu cases\n",
+          chain.links.size(), chain.cases.size());
+    replace_with_switch(code, chain);
+    ++stats.switches;
+    stats.compares_removed += chain.links.size();
+  }
+  code->build_cfg();
+  transform::remove_unreachable_blocks(code);
+  return stats;
+}
+
+} // namespace if_chain_to_switch
+
+void IfChainToSwitchPass::run_pass(DexStoresVector& stores,
+                                   ConfigFiles&,
+                                   PassManager& mgr) {
+  auto scope = build_class_scope(stores);
+  using if_chain_to_switch::Stats;
+  size_t min_cases = std::max<int64_t>(m_min_cases, 0);
+  auto stats = walk::parallel::reduce_code<Stats>(
+      scope, [min_cases](Stats& stats, DexMethod*, IRCode& code) {
+        stats += if_chain_to_switch::convert(&code, min_cases);
+      });
+  mgr.incr_metric("switches_created", stats.switches);
+  mgr.incr_metric("compares_removed", stats.compares_removed);
+  TRACE(IFCHAIN, 1, "Replaced %zu compares with %zu switches\n",
+        stats.compares_removed, stats.switches);
+}
+
+static IfChainToSwitchPass s_pass;
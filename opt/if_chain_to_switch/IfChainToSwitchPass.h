@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include "Pass.h"
+
+/*
+ * Turns the chains of if-eq/if-ne/if-eqz/if-nez instructions that compare
+ * one register with a different constant each into a single switch on that
+ * register. Generated code, like Kotlin's `when` and the code of annotation
+ * processors, is full of such chains, which the interpreter goes through one
+ * compare at a time, while it dispatches a switch with one lookup or binary
+ * search. Whether the switch is emitted as a packed or a sparse one depends
+ * on the density of its keys (see use_packed_switch() in IRCode.h).
+ *
+ * A chain is made of the blocks that end with such a compare, where each
+ * block after the first is only reached when the previous compare fails and
+ * only loads its constant. The registers that the constants are loaded into
+ * must be dead where the chain leads to. Run it after ConstantPropagationPass
+ * and CopyPropagationPass, which leave most of the constants right next to
+ * their compares.
+ */
+class IfChainToSwitchPass : public Pass {
+ public:
+  IfChainToSwitchPass() : Pass("IfChainToSwitchPass") {}
+
+  virtual void configure_pass(const PassConfig& pc) override {
+    pc.get("min_cases", 3, m_min_cases);
+  }
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual bool is_method_local() const override { return true; }
+
+ private:
+  // The fewest distinct keys that a chain needs to become a switch.
+  int64_t m_min_cases;
+};
+
+namespace if_chain_to_switch {
+
+struct Stats {
+  size_t switches{0};
+  size_t compares_removed{0};
+
+  Stats& operator+=(const Stats& that) {
+    switches += that.switches;
+    compares_removed += that.compares_removed;
+    return *this;
+  }
+};
+
+// Turns the chains of `code` with at least `min_cases` keys into switches.
+Stats convert(IRCode* code, size_t min_cases);
+
+} // namespace if_chain_to_switch
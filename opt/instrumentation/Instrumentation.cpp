@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Instrumentation.h"
+
+#include "ConfigFiles.h"
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "PassManager.h"
+#include "Walkers.h"
+
+namespace instrumentation {
+
+namespace {
+
+bool is_blacklisted(const DexClass* cls,
+                    const DexMethod* hook,
+                    const std::vector<std::string>& blacklist) {
+  if (cls == nullptr || cls->get_type() == hook->get_class()) {
+    return true;
+  }
+  auto name = cls->get_deobfuscated_name();
+  if (name.empty()) {
+    name = show(cls->get_type());
+  }
+  for (const auto& prefix : blacklist) {
+    if (name.compare(0, prefix.size(), prefix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The instructions that must stay at the start of their block.
+bool must_lead(IROpcode op) {
+  return opcode::is_load_param(op) || op == OPCODE_MOVE_EXCEPTION ||
+         is_move_result(op) || opcode::is_move_result_pseudo(op);
+}
+
+// Where to count the executions of a block.
+FatMethod::iterator probe_position(FatMethod::iterator begin,
+                                   FatMethod::iterator end) {
+  for (auto it = begin; it != end; ++it) {
+    if (it->type == MFLOW_OPCODE && !must_lead(it->insn->opcode())) {
+      return it;
+    }
+  }
+  return end;
+}
+
+void insert_probe(IRCode* code,
+                  FatMethod::iterator position,
+                  DexMethod* hook,
+                  uint16_t reg,
+                  size_t id) {
+  auto konst = new IRInstruction(OPCODE_CONST);
+  konst->set_dest(reg)->set_literal(id);
+  auto invoke = new IRInstruction(OPCODE_INVOKE_STATIC);
+  invoke->set_method(hook)->set_arg_word_count(1)->set_src(0, reg);
+  code->insert_before(position, konst);
+  code->insert_before(position, invoke);
+}
+
+} // namespace
+
+std::vector<Probe> instrument(const Scope& scope,
+                              DexMethod* hook,
+                              Strategy strategy,
+                              const std::vector<std::string>& blacklist) {
+  // Not in parallel, so that the ids don't change from one build to the next.
+  std::vector<Probe> probes;
+  walk::code(scope, [&](DexMethod* method, IRCode& code) {
+    if (is_blacklisted(type_class(method->get_class()), hook, blacklist)) {
+      return;
+    }
+    auto reg = code.allocate_temp();
+    if (strategy == Strategy::METHOD) {
+      // Before any branch target, so that loops don't count again.
+      insert_probe(&code,
+                   code.get_param_instructions().end(),
+                   hook,
+                   reg,
+                   probes.size());
+      probes.push_back({method, -1});
+      return;
+    }
+    code.build_cfg();
+    std::vector<std::pair<Block*, FatMethod::iterator>> positions;
+    for (auto* block : code.cfg().blocks()) {
+      positions.emplace_back(block,
+                             probe_position(block->begin(), block->end()));
+    }
+    for (const auto& pair : positions) {
+      insert_probe(&code, pair.second, hook, reg, probes.size());
+      probes.push_back({method, static_cast<int32_t>(pair.first->id())});
+    }
+  });
+  return probes;
+}
+
+void write_metadata(const std::vector<Probe>& probes, FILE* fd) {
+  fprintf(fd, "#id,kind,method,block\n");
+  for (size_t id = 0; id < probes.size(); ++id) {
+    const auto& probe = probes[id];
+    auto name = show_deobfuscated(probe.method);
+    if (probe.block < 0) {
+      fprintf(fd, "%zu,method,%s,\n", id, name.c_str());
+    } else {
+      fprintf(fd, "%zu,block,%s,%d\n", id, name.c_str(), probe.block);
+    }
+  }
+}
+
+} // namespace instrumentation
+
+void InstrumentationPass::run_pass(DexStoresVector& stores,
+                                   ConfigFiles& cfg,
+                                   PassManager& mgr) {
+  auto hook = static_cast<DexMethod*>(DexMethod::get_method(m_hook));
+  always_assert_log(hook != nullptr && hook->is_def() && is_static(hook),
+                    "InstrumentationPass: the hook %s isn't a static method",
+                    m_hook.c_str());
+  always_assert_log(m_strategy == "method" || m_strategy == "block",
+                    "InstrumentationPass: unknown strategy %s",
+                    m_strategy.c_str());
+  auto strategy = m_strategy == "method" ? instrumentation::Strategy::METHOD
+                                         : instrumentation::Strategy::BLOCK;
+
+  auto scope = build_class_scope(stores);
+  auto probes =
+      instrumentation::instrument(scope, hook, strategy, m_blacklist);
+  mgr.incr_metric("probes", probes.size());
+  TRACE(INSTRUMENT, 1, "Inserted %d probes\n", probes.size());
+
+  auto filename = cfg.metafile(m_metadata_file);
+  FILE* fd = fopen(filename.c_str(), "w");
+  if (fd == nullptr) {
+    perror("Error opening instrumentation metadata file");
+    return;
+  }
+  instrumentation::write_metadata(probes, fd);
+  fclose(fd);
+}
+
+static InstrumentationPass s_pass;
@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "DexClass.h"
+#include "Pass.h"
+
+/*
+ * Instruments the app to count how often its methods or basic blocks run.
+ * Each probe is a call of a static hook with the id of the probe,
+ *
+ *   const v5, 42
+ *   invoke-static {v5}, Lcom/foo/Profiler;.onProbe:(I)V
+ *
+ * at the entry of the method, or at the start of the block, after its
+ * move-exception or move-result. The ids are dense from 0, so that the
+ * runtime can keep its counters in an array. The pass writes what each id
+ * counts next to the other metadata files:
+ *
+ *   #id,kind,method,block
+ *   42,method,Lcom/foo/Bar;.baz:()V,
+ *   43,block,Lcom/foo/Bar;.baz:()V,0
+ *
+ * with the deobfuscated name of the method, and the id of the block in the
+ * CFG of the method when the pass ran. Blocks are cheaper to count than
+ * edges, and their counts are enough to order methods and blocks by
+ * hotness.
+ *
+ * Options:
+ *   "hook": the static (I)V method to call, e.g.
+ *     "Lcom/foo/Profiler;.onProbe:(I)V"
+ *   "strategy": "method" (default) or "block"
+ *   "metadata_file_name": defaults to "redex-instrument-metadata.txt"
+ *   "blacklist": class name prefixes not to instrument. The class of the hook
+ *     is never instrumented.
+ */
+class InstrumentationPass : public Pass {
+ public:
+  InstrumentationPass() : Pass("InstrumentationPass") {}
+
+  virtual void configure_pass(const PassConfig& pc) override {
+    pc.get("hook", "", m_hook);
+    pc.get("strategy", "method", m_strategy);
+    pc.get(
+        "metadata_file_name", "redex-instrument-metadata.txt", m_metadata_file);
+    pc.get("blacklist", {}, m_blacklist);
+  }
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+ private:
+  std::string m_hook;
+  std::string m_strategy;
+  std::string m_metadata_file;
+  std::vector<std::string> m_blacklist;
+};
+
+namespace instrumentation {
+
+enum class Strategy {
+  METHOD,
+  BLOCK,
+};
+
+// What the probe with a given id counts.
+struct Probe {
+  const DexMethod* method;
+  // The id of the block in the CFG, or -1 for the entry of the method.
+  int32_t block;
+};
+
+/*
+ * Inserts the probes into the methods of the scope whose class doesn't start
+ * with a blacklisted prefix, and returns them in the order of their ids.
+ */
+std::vector<Probe> instrument(const Scope& scope,
+                              DexMethod* hook,
+                              Strategy strategy,
+                              const std::vector<std::string>& blacklist);
+
+void write_metadata(const std::vector<Probe>& probes, FILE* fd);
+
+} // namespace instrumentation
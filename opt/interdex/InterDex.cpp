@@ -9,6 +9,7 @@
 
 #include "InterDex.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -19,6 +20,7 @@
 #include "Creators.h"
 #include "Debug.h"
 #include "DexClass.h"
+#include "DexIdMap.h"
 #include "DexLoader.h"
 #include "DexOutput.h"
 #include "DexUtil.h"
@@ -27,11 +29,12 @@
 #include "ReachableClasses.h"
 #include "StringUtil.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
-typedef std::unordered_set<DexMethodRef*> mrefs_t;
-typedef std::unordered_set<DexFieldRef*> frefs_t;
+typedef std::vector<DexMethodRef*> mrefs_t;
+typedef std::vector<DexFieldRef*> frefs_t;
 
 size_t global_dmeth_cnt;
 size_t global_smeth_cnt;
@@ -42,39 +45,91 @@ size_t global_cls_cnt;
 size_t cls_skipped_in_primary = 0;
 size_t cls_skipped_in_secondary = 0;
 size_t cold_start_set_dex_count = 1000;
+size_t packed_dexes_saved = 0;
 
 bool emit_canaries = false;
+bool pack_secondary_dexes = false;
 int64_t linear_alloc_limit;
 
-void gather_refs(InterDexPass* pass,
-                 const DexClass* cls,
-                 mrefs_t* mrefs,
-                 frefs_t* frefs) {
-  std::vector<DexMethodRef*> method_refs;
-  std::vector<DexFieldRef*> field_refs;
-  cls->gather_methods(method_refs);
-  cls->gather_fields(field_refs);
-  for (const auto& plugin : pass->m_plugins) {
-    plugin->gather_mrefs(cls, method_refs, field_refs);
+// The refs a class would add to the dex it goes into, without duplicates and
+// sorted by id.
+struct class_refs {
+  bool computed{false};
+  mrefs_t mrefs;
+  frefs_t frefs;
+};
+
+// The refs of the classes in the input dexes, see precompute_refs().
+TypeIdMap<class_refs> precomputed_refs;
+
+template <typename Ref>
+void sort_unique(std::vector<Ref*>& refs) {
+  std::sort(refs.begin(), refs.end(), [](const Ref* a, const Ref* b) {
+    return a->get_id() < b->get_id();
+  });
+  refs.erase(std::unique(refs.begin(), refs.end()), refs.end());
+}
+
+class_refs gather_own_refs(const DexClass* cls) {
+  class_refs refs;
+  cls->gather_methods(refs.mrefs);
+  cls->gather_fields(refs.frefs);
+  sort_unique(refs.mrefs);
+  sort_unique(refs.frefs);
+  refs.computed = true;
+  return refs;
+}
+
+/*
+ * Gathering a class's refs means going over all of its code, and a class
+ * may be tried for several dexes, so gather them up front for all input
+ * classes, in parallel.
+ */
+void precompute_refs(const Scope& scope) {
+  std::vector<class_refs> refs(scope.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { refs[i] = gather_own_refs(scope[i]); });
+  for (size_t i = 0; i < scope.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  for (size_t i = 0; i < scope.size(); ++i) {
+    precomputed_refs[scope[i]->get_type()] = std::move(refs[i]);
   }
-  mrefs->insert(method_refs.begin(), method_refs.end());
-  frefs->insert(field_refs.begin(), field_refs.end());
 }
 
 /*
- * Removes the elements of b from a. Runs in O(size(a)), so it works best if
- * size(a) << size(b).
+ * Plugins may add refs on top of the class's own, and may change their minds
+ * as classes get emitted, so they are asked every time. Their refs are merged
+ * into *scratch, which is returned in that case.
  */
-template <typename T>
-std::unordered_set<T> set_difference(const std::unordered_set<T>& a,
-                                     const std::unordered_set<T>& b) {
-  std::unordered_set<T> result;
-  for (auto& v : a) {
-    if (!b.count(v)) {
-      result.emplace(v);
+const class_refs& gather_refs(InterDexPass* pass,
+                              const DexClass* cls,
+                              class_refs* scratch) {
+  const auto& own = precomputed_refs.at(cls->get_type());
+  if (own.computed && pass->m_plugins.empty()) {
+    return own;
+  }
+  *scratch = own.computed ? own : gather_own_refs(cls);
+  for (const auto& plugin : pass->m_plugins) {
+    plugin->gather_mrefs(cls, scratch->mrefs, scratch->frefs);
+  }
+  sort_unique(scratch->mrefs);
+  sort_unique(scratch->frefs);
+  return *scratch;
+}
+
+// The number of refs that aren't in the set yet.
+template <typename Ref>
+size_t count_missing(const std::vector<Ref*>& refs,
+                     const DexIdBitSet<Ref>& set) {
+  size_t missing = 0;
+  for (auto ref : refs) {
+    if (!set.contains(ref)) {
+      ++missing;
     }
   }
-  return result;
+  return missing;
 }
 
 constexpr int kMaxMethodRefs = ((64 * 1024) - 1);
@@ -86,18 +141,36 @@ constexpr int kMaxDexNum = 99;
 
 struct dex_emit_tracker {
   unsigned la_size{0};
-  mrefs_t mrefs;
-  frefs_t frefs;
+  MethodBitSet mrefs;
+  FieldBitSet frefs;
+  size_t num_mrefs{0};
+  size_t num_frefs{0};
   std::vector<DexClass*> outs;
   std::unordered_set<DexClass*> emitted;
-  std::unordered_map<std::string, DexClass*> clookup;
+  TypeIdMap<DexClass*> clookup;
 
   void start_new_dex() {
     la_size = 0;
     mrefs.clear();
     frefs.clear();
+    num_mrefs = 0;
+    num_frefs = 0;
     outs.clear();
   }
+
+  void add_refs(const class_refs& refs) {
+    for (auto mref : refs.mrefs) {
+      num_mrefs += mrefs.insert(mref);
+    }
+    for (auto fref : refs.frefs) {
+      num_frefs += frefs.insert(fref);
+    }
+  }
+
+  // Returns nullptr for the entries of the coldstart list that aren't types.
+  DexClass* find_class(const DexType* type) const {
+    return type != nullptr ? clookup.at(type) : nullptr;
+  }
 };
 
 void update_dex_stats(size_t cls_cnt, size_t methrefs_cnt, size_t frefs_cnt) {
@@ -128,9 +201,9 @@ void check_refs_count(const dex_emit_tracker& det, const DexClasses& dc) {
     cls->gather_methods(mrefs);
   }
   std::unordered_set<DexMethodRef*> mrefs_set(mrefs.begin(), mrefs.end());
-  if (mrefs_set.size() > det.mrefs.size()) {
+  if (mrefs_set.size() > det.num_mrefs) {
     for (DexMethodRef* mr : mrefs_set) {
-      if (!det.mrefs.count(mr)) {
+      if (!det.mrefs.contains(mr)) {
         TRACE(IDEX, 1,
               "WARNING: Could not find %s in predicted mrefs set\n",
               SHOW(mr));
@@ -143,9 +216,9 @@ void check_refs_count(const dex_emit_tracker& det, const DexClasses& dc) {
     cls->gather_fields(frefs);
   }
   std::unordered_set<DexFieldRef*> frefs_set(frefs.begin(), frefs.end());
-  if (frefs_set.size() > det.frefs.size()) {
+  if (frefs_set.size() > det.num_frefs) {
     for (auto* fr : frefs_set) {
-      if (!det.frefs.count(fr)) {
+      if (!det.frefs.contains(fr)) {
         TRACE(IDEX, 1,
               "WARNING: Could not find %s in predicted frefs set\n",
               SHOW(fr));
@@ -160,10 +233,10 @@ void check_refs_count(const dex_emit_tracker& det, const DexClasses& dc) {
         det.outs.size(),
         det.la_size,
         linear_alloc_limit,
-        det.mrefs.size(),
+        det.num_mrefs,
         mrefs_set.size(),
         kMaxMethodRefs,
-        det.frefs.size(),
+        det.num_frefs,
         frefs_set.size(),
         kMaxFieldRefs);
 }
@@ -189,7 +262,7 @@ void flush_out_dex(InterDexPass* pass,
 
   outdex.emplace_back(std::move(dc));
 
-  update_dex_stats(det.outs.size(), det.mrefs.size(), det.frefs.size());
+  update_dex_stats(det.outs.size(), det.num_mrefs, det.num_frefs);
   det.start_new_dex();
 }
 
@@ -208,8 +281,8 @@ void flush_out_secondary(InterDexPass* pass,
                       "Bailing, Max dex number surpassed %d\n", dexnum);
     snprintf(buf, sizeof(buf), kCanaryClassFormat, dexnum);
     std::string canaryname(buf);
-    auto it = det.clookup.find(canaryname);
-    if (it == det.clookup.end()) {
+    auto clazz = det.find_class(DexType::get_type(canaryname.c_str()));
+    if (clazz == nullptr) {
       TRACE(IDEX, 2, "Warning, no canary class %s found\n", buf);
       auto canary_type = DexType::make_type(canaryname.c_str());
       auto canary_cls = type_class(canary_type);
@@ -223,7 +296,6 @@ void flush_out_secondary(InterDexPass* pass,
       }
       det.outs.push_back(canary_cls);
     } else {
-      auto clazz = it->second;
       det.outs.push_back(clazz);
     }
   }
@@ -327,32 +399,30 @@ void emit_class(InterDexPass* pass,
 
   // Calculate the extra method and field refs that we would need to add to
   // the current dex if we defined :clazz in it.
-  mrefs_t clazz_mrefs;
-  frefs_t clazz_frefs;
-  gather_refs(pass, clazz, &clazz_mrefs, &clazz_frefs);
-  auto extra_mrefs = set_difference(clazz_mrefs, det.mrefs);
-  auto extra_frefs = set_difference(clazz_frefs, det.frefs);
+  class_refs scratch;
+  const auto& clazz_refs = gather_refs(pass, clazz, &scratch);
+  auto extra_mrefs = count_missing(clazz_refs.mrefs, det.mrefs);
+  auto extra_frefs = count_missing(clazz_refs.frefs, det.frefs);
 
   // If those extra refs would cause use to overflow, start a new dex.
   if ((det.la_size + laclazz) > linear_alloc_limit ||
       // XXX(jezng): shouldn't this >= be > instead?
-      det.mrefs.size() + extra_mrefs.size() >= kMaxMethodRefs ||
-      det.frefs.size() + extra_frefs.size() >= kMaxFieldRefs) {
+      det.num_mrefs + extra_mrefs >= kMaxMethodRefs ||
+      det.num_frefs + extra_frefs >= kMaxFieldRefs) {
     // Emit out list
     always_assert_log(!is_primary,
                       "would have to do an early flush on the primary dex\n"
                       "la %d:%d , mrefs %lu:%d frefs %lu:%d\n",
                       det.la_size + laclazz,
                       linear_alloc_limit,
-                      det.mrefs.size() + extra_mrefs.size(),
+                      det.num_mrefs + extra_mrefs,
                       kMaxMethodRefs,
-                      det.frefs.size() + extra_frefs.size(),
+                      det.num_frefs + extra_frefs,
                       kMaxFieldRefs);
     flush_out_secondary(pass, det, outdex);
   }
 
-  det.mrefs.insert(clazz_mrefs.begin(), clazz_mrefs.end());
-  det.frefs.insert(clazz_frefs.begin(), clazz_frefs.end());
+  det.add_refs(clazz_refs);
   det.la_size += laclazz;
   det.outs.push_back(clazz);
   det.emitted.insert(clazz);
@@ -366,10 +436,189 @@ void emit_class(InterDexPass* pass,
   emit_class(pass, det, outdex, clazz, false);
 }
 
+/*
+ * A dex being filled by pack_classes(), which starts from the dex that the
+ * emitter has open.
+ */
+struct packed_dex {
+  unsigned la_size{0};
+  MethodBitSet mrefs;
+  FieldBitSet frefs;
+  size_t num_mrefs{0};
+  size_t num_frefs{0};
+  // Indices into the classes being packed.
+  std::vector<size_t> classes;
+
+  // The same limits as emit_class() checks.
+  bool fits(unsigned la, const class_refs& refs) const {
+    return la_size + la <= linear_alloc_limit &&
+           num_mrefs + count_missing(refs.mrefs, mrefs) < kMaxMethodRefs &&
+           num_frefs + count_missing(refs.frefs, frefs) < kMaxFieldRefs;
+  }
+
+  void add(size_t idx, unsigned la, const class_refs& refs) {
+    for (auto mref : refs.mrefs) {
+      num_mrefs += mrefs.insert(mref);
+    }
+    for (auto fref : refs.frefs) {
+      num_frefs += frefs.insert(fref);
+    }
+    la_size += la;
+    classes.push_back(idx);
+  }
+};
+
+struct pack_input {
+  std::vector<DexClass*> classes;
+  std::vector<class_refs> refs;
+  std::vector<unsigned> las;
+};
+
+/*
+ * Puts the classes, in the given order, into the dex that det has open and
+ * as few new dexes after it as it can. With first_fit, a class goes into the
+ * first dex it fits in, otherwise only the last dex is tried, as emit_class()
+ * does. Returns the indices of the classes of each dex.
+ */
+std::vector<std::vector<size_t>> pack_classes(const dex_emit_tracker& det,
+                                              const pack_input& input,
+                                              const std::vector<size_t>& order,
+                                              bool first_fit) {
+  std::vector<packed_dex> dexes(1);
+  auto& open = dexes.back();
+  open.la_size = det.la_size;
+  open.mrefs = det.mrefs;
+  open.frefs = det.frefs;
+  open.num_mrefs = det.num_mrefs;
+  open.num_frefs = det.num_frefs;
+  for (auto idx : order) {
+    auto la = input.las[idx];
+    const auto& refs = input.refs[idx];
+    size_t target = dexes.size();
+    for (size_t i = first_fit ? 0 : dexes.size() - 1; i < dexes.size(); ++i) {
+      if (dexes[i].fits(la, refs)) {
+        target = i;
+        break;
+      }
+    }
+    if (target == dexes.size()) {
+      // A class that doesn't fit in an empty dex gets one to itself, as in
+      // emit_class().
+      dexes.emplace_back();
+    }
+    dexes[target].add(idx, la, refs);
+  }
+  std::vector<std::vector<size_t>> result;
+  for (auto& dex : dexes) {
+    result.push_back(std::move(dex.classes));
+  }
+  return result;
+}
+
+std::string package_of(const DexClass* cls) {
+  std::string name = cls->get_type()->get_name()->c_str();
+  auto slash = name.rfind('/');
+  return slash == std::string::npos ? std::string() : name.substr(0, slash);
+}
+
+/*
+ * Emits the classes that are left once the coldstart classes are out, into
+ * as few dexes as it finds. A few orders and strategies are tried in
+ * parallel, and the one that needs the fewest dexes wins, the greedy one that
+ * emit_class() implements in case of a tie:
+ *
+ *  - the input order, filling one dex at a time, as emit_class() does;
+ *  - the input order, putting each class in the first dex with room for it;
+ *  - grouped by package, so that classes that tend to refer to the same
+ *    members, e.g. an outer class and its inner classes, end up together;
+ *  - the classes with the most refs first.
+ */
+void emit_packed(InterDexPass* pass,
+                 dex_emit_tracker& det,
+                 DexClassesVector& outdex,
+                 const std::vector<DexClass*>& classes) {
+  pack_input input;
+  input.classes = classes;
+  // Plugins aren't thread safe, so their refs are gathered up front.
+  for (auto cls : classes) {
+    class_refs scratch;
+    input.refs.push_back(gather_refs(pass, cls, &scratch));
+    input.las.push_back(estimate_linear_alloc(cls));
+  }
+
+  std::vector<size_t> input_order(classes.size());
+  for (size_t i = 0; i < input_order.size(); ++i) {
+    input_order[i] = i;
+  }
+  std::vector<std::string> packages;
+  for (auto cls : classes) {
+    packages.push_back(package_of(cls));
+  }
+  auto by_package = input_order;
+  std::stable_sort(by_package.begin(), by_package.end(), [&](size_t a, size_t b) {
+    return packages[a] < packages[b];
+  });
+  auto by_refs = input_order;
+  std::stable_sort(by_refs.begin(), by_refs.end(), [&](size_t a, size_t b) {
+    return input.refs[a].mrefs.size() + input.refs[a].frefs.size() >
+           input.refs[b].mrefs.size() + input.refs[b].frefs.size();
+  });
+
+  struct strategy {
+    const std::vector<size_t>* order;
+    bool first_fit;
+  };
+  const std::vector<strategy> strategies = {{&input_order, false},
+                                            {&input_order, true},
+                                            {&by_package, true},
+                                            {&by_refs, true}};
+  std::vector<std::vector<std::vector<size_t>>> packings(strategies.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    packings[i] = pack_classes(
+        det, input, *strategies[i].order, strategies[i].first_fit);
+  });
+  for (size_t i = 0; i < strategies.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  size_t best = 0;
+  for (size_t i = 1; i < packings.size(); ++i) {
+    if (packings[i].size() < packings[best].size()) {
+      best = i;
+    }
+  }
+  TRACE(IDEX, 1,
+        "Packed %lu classes into %lu dexes with strategy %lu, greedy needs "
+        "%lu\n",
+        classes.size(),
+        packings[best].size(),
+        best,
+        packings[0].size());
+  packed_dexes_saved = packings[0].size() - packings[best].size();
+
+  const auto& packing = packings[best];
+  for (size_t i = 0; i < packing.size(); ++i) {
+    if (i > 0) {
+      flush_out_secondary(pass, det, outdex);
+    }
+    for (auto idx : packing[i]) {
+      // emit_class() starts a new dex anyway if plugins now say that the
+      // class doesn't fit.
+      emit_class(pass,
+                 det,
+                 outdex,
+                 input.classes[idx],
+                 false, /* not primary */
+                 false /* already checked */);
+    }
+  }
+}
+
 std::unordered_set<const DexClass*> find_unrefenced_coldstart_classes(
     const Scope& scope,
     dex_emit_tracker& det,
-    const std::vector<std::string>& interdexorder,
+    const std::vector<DexType*>& interdexorder,
     bool static_prune_classes) {
   int old_no_ref = -1;
   int new_no_ref = 0;
@@ -383,9 +632,10 @@ std::unordered_set<const DexClass*> find_unrefenced_coldstart_classes(
     return unreferenced_classes;
   }
 
-  for (auto const& class_string : interdexorder) {
-    if (det.clookup.count(class_string)) {
-      coldstart_classes.insert(det.clookup[class_string]);
+  for (auto type : interdexorder) {
+    auto clazz = det.find_class(type);
+    if (clazz != nullptr) {
+      coldstart_classes.insert(clazz);
     }
   }
 
@@ -468,16 +718,17 @@ DexClassesVector run_interdex(InterDexPass* pass,
   cls_skipped_in_primary = 0;
   cls_skipped_in_secondary = 0;
 
-  auto interdexorder = cfg.get_coldstart_classes();
+  const auto& interdex_names = cfg.get_coldstart_classes();
+  const auto& interdexorder = cfg.get_coldstart_types();
   dex_emit_tracker det;
   for (auto const& dex : dexen) {
     for (auto const& clazz : dex) {
-      std::string clzname(clazz->get_type()->get_name()->c_str());
-      det.clookup[clzname] = clazz;
+      det.clookup[clazz->get_type()] = clazz;
     }
   }
 
   auto scope = build_class_scope(dexen);
+  precompute_refs(scope);
 
   auto unreferenced_classes = find_unrefenced_coldstart_classes(
       scope,
@@ -495,20 +746,18 @@ DexClassesVector run_interdex(InterDexPass* pass,
     dex_emit_tracker primary_det;
     auto const& primary_dex = dexen[0];
     for (auto const& clazz : primary_dex) {
-      std::string clzname(clazz->get_type()->get_name()->c_str());
-      primary_det.clookup[clzname] = clazz;
+      primary_det.clookup[clazz->get_type()] = clazz;
     }
 
     // First emit just the primary dex, but sort it according to interdex order
     auto coldstart_classes_in_primary = 0;
     // first add the classes in the interdex list
-    for (auto& entry : interdexorder) {
-      auto it = primary_det.clookup.find(entry);
-      if (it == primary_det.clookup.end()) {
-        TRACE(IDEX, 4, "No such entry %s\n", entry.c_str());
+    for (size_t i = 0; i < interdexorder.size(); ++i) {
+      auto clazz = primary_det.find_class(interdexorder[i]);
+      if (clazz == nullptr) {
+        TRACE(IDEX, 4, "No such entry %s\n", interdex_names[i].c_str());
         continue;
       }
-      auto clazz = it->second;
       if (unreferenced_classes.count(clazz)) {
         TRACE(IDEX, 3, "%s no longer linked to coldstart set.\n", SHOW(clazz));
         cls_skipped_in_primary++;
@@ -537,9 +786,10 @@ DexClassesVector run_interdex(InterDexPass* pass,
   // cold-start set.  Otherwise, we calculate it on the basis of the
   // whole list.
   bool end_markers_present = false;
-  for (auto& entry : interdexorder) {
-    auto it = det.clookup.find(entry);
-    if (it == det.clookup.end()) {
+  for (size_t i = 0; i < interdexorder.size(); ++i) {
+    const auto& entry = interdex_names[i];
+    auto clazz = det.find_class(interdexorder[i]);
+    if (clazz == nullptr) {
       TRACE(IDEX, 4, "No such entry %s\n", entry.c_str());
       if (entry.find("DexEndMarker") != std::string::npos) {
         TRACE(IDEX, 1, "Terminating dex due to DexEndMarker\n");
@@ -549,7 +799,6 @@ DexClassesVector run_interdex(InterDexPass* pass,
       }
       continue;
     }
-    auto clazz = it->second;
     if (unreferenced_classes.count(clazz)) {
       TRACE(IDEX, 3, "%s no longer linked to coldstart set.\n", SHOW(clazz));
       cls_skipped_in_secondary++;
@@ -559,13 +808,12 @@ DexClassesVector run_interdex(InterDexPass* pass,
   }
 
   // Now emit the classes we omitted from the original coldstart set
-  for (auto& entry : interdexorder) {
-    auto it = det.clookup.find(entry);
-    if (it == det.clookup.end()) {
-      TRACE(IDEX, 4, "No such entry %s\n", entry.c_str());
+  for (size_t i = 0; i < interdexorder.size(); ++i) {
+    auto clazz = det.find_class(interdexorder[i]);
+    if (clazz == nullptr) {
+      TRACE(IDEX, 4, "No such entry %s\n", interdex_names[i].c_str());
       continue;
     }
-    auto clazz = it->second;
     if (unreferenced_classes.count(clazz)) {
       emit_class(pass, det, outdex, clazz);
     }
@@ -577,23 +825,43 @@ DexClassesVector run_interdex(InterDexPass* pass,
   }
 
   // Now emit the classes that weren't specified in the head or primary list.
-  for (auto clazz : scope) {
-    emit_class(pass, det, outdex, clazz);
-  }
-  for (const auto& plugin : pass->m_plugins) {
-    auto add_classes = plugin->leftover_classes();
-    for (auto add_class : add_classes) {
-      TRACE(IDEX,
-            4,
-            "IDEX: Emitting plugin generated leftover class :: %s\n",
-            SHOW(add_class));
-      emit_class(
-          pass,
-          det,
-          outdex,
-          add_class,
-          false, /* not primary */
-          false /* shouldn't skip */);
+  if (pack_secondary_dexes) {
+    std::vector<DexClass*> leftover;
+    std::unordered_set<DexClass*> seen;
+    for (auto clazz : scope) {
+      if (det.emitted.count(clazz) == 0 && !is_canary(clazz) &&
+          !should_skip_class(pass, clazz) && seen.insert(clazz).second) {
+        leftover.push_back(clazz);
+      }
+    }
+    for (const auto& plugin : pass->m_plugins) {
+      for (auto add_class : plugin->leftover_classes()) {
+        if (det.emitted.count(add_class) == 0 && !is_canary(add_class) &&
+            seen.insert(add_class).second) {
+          leftover.push_back(add_class);
+        }
+      }
+    }
+    emit_packed(pass, det, outdex, leftover);
+  } else {
+    for (auto clazz : scope) {
+      emit_class(pass, det, outdex, clazz);
+    }
+    for (const auto& plugin : pass->m_plugins) {
+      auto add_classes = plugin->leftover_classes();
+      for (auto add_class : add_classes) {
+        TRACE(IDEX,
+              4,
+              "IDEX: Emitting plugin generated leftover class :: %s\n",
+              SHOW(add_class));
+        emit_class(
+            pass,
+            det,
+            outdex,
+            add_class,
+            false, /* not primary */
+            false /* shouldn't skip */);
+      }
     }
   }
 
@@ -616,6 +884,7 @@ DexClassesVector run_interdex(InterDexPass* pass,
 %d in secondary dexes due to static analysis\n",
     cls_skipped_in_primary,
     cls_skipped_in_secondary);
+  precomputed_refs.clear();
   return outdex;
 }
 
@@ -633,13 +902,18 @@ void InterDexPass::run_pass(DexClassesVector& dexen,
     plugin->configure(original_scope, cfg);
   }
   emit_canaries = m_emit_canaries;
+  pack_secondary_dexes = m_pack_secondary_dexes;
   linear_alloc_limit = m_linear_alloc_limit;
+  packed_dexes_saved = 0;
   dexen = run_interdex(
       this, dexen, cfg, true, m_static_prune, m_normal_primary_dex);
   for (const auto& plugin : m_plugins) {
     plugin->cleanup(original_scope);
   }
   mgr.incr_metric(METRIC_COLD_START_SET_DEX_COUNT, cold_start_set_dex_count);
+  if (pack_secondary_dexes) {
+    mgr.incr_metric(METRIC_PACKED_DEXES_SAVED, packed_dexes_saved);
+  }
 
   m_plugins.clear();
 }
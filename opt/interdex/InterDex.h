@@ -17,6 +17,7 @@
 #include "Util.h"
 
 #define METRIC_COLD_START_SET_DEX_COUNT "cold_start_set_dex_count"
+#define METRIC_PACKED_DEXES_SAVED "packed_dexes_saved"
 
 #define INTERDEX_PASS_NAME "InterDexPass"
 #define INTERDEX_PLUGIN "InterDexPlugin"
@@ -66,6 +67,7 @@ class InterDexPass : public Pass {
     pc.get("emit_canaries", true, m_emit_canaries);
     pc.get("normal_primary_dex", false, m_normal_primary_dex);
     pc.get("linear_alloc_limit", 11600 * 1024, m_linear_alloc_limit);
+    pc.get("pack_secondary_dexes", false, m_pack_secondary_dexes);
   }
 
   virtual void run_pass(DexClassesVector&, Scope&, ConfigFiles&, PassManager&);
@@ -78,4 +80,5 @@ class InterDexPass : public Pass {
   bool m_emit_canaries;
   bool m_normal_primary_dex;
   int64_t m_linear_alloc_limit;
+  bool m_pack_secondary_dexes;
 };
@@ -19,6 +19,8 @@
 #include "ControlFlow.h"
 #include "DexClass.h"
 #include "DexUtil.h"
+#include "HierarchyCache.h"
+#include "IncrementalCache.h"
 #include "IRCode.h"
 #include "IRInstruction.h"
 #include "DexUtil.h"
@@ -121,6 +123,7 @@ void remove_empty_try_regions(IRCode* code) {
         try_start->type = MFLOW_FALLTHROUGH;
         try_start = nullptr;
         mie.type = MFLOW_FALLTHROUGH;
+        code->mark_modified();
       }
     } else if (mie.type == MFLOW_OPCODE) {
       auto op = mie.insn->opcode();
@@ -265,7 +268,7 @@ bool LocalDce::is_required(IRInstruction* inst,
     if (is_invoke(inst->opcode())) {
       const auto meth =
           resolve_method(inst->get_method(), opcode_to_search(inst));
-      if (!is_pure(inst->get_method(), meth)) {
+      if (!is_pure(inst, meth)) {
         return true;
       }
       return bliveness.test(bliveness.size() - 1);
@@ -282,11 +285,16 @@ bool LocalDce::is_required(IRInstruction* inst,
   return false;
 }
 
-bool LocalDce::is_pure(DexMethodRef* ref, DexMethod* meth) {
+bool LocalDce::is_pure(IRInstruction* inst, DexMethod* meth) {
   if (meth != nullptr && assumenosideeffects(meth)) {
     return true;
   }
-  return m_pure_methods.find(ref) != m_pure_methods.end();
+  if (m_pure_methods.find(inst->get_method()) != m_pure_methods.end()) {
+    return true;
+  }
+  // The object that a constructor initializes can't be used without it.
+  return m_side_effects != nullptr && meth != nullptr && !is_init(meth) &&
+         side_effects::is_removable(m_side_effects->get_invoke(inst));
 }
 
 void LocalDcePass::run(DexMethod* m) {
@@ -302,23 +310,26 @@ void LocalDcePass::run_pass(DexStoresVector& stores,
     return;
   }
   auto scope = build_class_scope(stores);
-  auto stats = walk::parallel::reduce_methods<std::nullptr_t, LocalDce::Stats>(
-      scope,
-      [&](std::nullptr_t, DexMethod* m) {
-        auto* code = m->get_code();
-        if (code == nullptr) {
-          return LocalDce::Stats();
-        }
-        LocalDce ldce;
-        ldce.dce(m);
-        return ldce.get_stats();
-      },
-      [](LocalDce::Stats a, LocalDce::Stats b) {
-        a.dead_instruction_count += b.dead_instruction_count;
-        a.unreachable_instruction_count += b.unreachable_instruction_count;
-        return a;
-      },
-      [](int) { return nullptr; });
+  const SideEffectSummaries* side_effects = nullptr;
+  auto cache = mgr.get_incremental_cache();
+  if (m_use_side_effect_summaries) {
+    side_effects = &mgr.get_hierarchy_cache().get_side_effect_summaries();
+    // What a method becomes now depends on the methods it calls.
+    if (cache != nullptr) {
+      TRACE(DCE, 1, "Not using the incremental cache with side effects\n");
+      cache = nullptr;
+    }
+  }
+  auto stats = walk::parallel::reduce_code<LocalDce::Stats>(
+      scope, [&](LocalDce::Stats& stats, DexMethod* m, IRCode&) {
+        auto dce = [side_effects](DexMethod* m) {
+          LocalDce ldce(side_effects);
+          ldce.dce(m);
+          return ldce.get_stats();
+        };
+        stats += cache != nullptr ? cache->optimize<LocalDce::Stats>(m, dce)
+                                  : dce(m);
+      });
   mgr.incr_metric(METRIC_DEAD_INSTRUCTIONS, stats.dead_instruction_count);
   mgr.incr_metric(METRIC_UNREACHABLE_INSTRUCTIONS,
                   stats.unreachable_instruction_count);
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "Pass.h"
+#include "SideEffectSummaries.h"
 
 #include <boost/dynamic_bitset.hpp>
 
@@ -18,6 +19,12 @@ class LocalDce {
   struct Stats {
     size_t dead_instruction_count{0};
     size_t unreachable_instruction_count{0};
+
+    Stats& operator+=(const Stats& that) {
+      dead_instruction_count += that.dead_instruction_count;
+      unreachable_instruction_count += that.unreachable_instruction_count;
+      return *this;
+    }
   };
 
   /*
@@ -46,7 +53,12 @@ class LocalDce {
    *   potentially-excepting instructions can jump to a catch.)
    */
 
-  LocalDce() {
+  /*
+   * With side effect summaries, the calls to the methods that only read or
+   * allocate are pure too.
+   */
+  explicit LocalDce(const SideEffectSummaries* side_effects = nullptr)
+      : m_side_effects(side_effects) {
     /*
      * Pure methods have no observable side effects, so they can be removed
      * if their outputs are not used.
@@ -64,11 +76,12 @@ class LocalDce {
 
  private:
   std::unordered_set<DexMethodRef*> m_pure_methods;
+  const SideEffectSummaries* m_side_effects;
   Stats m_stats;
 
   bool is_required(IRInstruction* inst,
                    const boost::dynamic_bitset<>& bliveness);
-  bool is_pure(DexMethodRef* ref, DexMethod* meth);
+  bool is_pure(IRInstruction* inst, DexMethod* meth);
 };
 
 class LocalDcePass : public Pass {
@@ -77,5 +90,19 @@ class LocalDcePass : public Pass {
 
   static void run(DexMethod* method);
 
+  virtual void configure_pass(const PassConfig& pc) override {
+    pc.get("use_side_effect_summaries", true, m_use_side_effect_summaries);
+  }
+
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  // The side effect summaries come from the code of the callees.
+  virtual bool is_method_local() const override {
+    return !m_use_side_effect_summaries;
+  }
+
+ private:
+  bool m_use_side_effect_summaries{true};
 };
@@ -12,6 +12,7 @@
 #include "ClassHierarchy.h"
 #include "DexClass.h"
 #include "DexUtil.h"
+#include "HierarchyCache.h"
 #include "IRCode.h"
 #include "Obfuscate.h"
 #include "ObfuscateUtils.h"
@@ -21,6 +22,7 @@
 #include "Trace.h"
 #include "VirtualRenamer.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -74,34 +76,17 @@ void debug_logging(std::vector<DexClass*>& classes) {
   TRACE(OBFUSCATE, 3, "Finished applying new names to defs\n");
 }
 
-template<typename DexMember, typename DexMemberRef, typename DexMemberSpec, typename K>
-DexMember* find_renamable_ref(DexMemberRef* ref,
-    std::unordered_map<DexMemberRef*, DexMember*>& ref_def_cache,
-    DexElemManager<DexMember*, DexMemberRef*, DexMemberSpec, K>& name_mapping) {
-  TRACE(OBFUSCATE, 4, "Found a ref opcode\n");
-  DexMember* def = nullptr;
-  auto member_itr = ref_def_cache.find(ref);
-  if (member_itr != ref_def_cache.end()) {
-    def = member_itr->second;
-  } else {
-    def = name_mapping.def_of_ref(ref);
-  }
-  ref_def_cache[ref] = def;
-  return def;
-}
-
+// The name managers are only read from here on, so the workers share them as
+// the table of renamed members.
 void update_refs(Scope& scope, DexFieldManager& field_name_mapping,
     DexMethodManager& method_name_mapping) {
-  std::unordered_map<DexFieldRef*, DexField*> f_ref_def_cache;
-  std::unordered_map<DexMethodRef*, DexMethod*> m_ref_def_cache;
-  walk::opcodes(scope,
+  walk::parallel::opcodes(scope,
     [](DexMethod*) { return true; },
     [&](DexMethod*, IRInstruction* instr) {
       if (instr->has_field()) {
         DexFieldRef* field_ref = instr->get_field();
         if (field_ref->is_def()) return;
-        DexField* field_def =
-            find_renamable_ref(field_ref, f_ref_def_cache, field_name_mapping);
+        DexField* field_def = field_name_mapping.def_of_ref(field_ref);
         if (field_def != nullptr) {
           TRACE(OBFUSCATE, 4, "Found a ref to fixup %s", SHOW(field_ref));
           instr->set_field(field_def);
@@ -109,9 +94,7 @@ void update_refs(Scope& scope, DexFieldManager& field_name_mapping,
       } else if (instr->has_method()) {
         DexMethodRef* method_ref = instr->get_method();
         if (method_ref->is_def()) return;
-        DexMethod* method_def =
-            find_renamable_ref(method_ref, m_ref_def_cache,
-                method_name_mapping);
+        DexMethod* method_def = method_name_mapping.def_of_ref(method_ref);
         if (method_def != nullptr) {
           TRACE(OBFUSCATE, 4, "Found a ref to fixup %s", SHOW(method_ref));
           instr->set_method(method_def);
@@ -120,6 +103,137 @@ void update_refs(Scope& scope, DexFieldManager& field_name_mapping,
     });
 }
 
+/*
+ * Picks the new names of the fields and direct methods of a class. The names
+ * to avoid only come from the class itself, its superclasses and its
+ * subclasses.
+ */
+void obfuscate_class(DexClass* cls,
+                     const ClassHierarchy& ch,
+                     DexFieldManager& field_name_manager,
+                     DexMethodManager& method_name_manager) {
+  always_assert_log(!cls->is_external(),
+      "Shouldn't rename members of external classes. %s", SHOW(cls));
+  // Checks to short-circuit expensive name-gathering logic (code is still
+  // correct w/o this, but does unnecessary work)
+  bool operate_on_ifields =
+      contains_renamable_elem(cls->get_ifields(), field_name_manager);
+  bool operate_on_sfields =
+      contains_renamable_elem(cls->get_sfields(), field_name_manager);
+  bool operate_on_dmethods =
+      contains_renamable_elem(cls->get_dmethods(), method_name_manager);
+  if (operate_on_ifields || operate_on_sfields) {
+    FieldObfuscationState f_ob_state;
+    SimpleNameGenerator<DexField*> simple_name_generator(
+        f_ob_state.ids_to_avoid, f_ob_state.used_ids);
+    StaticFieldNameGenerator static_name_generator(
+        f_ob_state.ids_to_avoid, f_ob_state.used_ids);
+
+    TRACE(OBFUSCATE, 3, "Renaming the fields of class %s\n",
+        SHOW(cls->get_name()));
+
+    f_ob_state.populate_ids_to_avoid(cls, field_name_manager, true, ch);
+
+    // Keep this for all public ids in the class (they shouldn't conflict)
+    if (operate_on_ifields) {
+      obfuscate_elems(
+          FieldRenamingContext(cls->get_ifields(),
+              f_ob_state.ids_to_avoid,
+              simple_name_generator, false),
+          field_name_manager);
+    }
+    if (operate_on_sfields) {
+      obfuscate_elems(
+          FieldRenamingContext(cls->get_sfields(),
+              f_ob_state.ids_to_avoid,
+              static_name_generator, false),
+          field_name_manager);
+    }
+
+    // Obfu private fields
+    f_ob_state.populate_ids_to_avoid(cls, field_name_manager, false, ch);
+
+    // Keep this for all public ids in the class (they shouldn't conflict)
+    if (operate_on_ifields) {
+      obfuscate_elems(
+          FieldRenamingContext(cls->get_ifields(),
+          f_ob_state.ids_to_avoid,
+          simple_name_generator, true),
+      field_name_manager);
+    }
+    if (operate_on_sfields) {
+      obfuscate_elems(
+          FieldRenamingContext(cls->get_sfields(),
+              f_ob_state.ids_to_avoid,
+              static_name_generator, true),
+          field_name_manager);
+    }
+
+    // Make sure to bind the new names otherwise not all generators will
+    // assign names to the members
+    static_name_generator.bind_names();
+  }
+
+  // =========== Obfuscate Methods Below ==========
+  if (operate_on_dmethods) {
+    MethodObfuscationState m_ob_state;
+    MethodNameGenerator simple_name_gen(m_ob_state.ids_to_avoid,
+        m_ob_state.used_ids);
+
+    TRACE(OBFUSCATE, 3, "Renaming the methods of class %s\n",
+              SHOW(cls->get_name()));
+    m_ob_state.populate_ids_to_avoid(cls, method_name_manager, true, ch);
+
+    // Keep this for all public ids in the class (they shouldn't conflict)
+    obfuscate_elems(
+        MethodRenamingContext(cls->get_dmethods(),
+            m_ob_state.ids_to_avoid,
+            simple_name_gen,
+            method_name_manager,
+            false),
+        method_name_manager);
+
+    // Obfu private methods
+    m_ob_state.populate_ids_to_avoid(cls, method_name_manager, false, ch);
+
+    obfuscate_elems(
+        MethodRenamingContext(cls->get_dmethods(),
+            m_ob_state.ids_to_avoid,
+            simple_name_gen,
+            method_name_manager,
+            true),
+        method_name_manager);
+  }
+}
+
+/*
+ * Groups the classes of the scope by the top-most class of the scope they
+ * inherit from. Since obfuscate_class() never looks outside of the hierarchy
+ * of a class, the groups can be named independently of one another. The
+ * classes of a group keep their order in the scope, so that they get the same
+ * names as they would if the whole scope was named at once.
+ */
+std::vector<std::vector<DexClass*>> partition_by_hierarchy(
+    const Scope& scope) {
+  std::vector<std::vector<DexClass*>> partitions;
+  std::unordered_map<const DexClass*, size_t> root_to_partition;
+  for (DexClass* cls : scope) {
+    const DexClass* root = cls;
+    auto super_cls = type_class(root->get_super_class());
+    while (super_cls != nullptr && !super_cls->is_external()) {
+      root = super_cls;
+      super_cls = type_class(root->get_super_class());
+    }
+    auto it = root_to_partition.find(root);
+    if (it == root_to_partition.end()) {
+      it = root_to_partition.emplace(root, partitions.size()).first;
+      partitions.emplace_back();
+    }
+    partitions[it->second].push_back(cls);
+  }
+  return partitions;
+}
+
 void get_totals(Scope& scope, RenameStats& stats) {
   for (const auto& cls : scope) {
     stats.fields_total += cls->get_ifields().size();
@@ -131,106 +245,38 @@ void get_totals(Scope& scope, RenameStats& stats) {
 
 } // end namespace
 
-void obfuscate(Scope& scope, RenameStats& stats) {
+void obfuscate(Scope& scope, const ClassHierarchy& ch, RenameStats& stats) {
   get_totals(scope, stats);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+
+  // Each partition gets its own name managers, which are merged once all the
+  // names are picked.
+  auto partitions = partition_by_hierarchy(scope);
+  std::vector<DexFieldManager> field_name_managers;
+  std::vector<DexMethodManager> method_name_managers;
+  field_name_managers.reserve(partitions.size());
+  method_name_managers.reserve(partitions.size());
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    field_name_managers.emplace_back(new_dex_field_manager());
+    method_name_managers.emplace_back(new_dex_method_manager());
+  }
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        for (DexClass* cls : partitions[i]) {
+          obfuscate_class(
+              cls, ch, field_name_managers[i], method_name_managers[i]);
+        }
+      },
+      walk::parallel::default_num_threads());
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    wq.add_item(i, partitions[i].size());
+  }
+  wq.run_all();
 
   DexFieldManager field_name_manager(new_dex_field_manager());
   DexMethodManager method_name_manager = new_dex_method_manager();
-
-  for (DexClass* cls : scope) {
-    always_assert_log(!cls->is_external(),
-        "Shouldn't rename members of external classes. %s", SHOW(cls));
-    // Checks to short-circuit expensive name-gathering logic (code is still
-    // correct w/o this, but does unnecessary work)
-    bool operate_on_ifields =
-        contains_renamable_elem(cls->get_ifields(), field_name_manager);
-    bool operate_on_sfields =
-        contains_renamable_elem(cls->get_sfields(), field_name_manager);
-    bool operate_on_dmethods =
-        contains_renamable_elem(cls->get_dmethods(), method_name_manager);
-    if (operate_on_ifields || operate_on_sfields) {
-      FieldObfuscationState f_ob_state;
-      SimpleNameGenerator<DexField*> simple_name_generator(
-          f_ob_state.ids_to_avoid, f_ob_state.used_ids);
-      StaticFieldNameGenerator static_name_generator(
-          f_ob_state.ids_to_avoid, f_ob_state.used_ids);
-
-      TRACE(OBFUSCATE, 3, "Renaming the fields of class %s\n",
-          SHOW(cls->get_name()));
-
-      f_ob_state.populate_ids_to_avoid(cls, field_name_manager, true, ch);
-
-      // Keep this for all public ids in the class (they shouldn't conflict)
-      if (operate_on_ifields) {
-        obfuscate_elems(
-            FieldRenamingContext(cls->get_ifields(),
-                f_ob_state.ids_to_avoid,
-                simple_name_generator, false),
-            field_name_manager);
-      }
-      if (operate_on_sfields) {
-        obfuscate_elems(
-            FieldRenamingContext(cls->get_sfields(),
-                f_ob_state.ids_to_avoid,
-                static_name_generator, false),
-            field_name_manager);
-      }
-
-      // Obfu private fields
-      f_ob_state.populate_ids_to_avoid(cls, field_name_manager, false, ch);
-
-      // Keep this for all public ids in the class (they shouldn't conflict)
-      if (operate_on_ifields) {
-        obfuscate_elems(
-            FieldRenamingContext(cls->get_ifields(),
-            f_ob_state.ids_to_avoid,
-            simple_name_generator, true),
-        field_name_manager);
-      }
-      if (operate_on_sfields) {
-        obfuscate_elems(
-            FieldRenamingContext(cls->get_sfields(),
-                f_ob_state.ids_to_avoid,
-                static_name_generator, true),
-            field_name_manager);
-      }
-
-      // Make sure to bind the new names otherwise not all generators will
-      // assign names to the members
-      static_name_generator.bind_names();
-    }
-
-    // =========== Obfuscate Methods Below ==========
-    if (operate_on_dmethods) {
-      MethodObfuscationState m_ob_state;
-      MethodNameGenerator simple_name_gen(m_ob_state.ids_to_avoid,
-          m_ob_state.used_ids);
-
-      TRACE(OBFUSCATE, 3, "Renaming the methods of class %s\n",
-                SHOW(cls->get_name()));
-      m_ob_state.populate_ids_to_avoid(cls, method_name_manager, true, ch);
-
-      // Keep this for all public ids in the class (they shouldn't conflict)
-      obfuscate_elems(
-          MethodRenamingContext(cls->get_dmethods(),
-              m_ob_state.ids_to_avoid,
-              simple_name_gen,
-              method_name_manager,
-              false),
-          method_name_manager);
-
-      // Obfu private methods
-      m_ob_state.populate_ids_to_avoid(cls, method_name_manager, false, ch);
-
-      obfuscate_elems(
-          MethodRenamingContext(cls->get_dmethods(),
-              m_ob_state.ids_to_avoid,
-              simple_name_gen,
-              method_name_manager,
-              true),
-          method_name_manager);
-    }
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    field_name_manager.merge(std::move(field_name_managers[i]));
+    method_name_manager.merge(std::move(method_name_managers[i]));
   }
   field_name_manager.print_elements();
   method_name_manager.print_elements();
@@ -274,7 +320,7 @@ void ObfuscatePass::run_pass(DexStoresVector& stores,
   }
   auto scope = build_class_scope(stores);
   RenameStats stats;
-  obfuscate(scope, stats);
+  obfuscate(scope, mgr.get_hierarchy_cache().get_class_hierarchy(), stats);
   mgr.incr_metric(
       METRIC_FIELD_TOTAL, static_cast<int>(stats.fields_total));
   mgr.incr_metric(
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include "ClassHierarchy.h"
 #include "PassManager.h"
 
 class ObfuscatePass : public Pass {
@@ -16,6 +17,8 @@ class ObfuscatePass : public Pass {
   ObfuscatePass() : Pass("ObfuscatePass") {}
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
 };
 
 struct RenameStats {
@@ -27,4 +30,4 @@ struct RenameStats {
   size_t vmethods_renamed = 0;
 };
 
-void obfuscate(Scope& classes, RenameStats& stats);
+void obfuscate(Scope& classes, const ClassHierarchy& ch, RenameStats& stats);
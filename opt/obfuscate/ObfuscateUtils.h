@@ -477,6 +477,22 @@ public:
         [sig_getter_fn(elem)][elem->get_name()].get() : emplace(elem);
   }
 
+  // Takes over the wrappers of another manager. Both may have wrapped the
+  // same elements of external classes, which are never renamed, in which case
+  // we keep ours.
+  void merge(DexElemManager&& other) {
+    for (auto& class_itr : other.elements) {
+      auto& sigs = elements[class_itr.first];
+      for (auto& type_itr : class_itr.second) {
+        auto& names = sigs[type_itr.first];
+        for (auto& name_wrap : type_itr.second) {
+          names.emplace(name_wrap.first, std::move(name_wrap.second));
+        }
+      }
+    }
+    other.elements.clear();
+  }
+
   // Commits all the renamings in elements to the dex by modifying the
   // underlying DexFields. Does in-place modification. Returns the number
   // of elements renamed
@@ -12,9 +12,11 @@
 #include "VirtualScope.h"
 #include "DexUtil.h"
 #include "DexAccess.h"
+#include "IRCode.h"
 #include "Resolver.h"
 #include "Trace.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 #include <map>
 #include <set>
@@ -110,6 +112,19 @@ using RefsMap =
     std::unordered_map<DexMethod*,
                        std::set<DexMethodRef*, dexmethods_comparator>>;
 
+// The refs found by one thread, merged with the others' once all the code
+// has been walked.
+struct RefsCollector {
+  RefsMap def_refs;
+
+  RefsCollector& operator+=(const RefsCollector& that) {
+    for (const auto& pair : that.def_refs) {
+      def_refs[pair.first].insert(pair.second.begin(), pair.second.end());
+    }
+    return *this;
+  }
+};
+
 /**
  * Rename a given method with the given name.
  */
@@ -196,7 +211,7 @@ struct VirtualRenamer {
       class_scopes(class_scopes),
       def_refs(def_refs) {}
 
-  int rename_virtual_scopes(const DexType* type, int& seed) const;
+  int rename_virtual_scopes(const DexType* root, int& seed) const;
   int rename_interface_scopes(int& seed) const;
 
 private:
@@ -204,6 +219,7 @@ private:
   const RefsMap& def_refs;
 
 private:
+  int rename_scopes_of(const DexType* type, int& seed) const;
   DexString* get_unescaped_name(
       std::vector<const VirtualScope*> scopes,
       int& seed) const;
@@ -343,87 +359,132 @@ int VirtualRenamer::rename_interface_scopes(int& seed) const {
 }
 
 /**
- * Rename only scopes that are not interface and can_rename.
+ * Rename only the scopes rooted at type that are not interface and
+ * can_rename.
  */
-int VirtualRenamer::rename_virtual_scopes(
-    const DexType* type, int& seed) const {
+int VirtualRenamer::rename_scopes_of(const DexType* type, int& seed) const {
   int renamed = 0;
   const auto cls = type_class(type);
   TRACE(OBFUSCATE, 5, "Attempting to rename %s\n", SHOW(type));
   // object or external classes are not renamable, move
   // to the children
-  if (cls != nullptr && !cls->is_external()) {
-    const auto& scopes = class_scopes.get(type);
-    // rename all scopes at this level that are not interface
-    // and can be renamed
-    TRACE(OBFUSCATE, 5, "Found %ld scopes in %s\n", scopes.size(), SHOW(type));
-    for (auto& scope : scopes) {
-      if (!can_rename_scope(scope)) {
-        TRACE(OBFUSCATE, 5,
-            "Cannot rename %s\n", SHOW(scope->methods[0].first));
-        continue;
-      }
-      if (is_impl_scope(scope)) {
-        TRACE(OBFUSCATE, 5,
-            "Impl scope %s\n", SHOW(scope->methods[0].first));
-        continue;
-      }
-      auto name =  get_unescaped_name(scope, seed);
-      TRACE(OBFUSCATE, 5, "New name %s for %s\n",
-          SHOW(name), SHOW(scope->methods[0].first));
-      renamed += rename_scope(scope, def_refs, name);
-    }
+  if (cls == nullptr || cls->is_external()) {
+    return renamed;
   }
-
-  // will be used for interface renaming, effectively this
-  // gets the last name (seed) for all virtual scopes and
-  // interface are treated as all being at the same scope,
-  // that is, they will all have different names irrespective
-  // of where they are in the hierarchy
-  int max_seed = seed;
-  // recurse into children
-  for (const auto& child :
-      get_children(class_scopes.get_class_hierarchy(), type)) {
-    int base_seed = seed;
-    renamed += rename_virtual_scopes(child, base_seed);
-    max_seed = std::max(max_seed, base_seed);
+  const auto& scopes = class_scopes.get(type);
+  // rename all scopes at this level that are not interface
+  // and can be renamed
+  TRACE(OBFUSCATE, 5, "Found %ld scopes in %s\n", scopes.size(), SHOW(type));
+  for (auto& scope : scopes) {
+    if (!can_rename_scope(scope)) {
+      TRACE(OBFUSCATE, 5,
+          "Cannot rename %s\n", SHOW(scope->methods[0].first));
+      continue;
+    }
+    if (is_impl_scope(scope)) {
+      TRACE(OBFUSCATE, 5,
+          "Impl scope %s\n", SHOW(scope->methods[0].first));
+      continue;
+    }
+    auto name =  get_unescaped_name(scope, seed);
+    TRACE(OBFUSCATE, 5, "New name %s for %s\n",
+        SHOW(name), SHOW(scope->methods[0].first));
+    renamed += rename_scope(scope, def_refs, name);
   }
-  seed = max_seed;
   return renamed;
 }
 
 /**
- * Collect all method refs to concrete methods (definitions).
+ * Rename the scopes of root and of all the types below it, parents first.
+ *
+ * Each child starts from the seed its parent left, so siblings reuse the
+ * same names. The scopes of a type can only collide with those of its
+ * ancestors and descendants, so once a type is done, the subtrees of its
+ * children are renamed in parallel. The names don't depend on the schedule:
+ * a type's seed only depends on its ancestors.
+ *
+ * On return, seed is the largest one any type left. It will be used for
+ * interface renaming: interfaces are treated as all being at the same scope,
+ * that is, they will all have different names irrespective of where they are
+ * in the hierarchy.
  */
-void collect_refs(Scope& scope, RefsMap& def_refs) {
-  walk::opcodes(scope, [](DexMethod*) { return true; },
-    [&](DexMethod*, IRInstruction* insn) {
-      if (!insn->has_method()) return;
-      auto callee = insn->get_method();
-      if (callee->is_concrete()) return;
-      auto cls = type_class(callee->get_class());
-      if (cls == nullptr || cls->is_external()) return;
-      DexMethod* top = nullptr;
-      if (is_interface(cls)) {
-        top = resolve_method(callee, MethodSearch::Interface);
-      } else {
-        top = find_top_impl(cls, callee->get_name(), callee->get_proto());
-        if (top == nullptr) {
-          TRACE(OBFUSCATE, 2, "Possible top miranda: %s\n", SHOW(callee));
-          // see if it's a virtual call to an interface miranda method
-          top = find_top_intf_impl(
-              cls, callee->get_name(), callee->get_proto());
-          if (top != nullptr) {
-            TRACE(OBFUSCATE, 2, "Top miranda: %s\n", SHOW(top));
-          }
+int VirtualRenamer::rename_virtual_scopes(
+    const DexType* root, int& seed) const {
+  struct Result {
+    int renamed{0};
+    int max_seed{0};
+  };
+  using Item = std::pair<const DexType*, int>;
+  WorkQueue<Item, std::nullptr_t, Result>* queue;
+  auto wq = workqueue_mapreduce<Item, Result>(
+      [&](Item item) {
+        int type_seed = item.second;
+        Result result;
+        result.renamed = rename_scopes_of(item.first, type_seed);
+        result.max_seed = type_seed;
+        for (const auto& child :
+             get_children(class_scopes.get_class_hierarchy(), item.first)) {
+          queue->add_item(Item(child, type_seed));
         }
+        return result;
+      },
+      [](Result a, Result b) {
+        a.renamed += b.renamed;
+        a.max_seed = std::max(a.max_seed, b.max_seed);
+        return a;
+      });
+  queue = &wq;
+  wq.set_wait_for_dynamic_items(true);
+  wq.add_item(Item(root, seed));
+  auto result = wq.run_all();
+  seed = std::max(seed, result.max_seed);
+  return result.renamed;
+}
+
+/**
+ * Collect the method ref of insn, if it resolves to a concrete method
+ * (definition).
+ */
+void collect_ref(IRInstruction* insn, RefsMap& def_refs) {
+  if (!insn->has_method()) return;
+  auto callee = insn->get_method();
+  if (callee->is_concrete()) return;
+  auto cls = type_class(callee->get_class());
+  if (cls == nullptr || cls->is_external()) return;
+  DexMethod* top = nullptr;
+  if (is_interface(cls)) {
+    top = resolve_method(callee, MethodSearch::Interface);
+  } else {
+    top = find_top_impl(cls, callee->get_name(), callee->get_proto());
+    if (top == nullptr) {
+      TRACE(OBFUSCATE, 2, "Possible top miranda: %s\n", SHOW(callee));
+      // see if it's a virtual call to an interface miranda method
+      top = find_top_intf_impl(
+          cls, callee->get_name(), callee->get_proto());
+      if (top != nullptr) {
+        TRACE(OBFUSCATE, 2, "Top miranda: %s\n", SHOW(top));
+      }
+    }
+  }
+  if (top == nullptr || top == callee) return;
+  assert(type_class(top->get_class()) != nullptr);
+  if (type_class(top->get_class())->is_external()) return;
+  // it's a top definition on an internal class, save it
+  def_refs[top].insert(callee);
+}
+
+/**
+ * Collect all method refs to concrete methods (definitions), walking the code
+ * in parallel.
+ */
+RefsMap collect_refs(Scope& scope) {
+  auto collector = walk::parallel::reduce_code<RefsCollector>(scope,
+    [](RefsCollector& collector, DexMethod*, IRCode& code) {
+      for (const auto& mie : InstructionIterable(code)) {
+        collect_ref(mie.insn, collector.def_refs);
       }
-      if (top == nullptr || top == callee) return;
-      assert(type_class(top->get_class()) != nullptr);
-      if (type_class(top->get_class())->is_external()) return;
-      // it's a top definition on an internal class, save it
-      def_refs[top].insert(callee);
     });
+  return std::move(collector.def_refs);
 }
 
 }
@@ -435,8 +496,7 @@ size_t rename_virtuals(Scope& classes) {
   // build a ClassScope a RefsMap and a VirtualRenamer
   ClassScopes class_scopes(classes);
   scope_info(class_scopes);
-  RefsMap def_refs;
-  collect_refs(classes, def_refs);
+  auto def_refs = collect_refs(classes);
   VirtualRenamer vr(class_scopes, def_refs);
 
   // rename virtual only first
@@ -0,0 +1,678 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "OptimizeEnums.h"
+
+#include <unordered_set>
+#include <vector>
+
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "PassManager.h"
+#include "SSA.h"
+#include "Walkers.h"
+
+namespace optimize_enums {
+
+namespace {
+
+bool is_switch_map(const DexField* field) {
+  auto name = field->get_name()->str_ref();
+  return is_static(field) && field->get_type() == DexType::make_type("[I") &&
+         (name.starts_with("$SwitchMap$") ||
+          name.starts_with("$EnumSwitchMapping$"));
+}
+
+bool is_ordinal(const DexMethodRef* method, const DexType* enum_type) {
+  auto cls = method->get_class();
+  return method->get_name()->str_ref() == "ordinal" &&
+         method->get_proto()->get_rtype() == get_int_type() &&
+         method->get_proto()->get_args()->get_type_list().empty() &&
+         (cls == enum_type || cls == get_enum_type());
+}
+
+// Forgets what the registers that insn writes held.
+template <typename Map>
+void clobber(const IRInstruction* insn, Map* regs) {
+  if (!insn->dests_size()) {
+    return;
+  }
+  regs->erase(insn->dest());
+  if (insn->dest_is_wide()) {
+    regs->erase(insn->dest() + 1);
+  }
+}
+
+/*
+ * Whether the constructor passes its name and ordinal parameters to Enum's
+ * unchanged.
+ */
+bool passes_name_and_ordinal(const DexMethod* ctor) {
+  auto code = ctor->get_code();
+  if (code == nullptr) {
+    return false;
+  }
+  auto enum_ctor =
+      DexMethod::make_method("Ljava/lang/Enum;.<init>:(Ljava/lang/String;I)V");
+  std::vector<uint16_t> params;
+  bool passed = false;
+  for (const auto& mie : InstructionIterable(code)) {
+    auto insn = mie.insn;
+    if (opcode::is_load_param(insn->opcode())) {
+      params.push_back(insn->dest());
+      continue;
+    }
+    if (params.size() < 3) {
+      return false;
+    }
+    if (insn->opcode() == OPCODE_INVOKE_DIRECT &&
+        insn->get_method() == enum_ctor) {
+      if (passed || insn->src(0) != params[0] || insn->src(1) != params[1] ||
+          insn->src(2) != params[2]) {
+        return false;
+      }
+      passed = true;
+    }
+    if (insn->dests_size() &&
+        (insn->dest() == params[1] || insn->dest() == params[2] ||
+         (insn->dest_is_wide() && (insn->dest() + 1 == params[1] ||
+                                   insn->dest() + 1 == params[2])))) {
+      return false;
+    }
+  }
+  return passed;
+}
+
+/*
+ * Reads the ordinals that the static initializer of an enum gives to the
+ * constants it creates:
+ *
+ *   new-instance LColor;
+ *   move-result-pseudo-object v0
+ *   const-string "RED"
+ *   move-result-pseudo-object v1
+ *   const v2, 0
+ *   invoke-direct {v0, v1, v2}, LColor;.<init>:(Ljava/lang/String;I)V
+ *   sput-object v0, LColor;.RED:LColor;
+ */
+void compute_ordinals(const DexClass* cls, EnumOrdinals* ordinals) {
+  auto clinit = cls->get_clinit();
+  if (clinit == nullptr || clinit->get_code() == nullptr) {
+    return;
+  }
+  for (const auto* method : cls->get_dmethods()) {
+    if (is_init(method) && !passes_name_and_ordinal(method)) {
+      return;
+    }
+  }
+  auto type = cls->get_type();
+  std::unordered_map<uint16_t, int64_t> consts;
+  // The instances of the enum in registers, and their ordinals once they
+  // are constructed.
+  std::unordered_map<uint16_t, int64_t> instances;
+  constexpr int64_t UNCONSTRUCTED = -1;
+  EnumOrdinals result;
+  const IRInstruction* prev = nullptr;
+  for (const auto& mie : InstructionIterable(clinit->get_code())) {
+    auto insn = mie.insn;
+    auto op = insn->opcode();
+    if (op == OPCODE_INVOKE_DIRECT && insn->srcs_size() >= 3 &&
+        insn->get_method()->get_class() == type &&
+        insn->get_method()->get_name()->str_ref() == "<init>" &&
+        instances.count(insn->src(0)) && consts.count(insn->src(2))) {
+      instances[insn->src(0)] = consts.at(insn->src(2));
+    } else if (op == OPCODE_SPUT_OBJECT) {
+      auto it = instances.find(insn->src(0));
+      auto field = static_cast<DexField*>(insn->get_field());
+      if (it != instances.end() && it->second != UNCONSTRUCTED &&
+          field->is_def() && field->get_class() == type &&
+          field->get_type() == type && is_final(field) &&
+          !result.emplace(field, it->second).second) {
+        // Assigned twice.
+        return;
+      }
+    }
+    // Read before the move clobbers its source.
+    bool is_copy = op == OPCODE_MOVE_OBJECT && instances.count(insn->src(0));
+    auto copied = is_copy ? instances.at(insn->src(0)) : UNCONSTRUCTED;
+    clobber(insn, &consts);
+    clobber(insn, &instances);
+    if (op == OPCODE_CONST) {
+      consts[insn->dest()] = insn->get_literal();
+    } else if (is_copy) {
+      instances[insn->dest()] = copied;
+    } else if (opcode::is_move_result_pseudo(op) &&
+               prev->opcode() == OPCODE_NEW_INSTANCE &&
+               prev->get_type() == type) {
+      instances[insn->dest()] = UNCONSTRUCTED;
+    }
+    prev = insn;
+  }
+  ordinals->insert(result.begin(), result.end());
+}
+
+/*
+ * Whether initializing the enum runs no code of other classes, nor
+ * initializes them. Its constants are null until its static initializer sets
+ * them, and only the code that this initializer runs could otherwise observe
+ * that through a cycle of static initializers.
+ */
+bool initializes_in_isolation(const DexClass* cls) {
+  auto type = cls->get_type();
+  std::unordered_set<const DexMethod*> visited;
+  std::vector<const DexMethod*> worklist{cls->get_clinit()};
+  while (!worklist.empty()) {
+    auto method = worklist.back();
+    worklist.pop_back();
+    if (!visited.emplace(method).second) {
+      continue;
+    }
+    if (method->get_code() == nullptr) {
+      return false;
+    }
+    for (const auto& mie : InstructionIterable(method->get_code())) {
+      auto insn = mie.insn;
+      if (insn->has_method()) {
+        auto callee = insn->get_method();
+        auto callee_cls = callee->get_class();
+        if (callee_cls == type && callee->is_def()) {
+          worklist.push_back(static_cast<const DexMethod*>(callee));
+        } else if (callee_cls != get_enum_type() &&
+                   callee_cls != get_object_type()) {
+          return false;
+        }
+      } else if ((is_sfield_op(insn->opcode()) &&
+                  insn->get_field()->get_class() != type) ||
+                 (insn->opcode() == OPCODE_NEW_INSTANCE &&
+                  insn->get_type() != type)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+ * Whether the instruction may be part of a static initializer that only fills
+ * switch maps, so that skipping it has no visible effect.
+ */
+bool is_switch_map_initializer_insn(const IRInstruction* insn,
+                                    const DexType* holder,
+                                    const EnumOrdinals& ordinals) {
+  switch (insn->opcode()) {
+  case OPCODE_SGET_OBJECT:
+    return insn->get_field()->get_class() == holder ||
+           ordinals.count(static_cast<const DexField*>(insn->get_field()));
+  case OPCODE_SPUT_OBJECT:
+    return insn->get_field()->get_class() == holder;
+  case OPCODE_INVOKE_STATIC: {
+    auto cls = type_class(insn->get_method()->get_class());
+    return cls != nullptr && is_enum(cls) &&
+           insn->get_method()->get_name()->str_ref() == "values";
+  }
+  case OPCODE_INVOKE_VIRTUAL:
+    return insn->get_method()->get_name()->str_ref() == "ordinal";
+  case OPCODE_CONST:
+  case OPCODE_NEW_ARRAY:
+  case OPCODE_ARRAY_LENGTH:
+  case OPCODE_APUT:
+  case OPCODE_MOVE_RESULT:
+  case OPCODE_MOVE_RESULT_OBJECT:
+  case IOPCODE_MOVE_RESULT_PSEUDO:
+  case IOPCODE_MOVE_RESULT_PSEUDO_OBJECT:
+  case OPCODE_MOVE_EXCEPTION:
+  case OPCODE_GOTO:
+  case OPCODE_RETURN_VOID:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Reads the switch maps that the static initializer of a class fills:
+ *
+ *   invoke-static {}, LColor;.values:()[LColor;
+ *   move-result-object v0
+ *   array-length v0
+ *   move-result-pseudo v0
+ *   new-array v0, [I
+ *   move-result-pseudo-object v0
+ *   sput-object v0, LFoo$1;.$SwitchMap$LColor;:[I
+ *   sget-object LFoo$1;.$SwitchMap$LColor;:[I
+ *   move-result-pseudo-object v0
+ *   sget-object LColor;.BLUE:LColor;
+ *   move-result-pseudo-object v1
+ *   invoke-virtual {v1}, LColor;.ordinal:()I
+ *   move-result v1
+ *   const v2, 2
+ *   aput v2, v0, v1
+ *
+ * The stores usually sit in try blocks that catch NoSuchFieldError.
+ */
+void find_switch_maps(const DexClass* cls,
+                      const EnumOrdinals& ordinals,
+                      SwitchMaps* switch_maps) {
+  auto clinit = cls->get_clinit();
+  if (clinit == nullptr || clinit->get_code() == nullptr) {
+    return;
+  }
+  std::unordered_set<const DexFieldRef*> fields;
+  for (const auto* field : cls->get_sfields()) {
+    if (is_switch_map(field)) {
+      fields.emplace(field);
+    }
+  }
+  if (fields.empty()) {
+    return;
+  }
+  SwitchMaps result;
+  std::unordered_set<const DexField*> invalid;
+  std::unordered_set<uint16_t> new_arrays;
+  std::unordered_map<uint16_t, const DexField*> maps;
+  std::unordered_map<uint16_t, const DexField*> constants;
+  // The enum constants whose ordinal a register holds.
+  std::unordered_map<uint16_t, const DexField*> ordinals_of;
+  std::unordered_map<uint16_t, int64_t> consts;
+  const IRInstruction* prev = nullptr;
+  for (const auto& mie : InstructionIterable(clinit->get_code())) {
+    auto insn = mie.insn;
+    auto op = insn->opcode();
+    if (!is_switch_map_initializer_insn(insn, cls->get_type(), ordinals)) {
+      return;
+    }
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      auto it = maps.find(insn->src(i));
+      if (it != maps.end() && !(op == OPCODE_APUT && i == 1)) {
+        invalid.emplace(it->second);
+      }
+    }
+    if (op == OPCODE_SPUT_OBJECT && fields.count(insn->get_field())) {
+      auto field = static_cast<const DexField*>(insn->get_field());
+      if (!new_arrays.count(insn->src(0)) || result.count(field)) {
+        invalid.emplace(field);
+      }
+      result[field].clinit = clinit;
+      new_arrays.erase(insn->src(0));
+      maps[insn->src(0)] = field;
+    } else if (op == OPCODE_APUT && maps.count(insn->src(1))) {
+      auto field = maps.at(insn->src(1));
+      auto value = consts.find(insn->src(0));
+      auto index = ordinals_of.find(insn->src(2));
+      if (value == consts.end() || index == ordinals_of.end()) {
+        invalid.emplace(field);
+      } else {
+        auto& map = result[field];
+        auto enum_type = index->second->get_class();
+        if (map.enum_type != nullptr && map.enum_type != enum_type) {
+          invalid.emplace(field);
+        }
+        map.enum_type = enum_type;
+        map.case_of[ordinals.at(index->second)] = value->second;
+      }
+    }
+    // The constant whose ordinal the instruction gets.
+    const DexField* constant = nullptr;
+    if (op == OPCODE_MOVE_RESULT && prev->opcode() == OPCODE_INVOKE_VIRTUAL &&
+        constants.count(prev->src(0))) {
+      constant = constants.at(prev->src(0));
+      if (!is_ordinal(prev->get_method(), constant->get_class())) {
+        constant = nullptr;
+      }
+    }
+    clobber(insn, &new_arrays);
+    clobber(insn, &maps);
+    clobber(insn, &constants);
+    clobber(insn, &ordinals_of);
+    clobber(insn, &consts);
+    if (op == OPCODE_CONST) {
+      consts[insn->dest()] = insn->get_literal();
+    } else if (constant != nullptr) {
+      ordinals_of[insn->dest()] = constant;
+    } else if (opcode::is_move_result_pseudo(op)) {
+      if (prev->opcode() == OPCODE_NEW_ARRAY) {
+        new_arrays.emplace(insn->dest());
+      } else if (prev->opcode() == OPCODE_SGET_OBJECT) {
+        auto field = prev->get_field();
+        if (fields.count(field)) {
+          maps[insn->dest()] = static_cast<const DexField*>(field);
+        } else if (ordinals.count(static_cast<const DexField*>(field))) {
+          constants[insn->dest()] = static_cast<const DexField*>(field);
+        }
+      }
+    }
+    prev = insn;
+  }
+  for (auto& pair : result) {
+    if (invalid.count(pair.first) || pair.second.case_of.empty()) {
+      continue;
+    }
+    // Each case must come from a single ordinal.
+    std::unordered_set<int32_t> cases;
+    for (const auto& entry : pair.second.case_of) {
+      if (!cases.emplace(entry.second).second) {
+        invalid.emplace(pair.first);
+      }
+    }
+    if (!invalid.count(pair.first)) {
+      switch_maps->emplace(pair.first, std::move(pair.second));
+    }
+  }
+}
+
+/*
+ * A switch on the case that a switch map gives for the ordinal of an enum.
+ */
+struct Lookup {
+  const DexField* map;
+  IRInstruction* sget;
+  IRInstruction* aget;
+  IRInstruction* aget_result;
+  IRInstruction* switch_insn;
+};
+
+struct OrdinalCall {
+  IRInstruction* invoke;
+  IRInstruction* result;
+  int32_t ordinal;
+};
+
+struct MethodChanges {
+  std::vector<Lookup> lookups;
+  std::vector<OrdinalCall> ordinal_calls;
+};
+
+struct Analysis {
+  std::unordered_map<DexMethod*, MethodChanges> changes;
+  // The switch maps that some code reads or writes in another way.
+  std::unordered_set<const DexField*> escaped;
+};
+
+class MethodAnalyzer {
+ public:
+  MethodAnalyzer(const EnumOrdinals& ordinals,
+                 const std::unordered_set<const DexType*>& isolated_enums,
+                 const SwitchMaps& switch_maps)
+      : m_ordinals(ordinals),
+        m_isolated_enums(isolated_enums),
+        m_switch_maps(switch_maps) {}
+
+  Analysis analyze(DexMethod* method) {
+    Analysis analysis;
+    auto code = method->get_code();
+    if (code == nullptr || !scan(method, &analysis)) {
+      return analysis;
+    }
+    code->build_cfg();
+    ssa::SSAForm ssa(code->cfg());
+    MethodChanges changes;
+    for (const auto& mie : InstructionIterable(code)) {
+      auto insn = mie.insn;
+      if (insn->opcode() == OPCODE_SGET_OBJECT) {
+        auto it = m_switch_maps.find(
+            static_cast<const DexField*>(insn->get_field()));
+        if (it != m_switch_maps.end() && it->second.clinit != method) {
+          find_lookup(ssa, it->first, it->second, insn, &changes, &analysis);
+        }
+      } else if (insn->opcode() == OPCODE_INVOKE_VIRTUAL) {
+        find_ordinal_call(ssa, method, insn, &changes);
+      }
+    }
+    if (!changes.lookups.empty() || !changes.ordinal_calls.empty()) {
+      analysis.changes.emplace(method, std::move(changes));
+    }
+    return analysis;
+  }
+
+ private:
+  // Whether the method may have something to change. Also indexes the
+  // results of its instructions and the case keys of its switches.
+  bool scan(DexMethod* method, Analysis* analysis) {
+    bool relevant = false;
+    const IRInstruction* prev = nullptr;
+    for (const auto& mie : *method->get_code()) {
+      if (mie.type == MFLOW_TARGET && mie.target->type == BRANCH_MULTI) {
+        m_case_keys[mie.target->src->insn].push_back(mie.target->index);
+        continue;
+      }
+      if (mie.type != MFLOW_OPCODE) {
+        continue;
+      }
+      auto insn = mie.insn;
+      auto op = insn->opcode();
+      auto field = is_sfield_op(op)
+                       ? static_cast<const DexField*>(insn->get_field())
+                       : nullptr;
+      if (field != nullptr && m_switch_maps.count(field)) {
+        if (is_sput(op) && m_switch_maps.at(field).clinit != method) {
+          analysis->escaped.emplace(field);
+        }
+        relevant = true;
+      } else if (op == OPCODE_INVOKE_VIRTUAL &&
+                 insn->get_method()->get_name()->str_ref() == "ordinal") {
+        relevant = true;
+      }
+      if (prev != nullptr &&
+          (is_move_result(op) || opcode::is_move_result_pseudo(op))) {
+        m_producers.emplace(insn, prev);
+        m_results.emplace(prev, insn);
+      }
+      prev = insn;
+    }
+    return relevant;
+  }
+
+  const IRInstruction* producer(const ssa::SSAForm& ssa, ssa::ValueId v) {
+    auto insn = ssa.value(v).insn;
+    auto it = m_producers.find(insn);
+    return it == m_producers.end() ? nullptr : it->second;
+  }
+
+  IRInstruction* result(const IRInstruction* insn) {
+    auto it = m_results.find(insn);
+    return it == m_results.end() ? nullptr : it->second;
+  }
+
+  void find_lookup(const ssa::SSAForm& ssa,
+                   const DexField* field,
+                   const SwitchMap& map,
+                   IRInstruction* sget,
+                   MethodChanges* changes,
+                   Analysis* analysis) {
+    auto array = ssa.def(result(sget));
+    if (array == ssa::UNDEFINED) {
+      return;
+    }
+    const auto& uses = ssa.uses(array);
+    for (const auto& use : uses) {
+      if (use.insn == nullptr || use.insn->opcode() != OPCODE_AGET ||
+          use.operand != 0) {
+        analysis->escaped.emplace(field);
+        return;
+      }
+    }
+    if (uses.size() != 1) {
+      return;
+    }
+    auto aget = uses[0].insn;
+    auto aget_result = result(aget);
+    auto index = producer(ssa, ssa.use(aget, 1));
+    if (index == nullptr || index->opcode() != OPCODE_INVOKE_VIRTUAL ||
+        !is_ordinal(index->get_method(), map.enum_type)) {
+      return;
+    }
+    const auto& case_uses = ssa.uses(ssa.def(aget_result));
+    if (case_uses.size() != 1 || case_uses[0].insn == nullptr ||
+        !is_switch(case_uses[0].insn->opcode())) {
+      return;
+    }
+    auto switch_insn = case_uses[0].insn;
+    std::unordered_set<int32_t> cases;
+    for (const auto& entry : map.case_of) {
+      cases.emplace(entry.second);
+    }
+    for (auto key : m_case_keys[switch_insn]) {
+      if (!cases.count(key)) {
+        return;
+      }
+    }
+    changes->lookups.push_back({field, sget, aget, aget_result, switch_insn});
+  }
+
+  void find_ordinal_call(const ssa::SSAForm& ssa,
+                         const DexMethod* method,
+                         IRInstruction* invoke,
+                         MethodChanges* changes) {
+    auto sget = producer(ssa, ssa.use(invoke, 0));
+    if (sget == nullptr || sget->opcode() != OPCODE_SGET_OBJECT) {
+      return;
+    }
+    auto it = m_ordinals.find(static_cast<const DexField*>(sget->get_field()));
+    // The constant is null while its enum is being initialized, which only
+    // the enum itself can observe if its initialization runs no other code.
+    if (it == m_ordinals.end() ||
+        it->first->get_class() == method->get_class() ||
+        !m_isolated_enums.count(it->first->get_class()) ||
+        !is_ordinal(invoke->get_method(), it->first->get_class())) {
+      return;
+    }
+    changes->ordinal_calls.push_back({invoke, result(invoke), it->second});
+  }
+
+  const EnumOrdinals& m_ordinals;
+  const std::unordered_set<const DexType*>& m_isolated_enums;
+  const SwitchMaps& m_switch_maps;
+  std::unordered_map<const IRInstruction*, const IRInstruction*> m_producers;
+  std::unordered_map<const IRInstruction*, IRInstruction*> m_results;
+  std::unordered_map<const IRInstruction*, std::vector<int32_t>> m_case_keys;
+};
+
+void rewrite_lookup(IRCode* code, const SwitchMap& map, const Lookup& lookup) {
+  std::unordered_map<int32_t, int32_t> ordinal_of;
+  for (const auto& entry : map.case_of) {
+    ordinal_of.emplace(entry.second, entry.first);
+  }
+  for (auto& mie : *code) {
+    if (mie.type == MFLOW_TARGET &&
+        mie.target->src->insn == lookup.switch_insn) {
+      mie.target->index = ordinal_of.at(mie.target->index);
+    }
+  }
+  auto move = new IRInstruction(OPCODE_MOVE);
+  move->set_dest(lookup.aget_result->dest())->set_src(0, lookup.aget->src(1));
+  code->replace_opcode(lookup.aget, std::vector<IRInstruction*>{move});
+  code->remove_opcode(lookup.sget);
+}
+
+void fold_ordinal_call(IRCode* code, const OrdinalCall& call) {
+  if (call.result != nullptr) {
+    auto konst = new IRInstruction(OPCODE_CONST);
+    konst->set_dest(call.result->dest())->set_literal(call.ordinal);
+    code->replace_opcode(call.result, std::vector<IRInstruction*>{konst});
+  }
+  code->remove_opcode(call.invoke);
+}
+
+} // namespace
+
+EnumOrdinals compute_ordinals(const Scope& scope) {
+  EnumOrdinals ordinals;
+  for (const auto* cls : scope) {
+    if (is_enum(cls) && !cls->is_external() &&
+        cls->get_super_class() == get_enum_type()) {
+      compute_ordinals(cls, &ordinals);
+    }
+  }
+  return ordinals;
+}
+
+SwitchMaps find_switch_maps(const Scope& scope, const EnumOrdinals& ordinals) {
+  SwitchMaps switch_maps;
+  for (const auto* cls : scope) {
+    if (!cls->is_external()) {
+      find_switch_maps(cls, ordinals, &switch_maps);
+    }
+  }
+  return switch_maps;
+}
+
+Stats optimize(const Scope& scope) {
+  Stats stats;
+  auto ordinals = compute_ordinals(scope);
+  if (ordinals.empty()) {
+    return stats;
+  }
+  auto switch_maps = find_switch_maps(scope, ordinals);
+  stats.switch_maps = switch_maps.size();
+  std::unordered_set<const DexType*> isolated_enums;
+  for (const auto& pair : ordinals) {
+    isolated_enums.emplace(pair.first->get_class());
+  }
+  for (auto it = isolated_enums.begin(); it != isolated_enums.end();) {
+    if (initializes_in_isolation(type_class(*it))) {
+      ++it;
+    } else {
+      it = isolated_enums.erase(it);
+    }
+  }
+
+  auto analysis = walk::parallel::reduce_methods<std::nullptr_t, Analysis>(
+      scope,
+      [&](std::nullptr_t, DexMethod* method) {
+        return MethodAnalyzer(ordinals, isolated_enums, switch_maps)
+            .analyze(method);
+      },
+      [](Analysis a, Analysis b) {
+        for (auto& pair : b.changes) {
+          a.changes.emplace(pair.first, std::move(pair.second));
+        }
+        a.escaped.insert(b.escaped.begin(), b.escaped.end());
+        return a;
+      },
+      [](int) { return nullptr; });
+
+  for (const auto& pair : analysis.changes) {
+    auto code = pair.first->get_code();
+    for (const auto& lookup : pair.second.lookups) {
+      if (analysis.escaped.count(lookup.map)) {
+        continue;
+      }
+      TRACE(ENUM, 3, "Switching on the ordinal in %s\n", SHOW(pair.first));
+      rewrite_lookup(code, switch_maps.at(lookup.map), lookup);
+      ++stats.switches_rewritten;
+    }
+    for (const auto& call : pair.second.ordinal_calls) {
+      fold_ordinal_call(code, call);
+      ++stats.ordinals_folded;
+    }
+  }
+  return stats;
+}
+
+} // namespace optimize_enums
+
+void OptimizeEnumsPass::run_pass(DexStoresVector& stores,
+                                 ConfigFiles& /* unused */,
+                                 PassManager& mgr) {
+  auto scope = build_class_scope(stores);
+  auto stats = optimize_enums::optimize(scope);
+  mgr.incr_metric("switch_maps", stats.switch_maps);
+  mgr.incr_metric("switches_rewritten", stats.switches_rewritten);
+  mgr.incr_metric("ordinals_folded", stats.ordinals_folded);
+  TRACE(ENUM,
+        1,
+        "%d switch maps, %d switches rewritten, %d ordinals folded\n",
+        stats.switch_maps,
+        stats.switches_rewritten,
+        stats.ordinals_folded);
+}
+
+static OptimizeEnumsPass s_pass;
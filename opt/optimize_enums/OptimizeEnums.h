@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <unordered_map>
+
+#include "DexClass.h"
+#include "Pass.h"
+
+/*
+ * A switch over an enum compiles to a lookup in a synthetic array, which
+ * maps the ordinals of the constants to the cases of the switch:
+ *
+ *   sget-object LFoo$1;.$SwitchMap$LColor;:[I
+ *   move-result-pseudo-object v0
+ *   invoke-virtual {v1}, LColor;.ordinal:()I
+ *   move-result v2                              invoke-virtual {v1} ordinal
+ *   aget v0, v2                            =>   move-result v2
+ *   move-result-pseudo v3                       move v3, v2
+ *   packed-switch v3 (1 -> :red, 2 -> :blue)    packed-switch v3 (0 -> :red,
+ *                                                                 2 -> :blue)
+ *
+ * The static initializer of the holder class LFoo$1; fills the array with
+ * the ordinals of the constants, which the pass reads from the static
+ * initializer of the enum. Switching on the ordinal directly saves loading
+ * and initializing the holder, which RemoveUnreachablePass can then delete
+ * once no switch reads its arrays anymore. For the same reason, the
+ * ordinal() of a constant read from a static field of its enum is folded,
+ * unless the static initializer of the enum runs code of other classes,
+ * which could then read the constant before it is set.
+ *
+ * Only the enums whose constructors pass their name and ordinal straight to
+ * Enum's are simple enough, and only the arrays that nothing else reads or
+ * writes, and whose holder's static initializer does nothing else.
+ */
+class OptimizeEnumsPass : public Pass {
+ public:
+  OptimizeEnumsPass() : Pass("OptimizeEnumsPass") {}
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+};
+
+namespace optimize_enums {
+
+// The ordinal of each constant of the simple enums.
+using EnumOrdinals = std::unordered_map<const DexField*, int32_t>;
+
+/*
+ * A switch map: the static initializer of its holder stores case_of[o] at
+ * index o of the array, for the ordinals o of the constants of the enum.
+ */
+struct SwitchMap {
+  const DexMethod* clinit;
+  const DexType* enum_type;
+  std::unordered_map<int32_t, int32_t> case_of;
+};
+
+using SwitchMaps = std::unordered_map<const DexField*, SwitchMap>;
+
+EnumOrdinals compute_ordinals(const Scope& scope);
+
+SwitchMaps find_switch_maps(const Scope& scope, const EnumOrdinals& ordinals);
+
+struct Stats {
+  size_t switch_maps{0};
+  size_t switches_rewritten{0};
+  size_t ordinals_folded{0};
+};
+
+Stats optimize(const Scope& scope);
+
+} // namespace optimize_enums
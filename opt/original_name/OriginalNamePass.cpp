@@ -10,6 +10,7 @@
 #include "DexUtil.h"
 #include "OriginalNamePass.h"
 #include "ClassHierarchy.h"
+#include "HierarchyCache.h"
 
 #define METRIC_MISSING_ORIGINAL_NAME_ROOT "num_missing_original_name_root"
 #define METRIC_ORIGINAL_NAME_COUNT "num_original_name"
@@ -54,7 +55,7 @@ void OriginalNamePass::run_pass(DexStoresVector& stores,
                                 ConfigFiles&,
                                 PassManager& mgr) {
   auto scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+  const auto& ch = mgr.get_hierarchy_cache().get_class_hierarchy();
   std::unordered_map<const DexType*, std::string> to_annotate;
   build_hierarchies(mgr, ch, scope, &to_annotate);
   DexString* field_name = DexString::make_string(redex_field_name);
@@ -24,6 +24,10 @@ class OriginalNamePass : public Pass {
                         ConfigFiles& cfg,
                         PassManager& mgr) override;
 
+  // Only adds fields.
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+
  private:
   void build_hierarchies(
       PassManager& mgr,
@@ -10,7 +10,10 @@
 #include "Outliner.h"
 
 #include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <deque>
 #include <map>
+#include <numeric>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -22,11 +25,14 @@
 #include "DexUtil.h"
 #include "IRCode.h"
 #include "IRInstruction.h"
+#include "PassManager.h"
 #include "ReachableClasses.h"
 #include "RedexResources.h"
+#include "Resolver.h"
 #include "Trace.h"
 #include "Walkers.h"
 #include "Warning.h"
+#include "WorkQueue.h"
 
 static Outliner s_pass;
 
@@ -139,10 +145,791 @@ Scope build_scope(DexStoresVector& stores, bool include_primary_dex) {
   }
   return v;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Outlining of common tails
+//
+// Lots of methods end the same way: they load a few fields, call a method or
+// two and return the result, or build an exception and throw it. When the
+// same tail shows up in enough methods, it is smaller to keep one copy of it
+// in a static helper and have each method call that and return what it
+// returns:
+//
+//   iget-object v0, v3, LFoo;.bar:LBar;     invoke-static {v3}, $outlined$0
+//   invoke-virtual {v0}, LBar;.get:()I  =>  move-result v0
+//   move-result v0                          return v0
+//   return v0
+//
+// Only tails are outlined because nothing is live after a return or a throw,
+// so the helper never needs to hand back any register but the one returned.
+// Registers are numbered by where they first appear, so that two tails that
+// only differ in which registers they use still share a helper.
+//
+// To find the repeats, we turn each instruction into a fingerprint of its
+// opcode and operands, without registers, and sort the tails by their
+// fingerprints read backwards from the return. That is the generalized suffix
+// array of the reversed code, restricted to the suffixes that start at a
+// return or throw. Tails sharing the same last L instructions then sit next
+// to each other, and the longest common prefix (LCP) of their neighbors tells
+// how far back they agree.
+//
+namespace tails {
+
+using symbol_t = size_t;
+
+// Longer tails are rare, and would only make finding the repeats slower.
+constexpr size_t kMaxTailLength = 16;
+constexpr size_t kMinTailLength = 2;
+// A non-range invoke passes at most five registers, each with 4 bits.
+constexpr size_t kMaxInputs = 5;
+constexpr size_t kMaxRegisters = 16;
+// Roughly what a method costs besides its instructions, in 16-bit code units:
+// its code item header, method id, encoded method, name and proto.
+constexpr int64_t kHelperOverhead = 24;
+constexpr int kMaxMethodRefs = 64 * 1024 - 1;
+
+constexpr const char* HELPER_CLASS_PREFIX = "Lcom/facebook/redex/OutlinedTails";
+constexpr const char* HELPER_METHOD_PREFIX = "$outlined$";
+
+DexType* get_throwable_type() {
+  return DexType::make_type("Ljava/lang/Throwable;");
+}
+
+struct Tail {
+  DexMethod* method;
+  // In code order, ending with the return or throw.
+  std::vector<IRInstruction*> insns;
+  // The fingerprint of each instruction, last one first.
+  std::vector<symbol_t> reversed;
+};
+
+// How the last `length` instructions of a tail use registers.
+struct Shape {
+  bool valid{false};
+  // Each register the instructions use, in order, numbered so that registers
+  // that are written first come before those that are read first.
+  std::vector<uint16_t> regs;
+  // The registers of the tail that the helper takes as arguments.
+  std::vector<uint16_t> inputs;
+  std::unordered_map<uint16_t, uint16_t> renumbered;
+  uint16_t num_temps{0};
+};
+
+struct Candidate {
+  size_t length;
+  // Indices of the tails that share the helper, in increasing order.
+  std::vector<size_t> tails;
+  int64_t savings;
+};
+
+struct DexTails {
+  std::vector<Tail> tails;
+  std::vector<Candidate> accepted;
+};
+
+bool is_accessible(const DexType* type) {
+  type = get_array_type_or_self(type);
+  if (is_primitive(type)) {
+    return true;
+  }
+  auto cls = type_class(type);
+  return cls != nullptr && is_public(cls);
+}
+
+bool is_accessible(DexFieldRef* ref, bool is_put) {
+  auto field = resolve_field(ref);
+  return field != nullptr && is_public(field) && !(is_put && is_final(field)) &&
+         is_accessible(ref->get_class()) && is_accessible(field->get_class());
+}
+
+bool is_accessible(IRInstruction* insn, DexMethodRef* ref) {
+  auto method = resolve_method(ref, opcode_to_search(insn));
+  if (method == nullptr || !is_public(method) ||
+      !is_accessible(ref->get_class()) ||
+      !is_accessible(method->get_class())) {
+    return false;
+  }
+  auto proto = ref->get_proto();
+  if (is_wide_type(proto->get_rtype())) {
+    return false;
+  }
+  for (auto arg : proto->get_args()->get_type_list()) {
+    if (is_wide_type(arg)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool is_int_op(IROpcode op) {
+  switch (op) {
+  case OPCODE_NEG_INT:
+  case OPCODE_NOT_INT:
+  case OPCODE_INT_TO_BYTE:
+  case OPCODE_INT_TO_CHAR:
+  case OPCODE_INT_TO_SHORT:
+  case OPCODE_ADD_INT:
+  case OPCODE_SUB_INT:
+  case OPCODE_MUL_INT:
+  case OPCODE_DIV_INT:
+  case OPCODE_REM_INT:
+  case OPCODE_AND_INT:
+  case OPCODE_OR_INT:
+  case OPCODE_XOR_INT:
+  case OPCODE_SHL_INT:
+  case OPCODE_SHR_INT:
+  case OPCODE_USHR_INT:
+  case OPCODE_ADD_INT_LIT16:
+  case OPCODE_RSUB_INT:
+  case OPCODE_MUL_INT_LIT16:
+  case OPCODE_DIV_INT_LIT16:
+  case OPCODE_REM_INT_LIT16:
+  case OPCODE_AND_INT_LIT16:
+  case OPCODE_OR_INT_LIT16:
+  case OPCODE_XOR_INT_LIT16:
+  case OPCODE_ADD_INT_LIT8:
+  case OPCODE_RSUB_INT_LIT8:
+  case OPCODE_MUL_INT_LIT8:
+  case OPCODE_DIV_INT_LIT8:
+  case OPCODE_REM_INT_LIT8:
+  case OPCODE_AND_INT_LIT8:
+  case OPCODE_OR_INT_LIT8:
+  case OPCODE_XOR_INT_LIT8:
+  case OPCODE_SHL_INT_LIT8:
+  case OPCODE_SHR_INT_LIT8:
+  case OPCODE_USHR_INT_LIT8:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Whether insn could be moved to a static method of a class in another
+ * package. So nothing that touches wide registers, monitors or uninitialized
+ * objects, nothing that branches, and only public members of public classes.
+ */
+bool can_outline(IRInstruction* insn) {
+  auto op = insn->opcode();
+  if (insn->is_wide()) {
+    return false;
+  }
+  if (is_int_op(op)) {
+    return true;
+  }
+  switch (op) {
+  case OPCODE_MOVE:
+  case OPCODE_MOVE_OBJECT:
+  case OPCODE_MOVE_RESULT:
+  case OPCODE_MOVE_RESULT_OBJECT:
+  case IOPCODE_MOVE_RESULT_PSEUDO:
+  case IOPCODE_MOVE_RESULT_PSEUDO_OBJECT:
+  case OPCODE_RETURN_VOID:
+  case OPCODE_RETURN:
+  case OPCODE_RETURN_OBJECT:
+  case OPCODE_THROW:
+  case OPCODE_CONST:
+  case OPCODE_CONST_STRING:
+    return true;
+  case OPCODE_CONST_CLASS:
+  case OPCODE_CHECK_CAST:
+  case OPCODE_INSTANCE_OF:
+    return is_accessible(insn->get_type());
+  case OPCODE_INVOKE_VIRTUAL:
+  case OPCODE_INVOKE_INTERFACE:
+  case OPCODE_INVOKE_STATIC:
+    return is_accessible(insn, insn->get_method());
+  default:
+    if (is_iget(op) || is_sget(op)) {
+      return is_accessible(insn->get_field(), false);
+    }
+    if (is_iput(op) || is_sput(op)) {
+      return is_accessible(insn->get_field(), true);
+    }
+    return false;
+  }
+}
+
+symbol_t symbol(const DexMethod* method, IRInstruction* insn) {
+  symbol_t seed = 0;
+  boost::hash_combine(seed, static_cast<uint16_t>(insn->opcode()));
+  boost::hash_combine(seed, insn->srcs_size());
+  boost::hash_combine(seed, insn->dests_size());
+  if (insn->has_literal()) {
+    boost::hash_combine(seed, insn->get_literal());
+  } else if (insn->has_string()) {
+    boost::hash_combine(seed, insn->get_string());
+  } else if (insn->has_type()) {
+    boost::hash_combine(seed, insn->get_type());
+  } else if (insn->has_field()) {
+    boost::hash_combine(seed, insn->get_field());
+  } else if (insn->has_method()) {
+    boost::hash_combine(seed, insn->get_method());
+  }
+  if (is_return(insn->opcode())) {
+    // The helper returns what the method does, so it must return the same.
+    boost::hash_combine(seed, method->get_proto()->get_rtype());
+  }
+  return seed;
+}
+
+// Fingerprints can collide, so check that the operands really are the same.
+bool same_operands(const IRInstruction* a, const IRInstruction* b) {
+  if (a->opcode() != b->opcode() || a->srcs_size() != b->srcs_size() ||
+      a->dests_size() != b->dests_size()) {
+    return false;
+  }
+  if (a->has_literal()) {
+    return a->get_literal() == b->get_literal();
+  } else if (a->has_string()) {
+    return a->get_string() == b->get_string();
+  } else if (a->has_type()) {
+    return a->get_type() == b->get_type();
+  } else if (a->has_field()) {
+    return a->get_field() == b->get_field();
+  } else if (a->has_method()) {
+    return a->get_method() == b->get_method();
+  }
+  return true;
+}
+
+/*
+ * Finds the tails of a method: the runs of instructions we can outline that
+ * end in a return or throw, with nothing branching into their middle and no
+ * try region starting or ending in them.
+ */
+void collect_tails(DexMethod* method, std::vector<Tail>& tails) {
+  std::vector<IRInstruction*> run;
+  for (auto& mie : *method->get_code()) {
+    switch (mie.type) {
+    case MFLOW_OPCODE: {
+      auto insn = mie.insn;
+      if (!can_outline(insn)) {
+        run.clear();
+        break;
+      }
+      run.push_back(insn);
+      auto op = insn->opcode();
+      if (!is_return(op) && op != OPCODE_THROW) {
+        break;
+      }
+      if (run.size() >= kMinTailLength) {
+        Tail tail;
+        tail.method = method;
+        auto start = run.size() > kMaxTailLength ? run.size() - kMaxTailLength
+                                                 : 0;
+        tail.insns.assign(run.begin() + start, run.end());
+        for (auto it = tail.insns.rbegin(); it != tail.insns.rend(); ++it) {
+          tail.reversed.push_back(symbol(method, *it));
+        }
+        tails.push_back(std::move(tail));
+      }
+      run.clear();
+      break;
+    }
+    case MFLOW_POSITION:
+    case MFLOW_DEBUG:
+    case MFLOW_FALLTHROUGH:
+      break;
+    default:
+      run.clear();
+      break;
+    }
+  }
+}
+
+/*
+ * Works out how the last `length` instructions of the tail use registers, or
+ * returns an invalid Shape if they can't go into a helper as they are.
+ */
+Shape get_shape(const Tail& tail, size_t length) {
+  Shape shape;
+  auto begin = tail.insns.end() - length;
+  auto first_op = (*begin)->opcode();
+  // The move-result would be separated from its invoke.
+  if (first_op == OPCODE_MOVE_RESULT || first_op == OPCODE_MOVE_RESULT_OBJECT ||
+      opcode::is_move_result_pseudo(first_op)) {
+    return shape;
+  }
+
+  // Find whether each register is written or read first, and in what order.
+  std::vector<uint16_t> temps;
+  std::vector<uint16_t> order;
+  std::unordered_map<uint16_t, bool> is_input;
+  auto see = [&](uint16_t reg, bool read) {
+    order.push_back(reg);
+    if (is_input.emplace(reg, read).second) {
+      (read ? shape.inputs : temps).push_back(reg);
+    }
+  };
+  for (auto it = begin; it != tail.insns.end(); ++it) {
+    auto insn = *it;
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      see(insn->src(i), true);
+    }
+    if (insn->dests_size() > 0) {
+      see(insn->dest(), false);
+    }
+  }
+  if (shape.inputs.size() > kMaxInputs ||
+      temps.size() + shape.inputs.size() > kMaxRegisters) {
+    return shape;
+  }
+  for (auto reg : shape.inputs) {
+    // The call passes them in a non-range invoke.
+    if (reg >= kMaxRegisters) {
+      return shape;
+    }
+  }
+
+  shape.num_temps = temps.size();
+  for (size_t i = 0; i < temps.size(); ++i) {
+    shape.renumbered[temps[i]] = i;
+  }
+  for (size_t i = 0; i < shape.inputs.size(); ++i) {
+    shape.renumbered[shape.inputs[i]] = temps.size() + i;
+  }
+  for (auto reg : order) {
+    shape.regs.push_back(shape.renumbered.at(reg));
+  }
+  shape.valid = true;
+  return shape;
+}
+
+// The type that an instruction needs its `i`th source to have.
+DexType* type_of_src(DexMethod* method, IRInstruction* insn, size_t i) {
+  auto op = insn->opcode();
+  if (is_int_op(op)) {
+    return get_int_type();
+  }
+  if (is_invoke(op)) {
+    auto ref = insn->get_method();
+    if (!is_invoke_static(op)) {
+      if (i == 0) {
+        return ref->get_class();
+      }
+      --i;
+    }
+    return ref->get_proto()->get_args()->get_type_list().at(i);
+  }
+  if (is_iget(op)) {
+    return insn->get_field()->get_class();
+  }
+  if (is_iput(op)) {
+    return i == 0 ? insn->get_field()->get_type()
+                  : insn->get_field()->get_class();
+  }
+  if (is_sput(op)) {
+    return insn->get_field()->get_type();
+  }
+  switch (op) {
+  case OPCODE_CHECK_CAST:
+  case OPCODE_INSTANCE_OF:
+    return get_object_type();
+  case OPCODE_RETURN:
+  case OPCODE_RETURN_OBJECT:
+    return method->get_proto()->get_rtype();
+  case OPCODE_THROW:
+    return get_throwable_type();
+  default:
+    // A move could take anything, so its source must come from the tail.
+    return nullptr;
+  }
+}
+
+DexType* get_return_type(const Tail& tail) {
+  auto last = tail.insns.back();
+  if (last->opcode() == OPCODE_THROW) {
+    return get_throwable_type();
+  }
+  return tail.method->get_proto()->get_rtype();
+}
+
+/*
+ * The proto of the helper for the last `length` instructions of the tail, or
+ * nullptr if their inputs aren't used with one type each.
+ */
+DexProto* get_helper_proto(const Tail& tail,
+                           size_t length,
+                           const Shape& shape) {
+  std::unordered_map<uint16_t, DexType*> input_types;
+  for (auto reg : shape.inputs) {
+    input_types[reg] = nullptr;
+  }
+  std::unordered_set<uint16_t> written;
+  for (auto it = tail.insns.end() - length; it != tail.insns.end(); ++it) {
+    auto insn = *it;
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      auto reg = insn->src(i);
+      if (written.count(reg) != 0 || input_types.count(reg) == 0) {
+        continue;
+      }
+      auto type = type_of_src(tail.method, insn, i);
+      auto& input_type = input_types.at(reg);
+      if (type == nullptr || (input_type != nullptr && input_type != type)) {
+        return nullptr;
+      }
+      input_type = type;
+    }
+    if (insn->dests_size() > 0) {
+      written.insert(insn->dest());
+    }
+  }
+
+  std::deque<DexType*> args;
+  for (auto reg : shape.inputs) {
+    auto type = input_types.at(reg);
+    if (type == nullptr || !is_accessible(type)) {
+      return nullptr;
+    }
+    args.push_back(type);
+  }
+  auto rtype = get_return_type(tail);
+  if (!is_accessible(rtype)) {
+    return nullptr;
+  }
+  return DexProto::make_proto(rtype, DexTypeList::make_type_list(std::move(args)));
+}
+
+size_t code_units(const Tail& tail, size_t length) {
+  size_t size = 0;
+  for (auto it = tail.insns.end() - length; it != tail.insns.end(); ++it) {
+    size += (*it)->size();
+  }
+  return size;
+}
+
+// What replaces the tail in each method: the invoke, and a return or throw
+// with a move-result unless the tail returns void.
+int64_t call_code_units(const Tail& tail) {
+  return tail.insns.back()->opcode() == OPCODE_RETURN_VOID ? 4 : 5;
+}
+
+int64_t savings(const Tail& tail, size_t length, size_t count) {
+  int64_t size = code_units(tail, length);
+  return static_cast<int64_t>(count) * (size - call_code_units(tail)) - size -
+         kHelperOverhead;
+}
+
+/*
+ * Splits the tails that share their last `length` instructions into groups
+ * that also use registers the same way and adds a candidate for each group
+ * that would save space.
+ */
+void add_candidates(const std::vector<Tail>& tails,
+                    const std::vector<size_t>& group,
+                    size_t length,
+                    std::vector<Candidate>& candidates) {
+  std::map<std::vector<uint16_t>, std::vector<size_t>> by_shape;
+  for (auto idx : group) {
+    auto shape = get_shape(tails[idx], length);
+    if (shape.valid) {
+      auto& key = shape.regs;
+      key.push_back(shape.num_temps);
+      by_shape[key].push_back(idx);
+    }
+  }
+  for (auto& entry : by_shape) {
+    auto& same = entry.second;
+    if (same.size() < 2) {
+      continue;
+    }
+    std::sort(same.begin(), same.end());
+    const auto& first = tails[same[0]];
+    std::vector<size_t> members;
+    for (auto idx : same) {
+      const auto& tail = tails[idx];
+      if (std::equal(first.insns.end() - length,
+                     first.insns.end(),
+                     tail.insns.end() - length,
+                     same_operands)) {
+        members.push_back(idx);
+      }
+    }
+    auto shape = get_shape(first, length);
+    if (members.size() < 2 ||
+        get_helper_proto(first, length, shape) == nullptr) {
+      continue;
+    }
+    auto saved = savings(first, length, members.size());
+    if (saved > 0) {
+      candidates.push_back(Candidate{length, std::move(members), saved});
+    }
+  }
 }
 
+/*
+ * Finds candidates for the tails of one dex, and picks the ones to outline,
+ * the most profitable first.
+ */
+void find_candidates(DexTails& dex_tails, size_t max_helpers) {
+  const auto& tails = dex_tails.tails;
+  size_t n = tails.size();
+  if (n < 2) {
+    return;
+  }
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return tails[a].reversed < tails[b].reversed;
+  });
+  // lcp[i] is how many instructions the tails at order[i - 1] and order[i]
+  // end with in common.
+  std::vector<size_t> lcp(n + 1, 0);
+  for (size_t i = 1; i < n; ++i) {
+    const auto& a = tails[order[i - 1]].reversed;
+    const auto& b = tails[order[i]].reversed;
+    auto mismatch = std::mismatch(
+        a.begin(), a.begin() + std::min(a.size(), b.size()), b.begin());
+    lcp[i] = mismatch.first - a.begin();
+  }
+
+  // Walk the LCP intervals bottom-up. An interval [lb, rb] with value l is a
+  // maximal run of tails that all end with the same l instructions, while
+  // its parent's value is the most they share with their neighbors. So the
+  // tails in it are the ones that share any length in (parent, l].
+  std::vector<Candidate> candidates;
+  struct Interval {
+    size_t lcp;
+    size_t lb;
+  };
+  std::vector<Interval> stack{{0, 0}};
+  for (size_t i = 1; i <= n; ++i) {
+    auto lb = i - 1;
+    while (lcp[i] < stack.back().lcp) {
+      auto interval = stack.back();
+      stack.pop_back();
+      auto parent = std::max(lcp[i], stack.back().lcp);
+      std::vector<size_t> group(order.begin() + interval.lb, order.begin() + i);
+      for (auto length = std::max(parent + 1, kMinTailLength);
+           length <= interval.lcp;
+           ++length) {
+        add_candidates(tails, group, length, candidates);
+      }
+      lb = interval.lb;
+    }
+    if (lcp[i] > stack.back().lcp) {
+      stack.push_back({lcp[i], lb});
+    }
+  }
+
+  // Candidates overlap, since a tail ends the same way as different sets of
+  // other tails at different lengths. Take the best first, and drop the tails
+  // they take from the others.
+  std::sort(candidates.begin(),
+            candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              if (a.savings != b.savings) {
+                return a.savings > b.savings;
+              }
+              if (a.length != b.length) {
+                return a.length > b.length;
+              }
+              return a.tails < b.tails;
+            });
+  std::vector<bool> taken(n, false);
+  for (auto& candidate : candidates) {
+    if (dex_tails.accepted.size() >= max_helpers) {
+      break;
+    }
+    std::vector<size_t> remaining;
+    for (auto idx : candidate.tails) {
+      if (!taken[idx]) {
+        remaining.push_back(idx);
+      }
+    }
+    if (remaining.size() < 2 ||
+        savings(tails[remaining[0]], candidate.length, remaining.size()) <=
+            0) {
+      continue;
+    }
+    for (auto idx : remaining) {
+      taken[idx] = true;
+    }
+    candidate.tails = std::move(remaining);
+    candidate.savings = savings(
+        tails[candidate.tails[0]], candidate.length, candidate.tails.size());
+    dex_tails.accepted.push_back(std::move(candidate));
+  }
+}
+
+size_t count_method_refs(const DexClasses& dex) {
+  std::vector<DexMethodRef*> methods;
+  for (auto cls : dex) {
+    cls->gather_methods(methods);
+  }
+  sort_unique(methods);
+  return methods.size();
+}
+
+DexMethod* make_helper(DexType* helper_type,
+                       size_t index,
+                       const Tail& tail,
+                       size_t length) {
+  auto shape = get_shape(tail, length);
+  auto proto = get_helper_proto(tail, length, shape);
+  auto helper = static_cast<DexMethod*>(DexMethod::make_method(
+      helper_type,
+      DexString::make_string(HELPER_METHOD_PREFIX + std::to_string(index)),
+      proto));
+  helper->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  // The arguments go right after the temps, where Shape numbered the inputs.
+  auto code = std::make_unique<IRCode>(helper, shape.num_temps);
+  for (auto it = tail.insns.end() - length; it != tail.insns.end(); ++it) {
+    auto insn = *it;
+    if (insn->opcode() == OPCODE_THROW) {
+      // The caller throws what we return, for it has to end in a throw.
+      auto ret = new IRInstruction(OPCODE_RETURN_OBJECT);
+      ret->set_src(0, shape.renumbered.at(insn->src(0)));
+      code->push_back(ret);
+      continue;
+    }
+    auto copy = new IRInstruction(*insn);
+    for (size_t i = 0; i < copy->srcs_size(); ++i) {
+      copy->set_src(i, shape.renumbered.at(copy->src(i)));
+    }
+    if (copy->dests_size() > 0) {
+      copy->set_dest(shape.renumbered.at(copy->dest()));
+    }
+    code->push_back(copy);
+  }
+  helper->set_code(std::move(code));
+  return helper;
+}
+
+// Replaces the last `length` instructions of the tail with a call to helper.
+void call_helper(const Tail& tail, size_t length, DexMethodRef* helper) {
+  auto shape = get_shape(tail, length);
+  auto last = tail.insns.back();
+  auto invoke = new IRInstruction(OPCODE_INVOKE_STATIC);
+  invoke->set_method(helper)->set_arg_word_count(shape.inputs.size());
+  for (size_t i = 0; i < shape.inputs.size(); ++i) {
+    invoke->set_src(i, shape.inputs[i]);
+  }
+  std::vector<IRInstruction*> call{invoke};
+  if (last->opcode() != OPCODE_RETURN_VOID) {
+    auto result = last->src(0);
+    auto move = new IRInstruction(last->opcode() == OPCODE_RETURN
+                                      ? OPCODE_MOVE_RESULT
+                                      : OPCODE_MOVE_RESULT_OBJECT);
+    move->set_dest(result);
+    call.push_back(move);
+    call.push_back((new IRInstruction(last->opcode()))->set_src(0, result));
+  } else {
+    call.push_back(new IRInstruction(OPCODE_RETURN_VOID));
+  }
+
+  auto code = tail.method->get_code();
+  auto begin = tail.insns.end() - length;
+  for (auto it = begin + 1; it != tail.insns.end(); ++it) {
+    if (!opcode::is_move_result_pseudo((*it)->opcode())) {
+      code->remove_opcode(*it);
+    }
+  }
+  code->replace_opcode(*begin, call);
+}
+
+} // namespace tails
+
+/*
+ * Moves tails that many methods of a dex share to static helpers, one class
+ * of them per dex. The dexes are searched for repeats in parallel, then the
+ * helpers are made and called one dex after the other.
+ */
+void outline_tails(DexStoresVector& stores,
+                   ConfigFiles& cfg,
+                   bool include_primary_dex,
+                   PassManager& mgr) {
+  using namespace tails;
+  const auto& coldstart_ranks = cfg.get_coldstart_class_ranks();
+
+  auto& dexen = stores[0].get_dexen();
+  size_t first_dex = include_primary_dex ? 0 : 1;
+  std::vector<DexTails> all_tails(dexen.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t dex_idx) {
+    const auto& dex = dexen[dex_idx];
+    auto helper_name = HELPER_CLASS_PREFIX + std::to_string(dex_idx) + ";";
+    if (DexType::get_type(helper_name.c_str()) != nullptr) {
+      return;
+    }
+    auto& dex_tails = all_tails[dex_idx];
+    for (auto cls : dex) {
+      // Calling out to a helper would slow down cold start.
+      if (coldstart_ranks.count(cls->get_type()) != 0) {
+        continue;
+      }
+      auto collect = [&](DexMethod* method) {
+        if (method->get_code() != nullptr && !is_any_init(method)) {
+          collect_tails(method, dex_tails.tails);
+        }
+      };
+      for (auto method : cls->get_dmethods()) {
+        collect(method);
+      }
+      for (auto method : cls->get_vmethods()) {
+        collect(method);
+      }
+    }
+    // Each helper adds a method ref to the dex, and there's room for
+    // kMaxMethodRefs in all.
+    auto refs = count_method_refs(dex);
+    auto max_helpers = refs < kMaxMethodRefs ? kMaxMethodRefs - refs : 0;
+    find_candidates(dex_tails, max_helpers);
+  });
+  for (size_t i = first_dex; i < dexen.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  size_t num_helpers = 0;
+  size_t num_calls = 0;
+  int64_t code_units_saved = 0;
+  for (size_t dex_idx = first_dex; dex_idx < dexen.size(); ++dex_idx) {
+    const auto& dex_tails = all_tails[dex_idx];
+    if (dex_tails.accepted.empty()) {
+      continue;
+    }
+    auto helper_type = DexType::make_type(
+        (HELPER_CLASS_PREFIX + std::to_string(dex_idx) + ";").c_str());
+    ClassCreator creator(helper_type);
+    creator.set_super(get_object_type());
+    creator.set_access(ACC_PUBLIC | ACC_FINAL);
+    for (size_t i = 0; i < dex_tails.accepted.size(); ++i) {
+      const auto& candidate = dex_tails.accepted[i];
+      const auto& tails = dex_tails.tails;
+      auto helper = make_helper(
+          helper_type, i, tails[candidate.tails[0]], candidate.length);
+      TRACE(OUTLINE,
+            2,
+            "Outlined %lu instructions of %lu tails to %s\n",
+            candidate.length,
+            candidate.tails.size(),
+            SHOW(helper));
+      for (auto idx : candidate.tails) {
+        call_helper(tails[idx], candidate.length, helper);
+      }
+      creator.add_method(helper);
+      num_calls += candidate.tails.size();
+      code_units_saved += candidate.savings;
+    }
+    num_helpers += dex_tails.accepted.size();
+    dexen[dex_idx].push_back(creator.create());
+  }
+
+  mgr.incr_metric("outlined_tails", num_calls);
+  mgr.incr_metric("outlined_tail_helpers", num_helpers);
+  mgr.incr_metric("outlined_tail_code_units_saved", code_units_saved);
+  TRACE(OUTLINE,
+        1,
+        "Outlined %lu tails to %lu helpers, saving about %ld code units\n",
+        num_calls,
+        num_helpers,
+        code_units_saved);
+}
+} // namespace
+
 void Outliner::run_pass(DexStoresVector& stores,
-                        ConfigFiles& /* unused */,
+                        ConfigFiles& cfg,
                         PassManager& mgr) {
   auto scope = build_scope(stores, m_outline_primary_dex);
 
@@ -222,4 +1009,8 @@ void Outliner::run_pass(DexStoresVector& stores,
   if (outlined_throws.size() > 0) {
     build_dispatcher(stores, outlined_throws);
   }
+
+  if (m_outline_common_tails) {
+    outline_tails(stores, cfg, m_outline_primary_dex, mgr);
+  }
 }
@@ -20,6 +20,8 @@ class Outliner : public Pass {
     // we need to allow this to happen in some scenarios, e.g.
     // instrumentation tests, since they are single-dex affairs.
     pc.get("outline_primary_dex", false, m_outline_primary_dex);
+    // Move tails that many methods share to static helpers, to save space.
+    pc.get("outline_common_tails", false, m_outline_common_tails);
   }
 
   virtual void run_pass(DexStoresVector& stores,
@@ -28,4 +30,5 @@ class Outliner : public Pass {
 
  private:
   bool m_outline_primary_dex;
+  bool m_outline_common_tails;
 };
@@ -10,15 +10,16 @@
 #include "Peephole.h"
 
 #include <algorithm>
+#include <array>
 #include <numeric>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include "ControlFlow.h"
 #include "DexClass.h"
 #include "DexUtil.h"
 #include "IRInstruction.h"
+#include "Match.h"
 #include "PassManager.h"
 #include "RedundantCheckCastRemover.h"
 #include "Walkers.h"
@@ -145,7 +146,7 @@ static const char* LjavaStringBuilder = "Ljava/lang/StringBuilder;";
 static const char* LjavaObject = "Ljava/lang/Object;";
 
 struct DexPattern {
-  const std::unordered_set<uint16_t> opcodes;
+  const m::opcode_set opcodes;
   const std::vector<Register> srcs;
   const std::vector<Register> dests;
 
@@ -169,60 +170,60 @@ struct DexPattern {
     Field field;
   };
 
-  DexPattern(std::unordered_set<uint16_t>&& opcodes,
+  DexPattern(m::opcode_set opcodes,
              std::vector<Register>&& srcs,
              std::vector<Register>&& dests)
-      : opcodes(std::move(opcodes)),
+      : opcodes(opcodes),
         srcs(std::move(srcs)),
         dests(std::move(dests)),
         kind(DexPattern::Kind::none),
         dummy(nullptr) {}
 
-  DexPattern(std::unordered_set<uint16_t>&& opcodes,
+  DexPattern(m::opcode_set opcodes,
              std::vector<Register>&& srcs,
              std::vector<Register>&& dests,
              DexMethodRef* const method)
-      : opcodes(std::move(opcodes)),
+      : opcodes(opcodes),
         srcs(std::move(srcs)),
         dests(std::move(dests)),
         kind(DexPattern::Kind::method),
         method(method) {}
 
-  DexPattern(std::unordered_set<uint16_t>&& opcodes,
+  DexPattern(m::opcode_set opcodes,
              std::vector<Register>&& srcs,
              std::vector<Register>&& dests,
              const String string)
-      : opcodes(std::move(opcodes)),
+      : opcodes(opcodes),
         srcs(std::move(srcs)),
         dests(std::move(dests)),
         kind(DexPattern::Kind::string),
         string(string) {}
 
-  DexPattern(std::unordered_set<uint16_t>&& opcodes,
+  DexPattern(m::opcode_set opcodes,
              std::vector<Register>&& srcs,
              std::vector<Register>&& dests,
              const Literal literal)
-      : opcodes(std::move(opcodes)),
+      : opcodes(opcodes),
         srcs(std::move(srcs)),
         dests(std::move(dests)),
         kind(DexPattern::Kind::literal),
         literal(literal) {}
 
-  DexPattern(std::unordered_set<uint16_t>&& opcodes,
+  DexPattern(m::opcode_set opcodes,
              std::vector<Register>&& srcs,
              std::vector<Register>&& dests,
              const Type type)
-      : opcodes(std::move(opcodes)),
+      : opcodes(opcodes),
         srcs(std::move(srcs)),
         dests(std::move(dests)),
         kind(DexPattern::Kind::type),
         type(type) {}
 
-  DexPattern(std::unordered_set<uint16_t>&& opcodes,
+  DexPattern(m::opcode_set opcodes,
              std::vector<Register>&& srcs,
              std::vector<Register>&& dests,
              const Field field)
-      : opcodes(std::move(opcodes)),
+      : opcodes(opcodes),
         srcs(std::move(srcs)),
         dests(std::move(dests)),
         kind(DexPattern::Kind::field),
@@ -239,47 +240,49 @@ struct DexPattern {
 
 struct Matcher;
 
+// The most instructions a pattern can match, so that the matched ones fit in
+// a fixed array.
+constexpr size_t kMaxMatchSize = 8;
+
 struct Pattern {
   const std::string name;
   const std::vector<DexPattern> match;
   const std::vector<DexPattern> replace;
-  const std::function<bool(const Matcher&)> predicate;
+  bool (*const predicate)(const Matcher&);
 
   Pattern(std::string name,
           std::vector<DexPattern> match,
           std::vector<DexPattern> replace,
-          std::function<bool(const Matcher&)> predicate = {})
+          bool (*predicate)(const Matcher&) = nullptr)
       : name(std::move(name)),
         match(std::move(match)),
         replace(std::move(replace)),
-        predicate(std::move(predicate)) {}
+        predicate(predicate) {
+    always_assert_log(this->match.size() <= kMaxMatchSize,
+                      "Pattern %s is too long",
+                      this->name.c_str());
+  }
 };
 
-// Matcher holds the matching state for the given pattern.
+// Matcher holds the matching state for the given pattern. Matching an
+// instruction doesn't allocate: the state lives in fixed arrays.
 struct Matcher {
   const Pattern& pattern;
+  // How many instructions have been matched so far.
   size_t match_index;
-  std::vector<IRInstruction*> matched_instructions;
-
-  // Another reason why we need C++14...
-  struct EnumClassHash {
-    template <typename T>
-    size_t operator()(T t) const {
-      return static_cast<size_t>(t);
-    }
-  };
+  std::array<IRInstruction*, kMaxMatchSize> matched_instructions;
 
-  std::unordered_map<Register, uint16_t, EnumClassHash> matched_regs;
-  std::unordered_map<String, DexString*, EnumClassHash> matched_strings;
-  std::unordered_map<Literal, int64_t, EnumClassHash> matched_literals;
-  std::unordered_map<Type, DexType*, EnumClassHash> matched_types;
-  std::unordered_map<Field, DexFieldRef*, EnumClassHash> matched_fields;
+  m::captures<Register, uint16_t, 10> matched_regs;
+  // Only A and B are placeholders, the other Strings are directives.
+  m::captures<String, DexString*, 2> matched_strings;
+  m::captures<Literal, int64_t, 1> matched_literals;
+  m::captures<Type, DexType*, 2> matched_types;
+  m::captures<Field, DexFieldRef*, 2> matched_fields;
 
   explicit Matcher(const Pattern& pattern) : pattern(pattern), match_index(0) {}
 
   void reset() {
     match_index = 0;
-    matched_instructions.clear();
     matched_regs.clear();
     matched_strings.clear();
     matched_literals.clear();
@@ -290,54 +293,16 @@ struct Matcher {
   // It updates the matching state for the given instruction. Returns true if
   // insn matches to the last 'match' pattern.
   bool try_match(IRInstruction* insn) {
-    auto match_reg = [&](Register pattern_reg, uint16_t insn_reg) {
-      // This register has been observed already. Check whether they are same.
-      if (matched_regs.find(pattern_reg) != end(matched_regs)) {
-        return matched_regs.at(pattern_reg) == insn_reg;
-      }
-
-      // Newly observed. Remember it.
-      matched_regs.emplace(pattern_reg, insn_reg);
-      return true;
-    };
-
-    auto match_literal = [&](Literal lit_pattern, int64_t insn_literal_val) {
-      if (matched_literals.find(lit_pattern) != end(matched_literals)) {
-        return matched_literals.at(lit_pattern) == insn_literal_val;
-      }
-      matched_literals.emplace(lit_pattern, insn_literal_val);
-      return true;
-    };
-
     auto match_string = [&](String str_pattern, DexString* insn_str) {
       if (str_pattern == String::empty) {
         return (insn_str->is_simple() && insn_str->size() == 0);
       }
-      if (matched_strings.find(str_pattern) != end(matched_strings)) {
-        return matched_strings.at(str_pattern) == insn_str;
-      }
-      matched_strings.emplace(str_pattern, insn_str);
-      return true;
-    };
-
-    auto match_type = [&](Type type_pattern, DexType* insn_type) {
-      if (matched_types.find(type_pattern) != end(matched_types)) {
-        return matched_types.at(type_pattern) == insn_type;
-      }
-      matched_types.emplace(type_pattern, insn_type);
-      return true;
-    };
-
-    auto match_field = [&](Field field_pattern, DexFieldRef* insn_field) {
-      auto result = matched_fields.emplace(field_pattern, insn_field);
-      bool newly_inserted = result.second;
-      return newly_inserted ? true : result.first->second == insn_field;
+      return matched_strings.bind(str_pattern, insn_str);
     };
 
     // Does 'insn' match to the given DexPattern?
     auto match_instruction = [&](const DexPattern& dex_pattern) {
-      if (dex_pattern.opcodes.find(insn->opcode()) ==
-              end(dex_pattern.opcodes) ||
+      if (!dex_pattern.opcodes.contains(insn->opcode()) ||
           dex_pattern.srcs.size() != insn->srcs_size() ||
           dex_pattern.dests.size() != insn->dests_size()) {
         return false;
@@ -345,13 +310,13 @@ struct Matcher {
 
       if (dex_pattern.dests.size() != 0) {
         assert(dex_pattern.dests.size() == 1);
-        if (!match_reg(dex_pattern.dests[0], insn->dest())) {
+        if (!matched_regs.bind(dex_pattern.dests[0], insn->dest())) {
           return false;
         }
       }
 
       for (size_t i = 0; i < dex_pattern.srcs.size(); ++i) {
-        if (!match_reg(dex_pattern.srcs[i], insn->src(i))) {
+        if (!matched_regs.bind(dex_pattern.srcs[i], insn->src(i))) {
           return false;
         }
       }
@@ -362,13 +327,13 @@ struct Matcher {
       case DexPattern::Kind::string:
         return match_string(dex_pattern.string, insn->get_string());
       case DexPattern::Kind::literal:
-        return match_literal(dex_pattern.literal, insn->get_literal());
+        return matched_literals.bind(dex_pattern.literal, insn->get_literal());
       case DexPattern::Kind::method:
         return dex_pattern.method == insn->get_method();
       case DexPattern::Kind::type:
-        return match_type(dex_pattern.type, insn->get_type());
+        return matched_types.bind(dex_pattern.type, insn->get_type());
       case DexPattern::Kind::field:
-        return match_field(dex_pattern.field, insn->get_field());
+        return matched_fields.bind(dex_pattern.field, insn->get_field());
       case DexPattern::Kind::copy:
         always_assert_log(
             false, "Kind::copy can only be used in replacements. Not matches");
@@ -404,8 +369,7 @@ struct Matcher {
           match_index + 1,
           pattern.match.size(),
           SHOW(insn));
-    matched_instructions.push_back(insn);
-    ++match_index;
+    matched_instructions[match_index++] = insn;
 
     bool done = match_index == pattern.match.size();
 
@@ -424,7 +388,8 @@ struct Matcher {
       return nullptr;
     }
 
-    const auto opcode = *begin(replace.opcodes);
+    uint16_t opcode = 0;
+    replace.opcodes.for_each([&opcode](IROpcode op) { opcode = op; });
     switch (opcode) {
     case OPCODE_INVOKE_DIRECT:
     case OPCODE_INVOKE_STATIC:
@@ -490,7 +455,7 @@ struct Matcher {
     for (const auto& replace_info : pattern.replace) {
       // First, generate the instruction object.
       if (replace_info.kind == DexPattern::Kind::copy) {
-        always_assert(matched_instructions.size() > replace_info.copy_index);
+        always_assert(match_index > replace_info.copy_index);
         replacements.push_back(
             new IRInstruction(*matched_instructions[replace_info.copy_index]));
         continue;
@@ -502,13 +467,11 @@ struct Matcher {
       if (replace_info.dests.size() > 0) {
         assert(replace_info.dests.size() == 1);
         const Register dest = replace_info.dests[0];
-        always_assert(matched_regs.find(dest) != end(matched_regs));
         replace->set_dest(matched_regs.at(dest));
       }
 
       for (size_t i = 0; i < replace_info.srcs.size(); ++i) {
         const Register reg = replace_info.srcs[i];
-        always_assert(matched_regs.find(reg) != end(matched_regs));
         replace->set_src(i, matched_regs.at(reg));
       }
 
@@ -772,7 +735,7 @@ DexPattern move_result(Register dest) {
   return {{OPCODE_MOVE_RESULT}, {}, {dest}};
 };
 
-DexPattern const_literal(uint16_t opcode, Register dest, Literal literal) {
+DexPattern const_literal(IROpcode opcode, Register dest, Literal literal) {
   return {{opcode}, {}, {dest}, literal};
 };
 
@@ -1169,7 +1132,7 @@ const std::vector<Pattern>& get_nop_patterns() {
 }
 
 static bool second_get_non_volatile(const Matcher& m) {
-  if (m.matched_instructions.size() < 2) {
+  if (m.match_index < 2) {
     return false;
   }
 
@@ -1186,16 +1149,15 @@ DexPattern put_x_op(IROpcode op_code,
                     Register src,
                     Register obj_register,
                     Field field) {
-  static const auto* kPutOpcodes =
-      new std::unordered_set<IROpcode, Matcher::EnumClassHash>(
-          {OPCODE_IPUT,
-           OPCODE_IPUT_WIDE,
-           OPCODE_IPUT_OBJECT,
-           OPCODE_IPUT_SHORT,
-           OPCODE_IPUT_CHAR,
-           OPCODE_IPUT_BYTE,
-           OPCODE_IPUT_BOOLEAN});
-  if (kPutOpcodes->find(op_code) == kPutOpcodes->end()) {
+  static constexpr m::opcode_set kPutOpcodes{
+      OPCODE_IPUT,
+      OPCODE_IPUT_WIDE,
+      OPCODE_IPUT_OBJECT,
+      OPCODE_IPUT_SHORT,
+      OPCODE_IPUT_CHAR,
+      OPCODE_IPUT_BYTE,
+      OPCODE_IPUT_BOOLEAN};
+  if (!kPutOpcodes.contains(op_code)) {
     always_assert_log(false, "Not supported IROpcode");
   }
 
@@ -1203,16 +1165,15 @@ DexPattern put_x_op(IROpcode op_code,
 }
 
 DexPattern get_x_op(IROpcode op_code, Register src, Field field) {
-  static const auto* kGetOpcodes =
-      new std::unordered_set<IROpcode, Matcher::EnumClassHash>(
-          {OPCODE_IGET,
-           OPCODE_IGET_WIDE,
-           OPCODE_IGET_OBJECT,
-           OPCODE_IGET_SHORT,
-           OPCODE_IGET_CHAR,
-           OPCODE_IGET_BYTE,
-           OPCODE_IGET_BOOLEAN});
-  if (kGetOpcodes->find(op_code) == kGetOpcodes->end()) {
+  static constexpr m::opcode_set kGetOpcodes{
+      OPCODE_IGET,
+      OPCODE_IGET_WIDE,
+      OPCODE_IGET_OBJECT,
+      OPCODE_IGET_SHORT,
+      OPCODE_IGET_CHAR,
+      OPCODE_IGET_BYTE,
+      OPCODE_IGET_BOOLEAN};
+  if (!kGetOpcodes.contains(op_code)) {
     always_assert_log(false, "Not supported IROpcode");
   }
 
@@ -1273,10 +1234,10 @@ const std::vector<Pattern>& get_putget_patterns() {
 
 template <int64_t VALUE>
 static bool first_instruction_literal_is(const Matcher& m) {
-  if (m.matched_instructions.empty()) {
+  if (m.match_index == 0) {
     return false;
   }
-  return m.matched_instructions.front()->get_literal() == VALUE;
+  return m.matched_instructions[0]->get_literal() == VALUE;
 }
 
 DexPattern mul_lit(Register src, Register dst) {
@@ -1388,14 +1349,28 @@ class PeepholeOptimizer {
  private:
   std::vector<Matcher> m_matchers;
   std::vector<size_t> m_stats;
-  PassManager& m_mgr;
   int m_stats_removed = 0;
   int m_stats_inserted = 0;
 
+  // For each opcode, the indices of the matchers whose patterns can start
+  // with it, in increasing order. Those are the only idle matchers that an
+  // instruction with that opcode could move forward.
+  std::vector<std::vector<size_t>> m_matchers_by_first_opcode;
+  // When each matcher was last given an instruction, so that one instruction
+  // isn't given to the same matcher twice.
+  std::vector<size_t> m_last_step;
+  size_t m_step = 0;
+
+  struct Match {
+    IRInstruction* last;
+    std::array<IRInstruction*, kMaxMatchSize> matched;
+    size_t num_matched;
+    std::vector<IRInstruction*> replace;
+  };
+
  public:
   explicit PeepholeOptimizer(
-      PassManager& mgr, const std::vector<std::string>& disabled_peepholes)
-      : m_mgr(mgr) {
+      const std::vector<std::string>& disabled_peepholes) {
     for (const auto& pattern_list : patterns::get_all_patterns()) {
       for (const Pattern& pattern : pattern_list) {
         if (!contains(disabled_peepholes, pattern.name)) {
@@ -1409,65 +1384,149 @@ class PeepholeOptimizer {
       }
     }
     m_stats.resize(m_matchers.size(), 0);
+    m_last_step.resize(m_matchers.size(), 0);
+    for (size_t i = 0; i < m_matchers.size(); ++i) {
+      m_matchers[i].pattern.match.at(0).opcodes.for_each(
+          [this, i](IROpcode opcode) {
+            if (opcode >= m_matchers_by_first_opcode.size()) {
+              m_matchers_by_first_opcode.resize(opcode + 1);
+            }
+            m_matchers_by_first_opcode[opcode].push_back(i);
+          });
+    }
   }
 
   PeepholeOptimizer(const PeepholeOptimizer&) = delete;
   PeepholeOptimizer& operator=(const PeepholeOptimizer&) = delete;
+  PeepholeOptimizer(PeepholeOptimizer&&) = default;
 
   void peephole(DexMethod* method) {
     auto code = method->get_code();
     code->build_cfg();
 
-    // do optimizations one at a time
-    // so they can match on the same pattern without interfering
-    for (size_t i = 0; i < m_matchers.size(); ++i) {
-      auto& matcher = m_matchers[i];
+    // Do optimizations one at a time, so they can match on the same pattern
+    // without interfering. Rather than scanning the code once per pattern,
+    // scan it for all the remaining patterns at once and apply the first one
+    // that matched. The ones before it didn't match, so this is what running
+    // them one after the other would have done. Most methods match nothing,
+    // and then one scan is all it takes.
+    size_t first = 0;
+    std::vector<Match> matches;
+    while (first < m_matchers.size()) {
+      auto i = find_first_pattern_matches(code->cfg(), first, matches);
+      if (i == m_matchers.size()) {
+        break;
+      }
+      m_stats.at(i) += matches.size();
+      // Removing an instruction also frees the move-result-pseudo after it,
+      // so those are left out before anything is removed.
       std::vector<IRInstruction*> deletes;
-      std::vector<std::pair<IRInstruction*, std::vector<IRInstruction*>>>
-          inserts;
-      const auto& blocks = code->cfg().blocks();
-      for (const auto& block : blocks) {
-        // Currently, all patterns do not span over multiple basic blocks. So
-        // reset all matching states on visiting every basic block.
-        matcher.reset();
-
-        for (auto& mei : InstructionIterable(block)) {
-          if (!matcher.try_match(mei.insn)) {
-            continue;
-          }
-          m_stats.at(i)++;
-          TRACE(PEEPHOLE, 7, "PATTERN %s MATCHED!\n",
-                matcher.pattern.name.c_str());
-          for (auto insn : matcher.matched_instructions) {
-            if (opcode::is_move_result_pseudo(insn->opcode())) {
-              continue;
-            }
+      for (auto& match : matches) {
+        m_stats_inserted += match.replace.size();
+        m_stats_removed += match.num_matched;
+        code->insert_after(match.last, match.replace);
+        for (size_t j = 0; j < match.num_matched; ++j) {
+          auto insn = match.matched[j];
+          if (!opcode::is_move_result_pseudo(insn->opcode())) {
             deletes.push_back(insn);
           }
+        }
+      }
+      for (auto insn : deletes) {
+        code->remove_opcode(insn);
+      }
+      matches.clear();
+      first = i + 1;
+    }
+  }
 
-          auto replace = matcher.get_replacements();
-          for (const auto& r : replace) {
-            TRACE(PEEPHOLE, 8, "-- %s\n", SHOW(r));
+ private:
+  /*
+   * Runs the matchers from `first` on over every block, each instruction
+   * moving all of them forward at once. Returns the lowest index of those
+   * that matched, m_matchers.size() if none did, and the matches it found
+   * in `matches`. The matches of the others were found in code that the
+   * returned one is going to change, so they get thrown away.
+   */
+  size_t find_first_pattern_matches(ControlFlowGraph& cfg,
+                                    size_t first,
+                                    std::vector<Match>& matches) {
+    size_t best = m_matchers.size();
+    std::vector<size_t> active;
+    std::vector<size_t> next_active;
+
+    auto step = [&](size_t i, IRInstruction* insn) {
+      auto& matcher = m_matchers[i];
+      m_last_step[i] = m_step;
+      if (!matcher.try_match(insn)) {
+        if (matcher.match_index > 0) {
+          next_active.push_back(i);
+        }
+        return;
+      }
+      TRACE(PEEPHOLE, 7, "PATTERN %s MATCHED!\n", matcher.pattern.name.c_str());
+      if (i < best) {
+        for (auto& match : matches) {
+          for (auto insn : match.replace) {
+            delete insn;
           }
-
-          m_stats_inserted += replace.size();
-          m_stats_removed += matcher.match_index;
-
-          inserts.emplace_back(mei.insn, replace);
-          matcher.reset();
         }
+        matches.clear();
+        best = i;
       }
+      auto replace = matcher.get_replacements();
+      for (const auto& r : replace) {
+        TRACE(PEEPHOLE, 8, "-- %s\n", SHOW(r));
+      }
+      matches.push_back(Match{insn,
+                              matcher.matched_instructions,
+                              matcher.match_index,
+                              std::move(replace)});
+      matcher.reset();
+    };
 
-      for (auto& pair : inserts) {
-        std::vector<IRInstruction*> vec{begin(pair.second), end(pair.second)};
-        code->insert_after(pair.first, vec);
+    for (const auto& block : cfg.blocks()) {
+      // Currently, all patterns do not span over multiple basic blocks. So
+      // reset all matching states on visiting every basic block.
+      for (auto i : active) {
+        m_matchers[i].reset();
       }
-      for (auto& insn : deletes) {
-        code->remove_opcode(insn);
+      active.clear();
+
+      for (auto& mei : InstructionIterable(block)) {
+        auto insn = mei.insn;
+        ++m_step;
+        for (auto i : active) {
+          if (i < best) {
+            step(i, insn);
+          } else {
+            m_matchers[i].reset();
+          }
+        }
+        // Matchers that aren't in the middle of a match can only move forward
+        // on the first instruction of their pattern.
+        auto opcode = static_cast<size_t>(insn->opcode());
+        if (opcode < m_matchers_by_first_opcode.size()) {
+          for (auto i : m_matchers_by_first_opcode[opcode]) {
+            if (i >= best) {
+              break;
+            }
+            if (i >= first && m_last_step[i] != m_step) {
+              step(i, insn);
+            }
+          }
+        }
+        active.swap(next_active);
+        next_active.clear();
       }
     }
+    for (auto i : active) {
+      m_matchers[i].reset();
+    }
+    return best;
   }
 
+ public:
   void print_stats() {
     TRACE(PEEPHOLE, 1, "%d instructions removed\n", m_stats_removed);
     TRACE(PEEPHOLE, 1, "%d instructions inserted\n", m_stats_inserted);
@@ -1477,8 +1536,7 @@ class PeepholeOptimizer {
           m_stats_inserted - m_stats_removed);
     int num_patterns_matched = 0;
     for (size_t i = 0; i < m_matchers.size(); ++i) {
-      num_patterns_matched +=
-          m_mgr.get_metric(m_matchers[i].pattern.name.c_str());
+      num_patterns_matched += m_stats[i];
     }
     TRACE(PEEPHOLE,
           1,
@@ -1491,43 +1549,52 @@ class PeepholeOptimizer {
             5,
             "%s: %d\n",
             current_pattern_name.c_str(),
-            m_mgr.get_metric(current_pattern_name.c_str()));
+            m_stats[i]);
     }
   }
 
-  void run_method(DexMethod* m) {
-    if (m->get_code()) {
-      peephole(m);
+  // Sums up the stats of the optimizers of several threads.
+  PeepholeOptimizer& operator+=(const PeepholeOptimizer& that) {
+    for (size_t i = 0; i < m_stats.size(); i++) {
+      m_stats[i] += that.m_stats[i];
     }
+    m_stats_removed += that.m_stats_removed;
+    m_stats_inserted += that.m_stats_inserted;
+    return *this;
   }
 
-  void incr_all_metrics() {
+  void add_stats(std::unordered_map<std::string, size_t>* stats) {
     for (size_t i = 0; i < m_matchers.size(); i++) {
-      m_mgr.incr_metric(m_matchers[i].pattern.name.c_str(), m_stats[i]);
+      (*stats)[m_matchers[i].pattern.name] += m_stats[i];
     }
   }
 };
 }
 
+namespace peephole {
+
+std::unordered_map<std::string, size_t> run(
+    const Scope& scope, const std::vector<std::string>& disabled_peepholes) {
+  auto optimizer = walk::parallel::reduce_code<PeepholeOptimizer>(
+      scope,
+      [](PeepholeOptimizer& ph, DexMethod* m, IRCode&) { ph.peephole(m); },
+      [&](unsigned int /*thread_index*/) {
+        return PeepholeOptimizer(disabled_peepholes);
+      });
+  std::unordered_map<std::string, size_t> stats;
+  optimizer.add_stats(&stats);
+  return stats;
+}
+
+} // namespace peephole
+
 void PeepholePass::run_pass(DexStoresVector& stores,
                             ConfigFiles& /*cfg*/,
                             PassManager& mgr) {
   auto scope = build_class_scope(stores);
-  std::vector<std::unique_ptr<PeepholeOptimizer>> helpers;
-  walk::parallel::reduce_methods<PeepholeOptimizer*, std::nullptr_t>(
-      scope,
-      [](PeepholeOptimizer*& ph, DexMethod* m) { // walker
-        ph->run_method(m);
-        return nullptr;
-      },
-      [](std::nullptr_t, std::nullptr_t) { return nullptr; }, // reducer
-      [&](unsigned int /*thread_index*/) { // data initializer
-        helpers.emplace_back(std::make_unique<PeepholeOptimizer>(
-            mgr, config.disabled_peepholes));
-        return helpers.back().get();
-      });
-  for (const auto& helper : helpers) {
-    helper->incr_all_metrics();
+  for (const auto& pattern_stats :
+       peephole::run(scope, config.disabled_peepholes)) {
+    mgr.incr_metric(pattern_stats.first, pattern_stats.second);
   }
 
   if (!contains<std::string>(config.disabled_peepholes,
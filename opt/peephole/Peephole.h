@@ -9,15 +9,33 @@
 
 #pragma once
 
+#include <string>
+#include <unordered_map>
 #include <vector>
+#include "DexClass.h"
 #include "Pass.h"
 
+namespace peephole {
+
+/*
+ * Applies the peephole patterns, except the disabled ones, to the code in
+ * `scope`. Returns how many times each pattern was applied.
+ */
+std::unordered_map<std::string, size_t> run(
+    const Scope& scope, const std::vector<std::string>& disabled_peepholes);
+
+} // namespace peephole
+
 class PeepholePass : public Pass {
  public:
   PeepholePass() : Pass("PeepholePass") {}
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual bool is_method_local() const override { return true; }
+
   virtual void configure_pass(const PassConfig& pc) override {
     pc.get("disabled_peepholes", {}, config.disabled_peepholes);
   }
@@ -12,6 +12,7 @@
 #include <unordered_map>
 
 #include "DexUtil.h"
+#include "HierarchyCache.h"
 #include "IRCode.h"
 #include "Match.h"
 #include "Walkers.h"
@@ -28,12 +29,13 @@ void RedundantCheckCastRemover::run() {
 
   std::unordered_map<DexMethod*, std::vector<IRInstruction*>> to_remove;
 
+  const auto& index = m_mgr.get_hierarchy_cache().get_hierarchy_index();
   std::atomic<uint32_t> num_check_casts_removed;
   walk::parallel::matching_opcodes_in_block(
       m_scope,
       match,
-      [](DexMethod* method, const std::vector<IRInstruction*>& insns) {
-        if (RedundantCheckCastRemover::can_remove_check_cast(insns)) {
+      [&index](DexMethod* method, const std::vector<IRInstruction*>& insns) {
+        if (RedundantCheckCastRemover::can_remove_check_cast(index, insns)) {
           IRInstruction* check_cast = insns[2];
           method->get_code()->remove_opcode(check_cast);
 
@@ -48,7 +50,7 @@ void RedundantCheckCastRemover::run() {
 }
 
 bool RedundantCheckCastRemover::can_remove_check_cast(
-    const std::vector<IRInstruction*>& insns) {
+    const HierarchyIndex& index, const std::vector<IRInstruction*>& insns) {
   always_assert(insns.size() == 4);
   IRInstruction* invoke_op = insns[0];
   IRInstruction* move_result_op = insns[1];
@@ -59,5 +61,5 @@ bool RedundantCheckCastRemover::can_remove_check_cast(
   auto check_type = check_cast_op->get_type();
   return move_result_op->dest() == check_cast_op->src(0) &&
          move_result_pseudo->dest() == check_cast_op->src(0) &&
-         check_cast(invoke_return, check_type);
+         index.is_subtype(check_type, invoke_return);
 }
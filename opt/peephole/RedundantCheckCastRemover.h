@@ -13,6 +13,8 @@
 #include "DexClass.h"
 #include "PassManager.h"
 
+class HierarchyIndex;
+
 class RedundantCheckCastRemover {
  public:
   static const std::string& get_name() {
@@ -25,7 +27,8 @@ class RedundantCheckCastRemover {
   void run();
 
  private:
-  static bool can_remove_check_cast(const std::vector<IRInstruction*>&);
+  static bool can_remove_check_cast(const HierarchyIndex&,
+                                    const std::vector<IRInstruction*>&);
 
   PassManager& m_mgr;
   const std::vector<DexClass*>& m_scope;
@@ -44,6 +44,13 @@ class PrintMembersPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual unsigned reads() const override {
+    return TOUCHES_CODE | TOUCHES_HIERARCHY;
+  }
+  virtual unsigned writes() const override { return TOUCHES_NOTHING; }
+
  private:
   void handle_method(DexMethod* m, const char* type);
   struct Config {
@@ -9,11 +9,95 @@
 
 #include "ReachabilityGraphPrinter.h"
 
+#include "BinaryGraph.h"
 #include "PassManager.h"
 #include "ReachableObjects.h"
+#include "WorkQueue.h"
 
+#include <algorithm>
 #include <fstream>
 
+namespace {
+
+using namespace reachable_objects;
+
+binary_graph::NodeKind node_kind(const ReachableObject& obj) {
+  switch (obj.type) {
+  case ReachableObjectType::ANNO:
+    return binary_graph::NodeKind::ANNO;
+  case ReachableObjectType::CLASS:
+    return binary_graph::NodeKind::CLASS;
+  case ReachableObjectType::FIELD:
+    return binary_graph::NodeKind::FIELD;
+  case ReachableObjectType::METHOD:
+    return binary_graph::NodeKind::METHOD;
+  case ReachableObjectType::SEED:
+    return binary_graph::NodeKind::SEED;
+  }
+}
+
+/**
+ * Writes every object, retained or retaining, as a node labelled with its
+ * state, and an edge from each retainer to what it retains. The nodes are
+ * named in parallel, then numbered in the order of their names, so that the
+ * same graph comes out the same.
+ */
+void write_binary_graph(const ReachableObjectGraph& retainers_of,
+                        const std::string& file_name) {
+  ReachableObjectSet object_set;
+  for (const auto& retainers : retainers_of) {
+    object_set.insert(retainers.first);
+    object_set.insert(retainers.second.begin(), retainers.second.end());
+  }
+  std::vector<ReachableObject> objects(object_set.begin(), object_set.end());
+  std::vector<binary_graph::Graph::Node> nodes(objects.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    const auto& obj = objects[i];
+    auto label = obj.type == ReachableObjectType::SEED ? "" : obj.state_str();
+    nodes[i] = binary_graph::Graph::Node{node_kind(obj), obj.str(), label};
+  });
+  for (size_t i = 0; i < objects.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  std::vector<size_t> order(objects.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    const auto& na = nodes[a];
+    const auto& nb = nodes[b];
+    if (na.kind != nb.kind) return na.kind < nb.kind;
+    if (na.name != nb.name) return na.name < nb.name;
+    return na.label < nb.label;
+  });
+  binary_graph::Graph graph;
+  std::unordered_map<ReachableObject,
+                     uint32_t,
+                     ReachableObjectHash,
+                     ReachableObjectEq>
+      ids;
+  for (auto i : order) {
+    auto& node = nodes[i];
+    ids.emplace(objects[i],
+                graph.add_node(
+                    node.kind, std::move(node.name), std::move(node.label)));
+  }
+  for (const auto& retainers : retainers_of) {
+    auto retained = ids.at(retainers.first);
+    for (const auto& retainer : retainers.second) {
+      graph.edges[ids.at(retainer)].push_back(binary_graph::Edge{retained, 0});
+    }
+  }
+  if (!binary_graph::write(graph, file_name)) {
+    std::cerr << "Unable to write: " << file_name << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+} // namespace
+
 void ReachabilityGraphPrinterPass::run_pass(DexStoresVector& stores,
                                             ConfigFiles& /*cfg*/,
                                             PassManager& pm) {
@@ -63,6 +147,15 @@ void ReachabilityGraphPrinterPass::run_pass(DexStoresVector& stores,
     dump_reachability_graph(stores, reachables.retainers_of, tag, file);
   }
 
+  if (!m_binary_output_file_name.empty()) {
+    if (pm.get_current_pass_info()->total_repeat == 1) {
+      write_binary_graph(reachables.retainers_of, m_binary_output_file_name);
+    } else {
+      write_binary_graph(reachables.retainers_of,
+                         m_binary_output_file_name + "." + tag);
+    }
+  }
+
   if (m_dump_detailed_info) {
     dump_reachability(stores, reachables.retainers_of, "[" + tag + "]");
   }
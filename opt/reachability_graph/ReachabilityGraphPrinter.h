@@ -17,6 +17,8 @@ class ReachabilityGraphPrinterPass : public Pass {
 
   virtual void configure_pass(const PassConfig& pc) override {
     pc.get("output_file_name", "", m_output_file_name);
+    // The whole graph, in the format of BinaryGraph.h.
+    pc.get("binary_output_file_name", "", m_binary_output_file_name);
     pc.get("dump_detailed_info", false, m_dump_detailed_info);
     pc.get("ignore_string_literals", {}, m_ignore_string_literals);
     pc.get("ignore_string_literal_annos", {}, m_ignore_string_literal_annos);
@@ -27,6 +29,7 @@ class ReachabilityGraphPrinterPass : public Pass {
 
  private:
   std::string m_output_file_name;
+  std::string m_binary_output_file_name;
   bool m_dump_detailed_info{true};
   std::vector<std::string> m_ignore_string_literals;
   std::vector<std::string> m_ignore_string_literal_annos;
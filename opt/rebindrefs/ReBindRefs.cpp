@@ -11,6 +11,8 @@
 
 #include <functional>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "Debug.h"
@@ -21,6 +23,7 @@
 #include "Resolver.h"
 #include "Util.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -118,121 +121,193 @@ DexMethod* bind_to_visible_ancestor(
   return top_impl;
 }
 
+template <typename T>
+struct RefStats {
+  int count = 0;
+  std::unordered_set<T> in;
+  std::unordered_set<T> out;
+
+  void insert(T tin, T tout) {
+    ++count;
+    in.emplace(tin);
+    out.emplace(tout);
+  }
+
+  void insert(T tin) {
+    insert(tin, T());
+  }
+
+  void merge(const RefStats& other) {
+    count += other.count;
+    in.insert(other.in.begin(), other.in.end());
+    out.insert(other.out.begin(), other.out.end());
+  }
+
+  void print(const char* tag, PassManager* mgr) {
+    TRACE(BIND, 1,
+            "%11s [call sites: %6d, old refs: %6lu, new refs: %6lu]\n",
+            tag, count, in.size(), out.size());
+
+    if (mgr) {
+      using std::string;
+      string tagStr{tag};
+      string count_metric = tagStr + string("_candidates");
+      string rebound_metric = tagStr + string("_rebound");
+      mgr->incr_metric(count_metric, count);
+
+      auto rebound = static_cast<ssize_t>(in.size()) -
+        static_cast<ssize_t>(out.size());
+      mgr->incr_metric(rebound_metric, rebound);
+    }
+  }
+};
+
+/**
+ * What a worker of the Rebinder gathers about the classes it processes.
+ */
+struct RebinderState {
+  RefStats<DexFieldRef*> frefs;
+  RefStats<DexMethodRef*> mrefs;
+  RefStats<DexMethodRef*> array_clone_refs;
+  RefStats<DexMethodRef*> equals_refs;
+  RefStats<DexMethodRef*> hashCode_refs;
+  RefStats<DexMethodRef*> getClass_refs;
+  // The classes that have to be made public. They are only changed once all
+  // the references are rebound, as the visibility of the classes decides how
+  // far up the hierarchy a virtual call can be bound.
+  std::unordered_set<DexClass*> to_publicize;
+  // The visible ancestors the invoke-virtual refs were bound to.
+  std::unordered_map<DexMethodRef*, DexMethod*> visible_ancestors;
+
+  void merge(const RebinderState& other) {
+    frefs.merge(other.frefs);
+    mrefs.merge(other.mrefs);
+    array_clone_refs.merge(other.array_clone_refs);
+    equals_refs.merge(other.equals_refs);
+    hashCode_refs.merge(other.hashCode_refs);
+    getClass_refs.merge(other.getClass_refs);
+    to_publicize.insert(other.to_publicize.begin(), other.to_publicize.end());
+  }
+};
+
 struct Rebinder {
   Rebinder(Scope& scope, PassManager& mgr) : m_scope(scope), m_pass_mgr(mgr) {}
 
   void rewrite_refs() {
-    walk::opcodes(
-      m_scope,
-      [](DexMethod*) { return true; },
-      [&](DexMethod* m, IRInstruction* insn) {
-        bool top_ancestor = false;
-        switch (insn->opcode()) {
-          case OPCODE_INVOKE_VIRTUAL:
-            top_ancestor = true;
-            // fallthrough
-          case OPCODE_INVOKE_SUPER:
-          case OPCODE_INVOKE_INTERFACE:
-          case OPCODE_INVOKE_STATIC:
-            rebind_method(insn, opcode_to_search(insn), top_ancestor);
-            break;
-          case OPCODE_SGET:
-          case OPCODE_SGET_WIDE:
-          case OPCODE_SGET_OBJECT:
-          case OPCODE_SGET_BOOLEAN:
-          case OPCODE_SGET_BYTE:
-          case OPCODE_SGET_CHAR:
-          case OPCODE_SGET_SHORT:
-            rebind_field(insn, FieldSearch::Static);
-            break;
-          case OPCODE_IGET:
-          case OPCODE_IGET_WIDE:
-          case OPCODE_IGET_OBJECT:
-          case OPCODE_IGET_BOOLEAN:
-          case OPCODE_IGET_BYTE:
-          case OPCODE_IGET_CHAR:
-          case OPCODE_IGET_SHORT:
-            rebind_field(insn, FieldSearch::Instance);
-            break;
-          default:
-            break;
-        }
-      });
+    auto num_threads = workqueue_default_num_threads();
+    std::vector<RebinderState> states(num_threads);
+    auto wq = WorkQueue<DexClass*, RebinderState*, std::nullptr_t>(
+        [&](RebinderState*& state, DexClass* cls) -> std::nullptr_t {
+          for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+            for (auto method : *methods) {
+              auto code = method->get_code();
+              if (code == nullptr) continue;
+              for (const auto& mie : InstructionIterable(code)) {
+                rewrite_ref(*state, mie.insn);
+              }
+            }
+          }
+          return nullptr;
+        },
+        [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+        [&](unsigned int thread_idx) { return &states[thread_idx]; },
+        num_threads);
+    for (auto cls : m_scope) {
+      wq.add_item(cls);
+    }
+    wq.run_all();
+
+    for (const auto& state : states) {
+      m_stats.merge(state);
+    }
+    for (auto cls : m_stats.to_publicize) {
+      set_public(cls);
+    }
   }
 
   void print_stats() {
-    m_frefs.print("field_refs", &m_pass_mgr);
-    m_mrefs.print("method_refs", &m_pass_mgr);
-    m_array_clone_refs.print("array_clone", nullptr);
-    m_equals_refs.print("equals", nullptr);
-    m_hashCode_refs.print("hashCode", nullptr);
-    m_getClass_refs.print("getClass", nullptr);
+    m_stats.frefs.print("field_refs", &m_pass_mgr);
+    m_stats.mrefs.print("method_refs", &m_pass_mgr);
+    m_stats.array_clone_refs.print("array_clone", nullptr);
+    m_stats.equals_refs.print("equals", nullptr);
+    m_stats.hashCode_refs.print("hashCode", nullptr);
+    m_stats.getClass_refs.print("getClass", nullptr);
   }
 
  private:
-  template<typename T>
-  struct RefStats {
-    int count = 0;
-    std::unordered_set<T> in;
-    std::unordered_set<T> out;
-
-    void insert(T tin, T tout) {
-      ++count;
-      in.emplace(tin);
-      out.emplace(tout);
-    }
-
-    void insert(T tin) {
-      insert(tin, T());
-    }
-
-    void print(const char* tag, PassManager* mgr) {
-      TRACE(BIND, 1,
-              "%11s [call sites: %6d, old refs: %6lu, new refs: %6lu]\n",
-              tag, count, in.size(), out.size());
-
-      if (mgr) {
-        using std::string;
-        string tagStr{tag};
-        string count_metric = tagStr + string("_candidates");
-        string rebound_metric = tagStr + string("_rebound");
-        mgr->incr_metric(count_metric, count);
-
-        auto rebound = static_cast<ssize_t>(in.size()) -
-          static_cast<ssize_t>(out.size());
-        mgr->incr_metric(rebound_metric, rebound);
-      }
+  void rewrite_ref(RebinderState& state, IRInstruction* insn) {
+    bool top_ancestor = false;
+    switch (insn->opcode()) {
+      case OPCODE_INVOKE_VIRTUAL:
+        top_ancestor = true;
+        // fallthrough
+      case OPCODE_INVOKE_SUPER:
+      case OPCODE_INVOKE_INTERFACE:
+      case OPCODE_INVOKE_STATIC:
+        rebind_method(state, insn, opcode_to_search(insn), top_ancestor);
+        break;
+      case OPCODE_SGET:
+      case OPCODE_SGET_WIDE:
+      case OPCODE_SGET_OBJECT:
+      case OPCODE_SGET_BOOLEAN:
+      case OPCODE_SGET_BYTE:
+      case OPCODE_SGET_CHAR:
+      case OPCODE_SGET_SHORT:
+        rebind_field(state, insn, FieldSearch::Static);
+        break;
+      case OPCODE_IGET:
+      case OPCODE_IGET_WIDE:
+      case OPCODE_IGET_OBJECT:
+      case OPCODE_IGET_BOOLEAN:
+      case OPCODE_IGET_BYTE:
+      case OPCODE_IGET_CHAR:
+      case OPCODE_IGET_SHORT:
+        rebind_field(state, insn, FieldSearch::Instance);
+        break;
+      default:
+        break;
     }
-  };
+  }
 
-  void rebind_method(
-      IRInstruction* mop, MethodSearch search, bool top_ancestor) {
+  void rebind_method(RebinderState& state,
+                     IRInstruction* mop,
+                     MethodSearch search,
+                     bool top_ancestor) {
     const auto mref = mop->get_method();
     if (search == MethodSearch::Virtual && top_ancestor) {
       auto mtype = mref->get_class();
       if (is_array_clone(mref, mtype)) {
-        rebind_method_opcode(mop, mref, rebind_array_clone(mref));
+        rebind_method_opcode(
+            state, mop, mref, rebind_array_clone(state, mref));
         return;
       }
       // leave java.lang.String alone not to interfere with OP_EXECUTE_INLINE
       // and possibly any smart handling of String
       static auto str = DexType::make_type("Ljava/lang/String;");
       if (mtype == str) return;
-      auto real_ref = rebind_object_methods(mref);
+      auto real_ref = rebind_object_methods(state, mref);
       if (real_ref) {
-        rebind_method_opcode(mop, mref, real_ref);
+        rebind_method_opcode(state, mop, mref, real_ref);
         return;
       }
-      auto cls = type_class(mtype);
-      real_ref = bind_to_visible_ancestor(
-          cls, mref->get_name(), mref->get_proto());
-      rebind_method_opcode(mop, mref, real_ref);
+      auto it = state.visible_ancestors.find(mref);
+      if (it == state.visible_ancestors.end()) {
+        auto cls = type_class(mtype);
+        it = state.visible_ancestors
+                 .emplace(mref,
+                          bind_to_visible_ancestor(
+                              cls, mref->get_name(), mref->get_proto()))
+                 .first;
+      }
+      rebind_method_opcode(state, mop, mref, it->second);
       return;
     }
-    rebind_method_opcode(mop, mref, resolve_method(mref, search));
+    rebind_method_opcode(
+        state, mop, mref, resolve_method_cached(mref, search));
   }
 
   void rebind_method_opcode(
+      RebinderState& state,
       IRInstruction* mop,
       DexMethodRef* mref,
       DexMethodRef* real_ref) {
@@ -240,11 +315,11 @@ struct Rebinder {
       return;
     }
     TRACE(BIND, 2, "Rebinding %s\n\t=>%s\n", SHOW(mref), SHOW(real_ref));
-    m_mrefs.insert(mref, real_ref);
+    state.mrefs.insert(mref, real_ref);
     mop->set_method(real_ref);
     auto cls = type_class(real_ref->get_class());
     if (cls != nullptr && !is_public(cls)) {
-      set_public(cls);
+      state.to_publicize.insert(cls);
     }
   }
 
@@ -255,35 +330,38 @@ struct Rebinder {
         !is_primitive(get_array_type(mtype));
   }
 
-  DexMethodRef* rebind_array_clone(DexMethodRef* mref) {
+  DexMethodRef* rebind_array_clone(RebinderState& state, DexMethodRef* mref) {
    DexMethodRef* real_ref = object_array_clone();
-   m_array_clone_refs.insert(mref, real_ref);
+   state.array_clone_refs.insert(mref, real_ref);
    return real_ref;
   }
 
-  DexMethodRef* rebind_object_methods(DexMethodRef* mref) {
+  DexMethodRef* rebind_object_methods(RebinderState& state,
+                                      DexMethodRef* mref) {
     if (is_object_equals(mref)) {
-      m_equals_refs.insert(mref);
+      state.equals_refs.insert(mref);
       return object_equals();
     } else if (is_object_hashCode(mref)) {
-      m_hashCode_refs.insert(mref);
+      state.hashCode_refs.insert(mref);
       return object_hashCode();
     } else if (is_object_getClass(mref)) {
-      m_getClass_refs.insert(mref);
+      state.getClass_refs.insert(mref);
       return object_getClass();
     }
     return nullptr;
   }
 
-  void rebind_field(IRInstruction* insn, FieldSearch field_search) {
+  void rebind_field(RebinderState& state,
+                    IRInstruction* insn,
+                    FieldSearch field_search) {
     const auto fref = insn->get_field();
-    const auto real_ref = resolve_field(fref, field_search);
+    const auto real_ref = resolve_field_cached(fref, field_search);
     if (real_ref && real_ref != fref) {
       auto cls = type_class(real_ref->get_class());
       always_assert(cls != nullptr);
       if (!is_public(cls)) {
         if (cls->is_external()) return;
-        set_public(cls);
+        state.to_publicize.insert(cls);
       }
       TRACE(BIND,
             2,
@@ -291,21 +369,15 @@ struct Rebinder {
             SHOW(fref),
             SHOW(real_ref));
       insn->set_field(real_ref);
-      m_frefs.insert(fref, real_ref);
+      state.frefs.insert(fref, real_ref);
     }
   }
 
   Scope& m_scope;
   PassManager& m_pass_mgr;
 
-  RefStats<DexFieldRef*> m_frefs;
-  RefStats<DexMethodRef*> m_mrefs;
-  RefStats<DexMethodRef*> m_array_clone_refs;
-  RefStats<DexMethodRef*> m_equals_refs;
-  RefStats<DexMethodRef*> m_hashCode_refs;
-  RefStats<DexMethodRef*> m_getClass_refs;
+  RebinderState m_stats;
 };
-
 }
 
 void ReBindRefsPass::run_pass(
@@ -17,6 +17,7 @@
 #include "Debug.h"
 #include "DexUtil.h"
 #include "IRCode.h"
+#include "LinearScan.h"
 #include "Transform.h"
 #include "VirtualRegistersFile.h"
 
@@ -306,7 +307,11 @@ void Allocator::Stats::accumulate(const Allocator::Stats& that) {
   global_spill_moves += that.global_spill_moves;
   split_moves += that.split_moves;
   moves_coalesced += that.moves_coalesced;
+  moves_coalesced_conservatively += that.moves_coalesced_conservatively;
+  coalesce_rejections += that.coalesce_rejections;
   params_spill_early += that.params_spill_early;
+  linear_scan_fallbacks += that.linear_scan_fallbacks;
+  linear_scan_moves += that.linear_scan_moves;
 }
 
 static bool has_2addr_form(IROpcode op) {
@@ -336,6 +341,39 @@ static bool has_2addr_form(IROpcode op) {
  * This is fairly similar to the implementation in [Briggs92] section 8.6.
  */
 bool Allocator::coalesce(interference::Graph* ig, IRCode* code) {
+  return coalesce(ig, code, [ig](reg_t dest, reg_t src) {
+    return ig->is_coalesceable(dest, src);
+  });
+}
+
+bool Allocator::coalesce_conservatively(interference::Graph* ig,
+                                        IRCode* code,
+                                        reg_t initial_regs) {
+  auto old_coalesce_count = m_stats.moves_coalesced;
+  auto result = coalesce(ig, code, [&](reg_t dest, reg_t src) {
+    if (dest >= initial_regs || src >= initial_regs) {
+      return false;
+    }
+    const auto& dest_node = ig->get_node(dest);
+    const auto& src_node = ig->get_node(src);
+    if (dest_node.is_param() || dest_node.is_range() || src_node.is_param() ||
+        src_node.is_range() || !ig->is_coalesceable(dest, src)) {
+      return false;
+    }
+    if (!ig->can_coalesce_conservatively(dest, src)) {
+      ++m_stats.coalesce_rejections;
+      return false;
+    }
+    return true;
+  });
+  m_stats.moves_coalesced_conservatively +=
+      m_stats.moves_coalesced - old_coalesce_count;
+  return result;
+}
+
+bool Allocator::coalesce(interference::Graph* ig,
+                         IRCode* code,
+                         const std::function<bool(reg_t, reg_t)>& may_combine) {
   // XXX We could use something more compact than an unordered_map?
   using Rank = std::unordered_map<reg_t, size_t>;
   using Parent = std::unordered_map<reg_t, reg_t>;
@@ -375,7 +413,7 @@ bool Allocator::coalesce(interference::Graph* ig, IRCode* code) {
         ++m_stats.moves_coalesced;
         code->remove_opcode(it.unwrap());
       }
-    } else if (ig->is_coalesceable(dest, src)) {
+    } else if (may_combine(dest, src)) {
       // This unifies the two trees represented by dest and src
       aliases.link(dest, src);
       // Since link() doesn't tell us whether dest or src is the root of the
@@ -634,7 +672,7 @@ void Allocator::select_ranges(const IRCode* code,
     }
 
     reg_t range_base = find_best_range_fit(ig,
-                                           insn->srcs(),
+                                           insn->srcs_vec(),
                                            0,
                                            reg_transform->size,
                                            vreg_files,
@@ -1024,16 +1062,22 @@ void Allocator::spill(const interference::Graph& ig,
  * Main differences from the standard Chaitin-Briggs
  * build-coalesce-simplify-spill loop:
  *
- *   * We only coalesce the first time around, because our move instructions
- *     and our spill / reload instructions are one and the same. This is
- *     easily fixable, though I have yet to profile the performance tradeoff.
- *     We also don't rebuild the interference graph after coalescing; I'd
- *     like to do some performance work before enabling that.
+ *   * Only the first round coalesces aggressively, because our move
+ *     instructions and our spill / reload instructions are one and the same.
+ *     With Config::iterated_coalescing, the later rounds coalesce the symregs
+ *     that existed before spilling, conservatively (Briggs or George), so
+ *     that they don't undo the spills. We don't rebuild the interference
+ *     graph after coalescing; I'd like to do some performance work before
+ *     enabling that.
  *
  *   * We have to handle range instructions and have the parameter vregs
  *     at the end of the frame, which the original algorithm doesn't quite
  *     account for. These are handled in select_ranges and select_params
  *     respectively.
+ *
+ *   * Some methods take many rounds of spilling and splitting to converge.
+ *     If Config::max_reiterations is set, we stop after that many rounds and
+ *     let the linear scan allocator finish the method in one pass.
  */
 void Allocator::allocate(IRCode* code) {
 
@@ -1046,6 +1090,7 @@ void Allocator::allocate(IRCode* code) {
   auto range_set = init_range_set(code);
 
   bool first{true};
+  int64_t reiterations{0};
   while (true) {
     SplitCosts split_costs;
     SpillPlan spill_plan;
@@ -1069,12 +1114,16 @@ void Allocator::allocate(IRCode* code) {
       fixpoint_iter.run(LivenessDomain(code->get_registers_size()));
       TRACE(REG, 5, "Post-coalesce:\n%s\n", SHOW(code->cfg()));
     } else {
-      // TODO we should coalesce here too, but we'll need to avoid removing
-      // moves that were inserted by spilling
-
       // If we've hit this many iterations, it's very likely that we've hit
       // some bug that's causing us to loop infinitely.
       always_assert(m_stats.reiteration_count++ < 200);
+      // Splitting shortens live ranges, which may leave moves between symregs
+      // that no longer interfere.
+      if (m_config.iterated_coalescing &&
+          coalesce_conservatively(&ig, code, initial_regs)) {
+        fixpoint_iter.run(LivenessDomain(code->get_registers_size()));
+        TRACE(REG, 5, "Post-coalesce:\n%s\n", SHOW(code->cfg()));
+      }
     }
     TRACE(REG, 7, "IG:\n%s", SHOW(ig));
 
@@ -1116,6 +1165,17 @@ void Allocator::allocate(IRCode* code) {
       // Since we have inserted instructions, we need to rebuild the CFG to
       // ensure that block boundaries remain correct
       code->build_cfg();
+
+      if (m_config.max_reiterations > 0 &&
+          ++reiterations >= m_config.max_reiterations) {
+        TRACE(REG,
+              3,
+              "Falling back to linear scan after %ld iterations\n",
+              reiterations);
+        m_stats.linear_scan_moves += linear_scan::allocate(code);
+        ++m_stats.linear_scan_fallbacks;
+        break;
+      }
     } else {
       transform::remap_registers(code, reg_transform.map);
       code->set_registers_size(reg_transform.size);
@@ -1130,7 +1190,13 @@ void Allocator::allocate(IRCode* code) {
   TRACE(REG, 3, "  Global spills: %lu\n", m_stats.global_spill_moves);
   TRACE(REG, 3, "  splits: %lu\n", m_stats.split_moves);
   TRACE(REG, 3, "Coalesce count: %lu\n", m_stats.moves_coalesced);
+  TRACE(REG,
+        3,
+        "  Conservative: %lu (%lu rejected)\n",
+        m_stats.moves_coalesced_conservatively,
+        m_stats.coalesce_rejections);
   TRACE(REG, 3, "Params spilled too early: %lu\n", m_stats.params_spill_early);
+  TRACE(REG, 3, "Linear scan fallbacks: %lu\n", m_stats.linear_scan_fallbacks);
   TRACE(REG, 3, "Net moves: %ld\n", m_stats.net_moves());
 }
 
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <functional>
 #include <stack>
 
 #include "Interference.h"
@@ -76,6 +77,13 @@ class Allocator {
   struct Config {
     bool use_splitting{false};
     bool use_spill_costs{false};
+    // The number of spill / split rounds after which allocate() gives up and
+    // hands the method to linear_scan::allocate(). Zero means no limit.
+    int64_t max_reiterations{0};
+    // Whether to coalesce again after each spill / split round. Unlike the
+    // first round, these only merge symregs when the Briggs or George test
+    // shows that the graph stays as easy to color.
+    bool iterated_coalescing{false};
   };
 
   struct Stats {
@@ -85,13 +93,23 @@ class Allocator {
     size_t global_spill_moves{0};
     size_t split_moves{0};
     size_t moves_coalesced{0};
+    // Of moves_coalesced, those removed after the first round, and the pairs
+    // of symregs those rounds kept apart because neither test allowed it.
+    size_t moves_coalesced_conservatively{0};
+    size_t coalesce_rejections{0};
     size_t params_spill_early{0};
+    size_t linear_scan_fallbacks{0};
+    size_t linear_scan_moves{0};
     size_t moves_inserted() const {
       return param_spill_moves + range_spill_moves + global_spill_moves +
-             split_moves;
+             split_moves + linear_scan_moves;
     }
     size_t net_moves() const { return moves_inserted() - moves_coalesced; }
     void accumulate(const Stats&);
+    Stats& operator+=(const Stats& that) {
+      accumulate(that);
+      return *this;
+    }
   };
 
   Allocator() = default; // use default config
@@ -100,6 +118,16 @@ class Allocator {
 
   bool coalesce(interference::Graph*, IRCode*);
 
+  /*
+   * Like coalesce(), but for the rounds after spilling: symregs created by
+   * spilling or splitting (i.e. at or above initial_regs) are left alone, as
+   * are params and range symregs, and the others are only merged if
+   * Graph::can_coalesce_conservatively() holds.
+   */
+  bool coalesce_conservatively(interference::Graph*,
+                               IRCode*,
+                               reg_t initial_regs);
+
   void simplify(interference::Graph*,
                 std::stack<reg_t>* select_stack,
                 std::stack<reg_t>* spilled_select_stack);
@@ -151,6 +179,10 @@ class Allocator {
   const Stats& get_stats() const { return m_stats; }
 
  private:
+  bool coalesce(interference::Graph*,
+                IRCode*,
+                const std::function<bool(reg_t, reg_t)>& may_combine);
+
   Config m_config;
   Stats m_stats;
 };
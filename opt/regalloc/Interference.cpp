@@ -89,7 +89,7 @@ void Graph::add_edge(reg_t u, reg_t v, bool can_coalesce) {
   //
   // then the final state of the edge between s0 and s1 must be
   // non-coalesceable.
-  m_adj_matrix[Edge(u, v)] = m_adj_matrix[Edge(u, v)] || !can_coalesce;
+  m_adj_matrix.add(u, v, can_coalesce);
 }
 
 uint32_t Node::colorable_limit() const {
@@ -100,6 +100,52 @@ bool Node::definitely_colorable() const { return weight() < colorable_limit(); }
 
 const Node& Graph::get_node(reg_t v) const { return m_nodes.at(v); }
 
+bool Graph::can_coalesce_conservatively(reg_t u, reg_t v) const {
+  const auto& u_node = m_nodes.at(u);
+  const auto& v_node = m_nodes.at(v);
+  // Combining b into a: a must not end up with a tighter constraint.
+  auto george = [&](reg_t a, const Node& a_node, const Node& b_node) {
+    if (a_node.width() != b_node.width() ||
+        a_node.max_vreg() > b_node.max_vreg()) {
+      return false;
+    }
+    for (auto t : b_node.adjacent()) {
+      const auto& t_node = m_nodes.at(t);
+      if (t != a && t_node.is_active() && !t_node.definitely_colorable() &&
+          !is_adjacent(a, t)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (george(u, u_node, v_node) || george(v, v_node, u_node)) {
+    return true;
+  }
+
+  Node combined;
+  combined.m_width = std::max(u_node.width(), v_node.width());
+  combined.m_max_vreg = std::min(u_node.max_vreg(), v_node.max_vreg());
+  uint32_t significant_weight = 0;
+  std::unordered_set<reg_t> seen{u, v};
+  for (const auto* node : {&u_node, &v_node}) {
+    for (auto t : node->adjacent()) {
+      const auto& t_node = m_nodes.at(t);
+      if (!t_node.is_active() || !seen.emplace(t).second) {
+        continue;
+      }
+      // A neighbor of both loses one of its edges.
+      auto t_weight = t_node.weight();
+      if (is_adjacent(u, t) && is_adjacent(v, t)) {
+        t_weight -= edge_weight(t_node, v_node);
+      }
+      if (t_weight >= t_node.colorable_limit()) {
+        significant_weight += edge_weight(combined, t_node);
+      }
+    }
+  }
+  return significant_weight < combined.colorable_limit();
+}
+
 void Graph::combine(reg_t u, reg_t v) {
   auto& u_node = m_nodes.at(u);
   auto& v_node = m_nodes.at(v);
@@ -262,6 +308,7 @@ Graph GraphBuilder::build(const LivenessFixpointIterator& fixpoint_iter,
                           reg_t initial_regs,
                           const RangeSet& range_set) {
   Graph graph;
+  graph.m_adj_matrix = AdjacencyMatrix(code->get_registers_size());
   auto ii = InstructionIterable(code);
   for (auto it = ii.begin(); it != ii.end(); ++it) {
     GraphBuilder::update_node_constraints(it.unwrap(), range_set, &graph);
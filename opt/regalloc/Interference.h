@@ -85,6 +85,91 @@ inline size_t hash_value(const OrderedPair<T>& pair) {
   return seed;
 }
 
+/*
+ * The interference edges of a graph, and whether each of them may be
+ * coalesced. Edges between registers below the size given at construction
+ * are kept in a triangular bit matrix, so adding and testing them is
+ * constant-time bit twiddling rather than hashing. Anything else goes into a
+ * hash map, which is all that an AdjacencyMatrix of size zero uses. The
+ * neighbors of a node are listed in Node::adjacent(), so this is only used for
+ * membership tests.
+ */
+class AdjacencyMatrix {
+ public:
+  // Methods with more registers than this would need too much memory for the
+  // matrix: it takes n^2 bits for n registers.
+  static constexpr size_t kMaxDenseSize = 8192;
+
+  explicit AdjacencyMatrix(size_t size = 0)
+      : m_size(size <= kMaxDenseSize ? size : 0),
+        m_edges(num_words(m_size)),
+        m_not_coalesceable(num_words(m_size)) {}
+
+  bool contains(reg_t u, reg_t v) const {
+    if (is_dense(u, v)) {
+      return test(m_edges, index(u, v));
+    }
+    return m_sparse.find(Edge(u, v)) != m_sparse.end();
+  }
+
+  // Must only be called for edges that are in the matrix.
+  bool is_coalesceable(reg_t u, reg_t v) const {
+    if (is_dense(u, v)) {
+      return !test(m_not_coalesceable, index(u, v));
+    }
+    return !m_sparse.at(Edge(u, v));
+  }
+
+  /*
+   * Adds the edge u -- v. Once an edge has been added as not coalesceable, it
+   * stays that way.
+   */
+  void add(reg_t u, reg_t v, bool can_coalesce) {
+    if (is_dense(u, v)) {
+      auto i = index(u, v);
+      set(&m_edges, i);
+      if (!can_coalesce) {
+        set(&m_not_coalesceable, i);
+      }
+      return;
+    }
+    auto& not_coalesceable = m_sparse[Edge(u, v)];
+    not_coalesceable = not_coalesceable || !can_coalesce;
+  }
+
+ private:
+  using Edge = OrderedPair<reg_t>;
+
+  static size_t num_words(size_t size) {
+    return (size * (size - 1) / 2 + 63) / 64;
+  }
+
+  bool is_dense(reg_t u, reg_t v) const {
+    return u != v && u < m_size && v < m_size;
+  }
+
+  // The position of the edge in the lower triangle of the matrix, without its
+  // diagonal. u and v must differ.
+  static size_t index(reg_t u, reg_t v) {
+    Edge edge(u, v);
+    return size_t(edge.second) * (edge.second - 1) / 2 + edge.first;
+  }
+
+  static bool test(const std::vector<uint64_t>& bits, size_t i) {
+    return (bits[i / 64] >> (i % 64)) & 1;
+  }
+
+  static void set(std::vector<uint64_t>* bits, size_t i) {
+    (*bits)[i / 64] |= uint64_t(1) << (i % 64);
+  }
+
+  size_t m_size;
+  std::vector<uint64_t> m_edges;
+  std::vector<uint64_t> m_not_coalesceable;
+  std::unordered_map<Edge, bool /* not_coalesceable */, boost::hash<Edge>>
+      m_sparse;
+};
+
 } // namespace impl
 
 class Node {
@@ -194,13 +279,22 @@ class Graph {
   }
 
   bool is_adjacent(reg_t u, reg_t v) const {
-    return m_adj_matrix.find(Edge(u, v)) != m_adj_matrix.end();
+    return m_adj_matrix.contains(u, v);
   }
 
   bool is_coalesceable(reg_t u, reg_t v) const {
-    return !is_adjacent(u, v) || !m_adj_matrix.at(Edge(u, v));
+    return !is_adjacent(u, v) || m_adj_matrix.is_coalesceable(u, v);
   }
 
+  /*
+   * Whether combining u and v keeps the graph as colorable as it was. That
+   * holds if every significant neighbor of one node already interferes with
+   * the other, which doesn't tighten its constraints (George), or if the
+   * combined node has fewer significant neighbors than it has colors
+   * (Briggs). A node is significant if it isn't definitely_colorable().
+   */
+  bool can_coalesce_conservatively(reg_t u, reg_t v) const;
+
   bool has_containment_edge(reg_t u, reg_t v) const {
     return m_containment_graph.find(ContainmentEdge(u, v)) !=
            m_containment_graph.end();
@@ -245,9 +339,7 @@ class Graph {
   // from those without this constraint,
   bool m_separate_node{false};
   std::unordered_map<reg_t, Node> m_nodes;
-  using Edge = impl::OrderedPair<reg_t>;
-  std::unordered_map<Edge, bool /* not_coalesceable */, boost::hash<Edge>>
-      m_adj_matrix;
+  impl::AdjacencyMatrix m_adj_matrix;
   std::unordered_set<ContainmentEdge, boost::hash<ContainmentEdge>>
       m_containment_graph;
   // This map contains the LivenessDomains for all instructions which could
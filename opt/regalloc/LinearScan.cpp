@@ -0,0 +1,283 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "LinearScan.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "ControlFlow.h"
+#include "Debug.h"
+#include "DexOpcode.h"
+#include "Interference.h"
+#include "Liveness.h"
+#include "RegisterType.h"
+#include "Trace.h"
+#include "VirtualRegistersFile.h"
+
+namespace regalloc {
+
+namespace linear_scan {
+
+namespace {
+
+// v0 and v1 hold a dest whose home doesn't fit its instruction, v2 to v7 the
+// srcs. All of them fit in the 4 bits of the narrowest encodings, including
+// the five words of a non-range invoke.
+constexpr reg_t DEST_SCRATCH = 0;
+constexpr reg_t SRCS_SCRATCH = 2;
+constexpr reg_t NUM_SCRATCH = 8;
+
+constexpr size_t NONE = std::numeric_limits<size_t>::max();
+
+struct RegInfo {
+  // The first and last instruction where the register is live, in the order
+  // in which the blocks are laid out.
+  size_t start{NONE};
+  size_t end{0};
+  uint8_t width{1};
+  bool is_param{false};
+  RegisterTypeDomain type{RegisterType::UNKNOWN};
+  reg_t home{0};
+
+  void cover(size_t pos) {
+    start = start == NONE ? pos : std::min(start, pos);
+    end = std::max(end, pos);
+  }
+};
+
+size_t src_words(const IRInstruction* insn) {
+  size_t words = 0;
+  for (size_t i = 0; i < insn->srcs_size(); ++i) {
+    words += insn->src_is_wide(i) ? 2 : 1;
+  }
+  return words;
+}
+
+bool needs_range(const IRInstruction* insn) {
+  auto op = insn->opcode();
+  return (is_invoke(op) || op == OPCODE_FILLED_NEW_ARRAY) &&
+         src_words(insn) > dex_opcode::NON_RANGE_MAX;
+}
+
+reg_t max_src_vreg(const IRInstruction* insn, size_t i) {
+  auto op = insn->opcode();
+  // An `invoke {v0}` opcode can always be rewritten as `invoke/range {v0}`
+  if (opcode::has_range_form(op) && insn->srcs_size() == 1) {
+    return max_unsigned_value(16);
+  }
+  auto max_vreg = max_unsigned_value(interference::src_bit_width(op, i));
+  // Denormalizing a wide invoke operand also uses the register after it.
+  if (is_invoke(op) && insn->src_is_wide(i)) {
+    --max_vreg;
+  }
+  return max_vreg;
+}
+
+/*
+ * Finds out the width and type of every register and the interval over which
+ * it is live.
+ */
+std::vector<RegInfo> analyze(IRCode* code) {
+  std::vector<RegInfo> infos(code->get_registers_size());
+  for (auto& mie : InstructionIterable(code->get_param_instructions())) {
+    infos.at(mie.insn->dest()).is_param = true;
+  }
+
+  auto& cfg = code->cfg();
+  cfg.calculate_exit_block();
+  LivenessFixpointIterator fixpoint_iter(cfg);
+  fixpoint_iter.run(LivenessDomain(code->get_registers_size()));
+
+  size_t pos = 0;
+  for (Block* block : cfg.blocks()) {
+    auto first = pos;
+    for (auto& mie : InstructionIterable(block)) {
+      auto insn = mie.insn;
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        auto& info = infos.at(insn->src(i));
+        info.cover(pos);
+        info.type.meet_with(RegisterTypeDomain(src_reg_type(insn, i)));
+        if (insn->src_is_wide(i)) {
+          info.width = 2;
+        }
+      }
+      if (insn->dests_size()) {
+        auto& info = infos.at(insn->dest());
+        info.cover(pos);
+        info.type.meet_with(RegisterTypeDomain(dest_reg_type(insn)));
+        if (insn->dest_is_wide()) {
+          info.width = 2;
+        }
+      }
+      ++pos;
+    }
+    if (pos == first) {
+      continue;
+    }
+    // A register that is live anywhere in the block is either defined or used
+    // in it, or live at its start or end.
+    auto live_in = fixpoint_iter.get_live_in_vars_at(block);
+    if (live_in.is_value()) {
+      for (auto reg : live_in.elements()) {
+        infos.at(reg).cover(first);
+      }
+    }
+    auto live_out = fixpoint_iter.get_live_out_vars_at(block);
+    if (live_out.is_value()) {
+      for (auto reg : live_out.elements()) {
+        infos.at(reg).cover(pos - 1);
+      }
+    }
+  }
+  return infos;
+}
+
+/*
+ * Gives every register that isn't a parameter a home above the scratch
+ * registers, sharing them between registers whose intervals don't overlap.
+ * Returns the number of registers used.
+ */
+reg_t assign_homes(std::vector<RegInfo>* infos) {
+  std::vector<reg_t> regs;
+  for (size_t reg = 0; reg < infos->size(); ++reg) {
+    const auto& info = infos->at(reg);
+    if (info.start != NONE && !info.is_param) {
+      regs.push_back(reg);
+    }
+  }
+  std::sort(regs.begin(), regs.end(), [&](reg_t a, reg_t b) {
+    auto start_a = infos->at(a).start;
+    auto start_b = infos->at(b).start;
+    return start_a != start_b ? start_a < start_b : a < b;
+  });
+
+  VirtualRegistersFile vreg_file;
+  vreg_file.alloc_at(0, NUM_SCRATCH);
+  // The registers whose intervals contain the current point, by the end of
+  // their interval.
+  std::multimap<size_t, reg_t> active;
+  for (auto reg : regs) {
+    auto& info = infos->at(reg);
+    while (!active.empty() && active.begin()->first < info.start) {
+      const auto& expired = infos->at(active.begin()->second);
+      vreg_file.free(expired.home, expired.width);
+      active.erase(active.begin());
+    }
+    info.home = vreg_file.alloc(info.width);
+    active.emplace(info.end, reg);
+  }
+  return vreg_file.size();
+}
+
+bool has_contiguous_homes(const IRInstruction* insn,
+                          const std::vector<RegInfo>& infos) {
+  for (size_t i = 1; i < insn->srcs_size(); ++i) {
+    auto prev = insn->src(i - 1);
+    if (infos.at(insn->src(i)).home !=
+        infos.at(prev).home + (insn->src_is_wide(i - 1) ? 2 : 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+size_t allocate(IRCode* code) {
+  auto infos = analyze(code);
+  auto homes_size = assign_homes(&infos);
+
+  // The operands of range instructions are copied to a block of consecutive
+  // registers after the homes. Range instructions can address any register,
+  // so this leaves the low registers to the homes.
+  size_t range_size = 0;
+  for (auto& mie : InstructionIterable(code)) {
+    if (needs_range(mie.insn)) {
+      range_size = std::max(range_size, src_words(mie.insn));
+    }
+  }
+  reg_t range_base = homes_size;
+
+  // The parameters go at the end of the frame, in order.
+  size_t frame_size = homes_size + range_size;
+  for (auto& mie : InstructionIterable(code->get_param_instructions())) {
+    auto& info = infos.at(mie.insn->dest());
+    info.home = frame_size;
+    frame_size += info.width;
+  }
+  always_assert_log(frame_size <= max_unsigned_value(16),
+                    "Frame of %lu registers is too large",
+                    frame_size);
+
+  auto move_type = [&](reg_t reg) { return infos.at(reg).type.element(); };
+
+  std::vector<FatMethod::iterator> insns;
+  for (auto it = code->begin(); it != code->end(); ++it) {
+    if (it->type == MFLOW_OPCODE) {
+      insns.push_back(it);
+    }
+  }
+  size_t moves = 0;
+  for (auto it : insns) {
+    auto insn = it->insn;
+    if (needs_range(insn) && !has_contiguous_homes(insn, infos)) {
+      reg_t next = range_base;
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        auto src = insn->src(i);
+        code->insert_before(
+            it, gen_move(move_type(src), next, infos.at(src).home));
+        ++moves;
+        insn->set_src(i, next);
+        next += insn->src_is_wide(i) ? 2 : 1;
+      }
+    } else {
+      reg_t next_scratch = SRCS_SCRATCH;
+      for (size_t i = 0; i < insn->srcs_size(); ++i) {
+        auto src = insn->src(i);
+        auto home = infos.at(src).home;
+        if (needs_range(insn) || home <= max_src_vreg(insn, i)) {
+          insn->set_src(i, home);
+          continue;
+        }
+        code->insert_before(it, gen_move(move_type(src), next_scratch, home));
+        ++moves;
+        insn->set_src(i, next_scratch);
+        next_scratch += insn->src_is_wide(i) ? 2 : 1;
+      }
+      always_assert(next_scratch <= NUM_SCRATCH);
+    }
+
+    if (insn->dests_size()) {
+      auto dest = insn->dest();
+      auto home = infos.at(dest).home;
+      if (home <= max_unsigned_value(interference::dest_bit_width(it))) {
+        insn->set_dest(home);
+      } else {
+        insn->set_dest(DEST_SCRATCH);
+        code->insert_after(it, gen_move(move_type(dest), home, DEST_SCRATCH));
+        ++moves;
+      }
+    }
+  }
+  code->set_registers_size(frame_size);
+  TRACE(REG,
+        3,
+        "Linear scan: %u homes, %lu range registers, %lu moves\n",
+        homes_size,
+        range_size,
+        moves);
+  return moves;
+}
+
+} // namespace linear_scan
+
+} // namespace regalloc
@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "IRCode.h"
+
+namespace regalloc {
+
+namespace linear_scan {
+
+/*
+ * A fast register allocator for the methods that the graph coloring allocator
+ * gives up on. It runs in a single pass and never needs to iterate, at the
+ * cost of more moves.
+ *
+ * Every register gets a home register using linear scan [Poletto99] over
+ * intervals that cover all the points where the register is live. Operands
+ * whose home doesn't fit the encoding of their instruction go through a few
+ * low scratch registers instead, with moves from or to their home around the
+ * instruction. Range instructions get their operands moved into a block of
+ * consecutive registers. Parameters stay at the end of the frame.
+ *
+ * The code must have a CFG. Returns the number of moves inserted.
+ *
+ *  [Poletto99] M. Poletto and V. Sarkar. Linear Scan Register Allocation.
+ *    ACM TOPLAS, 21(5):895-913, 1999.
+ */
+size_t allocate(IRCode*);
+
+} // namespace linear_scan
+
+} // namespace regalloc
@@ -9,14 +9,16 @@
 
 #pragma once
 
+#include <unordered_map>
+
+#include "BitVectorAbstractDomain.h"
 #include "ControlFlow.h"
 #include "FixpointIterators.h"
-#include "SparseSetAbstractDomain.h"
 
 namespace regalloc {
 
 using namespace std::placeholders;
-using LivenessDomain = SparseSetAbstractDomain;
+using LivenessDomain = BitVectorAbstractDomain;
 
 class LivenessFixpointIterator final
     : public MonotonicFixpointIterator<
@@ -26,15 +28,40 @@ class LivenessFixpointIterator final
   using NodeId = Block*;
 
   LivenessFixpointIterator(const ControlFlowGraph& cfg)
-      : MonotonicFixpointIterator(cfg, cfg.blocks().size()) {}
+      : MonotonicFixpointIterator(cfg, cfg.blocks().size()), m_cfg(cfg) {}
+
+  /*
+   * Summarizes each block as the registers it reads before writing them (gen)
+   * and the registers it writes (kill), so that the iterations only apply
+   * live_in = gen | (live_out - kill) instead of walking the instructions.
+   * The summaries are recomputed on each run since the code may have changed
+   * in between.
+   */
+  void run(const LivenessDomain& init) {
+    m_block_summaries.clear();
+    for (auto block : m_cfg.blocks()) {
+      auto& summary =
+          m_block_summaries.emplace(block, BlockSummary(init)).first->second;
+      for (auto it = block->rbegin(); it != block->rend(); ++it) {
+        if (it->type == MFLOW_OPCODE) {
+          analyze_instruction(it->insn, &summary.gen);
+          if (it->insn->dests_size()) {
+            summary.kill.add(it->insn->dest());
+          }
+        }
+      }
+    }
+    MonotonicFixpointIterator::run(init);
+  }
 
   void analyze_node(const NodeId& block,
                     LivenessDomain* current_state) const override {
-    for (auto it = block->rbegin(); it != block->rend(); ++it) {
-      if (it->type == MFLOW_OPCODE) {
-        analyze_instruction(it->insn, current_state);
-      }
+    if (!current_state->is_value()) {
+      return;
     }
+    const auto& summary = m_block_summaries.at(block);
+    current_state->difference_with(summary.kill);
+    current_state->join_with(summary.gen);
   }
 
   LivenessDomain analyze_edge(
@@ -60,6 +87,21 @@ class LivenessFixpointIterator final
   LivenessDomain get_live_out_vars_at(const NodeId& block) const {
     return get_entry_state_at(block);
   }
+
+ private:
+  struct BlockSummary {
+    // Empty sets with the same capacity as init.
+    explicit BlockSummary(const LivenessDomain& init) : gen(init), kill(init) {
+      gen.difference_with(init);
+      kill.difference_with(init);
+    }
+
+    LivenessDomain gen;
+    LivenessDomain kill;
+  };
+
+  const ControlFlowGraph& m_cfg;
+  std::unordered_map<Block*, BlockSummary> m_block_summaries;
 };
 
 } // namespace regalloc
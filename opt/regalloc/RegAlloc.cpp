@@ -14,66 +14,61 @@
 #include "Dataflow.h"
 #include "DexUtil.h"
 #include "GraphColoring.h"
+#include "IncrementalCache.h"
 #include "IRCode.h"
 #include "IRInstruction.h"
 #include "LiveRange.h"
+#include "ScopeView.h"
 #include "Transform.h"
 #include "Walkers.h"
 
 using namespace regalloc;
 
-void RegAllocPass::run_pass(DexStoresVector& stores,
+void RegAllocPass::run_pass(DexStoresVector&,
                             ConfigFiles&,
                             PassManager& mgr) {
-  using Data = std::nullptr_t;
   using Output = graph_coloring::Allocator::Stats;
-  auto scope = build_class_scope(stores);
-  auto stats = walk::parallel::reduce_methods<Data, Output>(
-      scope,
-      [this](Data&, DexMethod* m) { // mapper
-        graph_coloring::Allocator::Stats stats;
-        if (m->get_code() == nullptr) {
-          return stats;
-        }
-        auto& code = *m->get_code();
+  auto scope = mgr.get_scope_view().get();
+  auto cache = mgr.get_incremental_cache();
+  auto allocate = [this](DexMethod* m) {
+    graph_coloring::Allocator::Stats stats;
+    auto& code = *m->get_code();
 
-        TRACE(REG, 3, "Handling %s:\n", SHOW(m));
-        TRACE(REG,
-              5,
-              "regs:%d code:\n%s\n",
-              code.get_registers_size(),
-              SHOW(&code));
-        try {
-          // The transformations below all require a CFG. Build it once
-          // here instead of requiring each transform to build it.
-          code.build_cfg();
-          // It doesn't make sense to try to allocate registers in
-          // unreachable code. Remove it so that the allocator doesn't
-          // get confused.
-          transform::remove_unreachable_blocks(&code);
-          live_range::renumber_registers(&code);
-          graph_coloring::Allocator allocator(m_allocator_config);
-          allocator.allocate(&code);
-          stats.accumulate(allocator.get_stats());
+    TRACE(REG, 3, "Handling %s:\n", SHOW(m));
+    TRACE(REG,
+          5,
+          "regs:%d code:\n%s\n",
+          code.get_registers_size(),
+          SHOW(&code));
+    try {
+      // The transformations below all require a CFG. Build it once
+      // here instead of requiring each transform to build it.
+      code.build_cfg();
+      // It doesn't make sense to try to allocate registers in
+      // unreachable code. Remove it so that the allocator doesn't
+      // get confused.
+      transform::remove_unreachable_blocks(&code);
+      live_range::renumber_registers(&code);
+      graph_coloring::Allocator allocator(m_allocator_config);
+      allocator.allocate(&code);
+      stats.accumulate(allocator.get_stats());
 
-          TRACE(REG,
-                5,
-                "After alloc: regs:%d code:\n%s\n",
-                code.get_registers_size(),
-                SHOW(&code));
-        } catch (std::exception&) {
-          fprintf(stderr, "Failed to allocate %s\n", SHOW(m));
-          fprintf(stderr, "%s\n", SHOW(code.cfg()));
-          throw;
-        }
-        return stats;
-      },
-      [](Output a, Output b) { // reducer
-        a.accumulate(b);
-        return a;
-      },
-      [&](unsigned int) { // data initializer
-        return nullptr;
+      TRACE(REG,
+            5,
+            "After alloc: regs:%d code:\n%s\n",
+            code.get_registers_size(),
+            SHOW(&code));
+    } catch (std::exception&) {
+      fprintf(stderr, "Failed to allocate %s\n", SHOW(m));
+      fprintf(stderr, "%s\n", SHOW(code.cfg()));
+      throw;
+    }
+    return stats;
+  };
+  auto stats = walk::parallel::reduce_code<Output>(
+      *scope, [&](Output& stats, DexMethod* m, IRCode&) {
+        stats += cache != nullptr ? cache->optimize<Output>(m, allocate)
+                                  : allocate(m);
       });
 
   TRACE(REG, 1, "Total reiteration count: %lu\n", stats.reiteration_count);
@@ -84,13 +79,27 @@ void RegAllocPass::run_pass(DexStoresVector& stores,
   TRACE(REG, 1, "  Total global spills: %lu\n", stats.global_spill_moves);
   TRACE(REG, 1, "  Total splits: %lu\n", stats.split_moves);
   TRACE(REG, 1, "Total coalesce count: %lu\n", stats.moves_coalesced);
+  TRACE(REG,
+        1,
+        "  Conservative: %lu (%lu rejected)\n",
+        stats.moves_coalesced_conservatively,
+        stats.coalesce_rejections);
   TRACE(REG, 1, "Total net moves: %ld\n", stats.net_moves());
+  TRACE(REG,
+        1,
+        "Linear scan fallbacks: %lu (%lu moves)\n",
+        stats.linear_scan_fallbacks,
+        stats.linear_scan_moves);
 
   mgr.incr_metric("param spilled too early", stats.params_spill_early);
   mgr.incr_metric("reiteration_count", stats.reiteration_count);
   mgr.incr_metric("spill_count", stats.moves_inserted());
   mgr.incr_metric("coalesce_count", stats.moves_coalesced);
+  mgr.incr_metric("conservative_coalesce_count",
+                  stats.moves_coalesced_conservatively);
+  mgr.incr_metric("coalesce_rejections", stats.coalesce_rejections);
   mgr.incr_metric("net_moves", stats.net_moves());
+  mgr.incr_metric("linear_scan_fallbacks", stats.linear_scan_fallbacks);
 
   mgr.record_running_regalloc();
 }
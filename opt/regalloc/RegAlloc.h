@@ -20,9 +20,16 @@ class RegAllocPass : public Pass {
   virtual void configure_pass(const PassConfig& pc) override {
     pc.get("live_range_splitting", false, m_allocator_config.use_splitting);
     pc.get("use_spill_costs", false, m_allocator_config.use_spill_costs);
+    pc.get("max_reiterations", 0, m_allocator_config.max_reiterations);
+    pc.get(
+        "iterated_coalescing", false, m_allocator_config.iterated_coalescing);
   }
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual bool is_method_local() const override { return true; }
+
  private:
   regalloc::graph_coloring::Allocator::Config m_allocator_config;
 };
@@ -18,6 +18,7 @@
 #include "RemoveBuildersHelper.h"
 #include "Resolver.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -208,21 +209,34 @@ std::vector<DexType*> RemoveBuildersPass::created_builders(DexMethod* m) {
   return builders;
 }
 
-// checks if any instances of :builder that get created in the method ever get
-// passed to a method (aside from when its own instance methods get invoked),
-// or if they get stored in a field, or if they escape as a return value.
-bool RemoveBuildersPass::escapes_stack(DexType* builder, DexMethod* method) {
-  always_assert(builder != nullptr);
+// returns the builders among `builders` for which some instance created in
+// the method ever gets passed to a method (aside from when its own instance
+// methods get invoked), or gets stored in a field, or escapes as a return
+// value. The CFG is built once for all of them, and each builder type is
+// analyzed once, however many instances of it the method creates.
+std::unordered_set<DexType*> RemoveBuildersPass::escaping_builders(
+    DexMethod* method, const std::vector<DexType*>& builders) {
   always_assert(method != nullptr);
 
+  std::unordered_set<DexType*> escaping;
   auto code = method->get_code();
   code->build_cfg();
   auto blocks = postorder_sort(code->cfg().blocks());
   std::reverse(blocks.begin(), blocks.end());
-  auto regs_size = method->get_code()->get_registers_size();
-  auto taint_map = get_tainted_regs(regs_size, blocks, builder);
-  return tainted_reg_escapes(
-      builder, method, *taint_map, m_enable_buildee_constr_change);
+  auto regs_size = code->get_registers_size();
+  std::unordered_set<DexType*> analyzed;
+  for (DexType* builder : builders) {
+    always_assert(builder != nullptr);
+    if (!analyzed.insert(builder).second) {
+      continue;
+    }
+    auto taint_map = get_tainted_regs(regs_size, blocks, builder);
+    if (tainted_reg_escapes(
+            builder, method, *taint_map, m_enable_buildee_constr_change)) {
+      escaping.insert(builder);
+    }
+  }
+  return escaping;
 }
 
 void RemoveBuildersPass::run_pass(DexStoresVector& stores,
@@ -249,21 +263,38 @@ void RemoveBuildersPass::run_pass(DexStoresVector& stores,
     }
   }
 
-  std::unordered_set<DexType*> escaped_builders;
+  // The methods that create builders, along with the builders they create,
+  // in scope order. Only those have anything to analyze or transform.
+  std::vector<std::pair<DexMethod*, std::vector<DexType*>>> creators;
   walk::methods(scope, [&](DexMethod* m) {
     auto builders = created_builders(m);
-    for (DexType* builder : builders) {
-      if (escapes_stack(builder, m)) {
-        TRACE(BUILDERS,
-              3,
-              "%s escapes in %s\n",
-              SHOW(builder),
-              m->get_deobfuscated_name().c_str());
-        escaped_builders.emplace(builder);
-      }
+    if (!builders.empty()) {
+      creators.emplace_back(m, std::move(builders));
     }
   });
 
+  // Each method has its own dataflow, so analyze them in parallel.
+  std::vector<std::unordered_set<DexType*>> escaping(creators.size());
+  auto escape_wq = workqueue_foreach<size_t>([&](size_t i) {
+    escaping[i] = escaping_builders(creators[i].first, creators[i].second);
+  });
+  for (size_t i = 0; i < creators.size(); ++i) {
+    escape_wq.add_item(i, creators[i].first->get_code()->count_opcodes());
+  }
+  escape_wq.run_all();
+
+  std::unordered_set<DexType*> escaped_builders;
+  for (size_t i = 0; i < creators.size(); ++i) {
+    for (DexType* builder : escaping[i]) {
+      TRACE(BUILDERS,
+            3,
+            "%s escapes in %s\n",
+            SHOW(builder),
+            creators[i].first->get_deobfuscated_name().c_str());
+      escaped_builders.emplace(builder);
+    }
+  }
+
   std::unordered_set<DexType*> stack_only_builders;
   for (DexType* builder : m_builders) {
     if (escaped_builders.find(builder) == escaped_builders.end()) {
@@ -280,12 +311,22 @@ void RemoveBuildersPass::run_pass(DexStoresVector& stores,
     }
   }
 
+  std::vector<DexType*> hierarchy_types(builders_and_supers.begin(),
+                                        builders_and_supers.end());
+  std::vector<char> type_escapes(hierarchy_types.size());
+  auto this_wq = workqueue_foreach<size_t>([&](size_t i) {
+    DexClass* cls = type_class(hierarchy_types[i]);
+    type_escapes[i] = cls->is_external() ||
+                      this_arg_escapes(cls, m_enable_buildee_constr_change);
+  });
+  for (size_t i = 0; i < hierarchy_types.size(); ++i) {
+    this_wq.add_item(i);
+  }
+  this_wq.run_all();
   std::unordered_set<DexType*> this_escapes;
-  for (DexType* cls_ty : builders_and_supers) {
-    DexClass* cls = type_class(cls_ty);
-    if (cls->is_external() ||
-        this_arg_escapes(cls, m_enable_buildee_constr_change)) {
-      this_escapes.emplace(cls_ty);
+  for (size_t i = 0; i < hierarchy_types.size(); ++i) {
+    if (type_escapes[i]) {
+      this_escapes.emplace(hierarchy_types[i]);
     }
   }
 
@@ -331,11 +372,12 @@ void RemoveBuildersPass::run_pass(DexStoresVector& stores,
   PassConfig pc(mgr.get_config());
   BuilderTransform b_transform(pc, scope, stores, false);
 
-  // Inline non init methods.
-  walk::methods(scope, [&](DexMethod* method) {
-    auto builders = created_builders(method);
-
-    for (DexType* builder : builders) {
+  // Inline non init methods. This stays serial: whether a builder is kept
+  // depends on the callers processed before, and inlining into one caller
+  // may create constructors on the buildee that others then reuse.
+  for (const auto& creator : creators) {
+    DexMethod* method = creator.first;
+    for (DexType* builder : creator.second) {
       if (method->get_class() == builder) {
         continue;
       }
@@ -370,7 +412,7 @@ void RemoveBuildersPass::run_pass(DexStoresVector& stores,
         DexMethod::erase_method(method_copy);
       }
     }
-  });
+  }
 
   // No need to remove the builders here, since `RemoveUnreachable` will
   // take care of it.
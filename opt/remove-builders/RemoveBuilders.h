@@ -26,5 +26,6 @@ class RemoveBuildersPass : public Pass {
   bool m_enable_buildee_constr_change;
 
   std::vector<DexType*> created_builders(DexMethod*);
-  bool escapes_stack(DexType*, DexMethod*);
+  std::unordered_set<DexType*> escaping_builders(
+      DexMethod*, const std::vector<DexType*>& builders);
 };
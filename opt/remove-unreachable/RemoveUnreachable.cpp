@@ -14,6 +14,7 @@
 #include "ReachableObjects.h"
 #include "Resolver.h"
 #include "Show.h"
+#include "WorkQueue.h"
 
 #include <string>
 
@@ -23,10 +24,38 @@
  */
 
 namespace {
-template <class Container, class Marked>
-void sweep_if_unmarked(Container& c, const std::unordered_set<Marked>& marked) {
-  auto p = [&](const Marked& m) {
-    if (marked.count(m) == 0) {
+
+struct deleted_stats {
+  size_t nclasses{0};
+  size_t nfields{0};
+  size_t nmethods{0};
+
+  deleted_stats& operator+=(const deleted_stats& that) {
+    nclasses += that.nclasses;
+    nfields += that.nfields;
+    nmethods += that.nmethods;
+    return *this;
+  }
+};
+
+// The sizes of the scope before and after the sweep.
+struct sweep_stats {
+  deleted_stats before;
+  deleted_stats after;
+};
+
+void count(const DexClass* cls, deleted_stats& stats) {
+  stats.nclasses++;
+  stats.nfields += cls->get_ifields().size();
+  stats.nfields += cls->get_sfields().size();
+  stats.nmethods += cls->get_dmethods().size();
+  stats.nmethods += cls->get_vmethods().size();
+}
+
+template <class Container>
+void sweep_if_unmarked(Container& c, const ReachableObjects& reachables) {
+  auto p = [&](typename Container::const_reference m) {
+    if (!reachables.marked(m)) {
       TRACE(RMU, 2, "Removing %s\n", SHOW(m));
       return true;
     }
@@ -35,36 +64,42 @@ void sweep_if_unmarked(Container& c, const std::unordered_set<Marked>& marked) {
   c.erase(std::remove_if(c.begin(), c.end(), p), c.end());
 }
 
-void sweep(DexStoresVector& stores, ReachableObjects& reachables) {
+/*
+ * Classes are swept one by one on the thread pool, since each only touches
+ * its own members. The scope is counted along the way.
+ */
+sweep_stats sweep(DexStoresVector& stores, ReachableObjects& reachables) {
+  auto wq = workqueue_mapreduce<DexClass*, sweep_stats>(
+      [&](DexClass* cls) {
+        sweep_stats stats;
+        count(cls, stats.before);
+        if (reachables.marked(cls)) {
+          sweep_if_unmarked(cls->get_ifields(), reachables);
+          sweep_if_unmarked(cls->get_sfields(), reachables);
+          sweep_if_unmarked(cls->get_dmethods(), reachables);
+          sweep_if_unmarked(cls->get_vmethods(), reachables);
+          count(cls, stats.after);
+        }
+        return stats;
+      },
+      [](sweep_stats a, sweep_stats b) {
+        a.before += b.before;
+        a.after += b.after;
+        return a;
+      });
   for (auto& dex : DexStoreClassesIterator(stores)) {
-    sweep_if_unmarked(dex, reachables.marked_classes);
-    for (auto const& cls : dex) {
-      sweep_if_unmarked(cls->get_ifields(), reachables.marked_fields);
-      sweep_if_unmarked(cls->get_sfields(), reachables.marked_fields);
-      sweep_if_unmarked(cls->get_dmethods(), reachables.marked_methods);
-      sweep_if_unmarked(cls->get_vmethods(), reachables.marked_methods);
+    for (auto cls : dex) {
+      wq.add_item(cls);
     }
   }
+  auto stats = wq.run_all();
+  for (auto& dex : DexStoreClassesIterator(stores)) {
+    sweep_if_unmarked(dex, reachables);
+  }
+  return stats;
 }
-} // namespace
-
-struct deleted_stats {
-  size_t nclasses{0};
-  size_t nfields{0};
-  size_t nmethods{0};
-};
 
-deleted_stats trace_stats(const char* label, DexStoresVector& stores) {
-  deleted_stats stats;
-  for (auto const& dex : DexStoreClassesIterator(stores)) {
-    stats.nclasses += dex.size();
-    for (auto const& cls : dex) {
-      stats.nfields += cls->get_ifields().size();
-      stats.nfields += cls->get_sfields().size();
-      stats.nmethods += cls->get_dmethods().size();
-      stats.nmethods += cls->get_vmethods().size();
-    }
-  }
+void trace_stats(const char* label, const deleted_stats& stats) {
   TRACE(RMU,
         1,
         "%s: %lu classes, %lu fields, %lu methods\n",
@@ -72,9 +107,10 @@ deleted_stats trace_stats(const char* label, DexStoresVector& stores) {
         stats.nclasses,
         stats.nfields,
         stats.nmethods);
-  return stats;
 }
 
+} // namespace
+
 void RemoveUnreachablePass::run_pass(DexStoresVector& stores,
                                      ConfigFiles& /*cfg*/,
                                      PassManager& pm) {
@@ -104,13 +140,15 @@ void RemoveUnreachablePass::run_pass(DexStoresVector& stores,
                                 load_annos(m_ignore_string_literal_annos),
                                 load_annos(m_ignore_system_annos),
                                 &num_ignore_check_strings);
-  deleted_stats before = trace_stats("before", stores);
-  sweep(stores, reachables);
-  deleted_stats after = trace_stats("after", stores);
+  auto stats = sweep(stores, reachables);
+  trace_stats("before", stats.before);
+  trace_stats("after", stats.after);
   pm.incr_metric("num_ignore_check_strings", num_ignore_check_strings);
-  pm.incr_metric("classes_removed", before.nclasses - after.nclasses);
-  pm.incr_metric("fields_removed", before.nfields - after.nfields);
-  pm.incr_metric("methods_removed", before.nmethods - after.nmethods);
+  pm.incr_metric("classes_removed",
+                 stats.before.nclasses - stats.after.nclasses);
+  pm.incr_metric("fields_removed", stats.before.nfields - stats.after.nfields);
+  pm.incr_metric("methods_removed",
+                 stats.before.nmethods - stats.after.nmethods);
 }
 
 static RemoveUnreachablePass s_pass;
@@ -7,10 +7,13 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <array>
 #include <stdio.h>
 #include <unordered_set>
 
 #include "Walkers.h"
+#include "WorkQueue.h"
+#include "DexIdMap.h"
 #include "ReachableClasses.h"
 #include "RemoveEmptyClasses.h"
 #include "DexClass.h"
@@ -19,8 +22,24 @@
 constexpr const char* METRIC_REMOVED_EMPTY_CLASSES =
   "num_empty_classes_removed";
 
+namespace {
+
+/**
+ * The types that are referenced from somewhere, as a bitset over the dense
+ * type ids. Each thread gathers its own, and they are OR-ed together.
+ */
+struct TypeReferences {
+  TypeBitSet types;
+
+  TypeReferences& operator+=(const TypeReferences& that) {
+    types.union_with(that.types);
+    return *this;
+  }
+};
+
 bool is_empty_class(DexClass* cls,
-                    std::unordered_set<const DexType*>& class_references) {
+                    const TypeBitSet& class_references,
+                    size_t num_children) {
   bool empty_class = cls->get_dmethods().empty() &&
   cls->get_vmethods().empty() &&
   cls->get_sfields().empty() &&
@@ -33,19 +52,20 @@ bool is_empty_class(DexClass* cls,
   TRACE(EMPTY, 4, "   not interface: %d\n",
       !(access & DexAccessFlags::ACC_INTERFACE));
   TRACE(EMPTY, 4, "   references: %d\n",
-      class_references.count(cls->get_type()));
+      class_references.contains(cls->get_type()));
+  TRACE(EMPTY, 4, "   subclasses: %ld\n", num_children);
   bool remove =
          empty_class &&
          can_delete(cls) &&
          !(access & DexAccessFlags::ACC_INTERFACE) &&
-         class_references.count(cls->get_type()) == 0;
+         !class_references.contains(cls->get_type()) &&
+         num_children == 0;
   TRACE(EMPTY, 4, "   remove: %d\n", remove);
   return remove;
 }
 
-void process_annotation(
-    std::unordered_set<const DexType*>* class_references,
-    DexAnnotation* annotation) {
+void process_annotation(TypeBitSet* class_references,
+                        DexAnnotation* annotation) {
   std::vector<DexType*> ltype;
   annotation->gather_types(ltype);
   for (DexType* dextype : ltype) {
@@ -62,8 +82,7 @@ DexType* array_base_type(DexType* type) {
   return type;
 }
 
-void process_proto(std::unordered_set<const DexType*>* class_references,
-                   DexMethodRef* meth) {
+void process_proto(TypeBitSet* class_references, DexMethodRef* meth) {
   // Types referenced in protos.
   auto const& proto = meth->get_proto();
   class_references->insert(array_base_type(proto->get_rtype()));
@@ -72,12 +91,12 @@ void process_proto(std::unordered_set<const DexType*>* class_references,
   }
 }
 
-void process_code(std::unordered_set<const DexType*>* class_references,
+void process_code(TypeBitSet* class_references,
                   DexMethod* meth,
                   IRCode& code) {
   process_proto(class_references, meth);
   // Types referenced in code.
-  for (auto const& mie : InstructionIterable(meth->get_code())) {
+  for (auto const& mie : InstructionIterable(&code)) {
     auto opcode = mie.insn;
     if (opcode->has_type()) {
       auto typ = array_base_type(opcode->get_type());
@@ -103,31 +122,89 @@ void process_code(std::unordered_set<const DexType*>* class_references,
   }
 }
 
-size_t remove_empty_classes(Scope& classes) {
+/**
+ * The types referenced by the annotations of the classes and their members,
+ * gathered in parallel into a bitset per thread.
+ */
+TypeReferences annotation_references(const Scope& classes) {
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<TypeReferences> refs(num_threads);
+  auto wq = WorkQueue<DexClass*, TypeReferences*, std::nullptr_t>(
+      [](TypeReferences*& thread_refs, DexClass* cls) -> std::nullptr_t {
+        std::array<DexClass*, 1> one_class{{cls}};
+        walk::annotations(one_class, [&](DexAnnotation* annotation) {
+          process_annotation(&thread_refs->types, annotation);
+        });
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &refs[thread_idx]; },
+      num_threads);
+  for (auto cls : classes) {
+    wq.add_item(cls);
+  }
+  wq.run_all();
+  for (size_t i = 1; i < refs.size(); ++i) {
+    refs[0] += refs[i];
+  }
+  return std::move(refs[0]);
+}
 
-  // class_references is a set of type names which represent classes
-  // which should not be deleted even if they are deemed to be empty.
-  std::unordered_set<const DexType*> class_references;
+}
 
-  walk::annotations(classes, [&](DexAnnotation* annotation)
-    { process_annotation(&class_references, annotation); });
+size_t remove_empty_classes(Scope& classes) {
 
-  walk::code(classes,
-            [](DexMethod*) { return true; },
-            [&](DexMethod* meth, IRCode& code)
-               { process_code(&class_references, meth, code); });
+  // class_references is the set of the types which represent classes
+  // which should not be deleted even if they are deemed to be empty.
+  auto class_references =
+      walk::parallel::reduce_code<TypeReferences>(
+          classes,
+          [](TypeReferences& refs, DexMethod* meth, IRCode& code) {
+            process_code(&refs.types, meth, code);
+          })
+          .types;
+  class_references.union_with(annotation_references(classes).types);
 
   size_t classes_before_size = classes.size();
 
-  // Ennumerate super classes.
+  // Super classes are kept for as long as they have subclasses, which are
+  // counted rather than referenced, so that removing the last subclass of an
+  // empty class makes it removable too.
+  TypeIdMap<size_t> num_children;
   for (auto& cls : classes) {
-    DexType* s = cls->get_super_class();
-    class_references.insert(s);
+    num_children[cls->get_super_class()]++;
   }
 
   TRACE(EMPTY, 3, "About to erase classes.\n");
+  // Only the super classes of the removed classes can become empty, so they
+  // are the only ones checked again.
+  std::unordered_set<const DexClass*> removed;
+  std::vector<DexClass*> worklist;
+  for (auto cls : classes) {
+    auto children = num_children.at(cls->get_type());
+    if (is_empty_class(cls, class_references, children)) {
+      worklist.push_back(cls);
+    }
+  }
+  while (!worklist.empty()) {
+    auto cls = worklist.back();
+    worklist.pop_back();
+    if (!removed.insert(cls).second) {
+      continue;
+    }
+    auto super_type = cls->get_super_class();
+    auto& super_children = num_children[super_type];
+    if (--super_children != 0) {
+      continue;
+    }
+    auto super_cls = type_class(super_type);
+    if (super_cls != nullptr && !super_cls->is_external() &&
+        is_empty_class(super_cls, class_references, 0)) {
+      worklist.push_back(super_cls);
+    }
+  }
   classes.erase(remove_if(classes.begin(), classes.end(),
-    [&](DexClass* cls) { return is_empty_class(cls, class_references); }),
+    [&](DexClass* cls) { return removed.count(cls) != 0; }),
     classes.end());
 
   auto num_classes_removed = classes_before_size - classes.size();
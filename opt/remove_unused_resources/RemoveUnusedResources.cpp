@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "RemoveUnusedResources.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "RedexResources.h"
+#include "Resolver.h"
+#include "ResourceIndex.h"
+#include "ResourceShrinker.h"
+#include "Trace.h"
+#include "Walkers.h"
+
+namespace {
+
+// What the code refers to.
+struct CodeReferences {
+  std::unordered_set<uint32_t> ids;
+  // Only gathered when the code looks resources up by name.
+  std::unordered_set<std::string> strings;
+  bool calls_get_identifier{false};
+};
+
+CodeReferences find_code_references(const Scope& scope,
+                                    const ResourceIndex& index) {
+  CodeReferences refs;
+  auto add = [&](int64_t value) {
+    if (value >= 0 && value <= 0xffffffff &&
+        index.contains(static_cast<uint32_t>(value))) {
+      refs.ids.insert(static_cast<uint32_t>(value));
+    }
+  };
+  std::unordered_set<DexField*> read_fields;
+  walk::code(scope, [&](DexMethod*, IRCode& code) {
+    for (const auto& mie : InstructionIterable(code)) {
+      auto insn = mie.insn;
+      auto op = insn->opcode();
+      if (is_literal_const(op)) {
+        add(insn->get_literal());
+      } else if (op == OPCODE_CONST_STRING) {
+        refs.strings.insert(insn->get_string()->str());
+      } else if (is_sget(op)) {
+        auto field = resolve_field(insn->get_field(), FieldSearch::Static);
+        if (field != nullptr) {
+          read_fields.insert(field);
+        }
+      } else if (op == OPCODE_FILL_ARRAY_DATA) {
+        // The element width, then the 32-bit count, then the elements.
+        auto data = insn->get_data()->data();
+        if (data[0] != 4) {
+          continue;
+        }
+        uint32_t count = data[1] | (uint32_t(data[2]) << 16);
+        for (uint32_t i = 0; i < count; ++i) {
+          add(data[3 + 2 * i] | (uint32_t(data[4 + 2 * i]) << 16));
+        }
+      } else if (is_invoke(op) &&
+                 insn->get_method()->get_name()->str_ref() == "getIdentifier") {
+        refs.calls_get_identifier = true;
+      }
+    }
+  });
+  // The fields that weren't inlined, like the ones of the library projects.
+  for (auto field : read_fields) {
+    auto value = field->get_static_value();
+    if (value != nullptr && value->evtype() == DEVT_INT) {
+      add(static_cast<int32_t>(value->value()));
+    }
+  }
+  if (!refs.calls_get_identifier) {
+    refs.strings.clear();
+  }
+  return refs;
+}
+
+// Adds `roots`, and everything that they or the XML files among their
+// strings refer to, to `kept`.
+void close_over(const ResourceIndex& index,
+                const std::string& apk_dir,
+                std::unordered_set<uint32_t> roots,
+                std::unordered_set<uint32_t>& kept) {
+  std::unordered_set<std::string> scanned;
+  while (!roots.empty()) {
+    std::unordered_set<std::string> strings;
+    for (auto id : roots) {
+      index.walk_references(id, kept, strings);
+    }
+    std::vector<std::string> files;
+    for (const auto& value : strings) {
+      if (boost::starts_with(value, "res/") &&
+          boost::ends_with(value, ".xml") && scanned.insert(value).second) {
+        files.push_back(apk_dir + "/" + value);
+      }
+    }
+    roots.clear();
+    for (auto id : scan_xml_files(files).reference_attributes) {
+      if (index.contains(id) && kept.count(id) == 0) {
+        roots.insert(id);
+      }
+    }
+  }
+}
+
+} // namespace
+
+void RemoveUnusedResourcesPass::run_pass(DexStoresVector& stores,
+                                         ConfigFiles&,
+                                         PassManager& mgr) {
+  if (m_apk_dir.empty()) {
+    TRACE(OPTRES, 1, "apk_dir not set, so not removing resources\n");
+    return;
+  }
+  auto arsc_path = m_apk_dir + "/resources.arsc";
+  if (!boost::filesystem::exists(arsc_path)) {
+    TRACE(OPTRES, 1, "No %s, so not removing resources\n", arsc_path.c_str());
+    return;
+  }
+
+  std::string shrunk;
+  resource_shrinker::Stats stats;
+  {
+    MappedFile arsc(arsc_path);
+    auto contents = arsc.contents();
+    android::ResTable table;
+    if (contents.empty() ||
+        table.add(contents.data(), contents.size()) != android::NO_ERROR) {
+      TRACE(OPTRES, 1, "Unable to read %s\n", arsc_path.c_str());
+      return;
+    }
+    auto index = ResourceIndex::build(table);
+
+    auto scope = build_class_scope(stores);
+    auto code_refs = find_code_references(scope, index);
+    std::unordered_set<uint32_t> roots = std::move(code_refs.ids);
+    auto name_to_ids = index.name_to_ids();
+    for (const auto& str : code_refs.strings) {
+      auto it = name_to_ids.find(str);
+      if (it != name_to_ids.end()) {
+        roots.insert(it->second.begin(), it->second.end());
+      }
+    }
+    for (auto id : scan_xml_files({m_apk_dir + "/AndroidManifest.xml"})
+                       .reference_attributes) {
+      roots.insert(id);
+    }
+    for (auto id : get_js_resources_by_parsing(m_apk_dir + "/assets",
+                                               name_to_ids)) {
+      roots.insert(id);
+    }
+    for (auto id : index.ids_by_name_prefix(m_keep_resource_prefixes)) {
+      roots.insert(id);
+    }
+    for (auto it = roots.begin(); it != roots.end();) {
+      it = index.contains(*it) ? std::next(it) : roots.erase(it);
+    }
+
+    std::unordered_set<uint32_t> kept;
+    close_over(index, m_apk_dir, std::move(roots), kept);
+    TRACE(OPTRES, 1, "Keeping %zu of %zu resources\n", kept.size(),
+          index.ids().size());
+    if (!resource_shrinker::shrink(
+            contents.data(), contents.size(), kept, &shrunk, &stats)) {
+      TRACE(OPTRES, 1, "Unable to shrink %s\n", arsc_path.c_str());
+      return;
+    }
+  }
+  write_entire_file(arsc_path, shrunk);
+
+  mgr.incr_metric("resources_removed", stats.resources_removed);
+  mgr.incr_metric("key_strings_removed", stats.key_strings_removed);
+  mgr.incr_metric("value_strings_removed", stats.value_strings_removed);
+  TRACE(OPTRES, 1, "Removed %zu resources, %zu key and %zu value strings\n",
+        stats.resources_removed, stats.key_strings_removed,
+        stats.value_strings_removed);
+}
+
+static RemoveUnusedResourcesPass s_pass;
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include "Pass.h"
+
+/*
+ * Removes the resources that nothing refers to from resources.arsc, along
+ * with the key and value strings that only they used (see
+ * ResourceShrinker.h).
+ *
+ * A resource is kept when the code refers to its id, which after
+ * FinalInlinePass is mostly a const literal, when the manifest, the JS
+ * bundles or the XML files of the resources that are kept refer to it, or
+ * when its name starts with one of keep_resource_prefixes. If the code calls
+ * Resources.getIdentifier(), the resources whose names are in its const
+ * strings are kept as well. Run it after FinalInlinePass.
+ */
+class RemoveUnusedResourcesPass : public Pass {
+ public:
+  RemoveUnusedResourcesPass() : Pass("RemoveUnusedResourcesPass") {}
+
+  virtual void configure_pass(const PassConfig& pc) override {
+    pc.get("apk_dir", "", m_apk_dir);
+    pc.get("keep_resource_prefixes", {}, m_keep_resource_prefixes);
+  }
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual unsigned reads() const override {
+    return TOUCHES_CODE | TOUCHES_RESOURCES;
+  }
+  virtual unsigned writes() const override { return TOUCHES_RESOURCES; }
+
+ private:
+  std::string m_apk_dir;
+  std::vector<std::string> m_keep_resource_prefixes;
+};
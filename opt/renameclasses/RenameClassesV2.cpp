@@ -10,6 +10,7 @@
 #include "RenameClassesV2.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <string>
 #include <vector>
@@ -23,6 +24,7 @@
 #include "RedexResources.h"
 #include "Walkers.h"
 #include "Warning.h"
+#include "WorkQueue.h"
 
 #define MAX_DESCRIPTOR_LENGTH (1024)
 #define MAX_IDENT_CHAR (62)
@@ -203,9 +205,10 @@ RenameClassesPassV2::build_dont_rename_resources(
     }
 
     // Classnames present in native libraries (lib/*/*.so)
-    for (std::string classname : get_native_classes(m_apk_dir)) {
-      auto type = DexType::get_type(classname.c_str());
-      if (type == nullptr) continue;
+    auto is_known_type = [](const char* name) {
+      return DexType::get_type(name) != nullptr;
+    };
+    for (std::string classname : get_native_classes(m_apk_dir, is_known_type)) {
       TRACE(RENAME, 4, "native_lib: %s\n", classname.c_str());
       dont_rename_resources.insert(classname);
     }
@@ -221,7 +224,9 @@ RenameClassesPassV2::build_dont_rename_class_name_literals(Scope& scope) {
   auto match = std::make_tuple(
     m::const_string(/* const-string {vX}, <any string> */)
   );
-  walk::matching_opcodes(scope, match,
+  // The aliases are complete by now, and only read by the workers.
+  std::atomic<size_t> rewritten_const_strings{0};
+  walk::parallel::matching_opcodes(scope, match,
       [&](const DexMethod*, const std::vector<IRInstruction*>& insns){
         IRInstruction* const_string = insns[0];
         auto classname = JavaNameUtil::external_to_internal(
@@ -480,23 +485,22 @@ RenameClassesPassV2::build_dont_rename_annotated() {
 
 class AliasMap {
   std::map<DexString*, DexString*, dexstrings_comparator> m_class_name_map;
-  std::map<DexString*, DexString*, dexstrings_comparator> m_extras_map;
+  // Every alias, including the ones of the class names. Strings are interned,
+  // so this is keyed by pointer and the lookups don't compare characters.
+  std::unordered_map<const DexString*, DexString*> m_all_aliases;
  public:
   void add_class_alias(DexClass* cls, DexString* alias) {
     m_class_name_map.emplace(cls->get_name(), alias);
+    m_all_aliases.emplace(cls->get_name(), alias);
   }
   void add_alias(DexString* original, DexString* alias) {
-    m_extras_map.emplace(original, alias);
+    m_all_aliases.emplace(original, alias);
   }
-  bool has(DexString* key) const {
-    return m_class_name_map.count(key) || m_extras_map.count(key);
+  bool has(const DexString* key) const {
+    return m_all_aliases.count(key);
   }
-  DexString* at(DexString* key) const {
-    auto it = m_class_name_map.find(key);
-    if (it != m_class_name_map.end()) {
-      return it->second;
-    }
-    return m_extras_map.at(key);
+  DexString* at(const DexString* key) const {
+    return m_all_aliases.at(key);
   }
   const std::map<DexString*, DexString*, dexstrings_comparator>& get_class_map()
       const {
@@ -812,7 +816,9 @@ void RenameClassesPassV2::rename_classes(
     m::const_string()
   );
 
-  walk::matching_opcodes(scope, match,
+  // The aliases are complete by now, and only read by the workers.
+  std::atomic<size_t> rewritten_const_strings{0};
+  walk::parallel::matching_opcodes(scope, match,
       [&](const DexMethod*, const std::vector<IRInstruction*>& insns){
         IRInstruction* insn = insns[0];
         DexString* str = insn->get_string();
@@ -842,13 +848,14 @@ void RenameClassesPassV2::rename_classes(
           DexType* alias_from_type = DexType::get_type(alias_from);
           DexClass* alias_from_cls = type_class(alias_from_type);
           if (m_force_rename_classes.count(alias_from_cls)) {
-            mgr.incr_metric(METRIC_REWRITTEN_CONST_STRINGS, 1);
+            ++rewritten_const_strings;
             insn->set_string(alias_to);
             TRACE(RENAME, 3, "Rewrote const-string \"%s\" to \"%s\"\n",
                 str->c_str(), alias_to->c_str());
           }
         }
       });
+  mgr.incr_metric(METRIC_REWRITTEN_CONST_STRINGS, rewritten_const_strings);
 
   /* Now we need to re-write the Signature annotations.  They use
    * Strings rather than Type's, so they have to be explicitly
@@ -879,7 +886,7 @@ void RenameClassesPassV2::rename_classes(
   }
   static DexType *dalviksig =
     DexType::get_type("Ldalvik/annotation/Signature;");
-  walk::annotations(scope, [&](DexAnnotation* anno) {
+  walk::parallel::annotations(scope, [&](DexAnnotation* anno) {
     if (anno->type() != dalviksig) return;
     auto elems = anno->anno_elems();
     for (auto elem : elems) {
@@ -918,23 +925,34 @@ void RenameClassesPassV2::rename_classes_in_layouts(
       JavaNameUtil::internal_to_external(apair.first->str()),
       JavaNameUtil::internal_to_external(apair.second->str()));
   }
-  ssize_t layout_bytes_delta = 0;
-  size_t num_layout_renamed = 0;
+  // Each layout file is rewritten on its own.
+  using Renamed = std::pair<size_t, ssize_t>;
+  auto wq = workqueue_mapreduce<const std::string*, Renamed>(
+      [&](const std::string* path) {
+        size_t num_renamed = 0;
+        ssize_t out_delta = 0;
+        TRACE(RENAME, 5, "Begin rename Views in layout %s\n", path->c_str());
+        rename_classes_in_layout(
+            *path, aliases_for_layouts, &num_renamed, &out_delta);
+        TRACE(
+          RENAME,
+          3,
+          "Renamed %zu ResStringPool entries in layout %s\n",
+          num_renamed,
+          path->c_str());
+        return Renamed(num_renamed, out_delta);
+      },
+      [](Renamed a, Renamed b) {
+        return Renamed(a.first + b.first, a.second + b.second);
+      },
+      walk::parallel::default_num_threads());
   auto xml_files = get_xml_files(m_apk_dir + "/res");
   for (const auto& path : xml_files) {
-    size_t num_renamed;
-    ssize_t out_delta;
-    TRACE(RENAME, 5, "Begin rename Views in layout %s\n", path.c_str());
-    rename_classes_in_layout(path, aliases_for_layouts, &num_renamed, &out_delta);
-    TRACE(
-      RENAME,
-      3,
-      "Renamed %zu ResStringPool entries in layout %s\n",
-      num_renamed,
-      path.c_str());
-    layout_bytes_delta += out_delta;
-    num_layout_renamed += num_renamed;
+    wq.add_item(&path);
   }
+  auto renamed = wq.run_all(Renamed(0, 0));
+  size_t num_layout_renamed = renamed.first;
+  ssize_t layout_bytes_delta = renamed.second;
   mgr.incr_metric("layout_bytes_delta", layout_bytes_delta);
   TRACE(
     RENAME,
@@ -9,8 +9,11 @@
 
 #include "ReorderInterfaces.h"
 
+#include <fstream>
+#include <memory>
 #include <unordered_map>
 
+#include "ConfigFiles.h"
 #include "DexClass.h"
 #include "DexUtil.h"
 #include "Resolver.h"
@@ -25,26 +28,36 @@
  * Interface across the app and sorts the Interface list in descending order
  * of the number of invocations. An alphabetical sort is used for tie-breaks
  * to increase consistency across Classes.
+ *
+ * The invoke sites in the code only approximate how often the interface
+ * method tables are searched at runtime. When a profile of the interface
+ * calls is given, its counts take precedence and the invoke sites only break
+ * the ties.
  */
 namespace {
-typedef std::unordered_map<const DexType*, int> CallFrequencyMap;
+typedef std::unordered_map<const DexType*, int64_t> CallFrequencyMap;
 
 /**
  * Helper class to implement the pass
  */
 class ReorderInterfacesImpl {
  public:
-  explicit ReorderInterfacesImpl(Scope& scope) : m_scope(scope) {}
+  ReorderInterfacesImpl(Scope& scope, CallFrequencyMap profiled_calls)
+      : m_profiled_calls(std::move(profiled_calls)), m_scope(scope) {}
   void run();
 
  private:
   // Map to store the number of method invokes for each Interface
   CallFrequencyMap m_call_frequency_map;
 
+  // Map to store the number of runtime calls for each profiled Interface
+  CallFrequencyMap m_profiled_calls;
+
   // Pointer to the Scope object used for the pass
   Scope& m_scope;
 
-  void compute_call_frequencies(IRInstruction* insn);
+  static void compute_call_frequencies(IRInstruction* insn,
+                                       CallFrequencyMap& call_frequency_map);
   void reorder_interfaces();
   void reorder_interfaces_for_class(DexClass* cls);
   std::deque<DexType*> sort_interfaces(
@@ -56,12 +69,31 @@ class ReorderInterfacesImpl {
  * then sorting the list of Interfaces for each Class.
  */
 void ReorderInterfacesImpl::run() {
-  // Check out each instruction and process if it is a function invoke
-  walk::opcodes(m_scope,
-               [](DexMethod*) { return true; },
-               [this](DexMethod* /* unused */, IRInstruction* insn) {
-                 compute_call_frequencies(insn);
-               });
+  // Check out each instruction and process if it is a function invoke. Each
+  // worker counts into its own map, the maps are summed afterwards.
+  std::vector<std::unique_ptr<CallFrequencyMap>> thread_maps;
+  walk::parallel::reduce_methods<CallFrequencyMap*, std::nullptr_t>(
+      m_scope,
+      [](CallFrequencyMap*& call_frequency_map, DexMethod* method) {
+        auto code = method->get_code();
+        if (code == nullptr) {
+          return nullptr;
+        }
+        for (const auto& mie : InstructionIterable(code)) {
+          compute_call_frequencies(mie.insn, *call_frequency_map);
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int /* unused */) {
+        thread_maps.emplace_back(std::make_unique<CallFrequencyMap>());
+        return thread_maps.back().get();
+      });
+  for (const auto& call_frequency_map : thread_maps) {
+    for (const auto& pair : *call_frequency_map) {
+      m_call_frequency_map[pair.first] += pair.second;
+    }
+  }
 
   // Now that we have the invoke frequencies for each Interface,
   // reorder the list of Interfaces for each Class.
@@ -74,11 +106,12 @@ void ReorderInterfacesImpl::run() {
  *
  * This method is used when we walk the opcodes in ReorderInterfacesImpl::run.
  */
-void ReorderInterfacesImpl::compute_call_frequencies(IRInstruction* insn) {
+void ReorderInterfacesImpl::compute_call_frequencies(
+    IRInstruction* insn, CallFrequencyMap& call_frequency_map) {
   // Process only call instructions
   if (is_invoke(insn->opcode())) {
     auto callee = insn->get_method();
-    auto def_callee = resolve_method(callee, opcode_to_search(insn));
+    auto def_callee = resolve_method_cached(callee, opcode_to_search(insn));
     if (def_callee != nullptr) {
       callee = def_callee;
     }
@@ -89,7 +122,7 @@ void ReorderInterfacesImpl::compute_call_frequencies(IRInstruction* insn) {
       if (callee_cls) {
         // If we are calling into an Interface, count this call.
         if (is_interface(callee_cls)) {
-          m_call_frequency_map[callee_cls_type]++;
+          call_frequency_map[callee_cls_type]++;
         }
       }
     }
@@ -98,24 +131,28 @@ void ReorderInterfacesImpl::compute_call_frequencies(IRInstruction* insn) {
 
 /**
  * Sort the list of given Interfaces with respect to the number of incoming
- * calls and return the sorted list
+ * calls, profiled ones first, and return the sorted list
  */
 std::deque<DexType*> ReorderInterfacesImpl::sort_interfaces(
     const std::deque<DexType*>& unsorted_list) {
   std::deque<DexType*> sorted_list;
   // Create list of interfaces and store frequencies
-  std::vector<std::pair<DexType*, int>> list_with_frequencies;
+  using Frequencies = std::pair<int64_t, int64_t>;
+  std::vector<std::pair<DexType*, Frequencies>> list_with_frequencies;
   for (auto interface : unsorted_list) {
-    list_with_frequencies.emplace_back(interface,
-                                       m_call_frequency_map[interface]);
+    auto it = m_profiled_calls.find(interface);
+    auto profiled = it == m_profiled_calls.end() ? 0 : it->second;
+    list_with_frequencies.emplace_back(
+        interface,
+        Frequencies(profiled, m_call_frequency_map[interface]));
   }
 
   // Sort the list with respect to number of calls for each Interface.
   std::sort(
       list_with_frequencies.begin(),
       list_with_frequencies.end(),
-      [](const std::pair<DexType*, int>& a,
-         const std::pair<DexType*, int>& b) -> bool {
+      [](const std::pair<DexType*, Frequencies>& a,
+         const std::pair<DexType*, Frequencies>& b) -> bool {
         return ((b.second < a.second) ||
                 ((b.second == a.second) && compare_dextypes(a.first, b.first)));
       });
@@ -159,6 +196,34 @@ void ReorderInterfacesImpl::reorder_interfaces() {
     reorder_interfaces_for_class(cls);
   }
 }
+
+/**
+ * Read the runtime call counts of the interfaces from the profile, whose
+ * names are translated through the ProGuard map.
+ */
+CallFrequencyMap read_interface_call_profile(const std::string& path,
+                                             ConfigFiles& cfg) {
+  CallFrequencyMap profiled_calls;
+  if (path.empty()) {
+    return profiled_calls;
+  }
+  std::ifstream profile(path);
+  if (!profile) {
+    fprintf(stderr, "Failed to open interface call profile: `%s'\n",
+            path.c_str());
+    return profiled_calls;
+  }
+  std::string descriptor;
+  int64_t calls;
+  while (profile >> descriptor >> calls) {
+    auto type = DexType::get_type(
+        cfg.get_proguard_map().translate_class(descriptor).c_str());
+    if (type != nullptr) {
+      profiled_calls[type] += calls;
+    }
+  }
+  return profiled_calls;
+}
 }
 
 /**
@@ -166,11 +231,12 @@ void ReorderInterfacesImpl::reorder_interfaces() {
  * sort the list of Interfaces for each Class.
  */
 void ReorderInterfacesPass::run_pass(DexStoresVector& stores,
-                                     ConfigFiles& /* unused */,
+                                     ConfigFiles& cfg,
                                      PassManager& /* unused */) {
   auto scope = build_class_scope(stores);
 
-  ReorderInterfacesImpl impl(scope);
+  ReorderInterfacesImpl impl(
+      scope, read_interface_call_profile(m_interface_call_profile, cfg));
   impl.run();
 }
 
@@ -9,13 +9,23 @@
 
 #pragma once
 
+#include <string>
+
 #include "Pass.h"
 
 class ReorderInterfacesPass : public Pass {
  public:
   ReorderInterfacesPass() : Pass("ReorderInterfacesPass") {}
 
-  virtual void configure_pass(const PassConfig& /* unused */) override {}
+  virtual void configure_pass(const PassConfig& pc) override {
+    pc.get("interface_call_profile", "", m_interface_call_profile);
+  }
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+ private:
+  // Runtime call counts of the interfaces, one "<interface descriptor> <call
+  // count>" line per interface. When given, the interfaces are ordered by
+  // these counts first, and by the number of invoke sites in the code second.
+  std::string m_interface_call_profile;
 };
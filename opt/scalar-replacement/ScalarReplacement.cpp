@@ -0,0 +1,357 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ScalarReplacement.h"
+
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "PassManager.h"
+#include "Resolver.h"
+#include "SSA.h"
+#include "ScopeView.h"
+#include "Walkers.h"
+
+namespace {
+
+using ssa::ValueId;
+
+// The fields that a constructor stores its arguments into, in order, along
+// with the index of the argument.
+using ConstructorStores = std::vector<std::pair<DexField*, size_t>>;
+
+bool is_finalize(const DexMethod* method) {
+  return method->get_name()->str_ref() == "finalize" &&
+         method->get_proto()->get_args()->get_type_list().empty();
+}
+
+/*
+ * Whether allocating an instance of the class has no effect besides the
+ * object itself.
+ */
+bool is_replaceable(const DexType* type) {
+  auto cls = type_class(type);
+  if (cls == nullptr || cls->is_external() || is_interface(cls) ||
+      is_abstract(cls) || cls->get_super_class() != get_object_type() ||
+      cls->get_clinit() != nullptr) {
+    return false;
+  }
+  for (const auto* method : cls->get_vmethods()) {
+    if (is_finalize(method)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+DexField* resolve_own_field(const IRInstruction* insn, const DexType* type) {
+  auto field = resolve_field(insn->get_field(), FieldSearch::Instance);
+  return field != nullptr && field->get_class() == type ? field : nullptr;
+}
+
+/*
+ * The stores of a constructor that only calls Object's, and stores its
+ * arguments into the fields of its class.
+ */
+bool get_constructor_stores(const DexMethod* ctor, ConstructorStores* stores) {
+  auto code = ctor->get_code();
+  if (code == nullptr) {
+    return false;
+  }
+  // The argument that each register holds, `this` being argument 0.
+  std::unordered_map<uint16_t, size_t> args;
+  auto arg_of = [&args](uint16_t reg) {
+    auto it = args.find(reg);
+    return it == args.end() ? std::numeric_limits<size_t>::max() : it->second;
+  };
+  for (const auto& mie : InstructionIterable(code)) {
+    auto insn = mie.insn;
+    auto op = insn->opcode();
+    if (opcode::is_load_param(op)) {
+      auto index = args.size();
+      if (!args.emplace(insn->dest(), index).second) {
+        return false;
+      }
+      continue;
+    }
+    if (op == OPCODE_RETURN_VOID) {
+      continue;
+    }
+    if (op == OPCODE_INVOKE_DIRECT) {
+      auto callee = insn->get_method();
+      if (callee->get_class() != get_object_type() ||
+          callee->get_name()->str_ref() != "<init>" || insn->srcs_size() != 1 ||
+          arg_of(insn->src(0)) != 0) {
+        return false;
+      }
+      continue;
+    }
+    if (!is_iput(op)) {
+      return false;
+    }
+    auto field = resolve_own_field(insn, ctor->get_class());
+    auto value = arg_of(insn->src(0));
+    if (field == nullptr || arg_of(insn->src(1)) != 0 || value == 0 ||
+        value == std::numeric_limits<size_t>::max()) {
+      return false;
+    }
+    stores->emplace_back(field, value);
+  }
+  return true;
+}
+
+IROpcode move_opcode(const DexType* type) {
+  if (is_wide_type(type)) {
+    return OPCODE_MOVE_WIDE;
+  }
+  return is_object(type) ? OPCODE_MOVE_OBJECT : OPCODE_MOVE;
+}
+
+/*
+ * An allocation that doesn't escape, and the instructions to rewrite.
+ */
+struct Candidate {
+  IRInstruction* new_instance;
+  // Kept aside, since the rewrite deletes new_instance.
+  const DexType* type;
+  std::vector<IRInstruction*> moves;
+  std::vector<IRInstruction*> accesses;
+  IRInstruction* ctor_call{nullptr};
+  ConstructorStores ctor_stores;
+  // The register that holds each field that the method accesses.
+  std::vector<std::pair<DexField*, uint16_t>> field_regs;
+};
+
+/*
+ * Follows the uses of the object that `result` gets, and fills the candidate
+ * if none of them lets it escape.
+ */
+bool find_uses(const ssa::SSAForm& ssa,
+               const IRInstruction* result,
+               Candidate* candidate) {
+  auto type = candidate->type;
+  std::vector<ValueId> values{ssa.def(result)};
+  std::unordered_set<DexField*> fields;
+  while (!values.empty()) {
+    auto v = values.back();
+    values.pop_back();
+    if (v == ssa::UNDEFINED) {
+      return false;
+    }
+    for (const auto& use : ssa.uses(v)) {
+      auto insn = use.insn;
+      if (insn == nullptr) {
+        return false;
+      }
+      auto op = insn->opcode();
+      if (op == OPCODE_MOVE_OBJECT) {
+        candidate->moves.push_back(insn);
+        values.push_back(ssa.def(insn));
+      } else if ((is_iget(op) || is_iput(op)) &&
+                 use.operand == (is_iget(op) ? 0 : 1)) {
+        auto field = resolve_own_field(insn, type);
+        if (field == nullptr) {
+          return false;
+        }
+        candidate->accesses.push_back(insn);
+        fields.emplace(field);
+      } else if (op == OPCODE_INVOKE_DIRECT && use.operand == 0 &&
+                 candidate->ctor_call == nullptr) {
+        auto ctor = resolve_method(insn->get_method(), MethodSearch::Direct);
+        if (ctor == nullptr || !is_init(ctor) || ctor->get_class() != type ||
+            !get_constructor_stores(ctor, &candidate->ctor_stores)) {
+          return false;
+        }
+        candidate->ctor_call = insn;
+        for (const auto& store : candidate->ctor_stores) {
+          fields.emplace(store.first);
+        }
+      } else {
+        return false;
+      }
+    }
+  }
+  // Keep the order of the fields of the class, so that the result doesn't
+  // depend on hashing.
+  for (auto* field : type_class(type)->get_ifields()) {
+    if (fields.count(field)) {
+      candidate->field_regs.emplace_back(field, 0);
+    }
+  }
+  return candidate->ctor_call != nullptr;
+}
+
+uint16_t field_reg(const Candidate& candidate, const DexField* field) {
+  for (const auto& pair : candidate.field_regs) {
+    if (pair.first == field) {
+      return pair.second;
+    }
+  }
+  not_reached();
+}
+
+} // namespace
+
+namespace scalar_replacement {
+
+Stats Stats::operator+(const Stats& other) const {
+  Stats result;
+  result.allocations_removed = allocations_removed + other.allocations_removed;
+  result.field_accesses_replaced =
+      field_accesses_replaced + other.field_accesses_replaced;
+  return result;
+}
+
+Stats ScalarReplacement::run(DexMethod* method) {
+  Stats stats;
+  auto code = method->get_code();
+  if (code == nullptr) {
+    return stats;
+  }
+  IRInstruction* prev = nullptr;
+  std::vector<std::pair<IRInstruction*, const IRInstruction*>> allocations;
+  for (const auto& mie : InstructionIterable(code)) {
+    if (prev != nullptr && prev->opcode() == OPCODE_NEW_INSTANCE &&
+        is_replaceable(prev->get_type())) {
+      allocations.emplace_back(prev, mie.insn);
+    }
+    prev = mie.insn;
+  }
+  if (allocations.empty()) {
+    return stats;
+  }
+
+  code->build_cfg();
+  ssa::SSAForm ssa(code->cfg());
+  std::vector<Candidate> candidates;
+  for (const auto& allocation : allocations) {
+    Candidate candidate;
+    candidate.new_instance = allocation.first;
+    candidate.type = allocation.first->get_type();
+    if (find_uses(ssa, allocation.second, &candidate)) {
+      TRACE(SCALAR_REPL,
+            3,
+            "Replacing %s in %s\n",
+            SHOW(allocation.first),
+            SHOW(method));
+      candidates.push_back(std::move(candidate));
+    }
+  }
+  if (candidates.empty()) {
+    return stats;
+  }
+
+  // What to do with each instruction of a candidate.
+  std::unordered_map<const IRInstruction*, const Candidate*> owners;
+  for (auto& candidate : candidates) {
+    for (auto& pair : candidate.field_regs) {
+      pair.second = code->allocate_temp();
+      if (is_wide_type(pair.first->get_type())) {
+        code->allocate_temp();
+      }
+    }
+    owners.emplace(candidate.new_instance, &candidate);
+    owners.emplace(candidate.ctor_call, &candidate);
+    for (auto insn : candidate.moves) {
+      owners.emplace(insn, &candidate);
+    }
+    for (auto insn : candidate.accesses) {
+      owners.emplace(insn, &candidate);
+    }
+  }
+
+  for (auto it = code->begin(); it != code->end(); ++it) {
+    if (it->type != MFLOW_OPCODE) {
+      continue;
+    }
+    auto insn = it->insn;
+    auto found = owners.find(insn);
+    if (found == owners.end()) {
+      continue;
+    }
+    const auto& candidate = *found->second;
+    auto op = insn->opcode();
+    std::vector<IRInstruction*> replacements;
+    if (op == OPCODE_NEW_INSTANCE) {
+      // The fields start with their default values.
+      for (const auto& pair : candidate.field_regs) {
+        auto wide = is_wide_type(pair.first->get_type());
+        auto init = new IRInstruction(wide ? OPCODE_CONST_WIDE : OPCODE_CONST);
+        init->set_dest(pair.second)->set_literal(0);
+        replacements.push_back(init);
+      }
+      ++stats.allocations_removed;
+    } else if (op == OPCODE_INVOKE_DIRECT) {
+      for (const auto& store : candidate.ctor_stores) {
+        auto move = new IRInstruction(move_opcode(store.first->get_type()));
+        move->set_dest(field_reg(candidate, store.first))
+            ->set_src(0, insn->src(store.second));
+        replacements.push_back(move);
+      }
+    } else if (is_iput(op)) {
+      auto field = resolve_own_field(insn, candidate.type);
+      auto move = new IRInstruction(move_opcode(field->get_type()));
+      move->set_dest(field_reg(candidate, field))->set_src(0, insn->src(0));
+      replacements.push_back(move);
+      ++stats.field_accesses_replaced;
+    } else if (is_iget(op)) {
+      auto field = resolve_own_field(insn, candidate.type);
+      auto result_it = std::next(it);
+      while (result_it->type != MFLOW_OPCODE) {
+        ++result_it;
+      }
+      auto move = new IRInstruction(move_opcode(field->get_type()));
+      move->set_dest(result_it->insn->dest())
+          ->set_src(0, field_reg(candidate, field));
+      replacements.push_back(move);
+      ++stats.field_accesses_replaced;
+    }
+    for (auto replacement : replacements) {
+      code->insert_before(it, replacement);
+    }
+    // Also removes the move-result-pseudo, if any.
+    code->remove_opcode(it);
+  }
+  return stats;
+}
+
+Stats ScalarReplacement::run(const Scope& scope) {
+  using Data = std::nullptr_t;
+  using Output = Stats;
+  return walk::parallel::reduce_methods<Data, Output>(
+      scope,
+      [this](Data&, DexMethod* m) { return run(m); },
+      [](Output a, Output b) { return a + b; },
+      [](unsigned int /* thread_index */) { return nullptr; });
+}
+
+} // namespace scalar_replacement
+
+void ScalarReplacementPass::run_pass(DexStoresVector& /* unused */,
+                                     ConfigFiles& /* unused */,
+                                     PassManager& mgr) {
+  auto scope = mgr.get_scope_view().get();
+  scalar_replacement::ScalarReplacement impl;
+  auto stats = impl.run(*scope);
+  mgr.incr_metric("allocations_removed", stats.allocations_removed);
+  mgr.incr_metric("field_accesses_replaced", stats.field_accesses_replaced);
+  TRACE(SCALAR_REPL,
+        1,
+        "%d allocations removed, %d field accesses replaced\n",
+        stats.allocations_removed,
+        stats.field_accesses_replaced);
+}
+
+static ScalarReplacementPass s_pass;
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include "Pass.h"
+
+/*
+ * Replaces the objects that never leave the method allocating them with a
+ * register per field. This generalizes RemoveBuildersPass to any class that
+ * is simple enough: after inlining, the iterators, small value holders and
+ * lambdas that only live in one method turn into
+ *
+ *   new-instance LPair;                  const v3, 0
+ *   move-result-pseudo-object v0         const v4, 0
+ *   invoke-direct {v0, v1, v2}, LPair;.<init>:(II)V
+ *                                   =>   move v3, v1
+ *                                        move v4, v2
+ *   iget v5, v0, LPair;.first:I          move v5, v3
+ *
+ * Following the def-use chains of the SSA view, an object stays in its method
+ * when it is only copied by move-object, and only used as the object of
+ * iget-* and iput-* instructions on its own fields and of one call of its
+ * constructor. Its value mustn't meet another one at a phi.
+ *
+ * Removing the allocation must not be observable either: the class extends
+ * Object directly, has no static initializer and no finalizer, and the
+ * constructor only stores its arguments into fields, as in the example.
+ */
+class ScalarReplacementPass : public Pass {
+ public:
+  ScalarReplacementPass() : Pass("ScalarReplacementPass") {}
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+};
+
+namespace scalar_replacement {
+
+struct Stats {
+  size_t allocations_removed{0};
+  size_t field_accesses_replaced{0};
+
+  Stats operator+(const Stats& other) const;
+};
+
+class ScalarReplacement final {
+ public:
+  Stats run(const Scope& scope);
+
+  Stats run(DexMethod* method);
+};
+
+} // namespace scalar_replacement
@@ -46,23 +46,56 @@ static bool is_reasonable_string(const char* str, size_t len) {
   return true;
 }
 
+static bool is_suitable_string(DexString* str) {
+  auto len = str->size();
+  return !maybe_file_name(str->c_str(), len) &&
+         is_reasonable_string(str->c_str(), len);
+}
+
 DexString* get_suitable_string(std::unordered_set<DexString*>& set,
                                std::vector<DexString*>& dex_strings) {
   while (dex_strings.size()) {
     DexString* val = dex_strings.back();
     dex_strings.pop_back();
-    auto valstr = val->c_str();
-    auto vallen = strlen(valstr);
-    auto not_file_name = !maybe_file_name(valstr, vallen);
-    auto no_bad_char = is_reasonable_string(valstr, vallen);
-    auto not_seen_yet = !set.count(val);
-    if (not_seen_yet && not_file_name && no_bad_char) {
+    if (!set.count(val)) {
       return val;
     }
   }
   return nullptr;
 }
 
+/**
+ * The strings of the dex that could stand in for a source file name, in the
+ * order get_suitable_string() hands them out. Each class gathers and filters
+ * its strings in parallel, so that only the candidates get sorted.
+ */
+static std::vector<DexString*> suitable_dex_strings(
+    const DexClasses& classes) {
+  std::vector<std::vector<DexString*>> class_strings(classes.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    std::vector<DexString*> strings;
+    classes[i]->gather_strings(strings);
+    sort_unique(strings);
+    auto& suitable = class_strings[i];
+    for (auto str : strings) {
+      if (is_suitable_string(str)) {
+        suitable.push_back(str);
+      }
+    }
+  });
+  for (size_t i = 0; i < classes.size(); i++) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  std::vector<DexString*> dex_strings;
+  for (auto& strings : class_strings) {
+    dex_strings.insert(dex_strings.end(), strings.begin(), strings.end());
+  }
+  sort_unique(dex_strings, compare_dexstrings);
+  return dex_strings;
+}
+
 static void strip_src_strings(
   DexStoresVector& stores, const char* map_path, PassManager& mgr) {
   size_t shortened = 0;
@@ -71,37 +104,36 @@ static void strip_src_strings(
   std::unordered_set<DexString*> shortened_used;
 
   for (auto& classes : DexStoreClassesIterator(stores)) {
-    std::unordered_map<DexString*, DexString*> src_to_shortened;
-    std::vector<DexString*> current_dex_strings;
-    for (auto const& clazz : classes) {
-      clazz->gather_strings(current_dex_strings);
-    }
-    sort_unique(current_dex_strings, compare_dexstrings);
+    auto current_dex_strings = suitable_dex_strings(classes);
 
+    // The replacements are picked serially, in the order of the classes,
+    // then the classes are all rewritten in parallel.
+    std::unordered_map<DexString*, DexString*> src_to_shortened;
     for (auto const& clazz : classes) {
       auto src_string = clazz->get_source_file();
-      if (!src_string) {
+      if (!src_string || src_to_shortened.count(src_string)) {
         continue;
       }
-      DexString* shortened_src_string = nullptr;
-      if (src_to_shortened.count(src_string) == 0) {
-        shortened_src_string =
-            get_suitable_string(shortened_used, current_dex_strings);
-        if (!shortened_src_string) {
-          opt_warn(UNSHORTENED_SRC_STRING, "%s\n", SHOW(src_string));
-          shortened_src_string = src_string;
-        } else {
-          shortened++;
-          string_savings += strlen(src_string->c_str());
-        }
-        src_to_shortened[src_string] = shortened_src_string;
-        shortened_used.emplace(shortened_src_string);
-        global_src_strings[src_string].push_back(shortened_src_string);
+      auto shortened_src_string =
+          get_suitable_string(shortened_used, current_dex_strings);
+      if (!shortened_src_string) {
+        opt_warn(UNSHORTENED_SRC_STRING, "%s\n", SHOW(src_string));
+        shortened_src_string = src_string;
       } else {
-        shortened_src_string = src_to_shortened[src_string];
+        shortened++;
+        string_savings += strlen(src_string->c_str());
       }
-      clazz->set_source_file(shortened_src_string);
+      src_to_shortened[src_string] = shortened_src_string;
+      shortened_used.emplace(shortened_src_string);
+      global_src_strings[src_string].push_back(shortened_src_string);
     }
+
+    walk::parallel::classes(classes, [&](DexClass* clazz) {
+      auto src_string = clazz->get_source_file();
+      if (src_string) {
+        clazz->set_source_file(src_to_shortened.at(src_string));
+      }
+    });
   }
 
   TRACE(SHORTEN, 1, "src strings shortened %ld, %lu bytes saved\n", shortened,
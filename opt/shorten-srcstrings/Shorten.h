@@ -24,6 +24,14 @@ class ShortenSrcStringsPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  // Picks replacement names among all the strings each dex already has, so
+  // it reads everything, but only rewrites source files and the mapping file.
+  virtual unsigned writes() const override {
+    return TOUCHES_DEBUG_INFO | TOUCHES_RESOURCES;
+  }
+
  private:
   std::string m_filename_mappings;
 };
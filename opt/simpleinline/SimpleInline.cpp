@@ -8,6 +8,7 @@
  */
 
 #include <algorithm>
+#include <fstream>
 #include <string>
 #include <vector>
 #include <map>
@@ -25,6 +26,7 @@
 #include "ReachableClasses.h"
 #include "VirtualScope.h"
 #include "ClassHierarchy.h"
+#include "HierarchyCache.h"
 
 namespace {
 
@@ -84,13 +86,30 @@ void SimpleInlinePass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassM
   auto scope = build_class_scope(stores);
   // gather all inlinable candidates
   auto methods = gather_non_virtual_methods(scope, no_inline, force_inline);
-  select_inlinable(
-      scope, methods, resolved_refs, &inlinable, m_multiple_callers);
+  if (m_inliner_config.profile_guided) {
+    m_inliner_config.hot_methods = gather_hot_methods(cfg);
+    TRACE(SINL, 1, "%ld hot methods\n", m_inliner_config.hot_methods.size());
+    select_inlinable(scope,
+                     methods,
+                     resolved_refs,
+                     &inlinable,
+                     m_multiple_callers,
+                     &m_inliner_config.hot_methods,
+                     m_hot_callee_size);
+  } else {
+    select_inlinable(
+        scope, methods, resolved_refs, &inlinable, m_multiple_callers);
+  }
 
   auto resolver = [&](DexMethodRef* method, MethodSearch search) {
     return resolve_method(method, search, resolved_refs);
   };
 
+  if (m_remove_pure_calls) {
+    m_inliner_config.side_effects =
+        &mgr.get_hierarchy_cache().get_side_effect_summaries();
+  }
+
   // inline candidates
   MultiMethodInliner inliner(
       scope, stores, inlinable, resolver, m_inliner_config);
@@ -118,12 +137,55 @@ void SimpleInlinePass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassM
       inliner.get_info().cross_store);
   TRACE(SINL, 3, "not found %ld\n", inliner.get_info().not_found);
   TRACE(SINL, 3, "caller too large %ld\n", inliner.get_info().caller_too_large);
+  TRACE(SINL, 3, "cold callers %ld\n", inliner.get_info().cold_caller);
   TRACE(SINL, 1,
       "%ld inlined calls over %ld methods and %ld methods removed\n",
       inliner.get_info().calls_inlined, inlined_count, deleted);
+  TRACE(SINL, 1, "%ld calls with unused results removed\n",
+      inliner.get_info().calls_removed);
 
   mgr.incr_metric("calls_inlined", inliner.get_info().calls_inlined);
+  mgr.incr_metric("calls_removed", inliner.get_info().calls_removed);
   mgr.incr_metric("methods_removed", deleted);
+  if (m_inliner_config.profile_guided) {
+    mgr.incr_metric("cold_callers_skipped", inliner.get_info().cold_caller);
+  }
+}
+
+/**
+ * Collect the methods that the coldstart method list and the method profile
+ * mark as hot.
+ */
+std::unordered_set<const DexMethod*> SimpleInlinePass::gather_hot_methods(
+    ConfigFiles& cfg) {
+  std::unordered_set<const DexMethod*> hot;
+  for (auto ref : cfg.get_coldstart_method_refs()) {
+    if (ref != nullptr && ref->is_def()) {
+      hot.insert(static_cast<DexMethod*>(ref));
+    }
+  }
+  if (m_method_profile.empty()) {
+    return hot;
+  }
+  std::ifstream profile(m_method_profile);
+  if (!profile) {
+    fprintf(stderr, "Failed to open method profile: `%s'\n",
+            m_method_profile.c_str());
+    return hot;
+  }
+  std::string descriptor;
+  int64_t calls;
+  while (profile >> descriptor >> calls) {
+    if (calls < m_hot_method_min_calls) {
+      continue;
+    }
+    auto method =
+        find_method(cfg.get_proguard_map().translate_method(descriptor));
+    if (method != nullptr) {
+      hot.insert(method);
+    }
+  }
+  return hot;
 }
 
 /**
@@ -31,6 +31,11 @@ class SimpleInlinePass : public Pass {
     pc.get("no_inline_annos", {}, m_no_inline_annos);
     pc.get("force_inline_annos", {}, m_force_inline_annos);
     pc.get("multiple_callers", false, m_multiple_callers);
+    pc.get("profile_guided", false, m_inliner_config.profile_guided);
+    pc.get("method_profile", "", m_method_profile);
+    pc.get("hot_method_min_calls", 1, m_hot_method_min_calls);
+    pc.get("hot_callee_size", 20, m_hot_callee_size);
+    pc.get("remove_pure_calls", true, m_remove_pure_calls);
 
     std::vector<std::string> black_list;
     pc.get("black_list", {}, black_list);
@@ -49,6 +54,8 @@ class SimpleInlinePass : public Pass {
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
  private:
+  std::unordered_set<const DexMethod*> gather_hot_methods(ConfigFiles& cfg);
+
   std::unordered_set<DexMethod*> gather_non_virtual_methods(
       Scope& scope,
       const std::unordered_set<DexType*>& no_inline,
@@ -63,6 +70,18 @@ class SimpleInlinePass : public Pass {
   // inline methods with multiple callers
   bool m_multiple_callers;
 
+  // In profile-guided mode, the hot methods are the coldstart methods along
+  // with the methods of the profile called at least this many times. The
+  // profile has one "<method descriptor> <call count>" line per method.
+  std::string m_method_profile;
+  int64_t m_hot_method_min_calls;
+  // callees up to this many instructions are inlined into all their hot
+  // callers
+  int64_t m_hot_callee_size;
+  // remove the calls to candidates that only read or allocate, when the
+  // caller doesn't use their result, instead of inlining them
+  bool m_remove_pure_calls;
+
   MultiMethodInliner::Config m_inliner_config;
 
   // annotations indicating not to inline a function
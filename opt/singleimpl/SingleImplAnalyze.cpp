@@ -27,6 +27,8 @@
 #include "Trace.h"
 #include "Walkers.h"
 
+struct OpcodeRefs;
+
 struct AnalysisImpl : SingleImplAnalysis {
   AnalysisImpl(const Scope& scope, const DexStoresVector& stores)
       : SingleImplAnalysis(), scope(scope), xstores(stores) {
@@ -43,6 +45,8 @@ struct AnalysisImpl : SingleImplAnalysis {
 
  private:
   DexType* get_and_check_single_impl(DexType* type);
+  DexType* find_single_impl(DexType* type, OpcodeRefs& refs) const;
+  void analyze_opcode(IRInstruction* insn, OpcodeRefs& refs) const;
   void collect_children(const TypeSet& intfs);
   void check_impl_hierarchy();
   void escape_with_clinit();
@@ -295,15 +299,44 @@ void AnalysisImpl::collect_method_defs() {
 }
 
 /**
- * Find all opcodes that reference a single implemented interface in a typeref,
- * fieldref or methodref.
+ * References to single impl interfaces found by one worker of
+ * analyze_opcodes. Escapes are recorded rather than applied, so that the
+ * shared single impl map is only read while the workers run.
  */
-void AnalysisImpl::analyze_opcodes() {
+struct OpcodeRefs {
+  std::vector<std::pair<DexType*, EscapeReason>> escapes;
+  std::unordered_map<DexType*, OpcodeList> typerefs;
+  std::unordered_map<DexType*, FieldRefToOpcodes> fieldrefs;
+  std::unordered_map<DexType*, MethodToOpcodes> intf_methodrefs;
+  std::unordered_map<DexType*, MethodToOpcodes> methodrefs;
+};
+
+/**
+ * Same as get_and_check_single_impl but records the array escape in `refs`.
+ */
+DexType* AnalysisImpl::find_single_impl(DexType* type,
+                                        OpcodeRefs& refs) const {
+  if (exists(single_impls, type)) return type;
+  if (is_array(type)) {
+    auto array_type = get_array_type(type);
+    assert(array_type);
+    const auto sit = single_impls.find(array_type);
+    if (sit != single_impls.end()) {
+      refs.escapes.emplace_back(sit->first, HAS_ARRAY_TYPE);
+      return sit->first;
+    }
+  }
+  return nullptr;
+}
 
+/**
+ * Record the references of a single opcode.
+ */
+void AnalysisImpl::analyze_opcode(IRInstruction* insn, OpcodeRefs& refs) const {
   auto check_arg = [&](DexType* type, DexMethodRef* meth, IRInstruction* insn) {
-    auto intf = get_and_check_single_impl(type);
+    auto intf = find_single_impl(type, refs);
     if (intf) {
-      single_impls[intf].methodrefs[meth].insert(insn);
+      refs.methodrefs[intf][meth].insert(insn);
     }
   };
 
@@ -319,110 +352,160 @@ void AnalysisImpl::analyze_opcodes() {
 
   auto check_field = [&](DexFieldRef* field, IRInstruction* insn) {
     auto cls = field->get_class();
-    cls = get_and_check_single_impl(cls);
+    cls = find_single_impl(cls, refs);
     if (cls) {
-      escape_interface(cls, HAS_FIELD_REF);
+      refs.escapes.emplace_back(cls, HAS_FIELD_REF);
     }
     const auto type = field->get_type();
-    auto intf = get_and_check_single_impl(type);
+    auto intf = find_single_impl(type, refs);
     if (intf) {
-      single_impls[intf].fieldrefs[field].push_back(insn);
+      refs.fieldrefs[intf][field].push_back(insn);
     }
   };
 
-  walk::opcodes(scope,
-               [](DexMethod* method) { return true; },
-               [&](DexMethod* method, IRInstruction* insn) {
-                 auto op = insn->opcode();
-                 switch (op) {
-                 // type ref
-                 case OPCODE_CONST_CLASS: {
-                   // const_class is problematic because DI can use it as a key
-                   // to mark
-                   // different instances to retrieve, so we simply drop all
-                   // single impl
-                   // that are used with const_class
-                   const auto typeref = insn->get_type();
-                   auto intf = get_and_check_single_impl(typeref);
-                   if (intf) {
-                     escape_interface(intf, CONST_CLASS);
-                   }
-                   return;
-                 }
-                 case OPCODE_CHECK_CAST:
-                 case OPCODE_INSTANCE_OF:
-                 case OPCODE_NEW_INSTANCE:
-                 case OPCODE_NEW_ARRAY:
-                 case OPCODE_FILLED_NEW_ARRAY: {
-                   auto intf = get_and_check_single_impl(insn->get_type());
-                   if (intf) {
-                     single_impls[intf].typerefs.push_back(insn);
-                   }
-                   return;
-                 }
-                 // field ref
-                 case OPCODE_IGET:
-                 case OPCODE_IGET_WIDE:
-                 case OPCODE_IGET_OBJECT:
-                 case OPCODE_IPUT:
-                 case OPCODE_IPUT_WIDE:
-                 case OPCODE_IPUT_OBJECT: {
-                   DexFieldRef* field =
-                       resolve_field(insn->get_field(), FieldSearch::Instance);
-                   if (field == nullptr) {
-                     field = insn->get_field();
-                   }
-                   check_field(field, insn);
-                   return;
-                 }
-                 case OPCODE_SGET:
-                 case OPCODE_SGET_WIDE:
-                 case OPCODE_SGET_OBJECT:
-                 case OPCODE_SPUT:
-                 case OPCODE_SPUT_WIDE:
-                 case OPCODE_SPUT_OBJECT: {
-                   DexFieldRef* field =
-                       resolve_field(insn->get_field(), FieldSearch::Static);
-                   if (field == nullptr) {
-                     field = insn->get_field();
-                   }
-                   check_field(field, insn);
-                   return;
-                 }
-                 // method ref
-                 case OPCODE_INVOKE_INTERFACE: {
-                   // if it is an invoke on the interface method, collect it as
-                   // such
-                   const auto meth = insn->get_method();
-                   const auto owner = meth->get_class();
-                   const auto intf = get_and_check_single_impl(owner);
-                   if (intf) {
-                     // if the method ref is not defined on the interface itself
-                     // drop the optimization
-                     const auto& meths = type_class(intf)->get_vmethods();
-                     if (std::find(meths.begin(), meths.end(), meth) ==
-                         meths.end()) {
-                       escape_interface(intf, UNKNOWN_MREF);
-                     } else {
-                       single_impls[intf].intf_methodrefs[meth].insert(insn);
-                     }
-                   }
-                   check_sig(meth, insn);
-                   return;
-                 }
-
-                 case OPCODE_INVOKE_DIRECT:
-                 case OPCODE_INVOKE_STATIC:
-                 case OPCODE_INVOKE_VIRTUAL:
-                 case OPCODE_INVOKE_SUPER: {
-                   const auto meth = insn->get_method();
-                   check_sig(meth, insn);
-                   return;
-                 }
-                 default:
-                   return;
-                 }
-               });
+  auto op = insn->opcode();
+  switch (op) {
+  // type ref
+  case OPCODE_CONST_CLASS: {
+    // const_class is problematic because DI can use it as a key to mark
+    // different instances to retrieve, so we simply drop all single impl
+    // that are used with const_class
+    const auto typeref = insn->get_type();
+    auto intf = find_single_impl(typeref, refs);
+    if (intf) {
+      refs.escapes.emplace_back(intf, CONST_CLASS);
+    }
+    return;
+  }
+  case OPCODE_CHECK_CAST:
+  case OPCODE_INSTANCE_OF:
+  case OPCODE_NEW_INSTANCE:
+  case OPCODE_NEW_ARRAY:
+  case OPCODE_FILLED_NEW_ARRAY: {
+    auto intf = find_single_impl(insn->get_type(), refs);
+    if (intf) {
+      refs.typerefs[intf].push_back(insn);
+    }
+    return;
+  }
+  // field ref
+  case OPCODE_IGET:
+  case OPCODE_IGET_WIDE:
+  case OPCODE_IGET_OBJECT:
+  case OPCODE_IPUT:
+  case OPCODE_IPUT_WIDE:
+  case OPCODE_IPUT_OBJECT: {
+    DexFieldRef* field =
+        resolve_field(insn->get_field(), FieldSearch::Instance);
+    if (field == nullptr) {
+      field = insn->get_field();
+    }
+    check_field(field, insn);
+    return;
+  }
+  case OPCODE_SGET:
+  case OPCODE_SGET_WIDE:
+  case OPCODE_SGET_OBJECT:
+  case OPCODE_SPUT:
+  case OPCODE_SPUT_WIDE:
+  case OPCODE_SPUT_OBJECT: {
+    DexFieldRef* field = resolve_field(insn->get_field(), FieldSearch::Static);
+    if (field == nullptr) {
+      field = insn->get_field();
+    }
+    check_field(field, insn);
+    return;
+  }
+  // method ref
+  case OPCODE_INVOKE_INTERFACE: {
+    // if it is an invoke on the interface method, collect it as such
+    const auto meth = insn->get_method();
+    const auto owner = meth->get_class();
+    const auto intf = find_single_impl(owner, refs);
+    if (intf) {
+      // if the method ref is not defined on the interface itself
+      // drop the optimization
+      const auto& meths = type_class(intf)->get_vmethods();
+      if (std::find(meths.begin(), meths.end(), meth) == meths.end()) {
+        refs.escapes.emplace_back(intf, UNKNOWN_MREF);
+      } else {
+        refs.intf_methodrefs[intf][meth].insert(insn);
+      }
+    }
+    check_sig(meth, insn);
+    return;
+  }
+
+  case OPCODE_INVOKE_DIRECT:
+  case OPCODE_INVOKE_STATIC:
+  case OPCODE_INVOKE_VIRTUAL:
+  case OPCODE_INVOKE_SUPER: {
+    const auto meth = insn->get_method();
+    check_sig(meth, insn);
+    return;
+  }
+  default:
+    return;
+  }
+}
+
+/**
+ * Find all opcodes that reference a single implemented interface in a typeref,
+ * fieldref or methodref.
+ * The scan runs in parallel, each worker collecting its own references, which
+ * are merged into the single impl map once all workers are done.
+ */
+void AnalysisImpl::analyze_opcodes() {
+  std::vector<std::unique_ptr<OpcodeRefs>> thread_refs;
+  walk::parallel::reduce_methods<OpcodeRefs*, std::nullptr_t>(
+      scope,
+      [&](OpcodeRefs*& refs, DexMethod* method) {
+        auto code = method->get_code();
+        if (code == nullptr) {
+          return nullptr;
+        }
+        for (const auto& mie : InstructionIterable(code)) {
+          analyze_opcode(mie.insn, *refs);
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int /*thread_index*/) {
+        thread_refs.emplace_back(std::make_unique<OpcodeRefs>());
+        return thread_refs.back().get();
+      });
+
+  for (const auto& refs : thread_refs) {
+    for (const auto& escape : refs->escapes) {
+      escape_interface(escape.first, escape.second);
+    }
+    for (auto& it : refs->typerefs) {
+      auto& typerefs = single_impls[it.first].typerefs;
+      typerefs.insert(typerefs.end(), it.second.begin(), it.second.end());
+    }
+    for (auto& it : refs->fieldrefs) {
+      auto& fieldrefs = single_impls[it.first].fieldrefs;
+      for (auto& field_it : it.second) {
+        auto& insns = fieldrefs[field_it.first];
+        insns.insert(insns.end(), field_it.second.begin(),
+                     field_it.second.end());
+      }
+    }
+    for (auto& it : refs->intf_methodrefs) {
+      auto& intf_methodrefs = single_impls[it.first].intf_methodrefs;
+      for (auto& meth_it : it.second) {
+        intf_methodrefs[meth_it.first].insert(meth_it.second.begin(),
+                                              meth_it.second.end());
+      }
+    }
+    for (auto& it : refs->methodrefs) {
+      auto& methodrefs = single_impls[it.first].methodrefs;
+      for (auto& meth_it : it.second) {
+        methodrefs[meth_it.first].insert(meth_it.second.begin(),
+                                         meth_it.second.end());
+      }
+    }
+  }
 }
 
 /**
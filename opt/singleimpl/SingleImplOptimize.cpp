@@ -405,9 +405,9 @@ void OptimizationImpl::rewrite_annotations(Scope& scope, const SingleImplConfig&
   auto enclosingMethod = DexType::get_type("Ldalvik/annotation/EnclosingMethod;");
   if (enclosingMethod == nullptr) return; // nothing to do
   if (!must_set_method_annotations(config)) return;
-  for (const auto& cls : scope) {
+  walk::parallel::classes(scope, [&](DexClass* cls) {
     auto anno_set = cls->get_anno_set();
-    if (anno_set == nullptr) continue;
+    if (anno_set == nullptr) return;
     for (auto& anno : anno_set->get_annotations()) {
       if (anno->type() != enclosingMethod) continue;
       const auto& elems = anno->anno_elems();
@@ -423,7 +423,7 @@ void OptimizationImpl::rewrite_annotations(Scope& scope, const SingleImplConfig&
         }
       }
     }
-  }
+  });
 }
 
 /**
@@ -24,93 +24,25 @@
 #include "ReachableClasses.h"
 #include "Walkers.h"
 #include "Warning.h"
+#include "WorkQueue.h"
 #include "ClassHierarchy.h"
+#include "HierarchyCache.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace {
 
 /*
- * Parse a string representing a type list.  Assumes the same format used by dexdump, e.g.,
- * "[[ILjava/lang/String;B" would become (int[][], String, boolean)
+ * The coldstart methods that are defined, warning about the others.
  */
-DexTypeList* parse_type_list_string(const char* str) {
-  std::deque<DexType*> type_list;
-  const char* p = str;
-  while (*p != '\0') {
-    if (*p == 'L') {
-      auto end = strchr(p, ';');
-      type_list.push_back(
-        DexType::get_type(std::string(p, end - p + 1).c_str()));
-      p = end + 1;
-    } else if (*p == '[') {
-      auto end = p + 1;
-      while (*end == '[') {
-        end++;
-      }
-      if (*end == 'L') {
-        auto clsend = strchr(end, ';');
-        type_list.push_back(
-          DexType::get_type(std::string(p, clsend - p + 1).c_str()));
-        p = clsend + 1;
-      } else {
-        type_list.push_back(
-          DexType::get_type(std::string(p, end - p + 1).c_str()));
-        p = end + 1;
-      }
-    } else {
-      type_list.push_back(DexType::get_type(std::string(p, 1).c_str()));
-      p++;
-    }
-    // check if any get_type generated a nullptr
-    if (type_list.back() == nullptr) {
-      return nullptr;
-    }
-  }
-  return DexTypeList::make_type_list(std::move(type_list));
-}
-
-/*
- * Parse a vector of strings into the corresponding DexMethods.
- */
-std::unordered_set<DexMethod*> strings_to_dexmethods(
-  std::vector<std::string> method_list
-) {
+std::unordered_set<DexMethod*> get_coldstart_methods(ConfigFiles& cfg) {
+  const auto& method_list = cfg.get_coldstart_methods();
+  const auto& refs = cfg.get_coldstart_method_refs();
   std::unordered_set<DexMethod*> methods;
-  for (auto const& mstr : method_list) {
-    // Format: class.method(arglist)rtype
-    auto dot = mstr.find('.');
-    auto lparen = mstr.find('(');
-    auto rparen = mstr.find(')');
-
-    if (dot == std::string::npos ||
-        lparen == std::string::npos ||
-        rparen == std::string::npos) {
-      opt_warn(COLDSTART_STATIC, "%s\n", mstr.c_str());
-      continue;
-    }
-    auto classpart = mstr.substr(0, dot);
-    auto methodpart = mstr.substr(dot + 1, lparen - dot - 1);
-    auto arglistpart = mstr.substr(lparen + 1, rparen - lparen - 1);
-    auto rtypepart = mstr.substr(rparen + 1, mstr.length() - rparen - 1);
-
-    auto classtype = DexType::get_type(classpart.c_str());
-    auto methodname = DexString::get_string(methodpart.c_str());
-    auto arglist = parse_type_list_string(arglistpart.c_str());
-    auto rtype = DexType::get_type(rtypepart.c_str());
-
-    if (!classtype || !methodname || !arglist || !rtype) {
-      opt_warn(COLDSTART_STATIC, "%s\n", mstr.c_str());
-      continue;
-    }
-    auto proto = DexProto::get_proto(rtype, arglist);
-    if (!proto) {
-      opt_warn(COLDSTART_STATIC, "%s\n", mstr.c_str());
-      continue;
-    }
-    auto method = DexMethod::get_method(classtype, methodname, proto);
+  for (size_t i = 0; i < refs.size(); ++i) {
+    auto method = refs[i];
     if (!method || !method->is_def()) {
-      opt_warn(COLDSTART_STATIC, "%s\n", mstr.c_str());
+      opt_warn(COLDSTART_STATIC, "%s\n", method_list[i].c_str());
       continue;
     }
     methods.insert(static_cast<DexMethod*>(method));
@@ -122,17 +54,15 @@ std::vector<DexClass*> get_coldstart_classes(
   const DexClassesVector& dexen,
   ConfigFiles& cfg
 ) {
-  auto interdex_list = cfg.get_coldstart_classes();
-  std::unordered_map<std::string, DexClass*> class_string_map;
-  std::vector<DexClass*> coldstart_classes;
+  std::unordered_set<const DexClass*> classes;
   for (auto const& dex : dexen) {
-    for (auto const& cls : dex) {
-      class_string_map[std::string(cls->get_type()->get_name()->c_str())] = cls;
-    }
+    classes.insert(dex.begin(), dex.end());
   }
-  for (auto const& class_string : interdex_list) {
-    if (class_string_map.count(class_string)) {
-      coldstart_classes.push_back(class_string_map[class_string]);
+  std::vector<DexClass*> coldstart_classes;
+  for (auto type : cfg.get_coldstart_types()) {
+    auto cls = type != nullptr ? type_class(type) : nullptr;
+    if (cls != nullptr && classes.count(cls)) {
+      coldstart_classes.push_back(cls);
     }
   }
   return coldstart_classes;
@@ -163,27 +93,95 @@ std::vector<DexMethod*> get_noncoldstart_statics(
   return noncold_methods;
 }
 
-void remove_primary_dex_refs(
-    const DexClasses& primary_dex,
-    std::vector<DexMethod*>& statics) {
-  std::unordered_set<DexMethod*> ref_set;
-  walk::opcodes(
-    primary_dex,
-    [](DexMethod*) { return true; },
-    [&](DexMethod*, IRInstruction* insn) {
-      if (insn->has_method()) {
-        auto callee =
-            resolve_method(insn->get_method(), opcode_to_search(insn));
-        if (callee != nullptr) {
-          ref_set.insert(callee);
-        }
+/*
+ * The methods called from the code of the scope, resolved once in a single
+ * walk so that the sink candidates can be filtered with lookups rather than by
+ * rescanning the code for every question asked.
+ */
+struct CalleeIndex {
+  // The methods referenced from the primary dex.
+  std::unordered_set<DexMethod*> primary_dex_refs;
+  // For every callee, the position in the scope of the first class that may
+  // host it, i.e. a public class outside of the coldstart set calling it.
+  std::unordered_map<DexMethod*, size_t> first_sink_caller;
+
+  void merge(const CalleeIndex& that) {
+    primary_dex_refs.insert(that.primary_dex_refs.begin(),
+                            that.primary_dex_refs.end());
+    for (const auto& pair : that.first_sink_caller) {
+      auto it = first_sink_caller.emplace(pair);
+      if (!it.second && pair.second < it.first->second) {
+        it.first->second = pair.second;
       }
     }
-  );
+  }
+};
+
+CalleeIndex build_callee_index(const Scope& scope,
+                               const DexClasses& primary_dex,
+                               const std::vector<DexClass*>& coldstart_classes) {
+  std::unordered_set<DexClass*> primary_set(primary_dex.begin(),
+                                            primary_dex.end());
+  std::unordered_set<DexClass*> coldstart_set(coldstart_classes.begin(),
+                                              coldstart_classes.end());
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<CalleeIndex> indices(num_threads);
+  auto wq = WorkQueue<size_t, CalleeIndex*, std::nullptr_t>(
+      [&](CalleeIndex*& index, size_t pos) -> std::nullptr_t {
+        auto cls = scope[pos];
+        bool in_primary_dex = primary_set.count(cls) != 0;
+        bool can_sink_into = coldstart_set.count(cls) == 0 && is_public(cls);
+        if (!in_primary_dex && !can_sink_into) {
+          return nullptr;
+        }
+        for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+          for (auto m : *methods) {
+            auto code = m->get_code();
+            if (code == nullptr) continue;
+            for (const auto& mie : InstructionIterable(code)) {
+              auto insn = mie.insn;
+              if (!insn->has_method()) continue;
+              auto callee = resolve_method_cached(insn->get_method(),
+                                                  opcode_to_search(insn));
+              if (callee == nullptr) continue;
+              if (in_primary_dex) {
+                index->primary_dex_refs.insert(callee);
+              }
+              if (can_sink_into) {
+                // Classes are visited in any order, the first one in the
+                // scope wins when the indices are merged.
+                auto it = index->first_sink_caller.emplace(callee, pos);
+                if (!it.second && pos < it.first->second) {
+                  it.first->second = pos;
+                }
+              }
+            }
+          }
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &indices[thread_idx]; },
+      num_threads);
+  for (size_t pos = 0; pos < scope.size(); ++pos) {
+    wq.add_item(pos);
+  }
+  wq.run_all();
+
+  CalleeIndex result;
+  for (const auto& index : indices) {
+    result.merge(index);
+  }
+  return result;
+}
+
+void remove_primary_dex_refs(
+    const CalleeIndex& index,
+    std::vector<DexMethod*>& statics) {
   statics.erase(
     std::remove_if(
       statics.begin(), statics.end(),
-      [&](DexMethod* m) { return ref_set.count(m); }),
+      [&](DexMethod* m) { return index.primary_dex_refs.count(m); }),
     statics.end());
 }
 
@@ -327,29 +325,16 @@ DexClass* move_statics_out(
 }
 
 std::unordered_map<DexMethod*, DexClass*> get_sink_map(
-    DexStoresVector& stores,
-    const std::vector<DexClass*>& classes,
+    const Scope& scope,
+    const CalleeIndex& index,
     const std::vector<DexMethod*>& statics) {
   std::unordered_map<DexMethod*, DexClass*> statics_to_callers;
-  std::unordered_set<DexClass*> class_set(classes.begin(), classes.end());
-  std::unordered_set<DexMethod*> static_set(statics.begin(), statics.end());
-  auto scope = build_class_scope(stores);
-  walk::opcodes(
-    scope,
-    [&](DexMethod* m) {
-      auto cls = type_class(m->get_class());
-      return class_set.count(cls) == 0 && is_public(cls);
-    },
-    [&](DexMethod* m, IRInstruction* insn) {
-      if (insn->has_method()) {
-        auto callee =
-            resolve_method(insn->get_method(), opcode_to_search(insn));
-        if (callee != nullptr && static_set.count(callee)) {
-          statics_to_callers[callee] = type_class(m->get_class());
-        }
-      }
+  for (auto meth : statics) {
+    auto it = index.first_sink_caller.find(meth);
+    if (it != index.first_sink_caller.end()) {
+      statics_to_callers[meth] = scope[it->second];
     }
-  );
+  }
   return statics_to_callers;
 }
 
@@ -378,18 +363,19 @@ void StaticSinkPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassMan
     TRACE(SINK, 1, "StaticSinkPass not run because no ProGuard configuration was provided.");
     return;
   }
-  ClassHierarchy ch = build_type_hierarchy(build_class_scope(stores));
+  const auto& ch = mgr.get_hierarchy_cache().get_class_hierarchy();
   DexClassesVector& root_store = stores[0].get_dexen();
-  auto method_list = cfg.get_coldstart_methods();
-  auto methods = strings_to_dexmethods(method_list);
+  auto methods = get_coldstart_methods(cfg);
   TRACE(SINK, 1, "methods used in coldstart: %lu\n", methods.size());
   auto coldstart_classes = get_coldstart_classes(root_store, cfg);
   count_coldstart_statics(coldstart_classes);
   auto statics = get_noncoldstart_statics(coldstart_classes, methods);
   TRACE(SINK, 1, "statics not used in coldstart: %lu\n", statics.size());
-  remove_primary_dex_refs(root_store[0], statics);
+  auto scope = build_class_scope(stores);
+  auto index = build_callee_index(scope, root_store[0], coldstart_classes);
+  remove_primary_dex_refs(index, statics);
   TRACE(SINK, 1, "statics after removing primary dex: %lu\n", statics.size());
-  auto sink_map = get_sink_map(stores, coldstart_classes, statics);
+  auto sink_map = get_sink_map(scope, index, statics);
   TRACE(SINK, 1, "statics with sinkable callsite: %lu\n", sink_map.size());
   auto holder = move_statics_out(ch, statics, sink_map);
   TRACE(SINK, 1, "methods in static holder: %lu\n",
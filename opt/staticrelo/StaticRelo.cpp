@@ -28,6 +28,7 @@
 #include "Match.h"
 #include "ConfigFiles.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -52,43 +53,6 @@ using refs_t = std::unordered_map<
 /** all relocation candidate classes */
 using candidates_t = std::set<DexClass*, dexclasses_comparator>;
 
-/**
- * Helper to visit all classes which match the given criteria.
- *
- * @param scope all classes we're processing
- * @param p A match_t<DexClass, ...> built up by m::* routines
- * @param v Visitor function
- */
-template<typename P, typename V = void(DexClass*)>
-void visit_classes(
-  const Scope& scope, const m::match_t<DexClass, P>& p, const V& v) {
-  for (const auto& cls : scope) {
-    if (p.matches(cls)) {
-      v(cls);
-    }
-  }
-}
-
-/**
- * Helper to visit all opcodes which match the given criteria.
- *
- * @param scope all classes we're processing
- * @param p A match_t<IRInstruction, ...> built up by m::* routines
- * @param v Visitor function
- */
-template<typename P, typename V = void(DexMethod*, IRInstruction*)>
-void visit_opcodes(
-  const Scope& scope, const m::match_t<IRInstruction, P>& p, const V& v) {
-  walk::opcodes(
-    scope,
-    [](const DexMethod*) { return true; },
-    [&](const DexMethod* m, IRInstruction* insn) {
-      if (p.matches(insn)) {
-        v(m, insn);
-      }
-    });
-}
-
 /**
  * Helper to build a map of DexClass* -> dex index
  *
@@ -117,26 +81,33 @@ std::unordered_map<const DexClass*, size_t> build_class_to_dex_map(
 std::unordered_map<const DexClass*, size_t> build_class_to_pgo_order_map(
   const DexClassesVector& dexen,
   ConfigFiles& cfg) {
-  auto interdex_list = cfg.get_coldstart_classes();
-  std::unordered_map<std::string, DexClass*> class_string_map;
-  std::unordered_map<const DexClass*, size_t> coldstart_classes;
+  std::unordered_set<const DexClass*> classes;
   for (auto const& dex : dexen) {
-    for (auto const& cls : dex) {
-      class_string_map[std::string(cls->get_type()->get_name()->c_str())] = cls;
-    }
+    classes.insert(dex.begin(), dex.end());
   }
+  std::unordered_map<const DexClass*, size_t> coldstart_classes;
   int rank = 0;
-  for (auto const& class_string : interdex_list) {
-    if (class_string_map.count(class_string)) {
-      coldstart_classes[class_string_map[class_string]] = rank++;
+  for (auto type : cfg.get_coldstart_types()) {
+    auto cls = type != nullptr ? type_class(type) : nullptr;
+    if (cls != nullptr && classes.count(cls)) {
+      coldstart_classes[cls] = rank++;
     }
   }
   return coldstart_classes;
 }
 
+/** Refs found by one worker of build_refs */
+struct Refs {
+  refs_t<DexMethodRef> dmethod_refs;
+  refs_t<DexClass> class_refs;
+  std::unordered_set<DexClass*> referenced_types;
+};
+
 /**
  * Helper function that scans all the bytecode in the application and
  * builds up two maps. Map goes from method/class to vector of its refs.
+ * Each worker fills in its own maps, which are merged at the end. The refs
+ * of a method or class thus aren't in any particular order.
  *
  * @param scope all classes we're processing
  * @param dmethod_refs [out] all refs to dmethods in the application
@@ -154,26 +125,61 @@ void build_refs(
     m::invoke_static()
     || m::invoke_direct()
     || m::has_type();
-  visit_opcodes(scope, match, [&](const DexMethod* meth, IRInstruction* insn){
-    if (insn->has_type()) {
-      const auto tref = type_class(insn->get_type());
-      if (tref) class_refs[tref].push_back(std::make_pair(meth, insn));
-    } else {
-      const auto mref = insn->get_method();
-      dmethod_refs[mref].push_back(std::make_pair(meth, insn));
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<Refs> locals(num_threads);
+  auto visit_method = [&match](Refs& refs, const DexMethod* meth) {
+    auto code = meth->get_code();
+    if (code == nullptr) return;
+    for (const auto& mie : InstructionIterable(code)) {
+      auto insn = mie.insn;
+      if (!match.matches(insn)) continue;
+      if (insn->has_type()) {
+        const auto tref = type_class(insn->get_type());
+        if (tref) refs.class_refs[tref].push_back(std::make_pair(meth, insn));
+      } else {
+        const auto mref = insn->get_method();
+        refs.dmethod_refs[mref].push_back(std::make_pair(meth, insn));
+      }
     }
-  });
-  // collect all exceptions and add to the set of references for the app
-  walk::code(scope,
-      [&](DexMethod* method, IRCode& code) {
-        std::vector<DexType*> exceptions;
-        code.gather_catch_types(exceptions);
-        for (const auto& exception : exceptions) {
-          auto cls = type_class(exception);
-          if (cls == nullptr || cls->is_external()) continue;
-          referenced_types.insert(cls);
+    // collect all exceptions and add to the set of references for the app
+    std::vector<DexType*> exceptions;
+    code->gather_catch_types(exceptions);
+    for (const auto& exception : exceptions) {
+      auto cls = type_class(exception);
+      if (cls == nullptr || cls->is_external()) continue;
+      refs.referenced_types.insert(cls);
+    }
+  };
+  auto wq = WorkQueue<DexClass*, Refs*, std::nullptr_t>(
+      [&](Refs*& refs, DexClass* cls) -> std::nullptr_t {
+        for (auto meth : cls->get_dmethods()) {
+          visit_method(*refs, meth);
         }
-      });
+        for (auto meth : cls->get_vmethods()) {
+          visit_method(*refs, meth);
+        }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &locals[thread_idx]; },
+      num_threads);
+  for (auto cls : scope) {
+    wq.add_item(cls);
+  }
+  wq.run_all();
+
+  for (auto& local : locals) {
+    for (auto& it : local.dmethod_refs) {
+      auto& refs = dmethod_refs[it.first];
+      refs.insert(refs.end(), it.second.begin(), it.second.end());
+    }
+    for (auto& it : local.class_refs) {
+      auto& refs = class_refs[it.first];
+      refs.insert(refs.end(), it.second.begin(), it.second.end());
+    }
+    referenced_types.insert(local.referenced_types.begin(),
+                            local.referenced_types.end());
+  }
 }
 
 /**
@@ -225,10 +231,20 @@ candidates_t build_candidates(
     && !m::any_annos<DexClass>(
         m::as_type<DexAnnotation>(m::in<DexType>(dont_optimize_annos)));
 
-  visit_classes(scope, match, [&](DexClass* cls){
-    TRACE(RELO, 5, "RELO %s is a candidate\n", SHOW(cls->get_type()));
-    candidates.insert(cls);
-  });
+  // Matching only reads the classes, so do it in parallel and collect the
+  // candidates in scope order afterwards.
+  std::vector<char> is_candidate(scope.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { is_candidate[i] = match.matches(scope[i]); });
+  for (size_t i = 0; i < scope.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  for (size_t i = 0; i < scope.size(); ++i) {
+    if (!is_candidate[i]) continue;
+    TRACE(RELO, 5, "RELO %s is a candidate\n", SHOW(scope[i]->get_type()));
+    candidates.insert(scope[i]);
+  }
 
   return candidates;
 }
@@ -425,39 +441,32 @@ void make_references_public(const DexMethod* from_meth) {
   }
 }
 
+/** The mutations for the candidates of one dex */
+struct Mutations {
+  std::unordered_map<DexMethod*, DexClass*> meth_moves;
+  std::unordered_set<DexMethod*> meth_deletes;
+  std::unordered_set<DexClass*> cls_deletes;
+  size_t relocations{0};
+  int could_not_move{0};
+  int single_ref_total{0};
+};
+
 /**
- * Builds all the mutations we'll make for relocation (method moves, method
- * deletes, class deletes).
- *
- * @param candidates Set of relocation candidates
- * @param dmethod_refs All references to dmethods in the entire program, used
- *        to find candidate call sites for relocation
- * @param cls_to_pgo_order Map of class -> cold start load rank
- * @param cls_to_dex Map of class -> dex index
- * @param meth_moves [out] Map of methods to move and what class to move to
- * @param meth_deletes [out] Set of methods to delete outright
- * @param cls_deletes [out] Set of classes to delete outright
+ * Builds the mutations for the candidates of a single dex, all of which
+ * relocate to the same default target.
  */
- void build_mutations(
-  const candidates_t& candidates,
+void build_dex_mutations(
+  const std::vector<DexClass*>& candidates,
+  DexClass* default_relocation_target,
   const refs_t<DexMethodRef>& dmethod_refs,
   const std::unordered_map<const DexClass*, size_t>& cls_to_pgo_order,
   const std::unordered_map<const DexClass*, size_t>& cls_to_dex,
-  const std::unordered_map<size_t, DexClass*>& dex_to_target,
-  std::unordered_map<DexMethod*, DexClass*>& meth_moves,
-  std::unordered_set<DexMethod*>& meth_deletes,
-  std::unordered_set<DexClass*>& cls_deletes) {
-  std::unordered_map<DexClass*, size_t> target_relocations;
+  Mutations& mutations) {
   std::unordered_map<DexClass*, std::vector<DexMethod*> > target_methods;
-  // Load the targets' existing methods into target_methods
-  for (auto it : dex_to_target) {
-    DexClass* target = it.second;
-    add_target_methods(target, target_methods);
-  }
+  // Load the target's existing methods into target_methods
+  add_target_methods(default_relocation_target, target_methods);
   for (DexClass* cls : candidates) {
     // If we're a relocation target, completely skip us.
-    DexClass* default_relocation_target = dex_to_target.at(cls_to_dex.at(cls));
-    always_assert(default_relocation_target);
     if (default_relocation_target == cls) {
       TRACE(RELO, 5, "RELO %s is a relo target - not deleting\n", SHOW(cls));
       continue;
@@ -472,17 +481,17 @@ void make_references_public(const DexMethod* from_meth) {
 
       if (dmethod_refs.find(meth) == dmethod_refs.end()) {
         // If the method is unreferenced, it may be deleted
-        meth_deletes.insert(meth);
+        mutations.meth_deletes.insert(meth);
         TRACE(RELO, 5, "RELO %s is unreferenced; deleting\n", SHOW(meth));
       } else {
         // Count single call site opportunities
         if (dmethod_refs.at(meth).size() == 1) {
-          s_single_ref_total_count++;
+          mutations.single_ref_total++;
         }
         // We need to make any references in the candidate public; if we can't,
         // then we can't move the class.
         if (!can_make_references_public(meth)) {
-          s_meth_could_not_move_count++;
+          mutations.could_not_move++;
           can_delete_class = false;
           continue;
         }
@@ -497,7 +506,7 @@ void make_references_public(const DexMethod* from_meth) {
           cls_to_dex,
           target_methods);
         if (!relocation_target) {
-          s_meth_could_not_move_count++;
+          mutations.could_not_move++;
           set_public(meth);
           can_delete_class = false;
           continue;
@@ -506,22 +515,82 @@ void make_references_public(const DexMethod* from_meth) {
             "Relocation target %s has no class data\n",
             SHOW(relocation_target->get_type()));
         target_methods[relocation_target].push_back(meth);
-        meth_moves[meth] = relocation_target;
-        target_relocations[relocation_target]++;
+        mutations.meth_moves[meth] = relocation_target;
+        mutations.relocations++;
       }
     }
     if (can_delete_class) {
-      cls_deletes.insert(cls);
+      mutations.cls_deletes.insert(cls);
     }
   }
+}
+
+/**
+ * Builds all the mutations we'll make for relocation (method moves, method
+ * deletes, class deletes). Every dex has its own relocation target, so the
+ * dexes are processed in parallel.
+ *
+ * @param candidates Set of relocation candidates
+ * @param dmethod_refs All references to dmethods in the entire program, used
+ *        to find candidate call sites for relocation
+ * @param cls_to_pgo_order Map of class -> cold start load rank
+ * @param cls_to_dex Map of class -> dex index
+ * @param meth_moves [out] Map of methods to move and what class to move to
+ * @param meth_deletes [out] Set of methods to delete outright
+ * @param cls_deletes [out] Set of classes to delete outright
+ */
+ void build_mutations(
+  const candidates_t& candidates,
+  const refs_t<DexMethodRef>& dmethod_refs,
+  const std::unordered_map<const DexClass*, size_t>& cls_to_pgo_order,
+  const std::unordered_map<const DexClass*, size_t>& cls_to_dex,
+  const std::unordered_map<size_t, DexClass*>& dex_to_target,
+  std::unordered_map<DexMethod*, DexClass*>& meth_moves,
+  std::unordered_set<DexMethod*>& meth_deletes,
+  std::unordered_set<DexClass*>& cls_deletes) {
+  std::map<size_t, std::vector<DexClass*>> dex_candidates;
+  for (DexClass* cls : candidates) {
+    dex_candidates[cls_to_dex.at(cls)].push_back(cls);
+  }
+  std::map<size_t, Mutations> dex_mutations;
+  for (const auto& it : dex_candidates) {
+    dex_mutations[it.first];
+  }
+  auto wq = workqueue_foreach<size_t>([&](size_t dex) {
+    DexClass* default_relocation_target = dex_to_target.at(dex);
+    always_assert(default_relocation_target);
+    build_dex_mutations(dex_candidates.at(dex),
+                        default_relocation_target,
+                        dmethod_refs,
+                        cls_to_pgo_order,
+                        cls_to_dex,
+                        dex_mutations.at(dex));
+  });
+  for (const auto& it : dex_candidates) {
+    wq.add_item(it.first, it.second.size());
+  }
+  wq.run_all();
 
   // Calculate avg and max relocation load
   float total_relocations = 0.0f;
-  for (const auto& kv : target_relocations) {
-    total_relocations += kv.second;
-    s_max_relocation_load = std::max(kv.second, s_max_relocation_load);
+  float target_relocations_count = 0.0f;
+  for (auto& it : dex_mutations) {
+    auto& mutations = it.second;
+    meth_moves.insert(mutations.meth_moves.begin(),
+                      mutations.meth_moves.end());
+    meth_deletes.insert(mutations.meth_deletes.begin(),
+                        mutations.meth_deletes.end());
+    cls_deletes.insert(mutations.cls_deletes.begin(),
+                       mutations.cls_deletes.end());
+    s_meth_could_not_move_count += mutations.could_not_move;
+    s_single_ref_total_count += mutations.single_ref_total;
+    if (mutations.relocations > 0) {
+      total_relocations += mutations.relocations;
+      target_relocations_count++;
+      s_max_relocation_load =
+          std::max(mutations.relocations, s_max_relocation_load);
+    }
   }
-  float target_relocations_count = target_relocations.size();
   s_avg_relocation_load = target_relocations_count ?
     total_relocations/target_relocations_count : 0.0f;
 }
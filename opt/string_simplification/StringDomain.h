@@ -12,7 +12,9 @@
 #include <algorithm>
 #include <boost/optional.hpp>
 #include <iostream>
+#include <limits>
 #include <tuple>
+#include <vector>
 
 #include "AbstractDomain.h"
 #include "HashedSetAbstractDomain.h"
@@ -20,11 +22,17 @@
 #include "ReducedProductAbstractDomain.h"
 #include "SimpleValueAbstractDomain.h"
 
-using string_register_t = uint16_t;
+using string_register_t = uint32_t;
 using pointer_reference_t = uint32_t;
 
+// The result of an invoke, or of an instruction followed by a
+// move-result-pseudo.
+constexpr string_register_t RESULT_REGISTER =
+    std::numeric_limits<string_register_t>::max();
+
 /**
- * This class represents constant strings living in the following lattice:
+ * This class represents the contents of strings and StringBuilders living in
+ * the following lattice:
  *                           T ( Any string e.g some unknown variable )
  *
  *                  /        |         \
@@ -35,11 +43,13 @@ using pointer_reference_t = uint32_t;
  *
  *                          _|_ ( Invalid configuration )
  *
- * e.g. String s = x + "const"; where x is a different string and "const"
- * is some constant that is appended to the right.  x is allowed to be
- * variable (unknown).  We can reconstruct s by taking the base register holding
- * x and then appending "const" to it.
+ * e.g. String s = "const" + x + "const2"; where x is a different string and
+ * "const", "const2" are constants that are appended around it.  x is allowed
+ * to be variable (unknown).  We can reconstruct s from the base register
+ * holding x, as long as that register isn't written in between.
  *
+ * A static string (a String rather than a StringBuilder) has no base and its
+ * whole value is in the suffix.
  */
 class StringyValue final : public AbstractValue<StringyValue> {
  public:
@@ -50,7 +60,9 @@ class StringyValue final : public AbstractValue<StringyValue> {
   Kind kind() const override { return Kind::Value; }
 
   bool equals(const StringyValue& other) const override {
-    return m_suffix == other.m_suffix && m_base_reg == other.m_base_reg;
+    return m_prefix == other.m_prefix && m_suffix == other.m_suffix &&
+           m_base_reg == other.m_base_reg &&
+           m_static_string == other.m_static_string;
   }
 
   bool leq(const StringyValue& other) const override { return equals(other); }
@@ -81,6 +93,8 @@ class StringyValue final : public AbstractValue<StringyValue> {
 
   bool is_static_string() const { return m_static_string; }
 
+  std::string prefix() const { return m_prefix; }
+
   std::string suffix() const { return m_suffix; }
 
   bool has_base() const { return (m_base_reg) ? true : false; }
@@ -89,12 +103,15 @@ class StringyValue final : public AbstractValue<StringyValue> {
 
   StringyValue(std::string suffix = "",
                boost::optional<string_register_t> base_reg = boost::none,
-               bool static_string = false)
-      : m_suffix(suffix),
+               bool static_string = false,
+               std::string prefix = "")
+      : m_prefix(prefix),
+        m_suffix(suffix),
         m_base_reg(base_reg),
         m_static_string(static_string) {}
 
  private:
+  std::string m_prefix;
   std::string m_suffix;
   boost::optional<string_register_t> m_base_reg;
   bool m_static_string;
@@ -106,7 +123,7 @@ inline std::ostream& operator<<(std::ostream& o, const StringyValue& sv) {
   } else {
     o << "builder[";
     if (sv.has_base()) {
-      o << "v" << sv.base() << "+";
+      o << '"' << sv.prefix() << "\"+v" << sv.base() << "+";
     }
     o << '"' << sv.suffix() << "\"]";
   }
@@ -127,28 +144,37 @@ class StringyDomain final
   static StringyDomain value(
       std::string suffix,
       boost::optional<string_register_t> base = boost::none,
-      bool is_static_string = false) {
+      bool is_static_string = false,
+      std::string prefix = "") {
     StringyDomain result;
-    result.set_to_value(StringyValue(suffix, base, is_static_string));
+    result.set_to_value(StringyValue(suffix, base, is_static_string, prefix));
     return result;
   }
 
-  static StringyDomain append(StringyDomain original,
-                              boost::optional<string_register_t> reg,
-                              std::string suffix) {
-    if (original.is_top()) {
-      return StringyDomain::value(suffix, reg);
-    } else if (original.is_bottom()) {
-      return StringyDomain::bottom();
-    } else {
-      always_assert(!original.value().is_static_string());
-      StringyDomain result;
-      result.set_to_value(StringyValue(
-          std::string(original.value().suffix()) + std::string(suffix),
-          original.value().m_base_reg,
-          original.value().m_static_string));
-      return result;
+  // The contents of the StringBuilder `original` followed by the constant
+  // `suffix`.
+  static StringyDomain append(StringyDomain original, std::string suffix) {
+    if (!original.is_value()) {
+      return original;
+    }
+    const auto& value = original.value();
+    always_assert(!value.is_static_string());
+    return StringyDomain::value(
+        value.suffix() + suffix, value.m_base_reg, false, value.prefix());
+  }
+
+  // The contents of the StringBuilder `original` followed by the unknown
+  // String held in `reg`. Only one of those is tracked per StringBuilder.
+  static StringyDomain append(StringyDomain original, string_register_t reg) {
+    if (!original.is_value()) {
+      return original;
+    }
+    const auto& value = original.value();
+    always_assert(!value.is_static_string());
+    if (value.has_base()) {
+      return StringyDomain::top();
     }
+    return StringyDomain::value("", reg, false, value.suffix());
   }
 
   StringyDomain(AbstractValueKind kind = AbstractValueKind::Top)
@@ -176,19 +202,28 @@ using PointerReferenceEnvironment =
 using StringConstantEnvironment =
     PatriciaTreeMapAbstractEnvironment<pointer_reference_t, StringyDomain>;
 
+// The objects that may be referenced from somewhere the analysis doesn't see,
+// e.g. passed to a method or held by a register that it lost track of. Their
+// contents can change behind our back, and they can't be removed.
+using EscapedDomain = HashedSetAbstractDomain<pointer_reference_t>;
+
 // We need a layer of indirection to be able to solve the pointer analysis
 // during the string concatenation because multiple registers can point to the
-// same StringBuilder.
+// same StringBuilder. Objects are identified by the instruction that
+// allocated them, so that the pointers agree across blocks. All the objects
+// allocated by the same instruction share their abstract contents.
 class StringProdEnvironment final
     : public ReducedProductAbstractDomain<StringProdEnvironment,
                                           PointerReferenceEnvironment,
-                                          StringConstantEnvironment> {
+                                          StringConstantEnvironment,
+                                          EscapedDomain> {
  public:
   using ReducedProductAbstractDomain::ReducedProductAbstractDomain;
 
   static void reduce_product(
       std::tuple<PointerReferenceEnvironment,
-                 StringConstantEnvironment>& /* product */) {}
+                 StringConstantEnvironment,
+                 EscapedDomain>& /* product */) {}
 
   static StringProdEnvironment top() {
     StringProdEnvironment p;
@@ -202,6 +237,24 @@ class StringProdEnvironment final
     return p;
   }
 
+  // A register that holds an object on one side of a join and something else
+  // on the other side isn't tracked anymore, so the object escapes.
+  void join_with(const StringProdEnvironment& other) override {
+    auto lost = lost_objects(other);
+    ReducedProductAbstractDomain::join_with(other);
+    for (auto id : lost) {
+      escape(id);
+    }
+  }
+
+  void widen_with(const StringProdEnvironment& other) override {
+    auto lost = lost_objects(other);
+    ReducedProductAbstractDomain::widen_with(other);
+    for (auto id : lost) {
+      escape(id);
+    }
+  }
+
   StringyDomain eval(string_register_t reg) const {
     auto ptr = get<0>().get(reg);
     if (ptr.is_value()) {
@@ -210,29 +263,70 @@ class StringProdEnvironment final
     return StringyDomain::top();
   }
 
+  // Sets the contents of the object that `reg` points to, if any.
   void put(string_register_t reg, StringyDomain val) {
     auto ptr = get<0>().get(reg);
     if (!ptr.is_value()) {
-      create(reg);
+      return;
     }
-    auto id = get<0>().get(reg).value();
+    auto id = ptr.value();
     apply<1>([=](auto env) { env->set(id, val); }, true);
   }
 
-  void create(string_register_t reg) {
-    pointer_reference_t id = new_pointer();
-    apply<0>([=](auto env) { env->set(reg, PointerDomain::value(id)); }, true);
+  // Points the result register to a new object allocated by `id`. If older
+  // objects allocated by `id` are still held by some register, they share
+  // their contents with the new one.
+  void allocate(pointer_reference_t id, StringyDomain val) {
+    if (is_held(id)) {
+      escape(id);
+      val.join_with(get<1>().get(id));
+    }
+    apply<0>(
+        [=](auto env) {
+          env->set(RESULT_REGISTER, PointerDomain::value(id));
+        },
+        true);
+    apply<1>([=](auto env) { env->set(id, val); }, true);
   }
 
   void move(string_register_t dest, string_register_t src) {
-    apply<0>([=](auto env) { env->set(dest, env->get(src)); }, true);
+    auto ptr = get<0>().get(src);
+    write(dest);
+    apply<0>([=](auto env) { env->set(dest, ptr); }, true);
   }
 
   void clear(string_register_t reg) {
+    write(reg);
     apply<0>([=](auto env) { env->set(reg, PointerDomain::top()); }, true);
   }
 
-  bool is_tracked(string_register_t reg) {
+  // Forgets `reg` without writing it, e.g. because it is dead.
+  void forget(string_register_t reg) {
+    apply<0>([=](auto env) { env->set(reg, PointerDomain::top()); }, true);
+  }
+
+  void escape(pointer_reference_t id) {
+    apply<2>([=](auto set) { set->add(id); }, true);
+  }
+
+  // The object that `reg` points to escapes, unless it is a String, which
+  // can't change anyway.
+  void escape_register(string_register_t reg) {
+    auto ptr = get<0>().get(reg);
+    if (!ptr.is_value()) {
+      return;
+    }
+    auto val = get<1>().get(ptr.value());
+    if (!val.is_value() || !val.value().is_static_string()) {
+      escape(ptr.value());
+    }
+  }
+
+  bool is_escaped(pointer_reference_t id) const {
+    return get<2>().contains(id);
+  }
+
+  bool is_tracked(string_register_t reg) const {
     return get<0>().get(reg).is_value();
   }
 
@@ -241,22 +335,63 @@ class StringProdEnvironment final
   }
 
  private:
-  // Create a new pointer to the object heap by finding the highest
-  // object id. (We need to scan both domains because some values can be top)
-  pointer_reference_t new_pointer() {
-    pointer_reference_t max = 0;
-    if (get<0>().is_value()) {
-      for (const auto& var : get<0>().bindings()) {
-        auto ptr = var.second;
-        max = std::max(max, ptr.value());
+  // Whether a register other than the result register points to `id`.
+  bool is_held(pointer_reference_t id) const {
+    if (!get<0>().is_value()) {
+      return false;
+    }
+    for (const auto& binding : get<0>().bindings()) {
+      if (binding.first != RESULT_REGISTER && binding.second.is_value() &&
+          binding.second.value() == id) {
+        return true;
       }
     }
-    if (get<1>().is_value()) {
-      for (const auto& var : get<1>().bindings()) {
-        auto ptr = var.first;
-        max = std::max(max, ptr);
+    return false;
+  }
+
+  // The contents that are built on top of the String in `reg` aren't known
+  // anymore once `reg` is written.
+  void write(string_register_t reg) {
+    if (!get<1>().is_value()) {
+      return;
+    }
+    std::vector<pointer_reference_t> stale;
+    for (const auto& binding : get<1>().bindings()) {
+      const auto& val = binding.second;
+      if (val.is_value() && val.value().has_base() &&
+          val.value().base() == reg) {
+        stale.push_back(binding.first);
       }
     }
-    return max + 1;
+    for (auto id : stale) {
+      apply<1>([=](auto env) { env->set(id, StringyDomain::top()); }, true);
+    }
+  }
+
+  // The objects held by a register on one side of the join with `other` and
+  // not on the other side.
+  std::vector<pointer_reference_t> lost_objects(
+      const StringProdEnvironment& other) const {
+    std::vector<pointer_reference_t> lost;
+    if (is_bottom() || other.is_bottom()) {
+      return lost;
+    }
+    auto collect = [&lost](const StringProdEnvironment& from,
+                           const StringProdEnvironment& to) {
+      if (!from.get<0>().is_value()) {
+        return;
+      }
+      for (const auto& binding : from.get<0>().bindings()) {
+        const auto& ptr = binding.second;
+        if (binding.first == RESULT_REGISTER || !ptr.is_value() ||
+            to.get<0>().get(binding.first).equals(ptr)) {
+          continue;
+        }
+        lost.push_back(ptr.value());
+      }
+    };
+    collect(*this, other);
+    collect(other, *this);
+    return lost;
   }
 };
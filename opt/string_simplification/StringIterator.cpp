@@ -9,6 +9,7 @@
 
 #include "DexAsm.h"
 #include "DexInstruction.h"
+#include "Resolver.h"
 
 #include "StringIterator.h"
 
@@ -22,59 +23,87 @@ static const std::string showd(const T& val) {
   return ss.str();
 }
 
-FatMethod::iterator next_insn(FatMethod::iterator it) {
-  auto future = std::next(it);
-  while (future->type != MFLOW_OPCODE) {
-    future = std::next(future);
+// The move-result that follows the invoke at `it`, if any. It is not
+// necessarily in the same block.
+static boost::optional<FatMethod::iterator> move_result_of(
+    FatMethod::iterator it, const FatMethod::iterator& end) {
+  for (++it; it != end; ++it) {
+    if (it->type == MFLOW_OPCODE) {
+      if (it->insn->opcode() == OPCODE_MOVE_RESULT_OBJECT) {
+        return it;
+      }
+      break;
+    }
   }
-  return future;
+  return boost::none;
 }
 
-FatMethod::iterator next_insn(FatMethod::iterator it, Block* blk) {
-  auto future = std::next(it);
-  while (future->type != MFLOW_OPCODE && future != blk->end()) {
-    future = std::next(future);
+StringIterator::StringIterator(IRCode* code, const KnownStrings& known_strings)
+    : MonotonicFixpointIterator(code->cfg(), code->cfg().blocks().size()),
+      m_code(code),
+      m_known_strings(known_strings),
+      m_builder_type(DexType::make_type(STRINGBUILDER_DEF)),
+      m_empty_init_method(
+          DexMethod::make_method(STRINGBUILDER_DEF, "<init>", "V", {})),
+      m_string_init_method(DexMethod::make_method(
+          STRINGBUILDER_DEF, "<init>", "V", {STRING_DEF})),
+      m_append_method(DexMethod::make_method(
+          STRINGBUILDER_DEF, "append", STRINGBUILDER_DEF, {STRING_DEF})),
+      m_to_string_method(DexMethod::make_method(
+          STRINGBUILDER_DEF, "toString", STRING_DEF, {})),
+      m_value_of_method(DexMethod::make_method(
+          STRING_DEF, "valueOf", STRING_DEF, {"Ljava/lang/Object;"})),
+      m_concat_method(DexMethod::make_method(
+          STRING_DEF, "concat", STRING_DEF, {STRING_DEF})) {
+  pointer_reference_t next_id = 0;
+  for (const auto& mie : InstructionIterable(code)) {
+    auto insn = mie.insn;
+    if (string_of(insn) != nullptr || is_sb_new_instance(insn) ||
+        is_sb_to_string(insn)) {
+      m_sites.emplace(insn, next_id++);
+    }
   }
-  return future;
+  m_liveness =
+      std::make_unique<regalloc::LivenessFixpointIterator>(code->cfg());
+  m_liveness->run(regalloc::LivenessDomain(code->get_registers_size()));
 }
 
-FatMethod::iterator prev_insn(FatMethod::iterator it) {
-  auto past = std::prev(it);
-  while (past->type != MFLOW_OPCODE) {
-    past = std::prev(past);
+Environment StringIterator::analyze_edge(
+    const std::shared_ptr<cfg::Edge>& edge,
+    const Environment& exit_state_at_source) const {
+  auto env = exit_state_at_source;
+  if (!env.get<0>().is_value()) {
+    return env;
   }
-  return past;
-}
-
-bool eq(const PointerDomain& a, const PointerDomain& b) {
-  if (a.is_top()) {
-    return b.is_top();
-  } else if (a.is_bottom()) {
-    return b.is_bottom();
-  } else {
-    return a.value() == b.value();
+  auto live = m_liveness->get_live_in_vars_at(edge->target());
+  std::vector<string_register_t> dead;
+  for (const auto& binding : env.get<0>().bindings()) {
+    if (binding.first != RESULT_REGISTER && !live.contains(binding.first)) {
+      dead.push_back(binding.first);
+    }
+  }
+  for (auto reg : dead) {
+    env.forget(reg);
   }
+  return env;
 }
 
-void StringIterator::analyze_instruction(const NodeId blk,
-                                         FatMethod::iterator& it,
+void StringIterator::analyze_instruction(const IRInstruction* insn,
                                          Environment* env) const {
-  always_assert(it->type == MFLOW_OPCODE);
-  auto insn = it->insn;
   TRACE(STR_SIMPLE, 8, "insn: %s\n", SHOW(insn));
+  auto op = insn->opcode();
 
-  if (is_const_string(it)) {
-    const std::string& s = insn->get_string()->str();
-    env->create(insn->dest());
-    env->put(insn->dest(), StringyDomain::value(s, boost::none, true));
+  if (auto s = string_of(insn)) {
+    env->allocate(m_sites.at(insn),
+                  StringyDomain::value(s->str(), boost::none, true));
 
-  } else if (is_sb_new_instance(it)) {
-    env->create(insn->dest());
+  } else if (is_sb_new_instance(insn)) {
+    env->allocate(m_sites.at(insn), StringyDomain::top());
 
-  } else if (is_sb_empty_init(it)) {
+  } else if (is_sb_empty_init(insn)) {
     env->put(insn->src(0), StringyDomain::value(""));
 
-  } else if (is_sb_string_init(it)) {
+  } else if (is_sb_string_init(insn)) {
     auto rhs_abstract = env->eval(insn->src(1));
     if (rhs_abstract.is_value() && rhs_abstract.value().is_static_string()) {
       auto s = rhs_abstract.value().suffix();
@@ -83,287 +112,271 @@ void StringIterator::analyze_instruction(const NodeId blk,
       env->put(insn->src(0), StringyDomain::top());
     }
 
-  } else if (is_sb_append_string(it)) {
+  } else if (is_sb_append_string(insn)) {
     auto sb_abstract = env->eval(insn->src(0));
     auto rhs_abstract = env->eval(insn->src(1));
-    if (sb_abstract.is_value() && rhs_abstract.is_value() &&
-        rhs_abstract.value().is_static_string()) {
-      auto result = StringyDomain::append(
-          sb_abstract, it->insn->src(0), rhs_abstract.value().suffix());
-      env->put(it->insn->src(0), result);
+    if (rhs_abstract.is_value() && rhs_abstract.value().is_static_string()) {
+      env->put(insn->src(0),
+               StringyDomain::append(sb_abstract,
+                                     rhs_abstract.value().suffix()));
     } else {
-      env->put(it->insn->src(0), StringyDomain::top());
+      env->put(insn->src(0), StringyDomain::append(sb_abstract, insn->src(1)));
     }
-
-    auto future = next_insn(it, blk);
-    if (future != blk->end() &&
-        future->insn->opcode() == OPCODE_MOVE_RESULT_OBJECT) {
-      env->move(future->insn->dest(), it->insn->src(0));
-      it = future;
+    // append() returns the StringBuilder itself.
+    env->move(RESULT_REGISTER, insn->src(0));
+
+  } else if (is_sb_to_string(insn)) {
+    auto contents = foldable_contents(insn, *env);
+    if (contents && !contents->has_base()) {
+      env->allocate(
+          m_sites.at(insn),
+          StringyDomain::value(contents->suffix(), boost::none, true));
+    } else {
+      env->clear(RESULT_REGISTER);
     }
 
-  } else if (is_sb_to_string(it)) {
-    TRACE(STR_SIMPLE, 6, "found StringBuilder.toString()\n");
+  } else if (op == OPCODE_MOVE_OBJECT) {
+    env->move(insn->dest(), insn->src(0));
 
-  } else if (is_invoke(insn->opcode())) {
-    // Set all call's to top if not static strings.
-    for (size_t i = 0; i < insn->srcs_size(); ++i) {
-      if (!env->is_tracked(insn->src(i))) {
-        continue;
-      }
-      auto val = env->eval(insn->src(i));
-      if (val.kind() != StringyValue::Kind::Value ||
-          !val.value().is_static_string()) {
-        env->put(insn->src(i), StringyDomain::top());
-      }
-    }
-
-  } else if (is_move(it->insn->opcode())) {
-    env->move(it->insn->dest(), it->insn->src(0));
-    if (it->insn->src_is_wide(0)) {
-      env->clear(it->insn->dest() + 1);
-    }
+  } else if (op == OPCODE_MOVE_RESULT_OBJECT ||
+             op == IOPCODE_MOVE_RESULT_PSEUDO_OBJECT) {
+    env->move(insn->dest(), RESULT_REGISTER);
 
   } else { // Any other instruction.
-    if (it->insn->dests_size()) {
-      env->clear(it->insn->dest());
-      if (it->insn->dest_is_wide()) {
-        env->clear(it->insn->dest() + 1);
+    // Whatever reads an object may keep a reference to it.
+    for (size_t i = 0; i < insn->srcs_size(); ++i) {
+      env->escape_register(insn->src(i));
+    }
+    if (insn->dests_size()) {
+      env->clear(insn->dest());
+      if (insn->dest_is_wide()) {
+        env->clear(insn->dest() + 1);
       }
     }
+    if (insn->has_move_result() || insn->has_move_result_pseudo()) {
+      env->clear(RESULT_REGISTER);
+    }
   }
   TRACE(STR_SIMPLE, 8, "env: %s\n", showd(*env).c_str());
 }
 
-void StringIterator::simplify_instruction(const NodeId block,
-                                          FatMethod::iterator& it,
-                                          const Environment* current_state) {
-  auto insn = it->insn;
-  if (!is_sb_to_string(it)) {
-    return;
+boost::optional<StringyValue> StringIterator::foldable_contents(
+    const IRInstruction* insn, const Environment& env) const {
+  auto ptr = env.get_id(insn->src(0));
+  if (!ptr.is_value() || env.is_escaped(ptr.value())) {
+    return boost::none;
   }
-
-  const auto sb_reg = insn->src(0);
-  const auto sb_abstract = current_state->eval(sb_reg);
-  always_assert(!sb_abstract.is_bottom());
-
-  TRACE(STR_SIMPLE, 4, "Simplifying toString()\n");
-  if (sb_abstract.is_top() || sb_abstract.value().has_base()) {
-    TRACE(STR_SIMPLE, 4, "Aborting, no information known.\n");
-    return;
+  auto contents = env.eval(insn->src(0));
+  if (!contents.is_value()) {
+    return boost::none;
   }
-  TRACE(STR_SIMPLE, 4, "value: %s\n", showd(sb_abstract).c_str());
-
-  auto future = next_insn(it);
-  if (future->insn->opcode() != OPCODE_MOVE_RESULT_OBJECT) {
-    remove_stringbuilder_instructions_in_block(
-        it, current_state, block, sb_reg);
-    return;
-  }
-
-  if (!sb_abstract.value().has_base()) {
-    always_assert(future->insn->opcode() == OPCODE_MOVE_RESULT_OBJECT);
-    auto result_reg = future->insn->dest();
-    future = m_code->erase(future);
-    remove_stringbuilder_instructions_in_block(
-        it, current_state, block, sb_reg);
-
-    auto final_string = sb_abstract.value().suffix();
-    insert_const_string(it, result_reg, final_string);
-    TRACE(STR_SIMPLE, 5, "pushed constant: %s\n", final_string.c_str());
-
-  } else if (sb_abstract.value().suffix() == "") {
-    using namespace dex_asm;
-
-    always_assert(future->insn->opcode() == OPCODE_MOVE_RESULT_OBJECT);
-    auto result_reg = future->insn->dest();
-
-    auto base_reg = sb_abstract.value().base();
-    TRACE(STR_SIMPLE, 1, "Warning: possibly empty stringbuilder.\n");
-    m_code->insert_after(
-        future,
-        dasm(OPCODE_MOVE_OBJECT, {{VREG, result_reg}, {VREG, base_reg}}));
-    ++m_instructions_added;
-    TRACE(STR_SIMPLE, 5, "pushed move.\n");
-
-  } else {
-    always_assert(future->insn->opcode() == OPCODE_MOVE_RESULT_OBJECT);
-    auto result_reg = future->insn->dest();
-    future = m_code->erase(future);
-    remove_stringbuilder_instructions_in_block(
-        it, current_state, block, sb_reg);
-
-    auto base_reg = sb_abstract.value().base();
-
-    insert_sb_init(it, sb_reg);
-    insert_sb_append(it, sb_reg, base_reg);
-
-    auto free_reg = m_code->allocate_temp();
-    insert_const_string(it, free_reg, sb_abstract.value().suffix());
-    insert_sb_append(it, sb_reg, free_reg);
-
-    insert_sb_to_string(it, sb_reg, result_reg);
-    TRACE(STR_SIMPLE, 5, "pushed simplified StringBuilder.\n");
+  auto value = contents.value();
+  // With constants on both sides of the unknown String, a StringBuilder is
+  // as good as two calls to concat().
+  if (value.has_base() && !value.prefix().empty() &&
+      !value.suffix().empty()) {
+    return boost::none;
   }
+  return value;
 }
 
-void StringIterator::remove_stringbuilder_instructions_in_block(
-    FatMethod::iterator& it,
-    const Environment* c_env,
-    NodeId block,
-    string_register_t sb_reg) {
-  Environment env = *c_env;
-
-  // Unique pointer id in heap, so we can make sure we catch register aliasing
-  // (other registers that point to this stringbuilder object).
-  auto id = env.get_id(sb_reg);
-  always_assert(id.is_value());
-
-  if (it == block->begin()) {
-    TRACE(STR_SIMPLE, 1, "toString at beginning of block.\n");
-    m_code->remove_opcode(it);
-    it = m_code->insert_after(it);
-    ++m_instructions_added;
-    ++m_instructions_removed;
-    return;
-  }
-
-  it = m_code->erase(it); // Erase the toString.
-  ++m_instructions_removed;
-
-  auto back_iter = std::prev(it);
-  while (back_iter != block->begin()) {
-    bool should_erase = false;
-    if (back_iter->type != MFLOW_OPCODE) {
-      back_iter = std::prev(back_iter);
+void StringIterator::simplify() {
+  // The toString() calls to fold, with the contents of their StringBuilder.
+  std::vector<std::pair<FatMethod::iterator, StringyValue>> folds;
+  // The instructions that allocate or update each StringBuilder.
+  std::unordered_map<pointer_reference_t, std::vector<FatMethod::iterator>>
+      builders;
+  // The StringBuilders that must stay.
+  std::unordered_set<pointer_reference_t> kept;
+  bool can_remove = true;
+
+  for (Block* block : m_code->cfg().blocks()) {
+    auto env = get_entry_state_at(block);
+    auto ii = InstructionIterable(block);
+    if (env.is_bottom()) {
+      // We don't know which objects the instructions of unreachable blocks
+      // operate on.
+      can_remove = can_remove && ii.begin() == ii.end();
       continue;
     }
-
-    if (back_iter->insn->dests_size() &&
-        eq(env.get_id(back_iter->insn->dest()), id)) {
-      if (back_iter->insn->opcode() == OPCODE_NEW_INSTANCE) {
-        TRACE(STR_SIMPLE, 5, "new instance.\n");
-        always_assert(back_iter->insn->get_type() == m_builder_type);
-        back_iter = m_code->erase(back_iter);
-        ++m_instructions_removed;
-        break;
+    for (auto it = ii.begin(); it != ii.end(); ++it) {
+      auto insn = it->insn;
+      if (is_sb_new_instance(insn)) {
+        builders[m_sites.at(insn)].push_back(it.unwrap());
+      } else if (is_sb_to_string(insn)) {
+        auto contents = foldable_contents(insn, env);
+        if (contents) {
+          TRACE(STR_SIMPLE, 4, "Folding toString(): %s\n",
+                showd(*contents).c_str());
+          folds.emplace_back(it.unwrap(), *contents);
+        } else {
+          TRACE(STR_SIMPLE, 4, "Aborting, no information known.\n");
+          auto ptr = env.get_id(insn->src(0));
+          if (ptr.is_value()) {
+            kept.insert(ptr.value());
+          }
+        }
+      } else if (is_sb_empty_init(insn) || is_sb_string_init(insn) ||
+                 is_sb_append_string(insn) ||
+                 insn->opcode() == OPCODE_MOVE_OBJECT) {
+        auto ptr = env.get_id(insn->src(0));
+        if (ptr.is_value()) {
+          builders[ptr.value()].push_back(it.unwrap());
+          // new StringBuilder(null) throws, so it has to stay.
+          if (is_sb_string_init(insn) && !env.eval(insn->src(1)).is_value()) {
+            kept.insert(ptr.value());
+          }
+        }
       }
-      should_erase = true;
+      analyze_instruction(insn, &env);
+    }
+    const auto& escaped = env.get<2>();
+    if (escaped.is_value()) {
+      kept.insert(escaped.elements().begin(), escaped.elements().end());
+    } else {
+      can_remove = false;
     }
+  }
 
-    // In the analysis it should catch all invoke's that aren't defined (aka not
-    // something like append/toString) and then to set the StringBuilder as top,
-    // so we wouldn't optimize this case, and wouldn't have to worry about it
-    // when removing instructions.
-    if ((back_iter->insn->opcode() == OPCODE_INVOKE_VIRTUAL ||
-         back_iter->insn->opcode() == OPCODE_INVOKE_DIRECT) &&
-        eq(env.get_id(back_iter->insn->src(0)), id)) {
-      should_erase = true;
+  for (const auto& fold : folds) {
+    fold_to_string(fold.first, fold.second);
+  }
+  if (!can_remove) {
+    return;
+  }
+  for (const auto& site : m_sites) {
+    auto id = site.second;
+    if (!is_sb_new_instance(site.first) || kept.count(id) != 0 ||
+        builders.count(id) == 0) {
+      continue;
+    }
+    TRACE(STR_SIMPLE, 5, "Removing StringBuilder %s\n", SHOW(site.first));
+    for (const auto& it : builders.at(id)) {
+      remove_instruction(it);
     }
+    ++m_builders_removed;
+  }
+}
 
-    if (back_iter->insn->opcode() == OPCODE_MOVE_RESULT_OBJECT &&
-        eq(env.get_id(back_iter->insn->dest()), id)) {
-      auto past = prev_insn(back_iter);
-
-      if (is_sb_append_string(past)) {
-        should_erase = true;
-        TRACE(STR_SIMPLE,
-              5,
-              "propagating: %d to %d\n",
-              sb_reg,
-              past->insn->src(0));
-        env.move(past->insn->src(0), sb_reg);
+void StringIterator::fold_to_string(const FatMethod::iterator& it,
+                                    const StringyValue& contents) {
+  auto move_result = move_result_of(it, m_code->end());
+  if (move_result) {
+    auto dest = (*move_result)->insn->dest();
+    if (!contents.has_base()) {
+      insert_const_string(it, dest, contents.suffix());
+      TRACE(STR_SIMPLE, 5, "pushed constant: %s\n", contents.suffix().c_str());
+    } else if (contents.suffix().empty() && contents.prefix().empty()) {
+      insert_value_of(it, dest, contents.base());
+    } else {
+      // String.valueOf() turns a null into "null", like append() does.
+      if (!m_temp) {
+        m_temp = m_code->allocate_temp();
+      }
+      auto tmp = *m_temp;
+      if (contents.prefix().empty()) {
+        insert_value_of(it, dest, contents.base());
+        insert_const_string(it, tmp, contents.suffix());
+        insert_concat(it, dest, dest, tmp);
+      } else {
+        insert_value_of(it, tmp, contents.base());
+        insert_const_string(it, dest, contents.prefix());
+        insert_concat(it, dest, dest, tmp);
       }
+      ++m_concats_added;
+      TRACE(STR_SIMPLE, 5, "pushed concat.\n");
     }
+  }
+  remove_instruction(it);
+}
 
-    if (should_erase) {
-      back_iter = m_code->erase(back_iter);
-      ++m_instructions_removed;
-    }
-    back_iter = std::prev(back_iter);
+void StringIterator::remove_instruction(const FatMethod::iterator& it) {
+  auto move_result = it->insn->has_move_result()
+                         ? move_result_of(it, m_code->end())
+                         : boost::none;
+  if (move_result) {
+    m_code->remove_opcode(*move_result);
+    ++m_instructions_removed;
   }
+  m_code->remove_opcode(it);
+  ++m_instructions_removed;
 }
 
 //========== dasm helpers ==========
 
-bool StringIterator::is_const_string(FatMethod::iterator it) const {
-  return it->insn->opcode() == OPCODE_CONST_STRING;
-}
-
-bool StringIterator::is_sb_new_instance(FatMethod::iterator it) const {
-  auto insn = it->insn;
+bool StringIterator::is_sb_new_instance(const IRInstruction* insn) const {
   return insn->opcode() == OPCODE_NEW_INSTANCE &&
          insn->get_type() == m_builder_type;
 }
 
-bool StringIterator::is_sb_empty_init(FatMethod::iterator it) const {
-  auto insn = it->insn;
+bool StringIterator::is_sb_empty_init(const IRInstruction* insn) const {
   return insn->opcode() == OPCODE_INVOKE_DIRECT &&
-         insn->get_method() ==
-             DexMethod::make_method(STRINGBUILDER_DEF, "<init>", "V", {});
+         insn->get_method() == m_empty_init_method;
 }
 
-bool StringIterator::is_sb_string_init(FatMethod::iterator it) const {
-  auto insn = it->insn;
+bool StringIterator::is_sb_string_init(const IRInstruction* insn) const {
   return insn->opcode() == OPCODE_INVOKE_DIRECT &&
-         insn->get_method() ==
-             DexMethod::make_method(
-                 STRINGBUILDER_DEF, "<init>", "V", {STRING_DEF});
+         insn->get_method() == m_string_init_method;
 }
 
-bool StringIterator::is_sb_append_string(FatMethod::iterator it) const {
-  auto insn = it->insn;
+bool StringIterator::is_sb_append_string(const IRInstruction* insn) const {
   return insn->opcode() == OPCODE_INVOKE_VIRTUAL &&
          insn->get_method() == m_append_method;
 }
 
-bool StringIterator::is_sb_to_string(FatMethod::iterator it) const {
-  return it->insn->opcode() == OPCODE_INVOKE_VIRTUAL &&
-         it->insn->get_method() == m_to_string_method;
+bool StringIterator::is_sb_to_string(const IRInstruction* insn) const {
+  return insn->opcode() == OPCODE_INVOKE_VIRTUAL &&
+         insn->get_method() == m_to_string_method;
 }
 
-void StringIterator::insert_sb_init(FatMethod::iterator& it, uint16_t vreg) {
-  using namespace dex_asm;
-  m_code->insert_before(it,
-                        dasm(OPCODE_NEW_INSTANCE,
-                             DexType::make_type(STRINGBUILDER_DEF),
-                             {{VREG, vreg}}));
-  m_code->insert_before(
-      it,
-      dasm(OPCODE_INVOKE_DIRECT,
-           DexMethod::make_method(STRINGBUILDER_DEF, "<init>", "V", {}),
-           {{VREG, vreg}}));
-  m_instructions_added += 2;
+DexString* StringIterator::string_of(const IRInstruction* insn) const {
+  if (insn->opcode() == OPCODE_CONST_STRING) {
+    return insn->get_string();
+  }
+  if (insn->opcode() == OPCODE_SGET_OBJECT) {
+    auto field = resolve_field(insn->get_field(), FieldSearch::Static);
+    if (field != nullptr) {
+      auto it = m_known_strings.find(field);
+      if (it != m_known_strings.end()) {
+        return it->second;
+      }
+    }
+  }
+  return nullptr;
 }
 
-void StringIterator::insert_sb_append(FatMethod::iterator& it,
-                                      uint16_t sb_vreg,
-                                      uint16_t str_vreg) {
+void StringIterator::insert_const_string(const FatMethod::iterator& it,
+                                         string_register_t dest,
+                                         const std::string& s) {
   using namespace dex_asm;
+  m_code->insert_before(
+      it, dasm(OPCODE_CONST_STRING, DexString::make_string(s)));
   m_code->insert_before(it,
-                        dasm(OPCODE_INVOKE_VIRTUAL,
-                             m_append_method,
-                             {{VREG, sb_vreg}, {VREG, str_vreg}}));
-  ++m_instructions_added;
+                        dasm(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT,
+                             {{VREG, dest}}));
+  m_instructions_added += 2;
+  ++m_strings_added;
 }
 
-void StringIterator::insert_const_string(FatMethod::iterator& it,
-                                         uint16_t dest,
-                                         std::string s) {
+void StringIterator::insert_value_of(const FatMethod::iterator& it,
+                                     string_register_t dest,
+                                     string_register_t src) {
   using namespace dex_asm;
   m_code->insert_before(
-      it, dasm(OPCODE_CONST_STRING, DexString::make_string(s), {{VREG, dest}}));
-  ++m_instructions_added;
-  ++m_strings_added;
+      it, dasm(OPCODE_INVOKE_STATIC, m_value_of_method, {{VREG, src}}));
+  m_code->insert_before(it, dasm(OPCODE_MOVE_RESULT_OBJECT, {{VREG, dest}}));
+  m_instructions_added += 2;
 }
 
-void StringIterator::insert_sb_to_string(FatMethod::iterator& it,
-                                         uint16_t sb_vreg,
-                                         uint16_t dest_vreg) {
+void StringIterator::insert_concat(const FatMethod::iterator& it,
+                                   string_register_t dest,
+                                   string_register_t lhs,
+                                   string_register_t rhs) {
   using namespace dex_asm;
-  m_code->insert_before(
-      it, dasm(OPCODE_INVOKE_VIRTUAL, m_to_string_method, {{VREG, sb_vreg}}));
   m_code->insert_before(it,
-                        dasm(OPCODE_MOVE_RESULT_OBJECT, {{VREG, dest_vreg}}));
+                        dasm(OPCODE_INVOKE_VIRTUAL,
+                             m_concat_method,
+                             {{VREG, lhs}, {VREG, rhs}}));
+  m_code->insert_before(it, dasm(OPCODE_MOVE_RESULT_OBJECT, {{VREG, dest}}));
   m_instructions_added += 2;
 }
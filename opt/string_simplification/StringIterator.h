@@ -9,125 +9,130 @@
 
 #pragma once
 
-#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "ControlFlow.h"
 #include "DexClass.h"
 #include "DexUtil.h"
 #include "FixpointIterators.h"
+#include "Liveness.h"
 #include "StringDomain.h"
 
 constexpr const char* STRING_DEF = "Ljava/lang/String;";
 constexpr const char* STRINGBUILDER_DEF = "Ljava/lang/StringBuilder;";
 
+// The static final String fields whose value is known, i.e. that have an
+// encoded value and are never written.
+using KnownStrings = std::unordered_map<const DexField*, DexString*>;
+
+/*
+ * Analyzes the contents of the Strings and StringBuilders of a method across
+ * its blocks, then folds the StringBuilders whose contents are known when
+ * toString() is called:
+ * - into a const-string, when they only hold constants;
+ * - into String.valueOf(x).concat(...) when they hold a constant followed or
+ *   preceded by an unknown String x.
+ * StringBuilders whose every toString() is folded and that don't escape are
+ * removed altogether.
+ *
+ * The cfg of the code must be built, with its exit block calculated.
+ */
 class StringIterator : public MonotonicFixpointIterator<cfg::GraphInterface,
                                                         StringProdEnvironment> {
   using NodeId = Block*;
   using Environment = StringProdEnvironment;
 
  public:
-  StringIterator(IRCode* code, NodeId start_block)
-      : MonotonicFixpointIterator(code->cfg()),
-        m_code(code),
-        m_string_type(DexType::make_type(STRING_DEF)),
-        m_builder_type(DexType::make_type(STRINGBUILDER_DEF)),
-        m_append_method(DexMethod::make_method(
-            STRINGBUILDER_DEF, "append", STRINGBUILDER_DEF, {STRING_DEF})),
-        m_to_string_method(DexMethod::make_method(
-            STRINGBUILDER_DEF, "toString", STRING_DEF, {})),
-        m_strings_added(0),
-        m_instructions_added(0),
-        m_instructions_removed(0) {}
+  StringIterator(IRCode* code, const KnownStrings& known_strings);
 
   size_t get_strings_added() const { return m_strings_added; }
+  size_t get_concats_added() const { return m_concats_added; }
+  size_t get_builders_removed() const { return m_builders_removed; }
   size_t get_instructions_added() const { return m_instructions_added; }
   size_t get_instructions_removed() const { return m_instructions_removed; }
 
+  // The registers that are dead at the target of the edge don't hold
+  // anything anymore, so they can't make an object escape when the states of
+  // the predecessors are joined.
   Environment analyze_edge(
-      const std::shared_ptr<cfg::Edge>&,
-      const Environment& exit_state_at_source) const override {
-    return exit_state_at_source;
-  }
+      const std::shared_ptr<cfg::Edge>& edge,
+      const Environment& exit_state_at_source) const override;
 
   void analyze_node(const NodeId& block, Environment* env) const override {
-    for (auto it = block->begin(); it != block->end(); ++it) {
-      if (it->type == MFLOW_OPCODE) {
-        analyze_instruction(block, it, env);
-      }
+    for (const auto& mie : InstructionIterable(block)) {
+      analyze_instruction(mie.insn, env);
     }
   }
 
-  void simplify() {
-    for (const auto& block : m_code->cfg().blocks()) {
-      auto state = this->get_entry_state_at(block);
-      for (auto it = block->begin(); it != block->end(); ++it) {
-        if (it->type != MFLOW_OPCODE) {
-          continue;
-        }
-        analyze_instruction(block, it, &state);
-        simplify_instruction(block, it, &state);
-      }
-    }
-  }
+  void simplify();
 
  private:
   // Performs the abstract interpretation analysis on a per instruction basis.
   // Cases considered:
   // new_instance -> create new object in pool.
   // constructor -> set up initial value.
-  // const-string -> new object that is static.
+  // const-string / sget of a known field -> new object that is static.
   // append -> handle if possible, otherwise set to top.
-  // to_string -> check result.
+  // to_string -> new static object if the contents are known.
+  // other uses of an object -> it escapes.
   // overwritten dest -> clear register pointer (object can exist elsewhere).
-  void analyze_instruction(const NodeId blk,
-                           FatMethod::iterator& it,
-                           Environment* env) const;
+  void analyze_instruction(const IRInstruction* insn, Environment* env) const;
 
-  // Modifies instructions by finding toString method calls and removing all
-  // opcodes related to an object in the block, and then either inserting a
-  // const-string or building a simpler invocation of the stringbuilder.
-  void simplify_instruction(const NodeId block,
-                            FatMethod::iterator& it,
-                            const Environment* current_state);
+  // The contents of the StringBuilder whose toString() is `insn`, if it can be
+  // folded.
+  boost::optional<StringyValue> foldable_contents(const IRInstruction* insn,
+                                                  const Environment& env) const;
 
- private:
-  // Walks backwards and removes all stringbuilder instructions.  It initially
-  // points at the toString method, which will be deleted.
-  // In the end, it will point to the valid instruction immediately before,
-  // or the same instruction if it is the beginning of the block.
-  void remove_stringbuilder_instructions_in_block(FatMethod::iterator& it,
-                                                  const Environment* env,
-                                                  NodeId block,
-                                                  string_register_t sb_reg);
-
-  bool is_const_string(FatMethod::iterator it) const;
-  bool is_sb_new_instance(FatMethod::iterator it) const;
-  bool is_sb_empty_init(FatMethod::iterator it) const;
-  bool is_sb_string_init(FatMethod::iterator it) const;
-  bool is_sb_append_string(FatMethod::iterator it) const;
-  bool is_sb_to_string(FatMethod::iterator it) const;
-
-  void insert_const_string(FatMethod::iterator& it,
-                           string_register_t sb,
-                           std::string s);
-
-  void insert_sb_init(FatMethod::iterator& it, string_register_t vreg);
-
-  void insert_sb_append(FatMethod::iterator& it,
-                        string_register_t sb,
-                        string_register_t rhs);
-
-  void insert_sb_to_string(FatMethod::iterator& it,
-                           string_register_t sb,
-                           string_register_t dest);
+  // Replaces the toString() at `it` with the instructions that produce the
+  // same String out of `contents`.
+  void fold_to_string(const FatMethod::iterator& it,
+                      const StringyValue& contents);
+
+  // Removes the instruction at `it`, and the move-result that follows it.
+  void remove_instruction(const FatMethod::iterator& it);
+
+  bool is_sb_new_instance(const IRInstruction* insn) const;
+  bool is_sb_empty_init(const IRInstruction* insn) const;
+  bool is_sb_string_init(const IRInstruction* insn) const;
+  bool is_sb_append_string(const IRInstruction* insn) const;
+  bool is_sb_to_string(const IRInstruction* insn) const;
+
+  // The String that a const-string or the sget of a known field loads.
+  DexString* string_of(const IRInstruction* insn) const;
+
+  void insert_const_string(const FatMethod::iterator& it,
+                           string_register_t dest,
+                           const std::string& s);
+
+  void insert_value_of(const FatMethod::iterator& it,
+                       string_register_t dest,
+                       string_register_t src);
+
+  void insert_concat(const FatMethod::iterator& it,
+                     string_register_t dest,
+                     string_register_t lhs,
+                     string_register_t rhs);
 
   IRCode* m_code;
-  const DexType* m_string_type;
+  const KnownStrings& m_known_strings;
+  // The instructions that allocate the objects, by their object id.
+  std::unordered_map<const IRInstruction*, pointer_reference_t> m_sites;
+  std::unique_ptr<regalloc::LivenessFixpointIterator> m_liveness;
+  // The register that holds an operand of concat() while it is computed.
+  boost::optional<string_register_t> m_temp;
   const DexType* m_builder_type;
+  DexMethodRef* m_empty_init_method;
+  DexMethodRef* m_string_init_method;
   DexMethodRef* m_append_method;
   DexMethodRef* m_to_string_method;
-
-  size_t m_strings_added;
-  size_t m_instructions_added;
-  size_t m_instructions_removed;
+  DexMethodRef* m_value_of_method;
+  DexMethodRef* m_concat_method;
+
+  size_t m_strings_added{0};
+  size_t m_concats_added{0};
+  size_t m_builders_removed{0};
+  size_t m_instructions_added{0};
+  size_t m_instructions_removed{0};
 };
@@ -8,26 +8,64 @@
  */
 
 #include "StringSimplification.h"
+#include "DexAnnotation.h"
 #include "DexClass.h"
+#include "Resolver.h"
 #include "StringDomain.h"
 #include "StringIterator.h"
 #include "Walkers.h"
 
 constexpr const char* NUM_CONST_STRINGS_ADDED = "num_const_strings_added";
+constexpr const char* NUM_CONCATS_ADDED = "num_concats_added";
+constexpr const char* NUM_BUILDERS_REMOVED = "num_builders_removed";
 constexpr const char* NUM_INSTRUCTIONS_ADDED = "num_instructions_added";
 constexpr const char* NUM_INSTRUCTIONS_REMOVED = "num_instructions_removed";
 
+namespace {
+
+KnownStrings find_known_strings(const Scope& scope) {
+  KnownStrings known_strings;
+  auto string_type = DexType::make_type(STRING_DEF);
+  for (auto cls : scope) {
+    for (auto field : cls->get_sfields()) {
+      auto value = field->get_static_value();
+      if (!is_final(field) || field->get_type() != string_type ||
+          value == nullptr || value->evtype() != DEVT_STRING) {
+        continue;
+      }
+      known_strings.emplace(
+          field, static_cast<DexEncodedValueString*>(value)->string());
+    }
+  }
+  // A <clinit> can still overwrite the encoded value.
+  walk::opcodes(scope, [&](DexMethod*, IRInstruction* insn) {
+    if (is_sput(insn->opcode())) {
+      auto field = resolve_field(insn->get_field(), FieldSearch::Static);
+      known_strings.erase(field);
+    }
+  });
+  return known_strings;
+}
+
+} // namespace
+
 void StringSimplificationPass::run_pass(DexStoresVector& stores,
                                         ConfigFiles& /* cfg */,
                                         PassManager& mgr) {
   auto scope = build_class_scope(stores);
+  auto known_strings = find_known_strings(scope);
+  TRACE(STR_SIMPLE, 2, "Known static final strings: %zu\n",
+        known_strings.size());
   walk::code(scope, [&](DexMethod* m, IRCode& code) {
     TRACE(STR_SIMPLE, 8, "Method: %s\n", SHOW(m));
     code.build_cfg();
-    StringIterator iter(&code, code.cfg().entry_block());
+    code.cfg().calculate_exit_block();
+    StringIterator iter(&code, known_strings);
     iter.run(StringProdEnvironment());
     iter.simplify();
     mgr.incr_metric(NUM_CONST_STRINGS_ADDED, iter.get_strings_added());
+    mgr.incr_metric(NUM_CONCATS_ADDED, iter.get_concats_added());
+    mgr.incr_metric(NUM_BUILDERS_REMOVED, iter.get_builders_removed());
     mgr.incr_metric(NUM_INSTRUCTIONS_ADDED, iter.get_instructions_added());
     mgr.incr_metric(NUM_INSTRUCTIONS_REMOVED, iter.get_instructions_removed());
   });
@@ -11,6 +11,17 @@
 
 #include "Pass.h"
 
+/*
+ * Folds the StringBuilder chains that string concatenation compiles to, when
+ * the contents of the StringBuilder are known at its toString(), whichever
+ * blocks its appends are in. The appended constants can come from
+ * const-strings, from the static final String fields that are never written,
+ * and from the toString() of other folded StringBuilders. A StringBuilder
+ * that only holds constants becomes a const-string, and one that holds an
+ * unknown String and a constant becomes a call to String.concat(). The
+ * StringBuilders that aren't needed anymore are removed, which saves their
+ * allocation in logging-heavy code. See StringIterator.h.
+ */
 class StringSimplificationPass : public Pass {
  public:
   StringSimplificationPass() : Pass("StringSimplificationPass") {}
@@ -9,13 +9,16 @@
 
 #include "StripDebugInfo.h"
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "AhoCorasick.h"
 #include "DexClass.h"
 #include "DexUtil.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -26,16 +29,38 @@ constexpr const char* METRIC_PROLOGUE_DROPPED = "num_prologue_dropped";
 constexpr const char* METRIC_EPILOGUE_DROPPED = "num_epilogue_dropped";
 constexpr const char* METRIC_EMPTY_DROPPED = "num_empty_dropped";
 
-bool pattern_matches(const char* str,
-                     const std::vector<std::string>& patterns) {
-  for (const auto& p : patterns) {
-    auto substr = strstr(str, p.c_str());
-    if (substr != nullptr) {
-      return true;
+/*
+ * Whether a string contains any of a list of patterns, looking for all of them
+ * in a single pass over the string.
+ */
+class PatternMatcher {
+ public:
+  explicit PatternMatcher(const std::vector<std::string>& patterns) {
+    std::vector<std::string> non_empty;
+    for (const auto& p : patterns) {
+      // Like strstr(), the empty pattern is found in every string.
+      if (p.empty()) {
+        m_matches_all = true;
+        return;
+      }
+      non_empty.push_back(p);
+    }
+    if (!non_empty.empty()) {
+      m_automaton = std::make_unique<AhoCorasick>(non_empty);
     }
   }
-  return false;
-}
+
+  bool matches(const DexString* str) const {
+    if (m_matches_all) return true;
+    if (m_automaton == nullptr) return false;
+    return m_automaton->contains_any(str->c_str(),
+                                     str->c_str() + str->size());
+  }
+
+ private:
+  bool m_matches_all{false};
+  std::unique_ptr<AhoCorasick> m_automaton;
+};
 
 bool is_debug_entry(const MethodItemEntry& mie) {
   return mie.type == MFLOW_DEBUG || mie.type == MFLOW_POSITION;
@@ -43,36 +68,41 @@ bool is_debug_entry(const MethodItemEntry& mie) {
 
 } // namespace
 
-bool StripDebugInfoPass::method_passes_filter(DexMethod* meth) const {
-  return !m_use_whitelist ||
-         pattern_matches(meth->get_class()->get_name()->c_str(),
-                         m_cls_patterns) ||
-         pattern_matches(meth->get_name()->c_str(), m_meth_patterns);
+StripDebugInfoPass::Stats& StripDebugInfoPass::Stats::operator+=(
+    const Stats& that) {
+  num_matches += that.num_matches;
+  num_pos_dropped += that.num_pos_dropped;
+  num_var_dropped += that.num_var_dropped;
+  num_prologue_dropped += that.num_prologue_dropped;
+  num_epilogue_dropped += that.num_epilogue_dropped;
+  num_empty_dropped += that.num_empty_dropped;
+  return *this;
 }
 
-bool StripDebugInfoPass::should_remove(const MethodItemEntry& mei) {
+bool StripDebugInfoPass::should_remove(const MethodItemEntry& mei,
+                                       Stats& stats) const {
   bool remove = false;
   if (mei.type == MFLOW_DEBUG) {
-    auto op = mei.dbgop->opcode();
+    auto op = mei.dbgop.opcode();
     switch (op) {
     case DBG_START_LOCAL:
     case DBG_START_LOCAL_EXTENDED:
     case DBG_END_LOCAL:
     case DBG_RESTART_LOCAL:
       if (drop_local_variables()) {
-        ++m_num_var_dropped;
+        ++stats.num_var_dropped;
         remove = true;
       }
       break;
     case DBG_SET_PROLOGUE_END:
       if (drop_prologue()) {
-        ++m_num_prologue_dropped;
+        ++stats.num_prologue_dropped;
         remove = true;
       }
       break;
     case DBG_SET_EPILOGUE_BEGIN:
       if (drop_epilogue()) {
-        ++m_num_epilogue_dropped;
+        ++stats.num_epilogue_dropped;
         remove = true;
       }
       break;
@@ -81,7 +111,7 @@ bool StripDebugInfoPass::should_remove(const MethodItemEntry& mei) {
     }
   } else if (mei.type == MFLOW_POSITION) {
     if (drop_line_numbers()) {
-      ++m_num_pos_dropped;
+      ++stats.num_pos_dropped;
       remove = true;
     }
   }
@@ -115,73 +145,103 @@ bool StripDebugInfoPass::should_drop_for_synth(const DexMethod* method) const {
           strstr(method->get_name()->c_str(), "access$") != nullptr);
 }
 
+void StripDebugInfoPass::strip_debug_info(DexMethod* meth,
+                                          IRCode& code,
+                                          Stats& stats) const {
+  ++stats.num_matches;
+  bool debug_info_empty = true;
+  bool force_discard = m_drop_all_dbg_info || should_drop_for_synth(meth);
+
+  for (auto it = code.begin(); it != code.end();) {
+    const auto& mei = *it;
+    if (should_remove(mei, stats) || (force_discard && is_debug_entry(mei))) {
+      // Even though force_discard will drop the debug item below, preventing
+      // any of the debug entries for :meth to be output, we still want to
+      // erase those entries here so that transformations like inlining won't
+      // move these entries into a method that does have a debug item.
+      it = code.erase(it);
+    } else {
+      switch (mei.type) {
+      case MFLOW_DEBUG:
+        // Any debug information op other than an end sequence means
+        // we have debug info.
+        if (mei.dbgop.opcode() != DBG_END_SEQUENCE) debug_info_empty = false;
+        break;
+      case MFLOW_POSITION:
+        // Any line position entry means we have debug info.
+        debug_info_empty = false;
+        break;
+      default:
+        break;
+      }
+      ++it;
+    }
+  }
+
+  if (m_drop_all_dbg_info ||
+      (debug_info_empty && m_drop_all_dbg_info_if_empty) || force_discard) {
+    ++stats.num_empty_dropped;
+    code.release_debug_item();
+  }
+}
+
 void StripDebugInfoPass::run_pass(DexStoresVector& stores,
                                   ConfigFiles& cfg,
                                   PassManager& mgr) {
-  m_num_matches = 0;
-  m_num_pos_dropped = 0;
-  m_num_var_dropped = 0;
-  m_num_prologue_dropped = 0;
-  m_num_epilogue_dropped = 0;
-  m_num_empty_dropped = 0;
   auto scope = build_class_scope(stores);
-  walk::code(scope, [&](DexMethod* meth, IRCode& code) {
-    if (!method_passes_filter(meth)) return;
-    ++m_num_matches;
-    bool debug_info_empty = true;
-    bool force_discard = m_drop_all_dbg_info || should_drop_for_synth(meth);
-
-    for (auto it = code.begin(); it != code.end();) {
-      const auto& mei = *it;
-      if (should_remove(mei) || (force_discard && is_debug_entry(mei))) {
-        // Even though force_discard will drop the debug item below, preventing
-        // any of the debug entries for :meth to be output, we still want to
-        // erase those entries here so that transformations like inlining won't
-        // move these entries into a method that does have a debug item.
-        it = code.erase(it);
-      } else {
-        switch (mei.type) {
-        case MFLOW_DEBUG:
-          // Any debug information op other than an end sequence means
-          // we have debug info.
-          if (mei.dbgop->opcode() != DBG_END_SEQUENCE) debug_info_empty = false;
-          break;
-        case MFLOW_POSITION:
-          // Any line position entry means we have debug info.
-          debug_info_empty = false;
-          break;
-        default:
-          break;
+  PatternMatcher cls_matcher(m_cls_patterns);
+  PatternMatcher meth_matcher(m_meth_patterns);
+
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<Stats> thread_stats(num_threads);
+  auto wq = WorkQueue<DexClass*, Stats*, std::nullptr_t>(
+      [&](Stats*& stats, DexClass* cls) -> std::nullptr_t {
+        // The class name is only matched once for all its methods.
+        bool cls_passes_filter =
+            !m_use_whitelist || cls_matcher.matches(cls->get_name());
+        for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+          for (auto meth : *methods) {
+            auto code = meth->get_code();
+            if (code == nullptr) continue;
+            if (!cls_passes_filter && !meth_matcher.matches(meth->get_name())) {
+              continue;
+            }
+            strip_debug_info(meth, *code, *stats);
+          }
         }
-        ++it;
-      }
-    }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &thread_stats[thread_idx]; },
+      num_threads);
+  for (auto cls : scope) {
+    wq.add_item(cls);
+  }
+  wq.run_all();
 
-    if (m_drop_all_dbg_info ||
-        (debug_info_empty && m_drop_all_dbg_info_if_empty) || force_discard) {
-      ++m_num_empty_dropped;
-      code.release_debug_item();
-    }
-  });
+  Stats stats;
+  for (const auto& s : thread_stats) {
+    stats += s;
+  }
 
   TRACE(DBGSTRIP,
         1,
         "matched on %d methods. Removed %d dbg line entries, %d dbg local var "
         "entries, %d dbg prologue start entries, %d "
         "epilogue end entries and %u empty dbg tables.\n",
-        m_num_matches,
-        m_num_pos_dropped,
-        m_num_var_dropped,
-        m_num_prologue_dropped,
-        m_num_epilogue_dropped,
-        m_num_empty_dropped);
-
-  mgr.incr_metric(METRIC_NUM_MATCHES, m_num_matches);
-  mgr.incr_metric(METRIC_POS_DROPPED, m_num_pos_dropped);
-  mgr.incr_metric(METRIC_VAR_DROPPED, m_num_var_dropped);
-  mgr.incr_metric(METRIC_PROLOGUE_DROPPED, m_num_prologue_dropped);
-  mgr.incr_metric(METRIC_EPILOGUE_DROPPED, m_num_epilogue_dropped);
-  mgr.incr_metric(METRIC_EMPTY_DROPPED, m_num_empty_dropped);
+        stats.num_matches,
+        stats.num_pos_dropped,
+        stats.num_var_dropped,
+        stats.num_prologue_dropped,
+        stats.num_epilogue_dropped,
+        stats.num_empty_dropped);
+
+  mgr.incr_metric(METRIC_NUM_MATCHES, stats.num_matches);
+  mgr.incr_metric(METRIC_POS_DROPPED, stats.num_pos_dropped);
+  mgr.incr_metric(METRIC_VAR_DROPPED, stats.num_var_dropped);
+  mgr.incr_metric(METRIC_PROLOGUE_DROPPED, stats.num_prologue_dropped);
+  mgr.incr_metric(METRIC_EPILOGUE_DROPPED, stats.num_epilogue_dropped);
+  mgr.incr_metric(METRIC_EMPTY_DROPPED, stats.num_empty_dropped);
 
   if (m_drop_src_files) {
     TRACE(DBGSTRIP, 1, "dropping src file strings\n");
@@ -32,12 +32,32 @@ class StripDebugInfoPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual unsigned reads() const override {
+    return TOUCHES_CODE | TOUCHES_DEBUG_INFO;
+  }
+  virtual unsigned writes() const override {
+    return TOUCHES_CODE | TOUCHES_DEBUG_INFO;
+  }
+
   void set_drop_prologue_end(bool b) { m_drop_prologue_end = b; }
   void set_drop_local_variables(bool b) { m_drop_local_variables = b; }
   void set_drop_epilogue_begin(bool b) { m_drop_epilogue_begin = b; }
   void set_drop_all_debug_info(bool b) { m_drop_all_dbg_info = b; }
   void set_drop_line_numbers(bool b) { m_drop_line_nrs = b; }
 
+  struct Stats {
+    int num_matches{0};
+    int num_pos_dropped{0};
+    int num_var_dropped{0};
+    int num_prologue_dropped{0};
+    int num_epilogue_dropped{0};
+    int num_empty_dropped{0};
+
+    Stats& operator+=(const Stats& that);
+  };
+
  private:
   bool drop_local_variables() const {
     return m_drop_local_variables || m_drop_all_dbg_info;
@@ -51,9 +71,9 @@ class StripDebugInfoPass : public Pass {
   bool drop_line_numbers() const {
     return m_drop_line_nrs || m_drop_all_dbg_info;
   }
-  bool method_passes_filter(DexMethod* meth) const;
-  bool should_remove(const MethodItemEntry& mei);
+  bool should_remove(const MethodItemEntry& mei, Stats& stats) const;
   bool should_drop_for_synth(const DexMethod*) const;
+  void strip_debug_info(DexMethod* meth, IRCode& code, Stats& stats) const;
 
   std::vector<std::string> m_cls_patterns;
   std::vector<std::string> m_meth_patterns;
@@ -67,10 +87,4 @@ class StripDebugInfoPass : public Pass {
   bool m_drop_all_dbg_info_if_empty = false;
   bool m_drop_synth_aggressive = false;
   bool m_drop_synth_conservative = false;
-  int m_num_matches = 0;
-  int m_num_pos_dropped = 0;
-  int m_num_var_dropped = 0;
-  int m_num_prologue_dropped = 0;
-  int m_num_epilogue_dropped = 0;
-  int m_num_empty_dropped = 0;
 };
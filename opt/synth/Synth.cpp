@@ -24,6 +24,7 @@
 #include "DexLoader.h"
 #include "DexOutput.h"
 #include "DexUtil.h"
+#include "HierarchyCache.h"
 #include "IRCode.h"
 #include "IRInstruction.h"
 #include "Mutators.h"
@@ -32,6 +33,7 @@
 #include "Resolver.h"
 #include "SynthConfig.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 
 constexpr const char* METRIC_GETTERS_REMOVED = "getter_methods_removed_count";
@@ -255,9 +257,21 @@ struct WrapperMethods {
   std::unordered_set<DexMethod*> keepers;
   std::unordered_set<DexMethod*> methods_to_update;
   std::unordered_set<DexMethod*> promoted_to_static;
+  // The methods with an invoke-static or invoke-direct to each callee, in no
+  // particular order. Only those of the methods above need rewriting.
+  std::unordered_map<const DexMethod*, std::vector<DexMethod*>> callers;
   bool next_pass = false;
 };
 
+/**
+ * What analyze() finds in one class, in the order it finds it.
+ */
+struct ClassWrappers {
+  std::vector<std::pair<DexMethod*, DexField*>> getters;
+  std::vector<std::pair<DexMethod*, DexMethod*>> wrappers;
+  std::vector<std::pair<DexMethod*, DexMethod*>> ctors;
+};
+
 /**
  * Find and remove wrappers to wrappers. This removes loops and chain of
  * wrappers leaving only one level (and the first level) of wrappers
@@ -290,71 +304,150 @@ void purge_wrapped_wrappers(WrapperMethods& ssms) {
   ssms.next_pass = ssms.next_pass || remove.size() > 0;
 }
 
+void analyze_class(const ClassHierarchy& ch,
+                   const DexClass* cls,
+                   const SynthConfig& synthConfig,
+                   ClassWrappers& found) {
+  for (auto dmethod : cls->get_dmethods()) {
+    // constructors are special and all we can remove are synthetic ones
+    if (is_synthetic(dmethod) && is_constructor(dmethod)) {
+      auto ctor = trivial_ctor_wrapper(dmethod);
+      if (ctor) {
+        TRACE(SYNT, 2, "Trivial constructor wrapper: %s\n", SHOW(dmethod));
+        TRACE(SYNT, 2, "  Calls constructor: %s\n", SHOW(ctor));
+        found.ctors.emplace_back(dmethod, ctor);
+      }
+      continue;
+    }
+    if (is_constructor(dmethod)) continue;
+
+    if (is_static_synthetic(dmethod)) {
+      auto field = trivial_get_field_wrapper(dmethod);
+      if (field) {
+        TRACE(SYNT, 2, "Static trivial getter: %s\n", SHOW(dmethod));
+        TRACE(SYNT, 2, "  Gets field: %s\n", SHOW(field));
+        found.getters.emplace_back(dmethod, field);
+        continue;
+      }
+      auto sfield = trivial_get_static_field_wrapper(dmethod);
+      if (sfield) {
+        TRACE(SYNT, 2, "Static trivial static field getter: %s\n",
+        SHOW(dmethod));
+        TRACE(SYNT, 2, "  Gets static field: %s\n", SHOW(sfield));
+        found.getters.emplace_back(dmethod, sfield);
+        continue;
+      }
+    }
+
+    if (can_optimize(dmethod, synthConfig)) {
+      auto method = trivial_method_wrapper(dmethod, ch);
+      if (method) {
+        // this is not strictly needed but to avoid changing visibility of
+        // virtuals we are skipping a wrapper to a virtual.
+        // Incidentally we have no single method falling in that bucket
+        // at this time
+        if (method->is_virtual()) continue;
+
+        TRACE(SYNT, 2, "Static trivial method wrapper: %s\n", SHOW(dmethod));
+        TRACE(SYNT, 2, "  Calls method: %s\n", SHOW(method));
+        found.wrappers.emplace_back(dmethod, method);
+      }
+    }
+  }
+  if (debug) {
+    // Static synthetics should never be virtual.
+    for (auto vmethod : cls->get_vmethods()) {
+      (void)vmethod;
+      assert(!is_static_synthetic(vmethod));
+    }
+  }
+}
+
+/**
+ * Record the methods that `caller` invokes the way replace_wrappers()
+ * resolves them.
+ */
+void gather_callees(
+    DexMethod* caller,
+    std::unordered_map<const DexMethod*, std::vector<DexMethod*>>& callers) {
+  auto code = caller->get_code();
+  if (code == nullptr) return;
+  std::unordered_set<const DexMethod*> callees;
+  for (auto& mie : InstructionIterable(code)) {
+    auto insn = mie.insn;
+    DexMethod* callee;
+    if (insn->opcode() == OPCODE_INVOKE_STATIC) {
+      callee = resolve_method(insn->get_method(), MethodSearch::Static);
+    } else if (insn->opcode() == OPCODE_INVOKE_DIRECT) {
+      callee = resolve_method(insn->get_method(), MethodSearch::Direct);
+    } else {
+      continue;
+    }
+    if (callee != nullptr && callees.insert(callee).second) {
+      callers[callee].push_back(caller);
+    }
+  }
+}
+
+/**
+ * Find the wrappers and, in the same walk over the code, who calls what.
+ * Classes are scanned in parallel; what they contain is then merged in
+ * scope order, so that the outcome doesn't depend on scheduling.
+ */
 WrapperMethods analyze(const ClassHierarchy& ch,
                        const std::vector<DexClass*>& classes,
                        const SynthConfig& synthConfig) {
-  WrapperMethods ssms;
-  for (auto cls : classes) {
-    for (auto dmethod : cls->get_dmethods()) {
-      // constructors are special and all we can remove are synthetic ones
-      if (is_synthetic(dmethod) && is_constructor(dmethod)) {
-        auto ctor = trivial_ctor_wrapper(dmethod);
-        if (ctor) {
-          TRACE(SYNT, 2, "Trivial constructor wrapper: %s\n", SHOW(dmethod));
-          TRACE(SYNT, 2, "  Calls constructor: %s\n", SHOW(ctor));
-          ssms.ctors.emplace(dmethod, ctor);
-        }
-        continue;
-      }
-      if (is_constructor(dmethod)) continue;
-
-      if (is_static_synthetic(dmethod)) {
-        auto field = trivial_get_field_wrapper(dmethod);
-        if (field) {
-          TRACE(SYNT, 2, "Static trivial getter: %s\n", SHOW(dmethod));
-          TRACE(SYNT, 2, "  Gets field: %s\n", SHOW(field));
-          ssms.getters.emplace(dmethod, field);
-          continue;
+  using CallerMap =
+      std::unordered_map<const DexMethod*, std::vector<DexMethod*>>;
+  std::vector<ClassWrappers> found(classes.size());
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<CallerMap> callers(num_threads);
+  auto wq = WorkQueue<size_t, CallerMap*, std::nullptr_t>(
+      [&](CallerMap*& local, size_t i) -> std::nullptr_t {
+        auto cls = classes[i];
+        analyze_class(ch, cls, synthConfig, found[i]);
+        for (auto dmethod : cls->get_dmethods()) {
+          gather_callees(dmethod, *local);
         }
-        auto sfield = trivial_get_static_field_wrapper(dmethod);
-        if (sfield) {
-          TRACE(SYNT, 2, "Static trivial static field getter: %s\n",
-          SHOW(dmethod));
-          TRACE(SYNT, 2, "  Gets static field: %s\n", SHOW(sfield));
-          ssms.getters.emplace(dmethod, sfield);
-          continue;
+        for (auto vmethod : cls->get_vmethods()) {
+          gather_callees(vmethod, *local);
         }
-      }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &callers[thread_idx]; },
+      num_threads);
+  for (size_t i = 0; i < classes.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
 
-      if (can_optimize(dmethod, synthConfig)) {
-        auto method = trivial_method_wrapper(dmethod, ch);
-        if (method) {
-          // this is not strictly needed but to avoid changing visibility of
-          // virtuals we are skipping a wrapper to a virtual.
-          // Incidentally we have no single method falling in that bucket
-          // at this time
-          if (method->is_virtual()) continue;
-
-          TRACE(SYNT, 2, "Static trivial method wrapper: %s\n", SHOW(dmethod));
-          TRACE(SYNT, 2, "  Calls method: %s\n", SHOW(method));
-          ssms.wrappers.emplace(dmethod, method);
-          if (!is_static(method)) {
-            auto wrapped = ssms.wrapped.find(method);
-            if (wrapped == ssms.wrapped.end()) {
-              ssms.wrapped.emplace(method, std::make_pair(dmethod, 1));
-            } else {
-              wrapped->second.second++;
-            }
-          }
+  WrapperMethods ssms;
+  for (const auto& cls_found : found) {
+    for (const auto& p : cls_found.ctors) {
+      ssms.ctors.emplace(p.first, p.second);
+    }
+    for (const auto& p : cls_found.getters) {
+      ssms.getters.emplace(p.first, p.second);
+    }
+    for (const auto& p : cls_found.wrappers) {
+      auto dmethod = p.first;
+      auto method = p.second;
+      ssms.wrappers.emplace(dmethod, method);
+      if (!is_static(method)) {
+        auto wrapped = ssms.wrapped.find(method);
+        if (wrapped == ssms.wrapped.end()) {
+          ssms.wrapped.emplace(method, std::make_pair(dmethod, 1));
+        } else {
+          wrapped->second.second++;
         }
       }
     }
-    if (debug) {
-      // Static synthetics should never be virtual.
-      for (auto vmethod : cls->get_vmethods()) {
-        (void)vmethod;
-        assert(!is_static_synthetic(vmethod));
-      }
+  }
+  for (auto& local : callers) {
+    for (auto& it : local) {
+      auto& all = ssms.callers[it.first];
+      all.insert(all.end(), it.second.begin(), it.second.end());
     }
   }
   purge_wrapped_wrappers(ssms);
@@ -817,25 +910,46 @@ void do_transform(const ClassHierarchy& ch,
                   WrapperMethods& ssms,
                   const SynthConfig& synthConfig,
                   SynthMetrics& metrics) {
+  // Only the methods calling one of the wrappers need rewriting.
+  std::unordered_set<DexMethod*> to_rewrite;
+  auto add_callers = [&](const DexMethod* callee) {
+    auto it = ssms.callers.find(callee);
+    if (it != ssms.callers.end()) {
+      to_rewrite.insert(it->second.begin(), it->second.end());
+    }
+  };
+  for (const auto& p : ssms.getters) add_callers(p.first);
+  for (const auto& p : ssms.wrappers) add_callers(p.first);
+  for (const auto& p : ssms.wrapped) add_callers(p.first);
+  for (const auto& p : ssms.ctors) add_callers(p.first);
+
   // remove wrappers.  build a vector ahead of time to ensure we only visit each
   // method once, even if we mutate the class method lists such that we'd hit
-  // something a second time.
+  // something a second time. Keeping the scope order makes the outcome
+  // deterministic.
   std::vector<DexMethod*> methods;
   for (auto const& cls : classes) {
     for (auto const& dm : cls->get_dmethods()) {
-      methods.emplace_back(dm);
+      if (to_rewrite.count(dm)) methods.emplace_back(dm);
     }
     for (auto const& vm : cls->get_vmethods()) {
-      methods.emplace_back(vm);
+      if (to_rewrite.count(vm)) methods.emplace_back(vm);
     }
   }
+  TRACE(SYNT, 2, "Rewriting %ld methods\n", methods.size());
   for (auto const& m : methods) {
     if (m->get_code()) {
       replace_wrappers(ch, m, ssms);
     }
   }
-  // check that invokes to promoted static method is correct
-  walk::parallel::code(classes, [&](DexMethod* meth, IRCode& code) {
+  // check that invokes to promoted static method is correct. Those invokes
+  // are either in the methods rewritten above, or were already there.
+  for (auto wrappee : ssms.promoted_to_static) {
+    add_callers(wrappee);
+  }
+  auto wq = workqueue_foreach<DexMethod*>([&](DexMethod* meth) {
+    auto code = meth->get_code();
+    if (code == nullptr) return;
     for (auto& mie : InstructionIterable(code)) {
       auto* insn = mie.insn;
       auto opcode = insn->opcode();
@@ -855,6 +969,10 @@ void do_transform(const ClassHierarchy& ch,
             SHOW(meth));
     }
   });
+  for (auto meth : to_rewrite) {
+    wq.add_item(meth);
+  }
+  wq.run_all();
   remove_dead_methods(ssms, synthConfig, metrics);
 }
 
@@ -908,7 +1026,7 @@ void SynthPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager&
     return;
   }
   Scope scope = build_class_scope(stores);
-  ClassHierarchy ch = build_type_hierarchy(scope);
+  const auto& ch = mgr.get_hierarchy_cache().get_class_hierarchy();
   SynthMetrics metrics;
   int passes = 0;
   do {
@@ -25,6 +25,8 @@ class SynthPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
+  virtual bool changes_class_hierarchy() const override { return false; }
+
  private:
   SynthConfig m_pass_config;
 };
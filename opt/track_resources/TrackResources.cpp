@@ -9,6 +9,8 @@
 
 #include "TrackResources.h"
 
+#include <algorithm>
+#include <memory>
 #include <stdio.h>
 #include <string>
 #include <unordered_map>
@@ -27,15 +29,20 @@
 
 namespace {
 
-std::unordered_set<std::string> build_cls_set(const std::vector<std::string>& cls_list) {
-  std::unordered_set<std::string> cls_set;
-  for (auto& cls : cls_list) {
-    cls_set.emplace(cls);
+std::unordered_set<const DexType*> build_cls_set(
+    const std::vector<DexType*>& cls_list) {
+  std::unordered_set<const DexType*> cls_set;
+  for (auto type : cls_list) {
+    // A class that was never loaded has no type, and can't be searched.
+    if (type != nullptr) {
+      cls_set.emplace(type);
+    }
   }
   return cls_set;
 }
 
-void write_found_fields(std::string path, std::unordered_set<DexField*>& recorded_fields) {
+void write_found_fields(const std::string& path,
+                        const std::unordered_set<DexField*>& recorded_fields) {
   if (!path.empty()) {
     TRACE(TRACKRESOURCES, 1, "Writing tracked fields to %s\n", path.c_str());
     FILE* fd = fopen(path.c_str(), "w");
@@ -43,7 +50,11 @@ void write_found_fields(std::string path, std::unordered_set<DexField*>& recorde
       perror("Error writing tracked fields file");
       return;
     }
-    for (const auto &it : recorded_fields) {
+    // Sorted, so that the output is the same from one run to the next.
+    std::vector<DexField*> fields(recorded_fields.begin(),
+                                  recorded_fields.end());
+    std::sort(fields.begin(), fields.end(), compare_dexfields);
+    for (const auto &it : fields) {
       TRACE(TRACKRESOURCES, 4, "recording %s -> %s\n",
           SHOW(it->get_class()->get_name()),
           SHOW(it->get_name()));
@@ -55,18 +66,13 @@ void write_found_fields(std::string path, std::unordered_set<DexField*>& recorde
   }
 }
 
-void check_if_tracked_sget(DexMethod* src_method,
+bool is_tracked_sget(DexMethod* src_method,
     DexField* target_field,
-    std::unordered_set<std::string>& src_set,
-    std::unordered_set<DexClass*>& classes_to_track,
-    size_t& num_field_references,
-    std::map<DexClass*, int, dexclasses_comparator>& per_cls_refs,
-    std::unordered_set<DexField*>& recorded_fields) {
-  auto src_cls_name = src_method->get_class()->get_name()->c_str();
+    const std::unordered_set<const DexType*>& src_set,
+    const std::unordered_set<DexClass*>& classes_to_track) {
   auto target_cls = type_class(target_field->get_class());
-  if ((src_set.empty() || src_set.count(src_cls_name))
-    && classes_to_track.count(target_cls)
-    && !recorded_fields.count(target_field)) {
+  if ((src_set.empty() || src_set.count(src_method->get_class()))
+    && classes_to_track.count(target_cls)) {
     always_assert_log(target_field->is_concrete(), "Must be a concrete field");
     if (is_primitive(target_field->get_type())) {
       auto value = target_field->get_static_value();
@@ -74,26 +80,22 @@ void check_if_tracked_sget(DexMethod* src_method,
     } else {
       TRACE(TRACKRESOURCES, 3, "(non-primitive) sget to %s from %s\n", SHOW(target_field), SHOW(src_method));
     }
-    num_field_references++;
-    recorded_fields.emplace(target_field);
-    ++per_cls_refs[target_cls];
+    return true;
   }
+  return false;
 }
 
 }
 
-void TrackResourcesPass::find_accessed_fields(Scope& fullscope,
+void TrackResourcesPass::find_accessed_fields(
+    Scope& fullscope,
     ConfigFiles& cfg,
-    std::unordered_set<DexClass*> classes_to_track,
+    const std::unordered_set<DexClass*>& classes_to_track,
     std::unordered_set<DexField*>& recorded_fields,
-    std::unordered_set<std::string>& classes_to_search) {
+    const std::unordered_set<const DexType*>& classes_to_search) {
   std::unordered_set<DexField*> inline_field;
   uint32_t aflags = ACC_STATIC | ACC_FINAL;
 
-  // data structures to track field references from given classes
-  size_t num_field_references = 0;
-  std::map<DexClass*, int, dexclasses_comparator> per_cls_refs;
-
   for (auto clazz : classes_to_track) {
     auto sfields = clazz->get_sfields();
     for (auto sfield : sfields) {
@@ -101,24 +103,50 @@ void TrackResourcesPass::find_accessed_fields(Scope& fullscope,
       inline_field.emplace(sfield);
     }
   }
-  walk::opcodes(
+
+  // The sgets are looked for in parallel, each worker recording the fields it
+  // finds in its own set.
+  using FieldSet = std::unordered_set<DexField*>;
+  std::vector<std::unique_ptr<FieldSet>> thread_fields;
+  walk::parallel::reduce_methods<FieldSet*, std::nullptr_t>(
       fullscope,
-      [](DexMethod* method) { return true; },
-      [&](DexMethod* method, IRInstruction* insn) {
-        if (insn->has_field() && is_sfield_op(insn->opcode())) {
-          auto field = resolve_field(insn->get_field(), FieldSearch::Static);
-          if (field == nullptr || !field->is_concrete()) return;
-          if (inline_field.count(field) == 0) return;
-          check_if_tracked_sget(
-            method,
-            field,
-            classes_to_search,
-            classes_to_track,
-            num_field_references,
-            per_cls_refs,
-            recorded_fields);
+      [&](FieldSet*& found, DexMethod* method) {
+        auto code = method->get_code();
+        if (code == nullptr) {
+          return nullptr;
+        }
+        for (const auto& mie : InstructionIterable(code)) {
+          auto insn = mie.insn;
+          if (!insn->has_field() || !is_sfield_op(insn->opcode())) continue;
+          auto field =
+              resolve_field_cached(insn->get_field(), FieldSearch::Static);
+          if (field == nullptr || !field->is_concrete()) continue;
+          if (inline_field.count(field) == 0) continue;
+          if (found->count(field)) continue;
+          if (is_tracked_sget(
+                  method, field, classes_to_search, classes_to_track)) {
+            found->emplace(field);
+          }
         }
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int /* thread_index */) {
+        thread_fields.emplace_back(std::make_unique<FieldSet>());
+        return thread_fields.back().get();
       });
+
+  // data structures to track field references from given classes
+  size_t num_field_references = 0;
+  std::map<DexClass*, int, dexclasses_comparator> per_cls_refs;
+  for (const auto& found : thread_fields) {
+    for (auto field : *found) {
+      if (recorded_fields.emplace(field).second) {
+        num_field_references++;
+        ++per_cls_refs[type_class(field->get_class())];
+      }
+    }
+  }
   TRACE(TRACKRESOURCES, 1,
       "found %d total sgets to tracked classes\n", num_field_references);
   for (auto& it : per_cls_refs) {
@@ -143,7 +171,7 @@ void TrackResourcesPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, Pas
   const auto& pg_map = cfg.get_proguard_map();
   auto tracked_classes = build_tracked_cls_set(m_classes_to_track, pg_map);
   auto scope = build_class_scope(stores);
-  auto coldstart_cls_map = build_cls_set(cfg.get_coldstart_classes());
+  auto coldstart_cls_map = build_cls_set(cfg.get_coldstart_types());
   find_accessed_fields(scope, cfg, tracked_classes, recorded_fields, coldstart_cls_map);
   m_tracked_fields_output = cfg.metafile(m_tracked_fields_output);
   write_found_fields(m_tracked_fields_output, recorded_fields);
@@ -22,11 +22,21 @@ class TrackResourcesPass : public Pass {
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
-  static void find_accessed_fields(Scope& fullscope,
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual unsigned reads() const override {
+    return TOUCHES_CODE | TOUCHES_HIERARCHY;
+  }
+  // The tracked fields are written to a metafile.
+  virtual unsigned writes() const override { return TOUCHES_RESOURCES; }
+
+  // An empty classes_to_search stands for all the classes.
+  static void find_accessed_fields(
+      Scope& fullscope,
       ConfigFiles& cfg,
-      std::unordered_set<DexClass*> classes_to_track,
+      const std::unordered_set<DexClass*>& classes_to_track,
       std::unordered_set<DexField*>& recorded_fields,
-      std::unordered_set<std::string>& classes_to_search);
+      const std::unordered_set<const DexType*>& classes_to_search);
 
   static std::unordered_set<DexClass*> build_tracked_cls_set(
       const std::vector<std::string>& cls_suffixes,
@@ -12,11 +12,13 @@
 #include "ClassHierarchy.h"
 #include "DexAnnotation.h"
 #include "DexClass.h"
+#include "DexIdMap.h"
 #include "DexUtil.h"
 #include "IROpcode.h"
 #include "Resolver.h"
 #include "Trace.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -98,78 +100,162 @@ TypeSet collect_interfaces(
   return candidates;
 }
 
-void remove_referenced(const Scope& scope,
-                       TypeSet& candidates,
-                       UnreferencedInterfacesPass::Metric& metric) {
+/*
+ * The candidates referenced from the scope, by kind of reference. Each thread
+ * fills its own and they are merged afterwards.
+ */
+struct References {
+  TypeBitSet field_refs;
+  TypeBitSet sig_refs;
+  TypeBitSet anno_refs;
+  TypeBitSet insn_refs;
+  TypeBitSet unresolved_meths;
 
-  const auto check_type = [&](DexType* t, size_t& count) {
+  void merge(const References& that) {
+    field_refs.union_with(that.field_refs);
+    sig_refs.union_with(that.sig_refs);
+    anno_refs.union_with(that.anno_refs);
+    insn_refs.union_with(that.insn_refs);
+    unresolved_meths.union_with(that.unresolved_meths);
+  }
+};
+
+void gather_references(DexClass* cls,
+                       const TypeBitSet& candidates,
+                       References& refs) {
+  const auto check_type = [&](DexType* t, TypeBitSet& found) {
     const auto type = get_array_type_or_self(t);
-    if (candidates.count(type) > 0) {
-      candidates.erase(type);
-      count++;
+    if (candidates.contains(type)) {
+      found.insert(type);
+    }
+  };
+  const auto check_annos = [&](const DexAnnotationSet* anno_set) {
+    if (anno_set == nullptr) return;
+    std::vector<DexType*> types_in_anno;
+    for (const auto& anno : anno_set->get_annotations()) {
+      anno->gather_types(types_in_anno);
+    }
+    for (const auto& type : types_in_anno) {
+      check_type(type, refs.anno_refs);
     }
   };
 
-  walk::fields(scope,
-      [&](DexField* field) {
-        check_type(field->get_type(), metric.field_refs);
-      });
-  walk::methods(scope,
-      [&](DexMethod* meth) {
-        const auto proto = meth->get_proto();
-        check_type(proto->get_rtype(), metric.sig_refs);
-        for (const auto& type : proto->get_args()->get_type_list()) {
-          check_type(type, metric.sig_refs);
-        }
-      });
-  walk::annotations(scope,
-      [&](DexAnnotation* anno) {
-        std::vector<DexType*> types_in_anno;
-        anno->gather_types(types_in_anno);
-        for (const auto& type : types_in_anno) {
-          check_type(type, metric.anno_refs);
+  check_annos(cls->get_anno_set());
+  for (auto fields : {&cls->get_sfields(), &cls->get_ifields()}) {
+    for (auto field : *fields) {
+      check_type(field->get_type(), refs.field_refs);
+      check_annos(field->get_anno_set());
+    }
+  }
+  for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+    for (auto meth : *methods) {
+      const auto proto = meth->get_proto();
+      check_type(proto->get_rtype(), refs.sig_refs);
+      for (const auto& type : proto->get_args()->get_type_list()) {
+        check_type(type, refs.sig_refs);
+      }
+      check_annos(meth->get_anno_set());
+      const auto& param_anno = meth->get_param_anno();
+      if (param_anno) {
+        for (const auto& it : *param_anno) {
+          check_annos(it.second);
         }
-      });
-  walk::opcodes(scope,
-      [](DexMethod*) { return true; },
-      [&](DexMethod*, IRInstruction* insn) {
+      }
+
+      auto code = meth->get_code();
+      if (code == nullptr) continue;
+      for (const auto& mie : InstructionIterable(code)) {
+        auto insn = mie.insn;
         if (insn->has_type()) {
-          check_type(insn->get_type(), metric.insn_refs);
-          return;
+          check_type(insn->get_type(), refs.insn_refs);
+          continue;
         }
-        if (!insn->has_method()) return;
+        if (!insn->has_method()) continue;
         const auto opcode = insn->opcode();
-        DexMethod* meth = nullptr;
+        DexMethod* callee = nullptr;
         if (opcode == OPCODE_INVOKE_VIRTUAL) {
-          meth =  resolve_method(insn->get_method(), MethodSearch::Virtual);
+          callee = resolve_method_cached(insn->get_method(),
+                                         MethodSearch::Virtual);
         } else if (opcode == OPCODE_INVOKE_INTERFACE) {
-          meth =  resolve_method(insn->get_method(), MethodSearch::Interface);
+          callee = resolve_method_cached(insn->get_method(),
+                                         MethodSearch::Interface);
         } else {
-          return;
+          continue;
         }
-        if (meth != nullptr) {
-          check_type(meth->get_class(), metric.insn_refs);
-          return;
+        if (callee != nullptr) {
+          check_type(callee->get_class(), refs.insn_refs);
+          continue;
         }
 
         // the method resolved to nothing which is odd but there are
         // cases where it happens (OS versions, virtual call on an
         // unimplemented interface method, etc.).
         // To be safe let's remove every interface involved in this branch
-        const auto& cls = type_class(insn->get_method()->get_class());
-        if (cls == nullptr) return;
+        const auto& callee_cls = type_class(insn->get_method()->get_class());
+        if (callee_cls == nullptr) continue;
 
         TypeSet intfs;
-        if (is_interface(cls)) {
-          intfs.insert(cls->get_type());
-          get_super_interfaces(intfs, cls);
+        if (is_interface(callee_cls)) {
+          intfs.insert(callee_cls->get_type());
+          get_super_interfaces(intfs, callee_cls);
         } else {
-          get_interfaces(intfs, cls);
+          get_interfaces(intfs, callee_cls);
         }
         for (const auto& intf : intfs) {
-          metric.unresolved_meths += candidates.erase(intf);
+          if (candidates.contains(intf)) {
+            refs.unresolved_meths.insert(intf);
+          }
         }
-      });
+      }
+    }
+  }
+}
+
+void remove_referenced(const Scope& scope,
+                       TypeSet& candidates,
+                       UnreferencedInterfacesPass::Metric& metric) {
+  TypeBitSet candidate_bits;
+  for (const auto& intf : candidates) {
+    candidate_bits.insert(intf);
+  }
+
+  auto num_threads = workqueue_default_num_threads();
+  std::vector<References> thread_refs(num_threads);
+  auto wq = WorkQueue<DexClass*, References*, std::nullptr_t>(
+      [&](References*& refs, DexClass* cls) -> std::nullptr_t {
+        gather_references(cls, candidate_bits, *refs);
+        return nullptr;
+      },
+      [](std::nullptr_t, std::nullptr_t) { return nullptr; },
+      [&](unsigned int thread_idx) { return &thread_refs[thread_idx]; },
+      num_threads);
+  for (auto cls : scope) {
+    wq.add_item(cls);
+  }
+  wq.run_all();
+
+  References refs;
+  for (const auto& r : thread_refs) {
+    refs.merge(r);
+  }
+
+  // A candidate referenced in several ways is counted once, against the
+  // first kind of reference in this order.
+  const auto remove = [&](const TypeBitSet& found, size_t& count) {
+    for (auto it = candidates.begin(); it != candidates.end();) {
+      if (found.contains(*it)) {
+        it = candidates.erase(it);
+        count++;
+      } else {
+        ++it;
+      }
+    }
+  };
+  remove(refs.field_refs, metric.field_refs);
+  remove(refs.sig_refs, metric.sig_refs);
+  remove(refs.anno_refs, metric.anno_refs);
+  remove(refs.insn_refs, metric.insn_refs);
+  remove(refs.unresolved_meths, metric.unresolved_meths);
 }
 
 bool implements_removables(const TypeSet& removable, DexClass* cls) {
@@ -256,22 +256,35 @@ void InterfaceImplementations::load_interfaces() {
   }
 }
 
+/**
+ * The traits of each interface only depend on the interface itself, so they
+ * are computed in parallel. Whether an interface has children is recorded
+ * afterwards, as it's set on the parents.
+ */
 void InterfaceImplementations::compute_interface_traits() {
-  for (auto& intf_it : intf_traits) {
-    auto intf = intf_it.first;
+  std::vector<DexClass*> intfs;
+  for (const auto& intf_it : intf_traits) {
+    intfs.push_back(intf_it.first);
+  }
+  // Every interface already has its entry, so the walkers only write to
+  // their own.
+  walk::parallel::classes(intfs, [&](DexClass* intf) {
+    auto& trait = intf_traits.at(intf);
     if (intf->get_interfaces()->get_type_list().size() != 0) {
-      intf_it.second |= HAS_SUPER;
-      for (auto super : intf->get_interfaces()->get_type_list()) {
-        auto super_cls = type_class(super);
-        if (super_cls == nullptr) continue;
-        intf_traits[super_cls] |= HAS_CHILDREN;
-      }
+      trait |= HAS_SUPER;
     }
-    intf_it.second |= check_dmethods(intf->get_dmethods());
-    intf_it.second |= check_vmethods(intf->get_vmethods());
-    intf_it.second |= check_sfields(intf->get_sfields());
+    trait |= check_dmethods(intf->get_dmethods());
+    trait |= check_vmethods(intf->get_vmethods());
+    trait |= check_sfields(intf->get_sfields());
     always_assert(intf->get_ifields().size() == 0);
-    always_assert((intf_it.second & (HAS_INIT | HAS_DIRECT_METHODS)) == 0);
+    always_assert((trait & (HAS_INIT | HAS_DIRECT_METHODS)) == 0);
+  });
+  for (auto intf : intfs) {
+    for (auto super : intf->get_interfaces()->get_type_list()) {
+      auto super_cls = type_class(super);
+      if (super_cls == nullptr) continue;
+      intf_traits[super_cls] |= HAS_CHILDREN;
+    }
   }
 }
 
@@ -303,12 +316,17 @@ void InterfaceImplementations::find_implementor(
 
 /**
  * Compute traits for the set of implementors in the specific analysis.
+ * Each implementor is looked at on its own, so they are done in parallel.
  */
 void InterfaceImplementations::compute_implementor_traits() {
-  for (auto& impl_it : impl_to_intfs) {
-    auto impl = impl_it.first;
-    auto trait =
-        impl_it.second.size() > 1 ? IMPL_MULTIPLE_INTERFACES : NO_TRAIT;
+  std::vector<DexClass*> impls;
+  for (const auto& impl_it : impl_to_intfs) {
+    impls.push_back(impl_it.first);
+    impl_traits[impl_it.first] = NO_TRAIT;
+  }
+  walk::parallel::classes(impls, [&](DexClass* impl) {
+    auto trait = impl_to_intfs.at(impl).size() > 1 ? IMPL_MULTIPLE_INTERFACES
+                                                   : NO_TRAIT;
     if (is_anonymous(impl)) trait |= IS_ANONYMOUS;
     if (impl->get_access() & DexAccessFlags::ACC_ABSTRACT) {
       trait |= IS_ABSTRACT;
@@ -319,8 +337,8 @@ void InterfaceImplementations::compute_implementor_traits() {
     trait |= check_vmethods(impl->get_vmethods());
     trait |= check_sfields(impl->get_sfields());
     trait |= check_ifields(impl->get_ifields());
-    impl_traits[impl] = trait;
-  }
+    impl_traits.at(impl) = trait;
+  });
 }
 
 void InterfaceImplementations::compute_lazy_traits(
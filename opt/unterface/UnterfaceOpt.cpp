@@ -9,6 +9,9 @@
 
 #include "UnterfaceOpt.h"
 
+#include <memory>
+#include <set>
+
 #include "DexClass.h"
 #include "DexUtil.h"
 #include "Creators.h"
@@ -172,41 +175,55 @@ void do_update_method(DexMethod* meth, Unterface& unterface) {
  * Particularly take care of the constructor which have to be changed to
  * construct the unterface and pass the extra "switch type" argument.
  *
+ * All the unterfaces are done in one parallel walk over the code, rather
+ * than a walk per unterface. A method that refers to the implementors of
+ * several unterfaces is updated for each, in the order of `unterfaces`.
+ *
  * TODO: this is just an initial example and there is a ton more to do
  */
-void update_impl_refereces(Scope& scope, Unterface& unterface) {
-  std::vector<DexMethod*> to_change;
-  walk::code(scope,
-      [&](DexMethod* meth) {
-        return !find_impl(meth->get_class(), unterface);
-      },
-      [&](DexMethod* meth, IRCode& code) {
-        for (auto& mie : InstructionIterable(&code)) {
-          auto insn = mie.insn;
-          auto op = insn->opcode();
-          switch (op) {
-          case OPCODE_NEW_INSTANCE:
-            if (find_impl(insn->get_type(), unterface)) {
-              to_change.push_back(meth);
-              return;
-            }
-            break;
-          case OPCODE_INVOKE_DIRECT:
-            if (find_impl(insn->get_method()->get_class(), unterface)) {
-              to_change.push_back(meth);
-              return;
-            }
-            break;
-          default:
-            // TODO the other infinite number of cases...
-            break;
-          }
-        }
-      });
-
-  for (auto meth : to_change) {
-    do_update_method(meth, unterface);
+void update_impl_refereces(
+    Scope& scope, std::vector<std::unique_ptr<Unterface>>& unterfaces) {
+  // Where each implementor went, by its index in `unterfaces`.
+  std::unordered_map<const DexType*, size_t> impl_to_untf;
+  for (size_t i = 0; i < unterfaces.size(); i++) {
+    for (auto impl : unterfaces[i]->impls) {
+      auto inserted = impl_to_untf.emplace(impl->get_type(), i).second;
+      always_assert_log(inserted,
+                        "%s implements more than one unterface",
+                        SHOW(impl));
+    }
   }
+
+  walk::parallel::code(scope, [&](DexMethod* meth, IRCode& code) {
+    // The implementors' own methods are moved, not updated.
+    auto own_it = impl_to_untf.find(meth->get_class());
+    std::set<size_t> to_change;
+    auto add_ref = [&](const DexType* type) {
+      auto it = impl_to_untf.find(type);
+      if (it != impl_to_untf.end() &&
+          (own_it == impl_to_untf.end() || own_it->second != it->second)) {
+        to_change.insert(it->second);
+      }
+    };
+    for (auto& mie : InstructionIterable(&code)) {
+      auto insn = mie.insn;
+      auto op = insn->opcode();
+      switch (op) {
+      case OPCODE_NEW_INSTANCE:
+        add_ref(insn->get_type());
+        break;
+      case OPCODE_INVOKE_DIRECT:
+        add_ref(insn->get_method()->get_class());
+        break;
+      default:
+        // TODO the other infinite number of cases...
+        break;
+      }
+    }
+    for (auto i : to_change) {
+      do_update_method(meth, *unterfaces[i]);
+    }
+  });
 }
 
 /**
@@ -473,7 +490,7 @@ void make_unterface_class(Unterface& unterface) {
   unterface.ctor = ctor;
 }
 
-void optimize_interface(Scope& scope, Unterface& unterface) {
+void optimize_interface(Unterface& unterface) {
   TRACE(UNTF, 5, "Optimizing %s\n", SHOW(unterface.intf->get_type()));
   for (auto cls : unterface.impls) {
     TRACE(UNTF, 5, "Implementor %s\n", SHOW(cls->get_type()));
@@ -483,19 +500,22 @@ void optimize_interface(Scope& scope, Unterface& unterface) {
   make_unterface_class(unterface);
   move_methods(unterface);
   build_invoke(unterface);
-  update_impl_refereces(scope, unterface);
 }
 
 }
 
 void optimize(Scope& scope, TypeRelationship& candidates,
     std::vector<DexClass*>& untfs, std::unordered_set<DexClass*>& removed) {
+  std::vector<std::unique_ptr<Unterface>> unterfaces;
   for (auto& cand_it : candidates) {
-    Unterface unterface(cand_it.first, cand_it.second);
-    optimize_interface(scope, unterface);
-    auto cls = unterface.untf->create();
+    unterfaces.emplace_back(new Unterface(cand_it.first, cand_it.second));
+    optimize_interface(*unterfaces.back());
+  }
+  update_impl_refereces(scope, unterfaces);
+  for (auto& unterface : unterfaces) {
+    auto cls = unterface->untf->create();
     untfs.push_back(cls);
-    for (auto rem : cand_it.second) {
+    for (auto rem : unterface->impls) {
       removed.insert(rem);
     }
   }
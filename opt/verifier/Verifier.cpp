@@ -18,153 +18,159 @@
 
 #include "Walkers.h"
 #include "DexClass.h"
+#include "DexIdMap.h"
 #include "IRInstruction.h"
 #include "DexUtil.h"
 #include "ReachableClasses.h"
+#include "StoreDependencies.h"
+#include "WorkQueue.h"
 
 namespace {
 
 using refs_t = std::unordered_map<const DexClass*,
                                   std::set<DexClass*, dexclasses_comparator>>;
-using class_to_store_map_t = std::unordered_map<const DexClass*, DexStore*>;
-using allowed_store_map_t = std::unordered_map<std::string, std::set<std::string>>;
+// Which store each class is in, by the id of its type. Built once and only
+// read from then on, by all the stores.
+using class_to_store_map_t = TypeIdMap<const DexStore*>;
+
+constexpr const char* METRIC_ILLEGAL_STORE_REFS = "illegal_store_refs";
 
 /**
- * Helper function that scans all the opcodes in the application and produces a map of references
- * from the class containing the opcode to the class referenced by the opcode.
- *
- * @param scope all classes we're processing
- * @param dmethod_refs [out] all refs to dmethods in the application
- * @param class_refs [out] all refs to classes in the application
- *
+ * Helper function that scans the opcodes of a class and returns the classes
+ * they refer to.
  */
-void build_refs(
-    const Scope& scope,
-    refs_t& class_refs) {
+std::vector<DexClass*> referenced_classes(DexClass* cls) {
   // TODO: walk through annotations
-  walk::opcodes(
-    scope,
-    [](const DexMethod*) { return true; },
-    [&](const DexMethod* meth, IRInstruction* insn) {
+  std::vector<DexClass*> refs;
+  auto add_ref = [&](DexType* type) {
+    const auto tref = type_class(type);
+    if (tref) refs.push_back(tref);
+  };
+  std::vector<DexMethod*> methods(cls->get_dmethods().begin(),
+                                  cls->get_dmethods().end());
+  methods.insert(methods.end(), cls->get_vmethods().begin(),
+                 cls->get_vmethods().end());
+  for (auto meth : methods) {
+    auto code = meth->get_code();
+    if (code == nullptr) continue;
+    for (const auto& mie : InstructionIterable(code)) {
+      auto insn = mie.insn;
       if (insn->has_type()) {
-        const auto tref = type_class(insn->get_type());
-        if (tref) class_refs[tref].emplace(type_class(meth->get_class()));
-        return;
-      }
-      if (insn->has_field()) {
-        const auto tref = type_class(insn->get_field()->get_class());
-        if (tref) class_refs[tref].emplace(type_class(meth->get_class()));
-        return;
-      }
-      if (insn->has_method()) {
-        // log methods class type, for virtual methods, this may not actually exist and true
-        // verification would require that the binding refers to a class that is valid.
-        const auto mref = type_class(insn->get_method()->get_class());
-        if (mref) class_refs[mref].emplace(type_class(meth->get_class()));
-
-        // don't log return type or types of parameters for now, but this is how you might do it.
-        //const auto proto = insn->get_method()->get_proto();
-        // const auto rref = type_class(proto->get_rtype());
-        // if (rref) class_refs[rref].emplace(type_class(meth->get_class()));
+        add_ref(insn->get_type());
+      } else if (insn->has_field()) {
+        add_ref(insn->get_field()->get_class());
+      } else if (insn->has_method()) {
+        // log methods class type, for virtual methods, this may not actually
+        // exist and true verification would require that the binding refers
+        // to a class that is valid.
+        add_ref(insn->get_method()->get_class());
+
+        // don't log return type or types of parameters for now, but this is
+        // how you might do it.
+        // const auto proto = insn->get_method()->get_proto();
+        // add_ref(proto->get_rtype());
         // for (const auto arg : proto->get_args()->get_type_list()) {
-        //   const auto aref = type_class(arg);
-        //   if (aref) class_refs[aref].emplace(type_class(meth->get_class()));
+        //   add_ref(arg);
         // }
-
-        return;
       }
-    });
-}
-
-DexStore& findStore(std::string& name, DexStoresVector& stores) {
-  for (auto& store : stores) {
-    if (name == store.get_name()) {
-      return store;
     }
   }
-  return stores[0];
+  sort_unique(refs);
+  return refs;
 }
 
-const std::set<std::string> getAllowedStores(DexStoresVector& stores, DexStore& store, allowed_store_map_t store_map) {
-  auto search = store_map.find(store.get_name());
-  if (search != store_map.end()) {
-    return search->second;
-  }
-  store_map[store.get_name()].emplace(store.get_name());
-  store_map[store.get_name()].emplace(stores[0].get_name());
-  for (auto parent : store.get_dependencies()) {
-    store_map[store.get_name()].emplace(parent);
-    for (auto grandparent : getAllowedStores(stores, findStore(parent, stores), store_map)) {
-      store_map[store.get_name()].emplace(grandparent);
-    }
-  }
-  return store_map[store.get_name()];
-}
-
-void verifyStore(DexStoresVector& stores, DexStore& store, class_to_store_map_t map, allowed_store_map_t store_map, FILE* fd) {
-  refs_t class_refs;
-  auto scope = build_class_scope(store.get_dexen());
-  build_refs(scope, class_refs);
+/**
+ * Writes every reference from a class of the store to a class, along with the
+ * store of the class it refers to. The lines of a store are formatted into
+ * one buffer, which is written at once.
+ */
+void dump_store_refs(const DexStore& store,
+                     const refs_t& class_refs,
+                     const class_to_store_map_t& map,
+                     FILE* fd) {
+  std::string out;
   for (auto& ref : class_refs) {
     const auto target = ref.first;
+    auto target_store = map.at(target->get_type());
+    const auto& target_store_name =
+        target_store != nullptr ? target_store->get_name() : "external";
     for (const auto& source : ref.second) {
-      std::string target_store_name;
-      auto find = map.find(target);
-      if (find != map.end()) {
-        target_store_name = find->second->get_name();
-      } else {
-        target_store_name = "external";
-      }
-      std::set<std::string> allowed_stores = getAllowedStores(stores, store, store_map);
-      if (allowed_stores.find(target_store_name) == allowed_stores.end()) {
-        TRACE(
-          VERIFY,
-          5,
-          "BAD REFERENCE from %s %s to %s %s\n",
-          store.get_name().c_str(),
-          source->get_deobfuscated_name().c_str(),
-          target_store_name.c_str(),
-          target->get_deobfuscated_name().c_str());
-      }
-      if (fd != nullptr) {
-        fprintf(fd, "%s:%s->%s:%s\n",
-          store.get_name().c_str(),
-          source->get_deobfuscated_name().c_str(),
-          target_store_name.c_str(),
-          target->get_deobfuscated_name().c_str());
-      }
+      out += store.get_name();
+      out += ':';
+      out += source->get_deobfuscated_name();
+      out += "->";
+      out += target_store_name;
+      out += ':';
+      out += target->get_deobfuscated_name();
+      out += '\n';
     }
   }
+  fwrite(out.data(), 1, out.size(), fd);
 }
 
 } // namespace
 
 void VerifierPass::run_pass(DexStoresVector& stores, ConfigFiles& cfg, PassManager& mgr) {
+  auto illegal_refs = find_illegal_store_refs(stores);
+  for (const auto& ref : illegal_refs) {
+    TRACE(VERIFY,
+          5,
+          "BAD REFERENCE from %s %s to %s %s\n",
+          stores[ref.referrer_store].get_name().c_str(),
+          ref.referrer->get_deobfuscated_name().c_str(),
+          stores[ref.reference_store].get_name().c_str(),
+          ref.reference->get_deobfuscated_name().c_str());
+  }
+  mgr.set_metric(METRIC_ILLEGAL_STORE_REFS, illegal_refs.size());
+  if (m_fail_if_illegal_refs && !illegal_refs.empty()) {
+    always_assert_log(false,
+                      "ERROR - %zu illegal cross store references, the first "
+                      "one from %s to %s",
+                      illegal_refs.size(),
+                      SHOW(illegal_refs.front().referrer),
+                      SHOW(illegal_refs.front().reference));
+  }
+
+  if (m_class_dependencies_output.empty()) {
+    return;
+  }
   m_class_dependencies_output = cfg.metafile(m_class_dependencies_output);
-  FILE* fd = nullptr;
-  if (!m_class_dependencies_output.empty()) {
-    fd = fopen(m_class_dependencies_output.c_str(), "w");
-    if (fd == nullptr) {
-      perror("Error opening class dependencies output file");
-      return;
-    }
+  FILE* fd = fopen(m_class_dependencies_output.c_str(), "w");
+  if (fd == nullptr) {
+    perror("Error opening class dependencies output file");
+    return;
   }
 
-  allowed_store_map_t store_map;
   class_to_store_map_t map;
-  for (auto& store : stores) {
-    auto scope = build_class_scope(store.get_dexen());
+  std::vector<std::pair<DexClass*, size_t>> classes;
+  for (size_t i = 0; i < stores.size(); i++) {
+    auto scope = build_class_scope(stores[i].get_dexen());
     for (const auto& cls : scope) {
-      map[cls] = &store;
+      map[cls->get_type()] = &stores[i];
+      classes.emplace_back(cls, i);
     }
   }
-  for (auto& store : stores) {
-    verifyStore(stores, store, map, store_map, fd);
+  // The classes of all the stores are scanned in parallel.
+  std::vector<std::vector<DexClass*>> class_targets(classes.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    class_targets[i] = referenced_classes(classes[i].first);
+  });
+  for (size_t i = 0; i < classes.size(); i++) {
+    wq.add_item(i);
   }
+  wq.run_all();
 
-  if (fd != nullptr) {
-    fclose(fd);
+  std::vector<refs_t> store_refs(stores.size());
+  for (size_t i = 0; i < classes.size(); i++) {
+    auto& class_refs = store_refs[classes[i].second];
+    for (auto target : class_targets[i]) {
+      class_refs[target].emplace(classes[i].first);
+    }
+  }
+  for (size_t i = 0; i < stores.size(); i++) {
+    dump_store_refs(stores[i], store_refs[i], map, fd);
   }
+  fclose(fd);
 }
 
 static VerifierPass s_pass;
@@ -17,10 +17,12 @@ class VerifierPass : public Pass {
 
   virtual void configure_pass(const PassConfig& pc) override {
     pc.get("class_dependencies_output", "", m_class_dependencies_output);
+    pc.get("fail_if_illegal_refs", false, m_fail_if_illegal_refs);
   }
 
   virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
 
  private:
   std::string m_class_dependencies_output;
+  bool m_fail_if_illegal_refs;
 };
@@ -0,0 +1,226 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "InterfaceCallDevirtualizationPass.h"
+
+#include <limits>
+#include <unordered_map>
+
+#include "ConstantAbstractDomain.h"
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "FixpointIterators.h"
+#include "IRCode.h"
+#include "IRInstruction.h"
+#include "PatriciaTreeMapAbstractEnvironment.h"
+#include "Resolver.h"
+#include "Trace.h"
+#include "Walkers.h"
+
+namespace interface_devirtualization {
+
+namespace {
+
+using register_t = uint32_t;
+
+// The result of a method invocation, or of an instruction followed by a
+// move-result-pseudo.
+constexpr register_t RESULT_REGISTER = std::numeric_limits<register_t>::max();
+
+// The declared type of the reference in a register.
+using TypeDomain = ConstantAbstractDomain<const DexType*>;
+
+using TypeEnvironment =
+    PatriciaTreeMapAbstractEnvironment<register_t, TypeDomain>;
+
+class Analyzer final
+    : public MonotonicFixpointIterator<cfg::GraphInterface, TypeEnvironment> {
+ public:
+  Analyzer(const ControlFlowGraph& cfg,
+           std::unordered_map<const IRInstruction*, const DexType*> params)
+      : MonotonicFixpointIterator(cfg, cfg.blocks().size()),
+        m_params(std::move(params)) {
+    MonotonicFixpointIterator::run(TypeEnvironment::top());
+  }
+
+  void analyze_node(const NodeId& node,
+                    TypeEnvironment* current_state) const override {
+    for (const MethodItemEntry& mie : InstructionIterable(node)) {
+      analyze_instruction(mie.insn, current_state);
+    }
+  }
+
+  TypeEnvironment analyze_edge(
+      const EdgeId&,
+      const TypeEnvironment& exit_state_at_source) const override {
+    return exit_state_at_source;
+  }
+
+  void analyze_instruction(const IRInstruction* insn,
+                           TypeEnvironment* current_state) const {
+    switch (insn->opcode()) {
+    case IOPCODE_LOAD_PARAM_OBJECT: {
+      current_state->set(insn->dest(), TypeDomain(m_params.at(insn)));
+      break;
+    }
+    case OPCODE_MOVE_OBJECT: {
+      current_state->set(insn->dest(), current_state->get(insn->src(0)));
+      break;
+    }
+    case IOPCODE_MOVE_RESULT_PSEUDO_OBJECT:
+    case OPCODE_MOVE_RESULT_OBJECT: {
+      current_state->set(insn->dest(), current_state->get(RESULT_REGISTER));
+      break;
+    }
+    case OPCODE_CONST_STRING: {
+      current_state->set(RESULT_REGISTER, TypeDomain(get_string_type()));
+      break;
+    }
+    // The verifier takes the type of a check-cast to be the one it casts to,
+    // whatever the type of its source.
+    case OPCODE_CHECK_CAST:
+    case OPCODE_NEW_INSTANCE: {
+      current_state->set(RESULT_REGISTER, TypeDomain(insn->get_type()));
+      break;
+    }
+    case OPCODE_IGET_OBJECT:
+    case OPCODE_SGET_OBJECT: {
+      current_state->set(RESULT_REGISTER,
+                         TypeDomain(insn->get_field()->get_type()));
+      break;
+    }
+    case OPCODE_INVOKE_VIRTUAL:
+    case OPCODE_INVOKE_SUPER:
+    case OPCODE_INVOKE_DIRECT:
+    case OPCODE_INVOKE_STATIC:
+    case OPCODE_INVOKE_INTERFACE: {
+      current_state->set(
+          RESULT_REGISTER,
+          TypeDomain(insn->get_method()->get_proto()->get_rtype()));
+      break;
+    }
+    default: {
+      if (insn->dests_size() > 0) {
+        current_state->set(insn->dest(), TypeDomain::top());
+        if (insn->dest_is_wide()) {
+          current_state->set(insn->dest() + 1, TypeDomain::top());
+        }
+      }
+      if (insn->has_move_result() || insn->has_move_result_pseudo()) {
+        current_state->set(RESULT_REGISTER, TypeDomain::top());
+      }
+    }
+    }
+  }
+
+ private:
+  std::unordered_map<const IRInstruction*, const DexType*> m_params;
+};
+
+// The declared types of the object parameters of `method`, by their
+// load-param instruction.
+std::unordered_map<const IRInstruction*, const DexType*> param_types(
+    const DexMethod* method, const IRCode& code) {
+  std::unordered_map<const IRInstruction*, const DexType*> types;
+  const auto& args = method->get_proto()->get_args()->get_type_list();
+  auto arg = args.begin();
+  bool is_this = !is_static(method);
+  for (const auto& mie : InstructionIterable(code.get_param_instructions())) {
+    const DexType* type;
+    if (is_this) {
+      type = method->get_class();
+      is_this = false;
+    } else {
+      type = *arg++;
+    }
+    if (mie.insn->opcode() == IOPCODE_LOAD_PARAM_OBJECT) {
+      types.emplace(mie.insn, type);
+    }
+  }
+  return types;
+}
+
+// The method that an interface call on a receiver of the given type ends up
+// in, if it can be called with invoke-virtual from `caller`.
+DexMethod* virtual_target(const DexMethod* caller,
+                          const DexType* receiver,
+                          const DexMethodRef* callee) {
+  auto cls = type_class(receiver);
+  if (cls == nullptr || is_interface(cls)) {
+    return nullptr;
+  }
+  auto target = resolve_virtual(cls, callee->get_name(), callee->get_proto());
+  if (target == nullptr || !is_public(target)) {
+    return nullptr;
+  }
+  auto target_cls = type_class(target->get_class());
+  if (target_cls == nullptr || is_interface(target_cls)) {
+    return nullptr;
+  }
+  if (!is_public(target_cls) &&
+      JavaNameUtil::package_name(target_cls->get_name()->str()) !=
+          JavaNameUtil::package_name(caller->get_class()->get_name()->str())) {
+    return nullptr;
+  }
+  return target;
+}
+
+} // namespace
+
+Stats devirtualize(DexMethod* method) {
+  Stats stats;
+  auto code = method->get_code();
+  if (code == nullptr) {
+    return stats;
+  }
+  code->build_cfg();
+  auto& cfg = code->cfg();
+  Analyzer analyzer(cfg, param_types(method, *code));
+  for (Block* block : cfg.blocks()) {
+    auto state = analyzer.get_entry_state_at(block);
+    for (auto& mie : InstructionIterable(block)) {
+      auto insn = mie.insn;
+      if (insn->opcode() == OPCODE_INVOKE_INTERFACE) {
+        ++stats.interface_calls;
+        auto receiver = state.get(insn->src(0)).get_constant();
+        auto target = receiver ? virtual_target(method, *receiver,
+                                                insn->get_method())
+                               : nullptr;
+        if (target != nullptr) {
+          TRACE(VIRT, 5, "%s: %s -> %s\n", SHOW(method),
+                SHOW(insn->get_method()), SHOW(target));
+          insn->set_opcode(OPCODE_INVOKE_VIRTUAL);
+          insn->set_method(target);
+          ++stats.devirtualized;
+        }
+      }
+      analyzer.analyze_instruction(insn, &state);
+    }
+  }
+  return stats;
+}
+
+} // namespace interface_devirtualization
+
+void InterfaceCallDevirtualizationPass::run_pass(DexStoresVector& stores,
+                                                 ConfigFiles&,
+                                                 PassManager& mgr) {
+  auto scope = build_class_scope(stores);
+  using interface_devirtualization::Stats;
+  auto stats = walk::parallel::reduce_code<Stats>(
+      scope, [](Stats& stats, DexMethod* method, IRCode&) {
+        stats += interface_devirtualization::devirtualize(method);
+      });
+  mgr.incr_metric("interface_calls", stats.interface_calls);
+  mgr.incr_metric("interface_calls_devirtualized", stats.devirtualized);
+  TRACE(VIRT, 1, "Devirtualized %zu of %zu interface calls\n",
+        stats.devirtualized, stats.interface_calls);
+}
+
+static InterfaceCallDevirtualizationPass s_pass;
@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include "Pass.h"
+
+/*
+ * Turns the invoke-interface instructions whose receiver is known to be of
+ * some class into invoke-virtual instructions on the method of that class
+ * that implements the interface method, since interface dispatch is slower
+ * than virtual dispatch, in the interpreter especially.
+ *
+ * The class of a receiver is found by an intraprocedural analysis over the
+ * declared types of the values it may come from: the parameters, the fields,
+ * the results of calls and of check-casts, and the new instances. A receiver
+ * that may come from values of different types is left alone.
+ */
+class InterfaceCallDevirtualizationPass : public Pass {
+ public:
+  InterfaceCallDevirtualizationPass()
+      : Pass("InterfaceCallDevirtualizationPass") {}
+
+  virtual void run_pass(DexStoresVector&, ConfigFiles&, PassManager&) override;
+
+  virtual bool changes_class_hierarchy() const override { return false; }
+  virtual bool changes_method_signatures() const override { return false; }
+  virtual bool is_method_local() const override { return true; }
+};
+
+namespace interface_devirtualization {
+
+struct Stats {
+  size_t interface_calls{0};
+  size_t devirtualized{0};
+
+  Stats& operator+=(const Stats& that) {
+    interface_calls += that.interface_calls;
+    devirtualized += that.devirtualized;
+    return *this;
+  }
+};
+
+// Rewrites the interface calls of `method` that can be.
+Stats devirtualize(DexMethod* method);
+
+} // namespace interface_devirtualization
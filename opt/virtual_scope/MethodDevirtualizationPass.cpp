@@ -9,6 +9,7 @@
 
 #include "MethodDevirtualizationPass.h"
 #include "DexUtil.h"
+#include "HierarchyCache.h"
 #include "MethodDevirtualizer.h"
 
 void MethodDevirtualizationPass::run_pass(DexStoresVector& stores,
@@ -20,7 +21,8 @@ void MethodDevirtualizationPass::run_pass(DexStoresVector& stores,
                              m_staticize_dmethods_using_this,
                              m_ignore_keep);
   const auto scope = build_class_scope(stores);
-  const auto metrics = devirt.devirtualize_methods(scope);
+  const auto metrics = devirt.devirtualize_methods(
+      scope, scope, manager.get_hierarchy_cache().get_signature_map());
   manager.incr_metric("num_staticized_methods_drop_this",
                       metrics.num_methods_not_using_this);
   manager.incr_metric("num_staticized_methods_keep_this",
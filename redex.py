@@ -227,11 +227,39 @@ def move_dexen_to_directories(root, dexpaths):
     return res
 
 
-def unzip_apk(apk, destination_directory):
+def find_apkutil(redex_binary):
+    """
+    redex-apkutil unpacks and repacks APKs on all cores. It is looked for
+    next to the redex binary, then on the PATH, then next to this script.
+    Returns None if it can't be found, in which case zipfile is used.
+    """
+    candidates = []
+    if redex_binary is not None:
+        candidates.append(join(dirname(abspath(redex_binary)), 'redex-apkutil'))
+    try:
+        candidates.append(subprocess.check_output(
+            ['which', 'redex-apkutil']).rstrip().decode('ascii'))
+    except subprocess.CalledProcessError:
+        pass
+    dir_name = dirname(abspath(__file__))
+    while not isdir(dir_name):
+        dir_name = dirname(dir_name)
+    candidates.append(join(dir_name, 'redex-apkutil'))
+    for candidate in candidates:
+        if isfile(candidate) and os.access(candidate, os.X_OK):
+            return candidate
+    return None
+
+
+def unzip_apk(apk, destination_directory, apkutil=None):
     with zipfile.ZipFile(apk) as z:
         for info in z.infolist():
             per_file_compression[info.filename] = info.compress_type
-        z.extractall(destination_directory)
+        if apkutil is None:
+            z.extractall(destination_directory)
+    if apkutil is not None:
+        subprocess.check_call(
+            [apkutil, 'unpack', apk, destination_directory])
 
 
 def zipalign(unaligned_apk_path, output_apk_path, ignore_zipalign, page_align):
@@ -255,7 +283,8 @@ def zipalign(unaligned_apk_path, output_apk_path, ignore_zipalign, page_align):
 
 
 def create_output_apk(extracted_apk_dir, output_apk_path, sign, keystore,
-        key_alias, key_password, ignore_zipalign, page_align):
+        key_alias, key_password, ignore_zipalign, page_align,
+        apkutil=None, input_apk=None):
 
     # Remove old signature files
     for f in abs_glob(extracted_apk_dir, 'META-INF/*'):
@@ -269,6 +298,26 @@ def create_output_apk(extracted_apk_dir, output_apk_path, sign, keystore,
     if isfile(unaligned_apk_path):
         os.remove(unaligned_apk_path)
 
+    if apkutil is not None:
+        # redex-apkutil writes an aligned APK, so zipalign is only needed
+        # again if signing moves the entries.
+        packed_apk_path = unaligned_apk_path if sign else output_apk_path
+        if isfile(packed_apk_path):
+            os.remove(packed_apk_path)
+        args = [apkutil, 'pack', extracted_apk_dir, packed_apk_path]
+        if input_apk is not None:
+            args += ['--reference', input_apk]
+        if page_align:
+            args += ['--page-align']
+        subprocess.check_call(args)
+        if sign:
+            sign_apk(keystore, key_password, key_alias, unaligned_apk_path)
+            if isfile(output_apk_path):
+                os.remove(output_apk_path)
+            zipalign(unaligned_apk_path, output_apk_path, ignore_zipalign,
+                    page_align)
+        return
+
     # Create new zip file
     with zipfile.ZipFile(unaligned_apk_path, 'w') as unaligned_apk:
         for dirpath, _dirnames, filenames in os.walk(extracted_apk_dir):
@@ -530,8 +579,12 @@ def run_redex(args):
     if not extracted_apk_dir:
         extracted_apk_dir = make_temp_dir('.redex_extracted_apk', debug_mode)
 
+    apkutil = find_apkutil(binary)
+    if apkutil is not None:
+        log('Using redex-apkutil at ' + apkutil)
+
     log('Extracting apk...')
-    unzip_apk(args.input_apk, extracted_apk_dir)
+    unzip_apk(args.input_apk, extracted_apk_dir, apkutil)
 
     dex_mode = unpacker.detect_secondary_dex_mode(extracted_apk_dir)
     log('Detected dex mode ' + str(type(dex_mode).__name__))
@@ -630,7 +683,8 @@ def run_redex(args):
 
     log('Creating output apk')
     create_output_apk(extracted_apk_dir, args.out, args.sign, args.keystore,
-            args.keyalias, args.keypass, args.ignore_zipalign, args.page_align_libs)
+            args.keyalias, args.keypass, args.ignore_zipalign, args.page_align_libs,
+            apkutil, args.input_apk)
     log('Creating output APK finished in {:.2f} seconds'.format(
             timer() - repack_start_time))
     copy_file_to_out_dir(dex_dir, args.out, 'redex-line-number-map', 'line number map', 'redex-line-number-map')
@@ -643,6 +697,7 @@ def run_redex(args):
     copy_file_to_out_dir(dex_dir, args.out, 'bytecode_offset_map.txt', 'bytecode offset map', 'redex-bytecode-offset-map.txt')
     copy_file_to_out_dir(dex_dir, args.out, 'coldstart_fields_in_R_classes.txt', 'resources accessed during coldstart', 'redex-tracked-coldstart-resources.txt')
     copy_file_to_out_dir(dex_dir, args.out, 'class_dependencies.txt', 'stats', 'redex-class-dependencies.txt')
+    copy_file_to_out_dir(dex_dir, args.out, 'class-locators.bin', 'class locator table', 'redex-class-locators.bin')
     copy_file_to_out_dir(dex_dir, args.out, 'resid-optres-mapping.json', 'resid map after optres pass', 'redex-resid-optres-mapping.json')
     copy_file_to_out_dir(dex_dir, args.out, 'resid-dedup-mapping.json', 'resid map after dedup pass', 'redex-resid-dedup-mapping.json')
     copy_file_to_out_dir(dex_dir, args.out, 'resid-splitres-mapping.json', 'resid map after split pass', 'redex-resid-splitres-mapping.json')
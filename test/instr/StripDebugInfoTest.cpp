@@ -28,9 +28,7 @@ TEST_F(PreVerify, StripDebugInfo) {
       if (!debug_item) continue;
       for (const auto& e : debug_item->get_entries()) {
         if (e.type == DexDebugEntryType::Instruction) {
-          DexDebugInstruction* dbg_op = e.insn.get();
-          if (!dbg_op) continue;
-          auto op = dbg_op->opcode();
+          auto op = e.insn.opcode();
           if (op == DBG_SET_PROLOGUE_END) {
             found_prologue_end = true;
             break;
@@ -59,9 +57,7 @@ TEST_F(PostVerify, StripDebugInfo) {
       }
       for (const auto& e : debug_item->get_entries()) {
         if (e.type == DexDebugEntryType::Instruction) {
-          DexDebugInstruction* dbg_op = e.insn.get();
-          if (!dbg_op) continue;
-          auto op = dbg_op->opcode();
+          auto op = e.insn.opcode();
           // Make sure all prologue begin, epilogue end and local variable
           // references are gone.
           EXPECT_NE(DBG_SET_PROLOGUE_END, op);
@@ -16,6 +16,9 @@
 #include <string>
 #include <vector>
 
+#include <boost/filesystem.hpp>
+
+#include "Creators.h"
 #include "DexClass.h"
 #include "DexLoader.h"
 #include "DexStore.h"
@@ -329,5 +332,24 @@ TEST(PointsToSemanticsTest, semanticActionGeneration) {
   }
   EXPECT_THAT(deserialization, ::testing::ContainerEq(method_semantics));
 
+  // Testing the binary serialization of stubs. They are loaded into the
+  // semantics of a scope that defines none of the methods.
+  auto stubs_file = (boost::filesystem::temp_directory_path() /
+                     boost::filesystem::unique_path("redex-pts-%%%%-%%%%"))
+                        .string();
+  pt_semantics.write_stubs(stubs_file);
+  ClassCreator creator(DexType::make_type("Lcom/facebook/redextest/Empty;"));
+  creator.set_super(get_object_type());
+  PointsToSemantics stub_semantics(Scope{creator.create()});
+  stub_semantics.load_stubs(stubs_file);
+  boost::filesystem::remove(stubs_file);
+  std::set<std::string> stub_output;
+  for (const auto& pt_entry : stub_semantics) {
+    std::ostringstream out;
+    out << pt_entry.second;
+    stub_output.insert(out.str());
+  }
+  EXPECT_THAT(stub_output, ::testing::ContainerEq(method_semantics));
+
   delete g_redex;
 }
@@ -91,8 +91,7 @@ TEST(StripDebugInfoTest, StripPrologueEnd) {
 
   run_test_pass(pass, [&](const MethodItemEntry& mei) {
     if (mei.type == MFLOW_DEBUG) {
-      DexDebugInstruction* dbgop = mei.dbgop.get();
-      auto op = dbgop->opcode();
+      auto op = mei.dbgop.opcode();
       EXPECT_NE(DBG_SET_PROLOGUE_END, op);
     }
   });
@@ -105,8 +104,7 @@ TEST(StripDebugInfoTest, StripEpilogueBegin) {
 
   run_test_pass(pass, [&](const MethodItemEntry& mei) {
     if (mei.type == MFLOW_DEBUG) {
-      DexDebugInstruction* dbgop = mei.dbgop.get();
-      auto op = dbgop->opcode();
+      auto op = mei.dbgop.opcode();
       EXPECT_NE(DBG_SET_EPILOGUE_BEGIN, op);
     }
   });
@@ -119,8 +117,7 @@ TEST(StripDebugInfoTest, StripLocals) {
 
   run_test_pass(pass, [&](const MethodItemEntry& mei) {
     if (mei.type == MFLOW_DEBUG) {
-      DexDebugInstruction* dbgop = mei.dbgop.get();
-      auto op = dbgop->opcode();
+      auto op = mei.dbgop.opcode();
       // Make sure all DBG_*LOCAL* ops were removed.
       EXPECT_NE(DBG_START_LOCAL, op);
       EXPECT_NE(DBG_START_LOCAL_EXTENDED, op);
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <utility>
+
+#include "AhoCorasick.h"
+
+namespace {
+
+using Matches = std::vector<std::pair<size_t, size_t>>;
+
+Matches search(const AhoCorasick& ac, const std::string& text) {
+  Matches matches;
+  ac.search(text.data(),
+            text.data() + text.size(),
+            [&](size_t pattern, const char* match_end) {
+              matches.emplace_back(pattern, match_end - text.data());
+            });
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
+
+Matches search_naively(const std::vector<std::string>& patterns,
+                       const std::string& text) {
+  Matches matches;
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    for (auto pos = text.find(patterns[i]); pos != std::string::npos;
+         pos = text.find(patterns[i], pos + 1)) {
+      matches.emplace_back(i, pos + patterns[i].size());
+    }
+  }
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
+
+} // namespace
+
+TEST(AhoCorasickTest, overlappingPatterns) {
+  std::vector<std::string> patterns = {"he", "she", "his", "hers"};
+  AhoCorasick ac(patterns);
+  Matches expected = {{0, 4}, {1, 4}, {3, 6}};
+  EXPECT_EQ(search(ac, "ushers"), expected);
+  EXPECT_EQ(search(ac, ""), Matches());
+}
+
+TEST(AhoCorasickTest, containsAny) {
+  AhoCorasick ac({"Lcom/foo/", "Bar;"});
+  auto contains_any = [&](const std::string& text) {
+    return ac.contains_any(text.data(), text.data() + text.size());
+  };
+  EXPECT_TRUE(contains_any("Lcom/foo/Baz;"));
+  EXPECT_TRUE(contains_any("Lcom/baz/Bar;"));
+  EXPECT_FALSE(contains_any("Lcom/fo/Baz;"));
+  EXPECT_FALSE(contains_any(""));
+}
+
+TEST(AhoCorasickTest, sameAsNaiveSearch) {
+  std::vector<std::string> patterns = {"\"",
+                                       ".m4a\"",
+                                       "uri:",
+                                       "aab",
+                                       "ab",
+                                       "b",
+                                       std::string("\xff\0", 2),
+                                       "registerAsset("};
+  AhoCorasick ac(patterns);
+  std::mt19937 gen(7);
+  const std::string alphabet = std::string("ab\".m4uri:\xff\0", 12);
+  std::string text;
+  for (size_t i = 0; i < 5000; ++i) {
+    text += alphabet[gen() % alphabet.size()];
+  }
+  text += "registerAsset(";
+  EXPECT_EQ(search(ac, text), search_naively(patterns, text));
+}
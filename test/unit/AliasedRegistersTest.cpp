@@ -374,3 +374,24 @@ TEST(AliasedRegistersTest, AbstractValueJoin) {
   EXPECT_FALSE(a.are_aliases(four, two));
   EXPECT_FALSE(a.are_aliases(four, three));
 }
+
+TEST(AliasedRegistersTest, CopiesAreIndependent) {
+  AliasedRegisters a;
+  a.move(zero, one);
+  a.move(two, one);
+
+  AliasedRegisters b(a);
+  EXPECT_TRUE(b.equals(a));
+  b.break_alias(one);
+  b.move(three, zero);
+
+  EXPECT_TRUE(a.are_aliases(zero, one));
+  EXPECT_TRUE(a.are_aliases(zero, two));
+  EXPECT_FALSE(a.are_aliases(zero, three));
+  EXPECT_EQ(1, a.get_representative(two));
+
+  EXPECT_FALSE(b.are_aliases(zero, one));
+  EXPECT_TRUE(b.are_aliases(zero, three));
+  EXPECT_EQ(0, b.get_representative(two));
+  EXPECT_EQ(0, b.get_representative(three));
+}
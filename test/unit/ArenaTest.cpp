@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+#include "ArenaAllocator.h"
+#include "WorkQueue.h"
+
+TEST(ArenaTest, alignment) {
+  Arena arena(64);
+  for (size_t i = 0; i < 100; ++i) {
+    arena.allocate(i % 7 + 1, 1);
+    auto p = arena.allocate(sizeof(uint64_t), alignof(uint64_t));
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % alignof(uint64_t));
+  }
+  EXPECT_GT(arena.num_chunks(), 1);
+}
+
+TEST(ArenaTest, largeAllocation) {
+  Arena arena(64);
+  auto p = static_cast<char*>(arena.allocate(1000, 1));
+  memset(p, 'x', 1000);
+  auto s = arena.copy_string("abc", 3);
+  EXPECT_STREQ("abc", s);
+  EXPECT_EQ('x', p[999]);
+}
+
+TEST(ArenaTest, concurrentStrings) {
+  Arena arena(256);
+  constexpr size_t kNumStrings = 10000;
+  std::vector<const char*> copies(kNumStrings);
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) {
+        auto str = std::to_string(i);
+        copies[i] = arena.copy_string(str.c_str(), str.size());
+      },
+      4);
+  for (size_t i = 0; i < kNumStrings; ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  for (size_t i = 0; i < kNumStrings; ++i) {
+    EXPECT_EQ(std::to_string(i), copies[i]);
+  }
+}
+
+TEST(ArenaTest, containers) {
+  Arena arena(256);
+  arena::vector<int> numbers(arena);
+  arena::unordered_map<int, std::string> names(0, arena);
+  for (int i = 0; i < 100; ++i) {
+    numbers.push_back(i);
+    names.emplace(i, std::to_string(i));
+  }
+  EXPECT_EQ(99, numbers.back());
+  EXPECT_EQ("42", names.at(42));
+  EXPECT_GE(arena.bytes_allocated(), 100 * sizeof(int));
+  EXPECT_GE(arena.bytes_reserved(), arena.bytes_allocated());
+}
+
+TEST(ArenaTest, hugePages) {
+  Arena::set_huge_pages(true);
+  {
+    Arena arena(64);
+    auto p = static_cast<char*>(arena.allocate(3 << 20, 1));
+    memset(p, 'x', 3 << 20);
+    EXPECT_EQ('x', p[(3 << 20) - 1]);
+    EXPECT_LE(arena.bytes_in_huge_pages(), arena.bytes_reserved());
+#ifdef __linux__
+    // Chunks cover whole huge pages.
+    EXPECT_EQ(0, arena.bytes_reserved() % (2 << 20));
+    EXPECT_EQ(6 << 20, arena.bytes_reserved());
+#endif
+  }
+  Arena::set_huge_pages(false);
+  Arena arena(64);
+  EXPECT_EQ(64, arena.bytes_reserved());
+  EXPECT_EQ(0, arena.bytes_in_huge_pages());
+}
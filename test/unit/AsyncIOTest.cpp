@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "AsyncIO.h"
+
+using namespace async_io;
+
+namespace {
+
+std::string read_file(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+} // namespace
+
+struct AsyncIOTest : testing::Test {
+  AsyncIOTest() {
+    m_dir = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("async-io-%%%%%%%%");
+    boost::filesystem::create_directories(m_dir);
+  }
+
+  ~AsyncIOTest() { boost::filesystem::remove_all(m_dir); }
+
+  std::string path(const char* name) { return (m_dir / name).string(); }
+
+  boost::filesystem::path m_dir;
+};
+
+TEST_F(AsyncIOTest, writesInOrder) {
+  AsyncWriter writer;
+  writer.write(path("map.txt"), "stale\n");
+  writer.write(path("map.txt"), "first\n");
+  for (int i = 0; i < 100; ++i) {
+    writer.write(path("map.txt"), std::to_string(i) + "\n", /* append */ true);
+  }
+  writer.flush();
+  std::string expected = "first\n";
+  for (int i = 0; i < 100; ++i) {
+    expected += std::to_string(i) + "\n";
+  }
+  EXPECT_EQ(read_file(path("map.txt")), expected);
+}
+
+TEST_F(AsyncIOTest, releasesBuffersOnceWritten) {
+  std::string bytes(1 << 20, 'x');
+  bool released = false;
+  {
+    AsyncWriter writer;
+    writer.write(path("classes.dex"), bytes.data(), bytes.size(), [&] {
+      released = true;
+    });
+  }
+  EXPECT_TRUE(released);
+  EXPECT_EQ(read_file(path("classes.dex")), bytes);
+}
+
+TEST_F(AsyncIOTest, prefetchIgnoresMissingFiles) {
+  prefetch_file(path("missing.dex"));
+  std::ofstream(path("present.dex")) << "dex";
+  prefetch_file(path("present.dex"));
+  EXPECT_EQ(read_file(path("present.dex")), "dex");
+}
+
+TEST_F(AsyncIOTest, failedWritesAbortOnFlush) {
+  AsyncWriter writer;
+  writer.write(path("no/such/dir/classes.dex"), "dex");
+  EXPECT_ANY_THROW(writer.flush());
+}
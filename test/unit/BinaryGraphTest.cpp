@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+
+#include "BinaryGraph.h"
+
+using namespace binary_graph;
+
+struct BinaryGraphTest : testing::Test {
+  BinaryGraphTest() {
+    m_file = boost::filesystem::temp_directory_path() /
+             boost::filesystem::unique_path("binary-graph-%%%%%%%%");
+  }
+
+  ~BinaryGraphTest() { boost::filesystem::remove(m_file); }
+
+  boost::filesystem::path m_file;
+};
+
+TEST_F(BinaryGraphTest, roundTrip) {
+  Graph graph;
+  auto a = graph.add_node(NodeKind::CLASS, "LA;", "classes");
+  auto b = graph.add_node(NodeKind::CLASS, "LB;", "classes");
+  auto c = graph.add_node(NodeKind::TYPE, "LC;", "external");
+  auto seed = graph.add_node(NodeKind::SEED, "<SEED>");
+  graph.edges[a] = {{c, 2}, {b, 1}, {c, 1}, {b, 1}};
+  graph.edges[seed] = {{a, 0}};
+  ASSERT_TRUE(write(graph, m_file.string()));
+
+  auto back = read(m_file.string());
+  ASSERT_EQ(back.nodes.size(), 4);
+  EXPECT_EQ(back.nodes[a].kind, NodeKind::CLASS);
+  EXPECT_EQ(back.nodes[a].name, "LA;");
+  EXPECT_EQ(back.nodes[b].label, "classes");
+  EXPECT_EQ(back.nodes[c].kind, NodeKind::TYPE);
+  EXPECT_EQ(back.nodes[c].label, "external");
+  EXPECT_EQ(back.nodes[seed].label, "");
+  // Sorted by target then kind, and the duplicate is gone.
+  std::vector<Edge> a_edges{{b, 1}, {c, 1}, {c, 2}};
+  EXPECT_EQ(back.edges[a], a_edges);
+  EXPECT_TRUE(back.edges[b].empty());
+  std::vector<Edge> seed_edges{{a, 0}};
+  EXPECT_EQ(back.edges[seed], seed_edges);
+}
+
+TEST_F(BinaryGraphTest, emptyGraph) {
+  ASSERT_TRUE(write(Graph(), m_file.string()));
+  auto back = read(m_file.string());
+  EXPECT_TRUE(back.nodes.empty());
+}
+
+TEST_F(BinaryGraphTest, unwritableFile) {
+  EXPECT_FALSE(write(Graph(), "/nonexistent/dir/graph.bin"));
+}
@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "BlockReordering.h"
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "ScopeHelper.h"
+
+using namespace block_reordering;
+
+struct BlockReorderingTest : testing::Test {
+  BlockReorderingTest() { g_redex = new RedexContext(); }
+
+  ~BlockReorderingTest() { delete g_redex; }
+
+  // Puts the methods, made from their name and code, in the class LFoo;.
+  static std::vector<DexMethod*> make_methods(
+      const std::vector<std::pair<const char*, const char*>>& methods,
+      Scope* scope) {
+    ClassCreator creator(DexType::make_type("LFoo;"));
+    creator.set_super(get_object_type());
+    std::vector<DexMethod*> result;
+    for (const auto& pair : methods) {
+      auto method = create_method_from_code(pair.first, pair.second);
+      method->get_code()->set_registers_size(3);
+      creator.add_method(method);
+      result.push_back(method);
+    }
+    scope->push_back(creator.create());
+    return result;
+  }
+};
+
+TEST_F(BlockReorderingTest, readProfile) {
+  std::istringstream metadata(
+      "#id,kind,method,block\n"
+      "0,method,LFoo;.bar:()V,\n"
+      "1,block,LFoo;.baz:(I)I,0\n"
+      "2,block,LFoo;.baz:(I)I,3\n");
+  std::istringstream counts("0,7\n1,5\n2,2\n");
+  auto profile = read_profile(metadata, counts);
+  ASSERT_EQ(profile.size(), 1);
+  BlockCounts expected{{0, 5}, {3, 2}};
+  EXPECT_EQ(profile.at("LFoo;.baz:(I)I"), expected);
+}
+
+TEST_F(BlockReorderingTest, likelyBranchFallsThrough) {
+  Scope scope;
+  auto method = make_methods({{"LFoo;.bar:(I)I", R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :likely)
+     (const v1 1)
+     (return v1)
+     :likely
+     (const v1 2)
+     (return v1)
+    )
+  )"}},
+                             &scope)[0];
+  Profile profile{{"LFoo;.bar:(I)I", {{0, 100}, {2, 100}}}};
+  auto stats = reorder(scope, profile, Config());
+  EXPECT_EQ(stats.methods_reordered, 1);
+  EXPECT_EQ(stats.branches_inverted, 1);
+  EXPECT_EQ(stats.gotos_added, 0);
+  expect_code_eq(method->get_code(), R"(
+    (
+     (load-param v0)
+     (if-nez v0 :unlikely)
+     (const v1 2)
+     (return v1)
+     :unlikely
+     (const v1 1)
+     (return v1)
+    )
+  )");
+}
+
+TEST_F(BlockReorderingTest, rotateLoop) {
+  Scope scope;
+  auto method = make_methods({{"LFoo;.bar:(I)I", R"(
+    (
+     (load-param v0)
+     (goto :loop)
+     :body
+     (add-int/lit8 v0 v0 -1)
+     :loop
+     (if-nez v0 :body)
+     (return v0)
+    )
+  )"}},
+                             &scope)[0];
+  Profile profile{{"LFoo;.bar:(I)I", {{0, 1}, {1, 10}, {2, 11}, {3, 1}}}};
+  auto stats = reorder(scope, profile, Config());
+  EXPECT_EQ(stats.methods_reordered, 1);
+  EXPECT_EQ(stats.gotos_removed, 1);
+  EXPECT_EQ(stats.branches_inverted, 1);
+  EXPECT_EQ(stats.gotos_added, 1);
+  expect_code_eq(method->get_code(), R"(
+    (
+     (load-param v0)
+     :loop
+     (if-eqz v0 :end)
+     (add-int/lit8 v0 v0 -1)
+     (goto :loop)
+     :end
+     (return v0)
+    )
+  )");
+}
+
+TEST_F(BlockReorderingTest, coldMethodsAreLeftAlone) {
+  Scope scope;
+  const char* code = R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :likely)
+     (const v1 1)
+     (return v1)
+     :likely
+     (const v1 2)
+     (return v1)
+    )
+  )";
+  auto method = make_methods({{"LFoo;.bar:(I)I", code}}, &scope)[0];
+  Profile profile{{"LFoo;.bar:(I)I", {{0, 3}, {2, 3}}}};
+  Config config;
+  config.hot_method_min_count = 10;
+  EXPECT_EQ(reorder(scope, profile, config).methods_reordered, 0);
+  expect_code_eq(method->get_code(), code);
+}
+
+TEST_F(BlockReorderingTest, outlineColdThrow) {
+  Scope scope;
+  // The exception depends on the argument.
+  const char* baz_code = R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :error)
+     (return v0)
+     :error
+     (new-instance "Ljava/lang/IllegalStateException;")
+     (move-result-pseudo-object v1)
+     (invoke-static (v0) "LFoo;.message:(I)Ljava/lang/String;")
+     (move-result-object v2)
+     (invoke-direct (v1 v2) "Ljava/lang/IllegalStateException;.<init>:(Ljava/lang/String;)V")
+     (throw v1)
+    )
+  )";
+  auto methods = make_methods(
+      {{"LFoo;.bar:(I)I", R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :error)
+     (return v0)
+     :error
+     (new-instance "Ljava/lang/IllegalStateException;")
+     (move-result-pseudo-object v1)
+     (const-string "bad")
+     (move-result-pseudo-object v2)
+     (invoke-direct (v1 v2) "Ljava/lang/IllegalStateException;.<init>:(Ljava/lang/String;)V")
+     (throw v1)
+    )
+  )"},
+       {"LFoo;.baz:(I)I", baz_code}},
+      &scope);
+  Profile profile{{"LFoo;.bar:(I)I", {{0, 5}, {1, 5}}},
+                  {"LFoo;.baz:(I)I", {{0, 5}, {1, 5}}}};
+  Config config;
+  config.outline_min_method_size = 0;
+  auto stats = reorder(scope, profile, config);
+  EXPECT_EQ(stats.methods_reordered, 0);
+  EXPECT_EQ(stats.cold_blocks_outlined, 1);
+
+  expect_code_eq(methods[0]->get_code(), R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :error)
+     (return v0)
+     :error
+     (invoke-static () "LFoo;.bar$cold$0:()Ljava/lang/Throwable;")
+     (move-result-object v1)
+     (throw v1)
+    )
+  )");
+  auto cold = static_cast<DexMethod*>(
+      DexMethod::get_method("LFoo;.bar$cold$0:()Ljava/lang/Throwable;"));
+  ASSERT_NE(cold, nullptr);
+  EXPECT_TRUE(is_private(cold) && is_static(cold));
+  EXPECT_EQ(cold->get_class(), methods[0]->get_class());
+  expect_code_eq(cold->get_code(), R"(
+    (
+     (new-instance "Ljava/lang/IllegalStateException;")
+     (move-result-pseudo-object v1)
+     (const-string "bad")
+     (move-result-pseudo-object v2)
+     (invoke-direct (v1 v2) "Ljava/lang/IllegalStateException;.<init>:(Ljava/lang/String;)V")
+     (return-object v1)
+    )
+  )");
+  expect_code_eq(methods[1]->get_code(), baz_code);
+}
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "CallGraph.h"
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "ReachableClasses.h"
+
+namespace {
+
+DexMethod* make_static_method(ClassCreator& creator,
+                              const std::string& name,
+                              const std::string& code) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(name));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC,
+                        assembler::ircode_from_string(code),
+                        /* is_virtual */ false);
+  creator.add_method(method);
+  return method;
+}
+
+std::vector<DexMethod*> callees_of(const call_graph::Graph& cg,
+                                   const DexMethod* method) {
+  std::vector<DexMethod*> result;
+  for (auto edge : cg.node(method).callees()) {
+    EXPECT_EQ(edge->caller(), method);
+    result.push_back(edge->callee());
+  }
+  return result;
+}
+
+std::vector<DexMethod*> callers_of(const call_graph::Graph& cg,
+                                   const DexMethod* method) {
+  std::vector<DexMethod*> result;
+  for (auto edge : cg.node(method).callers()) {
+    EXPECT_EQ(edge->callee(), method);
+    result.push_back(edge->caller());
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(CallGraphTest, edges) {
+  g_redex = new RedexContext();
+
+  ClassCreator creator(DexType::make_type("LFoo;"));
+  creator.set_super(get_object_type());
+  // The entry point calls bar() twice and baz() once; bar() calls baz().
+  auto main = make_static_method(creator, "LFoo;.main:()V", R"(
+    (
+     (invoke-static () "LFoo;.bar:()V")
+     (invoke-static () "LFoo;.baz:()V")
+     (invoke-static () "LFoo;.bar:()V")
+     (return-void)
+    )
+  )");
+  auto bar = make_static_method(creator, "LFoo;.bar:()V", R"(
+    (
+     (invoke-static () "LFoo;.baz:()V")
+     (return-void)
+    )
+  )");
+  auto baz = make_static_method(creator, "LFoo;.baz:()V", R"(
+    (
+     (return-void)
+    )
+  )");
+  Scope scope{creator.create()};
+  main->rstate.set_keep();
+
+  call_graph::Graph cg(scope);
+  EXPECT_EQ(cg.num_nodes(), 4);
+  EXPECT_EQ(cg.num_edges(), 5);
+
+  EXPECT_EQ(callees_of(cg, nullptr), std::vector<DexMethod*>({main}));
+  EXPECT_EQ(callers_of(cg, main), std::vector<DexMethod*>({nullptr}));
+  EXPECT_EQ(callees_of(cg, main), std::vector<DexMethod*>({bar, baz, bar}));
+  EXPECT_EQ(callees_of(cg, bar), std::vector<DexMethod*>({baz}));
+  EXPECT_EQ(callers_of(cg, bar), std::vector<DexMethod*>({main, main}));
+  // The class keeps its methods sorted, so bar() is walked before main().
+  EXPECT_EQ(callers_of(cg, baz), std::vector<DexMethod*>({bar, main}));
+  EXPECT_TRUE(cg.node(baz).callees().empty());
+
+  // The edges point at their invoke instructions.
+  auto callees = cg.node(main).callees();
+  EXPECT_EQ(callees[0]->invoke_iterator()->insn->get_method(), bar);
+  EXPECT_EQ(callees[1]->invoke_iterator()->insn->get_method(), baz);
+  EXPECT_EQ(cg.node(nullptr).callees()[0]->invoke_iterator(),
+            FatMethod::iterator());
+
+  EXPECT_EQ(call_graph::GraphInterface::node_index(cg, nullptr), 0);
+  EXPECT_EQ(call_graph::GraphInterface::successors(cg, bar).size(), 1);
+
+  delete g_redex;
+}
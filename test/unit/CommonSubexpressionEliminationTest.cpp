@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "CommonSubexpressionElimination.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "ScopeHelper.h"
+
+using namespace cse_impl;
+
+struct CommonSubexpressionEliminationTest : testing::Test {
+  CommonSubexpressionEliminationTest() { g_redex = new RedexContext(); }
+
+  ~CommonSubexpressionEliminationTest() { delete g_redex; }
+
+  Stats run(DexMethod* method) {
+    return CommonSubexpressionElimination(m_config).run(method);
+  }
+
+  CommonSubexpressionEliminationPass::Config m_config;
+};
+
+TEST_F(CommonSubexpressionEliminationTest, dominatedArithmetic) {
+  auto method = create_method_from_code("LFoo;.bar:(II)I", R"(
+    (
+     (load-param v0)
+     (load-param v1)
+     (add-int v2 v0 v1)
+     (if-eqz v0 :else)
+     (add-int v3 v1 v0)
+     (mul-int v4 v3 v3)
+     (mul-int v5 v2 v2)
+     (return v5)
+     :else
+     (mul-int v4 v2 v2)
+     (return v4)
+    )
+  )");
+  method->get_code()->set_registers_size(6);
+  auto stats = run(method);
+  EXPECT_EQ(stats.instructions_eliminated, 2);
+  // The second add-int has the same value number as the first one, and so
+  // do the products of either. v4 is also written on the other branch, so
+  // the first product is copied to a new register.
+  expect_code_eq(method->get_code(), R"(
+    (
+     (load-param v0)
+     (load-param v1)
+     (add-int v2 v0 v1)
+     (if-eqz v0 :else)
+     (move v3 v2)
+     (mul-int v4 v3 v3)
+     (move v6 v4)
+     (move v5 v6)
+     (return v5)
+     :else
+     (mul-int v4 v2 v2)
+     (return v4)
+    )
+  )");
+}
+
+TEST_F(CommonSubexpressionEliminationTest, siblingsAreNotRedundant) {
+  const char* code = R"(
+    (
+     (load-param v0)
+     (load-param v1)
+     (if-eqz v0 :else)
+     (sub-int v2 v0 v1)
+     (goto :join)
+     :else
+     (sub-int v2 v0 v1)
+     :join
+     (sub-int v3 v1 v0)
+     (return v3)
+    )
+  )";
+  auto method = create_method_from_code("LFoo;.bar:(II)I", code);
+  method->get_code()->set_registers_size(4);
+  auto stats = run(method);
+  EXPECT_EQ(stats.instructions_eliminated, 0);
+  expect_code_eq(method->get_code(), code);
+}
+
+TEST_F(CommonSubexpressionEliminationTest, finalFieldLoads) {
+  auto final_field =
+      static_cast<DexField*>(DexField::make_field("LFoo;.a:I"));
+  final_field->make_concrete(ACC_PUBLIC | ACC_FINAL);
+  auto field = static_cast<DexField*>(DexField::make_field("LFoo;.b:I"));
+  field->make_concrete(ACC_PUBLIC);
+
+  auto method = create_method_from_code("LBar;.bar:(LFoo;)I", R"(
+    (
+     (load-param-object v0)
+     (iget v0 "LFoo;.a:I")
+     (move-result-pseudo v1)
+     (const v1 0)
+     (iget v0 "LFoo;.a:I")
+     (move-result-pseudo v2)
+     (iget v0 "LFoo;.b:I")
+     (move-result-pseudo v3)
+     (iget v0 "LFoo;.b:I")
+     (move-result-pseudo v3)
+     (return v2)
+    )
+  )");
+  method->get_code()->set_registers_size(4);
+  auto stats = run(method);
+  EXPECT_EQ(stats.instructions_eliminated, 1);
+  EXPECT_EQ(stats.field_loads_eliminated, 1);
+  // v1 is written again, so the first load is copied to a new register.
+  expect_code_eq(method->get_code(), R"(
+    (
+     (load-param-object v0)
+     (iget v0 "LFoo;.a:I")
+     (move-result-pseudo v1)
+     (move v4 v1)
+     (const v1 0)
+     (move v2 v4)
+     (iget v0 "LFoo;.b:I")
+     (move-result-pseudo v3)
+     (iget v0 "LFoo;.b:I")
+     (move-result-pseudo v3)
+     (return v2)
+    )
+  )");
+
+  // The constructor writes the final field.
+  const char* init_code = R"(
+    (
+     (load-param-object v0)
+     (iget v0 "LFoo;.a:I")
+     (move-result-pseudo v1)
+     (const v2 1)
+     (iput v2 v0 "LFoo;.a:I")
+     (iget v0 "LFoo;.a:I")
+     (move-result-pseudo v1)
+     (return-void)
+    )
+  )";
+  auto init = create_method_from_code("LFoo;.<init>:()V", init_code);
+  init->get_code()->set_registers_size(3);
+  EXPECT_EQ(run(init).instructions_eliminated, 0);
+  expect_code_eq(init->get_code(), init_code);
+}
+
+TEST_F(CommonSubexpressionEliminationTest, immutableGetters) {
+  m_config.immutable_getters.emplace(
+      DexMethod::make_method("LFoo;.getA:()LA;"));
+  auto method = create_method_from_code("LBar;.bar:(LFoo;)V", R"(
+    (
+     (load-param-object v0)
+     (invoke-virtual (v0) "LFoo;.getA:()LA;")
+     (move-result-object v1)
+     (invoke-virtual (v0) "LFoo;.getB:()LB;")
+     (move-result-object v2)
+     (invoke-virtual (v0) "LFoo;.getA:()LA;")
+     (move-result-object v3)
+     (invoke-virtual (v0) "LFoo;.getB:()LB;")
+     (move-result-object v2)
+     (return-void)
+    )
+  )");
+  method->get_code()->set_registers_size(4);
+  auto stats = run(method);
+  EXPECT_EQ(stats.getter_calls_eliminated, 1);
+  expect_code_eq(method->get_code(), R"(
+    (
+     (load-param-object v0)
+     (invoke-virtual (v0) "LFoo;.getA:()LA;")
+     (move-result-object v1)
+     (invoke-virtual (v0) "LFoo;.getB:()LB;")
+     (move-result-object v2)
+     (move-object v3 v1)
+     (invoke-virtual (v0) "LFoo;.getB:()LB;")
+     (move-result-object v2)
+     (return-void)
+    )
+  )");
+}
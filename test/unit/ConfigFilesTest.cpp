@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+#include "ConfigFiles.h"
+#include "Creators.h"
+#include "DexUtil.h"
+
+namespace fs = boost::filesystem;
+
+TEST(ConfigFilesTest, resolveColdstartLists) {
+  g_redex = new RedexContext();
+
+  auto a_type = DexType::make_type("Lcom/foo/A;");
+  ClassCreator creator(a_type);
+  creator.set_super(get_object_type());
+  auto method = static_cast<DexMethod*>(
+      DexMethod::make_method("Lcom/foo/A;.bar:(I)V"));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  creator.add_method(method);
+  creator.create();
+  auto b_type = DexType::make_type("Lcom/foo/B;");
+
+  auto dir = fs::temp_directory_path() /
+             fs::unique_path("redex-coldstart-%%%%-%%%%");
+  fs::create_directories(dir);
+  auto classes_path = (dir / "classes.txt").string();
+  auto methods_path = (dir / "methods.txt").string();
+  std::ofstream(classes_path) << "com/foo/B.class\n"
+                              << "DexEndMarker0.class\n"
+                              << "com/foo/A.class\n"
+                              << "com/foo/B.class\n";
+  std::ofstream(methods_path) << "Lcom/foo/A;.bar(I)V\n"
+                              << "Lcom/foo/A;.baz()V\n";
+
+  Json::Value json;
+  json["coldstart_classes"] = classes_path;
+  json["coldstart_methods"] = methods_path;
+  ConfigFiles cfg(json);
+
+  std::vector<DexType*> types{b_type, nullptr, a_type, b_type};
+  EXPECT_EQ(cfg.get_coldstart_types(), types);
+  EXPECT_EQ(cfg.get_coldstart_types().size(),
+            cfg.get_coldstart_classes().size());
+  const auto& class_ranks = cfg.get_coldstart_class_ranks();
+  EXPECT_EQ(class_ranks.size(), 2);
+  EXPECT_EQ(class_ranks.at(b_type), 0);
+  EXPECT_EQ(class_ranks.at(a_type), 2);
+
+  std::vector<DexMethodRef*> refs{method, nullptr};
+  EXPECT_EQ(cfg.get_coldstart_method_refs(), refs);
+  EXPECT_EQ(cfg.get_coldstart_method_ranks().at(method), 0);
+
+  fs::remove_all(dir);
+  delete g_redex;
+}
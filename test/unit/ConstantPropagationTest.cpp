@@ -436,7 +436,8 @@ TEST(ConstantPropagation, SignedConstantDomainOperations) {
   EXPECT_EQ(max_val.interval(), Interval::GTZ);
   EXPECT_EQ(min_val.interval(), Interval::LTZ);
 
-  EXPECT_EQ(one.join(minus_one).interval(), Interval::ALL);
+  EXPECT_EQ(one.join(minus_one).interval(), Interval::NEZ);
+  EXPECT_EQ(one.join(minus_one).join(zero).interval(), Interval::ALL);
   EXPECT_EQ(one.join(zero).interval(), Interval::GEZ);
   EXPECT_EQ(minus_one.join(zero).interval(), Interval::LEZ);
   EXPECT_EQ(max_val.join(zero).interval(), Interval::GEZ);
@@ -446,13 +447,13 @@ TEST(ConstantPropagation, SignedConstantDomainOperations) {
   auto negative = SignedConstantDomain(Interval::LTZ);
 
   EXPECT_EQ(one.join(positive), positive);
-  EXPECT_TRUE(one.join(negative).is_top());
+  EXPECT_EQ(one.join(negative).interval(), Interval::NEZ);
   EXPECT_EQ(max_val.join(positive), positive);
-  EXPECT_TRUE(max_val.join(negative).is_top());
+  EXPECT_EQ(max_val.join(negative).interval(), Interval::NEZ);
   EXPECT_EQ(minus_one.join(negative), negative);
-  EXPECT_TRUE(minus_one.join(positive).is_top());
+  EXPECT_EQ(minus_one.join(positive).interval(), Interval::NEZ);
   EXPECT_EQ(min_val.join(negative), negative);
-  EXPECT_TRUE(min_val.join(positive).is_top());
+  EXPECT_EQ(min_val.join(positive).interval(), Interval::NEZ);
   EXPECT_EQ(zero.join(positive).interval(), Interval::GEZ);
   EXPECT_EQ(zero.join(negative).interval(), Interval::LEZ);
 
@@ -466,6 +467,92 @@ TEST(ConstantPropagation, SignedConstantDomainOperations) {
   EXPECT_TRUE(min_val.meet(positive).is_bottom());
 }
 
+TEST(ConstantPropagation, RedundantNullChecks) {
+  g_redex = new RedexContext();
+
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param-object v0)
+     (load-param-object v1)
+     (new-instance "LFoo;")
+     (move-result-pseudo-object v2)
+     (invoke-static (v2) "Ljava/util/Objects;.requireNonNull:(Ljava/lang/Object;)Ljava/lang/Object;")
+     (invoke-virtual (v0) "LFoo;.bar:()V")
+     (invoke-virtual (v0) "Ljava/lang/Object;.getClass:()Ljava/lang/Class;")
+     (invoke-static (v1) "Ljava/util/Objects;.requireNonNull:(Ljava/lang/Object;)Ljava/lang/Object;")
+     (move-result-object v3)
+     (if-nez v1 :non-null)
+     (const v4 0)
+
+     :non-null
+     (invoke-static (v1) "Ljava/util/Objects;.requireNonNull:(Ljava/lang/Object;)Ljava/lang/Object;")
+     (return-void)
+    )
+)");
+
+  ConstPropConfig config;
+  do_const_prop(code.get(), config);
+
+  // The result of the first check of v1 is used, so it stays.
+  auto expected_code = assembler::ircode_from_string(R"(
+    (
+     (load-param-object v0)
+     (load-param-object v1)
+     (new-instance "LFoo;")
+     (move-result-pseudo-object v2)
+     (invoke-virtual (v0) "LFoo;.bar:()V")
+     (invoke-static (v1) "Ljava/util/Objects;.requireNonNull:(Ljava/lang/Object;)Ljava/lang/Object;")
+     (move-result-object v3)
+     (goto :non-null)
+     (const v4 0)
+
+     :non-null
+     (return-void)
+    )
+)");
+  EXPECT_EQ(assembler::to_s_expr(code.get()),
+            assembler::to_s_expr(expected_code.get()));
+
+  delete g_redex;
+}
+
+TEST(ConstantPropagation, WhiteBoxNullness) {
+  g_redex = new RedexContext();
+
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param-object v0)
+     (const v1 0)
+     (instance-of v1 "LFoo;")
+     (move-result-pseudo v2)
+     (new-instance "LFoo;")
+     (move-result-pseudo-object v3)
+     (check-cast v3 "LFoo;")
+     (move-result-pseudo-object v4)
+     (move-object v5 v4)
+     (iget v0 "LFoo;.baz:I")
+     (move-result-pseudo v6)
+     (return-void)
+    )
+)");
+
+  ConstPropConfig config;
+  code->build_cfg();
+  auto& cfg = code->cfg();
+  cfg.calculate_exit_block();
+  cp::intraprocedural::FixpointIterator rcp(cfg, config);
+  rcp.run(ConstantEnvironment());
+
+  auto non_null = SignedConstantDomain(sign_domain::Interval::NEZ);
+  auto exit_state = rcp.get_exit_state_at(cfg.exit_block());
+  EXPECT_EQ(exit_state.get(0), non_null);
+  EXPECT_EQ(exit_state.get(2), SignedConstantDomain(0));
+  EXPECT_EQ(exit_state.get(4), non_null);
+  EXPECT_EQ(exit_state.get(5), non_null);
+
+  delete g_redex;
+}
+
 TEST(ConstantPropagation, WhiteBox1) {
   auto code = assembler::ircode_from_string(R"(
     (
@@ -9,6 +9,7 @@
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <sstream>
 
 #include "ControlFlow.h"
 
@@ -275,3 +276,34 @@ TEST(ControlFlow, findImmediateDominator) {
     EXPECT_EQ(idom[b5].dom, b1);
   }
 }
+
+TEST(ControlFlow, cachedWeakTopologicalOrdering) {
+  ControlFlowGraph cfg;
+  auto b0 = cfg.create_block();
+  auto b1 = cfg.create_block();
+  auto b2 = cfg.create_block();
+  cfg.set_entry_block(b0);
+  cfg.add_edge(b0, b1, EDGE_GOTO);
+  cfg.add_edge(b1, b2, EDGE_GOTO);
+  cfg.calculate_exit_block();
+
+  auto wto = cfg.wto(/* backwards */ false);
+  EXPECT_EQ(wto, cfg.wto(/* backwards */ false));
+  std::ostringstream before;
+  before << *wto;
+  EXPECT_EQ("0 1 2", before.str());
+
+  auto backward_wto = cfg.wto(/* backwards */ true);
+  EXPECT_NE(wto, backward_wto);
+  std::ostringstream backward;
+  backward << *backward_wto;
+  EXPECT_EQ("2 1 0", backward.str());
+
+  // Changing the edges invalidates the orderings.
+  cfg.add_edge(b1, b0, EDGE_GOTO);
+  auto new_wto = cfg.wto(/* backwards */ false);
+  EXPECT_NE(wto, new_wto);
+  std::ostringstream after;
+  after << *new_wto;
+  EXPECT_EQ("(0 1) 2", after.str());
+}
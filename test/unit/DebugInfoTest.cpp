@@ -86,3 +86,98 @@ TEST(DexPositionTest, consecutiveIdenticalPositions) {
 
   delete g_redex;
 }
+
+TEST(DexPositionTest, interning) {
+  g_redex = new RedexContext();
+
+  auto method =
+      static_cast<DexMethod*>(DexMethod::make_method("LFoo;.bar:()V"));
+  auto file = DexString::make_string("Foo.java");
+  auto callsite = DexPosition::make(method, file, 10);
+  EXPECT_EQ(callsite, DexPosition::make(method, file, 10));
+  EXPECT_NE(callsite, DexPosition::make(method, file, 11));
+  EXPECT_NE(callsite, DexPosition::make(method, nullptr, 10));
+
+  auto inlined = DexPosition::make(method, file, 20, callsite);
+  EXPECT_EQ(inlined, DexPosition::make(method, file, 20, callsite));
+  EXPECT_NE(inlined, DexPosition::make(method, file, 20));
+  EXPECT_EQ(callsite, inlined->parent);
+
+  auto unbound = DexPosition::make(10);
+  EXPECT_EQ(nullptr, unbound->method);
+  EXPECT_EQ(callsite, unbound->bind(method, file));
+
+  delete g_redex;
+}
+
+TEST(DexPositionTest, sharedParentEmittedOnce) {
+  g_redex = new RedexContext();
+
+  auto method =
+      static_cast<DexMethod*>(DexMethod::make_method("LFoo;.bar:()V"));
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  auto file = DexString::make_string("Foo.java");
+  auto callsite = DexPosition::make(method, file, 10);
+  auto inlined = DexPosition::make(method, file, 20, callsite);
+  auto after = DexPosition::make(method, file, 30);
+
+  // The call site's position is carried by two entries, only the first one is
+  // needed as the parent of the inlined position.
+  auto code = std::make_unique<IRCode>();
+  code->set_registers_size(1);
+  code->push_back(callsite);
+  code->push_back(inlined);
+  code->push_back(
+      (new IRInstruction(OPCODE_CONST))->set_dest(0)->set_literal(0));
+  code->push_back(callsite);
+  code->push_back(after);
+  code->push_back(
+      (new IRInstruction(OPCODE_CONST))->set_dest(0)->set_literal(0));
+  code->push_back(new IRInstruction(OPCODE_RETURN_VOID));
+  code->set_debug_item(std::make_unique<DexDebugItem>());
+  method->set_code(std::move(code));
+
+  instruction_lowering::lower(method);
+  method->sync();
+  method->balloon();
+
+  std::vector<DexPosition*> positions;
+  for (const auto& mie : *method->get_code()) {
+    if (mie.type == MFLOW_POSITION) {
+      positions.push_back(mie.pos);
+    }
+  }
+  EXPECT_EQ(std::vector<DexPosition*>({callsite, inlined, after}), positions);
+
+  delete g_redex;
+}
+
+TEST(DexDebugInstructionTest, startLocal) {
+  g_redex = new RedexContext();
+
+  auto name = DexString::make_string("x");
+  auto type = DexType::make_type("I");
+  auto sig = DexString::make_string("TT;");
+  auto local = DexDebugInstruction::make_start_local(3, name, type);
+  EXPECT_EQ(DBG_START_LOCAL, local.opcode());
+  EXPECT_EQ(3, local.uvalue());
+  EXPECT_EQ(name, local.name());
+  EXPECT_EQ(type, local.type());
+  EXPECT_EQ(nullptr, local.sig());
+
+  auto extended = DexDebugInstruction::make_start_local(4, name, type, sig);
+  EXPECT_EQ(DBG_START_LOCAL_EXTENDED, extended.opcode());
+  EXPECT_EQ(sig, extended.sig());
+
+  // The instructions are values, the copies of a method's code get their own.
+  auto code = std::make_unique<IRCode>();
+  code->push_back(local);
+  code->push_back(new IRInstruction(OPCODE_RETURN_VOID));
+  IRCode copy(*code);
+  auto& copied = copy.begin()->dbgop;
+  copied.set_uvalue(5);
+  EXPECT_EQ(3, code->begin()->dbgop.uvalue());
+  EXPECT_EQ(name, copied.name());
+
+  delete g_redex;
+}
@@ -9,6 +9,8 @@
 
 #include <gtest/gtest.h>
 #include <iterator>
+#include <string>
+#include <unordered_map>
 
 #include "Creators.h"
 #include "ControlFlow.h"
@@ -67,7 +69,9 @@ struct DedupBlocksTest : testing::Test {
   ~DedupBlocksTest() { delete g_redex; }
 };
 
-void run_passes(std::vector<Pass*> passes, std::vector<DexClass*> classes) {
+// Returns the metrics of the first pass.
+std::unordered_map<std::string, int> run_passes(
+    std::vector<Pass*> passes, std::vector<DexClass*> classes) {
   std::vector<DexStore> stores;
   DexMetadata dm;
   dm.set_id("classes");
@@ -81,6 +85,7 @@ void run_passes(std::vector<Pass*> passes, std::vector<DexClass*> classes) {
   Json::Value conf_obj = Json::nullValue;
   ConfigFiles dummy_config(conf_obj);
   manager.run_passes(stores, external_classes, dummy_config);
+  return manager.get_pass_info().at(0).metrics;
 }
 
 // in Code:     A B E C D          (where C == D)
@@ -246,3 +251,24 @@ TEST_F(DedupBlocksTest, noFallthrough) {
   printf("Result cfg:\n%s\n", SHOW(code->cfg()));
   EXPECT_EQ(5, code->cfg().blocks().size());
 }
+
+// Two methods that end in the same three instructions. Neither has a copy
+// within itself, but the copies across them are counted.
+TEST_F(DedupBlocksTest, crossMethodTails) {
+  using namespace dex_asm;
+  for (auto name : {"first", "second"}) {
+    auto code = get_fresh_method(name)->get_code();
+    code->push_back(dasm(OPCODE_CONST, {0_v, 1_L}));
+    code->push_back(dasm(OPCODE_MUL_INT, {0_v, 0_v, 0_v}));
+    code->push_back(dasm(OPCODE_ADD_INT, {0_v, 0_v, 0_v}));
+    code->push_back(dasm(OPCODE_RETURN_VOID));
+  }
+
+  auto pass = new DedupBlocksPass();
+  pass->m_config.report_cross_method_dups = true;
+  auto metrics = run_passes({pass}, {m_class});
+  EXPECT_EQ(0, metrics["blocks_removed"]);
+  EXPECT_EQ(1, metrics["cross_method_dup_blocks"]);
+  EXPECT_EQ(4, metrics["cross_method_dup_insns"]);
+  EXPECT_EQ(1, metrics["cross_method_dup_tails"]);
+}
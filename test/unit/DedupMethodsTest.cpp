@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <unordered_map>
+
+#include "Creators.h"
+#include "DedupMethodsPass.h"
+#include "DexAsm.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "ScopeHelper.h"
+
+struct DedupMethodsTest : testing::Test {
+  DedupMethodsTest() { g_redex = new RedexContext(); }
+
+  ~DedupMethodsTest() { delete g_redex; }
+
+  DexClass* make_class(const char* name) {
+    ClassCreator creator(DexType::make_type(name));
+    creator.set_super(get_object_type());
+    return creator.create();
+  }
+
+  DexMethod* add_method(DexClass* cls,
+                        const char* name,
+                        DexAccessFlags access,
+                        const std::string& code) {
+    auto method = create_method_from_code(
+        cls->get_type()->get_name()->str() + "." + name + ":(I)I",
+        code,
+        access);
+    cls->add_method(method);
+    return method;
+  }
+};
+
+// Returns the metrics of the first pass.
+std::unordered_map<std::string, int> run_passes(
+    std::vector<Pass*> passes, std::vector<DexClass*> classes) {
+  std::vector<DexStore> stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes(classes);
+  stores.emplace_back(std::move(store));
+  PassManager manager(passes);
+  manager.set_testing_mode();
+
+  Scope external_classes;
+  Json::Value conf_obj = Json::nullValue;
+  ConfigFiles dummy_config(conf_obj);
+  manager.run_passes(stores, external_classes, dummy_config);
+  return manager.get_pass_info().at(0).metrics;
+}
+
+const char* kBody = R"(
+  (
+   (load-param v0)
+   (add-int/lit8 v0 v0 1)
+   (mul-int v0 v0 v0)
+   (add-int/lit8 v0 v0 2)
+   (return v0)
+  )
+)";
+
+TEST_F(DedupMethodsTest, staticCopiesAcrossClasses) {
+  auto cls_a = make_class("LA;");
+  auto cls_b = make_class("LB;");
+  auto foo = add_method(cls_a, "foo", ACC_PRIVATE | ACC_STATIC, kBody);
+  auto bar = add_method(cls_b, "bar", ACC_PRIVATE | ACC_STATIC, kBody);
+  auto caller = add_method(cls_b, "caller", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (load-param v0)
+     (invoke-static (v0) "LB;.bar:(I)I")
+     (move-result v0)
+     (return v0)
+    )
+  )");
+
+  DedupMethodsPass pass;
+  auto metrics = run_passes({&pass}, {cls_a, cls_b});
+
+  EXPECT_EQ(1, metrics.at("duplicate_methods"));
+  EXPECT_EQ(1, metrics.at("methods_removed"));
+  auto& dmethods = cls_b->get_dmethods();
+  EXPECT_EQ(dmethods.end(), std::find(dmethods.begin(), dmethods.end(), bar));
+  // The canonical copy is now called from another class.
+  EXPECT_TRUE(is_public(foo));
+  EXPECT_TRUE(is_public(cls_a));
+  for (const auto& mie : InstructionIterable(caller->get_code())) {
+    if (is_invoke(mie.insn->opcode())) {
+      EXPECT_EQ(foo, mie.insn->get_method());
+    }
+  }
+}
+
+TEST_F(DedupMethodsTest, differentCatchTypes) {
+  using namespace dex_asm;
+  auto cls = make_class("LA;");
+  auto add_catching_method = [&](const char* name, const char* catch_type) {
+    auto method = add_method(cls, name, ACC_PRIVATE | ACC_STATIC, kBody);
+    method->set_code(std::make_unique<IRCode>(method, 0));
+    auto code = method->get_code();
+    auto catch_start = new MethodItemEntry(DexType::make_type(catch_type));
+    code->push_back(TRY_START, catch_start);
+    code->push_back(dasm(OPCODE_ADD_INT_LIT8, {0_v, 0_v, 1_L}));
+    code->push_back(dasm(OPCODE_MUL_INT, {0_v, 0_v, 0_v}));
+    code->push_back(TRY_END, catch_start);
+    code->push_back(dasm(OPCODE_RETURN, {0_v}));
+    code->push_back(*catch_start);
+    code->push_back(dasm(OPCODE_CONST, {0_v, 0_L}));
+    code->push_back(dasm(OPCODE_RETURN, {0_v}));
+  };
+  add_catching_method("foo", "Ljava/lang/ArithmeticException;");
+  add_catching_method("bar", "Ljava/lang/RuntimeException;");
+
+  DedupMethodsPass pass;
+  auto metrics = run_passes({&pass}, {cls});
+
+  // Same instructions, but they don't handle the same exceptions.
+  EXPECT_EQ(0, metrics.at("duplicate_methods"));
+  EXPECT_EQ(2, cls->get_dmethods().size());
+}
+
+TEST_F(DedupMethodsTest, staticInitializerKeepsCopy) {
+  auto cls_a = make_class("LA;");
+  auto cls_b = make_class("LB;");
+  add_method(cls_a, "foo", ACC_PUBLIC | ACC_STATIC, kBody);
+  add_method(cls_b, "bar", ACC_PUBLIC | ACC_STATIC, kBody);
+  cls_b->add_method(create_method_from_code(
+      "LB;.<clinit>:()V", "((return-void))", ACC_STATIC | ACC_CONSTRUCTOR));
+
+  DedupMethodsPass pass;
+  auto metrics = run_passes({&pass}, {cls_a, cls_b});
+
+  // Calling A.foo instead of B.bar would skip initializing B.
+  EXPECT_EQ(0, metrics.at("duplicate_methods"));
+}
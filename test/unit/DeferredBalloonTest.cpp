@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#include "DexClass.h"
+#include "DexLoader.h"
+#include "IRCode.h"
+#include "InstructionLowering.h"
+#include "RedexContext.h"
+
+namespace {
+
+DexMethod* make_method_with_dex_code(DexString* str) {
+  DexType* ty = DexType::make_type("Lfoo;");
+  auto* method = static_cast<DexMethod*>(DexMethod::make_method(
+      ty,
+      DexString::make_string("bar"),
+      DexProto::make_proto(DexType::make_type("V"),
+                           DexTypeList::make_type_list({}))));
+  auto code = std::make_unique<DexCode>();
+  auto const_string = new DexOpcodeString(DOPCODE_CONST_STRING, str);
+  const_string->set_dest(0);
+  code->get_instructions().push_back(const_string);
+  code->get_instructions().push_back(new DexInstruction(DOPCODE_RETURN_VOID));
+  code->set_registers_size(1);
+  method->make_concrete(ACC_PUBLIC | ACC_STATIC, std::move(code), false);
+  return method;
+}
+
+} // namespace
+
+TEST(DeferredBalloonTest, balloonsOnFirstAccess) {
+  g_redex = new RedexContext();
+  auto str = DexString::make_string("hello");
+  auto method = make_method_with_dex_code(str);
+
+  method->defer_balloon();
+  EXPECT_TRUE(method->is_balloon_deferred());
+
+  // Gathering looks at the DexCode without ballooning it.
+  std::vector<DexString*> strings;
+  method->gather_strings(strings);
+  EXPECT_NE(std::find(strings.begin(), strings.end(), str), strings.end());
+  EXPECT_TRUE(method->is_balloon_deferred());
+  EXPECT_NE(nullptr, method->get_dex_code());
+
+  auto code = method->get_code();
+  ASSERT_NE(nullptr, code);
+  EXPECT_FALSE(method->is_balloon_deferred());
+  EXPECT_EQ(nullptr, method->get_dex_code());
+  EXPECT_EQ(2, code->count_opcodes());
+  EXPECT_EQ(code, method->get_code());
+
+  delete g_redex;
+}
+
+TEST(DeferredBalloonTest, setCodeDropsDeferredDexCode) {
+  g_redex = new RedexContext();
+  auto method = make_method_with_dex_code(DexString::make_string("hello"));
+  method->defer_balloon();
+
+  auto code = std::make_unique<IRCode>();
+  code->push_back(new IRInstruction(OPCODE_RETURN_VOID));
+  method->set_code(std::move(code));
+  EXPECT_FALSE(method->is_balloon_deferred());
+  EXPECT_EQ(nullptr, method->get_dex_code());
+  EXPECT_EQ(1, method->get_code()->count_opcodes());
+
+  delete g_redex;
+}
+
+TEST(DeferredBalloonTest, unballoonDefersUntilNextAccess) {
+  g_redex = new RedexContext();
+  auto method = make_method_with_dex_code(DexString::make_string("hello"));
+  method->balloon();
+  auto epoch = DexMethod::advance_code_epoch();
+  EXPECT_NE(epoch, method->get_code_epoch());
+
+  EXPECT_TRUE(instruction_lowering::unballoon(method, false));
+  EXPECT_TRUE(method->is_balloon_deferred());
+  ASSERT_NE(nullptr, method->get_dex_code());
+  EXPECT_EQ(2, method->get_dex_code()->get_instructions().size());
+  // Already unballooned.
+  EXPECT_FALSE(instruction_lowering::unballoon(method, false));
+
+  auto code = method->get_code();
+  ASSERT_NE(nullptr, code);
+  EXPECT_FALSE(method->is_balloon_deferred());
+  EXPECT_EQ(2, code->count_opcodes());
+  EXPECT_EQ(epoch, method->get_code_epoch());
+
+  delete g_redex;
+}
+
+TEST(DeferredBalloonTest, unballoonNeedsEncodableRegisters) {
+  g_redex = new RedexContext();
+  auto method = make_method_with_dex_code(DexString::make_string("hello"));
+  method->balloon();
+  auto code = method->get_code();
+  auto move = new IRInstruction(OPCODE_MOVE_OBJECT);
+  move->set_dest(16)->set_src(0, 0);
+  code->insert_before(code->begin(), move);
+  code->set_registers_size(17);
+
+  EXPECT_FALSE(instruction_lowering::unballoon(method, false));
+  EXPECT_FALSE(method->is_balloon_deferred());
+  EXPECT_EQ(code, method->get_code());
+  EXPECT_TRUE(instruction_lowering::unballoon(method, true));
+  EXPECT_TRUE(method->is_balloon_deferred());
+
+  delete g_redex;
+}
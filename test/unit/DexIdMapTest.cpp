@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <unordered_set>
+
+#include "DexClass.h"
+#include "DexIdMap.h"
+#include "RedexContext.h"
+
+TEST(DexIdMapTest, idsAreDenseAndStable) {
+  g_redex = new RedexContext();
+  auto base = g_redex->num_type_ids();
+  std::unordered_set<uint32_t> ids;
+  for (int i = 0; i < 100; ++i) {
+    auto type = DexType::make_type(("LFoo" + std::to_string(i) + ";").c_str());
+    EXPECT_TRUE(ids.insert(type->get_id()).second);
+    EXPECT_LT(type->get_id(), g_redex->num_type_ids());
+  }
+  EXPECT_EQ(base + 100, g_redex->num_type_ids());
+  // Interning the same type again doesn't use up an id.
+  auto foo = DexType::make_type("LFoo0;");
+  EXPECT_EQ(base + 100, g_redex->num_type_ids());
+  auto id = foo->get_id();
+  foo->assign_name_alias(DexString::make_string("LBar0;"));
+  EXPECT_EQ(id, DexType::get_type("LBar0;")->get_id());
+
+  auto proto = DexProto::make_proto(
+      DexType::make_type("V"), DexTypeList::make_type_list({}));
+  auto m1 = DexMethod::make_method(foo, DexString::make_string("a"), proto);
+  auto m2 = DexMethod::make_method(foo, DexString::make_string("b"), proto);
+  EXPECT_NE(m1->get_id(), m2->get_id());
+  m1->change(DexMethodSpec(nullptr, DexString::make_string("c"), nullptr));
+  EXPECT_EQ(m1, DexMethod::get_method(foo, DexString::make_string("c"), proto));
+  EXPECT_LT(m1->get_id(), g_redex->num_method_ids());
+
+  auto f1 = DexField::make_field(
+      foo, DexString::make_string("f"), DexType::make_type("I"));
+  auto f2 = DexField::make_field(
+      foo, DexString::make_string("g"), DexType::make_type("I"));
+  EXPECT_NE(f1->get_id(), f2->get_id());
+  EXPECT_EQ(2, g_redex->num_field_ids());
+  delete g_redex;
+}
+
+TEST(DexIdMapTest, mapsAndBitSets) {
+  g_redex = new RedexContext();
+  auto a = DexType::make_type("LA;");
+  auto b = DexType::make_type("LB;");
+
+  TypeIdMap<int> map;
+  EXPECT_EQ(0, map.at(a));
+  map[b] = 2;
+  auto c = DexType::make_type("LC;");
+  map[c] = 3;
+  EXPECT_EQ(0, map.at(a));
+  EXPECT_EQ(2, map.at(b));
+  EXPECT_EQ(3, map.at(c));
+
+  TypeBitSet set;
+  EXPECT_TRUE(set.empty());
+  EXPECT_TRUE(set.insert(c));
+  EXPECT_FALSE(set.insert(c));
+  EXPECT_FALSE(set.contains(a));
+  EXPECT_TRUE(set.contains(c));
+  TypeBitSet other;
+  other.insert(a);
+  set.union_with(other);
+  EXPECT_EQ(2, set.size());
+  set.erase(c);
+  EXPECT_FALSE(set.contains(c));
+  EXPECT_TRUE(set.contains(a));
+  EXPECT_EQ(1, set.size());
+  delete g_redex;
+}
@@ -8,6 +8,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <thread>
 
 #include "Creators.h"
 #include "DexClass.h"
@@ -65,3 +66,36 @@ TEST(RenameMembers, rename) {
   std::string name_after = field->get_name()->c_str();
   ASSERT_EQ("numbat", name_after);
 }
+
+TEST(RenameMembers, renameConcurrently) {
+  g_redex = new RedexContext();
+  auto int_t = DexType::make_type("I");
+  auto a = DexType::make_type("A");
+  constexpr size_t n_fields = 64;
+  std::vector<DexFieldRef*> fields;
+  for (size_t i = 0; i < n_fields; ++i) {
+    fields.push_back(
+        make_field_ref(a, ("f" + std::to_string(i)).c_str(), int_t));
+  }
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < n_fields; i += 4) {
+        DexFieldSpec spec;
+        spec.name = DexString::make_string("g" + std::to_string(i));
+        fields[i]->change(spec);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (size_t i = 0; i < n_fields; ++i) {
+    auto name = std::to_string(i);
+    EXPECT_EQ(DexField::get_field(a, DexString::make_string("g" + name), int_t),
+              fields[i]);
+    EXPECT_EQ(DexField::get_field(a, DexString::make_string("f" + name), int_t),
+              nullptr);
+  }
+  delete g_redex;
+}
@@ -7,16 +7,98 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <fstream>
+#include <random>
 #include <string>
+#include <boost/filesystem.hpp>
 #include <gtest/gtest.h>
 
 #include "RedexResources.h"
 
 std::unordered_set<std::string> extract_classes_from_native_lib(
-    const std::string& lib_contents);
+    boost::string_ref lib_contents);
+
+namespace {
+
+// The byte at a time scan that extract_classes_from_native_lib() replaced.
+std::unordered_set<std::string> scan_bytes(const std::string& lib_contents) {
+  std::unordered_set<std::string> classes;
+  const char* inptr = lib_contents.c_str();
+  const char* end = inptr + lib_contents.size();
+  while (inptr < end) {
+    std::string name;
+    if ((*inptr >= 'a' && *inptr <= 'z') || *inptr == 'L') {
+      if (*inptr != 'L') {
+        name += 'L';
+      }
+      while (((*inptr >= 'a' && *inptr <= 'z') ||
+              (*inptr >= 'A' && *inptr <= 'Z') ||
+              (*inptr >= '0' && *inptr <= '9') || *inptr == '/' ||
+              *inptr == '_' || *inptr == '$') &&
+             name.size() < 500) {
+        name += *inptr++;
+      }
+      if (name.size() >= 10) {
+        classes.insert(name + ';');
+      }
+    }
+    inptr++;
+  }
+  return classes;
+}
+
+} // namespace
 
 TEST(ExtractNativeTest, empty) {
   std::string over(700, 'L');
   auto overset = extract_classes_from_native_lib(over);
   EXPECT_EQ(overset.size(), 2);
 }
+
+TEST(ExtractNativeTest, names) {
+  std::string lib("\x7f" "ELF\0Lcom/facebook/Foo;\0com/facebook/Bar$1\xff"
+                  "9_com/facebook/Baz short Lcom/x/Y;",
+                  77);
+  std::unordered_set<std::string> expected = {
+      "Lcom/facebook/Foo;", "Lcom/facebook/Bar$1;", "Lcom/facebook/Baz;"};
+  EXPECT_EQ(extract_classes_from_native_lib(lib), expected);
+}
+
+TEST(ExtractNativeTest, sameAsByteScan) {
+  std::mt19937 gen(42);
+  // 13 name characters, then 4 that end names.
+  const std::string alphabet("abcLXYZ019/_$;.\0\xff", 17);
+  for (size_t size : {0, 1, 15, 16, 17, 31, 100, 1000, 20000}) {
+    std::string lib;
+    for (size_t i = 0; i < size; ++i) {
+      // Mostly name characters, so that there are long runs and names that
+      // cross the 16 byte blocks.
+      auto r = gen() % 100;
+      lib += r < 90 ? alphabet[r % 13] : alphabet[13 + r % 4];
+    }
+    EXPECT_EQ(extract_classes_from_native_lib(lib), scan_bytes(lib)) << size;
+  }
+}
+
+TEST(ExtractNativeTest, getNativeClasses) {
+  namespace fs = boost::filesystem;
+  auto apk_dir = fs::temp_directory_path() /
+                 fs::unique_path("redex-native-%%%%-%%%%");
+  fs::create_directories(apk_dir / "lib" / "x86");
+  std::ofstream(((apk_dir / "lib" / "x86" / "libfoo.so").string()))
+      << "Lcom/facebook/Foo;" << '\0' << "com/facebook/Unknown";
+  // Empty files can't be mapped, and have no names anyway.
+  std::ofstream(((apk_dir / "lib" / "x86" / "libempty.so").string()));
+
+  auto all = get_native_classes(apk_dir.string());
+  std::unordered_set<std::string> expected = {"Lcom/facebook/Foo;",
+                                              "Lcom/facebook/Unknown;"};
+  EXPECT_EQ(all, expected);
+
+  auto known = get_native_classes(apk_dir.string(), [](const char* name) {
+    return strcmp(name, "Lcom/facebook/Foo;") == 0;
+  });
+  expected = {"Lcom/facebook/Foo;"};
+  EXPECT_EQ(known, expected);
+  fs::remove_all(apk_dir);
+}
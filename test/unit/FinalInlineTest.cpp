@@ -17,6 +17,7 @@
 #include "DexInstruction.h"
 #include "DexUtil.h"
 #include "FinalInline.h"
+#include "IRAssembler.h"
 #include "IRCode.h"
 #include "IROpcode.h"
 #include "Resolver.h"
@@ -484,3 +485,76 @@ TEST_F(ConstPropTest, multiLevelWithSiblings) {
   expect_field_eq(
       grandchild2, "CONST_BOOL", m_bool_type, static_cast<uint64_t>(0));
 }
+
+// Add a field that its class's clinit initializes
+DexField* add_blank_field(DexClass* cls,
+                          const std::string& name,
+                          DexType* type) {
+  auto field = static_cast<DexField*>(DexField::make_field(
+      cls->get_type(), DexString::make_string(name), type));
+  field->make_concrete(ACC_PUBLIC | ACC_STATIC | ACC_FINAL);
+  cls->add_field(field);
+  return field;
+}
+
+// A clinit that only computes constants is evaluated away:
+//
+//   class Foo {
+//     public static final int INT = 1 + 2;
+//     public static final String STRING = "foo";
+//   }
+TEST_F(ConstPropTest, evaluatedClinitIsReplaced) {
+  auto foo = create_class("LFoo;");
+  add_blank_field(foo, "INT", m_int_type);
+  add_blank_field(foo, "STRING", m_string_type);
+  foo->get_clinit()->set_code(assembler::ircode_from_string(R"(
+    (
+     (const v0 1)
+     (add-int/lit8 v0 v0 2)
+     (sput v0 "LFoo;.INT:I")
+     (const-string "foo")
+     (move-result-pseudo-object v1)
+     (move-object v0 v1)
+     (sput-object v0 "LFoo;.STRING:Ljava/lang/String;")
+     (return-void)
+    )
+  )"));
+
+  Scope classes = {foo};
+  EXPECT_EQ(FinalInlinePass::replace_encodable_clinits_for_test(classes), 1);
+  EXPECT_EQ(foo->get_clinit(), nullptr);
+  expect_field_eq(foo, "INT", m_int_type, static_cast<uint64_t>(3));
+  expect_field_eq(
+      foo, "STRING", m_string_type, DexString::make_string("foo"));
+}
+
+// The constant stores before anything with a side effect are taken out of
+// the clinit, and the rest of it is kept.
+TEST_F(ConstPropTest, clinitIsTrimmed) {
+  auto foo = create_class("LFoo;");
+  add_blank_field(foo, "INT", m_int_type);
+  add_blank_field(foo, "LATER", m_int_type);
+  foo->get_clinit()->set_code(assembler::ircode_from_string(R"(
+    (
+     (const v0 5)
+     (sput v0 "LFoo;.INT:I")
+     (invoke-static () "LBar;.init:()V")
+     (sput v0 "LFoo;.LATER:I")
+     (return-void)
+    )
+  )"));
+
+  Scope classes = {foo};
+  EXPECT_EQ(FinalInlinePass::replace_encodable_clinits_for_test(classes), 0);
+  expect_field_eq(foo, "INT", m_int_type, static_cast<uint64_t>(5));
+  auto expected = assembler::ircode_from_string(R"(
+    (
+     (const v0 5)
+     (invoke-static () "LBar;.init:()V")
+     (sput v0 "LFoo;.LATER:I")
+     (return-void)
+    )
+  )");
+  EXPECT_EQ(assembler::to_s_expr(foo->get_clinit()->get_code()),
+            assembler::to_s_expr(expected.get()));
+}
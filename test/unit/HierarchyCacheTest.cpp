@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "HierarchyCache.h"
+
+TEST(HierarchyCacheTest, keepsAnalysesUntilInvalidated) {
+  g_redex = new RedexContext();
+
+  auto a_type = DexType::make_type("LA;");
+  ClassCreator a_creator(a_type);
+  a_creator.set_super(get_object_type());
+  auto a_cls = a_creator.create();
+
+  auto b_type = DexType::make_type("LB;");
+  ClassCreator b_creator(b_type);
+  b_creator.set_super(a_type);
+  auto b_cls = b_creator.create();
+
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes({a_cls, b_cls});
+  stores.emplace_back(std::move(store));
+
+  ScopeView view(stores);
+  HierarchyCache cache(view);
+  const auto* ch = &cache.get_class_hierarchy();
+  const auto* sm = &cache.get_signature_map();
+  EXPECT_EQ(1, ch->at(a_type).count(b_type));
+  EXPECT_EQ(ch, &cache.get_class_hierarchy());
+  EXPECT_EQ(sm, &cache.get_signature_map());
+
+  cache.invalidate(false, false);
+  EXPECT_EQ(ch, &cache.get_class_hierarchy());
+  EXPECT_EQ(sm, &cache.get_signature_map());
+
+  // Changing signatures only drops what depends on the methods.
+  cache.invalidate(false, true);
+  EXPECT_EQ(ch, &cache.get_class_hierarchy());
+  cache.get_signature_map();
+
+  cache.invalidate_all();
+  EXPECT_EQ(1, cache.get_class_hierarchy().at(a_type).count(b_type));
+
+  delete g_redex;
+}
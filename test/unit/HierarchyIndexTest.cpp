@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "DexUtil.h"
+#include "HierarchyIndex.h"
+#include "ScopeHelper.h"
+
+struct HierarchyIndexTest : testing::Test {
+  HierarchyIndexTest() { g_redex = new RedexContext(); }
+
+  ~HierarchyIndexTest() { delete g_redex; }
+};
+
+TEST_F(HierarchyIndexTest, sameAsWalkingTheHierarchy) {
+  Scope scope = create_empty_scope();
+  auto obj_t = get_object_type();
+
+  // I1 <- I2, I3 (extends I1 and I2)
+  auto i1_t = DexType::make_type("LI1;");
+  auto i2_t = DexType::make_type("LI2;");
+  auto i3_t = DexType::make_type("LI3;");
+  // An interface without a class.
+  auto ext_t = DexType::make_type("LExt;");
+  scope.push_back(create_internal_class(i1_t, obj_t, {}, ACC_INTERFACE));
+  scope.push_back(create_internal_class(i2_t, obj_t, {}, ACC_INTERFACE));
+  scope.push_back(
+      create_internal_class(i3_t, obj_t, {i1_t, i2_t}, ACC_INTERFACE));
+
+  // A <- B (implements I3) <- C, A <- D (implements Ext), E
+  auto a_t = DexType::make_type("LA;");
+  auto b_t = DexType::make_type("LB;");
+  auto c_t = DexType::make_type("LC;");
+  auto d_t = DexType::make_type("LD;");
+  auto e_t = DexType::make_type("LE;");
+  scope.push_back(create_internal_class(a_t, obj_t, {}));
+  scope.push_back(create_internal_class(b_t, a_t, {i3_t}));
+  scope.push_back(create_internal_class(c_t, b_t, {}));
+  scope.push_back(create_internal_class(d_t, a_t, {ext_t}));
+  scope.push_back(create_internal_class(e_t, obj_t, {}));
+
+  HierarchyIndex index(build_type_hierarchy(scope));
+  EXPECT_EQ(index.interface_count(), 4);
+
+  // A type that is unknown to the index.
+  auto unknown_t = DexType::make_type("LUnknown;");
+  std::vector<const DexType*> types = {obj_t,
+                                       i1_t,
+                                       i2_t,
+                                       i3_t,
+                                       ext_t,
+                                       a_t,
+                                       b_t,
+                                       c_t,
+                                       d_t,
+                                       e_t,
+                                       unknown_t,
+                                       get_string_type()};
+  for (auto parent : types) {
+    for (auto child : types) {
+      EXPECT_EQ(index.is_subtype(parent, child), check_cast(child, parent))
+          << SHOW(parent) << " " << SHOW(child);
+    }
+  }
+
+  EXPECT_TRUE(index.is_subclass(a_t, c_t));
+  EXPECT_TRUE(index.is_subclass(obj_t, c_t));
+  EXPECT_TRUE(index.is_subclass(c_t, c_t));
+  EXPECT_FALSE(index.is_subclass(c_t, a_t));
+  EXPECT_FALSE(index.is_subclass(d_t, c_t));
+  EXPECT_FALSE(index.is_subclass(e_t, c_t));
+
+  EXPECT_TRUE(index.implements(c_t, i1_t));
+  EXPECT_TRUE(index.implements(c_t, i2_t));
+  EXPECT_TRUE(index.implements(d_t, ext_t));
+  EXPECT_TRUE(index.implements(i3_t, i1_t));
+  EXPECT_FALSE(index.implements(a_t, i1_t));
+  EXPECT_FALSE(index.implements(d_t, i3_t));
+  EXPECT_FALSE(index.implements(i1_t, i1_t));
+}
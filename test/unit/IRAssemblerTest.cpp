@@ -38,3 +38,70 @@ TEST(IRAssembler, disassemble) {
 
   delete g_redex;
 }
+
+TEST(IRAssembler, codeBuilder) {
+  g_redex = new RedexContext();
+
+  assembler::CodeBuilder builder;
+  auto loop = builder.make_label();
+  auto done = builder.make_label();
+  builder.push(OPCODE_CONST, {0}, 3);
+  builder.place(loop);
+  builder.branch(OPCODE_IF_EQZ, {0}, done);
+  builder.push(OPCODE_ADD_INT_LIT8, {0, 0}, -1);
+  builder.push(OPCODE_INVOKE_STATIC, {0})
+      ->set_method(DexMethod::make_method("LFoo;.bar:(I)V"));
+  builder.branch(OPCODE_GOTO, {}, loop);
+  builder.place(done);
+  builder.push(OPCODE_RETURN, {0});
+  auto code = builder.release();
+
+  EXPECT_EQ(assembler::to_s_expr(code.get()),
+            assembler::to_s_expr(assembler::ircode_from_string(R"(
+    (
+     (const v0 3)
+     :loop
+     (if-eqz v0 :done)
+     (add-int/lit8 v0 v0 -1)
+     (invoke-static (v0) "LFoo;.bar:(I)V")
+     (goto :loop)
+     :done
+     (return v0)
+    )
+)").get()));
+
+  delete g_redex;
+}
+
+TEST(IRAssembler, binaryRoundTrip) {
+  g_redex = new RedexContext();
+
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param v1)
+     (const-wide v2 -5000000000)
+     :top
+     (if-eqz v1 :end)
+     (if-nez v1 :end)
+     (const-string "hello")
+     (move-result-pseudo-object v0)
+     (new-instance "LFoo;")
+     (move-result-pseudo-object v3)
+     (iget v3 "LFoo;.x:I")
+     (move-result-pseudo v1)
+     (invoke-virtual (v3 v1) "LFoo;.bar:(I)V")
+     (goto :top)
+     :end
+     (return-void)
+    )
+)");
+  code->set_registers_size(4);
+  auto binary = assembler::to_binary(code.get());
+  auto back = assembler::ircode_from_binary(binary);
+  EXPECT_EQ(assembler::to_s_expr(back.get()),
+            assembler::to_s_expr(code.get()));
+  EXPECT_EQ(back->get_registers_size(), 4);
+  EXPECT_EQ(assembler::to_binary(back.get()), binary);
+
+  delete g_redex;
+}
@@ -9,7 +9,9 @@
 
 #include <gtest/gtest.h>
 
+#include "ControlFlow.h"
 #include "DexAsm.h"
+#include "IRAssembler.h"
 #include "IRCode.h"
 
 std::ostream& operator<<(std::ostream& os, const IRInstruction& to_show) {
@@ -51,3 +53,65 @@ TEST(IRCode, LoadParamInstructionsVirtual) {
 
   delete g_redex;
 }
+
+TEST(IRCode, CachedCFG) {
+  using namespace dex_asm;
+
+  g_redex = new RedexContext();
+
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (const v0 0)
+     (return v0)
+    )
+  )");
+  auto count_insns = [](ControlFlowGraph& cfg) {
+    size_t count = 0;
+    for (auto* block : cfg.blocks()) {
+      for (auto& mie : InstructionIterable(block)) {
+        (void)mie;
+        ++count;
+      }
+    }
+    return count;
+  };
+
+  code->build_cfg();
+  auto* cfg = &code->cfg();
+  EXPECT_EQ(2, count_insns(*cfg));
+
+  // Nothing changed, so the CFG is reused.
+  code->build_cfg();
+  EXPECT_EQ(cfg, &code->cfg());
+
+  auto epoch = code->epoch();
+  code->insert_before(code->begin(), dasm(OPCODE_CONST, {1_v, 1_L}));
+  EXPECT_NE(epoch, code->epoch());
+  code->build_cfg();
+  EXPECT_EQ(3, count_insns(code->cfg()));
+
+  delete g_redex;
+}
+
+TEST(IRCode, TypeCheckedUntilModified) {
+  using namespace dex_asm;
+
+  g_redex = new RedexContext();
+
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (const v0 0)
+     (return v0)
+    )
+  )");
+  EXPECT_FALSE(code->type_checked(42));
+  code->mark_type_checked(42);
+  EXPECT_TRUE(code->type_checked(42));
+  // Instructions edited in place only show up in the fingerprint.
+  EXPECT_FALSE(code->type_checked(43));
+
+  code->insert_before(code->begin(), dasm(OPCODE_CONST, {1_v, 1_L}));
+  EXPECT_FALSE(code->type_checked(42));
+
+  delete g_redex;
+}
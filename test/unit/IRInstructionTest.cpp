@@ -367,3 +367,32 @@ TEST(IRInstruction, InvokeSourceIsWideComplex2) {
 
   delete g_redex;
 }
+
+TEST(IRInstruction, ResizeSrcs) {
+  g_redex = new RedexContext();
+  IRInstruction insn(OPCODE_INVOKE_STATIC);
+  insn.set_arg_word_count(3);
+  for (size_t i = 0; i < 3; ++i) {
+    insn.set_src(i, i + 1);
+  }
+
+  // Growing past the inline capacity keeps the existing registers.
+  insn.set_arg_word_count(8);
+  std::vector<uint16_t> expected{1, 2, 3, 0, 0, 0, 0, 0};
+  EXPECT_EQ(expected, insn.srcs_vec());
+  insn.set_src(7, 8);
+
+  IRInstruction copy(insn);
+  EXPECT_EQ(insn, copy);
+  copy.set_src(0, 42);
+  EXPECT_EQ(1, insn.src(0));
+
+  // And so does shrinking back into it.
+  insn.set_arg_word_count(2);
+  expected = {1, 2};
+  EXPECT_EQ(expected, insn.srcs_vec());
+
+  copy = insn;
+  EXPECT_EQ(insn, copy);
+  delete g_redex;
+}
@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "IfChainToSwitchPass.h"
+
+// The assembler can't print switches, so these look at the code directly.
+struct IfChainToSwitchTest : testing::Test {
+  IfChainToSwitchTest() { g_redex = new RedexContext(); }
+
+  ~IfChainToSwitchTest() { delete g_redex; }
+
+  static std::unique_ptr<IRCode> assemble(const std::string& code) {
+    auto result = assembler::ircode_from_string(code);
+    result->set_registers_size(3);
+    return result;
+  }
+
+  // The opcode of the only switch of `code`, and the keys of its cases.
+  static std::pair<IROpcode, std::vector<int32_t>> switch_of(IRCode* code) {
+    IRInstruction* sw = nullptr;
+    for (const auto& mie : InstructionIterable(code)) {
+      EXPECT_FALSE(is_conditional_branch(mie.insn->opcode()));
+      if (is_switch(mie.insn->opcode())) {
+        EXPECT_EQ(sw, nullptr);
+        sw = mie.insn;
+      }
+    }
+    EXPECT_NE(sw, nullptr);
+    std::vector<int32_t> keys;
+    for (const auto& mie : *code) {
+      if (mie.type == MFLOW_TARGET && mie.target->type == BRANCH_MULTI) {
+        EXPECT_EQ(mie.target->src->insn, sw);
+        keys.push_back(mie.target->index);
+      }
+    }
+    return {sw ? sw->opcode() : OPCODE_NOP, keys};
+  }
+};
+
+TEST_F(IfChainToSwitchTest, ifEqChainBecomesPackedSwitch) {
+  auto code = assemble(R"(
+    (
+     (load-param v0)
+     (const v1 1)
+     (if-eq v0 v1 :one)
+     (const v1 2)
+     (if-eq v0 v1 :two)
+     (const v1 5)
+     (if-eq v0 v1 :five)
+     (const v2 0)
+     (return v2)
+     :one
+     (const v2 10)
+     (return v2)
+     :two
+     (const v2 20)
+     (return v2)
+     :five
+     (const v2 50)
+     (return v2)
+    )
+  )");
+  auto stats = if_chain_to_switch::convert(code.get(), 3);
+  EXPECT_EQ(stats.switches, 1);
+  EXPECT_EQ(stats.compares_removed, 3);
+  auto sw = switch_of(code.get());
+  EXPECT_EQ(sw.first, OPCODE_PACKED_SWITCH);
+  EXPECT_EQ(sw.second, std::vector<int32_t>({1, 2, 5}));
+  // The consts of the keys are gone with the compares.
+  for (const auto& mie : InstructionIterable(code.get())) {
+    EXPECT_TRUE(mie.insn->dests_size() == 0 || mie.insn->dest() != 1);
+  }
+}
+
+TEST_F(IfChainToSwitchTest, ifNeChainBecomesSparseSwitch) {
+  auto code = assemble(R"(
+    (
+     (load-param v0)
+     (if-nez v0 :not-zero)
+     (const v1 10)
+     (return v1)
+     :not-zero
+     (const v1 100)
+     (if-ne v0 v1 :not-hundred)
+     (const v1 20)
+     (return v1)
+     :not-hundred
+     (const v1 1000)
+     (if-ne v0 v1 :default)
+     (const v1 30)
+     (return v1)
+     :default
+     (const v1 0)
+     (return v1)
+    )
+  )");
+  auto stats = if_chain_to_switch::convert(code.get(), 3);
+  EXPECT_EQ(stats.switches, 1);
+  auto sw = switch_of(code.get());
+  EXPECT_EQ(sw.first, OPCODE_SPARSE_SWITCH);
+  std::sort(sw.second.begin(), sw.second.end());
+  EXPECT_EQ(sw.second, std::vector<int32_t>({0, 100, 1000}));
+}
+
+TEST_F(IfChainToSwitchTest, chainsAreKept) {
+  // The case of 2 reads the key it was compared with.
+  auto live_key = R"(
+    (
+     (load-param v0)
+     (const v1 1)
+     (if-eq v0 v1 :one)
+     (const v1 2)
+     (if-eq v0 v1 :two)
+     (const v1 3)
+     (if-eq v0 v1 :one)
+     (return v0)
+     :one
+     (return v0)
+     :two
+     (return v1)
+    )
+  )";
+  // The second compare is on another register.
+  auto other_register = R"(
+    (
+     (load-param v0)
+     (load-param v2)
+     (const v1 1)
+     (if-eq v0 v1 :one)
+     (const v1 2)
+     (if-eq v2 v1 :one)
+     (const v1 3)
+     (if-eq v0 v1 :one)
+     (return v0)
+     :one
+     (return v2)
+    )
+  )";
+  for (auto original : {live_key, other_register}) {
+    auto code = assemble(original);
+    EXPECT_EQ(if_chain_to_switch::convert(code.get(), 3).switches, 0);
+    code->clear_cfg();
+    EXPECT_EQ(assembler::to_s_expr(code.get()),
+              assembler::to_s_expr(
+                  assembler::ircode_from_string(original).get()));
+  }
+}
+
+TEST_F(IfChainToSwitchTest, packedSwitchCostModel) {
+  // 4 + 2 * 3 code units against 2 + 4 * 2.
+  EXPECT_TRUE(use_packed_switch(0, 2, 2));
+  // 4 + 2 * 4 against 2 + 4 * 2.
+  EXPECT_FALSE(use_packed_switch(0, 3, 2));
+  EXPECT_TRUE(use_packed_switch(-5, 5, 11));
+  EXPECT_FALSE(use_packed_switch(std::numeric_limits<int32_t>::min(),
+                                 std::numeric_limits<int32_t>::max(),
+                                 2));
+}
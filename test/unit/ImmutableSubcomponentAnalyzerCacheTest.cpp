@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "ImmutableSubcomponentAnalyzer.h"
+#include "ScopeHelper.h"
+
+struct ImmutableSubcomponentAnalyzerCacheTest : testing::Test {
+  ImmutableSubcomponentAnalyzerCacheTest() {
+    g_redex = new RedexContext();
+    m_cls = create_internal_class(
+        DexType::make_type("LFoo;"), get_object_type(), {});
+  }
+
+  ~ImmutableSubcomponentAnalyzerCacheTest() { delete g_redex; }
+
+  // A static method that passes p0.getA() to the given callee, possibly
+  // through p0.getA().getB().
+  DexMethod* make_method(const std::string& name, bool nested) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        "LFoo;." + name + ":(LFoo;)V"));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    std::string code = R"(
+      (
+       (load-param-object v0)
+       (invoke-virtual (v0) "LFoo;.getA:()LFoo;")
+       (move-result-object v1)
+    )";
+    if (nested) {
+      code += R"(
+       (invoke-virtual (v1) "LFoo;.getB:()LFoo;")
+       (move-result-object v1)
+      )";
+    }
+    code += R"(
+       (invoke-static (v1) "LFoo;.check:(LFoo;)V")
+       (return-void)
+      )
+    )";
+    method->set_code(assembler::ircode_from_string(code));
+    m_cls->add_method(method);
+    return method;
+  }
+
+  static IRInstruction* find_check(DexMethod* method) {
+    for (auto& mie : InstructionIterable(method->get_code())) {
+      if (mie.insn->opcode() == OPCODE_INVOKE_STATIC) {
+        return mie.insn;
+      }
+    }
+    return nullptr;
+  }
+
+  static bool is_immutable_getter(DexMethodRef* method) {
+    return boost::algorithm::starts_with(method->get_name()->str(), "get");
+  }
+
+  DexClass* m_cls;
+};
+
+TEST_F(ImmutableSubcomponentAnalyzerCacheTest, reusedUntilModified) {
+  auto method = make_method("test", /* nested */ false);
+  ImmutableSubcomponentAnalyzerCache cache(is_immutable_getter);
+
+  auto analyzer = cache.get(method);
+  EXPECT_EQ(cache.get(method), analyzer);
+  auto check = find_check(method);
+  auto path = analyzer->get_access_path(check->src(0), check);
+  ASSERT_TRUE(path);
+  EXPECT_EQ(path->to_string(), "p0.getA()");
+
+  // Inserting an instruction bumps the epoch of the code.
+  auto code = method->get_code();
+  auto it = code->begin();
+  ++it;
+  code->insert_before(
+      it, (new IRInstruction(OPCODE_CONST))->set_dest(2)->set_literal(0));
+  auto new_analyzer = cache.get(method);
+  EXPECT_NE(new_analyzer, analyzer);
+  EXPECT_EQ(cache.get(method), new_analyzer);
+
+  cache.invalidate(method);
+  EXPECT_NE(cache.get(method), new_analyzer);
+}
+
+TEST_F(ImmutableSubcomponentAnalyzerCacheTest, batch) {
+  std::vector<DexMethod*> methods;
+  for (size_t i = 0; i < 16; ++i) {
+    methods.push_back(make_method("test" + std::to_string(i), i % 2 == 1));
+  }
+  auto abstract = static_cast<DexMethod*>(
+      DexMethod::make_method("LFoo;.abstract:(LFoo;)V"));
+  abstract->make_concrete(ACC_PUBLIC | ACC_ABSTRACT, true);
+  methods.push_back(abstract);
+
+  ImmutableSubcomponentAnalyzerCache cache(is_immutable_getter);
+  auto all_paths = cache.get_access_paths(methods);
+  EXPECT_EQ(all_paths.size(), 16);
+  EXPECT_EQ(all_paths.count(abstract), 0);
+  for (size_t i = 0; i < 16; ++i) {
+    auto method = methods[i];
+    auto check = find_check(method);
+    const auto& paths = all_paths.at(method).at(check);
+    // The parameter and the argument of the call.
+    ASSERT_EQ(paths.size(), 2);
+    EXPECT_EQ(paths.at(check->src(0)).to_string(),
+              i % 2 == 1 ? "p0.getA().getB()" : "p0.getA()");
+    EXPECT_EQ(all_paths.at(method).size(),
+              method->get_code()->count_opcodes() + 1);
+    // The batch fills in the cache.
+    EXPECT_EQ(cache.get(method)->get_access_paths(check), paths);
+  }
+}
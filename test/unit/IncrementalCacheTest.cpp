@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+#include <json/json.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "IncrementalCache.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct Stats {
+  size_t runs{0};
+  size_t removed{0};
+};
+
+// Stands in for a pass: drops the nops.
+Stats remove_nops(DexMethod* method) {
+  Stats stats;
+  stats.runs = 1;
+  auto code = method->get_code();
+  for (auto it = code->begin(); it != code->end();) {
+    if (it->type == MFLOW_OPCODE && it->insn->opcode() == OPCODE_NOP) {
+      it = code->erase(it);
+      ++stats.removed;
+    } else {
+      ++it;
+    }
+  }
+  return stats;
+}
+
+} // namespace
+
+struct IncrementalCacheTest : testing::Test {
+  IncrementalCacheTest()
+      : m_dir((fs::temp_directory_path() /
+               fs::unique_path("redex-incremental-%%%%-%%%%"))
+                  .string()) {
+    g_redex = new RedexContext();
+  }
+
+  ~IncrementalCacheTest() {
+    delete g_redex;
+    fs::remove_all(m_dir);
+  }
+
+  // Like a new run of redex over the same app: the classes are made again
+  // in a new context.
+  DexMethod* make_program(DexAccessFlags callee_access = ACC_PUBLIC) {
+    delete g_redex;
+    g_redex = new RedexContext();
+    ClassCreator creator(DexType::make_type("LFoo;"));
+    creator.set_super(get_object_type());
+    auto callee = static_cast<DexMethod*>(
+        DexMethod::make_method("LFoo;.callee:()V"));
+    callee->make_concrete(callee_access | ACC_STATIC, false);
+    creator.add_method(callee);
+    auto method =
+        static_cast<DexMethod*>(DexMethod::make_method("LFoo;.bar:()V"));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(assembler::ircode_from_string(R"(
+      (
+       (nop)
+       (invoke-static () "LFoo;.callee:()V")
+       (nop)
+       (return-void)
+      )
+    )"));
+    creator.add_method(method);
+    creator.create();
+    return method;
+  }
+
+  std::unique_ptr<IncrementalCache> make_cache(const Json::Value& config) {
+    return std::make_unique<IncrementalCache>(m_dir, "RemoveNops", config);
+  }
+
+  std::string m_dir;
+};
+
+TEST_F(IncrementalCacheTest, unchangedMethodsComeFromTheCache) {
+  Json::Value config;
+  auto method = make_program();
+  auto cache = make_cache(config);
+  auto stats = cache->optimize<Stats>(method, remove_nops);
+  EXPECT_EQ(1, stats.runs);
+  EXPECT_EQ(2, stats.removed);
+  EXPECT_EQ(0, cache->hits());
+  EXPECT_EQ(1, cache->misses());
+  auto optimized = assembler::to_string(method->get_code());
+
+  method = make_program();
+  cache = make_cache(config);
+  stats = cache->optimize<Stats>(method, remove_nops);
+  EXPECT_EQ(1, cache->hits());
+  EXPECT_EQ(0, cache->misses());
+  // The stats are the ones of the run that did the work.
+  EXPECT_EQ(1, stats.runs);
+  EXPECT_EQ(2, stats.removed);
+  EXPECT_EQ(optimized, assembler::to_string(method->get_code()));
+}
+
+TEST_F(IncrementalCacheTest, contextIsPartOfTheKey) {
+  Json::Value config;
+  auto method = make_program();
+  make_cache(config)->optimize<Stats>(method, remove_nops);
+
+  // A callee that changed.
+  method = make_program(ACC_PRIVATE);
+  auto cache = make_cache(config);
+  cache->optimize<Stats>(method, remove_nops);
+  EXPECT_EQ(0, cache->hits());
+
+  // Another config.
+  method = make_program();
+  config["aggressive"] = true;
+  cache = make_cache(config);
+  cache->optimize<Stats>(method, remove_nops);
+  EXPECT_EQ(0, cache->hits());
+
+  // Other code.
+  method = make_program();
+  method->get_code()->push_back(new IRInstruction(OPCODE_NOP));
+  cache = make_cache(Json::Value());
+  cache->optimize<Stats>(method, remove_nops);
+  EXPECT_EQ(0, cache->hits());
+
+  method = make_program();
+  cache = make_cache(Json::Value());
+  auto stats = cache->optimize<Stats>(method, remove_nops);
+  EXPECT_EQ(1, cache->hits());
+  EXPECT_EQ(2, stats.removed);
+}
@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "Instrumentation.h"
+#include "ScopeHelper.h"
+
+using namespace instrumentation;
+
+struct InstrumentationTest : testing::Test {
+  DexMethod* m_hook;
+  DexMethod* m_method;
+  Scope m_scope;
+
+  InstrumentationTest() {
+    g_redex = new RedexContext();
+    m_hook = create_method_from_code("LProfiler;.onProbe:(I)V", R"(
+      (
+       (load-param v0)
+       (return-void)
+      )
+    )");
+    m_hook->get_code()->set_registers_size(1);
+    ClassCreator profiler(DexType::make_type("LProfiler;"));
+    profiler.set_super(get_object_type());
+    profiler.add_method(m_hook);
+
+    m_method = create_method_from_code("LFoo;.bar:(I)I", R"(
+      (
+       (load-param v1)
+       :loop
+       (if-eqz v1 :end)
+       (add-int/lit8 v1 v1 -1)
+       (goto :loop)
+       :end
+       (return v1)
+      )
+    )");
+    m_method->get_code()->set_registers_size(2);
+    ClassCreator foo(DexType::make_type("LFoo;"));
+    foo.set_super(get_object_type());
+    foo.add_method(m_method);
+    m_scope = {profiler.create(), foo.create()};
+  }
+
+  ~InstrumentationTest() { delete g_redex; }
+};
+
+TEST_F(InstrumentationTest, methodEntries) {
+  auto probes = instrument(m_scope, m_hook, Strategy::METHOD, {});
+  ASSERT_EQ(probes.size(), 1);
+  EXPECT_EQ(probes[0].method, m_method);
+  EXPECT_EQ(probes[0].block, -1);
+  // Counted once, outside of the loop.
+  expect_code_eq(m_method->get_code(), R"(
+    (
+     (load-param v1)
+     (const v2 0)
+     (invoke-static (v2) "LProfiler;.onProbe:(I)V")
+     :loop
+     (if-eqz v1 :end)
+     (add-int/lit8 v1 v1 -1)
+     (goto :loop)
+     :end
+     (return v1)
+    )
+  )");
+  // The hook itself isn't instrumented.
+  expect_code_eq(m_hook->get_code(), R"(
+    (
+     (load-param v0)
+     (return-void)
+    )
+  )");
+}
+
+TEST_F(InstrumentationTest, blocks) {
+  auto probes = instrument(m_scope, m_hook, Strategy::BLOCK, {});
+  ASSERT_EQ(probes.size(), 4);
+  for (size_t i = 0; i < probes.size(); ++i) {
+    EXPECT_EQ(probes[i].method, m_method);
+    EXPECT_EQ(probes[i].block, i);
+  }
+  expect_code_eq(m_method->get_code(), R"(
+    (
+     (load-param v1)
+     (const v2 0)
+     (invoke-static (v2) "LProfiler;.onProbe:(I)V")
+     :loop
+     (const v2 1)
+     (invoke-static (v2) "LProfiler;.onProbe:(I)V")
+     (if-eqz v1 :end)
+     (const v2 2)
+     (invoke-static (v2) "LProfiler;.onProbe:(I)V")
+     (add-int/lit8 v1 v1 -1)
+     (goto :loop)
+     :end
+     (const v2 3)
+     (invoke-static (v2) "LProfiler;.onProbe:(I)V")
+     (return v1)
+    )
+  )");
+}
+
+TEST_F(InstrumentationTest, blacklistAndMetadata) {
+  EXPECT_TRUE(instrument(m_scope, m_hook, Strategy::METHOD, {"LFoo;"}).empty());
+
+  std::vector<Probe> probes{{m_method, -1}, {m_method, 2}};
+  char buf[256] = {};
+  FILE* fd = fmemopen(buf, sizeof(buf), "w");
+  write_metadata(probes, fd);
+  fclose(fd);
+  EXPECT_STREQ(buf,
+               "#id,kind,method,block\n"
+               "0,method,LFoo;.bar:(I)I,\n"
+               "1,block,LFoo;.bar:(I)I,2\n");
+}
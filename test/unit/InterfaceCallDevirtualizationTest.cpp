@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "InterfaceCallDevirtualizationPass.h"
+#include "ScopeHelper.h"
+
+/*
+ * interface LI; { void m(); }
+ * class LA; implements LI; { public void m() {} }
+ * class LB; implements LI; { public void m() {} }
+ */
+struct InterfaceCallDevirtualizationTest : testing::Test {
+  InterfaceCallDevirtualizationTest() {
+    g_redex = new RedexContext();
+    auto obj_t = get_object_type();
+    auto void_void = DexProto::make_proto(get_void_type(),
+                                          DexTypeList::make_type_list({}));
+    auto i_t = DexType::make_type("LI;");
+    auto i_cls =
+        create_internal_class(i_t, obj_t, {}, ACC_PUBLIC | ACC_INTERFACE);
+    create_abstract_method(i_cls, "m", void_void);
+    for (const char* name : {"LA;", "LB;"}) {
+      auto cls = create_internal_class(DexType::make_type(name), obj_t, {i_t});
+      create_empty_method(cls, "m", void_void);
+    }
+  }
+
+  ~InterfaceCallDevirtualizationTest() { delete g_redex; }
+
+  // Runs the devirtualization on a static method of LA; with the given
+  // signature and code, and returns the code it ends up with.
+  std::string devirtualize(const std::string& descriptor,
+                           const std::string& code,
+                           size_t expected_devirtualized) {
+    auto method =
+        static_cast<DexMethod*>(DexMethod::make_method("LA;." + descriptor));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(assembler::ircode_from_string(code));
+    auto stats = interface_devirtualization::devirtualize(method);
+    EXPECT_EQ(stats.devirtualized, expected_devirtualized);
+    method->get_code()->clear_cfg();
+    return assembler::to_s_expr(method->get_code()).str();
+  }
+
+  static std::string expected(const std::string& code) {
+    return assembler::to_s_expr(assembler::ircode_from_string(code).get())
+        .str();
+  }
+};
+
+TEST_F(InterfaceCallDevirtualizationTest, callsOnAClassBecomeVirtual) {
+  auto code = devirtualize("f:(LA;)V", R"(
+    (
+     (load-param-object v0)
+     (invoke-interface (v0) "LI;.m:()V")
+     (new-instance "LB;")
+     (move-result-pseudo-object v1)
+     (invoke-direct (v1) "LB;.<init>:()V")
+     (invoke-interface (v1) "LI;.m:()V")
+     (return-void)
+    )
+  )", 2);
+  EXPECT_EQ(code, expected(R"(
+    (
+     (load-param-object v0)
+     (invoke-virtual (v0) "LA;.m:()V")
+     (new-instance "LB;")
+     (move-result-pseudo-object v1)
+     (invoke-direct (v1) "LB;.<init>:()V")
+     (invoke-virtual (v1) "LB;.m:()V")
+     (return-void)
+    )
+  )"));
+}
+
+TEST_F(InterfaceCallDevirtualizationTest, callsOnAnInterfaceAreKept) {
+  auto original = R"(
+    (
+     (load-param-object v0)
+     (load-param-object v1)
+     (invoke-interface (v0) "LI;.m:()V")
+     (if-eqz v1 :b)
+     (move-object v0 v1)
+     :b
+     (invoke-interface (v0) "LI;.m:()V")
+     (return-void)
+    )
+  )";
+  // v0 is an LI; first, then either an LI; or an LA;.
+  EXPECT_EQ(devirtualize("g:(LI;LA;)V", original, 0), expected(original));
+}
@@ -292,6 +292,78 @@ TEST(InterproceduralConstantPropagation, unreachableInvoke) {
   delete g_redex;
 }
 
+TEST(InterproceduralConstantPropagation, mutualRecursion) {
+  g_redex = new RedexContext();
+
+  // baz() and qux() call each other, and bar() calls into their cycle with a
+  // constant argument. The cycle itself passes the argument along unchanged.
+
+  Scope scope;
+  auto cls_ty = DexType::make_type("LFoo;");
+  ClassCreator creator(cls_ty);
+  creator.set_super(get_object_type());
+
+  auto m1 = static_cast<DexMethod*>(DexMethod::make_method("LFoo;.bar:()V"));
+  auto code1 = assembler::ircode_from_string(R"(
+    (
+     (const v0 1)
+     (invoke-static (v0) "LFoo;.baz:(I)V")
+     (return-void)
+    )
+  )");
+  code1->set_registers_size(1);
+  m1->make_concrete(
+      ACC_PUBLIC | ACC_STATIC, std::move(code1), /* is_virtual */ false);
+  m1->rstate.set_keep();
+  creator.add_method(m1);
+
+  auto m2 = static_cast<DexMethod*>(DexMethod::make_method("LFoo;.baz:(I)V"));
+  auto code2 = assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (invoke-static (v0) "LFoo;.qux:(I)V")
+     (return-void)
+    )
+  )");
+  code2->set_registers_size(1);
+  m2->make_concrete(
+      ACC_PUBLIC | ACC_STATIC, std::move(code2), /* is_virtual */ false);
+  creator.add_method(m2);
+
+  auto m3 = static_cast<DexMethod*>(DexMethod::make_method("LFoo;.qux:(I)V"));
+  auto code3 = assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :done)
+     (invoke-static (v0) "LFoo;.baz:(I)V")
+     :done
+     (return-void)
+    )
+  )");
+  code3->set_registers_size(1);
+  m3->make_concrete(
+      ACC_PUBLIC | ACC_STATIC, std::move(code3), /* is_virtual */ false);
+  creator.add_method(m3);
+
+  auto cls = creator.create();
+  scope.push_back(cls);
+
+  call_graph::Graph cg(scope, /* include_virtuals */ false);
+  walk::code(scope, [](DexMethod*, IRCode& code) {
+    code.build_cfg();
+  });
+  ConstPropConfig config;
+  FixpointIterator fp_iter(cg, config);
+  fp_iter.run({{INPUT_ARGS, ArgumentDomain()}});
+
+  EXPECT_EQ(fp_iter.get_entry_state_at(m2).get(INPUT_ARGS),
+            ArgumentDomain({{0, SignedConstantDomain(1)}}));
+  EXPECT_EQ(fp_iter.get_entry_state_at(m3).get(INPUT_ARGS),
+            ArgumentDomain({{0, SignedConstantDomain(1)}}));
+
+  delete g_redex;
+}
+
 struct RuntimeInputCheckTest : testing::Test {
   DexMethodRef* m_fail_handler;
 
@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <unordered_set>
+
+#include <boost/regex.hpp>
+
+#include "RedexResources.h"
+
+std::unordered_set<std::string> extract_js_resources(
+    boost::string_ref file_contents);
+
+namespace {
+
+// The successive regex searches that extract_js_resources() replaced, for
+// the sounds and the uris.
+std::unordered_set<std::string> search_regexes(const std::string& contents) {
+  std::unordered_set<std::string> result;
+  for (const auto& regex : {boost::regex("\"([^\\\"]+)\\.(m4a|ogg)\""),
+                            boost::regex("\\buri:\\s*\"([^\\\"]+)\"")}) {
+    boost::smatch m;
+    std::string s = contents;
+    while (boost::regex_search(s, m, regex)) {
+      result.insert(m[1].str());
+      s = m.suffix().str();
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(JsResourcesTest, extractsAllKinds) {
+  std::string bundle = R"(
+    var ding = require("sounds/ding.m4a"), boom = "boom.ogg";
+    var img = {uri: "https://example.com/a.png"};
+    registerAsset({name:"Icon",httpServerLocation:"/assets/img/Main",type:"png"});
+    var x = "not.a.sound";
+  )";
+  std::unordered_set<std::string> expected = {
+      "sounds/ding", "boom", "https://example.com/a.png", "img_main_icon"};
+  EXPECT_EQ(extract_js_resources(bundle), expected);
+}
+
+TEST(JsResourcesTest, sameAsRegexes) {
+  std::mt19937 gen(13);
+  const std::vector<std::string> pieces = {
+      "\"", ".m4a\"", ".ogg", "uri:", "uri: ", "xuri:", "a", "b/c", "\n", " "};
+  for (size_t round = 0; round < 200; ++round) {
+    std::string bundle;
+    for (size_t i = 0; i < 40; ++i) {
+      bundle += pieces[gen() % pieces.size()];
+    }
+    EXPECT_EQ(extract_js_resources(bundle), search_regexes(bundle)) << bundle;
+  }
+}
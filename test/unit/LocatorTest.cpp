@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+#include "DexOutput.h"
+#include "RedexContext.h"
+#include <locator_table.h>
+
+using facebook::LocatorTable;
+
+namespace {
+
+// Decodes buf the way the class loader does, from the NUL at the end of the
+// string, which the ULEB length prefix precedes.
+Locator round_trip(Locator locator, uint32_t* len) {
+  char buf[Locator::encoded_max + 1];
+  *len = locator.encode(buf + 1);
+  buf[0] = *len;
+  EXPECT_EQ(strlen(buf + 1), *len);
+  return Locator::decodeBackward(buf + 1 + *len);
+}
+
+} // namespace
+
+TEST(LocatorTest, encodeDecode) {
+  uint32_t len;
+  auto special = round_trip(Locator::make(0, 0, 0), &len);
+  EXPECT_EQ(len, 0);
+  EXPECT_EQ(special.strnr, 0);
+  EXPECT_EQ(special.dexnr, 0);
+  EXPECT_EQ(special.clsnr, 0);
+
+  auto largest = round_trip(
+      Locator::make((1 << 16) - 1, (1 << 6) - 1, (1 << 20) - 1), &len);
+  EXPECT_EQ(len, Locator::encoded_max - 1);
+  EXPECT_EQ(largest.strnr, (1 << 16) - 1);
+  EXPECT_EQ(largest.dexnr, (1 << 6) - 1);
+  EXPECT_EQ(largest.clsnr, (1 << 20) - 1);
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint32_t> str_dist(0, (1 << 16) - 1);
+  std::uniform_int_distribution<uint32_t> dex_dist(0, (1 << 6) - 1);
+  std::uniform_int_distribution<uint32_t> cls_dist(0, (1 << 20) - 1);
+  for (size_t i = 0; i < 10000; ++i) {
+    // Mostly the common case of the primary store.
+    auto str = i % 4 == 0 ? str_dist(gen) : 0;
+    auto dex = dex_dist(gen);
+    auto cls = i % 3 == 0 ? cls_dist(gen) : cls_dist(gen) % 100;
+    auto decoded = round_trip(Locator::make(str, dex, cls), &len);
+    EXPECT_EQ(decoded.strnr, str);
+    EXPECT_EQ(decoded.dexnr, dex);
+    EXPECT_EQ(decoded.clsnr, cls);
+  }
+}
+
+TEST(LocatorTest, table) {
+  g_redex = new RedexContext();
+  LocatorIndex index;
+  for (uint32_t i = 0; i < 5000; ++i) {
+    auto name = DexString::make_string("Lcom/foo/C" + std::to_string(i) + ";");
+    index.emplace(name, Locator::make(i % 3, i % 7 + 1, i));
+  }
+
+  auto data = make_locator_table(index);
+  LocatorTable table;
+  ASSERT_TRUE(table.init(data.data(), data.size()));
+  for (const auto& pair : index) {
+    auto entry = table.find(pair.first->c_str());
+    ASSERT_NE(entry, nullptr) << pair.first->c_str();
+    EXPECT_STREQ(table.name(entry), pair.first->c_str());
+    EXPECT_EQ(entry->strnr, pair.second.strnr);
+    EXPECT_EQ(entry->dexnr, pair.second.dexnr);
+    EXPECT_EQ(entry->clsnr, pair.second.clsnr);
+  }
+  EXPECT_EQ(table.find("Lcom/foo/C5000;"), nullptr);
+  EXPECT_EQ(table.find(""), nullptr);
+
+  EXPECT_FALSE(table.init(data.data(), data.size() - 1));
+  LocatorTable empty;
+  auto empty_data = make_locator_table(LocatorIndex());
+  ASSERT_TRUE(empty.init(empty_data.data(), empty_data.size()));
+  EXPECT_EQ(empty.find("LFoo;"), nullptr);
+  delete g_redex;
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "DexAsm.h"
+#include "IRCode.h"
+#include "Match.h"
+
+struct MatchTest : testing::Test {
+  MatchTest() { g_redex = new RedexContext(); }
+
+  ~MatchTest() { delete g_redex; }
+};
+
+TEST_F(MatchTest, opcodeSet) {
+  constexpr m::opcode_set moves{OPCODE_MOVE, OPCODE_MOVE_OBJECT};
+  static_assert(moves.contains(OPCODE_MOVE), "built at compile time");
+  EXPECT_FALSE(moves.contains(OPCODE_MOVE_WIDE));
+  EXPECT_EQ(moves.size(), 2);
+
+  auto all = moves | m::opcode_set{IOPCODE_MOVE_RESULT_PSEUDO_WIDE};
+  std::vector<IROpcode> opcodes;
+  all.for_each([&opcodes](IROpcode op) { opcodes.push_back(op); });
+  EXPECT_EQ(opcodes,
+            std::vector<IROpcode>({OPCODE_MOVE,
+                                   OPCODE_MOVE_OBJECT,
+                                   IOPCODE_MOVE_RESULT_PSEUDO_WIDE}));
+}
+
+TEST_F(MatchTest, insnWindow) {
+  using namespace dex_asm;
+  std::vector<std::unique_ptr<IRInstruction>> insns;
+  for (int i = 0; i < 5; ++i) {
+    insns.emplace_back(dasm(OPCODE_CONST, {0_v, Operand{LITERAL, i}}));
+  }
+
+  m::insn_window<3> window;
+  window.push(insns[0].get());
+  EXPECT_FALSE(window.full());
+  EXPECT_EQ(window.size(), 1);
+  EXPECT_EQ(window[0], insns[0].get());
+  for (size_t i = 1; i < insns.size(); ++i) {
+    window.push(insns[i].get());
+  }
+  EXPECT_TRUE(window.full());
+  EXPECT_EQ(window.to_array(),
+            (std::array<IRInstruction*, 3>{
+                {insns[2].get(), insns[3].get(), insns[4].get()}}));
+}
+
+TEST_F(MatchTest, forEachMatch) {
+  using namespace dex_asm;
+  IRCode code;
+  code.push_back(dasm(OPCODE_CONST, {0_v, 1_L}));
+  code.push_back(dasm(OPCODE_MOVE, {1_v, 0_v}));
+  code.push_back(dasm(OPCODE_MOVE, {2_v, 1_v}));
+  code.push_back(dasm(OPCODE_RETURN, {2_v}));
+
+  auto pattern =
+      std::make_tuple(m::is_opcode_in({OPCODE_CONST, OPCODE_MOVE}),
+                      m::is_opcode(OPCODE_MOVE));
+  std::vector<IRInstruction*> firsts;
+  m::for_each_match(InstructionIterable(code),
+                    pattern,
+                    [&firsts](const m::insn_window<2>& window) {
+                      firsts.push_back(window[0]);
+                    });
+  ASSERT_EQ(firsts.size(), 2);
+  EXPECT_EQ(firsts[0]->opcode(), OPCODE_CONST);
+  EXPECT_EQ(firsts[1]->opcode(), OPCODE_MOVE);
+  EXPECT_EQ(firsts[1]->dest(), 1);
+}
+
+TEST_F(MatchTest, captures) {
+  enum class Reg { A, B };
+  m::captures<Reg, uint16_t, 2> regs;
+  EXPECT_TRUE(regs.bind(Reg::A, 3));
+  EXPECT_TRUE(regs.bind(Reg::A, 3));
+  EXPECT_FALSE(regs.bind(Reg::A, 4));
+  EXPECT_FALSE(regs.contains(Reg::B));
+  EXPECT_EQ(regs.at(Reg::A), 3);
+
+  regs.clear();
+  EXPECT_FALSE(regs.contains(Reg::A));
+  EXPECT_TRUE(regs.bind(Reg::A, 4));
+}
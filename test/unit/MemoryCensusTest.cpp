@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "ControlFlow.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "MemoryCensus.h"
+#include "ScopeHelper.h"
+
+using namespace memory_census;
+
+struct MemoryCensusTest : testing::Test {
+  MemoryCensusTest() { g_redex = new RedexContext(); }
+
+  ~MemoryCensusTest() { delete g_redex; }
+
+  static DexMethod* make_method(Scope* scope) {
+    auto method = create_class_with_branching_method("LFoo;");
+    scope->push_back(type_class(method->get_class()));
+    return method;
+  }
+};
+
+TEST_F(MemoryCensusTest, countsEntriesByType) {
+  Scope scope;
+  make_method(&scope);
+  auto census = take(scope);
+  EXPECT_EQ(census.at("classes").count, 1);
+  EXPECT_EQ(census.at("methods").count, 1);
+  EXPECT_EQ(census.at("ir.code").count, 1);
+  EXPECT_EQ(census.at("ir.opcode").count, 5);
+  EXPECT_EQ(census.at("ir.opcode").bytes, 5 * sizeof(IRInstruction));
+  EXPECT_EQ(census.at("ir.target").count, 1);
+  EXPECT_EQ(census.count("cfg"), 0);
+  EXPECT_GE(census.at("interned.strings").count, 3);
+  EXPECT_GT(census.at("interned.string_data").bytes,
+            census.at("interned.strings").count);
+  EXPECT_EQ(census.at("interned.methods").count, 1);
+}
+
+TEST_F(MemoryCensusTest, countsEditableCfg) {
+  Scope scope;
+  auto method = make_method(&scope);
+  auto before = take(scope);
+  method->get_code()->build_cfg(/* editable */ true);
+  auto after = take(scope);
+  EXPECT_EQ(after.at("cfg").count, 1);
+  EXPECT_GE(after.at("cfg.blocks").count, 3);
+  EXPECT_GE(after.at("cfg.edges").count, 2);
+  // The entries moved into the blocks are still counted.
+  EXPECT_EQ(after.at("ir.opcode").count, before.at("ir.opcode").count);
+}
+
+TEST_F(MemoryCensusTest, toJson) {
+  Census census;
+  census["a"].add(2, 8);
+  census["b"].add(1, 4);
+  auto json = to_json(census);
+  EXPECT_EQ(json["a"]["count"].asUInt64(), 2);
+  EXPECT_EQ(json["a"]["bytes"].asUInt64(), 16);
+  EXPECT_EQ(json["total_bytes"].asUInt64(), 20);
+}
@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2017-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "MethodDevirtualizer.h"
+#include "ScopeHelper.h"
+
+struct MethodDevirtualizerTest : testing::Test {
+  MethodDevirtualizerTest() { g_redex = new RedexContext(); }
+
+  ~MethodDevirtualizerTest() { delete g_redex; }
+
+  DexMethod* add_method(DexClass* cls,
+                        const std::string& signature,
+                        DexAccessFlags access,
+                        const std::string& code) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        cls->get_type()->get_name()->str() + "." + signature));
+    method->make_concrete(access, !(access & (ACC_STATIC | ACC_PRIVATE)));
+    method->set_code(assembler::ircode_from_string(code));
+    // The assembler leaves the frame empty, and staticizing shrinks it.
+    method->get_code()->set_registers_size(2);
+    cls->add_method(method);
+    return method;
+  }
+};
+
+TEST_F(MethodDevirtualizerTest, allCallsRewrittenInOneSweep) {
+  Scope scope = create_empty_scope();
+  auto foo_t = DexType::make_type("LFoo;");
+  auto foo_cls = create_internal_class(foo_t, get_object_type(), {});
+  scope.push_back(foo_cls);
+
+  // Doesn't use `this`.
+  auto ignores_this = add_method(foo_cls,
+                                 "ignoresThis:(I)I",
+                                 ACC_PUBLIC,
+                                 R"(
+    (
+     (load-param-object v0)
+     (load-param v1)
+     (return v1)
+    )
+  )");
+  // Uses `this`.
+  auto uses_this = add_method(foo_cls,
+                              "usesThis:()Ljava/lang/Object;",
+                              ACC_PUBLIC,
+                              R"(
+    (
+     (load-param-object v0)
+     (return-object v0)
+    )
+  )");
+  // A private method that doesn't use `this`.
+  auto direct = add_method(foo_cls,
+                           "direct:()V",
+                           ACC_PRIVATE,
+                           R"(
+    (
+     (load-param-object v0)
+     (return-void)
+    )
+  )");
+  auto caller = add_method(foo_cls,
+                           "caller:(LFoo;)V",
+                           ACC_PUBLIC | ACC_STATIC,
+                           R"(
+    (
+     (load-param-object v0)
+     (const v1 1)
+     (invoke-virtual (v0 v1) "LFoo;.ignoresThis:(I)I")
+     (invoke-virtual (v0) "LFoo;.usesThis:()Ljava/lang/Object;")
+     (invoke-direct (v0) "LFoo;.direct:()V")
+     (return-void)
+    )
+  )");
+
+  MethodDevirtualizer devirt(/* vmethods_not_using_this */ true,
+                             /* vmethods_using_this */ true,
+                             /* dmethods_not_using_this */ true,
+                             /* dmethods_using_this */ false,
+                             /* ignore_keep */ false);
+  auto metrics = devirt.devirtualize_methods(scope);
+  EXPECT_EQ(metrics.num_methods_not_using_this, 2);
+  EXPECT_EQ(metrics.num_methods_using_this, 1);
+  EXPECT_EQ(metrics.num_virtual_calls, 2);
+  EXPECT_EQ(metrics.num_direct_calls, 1);
+  EXPECT_TRUE(is_static(ignores_this));
+  EXPECT_TRUE(is_static(uses_this));
+  EXPECT_TRUE(is_static(direct));
+
+  auto expected_code = assembler::ircode_from_string(R"(
+    (
+     (load-param-object v0)
+     (const v1 1)
+     (invoke-static (v1) "LFoo;.ignoresThis:(I)I")
+     (invoke-static (v0) "LFoo;.usesThis:(LFoo;)Ljava/lang/Object;")
+     (invoke-static () "LFoo;.direct:()V")
+     (return-void)
+    )
+  )");
+  EXPECT_EQ(assembler::to_s_expr(caller->get_code()),
+            assembler::to_s_expr(expected_code.get()));
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "MethodProfiler.h"
+#include "Walkers.h"
+
+struct MethodProfilerTest : testing::Test {
+  MethodProfilerTest() { g_redex = new RedexContext(); }
+
+  ~MethodProfilerTest() {
+    method_profiler::enable(0);
+    delete g_redex;
+  }
+
+  DexMethod* add_method(DexClass* cls,
+                        const char* name,
+                        const std::string& code) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        cls->get_type()->get_name()->str() + "." + name + ":(I)I"));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(assembler::ircode_from_string(code));
+    cls->add_method(method);
+    return method;
+  }
+};
+
+TEST_F(MethodProfilerTest, slowestMethodsOfPass) {
+  ClassCreator creator(DexType::make_type("LA;"));
+  creator.set_super(get_object_type());
+  auto cls = creator.create();
+  add_method(cls, "fast", "((load-param v0) (return v0))");
+  add_method(cls, "slow", R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :zero)
+     (add-int/lit8 v0 v0 1)
+     (:zero)
+     (return v0)
+    )
+  )");
+  Scope scope{cls};
+
+  // Off by default.
+  EXPECT_EQ(nullptr, method_profiler::current_phase());
+
+  method_profiler::enable(1);
+  {
+    method_profiler::ScopedPhase phase("MyPass");
+    walk::parallel::code(scope, [](DexMethod* m, IRCode&) {
+      if (m->get_name()->str() == "slow") {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+    });
+  }
+
+  auto slowest = method_profiler::slowest();
+  ASSERT_EQ(1, slowest.size());
+  EXPECT_EQ("MyPass", slowest[0].phase);
+  EXPECT_EQ("LA;.slow:(I)I", slowest[0].method);
+  EXPECT_GE(slowest[0].seconds, 0.02);
+  EXPECT_EQ(4, slowest[0].instructions);
+  EXPECT_EQ(2, slowest[0].blocks);
+}
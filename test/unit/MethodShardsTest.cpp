@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+#include <json/json.h>
+
+#include "ConfigFiles.h"
+#include "Creators.h"
+#include "DexStore.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "MethodShards.h"
+#include "Pass.h"
+#include "PassManager.h"
+#include "Walkers.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// Removes the nops of every method.
+class RemoveNopsPass : public Pass {
+ public:
+  RemoveNopsPass() : Pass("RemoveNopsPass") {}
+
+  void run_pass(DexStoresVector& stores,
+                ConfigFiles&,
+                PassManager& mgr) override {
+    int removed = 0;
+    walk::code(build_class_scope(stores), [&](DexMethod*, IRCode& code) {
+      std::vector<IRInstruction*> nops;
+      for (const auto& mie : InstructionIterable(code)) {
+        if (mie.insn->opcode() == OPCODE_NOP) {
+          nops.push_back(mie.insn);
+        }
+      }
+      for (auto insn : nops) {
+        code.remove_opcode(insn);
+      }
+      removed += nops.size();
+    });
+    mgr.incr_metric("nops_removed", removed);
+  }
+
+  bool is_method_local() const override { return true; }
+};
+
+RemoveNopsPass s_pass;
+
+} // namespace
+
+struct MethodShardsTest : testing::Test {
+  MethodShardsTest()
+      : m_dir((fs::temp_directory_path() /
+               fs::unique_path("redex-shards-%%%%-%%%%"))
+                  .string()) {
+    g_redex = new RedexContext();
+  }
+
+  ~MethodShardsTest() {
+    delete g_redex;
+    fs::remove_all(m_dir);
+  }
+
+  DexMethod* add_method(DexClass* cls, const std::string& descriptor) {
+    auto method =
+        static_cast<DexMethod*>(DexMethod::make_method(descriptor));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    cls->add_method(method);
+    return method;
+  }
+
+  // Runs the worker of the shard in a context of its own, as its process
+  // would.
+  void run_worker(size_t shard) {
+    auto coordinator = g_redex;
+    g_redex = new RedexContext();
+    EXPECT_EQ(method_shards::run_worker(m_dir, shard), EXIT_SUCCESS);
+    delete g_redex;
+    g_redex = coordinator;
+  }
+
+  std::string m_dir;
+};
+
+TEST_F(MethodShardsTest, workersRewriteTheirShards) {
+  ClassCreator creator(DexType::make_type("LFoo;"));
+  creator.set_super(get_object_type());
+  auto cls = creator.create();
+  std::vector<DexMethod*> methods;
+  for (const char* name : {"a", "b", "c"}) {
+    auto method = add_method(cls, std::string("LFoo;.") + name + ":()I");
+    method->set_code(assembler::ircode_from_string(R"(
+      (
+       (const v0 1)
+       (nop)
+       (nop)
+       (return v0)
+      )
+    )"));
+    methods.push_back(method);
+  }
+  DexStoresVector stores;
+  stores.emplace_back(DexStore("classes"));
+  stores[0].add_classes({cls});
+
+  Json::Value config;
+  config["redex"]["passes"].append("RemoveNopsPass");
+  ConfigFiles cfg(config);
+  Json::Value state;
+  state["reachability_done"] = true;
+  method_shards::write(m_dir, stores, cfg, config, state, 2);
+  // The coordinator keeps its code while the workers run.
+  EXPECT_EQ(methods[0]->get_code()->count_opcodes(), 4);
+
+  run_worker(0);
+  run_worker(1);
+  auto results = method_shards::read_results(m_dir, 2);
+  ASSERT_EQ(results.size(), 2);
+
+  int removed = 0;
+  for (const auto& result : results) {
+    ASSERT_EQ(result["passes"].size(), 1);
+    removed += result["passes"][0]["metrics"]["nops_removed"].asInt();
+  }
+  EXPECT_EQ(removed, 6);
+  auto expected = assembler::ircode_from_string(R"(
+    (
+     (const v0 1)
+     (return v0)
+    )
+  )");
+  for (auto method : methods) {
+    EXPECT_EQ(assembler::to_s_expr(method->get_code()),
+              assembler::to_s_expr(expected.get()))
+        << show(method);
+  }
+}
@@ -359,3 +359,62 @@ TEST_F(MonotonicFixpointIteratorTest, program2) {
   ASSERT_TRUE(fp.get_live_in_vars_at("7").is_bottom());
   ASSERT_TRUE(fp.get_live_out_vars_at("7").is_bottom());
 }
+
+/*
+ * An analysis that never converges on loops: every node adds a new element to
+ * the set, so the states keep growing around a cycle.
+ */
+class GrowingSetIterator final
+    : public MonotonicFixpointIterator<ProgramInterface,
+                                       LivenessDomain,
+                                       boost::hash<ControlPoint>> {
+ public:
+  GrowingSetIterator(const Program& program,
+                     const FixpointIterationOptions& options)
+      : MonotonicFixpointIterator(program, 4, options) {}
+
+  void analyze_node(const ControlPoint&,
+                    LivenessDomain* current_state) const override {
+    if (current_state->is_value()) {
+      current_state->add(std::to_string(current_state->size()));
+    }
+  }
+
+  LivenessDomain analyze_edge(
+      const EdgeId&,
+      const LivenessDomain& exit_state_at_source) const override {
+    return exit_state_at_source;
+  }
+};
+
+TEST_F(MonotonicFixpointIteratorTest, iterationLimit) {
+  FixpointIterationOptions options;
+  options.max_iterations = 5;
+  GrowingSetIterator fp(this->m_program1, options);
+  fp.run(LivenessDomain());
+
+  // The loop of program1 is headed by node 2.
+  EXPECT_TRUE(fp.get_entry_state_at(ControlPoint("2")).is_top());
+  EXPECT_TRUE(fp.get_exit_state_at(ControlPoint("6")).is_top());
+  EXPECT_THAT(fp.get_exit_state_at(ControlPoint("1")).elements(),
+              ::testing::UnorderedElementsAre("0"));
+
+  const auto& context = fp.get_context();
+  EXPECT_EQ(5, context.get_global_iterations_for(ControlPoint("2")));
+  EXPECT_EQ(5, context.get_total_iterations());
+  EXPECT_EQ(1, context.get_iteration_limit_hits());
+}
+
+TEST_F(MonotonicFixpointIteratorTest, iterationCounts) {
+  FixpointIterator fp(this->m_program1);
+  fp.run(LivenessDomain());
+
+  // Going backwards, the loop of program1 is headed by node 5, and the
+  // liveness converges after a couple of iterations.
+  const auto& context = fp.get_context();
+  EXPECT_EQ(0, context.get_iteration_limit_hits());
+  EXPECT_EQ(context.get_total_iterations(),
+            context.get_global_iterations_for(ControlPoint("5")));
+  EXPECT_LE(context.get_total_iterations(), 3);
+  EXPECT_LE(1, context.get_total_iterations());
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "DexOpcode.h"
+#include "IROpcode.h"
+#include "OpcodeList.h"
+#include "Show.h"
+
+TEST(OpcodePropertiesTest, dexTableMatchesSwitches) {
+  auto ops = all_dex_opcodes;
+  ops.push_back(FOPCODE_PACKED_SWITCH);
+  ops.push_back(FOPCODE_SPARSE_SWITCH);
+  ops.push_back(FOPCODE_FILLED_ARRAY);
+  for (auto op : ops) {
+    const auto& props = dex_opcode::impl::properties(op);
+    auto expected = dex_opcode::impl::properties_from_switches(op);
+    EXPECT_TRUE(props.valid) << show(op);
+    EXPECT_EQ(props.format, expected.format) << show(op);
+    EXPECT_EQ(props.dests_size, expected.dests_size) << show(op);
+    EXPECT_EQ(props.min_srcs_size, expected.min_srcs_size) << show(op);
+    EXPECT_EQ(props.has_literal, expected.has_literal) << show(op);
+    EXPECT_EQ(props.has_offset, expected.has_offset) << show(op);
+    EXPECT_EQ(props.has_range, expected.has_range) << show(op);
+    EXPECT_EQ(props.is_commutative, expected.is_commutative) << show(op);
+    EXPECT_EQ(props.is_branch, expected.is_branch) << show(op);
+    EXPECT_EQ(props.is_conditional_branch, expected.is_conditional_branch)
+        << show(op);
+    EXPECT_EQ(props.is_goto, expected.is_goto) << show(op);
+  }
+
+  // Spot checks of the lookups.
+  EXPECT_EQ(dex_opcode::format(DOPCODE_ADD_INT_2ADDR), FMT_f12x_2);
+  EXPECT_EQ(dex_opcode::format(FOPCODE_SPARSE_SWITCH), FMT_fopcode);
+  EXPECT_EQ(dex_opcode::dests_size(DOPCODE_ADD_INT), 1);
+  EXPECT_EQ(dex_opcode::min_srcs_size(DOPCODE_APUT), 3);
+  EXPECT_TRUE(dex_opcode::has_range(DOPCODE_INVOKE_STATIC_RANGE));
+  EXPECT_TRUE(dex_opcode::is_conditional_branch(DOPCODE_IF_LEZ));
+  EXPECT_FALSE(dex_opcode::is_branch(FOPCODE_PACKED_SWITCH));
+  // Unused opcodes aren't branches, but have no format.
+  EXPECT_FALSE(dex_opcode::is_branch(static_cast<DexOpcode>(0x3e)));
+  EXPECT_THROW(dex_opcode::format(static_cast<DexOpcode>(0x3e)),
+               std::runtime_error);
+}
+
+TEST(OpcodePropertiesTest, irTableMatchesSwitches) {
+  auto ops = all_opcodes;
+  ops.push_back(IOPCODE_LOAD_PARAM);
+  ops.push_back(IOPCODE_LOAD_PARAM_OBJECT);
+  ops.push_back(IOPCODE_LOAD_PARAM_WIDE);
+  ops.push_back(IOPCODE_MOVE_RESULT_PSEUDO);
+  ops.push_back(IOPCODE_MOVE_RESULT_PSEUDO_OBJECT);
+  ops.push_back(IOPCODE_MOVE_RESULT_PSEUDO_WIDE);
+  for (auto op : ops) {
+    const auto& props = opcode_impl::properties(op);
+    auto expected = opcode_impl::properties_from_switches(op);
+    EXPECT_EQ(props.ref, expected.ref) << show(op);
+    EXPECT_EQ(props.is_internal, expected.is_internal) << show(op);
+    if (!props.is_internal) {
+      EXPECT_EQ(props.dex_opcode, expected.dex_opcode) << show(op);
+    }
+    EXPECT_EQ(props.may_throw, expected.may_throw) << show(op);
+    EXPECT_EQ(props.branchingness, expected.branchingness) << show(op);
+    EXPECT_EQ(props.has_range_form, expected.has_range_form) << show(op);
+    EXPECT_EQ(props.has_variable_srcs_size, expected.has_variable_srcs_size)
+        << show(op);
+    EXPECT_EQ(props.dest_is_wide, expected.dest_is_wide) << show(op);
+  }
+
+  // Spot checks of the lookups.
+  EXPECT_EQ(opcode::ref(OPCODE_CONST_STRING), opcode::Ref::String);
+  EXPECT_EQ(opcode::to_dex_opcode(OPCODE_ADD_INT), DOPCODE_ADD_INT);
+  EXPECT_THROW(opcode::to_dex_opcode(IOPCODE_LOAD_PARAM), std::runtime_error);
+  EXPECT_EQ(opcode::branchingness(OPCODE_DIV_INT), opcode::BRANCH_THROW);
+  EXPECT_EQ(opcode::branchingness(OPCODE_IF_EQZ), opcode::BRANCH_IF);
+  EXPECT_EQ(opcode_impl::dests_size(OPCODE_DIV_INT), 0);
+  EXPECT_TRUE(opcode_impl::has_move_result_pseudo(OPCODE_DIV_INT));
+  EXPECT_TRUE(opcode_impl::dest_is_wide(IOPCODE_MOVE_RESULT_PSEUDO_WIDE));
+  EXPECT_EQ(opcode_impl::min_srcs_size(OPCODE_APUT), 3);
+}
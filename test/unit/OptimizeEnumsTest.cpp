@@ -0,0 +1,288 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "OptimizeEnums.h"
+#include "ScopeHelper.h"
+
+using namespace optimize_enums;
+
+namespace {
+
+void add_static_field(ClassCreator* creator, const char* name) {
+  auto field = static_cast<DexField*>(DexField::make_field(name));
+  field->make_concrete(ACC_PUBLIC | ACC_STATIC | ACC_FINAL);
+  creator->add_field(field);
+}
+
+/*
+ * enum Color { RED, GREEN, BLUE }
+ */
+DexClass* make_enum(const std::string& clinit_prefix = "") {
+  ClassCreator creator(DexType::make_type("LColor;"));
+  creator.set_super(get_enum_type());
+  creator.set_access(ACC_PUBLIC | ACC_FINAL | ACC_ENUM);
+  for (auto name : {"RED", "GREEN", "BLUE"}) {
+    add_static_field(&creator,
+                     (std::string("LColor;.") + name + ":LColor;").c_str());
+  }
+  creator.add_method(
+      create_method_from_code("LColor;.<init>:(Ljava/lang/String;I)V", R"(
+    (
+     (load-param-object v0)
+     (load-param-object v1)
+     (load-param v2)
+     (invoke-direct (v0 v1 v2) "Ljava/lang/Enum;.<init>:(Ljava/lang/String;I)V")
+     (return-void)
+    )
+  )",
+                              ACC_PRIVATE | ACC_CONSTRUCTOR));
+  std::string clinit = "(" + clinit_prefix;
+  int ordinal = 0;
+  for (auto name : {"RED", "GREEN", "BLUE"}) {
+    clinit += std::string(R"(
+     (new-instance "LColor;")
+     (move-result-pseudo-object v0)
+     (const-string ")") + name + R"(")
+     (move-result-pseudo-object v1)
+     (const v2 )" + std::to_string(ordinal++) + R"()
+     (invoke-direct (v0 v1 v2) "LColor;.<init>:(Ljava/lang/String;I)V")
+     (sput-object v0 "LColor;.)" + name + R"(:LColor;")
+    )";
+  }
+  clinit += "(return-void))";
+  creator.add_method(create_method_from_code("LColor;.<clinit>:()V", clinit,
+                                             ACC_STATIC | ACC_CONSTRUCTOR));
+  return creator.create();
+}
+
+/*
+ * The holder of the switch map of `switch (color) { case BLUE: ... case RED:
+ * ... }`, which numbers the cases in their order.
+ */
+DexClass* make_switch_map_holder() {
+  ClassCreator creator(DexType::make_type("LFoo$1;"));
+  creator.set_super(get_object_type());
+  add_static_field(&creator, "LFoo$1;.$SwitchMap$LColor;:[I");
+  creator.add_method(create_method_from_code("LFoo$1;.<clinit>:()V", R"(
+    (
+     (invoke-static () "LColor;.values:()[LColor;")
+     (move-result-object v0)
+     (array-length v0)
+     (move-result-pseudo v0)
+     (new-array v0 "[I")
+     (move-result-pseudo-object v0)
+     (sput-object v0 "LFoo$1;.$SwitchMap$LColor;:[I")
+     (sget-object "LFoo$1;.$SwitchMap$LColor;:[I")
+     (move-result-pseudo-object v0)
+     (sget-object "LColor;.BLUE:LColor;")
+     (move-result-pseudo-object v1)
+     (invoke-virtual (v1) "LColor;.ordinal:()I")
+     (move-result v1)
+     (const v2 1)
+     (aput v2 v0 v1)
+     (sget-object "LFoo$1;.$SwitchMap$LColor;:[I")
+     (move-result-pseudo-object v0)
+     (sget-object "LColor;.RED:LColor;")
+     (move-result-pseudo-object v1)
+     (invoke-virtual (v1) "LColor;.ordinal:()I")
+     (move-result v1)
+     (const v2 2)
+     (aput v2 v0 v1)
+     (return-void)
+    )
+  )",
+                                             ACC_STATIC | ACC_CONSTRUCTOR));
+  return creator.create();
+}
+
+/*
+ * switch (color) { case BLUE: return 10; case RED: return 20; } return 0;
+ */
+DexMethod* make_switch_method(const std::string& name) {
+  auto method = create_method_from_code(name, R"(
+    (
+     (load-param-object v0)
+     (sget-object "LFoo$1;.$SwitchMap$LColor;:[I")
+     (move-result-pseudo-object v1)
+     (invoke-virtual (v0) "LColor;.ordinal:()I")
+     (move-result v2)
+     (aget v1 v2)
+     (move-result-pseudo v3)
+     (const v4 0)
+     (return v4)
+     (const v4 10)
+     (return v4)
+     (const v4 20)
+     (return v4)
+    )
+  )");
+  auto code = method->get_code();
+  std::vector<FatMethod::iterator> insns;
+  for (auto it = code->begin(); it != code->end(); ++it) {
+    if (it->type == MFLOW_OPCODE) {
+      insns.push_back(it);
+    }
+  }
+  auto sw = new IRInstruction(OPCODE_PACKED_SWITCH);
+  sw->set_arg_word_count(1)->set_src(0, 3);
+  auto sw_it = code->insert_after(insns[6], sw);
+  code->insert_before(insns[9], new BranchTarget(&*sw_it, 1));
+  code->insert_before(insns[11], new BranchTarget(&*sw_it, 2));
+  return method;
+}
+
+// The value that each case of the switch returns.
+std::map<int32_t, int64_t> get_cases(IRCode* code) {
+  std::map<int32_t, int64_t> cases;
+  for (auto it = code->begin(); it != code->end(); ++it) {
+    if (it->type == MFLOW_TARGET && it->target->type == BRANCH_MULTI) {
+      auto next = std::next(it);
+      while (next->type != MFLOW_OPCODE) {
+        ++next;
+      }
+      cases.emplace(it->target->index, next->insn->get_literal());
+    }
+  }
+  return cases;
+}
+
+bool has_opcode(IRCode* code, IROpcode op) {
+  for (const auto& mie : InstructionIterable(code)) {
+    if (mie.insn->opcode() == op) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+struct OptimizeEnumsTest : testing::Test {
+  OptimizeEnumsTest() { g_redex = new RedexContext(); }
+
+  ~OptimizeEnumsTest() { delete g_redex; }
+};
+
+TEST_F(OptimizeEnumsTest, analysis) {
+  Scope scope{make_enum(), make_switch_map_holder()};
+  auto ordinals = compute_ordinals(scope);
+  auto color = [](const char* name) {
+    return static_cast<DexField*>(DexField::get_field(
+        DexType::get_type("LColor;"), DexString::get_string(name),
+        DexType::get_type("LColor;")));
+  };
+  EXPECT_EQ(ordinals.size(), 3);
+  EXPECT_EQ(ordinals.at(color("RED")), 0);
+  EXPECT_EQ(ordinals.at(color("GREEN")), 1);
+  EXPECT_EQ(ordinals.at(color("BLUE")), 2);
+
+  auto switch_maps = find_switch_maps(scope, ordinals);
+  ASSERT_EQ(switch_maps.size(), 1);
+  const auto& map = switch_maps.begin()->second;
+  EXPECT_EQ(map.enum_type, DexType::get_type("LColor;"));
+  std::unordered_map<int32_t, int32_t> expected{{2, 1}, {0, 2}};
+  EXPECT_EQ(map.case_of, expected);
+}
+
+TEST_F(OptimizeEnumsTest, switchOnOrdinal) {
+  auto method = make_switch_method("LFoo;.bar:(LColor;)I");
+  ClassCreator creator(DexType::make_type("LFoo;"));
+  creator.set_super(get_object_type());
+  creator.add_method(method);
+  Scope scope{make_enum(), make_switch_map_holder(), creator.create()};
+
+  auto stats = optimize(scope);
+  EXPECT_EQ(stats.switch_maps, 1);
+  EXPECT_EQ(stats.switches_rewritten, 1);
+  auto code = method->get_code();
+  EXPECT_FALSE(has_opcode(code, OPCODE_SGET_OBJECT));
+  EXPECT_FALSE(has_opcode(code, OPCODE_AGET));
+  // BLUE has ordinal 2 and RED ordinal 0.
+  std::map<int32_t, int64_t> expected{{2, 10}, {0, 20}};
+  EXPECT_EQ(get_cases(code), expected);
+}
+
+TEST_F(OptimizeEnumsTest, escapingSwitchMap) {
+  auto method = make_switch_method("LFoo;.bar:(LColor;)I");
+  auto other = create_method_from_code("LFoo;.baz:()V", R"(
+    (
+     (sget-object "LFoo$1;.$SwitchMap$LColor;:[I")
+     (move-result-pseudo-object v0)
+     (invoke-static (v0) "LBar;.use:([I)V")
+     (return-void)
+    )
+  )");
+  ClassCreator creator(DexType::make_type("LFoo;"));
+  creator.set_super(get_object_type());
+  creator.add_method(method);
+  creator.add_method(other);
+  Scope scope{make_enum(), make_switch_map_holder(), creator.create()};
+
+  auto stats = optimize(scope);
+  EXPECT_EQ(stats.switches_rewritten, 0);
+  std::map<int32_t, int64_t> expected{{1, 10}, {2, 20}};
+  EXPECT_EQ(get_cases(method->get_code()), expected);
+}
+
+TEST_F(OptimizeEnumsTest, foldOrdinal) {
+  auto method = create_method_from_code("LFoo;.bar:()I", R"(
+    (
+     (sget-object "LColor;.BLUE:LColor;")
+     (move-result-pseudo-object v0)
+     (invoke-virtual (v0) "LColor;.ordinal:()I")
+     (move-result v1)
+     (return v1)
+    )
+  )");
+  ClassCreator creator(DexType::make_type("LFoo;"));
+  creator.set_super(get_object_type());
+  creator.add_method(method);
+  Scope scope{make_enum(), creator.create()};
+
+  auto stats = optimize(scope);
+  EXPECT_EQ(stats.ordinals_folded, 1);
+  auto expected = assembler::ircode_from_string(R"(
+    (
+     (sget-object "LColor;.BLUE:LColor;")
+     (move-result-pseudo-object v0)
+     (const v1 2)
+     (return v1)
+    )
+  )");
+  EXPECT_EQ(assembler::to_s_expr(method->get_code()),
+            assembler::to_s_expr(expected.get()));
+}
+
+TEST_F(OptimizeEnumsTest, keepOrdinalReadDuringInitialization) {
+  // Color's static initializer runs Foo.bar() before it sets BLUE, so bar
+  // reads null then.
+  auto color = make_enum(R"((invoke-static () "LFoo;.bar:()I"))");
+  auto method = create_method_from_code("LFoo;.bar:()I", R"(
+    (
+     (sget-object "LColor;.BLUE:LColor;")
+     (move-result-pseudo-object v0)
+     (invoke-virtual (v0) "LColor;.ordinal:()I")
+     (move-result v1)
+     (return v1)
+    )
+  )");
+  ClassCreator creator(DexType::make_type("LFoo;"));
+  creator.set_super(get_object_type());
+  creator.add_method(method);
+  Scope scope{color, creator.create()};
+
+  auto stats = optimize(scope);
+  EXPECT_EQ(stats.ordinals_folded, 0);
+}
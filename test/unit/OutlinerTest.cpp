@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "Creators.h"
+#include "DexClass.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "Outliner.h"
+#include "PassManager.h"
+#include "RedexContext.h"
+
+namespace {
+
+struct OutlinerTest : testing::Test {
+  DexType* m_foo;
+
+  OutlinerTest() {
+    g_redex = new RedexContext();
+    // The throw outliner looks this up.
+    DexType::make_type("Ljava/lang/Exception;");
+    m_foo = DexType::make_type("LFoo;");
+    ClassCreator creator(m_foo);
+    creator.set_super(get_object_type());
+    creator.set_access(ACC_PUBLIC);
+    auto field = static_cast<DexField*>(DexField::make_field(
+        m_foo, DexString::make_string("bar"), get_int_type()));
+    field->make_concrete(ACC_PUBLIC);
+    creator.add_field(field);
+    creator.create();
+  }
+
+  ~OutlinerTest() { delete g_redex; }
+
+  // A public class with a static method that takes a Foo for each of
+  // `tails`, which reads it from v0.
+  DexClass* make_class(const std::vector<std::string>& tails) {
+    auto type = DexType::make_type("LUser;");
+    ClassCreator creator(type);
+    creator.set_super(get_object_type());
+    creator.set_access(ACC_PUBLIC);
+    auto proto = DexProto::make_proto(get_int_type(),
+                                      DexTypeList::make_type_list({m_foo}));
+    for (size_t i = 0; i < tails.size(); ++i) {
+      auto method = static_cast<DexMethod*>(DexMethod::make_method(
+          type, DexString::make_string("m" + std::to_string(i)), proto));
+      method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+      method->set_code(assembler::ircode_from_string(
+          "((load-param-object v0) " + tails[i] + ")"));
+      creator.add_method(method);
+    }
+    return creator.create();
+  }
+
+  std::unordered_map<std::string, int> run_outliner(DexStoresVector& stores) {
+    Json::Value config(Json::objectValue);
+    config["Outliner"]["outline_common_tails"] = true;
+    std::vector<Pass*> passes{new Outliner()};
+    PassManager manager(passes, config);
+    manager.set_testing_mode();
+    Scope external_classes;
+    Json::Value conf_obj = Json::nullValue;
+    ConfigFiles dummy_config(conf_obj);
+    manager.run_passes(stores, external_classes, dummy_config);
+    return manager.get_pass_info().at(0).metrics;
+  }
+};
+
+DexStoresVector make_stores(DexClass* secondary) {
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes({});
+  store.add_classes({secondary});
+  stores.emplace_back(std::move(store));
+  return stores;
+}
+
+} // namespace
+
+// Ten methods end in the same instructions, some with other registers. They
+// all call one helper now.
+TEST_F(OutlinerTest, sharedTails) {
+  auto tail = [](const char* reg) {
+    return std::string("(iget v0 \"LFoo;.bar:I\") ") +
+           "(move-result-pseudo " + reg + ") " + "(add-int/lit8 " + reg + " " +
+           reg + " 3) " + "(mul-int/lit8 " + reg + " " + reg + " 5) " +
+           "(xor-int/lit16 " + reg + " " + reg + " 1000) " + "(return " +
+           reg + ")";
+  };
+  std::vector<std::string> tails;
+  for (size_t i = 0; i < 10; ++i) {
+    tails.push_back(tail(i % 2 == 0 ? "v1" : "v2"));
+  }
+  auto cls = make_class(tails);
+  auto stores = make_stores(cls);
+
+  auto metrics = run_outliner(stores);
+  EXPECT_EQ(10, metrics["outlined_tails"]);
+  EXPECT_EQ(1, metrics["outlined_tail_helpers"]);
+
+  const auto& dex = stores[0].get_dexen().at(1);
+  ASSERT_EQ(2, dex.size());
+  auto helper_cls = dex.back();
+  EXPECT_STREQ("Lcom/facebook/redex/OutlinedTails1;",
+               helper_cls->get_type()->get_name()->c_str());
+  ASSERT_EQ(1, helper_cls->get_dmethods().size());
+  auto helper = helper_cls->get_dmethods().at(0);
+  EXPECT_EQ(DexProto::make_proto(get_int_type(),
+                                 DexTypeList::make_type_list({m_foo})),
+            helper->get_proto());
+
+  auto expected = assembler::ircode_from_string(R"(
+    (
+     (load-param-object v0)
+     (invoke-static (v0) "Lcom/facebook/redex/OutlinedTails1;.$outlined$0:(LFoo;)I")
+     (move-result v1)
+     (return v1)
+    )
+  )");
+  auto method = DexMethod::get_method("LUser;.m0:(LFoo;)I");
+  ASSERT_NE(nullptr, method);
+  EXPECT_EQ(assembler::to_s_expr(expected.get()),
+            assembler::to_s_expr(static_cast<DexMethod*>(method)->get_code()));
+}
+
+// A tail that only a couple of methods share isn't worth a helper.
+TEST_F(OutlinerTest, rareTailsStay) {
+  std::string tail =
+      "(iget v0 \"LFoo;.bar:I\") (move-result-pseudo v1) "
+      "(add-int/lit8 v1 v1 3) (return v1)";
+  auto cls = make_class({tail, tail});
+  auto stores = make_stores(cls);
+
+  auto metrics = run_outliner(stores);
+  EXPECT_EQ(0, metrics["outlined_tails"]);
+  EXPECT_EQ(1, stores[0].get_dexen().at(1).size());
+}
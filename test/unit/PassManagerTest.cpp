@@ -0,0 +1,328 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "ArenaAllocator.h"
+#include "DexUtil.h"
+#include "PassManager.h"
+#include "RedexContext.h"
+
+namespace {
+
+/*
+ * Waits a little for the other instances to start, and records whether they
+ * did, i.e. whether they ran at the same time as this one.
+ */
+class RendezvousPass : public Pass {
+ public:
+  RendezvousPass(const std::string& name,
+                 unsigned reads,
+                 unsigned writes,
+                 std::atomic<int>& started,
+                 int expected)
+      : Pass(name),
+        m_reads(reads),
+        m_writes(writes),
+        m_started(started),
+        m_expected(expected) {}
+
+  void run_pass(DexStoresVector&, ConfigFiles&, PassManager& mgr) override {
+    ++m_started;
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (m_started.load() < m_expected &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+    overlapped = m_started.load() >= m_expected;
+    mgr.incr_metric("ran", 1);
+    if (record_from_helper) {
+      std::thread helper([&] {
+        try {
+          mgr.incr_metric("helper", 1);
+        } catch (const std::runtime_error&) {
+          helper_failed = true;
+        }
+      });
+      helper.join();
+    }
+  }
+
+  unsigned reads() const override { return m_reads; }
+  unsigned writes() const override { return m_writes; }
+
+  bool overlapped{false};
+  // Records a metric from another thread than the pass's own.
+  bool record_from_helper{false};
+  bool helper_failed{false};
+
+ private:
+  unsigned m_reads;
+  unsigned m_writes;
+  std::atomic<int>& m_started;
+  int m_expected;
+};
+
+/*
+ * Records the order in which it ran on the stores, and how many stores it ran
+ * on at once.
+ */
+class StoreLocalPass : public Pass {
+ public:
+  StoreLocalPass() : Pass("StoreLocalPass") {}
+
+  bool is_store_local() const override { return true; }
+
+  void run_pass(DexStoresVector& stores,
+                ConfigFiles& cfg,
+                PassManager& mgr) override {
+    for (size_t i = 0; i < stores.size(); ++i) {
+      run_pass_on_store(stores, i, cfg, mgr);
+    }
+  }
+
+  void run_pass_on_store(DexStoresVector&,
+                         size_t store_idx,
+                         ConfigFiles&,
+                         PassManager& mgr) override {
+    int running = ++m_running;
+    int max = m_max_running.load();
+    while (running > max && !m_max_running.compare_exchange_weak(max, running)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      order.push_back(store_idx);
+    }
+    mgr.incr_metric("stores", 1);
+    --m_running;
+  }
+
+  int max_running() const { return m_max_running.load(); }
+
+  std::vector<size_t> order;
+
+ private:
+  std::mutex m_lock;
+  std::atomic<int> m_running{0};
+  std::atomic<int> m_max_running{0};
+};
+
+/*
+ * Fills a container of the scratch arena.
+ */
+class ScratchPass : public Pass {
+ public:
+  ScratchPass() : Pass("ScratchPass") {}
+
+  void run_pass(DexStoresVector&, ConfigFiles&, PassManager& mgr) override {
+    auto& scratch = mgr.get_scratch_arena();
+    arena::vector<size_t> numbers(scratch);
+    for (size_t i = 0; i < 100000; ++i) {
+      numbers.push_back(i);
+    }
+    EXPECT_EQ(&scratch, &mgr.get_scratch_arena());
+    mgr.incr_metric("ran", 1);
+  }
+};
+
+void add_store(DexStoresVector& stores,
+               const std::string& name,
+               const std::vector<std::string>& deps) {
+  DexMetadata dm;
+  dm.set_id(name);
+  dm.get_dependencies() = deps;
+  DexStore store(dm);
+  store.add_classes({});
+  stores.emplace_back(std::move(store));
+}
+
+size_t position(const std::vector<size_t>& order, size_t store_idx) {
+  return std::find(order.begin(), order.end(), store_idx) - order.begin();
+}
+
+void run_on_stores(Pass* pass,
+                   DexStoresVector& stores,
+                   Json::Value config = Json::Value(Json::objectValue)) {
+  config["jobs"] = 4;
+  PassManager manager({pass}, config);
+  manager.set_testing_mode();
+  Scope external_classes;
+  Json::Value conf_obj = Json::nullValue;
+  ConfigFiles dummy_config(conf_obj);
+  manager.run_passes(stores, external_classes, dummy_config);
+  EXPECT_EQ(stores.size(),
+            manager.get_pass_info().at(0).metrics.at("stores"));
+}
+
+void run(const std::vector<Pass*>& passes,
+         Json::Value config = Json::Value(Json::objectValue)) {
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes({});
+  stores.emplace_back(std::move(store));
+
+  config["jobs"] = 4;
+  PassManager manager(passes, config);
+  manager.set_testing_mode();
+
+  Scope external_classes;
+  Json::Value conf_obj = Json::nullValue;
+  ConfigFiles dummy_config(conf_obj);
+  manager.run_passes(stores, external_classes, dummy_config);
+
+  for (const auto& info : manager.get_pass_info()) {
+    EXPECT_EQ(1, info.metrics.at("ran")) << info.name;
+    EXPECT_GT(info.profile.wall_s, 0) << info.name;
+    EXPECT_GE(info.profile.cpu_s, 0) << info.name;
+    EXPECT_EQ(config.get("profile_methods_touched", false).asBool() ? 0 : -1,
+              info.profile.methods_touched)
+        << info.name;
+  }
+}
+
+} // namespace
+
+TEST(PassManagerTest, disjointPassesRunConcurrently) {
+  g_redex = new RedexContext();
+  std::atomic<int> started{0};
+  RendezvousPass code("DisjointCodePass", Pass::TOUCHES_CODE,
+                      Pass::TOUCHES_CODE, started, 2);
+  RendezvousPass resources("DisjointResourcesPass", Pass::TOUCHES_NOTHING,
+                           Pass::TOUCHES_RESOURCES, started, 2);
+  run({&code, &resources});
+  EXPECT_TRUE(code.overlapped);
+  EXPECT_TRUE(resources.overlapped);
+  delete g_redex;
+}
+
+TEST(PassManagerTest, metricsOfConcurrentPassesNeedTheirThread) {
+  g_redex = new RedexContext();
+  std::atomic<int> started{0};
+  RendezvousPass code("DisjointCodePass", Pass::TOUCHES_CODE,
+                      Pass::TOUCHES_CODE, started, 2);
+  RendezvousPass resources("DisjointResourcesPass", Pass::TOUCHES_NOTHING,
+                           Pass::TOUCHES_RESOURCES, started, 2);
+  code.record_from_helper = true;
+  run({&code, &resources});
+  EXPECT_TRUE(code.overlapped);
+  EXPECT_TRUE(code.helper_failed);
+
+  // Alone, the pass is the current one on every thread.
+  started = 0;
+  RendezvousPass alone("AlonePass", Pass::TOUCHES_CODE, Pass::TOUCHES_CODE,
+                       started, 1);
+  alone.record_from_helper = true;
+  run({&alone});
+  EXPECT_FALSE(alone.helper_failed);
+  delete g_redex;
+}
+
+TEST(PassManagerTest, conflictingPassesRunInOrder) {
+  g_redex = new RedexContext();
+  std::atomic<int> started{0};
+  RendezvousPass writer("CodeWriterPass", Pass::TOUCHES_CODE,
+                        Pass::TOUCHES_CODE, started, 2);
+  RendezvousPass reader("CodeReaderPass", Pass::TOUCHES_CODE,
+                        Pass::TOUCHES_NOTHING, started, 2);
+  run({&writer, &reader});
+  EXPECT_FALSE(writer.overlapped);
+  delete g_redex;
+}
+
+TEST(PassManagerTest, profileCountsMethodsTouched) {
+  g_redex = new RedexContext();
+  std::atomic<int> started{0};
+  RendezvousPass pass("ProfiledPass", Pass::TOUCHES_NOTHING,
+                      Pass::TOUCHES_NOTHING, started, 1);
+  Json::Value config(Json::objectValue);
+  config["profile_methods_touched"] = true;
+  run({&pass}, config);
+  delete g_redex;
+}
+
+TEST(PassManagerTest, storeLocalPassFollowsDependencies) {
+  g_redex = new RedexContext();
+  DexStoresVector stores;
+  add_store(stores, "classes", {});
+  add_store(stores, "a", {});
+  add_store(stores, "b", {});
+  add_store(stores, "c", {"a"});
+  add_store(stores, "d", {"c", "b"});
+  StoreLocalPass pass;
+  run_on_stores(&pass, stores);
+
+  const auto& order = pass.order;
+  ASSERT_EQ(5, order.size());
+  EXPECT_EQ(0, order[0]);
+  EXPECT_LT(position(order, 1), position(order, 3));
+  EXPECT_LT(position(order, 3), position(order, 4));
+  EXPECT_LT(position(order, 2), position(order, 4));
+  // a and b are independent.
+  EXPECT_EQ(2, pass.max_running());
+  delete g_redex;
+}
+
+TEST(PassManagerTest, storeLocalPassRunsSeriallyOnCycles) {
+  g_redex = new RedexContext();
+  DexStoresVector stores;
+  add_store(stores, "classes", {});
+  add_store(stores, "a", {"b"});
+  add_store(stores, "b", {"a"});
+  add_store(stores, "c", {});
+  StoreLocalPass pass;
+  run_on_stores(&pass, stores);
+  EXPECT_EQ(std::vector<size_t>({0, 1, 2, 3}), pass.order);
+  EXPECT_EQ(1, pass.max_running());
+  delete g_redex;
+}
+
+TEST(PassManagerTest, storeParallelPassesCanBeDisabled) {
+  g_redex = new RedexContext();
+  DexStoresVector stores;
+  add_store(stores, "classes", {});
+  add_store(stores, "a", {});
+  add_store(stores, "b", {});
+  StoreLocalPass pass;
+  Json::Value config(Json::objectValue);
+  config["store_parallel_passes"] = false;
+  run_on_stores(&pass, stores, config);
+  EXPECT_EQ(std::vector<size_t>({0, 1, 2}), pass.order);
+  EXPECT_EQ(1, pass.max_running());
+  delete g_redex;
+}
+
+TEST(PassManagerTest, scratchArenaIsReleased) {
+  g_redex = new RedexContext();
+  std::atomic<int> started{0};
+  ScratchPass scratch;
+  RendezvousPass other("OtherPass", Pass::TOUCHES_NOTHING,
+                       Pass::TOUCHES_NOTHING, started, 1);
+  DexStoresVector stores;
+  add_store(stores, "classes", {});
+  PassManager manager({&scratch, &other});
+  manager.set_testing_mode();
+  Scope external_classes;
+  Json::Value conf_obj = Json::nullValue;
+  ConfigFiles dummy_config(conf_obj);
+  manager.run_passes(stores, external_classes, dummy_config);
+  const auto& infos = manager.get_pass_info();
+  EXPECT_GE(infos.at(0).profile.scratch_kb,
+            int64_t(100000 * sizeof(size_t) / 1024));
+  EXPECT_EQ(0, infos.at(1).profile.scratch_kb);
+  delete g_redex;
+}
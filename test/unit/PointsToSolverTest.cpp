@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "PointsToSemantics.h"
+#include "PointsToSolver.h"
+#include "ScopeHelper.h"
+
+struct PointsToSolverTest : testing::Test {
+  PointsToSolverTest() { g_redex = new RedexContext(); }
+
+  ~PointsToSolverTest() { delete g_redex; }
+
+  DexMethod* add_method(DexClass* cls,
+                        const std::string& signature,
+                        DexAccessFlags access,
+                        const std::string& code) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        cls->get_type()->get_name()->str() + "." + signature));
+    method->make_concrete(access, !(access & ACC_STATIC));
+    method->set_code(assembler::ircode_from_string(code));
+    cls->add_method(method);
+    return method;
+  }
+
+  // The index of the first action of the given kind in the method.
+  size_t find_action(PointsToSemantics& semantics,
+                     DexMethod* method,
+                     PointsToOperationKind kind) {
+    const auto& actions =
+        (*semantics.get_method_semantics(method))->get_points_to_actions();
+    for (size_t i = 0; i < actions.size(); ++i) {
+      if (actions[i].operation().kind == kind) {
+        return i;
+      }
+    }
+    ADD_FAILURE() << "No such action in " << SHOW(method);
+    return 0;
+  }
+
+  PointsToVariable returned_variable(PointsToSemantics& semantics,
+                                     DexMethod* method) {
+    auto semantics_opt = semantics.get_method_semantics(method);
+    auto i = find_action(semantics, method, PTS_RETURN);
+    return (*semantics_opt)->get_points_to_actions()[i].src();
+  }
+};
+
+TEST_F(PointsToSolverTest, virtualCallsAndEscapes) {
+  Scope scope = create_empty_scope();
+  auto obj_t = get_object_type();
+  auto a_t = DexType::make_type("LA;");
+  auto b_t = DexType::make_type("LB;");
+  auto main_t = DexType::make_type("LMain;");
+  auto a_cls = create_internal_class(a_t, obj_t, {});
+  auto b_cls = create_internal_class(b_t, a_t, {});
+  auto main_cls = create_internal_class(main_t, obj_t, {});
+  scope.push_back(a_cls);
+  scope.push_back(b_cls);
+  scope.push_back(main_cls);
+
+  // A#id returns its argument, B#id returns a new object.
+  auto a_id = add_method(a_cls,
+                         "id:(Ljava/lang/Object;)Ljava/lang/Object;",
+                         ACC_PUBLIC,
+                         R"(
+    (
+     (load-param-object v0)
+     (load-param-object v1)
+     (return-object v1)
+    )
+  )");
+  auto b_id = add_method(b_cls,
+                         "id:(Ljava/lang/Object;)Ljava/lang/Object;",
+                         ACC_PUBLIC,
+                         R"(
+    (
+     (load-param-object v0)
+     (load-param-object v1)
+     (new-instance "LBox;")
+     (move-result-pseudo-object v0)
+     (return-object v0)
+    )
+  )");
+  // Only an A reaches the call, so it can only go to A#id.
+  auto run = add_method(main_cls,
+                        "run:()Ljava/lang/Object;",
+                        ACC_PUBLIC | ACC_STATIC,
+                        R"(
+    (
+     (new-instance "LA;")
+     (move-result-pseudo-object v0)
+     (new-instance "LBox;")
+     (move-result-pseudo-object v1)
+     (invoke-virtual (v0 v1) "LA;.id:(Ljava/lang/Object;)Ljava/lang/Object;")
+     (move-result-object v2)
+     (return-object v2)
+    )
+  )");
+  // The first object is stored into a static field, the second one is handed
+  // to a method that we know nothing about, and the third one stays here.
+  auto leak = add_method(main_cls,
+                         "leak:()V",
+                         ACC_PUBLIC | ACC_STATIC,
+                         R"(
+    (
+     (new-instance "LBox;")
+     (move-result-pseudo-object v0)
+     (sput-object v0 "LMain;.sfield:Ljava/lang/Object;")
+     (new-instance "LBox;")
+     (move-result-pseudo-object v1)
+     (invoke-static (v1) "LExternal;.take:(Ljava/lang/Object;)V")
+     (new-instance "LBox;")
+     (move-result-pseudo-object v2)
+     (new-instance "LA;")
+     (move-result-pseudo-object v3)
+     (iput-object v2 v3 "LA;.f:Ljava/lang/Object;")
+     (return-void)
+    )
+  )");
+
+  PointsToSemantics semantics(scope);
+  PointsToSolver solver(semantics, [](DexMethodRef*) { return false; });
+
+  // The call.
+  auto call = find_action(semantics, run, PTS_INVOKE_VIRTUAL);
+  auto callees = solver.get_callees(run, call);
+  EXPECT_TRUE(callees.is_complete);
+  EXPECT_EQ(std::unordered_set<DexMethodRef*>{a_id}, callees.methods);
+  EXPECT_TRUE(solver.returned_by(b_id).empty() == false);
+
+  // What run() returns is the Box it made, through A#id.
+  const auto& returned = solver.points_to(run, returned_variable(semantics, run));
+  ASSERT_EQ(1, returned.size());
+  const auto& site = solver.get_allocation_site(*returned.begin());
+  EXPECT_EQ(PTS_SITE_NEW_OBJECT, site.kind);
+  EXPECT_EQ(DexType::make_type("LBox;"), site.type);
+  EXPECT_EQ(run, site.method);
+  EXPECT_EQ(returned, solver.returned_by(a_id));
+  EXPECT_FALSE(solver.may_escape(*returned.begin()));
+
+  // The objects of leak().
+  std::vector<AllocationSiteId> boxes;
+  const auto& actions =
+      (*semantics.get_method_semantics(leak))->get_points_to_actions();
+  for (size_t i = 0; i < actions.size(); ++i) {
+    auto site_opt = solver.get_allocation_site(leak, i);
+    if (site_opt &&
+        solver.get_allocation_site(*site_opt).type ==
+            DexType::make_type("LBox;")) {
+      boxes.push_back(*site_opt);
+    }
+  }
+  ASSERT_EQ(3, boxes.size());
+  EXPECT_TRUE(solver.may_escape(boxes[0]));
+  EXPECT_TRUE(solver.may_escape(boxes[1]));
+  EXPECT_FALSE(solver.may_escape(boxes[2]));
+}
+
+TEST_F(PointsToSolverTest, cyclesAndEntryPoints) {
+  Scope scope = create_empty_scope();
+  auto obj_t = get_object_type();
+  auto node_t = DexType::make_type("LNode;");
+  auto node_cls = create_internal_class(node_t, obj_t, {});
+  scope.push_back(node_cls);
+
+  // The objects go around a cycle of variables and back out.
+  auto loop = add_method(node_cls,
+                         "loop:(LNode;)LNode;",
+                         ACC_PUBLIC | ACC_STATIC,
+                         R"(
+    (
+     (load-param-object v0)
+     (new-instance "LNode;")
+     (move-result-pseudo-object v1)
+     :loop
+     (iput-object v1 v0 "LNode;.next:LNode;")
+     (iget-object v0 "LNode;.next:LNode;")
+     (move-result-pseudo-object v0)
+     (if-nez v0 :loop)
+     (return-object v0)
+    )
+  )");
+
+  PointsToSemantics semantics(scope);
+  PointsToSolver solver(semantics,
+                        [&](DexMethodRef* method) { return method == loop; });
+
+  // The parameter comes from the outside world, and the new object gets out
+  // through it.
+  const auto& returned =
+      solver.points_to(loop, returned_variable(semantics, loop));
+  EXPECT_EQ(2, returned.size());
+  auto site = solver.get_allocation_site(
+      loop, find_action(semantics, loop, PTS_NEW_OBJECT));
+  ASSERT_TRUE(site);
+  EXPECT_TRUE(returned.contains(*site));
+  EXPECT_TRUE(solver.may_escape(*site));
+  EXPECT_EQ(returned, solver.returned_by(loop));
+}
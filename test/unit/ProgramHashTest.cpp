@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "ProgramHash.h"
+#include "ScopeHelper.h"
+
+struct ProgramHashTest : testing::Test {
+  ProgramHashTest() { g_redex = new RedexContext(); }
+
+  ~ProgramHashTest() { delete g_redex; }
+
+  static DexClass* make_class(const char* name) {
+    return type_class(create_class_with_branching_method(name)->get_class());
+  }
+
+  static DexStoresVector make_stores(const DexClasses& classes) {
+    DexStoresVector stores;
+    stores.emplace_back(DexStore("classes"));
+    stores[0].add_classes(classes);
+    return stores;
+  }
+};
+
+TEST_F(ProgramHashTest, sameProgramSameHash) {
+  auto foo = make_class("LFoo;");
+  auto stores = make_stores({foo});
+  auto before = program_hash::hash(stores);
+  EXPECT_EQ(before, program_hash::hash(stores));
+
+  auto code = foo->get_dmethods()[0]->get_code();
+  code->push_back(new IRInstruction(OPCODE_NOP));
+  auto after = program_hash::hash(stores);
+  EXPECT_EQ(after.class_order, before.class_order);
+  EXPECT_EQ(after.classes, before.classes);
+  EXPECT_NE(after.code, before.code);
+}
+
+TEST_F(ProgramHashTest, classOrderIsHashedApart) {
+  auto foo = make_class("LFoo;");
+  auto baz = make_class("LBaz;");
+  auto hash = program_hash::hash(make_stores({foo, baz}));
+  auto swapped = program_hash::hash(make_stores({baz, foo}));
+  EXPECT_NE(hash.class_order, swapped.class_order);
+  EXPECT_EQ(hash.classes, swapped.classes);
+  EXPECT_EQ(hash.code, swapped.code);
+}
+
+TEST_F(ProgramHashTest, branchTargetsAreHashedByPosition) {
+  // The same code, built twice, lives at different addresses.
+  const char* s_expr = R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :zero)
+     (const v1 1)
+     (return v1)
+     :zero
+     (return v0)
+    )
+  )";
+  auto code = assembler::ircode_from_string(s_expr);
+  EXPECT_EQ(program_hash::hash_code(*code),
+            program_hash::hash_code(*assembler::ircode_from_string(s_expr)));
+  code->set_registers_size(code->get_registers_size() + 1);
+  EXPECT_NE(program_hash::hash_code(*code),
+            program_hash::hash_code(*assembler::ircode_from_string(s_expr)));
+}
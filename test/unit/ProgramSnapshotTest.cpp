@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+#include <json/json.h>
+
+#include "ConfigFiles.h"
+#include "Creators.h"
+#include "DexStore.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "InstructionLowering.h"
+#include "ProgramSnapshot.h"
+
+namespace fs = boost::filesystem;
+
+struct ProgramSnapshotTest : testing::Test {
+  ProgramSnapshotTest()
+      : m_dir((fs::temp_directory_path() /
+               fs::unique_path("redex-snapshot-%%%%-%%%%"))
+                  .string()) {
+    g_redex = new RedexContext();
+  }
+
+  ~ProgramSnapshotTest() {
+    delete g_redex;
+    fs::remove_all(m_dir);
+  }
+
+  // Reading a snapshot back defines its classes, so it needs a context
+  // where they don't exist yet, like a new run would.
+  void reset_context() {
+    delete g_redex;
+    g_redex = new RedexContext();
+  }
+
+  DexClass* make_class(const char* name) {
+    ClassCreator creator(DexType::make_type(name));
+    creator.set_super(get_object_type());
+    return creator.create();
+  }
+
+  DexMethod* add_method(DexClass* cls, const std::string& descriptor) {
+    auto method =
+        static_cast<DexMethod*>(DexMethod::make_method(descriptor));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    cls->add_method(method);
+    return method;
+  }
+
+  void write(DexStoresVector& stores, const Json::Value& state) {
+    Json::Value json_cfg;
+    ConfigFiles cfg(json_cfg);
+    program_snapshot::write(m_dir, stores, cfg, state);
+  }
+
+  std::string m_dir;
+};
+
+TEST_F(ProgramSnapshotTest, codeAndStateRoundTrip) {
+  auto cls = make_class("LFoo;");
+  auto field = static_cast<DexField*>(DexField::make_field("LFoo;.count:I"));
+  field->make_concrete(ACC_PUBLIC | ACC_STATIC,
+                       DexEncodedValue::zero_for_type(get_int_type()));
+  cls->add_field(field);
+  // More registers than lowering can encode before register allocation.
+  auto method = add_method(cls, "LFoo;.bar:(I)I");
+  method->set_code(assembler::ircode_from_string(R"(
+    (
+     (load-param v20)
+     (.pos "LFoo;.bar:(I)I" "Foo.java" 12)
+     (const-string "hello")
+     (move-result-pseudo-object v17)
+     (sget "LFoo;.count:I")
+     (move-result-pseudo v18)
+     (if-eqz v20 :skip)
+     (const-wide v18 4294967297)
+     (invoke-static (v20) "LFoo;.bar:(I)I")
+     (move-result v20)
+     :skip
+     (return v20)
+    )
+  )"));
+  method->get_code()->set_registers_size(21);
+  auto deferred = add_method(cls, "LFoo;.qux:(I)I");
+  deferred->set_code(assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (add-int/lit8 v0 v0 1)
+     (return v0)
+    )
+  )"));
+  deferred->get_code()->set_registers_size(1);
+  auto deferred_code = assembler::to_string(deferred->get_code());
+  ASSERT_TRUE(instruction_lowering::unballoon(deferred, true));
+
+  cls->rstate.ref_by_string(false);
+  field->rstate.set_keep();
+  field->rstate.increment_keep_count();
+  method->rstate.set_keep();
+  method->rstate.set_allowobfuscation();
+  method->set_deobfuscated_name("LFoo;.original:(I)I");
+  auto cls_state = cls->rstate.str();
+  auto field_state = field->rstate.str();
+  auto method_state = method->rstate.str();
+  auto code = assembler::to_string(method->get_code());
+
+  DexStoresVector stores;
+  stores.emplace_back(DexStore("classes"));
+  stores[0].add_classes({cls});
+  Json::Value state;
+  state["resume_at"] = 3;
+  write(stores, state);
+  // The stores are left as they were.
+  EXPECT_EQ(code, assembler::to_string(method->get_code()));
+  EXPECT_TRUE(deferred->is_balloon_deferred());
+
+  reset_context();
+  DexStoresVector restored;
+  auto restored_state =
+      program_snapshot::read(m_dir, &restored, /* lazy_balloon */ true);
+  EXPECT_EQ(3, restored_state["resume_at"].asInt());
+  ASSERT_EQ(1, restored.size());
+  EXPECT_EQ("classes", restored[0].get_name());
+  ASSERT_EQ(1, restored[0].get_dexen().size());
+  ASSERT_EQ(1, restored[0].get_dexen()[0].size());
+
+  cls = restored[0].get_dexen()[0][0];
+  EXPECT_EQ(cls_state, cls->rstate.str());
+  field = static_cast<DexField*>(DexField::get_field("LFoo;.count:I"));
+  ASSERT_NE(nullptr, field);
+  EXPECT_EQ(field_state, field->rstate.str());
+  method = static_cast<DexMethod*>(DexMethod::get_method("LFoo;.bar:(I)I"));
+  ASSERT_NE(nullptr, method);
+  EXPECT_EQ(method_state, method->rstate.str());
+  EXPECT_EQ("LFoo;.original:(I)I", method->get_deobfuscated_name());
+  EXPECT_FALSE(method->is_balloon_deferred());
+  EXPECT_EQ(code, assembler::to_string(method->get_code()));
+
+  // The code that was still DexCode came back through the dex.
+  deferred = static_cast<DexMethod*>(DexMethod::get_method("LFoo;.qux:(I)I"));
+  ASSERT_NE(nullptr, deferred);
+  EXPECT_TRUE(deferred->is_balloon_deferred());
+  EXPECT_EQ(deferred_code, assembler::to_string(deferred->get_code()));
+}
+
+TEST_F(ProgramSnapshotTest, entriesPointingToEachOther) {
+  auto cls = make_class("LFoo;");
+  auto code = std::make_unique<IRCode>();
+  auto method = add_method(cls, "LFoo;.bar:()V");
+  auto file = DexString::make_string("Foo.java");
+  auto callsite = DexPosition::make(method, file, 10);
+  auto inlined = DexPosition::make(method, file, 20, callsite);
+  auto catch_start =
+      new MethodItemEntry(DexType::make_type("Ljava/lang/Exception;"));
+  code->push_back(callsite);
+  code->push_back(TRY_START, catch_start);
+  code->push_back(inlined);
+  code->push_back(new IRInstruction(OPCODE_RETURN_VOID));
+  code->push_back(TRY_END, catch_start);
+  code->push_back(*catch_start);
+  code->push_back(new IRInstruction(OPCODE_RETURN_VOID));
+  method->set_code(std::move(code));
+
+  DexStoresVector stores;
+  stores.emplace_back(DexStore("classes"));
+  stores[0].add_classes({cls});
+  write(stores, Json::Value());
+
+  reset_context();
+  DexStoresVector restored;
+  program_snapshot::read(m_dir, &restored, /* lazy_balloon */ false);
+  method = static_cast<DexMethod*>(DexMethod::get_method("LFoo;.bar:()V"));
+  ASSERT_NE(nullptr, method);
+  std::vector<MethodItemEntry*> entries;
+  for (auto& mie : *method->get_code()) {
+    entries.push_back(&mie);
+  }
+  ASSERT_EQ(7, entries.size());
+  EXPECT_EQ(MFLOW_POSITION, entries[0]->type);
+  EXPECT_EQ(10, entries[0]->pos->line);
+  EXPECT_EQ(method, entries[0]->pos->method);
+  EXPECT_EQ(nullptr, entries[0]->pos->parent);
+  ASSERT_EQ(MFLOW_TRY, entries[1]->type);
+  EXPECT_EQ(TRY_START, entries[1]->tentry->type);
+  EXPECT_EQ(entries[5], entries[1]->tentry->catch_start);
+  ASSERT_EQ(MFLOW_POSITION, entries[2]->type);
+  EXPECT_EQ(20, entries[2]->pos->line);
+  EXPECT_EQ(entries[0]->pos, entries[2]->pos->parent);
+  EXPECT_EQ(MFLOW_OPCODE, entries[3]->type);
+  ASSERT_EQ(MFLOW_TRY, entries[4]->type);
+  EXPECT_EQ(TRY_END, entries[4]->tentry->type);
+  EXPECT_EQ(entries[5], entries[4]->tentry->catch_start);
+  ASSERT_EQ(MFLOW_CATCH, entries[5]->type);
+  EXPECT_EQ(DexType::get_type("Ljava/lang/Exception;"),
+            entries[5]->centry->catch_type);
+  EXPECT_EQ(nullptr, entries[5]->centry->next);
+  EXPECT_EQ(MFLOW_OPCODE, entries[6]->type);
+}
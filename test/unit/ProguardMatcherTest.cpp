@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Creators.h"
+#include "DexClass.h"
+#include "ProguardMap.h"
+#include "ProguardMatcher.h"
+#include "ProguardParser.h"
+#include "RedexContext.h"
+#include "ScopeHelper.h"
+#include "ThreadPool.h"
+
+using namespace redex;
+
+namespace {
+
+const char* kRules = R"(
+-keep class com.foo.Base { *; }
+-keep,allowobfuscation class com.foo.** { int f*; }
+-keepclasseswithmembers class * { native <methods>; }
+-keepnames class *
+-keep,allowshrinking class * extends com.foo.Base { void run(); }
+-keepclassmembers class * { void run(); }
+-whyareyoukeeping class com.foo.A1*
+-assumenosideeffects class * { void log(); }
+)";
+
+/*
+ * Builds a few hundred classes under com.foo and com.bar, runs kRules over
+ * them on a pool of the given size, and returns the states of all classes and
+ * members in order.
+ */
+std::vector<std::string> run_rules(size_t num_threads) {
+  g_redex = new RedexContext();
+  ThreadPool pool(num_threads);
+  auto previous_pool = ThreadPool::set_current(&pool);
+
+  Scope scope = create_empty_scope();
+  auto base_type = DexType::make_type("Lcom/foo/Base;");
+  scope.push_back(create_internal_class(base_type, get_object_type(), {}));
+  auto void_void = DexProto::make_proto(get_void_type(),
+                                        DexTypeList::make_type_list({}));
+  for (size_t i = 0; i < 600; ++i) {
+    auto pkg = i % 3 == 0 ? "bar" : "foo";
+    auto name = "Lcom/" + std::string(pkg) + "/A" + std::to_string(i) + ";";
+    auto super = i % 2 == 0 ? base_type : get_object_type();
+    ClassCreator creator(DexType::make_type(name.c_str()));
+    creator.set_super(super);
+    auto field = static_cast<DexField*>(DexField::make_field(
+        creator.get_type(),
+        DexString::make_string(i % 4 == 0 ? "flag" : "count"),
+        get_int_type()));
+    field->make_concrete(ACC_PUBLIC);
+    creator.add_field(field);
+    for (auto method_name : {"run", "log", "get"}) {
+      auto method = static_cast<DexMethod*>(DexMethod::make_method(
+          creator.get_type(), DexString::make_string(method_name), void_void));
+      auto access = ACC_PUBLIC;
+      if (i % 5 == 0 && method_name == std::string("get")) {
+        access = access | ACC_NATIVE;
+      }
+      method->make_concrete(access, true);
+      creator.add_method(method);
+    }
+    scope.push_back(creator.create());
+  }
+
+  std::istringstream empty_map("");
+  ProguardMap pg_map(empty_map);
+  apply_deobfuscated_names({scope}, pg_map);
+  ProguardConfiguration pg_config;
+  std::istringstream rules(kRules);
+  proguard_parser::parse(rules, &pg_config);
+  EXPECT_TRUE(pg_config.ok);
+  process_proguard_rules(pg_map, scope, {}, &pg_config);
+
+  std::vector<std::string> states;
+  for (auto cls : scope) {
+    states.push_back(show(cls) + " " + cls->rstate.str());
+    for (auto field : cls->get_ifields()) {
+      states.push_back(show(field) + " " + field->rstate.str());
+    }
+    for (auto method : cls->get_vmethods()) {
+      states.push_back(show(method) + " " + method->rstate.str());
+    }
+  }
+  for (const auto& rule : pg_config.keep_rules) {
+    states.push_back(std::to_string(rule.count));
+  }
+
+  ThreadPool::set_current(previous_pool);
+  delete g_redex;
+  return states;
+}
+
+} // namespace
+
+TEST(ProguardMatcherTest, parallelMatchesSerial) {
+  auto serial = run_rules(1);
+  auto parallel = run_rules(4);
+  ASSERT_EQ(serial.size(), parallel.size());
+  for (size_t i = 0; i < serial.size(); ++i) {
+    EXPECT_EQ(serial[i], parallel[i]);
+  }
+}
+
+TEST(ProguardMatcherTest, literalPrefixSelectsClasses) {
+  g_redex = new RedexContext();
+  Scope scope = create_empty_scope();
+  for (auto name : {"Lcom/foo/A;", "Lcom/foo/AB;", "Lcom/foo/bar/A;",
+                    "Lcom/foobar/A;", "Lcom/fo/A;"}) {
+    scope.push_back(create_internal_class(
+        DexType::make_type(name), get_object_type(), {}));
+  }
+  std::istringstream empty_map("");
+  ProguardMap pg_map(empty_map);
+  apply_deobfuscated_names({scope}, pg_map);
+  ProguardConfiguration pg_config;
+  std::istringstream rules("-keep class com.foo.A* -keep class com.foo.*.A");
+  proguard_parser::parse(rules, &pg_config);
+  process_proguard_rules(pg_map, scope, {}, &pg_config);
+
+  auto kept = [](const char* name) {
+    return type_class(DexType::get_type(name))->rstate.keep();
+  };
+  EXPECT_TRUE(kept("Lcom/foo/A;"));
+  EXPECT_TRUE(kept("Lcom/foo/AB;"));
+  EXPECT_TRUE(kept("Lcom/foo/bar/A;"));
+  EXPECT_FALSE(kept("Lcom/foobar/A;"));
+  EXPECT_FALSE(kept("Lcom/fo/A;"));
+  delete g_redex;
+}
+
+TEST(ProguardMatcherTest, duplicateRulesRemoved) {
+  g_redex = new RedexContext();
+  Scope scope = create_empty_scope();
+  std::istringstream empty_map("");
+  ProguardMap pg_map(empty_map);
+  ProguardConfiguration pg_config;
+  std::istringstream rules(R"(
+-keep class com.foo.A { int f; }
+-keep class com.foo.B
+-keep class com.foo.A { int f; }
+-keep,allowobfuscation class com.foo.A { int f; }
+-keep class com.foo.A { int g; }
+-keep class com.foo.B
+)");
+  proguard_parser::parse(rules, &pg_config);
+  process_proguard_rules(pg_map, scope, {}, &pg_config);
+
+  EXPECT_EQ(2, pg_config.duplicate_keep_rules);
+  ASSERT_EQ(4, pg_config.keep_rules.size());
+  EXPECT_EQ("com.foo.A", pg_config.keep_rules[0].class_spec.className);
+  EXPECT_EQ("com.foo.B", pg_config.keep_rules[1].class_spec.className);
+  EXPECT_TRUE(pg_config.keep_rules[2].allowobfuscation);
+  EXPECT_EQ("g",
+            pg_config.keep_rules[3].class_spec.fieldSpecifications[0].name);
+  delete g_redex;
+}
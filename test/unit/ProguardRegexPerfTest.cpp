@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ProguardRegex.h"
+
+#include <boost/regex.hpp>
+#include <cassert>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//==========
+// Test for performance
+//==========
+
+using namespace redex;
+
+// Method descriptors with many parameters, which is where the regexes that
+// form_type_regex() makes for ... and *** spend the most time backtracking.
+std::vector<std::string> make_descriptors() {
+  std::vector<std::string> descriptors;
+  for (int n = 1; n <= 64; n *= 2) {
+    std::string params;
+    for (int i = 0; i < n; ++i) {
+      params += i % 3 == 0 ? "I" : "Lcom/facebook/redex/Param" +
+                                       std::to_string(i) + ";";
+    }
+    descriptors.push_back("run:(" + params + ")V");
+    descriptors.push_back("run:(" + params + "[J)Ljava/lang/Object;");
+  }
+  return descriptors;
+}
+
+void compare(const char* name, const std::string& descriptor) {
+  boost::regex regex(proguard_parser::form_member_regex("run") + "\\:" +
+                     proguard_parser::form_type_regex(descriptor));
+  proguard_parser::WildcardPattern wildcard;
+  wildcard.append_member("run");
+  wildcard.append_literal(':');
+  wildcard.append_type(descriptor);
+  wildcard.finish();
+
+  auto descriptors = make_descriptors();
+  const int rounds = 100;
+
+  size_t regex_matches = 0;
+  // boost::regex throws rather than backtrack forever.
+  size_t regex_gave_up = 0;
+  auto regex_start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < rounds; ++i) {
+    for (const auto& s : descriptors) {
+      try {
+        regex_matches += boost::regex_match(s, regex);
+      } catch (const std::runtime_error&) {
+        ++regex_gave_up;
+      }
+    }
+  }
+  auto regex_end = std::chrono::high_resolution_clock::now();
+
+  size_t wildcard_matches = 0;
+  auto wildcard_start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < rounds; ++i) {
+    for (const auto& s : descriptors) {
+      wildcard_matches += wildcard.matches(s);
+    }
+  }
+  auto wildcard_end = std::chrono::high_resolution_clock::now();
+
+  assert(regex_gave_up > 0 || regex_matches == wildcard_matches);
+
+  double regex_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                        regex_end - regex_start)
+                        .count() /
+                    1000.0;
+  double wildcard_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                           wildcard_end - wildcard_start)
+                           .count() /
+                       1000.0;
+  printf("%s: regex %.1fms (gave up %zu times), wildcard %.1fms, speedup %f\n",
+         name,
+         regex_ms,
+         regex_gave_up,
+         wildcard_ms,
+         regex_ms / wildcard_ms);
+}
+
+int main() {
+  printf("Begin!\n");
+  compare("any parameters", "(...)V");
+  compare("any parameters, any return", "(...)***");
+  compare("object parameters", "(L**;...)L*;");
+  compare("int then anything", "(I...)***");
+}
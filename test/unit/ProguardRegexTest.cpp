@@ -249,3 +249,104 @@ TEST(ProguardRegexTest, types) {
     ASSERT_EQ("Lalpha/**/beta;", descriptor);
   }
 }
+
+namespace {
+
+// Matches s both ways for a member pattern and for a type pattern, and checks
+// that the WildcardPattern agrees with the regex.
+void expect_same_member_match(const std::string& pattern,
+                              const std::string& s) {
+  proguard_parser::WildcardPattern wildcard;
+  ASSERT_TRUE(wildcard.append_member(pattern)) << pattern;
+  wildcard.finish();
+  boost::regex matcher(proguard_parser::form_member_regex(pattern));
+  EXPECT_EQ(boost::regex_match(s, matcher), wildcard.matches(s))
+      << pattern << " against " << s;
+}
+
+void expect_same_type_match(const std::string& pattern, const std::string& s) {
+  auto descriptor = proguard_parser::convert_wildcard_type(pattern);
+  proguard_parser::WildcardPattern wildcard;
+  ASSERT_TRUE(wildcard.append_type(descriptor)) << descriptor;
+  wildcard.finish();
+  boost::regex matcher(proguard_parser::form_type_regex(descriptor));
+  EXPECT_EQ(boost::regex_match(s, matcher), wildcard.matches(s))
+      << descriptor << " against " << s;
+}
+
+} // namespace
+
+TEST(ProguardRegexTest, wildcardPatternMembers) {
+  std::vector<std::string> patterns = {
+      "alpha", "*", "*pha", "*pha*", "wombat?numbat", "a*b*c", "", "?", "**"};
+  std::vector<std::string> names = {"",          "alpha",     "pha",
+                                    "betapha",   "betapha42", "wombatxnumbat",
+                                    "wombatnumbat", "abc",    "aXbYc",
+                                    "ab",        "a/b/c",     "x"};
+  for (const auto& pattern : patterns) {
+    for (const auto& name : names) {
+      expect_same_member_match(pattern, name);
+    }
+  }
+}
+
+TEST(ProguardRegexTest, wildcardPatternTypes) {
+  std::vector<std::string> patterns = {
+      "int",
+      "int[]",
+      "java.lang.String",
+      "java.lang.*",
+      "java.**",
+      "java.**.List",
+      "*",
+      "**",
+      "***",
+      "%",
+      "...",
+      "com.facebook.redex.test.proguard.Delta$B",
+      "java.lang.Str?ng",
+      "java.*.*[]"};
+  std::vector<std::string> descriptors = {
+      "I",
+      "[I",
+      "[[I",
+      "V",
+      "Ljava/lang/String;",
+      "[Ljava/lang/String;",
+      "Ljava/lang/reflect/Method;",
+      "Ljava/util/List;",
+      "Ljava/util/concurrent/List;",
+      "Ljava/util/List;IZ",
+      "I[ILjava/lang/String;S",
+      "(Ljava/util/List;IZ)I",
+      "Lcom/facebook/redex/test/proguard/Delta$B;",
+      "Ljava//List;",
+      "LFoo;",
+      "",
+      "[Ljava/util/Set;"};
+  for (const auto& pattern : patterns) {
+    for (const auto& descriptor : descriptors) {
+      expect_same_type_match(pattern, descriptor);
+    }
+  }
+}
+
+TEST(ProguardRegexTest, wildcardPatternMemberAndType) {
+  // The way the matcher checks a method: name, then ':' then descriptor.
+  proguard_parser::WildcardPattern wildcard;
+  ASSERT_TRUE(wildcard.append_member("get*"));
+  wildcard.append_literal(':');
+  ASSERT_TRUE(wildcard.append_type("(L**;I)V"));
+  wildcard.finish();
+  EXPECT_TRUE(wildcard.matches("getFoo:(Ljava/lang/String;I)V"));
+  EXPECT_TRUE(wildcard.matches("get:(LFoo;I)V"));
+  EXPECT_FALSE(wildcard.matches("getFoo:(Ljava/lang/String;J)V"));
+  EXPECT_FALSE(wildcard.matches("setFoo:(Ljava/lang/String;I)V"));
+}
+
+TEST(ProguardRegexTest, wildcardPatternRejectsRegexSyntax) {
+  for (auto pattern : {"a|b", "a+", "(a)", "a{2}", "[ab]", "^a", "a$"}) {
+    proguard_parser::WildcardPattern wildcard;
+    EXPECT_FALSE(wildcard.append_member(pattern)) << pattern;
+  }
+}
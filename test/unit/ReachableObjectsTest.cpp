@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "Creators.h"
+#include "DexClass.h"
+#include "ReachableObjects.h"
+#include "RedexContext.h"
+#include "ScopeHelper.h"
+#include "ThreadPool.h"
+
+namespace {
+
+/*
+ * Builds chains of classes, each extending the previous one, with a field
+ * that is kept if its class is. Only every fourth chain ends in a kept class,
+ * so only those chains, and their fields, are reachable. Returns which
+ * classes and fields were found reachable, in order.
+ */
+std::vector<std::string> mark_chains(size_t num_threads,
+                                     bool record_reachability) {
+  g_redex = new RedexContext();
+  ThreadPool pool(num_threads);
+  auto previous_pool = ThreadPool::set_current(&pool);
+
+  Scope scope = create_empty_scope();
+  for (size_t chain = 0; chain < 40; ++chain) {
+    auto super = get_object_type();
+    for (size_t i = 0; i < 50; ++i) {
+      auto name = "LC" + std::to_string(chain) + "_" + std::to_string(i) + ";";
+      ClassCreator creator(DexType::make_type(name.c_str()));
+      creator.set_super(super);
+      auto field = static_cast<DexField*>(DexField::make_field(
+          creator.get_type(), DexString::make_string("f"), get_int_type()));
+      field->make_concrete(ACC_PUBLIC);
+      field->rstate.set_keep();
+      creator.add_field(field);
+      auto cls = creator.create();
+      if (i == 49 && chain % 4 == 0) {
+        cls->rstate.set_keep();
+      }
+      scope.push_back(cls);
+      super = cls->get_type();
+    }
+  }
+
+  DexStoresVector stores;
+  DexStore store("classes");
+  store.add_classes(scope);
+  stores.emplace_back(std::move(store));
+  auto reachables = compute_reachable_objects(
+      stores, {}, {}, {}, nullptr, record_reachability);
+
+  std::vector<std::string> marked;
+  for (auto cls : scope) {
+    if (reachables.marked(cls)) {
+      marked.push_back(show(cls));
+      if (record_reachability) {
+        auto retainers =
+            reachables.retainers_of[reachable_objects::ReachableObject(cls)];
+        EXPECT_EQ(1, retainers.size()) << show(cls);
+      }
+    }
+    for (auto field : cls->get_ifields()) {
+      if (reachables.marked(field)) {
+        marked.push_back(show(field));
+      }
+    }
+  }
+
+  ThreadPool::set_current(previous_pool);
+  delete g_redex;
+  return marked;
+}
+
+} // namespace
+
+TEST(ReachableObjectsTest, keptChainsAreReachable) {
+  auto marked = mark_chains(4, false);
+  // Ten chains of 50 classes, each with its field.
+  ASSERT_EQ(10 * 50 * 2, marked.size());
+  for (const auto& name : marked) {
+    auto chain = std::stoi(name.substr(name.find('C') + 1));
+    EXPECT_EQ(0, chain % 4) << name;
+  }
+}
+
+TEST(ReachableObjectsTest, parallelMatchesSerial) {
+  EXPECT_EQ(mark_chains(1, false), mark_chains(4, false));
+  EXPECT_EQ(mark_chains(1, false), mark_chains(4, true));
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "DexClass.h"
+#include "RedexContext.h"
+#include "WorkQueue.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+//==========
+// Test for interning scalability
+//==========
+
+constexpr int kNumNames = 200000;
+
+std::vector<std::string> make_names(int batch) {
+  std::vector<std::string> names;
+  names.reserve(kNumNames);
+  for (int i = 0; i < kNumNames; ++i) {
+    names.push_back("Lcom/facebook/batch" + std::to_string(batch) + "/Cls" +
+                    std::to_string(i) + ";");
+  }
+  return names;
+}
+
+// Interns every name through make_string and make_type, splitting the list
+// into one chunk per thread.
+double intern_all(const std::vector<std::string>& names, int num_threads) {
+  auto wq = workqueue_foreach<int>(
+      [&](int chunk) {
+        for (size_t i = chunk; i < names.size(); i += num_threads) {
+          auto str = DexString::make_string(names[i].c_str());
+          auto type = DexType::make_type(str);
+          always_assert(DexType::get_type(names[i].c_str()) == type);
+        }
+      },
+      num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    wq.add_item(i);
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  wq.run_all();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
+      .count();
+}
+
+void profileInterning() {
+  g_redex = new RedexContext();
+  int num_threads = std::max(1u, boost::thread::hardware_concurrency());
+  // Use fresh names for each run so both measure inserts, not lookups.
+  double single = intern_all(make_names(0), 1);
+  double parallel = intern_all(make_names(1), num_threads);
+  printf("interning %d strings+types, 1 thread: %.0fms, %d threads: %.0fms, "
+         "speedup: %f\n",
+         kNumNames,
+         single,
+         num_threads,
+         parallel,
+         single / std::max(parallel, 1.0));
+  delete g_redex;
+}
+
+int main() {
+  printf("Begin!\n");
+  profileInterning();
+}
@@ -18,6 +18,7 @@
 #include "IRCode.h"
 #include "IRInstruction.h"
 #include "Interference.h"
+#include "LinearScan.h"
 #include "LiveRange.h"
 #include "Liveness.h"
 #include "OpcodeList.h"
@@ -239,6 +240,37 @@ TEST_F(RegAllocTest, InterferenceWeights) {
   EXPECT_EQ(fp_div_ceil(2, 2), edge_weight_helper(2, 2));
 }
 
+// The bit matrix and the hash map fallback should agree on every edge.
+TEST_F(RegAllocTest, AdjacencyMatrix) {
+  using namespace interference::impl;
+  AdjacencyMatrix dense(100);
+  AdjacencyMatrix sparse;
+  for (auto* matrix : {&dense, &sparse}) {
+    matrix->add(3, 7, /* can_coalesce */ true);
+    matrix->add(99, 0, /* can_coalesce */ false);
+    matrix->add(64, 63, /* can_coalesce */ true);
+    matrix->add(63, 64, /* can_coalesce */ false);
+    // Beyond the size of the matrix.
+    matrix->add(5, 200, /* can_coalesce */ true);
+  }
+  for (reg_t u = 0; u < 100; ++u) {
+    for (reg_t v = 0; v < 100; ++v) {
+      EXPECT_EQ(sparse.contains(u, v), dense.contains(u, v)) << u << " " << v;
+    }
+  }
+  for (auto* matrix : {&dense, &sparse}) {
+    EXPECT_TRUE(matrix->contains(7, 3));
+    EXPECT_TRUE(matrix->is_coalesceable(7, 3));
+    EXPECT_TRUE(matrix->contains(0, 99));
+    EXPECT_FALSE(matrix->is_coalesceable(0, 99));
+    EXPECT_FALSE(matrix->is_coalesceable(63, 64));
+    EXPECT_TRUE(matrix->contains(200, 5));
+    EXPECT_TRUE(matrix->is_coalesceable(200, 5));
+    EXPECT_FALSE(matrix->contains(3, 3));
+    EXPECT_FALSE(matrix->contains(4, 7));
+  }
+}
+
 TEST_F(RegAllocTest, BuildInterferenceGraph) {
   auto code = assembler::ircode_from_string(R"(
     (
@@ -459,6 +491,70 @@ static std::vector<reg_t> stack_to_vec(std::stack<reg_t> stack) {
   return vec;
 }
 
+TEST_F(RegAllocTest, ConservativeCoalesceTests) {
+  using namespace interference::impl;
+  auto ig = GraphBuilder::create_empty();
+  // Two colors for each node.
+  for (reg_t reg = 0; reg < 5; ++reg) {
+    GraphBuilder::make_node(&ig, reg, RegisterType::NORMAL, /* max_vreg */ 1);
+  }
+  GraphBuilder::add_edge(&ig, 0, 2);
+  GraphBuilder::add_edge(&ig, 1, 3);
+  GraphBuilder::add_edge(&ig, 2, 4);
+  GraphBuilder::add_edge(&ig, 3, 4);
+  // +---+     +---+     +---+     +---+     +---+
+  // | 0 | --- | 2 | --- | 4 | --- | 3 | --- | 1 |
+  // +---+     +---+     +---+     +---+     +---+
+  //
+  // 2 and 3 are significant, and combining 0 and 1 would give the new node
+  // both of them as neighbors.
+  EXPECT_FALSE(ig.can_coalesce_conservatively(0, 1));
+
+  // Now 3 already interferes with 0, so 1 can be combined into it.
+  GraphBuilder::add_edge(&ig, 0, 3);
+  EXPECT_TRUE(ig.can_coalesce_conservatively(0, 1));
+}
+
+TEST_F(RegAllocTest, CoalesceConservatively) {
+  const char* original = R"(
+    (
+     (const v0 0)
+     (move v1 v0)
+     (return v1)
+    )
+  )";
+  auto coalesce = [&](reg_t initial_regs) {
+    auto code = assembler::ircode_from_string(original);
+    code->set_registers_size(2);
+    code->build_cfg();
+    auto& cfg = code->cfg();
+    cfg.calculate_exit_block();
+    LivenessFixpointIterator fixpoint_iter(cfg);
+    fixpoint_iter.run(LivenessDomain(code->get_registers_size()));
+
+    RangeSet range_set;
+    interference::Graph ig = interference::build_graph(
+        fixpoint_iter, code.get(), code->get_registers_size(), range_set);
+    graph_coloring::Allocator allocator;
+    allocator.coalesce_conservatively(&ig, code.get(), initial_regs);
+    EXPECT_EQ(allocator.get_stats().moves_coalesced,
+              allocator.get_stats().moves_coalesced_conservatively);
+    return assembler::to_s_expr(code.get());
+  };
+
+  // v1 was made by spilling, so the move stays.
+  auto expected_code = assembler::ircode_from_string(original);
+  EXPECT_EQ(coalesce(1), assembler::to_s_expr(expected_code.get()));
+
+  expected_code = assembler::ircode_from_string(R"(
+    (
+     (const v0 0)
+     (return v0)
+    )
+  )");
+  EXPECT_EQ(coalesce(2), assembler::to_s_expr(expected_code.get()));
+}
+
 TEST_F(RegAllocTest, Simplify) {
   using namespace interference::impl;
   auto ig = GraphBuilder::create_empty();
@@ -848,3 +944,137 @@ TEST_F(RegAllocTest, ParamFirstUse) {
   EXPECT_EQ(assembler::to_s_expr(code.get()),
             assembler::to_s_expr(expected_code.get()));
 }
+
+TEST_F(RegAllocTest, LinearScanSharesHomes) {
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param v3)
+     (add-int/lit8 v0 v3 1)
+     (add-int/lit8 v1 v0 2)
+     (add-int/lit8 v2 v1 3)
+     (return v2)
+    )
+)");
+  code->set_registers_size(4);
+  code->build_cfg();
+  EXPECT_EQ(0, linear_scan::allocate(code.get()));
+
+  // v0 is dead by the time v2 is defined, so they share a home. v0-v7 are
+  // the scratch registers, and the param goes at the end.
+  auto expected_code = assembler::ircode_from_string(R"(
+    (
+     (load-param v10)
+     (add-int/lit8 v8 v10 1)
+     (add-int/lit8 v9 v8 2)
+     (add-int/lit8 v8 v9 3)
+     (return v8)
+    )
+)");
+  EXPECT_EQ(assembler::to_s_expr(code.get()),
+            assembler::to_s_expr(expected_code.get()));
+  EXPECT_EQ(11, code->get_registers_size());
+}
+
+/*
+ * Twenty registers are live across neg-ints that read each of them, but a
+ * neg-int can only address v0-v15.
+ */
+std::unique_ptr<IRCode> make_crowded_code() {
+  std::string body;
+  for (int i = 0; i < 20; ++i) {
+    body += "(const v" + std::to_string(i) + " " + std::to_string(i) + ")\n";
+  }
+  for (int i = 0; i < 20; ++i) {
+    body += "(neg-int v20 v" + std::to_string(i) + ")\n";
+  }
+  for (int i = 0; i < 20; ++i) {
+    body += "(add-int v20 v20 v" + std::to_string(i) + ")\n";
+  }
+  body += "(return v20)\n";
+  auto code = assembler::ircode_from_string("(" + body + ")");
+  code->set_registers_size(21);
+  code->build_cfg();
+  return code;
+}
+
+TEST_F(RegAllocTest, LinearScanScratch) {
+  using namespace dex_asm;
+  auto code = make_crowded_code();
+  // v0-v7 live in v8-v15 and can be read directly; the others and v20 go
+  // through scratch registers.
+  EXPECT_EQ(12 + 20, linear_scan::allocate(code.get()));
+  EXPECT_EQ(29, code->get_registers_size());
+
+  std::vector<IRInstruction*> insns;
+  for (auto& mie : InstructionIterable(code.get())) {
+    insns.push_back(mie.insn);
+  }
+  auto rit =
+      std::find_if(insns.rbegin(), insns.rend(), [](IRInstruction* insn) {
+        return insn->opcode() == OPCODE_NEG_INT;
+      });
+  ASSERT_NE(rit, insns.rend());
+  auto it = std::prev(rit.base());
+  // v19 lives in v27 and v20 in v28.
+  EXPECT_EQ(**std::prev(it), *dasm(OPCODE_MOVE, {2_v, 27_v}));
+  EXPECT_EQ(**it, *dasm(OPCODE_NEG_INT, {0_v, 2_v}));
+  EXPECT_EQ(**std::next(it), *dasm(OPCODE_MOVE, {28_v, 0_v}));
+}
+
+TEST_F(RegAllocTest, LinearScanRange) {
+  auto make_code = [](const std::string& args) {
+    auto code = assembler::ircode_from_string(R"(
+      (
+       (const v0 0)
+       (const v1 1)
+       (const v2 2)
+       (const v3 3)
+       (const v4 4)
+       (const v5 5)
+       (invoke-static ()" + args + R"() "LFoo;.bar:(IIIIII)V")
+       (return-void)
+      )
+    )");
+    code->set_registers_size(6);
+    code->build_cfg();
+    return code;
+  };
+  auto find_invoke = [](IRCode* code) {
+    for (auto& mie : InstructionIterable(code)) {
+      if (is_invoke(mie.insn->opcode())) {
+        return mie.insn;
+      }
+    }
+    return static_cast<IRInstruction*>(nullptr);
+  };
+
+  // The homes of the operands are already consecutive.
+  auto in_order = make_code("v0 v1 v2 v3 v4 v5");
+  EXPECT_EQ(0, linear_scan::allocate(in_order.get()));
+  EXPECT_EQ(find_invoke(in_order.get())->srcs_vec(),
+            std::vector<uint16_t>({8, 9, 10, 11, 12, 13}));
+
+  // Otherwise they get copied to the range block after the homes.
+  auto reversed = make_code("v5 v4 v3 v2 v1 v0");
+  EXPECT_EQ(6, linear_scan::allocate(reversed.get()));
+  EXPECT_EQ(find_invoke(reversed.get())->srcs_vec(),
+            std::vector<uint16_t>({14, 15, 16, 17, 18, 19}));
+  EXPECT_EQ(20, reversed->get_registers_size());
+}
+
+TEST_F(RegAllocTest, FallBackToLinearScan) {
+  auto code = make_crowded_code();
+  graph_coloring::Allocator::Config config;
+  config.max_reiterations = 1;
+  graph_coloring::Allocator allocator(config);
+  allocator.allocate(code.get());
+  EXPECT_EQ(1, allocator.get_stats().linear_scan_fallbacks);
+
+  for (auto& mie : InstructionIterable(code.get())) {
+    auto insn = mie.insn;
+    if (insn->opcode() == OPCODE_NEG_INT) {
+      EXPECT_LE(insn->dest(), 15);
+      EXPECT_LE(insn->src(0), 15);
+    }
+  }
+}
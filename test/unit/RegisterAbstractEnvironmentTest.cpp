@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <cstdint>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+
+#include "HashedSetAbstractDomain.h"
+#include "PatriciaTreeMapAbstractEnvironment.h"
+#include "RegisterAbstractEnvironment.h"
+
+using Domain = HashedSetAbstractDomain<std::string>;
+using Environment = RegisterAbstractEnvironment<uint32_t, Domain>;
+using ReferenceEnvironment =
+    PatriciaTreeMapAbstractEnvironment<uint32_t, Domain>;
+
+constexpr uint32_t RESULT_REGISTER = std::numeric_limits<uint32_t>::max();
+
+class RegisterAbstractEnvironmentTest : public ::testing::Test {
+ protected:
+  RegisterAbstractEnvironmentTest()
+      : m_generator(0), m_size_dist(0, 50), m_reg_dist(0, 200) {}
+
+  // Builds the same random environment in both representations. A few of the
+  // registers are outside of the dense range.
+  std::pair<Environment, ReferenceEnvironment> generate_random_environments() {
+    Environment env;
+    ReferenceEnvironment reference;
+    size_t size = m_size_dist(m_generator);
+    for (size_t i = 0; i < size; ++i) {
+      uint32_t reg = m_reg_dist(m_generator);
+      if (reg == 0) {
+        reg = RESULT_REGISTER;
+      }
+      Domain value({std::to_string(m_reg_dist(m_generator) % 4)});
+      env.set(reg, value);
+      reference.set(reg, value);
+    }
+    return std::make_pair(env, reference);
+  }
+
+  static void expect_same(const Environment& env,
+                          const ReferenceEnvironment& reference) {
+    ASSERT_EQ(env.is_top(), reference.is_top()) << env;
+    ASSERT_EQ(env.is_bottom(), reference.is_bottom()) << env;
+    if (!env.is_value()) {
+      return;
+    }
+    EXPECT_EQ(env.size(), reference.size()) << env;
+    for (const auto& pair : reference.bindings()) {
+      EXPECT_TRUE(env.get(pair.first).equals(pair.second)) << pair.first;
+    }
+  }
+
+  std::mt19937 m_generator;
+  std::uniform_int_distribution<uint32_t> m_size_dist;
+  std::uniform_int_distribution<uint32_t> m_reg_dist;
+};
+
+TEST_F(RegisterAbstractEnvironmentTest, latticeOperations) {
+  Environment e1({{1, Domain({"a", "b"})},
+                  {2, Domain("c")},
+                  {100, Domain({"d", "e", "f"})},
+                  {RESULT_REGISTER, Domain({"a", "f"})}});
+  Environment e2({{0, Domain({"c", "f"})},
+                  {2, Domain({"c", "d"})},
+                  {100, Domain({"d", "e", "g", "h"})}});
+
+  EXPECT_EQ(4, e1.size());
+  EXPECT_EQ(3, e2.size());
+
+  EXPECT_TRUE(Environment::bottom().leq(e1));
+  EXPECT_FALSE(e1.leq(Environment::bottom()));
+  EXPECT_FALSE(Environment::top().leq(e1));
+  EXPECT_TRUE(e1.leq(Environment::top()));
+  EXPECT_FALSE(e1.leq(e2));
+  EXPECT_FALSE(e2.leq(e1));
+
+  EXPECT_TRUE(e1.equals(e1));
+  EXPECT_FALSE(e1.equals(e2));
+  EXPECT_TRUE(Environment::bottom().equals(Environment::bottom()));
+  EXPECT_TRUE(Environment::top().equals(Environment::top()));
+  EXPECT_FALSE(Environment::bottom().equals(Environment::top()));
+
+  Environment join = e1.join(e2);
+  EXPECT_TRUE(e1.leq(join));
+  EXPECT_TRUE(e2.leq(join));
+  EXPECT_EQ(2, join.size());
+  EXPECT_THAT(join.get(2).elements(),
+              ::testing::UnorderedElementsAre("c", "d"));
+  EXPECT_THAT(join.get(100).elements(),
+              ::testing::UnorderedElementsAre("d", "e", "f", "g", "h"));
+  EXPECT_TRUE(join.get(RESULT_REGISTER).is_top());
+  EXPECT_TRUE(join.equals(e1.widening(e2)));
+
+  EXPECT_TRUE(e1.join(Environment::top()).is_top());
+  EXPECT_TRUE(e1.join(Environment::bottom()).equals(e1));
+
+  Environment meet = e1.meet(e2);
+  EXPECT_TRUE(meet.leq(e1));
+  EXPECT_TRUE(meet.leq(e2));
+  EXPECT_EQ(5, meet.size());
+  EXPECT_THAT(meet.get(0).elements(),
+              ::testing::UnorderedElementsAre("c", "f"));
+  EXPECT_THAT(meet.get(2).elements(), ::testing::ElementsAre("c"));
+  EXPECT_THAT(meet.get(100).elements(),
+              ::testing::UnorderedElementsAre("d", "e"));
+  EXPECT_THAT(meet.get(RESULT_REGISTER).elements(),
+              ::testing::UnorderedElementsAre("a", "f"));
+  EXPECT_TRUE(meet.equals(e1.narrowing(e2)));
+
+  EXPECT_TRUE(e1.meet(Environment::bottom()).is_bottom());
+  EXPECT_TRUE(e1.meet(Environment::top()).equals(e1));
+
+  EXPECT_EQ("[#2]{3 -> [#1]{a}, 4294967295 -> [#1]{b}}",
+            Environment({{RESULT_REGISTER, Domain("b")}, {3, Domain("a")}})
+                .str());
+}
+
+TEST_F(RegisterAbstractEnvironmentTest, copiesAreIndependent) {
+  Environment e1({{1, Domain("a")}, {70, Domain("b")}});
+  Environment e2 = e1;
+  e2.set(1, Domain("c")).set(70, Domain::top());
+  EXPECT_THAT(e1.get(1).elements(), ::testing::ElementsAre("a"));
+  EXPECT_THAT(e1.get(70).elements(), ::testing::ElementsAre("b"));
+  EXPECT_EQ(1, e2.size());
+  EXPECT_THAT(e2.get(1).elements(), ::testing::ElementsAre("c"));
+
+  // Removing the last binding gives Top back.
+  e2.set(1, Domain::top());
+  EXPECT_TRUE(e2.is_top());
+  EXPECT_EQ(2, e1.size());
+
+  Environment join = e1;
+  join.join_with(Environment({{1, Domain("d")}}));
+  EXPECT_EQ(1, join.size());
+  EXPECT_THAT(e1.get(1).elements(), ::testing::ElementsAre("a"));
+  EXPECT_TRUE(e1.leq(join));
+
+  // Setting a binding to Bottom makes the whole environment Bottom.
+  e2 = e1;
+  e2.update(70, [](const Domain&) { return Domain::bottom(); });
+  EXPECT_TRUE(e2.is_bottom());
+  EXPECT_EQ(2, e1.size());
+}
+
+TEST_F(RegisterAbstractEnvironmentTest, sameAsPatriciaTreeEnvironment) {
+  for (size_t k = 0; k < 200; ++k) {
+    auto p1 = generate_random_environments();
+    auto p2 = generate_random_environments();
+    expect_same(p1.first, p1.second);
+
+    EXPECT_EQ(p1.first.leq(p2.first), p1.second.leq(p2.second));
+    EXPECT_EQ(p1.first.equals(p2.first), p1.second.equals(p2.second));
+    EXPECT_TRUE(p1.first.equals(p1.first.join(p1.first)));
+    expect_same(p1.first.join(p2.first), p1.second.join(p2.second));
+    expect_same(p1.first.meet(p2.first), p1.second.meet(p2.second));
+
+    auto joined = p1.first;
+    joined.join_with(p2.first);
+    EXPECT_TRUE(p1.first.leq(joined));
+    EXPECT_TRUE(p2.first.leq(joined));
+    EXPECT_EQ(joined.leq(p1.first), joined.equals(p1.first));
+  }
+}
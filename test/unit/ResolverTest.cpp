@@ -212,3 +212,35 @@ TEST(ResolveField, empty) {
 
   delete g_redex;
 }
+
+TEST(ResolveField, cachedUntilMembersChange) {
+  g_redex = new RedexContext();
+  create_scope();
+
+  auto b_cls = type_class(DexType::get_type("B"));
+  auto string_t = DexType::get_type("Ljava/lang/String;");
+  auto f2 = static_cast<DexField*>(DexField::get_field(
+      DexType::get_type("B"), DexString::get_string("f2"), string_t));
+  auto fref = make_field_ref(DexType::get_type("C"), "f2", string_t);
+  EXPECT_EQ(resolve_field_cached(fref), f2);
+  EXPECT_EQ(resolve_field_cached(fref), f2);
+  EXPECT_EQ(resolve_field_cached(fref, FieldSearch::Instance), nullptr);
+
+  // Removing and adding the field drops what was cached.
+  b_cls->remove_field(f2);
+  EXPECT_EQ(resolve_field_cached(fref), nullptr);
+  b_cls->add_field(f2);
+  EXPECT_EQ(resolve_field_cached(fref), f2);
+
+  // So does a change in the hierarchy.
+  auto d_fref =
+      make_field_ref(DexType::get_type("C"), "f", DexType::get_type("A"));
+  EXPECT_EQ(resolve_field_cached(d_fref), nullptr);
+  b_cls->set_super_class(DexType::get_type("D"));
+  EXPECT_EQ(resolve_field_cached(d_fref),
+            DexField::get_field(DexType::get_type("D"),
+                                DexString::get_string("f"),
+                                DexType::get_type("A")));
+
+  delete g_redex;
+}
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "RedexResources.h"
+#include "ResourceIndex.h"
+
+namespace fs = boost::filesystem;
+
+struct ResourceIndexTest : testing::Test {
+  ResourceIndexTest() {
+    m_data = map_file(std::getenv("test_arsc_path"), m_fd, m_length);
+    EXPECT_EQ(m_table.add(m_data, m_length), 0);
+  }
+
+  ~ResourceIndexTest() { unmap_and_close(m_fd, m_data, m_length); }
+
+  int m_fd;
+  size_t m_length;
+  void* m_data;
+  android::ResTable m_table;
+};
+
+TEST_F(ResourceIndexTest, sameAsTheTable) {
+  auto index = ResourceIndex::build(m_table);
+  android::SortedVector<uint32_t> ids;
+  m_table.getResourceIds(&ids);
+  ASSERT_EQ(index.ids().size(), ids.size());
+  ASSERT_GT(ids.size(), 0);
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    auto id = ids[i];
+    EXPECT_TRUE(index.contains(id));
+    android::ResTable::resource_name name;
+    ASSERT_TRUE(m_table.getResourceName(id, true, &name));
+    if (name.name8 != nullptr) {
+      EXPECT_EQ(index.name(id), std::string(name.name8, name.nameLen));
+    }
+
+    std::unordered_set<uint32_t> expected_nodes;
+    std::unordered_set<std::string> expected_strings;
+    walk_references_for_resource(
+        id, expected_nodes, expected_strings, &m_table);
+    std::unordered_set<uint32_t> nodes;
+    std::unordered_set<std::string> strings;
+    index.walk_references(id, nodes, strings);
+    EXPECT_EQ(nodes, expected_nodes);
+    EXPECT_EQ(strings, expected_strings);
+  }
+  EXPECT_FALSE(index.contains(0x7f7f7f7f));
+  EXPECT_EQ(index.name(0x7f7f7f7f), "");
+}
+
+TEST_F(ResourceIndexTest, namePrefixes) {
+  auto index = ResourceIndex::build(m_table);
+  auto name_to_ids = index.name_to_ids();
+  ASSERT_FALSE(name_to_ids.empty());
+  const auto& some_name = name_to_ids.begin()->first;
+  auto prefix = some_name.substr(0, 1);
+  EXPECT_EQ(index.ids_by_name_prefix({prefix}),
+            get_resources_by_name_prefix({prefix}, name_to_ids));
+}
+
+TEST_F(ResourceIndexTest, roundTrip) {
+  auto index = ResourceIndex::build(m_table);
+  auto path = (fs::temp_directory_path() /
+               fs::unique_path("redex-resource-index-%%%%-%%%%"))
+                  .string();
+  index.write(path);
+  EXPECT_TRUE(ResourceIndex::read(path) == index);
+
+  // A truncated file is rejected.
+  fs::resize_file(path, fs::file_size(path) / 2);
+  EXPECT_THROW(ResourceIndex::read(path), std::runtime_error);
+  fs::remove(path);
+}
@@ -9,6 +9,8 @@
 
 #include <array>
 #include <gtest/gtest.h>
+#include <map>
+#include <vector>
 
 #include "Debug.h"
 #include "RedexResources.h"
@@ -193,6 +195,57 @@ TEST(ResStringPool, ReplaceStringsInXmlLayout) {
   unmap_and_close(file_descriptor, fp, length);
 }
 
+TEST(ResStringPool, ReplaceStringsInXmlLayoutInPlace) {
+  size_t length;
+  int file_descriptor;
+  auto fp = map_file(std::getenv("test_layout_path"), file_descriptor, length);
+  std::vector<char> original((char*) fp, (char*) fp + length);
+  unmap_and_close(file_descriptor, fp, length);
+
+  // A name that is longer than the one it replaces can't be written in place,
+  // and nothing may be written then, even for the ones that fit.
+  std::map<std::string, std::string> lengthened_names;
+  lengthened_names.emplace("com.example.test.CustomViewGroup", "Z.a");
+  lengthened_names.emplace(
+    "com.example.test.CustomButton",
+    "com.example.test.CustomButtonWithALongerName");
+  auto data = original;
+  size_t num_renamed = 0;
+  EXPECT_FALSE(replace_in_xml_string_pool_in_place(
+    &data[0], data.size(), lengthened_names, &num_renamed));
+  EXPECT_EQ(data, original);
+
+  std::map<std::string, std::string> shortened_names;
+  shortened_names.emplace("com.example.test.CustomViewGroup", "Z.a");
+  shortened_names.emplace("com.example.test.CustomTextView", "Z.b");
+  shortened_names.emplace("com.example.test.CustomButton", "Z.c");
+  shortened_names.emplace("com.example.test.NotFound", "Z.d");
+  EXPECT_TRUE(replace_in_xml_string_pool_in_place(
+    &data[0], data.size(), shortened_names, &num_renamed));
+  EXPECT_EQ(num_renamed, 3);
+  EXPECT_EQ(data.size(), original.size());
+
+  android::ResXMLTree parser;
+  parser.setTo(&data[0], data.size());
+  EXPECT_EQ(android::NO_ERROR, parser.getError())
+    << "Error parsing layout after rename";
+
+  std::vector<std::string> expected_xml_tags{
+    "Z.a", "TextView", "Z.b", "Z.c", "Button"};
+  std::vector<std::string> xml_tags;
+  android::ResXMLParser::event_code_t type;
+  do {
+    type = parser.next();
+    if (type == android::ResXMLParser::START_TAG) {
+      size_t len;
+      android::String16 tag(parser.getElementName(&len));
+      xml_tags.push_back(android::String8(tag).string());
+    }
+  } while (type != android::ResXMLParser::BAD_DOCUMENT &&
+           type != android::ResXMLParser::END_DOCUMENT);
+  EXPECT_EQ(xml_tags, expected_xml_tags);
+}
+
 void assert_serialized_data(void* original, size_t length, android::Vector<char>& serialized) {
   ASSERT_EQ(length, serialized.size());
   for (size_t i = 0; i < length; i++) {
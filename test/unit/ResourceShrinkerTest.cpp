@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "RedexResources.h"
+#include "ResourceIndex.h"
+#include "ResourceShrinker.h"
+
+struct ResourceShrinkerTest : testing::Test {
+  ResourceShrinkerTest() {
+    m_data = map_file(std::getenv("test_arsc_path"), m_fd, m_length);
+    EXPECT_EQ(m_table.add(m_data, m_length), 0);
+    m_index = ResourceIndex::build(m_table);
+  }
+
+  ~ResourceShrinkerTest() { unmap_and_close(m_fd, m_data, m_length); }
+
+  std::unordered_set<uint32_t> all_ids() const {
+    return std::unordered_set<uint32_t>(m_index.ids().begin(),
+                                        m_index.ids().end());
+  }
+
+  int m_fd;
+  size_t m_length;
+  void* m_data;
+  android::ResTable m_table;
+  ResourceIndex m_index;
+};
+
+TEST_F(ResourceShrinkerTest, keepingEverythingKeepsTheResources) {
+  std::string shrunk;
+  resource_shrinker::Stats stats;
+  ASSERT_TRUE(
+      resource_shrinker::shrink(m_data, m_length, all_ids(), &shrunk, &stats));
+  EXPECT_EQ(stats.resources_removed, 0);
+  EXPECT_LE(shrunk.size(), m_length);
+
+  android::ResTable table;
+  ASSERT_EQ(table.add(shrunk.data(), shrunk.size()), 0);
+  EXPECT_TRUE(ResourceIndex::build(table) == m_index);
+}
+
+TEST_F(ResourceShrinkerTest, removesResourcesAndTheirStrings) {
+  // A resource with a string value that no other resource refers to.
+  uint32_t removed = 0;
+  std::unordered_set<uint32_t> referenced;
+  std::unordered_set<std::string> strings;
+  for (auto id : m_index.ids()) {
+    std::unordered_set<uint32_t> nodes;
+    m_index.walk_references(id, nodes, strings);
+    nodes.erase(id);
+    referenced.insert(nodes.begin(), nodes.end());
+  }
+  for (auto id : m_index.ids()) {
+    std::unordered_set<uint32_t> nodes;
+    std::unordered_set<std::string> values;
+    m_index.walk_references(id, nodes, values);
+    if (referenced.count(id) == 0 && nodes.size() == 1 && !values.empty()) {
+      removed = id;
+      break;
+    }
+  }
+  ASSERT_NE(removed, 0);
+  auto kept = all_ids();
+  kept.erase(removed);
+
+  std::string shrunk;
+  resource_shrinker::Stats stats;
+  ASSERT_TRUE(
+      resource_shrinker::shrink(m_data, m_length, kept, &shrunk, &stats));
+  EXPECT_EQ(stats.resources_removed, 1);
+  EXPECT_LT(shrunk.size(), m_length);
+
+  // Its strings go too, unless another resource has them.
+  std::unordered_set<uint32_t> nodes;
+  std::unordered_set<std::string> removed_values;
+  m_index.walk_references(removed, nodes, removed_values);
+  std::unordered_set<std::string> kept_values;
+  for (auto id : kept) {
+    m_index.walk_references(id, nodes, kept_values);
+  }
+  size_t orphans = 0;
+  for (const auto& value : removed_values) {
+    orphans += kept_values.count(value) == 0;
+  }
+  EXPECT_GE(stats.value_strings_removed, orphans);
+
+  android::ResTable table;
+  ASSERT_EQ(table.add(shrunk.data(), shrunk.size()), 0);
+  auto index = ResourceIndex::build(table);
+  EXPECT_FALSE(index.contains(removed));
+  ASSERT_EQ(index.ids().size(), kept.size());
+  for (auto id : kept) {
+    EXPECT_EQ(index.type_name(id), m_index.type_name(id));
+    EXPECT_EQ(index.name(id), m_index.name(id));
+    std::unordered_set<uint32_t> nodes, expected_nodes;
+    std::unordered_set<std::string> values, expected_values;
+    index.walk_references(id, nodes, values);
+    m_index.walk_references(id, expected_nodes, expected_values);
+    EXPECT_EQ(nodes, expected_nodes);
+    EXPECT_EQ(values, expected_values);
+  }
+}
+
+TEST_F(ResourceShrinkerTest, rejectsWhatIsNotATable) {
+  std::string garbage(64, 'x');
+  std::string shrunk = "untouched";
+  resource_shrinker::Stats stats;
+  EXPECT_FALSE(resource_shrinker::shrink(
+      garbage.data(), garbage.size(), all_ids(), &shrunk, &stats));
+  EXPECT_EQ(shrunk, "untouched");
+}
@@ -0,0 +1,148 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "ControlFlow.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "RedexContext.h"
+#include "SSA.h"
+
+namespace {
+
+IRInstruction* find_insn(IRCode* code, IROpcode op, size_t nth = 0) {
+  for (auto& mie : InstructionIterable(code)) {
+    if (mie.insn->opcode() == op && nth-- == 0) {
+      return mie.insn;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace
+
+TEST(SSA, dominators) {
+  //     +---+     +---+     +---+
+  //     | 0 | --> | 1 | --> | 3 |
+  //     +---+     +---+     +---+
+  //       |                   ^
+  //       |       +---+       |
+  //       +-----> | 2 | ------+
+  //               +---+
+  //               +---+
+  //               | 4 |  (unreachable)
+  //               +---+
+  ControlFlowGraph cfg;
+  auto b0 = cfg.create_block();
+  auto b1 = cfg.create_block();
+  auto b2 = cfg.create_block();
+  auto b3 = cfg.create_block();
+  auto b4 = cfg.create_block();
+  cfg.set_entry_block(b0);
+  cfg.add_edge(b0, b1, EDGE_GOTO);
+  cfg.add_edge(b0, b2, EDGE_BRANCH);
+  cfg.add_edge(b1, b3, EDGE_GOTO);
+  cfg.add_edge(b2, b3, EDGE_GOTO);
+  cfg.add_edge(b4, b3, EDGE_GOTO);
+
+  auto dom = cfg.dominators();
+  EXPECT_EQ(dom, cfg.dominators());
+  EXPECT_EQ(dom->idom(b0), nullptr);
+  EXPECT_EQ(dom->idom(b1), b0);
+  EXPECT_EQ(dom->idom(b2), b0);
+  EXPECT_EQ(dom->idom(b3), b0);
+  EXPECT_FALSE(dom->is_reachable(b4));
+  EXPECT_TRUE(dom->dominates(b0, b3));
+  EXPECT_TRUE(dom->dominates(b3, b3));
+  EXPECT_FALSE(dom->dominates(b1, b3));
+  EXPECT_EQ(dom->frontier(b1), std::vector<Block*>{b3});
+  EXPECT_EQ(dom->frontier(b2), std::vector<Block*>{b3});
+  EXPECT_TRUE(dom->frontier(b0).empty());
+  EXPECT_EQ(dom->children(b0).size(), 3);
+
+  // Adding an edge drops the cached tree.
+  cfg.add_edge(b1, b2, EDGE_GOTO);
+  auto new_dom = cfg.dominators();
+  EXPECT_NE(dom, new_dom);
+  EXPECT_EQ(new_dom->frontier(b1), (std::vector<Block*>{b2, b3}));
+}
+
+TEST(SSA, diamond) {
+  g_redex = new RedexContext();
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param v1)
+     (const v0 0)
+     (if-eqz v1 :true)
+     (const v0 1)
+     :true
+     (return v0)
+    )
+  )");
+  code->build_cfg();
+  ssa::SSAForm ssa(code->cfg());
+
+  auto ret = find_insn(code.get(), OPCODE_RETURN);
+  auto v = ssa.use(ret, 0);
+  const auto& phi_value = ssa.value(v);
+  ASSERT_NE(phi_value.phi, nullptr);
+  EXPECT_EQ(phi_value.reg, 0);
+  EXPECT_EQ(ssa.num_phis(), 1);
+
+  auto const0 = find_insn(code.get(), OPCODE_CONST, 0);
+  auto const1 = find_insn(code.get(), OPCODE_CONST, 1);
+  std::vector<ssa::ValueId> args;
+  for (const auto& arg : phi_value.phi->args) {
+    args.push_back(arg.second);
+  }
+  std::sort(args.begin(), args.end());
+  EXPECT_EQ(args, (std::vector<ssa::ValueId>{ssa.def(const0), ssa.def(const1)}));
+
+  // The phi is the only use of either constant, and the return the only use
+  // of the phi.
+  ASSERT_EQ(ssa.uses(ssa.def(const1)).size(), 1);
+  EXPECT_EQ(ssa.uses(ssa.def(const1))[0].phi, phi_value.phi);
+  ASSERT_EQ(ssa.uses(v).size(), 1);
+  EXPECT_EQ(ssa.uses(v)[0].insn, ret);
+
+  auto param = find_insn(code.get(), IOPCODE_LOAD_PARAM);
+  auto if_eqz = find_insn(code.get(), OPCODE_IF_EQZ);
+  EXPECT_EQ(ssa.use(if_eqz, 0), ssa.def(param));
+  delete g_redex;
+}
+
+TEST(SSA, loop) {
+  g_redex = new RedexContext();
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (const v0 0)
+     :loop
+     (add-int/lit8 v0 v0 1)
+     (if-nez v0 :loop)
+     (return v0)
+    )
+  )");
+  code->build_cfg();
+  ssa::SSAForm ssa(code->cfg());
+
+  auto const0 = find_insn(code.get(), OPCODE_CONST);
+  auto add = find_insn(code.get(), OPCODE_ADD_INT_LIT8);
+  auto ret = find_insn(code.get(), OPCODE_RETURN);
+  const auto& header = ssa.value(ssa.use(add, 0));
+  ASSERT_NE(header.phi, nullptr);
+  std::vector<ssa::ValueId> args;
+  for (const auto& arg : header.phi->args) {
+    args.push_back(arg.second);
+  }
+  std::sort(args.begin(), args.end());
+  EXPECT_EQ(args, (std::vector<ssa::ValueId>{ssa.def(const0), ssa.def(add)}));
+  EXPECT_EQ(ssa.use(ret, 0), ssa.def(add));
+  delete g_redex;
+}
@@ -232,3 +232,22 @@ TEST(S_ExpressionTest, patternMatching) {
   EXPECT_TRUE(y.is_nil());
   EXPECT_EQ(parse("((c d) e)"), z);
 }
+
+TEST(S_ExpressionTest, parsedNodes) {
+  s_expr e1, e2;
+  {
+    std::istringstream str_input("(a \"a\" (a b)) (b ())");
+    s_expr_istream input(str_input);
+    input >> e1 >> e2;
+    EXPECT_TRUE(input.good());
+  }
+  // The nodes outlive the parser that made them.
+  EXPECT_EQ("(a a (a b))", e1.str());
+  EXPECT_EQ("(b ())", e2.str());
+
+  // Symbols and strings with the same contents are one atom.
+  EXPECT_EQ(&e1[0].get_string(), &e1[1].get_string());
+  EXPECT_EQ(&e1[0].get_string(), &e1[2][0].get_string());
+  EXPECT_EQ(&e1[2][1].get_string(), &e2[0].get_string());
+  EXPECT_TRUE(e2[1].is_nil());
+}
@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "ScalarReplacement.h"
+#include "ScopeHelper.h"
+
+using namespace scalar_replacement;
+
+struct ScalarReplacementTest : testing::Test {
+  ScalarReplacementTest() {
+    g_redex = new RedexContext();
+    ClassCreator creator(DexType::make_type("LPair;"));
+    creator.set_super(get_object_type());
+    for (auto name : {"LPair;.first:I", "LPair;.second:I"}) {
+      auto field = static_cast<DexField*>(DexField::make_field(name));
+      field->make_concrete(ACC_PUBLIC);
+      creator.add_field(field);
+    }
+    auto ctor = create_method_from_code("LPair;.<init>:(II)V", R"(
+      (
+       (load-param-object v0)
+       (load-param v1)
+       (load-param v2)
+       (invoke-direct (v0) "Ljava/lang/Object;.<init>:()V")
+       (iput v1 v0 "LPair;.first:I")
+       (iput v2 v0 "LPair;.second:I")
+       (return-void)
+      )
+    )",
+                                        ACC_PUBLIC | ACC_CONSTRUCTOR);
+    creator.add_method(ctor);
+    creator.create();
+  }
+
+  ~ScalarReplacementTest() { delete g_redex; }
+};
+
+TEST_F(ScalarReplacementTest, localObject) {
+  auto method = create_method_from_code("LFoo;.bar:(II)I", R"(
+    (
+     (load-param v1)
+     (load-param v2)
+     (new-instance "LPair;")
+     (move-result-pseudo-object v0)
+     (invoke-direct (v0 v1 v2) "LPair;.<init>:(II)V")
+     (move-object v3 v0)
+     (const v4 3)
+     (iput v4 v3 "LPair;.second:I")
+     (iget v0 "LPair;.second:I")
+     (move-result-pseudo v4)
+     (return v4)
+    )
+  )");
+  method->get_code()->set_registers_size(5);
+  auto stats = ScalarReplacement().run(method);
+  EXPECT_EQ(stats.allocations_removed, 1);
+  EXPECT_EQ(stats.field_accesses_replaced, 2);
+  // The fields get the new registers v5 and v6.
+  expect_code_eq(method->get_code(), R"(
+    (
+     (load-param v1)
+     (load-param v2)
+     (const v5 0)
+     (const v6 0)
+     (move v5 v1)
+     (move v6 v2)
+     (const v4 3)
+     (move v6 v4)
+     (move v4 v6)
+     (return v4)
+    )
+  )");
+}
+
+TEST_F(ScalarReplacementTest, escapingObjects) {
+  // Returned.
+  const char* returned = R"(
+    (
+     (load-param v1)
+     (load-param v2)
+     (new-instance "LPair;")
+     (move-result-pseudo-object v0)
+     (invoke-direct (v0 v1 v2) "LPair;.<init>:(II)V")
+     (return-object v0)
+    )
+  )";
+  auto method = create_method_from_code("LFoo;.bar:(II)I", returned);
+  method->get_code()->set_registers_size(3);
+  EXPECT_EQ(ScalarReplacement().run(method).allocations_removed, 0);
+  expect_code_eq(method->get_code(), returned);
+
+  // Passed to another method.
+  const char* passed = R"(
+    (
+     (load-param v1)
+     (load-param v2)
+     (new-instance "LPair;")
+     (move-result-pseudo-object v0)
+     (invoke-direct (v0 v1 v2) "LPair;.<init>:(II)V")
+     (invoke-static (v0) "LBaz;.use:(LPair;)V")
+     (return v1)
+    )
+  )";
+  method = create_method_from_code("LFoo;.bar:(II)I", passed);
+  method->get_code()->set_registers_size(3);
+  EXPECT_EQ(ScalarReplacement().run(method).allocations_removed, 0);
+  expect_code_eq(method->get_code(), passed);
+
+  // Meets another object at a phi.
+  const char* merged = R"(
+    (
+     (load-param v1)
+     (load-param v2)
+     (new-instance "LPair;")
+     (move-result-pseudo-object v0)
+     (invoke-direct (v0 v1 v2) "LPair;.<init>:(II)V")
+     (if-eqz v1 :end)
+     (new-instance "LPair;")
+     (move-result-pseudo-object v0)
+     (invoke-direct (v0 v2 v1) "LPair;.<init>:(II)V")
+     :end
+     (iget v0 "LPair;.first:I")
+     (move-result-pseudo v1)
+     (return v1)
+    )
+  )";
+  method = create_method_from_code("LFoo;.bar:(II)I", merged);
+  method->get_code()->set_registers_size(3);
+  EXPECT_EQ(ScalarReplacement().run(method).allocations_removed, 0);
+  expect_code_eq(method->get_code(), merged);
+}
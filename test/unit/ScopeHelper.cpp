@@ -9,7 +9,10 @@
 
 #include "ScopeHelper.h"
 
+#include <gtest/gtest.h>
+
 #include "Creators.h"
+#include "IRAssembler.h"
 
 
 namespace {
@@ -245,6 +248,41 @@ DexMethod* create_abstract_method(
   return method;
 }
 
+DexMethod* create_method_from_code(
+    const std::string& descriptor,
+    const std::string& code,
+    DexAccessFlags access,
+    bool is_virtual) {
+  auto method = static_cast<DexMethod*>(DexMethod::make_method(descriptor));
+  method->make_concrete(access, is_virtual);
+  method->set_code(assembler::ircode_from_string(code));
+  return method;
+}
+
+void expect_code_eq(const IRCode* code, const std::string& expected) {
+  auto expected_code = assembler::ircode_from_string(expected);
+  EXPECT_EQ(assembler::to_s_expr(code),
+            assembler::to_s_expr(expected_code.get()));
+}
+
+DexMethod* create_class_with_branching_method(const char* name) {
+  ClassCreator creator(DexType::make_type(name));
+  creator.set_super(get_object_type());
+  auto method = create_method_from_code(std::string(name) + ".bar:(I)I", R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :zero)
+     (const v1 1)
+     (return v1)
+     :zero
+     (return v0)
+    )
+  )");
+  creator.add_method(method);
+  creator.create();
+  return method;
+}
+
 DexMethod* create_empty_method(
     DexClass* cls,
     const char* name,
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <string>
+
 #include "DexClass.h"
 #include "DexAccess.h"
 
@@ -50,6 +52,28 @@ DexMethod* create_abstract_method(
     DexProto* proto,
     DexAccessFlags access = ACC_PUBLIC);
 
+/**
+ * Create a concrete method from its full descriptor and the s-expression of
+ * its code, without adding it to any class.
+ */
+DexMethod* create_method_from_code(
+    const std::string& descriptor,
+    const std::string& code,
+    DexAccessFlags access = ACC_PUBLIC | ACC_STATIC,
+    bool is_virtual = false);
+
+/**
+ * Expect the code to be the one that the s-expression describes.
+ */
+void expect_code_eq(const IRCode* code, const std::string& expected);
+
+/**
+ * Create a class that only has a static method `int bar(int)`, whose code
+ * branches on the argument: it returns 1 unless the argument is 0. Returns
+ * the method.
+ */
+DexMethod* create_class_with_branching_method(const char* name);
+
 /**
  * Add a concrete empty method (only return statement) to the given class.
  */
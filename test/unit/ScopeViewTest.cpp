@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "ScopeView.h"
+
+namespace {
+
+DexClass* make_class(const char* name) {
+  ClassCreator creator(DexType::make_type(name));
+  creator.set_super(get_object_type());
+  return creator.create();
+}
+
+} // namespace
+
+TEST(ScopeViewTest, rebuildsWhenStoresChange) {
+  g_redex = new RedexContext();
+
+  auto a_cls = make_class("LA;");
+  auto b_cls = make_class("LB;");
+  auto c_cls = make_class("LC;");
+
+  DexStoresVector stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes({a_cls});
+  store.add_classes({b_cls});
+  stores.emplace_back(std::move(store));
+
+  ScopeView view(stores);
+  auto scope = view.get();
+  EXPECT_EQ(*scope, build_class_scope(stores));
+  auto version = view.version();
+  EXPECT_EQ(scope, view.get());
+  EXPECT_EQ(version, view.version());
+
+  auto location = view.get_location(b_cls);
+  EXPECT_EQ(0, location.store);
+  EXPECT_EQ(1, location.dex);
+
+  stores[0].get_dexen()[0].push_back(c_cls);
+  auto rebuilt = view.get();
+  EXPECT_NE(version, view.version());
+  EXPECT_EQ(*rebuilt, build_class_scope(stores));
+  EXPECT_EQ(0, view.get_location(c_cls).dex);
+  // The old snapshot is unaffected.
+  EXPECT_EQ(2, scope->size());
+
+  // Replacing a class in place goes unnoticed until invalidated.
+  version = view.version();
+  stores[0].get_dexen()[0][0] = b_cls;
+  stores[0].get_dexen()[1][0] = a_cls;
+  EXPECT_EQ(version, view.version());
+  view.invalidate();
+  EXPECT_EQ(*view.get(), build_class_scope(stores));
+  EXPECT_EQ(1, view.get_location(a_cls).dex);
+
+  delete g_redex;
+}
@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRCode.h"
+#include "ScopeHelper.h"
+#include "SideEffectSummaries.h"
+
+using namespace side_effects;
+
+struct SideEffectSummariesTest : testing::Test {
+  SideEffectSummariesTest() {
+    g_redex = new RedexContext();
+    ClassCreator creator(DexType::make_type("LFoo;"));
+    creator.set_super(get_object_type());
+    m_cls = creator.create();
+    auto field = static_cast<DexField*>(DexField::make_field("LFoo;.f:I"));
+    field->make_concrete(ACC_PUBLIC);
+    m_cls->add_field(field);
+    auto sfield = static_cast<DexField*>(DexField::make_field("LFoo;.s:I"));
+    sfield->make_concrete(ACC_PUBLIC | ACC_STATIC);
+    m_cls->add_field(sfield);
+  }
+
+  ~SideEffectSummariesTest() { delete g_redex; }
+
+  DexMethod* add_method(const std::string& name,
+                        DexAccessFlags access,
+                        const std::string& code,
+                        bool is_virtual = false) {
+    auto method = create_method_from_code(name, code, access, is_virtual);
+    m_cls->add_method(method);
+    return method;
+  }
+
+  DexClass* m_cls;
+};
+
+TEST_F(SideEffectSummariesTest, fieldsAndCalls) {
+  auto getter = add_method("LFoo;.getF:()I", ACC_PRIVATE, R"(
+    (
+     (load-param-object v0)
+     (iget v0 "LFoo;.f:I")
+     (move-result-pseudo v1)
+     (return v1)
+    )
+  )");
+  auto setter = add_method("LFoo;.setF:(I)V", ACC_PRIVATE, R"(
+    (
+     (load-param-object v0)
+     (load-param v1)
+     (iput v1 v0 "LFoo;.f:I")
+     (return-void)
+    )
+  )");
+  // Setting a field of an object that nothing else refers to yet.
+  auto make = add_method("LFoo;.make:()V", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (new-instance "LFoo;")
+     (move-result-pseudo-object v0)
+     (const v1 1)
+     (invoke-direct (v0 v1) "LFoo;.setF:(I)V")
+     (return-void)
+    )
+  )");
+  auto set_other =
+      add_method("LFoo;.setOther:(LFoo;)V", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (load-param-object v0)
+     (const v1 1)
+     (invoke-direct (v0 v1) "LFoo;.setF:(I)V")
+     (return-void)
+    )
+  )");
+  auto set_static = add_method("LFoo;.setS:()V", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (const v0 1)
+     (sput v0 "LFoo;.s:I")
+     (return-void)
+    )
+  )");
+  auto external = add_method("LFoo;.external:()V", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (invoke-static () "LBar;.unknown:()V")
+     (return-void)
+    )
+  )");
+
+  SideEffectSummaries summaries({m_cls}, {});
+  EXPECT_EQ(summaries.get(getter), READS);
+  EXPECT_EQ(summaries.get(setter), WRITES_RECEIVER);
+  EXPECT_EQ(summaries.get(make), ALLOCATES);
+  EXPECT_EQ(summaries.get(set_other), WRITES);
+  EXPECT_EQ(summaries.get(set_static), WRITES);
+  EXPECT_EQ(summaries.get(external), UNKNOWN);
+  EXPECT_TRUE(is_removable(summaries.get(getter)));
+  EXPECT_TRUE(is_removable(summaries.get(make)));
+  EXPECT_FALSE(is_removable(summaries.get(setter)));
+
+  auto invoke = new IRInstruction(OPCODE_INVOKE_DIRECT);
+  invoke->set_method(getter)->set_arg_word_count(1)->set_src(0, 0);
+  EXPECT_EQ(summaries.get_invoke(invoke), READS);
+  delete invoke;
+}
+
+TEST_F(SideEffectSummariesTest, recursion) {
+  // Two methods that call each other: the effects of either one reach both.
+  auto even = add_method("LFoo;.even:(I)I", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :zero)
+     (add-int/lit8 v0 v0 -1)
+     (invoke-static (v0) "LFoo;.odd:(I)I")
+     (move-result v1)
+     (return v1)
+     :zero
+     (sget "LFoo;.s:I")
+     (move-result-pseudo v1)
+     (return v1)
+    )
+  )");
+  auto odd = add_method("LFoo;.odd:(I)I", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :zero)
+     (add-int/lit8 v0 v0 -1)
+     (invoke-static (v0) "LFoo;.even:(I)I")
+     (move-result v1)
+     (return v1)
+     :zero
+     (div-int v0 v0)
+     (move-result-pseudo v1)
+     (return v1)
+    )
+  )");
+  auto caller = add_method("LFoo;.caller:()I", ACC_PUBLIC | ACC_STATIC, R"(
+    (
+     (const v0 4)
+     (invoke-static (v0) "LFoo;.even:(I)I")
+     (move-result v1)
+     (return v1)
+    )
+  )");
+
+  SideEffectSummaries summaries({m_cls}, {});
+  EXPECT_EQ(summaries.get(even), READS | THROWS);
+  EXPECT_EQ(summaries.get(odd), READS | THROWS);
+  EXPECT_EQ(summaries.get(caller), READS | THROWS);
+}
+
+TEST_F(SideEffectSummariesTest, virtualCalls) {
+  auto get = add_method("LFoo;.get:()I", ACC_PUBLIC, R"(
+    (
+     (load-param-object v0)
+     (iget v0 "LFoo;.f:I")
+     (move-result-pseudo v1)
+     (return v1)
+    )
+  )",
+                        /* is_virtual */ true);
+  auto caller = add_method("LFoo;.caller:(LFoo;)V", ACC_PUBLIC | ACC_STATIC,
+                           R"(
+    (
+     (load-param-object v0)
+     (invoke-virtual (v0) "LFoo;.get:()I")
+     (return-void)
+    )
+  )");
+
+  // The call may dispatch to an override, unless nothing overrides get().
+  SideEffectSummaries overridable({m_cls}, {});
+  EXPECT_EQ(overridable.get(caller), UNKNOWN);
+  SideEffectSummaries final_get({m_cls}, {get});
+  EXPECT_EQ(final_get.get(caller), READS);
+}
@@ -9,9 +9,11 @@
 
 #include <gtest/gtest.h>
 
+#include "Creators.h"
 #include "DexAsm.h"
 #include "DexUtil.h"
 #include "Inliner.h"
+#include "IRAssembler.h"
 #include "IRCode.h"
 
 std::ostream& operator<<(std::ostream& os, const IRInstruction& to_show) {
@@ -71,3 +73,202 @@ TEST(SimpleInlineTest, insertMoves) {
   EXPECT_EQ(caller_code->get_registers_size(), 5);
   delete g_redex;
 }
+
+/*
+ * Test that chains of callers get completely inlined bottom up when the
+ * inliner processes independent callers in parallel.
+ */
+TEST(SimpleInlineTest, parallelChains) {
+  g_redex = new RedexContext();
+
+  using namespace dex_asm;
+  constexpr int kNumChains = 20;
+  constexpr int kChainLength = 5;
+  auto type = DexType::make_type("Lfoo;");
+  ClassCreator creator(type);
+  creator.set_super(get_object_type());
+  auto cls = creator.create();
+
+  std::vector<DexMethod*> tops;
+  std::unordered_set<DexMethod*> candidates;
+  for (int chain = 0; chain < kNumChains; ++chain) {
+    DexMethod* callee = nullptr;
+    for (int depth = kChainLength; depth >= 0; --depth) {
+      auto name = "m" + std::to_string(chain) + "_" + std::to_string(depth);
+      auto method = static_cast<DexMethod*>(
+          DexMethod::make_method("Lfoo;", name.c_str(), "V", {}));
+      method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+      method->set_code(std::make_unique<IRCode>(method, 1));
+      auto code = method->get_code();
+      if (callee == nullptr) {
+        code->push_back(dasm(OPCODE_CONST, {0_v, 1_L}));
+      } else {
+        code->push_back(dasm(OPCODE_INVOKE_STATIC, callee, {}));
+        candidates.insert(callee);
+      }
+      code->push_back(dasm(OPCODE_RETURN_VOID));
+      cls->add_method(method);
+      callee = method;
+    }
+    tops.push_back(callee);
+  }
+
+  std::vector<DexStore> stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes({cls});
+  stores.emplace_back(std::move(store));
+
+  MethodRefCache resolved_refs;
+  auto resolver = [&](DexMethodRef* method, MethodSearch search) {
+    return resolve_method(method, search, resolved_refs);
+  };
+  MultiMethodInliner::Config config;
+  config.throws_inline = false;
+  {
+    std::vector<DexClass*> scope{cls};
+    MultiMethodInliner inliner(scope, stores, candidates, resolver, config);
+    inliner.inline_methods(4);
+    EXPECT_EQ(kNumChains * kChainLength, inliner.get_info().calls_inlined);
+    EXPECT_EQ(candidates, inliner.get_inlined());
+  }
+
+  for (auto top : tops) {
+    size_t num_consts = 0;
+    for (auto& mie : InstructionIterable(top->get_code())) {
+      EXPECT_FALSE(is_invoke(mie.insn->opcode()));
+      if (mie.insn->opcode() == OPCODE_CONST) {
+        num_consts++;
+      }
+    }
+    EXPECT_EQ(1, num_consts);
+  }
+  delete g_redex;
+}
+
+/*
+ * Test that an inline template can be inlined at several call sites, each
+ * time with the callee registers past the caller's.
+ */
+TEST(SimpleInlineTest, templateAtSeveralSites) {
+  g_redex = new RedexContext();
+
+  auto callee_code = assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (if-eqz v0 :zero)
+     (add-int/lit8 v0 v0 1)
+     :zero
+     (return v0)
+    )
+  )");
+  callee_code->set_registers_size(1);
+  auto caller_code = assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (invoke-static (v0) "Lfoo;.callee:(I)I")
+     (move-result v1)
+     (invoke-static (v1) "Lfoo;.callee:(I)I")
+     (move-result v1)
+     (return v1)
+    )
+  )");
+  caller_code->set_registers_size(2);
+
+  inliner::InlineTemplate tmpl(callee_code.get());
+  EXPECT_TRUE(tmpl.is_current(callee_code.get()));
+  for (int i = 0; i < 2; ++i) {
+    auto ii = InstructionIterable(caller_code.get());
+    auto invoke_it = std::find_if(ii.begin(), ii.end(), [](const auto& mie) {
+      return is_invoke(mie.insn->opcode());
+    });
+    inliner::inline_method(caller_code.get(), tmpl, invoke_it.unwrap());
+  }
+
+  auto expected_code = assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (move v2 v0)
+     (if-eqz v2 :zero1)
+     (add-int/lit8 v2 v2 1)
+     :zero1
+     (move v1 v2)
+     (move v3 v1)
+     (if-eqz v3 :zero2)
+     (add-int/lit8 v3 v3 1)
+     :zero2
+     (move v1 v3)
+     (return v1)
+    )
+  )");
+  EXPECT_EQ(assembler::to_s_expr(caller_code.get()),
+            assembler::to_s_expr(expected_code.get()));
+  EXPECT_EQ(caller_code->get_registers_size(), 4);
+
+  // The template doesn't follow the callee once it changes.
+  callee_code->push_back(new IRInstruction(OPCODE_NOP));
+  EXPECT_FALSE(tmpl.is_current(callee_code.get()));
+  delete g_redex;
+}
+
+/*
+ * Test that the summary of a callee gives the same answer at each of its call
+ * sites, depending on whether the caller is in the callee's class.
+ */
+TEST(SimpleInlineTest, calleeSummaryPerCallerClass) {
+  g_redex = new RedexContext();
+
+  auto make_method = [](ClassCreator& creator, const char* name,
+                        const char* code) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(name));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(assembler::ircode_from_string(code));
+    creator.add_method(method);
+    return method;
+  };
+  const char* caller_code = R"(
+    (
+     (load-param-object v0)
+     (invoke-static (v0) "Lfoo;.callee:(Lfoo;)V")
+     (return-void)
+    )
+  )";
+  ClassCreator foo_creator(DexType::make_type("Lfoo;"));
+  foo_creator.set_super(get_object_type());
+  auto callee = make_method(foo_creator, "Lfoo;.callee:(Lfoo;)V", R"(
+    (
+     (load-param-object v0)
+     (invoke-super (v0) "Ljava/lang/Object;.hashCode:()I")
+     (return-void)
+    )
+  )");
+  make_method(foo_creator, "Lfoo;.c:(Lfoo;)V", caller_code);
+  ClassCreator bar_creator(DexType::make_type("Lbar;"));
+  bar_creator.set_super(get_object_type());
+  make_method(bar_creator, "Lbar;.a:(Lfoo;)V", caller_code);
+  make_method(bar_creator, "Lbar;.b:(Lfoo;)V", caller_code);
+  std::vector<DexClass*> scope{foo_creator.create(), bar_creator.create()};
+
+  std::vector<DexStore> stores;
+  DexMetadata dm;
+  dm.set_id("classes");
+  DexStore store(dm);
+  store.add_classes(scope);
+  stores.emplace_back(std::move(store));
+
+  MethodRefCache resolved_refs;
+  auto resolver = [&](DexMethodRef* method, MethodSearch search) {
+    return resolve_method(method, search, resolved_refs);
+  };
+  MultiMethodInliner::Config config;
+  config.throws_inline = false;
+  std::unordered_set<DexMethod*> candidates{callee};
+  {
+    MultiMethodInliner inliner(scope, stores, candidates, resolver, config);
+    inliner.inline_methods(1);
+    EXPECT_EQ(1, inliner.get_info().calls_inlined);
+    EXPECT_EQ(2, inliner.get_info().invoke_super);
+  }
+  delete g_redex;
+}
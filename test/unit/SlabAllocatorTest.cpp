@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "SlabAllocator.h"
+
+namespace {
+
+struct Node : public SlabAllocated<Node> {
+  explicit Node(uint64_t value) : value(value) {}
+  uint64_t value;
+  char padding[13];
+};
+
+} // namespace
+
+TEST(SlabAllocatorTest, reusesFreedCells) {
+  std::vector<Node*> nodes;
+  for (uint64_t i = 0; i < 10000; ++i) {
+    nodes.push_back(new Node(i));
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(nodes.back()) % alignof(Node));
+  }
+  std::unordered_set<Node*> distinct(nodes.begin(), nodes.end());
+  EXPECT_EQ(nodes.size(), distinct.size());
+  for (uint64_t i = 0; i < nodes.size(); ++i) {
+    EXPECT_EQ(i, nodes[i]->value);
+  }
+
+  Node* last = nodes.back();
+  delete last;
+  nodes.pop_back();
+  auto again = new Node(42);
+  EXPECT_EQ(last, again);
+  delete again;
+  for (auto node : nodes) {
+    delete node;
+  }
+}
+
+TEST(SlabAllocatorTest, freeOnAnotherThread) {
+  std::vector<Node*> nodes;
+  std::thread producer([&] {
+    for (uint64_t i = 0; i < 1000; ++i) {
+      nodes.push_back(new Node(i));
+    }
+  });
+  producer.join();
+  for (auto node : nodes) {
+    delete node;
+  }
+  // The cells that the producer never freed are up for grabs, and the ones
+  // freed here are reused first.
+  auto node = new Node(0);
+  EXPECT_EQ(nodes.back(), node);
+  delete node;
+}
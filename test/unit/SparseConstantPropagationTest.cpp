@@ -0,0 +1,203 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "ConstantPropagation.h"
+#include "IRAssembler.h"
+#include "ScopeHelper.h"
+#include "SparseConstantPropagation.h"
+
+namespace cp = constant_propagation;
+
+static cp::Transform::Stats do_sparse_const_prop(
+    IRCode* code,
+    const ConstantEnvironment& params = ConstantEnvironment()) {
+  ConstPropConfig config;
+  code->build_cfg();
+  cp::sparse::Analyzer analyzer(code->cfg(), config);
+  analyzer.run(params);
+  cp::Transform tf(config);
+  return tf.apply(analyzer, code);
+}
+
+TEST(SparseConstantPropagation, constantPhi) {
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param v2)
+     (if-eqz v2 :a)
+     (const v0 1)
+     (goto :join)
+     :a
+     (const v0 1)
+     :join
+     (if-nez v0 :b)
+     (const v1 5)
+     (return v1)
+     :b
+     (const v1 6)
+     (return v1)
+    )
+  )");
+  auto stats = do_sparse_const_prop(code.get());
+  EXPECT_EQ(stats.branches_removed, 1);
+  EXPECT_EQ(stats.unreachable_instructions_removed, 2);
+  expect_code_eq(code.get(), R"(
+    (
+     (load-param v2)
+     (if-eqz v2 :a)
+     (const v0 1)
+     (goto :join)
+     :a
+     (const v0 1)
+     :join
+     (goto :b)
+     :b
+     (const v1 6)
+     (return v1)
+    )
+  )");
+}
+
+TEST(SparseConstantPropagation, unreachableDefinitions) {
+  // The first branch is always taken, so the only value of v0 that reaches
+  // the second one is 0.
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (const v0 0)
+     (const v1 0)
+     (if-eqz v1 :a)
+     (const v0 1)
+     :a
+     (if-nez v0 :b)
+     (return v0)
+     :b
+     (const v0 2)
+     (return v0)
+    )
+  )");
+  auto stats = do_sparse_const_prop(code.get());
+  EXPECT_EQ(stats.branches_removed, 2);
+  expect_code_eq(code.get(), R"(
+    (
+     (const v0 0)
+     (const v1 0)
+     (goto :a)
+     :a
+     (return v0)
+    )
+  )");
+}
+
+TEST(SparseConstantPropagation, loop) {
+  // v0 changes in the loop, so the exit test can't be folded.
+  const char* loop = R"(
+    (
+     (const v0 0)
+     (const v1 3)
+     :loop
+     (if-ge v0 v1 :end)
+     (add-int/lit8 v0 v0 1)
+     (goto :loop)
+     :end
+     (return v0)
+    )
+  )";
+  auto code = assembler::ircode_from_string(loop);
+  auto stats = do_sparse_const_prop(code.get());
+  EXPECT_EQ(stats.branches_removed, 0);
+  expect_code_eq(code.get(), loop);
+}
+
+TEST(SparseConstantPropagation, parameters) {
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (load-param v0)
+     (if-lez v0 :a)
+     (const v1 1)
+     (return v1)
+     :a
+     (const v1 2)
+     (return v1)
+    )
+  )");
+  ConstantEnvironment params;
+  params.set(0, SignedConstantDomain(7));
+  do_sparse_const_prop(code.get(), params);
+  expect_code_eq(code.get(), R"(
+    (
+     (load-param v0)
+     (const v1 1)
+     (return v1)
+    )
+  )");
+}
+
+/*
+ * (const v0 <selector>)
+ * (packed-switch v0) with case 0 -> :a and case 1 -> :b
+ * (const v1 0) (return v1)
+ * :a (const v1 10) (return v1)
+ * :b (const v1 20) (return v1)
+ */
+static std::unique_ptr<IRCode> make_switch_code(int64_t selector) {
+  auto code = assembler::ircode_from_string(R"(
+    (
+     (const v0 0)
+     (const v1 0)
+     (return v1)
+     (const v1 10)
+     (return v1)
+     (const v1 20)
+     (return v1)
+    )
+  )");
+  std::vector<FatMethod::iterator> insns;
+  for (auto it = code->begin(); it != code->end(); ++it) {
+    if (it->type == MFLOW_OPCODE) {
+      insns.push_back(it);
+    }
+  }
+  insns[0]->insn->set_literal(selector);
+  auto sw = new IRInstruction(OPCODE_PACKED_SWITCH);
+  sw->set_arg_word_count(1)->set_src(0, 0);
+  auto sw_it = code->insert_after(insns[0], sw);
+  code->insert_before(insns[3], new BranchTarget(&*sw_it, 0));
+  code->insert_before(insns[5], new BranchTarget(&*sw_it, 1));
+  return code;
+}
+
+TEST(SparseConstantPropagation, switchToCase) {
+  auto code = make_switch_code(1);
+  auto stats = do_sparse_const_prop(code.get());
+  EXPECT_EQ(stats.branches_removed, 1);
+  EXPECT_EQ(stats.unreachable_instructions_removed, 4);
+  expect_code_eq(code.get(), R"(
+    (
+     (const v0 1)
+     (goto :b)
+     :b
+     (const v1 20)
+     (return v1)
+    )
+  )");
+}
+
+TEST(SparseConstantPropagation, switchToDefault) {
+  auto code = make_switch_code(5);
+  auto stats = do_sparse_const_prop(code.get());
+  EXPECT_EQ(stats.branches_removed, 1);
+  expect_code_eq(code.get(), R"(
+    (
+     (const v0 5)
+     (const v1 0)
+     (return v1)
+    )
+  )");
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "StoreDependencies.h"
+
+struct StoreDependenciesTest : testing::Test {
+  StoreDependenciesTest() { g_redex = new RedexContext(); }
+
+  ~StoreDependenciesTest() { delete g_redex; }
+
+  static void add_store(DexStoresVector& stores,
+                        const std::string& name,
+                        const std::vector<std::string>& deps,
+                        const DexClasses& classes) {
+    DexMetadata dm;
+    dm.set_id(name);
+    dm.get_dependencies() = deps;
+    DexStore store(dm);
+    store.add_classes(classes);
+    stores.emplace_back(std::move(store));
+  }
+
+  // A class whose static method refers to the given classes.
+  static DexClass* make_class(const char* name,
+                              const std::vector<const char*>& refs) {
+    ClassCreator creator(DexType::make_type(name));
+    creator.set_super(get_object_type());
+    auto cls = creator.create();
+    std::string code = "((new-instance \"LA;\") (move-result-pseudo-object v0)";
+    for (auto ref : refs) {
+      code += std::string(" (sget \"") + ref + ".f:I\") (move-result-pseudo v1)";
+    }
+    code += " (return-void))";
+    auto method = static_cast<DexMethod*>(
+        DexMethod::make_method(std::string(name) + ".m:()V"));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(assembler::ircode_from_string(code));
+    cls->add_method(method);
+    return cls;
+  }
+};
+
+TEST_F(StoreDependenciesTest, closures) {
+  DexStoresVector stores;
+  add_store(stores, "classes", {}, {});
+  add_store(stores, "a", {}, {});
+  add_store(stores, "b", {"a"}, {});
+  add_store(stores, "c", {"b", "unknown"}, {});
+  // A cycle.
+  add_store(stores, "d", {"e"}, {});
+  add_store(stores, "e", {"d"}, {});
+
+  StoreDependencies deps(stores);
+  for (size_t i = 0; i < stores.size(); ++i) {
+    EXPECT_TRUE(deps.can_refer_to(i, i));
+    EXPECT_TRUE(deps.can_refer_to(i, 0));
+  }
+  EXPECT_FALSE(deps.can_refer_to(0, 1));
+  EXPECT_TRUE(deps.can_refer_to(3, 1));
+  EXPECT_TRUE(deps.can_refer_to(3, 2));
+  EXPECT_TRUE(deps.can_refer_to(2, 1));
+  EXPECT_FALSE(deps.can_refer_to(1, 2));
+  EXPECT_FALSE(deps.can_refer_to(2, 3));
+  EXPECT_TRUE(deps.can_refer_to(4, 5));
+  EXPECT_TRUE(deps.can_refer_to(5, 4));
+  EXPECT_FALSE(deps.can_refer_to(4, 1));
+}
+
+TEST_F(StoreDependenciesTest, illegalRefs) {
+  // Every class refers to LA; of the root store.
+  auto a = make_class("LA;", {});
+  auto b = make_class("LB;", {"LC;", "LExternal;"});
+  auto c = make_class("LC;", {"LB;"});
+  auto d = make_class("LD;", {"LB;", "LC;"});
+  DexStoresVector stores;
+  add_store(stores, "classes", {}, {a});
+  add_store(stores, "b", {}, {b});
+  add_store(stores, "c", {"b"}, {c});
+  add_store(stores, "d", {}, {d});
+
+  auto refs = find_illegal_store_refs(stores);
+  ASSERT_EQ(refs.size(), 3);
+  EXPECT_EQ(refs[0].referrer, b);
+  EXPECT_EQ(refs[0].referrer_store, 1);
+  EXPECT_EQ(refs[0].reference, c);
+  EXPECT_EQ(refs[0].reference_store, 2);
+  EXPECT_EQ(refs[1].referrer, d);
+  EXPECT_EQ(refs[1].reference, b);
+  EXPECT_EQ(refs[2].referrer, d);
+  EXPECT_EQ(refs[2].reference, c);
+  EXPECT_EQ(refs[2].reference_store, 2);
+}
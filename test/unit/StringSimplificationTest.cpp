@@ -9,523 +9,459 @@
 
 #include <gtest/gtest.h>
 
-#include "DexAsm.h"
-#include "DexUnitTestRunner.h"
-#include "DexUtil.h"
-
-#include "StringSimplification.h"
-
-using namespace dex_asm;
+#include "DexAnnotation.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "StringIterator.h"
 
 //========== Helpers ==========
 
-IRInstruction* make_noise_instructions(uint16_t dest,
-                                       uint16_t src_a,
-                                       uint16_t src_b) {
-  return dasm(OPCODE_ADD_INT, {{VREG, dest}, {VREG, src_a}, {VREG, src_b}});
-}
-
-IRInstruction* make_const_string(uint16_t dest, std::string s) {
-  auto insn = new IRInstruction(OPCODE_CONST_STRING);
-  insn->set_string(DexString::make_string(s));
-  insn->set_dest(dest);
-  return insn;
-}
-
-IRInstruction* make_stringbuilder(uint16_t dest) {
-  auto insn = new IRInstruction(OPCODE_NEW_INSTANCE);
-  insn->set_type(DexType::make_type("Ljava/lang/StringBuilder;"));
-  insn->set_dest(dest);
-  return insn;
-}
-
-IRInstruction* make_constructor(uint16_t dest) {
-  auto insn = new IRInstruction(OPCODE_INVOKE_DIRECT);
-  insn->set_arg_word_count(1);
-  insn->set_src(0, dest);
-  insn->set_method(
-      DexMethod::make_method("Ljava/lang/StringBuilder;", "<init>", "V", {}));
-  return insn;
-}
-
-IRInstruction* make_append_instruction(uint16_t vreg_sb, uint16_t vreg_str) {
-  auto insn = new IRInstruction(OPCODE_INVOKE_VIRTUAL);
-  insn->set_arg_word_count(2);
-  insn->set_src(0, vreg_sb);
-  insn->set_src(1, vreg_str);
-  insn->set_method(DexMethod::make_method("Ljava/lang/StringBuilder;",
-                                          "append",
-                                          "Ljava/lang/StringBuilder;",
-                                          {"Ljava/lang/String;"}));
-  return insn;
-}
+// The s-expressions of the StringBuilder methods, to be pasted in the code.
+#define INIT "\"Ljava/lang/StringBuilder;.<init>:()V\""
+#define APPEND                                                          \
+  "\"Ljava/lang/StringBuilder;.append:(Ljava/lang/String;)Ljava/lang/" \
+  "StringBuilder;\""
+#define TO_STRING "\"Ljava/lang/StringBuilder;.toString:()Ljava/lang/String;\""
+#define VALUE_OF                                                        \
+  "\"Ljava/lang/String;.valueOf:(Ljava/lang/Object;)Ljava/lang/String;\""
+#define CONCAT                                                         \
+  "\"Ljava/lang/String;.concat:(Ljava/lang/String;)Ljava/lang/String;\""
+#define NEW_BUILDER(reg)                               \
+  "(new-instance \"Ljava/lang/StringBuilder;\")\n"     \
+  "(move-result-pseudo-object " reg ")\n"              \
+  "(invoke-direct (" reg ") " INIT ")\n"
+
+struct StringSimplificationTest : testing::Test {
+  StringSimplificationTest() { g_redex = new RedexContext(); }
+
+  ~StringSimplificationTest() { delete g_redex; }
+
+  // Runs the simplification on `code`, whose registers are below v10, and
+  // returns the code it ends up with.
+  static std::string simplify(const std::string& code,
+                              const KnownStrings& known_strings = {}) {
+    auto ir = assembler::ircode_from_string(code);
+    ir->set_registers_size(10);
+    ir->build_cfg();
+    ir->cfg().calculate_exit_block();
+    StringIterator iter(ir.get(), known_strings);
+    iter.run(StringProdEnvironment());
+    iter.simplify();
+    ir->clear_cfg();
+    return assembler::to_s_expr(ir.get()).str();
+  }
 
-IRInstruction* make_to_string(uint16_t dest) {
-  auto insn = new IRInstruction(OPCODE_INVOKE_VIRTUAL);
-  insn->set_arg_word_count(1);
-  insn->set_src(0, dest);
-  insn->set_method(DexMethod::make_method(
-      "Ljava/lang/StringBuilder;", "toString", "Ljava/lang/String;", {}));
-  return insn;
-}
+  static std::string expected(const std::string& code) {
+    return assembler::to_s_expr(assembler::ircode_from_string(code).get())
+        .str();
+  }
+};
 
 //========== Test Cases ==========
 
-// Check that unicode strings can be appened together.
-TEST(StringSimplification, testUnicodeStrings) {
-  DexUnitTestRunner runner;
-
-  auto parent = runner.create_class("Lcom/redex/UnicodeTest;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(1, "Привет!"));
-  code->push_back(make_const_string(2, "TWO"));
-  code->push_back(make_stringbuilder(3));
-  code->push_back(make_constructor(3));
-
-  code->push_back(make_append_instruction(3, 1));
-  code->push_back(make_append_instruction(3, 2));
-  code->push_back(make_to_string(3));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {3_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  runner.run(new StringSimplificationPass());
-  std::vector<DexString*> arr;
-  code->gather_strings(arr);
-  EXPECT_TRUE(std::any_of(
-      arr.begin(), arr.end(), [](auto x) { return "Привет!TWO" == x->str(); }));
-}
-
 // Check that the const string appears, and that no string builder instructions
-// remain.
-TEST(StringSimplification, testConstString) {
-  DexUnitTestRunner runner;
-  auto parent = runner.create_class("Lcom/redex/Parent2;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(1, "ONE "));
-  code->push_back(make_const_string(6, "THREE"));
-  code->push_back(make_const_string(18, "TWO "));
-
-  code->push_back(make_stringbuilder(2));
-  code->push_back(make_constructor(2));
-
-  code->push_back(make_append_instruction(2, 1));
-  code->push_back(make_append_instruction(2, 18));
-  code->push_back(make_append_instruction(2, 6));
-  code->push_back(make_to_string(2));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {2_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  runner.run(new StringSimplificationPass());
-  std::vector<DexString*> arr;
-  code->gather_strings(arr);
-
-  EXPECT_TRUE(std::any_of(arr.begin(), arr.end(), [](auto x) {
-    return "ONE TWO THREE" == x->str();
-  }));
-  for (auto& mie : InstructionIterable(code)) {
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_VIRTUAL);
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_DIRECT);
-    EXPECT_NE(mie.insn->opcode(), OPCODE_NEW_INSTANCE);
-  }
+// remain. Unicode strings can be appended together as well.
+TEST_F(StringSimplificationTest, constString) {
+  auto code = simplify(R"(
+    (
+     (const-string "ONE ")
+     (move-result-pseudo-object v1)
+     (const-string "TWO ")
+     (move-result-pseudo-object v2)
+     (const-string "Привет!")
+     (move-result-pseudo-object v3)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (move-result-object v0)
+     (invoke-virtual (v0 v2) )" APPEND R"()
+     (invoke-virtual (v0 v3) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v4)
+     (return-object v4)
+    )
+  )");
+  EXPECT_EQ(code, expected(R"(
+    (
+     (const-string "ONE ")
+     (move-result-pseudo-object v1)
+     (const-string "TWO ")
+     (move-result-pseudo-object v2)
+     (const-string "Привет!")
+     (move-result-pseudo-object v3)
+     (const-string "ONE TWO Привет!")
+     (move-result-pseudo-object v4)
+     (return-object v4)
+    )
+  )"));
 }
 
-// Check that two constant string interrelations are converted while they are
-// intertwined.
-// StringBuilder v4 -> "THREE TWO ONE"
-// StringBuilder v5 -> "TWO ONE THREE"
-TEST(StringSimplification, testMultipleConstantBuilders) {
-  DexUnitTestRunner runner;
-  auto parent = runner.create_class("Lcom/redex/Parent3;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(11, "ONE"));
-  code->push_back(make_const_string(13, "THREE"));
-  code->push_back(make_const_string(12, "TWO"));
-
-  code->push_back(make_stringbuilder(4));
-  code->push_back(make_constructor(4));
-
-  code->push_back(make_stringbuilder(5));
-  code->push_back(make_constructor(5));
-
-  code->push_back(make_append_instruction(4, 13));
-  code->push_back(make_append_instruction(5, 12));
-
-  code->push_back(make_append_instruction(4, 12));
-  code->push_back(make_append_instruction(5, 11));
-
-  code->push_back(make_append_instruction(4, 11));
-  code->push_back(make_append_instruction(5, 13));
-
-  code->push_back(make_to_string(4));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {2_v}));
-
-  code->push_back(make_to_string(5));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {9_v}));
-
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  runner.run(new StringSimplificationPass());
-  std::vector<DexString*> arr;
-  code->gather_strings(arr);
-
-  EXPECT_TRUE(std::any_of(arr.begin(), arr.end(), [](auto x) {
-    return "THREETWOONE" == x->str();
-  }));
-  EXPECT_TRUE(std::any_of(arr.begin(), arr.end(), [](auto x) {
-    return "TWOONETHREE" == x->str();
-  }));
-  for (auto& mie : InstructionIterable(code)) {
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_VIRTUAL);
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_DIRECT);
-    EXPECT_NE(mie.insn->opcode(), OPCODE_NEW_INSTANCE);
-  }
-}
-
-// Before: A stringbuilder is appended to with additional noise inbetween.
-// After: The stringbuilder is deleted, and the result is stored as a constant.
-//        The number of noise instructions shouldn't be changed.
-TEST(StringSimplification, testInterleavedInstructions) {
-  DexUnitTestRunner runner;
-  auto parent = runner.create_class("Lcom/redex/Parent4;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(11, "ONE"));
-
-  code->push_back(dasm(OPCODE_CONST, {54_v, 1_L}));
-  code->push_back(dasm(OPCODE_CONST, {55_v, 23_L}));
-  code->push_back(make_noise_instructions(54, 54, 55));
-
-  code->push_back(make_stringbuilder(4));
-  code->push_back(make_constructor(4));
-
-  code->push_back(make_const_string(13, "THREE"));
-  code->push_back(make_const_string(12, "TWO"));
-
-  code->push_back(make_noise_instructions(54, 54, 55));
-
-  code->push_back(make_append_instruction(4, 13));
-  code->push_back(make_noise_instructions(54, 54, 55));
-  code->push_back(make_append_instruction(4, 12));
-  code->push_back(make_noise_instructions(54, 54, 55));
-  code->push_back(make_append_instruction(4, 11));
-
-  code->push_back(make_to_string(4));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {4_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  runner.run(new StringSimplificationPass());
-  std::vector<DexString*> arr;
-  code->gather_strings(arr);
-
-  EXPECT_EQ(4, std::count_if(code->begin(), code->end(), [](auto& x) {
-              return x.type == MFLOW_OPCODE &&
-                     x.insn->opcode() == OPCODE_ADD_INT;
-            }));
-
-  EXPECT_TRUE(std::any_of(arr.begin(), arr.end(), [](auto x) {
-    return "THREETWOONE" == x->str();
-  }));
-  for (auto& mie : InstructionIterable(code)) {
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_VIRTUAL);
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_DIRECT);
-    EXPECT_NE(mie.insn->opcode(), OPCODE_NEW_INSTANCE);
-  }
+// Check that two intertwined builders, with other instructions in between,
+// are converted, and that the register aliasing of append() is followed.
+TEST_F(StringSimplificationTest, interleavedBuilders) {
+  auto code = simplify(R"(
+    (
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (const-string "TWO")
+     (move-result-pseudo-object v2)
+    )" NEW_BUILDER("v4") NEW_BUILDER("v5") R"(
+     (add-int v6 v6 v6)
+     (invoke-virtual (v4 v2) )" APPEND R"()
+     (move-result-object v3)
+     (invoke-virtual (v5 v1) )" APPEND R"()
+     (add-int v6 v6 v6)
+     (invoke-virtual (v3 v1) )" APPEND R"()
+     (invoke-virtual (v5 v2) )" APPEND R"()
+     (invoke-virtual (v4) )" TO_STRING R"()
+     (move-result-object v2)
+     (invoke-virtual (v5) )" TO_STRING R"()
+     (move-result-object v9)
+     (return-object v9)
+    )
+  )");
+  EXPECT_EQ(code, expected(R"(
+    (
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (const-string "TWO")
+     (move-result-pseudo-object v2)
+     (add-int v6 v6 v6)
+     (add-int v6 v6 v6)
+     (const-string "TWOONE")
+     (move-result-pseudo-object v2)
+     (const-string "ONETWO")
+     (move-result-pseudo-object v9)
+     (return-object v9)
+    )
+  )"));
 }
 
 // Before: 3 blocks, A -> B and A -> C.  Both diverge with string result.
 // After: block B should have "THREEONE" and block C should have "THREETWO"
-//        and the two blocks shouldn't have any stringbuilder code
-TEST(StringSimplification, testBranching) {
-  DexUnitTestRunner runner;
-  auto parent = runner.create_class("Lcom/redex/Parent5;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(11, "ONE"));
-  code->push_back(make_const_string(13, "THREE"));
-  code->push_back(make_const_string(12, "TWO"));
-
-  code->push_back(make_stringbuilder(4));
-  code->push_back(make_constructor(4));
-
-  code->push_back(make_append_instruction(4, 13));
-  code->push_back(dasm(OPCODE_CONST, {6_v, 0_L}));
-
-  auto insn = new IRInstruction(OPCODE_INVOKE_VIRTUAL);
-  insn->set_arg_word_count(1);
-  insn->set_src(0, 6);
-  insn->set_dest(6);
-  insn->set_method(
-      DexMethod::make_method("Ljava/lang/Funky;", "doTheThing", "B", {}));
-  code->push_back(insn);
-
-  auto if_mie = new MethodItemEntry(dasm(OPCODE_IF_EQZ, {6_v}));
-  auto target = new BranchTarget();
-  target->type = BRANCH_SIMPLE;
-  target->src = if_mie;
-  code->push_back(*if_mie);
-  code->push_back(make_append_instruction(4, 11));
-  code->push_back(make_to_string(4));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {5_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->push_back(target);
-  code->push_back(make_append_instruction(4, 12));
-  code->push_back(make_to_string(4));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {5_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  code->build_cfg();
-  runner.run(new StringSimplificationPass());
+//        and no block should have any stringbuilder code.
+TEST_F(StringSimplificationTest, branching) {
+  auto code = simplify(R"(
+    (
+     (load-param v5)
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (const-string "TWO")
+     (move-result-pseudo-object v2)
+     (const-string "THREE")
+     (move-result-pseudo-object v3)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v3) )" APPEND R"()
+     (if-eqz v5 :two)
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v4)
+     (return-object v4)
+     :two
+     (invoke-virtual (v0 v2) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v4)
+     (return-object v4)
+    )
+  )");
+  EXPECT_EQ(code, expected(R"(
+    (
+     (load-param v5)
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (const-string "TWO")
+     (move-result-pseudo-object v2)
+     (const-string "THREE")
+     (move-result-pseudo-object v3)
+     (if-eqz v5 :two)
+     (const-string "THREEONE")
+     (move-result-pseudo-object v4)
+     (return-object v4)
+     :two
+     (const-string "THREETWO")
+     (move-result-pseudo-object v4)
+     (return-object v4)
+    )
+  )"));
+}
 
-  std::vector<DexString*> arr;
-  code->gather_strings(arr);
-  EXPECT_TRUE(std::any_of(arr.begin(), arr.end(), [](auto x) {
-    return "THREEONE" == x->str();
-  })); // Check block 1.
-  EXPECT_TRUE(std::any_of(arr.begin(), arr.end(), [](auto x) {
-    return "THREETWO" == x->str();
-  })); // Check block 2.
+// The contents are known after a join if they are the same on both sides.
+TEST_F(StringSimplificationTest, joins) {
+  auto same_contents = simplify(R"(
+    (
+     (load-param v5)
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+    )" NEW_BUILDER("v0") R"(
+     (if-eqz v5 :other)
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (goto :end)
+     :other
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     :end
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v4)
+     (return-object v4)
+    )
+  )");
+  EXPECT_EQ(same_contents, expected(R"(
+    (
+     (load-param v5)
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (if-eqz v5 :other)
+     (goto :end)
+     :other
+     :end
+     (const-string "ONE")
+     (move-result-pseudo-object v4)
+     (return-object v4)
+    )
+  )"));
+
+  auto different_contents = R"(
+    (
+     (load-param v5)
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (const-string "TWO")
+     (move-result-pseudo-object v2)
+    )" NEW_BUILDER("v0") R"(
+     (if-eqz v5 :other)
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (goto :end)
+     :other
+     (invoke-virtual (v0 v2) )" APPEND R"()
+     :end
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v4)
+     (return-object v4)
+    )
+  )";
+  EXPECT_EQ(simplify(different_contents), expected(different_contents));
 }
 
-// Before: 2 blocks A -> B.  B's first instruction is toString.
+// Before: A -> B and A -> C -> B.  B's first instruction is toString.
 // After: Replace toString with const-string "THREEONE".
-// Test shouldn't crash during execution of runner. (beginning of block test)
-TEST(StringSimplification, testBeginningOfBlockToString) {
-  DexUnitTestRunner runner;
-  auto parent = runner.create_class("Lcom/redex/Parent6;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(11, "ONE"));
-  code->push_back(make_const_string(13, "THREE"));
-  code->push_back(make_stringbuilder(4));
-  code->push_back(make_constructor(4));
-
-  code->push_back(make_append_instruction(4, 13));
-  code->push_back(make_append_instruction(4, 11));
-  auto goto_mie = new MethodItemEntry(dasm(OPCODE_GOTO));
-  auto target = new BranchTarget();
-  target->type = BRANCH_SIMPLE;
-  target->src = goto_mie;
-  code->push_back(*goto_mie);
-  code->push_back(make_noise_instructions(54, 54, 54));
-  code->push_back(target);
-  code->push_back(make_to_string(4));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {5_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  code->build_cfg();
-  runner.run(new StringSimplificationPass());
-  code->build_cfg();
-  printf("Final Cfg: %s\n", SHOW(code->cfg()));
+TEST_F(StringSimplificationTest, beginningOfBlockToString) {
+  auto code = simplify(R"(
+    (
+     (load-param v6)
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (const-string "THREE")
+     (move-result-pseudo-object v3)
+    )" NEW_BUILDER("v4") R"(
+     (invoke-virtual (v4 v3) )" APPEND R"()
+     (invoke-virtual (v4 v1) )" APPEND R"()
+     (if-eqz v6 :end)
+     (add-int v6 v6 v6)
+     :end
+     (invoke-virtual (v4) )" TO_STRING R"()
+     (move-result-object v5)
+     (return-object v5)
+    )
+  )");
+  EXPECT_EQ(code, expected(R"(
+    (
+     (load-param v6)
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+     (const-string "THREE")
+     (move-result-pseudo-object v3)
+     (if-eqz v6 :end)
+     (add-int v6 v6 v6)
+     :end
+     (const-string "THREEONE")
+     (move-result-pseudo-object v5)
+     (return-object v5)
+    )
+  )"));
 }
 
 // If we pass a stringbuilder into a method, we shouldn't modify the code.
 // Since the method can append at will, we must assume the builder becomes top.
-TEST(StringSimplification, passStringBuilderInMethod) {
-  DexUnitTestRunner runner;
-  auto parent = runner.create_class("Lcom/redex/ParentBuilderInMethod;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(2, "TEST STRING TWO "));
-
-  code->push_back(make_stringbuilder(3));
-  code->push_back(make_constructor(3));
-  code->push_back(make_append_instruction(3, 2));
-  code->push_back(dasm(OPCODE_CONST, {6_v, 0_L}));
-
-  auto insn = new IRInstruction(OPCODE_INVOKE_VIRTUAL);
-  insn->set_arg_word_count(2);
-  insn->set_src(0, 6);
-  insn->set_src(1, 3);
-  insn->set_method(DexMethod::make_method(
-      "Ljava/lang/Funky;", "doTheThing", "V", {"Ljava/lang/StringBuilder;"}));
-  code->push_back(insn);
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {6_v}));
-
-  code->push_back(make_to_string(3));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {3_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  runner.run(new StringSimplificationPass());
-  EXPECT_EQ(10, code->count_opcodes());
-  for (auto& mie : InstructionIterable(code)) {
-    if ((mie.insn->opcode() == OPCODE_INVOKE_VIRTUAL ||
-         mie.insn->opcode() == OPCODE_INVOKE_DIRECT) &&
-        mie.insn->get_method()->get_class() ==
-            DexType::make_type("Ljava/lang/Stringbuilder;")) {
-      EXPECT_TRUE(false);
-    }
-  }
-  code->build_cfg();
-  printf("Final Cfg: %s\n", SHOW(code->cfg()));
+TEST_F(StringSimplificationTest, passStringBuilderInMethod) {
+  auto original = R"(
+    (
+     (const-string "TEST STRING TWO ")
+     (move-result-pseudo-object v2)
+    )" NEW_BUILDER("v3") R"(
+     (invoke-virtual (v3 v2) )" APPEND R"()
+     (invoke-static (v3) "LFunky;.doTheThing:(Ljava/lang/StringBuilder;)V")
+     (invoke-virtual (v3) )" TO_STRING R"()
+     (move-result-object v3)
+     (return-object v3)
+    )
+  )";
+  EXPECT_EQ(simplify(original), expected(original));
 }
 
-// Check that interleaved stringbuilders do not mess with each other.
-// StringBuilder v4 -> "foobar"
-// StringBuilder v5 -> x + "bar"
-TEST(StringSimplification, oneKnownOneUnkownBuilder) {
-  DexUnitTestRunner runner;
-  auto parent = runner.create_class("Lcom/redex/OneKnownOneUnkown;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(1, "foo"));
-  code->push_back(make_const_string(2, "bar"));
-
-  code->push_back(make_stringbuilder(4));
-  code->push_back(make_constructor(4));
-
-  code->push_back(make_stringbuilder(5));
-  code->push_back(make_constructor(5));
-  code->push_back(dasm(OPCODE_CONST, {6_v, 0_L}));
-
-  code->push_back(make_append_instruction(4, 1));
-  code->push_back(make_append_instruction(5, 6));
-
-  code->push_back(make_append_instruction(4, 2));
-  code->push_back(make_append_instruction(5, 2));
-
-  code->push_back(make_to_string(4));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {2_v}));
-
-  code->push_back(make_to_string(5));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {9_v}));
-
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-  runner.run(new StringSimplificationPass());
-  code->build_cfg();
-  printf("Final Cfg: %s\n", SHOW(code->cfg()));
-
-  std::vector<DexString*> arr;
-  code->gather_strings(arr);
+// A builder that escapes after its toString() still gets it folded, but has
+// to stay.
+TEST_F(StringSimplificationTest, builderEscapesAfterToString) {
+  auto code = simplify(R"(
+    (
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v2)
+     (invoke-static (v0) "LFunky;.doTheThing:(Ljava/lang/StringBuilder;)V")
+     (return-object v2)
+    )
+  )");
+  EXPECT_EQ(code, expected(R"(
+    (
+     (const-string "ONE")
+     (move-result-pseudo-object v1)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (const-string "ONE")
+     (move-result-pseudo-object v2)
+     (invoke-static (v0) "LFunky;.doTheThing:(Ljava/lang/StringBuilder;)V")
+     (return-object v2)
+    )
+  )"));
+}
 
-  EXPECT_TRUE(std::any_of(
-      arr.begin(), arr.end(), [](auto x) { return "foobar" == x->str(); }));
-  auto count = 0;
-  for (auto& mie : InstructionIterable(code)) {
-    if (mie.insn->opcode() == OPCODE_INVOKE_VIRTUAL ||
-        mie.insn->opcode() == OPCODE_INVOKE_DIRECT) {
-      ASSERT_EQ(5, mie.insn->src(0));
-      ++count;
-    }
-  }
-  ASSERT_EQ(4, count);
+// A constant and an unknown String become a call to concat(), and an unknown
+// String alone becomes String.valueOf().
+TEST_F(StringSimplificationTest, concat) {
+  auto code = simplify(R"(
+    (
+     (load-param-object v5)
+     (const-string "name: ")
+     (move-result-pseudo-object v1)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (invoke-virtual (v0 v5) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v2)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v5) )" APPEND R"()
+     (const-string "!")
+     (move-result-pseudo-object v1)
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v3)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v5) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v4)
+     (invoke-static (v2 v3) "LLog;.d:(Ljava/lang/String;Ljava/lang/String;)V")
+     (return-object v4)
+    )
+  )");
+  EXPECT_EQ(code, expected(R"(
+    (
+     (load-param-object v5)
+     (const-string "name: ")
+     (move-result-pseudo-object v1)
+     (invoke-static (v5) )" VALUE_OF R"()
+     (move-result-object v10)
+     (const-string "name: ")
+     (move-result-pseudo-object v2)
+     (invoke-virtual (v2 v10) )" CONCAT R"()
+     (move-result-object v2)
+     (const-string "!")
+     (move-result-pseudo-object v1)
+     (invoke-static (v5) )" VALUE_OF R"()
+     (move-result-object v3)
+     (const-string "!")
+     (move-result-pseudo-object v10)
+     (invoke-virtual (v3 v10) )" CONCAT R"()
+     (move-result-object v3)
+     (invoke-static (v5) )" VALUE_OF R"()
+     (move-result-object v4)
+     (invoke-static (v2 v3) "LLog;.d:(Ljava/lang/String;Ljava/lang/String;)V")
+     (return-object v4)
+    )
+  )"));
 }
 
 // Before: sb = new StringBuilder()
-//         x = someRandomString()    // "a"
+//         x = someRandomString()
 //         sb.append(x).append("foo");
-//         x = someOtherString()     // "b"
-//         sb.toString()            // has value x + "", but wrong x.
+//         x = "b"
+//         sb.toString()            // has value x + "foo", but wrong x.
 // After:
 //         Don't change
-TEST(StringSimplification, modificationOfBaseVariable) {
-  DexUnitTestRunner runner;
-
-  auto parent = runner.create_class("Lcom/redex/ParentTestModification;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(1, "TEST STRING ONE "));
-  code->push_back(make_stringbuilder(3));
-  code->push_back(make_constructor(3));
-  code->push_back(dasm(OPCODE_CONST, {6_v, 0_L}));
-
-  auto insn = new IRInstruction(OPCODE_INVOKE_VIRTUAL);  
-  insn->set_arg_word_count(1);
-  insn->set_src(0, 6);
-  insn->set_method(DexMethod::make_method(
-      "Ljava/lang/Funky;", "doTheThing", "Ljava/lang/String;", {}));
-  code->push_back(insn);
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {6_v}));
-
-  code->push_back(make_append_instruction(3, 6));
-  code->push_back(make_append_instruction(3, 1));
-
-  insn = new IRInstruction(OPCODE_INVOKE_VIRTUAL);
-  insn->set_arg_word_count(1);
-  insn->set_src(0, 6);
-  insn->set_method(DexMethod::make_method(
-      "Ljava/lang/Funky;", "doTheThing2", "Ljava/lang/String;", {}));
-  code->push_back(insn);
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {6_v}));
-
-  code->push_back(make_to_string(3));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {3_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-
-  code->build_cfg();
-  printf("Initial Cfg: %s\n", SHOW(code->cfg()));
-  runner.run(new StringSimplificationPass());
-
-  code->build_cfg();
-  printf("Final Cfg: %s\n", SHOW(code->cfg()));
-  EXPECT_EQ(13, code->count_opcodes());
+// Constants on both sides of an unknown String aren't folded either.
+TEST_F(StringSimplificationTest, builderStays) {
+  auto modified_base = R"(
+    (
+     (load-param-object v5)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v5) )" APPEND R"()
+     (const-string "foo")
+     (move-result-pseudo-object v1)
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (const-string "b")
+     (move-result-pseudo-object v5)
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v2)
+     (return-object v2)
+    )
+  )";
+  EXPECT_EQ(simplify(modified_base), expected(modified_base));
+
+  auto three_operands = R"(
+    (
+     (load-param-object v5)
+     (const-string "foo")
+     (move-result-pseudo-object v1)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (invoke-virtual (v0 v5) )" APPEND R"()
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v2)
+     (return-object v2)
+    )
+  )";
+  EXPECT_EQ(simplify(three_operands), expected(three_operands));
 }
 
-// Check that the pointer aliasing is supported. (a stringbuilder
-// is referenced via two registers but the state is shared correctly)
-TEST(StringSimplification, registerAliasingTest) {
-  DexUnitTestRunner runner;
-
-  auto parent = runner.create_class("Lcom/redex/registerAliasingTest;");
-  auto clinit = parent->get_clinit();
-  auto code = clinit->get_code();
-
-  code->push_back(make_const_string(1, "TEST"));
-
-  code->push_back(make_stringbuilder(3));
-  code->push_back(make_constructor(3));
-
-  code->push_back(make_append_instruction(3, 1));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {2_v}));
-  code->push_back(make_append_instruction(2, 1));
-  code->push_back(make_append_instruction(2, 1));
-
-  code->push_back(make_append_instruction(3, 1));
-
-  code->push_back(make_to_string(3));
-  code->push_back(dasm(OPCODE_MOVE_RESULT_OBJECT, {3_v}));
-  code->push_back(dasm(OPCODE_RETURN_VOID));
-
-  code->set_registers_size(9001);
-
-  code->build_cfg();
-  printf("Initial Cfg: %s\n", SHOW(code->cfg()));
-  runner.run(new StringSimplificationPass());
-
-  code->build_cfg();
-  printf("Final Cfg: %s\n", SHOW(code->cfg()));
-
-  std::vector<DexString*> arr;
-  code->gather_strings(arr);
-
-  EXPECT_TRUE(std::any_of(arr.begin(), arr.end(), [](auto x) {
-    return "TESTTESTTESTTEST" == x->str();
-  }));
-  for (auto& mie : InstructionIterable(code)) {
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_DIRECT);
-    EXPECT_NE(mie.insn->opcode(), OPCODE_INVOKE_VIRTUAL);
-  }
+// The static final fields that are known, and the results of the builders
+// that are folded, are constants too.
+TEST_F(StringSimplificationTest, knownStrings) {
+  auto field = static_cast<DexField*>(
+      DexField::make_field("LFoo;.TAG:Ljava/lang/String;"));
+  field->make_concrete(
+      ACC_PUBLIC | ACC_STATIC | ACC_FINAL,
+      new DexEncodedValueString(DexString::make_string("Foo")));
+  auto code = simplify(R"(
+    (
+     (sget-object "LFoo;.TAG:Ljava/lang/String;")
+     (move-result-pseudo-object v1)
+     (const-string ": ")
+     (move-result-pseudo-object v2)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v1) )" APPEND R"()
+     (invoke-virtual (v0 v2) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v3)
+    )" NEW_BUILDER("v0") R"(
+     (invoke-virtual (v0 v3) )" APPEND R"()
+     (invoke-virtual (v0 v3) )" APPEND R"()
+     (invoke-virtual (v0) )" TO_STRING R"()
+     (move-result-object v3)
+     (return-object v3)
+    )
+  )",
+                       {{field, DexString::make_string("Foo")}});
+  EXPECT_EQ(code, expected(R"(
+    (
+     (sget-object "LFoo;.TAG:Ljava/lang/String;")
+     (move-result-pseudo-object v1)
+     (const-string ": ")
+     (move-result-pseudo-object v2)
+     (const-string "Foo: ")
+     (move-result-pseudo-object v3)
+     (const-string "Foo: Foo: ")
+     (move-result-pseudo-object v3)
+     (return-object v3)
+    )
+  )"));
 }
@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "WorkQueue.h"
+
+TEST(ThreadPoolTest, runsEachIndexOnce) {
+  ThreadPool pool(4);
+  constexpr size_t kSize = 10000;
+  std::vector<std::atomic<int>> counts(kSize);
+  for (int round = 0; round < 10; ++round) {
+    pool.run(kSize, [&](size_t i) { counts[i]++; });
+  }
+  for (size_t i = 0; i < kSize; ++i) {
+    EXPECT_EQ(10, counts[i].load());
+  }
+}
+
+TEST(ThreadPoolTest, pinnedThreadsRun) {
+  // Hosts with a single NUMA node leave the threads where they are.
+  ThreadPool pool(4, /* pin_to_nodes */ true);
+  EXPECT_NE(1, pool.num_nodes());
+  std::atomic<int> total{0};
+  pool.run(1000, [&](size_t) { total++; });
+  EXPECT_EQ(1000, total.load());
+}
+
+TEST(ThreadPoolTest, nestedRunsComplete) {
+  ThreadPool pool(2);
+  std::atomic<int> total{0};
+  pool.run(8, [&](size_t) {
+    pool.run(8, [&](size_t) { total++; });
+  });
+  EXPECT_EQ(64, total.load());
+}
+
+TEST(ThreadPoolTest, exceptionsPropagate) {
+  ThreadPool pool(3);
+  std::atomic<int> ran{0};
+  EXPECT_THROW(pool.run(100,
+                        [&](size_t i) {
+                          ran++;
+                          if (i == 42) {
+                            throw std::runtime_error("boom");
+                          }
+                        }),
+               std::runtime_error);
+  EXPECT_EQ(100, ran.load());
+}
+
+TEST(ThreadPoolTest, workQueueUsesCurrentPool) {
+  ThreadPool pool(3);
+  auto previous = ThreadPool::set_current(&pool);
+  EXPECT_EQ(3, workqueue_default_num_threads());
+
+  auto wq = WorkQueue<int, int, int>(
+      [](int& data, int a) { return a + data; },
+      [](int a, int b) { return a + b; },
+      [](unsigned int thread_idx) { return static_cast<int>(thread_idx); },
+      3);
+  for (int i = 0; i < 10; ++i) {
+    wq.add_item(1);
+  }
+  // Each worker adds its index to every item it processes; processing spreads
+  // over workers arbitrarily, so only check the bounds.
+  int result = wq.run_all();
+  EXPECT_GE(result, 10);
+  EXPECT_LE(result, 30);
+
+  ThreadPool::set_current(previous);
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+#include "VirtualRenamer.h"
+
+struct VirtualRenamerTest : testing::Test {
+  VirtualRenamerTest() { g_redex = new RedexContext(); }
+
+  ~VirtualRenamerTest() { delete g_redex; }
+
+  // A class with a public virtual method of each of the names.
+  static DexClass* make_class(const char* name,
+                              DexType* super,
+                              const std::vector<const char*>& methods,
+                              Scope* scope) {
+    ClassCreator creator(DexType::make_type(name));
+    creator.set_super(super);
+    for (auto method_name : methods) {
+      auto method = static_cast<DexMethod*>(DexMethod::make_method(
+          std::string(name) + "." + method_name + ":()V"));
+      method->make_concrete(ACC_PUBLIC, true);
+      method->set_code(assembler::ircode_from_string("((return-void))"));
+      creator.add_method(method);
+    }
+    auto cls = creator.create();
+    scope->push_back(cls);
+    return cls;
+  }
+
+  static std::string name_of(const DexClass* cls, size_t i) {
+    return cls->get_vmethods()[i]->get_name()->str();
+  }
+};
+
+TEST_F(VirtualRenamerTest, siblingHierarchiesReuseNames) {
+  Scope scope;
+  auto a = make_class("LA;", get_object_type(), {"foo"}, &scope);
+  auto b = make_class("LB;", a->get_type(), {"foo"}, &scope);
+  auto d = make_class("LD;", b->get_type(), {"baz"}, &scope);
+  auto c = make_class("LC;", get_object_type(), {"bar", "qux"}, &scope);
+  // A call through a subclass that doesn't define the method.
+  auto caller = make_class("LCaller;", get_object_type(), {}, &scope);
+  auto call = static_cast<DexMethod*>(
+      DexMethod::make_method("LCaller;.call:(LD;)V"));
+  call->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+  call->set_code(assembler::ircode_from_string(R"(
+    (
+     (load-param-object v0)
+     (invoke-virtual (v0) "LD;.foo:()V")
+     (return-void)
+    )
+  )"));
+  caller->add_method(call);
+
+  EXPECT_EQ(rename_virtuals(scope), 5);
+  // The scope of foo spans A and B, and D's own scope comes after it.
+  auto foo = name_of(a, 0);
+  EXPECT_NE(foo, "foo");
+  EXPECT_EQ(name_of(b, 0), foo);
+  EXPECT_NE(name_of(d, 0), foo);
+  // C doesn't share a hierarchy with A, so it starts over.
+  EXPECT_EQ(name_of(c, 0), foo);
+  EXPECT_EQ(name_of(c, 1), name_of(d, 0));
+  EXPECT_NE(DexMethod::get_method("LD;." + foo + ":()V"), nullptr);
+  EXPECT_EQ(DexMethod::get_method("LD;.foo:()V"), nullptr);
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <gtest/gtest.h>
+
+#include "Creators.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "Walkers.h"
+
+struct WalkersTest : testing::Test {
+  WalkersTest() { g_redex = new RedexContext(); }
+
+  ~WalkersTest() { delete g_redex; }
+
+  // A class with `num_methods` methods of two opcodes each, and an abstract
+  // one.
+  static DexClass* make_class(const std::string& name, size_t num_methods) {
+    ClassCreator creator(DexType::make_type(name.c_str()));
+    creator.set_super(get_object_type());
+    creator.set_access(ACC_PUBLIC | ACC_ABSTRACT);
+    for (size_t i = 0; i < num_methods; ++i) {
+      auto method = static_cast<DexMethod*>(DexMethod::make_method(
+          name + ".m" + std::to_string(i) + ":()V"));
+      method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+      method->set_code(assembler::ircode_from_string(R"(
+        (
+         (const v0 0)
+         (return-void)
+        )
+      )"));
+      creator.add_method(method);
+    }
+    auto abstract = static_cast<DexMethod*>(
+        DexMethod::make_method(name + ".abstract:()V"));
+    abstract->make_concrete(ACC_PUBLIC | ACC_ABSTRACT, true);
+    creator.add_method(abstract);
+    return creator.create();
+  }
+
+  struct Counts {
+    size_t methods{0};
+    size_t opcodes{0};
+
+    Counts& operator+=(const Counts& that) {
+      methods += that.methods;
+      opcodes += that.opcodes;
+      return *this;
+    }
+  };
+};
+
+TEST_F(WalkersTest, reduceCodeSumsAllMethods) {
+  // Small classes share chunks, and the large one is split.
+  Scope scope{make_class("LSmall1;", 1),
+              make_class("LSmall2;", 2),
+              make_class("LLarge;", 200)};
+  for (size_t grain_size : {1, 8, 1024}) {
+    auto counts = walk::parallel::reduce_code<Counts>(
+        scope,
+        [](Counts& counts, DexMethod*, IRCode& code) {
+          counts.methods++;
+          counts.opcodes += code.count_opcodes();
+        },
+        grain_size,
+        /* num_threads */ 4);
+    EXPECT_EQ(counts.methods, 203);
+    EXPECT_EQ(counts.opcodes, 406);
+  }
+}
+
+TEST_F(WalkersTest, reduceCodeKeepsOneAccumulatorPerThread) {
+  Scope scope{make_class("LFoo;", 50)};
+  std::atomic<size_t> made{0};
+  auto counts = walk::parallel::reduce_code<Counts>(
+      scope,
+      [](Counts& counts, DexMethod*, IRCode&) { counts.methods++; },
+      [&](unsigned int) {
+        made++;
+        return Counts();
+      },
+      /* grain_size */ 4,
+      /* num_threads */ 3);
+  EXPECT_EQ(made, 3);
+  EXPECT_EQ(counts.methods, 50);
+}
+
+TEST_F(WalkersTest, sizingUpCodeDoesNotAccessIt) {
+  Scope scope{make_class("LFoo;", 10)};
+  auto epoch = DexMethod::advance_code_epoch();
+  std::atomic<size_t> walked{0};
+  walk::parallel::methods(
+      scope, [&](DexMethod*) { walked++; }, /* num_threads */ 2);
+  EXPECT_EQ(walked, 11);
+  for (auto m : scope[0]->get_dmethods()) {
+    EXPECT_NE(epoch, m->get_code_epoch());
+  }
+}
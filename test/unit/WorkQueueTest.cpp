@@ -11,7 +11,10 @@
 
 #include <chrono>
 #include <gtest/gtest.h>
+#include <mutex>
 #include <random>
+#include <set>
+#include <thread>
 
 constexpr unsigned int NUM_STRINGS = 100'000;
 constexpr unsigned int NUM_INTS = 1000;
@@ -103,3 +106,122 @@ TEST(WorkQueueTest, checkDynamicallyAddingTasks) {
   // 10 + 9 + ... + 1 + 0 = 55
   EXPECT_EQ(55, result);
 }
+
+// With a single worker, items with size hints run largest first.
+TEST(WorkQueueTest, sizeHintsOrderItems) {
+  std::vector<int> order;
+  auto wq = workqueue_foreach<int>([&order](int a) { order.push_back(a); }, 1);
+  wq.add_item(1, 1);
+  wq.add_item(3, 300);
+  wq.add_item(2, 20);
+  wq.add_item(4, 4000);
+  wq.run_all();
+  EXPECT_EQ(std::vector<int>({4, 3, 2, 1}), order);
+}
+
+// Every item is processed exactly once, whether the owner or a thief gets it.
+TEST(WorkQueueTest, stealingProcessesEachItemOnce) {
+  constexpr int kNumItems = 100'000;
+  std::vector<std::atomic<int>> counts(kNumItems);
+  auto wq = workqueue_foreach<int>([&counts](int a) { counts[a]++; }, 8);
+  for (int idx = 0; idx < kNumItems; ++idx) {
+    wq.add_item(idx, idx % 97);
+  }
+  wq.run_all();
+  for (int idx = 0; idx < kNumItems; ++idx) {
+    ASSERT_EQ(1, counts[idx]);
+  }
+}
+
+// Items added by a running task are shared with the other workers, even when
+// they had already run out of work by the time the items were added.
+TEST(WorkQueueTest, idleWorkersPickUpDynamicItems) {
+  std::mutex lock;
+  std::set<boost::thread::id> threads;
+  WorkQueue<int, std::nullptr_t, std::nullptr_t>* queue;
+  auto wq = workqueue_foreach<int>(
+      [&](int a) {
+        if (a == 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(50));
+          for (int i = 1; i <= 8; ++i) {
+            queue->add_item(i);
+          }
+          return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::lock_guard<std::mutex> guard(lock);
+        threads.insert(boost::this_thread::get_id());
+      },
+      4);
+  queue = &wq;
+  wq.set_wait_for_dynamic_items(true);
+  wq.add_item(0);
+  wq.run_all();
+  EXPECT_GT(threads.size(), 1);
+}
+
+// Unless asked to wait for dynamic items, a worker that runs out of work
+// returns while the others are still running.
+TEST(WorkQueueTest, idleWorkersReturn) {
+  static std::atomic<int> num_exited{0};
+  struct ExitCounter {
+    ~ExitCounter() { num_exited++; }
+  };
+  std::mutex lock;
+  boost::thread::id quick_thread;
+  std::atomic<bool> quick_done{false};
+  std::atomic<bool> saw_exit{false};
+  auto wq = workqueue_foreach<int>(
+      [&](int a) {
+        if (a == 1) {
+          thread_local ExitCounter counter;
+          (void)counter;
+          std::lock_guard<std::mutex> guard(lock);
+          quick_thread = boost::this_thread::get_id();
+          quick_done = true;
+          return;
+        }
+        while (!quick_done) {
+          std::this_thread::yield();
+        }
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          if (quick_thread == boost::this_thread::get_id()) {
+            // This worker ran both items, so there is no one to wait for.
+            saw_exit = true;
+            return;
+          }
+        }
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (num_exited == 0 && std::chrono::steady_clock::now() < deadline) {
+          std::this_thread::yield();
+        }
+        saw_exit = num_exited > 0;
+      },
+      2);
+  wq.add_item(0);
+  wq.add_item(1);
+  wq.run_all();
+  EXPECT_TRUE(saw_exit);
+}
+
+// With shuffled schedules, the items run in a different order, but each one
+// still runs once.
+TEST(WorkQueueTest, shuffledSchedules) {
+  constexpr int kNumItems = 100;
+  std::vector<int> order;
+  auto wq = workqueue_foreach<int>([&](int a) { order.push_back(a); }, 1);
+  for (int idx = 0; idx < kNumItems; ++idx) {
+    wq.add_item(idx);
+  }
+  workqueue_shuffle_schedules(42);
+  wq.run_all();
+  workqueue_shuffle_schedules(0);
+  ASSERT_EQ(order.size(), kNumItems);
+  EXPECT_FALSE(std::is_sorted(order.begin(), order.end()));
+  std::sort(order.begin(), order.end());
+  for (int idx = 0; idx < kNumItems; ++idx) {
+    EXPECT_EQ(order[idx], idx);
+  }
+}
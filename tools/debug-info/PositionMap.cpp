@@ -8,15 +8,21 @@
  */
 
 #include <boost/scope_exit.hpp>
+#include <cstring>
 #include <fcntl.h>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "PositionMap.h"
 
+PositionMap::~PositionMap() {
+  munmap(m_mapping, m_mapping_size);
+}
+
 std::unique_ptr<PositionMap> read_map(const char* filename) {
   int fd = open(filename, O_RDONLY);
   if (fd == -1) {
@@ -24,24 +30,27 @@ std::unique_ptr<PositionMap> read_map(const char* filename) {
               << ") with error: " << strerror(errno) << std::endl;
     return nullptr;
   }
+  BOOST_SCOPE_EXIT_ALL(=) {
+    close(fd);
+  };
   struct stat buf;
   if (fstat(fd, &buf)) {
     std::cerr << "Cannot fstat file (" << filename
               << ") with error: " << strerror(errno) << std::endl;
     return nullptr;
   }
-  uint8_t* mapping = (uint8_t*)mmap(
+  void* base = mmap(
       nullptr, buf.st_size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
-  uint32_t magic = *(uint32_t*)mapping;
-  mapping += sizeof(uint32_t);
-  if (mapping == MAP_FAILED) {
+  if (base == MAP_FAILED) {
     std::cerr << "mmap failed for file (" << filename
               << ") with error: " << strerror(errno) << std::endl;
     return nullptr;
   }
-  BOOST_SCOPE_EXIT_ALL(=, &buf) {
-    munmap(mapping, buf.st_size);
-  };
+  // Owns the mapping from here on.
+  std::unique_ptr<PositionMap> map(new PositionMap(base, buf.st_size));
+  auto mapping = (const uint8_t*)base;
+  uint32_t magic = *(uint32_t*)mapping;
+  mapping += sizeof(uint32_t);
   if (magic != 0xfaceb000) {
     std::cerr << "Magic number mismatch\n";
     return nullptr;
@@ -53,10 +62,9 @@ std::unique_ptr<PositionMap> read_map(const char* filename) {
     return nullptr;
   }
 
-  std::unique_ptr<PositionMap> map(new PositionMap());
-  std::vector<std::string> string_pool;
   uint32_t spool_count = *(uint32_t*)mapping;
   mapping += sizeof(uint32_t);
+  map->string_pool.reserve(spool_count);
   for (uint32_t i = 0; i < spool_count; ++i) {
     uint32_t ssize = *(uint32_t*)mapping;
     mapping += sizeof(uint32_t);
@@ -65,9 +73,8 @@ std::unique_ptr<PositionMap> read_map(const char* filename) {
   }
   uint32_t pos_count = *(uint32_t*)mapping;
   mapping += sizeof(uint32_t);
-  map->positions.reset(new PositionItem[pos_count]);
+  map->positions = (const PositionItem*)mapping;
   map->positions_size = pos_count;
-  memcpy(map->positions.get(), mapping, pos_count * sizeof(PositionItem));
   return map;
 }
 
@@ -83,3 +90,22 @@ std::vector<Position> get_stack(const PositionMap& map, int64_t idx) {
   }
   return stack;
 }
+
+const PositionMap* PositionMapCache::get(const std::string& filename) {
+  auto it = m_index.find(filename);
+  if (it != m_index.end()) {
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return it->second->second.get();
+  }
+  auto map = read_map(filename.c_str());
+  if (map == nullptr) {
+    return nullptr;
+  }
+  if (m_entries.size() >= m_capacity && !m_entries.empty()) {
+    m_index.erase(m_entries.back().first);
+    m_entries.pop_back();
+  }
+  m_entries.emplace_front(filename, std::move(map));
+  m_index[filename] = m_entries.begin();
+  return m_entries.front().second.get();
+}
@@ -7,8 +7,12 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#pragma once
+
+#include <list>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 struct __attribute__((packed)) PositionItem {
@@ -31,11 +35,44 @@ struct Position {
       : cls(cls), method(method), filename(filename), line(line) {}
 };
 
+/*
+ * The positions are read in place from the mapped file, so loading a map only
+ * costs the string pool.
+ */
 struct PositionMap {
   std::vector<std::string> string_pool;
-  std::unique_ptr<PositionItem[]> positions;
-  size_t positions_size;
+  const PositionItem* positions{nullptr};
+  size_t positions_size{0};
+
+  PositionMap(void* mapping, size_t mapping_size)
+      : m_mapping(mapping), m_mapping_size(mapping_size) {}
+  PositionMap(const PositionMap&) = delete;
+  PositionMap& operator=(const PositionMap&) = delete;
+  ~PositionMap();
+
+ private:
+  void* m_mapping;
+  size_t m_mapping_size;
 };
 
 std::unique_ptr<PositionMap> read_map(const char* filename);
 std::vector<Position> get_stack(const PositionMap& map, int64_t idx);
+
+/*
+ * Keeps the most recently used maps loaded, for symbolicating traces from
+ * many builds in one run.
+ */
+class PositionMapCache {
+ public:
+  explicit PositionMapCache(size_t capacity) : m_capacity(capacity) {}
+
+  // Returns nullptr if the map can't be read.
+  const PositionMap* get(const std::string& filename);
+
+ private:
+  using Entry = std::pair<std::string, std::unique_ptr<PositionMap>>;
+  size_t m_capacity;
+  // Most recently used first.
+  std::list<Entry> m_entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+};
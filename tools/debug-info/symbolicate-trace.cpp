@@ -7,31 +7,112 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
-#include <boost/regex.hpp>
+#include <cctype>
+#include <cstring>
 #include <iostream>
 #include <string>
 
 #include "PositionMap.h"
 
-boost::regex trace_regex(R"/((\s+at\s+[^(]*)\(:(\d+)\)\s?)/");
+namespace {
+
+constexpr size_t k_map_cache_size = 16;
+constexpr const char* k_batch_map_prefix = "#map ";
+
+/*
+ * Matches lines of the form `\s+at\s+[^(]*\(:(\d+)\)\s?`, i.e. a stack frame
+ * whose line number is an index into the position map. On a match, `prefix_len`
+ * is the length of the frame up to the '(' and `idx` the index it refers to.
+ */
+bool scan_trace_line(const std::string& line, size_t* prefix_len, int64_t* idx) {
+  size_t i = 0;
+  size_t n = line.size();
+  auto skip_spaces = [&] {
+    size_t start = i;
+    while (i < n && isspace((unsigned char)line[i])) {
+      ++i;
+    }
+    return i > start;
+  };
+  if (!skip_spaces() || line.compare(i, 2, "at") != 0) {
+    return false;
+  }
+  i += 2;
+  if (!skip_spaces()) {
+    return false;
+  }
+  auto paren = line.find('(', i);
+  if (paren == std::string::npos || paren + 1 >= n || line[paren + 1] != ':') {
+    return false;
+  }
+  i = paren + 2;
+  int64_t value = 0;
+  size_t digits_start = i;
+  while (i < n && isdigit((unsigned char)line[i])) {
+    value = value * 10 + (line[i] - '0');
+    ++i;
+  }
+  if (i == digits_start || i >= n || line[i] != ')') {
+    return false;
+  }
+  ++i;
+  if (i < n && isspace((unsigned char)line[i])) {
+    ++i;
+  }
+  if (i != n) {
+    return false;
+  }
+  *prefix_len = paren;
+  *idx = value;
+  return true;
+}
+
+void symbolicate_line(const PositionMap* map,
+                      const std::string& line,
+                      std::string& out) {
+  size_t prefix_len;
+  int64_t idx;
+  if (map == nullptr || !scan_trace_line(line, &prefix_len, &idx)) {
+    out += line;
+    out += '\n';
+    return;
+  }
+  for (const auto& pos : get_stack(*map, idx - 1)) {
+    out.append(line, 0, prefix_len);
+    out += '(';
+    out += pos.filename;
+    out += ':';
+    out += std::to_string(pos.line);
+    out += ")\n";
+  }
+}
+
+} // namespace
 
 int main(int argc, char** argv) {
   if (argc < 2) {
-    std::cerr << "Usage: cat trace | remap mapping_file\n";
+    std::cerr << "Usage: cat trace | remap mapping_file\n"
+              << "       cat traces | remap --batch\n"
+              << "In batch mode, a line `" << k_batch_map_prefix
+              << "mapping_file` selects the map for the lines after it.\n";
     abort();
   }
-  auto map = read_map(argv[1]);
+  std::ios::sync_with_stdio(false);
+  bool batch = strcmp(argv[1], "--batch") == 0;
+  PositionMapCache cache(k_map_cache_size);
+  const PositionMap* map = batch ? nullptr : cache.get(argv[1]);
+  std::string out;
   for (std::string line; std::getline(std::cin, line);) {
-    boost::smatch matches;
-    if (boost::regex_match(line, matches, trace_regex)) {
-      auto idx = std::stoi(matches[2]) - 1;
-      auto stack = get_stack(*map, idx);
-      for (auto pos : stack) {
-        std::cout << matches[1] << "(" << pos.filename << ":" << pos.line
-                  << ")" << std::endl;
-      }
-    } else {
-      std::cout << line << std::endl;
+    if (batch && line.compare(0, strlen(k_batch_map_prefix),
+                              k_batch_map_prefix) == 0) {
+      map = cache.get(line.substr(strlen(k_batch_map_prefix)));
+      continue;
+    }
+    symbolicate_line(map, line, out);
+    if (out.size() >= (1 << 16)) {
+      std::cout << out;
+      out.clear();
     }
   }
+  std::cout << out;
 }
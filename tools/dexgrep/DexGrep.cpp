@@ -7,33 +7,259 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <getopt.h>
+#include <set>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
 #include "DexCommon.h"
 
+/*
+ * An index file maps the class names of a set of dex files to the
+ * (dex, class_def) that defines them, so that queries don't have to open
+ * the dexes. It is mmapped as is, and laid out as:
+ *
+ *   dexgrep_index_header
+ *   uint32_t dex_names[num_dexes]  offsets of the dex file names
+ *   dexgrep_index_entry entries[num_classes]  sorted by class name
+ *   char strings[strings_size]  NUL terminated names
+ *
+ * The entries hold plain (dex, class_def) numbers rather than a Locator
+ * (see liblocator), whose six bit dex number is too narrow to index
+ * hundreds of dexes. Like the locators, the index is in host byte order.
+ */
+static const char dexgrep_index_magic[4] = {'D', 'G', 'X', '1'};
+
+struct dexgrep_index_header {
+  char magic[4];
+  uint32_t num_dexes;
+  uint32_t num_classes;
+  uint32_t strings_size;
+};
+
+struct dexgrep_index_entry {
+  uint32_t name_off;
+  uint32_t dex;
+  uint32_t class_def;
+};
+
+struct dexgrep_index {
+  const dexgrep_index_header* header;
+  const uint32_t* dex_names;
+  const dexgrep_index_entry* entries;
+  const char* strings;
+
+  const char* dex_name(uint32_t dex) const {
+    return strings + dex_names[dex];
+  }
+  const char* class_name(const dexgrep_index_entry& entry) const {
+    return strings + entry.name_off;
+  }
+};
+
 void print_usage() {
   fprintf(stderr, "Usage: dexgrep <classname> <dexfile 1> <dexfile 2> ...\n");
+  fprintf(stderr,
+          "       dexgrep --build-index <index file> <dexfile 1> ...\n");
+  fprintf(stderr, "       dexgrep --index <index file> <pattern>\n");
+  fprintf(stderr,
+          "A pattern with *, ? or [ wildcards matches whole class names, and\n"
+          "one whose only wildcard is a trailing * is a fast prefix lookup.\n"
+          "Other patterns match substrings of the class names.\n");
+}
+
+void print_match(bool files_only, const char* dexfile, const char* name) {
+  if (files_only) {
+    printf("%s\n", dexfile);
+  } else {
+    printf("%s: %s\n", dexfile, name);
+  }
+}
+
+void build_index(const char* index_file, char** dexfiles, int num_dexfiles) {
+  std::string strings;
+  std::vector<uint32_t> dex_names;
+  std::vector<dexgrep_index_entry> entries;
+  for (int i = 0; i < num_dexfiles; ++i) {
+    ddump_data rd;
+    open_dex_file(dexfiles[i], &rd);
+    dex_names.push_back(strings.size());
+    strings.append(dexfiles[i]).push_back('\0');
+
+    auto size = rd.dexh->class_defs_size;
+    for (uint32_t j = 0; j < size; j++) {
+      dex_class_def* cls_def = rd.dex_class_defs + j;
+      char* name = dex_string_by_type_idx(&rd, cls_def->typeidx);
+      entries.push_back(dexgrep_index_entry{
+          static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(i), j});
+      strings.append(name).push_back('\0');
+    }
+  }
+  std::sort(entries.begin(),
+            entries.end(),
+            [&](const dexgrep_index_entry& a, const dexgrep_index_entry& b) {
+              return strcmp(strings.c_str() + a.name_off,
+                            strings.c_str() + b.name_off) < 0;
+            });
+
+  dexgrep_index_header header;
+  memcpy(header.magic, dexgrep_index_magic, sizeof(header.magic));
+  header.num_dexes = dex_names.size();
+  header.num_classes = entries.size();
+  header.strings_size = strings.size();
+
+  FILE* fh = fopen(index_file, "wb");
+  if (fh == nullptr) {
+    fprintf(stderr, "Cannot open index file %s, bailing\n", index_file);
+    exit(1);
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fh) == 1 &&
+            fwrite(dex_names.data(), sizeof(uint32_t), dex_names.size(), fh) ==
+                dex_names.size() &&
+            fwrite(entries.data(),
+                   sizeof(dexgrep_index_entry),
+                   entries.size(),
+                   fh) == entries.size() &&
+            fwrite(strings.data(), 1, strings.size(), fh) == strings.size();
+  if (fclose(fh) != 0 || !ok) {
+    fprintf(stderr, "Cannot write index file %s, bailing\n", index_file);
+    exit(1);
+  }
+}
+
+dexgrep_index open_index(const char* index_file) {
+  int fd = open(index_file, O_RDONLY);
+  struct stat stat;
+  if (fd < 0 || fstat(fd, &stat)) {
+    fprintf(stderr, "Cannot open index file %s, bailing\n", index_file);
+    exit(1);
+  }
+  size_t size = stat.st_size;
+  if (size < sizeof(dexgrep_index_header)) {
+    fprintf(stderr, "Truncated index file %s, bailing\n", index_file);
+    exit(1);
+  }
+  auto data = (const char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Cannot mmap index file %s, bailing\n", index_file);
+    exit(1);
+  }
+
+  dexgrep_index index;
+  index.header = (const dexgrep_index_header*)data;
+  if (memcmp(index.header->magic,
+             dexgrep_index_magic,
+             sizeof(index.header->magic))) {
+    fprintf(stderr, "Bad index magic, bailing\n");
+    exit(1);
+  }
+  uint64_t expected_size =
+      sizeof(dexgrep_index_header) +
+      uint64_t(index.header->num_dexes) * sizeof(uint32_t) +
+      uint64_t(index.header->num_classes) * sizeof(dexgrep_index_entry) +
+      index.header->strings_size;
+  if (expected_size != size ||
+      (index.header->strings_size > 0 && data[size - 1] != '\0')) {
+    fprintf(stderr, "Corrupt index file %s, bailing\n", index_file);
+    exit(1);
+  }
+  index.dex_names = (const uint32_t*)(index.header + 1);
+  index.entries =
+      (const dexgrep_index_entry*)(index.dex_names + index.header->num_dexes);
+  index.strings = (const char*)(index.entries + index.header->num_classes);
+  return index;
+}
+
+void query_index(const char* index_file, const char* pattern, bool files_only) {
+  auto index = open_index(index_file);
+  auto begin = index.entries;
+  auto end = index.entries + index.header->num_classes;
+
+  std::vector<const dexgrep_index_entry*> matches;
+  size_t len = strlen(pattern);
+  size_t wildcard = strcspn(pattern, "*?[");
+  if (wildcard + 1 == len && pattern[wildcard] == '*') {
+    // A prefix, whose matches are contiguous in the sorted entries.
+    std::string prefix(pattern, wildcard);
+    auto it = std::lower_bound(
+        begin,
+        end,
+        prefix,
+        [&](const dexgrep_index_entry& e, const std::string& p) {
+          return strcmp(index.class_name(e), p.c_str()) < 0;
+        });
+    for (; it != end && strncmp(index.class_name(*it),
+                                prefix.c_str(),
+                                prefix.size()) == 0;
+         ++it) {
+      matches.push_back(it);
+    }
+  } else if (wildcard < len) {
+    for (auto it = begin; it != end; ++it) {
+      if (fnmatch(pattern, index.class_name(*it), 0) == 0) {
+        matches.push_back(it);
+      }
+    }
+  } else {
+    for (auto it = begin; it != end; ++it) {
+      if (strstr(index.class_name(*it), pattern) != nullptr) {
+        matches.push_back(it);
+      }
+    }
+  }
+
+  if (files_only) {
+    std::set<uint32_t> dexes;
+    for (auto entry : matches) {
+      dexes.insert(entry->dex);
+    }
+    for (auto dex : dexes) {
+      printf("%s\n", index.dex_name(dex));
+    }
+    return;
+  }
+  for (auto entry : matches) {
+    print_match(false, index.dex_name(entry->dex), index.class_name(*entry));
+  }
 }
 
 int main(int argc, char* argv[]) {
   bool files_only = false;
-  char c;
+  const char* build_index_file = nullptr;
+  const char* index_file = nullptr;
+  int c;
   static const struct option options[] = {
     { "files-without-match", no_argument, nullptr, 'l' },
+    { "build-index", required_argument, nullptr, 'b' },
+    { "index", required_argument, nullptr, 'i' },
+    { nullptr, 0, nullptr, 0 },
   };
   while ((c = getopt_long(
             argc,
             argv,
-            "hl",
+            "hlb:i:",
             &options[0],
             nullptr)) != -1) {
     switch (c) {
       case 'l':
         files_only = true;
         break;
+      case 'b':
+        build_index_file = optarg;
+        break;
+      case 'i':
+        index_file = optarg;
+        break;
       case 'h':
         print_usage();
         return 0;
@@ -43,6 +269,26 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (build_index_file != nullptr) {
+    if (optind == argc) {
+      fprintf(stderr, "%s: no dex files given\n", argv[0]);
+      print_usage();
+      return 1;
+    }
+    build_index(build_index_file, argv + optind, argc - optind);
+    return 0;
+  }
+
+  if (index_file != nullptr) {
+    if (optind + 1 != argc) {
+      fprintf(stderr, "%s: expected exactly one pattern\n", argv[0]);
+      print_usage();
+      return 1;
+    }
+    query_index(index_file, argv[optind], files_only);
+    return 0;
+  }
+
   if (optind == argc) {
     fprintf(stderr, "%s: no dex files given\n", argv[0]);
     print_usage();
@@ -61,11 +307,7 @@ int main(int argc, char* argv[]) {
       dex_class_def* cls_def = rd.dex_class_defs + j;
       char* name = dex_string_by_type_idx(&rd, cls_def->typeidx);
       if (strstr(name, search_str) != nullptr) {
-        if (files_only) {
-          printf("%s\n", dexfile);
-        } else {
-          printf("%s: %s\n", dexfile, name);
-        }
+        print_match(files_only, dexfile, name);
       }
     }
   }
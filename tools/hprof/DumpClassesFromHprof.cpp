@@ -0,0 +1,455 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+/*
+ * Lists the classes loaded in an android heap dump, in the same format as
+ * dump_classes_from_hprof.py: one "<class name>.class" line per class, array
+ * classes excluded.
+ *
+ * The hprof is mapped rather than read, and only the records that name
+ * classes are decoded: the STRING and LOAD_CLASS records, and the CLASS_DUMP
+ * sub-records of the heap dump. Every other heap dump sub-record is skipped
+ * over by its size. The heap dump segments are independent of each other, so
+ * they are walked in parallel.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+enum HprofTag : uint8_t {
+  STRING = 0x01,
+  LOAD_CLASS = 0x02,
+  HEAP_DUMP = 0x0C,
+  HEAP_DUMP_SEGMENT = 0x1C,
+  HEAP_DUMP_END = 0x2C,
+};
+
+enum HeapTag : uint8_t {
+  ROOT_UNKNOWN = 0xFF,
+  ROOT_JNI_GLOBAL = 0x01,
+  ROOT_JNI_LOCAL = 0x02,
+  ROOT_JAVA_FRAME = 0x03,
+  ROOT_NATIVE_STACK = 0x04,
+  ROOT_STICKY_CLASS = 0x05,
+  ROOT_THREAD_BLOCK = 0x06,
+  ROOT_MONITOR_USED = 0x07,
+  ROOT_THREAD_OBJECT = 0x08,
+  CLASS_DUMP = 0x20,
+  INSTANCE_DUMP = 0x21,
+  OBJECT_ARRAY_DUMP = 0x22,
+  PRIMITIVE_ARRAY_DUMP = 0x23,
+
+  // Android
+  HEAP_DUMP_INFO = 0xFE,
+  ROOT_INTERNED_STRING = 0x89,
+  ROOT_FINALIZING = 0x8A,
+  ROOT_DEBUGGER = 0x8B,
+  ROOT_REFERENCE_CLEANUP = 0x8C,
+  ROOT_VM_INTERNAL = 0x8D,
+  ROOT_JNI_MONITOR = 0x8E,
+  UNREACHABLE = 0x90,
+  PRIMITIVE_ARRAY_NODATA_DUMP = 0xC3,
+};
+
+/*
+ * A big endian cursor over a range of the mapped file.
+ */
+class Reader {
+ public:
+  Reader(const uint8_t* begin, const uint8_t* end, uint32_t id_size)
+      : m_ptr(begin), m_end(end), m_id_size(id_size) {}
+
+  bool has_more() const { return m_ptr < m_end; }
+
+  const uint8_t* pos() const { return m_ptr; }
+
+  uint8_t u1() { return static_cast<uint8_t>(read(1)); }
+  uint16_t u2() { return static_cast<uint16_t>(read(2)); }
+  uint32_t u4() { return static_cast<uint32_t>(read(4)); }
+  uint64_t id() { return read(m_id_size); }
+
+  void skip(uint64_t count) {
+    check(count);
+    m_ptr += count;
+  }
+
+  void skip_ids(uint64_t count) { skip(count * m_id_size); }
+
+  // The size of a value of the given basic type.
+  uint32_t basic_size(uint8_t type) const {
+    switch (type) {
+    case 2: // object
+      return m_id_size;
+    case 4: // boolean
+    case 8: // byte
+      return 1;
+    case 5: // char
+    case 9: // short
+      return 2;
+    case 6: // float
+    case 10: // int
+      return 4;
+    case 7: // double
+    case 11: // long
+      return 8;
+    default:
+      throw std::runtime_error("invalid basic type " + std::to_string(type));
+    }
+  }
+
+ private:
+  void check(uint64_t count) const {
+    if (count > static_cast<uint64_t>(m_end - m_ptr)) {
+      throw std::runtime_error("truncated hprof");
+    }
+  }
+
+  uint64_t read(uint32_t size) {
+    check(size);
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+      value = (value << 8) | m_ptr[i];
+    }
+    m_ptr += size;
+    return value;
+  }
+
+  const uint8_t* m_ptr;
+  const uint8_t* m_end;
+  uint32_t m_id_size;
+};
+
+struct LoadedClass {
+  uint32_t serial;
+  uint64_t name_id;
+};
+
+struct Hprof {
+  uint32_t id_size;
+  // Points into the mapping, which outlives the Hprof.
+  std::unordered_map<uint64_t, std::pair<const char*, size_t>> strings;
+  std::unordered_map<uint64_t, LoadedClass> loaded_classes;
+  std::vector<std::pair<const uint8_t*, const uint8_t*>> heap_dump_segments;
+};
+
+/*
+ * Walks the top level records. The heap dump segments are only located
+ * here, to be walked later.
+ */
+Hprof parse_records(const uint8_t* begin, const uint8_t* end) {
+  auto tag_end =
+      static_cast<const uint8_t*>(memchr(begin, '\0', end - begin));
+  if (tag_end == nullptr) {
+    throw std::runtime_error("missing hprof header");
+  }
+  Hprof hprof;
+  Reader header(tag_end + 1, end, 4);
+  hprof.id_size = header.u4();
+  if (hprof.id_size != 4 && hprof.id_size != 8) {
+    throw std::runtime_error("unsupported id size " +
+                             std::to_string(hprof.id_size));
+  }
+  header.skip(8); // timestamp
+
+  Reader records(header.pos(), end, hprof.id_size);
+  while (records.has_more()) {
+    auto tag = records.u1();
+    records.u4(); // time offset
+    auto length = records.u4();
+    auto body = records.pos();
+    records.skip(length);
+    Reader record(body, body + length, hprof.id_size);
+    switch (tag) {
+    case STRING: {
+      auto string_id = record.id();
+      hprof.strings[string_id] = std::make_pair(
+          reinterpret_cast<const char*>(record.pos()), body + length - record.pos());
+      break;
+    }
+    case LOAD_CLASS: {
+      auto serial = record.u4();
+      auto object_id = record.id();
+      record.u4(); // stack serial
+      auto name_id = record.id();
+      hprof.loaded_classes[object_id] = LoadedClass{serial, name_id};
+      break;
+    }
+    case HEAP_DUMP:
+    case HEAP_DUMP_SEGMENT:
+      hprof.heap_dump_segments.emplace_back(body, body + length);
+      break;
+    case HEAP_DUMP_END:
+      return hprof;
+    default:
+      break;
+    }
+  }
+  return hprof;
+}
+
+/*
+ * Returns the object ids of the classes dumped in one heap dump segment.
+ */
+std::vector<uint64_t> parse_heap_dump_segment(const uint8_t* begin,
+                                              const uint8_t* end,
+                                              uint32_t id_size) {
+  std::vector<uint64_t> classes;
+  Reader reader(begin, end, id_size);
+  while (reader.has_more()) {
+    auto heap_tag = reader.u1();
+    switch (heap_tag) {
+    case ROOT_UNKNOWN:
+    case ROOT_STICKY_CLASS:
+    case ROOT_MONITOR_USED:
+    case ROOT_INTERNED_STRING:
+    case ROOT_FINALIZING:
+    case ROOT_DEBUGGER:
+    case ROOT_REFERENCE_CLEANUP:
+    case ROOT_VM_INTERNAL:
+    case UNREACHABLE:
+      reader.id();
+      break;
+    case ROOT_JNI_GLOBAL:
+      reader.skip_ids(2);
+      break;
+    case ROOT_THREAD_OBJECT:
+    case ROOT_JNI_LOCAL:
+    case ROOT_JNI_MONITOR:
+    case ROOT_JAVA_FRAME:
+      reader.id();
+      reader.skip(8); // thread and stack serials
+      break;
+    case ROOT_NATIVE_STACK:
+    case ROOT_THREAD_BLOCK:
+      reader.id();
+      reader.skip(4); // thread serial
+      break;
+    case HEAP_DUMP_INFO:
+      reader.skip_ids(2);
+      break;
+    case CLASS_DUMP: {
+      classes.push_back(reader.id());
+      reader.skip(4); // stack serial
+      // The super class, class loader, signer, protection domain and two
+      // reserved ids.
+      reader.skip_ids(6);
+      reader.skip(4); // instance size
+      auto const_pool_count = reader.u2();
+      for (uint32_t i = 0; i < const_pool_count; ++i) {
+        reader.skip(2); // constant pool index
+        reader.skip(reader.basic_size(reader.u1()));
+      }
+      auto static_field_count = reader.u2();
+      for (uint32_t i = 0; i < static_field_count; ++i) {
+        reader.id(); // name
+        reader.skip(reader.basic_size(reader.u1()));
+      }
+      auto instance_field_count = reader.u2();
+      for (uint32_t i = 0; i < instance_field_count; ++i) {
+        reader.id(); // name
+        reader.u1(); // type
+      }
+      break;
+    }
+    case INSTANCE_DUMP: {
+      reader.id();
+      reader.skip(4); // stack serial
+      reader.id(); // class
+      reader.skip(reader.u4());
+      break;
+    }
+    case OBJECT_ARRAY_DUMP: {
+      reader.id();
+      reader.skip(4); // stack serial
+      auto length = reader.u4();
+      reader.id(); // array class
+      reader.skip_ids(length);
+      break;
+    }
+    case PRIMITIVE_ARRAY_DUMP: {
+      reader.id();
+      reader.skip(4); // stack serial
+      auto length = reader.u4();
+      reader.skip(static_cast<uint64_t>(length) *
+                  reader.basic_size(reader.u1()));
+      break;
+    }
+    case PRIMITIVE_ARRAY_NODATA_DUMP:
+      reader.id();
+      reader.skip(9); // stack serial, length and type
+      break;
+    default:
+      throw std::runtime_error("unrecognized heap tag " +
+                               std::to_string(heap_tag));
+    }
+  }
+  return classes;
+}
+
+/*
+ * Walks all the heap dump segments on a pool of threads, and returns their
+ * classes in segment order.
+ */
+std::vector<uint64_t> parse_heap_dump(const Hprof& hprof) {
+  const auto& segments = hprof.heap_dump_segments;
+  std::vector<std::vector<uint64_t>> classes(segments.size());
+  std::vector<std::string> errors(segments.size());
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i = next++; i < segments.size(); i = next++) {
+      try {
+        classes[i] = parse_heap_dump_segment(
+            segments[i].first, segments[i].second, hprof.id_size);
+      } catch (const std::exception& e) {
+        errors[i] = e.what();
+      }
+    }
+  };
+  size_t num_threads = std::min<size_t>(
+      segments.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<uint64_t> all_classes;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    if (!errors[i].empty()) {
+      throw std::runtime_error(errors[i]);
+    }
+    all_classes.insert(all_classes.end(), classes[i].begin(), classes[i].end());
+  }
+  return all_classes;
+}
+
+bool ends_with(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/*
+ * Prints the dumped classes, in the order they were loaded.
+ */
+void print_classes(const Hprof& hprof, const std::vector<uint64_t>& classes) {
+  std::vector<std::pair<uint32_t, std::string>> names;
+  std::unordered_set<std::string> seen;
+  for (auto object_id : classes) {
+    auto it = hprof.loaded_classes.find(object_id);
+    if (it == hprof.loaded_classes.end()) {
+      throw std::runtime_error("no LOAD_CLASS record for class dump " +
+                               std::to_string(object_id));
+    }
+    auto str_it = hprof.strings.find(it->second.name_id);
+    if (str_it == hprof.strings.end()) {
+      throw std::runtime_error("no STRING record for class name " +
+                               std::to_string(it->second.name_id));
+    }
+    std::string name(str_it->second.first, str_it->second.second);
+    if (!seen.insert(name).second) {
+      fprintf(stderr, "Warning: duplicate class: %s\n", name.c_str());
+      continue;
+    }
+    if (!ends_with(name, "[]")) {
+      names.emplace_back(it->second.serial, std::move(name));
+    }
+  }
+  std::stable_sort(
+      names.begin(),
+      names.end(),
+      [](const std::pair<uint32_t, std::string>& a,
+         const std::pair<uint32_t, std::string>& b) {
+        return a.first < b.first;
+      });
+  for (const auto& pair : names) {
+    printf("%s.class\n", pair.second.c_str());
+  }
+}
+
+void print_usage() {
+  fprintf(stderr, "Usage: dump-classes-from-hprof --hprof <heap dump>\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const char* hprof_file = nullptr;
+  int c;
+  static const struct option options[] = {
+      {"hprof", required_argument, nullptr, 'f'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+  while ((c = getopt_long(argc, argv, "f:h", &options[0], nullptr)) != -1) {
+    switch (c) {
+    case 'f':
+      hprof_file = optarg;
+      break;
+    case 'h':
+      print_usage();
+      return 0;
+    default:
+      print_usage();
+      return 1;
+    }
+  }
+
+  if (hprof_file == nullptr) {
+    print_usage();
+    return 1;
+  }
+
+  auto fd = open(hprof_file, O_RDONLY);
+  struct stat hprof_stat;
+  if (fd < 0 || fstat(fd, &hprof_stat) != 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", hprof_file, strerror(errno));
+    return 1;
+  }
+  size_t size = hprof_stat.st_size;
+  void* data = size > 0
+                   ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                   : MAP_FAILED;
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Cannot map %s: %s\n", hprof_file, strerror(errno));
+    return 1;
+  }
+
+  int ret = 0;
+  try {
+    auto begin = static_cast<const uint8_t*>(data);
+    auto hprof = parse_records(begin, begin + size);
+    print_classes(hprof, parse_heap_dump(hprof));
+  } catch (const std::exception& e) {
+    fprintf(stderr, "Cannot parse %s: %s\n", hprof_file, e.what());
+    ret = 1;
+  }
+  munmap(data, size);
+  return ret;
+}
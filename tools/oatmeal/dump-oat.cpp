@@ -1451,11 +1451,12 @@ class SamsungLookupTables {
   };
 
   struct LookupTable {
+    LookupTable() = default;
     LookupTable(LookupTable&&) = default;
     LookupTable& operator=(LookupTable&&) = default;
 
     std::unique_ptr<LookupTableEntry[]> data;
-    uint32_t size;
+    uint32_t size{0};
 
     size_t byte_size() const { return size * sizeof(LookupTableEntry); }
   };
@@ -1477,15 +1478,17 @@ class SamsungLookupTables {
       const std::vector<DexInput>& dex_input_vec,
       const std::vector<DexFileListing_064::DexFile_064>& dex_files,
       FileHandle& cksum_fh) {
+    // The tables are built independently of each other, and then written out
+    // in order.
+    auto tables = parallel_map(dex_input_vec.size(), [&](size_t i) {
+      return build_lookup_table(dex_input_vec[i].filename);
+    });
     foreach_pair(
-        dex_input_vec,
+        tables,
         dex_files,
-        [&](const DexInput& dex_input,
+        [&](const LookupTable& table,
             const DexFileListing_064::DexFile_064& dex_file) {
           CHECK(dex_file.lookup_table_offset == cksum_fh.bytes_written());
-
-          auto table = build_lookup_table(dex_input.filename);
-
           auto buf =
               ConstBuffer{reinterpret_cast<const char*>(table.data.get()),
                           table.byte_size()};
@@ -1695,20 +1698,21 @@ class LookupTables {
       const std::vector<DexInput>& dex_input_vec,
       const std::vector<DexFileListing_079::DexFile_079>& dex_files,
       FileHandle& cksum_fh) {
+    CHECK(dex_input_vec.size() == dex_files.size());
+    // The tables are built independently of each other, and then written out
+    // in order.
+    auto tables = parallel_map(dex_input_vec.size(), [&](size_t i) {
+      return build_lookup_table(dex_input_vec[i].filename,
+                                numEntries(dex_files[i].num_classes));
+    });
     foreach_pair(
-        dex_input_vec,
+        tables,
         dex_files,
-        [&](const DexInput& dex_input,
+        [&](const std::unique_ptr<LookupTableEntry[]>& lookup_table_buf,
             const DexFileListing_079::DexFile_079& dex_file) {
           CHECK(dex_file.lookup_table_offset == cksum_fh.bytes_written());
-          const auto num_classes = dex_file.num_classes;
-
-          const auto lookup_table_size = numEntries(num_classes);
           const auto lookup_table_byte_size =
-              lookup_table_size * sizeof(LookupTableEntry);
-
-          auto lookup_table_buf =
-              build_lookup_table(dex_input.filename, lookup_table_size);
+              numEntries(dex_file.num_classes) * sizeof(LookupTableEntry);
           auto buf =
               ConstBuffer{reinterpret_cast<const char*>(lookup_table_buf.get()),
                           lookup_table_byte_size};
@@ -51,6 +51,9 @@ struct Arguments {
 
   bool print_unverified_classes = false;
 
+  // dump a summary of every oat file as json, instead of the full text dump.
+  bool json_summary = false;
+
   std::string arch;
 
   std::string art_image_location;
@@ -97,6 +100,7 @@ Arguments parse_args(int argc, char* argv[]) {
       {"test-is-oatmeal", no_argument, nullptr, 1},
       {"samsung-oatformat", no_argument, nullptr, 2},
       {"one-oat-per-dex", no_argument, nullptr, 3},
+      {"json-summary", no_argument, nullptr, 4},
       {nullptr, 0, nullptr, 0}};
 
   Arguments ret;
@@ -179,6 +183,10 @@ Arguments parse_args(int argc, char* argv[]) {
       ret.one_oat_per_dex = true;
       break;
 
+    case 4:
+      ret.json_summary = true;
+      break;
+
     case ':':
       fprintf(stderr, "ERROR: %s requires an argument\n", argv[optind - 1]);
       exit(1);
@@ -197,6 +205,11 @@ Arguments parse_args(int argc, char* argv[]) {
     exit(1);
   }
 
+  if (ret.action != Action::DUMP && ret.json_summary) {
+    fprintf(stderr, "--json-summary can only be used with -d/--dump\n");
+    exit(1);
+  }
+
   if (dex_locations.size() > 0) {
     if (dex_locations.size() != dex_files.size()) {
       fprintf(
@@ -226,31 +239,17 @@ int dump(const Arguments& args) {
   }
 
   auto const& oat_file_name = args.oat_files[0];
-  auto oat_file = FileHandle(fopen(oat_file_name.c_str(), "r"));
-  if (oat_file.get() == nullptr) {
+  // The parsed structures refer straight into the mapping.
+  MappedFile oat_file(oat_file_name);
+  if (!oat_file.is_mapped()) {
     fprintf(stderr,
-            "failed to open file %s %s\n",
+            "failed to map file %s %s\n",
             oat_file_name.c_str(),
             std::strerror(errno));
     return 1;
   }
 
-  auto oat_file_size = get_filesize(oat_file);
-
-  // We don't run dumping during install on device, so it is allowed to consume
-  // lots of memory.
-  auto oat_file_contents = std::make_unique<char[]>(oat_file_size);
-  auto oatFileBytesRead =
-      fread(oat_file_contents.get(), 1, oat_file_size, oat_file.get());
-  if (oatFileBytesRead != oat_file_size) {
-    fprintf(stderr,
-            "Failed to read file %s (%zd)\n",
-            std::strerror(errno),
-            oatFileBytesRead);
-    return 1;
-  }
-
-  ConstBuffer oatfile_buffer{oat_file_contents.get(), oat_file_size};
+  ConstBuffer oatfile_buffer = oat_file.buffer();
   auto ma_scope = MemoryAccounter::NewScope(oatfile_buffer);
 
   auto oatfile =
@@ -275,6 +274,97 @@ int dump(const Arguments& args) {
   return oatfile->status() == OatFile::Status::PARSE_SUCCESS ? 0 : 1;
 }
 
+const char* status_str(OatFile::Status status) {
+  switch (status) {
+  case OatFile::Status::PARSE_SUCCESS:
+    return "PARSE_SUCCESS";
+  case OatFile::Status::PARSE_UNKNOWN_VERSION:
+    return "PARSE_UNKNOWN_VERSION";
+  case OatFile::Status::PARSE_BAD_MAGIC_NUMBER:
+    return "PARSE_BAD_MAGIC_NUMBER";
+  case OatFile::Status::PARSE_FAILURE:
+    return "PARSE_FAILURE";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+std::string json_str(const std::string& str) {
+  std::string ret = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      ret += buf;
+    } else {
+      ret += c;
+    }
+  }
+  ret += '"';
+  return ret;
+}
+
+// Parses one oat file, and returns its summary as a json object.
+std::string summarize(const std::string& oat_file_name,
+                      const std::vector<DexInput>& dex_files) {
+  std::string ret = "{\"file\": " + json_str(oat_file_name);
+
+  MappedFile oat_file(oat_file_name);
+  if (!oat_file.is_mapped()) {
+    return ret + ", \"error\": " + json_str(std::strerror(errno)) + "}";
+  }
+
+  auto ma_scope = MemoryAccounter::NewScope(oat_file.buffer());
+  auto oatfile = OatFile::parse(oat_file.buffer(), dex_files, false);
+  if (!oatfile) {
+    return ret + ", \"error\": \"cannot open .oat file\"}";
+  }
+
+  ret += ", \"status\": " + json_str(status_str(oatfile->status()));
+  ret += ", \"version\": " + json_str(oatfile->version_string());
+  ret += ", \"samsung\": ";
+  ret += oatfile->is_samsung() ? "true" : "false";
+  ret += ", \"created_by_oatmeal\": ";
+  ret += oatfile->created_by_oatmeal() ? "true" : "false";
+  ret += ", \"dex_files\": [";
+  if (oatfile->status() == OatFile::Status::PARSE_SUCCESS) {
+    bool first = true;
+    for (const auto& dex : oatfile->get_oat_dexfiles()) {
+      ret += first ? "" : ", ";
+      first = false;
+      ret += "{\"location\": " + json_str(dex.location) +
+             ", \"offset\": " + std::to_string(dex.file_offset) +
+             ", \"size\": " + std::to_string(dex.file_size) + "}";
+    }
+  }
+  return ret + "]}";
+}
+
+// Dumps any number of oat files in parallel, printing a json array with a
+// summary of each of them, in the order they were given.
+int dump_json_summary(const Arguments& args) {
+  if (args.oat_files.empty()) {
+    fprintf(stderr, "one or more -o/--oat args required.\n");
+    return 1;
+  }
+
+  auto summaries = parallel_map(args.oat_files.size(), [&](size_t i) {
+    return summarize(args.oat_files[i], args.dex_files);
+  });
+
+  printf("[\n");
+  for (size_t i = 0; i < summaries.size(); i++) {
+    printf("  %s%s\n",
+           summaries[i].c_str(),
+           i + 1 < summaries.size() ? "," : "");
+  }
+  printf("]\n");
+  return 0;
+}
+
 int build(const Arguments& args) {
 
   if (args.dex_files.empty()) {
@@ -322,7 +412,7 @@ int main(int argc, char* argv[]) {
   case Action::BUILD:
     return build(args);
   case Action::DUMP:
-    return dump(args);
+    return args.json_summary ? dump_json_summary(args) : dump(args);
   case Action::NONE:
     fprintf(stderr, "Please specify --dump or --build\n");
     return 1;
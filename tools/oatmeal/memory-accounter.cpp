@@ -126,7 +126,9 @@ class MemoryAccounterImpl : public MemoryAccounter {
   std::vector<Range> consumed_ranges_;
 
   static NilMemoryAccounterImpl nil_accounter_;
-  static std::vector<std::unique_ptr<MemoryAccounter>> accounter_stack_;
+  // Each thread parses its own oat files, with its own scopes.
+  static thread_local std::vector<std::unique_ptr<MemoryAccounter>>
+      accounter_stack_;
 
   void markRangeImpl(uint32_t begin, uint32_t end) {
     CHECK(begin <= end);
@@ -218,7 +220,7 @@ void MultiBufferMemoryAccounter::addBuffer(ConstBuffer buf) {
 }
 
 NilMemoryAccounterImpl MemoryAccounterImpl::nil_accounter_;
-std::vector<std::unique_ptr<MemoryAccounter>>
+thread_local std::vector<std::unique_ptr<MemoryAccounter>>
     MemoryAccounterImpl::accounter_stack_;
 } // namespace
 
@@ -10,7 +10,10 @@
 #include "util.h"
 #include <cerrno>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 size_t FileHandle::fwrite_impl(const void* p, size_t size, size_t count) {
   auto ret = ::fwrite(p, size, count, fh_);
@@ -77,6 +80,32 @@ size_t get_filesize(FileHandle& fh) {
   return dex_stat.st_size;
 }
 
+MappedFile::MappedFile(const std::string& filename) {
+  auto fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    auto len = static_cast<size_t>(file_stat.st_size);
+    auto ptr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      ptr_ = static_cast<const char*>(ptr);
+      len_ = len;
+    }
+  }
+  // The mapping stays valid after the descriptor is closed.
+  auto saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+}
+
+MappedFile::~MappedFile() {
+  if (ptr_ != nullptr) {
+    munmap(const_cast<char*>(ptr_), len_);
+  }
+}
+
 void stream_file(FileHandle& in, FileHandle& out) {
   constexpr int kBufSize = 0x80000;
   std::unique_ptr<char[]> buf(new char[kBufSize]);
@@ -9,10 +9,13 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -43,6 +46,30 @@ static void foreach_pair(const T1& t1, const T2& t2, const L& fn) {
   }
 }
 
+// Calls fn(i) for every i in [0, n) on a pool of threads, and returns the
+// results in order of i. fn's result type must be default constructible.
+template <typename L>
+auto parallel_map(size_t n, const L& fn) -> std::vector<decltype(fn(n))> {
+  std::vector<decltype(fn(n))> results(n);
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i = next++; i < n; i = next++) {
+      results[i] = fn(i);
+    }
+  };
+  const size_t num_threads = std::min<size_t>(
+      n, std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
 template <uint32_t Width>
 uint32_t align(uint32_t in) {
   return (in + (Width - 1)) & -Width;
@@ -173,6 +200,25 @@ class FileHandle {
   FILE* fh_;
 };
 
+// A read-only mapping of a whole file. The buffer points straight into the
+// mapping, so it is only valid for the lifetime of the MappedFile.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename);
+  UNCOPYABLE(MappedFile);
+  ~MappedFile();
+
+  // Whether the file could be opened and mapped. errno is left as set by
+  // the failing call otherwise.
+  bool is_mapped() const { return ptr_ != nullptr; }
+
+  ConstBuffer buffer() const { return ConstBuffer{ptr_, len_}; }
+
+ private:
+  const char* ptr_ = nullptr;
+  size_t len_ = 0;
+};
+
 void write_word(FileHandle& fh, uint32_t value);
 
 void write_buf(FileHandle& fh, ConstBuffer buf);
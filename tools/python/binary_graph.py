@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2016-present, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree. An additional grant
+# of patent rights can be found in the PATENTS file in the same directory.
+
+"""
+Reads the graphs written in the format of libredex/BinaryGraph.h, like the
+"ref_output_filename" of CreateReferenceGraphPass and the
+"binary_output_file_name" of ReachabilityGraphPrinterPass.
+
+The file is mmapped and its arrays are used in place, so opening even a graph
+with millions of nodes is instant. Only the reverse edges and the name index
+are built, the first time they are needed.
+
+    graph = BinaryGraph("reachability.bin")
+    node = graph.find("Lcom/foo/Bar;")[0]
+    for pred, kind in graph.predecessors(node):
+        print(graph.describe(pred))
+"""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+from __future__ import unicode_literals
+
+import argparse
+import mmap
+import struct
+from collections import deque
+
+MAGIC = b"RDXGRAPH"
+VERSION = 1
+
+NODE_KINDS = ["CLASS", "TYPE", "METHOD", "FIELD", "ANNO", "SEED"]
+
+# The edge kinds of CreateReferenceGraphPass, a mask of the ways a class refers
+# to a type. The edges of ReachabilityGraphPrinterPass are all 0, from the
+# retainer to what it retains.
+REF_KINDS = [
+    (1, "annotation"),
+    (2, "class_structure"),
+    (4, "code"),
+    (8, "anywhere"),
+]
+
+HEADER = struct.Struct("<8sIIQQ")
+
+
+def _align(offset):
+    return (offset + 7) & ~7
+
+
+class BinaryGraph:
+    def __init__(self, file_name):
+        with open(file_name, "rb") as f:
+            self._mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, num_nodes, num_edges, strings_size = \
+            HEADER.unpack_from(self._mm, 0)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError(
+                "{} is not a graph of version {}".format(file_name, VERSION)
+            )
+        self.num_nodes = num_nodes
+        self.num_edges = num_edges
+
+        view = memoryview(self._mm)
+        pos = _align(HEADER.size)
+
+        def section(size, fmt):
+            nonlocal pos
+            s = view[pos:pos + size]
+            pos = _align(pos + size)
+            return s.cast(fmt) if fmt != "B" else s
+
+        # kind, name, label for each node.
+        self._nodes = section(num_nodes * 12, "I")
+        self._offsets = section((num_nodes + 1) * 8, "Q")
+        self._targets = section(num_edges * 4, "I")
+        self._kinds = section(num_edges, "B")
+        self._strings_start = pos
+        self._strings_end = pos + strings_size
+
+        self._rev_offsets = None
+        self._rev_sources = None
+        self._rev_kinds = None
+        self._by_name = None
+
+    def _string(self, offset):
+        start = self._strings_start + offset
+        end = self._mm.find(b"\0", start, self._strings_end)
+        return self._mm[start:end].decode("utf-8", errors="replace")
+
+    def kind(self, node):
+        return NODE_KINDS[self._nodes[node * 3]]
+
+    def name(self, node):
+        return self._string(self._nodes[node * 3 + 1])
+
+    def label(self, node):
+        return self._string(self._nodes[node * 3 + 2])
+
+    def describe(self, node):
+        label = self.label(node)
+        return "[{}] {}{}".format(
+            self.kind(node), self.name(node), " (" + label + ")" if label else ""
+        )
+
+    def successors(self, node):
+        """ The (target, edge kind) pairs of the edges out of node """
+        begin, end = self._offsets[node], self._offsets[node + 1]
+        return list(zip(self._targets[begin:end], self._kinds[begin:end]))
+
+    def _build_reverse(self):
+        counts = [0] * (self.num_nodes + 1)
+        for target in self._targets:
+            counts[target + 1] += 1
+        for i in range(self.num_nodes):
+            counts[i + 1] += counts[i]
+        sources = [0] * self.num_edges
+        kinds = [0] * self.num_edges
+        fill = counts[:-1]
+        offsets = self._offsets
+        for source in range(self.num_nodes):
+            for e in range(offsets[source], offsets[source + 1]):
+                target = self._targets[e]
+                sources[fill[target]] = source
+                kinds[fill[target]] = self._kinds[e]
+                fill[target] += 1
+        self._rev_offsets = counts
+        self._rev_sources = sources
+        self._rev_kinds = kinds
+
+    def predecessors(self, node):
+        """ The (source, edge kind) pairs of the edges into node """
+        if self._rev_offsets is None:
+            self._build_reverse()
+        begin, end = self._rev_offsets[node], self._rev_offsets[node + 1]
+        return list(
+            zip(self._rev_sources[begin:end], self._rev_kinds[begin:end])
+        )
+
+    def find(self, name):
+        """ All the nodes with that name """
+        if self._by_name is None:
+            self._by_name = {}
+            for node in range(self.num_nodes):
+                self._by_name.setdefault(self.name(node), []).append(node)
+        return self._by_name.get(name, [])
+
+    def shortest_path(self, sources, target, reverse=False):
+        """
+        The shortest path from any of sources to target, following the edges
+        backwards if reverse, or None.
+        """
+        edges = self.predecessors if reverse else self.successors
+        parent = {source: None for source in sources}
+        queue = deque(sources)
+        while queue:
+            node = queue.popleft()
+            if node == target:
+                path = []
+                while node is not None:
+                    path.append(node)
+                    node = parent[node]
+                return path[::-1]
+            for succ, _ in edges(node):
+                if succ not in parent:
+                    parent[succ] = node
+                    queue.append(succ)
+        return None
+
+
+def ref_kinds_str(kind):
+    return "|".join(name for bit, name in REF_KINDS if kind & bit) or "0"
+
+
+def main(args):
+    graph = BinaryGraph(args.graph)
+    print("{} nodes, {} edges".format(graph.num_nodes, graph.num_edges))
+    for name in args.show or []:
+        for node in graph.find(name):
+            print(graph.describe(node))
+            for succ, kind in graph.successors(node):
+                print("  -> {} [{}]".format(graph.describe(succ),
+                                           ref_kinds_str(kind)))
+            for pred, kind in graph.predecessors(node):
+                print("  <- {} [{}]".format(graph.describe(pred),
+                                           ref_kinds_str(kind)))
+    for name in args.why or []:
+        # Walks back from the node to a seed, i.e. a node nothing points to.
+        for node in graph.find(name):
+            seeds = [
+                n for n in range(graph.num_nodes) if graph.kind(n) == "SEED"
+            ]
+            path = graph.shortest_path(seeds, node)
+            if path is None:
+                print("{} is not reachable".format(graph.describe(node)))
+                continue
+            print("{} is reachable via".format(graph.describe(node)))
+            for n in reversed(path[:-1]):
+                print("  " + graph.describe(n))
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        description=__doc__,
+    )
+    parser.add_argument("graph", help="Binary graph written by a pass")
+    parser.add_argument(
+        "--show",
+        action="append",
+        help="Print the edges into and out of the nodes with this name",
+    )
+    parser.add_argument(
+        "--why",
+        action="append",
+        help="Print how the nodes with this name are reached from a seed",
+    )
+    return parser.parse_args()
+
+
+if __name__ == "__main__":
+    main(parse_args())
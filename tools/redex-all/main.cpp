@@ -7,8 +7,11 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <set>
@@ -23,11 +26,13 @@
 #ifdef _MSC_VER
 #include <io.h>
 #else
+#include <sys/wait.h>
 #include <unistd.h>
 #endif
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
 #ifdef __GNUC__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
@@ -38,6 +43,8 @@
 #endif
 #include <json/json.h>
 
+#include "Arena.h"
+#include "AsyncIO.h"
 #include "CommentFilter.h"
 #include "Debug.h"
 #include "DexClass.h"
@@ -45,14 +52,21 @@
 #include "DexOutput.h"
 #include "InstructionLowering.h"
 #include "JarLoader.h"
+#include "MethodProfiler.h"
+#include "MethodShards.h"
 #include "PassManager.h"
 #include "PassRegistry.h"
+#include "ProgramHash.h"
+#include "ProgramSnapshot.h"
 #include "ProguardConfiguration.h" // New ProGuard configuration
 #include "ProguardParser.h" // New ProGuard Parser
 #include "ReachableClasses.h"
 #include "RedexContext.h"
+#include "ThreadPool.h"
+#include "Timeline.h"
 #include "Timer.h"
 #include "Warning.h"
+#include "WorkQueue.h"
 
 namespace {
 const std::string k_usage_header = "usage: redex-all [options...] dex-files...";
@@ -69,6 +83,11 @@ struct Arguments {
   std::string out_dir;
   std::vector<std::string> dex_files;
   bool verify_none_mode{false};
+  size_t bench_runs{0};
+  std::string bench_pass;
+  bool determinism_check{false};
+  std::string shard_worker_dir;
+  size_t shard{0};
 };
 
 UNUSED void dump_args(const Arguments& args) {
@@ -196,6 +215,40 @@ Arguments parse_args(int argc, char* argv[]) {
   od.add_options()("printseeds,q",
                    po::value<std::vector<std::string>>(),
                    "file to report seeds computed by redex");
+  od.add_options()("trace-timeline",
+                   po::value<std::vector<std::string>>(),
+                   "file in the output directory to write a Chrome trace of "
+                   "the timers and work queue threads to\n"
+                   "  \tLoad it in chrome://tracing or Perfetto.");
+  od.add_options()("snapshot-after",
+                   po::value<std::vector<std::string>>(),
+                   "write a snapshot of the program after this pass, from "
+                   "which --restore-snapshot resumes");
+  od.add_options()("memory-census-after",
+                   po::value<std::vector<std::string>>(), // Accumulation
+                   "count the objects of the program model and the memory "
+                   "they take after this pass, into the stats of the pass\n"
+                   "  \tEither a pass, for all of its runs, or one of its "
+                   "runs, like \"Pass#2\". Can be given more than once.");
+  od.add_options()("snapshot-dir",
+                   po::value<std::vector<std::string>>(),
+                   "directory to write the --snapshot-after snapshot to");
+  od.add_options()("restore-snapshot",
+                   po::value<std::vector<std::string>>(),
+                   "load the program from the snapshot in this directory "
+                   "instead of from dex files, and resume with the pass "
+                   "after the one it was taken after\n"
+                   "  \tThe config and ProGuard rules should be the same "
+                   "as when the snapshot was taken. Snapshots written by "
+                   "--intermediate-output start over with the first pass "
+                   "of this run's config instead.");
+  od.add_options()("intermediate-output",
+                   po::value<std::vector<std::string>>(),
+                   "write the optimized program to this directory as a "
+                   "snapshot instead of as dex files, for a later stage "
+                   "to load with --restore-snapshot\n"
+                   "  \tThe code is not lowered, so virtual registers, "
+                   "positions and keep state carry over to that stage.");
   od.add_options()("warn,w",
                    po::value<std::vector<int>>(),
                    "warning level:\n"
@@ -208,6 +261,35 @@ Arguments parse_args(int argc, char* argv[]) {
       "run redex in verify-none mode\n"
       "  \tThis will activate optimization passes or code in some passes that "
       "wouldn't normally operate with verification enabled.");
+  od.add_options()(
+      "bench",
+      po::value<size_t>(&args.bench_runs),
+      "run the pass pipeline this many times, each time on the inputs as "
+      "they were loaded, and report the wall time of each pass instead of "
+      "writing any output");
+  od.add_options()(
+      "bench-pass",
+      po::value<std::string>(&args.bench_pass),
+      "only benchmark this pass: run the passes before it once, and then run "
+      "it --bench times (5 by default) on the state they left");
+  od.add_options()(
+      "determinism-check",
+      po::bool_switch(&args.determinism_check)->default_value(false),
+      "run the pass pipeline once per thread count of the "
+      "\"determinism_check_jobs\" config, 1 and the number of CPUs by "
+      "default, with the work queues scheduling their items at random, and "
+      "report the first pass after which the runs disagree on the program, "
+      "or the first dex file they write differently, instead of writing any "
+      "output");
+  od.add_options()(
+      "shard-worker",
+      po::value<std::string>(&args.shard_worker_dir),
+      "run the passes of a directory of method shards that a run with the "
+      "\"sharded_passes\" config wrote, on the shard given by --shard, "
+      "instead of optimizing any dex files");
+  od.add_options()("shard",
+                   po::value<size_t>(&args.shard),
+                   "the shard for --shard-worker to run the passes on");
   od.add_options()(",S",
                    po::value<std::vector<std::string>>(), // Accumulation
                    "-Skey=string\n"
@@ -267,7 +349,7 @@ Arguments parse_args(int argc, char* argv[]) {
 
   if (vm.count("dex-files")) {
     args.dex_files = vm["dex-files"].as<std::vector<std::string>>();
-  } else {
+  } else if (!vm.count("restore-snapshot") && !vm.count("shard-worker")) {
     std::cerr << "error: no input dex files" << std::endl << std::endl;
     print_usage();
     exit(EXIT_SUCCESS);
@@ -320,6 +402,36 @@ Arguments parse_args(int argc, char* argv[]) {
     args.config["printseeds"] = take_last(vm["printseeds"]);
   }
 
+  if (vm.count("trace-timeline")) {
+    args.config["trace_timeline"] = take_last(vm["trace-timeline"]);
+  }
+
+  if (vm.count("snapshot-after")) {
+    args.config["snapshot_after_pass"] = take_last(vm["snapshot-after"]);
+  }
+
+  if (vm.count("memory-census-after")) {
+    Json::Value passes(Json::arrayValue);
+    for (const auto& name :
+         vm["memory-census-after"].as<std::vector<std::string>>()) {
+      passes.append(name);
+    }
+    args.config["memory_census_after_passes"] = passes;
+  }
+
+  if (vm.count("snapshot-dir")) {
+    args.config["snapshot_dir"] = take_last(vm["snapshot-dir"]);
+  }
+
+  if (vm.count("restore-snapshot")) {
+    args.config["restore_snapshot"] = take_last(vm["restore-snapshot"]);
+  }
+
+  if (vm.count("intermediate-output")) {
+    args.config["intermediate_output_dir"] =
+        take_last(vm["intermediate-output"]);
+  }
+
   if (vm.count("-S")) {
     for (auto& key_value : vm["-S"].as<std::vector<std::string>>()) {
       if (!add_value_to_config(args.config, key_value, false)) {
@@ -367,19 +479,58 @@ Json::Value get_stats(const dex_stats_t& stats) {
   val["num_annotations"] = stats.num_annotations;
   val["num_bytes"] = stats.num_bytes;
   val["num_instructions"] = stats.num_instructions;
+  val["num_hot_code_bytes"] = stats.num_hot_code_bytes;
+  val["num_hot_string_pages"] = stats.num_hot_string_pages;
   return val;
 }
 
 Json::Value get_pass_stats(const PassManager& mgr) {
   Json::Value all(Json::ValueType::objectValue);
   for (const auto& pass_info : mgr.get_pass_info()) {
-    if (pass_info.metrics.empty()) {
+    if (pass_info.metrics.empty() && pass_info.memory_census.isNull()) {
       continue;
     }
     Json::Value pass;
     for (const auto& pass_metric : pass_info.metrics) {
       pass[pass_metric.first] = pass_metric.second;
     }
+    const auto& profile = pass_info.profile;
+    Json::Value prof;
+    prof["wall_time_s"] = std::round(profile.wall_s * 1000) / 1000.0;
+    prof["cpu_time_s"] = std::round(profile.cpu_s * 1000) / 1000.0;
+    prof["peak_rss_kb"] = Json::Int64(profile.peak_rss_kb);
+    prof["rss_delta_kb"] = Json::Int64(profile.rss_delta_kb);
+    if (profile.methods_touched >= 0) {
+      prof["methods_touched"] = Json::Int64(profile.methods_touched);
+    }
+    if (profile.allocations >= 0) {
+      prof["allocations"] = Json::Int64(profile.allocations);
+    }
+    if (profile.scratch_kb > 0) {
+      prof["scratch_kb"] = Json::Int64(profile.scratch_kb);
+    }
+    if (profile.huge_pages_kb >= 0) {
+      prof["huge_pages_kb"] = Json::Int64(profile.huge_pages_kb);
+    }
+    if (!profile.allocation_sites.empty()) {
+      Json::Value sites(Json::arrayValue);
+      for (const auto& site : profile.allocation_sites) {
+        Json::Value entry;
+        entry["count"] = Json::UInt64(site.count);
+        entry["bytes"] = Json::UInt64(site.bytes);
+        Json::Value backtrace(Json::arrayValue);
+        for (const auto& frame : site.backtrace) {
+          backtrace.append(frame);
+        }
+        entry["backtrace"] = backtrace;
+        sites.append(entry);
+      }
+      prof["allocation_sites"] = sites;
+    }
+    pass["profile"] = prof;
+    if (!pass_info.memory_census.isNull()) {
+      pass["memory_census"] = pass_info.memory_census;
+    }
     all[pass_info.name] = pass;
   }
   return all;
@@ -419,6 +570,199 @@ Json::Value get_input_stats(const dex_stats_t& stats,
   return d;
 }
 
+// The wall times of each pass over several runs, in pipeline order.
+using BenchTimes = std::vector<std::pair<std::string, std::vector<double>>>;
+
+void print_bench_times(const BenchTimes& times) {
+  printf("%-40s %6s %10s %10s %10s\n",
+         "pass",
+         "runs",
+         "min (s)",
+         "median (s)",
+         "max (s)");
+  for (const auto& pass_times : times) {
+    auto sorted = pass_times.second;
+    if (sorted.empty()) {
+      continue;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    double median = n % 2 == 1 ? sorted[n / 2]
+                               : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    printf("%-40s %6zu %10.3f %10.3f %10.3f\n",
+           pass_times.first.c_str(),
+           n,
+           sorted.front(),
+           median,
+           sorted.back());
+  }
+}
+
+#ifdef _POSIX_VERSION
+/*
+ * Calls run in a forked process, so that it starts from the inputs as they
+ * were loaded rather than from what an earlier run left, and returns the
+ * (name, value) pairs it returned, as strings.
+ */
+std::vector<std::pair<std::string, std::string>> run_forked(
+    const std::function<std::vector<std::pair<std::string, std::string>>()>&
+        run,
+    const std::string& what) {
+  int fds[2];
+  always_assert_log(pipe(fds) == 0, "Failed to create a pipe");
+  fflush(nullptr);
+  auto child = fork();
+  always_assert_log(child != -1, "Failed to fork");
+  if (child == 0) {
+    close(fds[0]);
+    std::string report;
+    for (const auto& pair : run()) {
+      report += pair.first + '\t' + pair.second + '\n';
+    }
+    always_assert(write(fds[1], report.data(), report.size()) ==
+                  static_cast<ssize_t>(report.size()));
+    fflush(nullptr);
+    _exit(EXIT_SUCCESS);
+  }
+  close(fds[1]);
+  std::string report;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+    report.append(buf, n);
+  }
+  close(fds[0]);
+  int status;
+  waitpid(child, &status, 0);
+  always_assert_log(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS,
+                    "%s failed",
+                    what.c_str());
+  std::vector<std::pair<std::string, std::string>> pairs;
+  std::istringstream lines(report);
+  for (std::string line; std::getline(lines, line);) {
+    auto tab = line.find('\t');
+    pairs.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+  }
+  return pairs;
+}
+#endif
+
+/*
+ * Calls run_pipeline `runs` times and collects the (pass, wall time) pairs it
+ * returns. Each call is in a forked process.
+ */
+BenchTimes bench_pipeline(
+    size_t runs,
+    const std::function<std::vector<std::pair<std::string, double>>()>&
+        run_pipeline) {
+  BenchTimes times;
+#ifdef _POSIX_VERSION
+  for (size_t i = 0; i < runs; ++i) {
+    auto pairs = run_forked(
+        [&] {
+          std::vector<std::pair<std::string, std::string>> pairs;
+          for (const auto& pass_time : run_pipeline()) {
+            pairs.emplace_back(pass_time.first,
+                               std::to_string(pass_time.second));
+          }
+          return pairs;
+        },
+        "Benchmark run " + std::to_string(i));
+    for (size_t k = 0; k < pairs.size(); ++k) {
+      if (k == times.size()) {
+        times.emplace_back(pairs[k].first, std::vector<double>());
+      }
+      times[k].second.push_back(std::stod(pairs[k].second));
+    }
+  }
+#else
+  fprintf(stderr, "bench_pipeline() is a no-op");
+#endif
+  return times;
+}
+
+// The hash of the program after each pass, then of each dex file written,
+// in order.
+using PipelineHashes = std::vector<std::pair<std::string, std::string>>;
+
+/*
+ * Calls run_pipeline once per thread count of `jobs`, each in a forked
+ * process, and compares the hashes the runs return. Prints the first pass or
+ * dex file whose hashes differ and returns false, or returns true if all the
+ * runs agree.
+ */
+bool check_determinism(
+    const std::vector<unsigned>& jobs,
+    const std::function<PipelineHashes(size_t run)>& run_pipeline) {
+#ifdef _POSIX_VERSION
+  std::vector<PipelineHashes> runs;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    fprintf(stderr, "Determinism check: running with %u threads\n", jobs[i]);
+    runs.push_back(run_forked([&] { return run_pipeline(i); },
+                              "Determinism check run " + std::to_string(i)));
+  }
+  // The first pass or dex file where some run differs from the first one.
+  size_t first = runs[0].size();
+  size_t other = 0;
+  for (size_t i = 1; i < runs.size(); ++i) {
+    auto k = std::mismatch(runs[0].begin(),
+                           runs[0].end(),
+                           runs[i].begin(),
+                           runs[i].end())
+                 .first -
+             runs[0].begin();
+    if (k < first || (k == first && runs[i].size() != runs[0].size())) {
+      first = k;
+      other = i;
+    }
+  }
+  if (other != 0) {
+    // Only a run that failed to hash a pass or to write a dex file ends
+    // early.
+    const auto& name = first < runs[0].size() ? runs[0][first].first
+                                              : runs[other][first].first;
+    fprintf(stderr,
+            "Determinism check: the runs with %u and %u threads differ "
+            "after %s\n",
+            jobs[0],
+            jobs[other],
+            name.c_str());
+    for (size_t i : {size_t(0), other}) {
+      fprintf(stderr,
+              "  %3u threads: %s\n",
+              jobs[i],
+              first < runs[i].size() ? runs[i][first].second.c_str()
+                                     : "(none)");
+    }
+    fprintf(stderr,
+            "The hashes of the program are of the class order, what the "
+            "classes declare, and their code.\n");
+    return false;
+  }
+  fprintf(stderr,
+          "Determinism check: %zu runs agree on %zu passes and dex files\n",
+          runs.size(),
+          runs[0].size());
+#else
+  fprintf(stderr, "check_determinism() is a no-op");
+#endif
+  return true;
+}
+
+Json::Value get_slowest_methods() {
+  Json::Value list(Json::arrayValue);
+  for (const auto& sample : method_profiler::slowest()) {
+    Json::Value element;
+    element["pass"] = sample.phase;
+    element["method"] = sample.method;
+    element["seconds"] = std::round(sample.seconds * 1000) / 1000.0;
+    element["instructions"] = Json::UInt64(sample.instructions);
+    element["blocks"] = Json::UInt64(sample.blocks);
+    list.append(element);
+  }
+  return list;
+}
+
 Json::Value get_output_stats(
     const dex_stats_t& stats,
     const std::vector<dex_stats_t>& dexes_stats,
@@ -428,7 +772,15 @@ Json::Value get_output_stats(
   d["total_stats"] = get_stats(stats);
   d["dexes_stats"] = get_detailed_stats(dexes_stats);
   d["pass_stats"] = get_pass_stats(mgr);
+  // Tells apart the runs to compare the pass profiles of.
+  Json::Value placement;
+  placement["arena_huge_pages"] = Arena::huge_pages();
+  placement["numa_nodes"] = Json::UInt64(mgr.get_thread_pool().num_nodes());
+  d["memory_placement"] = placement;
   d["lowering_stats"] = get_lowering_stats(instruction_lowering_stats);
+  if (method_profiler::enabled()) {
+    d["slowest_methods"] = get_slowest_methods();
+  }
   return d;
 }
 
@@ -466,6 +818,104 @@ void output_moved_methods_map(const char* path, ConfigFiles& cfg) {
     TRACE(MAIN, 1, "No method move map data structure!\n");
   }
 }
+
+/*
+ * With a writer, the files are only complete once it has been flushed.
+ */
+void write_dexes(const Arguments& args,
+                 ConfigFiles& cfg,
+                 DexStoresVector& stores,
+                 PositionMapper* pos_mapper,
+                 dex_stats_t* output_totals,
+                 std::vector<dex_stats_t>* output_dexes_stats,
+                 async_io::AsyncWriter* writer) {
+  TRACE(MAIN, 1, "Writing out new DexClasses...\n");
+
+  LocatorIndex* locator_index = nullptr;
+  if (args.config.get("emit_locator_strings", false).asBool()) {
+    TRACE(LOC,
+          1,
+          "Will emit class-locator strings for classloader optimization\n");
+    locator_index = new LocatorIndex(make_locator_index(stores));
+  }
+  if (args.config.get("emit_locator_table", false).asBool()) {
+    auto path = args.out_dir + "/class-locators.bin";
+    TRACE(LOC, 1, "Writing the class-locator table to %s\n", path.c_str());
+    auto table = locator_index != nullptr
+                     ? make_locator_table(*locator_index)
+                     : make_locator_table(make_locator_index(stores));
+    if (writer != nullptr) {
+      writer->write(path, std::move(table));
+    } else {
+      std::ofstream out(path, std::ios::binary);
+      out.write(table.data(), table.size());
+      always_assert_log(out.good(), "Cannot write %s", path.c_str());
+    }
+  }
+
+  std::vector<std::vector<DexOutputTarget>> store_targets;
+  for (auto& store : stores) {
+    std::vector<DexOutputTarget> targets;
+    for (size_t i = 0; i < store.get_dexen().size(); i++) {
+      std::stringstream ss;
+      ss << args.out_dir << "/" << store.get_name();
+      if (store.get_name().compare("classes") == 0) {
+        // primary/secondary dex store, primary has no numeral and secondaries
+        // start at 2
+        if (i > 0) {
+          ss << (i + 1);
+        }
+      } else {
+        // other dex stores do not have a primary,
+        // so it makes sense to start at 2
+        ss << (i + 2);
+      }
+      ss << ".dex";
+      targets.push_back({ss.str(), &store.get_dexen()[i], i});
+    }
+    store_targets.push_back(std::move(targets));
+  }
+  if (args.config.get("parallel_dex_output", false).asBool()) {
+    Timer t("Writing optimized dexes");
+    std::vector<DexOutputTarget> all_targets;
+    for (const auto& targets : store_targets) {
+      all_targets.insert(all_targets.end(), targets.begin(), targets.end());
+    }
+    auto num_threads =
+        args.config
+            .get("parallel_dex_output_threads",
+                 std::max(1u, boost::thread::hardware_concurrency()))
+            .asUInt();
+    auto all_dexes_stats = write_classes_to_dexes(all_targets,
+                                                  locator_index,
+                                                  cfg,
+                                                  args.config,
+                                                  pos_mapper,
+                                                  std::max(1u, num_threads),
+                                                  writer);
+    for (const auto& this_dex_stats : all_dexes_stats) {
+      *output_totals += this_dex_stats;
+      output_dexes_stats->push_back(this_dex_stats);
+    }
+  } else {
+    for (const auto& targets : store_targets) {
+      Timer t("Writing optimized dexes");
+      for (const auto& target : targets) {
+        auto this_dex_stats = write_classes_to_dex(target.filename,
+                                                   target.classes,
+                                                   locator_index,
+                                                   target.dex_number,
+                                                   cfg,
+                                                   args.config,
+                                                   pos_mapper,
+                                                   writer);
+        *output_totals += this_dex_stats;
+        output_dexes_stats->push_back(this_dex_stats);
+      }
+    }
+  }
+}
+
 } // namespace
 
 int main(int argc, char* argv[]) {
@@ -476,6 +926,7 @@ int main(int argc, char* argv[]) {
 #endif
 
   std::string stats_output_path;
+  std::string timeline_output_path;
   Json::Value stats;
   {
     Timer redex_all_main_timer("redex-all main()");
@@ -493,6 +944,15 @@ int main(int argc, char* argv[]) {
     // TODO: Make the command line -jarpath option like a colon separated
     //       list of library JARS.
     Arguments args = parse_args(argc, argv);
+    // Before the program is loaded, so that the arenas of g_redex grow in
+    // huge pages.
+    Arena::set_huge_pages(args.config.get("arena_huge_pages", false).asBool());
+    if (!args.shard_worker_dir.empty()) {
+      return method_shards::run_worker(args.shard_worker_dir, args.shard);
+    }
+    if (!args.config.get("trace_timeline", "").asString().empty()) {
+      timeline::enable();
+    }
 
     if (!dir_is_writable(args.out_dir)) {
       std::cerr << "error: outdir is not a writable directory: " << args.out_dir
@@ -504,9 +964,10 @@ int main(int argc, char* argv[]) {
         args.config.get("next_release_gate", false).asBool());
 
     redex::ProguardConfiguration pg_config;
-    for (const auto pg_config_path : args.proguard_config_paths) {
-      Timer time_pg_parsing("Parsed ProGuard config file");
-      redex::proguard_parser::parse_file(pg_config_path, &pg_config);
+    {
+      Timer time_pg_parsing("Parsed ProGuard config files");
+      redex::proguard_parser::parse_files(args.proguard_config_paths,
+                                          &pg_config);
     }
 
     const auto& pg_libs = pg_config.libraryjars;
@@ -525,51 +986,81 @@ int main(int argc, char* argv[]) {
       }
     }
 
-    DexStore root_store("classes");
     DexStoresVector stores;
-    stores.emplace_back(std::move(root_store));
 
     dex_stats_t input_totals;
     std::vector<dex_stats_t> input_dexes_stats;
 
-    {
+    // PassManager installs the process-wide thread pool later on. Until then,
+    // the dex and jar loaders get one of the same size to share.
+    unsigned int num_jobs =
+        args.config.get("jobs", boost::thread::hardware_concurrency())
+            .asUInt();
+    auto loader_pool = std::make_unique<ThreadPool>(std::max(1u, num_jobs));
+    auto previous_pool = ThreadPool::set_current(loader_pool.get());
+
+    // Balloon each method when a pass first asks for its code, rather than
+    // all of them up front.
+    bool lazy_balloon = args.config.get("lazy_balloon", false).asBool();
+    auto restore_dir = args.config.get("restore_snapshot", "").asString();
+    Json::Value snapshot_state;
+    if (!restore_dir.empty()) {
+      snapshot_state =
+          program_snapshot::read(restore_dir, &stores, lazy_balloon);
+    } else {
       Timer t("Load classes from dexes");
+      stores.emplace_back(DexStore("classes"));
+      // Each dex goes either into the root store or into the store whose
+      // metadata lists it. They are all loaded at once, and then added to
+      // their stores in command line order.
+      std::vector<std::string> dex_paths;
+      std::vector<size_t> dex_stores;
       for (const auto& filename : args.dex_files) {
         if (filename.size() >= 5 &&
             filename.compare(filename.size() - 4, 4, ".dex") == 0) {
-          dex_stats_t dex_stats;
-          DexClasses classes =
-              load_classes_from_dex(filename.c_str(), &dex_stats);
-          input_totals += dex_stats;
-          input_dexes_stats.push_back(dex_stats);
-          stores[0].add_classes(std::move(classes));
+          dex_paths.push_back(filename);
+          dex_stores.push_back(0);
         } else {
           DexMetadata store_metadata;
           store_metadata.parse(filename);
-          DexStore store(store_metadata);
+          stores.emplace_back(store_metadata);
           for (auto file_path : store_metadata.get_files()) {
-            dex_stats_t dex_stats;
-            DexClasses classes =
-                load_classes_from_dex(file_path.c_str(), &dex_stats);
-            input_totals += dex_stats;
-            input_dexes_stats.push_back(dex_stats);
-            store.add_classes(std::move(classes));
+            dex_paths.push_back(file_path);
+            dex_stores.push_back(stores.size() - 1);
           }
-          stores.emplace_back(std::move(store));
         }
       }
+      auto dexen =
+          load_classes_from_dexes(dex_paths, &input_dexes_stats, !lazy_balloon);
+      for (size_t i = 0; i < dexen.size(); ++i) {
+        input_totals += input_dexes_stats[i];
+        if (lazy_balloon) {
+          defer_balloon_all(dexen[i]);
+        }
+        stores[dex_stores[i]].add_classes(std::move(dexen[i]));
+      }
     }
 
     Scope external_classes;
     if (!library_jars.empty()) {
       Timer t("Load library jars");
+      // Library jars rarely change between builds, so they can be loaded
+      // from snapshots that the first build writes.
+      auto snapshot_dir =
+          args.config.get("library_jar_snapshot_dir", "").asString();
+      auto load_library_jar = [&](const std::string& path, Scope* classes) {
+        if (snapshot_dir.empty()) {
+          return load_jar_file(path.c_str(), classes);
+        }
+        return load_jar_file_cached(path.c_str(), snapshot_dir, classes);
+      };
       for (const auto& library_jar : library_jars) {
         TRACE(MAIN, 1, "LIBRARY JAR: %s\n", library_jar.c_str());
-        if (!load_jar_file(library_jar.c_str(), &external_classes)) {
+        if (!load_library_jar(library_jar, &external_classes)) {
           // Try again with the basedir
           std::string basedir_path =
               pg_config.basedirectory + "/" + library_jar.c_str();
-          if (!load_jar_file(basedir_path.c_str())) {
+          if (!load_library_jar(basedir_path, nullptr)) {
             std::cerr << "error: library jar could not be loaded: "
                       << library_jar << std::endl;
             exit(EXIT_FAILURE);
@@ -577,9 +1068,12 @@ int main(int argc, char* argv[]) {
         }
       }
     }
+    ThreadPool::set_current(previous_pool);
+    loader_pool.reset();
 
     ConfigFiles cfg(args.config);
-    {
+    // The snapshot has the deobfuscated names.
+    if (restore_dir.empty()) {
       Timer t("Deobfuscating dex elements");
       for (auto& store : stores) {
         apply_deobfuscated_names(store.get_dexen(), cfg.get_proguard_map());
@@ -588,26 +1082,133 @@ int main(int argc, char* argv[]) {
     cfg.outdir = args.out_dir;
 
     auto const& passes = PassRegistry::get().get_passes();
+    if (args.bench_runs > 0 && args.bench_pass.empty()) {
+      print_bench_times(bench_pipeline(args.bench_runs, [&] {
+        PassManager manager(
+            passes, pg_config, args.config, args.verify_none_mode);
+        if (!snapshot_state.isNull()) {
+          manager.resume_from_snapshot(snapshot_state);
+        }
+        auto start = std::chrono::steady_clock::now();
+        manager.run_passes(stores, external_classes, cfg);
+        std::vector<std::pair<std::string, double>> pass_times;
+        for (const auto& pass_info : manager.get_pass_info()) {
+          pass_times.emplace_back(pass_info.name, pass_info.profile.wall_s);
+        }
+        pass_times.emplace_back(
+            "(all passes)",
+            std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          start)
+                .count());
+        return pass_times;
+      }));
+      return EXIT_SUCCESS;
+    }
+    if (args.determinism_check) {
+      std::vector<unsigned> jobs;
+      for (const auto& n :
+           args.config.get("determinism_check_jobs", Json::arrayValue)) {
+        jobs.push_back(n.asUInt());
+      }
+      if (jobs.empty()) {
+        jobs = {1, std::max(2u, boost::thread::hardware_concurrency())};
+      }
+      always_assert_log(jobs.size() >= 2,
+                        "A determinism check needs at least two runs");
+      // Each run schedules differently, and the same way every time.
+      auto seed = args.config.get("determinism_check_seed", 1).asUInt64();
+      bool same = check_determinism(jobs, [&](size_t run) {
+        auto config = args.config;
+        config["jobs"] = jobs[run];
+        config["hash_program_after_passes"] = true;
+        workqueue_shuffle_schedules(seed + run);
+        PassManager manager(passes, pg_config, config, args.verify_none_mode);
+        if (!snapshot_state.isNull()) {
+          manager.resume_from_snapshot(snapshot_state);
+        }
+        manager.run_passes(stores, external_classes, cfg);
+        PipelineHashes hashes;
+        for (const auto& pass_info : manager.get_pass_info()) {
+          if (pass_info.program_hash) {
+            hashes.emplace_back(
+                pass_info.name,
+                program_hash::to_string(*pass_info.program_hash));
+          }
+        }
+        if (args.config.isMember("intermediate_output_dir")) {
+          return hashes;
+        }
+        // Write the dexes of each run to a directory of its own, and hash
+        // them.
+        instruction_lowering::run(stores);
+        auto run_args = args;
+        run_args.out_dir =
+            args.out_dir + "/determinism-check-" + std::to_string(run);
+        boost::filesystem::create_directories(run_args.out_dir);
+        cfg.outdir = run_args.out_dir;
+        std::unique_ptr<PositionMapper> pos_mapper(
+            PositionMapper::make("", ""));
+        dex_stats_t totals;
+        std::vector<dex_stats_t> dexes_stats;
+        write_dexes(run_args,
+                    cfg,
+                    stores,
+                    pos_mapper.get(),
+                    &totals,
+                    &dexes_stats,
+                    /* writer */ nullptr);
+        std::vector<std::string> dex_files;
+        for (const auto& entry :
+             boost::filesystem::directory_iterator(run_args.out_dir)) {
+          if (entry.path().extension() == ".dex") {
+            dex_files.push_back(entry.path().filename().string());
+          }
+        }
+        std::sort(dex_files.begin(), dex_files.end());
+        for (const auto& name : dex_files) {
+          std::ifstream in(run_args.out_dir + "/" + name, std::ios::binary);
+          std::string bytes((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+          char hash[17];
+          snprintf(hash,
+                   sizeof(hash),
+                   "%016llx",
+                   static_cast<unsigned long long>(
+                       std::hash<std::string>()(bytes)));
+          hashes.emplace_back(name, hash);
+        }
+        boost::filesystem::remove_all(run_args.out_dir);
+        return hashes;
+      });
+      return same ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
     PassManager manager(passes, pg_config, args.config, args.verify_none_mode);
+    if (!snapshot_state.isNull()) {
+      manager.resume_from_snapshot(snapshot_state);
+    }
+    if (!args.bench_pass.empty()) {
+      manager.set_bench_pass(args.bench_pass,
+                             args.bench_runs > 0 ? args.bench_runs : 5);
+      manager.run_passes(stores, external_classes, cfg);
+      print_bench_times({{args.bench_pass, manager.get_bench_pass_times()}});
+      return EXIT_SUCCESS;
+    }
+    auto intermediate_dir =
+        args.config.get("intermediate_output_dir", "").asString();
     instruction_lowering::Stats instruction_lowering_stats;
     {
       Timer t("Running optimization passes");
       manager.run_passes(stores, external_classes, cfg);
-      instruction_lowering_stats = instruction_lowering::run(stores);
-    }
-
-    TRACE(MAIN, 1, "Writing out new DexClasses...\n");
-
-    LocatorIndex* locator_index = nullptr;
-    if (args.config.get("emit_locator_strings", false).asBool()) {
-      TRACE(LOC,
-            1,
-            "Will emit class-locator strings for classloader optimization\n");
-      locator_index = new LocatorIndex(make_locator_index(stores));
+      if (intermediate_dir.empty()) {
+        instruction_lowering_stats = instruction_lowering::run(stores);
+      }
     }
 
     dex_stats_t output_totals;
     std::vector<dex_stats_t> output_dexes_stats;
+    // Writes the dexes and the symbol files while the next dex is laid out,
+    // and the stats computed.
+    async_io::AsyncWriter output_writer;
 
     auto pos_output =
         cfg.metafile(args.config.get("line_number_map", "").asString());
@@ -615,39 +1216,28 @@ int main(int argc, char* argv[]) {
         cfg.metafile(args.config.get("line_number_map_v2", "").asString());
     std::unique_ptr<PositionMapper> pos_mapper(
         PositionMapper::make(pos_output, pos_output_v2));
-    for (auto& store : stores) {
-      Timer t("Writing optimized dexes");
-      for (size_t i = 0; i < store.get_dexen().size(); i++) {
-        std::stringstream ss;
-        ss << args.out_dir << "/" << store.get_name();
-        if (store.get_name().compare("classes") == 0) {
-          // primary/secondary dex store, primary has no numeral and secondaries
-          // start at 2
-          if (i > 0) {
-            ss << (i + 1);
-          }
-        } else {
-          // other dex stores do not have a primary,
-          // so it makes sense to start at 2
-          ss << (i + 2);
-        }
-        ss << ".dex";
-        auto this_dex_stats = write_classes_to_dex(ss.str(),
-                                                   &store.get_dexen()[i],
-                                                   locator_index,
-                                                   i,
-                                                   cfg,
-                                                   args.config,
-                                                   pos_mapper.get());
-        output_totals += this_dex_stats;
-        output_dexes_stats.push_back(this_dex_stats);
-      }
+    if (!intermediate_dir.empty()) {
+      // Without a resume point, restoring it runs all the passes of the next
+      // stage.
+      Json::Value state(Json::objectValue);
+      state["regalloc_has_run"] = manager.regalloc_has_run();
+      program_snapshot::write(intermediate_dir, stores, cfg, state);
+    } else {
+      write_dexes(args,
+                  cfg,
+                  stores,
+                  pos_mapper.get(),
+                  &output_totals,
+                  &output_dexes_stats,
+                  &output_writer);
     }
 
     {
       Timer t("Writing stats");
       stats_output_path =
           cfg.metafile(args.config.get("stats_output", "").asString());
+      timeline_output_path =
+          cfg.metafile(args.config.get("trace_timeline", "").asString());
       auto method_move_map =
           cfg.metafile(args.config.get("method_move_map", "").asString());
       pos_mapper->write_map();
@@ -663,6 +1253,10 @@ int main(int argc, char* argv[]) {
       Timer t("Freeing global memory");
       delete g_redex;
     }
+    {
+      Timer t("Waiting for the output to be written");
+      output_writer.flush();
+    }
     TRACE(MAIN, 1, "Done.\n");
   }
 
@@ -673,6 +1267,9 @@ int main(int argc, char* argv[]) {
     std::ofstream out(stats_output_path);
     writer.write(out, stats);
   }
+  if (!timeline_output_path.empty()) {
+    timeline::write(timeline_output_path);
+  }
 
   return 0;
 }
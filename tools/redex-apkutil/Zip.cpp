@@ -0,0 +1,337 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Zip.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "Util.h"
+
+namespace apkutil {
+
+namespace {
+
+constexpr uint32_t kLocalFileSignature = 0x04034b50;
+constexpr uint32_t kCentralFileSignature = 0x02014b50;
+constexpr uint32_t kCentralDirEndSignature = 0x06054b50;
+// Entries whose sizes only come after their data, in a data descriptor.
+constexpr uint16_t kFlagDataDescriptor = 1 << 3;
+constexpr uint16_t kFlagEncrypted = 1 << 0;
+constexpr uint32_t kZip64Marker = 0xffffffff;
+// The end of central directory record may be followed by a comment of up to
+// 64K.
+constexpr size_t kMaxCommentSize = 0xffff;
+
+PACKED(struct local_file_header {
+  uint32_t signature;
+  uint16_t vextract;
+  uint16_t flags;
+  uint16_t method;
+  uint16_t mod_time;
+  uint16_t mod_date;
+  uint32_t crc32;
+  uint32_t compressed_size;
+  uint32_t size;
+  uint16_t name_len;
+  uint16_t extra_len;
+});
+
+PACKED(struct central_file_header {
+  uint32_t signature;
+  uint16_t vmade;
+  uint16_t vextract;
+  uint16_t flags;
+  uint16_t method;
+  uint16_t mod_time;
+  uint16_t mod_date;
+  uint32_t crc32;
+  uint32_t compressed_size;
+  uint32_t size;
+  uint16_t name_len;
+  uint16_t extra_len;
+  uint16_t comment_len;
+  uint16_t diskno;
+  uint16_t internal_attr;
+  uint32_t external_attr;
+  uint32_t offset;
+});
+
+PACKED(struct central_dir_end {
+  uint32_t signature;
+  uint16_t diskno;
+  uint16_t cd_diskno;
+  uint16_t cd_disk_entries;
+  uint16_t cd_entries;
+  uint32_t cd_size;
+  uint32_t cd_offset;
+  uint16_t comment_len;
+});
+
+void check(bool ok, const std::string& path, const char* what) {
+  if (!ok) {
+    throw std::runtime_error(path + ": " + what);
+  }
+}
+
+uint16_t version_needed(uint16_t method) {
+  return method == kDeflated ? 20 : 10;
+}
+
+// Made on unix, so that the high half of the external attributes is read as
+// the file mode.
+uint16_t version_made_by(uint16_t method) {
+  return 3 << 8 | version_needed(method);
+}
+
+} // namespace
+
+ZipReader::ZipReader(const std::string& path) : m_path(path) {
+  m_file.open(path);
+  check(m_file.is_open(), path, "cannot open");
+  auto data = (const uint8_t*)m_file.data();
+  size_t size = m_file.size();
+  check(size >= sizeof(central_dir_end), path, "not a zip file");
+
+  size_t end_offset = size - sizeof(central_dir_end);
+  size_t search_limit =
+      end_offset > kMaxCommentSize ? end_offset - kMaxCommentSize : 0;
+  central_dir_end end;
+  while (true) {
+    uint32_t signature;
+    memcpy(&signature, data + end_offset, sizeof(signature));
+    if (signature == kCentralDirEndSignature) {
+      break;
+    }
+    check(end_offset > search_limit, path, "no end of central directory");
+    --end_offset;
+  }
+  memcpy(&end, data + end_offset, sizeof(end));
+  check(end.diskno == 0 && end.cd_diskno == 0 &&
+            end.cd_entries == end.cd_disk_entries,
+        path,
+        "spanned archives are not supported");
+  check(end.cd_offset != kZip64Marker, path, "zip64 is not supported");
+  check(uint64_t(end.cd_offset) + end.cd_size <= end_offset,
+        path,
+        "central directory out of bounds");
+
+  const uint8_t* cd = data + end.cd_offset;
+  const uint8_t* cd_end = cd + end.cd_size;
+  m_entries.reserve(end.cd_entries);
+  for (size_t i = 0; i < end.cd_entries; ++i) {
+    central_file_header header;
+    check(cd + sizeof(header) <= cd_end, path, "truncated central directory");
+    memcpy(&header, cd, sizeof(header));
+    check(header.signature == kCentralFileSignature,
+          path,
+          "bad central directory entry");
+    cd += sizeof(header);
+    check(cd + header.name_len + header.extra_len + header.comment_len <=
+              cd_end,
+          path,
+          "truncated central directory");
+    ZipEntry entry;
+    entry.name.assign((const char*)cd, header.name_len);
+    cd += header.name_len + header.extra_len + header.comment_len;
+    entry.flags = header.flags;
+    entry.method = header.method;
+    entry.mod_time = header.mod_time;
+    entry.mod_date = header.mod_date;
+    entry.crc32 = header.crc32;
+    entry.compressed_size = header.compressed_size;
+    entry.size = header.size;
+    entry.external_attr = header.external_attr;
+    check(!(entry.flags & kFlagEncrypted), path, "encrypted entry");
+    check(entry.method == kStored || entry.method == kDeflated,
+          path,
+          "unsupported compression method");
+    check(entry.size != kZip64Marker && entry.compressed_size != kZip64Marker &&
+              header.offset != kZip64Marker,
+          path,
+          "zip64 is not supported");
+
+    // The local header has its own name and extra field lengths, and with a
+    // data descriptor, no sizes.
+    local_file_header local;
+    check(uint64_t(header.offset) + sizeof(local) <= end.cd_offset,
+          path,
+          "local header out of bounds");
+    memcpy(&local, data + header.offset, sizeof(local));
+    check(local.signature == kLocalFileSignature, path, "bad local header");
+    uint64_t data_offset =
+        uint64_t(header.offset) + sizeof(local) + local.name_len +
+        local.extra_len;
+    check(data_offset + entry.compressed_size <= end.cd_offset,
+          path,
+          "entry data out of bounds");
+    entry.data = data + data_offset;
+
+    m_index.emplace(entry.name, m_entries.size());
+    m_entries.push_back(std::move(entry));
+  }
+}
+
+const ZipEntry* ZipReader::find(const std::string& name) const {
+  auto it = m_index.find(name);
+  return it == m_index.end() ? nullptr : &m_entries[it->second];
+}
+
+std::string ZipReader::read(const ZipEntry& entry) const {
+  std::string contents;
+  if (entry.method == kStored) {
+    check(entry.compressed_size == entry.size, m_path, "bad stored entry");
+    contents.assign((const char*)entry.data, entry.size);
+  } else {
+    contents.resize(entry.size);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    check(inflateInit2(&stream, -MAX_WBITS) == Z_OK, m_path, "zlib failed");
+    stream.next_in = (Bytef*)entry.data;
+    stream.avail_in = entry.compressed_size;
+    stream.next_out = (Bytef*)&contents[0];
+    stream.avail_out = entry.size;
+    int rv = inflate(&stream, Z_FINISH);
+    auto total_out = stream.total_out;
+    inflateEnd(&stream);
+    check(rv == Z_STREAM_END && total_out == entry.size,
+          m_path,
+          ("cannot inflate " + entry.name).c_str());
+  }
+  check(crc32_of(contents) == entry.crc32,
+        m_path,
+        ("CRC mismatch in " + entry.name).c_str());
+  return contents;
+}
+
+ZipWriter::ZipWriter(const std::string& path)
+    : m_path(path), m_out(path, std::ios::binary | std::ios::trunc) {
+  check(static_cast<bool>(m_out), path, "cannot create");
+}
+
+void ZipWriter::add(const ZipEntry& entry, size_t alignment) {
+  check(m_offset + entry.compressed_size < kZip64Marker,
+        m_path,
+        "the archive would need zip64");
+  size_t header_size = sizeof(local_file_header) + entry.name.size();
+  size_t padding = 0;
+  if (entry.method == kStored && alignment > 1) {
+    padding = (alignment - (m_offset + header_size) % alignment) % alignment;
+  }
+
+  local_file_header local;
+  local.signature = kLocalFileSignature;
+  local.vextract = version_needed(entry.method);
+  local.flags = entry.flags & ~kFlagDataDescriptor;
+  local.method = entry.method;
+  local.mod_time = entry.mod_time;
+  local.mod_date = entry.mod_date;
+  local.crc32 = entry.crc32;
+  local.compressed_size = entry.compressed_size;
+  local.size = entry.size;
+  local.name_len = entry.name.size();
+  local.extra_len = padding;
+  m_out.write((const char*)&local, sizeof(local));
+  m_out.write(entry.name.data(), entry.name.size());
+  static const char zeros[4096] = {};
+  m_out.write(zeros, padding);
+  m_out.write((const char*)entry.data, entry.compressed_size);
+  check(static_cast<bool>(m_out), m_path, "write failed");
+
+  m_central.emplace_back(entry, (uint32_t)m_offset);
+  m_central.back().first.data = nullptr;
+  m_offset += header_size + padding + entry.compressed_size;
+}
+
+void ZipWriter::finish() {
+  check(m_central.size() < 0xffff, m_path, "the archive would need zip64");
+  uint64_t cd_offset = m_offset;
+  for (const auto& pair : m_central) {
+    const auto& entry = pair.first;
+    central_file_header header;
+    header.signature = kCentralFileSignature;
+    header.vmade = version_made_by(entry.method);
+    header.vextract = version_needed(entry.method);
+    header.flags = entry.flags & ~kFlagDataDescriptor;
+    header.method = entry.method;
+    header.mod_time = entry.mod_time;
+    header.mod_date = entry.mod_date;
+    header.crc32 = entry.crc32;
+    header.compressed_size = entry.compressed_size;
+    header.size = entry.size;
+    header.name_len = entry.name.size();
+    header.extra_len = 0;
+    header.comment_len = 0;
+    header.diskno = 0;
+    header.internal_attr = 0;
+    header.external_attr = entry.external_attr;
+    header.offset = pair.second;
+    m_out.write((const char*)&header, sizeof(header));
+    m_out.write(entry.name.data(), entry.name.size());
+    m_offset += sizeof(header) + entry.name.size();
+  }
+  check(m_offset < kZip64Marker, m_path, "the archive would need zip64");
+
+  central_dir_end end;
+  end.signature = kCentralDirEndSignature;
+  end.diskno = 0;
+  end.cd_diskno = 0;
+  end.cd_disk_entries = m_central.size();
+  end.cd_entries = m_central.size();
+  end.cd_size = m_offset - cd_offset;
+  end.cd_offset = cd_offset;
+  end.comment_len = 0;
+  m_out.write((const char*)&end, sizeof(end));
+  m_out.close();
+  check(static_cast<bool>(m_out), m_path, "write failed");
+}
+
+uint32_t crc32_of(const std::string& data) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  // zlib takes the length as a uInt.
+  const Bytef* bytes = (const Bytef*)data.data();
+  size_t remaining = data.size();
+  while (remaining > 0) {
+    uInt chunk = remaining > (1u << 30) ? (1u << 30) : (uInt)remaining;
+    crc = crc32(crc, bytes, chunk);
+    bytes += chunk;
+    remaining -= chunk;
+  }
+  return (uint32_t)crc;
+}
+
+std::string deflate(const std::string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream,
+                   Z_DEFAULT_COMPRESSION,
+                   Z_DEFLATED,
+                   -MAX_WBITS,
+                   8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("zlib failed");
+  }
+  std::string out;
+  out.resize(deflateBound(&stream, data.size()));
+  stream.next_in = (Bytef*)data.data();
+  stream.avail_in = data.size();
+  stream.next_out = (Bytef*)&out[0];
+  stream.avail_out = out.size();
+  int rv = ::deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (rv != Z_STREAM_END) {
+    throw std::runtime_error("deflate failed");
+  }
+  return out;
+}
+
+} // namespace apkutil
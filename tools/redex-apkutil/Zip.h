@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+/*
+ * Just enough of the zip format for APKs: stored and deflated entries, no
+ * zip64, no encryption, no spanning. Malformed archives throw
+ * std::runtime_error.
+ */
+namespace apkutil {
+
+constexpr uint16_t kStored = 0;
+constexpr uint16_t kDeflated = 8;
+
+struct ZipEntry {
+  std::string name;
+  uint16_t flags{0};
+  uint16_t method{kDeflated};
+  uint16_t mod_time{0};
+  uint16_t mod_date{0};
+  uint32_t crc32{0};
+  uint32_t compressed_size{0};
+  uint32_t size{0};
+  uint32_t external_attr{0};
+  // The compressed bytes. When reading, they point into the mapped archive.
+  const uint8_t* data{nullptr};
+};
+
+class ZipReader {
+ public:
+  explicit ZipReader(const std::string& path);
+
+  const std::vector<ZipEntry>& entries() const { return m_entries; }
+
+  // nullptr if there is no entry with that name.
+  const ZipEntry* find(const std::string& name) const;
+
+  // The uncompressed contents of `entry`, checked against its CRC.
+  std::string read(const ZipEntry& entry) const;
+
+ private:
+  std::string m_path;
+  boost::iostreams::mapped_file_source m_file;
+  std::vector<ZipEntry> m_entries;
+  std::unordered_map<std::string, size_t> m_index;
+};
+
+/*
+ * Writes the entries in the order they are added, each with its compressed
+ * bytes already in hand.
+ */
+class ZipWriter {
+ public:
+  explicit ZipWriter(const std::string& path);
+
+  /*
+   * Stored entries start at a multiple of `alignment`, by padding the extra
+   * field of their local header the way zipalign does.
+   */
+  void add(const ZipEntry& entry, size_t alignment);
+
+  // Writes the central directory.
+  void finish();
+
+ private:
+  std::string m_path;
+  std::ofstream m_out;
+  uint64_t m_offset{0};
+  std::vector<std::pair<ZipEntry, uint32_t>> m_central;
+};
+
+uint32_t crc32_of(const std::string& data);
+
+// Raw deflate, as zip entries hold it.
+std::string deflate(const std::string& data);
+
+} // namespace apkutil
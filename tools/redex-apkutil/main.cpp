@@ -0,0 +1,284 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <sys/stat.h>
+
+#include "WorkQueue.h"
+#include "Zip.h"
+
+/*
+ * redex-apkutil: unpacks and repacks APKs for redex.py, compressing and
+ * extracting the entries on all cores.
+ *
+ *   redex-apkutil unpack APK DIR
+ *   redex-apkutil pack DIR OUT [--reference APK] [--page-align]
+ *
+ * pack writes an APK that is already aligned the way `zipalign 4` (or
+ * `zipalign -p 4` with --page-align) would align it. Given the APK that DIR
+ * was unpacked from, it keeps the order and compression method of its
+ * entries, and copies the compressed bytes of the files that did not change
+ * instead of compressing them again.
+ */
+
+namespace fs = boost::filesystem;
+using namespace apkutil;
+
+namespace {
+
+constexpr size_t kAlignment = 4;
+constexpr size_t kPageAlignment = 4096;
+
+// Runs fn(0) ... fn(n - 1) on all cores, and rethrows the first error.
+template <typename Fn>
+void parallel_for(size_t n, Fn fn) {
+  std::mutex mutex;
+  std::string error;
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    try {
+      fn(i);
+    } catch (const std::exception& e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (error.empty()) {
+        error = e.what();
+      }
+    }
+  });
+  for (size_t i = 0; i < n; ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error(path + ": cannot open");
+  }
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::string& path, const std::string& contents) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(contents.data(), contents.size());
+  out.close();
+  if (!out) {
+    throw std::runtime_error(path + ": write failed");
+  }
+}
+
+bool is_safe_name(const std::string& name) {
+  if (name.empty() || name[0] == '/' || name.find('\\') != std::string::npos) {
+    return false;
+  }
+  size_t start = 0;
+  while (start <= name.size()) {
+    auto end = name.find('/', start);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    if (name.compare(start, end - start, "..") == 0) {
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+bool is_directory_entry(const ZipEntry& entry) {
+  return entry.name.back() == '/';
+}
+
+void unpack(const std::string& apk, const std::string& dir) {
+  ZipReader reader(apk);
+  const auto& entries = reader.entries();
+  // The directories are made up front, so that the workers only write files.
+  for (const auto& entry : entries) {
+    if (!is_safe_name(entry.name)) {
+      throw std::runtime_error(apk + ": unsafe entry name " + entry.name);
+    }
+    auto path = fs::path(dir) / entry.name;
+    fs::create_directories(is_directory_entry(entry) ? path
+                                                     : path.parent_path());
+  }
+  parallel_for(entries.size(), [&](size_t i) {
+    const auto& entry = entries[i];
+    if (!is_directory_entry(entry)) {
+      write_file((fs::path(dir) / entry.name).string(), reader.read(entry));
+    }
+  });
+}
+
+void to_dos_time(std::time_t t, uint16_t* dos_time, uint16_t* dos_date) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  if (tm.tm_year < 80) {
+    // DOS dates start in 1980.
+    *dos_time = 0;
+    *dos_date = 1 << 5 | 1;
+    return;
+  }
+  *dos_time = tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2;
+  *dos_date = (tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday;
+}
+
+struct PackedFile {
+  std::string path;
+  // The index of the entry in the reference APK, if it has one.
+  size_t rank{std::numeric_limits<size_t>::max()};
+  ZipEntry entry;
+  // The compressed bytes, unless they come from the reference APK.
+  std::string compressed;
+};
+
+// The files under `dir`, in the order of the reference APK, then by name.
+std::vector<PackedFile> list_files(const std::string& dir,
+                                   const ZipReader* reference) {
+  std::vector<PackedFile> files;
+  for (fs::recursive_directory_iterator it(dir), end; it != end; ++it) {
+    if (!fs::is_regular_file(it->status())) {
+      continue;
+    }
+    PackedFile file;
+    file.path = it->path().string();
+    file.entry.name = it->path().generic_string().substr(
+        fs::path(dir).generic_string().size() + 1);
+    auto original = reference ? reference->find(file.entry.name) : nullptr;
+    if (original != nullptr) {
+      file.rank = original - reference->entries().data();
+    }
+    files.push_back(std::move(file));
+  }
+  std::sort(files.begin(),
+            files.end(),
+            [](const PackedFile& a, const PackedFile& b) {
+              return a.rank != b.rank ? a.rank < b.rank
+                                      : a.entry.name < b.entry.name;
+            });
+  return files;
+}
+
+void compress(PackedFile* file, const ZipReader* reference) {
+  auto contents = read_file(file->path);
+  if (contents.size() >= 0xffffffff) {
+    throw std::runtime_error(file->path + ": too large for a zip without zip64");
+  }
+  auto& entry = file->entry;
+  entry.size = contents.size();
+  entry.crc32 = crc32_of(contents);
+
+  const ZipEntry* original =
+      reference ? reference->find(entry.name) : nullptr;
+  if (original != nullptr && original->size == entry.size &&
+      original->crc32 == entry.crc32) {
+    auto name = std::move(entry.name);
+    entry = *original;
+    entry.name = std::move(name);
+    return;
+  }
+
+  struct stat st;
+  if (stat(file->path.c_str(), &st) != 0) {
+    throw std::runtime_error(file->path + ": " + strerror(errno));
+  }
+  to_dos_time(st.st_mtime, &entry.mod_time, &entry.mod_date);
+  entry.external_attr = uint32_t(st.st_mode & 0xffff) << 16;
+  entry.method = original != nullptr ? original->method : kDeflated;
+  if (entry.method == kStored) {
+    file->compressed = std::move(contents);
+  } else {
+    file->compressed = deflate(contents);
+  }
+  entry.compressed_size = file->compressed.size();
+  entry.data = (const uint8_t*)file->compressed.data();
+}
+
+bool ends_with(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+void pack(const std::string& dir,
+          const std::string& out,
+          const std::string& reference_path,
+          bool page_align) {
+  std::unique_ptr<ZipReader> reference;
+  if (!reference_path.empty()) {
+    reference = std::make_unique<ZipReader>(reference_path);
+  }
+  auto files = list_files(dir, reference.get());
+  parallel_for(files.size(),
+               [&](size_t i) { compress(&files[i], reference.get()); });
+
+  ZipWriter writer(out);
+  for (const auto& file : files) {
+    size_t alignment = page_align && ends_with(file.entry.name, ".so")
+                           ? kPageAlignment
+                           : kAlignment;
+    writer.add(file.entry, alignment);
+  }
+  writer.finish();
+}
+
+void usage() {
+  std::cerr << "usage:\n"
+            << "  redex-apkutil unpack APK DIR\n"
+            << "  redex-apkutil pack DIR OUT [--reference APK] [--page-align]\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  try {
+    if (args.size() == 3 && args[0] == "unpack") {
+      unpack(args[1], args[2]);
+      return EXIT_SUCCESS;
+    }
+    if (args.size() >= 3 && args[0] == "pack") {
+      std::string reference;
+      bool page_align = false;
+      for (size_t i = 3; i < args.size(); ++i) {
+        if (args[i] == "--reference" && i + 1 < args.size()) {
+          reference = args[++i];
+        } else if (args[i] == "--page-align") {
+          page_align = true;
+        } else {
+          usage();
+          return EXIT_FAILURE;
+        }
+      }
+      pack(args[1], args[2], reference, page_align);
+      return EXIT_SUCCESS;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "redex-apkutil: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  usage();
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Benchmark.h"
+
+namespace bench {
+
+namespace {
+
+std::vector<Benchmark>& registry() {
+  static std::vector<Benchmark>* benchmarks = new std::vector<Benchmark>();
+  return *benchmarks;
+}
+
+} // namespace
+
+const std::vector<Benchmark>& all_benchmarks() { return registry(); }
+
+Registration::Registration(const char* name, Kind kind, BenchmarkFn fn) {
+  registry().push_back(Benchmark{name, kind, fn});
+}
+
+} // namespace bench
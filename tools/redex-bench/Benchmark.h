@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "DexClass.h"
+
+namespace bench {
+
+/*
+ * What a benchmark runs on: either synthetic methods of a given number of
+ * instructions, or all the methods of the dexes in a corpus directory.
+ */
+struct Input {
+  std::string name;
+  // The number of instructions per synthetic method, or the number of
+  // elements for the benchmarks that don't look at code.
+  size_t size{0};
+  bool is_corpus{false};
+  Scope scope;
+  // The methods of `scope` that have code.
+  std::vector<DexMethod*> methods;
+  size_t num_instructions{0};
+};
+
+/*
+ * Passed to the benchmarks, which run their loop for as long as
+ * keep_running() says so:
+ *
+ *   void my_benchmark(bench::State& state) {
+ *     // setup, not timed
+ *     while (state.keep_running()) {
+ *       // timed
+ *     }
+ *   }
+ */
+class State {
+ public:
+  State(const Input& input, size_t iterations)
+      : m_input(input), m_iterations(iterations), m_remaining(iterations) {}
+
+  bool keep_running() {
+    if (m_remaining == m_iterations) {
+      resume_timing();
+    }
+    if (m_remaining == 0) {
+      pause_timing();
+      return false;
+    }
+    --m_remaining;
+    return true;
+  }
+
+  // For per-iteration setup that shouldn't be timed, e.g. copying the code
+  // that the benchmark is about to modify.
+  void pause_timing() { m_elapsed += clock::now() - m_start; }
+  void resume_timing() { m_start = clock::now(); }
+
+  const Input& input() const { return m_input; }
+
+  // How many items (instructions, elements...) one iteration processes.
+  void set_items_per_iteration(size_t items) { m_items = items; }
+
+  size_t iterations() const { return m_iterations; }
+  size_t items_per_iteration() const { return m_items; }
+  double elapsed_s() const {
+    return std::chrono::duration<double>(m_elapsed).count();
+  }
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  const Input& m_input;
+  size_t m_iterations;
+  size_t m_remaining;
+  size_t m_items{0};
+  clock::time_point m_start;
+  clock::duration m_elapsed{0};
+};
+
+enum class Kind {
+  // Looks at input().methods, so runs on synthetic methods and the corpus.
+  CODE,
+  // Only looks at input().size, so only runs on synthetic inputs.
+  SIZE,
+};
+
+using BenchmarkFn = void (*)(State&);
+
+struct Benchmark {
+  std::string name;
+  Kind kind;
+  BenchmarkFn fn;
+};
+
+const std::vector<Benchmark>& all_benchmarks();
+
+struct Registration {
+  Registration(const char* name, Kind kind, BenchmarkFn fn);
+};
+
+#define REDEX_BENCHMARK(fn, kind) \
+  static bench::Registration s_##fn##_registration(#fn, kind, fn)
+
+} // namespace bench
@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+#include <json/json.h>
+
+#include "Benchmark.h"
+#include "ConfigFiles.h"
+#include "ControlFlow.h"
+#include "DexOutput.h"
+#include "DexPosition.h"
+#include "GraphColoring.h"
+#include "IRCode.h"
+#include "InstructionLowering.h"
+#include "LiveRange.h"
+#include "Liveness.h"
+#include "Peephole.h"
+#include "Transform.h"
+
+/*
+ * Benchmarks of the IR and the analyses and transformations that run on it.
+ * The ones that modify the code work on copies, made while the timer is
+ * paused, so that every iteration sees the same input.
+ */
+
+namespace {
+
+using CodeCopies = std::vector<std::unique_ptr<IRCode>>;
+
+CodeCopies copy_code(const std::vector<DexMethod*>& methods) {
+  CodeCopies copies;
+  copies.reserve(methods.size());
+  for (auto method : methods) {
+    copies.emplace_back(std::make_unique<IRCode>(*method->get_code()));
+  }
+  return copies;
+}
+
+void build_cfg(bench::State& state) {
+  const auto& input = state.input();
+  state.set_items_per_iteration(input.num_instructions);
+  while (state.keep_running()) {
+    state.pause_timing();
+    auto copies = copy_code(input.methods);
+    state.resume_timing();
+    for (auto& code : copies) {
+      code->build_cfg();
+    }
+    state.pause_timing();
+    copies.clear();
+    state.resume_timing();
+  }
+}
+REDEX_BENCHMARK(build_cfg, bench::Kind::CODE);
+
+void liveness(bench::State& state) {
+  const auto& input = state.input();
+  state.set_items_per_iteration(input.num_instructions);
+  auto copies = copy_code(input.methods);
+  for (auto& code : copies) {
+    code->build_cfg();
+  }
+  while (state.keep_running()) {
+    for (auto& code : copies) {
+      regalloc::LivenessFixpointIterator fixpoint_iter(code->cfg());
+      fixpoint_iter.run(regalloc::LivenessDomain(code->get_registers_size()));
+    }
+  }
+}
+REDEX_BENCHMARK(liveness, bench::Kind::CODE);
+
+void graph_coloring(bench::State& state) {
+  const auto& input = state.input();
+  state.set_items_per_iteration(input.num_instructions);
+  regalloc::graph_coloring::Allocator::Config config;
+  while (state.keep_running()) {
+    state.pause_timing();
+    // The same preparation as RegAllocPass does.
+    auto copies = copy_code(input.methods);
+    for (auto& code : copies) {
+      code->build_cfg();
+      transform::remove_unreachable_blocks(code.get());
+      regalloc::live_range::renumber_registers(code.get());
+    }
+    state.resume_timing();
+    for (auto& code : copies) {
+      regalloc::graph_coloring::Allocator allocator(config);
+      allocator.allocate(code.get());
+    }
+    state.pause_timing();
+    copies.clear();
+    state.resume_timing();
+  }
+}
+REDEX_BENCHMARK(graph_coloring, bench::Kind::CODE);
+
+void peephole_matchers(bench::State& state) {
+  const auto& input = state.input();
+  state.set_items_per_iteration(input.num_instructions);
+  while (state.keep_running()) {
+    state.pause_timing();
+    auto originals = copy_code(input.methods);
+    state.resume_timing();
+    peephole::run(input.scope, {});
+    state.pause_timing();
+    for (size_t i = 0; i < input.methods.size(); ++i) {
+      input.methods[i]->set_code(std::move(originals[i]));
+    }
+    state.resume_timing();
+  }
+}
+REDEX_BENCHMARK(peephole_matchers, bench::Kind::CODE);
+
+void lower_all(const std::vector<DexMethod*>& methods) {
+  for (auto method : methods) {
+    instruction_lowering::lower(method);
+  }
+}
+
+void balloon_all(const std::vector<DexMethod*>& methods) {
+  for (auto method : methods) {
+    method->balloon();
+  }
+}
+
+// Lowering is a pass of its own, so it isn't part of the round trip.
+void balloon_sync(bench::State& state) {
+  const auto& input = state.input();
+  state.set_items_per_iteration(input.num_instructions);
+  while (state.keep_running()) {
+    state.pause_timing();
+    lower_all(input.methods);
+    state.resume_timing();
+    for (auto method : input.methods) {
+      method->sync();
+      method->balloon();
+    }
+  }
+}
+REDEX_BENCHMARK(balloon_sync, bench::Kind::CODE);
+
+void dex_output(bench::State& state) {
+  const auto& input = state.input();
+  state.set_items_per_iteration(input.num_instructions);
+  Json::Value json_cfg;
+  ConfigFiles cfg(json_cfg);
+  std::unique_ptr<PositionMapper> pos_mapper(PositionMapper::make("", ""));
+  DexClasses classes(input.scope.begin(), input.scope.end());
+  auto filename = "/tmp/redex-bench-" + std::to_string(getpid()) + ".dex";
+  while (state.keep_running()) {
+    state.pause_timing();
+    lower_all(input.methods);
+    state.resume_timing();
+    write_classes_to_dex(
+        filename, &classes, nullptr, 0, cfg, json_cfg, pos_mapper.get());
+    state.pause_timing();
+    // Writing the dex synced all the methods.
+    balloon_all(input.methods);
+    state.resume_timing();
+  }
+  unlink(filename.c_str());
+}
+REDEX_BENCHMARK(dex_output, bench::Kind::CODE);
+
+} // namespace
@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "ConstantAbstractDomain.h"
+#include "DexClass.h"
+#include "HashedAbstractEnvironment.h"
+#include "PatriciaTreeSet.h"
+
+/*
+ * Benchmarks of the RedexContext and of the abstract domains, on `size`
+ * elements.
+ */
+
+namespace {
+
+std::vector<std::string> type_names(size_t size, const std::string& prefix) {
+  std::vector<std::string> names;
+  names.reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    names.push_back("Lbench/" + prefix + std::to_string(i) + ";");
+  }
+  return names;
+}
+
+// Looking up types that already exist, which is what most make_type() calls
+// in passes do.
+void intern_existing(bench::State& state) {
+  auto names = type_names(state.input().size, "Existing");
+  for (const auto& name : names) {
+    DexType::make_type(name.c_str());
+  }
+  state.set_items_per_iteration(names.size());
+  while (state.keep_running()) {
+    for (const auto& name : names) {
+      DexType::make_type(name.c_str());
+    }
+  }
+}
+REDEX_BENCHMARK(intern_existing, bench::Kind::SIZE);
+
+void intern_new(bench::State& state) {
+  static size_t round = 0;
+  state.set_items_per_iteration(state.input().size);
+  while (state.keep_running()) {
+    state.pause_timing();
+    auto names =
+        type_names(state.input().size, "New" + std::to_string(round++) + "_");
+    state.resume_timing();
+    for (const auto& name : names) {
+      DexType::make_type(name.c_str());
+    }
+  }
+}
+REDEX_BENCHMARK(intern_new, bench::Kind::SIZE);
+
+using pt_set = PatriciaTreeSet<uint32_t>;
+
+// Two sets of `size` elements that have about half of them in common.
+std::pair<pt_set, pt_set> overlapping_sets(size_t size) {
+  std::mt19937 rng(size);
+  std::uniform_int_distribution<uint32_t> dist(0, size * 4);
+  pt_set a;
+  pt_set b;
+  for (size_t i = 0; i < size; ++i) {
+    auto x = dist(rng);
+    a.insert(x);
+    b.insert(i % 2 == 0 ? x : dist(rng));
+  }
+  return std::make_pair(a, b);
+}
+
+void patricia_tree_set_union(bench::State& state) {
+  auto sets = overlapping_sets(state.input().size);
+  state.set_items_per_iteration(state.input().size);
+  while (state.keep_running()) {
+    auto u = sets.first.get_union_with(sets.second);
+    (void)u;
+  }
+}
+REDEX_BENCHMARK(patricia_tree_set_union, bench::Kind::SIZE);
+
+void patricia_tree_set_intersection(bench::State& state) {
+  auto sets = overlapping_sets(state.input().size);
+  state.set_items_per_iteration(state.input().size);
+  while (state.keep_running()) {
+    auto i = sets.first.get_intersection_with(sets.second);
+    (void)i;
+  }
+}
+REDEX_BENCHMARK(patricia_tree_set_intersection, bench::Kind::SIZE);
+
+using Domain = ConstantAbstractDomain<int64_t>;
+using Environment = HashedAbstractEnvironment<uint32_t, Domain>;
+
+void hashed_environment_join(bench::State& state) {
+  size_t size = state.input().size;
+  // Half of the bindings agree, so the join keeps those and drops the rest.
+  Environment a;
+  Environment b;
+  for (size_t i = 0; i < size; ++i) {
+    a.set(i, Domain(i));
+    b.set(i, Domain(i % 2 == 0 ? i : i + 1));
+  }
+  state.set_items_per_iteration(size);
+  Environment joined;
+  while (state.keep_running()) {
+    state.pause_timing();
+    joined = a;
+    state.resume_timing();
+    joined.join_with(b);
+  }
+}
+REDEX_BENCHMARK(hashed_environment_join, bench::Kind::SIZE);
+
+} // namespace
@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Inputs.h"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "Creators.h"
+#include "DexLoader.h"
+#include "DexUtil.h"
+#include "IRAssembler.h"
+#include "IRCode.h"
+
+namespace bench {
+
+namespace {
+
+// Registers that fit in 4 bits, so that the code can be lowered without
+// running the register allocator. The parameter is in the last one.
+constexpr int k_num_regs = 16;
+constexpr int k_param_reg = k_num_regs - 1;
+
+std::unique_ptr<IRCode> synthetic_code(size_t size, std::mt19937& rng) {
+  auto any_reg = [&] { return static_cast<uint16_t>(rng() % k_num_regs); };
+  auto dest_reg = [&] { return static_cast<uint16_t>(rng() % k_param_reg); };
+  assembler::CodeBuilder b;
+  b.push(IOPCODE_LOAD_PARAM, {k_param_reg});
+  for (uint16_t r = 0; r < k_param_reg; ++r) {
+    b.push(OPCODE_CONST, {r}, r);
+  }
+  // Labels of the branches taken so far, and how many instructions later
+  // each one goes.
+  std::vector<std::pair<assembler::CodeBuilder::Label, size_t>> pending;
+  for (size_t i = 0; i < size; ++i) {
+    for (auto it = pending.begin(); it != pending.end();) {
+      if (it->second-- == 0) {
+        b.place(it->first);
+        it = pending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    // The operands are drawn one statement at a time, so that the code
+    // doesn't depend on the order the compiler evaluates arguments in.
+    auto dest = dest_reg();
+    auto src = any_reg();
+    switch (rng() % 10) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+      b.push(OPCODE_ADD_INT, {dest, src, any_reg()});
+      break;
+    case 4:
+    case 5:
+      b.push(OPCODE_MUL_INT, {dest, src, any_reg()});
+      break;
+    case 6:
+      b.push(OPCODE_ADD_INT_LIT8, {dest, src}, 1 + rng() % 100);
+      break;
+    case 7:
+      // Peephole turns this into a move.
+      b.push(OPCODE_MUL_INT_LIT8, {dest, src}, 1);
+      break;
+    case 8: {
+      auto label = b.make_label();
+      b.branch(OPCODE_IF_EQZ, {src}, label);
+      pending.emplace_back(label, 1 + rng() % 8);
+      break;
+    }
+    default:
+      b.push(OPCODE_MOVE, {dest, src});
+      break;
+    }
+  }
+  for (const auto& label : pending) {
+    b.place(label.first);
+  }
+  b.push(OPCODE_RETURN, {0});
+  return b.release();
+}
+
+void add_methods_with_code(Input* input) {
+  for (auto cls : input->scope) {
+    for (auto methods : {&cls->get_dmethods(), &cls->get_vmethods()}) {
+      for (auto method : *methods) {
+        if (method->get_code() != nullptr) {
+          input->methods.push_back(method);
+          input->num_instructions += method->get_code()->count_opcodes();
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+Input make_synthetic_input(size_t size, size_t num_methods) {
+  Input input;
+  input.name = "synthetic/" + std::to_string(size);
+  input.size = size;
+  auto cls_name = "Lbench/Synthetic" + std::to_string(size) + ";";
+  ClassCreator creator(DexType::make_type(cls_name.c_str()));
+  creator.set_super(get_object_type());
+  auto cls = creator.create();
+  std::mt19937 rng(size);
+  for (size_t i = 0; i < num_methods; ++i) {
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        cls_name + ".m" + std::to_string(i) + ":(I)I"));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(synthetic_code(size, rng));
+    cls->add_method(method);
+  }
+  input.scope.push_back(cls);
+  add_methods_with_code(&input);
+  return input;
+}
+
+Input load_corpus_input(const std::string& dir) {
+  namespace fs = boost::filesystem;
+  Input input;
+  input.name = "corpus";
+  input.is_corpus = true;
+  std::vector<std::string> dexes;
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    if (entry.path().extension() == ".dex") {
+      dexes.push_back(entry.path().string());
+    }
+  }
+  std::sort(dexes.begin(), dexes.end());
+  for (const auto& dex : dexes) {
+    auto classes = load_classes_from_dex(dex.c_str());
+    input.scope.insert(input.scope.end(), classes.begin(), classes.end());
+  }
+  add_methods_with_code(&input);
+  input.size = input.num_instructions;
+  return input;
+}
+
+Input load_fixtures_input(const std::string& dir) {
+  namespace fs = boost::filesystem;
+  Input input;
+  input.name = "fixtures";
+  input.is_corpus = true;
+  std::vector<fs::path> fixtures;
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    if (entry.path().extension() == ".irbin") {
+      fixtures.push_back(entry.path());
+    }
+  }
+  std::sort(fixtures.begin(), fixtures.end());
+  std::string cls_name = "Lbench/Fixtures;";
+  ClassCreator creator(DexType::make_type(cls_name.c_str()));
+  creator.set_super(get_object_type());
+  auto cls = creator.create();
+  for (size_t i = 0; i < fixtures.size(); ++i) {
+    std::ifstream in(fixtures[i].string(), std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+    always_assert_log(!in.bad(), "Can't read %s", fixtures[i].c_str());
+    auto method = static_cast<DexMethod*>(DexMethod::make_method(
+        cls_name + ".m" + std::to_string(i) + ":(I)I"));
+    method->make_concrete(ACC_PUBLIC | ACC_STATIC, false);
+    method->set_code(assembler::ircode_from_binary(contents));
+    cls->add_method(method);
+  }
+  input.scope.push_back(cls);
+  add_methods_with_code(&input);
+  input.size = input.num_instructions;
+  return input;
+}
+
+void write_fixtures(const Input& input, const std::string& dir) {
+  // "synthetic/1000" is written as synthetic-1000-0.irbin and so on.
+  auto prefix = input.name;
+  std::replace(prefix.begin(), prefix.end(), '/', '-');
+  for (size_t i = 0; i < input.methods.size(); ++i) {
+    auto path = dir + "/" + prefix + "-" + std::to_string(i) + ".irbin";
+    std::ofstream out(path, std::ios::binary);
+    out << assembler::to_binary(input.methods[i]->get_code());
+    always_assert_log(out.good(), "Can't write %s", path.c_str());
+  }
+}
+
+} // namespace bench
@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "Benchmark.h"
+
+namespace bench {
+
+/*
+ * A class with `num_methods` static methods of about `size` instructions
+ * each: arithmetic over a few registers, with forward branches so that they
+ * have some blocks, and the odd instruction that a peephole pattern matches.
+ * The methods are the same from run to run.
+ */
+Input make_synthetic_input(size_t size, size_t num_methods);
+
+/*
+ * The classes of all the .dex files in `dir`.
+ */
+Input load_corpus_input(const std::string& dir);
+
+/*
+ * A method for each of the .irbin files in `dir`, in the binary form of
+ * IRAssembler.
+ */
+Input load_fixtures_input(const std::string& dir);
+
+/*
+ * Writes each method of `input` to `dir` as a .irbin file, so that inputs
+ * made once, or taken from elsewhere, can be loaded fast later.
+ */
+void write_fixtures(const Input& input, const std::string& dir);
+
+} // namespace bench
@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <json/json.h>
+
+#include "Benchmark.h"
+#include "Inputs.h"
+#include "RedexContext.h"
+
+/*
+ * redex-bench: microbenchmarks of the core IR data structures and analyses.
+ *
+ * Every benchmark runs on each input, with as many iterations as it takes to
+ * run for --min-time seconds. The results can be written as JSON, to track
+ * them over time.
+ */
+
+namespace po = boost::program_options;
+
+namespace {
+
+struct Result {
+  std::string benchmark;
+  std::string input;
+  size_t iterations;
+  double ns_per_iteration;
+  double items_per_second;
+};
+
+Result run_benchmark(const bench::Benchmark& benchmark,
+                     const bench::Input& input,
+                     double min_time_s) {
+  size_t iterations = 1;
+  while (true) {
+    bench::State state(input, iterations);
+    benchmark.fn(state);
+    double elapsed_s = state.elapsed_s();
+    if (elapsed_s >= min_time_s || iterations >= 1000000000) {
+      Result result;
+      result.benchmark = benchmark.name;
+      result.input = input.name;
+      result.iterations = iterations;
+      result.ns_per_iteration = elapsed_s * 1e9 / iterations;
+      result.items_per_second =
+          elapsed_s > 0 ? state.items_per_iteration() * iterations / elapsed_s
+                        : 0;
+      return result;
+    }
+    // Aim a bit past the minimum time, so that the next run is likely the
+    // last, but don't grow too fast on a noisy first measurement.
+    double factor = elapsed_s > 0 ? min_time_s * 1.4 / elapsed_s : 100;
+    iterations = static_cast<size_t>(iterations *
+                                     std::max(2.0, std::min(factor, 100.0)));
+  }
+}
+
+Json::Value to_json(const std::vector<Result>& results) {
+  Json::Value list(Json::arrayValue);
+  for (const auto& result : results) {
+    Json::Value element;
+    element["benchmark"] = result.benchmark;
+    element["input"] = result.input;
+    element["iterations"] = Json::UInt64(result.iterations);
+    element["ns_per_iteration"] = std::round(result.ns_per_iteration);
+    element["items_per_second"] = std::round(result.items_per_second);
+    list.append(element);
+  }
+  Json::Value root;
+  root["benchmarks"] = list;
+  return root;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::string filter;
+  std::vector<size_t> sizes;
+  size_t num_methods;
+  std::string corpus_dir;
+  std::string fixtures_dir;
+  std::string write_fixtures_dir;
+  double min_time_s;
+  std::string json_path;
+
+  po::options_description od("usage: redex-bench [options...]");
+  od.add_options()("help,h", "print this help message");
+  od.add_options()("filter",
+                   po::value<std::string>(&filter),
+                   "only run the benchmarks whose name contains this");
+  od.add_options()(
+      "size",
+      po::value<std::vector<size_t>>(&sizes),
+      "number of instructions per synthetic method, and of elements for the "
+      "benchmarks that don't run on code; may be repeated (default: 100, "
+      "1000 and 10000)");
+  od.add_options()("methods",
+                   po::value<size_t>(&num_methods)->default_value(16),
+                   "number of synthetic methods per size");
+  od.add_options()("corpus",
+                   po::value<std::string>(&corpus_dir),
+                   "also run the code benchmarks on the .dex files in this "
+                   "directory");
+  od.add_options()("fixtures",
+                   po::value<std::string>(&fixtures_dir),
+                   "also run the code benchmarks on the .irbin fixtures in "
+                   "this directory");
+  od.add_options()("write-fixtures",
+                   po::value<std::string>(&write_fixtures_dir),
+                   "write the synthetic methods to this directory as .irbin "
+                   "fixtures");
+  od.add_options()("min-time",
+                   po::value<double>(&min_time_s)->default_value(0.5),
+                   "minimum number of seconds to run each benchmark for");
+  od.add_options()("json",
+                   po::value<std::string>(&json_path),
+                   "file to write the results to, as JSON");
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, od), vm);
+    po::notify(vm);
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl << std::endl << od;
+    return EXIT_FAILURE;
+  }
+  if (vm.count("help")) {
+    std::cout << od;
+    return EXIT_SUCCESS;
+  }
+  if (sizes.empty()) {
+    sizes = {100, 1000, 10000};
+  }
+
+  g_redex = new RedexContext();
+  std::vector<bench::Input> inputs;
+  for (auto size : sizes) {
+    inputs.push_back(bench::make_synthetic_input(size, num_methods));
+    if (!write_fixtures_dir.empty()) {
+      bench::write_fixtures(inputs.back(), write_fixtures_dir);
+    }
+  }
+  if (!corpus_dir.empty()) {
+    inputs.push_back(bench::load_corpus_input(corpus_dir));
+  }
+  if (!fixtures_dir.empty()) {
+    inputs.push_back(bench::load_fixtures_input(fixtures_dir));
+  }
+
+  std::vector<Result> results;
+  printf("%-32s %-20s %12s %16s %16s\n",
+         "benchmark",
+         "input",
+         "iterations",
+         "ns/iteration",
+         "items/s");
+  for (const auto& benchmark : bench::all_benchmarks()) {
+    if (benchmark.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    for (const auto& input : inputs) {
+      if (input.is_corpus && benchmark.kind != bench::Kind::CODE) {
+        continue;
+      }
+      auto result = run_benchmark(benchmark, input, min_time_s);
+      printf("%-32s %-20s %12zu %16.0f %16.0f\n",
+             result.benchmark.c_str(),
+             result.input.c_str(),
+             result.iterations,
+             result.ns_per_iteration,
+             result.items_per_second);
+      fflush(stdout);
+      results.push_back(result);
+    }
+  }
+
+  if (!json_path.empty()) {
+    std::ofstream out(json_path);
+    Json::StyledStreamWriter writer;
+    writer.write(out, to_json(results));
+  }
+  delete g_redex;
+  return EXIT_SUCCESS;
+}
@@ -24,6 +24,7 @@ $ ./native/redex/tools/redex-tool/DexSqlQuery.py dex.db
 */
 
 #include <boost/algorithm/string/replace.hpp>
+#include <cstdarg>
 #include <queue>
 #include <vector>
 #include <unordered_map>
@@ -36,6 +37,7 @@ $ ./native/redex/tools/redex-tool/DexSqlQuery.py dex.db
 #include "Show.h"
 #include "Tool.h"
 #include "Walkers.h"
+#include "WorkQueue.h"
 
 namespace {
 
@@ -44,100 +46,123 @@ static std::unordered_map<DexMethod*, int> method_ids;
 static std::unordered_map<DexField*, int> field_ids;
 static std::unordered_map<DexString*, int> string_ids;
 
-void dump_field_refs(FILE* fdout, const char* prefix, DexField* field, int field_id) {
-  static int next_string_ref = 0;
+/*
+ * Writes the rows of a table as multi-row INSERT statements, which sqlite
+ * imports much faster than one statement per row. Batches stay within the
+ * default SQLITE_MAX_COMPOUND_SELECT.
+ */
+class BatchedInserts {
+ public:
+  BatchedInserts(FILE* fdout, const char* prefix, const char* table)
+      : m_fdout(fdout), m_prefix(prefix), m_table(table) {}
+
+  ~BatchedInserts() { flush(); }
+
+  void add(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (m_rows == 0) {
+      fprintf(m_fdout, "INSERT INTO %s%s VALUES\n", m_prefix, m_table);
+    } else {
+      fprintf(m_fdout, ",\n");
+    }
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(m_fdout, fmt, args);
+    va_end(args);
+    if (++m_rows == k_max_rows) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (m_rows != 0) {
+      fprintf(m_fdout, ";\n");
+      m_rows = 0;
+    }
+  }
+
+ private:
+  static constexpr size_t k_max_rows = 500;
+  FILE* m_fdout;
+  const char* m_prefix;
+  const char* m_table;
+  size_t m_rows{0};
+};
+
+// A reference from a method or field to an item, before it gets its row id.
+struct Ref {
+  int from_id;
+  int to_id;
+  int opcode;
+};
+
+struct DexRefs {
+  std::vector<Ref> field_string_refs;
+  std::vector<Ref> method_string_refs;
+  std::vector<Ref> method_class_refs;
+  std::vector<Ref> method_field_refs;
+  std::vector<Ref> method_method_refs;
+};
+
+template <typename T>
+int id_or(const std::unordered_map<T*, int>& ids, T* item, int none) {
+  auto it = ids.find(item);
+  return it == ids.end() ? none : it->second;
+}
+
+void gather_field_refs(DexRefs& refs, DexField* field, int field_id) {
   auto* static_value = field->get_static_value();
   if (!static_value || (static_value->evtype() != DEVT_STRING)) return;
   auto* static_string_value = static_cast<DexEncodedValueString*>(static_value);
-  auto string_id = string_ids[static_string_value->string()];
-  fprintf(
-    fdout,
-    "INSERT INTO %sfield_string_refs VALUES (%d, %d, %d);\n",
-    prefix,
-    next_string_ref++,
-    field_id,
-    string_id);
+  // Unknown strings used to be given id 0.
+  auto string_id = id_or(string_ids, static_string_value->string(), 0);
+  refs.field_string_refs.push_back({field_id, string_id, 0});
 }
 
-void dump_method_refs(FILE* fdout, const char* prefix, DexMethod* method, int method_id) {
+void gather_method_refs(DexRefs& refs, DexMethod* method, int method_id) {
   auto code = method->get_code();
   if (!code) return;
 
-  static int next_string_ref = 0;
-  static int next_class_ref = 0;
-  static int next_field_ref = 0;
-  static int next_method_ref = 0;
-
   for (auto& mie : InstructionIterable(code)) {
     auto insn = mie.insn;
+    int opcode = insn->opcode();
     if (insn->has_string()) {
-      if (string_ids.count(insn->get_string())) {
-        auto string_id = string_ids[insn->get_string()];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_string_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_string_ref++,
-          method_id,
-          string_id,
-          insn->opcode());
+      auto string_id = id_or(string_ids, insn->get_string(), -1);
+      if (string_id != -1) {
+        refs.method_string_refs.push_back({method_id, string_id, opcode});
       }
     }
     if (insn->has_type()) {
       auto cls = type_class(insn->get_type());
-      if (cls && class_ids.count(cls)) {
-        auto class_id = class_ids[cls];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_class_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_class_ref++,
-          method_id,
-          class_id,
-          insn->opcode());
+      auto class_id = cls ? id_or(class_ids, cls, -1) : -1;
+      if (class_id != -1) {
+        refs.method_class_refs.push_back({method_id, class_id, opcode});
       }
     }
     if (insn->has_field()) {
       auto field = resolve_field(insn->get_field());
-      if (field != nullptr && field_ids.count(field)) {
-        auto field_id = field_ids[field];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_field_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_field_ref++,
-          method_id,
-          field_id,
-          insn->opcode());
+      auto field_id = field ? id_or(field_ids, field, -1) : -1;
+      if (field_id != -1) {
+        refs.method_field_refs.push_back({method_id, field_id, opcode});
       }
     }
     if (insn->has_method()) {
       auto meth = resolve_method(insn->get_method(), opcode_to_search(insn));
-      if (meth != nullptr && method_ids.count(meth)) {
-        auto method_ref_id = method_ids[meth];
-        fprintf(
-          fdout,
-          "INSERT INTO %smethod_method_refs VALUES (%d, %d, %d, %d);\n",
-          prefix,
-          next_method_ref++,
-          method_id,
-          method_ref_id,
-          insn->opcode());
+      auto method_ref_id = meth ? id_or(method_ids, meth, -1) : -1;
+      if (method_ref_id != -1) {
+        refs.method_method_refs.push_back({method_id, method_ref_id, opcode});
       }
     }
   }
 }
 
-void dump_class(FILE* fdout, const char* prefix, const char* dex_id, DexClass* cls, int class_id) {
+void dump_class(BatchedInserts& out, const char* dex_id, DexClass* cls, int class_id) {
   // TODO: annotations?
   // TODO: inheritance?
   // TODO: string usage
   // TODO: size estimate
   auto deobfuscated_name = cls->get_deobfuscated_name();
-  fprintf(
-    fdout,
-    "INSERT INTO %sclasses VALUES (%d,'%s','%s','%s',%u);\n",
-    prefix,
+  out.add(
+    "(%d,'%s','%s','%s',%u)",
     class_id,
     dex_id,
     deobfuscated_name.c_str(),
@@ -146,17 +171,15 @@ void dump_class(FILE* fdout, const char* prefix, const char* dex_id, DexClass* c
   );
 }
 
-void dump_field(FILE* fdout, const char* prefix, int class_id, DexField* field, int field_id) {
+void dump_field(BatchedInserts& out, int class_id, DexField* field, int field_id) {
   // TODO: more fixup here on this crapped up name/signature
   // TODO: break down signature
   // TODO: annotations?
   // TODO: string usage (encoded_value for static fields)
   auto deobfuscated_name = field->get_deobfuscated_name();
   auto field_name = strchr(deobfuscated_name.c_str(), ';');
-  fprintf(
-    fdout,
-    "INSERT INTO %sfields VALUES(%d, %d, '%s', '%s', %u);\n",
-    prefix,
+  out.add(
+    "(%d, %d, '%s', '%s', %u)",
     field_id,
     class_id,
     field_name,
@@ -165,7 +188,7 @@ void dump_field(FILE* fdout, const char* prefix, int class_id, DexField* field,
   );
 }
 
-void dump_method(FILE* fdout, const char* prefix, int class_id, DexMethod* method, int method_id) {
+void dump_method(BatchedInserts& out, int class_id, DexMethod* method, int method_id) {
   // TODO: more fixup here on this crapped up name/signature
   // TODO: break down signature
   // TODO: throws?
@@ -174,10 +197,8 @@ void dump_method(FILE* fdout, const char* prefix, int class_id, DexMethod* metho
   // TODO: size estimate
   auto deobfuscated_name = method->get_deobfuscated_name();
   auto method_name = strchr(deobfuscated_name.c_str(), ';');
-  fprintf(
-    fdout,
-    "INSERT INTO %smethods VALUES (%d,%d,'%s','%s',%d,%lu);\n",
-    prefix,
+  out.add(
+    "(%d,%d,'%s','%s',%d,%lu)",
     method_id,
     class_id,
     method_name,
@@ -275,6 +296,10 @@ CREATE TABLE %1$smethod_string_refs (
 
   // Dump all dex items
   fprintf(fdout, "BEGIN TRANSACTION;\n");
+  BatchedInserts string_rows(fdout, prefix, "strings");
+  BatchedInserts class_rows(fdout, prefix, "classes");
+  BatchedInserts field_rows(fdout, prefix, "fields");
+  BatchedInserts method_rows(fdout, prefix, "methods");
   for (auto& store : stores) {
     auto store_name = store.get_name();
     auto& dexen = store.get_dexen();
@@ -289,64 +314,106 @@ CREATE TABLE %1$smethod_string_refs (
         // Escape string before inserting. ' -> ''
         std::string esc(dexstr->c_str());
         boost::replace_all(esc, "'", "''");
-        fprintf(fdout, "INSERT INTO %sstrings VALUES(%d, '%s');\n", prefix, id, esc.c_str());
+        string_rows.add("(%d, '%s')", id, esc.c_str());
       }
       std::string dex_id_str(store_name + "/" + std::to_string(dex_idx));
       const char* dex_id = dex_id_str.c_str();
       for (const auto& cls : dex) {
         int class_id = next_class_id++;
-        dump_class(fdout, prefix, dex_id, cls, class_id);
+        dump_class(class_rows, dex_id, cls, class_id);
         class_ids[cls] = class_id;
         for (auto field : cls->get_ifields()) {
           int field_id = next_field_id++;
           field_ids[field] = field_id;
-          dump_field(fdout, prefix, class_id, field, field_id);
+          dump_field(field_rows, class_id, field, field_id);
         }
         for (auto field : cls->get_sfields()) {
           int field_id = next_field_id++;
           field_ids[field] = field_id;
-          dump_field(fdout, prefix, class_id, field, field_id);
+          dump_field(field_rows, class_id, field, field_id);
         }
         for (const auto& meth : cls->get_dmethods()) {
           int meth_id = next_method_id++;
           method_ids[meth] = meth_id;
-          dump_method(fdout, prefix, class_id, meth, meth_id);
+          dump_method(method_rows, class_id, meth, meth_id);
         }
         for (auto& meth : cls->get_vmethods()) {
           int meth_id = next_method_id++;
           method_ids[meth] = meth_id;
-          dump_method(fdout, prefix, class_id, meth, meth_id);
+          dump_method(method_rows, class_id, meth, meth_id);
         }
       }
     }
   }
+  for (auto rows : {&string_rows, &class_rows, &field_rows, &method_rows}) {
+    rows->flush();
+  }
   fprintf(fdout, "END TRANSACTION;\n");
 
-  // Dump references
-  fprintf(fdout, "BEGIN TRANSACTION;\n");
+  // Dump references. They are gathered for each dex in parallel, then numbered
+  // and written in dex order.
+  std::vector<DexClasses*> all_dexen;
   for (auto& store : stores) {
-    auto& dexen = store.get_dexen();
-    for (size_t dex_idx = 0 ; dex_idx < dexen.size() ; ++dex_idx) {
-      auto& dex = dexen[dex_idx];
-      for (const auto& cls : dex) {
-        for (const auto& meth : cls->get_dmethods()) {
-          int meth_id = method_ids[meth];
-          dump_method_refs(fdout, prefix, meth, meth_id);
-        }
-        for (auto& meth : cls->get_vmethods()) {
-          int meth_id = method_ids[meth];
-          dump_method_refs(fdout, prefix, meth, meth_id);
-        }
-        for (const auto& field : cls->get_sfields()) {
-          int field_id = field_ids[field];
-          dump_field_refs(fdout, prefix, field, field_id);
-        }
-        for (const auto& field : cls->get_ifields()) {
-          int field_id = field_ids[field];
-          dump_field_refs(fdout, prefix, field, field_id);
-        }
+    for (auto& dex : store.get_dexen()) {
+      all_dexen.push_back(&dex);
+    }
+  }
+  std::vector<DexRefs> dex_refs(all_dexen.size());
+  auto wq = workqueue_foreach<size_t>([&](size_t i) {
+    auto& refs = dex_refs[i];
+    for (const auto& cls : *all_dexen[i]) {
+      for (const auto& meth : cls->get_dmethods()) {
+        gather_method_refs(refs, meth, method_ids.at(meth));
+      }
+      for (auto& meth : cls->get_vmethods()) {
+        gather_method_refs(refs, meth, method_ids.at(meth));
+      }
+      for (const auto& field : cls->get_sfields()) {
+        gather_field_refs(refs, field, field_ids.at(field));
+      }
+      for (const auto& field : cls->get_ifields()) {
+        gather_field_refs(refs, field, field_ids.at(field));
       }
     }
+  });
+  for (size_t i = 0; i < all_dexen.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
+
+  fprintf(fdout, "BEGIN TRANSACTION;\n");
+  BatchedInserts field_string_rows(fdout, prefix, "field_string_refs");
+  BatchedInserts method_string_rows(fdout, prefix, "method_string_refs");
+  BatchedInserts method_class_rows(fdout, prefix, "method_class_refs");
+  BatchedInserts method_field_rows(fdout, prefix, "method_field_refs");
+  BatchedInserts method_method_rows(fdout, prefix, "method_method_refs");
+  int next_field_string_ref = 0;
+  int next_string_ref = 0;
+  int next_class_ref = 0;
+  int next_field_ref = 0;
+  int next_method_ref = 0;
+  auto dump_refs = [](BatchedInserts& out,
+                      int& next_ref,
+                      const std::vector<Ref>& refs) {
+    for (const auto& ref : refs) {
+      out.add("(%d, %d, %d, %d)", next_ref++, ref.from_id, ref.to_id,
+              ref.opcode);
+    }
+  };
+  for (auto& refs : dex_refs) {
+    for (const auto& ref : refs.field_string_refs) {
+      field_string_rows.add("(%d, %d, %d)", next_field_string_ref++,
+                            ref.from_id, ref.to_id);
+    }
+    dump_refs(method_string_rows, next_string_ref, refs.method_string_refs);
+    dump_refs(method_class_rows, next_class_ref, refs.method_class_refs);
+    dump_refs(method_field_rows, next_field_ref, refs.method_field_refs);
+    dump_refs(method_method_rows, next_method_ref, refs.method_method_refs);
+  }
+  for (auto rows : {&field_string_rows, &method_string_rows,
+                    &method_class_rows, &method_field_rows,
+                    &method_method_rows}) {
+    rows->flush();
   }
   fprintf(fdout, "END TRANSACTION;\n");
 
@@ -355,16 +422,15 @@ CREATE TABLE %1$smethod_string_refs (
   ClassHierarchy ch = build_type_hierarchy(scope);
   int next_is_a_id = 0;
   fprintf(fdout, "BEGIN TRANSACTION;\n");
+  BatchedInserts is_a_rows(fdout, prefix, "is_a");
   for (auto& cls : scope) {
     TypeSet results;
     get_all_children_or_implementors(ch, scope, cls, results);
     for(auto type : results) {
       auto type_cls = type_class(type);
       if (type_cls) {
-        fprintf(
-          fdout,
-          "INSERT INTO %sis_a VALUES(%d, %d, %d);\n",
-          prefix,
+        is_a_rows.add(
+          "(%d, %d, %d)",
           next_is_a_id++,
           class_ids[type_cls],
           class_ids[cls]
@@ -372,6 +438,7 @@ CREATE TABLE %1$smethod_string_refs (
       }
     }
   }
+  is_a_rows.flush();
   fprintf(fdout, "END TRANSACTION;\n");
 }
 
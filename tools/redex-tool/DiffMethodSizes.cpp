@@ -8,28 +8,62 @@
  */
 
 #include "DexClass.h"
-#include "DexInstruction.h"
-#include "DexUtil.h"
+#include "DexDefs.h"
+#include "DexOpcode.h"
 #include "JarLoader.h"
 #include "ProguardConfiguration.h"
 #include "ProguardParser.h"
-#include "ReachableClasses.h"
 #include "Tool.h"
-#include "Walkers.h"
+#include "WorkQueue.h"
 
 #include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <iostream>
-#include <map>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 namespace {
 
-using JarMethodInfoMap = std::unordered_map<
-    // Method as string
-    std::string,
+/*
+ * Method infos are kept sorted by method descriptor, so that two of them can
+ * be diffed with a single merge.
+ */
+template <typename Sizes>
+using MethodInfos = std::vector<std::pair<std::string, Sizes>>;
+
+template <typename Sizes>
+void sort_infos(MethodInfos<Sizes>& infos) {
+  std::stable_sort(
+      infos.begin(),
+      infos.end(),
+      [](const std::pair<std::string, Sizes>& a,
+         const std::pair<std::string, Sizes>& b) { return a.first < b.first; });
+}
+
+/*
+ * Calls `diff(name, a_sizes, b_sizes)` for the methods that are in both a and
+ * b, and `only_in_a(name)` for the ones that are missing from b.
+ */
+template <typename Sizes, typename Diff, typename OnlyInA>
+void merge_infos(const MethodInfos<Sizes>& a,
+                 const MethodInfos<Sizes>& b,
+                 Diff diff,
+                 OnlyInA only_in_a) {
+  auto b_it = b.begin();
+  for (const auto& pair : a) {
+    while (b_it != b.end() && b_it->first < pair.first) {
+      ++b_it;
+    }
+    if (b_it == b.end() || b_it->first != pair.first) {
+      only_in_a(pair.first);
+      continue;
+    }
+    diff(pair.first, pair.second, b_it->second);
+  }
+}
+
+using JarMethodInfoMap = MethodInfos<
     // Fields of interest in "Code_attribute" from JVM class file.
     std::tuple<int /*max_stack*/, int /*max_locals*/, int /*code_length*/>>;
 
@@ -48,13 +82,25 @@ JarMethodInfoMap load_jar_method_info(const std::string& base_directory,
     uint16_t max_locals = JarLoaderUtil::read16(attribute_pointer);
     uint32_t code_length = JarLoaderUtil::read32(attribute_pointer);
     DexMethod* method = boost::get<DexMethod*>(field_or_method);
-    info.emplace(show(method),
-                 std::make_tuple(max_stack, max_locals, code_length));
+    info.emplace_back(show(method),
+                      std::make_tuple(max_stack, max_locals, code_length));
   };
 
+  // The entries of each jar are parsed in parallel. The jars themselves are
+  // loaded one after the other, as loading them creates classes.
   for (const auto& jar : jars) {
     load_jar_file((base_directory + "/" + jar).c_str(), nullptr, hook);
   }
+
+  // Like the classes themselves, the first definition of a method wins.
+  sort_infos(info);
+  info.erase(std::unique(info.begin(),
+                         info.end(),
+                         [](const JarMethodInfoMap::value_type& a,
+                            const JarMethodInfoMap::value_type& b) {
+                           return a.first == b.first;
+                         }),
+             info.end());
   return info;
 }
 
@@ -88,24 +134,24 @@ void diff_in_out_jars_from_command_line(const std::string& command_line_path) {
 
   std::cout << "Diffing in and out jars... " << std::endl;
   JarMethodInfoMap diff;
-  for (auto&& pair : injar_info) {
-    auto found = outjar_info.find(pair.first);
-    if (found == end(outjar_info)) {
-      std::cerr << "Uh-oh, " << pair.first << " can't be found in outjars"
-                << std::endl;
-      continue;
-    }
-    const auto& in = pair.second;
-    const auto& out = found->second;
-    if (in == out) {
-      continue;
-    }
-
-    diff.emplace(pair.first,
-                 std::make_tuple(std::get<0>(out) - std::get<0>(in),
-                                 std::get<1>(out) - std::get<1>(in),
-                                 std::get<2>(out) - std::get<2>(in)));
-  }
+  merge_infos(
+      injar_info,
+      outjar_info,
+      [&diff](const std::string& name,
+              const JarMethodInfoMap::value_type::second_type& in,
+              const JarMethodInfoMap::value_type::second_type& out) {
+        if (in == out) {
+          return;
+        }
+        diff.emplace_back(name,
+                          std::make_tuple(std::get<0>(out) - std::get<0>(in),
+                                          std::get<1>(out) - std::get<1>(in),
+                                          std::get<2>(out) - std::get<2>(in)));
+      },
+      [](const std::string& name) {
+        std::cerr << "Uh-oh, " << name << " can't be found in outjars"
+                  << std::endl;
+      });
 
   auto print_tuple = [](const std::tuple<int, int, int>& t) {
     return std::to_string(std::get<0>(t)) + " " +
@@ -132,27 +178,197 @@ void diff_in_out_jars_from_command_line(const std::string& command_line_path) {
 }
 
 using DexMethodInfoMap =
-    std::unordered_map<std::string, // Method as string
-                       std::tuple<int, int>>; // code size, register size
+    MethodInfos<std::tuple<int, int>>; // code size, register size
 
-DexMethodInfoMap load_dex_method_info(const std::string& dir) {
-  DexStore root_store("dex");
-  DexStoresVector stores;
+/*
+ * The number of code units taken by the instruction, or by the payload, at
+ * insns. Payloads are only found past the code, so they can't be mistaken for
+ * a NOP.
+ */
+uint32_t insn_units(const uint16_t* insns, bool* is_payload) {
+  *is_payload = true;
+  switch (*insns) {
+  case FOPCODE_PACKED_SWITCH:
+    return insns[1] * 2 + 4;
+  case FOPCODE_SPARSE_SWITCH:
+    return insns[1] * 4 + 2;
+  case FOPCODE_FILLED_ARRAY: {
+    uint32_t size = insns[2] | (uint32_t(insns[3]) << 16);
+    return (insns[1] * size + 1) / 2 + 4;
+  }
+  }
+  *is_payload = false;
+  switch (dex_opcode::format(DexOpcode(*insns & 0xff))) {
+  case FMT_f10x:
+  case FMT_f12x:
+  case FMT_f12x_2:
+  case FMT_f11n:
+  case FMT_f11x_d:
+  case FMT_f11x_s:
+  case FMT_f10t:
+    return 1;
+  case FMT_f20t:
+  case FMT_f20bc:
+  case FMT_f22x:
+  case FMT_f21t:
+  case FMT_f21s:
+  case FMT_f21h:
+  case FMT_f21c_d:
+  case FMT_f21c_s:
+  case FMT_f23x_d:
+  case FMT_f23x_s:
+  case FMT_f22b:
+  case FMT_f22t:
+  case FMT_f22s:
+  case FMT_f22c_d:
+  case FMT_f22c_s:
+  case FMT_f22cs:
+    return 2;
+  case FMT_f30t:
+  case FMT_f32x:
+  case FMT_f31i:
+  case FMT_f31t:
+  case FMT_f31c:
+  case FMT_f35c:
+  case FMT_f35ms:
+  case FMT_f35mi:
+  case FMT_f3rc:
+  case FMT_f3rms:
+  case FMT_f3rmi:
+    return 3;
+  case FMT_f41c_d:
+  case FMT_f41c_s:
+    return 4;
+  case FMT_f51l:
+  case FMT_f52c_d:
+  case FMT_f52c_s:
+  case FMT_f5rc:
+  case FMT_f57c:
+    return 5;
+  case FMT_f00x:
+  case FMT_fopcode:
+  case FMT_iopcode:
+    break;
+  }
+  always_assert_log(false, "Unexpected opcode 0x%x", *insns);
+}
+
+/*
+ * Reads the method sizes of a dex file straight from its code items, without
+ * loading its classes. Like DexCode::size(), the size leaves out the switch
+ * and array payloads.
+ */
+DexMethodInfoMap load_dex_file_method_info(const std::string& path) {
+  boost::iostreams::mapped_file file;
+  file.open(path, boost::iostreams::mapped_file::readonly);
+  always_assert_log(file.is_open(), "Cannot open %s", path.c_str());
+  auto base = reinterpret_cast<const uint8_t*>(file.const_data());
+  auto dh = reinterpret_cast<const dex_header*>(base);
+  auto string_ids =
+      reinterpret_cast<const dex_string_id*>(base + dh->string_ids_off);
+  auto type_ids = reinterpret_cast<const dex_type_id*>(base + dh->type_ids_off);
+  auto proto_ids =
+      reinterpret_cast<const dex_proto_id*>(base + dh->proto_ids_off);
+  auto method_ids =
+      reinterpret_cast<const dex_method_id*>(base + dh->method_ids_off);
+  auto class_defs =
+      reinterpret_cast<const dex_class_def*>(base + dh->class_defs_off);
+
+  auto string_at = [&](uint32_t idx) {
+    auto ptr = base + string_ids[idx].offset;
+    read_uleb128(&ptr);
+    return reinterpret_cast<const char*>(ptr);
+  };
+  auto type_at = [&](uint32_t idx) {
+    return string_at(type_ids[idx].string_idx);
+  };
+  auto method_name = [&](uint32_t idx) {
+    const auto& mid = method_ids[idx];
+    const auto& pid = proto_ids[mid.protoidx];
+    std::string name = type_at(mid.classidx);
+    name.append(".").append(string_at(mid.nameidx)).append(":(");
+    if (pid.param_off != 0) {
+      auto params = reinterpret_cast<const uint32_t*>(base + pid.param_off);
+      auto types = reinterpret_cast<const uint16_t*>(params + 1);
+      for (uint32_t i = 0; i < *params; ++i) {
+        name.append(type_at(types[i]));
+      }
+    }
+    return name.append(")").append(type_at(pid.rtypeidx));
+  };
 
-  // Load root dexen
-  load_root_dexen(root_store, dir);
-  stores.emplace_back(std::move(root_store));
   DexMethodInfoMap result;
+  for (uint32_t i = 0; i < dh->class_defs_size; ++i) {
+    if (class_defs[i].class_data_offset == 0) {
+      continue;
+    }
+    auto ptr = base + class_defs[i].class_data_offset;
+    uint32_t sfield_count = read_uleb128(&ptr);
+    uint32_t ifield_count = read_uleb128(&ptr);
+    uint32_t dmethod_count = read_uleb128(&ptr);
+    uint32_t vmethod_count = read_uleb128(&ptr);
+    for (uint32_t j = 0; j < sfield_count + ifield_count; ++j) {
+      read_uleb128(&ptr);
+      read_uleb128(&ptr);
+    }
+    uint32_t midx = 0;
+    for (uint32_t j = 0; j < dmethod_count + vmethod_count; ++j) {
+      if (j == dmethod_count) {
+        // The method indices restart with the virtual methods.
+        midx = 0;
+      }
+      midx += read_uleb128(&ptr);
+      read_uleb128(&ptr); // access flags
+      uint32_t code_off = read_uleb128(&ptr);
+      int code_size = 0;
+      int registers_size = 0;
+      if (code_off != 0) {
+        auto code = reinterpret_cast<const dex_code_item*>(base + code_off);
+        auto insns = reinterpret_cast<const uint16_t*>(code + 1);
+        uint32_t units = 0;
+        while (units < code->insns_size) {
+          bool is_payload;
+          auto size = insn_units(insns + units, &is_payload);
+          if (!is_payload) {
+            code_size += size;
+          }
+          units += size;
+        }
+        registers_size = code->registers_size;
+      }
+      result.emplace_back(method_name(midx),
+                          std::make_tuple(code_size, registers_size));
+    }
+  }
+  return result;
+}
 
-  walk::methods(build_class_scope(stores), [&result](DexMethod* method) {
-    auto key = show(method);
-    always_assert(result.find(key) == end(result));
-    const auto* code = method->get_dex_code();
-    result.emplace(key,
-                   std::make_tuple((code ? code->size() : 0),
-                                   (code ? code->get_registers_size() : 0)));
-  });
+DexMethodInfoMap load_dex_method_info(const std::string& dir) {
+  namespace fs = boost::filesystem;
+  std::vector<std::string> dexen;
+  for (fs::directory_iterator it(dir), end; it != end; ++it) {
+    auto file = it->path();
+    if (fs::is_regular_file(file) && file.extension() == ".dex") {
+      dexen.emplace_back(file.string());
+    }
+  }
+
+  std::vector<DexMethodInfoMap> infos(dexen.size());
+  auto wq = workqueue_foreach<size_t>(
+      [&](size_t i) { infos[i] = load_dex_file_method_info(dexen[i]); });
+  for (size_t i = 0; i < dexen.size(); ++i) {
+    wq.add_item(i);
+  }
+  wq.run_all();
 
+  DexMethodInfoMap result;
+  for (auto& info : infos) {
+    std::move(info.begin(), info.end(), std::back_inserter(result));
+  }
+  sort_infos(result);
+  for (size_t i = 1; i < result.size(); ++i) {
+    always_assert(result[i - 1].first != result[i].first);
+  }
   return result;
 }
 
@@ -172,43 +388,38 @@ void diff_from_two_dexen_dirs(const std::string& dexen_dir_A,
                               const std::string& dexen_dir_B) {
   std::cout << "INFO: "
             << "Loading directory " << dexen_dir_A << " ... " << std::endl;
-  RedexContext* A_context = g_redex;
   auto A_info = load_dex_method_info(dexen_dir_A);
   std::cout << "INFO: " << A_info.size() << " method information loaded"
             << std::endl;
 
   std::cout << "INFO: "
             << "Loading directory " << dexen_dir_B << " ... " << std::endl;
-  std::unique_ptr<RedexContext> B_context(new RedexContext());
-  g_redex = B_context.get();
   auto B_info = load_dex_method_info(dexen_dir_B);
   std::cout << "INFO: " << B_info.size() << " method information loaded"
             << std::endl;
 
   std::cout << "Diffing A and B... " << std::endl;
   DexMethodInfoMap diff;
-  for (auto&& pair : A_info) {
-    auto found = B_info.find(pair.first);
-    if (found == end(B_info)) {
-      continue;
-    }
-    const auto& A_sizes = pair.second;
-    const auto& B_sizes = found->second;
-    if (A_sizes == B_sizes) {
-      continue;
-    }
-
-    diff.emplace(pair.first,
-                 std::make_tuple(std::get<0>(B_sizes) - std::get<0>(A_sizes),
-                                 std::get<1>(B_sizes) - std::get<1>(A_sizes)));
-  }
+  merge_infos(
+      A_info,
+      B_info,
+      [&diff](const std::string& name,
+              const std::tuple<int, int>& A_sizes,
+              const std::tuple<int, int>& B_sizes) {
+        if (A_sizes == B_sizes) {
+          return;
+        }
+        diff.emplace_back(
+            name,
+            std::make_tuple(std::get<0>(B_sizes) - std::get<0>(A_sizes),
+                            std::get<1>(B_sizes) - std::get<1>(A_sizes)));
+      },
+      [](const std::string&) {});
 
   for (const auto& pair : diff) {
     std::cout << "DIFF: " << pair.first << " " << std::get<0>(pair.second)
               << " " << std::get<1>(pair.second) << std::endl;
   }
-
-  g_redex = A_context;
 }
 
 class DiffMethodSizes : public Tool {
@@ -515,16 +515,18 @@ void dump_strings(ddump_data* rd, bool print_headers) {
   auto offset = rd->dexh->string_ids_off;
   const uint8_t* str_id_ptr = (uint8_t*)(rd->dexmmap) + offset;
   auto size = rd->dexh->string_ids_size;
-  auto length = 0;
-  uint32_t tmp_str_id_off = 0;
-  for (uint32_t i = 0; i < size; ++i) {
-    const uint8_t* str_data_ptr = (uint8_t*)(rd->dexmmap) + tmp_str_id_off;
-    length += strlen((char*) str_data_ptr);
-    tmp_str_id_off += 4;
-  }
 
   if (print_headers) {
-    redump("\nSTRING IDS TABLE: %d %d\n", size, length);
+    // The total length is only needed for the header, so don't walk the
+    // strings twice otherwise.
+    size_t length = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+      auto str_data_off = ((uint32_t*)str_id_ptr)[i];
+      const uint8_t* str_data_ptr = (uint8_t*)(rd->dexmmap) + str_data_off;
+      read_uleb128(&str_data_ptr);
+      length += strlen((char*) str_data_ptr);
+    }
+    redump("\nSTRING IDS TABLE: %d %zu\n", size, length);
     redump("%s\n", string_data_header);
   }
   for (uint32_t i = 0; i < size; ++i) {
@@ -15,25 +15,56 @@ bool clean = false;
 bool raw = false;
 bool escape = false;
 
+static thread_local RedumpBuffer* s_buffer = nullptr;
+
+RedumpBuffer::RedumpBuffer() : m_prev(s_buffer) { s_buffer = this; }
+
+RedumpBuffer::~RedumpBuffer() { s_buffer = m_prev; }
+
+void vredump(const char* format, va_list va) {
+  if (s_buffer == nullptr) {
+    vprintf(format, va);
+    return;
+  }
+  va_list va_copy;
+  va_copy(va_copy, va);
+  char buf[256];
+  int len = vsnprintf(buf, sizeof(buf), format, va);
+  if (len < 0) {
+    va_end(va_copy);
+    return;
+  }
+  auto& out = s_buffer->m_buf;
+  if (static_cast<size_t>(len) < sizeof(buf)) {
+    out.append(buf, len);
+  } else {
+    auto start = out.size();
+    out.resize(start + len + 1);
+    vsnprintf(&out[start], len + 1, format, va_copy);
+    out.resize(start + len);
+  }
+  va_end(va_copy);
+}
+
 void redump(const char* format, ...) {
   va_list va;
   va_start(va, format);
-  vprintf(format, va);
+  vredump(format, va);
   va_end(va);
 }
 
 void redump(uint32_t off, const char* format, ...) {
   va_list va;
   va_start(va, format);
-  if (!clean) printf("[0x%x] ", off);
-  vprintf(format, va);
+  if (!clean) redump("[0x%x] ", off);
+  vredump(format, va);
   va_end(va);
 }
 
 void redump(uint32_t pos, uint32_t off, const char* format, ...) {
   va_list va;
   va_start(va, format);
-  if (!clean) printf("(0x%x) [0x%x] ", pos, off);
-  vprintf(format, va);
+  if (!clean) redump("(0x%x) [0x%x] ", pos, off);
+  vredump(format, va);
   va_end(va);
 }
@@ -9,12 +9,36 @@
 
 #pragma once
 
+#include <cstdarg>
 #include <stdint.h>
+#include <string>
 
 extern bool clean;
 extern bool raw;
 extern bool escape;
 
+void vredump(const char* format, va_list va);
 void redump(const char* format, ...);
 void redump(uint32_t off, const char* format, ...);
 void redump(uint32_t pos, uint32_t off, const char* format, ...);
+
+/**
+ * While a RedumpBuffer is alive, redump() calls made on its thread append to
+ * it instead of printing to stdout, so that dexes can be dumped in parallel
+ * and printed in order.
+ */
+class RedumpBuffer {
+ public:
+  RedumpBuffer();
+  ~RedumpBuffer();
+  RedumpBuffer(const RedumpBuffer&) = delete;
+  RedumpBuffer& operator=(const RedumpBuffer&) = delete;
+
+  const std::string& str() const { return m_buf; }
+
+ private:
+  friend void vredump(const char* format, va_list va);
+
+  std::string m_buf;
+  RedumpBuffer* m_prev;
+};
@@ -13,6 +13,14 @@
 #include <string.h>
 #include <getopt.h>
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "PrintUtil.h"
 #include "Formatters.h"
 
@@ -48,8 +56,84 @@ static const char ddump_usage_string[] =
     "--clean: suppress indices and offsets\n"
     "--no-headers: suppress headers\n"
     "--raw: print all bytes, even control characters\n"
+    "--json: print a json array with, for each dex, the lines of each\n"
+    "        selected section\n"
+    "-j, --jobs=<n>: dump up to <n> dexes in parallel (default: all cores)\n"
   ;
 
+namespace {
+
+// A section to print, along with the function that prints it.
+struct Section {
+  const char* name;
+  std::function<void(ddump_data*)> dump;
+};
+
+// The output of each selected section of a dex.
+struct DexDump {
+  std::string dexfile;
+  std::vector<std::pair<const char*, std::string>> sections;
+};
+
+DexDump dump_dex(const char* dexfile, const std::vector<Section>& sections) {
+  DexDump ret;
+  ret.dexfile = dexfile;
+  ddump_data rd;
+  open_dex_file(dexfile, &rd);
+  for (const auto& section : sections) {
+    RedumpBuffer buffer;
+    section.dump(&rd);
+    ret.sections.emplace_back(section.name, buffer.str());
+  }
+  return ret;
+}
+
+void print_json_string(const char* str, size_t len) {
+  putchar('"');
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (c < 0x20) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+// Prints a dex as a json object, with the output of each section split into
+// lines.
+void print_json(const DexDump& dump, bool last) {
+  printf("  {\"file\": ");
+  print_json_string(dump.dexfile.c_str(), dump.dexfile.size());
+  printf(", \"sections\": {");
+  for (size_t i = 0; i < dump.sections.size(); i++) {
+    const auto& text = dump.sections[i].second;
+    printf("%s\n    \"%s\": [", i == 0 ? "" : ",", dump.sections[i].first);
+    size_t begin = 0;
+    bool first = true;
+    while (begin < text.size()) {
+      auto end = text.find('\n', begin);
+      if (end == std::string::npos) {
+        end = text.size();
+      }
+      // Skip the blank lines that separate the sections of the text output.
+      if (end > begin) {
+        printf("%s\n      ", first ? "" : ",");
+        print_json_string(text.c_str() + begin, end - begin);
+        first = false;
+      }
+      begin = end + 1;
+    }
+    printf("]");
+  }
+  printf("}}%s\n", last ? "" : ",");
+}
+
+} // namespace
+
 int main(int argc, char* argv[]) {
 
   bool all = false;
@@ -67,6 +151,8 @@ int main(int argc, char* argv[]) {
   bool redexdump_debug = false;
   uint32_t ddebug_offset = 0;
   int no_headers = 0;
+  int json = 0;
+  unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
 
   char c;
   static const struct option options[] = {
@@ -88,6 +174,8 @@ int main(int argc, char* argv[]) {
     { "raw", no_argument, (int*)&raw, 1 },
     { "escape", no_argument, (int*)&escape, 1 },
     { "no-headers", no_argument, &no_headers, 1 },
+    { "json", no_argument, &json, 1 },
+    { "jobs", required_argument, nullptr, 'j' },
     { "help", no_argument, nullptr, 'h' },
     { nullptr, 0, nullptr, 0 },
   };
@@ -95,7 +183,7 @@ int main(int argc, char* argv[]) {
   while ((c = getopt_long(
             argc,
             argv,
-            "asStpfmcCxeAdDh",
+            "asStpfmcCxeAdD:hj:",
             &options[0],
             nullptr)) != -1) {
     switch (c) {
@@ -141,6 +229,9 @@ int main(int argc, char* argv[]) {
       case 'D':
         sscanf(optarg, "%x", &ddebug_offset);
         break;
+      case 'j':
+        jobs = std::max(1, atoi(optarg));
+        break;
       case 'h':
         puts(ddump_usage_string);
         return 0;
@@ -159,55 +250,99 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  while (optind < argc) {
-    const char* dexfile = argv[optind++];
-    ddump_data rd;
-    open_dex_file(dexfile, &rd);
-    if (!no_headers) {
-      redump(format_map(&rd).c_str());
-    }
-    if (string || all) {
-      dump_strings(&rd, !no_headers);
-    }
-    if (stringdata || all) {
-      dump_stringdata(&rd, !no_headers);
-    }
-    if (type || all) {
-      dump_types(&rd);
-    }
-    if (proto || all) {
-      dump_protos(&rd, !no_headers);
-    }
-    if (field || all) {
-      dump_fields(&rd, !no_headers);
-    }
-    if (meth || all) {
-      dump_methods(&rd, !no_headers);
-    }
-    if (clsdef || all) {
-      dump_clsdefs(&rd, !no_headers);
-    }
-    if (clsdata || all) {
-      dump_clsdata(&rd, !no_headers);
-    }
-    if (code || all) {
-      dump_code(&rd);
-    }
-    if (enarr || all) {
-      dump_enarr(&rd);
-    }
-    if (anno || all) {
-      dump_anno(&rd);
+  // Only the selected sections are decoded.
+  std::vector<Section> sections;
+  bool headers = !no_headers;
+  if (headers) {
+    sections.push_back({"map", [](ddump_data* rd) {
+                          redump(format_map(rd).c_str());
+                        }});
+  }
+  if (string || all) {
+    sections.push_back(
+        {"string", [=](ddump_data* rd) { dump_strings(rd, headers); }});
+  }
+  if (stringdata || all) {
+    sections.push_back({"stringdata", [=](ddump_data* rd) {
+                          dump_stringdata(rd, headers);
+                        }});
+  }
+  if (type || all) {
+    sections.push_back({"type", dump_types});
+  }
+  if (proto || all) {
+    sections.push_back(
+        {"proto", [=](ddump_data* rd) { dump_protos(rd, headers); }});
+  }
+  if (field || all) {
+    sections.push_back(
+        {"field", [=](ddump_data* rd) { dump_fields(rd, headers); }});
+  }
+  if (meth || all) {
+    sections.push_back(
+        {"meth", [=](ddump_data* rd) { dump_methods(rd, headers); }});
+  }
+  if (clsdef || all) {
+    sections.push_back(
+        {"clsdef", [=](ddump_data* rd) { dump_clsdefs(rd, headers); }});
+  }
+  if (clsdata || all) {
+    sections.push_back(
+        {"clsdata", [=](ddump_data* rd) { dump_clsdata(rd, headers); }});
+  }
+  if (code || all) {
+    sections.push_back({"code", dump_code});
+  }
+  if (enarr || all) {
+    sections.push_back({"enarr", dump_enarr});
+  }
+  if (anno || all) {
+    sections.push_back({"anno", dump_anno});
+  }
+  if (redexdump_debug || all) {
+    sections.push_back({"debug", dump_debug});
+  }
+  if (ddebug_offset != 0) {
+    sections.push_back({"ddebug", [=](ddump_data* rd) {
+                          disassemble_debug(rd, ddebug_offset);
+                        }});
+  }
+
+  // Each dex is dumped into its own buffers, and printed in order.
+  std::vector<const char*> dexfiles(argv + optind, argv + argc);
+  std::vector<DexDump> dumps(dexfiles.size());
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i = next++; i < dexfiles.size(); i = next++) {
+      dumps[i] = dump_dex(dexfiles[i], sections);
     }
-    if (redexdump_debug || all) {
-      dump_debug(&rd);
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min<size_t>(jobs, dexfiles.size()); i++) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (json) {
+    printf("[\n");
+  }
+  for (size_t i = 0; i < dumps.size(); i++) {
+    if (json) {
+      print_json(dumps[i], i + 1 == dumps.size());
+      continue;
     }
-    if (ddebug_offset != 0) {
-      disassemble_debug(&rd, ddebug_offset);
+    for (const auto& section : dumps[i].sections) {
+      fputs(section.second.c_str(), stdout);
     }
     fprintf(stdout, "\n");
     fflush(stdout);
   }
+  if (json) {
+    printf("]\n");
+  }
 
   return 0;
 }
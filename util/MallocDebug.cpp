@@ -24,23 +24,35 @@
  * very similarly, which can hide non determinisms caused by pointers. This
  * allocator is intended to make such non determinisms happen *every* time,
  * instead of only once in a while.
+ *
+ * It also samples where allocations come from: one in every MALLOC_SAMPLE_EVERY
+ * allocations (1024 by default, 0 turns sampling off) has its backtrace
+ * recorded, and PassManager reports the sites that allocated the most during
+ * each pass, see redex_malloc_take_sites(). With CMake, configure with
+ * -DREDEX_MALLOC_DEBUG=ON to link this file into redex-all.
  */
 
 #ifdef __APPLE__
 #include <dlfcn.h>
 #endif
+#include <execinfo.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <string>
 #include <map>
+#include <mutex>
 #include <vector>
 
 #include <thread>
 
 #include "Debug.h"
+#include "MallocSites.h"
 
 namespace {
 
@@ -160,10 +172,169 @@ class MallocDebug {
 
 thread_local MallocDebug malloc_debug;
 
+std::atomic<size_t> malloc_count{0};
+
+size_t sample_every() {
+  static const size_t every = [] {
+    const char* env = getenv("MALLOC_SAMPLE_EVERY");
+    return env != nullptr ? strtoul(env, nullptr, 10) : 1024;
+  }();
+  return every;
+}
+
+using SiteKey = std::array<void*, kMallocSiteFrames>;
+
+struct SiteTotals {
+  uint64_t count{0};
+  uint64_t bytes{0};
+};
+
+class SampleBuffer;
+
+// What the threads flushed, leaked so that it outlives every thread.
+struct Sites {
+  std::mutex lock;
+  std::vector<SampleBuffer*> buffers;
+  std::map<SiteKey, SiteTotals> totals;
+};
+
+Sites& sites() {
+  static auto sites = new Sites();
+  return *sites;
+}
+
+// Set while a thread records samples, whose own allocations aren't sampled.
+thread_local bool t_in_sampler = false;
+
+/*
+ * The samples of one thread, taken without touching the shared table until
+ * the buffer fills up or the sites are taken.
+ */
+class SampleBuffer {
+ public:
+  SampleBuffer() {
+    std::lock_guard<std::mutex> guard(sites().lock);
+    sites().buffers.push_back(this);
+  }
+
+  ~SampleBuffer() {
+    t_in_sampler = true;
+    auto& all = sites();
+    std::lock_guard<std::mutex> guard(all.lock);
+    flush_locked(all);
+    all.buffers.erase(
+        std::find(all.buffers.begin(), all.buffers.end(), this));
+  }
+
+  __attribute__((noinline)) void maybe_sample(size_t size) {
+    auto every = sample_every();
+    if (every == 0 || ++m_allocations < every) {
+      return;
+    }
+    m_allocations = 0;
+    // Skip this frame and the ones of sample() and malloc.
+    void* frames[kMallocSiteFrames + kSkippedFrames] = {};
+    int depth = backtrace(frames, kMallocSiteFrames + kSkippedFrames);
+    if (is_full()) {
+      auto& all = sites();
+      std::lock_guard<std::mutex> guard(all.lock);
+      flush_locked(all);
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto& sample = m_samples[m_num_samples++];
+    sample.key.fill(nullptr);
+    for (int i = kSkippedFrames; i < depth; ++i) {
+      sample.key[i - kSkippedFrames] = frames[i];
+    }
+    sample.size = size;
+  }
+
+  bool is_full() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_num_samples == kCapacity;
+  }
+
+  // Moves the samples into the shared table, whose lock is held.
+  void flush_locked(Sites& all) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto every = sample_every();
+    for (size_t i = 0; i < m_num_samples; ++i) {
+      auto& totals = all.totals[m_samples[i].key];
+      totals.count += every;
+      totals.bytes += every * m_samples[i].size;
+    }
+    m_num_samples = 0;
+  }
+
+ private:
+  static constexpr size_t kCapacity = 256;
+  static constexpr int kSkippedFrames = 3;
+
+  struct Sample {
+    SiteKey key;
+    size_t size;
+  };
+
+  size_t m_allocations{0};
+  std::mutex m_lock;
+  std::array<Sample, kCapacity> m_samples;
+  size_t m_num_samples{0};
+};
+
+__attribute__((noinline)) void sample(size_t size) {
+  // The buffer leaves t_in_sampler set once it's destroyed with its thread.
+  if (t_in_sampler) {
+    return;
+  }
+  t_in_sampler = true;
+  static thread_local SampleBuffer buffer;
+  buffer.maybe_sample(size);
+  t_in_sampler = false;
+}
+
 }
 
 extern "C" {
 
-void* malloc(size_t sz) { return malloc_debug.malloc(sz); }
+void* malloc(size_t sz) {
+  malloc_count.fetch_add(1, std::memory_order_relaxed);
+  sample(sz);
+  return malloc_debug.malloc(sz);
+}
+
+size_t redex_malloc_take_sites(RedexMallocSite* out, size_t max_sites) {
+  bool was_in_sampler = t_in_sampler;
+  t_in_sampler = true;
+  std::vector<std::pair<SiteKey, SiteTotals>> taken;
+  {
+    auto& all = sites();
+    std::lock_guard<std::mutex> guard(all.lock);
+    for (auto buffer : all.buffers) {
+      buffer->flush_locked(all);
+    }
+    taken.assign(all.totals.begin(), all.totals.end());
+    all.totals.clear();
+  }
+  size_t n = std::min(max_sites, taken.size());
+  std::partial_sort(taken.begin(),
+                    taken.begin() + n,
+                    taken.end(),
+                    [](const std::pair<SiteKey, SiteTotals>& a,
+                       const std::pair<SiteKey, SiteTotals>& b) {
+                      return a.second.bytes > b.second.bytes;
+                    });
+  for (size_t i = 0; i < n; ++i) {
+    std::copy(taken[i].first.begin(), taken[i].first.end(), out[i].frames);
+    out[i].count = taken[i].second.count;
+    out[i].bytes = taken[i].second.bytes;
+  }
+  t_in_sampler = was_in_sampler;
+  return n;
+}
+
+// Lets PassManager report the number of allocations each pass made.
+size_t redex_malloc_count() {
+  return malloc_count.load(std::memory_order_relaxed);
+}
 
 }
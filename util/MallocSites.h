@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// How many frames of the caller of malloc identify an allocation site.
+constexpr size_t kMallocSiteFrames = 8;
+
+/*
+ * An allocation site sampled by util/MallocDebug.cpp. The count and bytes are
+ * estimates: each sample stands for all the allocations between two samples.
+ */
+struct RedexMallocSite {
+  // Innermost first, and padded with nullptr when the stack is shallower.
+  void* frames[kMallocSiteFrames];
+  uint64_t count;
+  uint64_t bytes;
+};
+
+extern "C" {
+
+/*
+ * Moves the sites sampled since the last call into `sites`, the ones that
+ * allocated the most bytes first, and returns how many of the at most
+ * `max_sites` it wrote. The others are dropped.
+ */
+size_t redex_malloc_take_sites(RedexMallocSite* sites, size_t max_sites);
+}